@@ -0,0 +1,637 @@
+// Copyright 2011 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#if defined (__x86_64__) || defined (_M_X64) || defined (__i386__) || defined (_M_IX86)
+    #define THEKOGANS_CRYPTO_CPU_X86
+    #if defined (_MSC_VER)
+        #include <intrin.h>
+    #else // defined (_MSC_VER)
+        #include <x86intrin.h>
+    #endif // defined (_MSC_VER)
+#endif // defined (__x86_64__) || defined (_M_X64) || defined (__i386__) || defined (_M_IX86)
+#include <cstdio>
+#include <memory>
+#include <atomic>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <iostream>
+#include <openssl/evp.h>
+#include "thekogans/util/Types.h"
+#include "thekogans/util/CommandLineOptions.h"
+#include "thekogans/util/Exception.h"
+#include "thekogans/util/HRTimer.h"
+#include "thekogans/util/Thread.h"
+#include "thekogans/util/SystemInfo.h"
+#include "thekogans/util/RandomSource.h"
+#include "thekogans/util/StringUtils.h"
+#include "thekogans/crypto/OpenSSLInit.h"
+#include "thekogans/crypto/OpenSSLUtils.h"
+#include "thekogans/crypto/CPUFeatures.h"
+#include "thekogans/crypto/CipherSuite.h"
+#include "thekogans/crypto/SymmetricKey.h"
+#include "thekogans/crypto/Cipher.h"
+#include "thekogans/crypto/HMAC.h"
+#include "thekogans/crypto/CMAC.h"
+#include "thekogans/crypto/MessageDigest.h"
+
+using namespace thekogans;
+
+namespace {
+    // Return the time stamp counter on x86 (0 elsewhere). Used to
+    // report cycles/byte. NOTE: On modern x86 the TSC ticks at a
+    // constant (nominal) rate, so cycles/byte is only exact when
+    // turbo and frequency scaling are disabled.
+    inline util::ui64 ReadCycleCounter () {
+    #if defined (THEKOGANS_CRYPTO_CPU_X86)
+        return __rdtsc ();
+    #else // defined (THEKOGANS_CRYPTO_CPU_X86)
+        return 0;
+    #endif // defined (THEKOGANS_CRYPTO_CPU_X86)
+    }
+
+    // A single benchmarked operation. Every worker thread gets its
+    // own instance (Cipher, MAC and MessageDigest are not thread safe).
+    struct Operation {
+        std::vector<util::ui8> input;
+        std::vector<util::ui8> output;
+
+        explicit Operation (std::size_t length) :
+                input (length),
+                output (crypto::Cipher::GetMaxBufferLength (length)) {
+            util::GlobalRandomSource::Instance ().GetBytes (input.data (), input.size ());
+        }
+        virtual ~Operation () {}
+
+        virtual void Run () = 0;
+    };
+
+    struct EncryptOperation : public Operation {
+        crypto::Cipher cipher;
+
+        EncryptOperation (
+            crypto::SymmetricKey::SharedPtr key,
+            const EVP_CIPHER *cipher_,
+            const EVP_MD *md,
+            std::size_t length) :
+            Operation (length),
+            cipher (key, cipher_, md) {}
+
+        virtual void Run () override {
+            cipher.Encrypt (input.data (), input.size (), 0, 0, output.data ());
+        }
+    };
+
+    struct EncryptAndFrameOperation : public Operation {
+        crypto::Cipher cipher;
+
+        EncryptAndFrameOperation (
+            crypto::SymmetricKey::SharedPtr key,
+            const EVP_CIPHER *cipher_,
+            const EVP_MD *md,
+            std::size_t length) :
+            Operation (length),
+            cipher (key, cipher_, md) {}
+
+        virtual void Run () override {
+            cipher.EncryptAndFrame (input.data (), input.size (), 0, 0, output.data ());
+        }
+    };
+
+    struct DecryptOperation : public Operation {
+        crypto::Cipher cipher;
+        std::vector<util::ui8> ciphertext;
+
+        DecryptOperation (
+                crypto::SymmetricKey::SharedPtr key,
+                const EVP_CIPHER *cipher_,
+                const EVP_MD *md,
+                std::size_t length) :
+                Operation (length),
+                cipher (key, cipher_, md),
+                ciphertext (crypto::Cipher::GetMaxBufferLength (length)) {
+            ciphertext.resize (
+                cipher.Encrypt (input.data (), input.size (), 0, 0, ciphertext.data ()));
+        }
+
+        virtual void Run () override {
+            cipher.Decrypt (ciphertext.data (), ciphertext.size (), 0, 0, output.data ());
+        }
+    };
+
+    struct MACOperation : public Operation {
+        std::unique_ptr<crypto::MAC> mac;
+
+        MACOperation (
+            crypto::MAC *mac_,
+            std::size_t length) :
+            Operation (length),
+            mac (mac_) {}
+
+        virtual void Run () override {
+            mac->SignBuffer (input.data (), input.size (), output.data ());
+        }
+    };
+
+    struct HashOperation : public Operation {
+        crypto::MessageDigest messageDigest;
+
+        HashOperation (
+            const EVP_MD *md,
+            std::size_t length) :
+            Operation (length),
+            messageDigest (md) {}
+
+        virtual void Run () override {
+            messageDigest.Init ();
+            messageDigest.Update (input.data (), input.size ());
+            messageDigest.Final (output.data ());
+        }
+    };
+
+    typedef std::unique_ptr<Operation> (*OperationFactory) (
+        crypto::SymmetricKey::SharedPtr key,
+        const EVP_CIPHER *cipher,
+        const EVP_MD *md,
+        std::size_t length);
+
+    std::unique_ptr<Operation> CreateEncrypt (
+            crypto::SymmetricKey::SharedPtr key,
+            const EVP_CIPHER *cipher,
+            const EVP_MD *md,
+            std::size_t length) {
+        return std::unique_ptr<Operation> (new EncryptOperation (key, cipher, md, length));
+    }
+
+    std::unique_ptr<Operation> CreateEncryptAndFrame (
+            crypto::SymmetricKey::SharedPtr key,
+            const EVP_CIPHER *cipher,
+            const EVP_MD *md,
+            std::size_t length) {
+        return std::unique_ptr<Operation> (new EncryptAndFrameOperation (key, cipher, md, length));
+    }
+
+    std::unique_ptr<Operation> CreateDecrypt (
+            crypto::SymmetricKey::SharedPtr key,
+            const EVP_CIPHER *cipher,
+            const EVP_MD *md,
+            std::size_t length) {
+        return std::unique_ptr<Operation> (new DecryptOperation (key, cipher, md, length));
+    }
+
+    std::unique_ptr<Operation> CreateHMAC (
+            crypto::SymmetricKey::SharedPtr key,
+            const EVP_CIPHER * /*cipher*/,
+            const EVP_MD *md,
+            std::size_t length) {
+        return std::unique_ptr<Operation> (
+            new MACOperation (new crypto::HMAC (key, md), length));
+    }
+
+    std::unique_ptr<Operation> CreateCMAC (
+            crypto::SymmetricKey::SharedPtr key,
+            const EVP_CIPHER *cipher,
+            const EVP_MD * /*md*/,
+            std::size_t length) {
+        return std::unique_ptr<Operation> (
+            new MACOperation (new crypto::CMAC (key, cipher), length));
+    }
+
+    std::unique_ptr<Operation> CreateHash (
+            crypto::SymmetricKey::SharedPtr /*key*/,
+            const EVP_CIPHER * /*cipher*/,
+            const EVP_MD *md,
+            std::size_t length) {
+        return std::unique_ptr<Operation> (new HashOperation (md, length));
+    }
+
+    // Per thread latency samples are capped. Once the cap is reached
+    // every other sample is dropped and the sampling stride doubles,
+    // so the retained samples stay evenly spread over the run.
+    const std::size_t MAX_LATENCY_SAMPLES = 1 << 16;
+
+    struct Worker : public util::Thread {
+        Operation &operation;
+        const std::atomic<bool> &start;
+        util::f64 duration;
+        util::ui64 ops;
+        util::f64 seconds;
+        util::ui64 cycles;
+        std::vector<util::f64> samples;
+        std::string error;
+
+        Worker (
+            Operation &operation_,
+            const std::atomic<bool> &start_,
+            util::f64 duration_) :
+            operation (operation_),
+            start (start_),
+            duration (duration_),
+            ops (0),
+            seconds (0.0),
+            cycles (0) {}
+
+    protected:
+        // util::Thread
+        virtual void Run () throw () override {
+            THEKOGANS_UTIL_TRY {
+                while (!start) {
+                }
+                samples.reserve (MAX_LATENCY_SAMPLES);
+                util::ui64 stride = 1;
+                util::ui64 startCycles = ReadCycleCounter ();
+                util::ui64 startTime = util::HRTimer::Click ();
+                util::ui64 lastTime = startTime;
+                // Always run at least one operation (16MB buffers on
+                // slow ciphers can take longer than the duration).
+                do {
+                    operation.Run ();
+                    util::ui64 now = util::HRTimer::Click ();
+                    if (ops++ % stride == 0) {
+                        if (samples.size () == MAX_LATENCY_SAMPLES) {
+                            for (std::size_t i = 0, count = samples.size () / 2; i < count; ++i) {
+                                samples[i] = samples[i * 2];
+                            }
+                            samples.resize (samples.size () / 2);
+                            stride *= 2;
+                        }
+                        samples.push_back (
+                            util::HRTimer::ToSeconds (
+                                util::HRTimer::ComputeElapsedTime (lastTime, now)));
+                    }
+                    lastTime = now;
+                    seconds = util::HRTimer::ToSeconds (
+                        util::HRTimer::ComputeElapsedTime (startTime, now));
+                } while (seconds < duration);
+                cycles = ReadCycleCounter () - startCycles;
+            }
+            THEKOGANS_UTIL_CATCH (util::Exception) {
+                error = exception.Report ();
+            }
+        }
+    };
+
+    struct Result {
+        std::string operation;
+        std::string cipher;
+        std::string messageDigest;
+        std::size_t length;
+        std::size_t threads;
+        util::ui64 ops;
+        util::f64 seconds;
+        util::f64 opsPerSecond;
+        util::f64 mbPerSecond;
+        // < 0 == not available on this architecture.
+        util::f64 cyclesPerByte;
+        util::f64 p50;
+        util::f64 p99;
+    };
+
+    util::f64 GetPercentile (
+            const std::vector<util::f64> &samples,
+            util::f64 percentile) {
+        return samples.empty () ? 0.0 :
+            samples[(std::size_t)((samples.size () - 1) * percentile / 100.0)];
+    }
+
+    bool RunBenchmark (
+            const std::string &operationName,
+            OperationFactory factory,
+            crypto::SymmetricKey::SharedPtr key,
+            const std::string &cipherName,
+            const EVP_CIPHER *cipher,
+            const std::string &messageDigestName,
+            const EVP_MD *md,
+            std::size_t length,
+            std::size_t threads,
+            util::f64 duration,
+            Result &result) {
+        std::vector<std::unique_ptr<Operation>> operations;
+        for (std::size_t i = 0; i < threads; ++i) {
+            operations.push_back (factory (key, cipher, md, length));
+        }
+        std::atomic<bool> start (false);
+        std::vector<std::unique_ptr<Worker>> workers;
+        for (std::size_t i = 0; i < threads; ++i) {
+            workers.push_back (
+                std::unique_ptr<Worker> (new Worker (*operations[i], start, duration)));
+            workers.back ()->Create ();
+        }
+        start = true;
+        result.operation = operationName;
+        result.cipher = cipherName;
+        result.messageDigest = messageDigestName;
+        result.length = length;
+        result.threads = threads;
+        result.ops = 0;
+        result.seconds = 0.0;
+        util::ui64 cycles = 0;
+        std::vector<util::f64> samples;
+        bool success = true;
+        for (std::size_t i = 0; i < threads; ++i) {
+            workers[i]->Wait ();
+            if (!workers[i]->error.empty ()) {
+                std::cerr << operationName << " " << cipherName << " " <<
+                    messageDigestName << ": " << workers[i]->error << std::endl;
+                success = false;
+            }
+            result.ops += workers[i]->ops;
+            result.seconds = std::max (result.seconds, workers[i]->seconds);
+            cycles += workers[i]->cycles;
+            samples.insert (samples.end (),
+                workers[i]->samples.begin (), workers[i]->samples.end ());
+        }
+        if (success) {
+            std::sort (samples.begin (), samples.end ());
+            result.opsPerSecond = result.seconds > 0.0 ? result.ops / result.seconds : 0.0;
+            result.mbPerSecond = result.opsPerSecond * length / (1024.0 * 1024.0);
+            result.cyclesPerByte = cycles == 0 ? -1.0 : (util::f64)cycles / (result.ops * length);
+            result.p50 = GetPercentile (samples, 50.0);
+            result.p99 = GetPercentile (samples, 99.0);
+        }
+        return success;
+    }
+
+    std::string FormatNumber (util::f64 value) {
+        char buffer[64];
+        snprintf (buffer, sizeof (buffer), "%.3f", value);
+        return buffer;
+    }
+
+    void WriteCSVHeader () {
+        std::cout << "operation,cipher,digest,size,threads,ops,seconds,"
+            "ops_per_sec,mb_per_sec,cycles_per_byte,p50_us,p99_us" << std::endl;
+    }
+
+    void WriteCSV (const Result &result) {
+        std::cout <<
+            result.operation << "," <<
+            result.cipher << "," <<
+            result.messageDigest << "," <<
+            result.length << "," <<
+            result.threads << "," <<
+            result.ops << "," <<
+            FormatNumber (result.seconds) << "," <<
+            FormatNumber (result.opsPerSecond) << "," <<
+            FormatNumber (result.mbPerSecond) << "," <<
+            (result.cyclesPerByte < 0.0 ? std::string () : FormatNumber (result.cyclesPerByte)) << "," <<
+            FormatNumber (result.p50 * 1e6) << "," <<
+            FormatNumber (result.p99 * 1e6) << std::endl;
+    }
+
+    void WriteJSON (
+            const Result &result,
+            bool first) {
+        std::cout << (first ? "\n" : ",\n") <<
+            "    {\"operation\": \"" << result.operation << "\", " <<
+            "\"cipher\": \"" << result.cipher << "\", " <<
+            "\"digest\": \"" << result.messageDigest << "\", " <<
+            "\"size\": " << result.length << ", " <<
+            "\"threads\": " << result.threads << ", " <<
+            "\"ops\": " << result.ops << ", " <<
+            "\"seconds\": " << FormatNumber (result.seconds) << ", " <<
+            "\"ops_per_sec\": " << FormatNumber (result.opsPerSecond) << ", " <<
+            "\"mb_per_sec\": " << FormatNumber (result.mbPerSecond) << ", " <<
+            "\"cycles_per_byte\": " <<
+                (result.cyclesPerByte < 0.0 ? std::string ("null") : FormatNumber (result.cyclesPerByte)) << ", " <<
+            "\"p50_us\": " << FormatNumber (result.p50 * 1e6) << ", " <<
+            "\"p99_us\": " << FormatNumber (result.p99 * 1e6) << "}";
+        std::cout.flush ();
+    }
+
+    struct Benchmark {
+        std::string operation;
+        OperationFactory factory;
+        std::string cipherName;
+        const EVP_CIPHER *cipher;
+        std::string messageDigestName;
+        const EVP_MD *md;
+
+        Benchmark (
+            const std::string &operation_,
+            OperationFactory factory_,
+            const std::string &cipherName_,
+            const EVP_CIPHER *cipher_,
+            const std::string &messageDigestName_,
+            const EVP_MD *md_) :
+            operation (operation_),
+            factory (factory_),
+            cipherName (cipherName_),
+            cipher (cipher_),
+            messageDigestName (messageDigestName_),
+            md (md_) {}
+    };
+}
+
+int main (
+        int argc,
+        const char *argv[]) {
+    struct Options : public util::CommandLineOptions {
+        bool help;
+        std::string format;
+        util::ui32 duration;
+        util::ui32 maxThreads;
+        util::ui32 minSize;
+        util::ui32 maxSize;
+        std::string cipher;
+        std::string messageDigest;
+        std::string operation;
+
+        Options () :
+            help (false),
+            format ("csv"),
+            duration (100),
+            maxThreads (util::SystemInfo::Instance ().GetCPUCount ()),
+            minSize (16),
+            maxSize (16 * 1024 * 1024) {}
+
+        virtual void DoOption (
+                char option,
+                const std::string &value) {
+            switch (option) {
+                case 'h': {
+                    help = true;
+                    break;
+                }
+                case 'f': {
+                    format = value;
+                    break;
+                }
+                case 'd': {
+                    duration = util::stringToui32 (value.c_str ());
+                    break;
+                }
+                case 't': {
+                    maxThreads = util::stringToui32 (value.c_str ());
+                    break;
+                }
+                case 'n': {
+                    minSize = util::stringToui32 (value.c_str ());
+                    break;
+                }
+                case 'x': {
+                    maxSize = util::stringToui32 (value.c_str ());
+                    break;
+                }
+                case 'c': {
+                    cipher = value;
+                    break;
+                }
+                case 'm': {
+                    messageDigest = value;
+                    break;
+                }
+                case 'o': {
+                    operation = value;
+                    break;
+                }
+            }
+        }
+    } options;
+    options.Parse (argc, argv, "hfdtnxcmo");
+    if (options.help || (options.format != "csv" && options.format != "json") ||
+            options.maxThreads == 0 || options.minSize == 0 || options.minSize > options.maxSize) {
+        std::cout << "usage: " << argv[0] << " [-h] [-f:csv|json] "
+            "[-d:'milliseconds per case (default 100)'] "
+            "[-t:'max threads (default cpu count)'] "
+            "[-n:'min size (default 16)'] [-x:'max size (default 16MB)'] "
+            "[-c:cipher] [-m:digest] "
+            "[-o:Encrypt|EncryptAndFrame|Decrypt|HMAC|CMAC|Hash]" << std::endl;
+        return 1;
+    }
+    THEKOGANS_UTIL_TRY {
+        crypto::OpenSSLInit openSSLInit;
+        std::cerr << crypto::CPUFeatures::Instance ().architecture << ": " <<
+            crypto::CPUFeatures::Instance ().ToString () << std::endl;
+        // Sizes sweep from minSize to maxSize in powers of 4
+        // (16 B, 64 B, ... 16 MB by default).
+        std::vector<std::size_t> sizes;
+        for (std::size_t size = options.minSize; size <= options.maxSize; size *= 4) {
+            sizes.push_back (size);
+        }
+        // Thread counts sweep from 1 to maxThreads in powers of 2
+        // (always including maxThreads).
+        std::vector<std::size_t> threads;
+        for (std::size_t count = 1; count < options.maxThreads; count *= 2) {
+            threads.push_back (count);
+        }
+        threads.push_back (options.maxThreads);
+        const std::vector<std::string> &ciphers = crypto::CipherSuite::GetCiphers ();
+        const std::vector<std::string> &messageDigests = crypto::CipherSuite::GetMessageDigests ();
+        std::vector<Benchmark> benchmarks;
+        for (std::size_t i = 0, count = ciphers.size (); i < count; ++i) {
+            if (!options.cipher.empty () && options.cipher != ciphers[i]) {
+                continue;
+            }
+            const EVP_CIPHER *cipher = crypto::CipherSuite::GetOpenSSLCipherByName (ciphers[i]);
+            // AEAD ciphers don't use the message digest, so they're
+            // only measured once.
+            if (crypto::IsCipherAEAD (cipher)) {
+                benchmarks.push_back (Benchmark ("Encrypt", CreateEncrypt,
+                    ciphers[i], cipher, "AEAD", THEKOGANS_CRYPTO_DEFAULT_MD));
+                benchmarks.push_back (Benchmark ("EncryptAndFrame", CreateEncryptAndFrame,
+                    ciphers[i], cipher, "AEAD", THEKOGANS_CRYPTO_DEFAULT_MD));
+                benchmarks.push_back (Benchmark ("Decrypt", CreateDecrypt,
+                    ciphers[i], cipher, "AEAD", THEKOGANS_CRYPTO_DEFAULT_MD));
+            }
+            else {
+                for (std::size_t j = 0, count = messageDigests.size (); j < count; ++j) {
+                    if (!options.messageDigest.empty () && options.messageDigest != messageDigests[j]) {
+                        continue;
+                    }
+                    const EVP_MD *md =
+                        crypto::CipherSuite::GetOpenSSLMessageDigestByName (messageDigests[j]);
+                    benchmarks.push_back (Benchmark ("Encrypt", CreateEncrypt,
+                        ciphers[i], cipher, messageDigests[j], md));
+                    benchmarks.push_back (Benchmark ("EncryptAndFrame", CreateEncryptAndFrame,
+                        ciphers[i], cipher, messageDigests[j], md));
+                    benchmarks.push_back (Benchmark ("Decrypt", CreateDecrypt,
+                        ciphers[i], cipher, messageDigests[j], md));
+                }
+            }
+            // CMAC is only defined for block ciphers in CBC mode.
+            if (crypto::GetCipherMode (cipher) == EVP_CIPH_CBC_MODE) {
+                benchmarks.push_back (Benchmark ("CMAC", CreateCMAC,
+                    ciphers[i], cipher, "-", 0));
+            }
+        }
+        for (std::size_t i = 0, count = messageDigests.size (); i < count; ++i) {
+            if (!options.messageDigest.empty () && options.messageDigest != messageDigests[i]) {
+                continue;
+            }
+            const EVP_MD *md = crypto::CipherSuite::GetOpenSSLMessageDigestByName (messageDigests[i]);
+            benchmarks.push_back (Benchmark ("HMAC", CreateHMAC,
+                "-", THEKOGANS_CRYPTO_DEFAULT_CIPHER, messageDigests[i], md));
+            benchmarks.push_back (Benchmark ("Hash", CreateHash,
+                "-", THEKOGANS_CRYPTO_DEFAULT_CIPHER, messageDigests[i], md));
+        }
+        bool json = options.format == "json";
+        if (json) {
+            std::cout << "{\"architecture\": \"" << crypto::CPUFeatures::Instance ().architecture <<
+                "\", \"cpu_features\": \"" << crypto::CPUFeatures::Instance ().ToString () <<
+                "\", \"results\": [";
+        }
+        else {
+            WriteCSVHeader ();
+        }
+        bool first = true;
+        for (std::size_t i = 0, count = benchmarks.size (); i < count; ++i) {
+            const Benchmark &benchmark = benchmarks[i];
+            if (!options.operation.empty () && options.operation != benchmark.operation) {
+                continue;
+            }
+            crypto::SymmetricKey::SharedPtr key = crypto::SymmetricKey::FromRandom (
+                crypto::SymmetricKey::MIN_RANDOM_LENGTH,
+                0,
+                0,
+                crypto::GetCipherKeyLength (benchmark.cipher));
+            for (std::size_t j = 0, sizeCount = sizes.size (); j < sizeCount; ++j) {
+                for (std::size_t k = 0, threadCount = threads.size (); k < threadCount; ++k) {
+                    Result result;
+                    if (RunBenchmark (
+                            benchmark.operation,
+                            benchmark.factory,
+                            key,
+                            benchmark.cipherName,
+                            benchmark.cipher,
+                            benchmark.messageDigestName,
+                            benchmark.md,
+                            sizes[j],
+                            threads[k],
+                            options.duration / 1000.0,
+                            result)) {
+                        if (json) {
+                            WriteJSON (result, first);
+                            first = false;
+                        }
+                        else {
+                            WriteCSV (result);
+                        }
+                    }
+                }
+            }
+        }
+        if (json) {
+            std::cout << "\n]}" << std::endl;
+        }
+    }
+    THEKOGANS_UTIL_CATCH (util::Exception) {
+        std::cerr << exception.Report () << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,690 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#include <cstdio>
+#include <memory>
+#include <atomic>
+#include <functional>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <iostream>
+#include <openssl/obj_mac.h>
+#include "thekogans/util/Types.h"
+#include "thekogans/util/CommandLineOptions.h"
+#include "thekogans/util/Exception.h"
+#include "thekogans/util/HRTimer.h"
+#include "thekogans/util/Thread.h"
+#include "thekogans/util/SystemInfo.h"
+#include "thekogans/util/RandomSource.h"
+#include "thekogans/util/StringUtils.h"
+#include "thekogans/crypto/OpenSSLInit.h"
+#include "thekogans/crypto/OpenSSLUtils.h"
+#include "thekogans/crypto/CPUFeatures.h"
+#include "thekogans/crypto/ID.h"
+#include "thekogans/crypto/Params.h"
+#include "thekogans/crypto/AsymmetricKey.h"
+#include "thekogans/crypto/SymmetricKey.h"
+#include "thekogans/crypto/CipherSuite.h"
+#include "thekogans/crypto/Cipher.h"
+#include "thekogans/crypto/Authenticator.h"
+#include "thekogans/crypto/EC.h"
+#include "thekogans/crypto/DH.h"
+#include "thekogans/crypto/RSA.h"
+#include "thekogans/crypto/DHEKeyExchange.h"
+#include "thekogans/crypto/RSAKeyExchange.h"
+
+using namespace thekogans;
+
+namespace {
+    // Unlike cipherbench and pkbench (which measure the raw primitives),
+    // cryptospeed measures the library's own APIs for one cipher suite:
+    // CiphertextHeader, framing, MAC derivation and util::Buffer overhead
+    // included. Every worker thread gets its own operation (Cipher,
+    // Authenticator and KeyExchange are not thread safe).
+    typedef std::function<void ()> Operation;
+    typedef std::function<Operation (std::size_t /*length*/)> OperationFactory;
+
+    // Key lengths used for the non EC authenticators and RSA key exchange.
+    const std::size_t RSA_KEY_LENGTH = 2048;
+    const std::size_t DSA_KEY_LENGTH = 2048;
+    // Length of the secret fed to the KDFs.
+    const std::size_t KDF_SECRET_LENGTH = 32;
+    // PBKDF2 iteration count.
+    const std::size_t PBKDF2_COUNT = 1000;
+
+    std::shared_ptr<std::vector<util::ui8>> CreateRandomBuffer (std::size_t length) {
+        std::shared_ptr<std::vector<util::ui8>> buffer (new std::vector<util::ui8> (length));
+        util::GlobalRandomSource::Instance ().GetBytes (buffer->data (), buffer->size ());
+        return buffer;
+    }
+
+    Operation CreateEncrypt (
+            const crypto::CipherSuite &cipherSuite,
+            crypto::SymmetricKey::SharedPtr key,
+            std::size_t length) {
+        crypto::Cipher::SharedPtr cipher = cipherSuite.GetCipher (key);
+        std::shared_ptr<std::vector<util::ui8>> plaintext = CreateRandomBuffer (length);
+        std::shared_ptr<std::vector<util::ui8>> ciphertext (
+            new std::vector<util::ui8> (crypto::Cipher::GetMaxBufferLength (length)));
+        return [cipher, plaintext, ciphertext] () {
+            cipher->Encrypt (plaintext->data (), plaintext->size (), 0, 0, ciphertext->data ());
+        };
+    }
+
+    Operation CreateEncryptAndFrame (
+            const crypto::CipherSuite &cipherSuite,
+            crypto::SymmetricKey::SharedPtr key,
+            std::size_t length) {
+        crypto::Cipher::SharedPtr cipher = cipherSuite.GetCipher (key);
+        std::shared_ptr<std::vector<util::ui8>> plaintext = CreateRandomBuffer (length);
+        std::shared_ptr<std::vector<util::ui8>> ciphertext (
+            new std::vector<util::ui8> (crypto::Cipher::GetMaxBufferLength (length)));
+        return [cipher, plaintext, ciphertext] () {
+            cipher->EncryptAndFrame (plaintext->data (), plaintext->size (), 0, 0, ciphertext->data ());
+        };
+    }
+
+    Operation CreateDecrypt (
+            const crypto::CipherSuite &cipherSuite,
+            crypto::SymmetricKey::SharedPtr key,
+            std::size_t length) {
+        crypto::Cipher::SharedPtr cipher = cipherSuite.GetCipher (key);
+        std::shared_ptr<std::vector<util::ui8>> plaintext = CreateRandomBuffer (length);
+        std::shared_ptr<std::vector<util::ui8>> ciphertext (
+            new std::vector<util::ui8> (crypto::Cipher::GetMaxBufferLength (length)));
+        ciphertext->resize (
+            cipher->Encrypt (plaintext->data (), plaintext->size (), 0, 0, ciphertext->data ()));
+        return [cipher, plaintext, ciphertext] () {
+            cipher->Decrypt (ciphertext->data (), ciphertext->size (), 0, 0, plaintext->data ());
+        };
+    }
+
+    Operation CreateSign (
+            const crypto::CipherSuite &cipherSuite,
+            crypto::AsymmetricKey::SharedPtr privateKey,
+            std::size_t length) {
+        crypto::Authenticator::SharedPtr authenticator = cipherSuite.GetAuthenticator (privateKey);
+        std::shared_ptr<std::vector<util::ui8>> message = CreateRandomBuffer (length);
+        return [authenticator, message] () {
+            authenticator->SignBuffer (message->data (), message->size ());
+        };
+    }
+
+    Operation CreateVerify (
+            const crypto::CipherSuite &cipherSuite,
+            crypto::AsymmetricKey::SharedPtr privateKey,
+            std::size_t length) {
+        std::shared_ptr<std::vector<util::ui8>> message = CreateRandomBuffer (length);
+        std::shared_ptr<util::Buffer> signature (
+            new util::Buffer (
+                cipherSuite.GetAuthenticator (privateKey)->SignBuffer (
+                    message->data (), message->size ())));
+        crypto::Authenticator::SharedPtr authenticator =
+            cipherSuite.GetAuthenticator (privateKey->GetPublicKey ());
+        return [authenticator, message, signature] () {
+            if (!authenticator->VerifyBufferSignature (
+                    message->data (),
+                    message->size (),
+                    signature->GetReadPtr (),
+                    signature->GetDataAvailableForReading ())) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION ("%s", "Signature verification failed.");
+            }
+        };
+    }
+
+    // One complete exchange: both peers' GetParams and
+    // DeriveSharedSymmetricKey (two ephemeral keys and two derivations).
+    Operation CreateDHE (
+            const crypto::CipherSuite &cipherSuite,
+            crypto::Params::SharedPtr params) {
+        return [cipherSuite, params] () {
+            crypto::KeyExchange::SharedPtr initiator =
+                cipherSuite.GetDHEKeyExchange (crypto::ID (), params);
+            crypto::KeyExchange::Params::SharedPtr initiatorParams = initiator->GetParams ();
+            crypto::DHEKeyExchange responder (initiatorParams);
+            crypto::KeyExchange::Params::SharedPtr responderParams = responder.GetParams ();
+            initiator->DeriveSharedSymmetricKey (responderParams);
+            responder.DeriveSharedSymmetricKey (initiatorParams);
+        };
+    }
+
+    // One complete exchange: the initiator encrypts a secret with the
+    // public key, the responder decrypts it with the private key.
+    Operation CreateRSAKeyExchange (
+            const crypto::CipherSuite &cipherSuite,
+            crypto::AsymmetricKey::SharedPtr privateKey) {
+        crypto::AsymmetricKey::SharedPtr publicKey = privateKey->GetPublicKey ();
+        return [cipherSuite, privateKey, publicKey] () {
+            crypto::KeyExchange::SharedPtr initiator =
+                cipherSuite.GetRSAKeyExchange (crypto::ID (), publicKey);
+            crypto::KeyExchange::Params::SharedPtr initiatorParams = initiator->GetParams ();
+            crypto::RSAKeyExchange responder (privateKey, initiatorParams);
+            crypto::KeyExchange::Params::SharedPtr responderParams = responder.GetParams ();
+            initiator->DeriveSharedSymmetricKey (responderParams);
+            responder.DeriveSharedSymmetricKey (initiatorParams);
+        };
+    }
+
+    Operation CreateHKDF (const crypto::CipherSuite &cipherSuite) {
+        std::shared_ptr<std::vector<util::ui8>> secret = CreateRandomBuffer (KDF_SECRET_LENGTH);
+        std::shared_ptr<std::vector<util::ui8>> salt = CreateRandomBuffer (KDF_SECRET_LENGTH);
+        const EVP_MD *md = cipherSuite.GetOpenSSLMessageDigest ();
+        std::size_t keyLength = crypto::GetCipherKeyLength (cipherSuite.GetOpenSSLCipher ());
+        return [secret, salt, md, keyLength] () {
+            crypto::SymmetricKey::FromHKDF (
+                secret->data (),
+                secret->size (),
+                salt->data (),
+                salt->size (),
+                0,
+                0,
+                keyLength,
+                crypto::SymmetricKey::HKDF_MODE_EXTRACT_AND_EXPAND,
+                md,
+                crypto::ID::Empty);
+        };
+    }
+
+    Operation CreatePBKDF2 (const crypto::CipherSuite &cipherSuite) {
+        std::shared_ptr<std::vector<util::ui8>> secret = CreateRandomBuffer (KDF_SECRET_LENGTH);
+        std::shared_ptr<std::vector<util::ui8>> salt = CreateRandomBuffer (KDF_SECRET_LENGTH);
+        std::size_t keyLength = crypto::GetCipherKeyLength (cipherSuite.GetOpenSSLCipher ());
+        return [secret, salt, keyLength] () {
+            crypto::SymmetricKey::FromPBKDF2 (
+                secret->data (),
+                secret->size (),
+                salt->data (),
+                salt->size (),
+                keyLength,
+                crypto::SymmetricKey::PBKDF2_HMAC_SHA256,
+                PBKDF2_COUNT,
+                crypto::ID::Empty);
+        };
+    }
+
+    Operation CreateSecretAndSalt (const crypto::CipherSuite &cipherSuite) {
+        std::shared_ptr<std::vector<util::ui8>> secret = CreateRandomBuffer (KDF_SECRET_LENGTH);
+        std::shared_ptr<std::vector<util::ui8>> salt = CreateRandomBuffer (KDF_SECRET_LENGTH);
+        const EVP_MD *md = cipherSuite.GetOpenSSLMessageDigest ();
+        std::size_t keyLength = crypto::GetCipherKeyLength (cipherSuite.GetOpenSSLCipher ());
+        return [secret, salt, md, keyLength] () {
+            crypto::SymmetricKey::FromSecretAndSalt (
+                secret->data (),
+                secret->size (),
+                salt->data (),
+                salt->size (),
+                keyLength,
+                md,
+                1,
+                crypto::ID::Empty);
+        };
+    }
+
+    // Per thread latency samples are capped. Once the cap is reached
+    // every other sample is dropped and the sampling stride doubles,
+    // so the retained samples stay evenly spread over the run.
+    const std::size_t MAX_LATENCY_SAMPLES = 1 << 16;
+
+    struct Worker : public util::Thread {
+        Operation operation;
+        const std::atomic<bool> &start;
+        util::f64 duration;
+        util::ui64 ops;
+        util::f64 seconds;
+        std::vector<util::f64> samples;
+        std::string error;
+
+        Worker (
+            const Operation &operation_,
+            const std::atomic<bool> &start_,
+            util::f64 duration_) :
+            operation (operation_),
+            start (start_),
+            duration (duration_),
+            ops (0),
+            seconds (0.0) {}
+
+    protected:
+        // util::Thread
+        virtual void Run () throw () override {
+            THEKOGANS_UTIL_TRY {
+                while (!start) {
+                }
+                samples.reserve (MAX_LATENCY_SAMPLES);
+                util::ui64 stride = 1;
+                util::ui64 startTime = util::HRTimer::Click ();
+                util::ui64 lastTime = startTime;
+                // Always run at least one operation (PBKDF2 and RSA
+                // can take longer than a short duration).
+                do {
+                    operation ();
+                    util::ui64 now = util::HRTimer::Click ();
+                    if (ops++ % stride == 0) {
+                        if (samples.size () == MAX_LATENCY_SAMPLES) {
+                            for (std::size_t i = 0, count = samples.size () / 2; i < count; ++i) {
+                                samples[i] = samples[i * 2];
+                            }
+                            samples.resize (samples.size () / 2);
+                            stride *= 2;
+                        }
+                        samples.push_back (
+                            util::HRTimer::ToSeconds (
+                                util::HRTimer::ComputeElapsedTime (lastTime, now)));
+                    }
+                    lastTime = now;
+                    seconds = util::HRTimer::ToSeconds (
+                        util::HRTimer::ComputeElapsedTime (startTime, now));
+                } while (seconds < duration);
+            }
+            THEKOGANS_UTIL_CATCH (util::Exception) {
+                error = exception.Report ();
+            }
+        }
+    };
+
+    struct Result {
+        std::string operation;
+        std::string algorithm;
+        std::size_t length;
+        std::size_t threads;
+        util::ui64 ops;
+        util::f64 seconds;
+        util::f64 opsPerSecond;
+        util::f64 mbPerSecond;
+        util::f64 p50;
+        util::f64 p99;
+    };
+
+    util::f64 GetPercentile (
+            const std::vector<util::f64> &samples,
+            util::f64 percentile) {
+        return samples.empty () ? 0.0 :
+            samples[(std::size_t)((samples.size () - 1) * percentile / 100.0)];
+    }
+
+    struct Benchmark {
+        std::string operation;
+        std::string algorithm;
+        // false == the operation doesn't take a buffer (KeyExchange, KDF)
+        // and is run once per thread count instead of once per size.
+        bool sized;
+        OperationFactory factory;
+
+        Benchmark (
+            const std::string &operation_,
+            const std::string &algorithm_,
+            bool sized_,
+            const OperationFactory &factory_) :
+            operation (operation_),
+            algorithm (algorithm_),
+            sized (sized_),
+            factory (factory_) {}
+    };
+
+    bool RunBenchmark (
+            const Benchmark &benchmark,
+            std::size_t length,
+            std::size_t threads,
+            util::f64 duration,
+            Result &result) {
+        result.operation = benchmark.operation;
+        result.algorithm = benchmark.algorithm;
+        result.length = length;
+        result.threads = threads;
+        result.ops = 0;
+        result.seconds = 0.0;
+        std::atomic<bool> start (false);
+        std::vector<std::unique_ptr<Worker>> workers;
+        THEKOGANS_UTIL_TRY {
+            for (std::size_t i = 0; i < threads; ++i) {
+                workers.push_back (
+                    std::unique_ptr<Worker> (
+                        new Worker (benchmark.factory (length), start, duration)));
+            }
+        }
+        THEKOGANS_UTIL_CATCH (util::Exception) {
+            std::cerr << benchmark.operation << " " << benchmark.algorithm << ": " <<
+                exception.Report () << std::endl;
+            return false;
+        }
+        for (std::size_t i = 0; i < threads; ++i) {
+            workers[i]->Create ();
+        }
+        start = true;
+        std::vector<util::f64> samples;
+        bool success = true;
+        for (std::size_t i = 0; i < threads; ++i) {
+            workers[i]->Wait ();
+            if (!workers[i]->error.empty ()) {
+                std::cerr << benchmark.operation << " " << benchmark.algorithm << ": " <<
+                    workers[i]->error << std::endl;
+                success = false;
+            }
+            result.ops += workers[i]->ops;
+            result.seconds = std::max (result.seconds, workers[i]->seconds);
+            samples.insert (samples.end (),
+                workers[i]->samples.begin (), workers[i]->samples.end ());
+        }
+        if (success) {
+            std::sort (samples.begin (), samples.end ());
+            result.opsPerSecond = result.seconds > 0.0 ? result.ops / result.seconds : 0.0;
+            result.mbPerSecond = result.opsPerSecond * length / (1024.0 * 1024.0);
+            result.p50 = GetPercentile (samples, 50.0);
+            result.p99 = GetPercentile (samples, 99.0);
+        }
+        return success;
+    }
+
+    std::string FormatNumber (util::f64 value) {
+        char buffer[64];
+        snprintf (buffer, sizeof (buffer), "%.3f", value);
+        return buffer;
+    }
+
+    void WriteTableHeader () {
+        printf ("%-16s %-24s %10s %8s %14s %12s %12s %12s\n",
+            "operation", "algorithm", "size", "threads",
+            "ops/sec", "MB/sec", "p50 (us)", "p99 (us)");
+    }
+
+    void WriteTable (const Result &result) {
+        printf ("%-16s %-24s %10s %8u %14.1f %12s %12.3f %12.3f\n",
+            result.operation.c_str (),
+            result.algorithm.c_str (),
+            result.length > 0 ? util::size_tTostring (result.length).c_str () : "-",
+            (util::ui32)result.threads,
+            result.opsPerSecond,
+            result.length > 0 ? FormatNumber (result.mbPerSecond).c_str () : "-",
+            result.p50 * 1e6,
+            result.p99 * 1e6);
+        fflush (stdout);
+    }
+
+    void WriteJSON (
+            const Result &result,
+            bool first) {
+        std::cout << (first ? "\n" : ",\n") <<
+            "    {\"operation\": \"" << result.operation << "\", " <<
+            "\"algorithm\": \"" << result.algorithm << "\", " <<
+            "\"size\": " << result.length << ", " <<
+            "\"threads\": " << result.threads << ", " <<
+            "\"ops\": " << result.ops << ", " <<
+            "\"seconds\": " << FormatNumber (result.seconds) << ", " <<
+            "\"ops_per_sec\": " << FormatNumber (result.opsPerSecond) << ", " <<
+            "\"mb_per_sec\": " << FormatNumber (result.mbPerSecond) << ", " <<
+            "\"p50_us\": " << FormatNumber (result.p50 * 1e6) << ", " <<
+            "\"p99_us\": " << FormatNumber (result.p99 * 1e6) << "}";
+        std::cout.flush ();
+    }
+
+    // Keys and params are created once, up front, and shared by all
+    // worker threads (they're immutable once created).
+    void AddBenchmarks (
+            const crypto::CipherSuite &cipherSuite,
+            std::vector<Benchmark> &benchmarks) {
+        // Cipher
+        {
+            crypto::SymmetricKey::SharedPtr key = crypto::SymmetricKey::FromRandom (
+                crypto::SymmetricKey::MIN_RANDOM_LENGTH,
+                0,
+                0,
+                crypto::GetCipherKeyLength (cipherSuite.GetOpenSSLCipher ()));
+            std::string name = cipherSuite.cipher + "_" + cipherSuite.messageDigest;
+            benchmarks.push_back (Benchmark ("Encrypt", name, true,
+                [cipherSuite, key] (std::size_t length) {
+                    return CreateEncrypt (cipherSuite, key, length);
+                }));
+            benchmarks.push_back (Benchmark ("EncryptAndFrame", name, true,
+                [cipherSuite, key] (std::size_t length) {
+                    return CreateEncryptAndFrame (cipherSuite, key, length);
+                }));
+            benchmarks.push_back (Benchmark ("Decrypt", name, true,
+                [cipherSuite, key] (std::size_t length) {
+                    return CreateDecrypt (cipherSuite, key, length);
+                }));
+        }
+        // Authenticator
+        {
+            crypto::AsymmetricKey::SharedPtr key;
+            std::string name = cipherSuite.authenticator;
+            if (cipherSuite.authenticator == crypto::CipherSuite::AUTHENTICATOR_ECDSA) {
+                key = crypto::EC::ParamsFromNamedCurve (NID_X9_62_prime256v1)->CreateKey ();
+                name += "-P-256";
+            }
+            else if (cipherSuite.authenticator == crypto::CipherSuite::AUTHENTICATOR_Ed25519) {
+                key = crypto::EC::ParamsFromEd25519Curve ()->CreateKey ();
+            }
+            else if (cipherSuite.authenticator == crypto::CipherSuite::AUTHENTICATOR_DSA) {
+                key = cipherSuite.CreateAuthenticatorKey (DSA_KEY_LENGTH);
+                name += "-" + util::size_tTostring (DSA_KEY_LENGTH);
+            }
+            else {
+                key = cipherSuite.CreateAuthenticatorKey (RSA_KEY_LENGTH);
+                name += "-" + util::size_tTostring (RSA_KEY_LENGTH);
+            }
+            benchmarks.push_back (Benchmark ("Sign", name, true,
+                [cipherSuite, key] (std::size_t length) {
+                    return CreateSign (cipherSuite, key, length);
+                }));
+            benchmarks.push_back (Benchmark ("Verify", name, true,
+                [cipherSuite, key] (std::size_t length) {
+                    return CreateVerify (cipherSuite, key, length);
+                }));
+        }
+        // KeyExchange
+        if (cipherSuite.keyExchange == crypto::CipherSuite::KEY_EXCHANGE_RSA) {
+            crypto::AsymmetricKey::SharedPtr key = crypto::RSA::CreateKey (RSA_KEY_LENGTH);
+            benchmarks.push_back (Benchmark ("KeyExchange",
+                cipherSuite.keyExchange + "-" + util::size_tTostring (RSA_KEY_LENGTH), false,
+                [cipherSuite, key] (std::size_t /*length*/) {
+                    return CreateRSAKeyExchange (cipherSuite, key);
+                }));
+        }
+        else {
+            // ECDHE defaults to X25519, DHE has no default group.
+            crypto::Params::SharedPtr params;
+            std::string name = cipherSuite.keyExchange;
+            if (cipherSuite.keyExchange == crypto::CipherSuite::KEY_EXCHANGE_DHE) {
+                params = crypto::DH::ParamsFromRFC3526Prime (crypto::DH::RFC3526_PRIME_2048);
+                name += "-RFC3526-2048";
+            }
+            else {
+                name += "-X25519";
+            }
+            benchmarks.push_back (Benchmark ("KeyExchange", name, false,
+                [cipherSuite, params] (std::size_t /*length*/) {
+                    return CreateDHE (cipherSuite, params);
+                }));
+        }
+        // KDF
+        benchmarks.push_back (Benchmark ("KDF", "HKDF-" + cipherSuite.messageDigest, false,
+            [cipherSuite] (std::size_t /*length*/) {
+                return CreateHKDF (cipherSuite);
+            }));
+        benchmarks.push_back (Benchmark ("KDF",
+            "PBKDF2-SHA256-" + util::size_tTostring (PBKDF2_COUNT), false,
+            [cipherSuite] (std::size_t /*length*/) {
+                return CreatePBKDF2 (cipherSuite);
+            }));
+        benchmarks.push_back (Benchmark ("KDF", "SecretAndSalt-" + cipherSuite.messageDigest, false,
+            [cipherSuite] (std::size_t /*length*/) {
+                return CreateSecretAndSalt (cipherSuite);
+            }));
+    }
+
+    // Parse a comma separated list of sizes.
+    bool ParseSizes (
+            const std::string &value,
+            std::vector<std::size_t> &sizes) {
+        sizes.clear ();
+        std::string::size_type begin = 0;
+        while (begin <= value.size ()) {
+            std::string::size_type end = value.find (',', begin);
+            if (end == std::string::npos) {
+                end = value.size ();
+            }
+            std::size_t size = util::stringToui32 (value.substr (begin, end - begin).c_str ());
+            if (size == 0) {
+                return false;
+            }
+            sizes.push_back (size);
+            begin = end + 1;
+        }
+        return !sizes.empty ();
+    }
+
+    std::string GetCipherSuites () {
+        std::string cipherSuites_;
+        const std::vector<crypto::CipherSuite> &cipherSuites =
+            crypto::CipherSuite::GetCipherSuites ();
+        if (!cipherSuites.empty ()) {
+            cipherSuites_ = cipherSuites[0].ToString ();
+            for (std::size_t i = 1, count = cipherSuites.size (); i < count; ++i) {
+                cipherSuites_ += " | " + cipherSuites[i].ToString ();
+            }
+        }
+        return cipherSuites_;
+    }
+}
+
+int main (
+        int argc,
+        const char *argv[]) {
+    struct Options : public util::CommandLineOptions {
+        bool help;
+        std::string cipherSuite;
+        std::string format;
+        util::ui32 duration;
+        util::ui32 maxThreads;
+        std::string sizes;
+        std::string operation;
+
+        Options () :
+            help (false),
+            cipherSuite (crypto::CipherSuite::Strongest.ToString ()),
+            format ("table"),
+            duration (1000),
+            maxThreads (util::SystemInfo::Instance ().GetCPUCount ()),
+            sizes ("16,256,1024,8192,16384") {}
+
+        virtual void DoOption (
+                char option,
+                const std::string &value) {
+            switch (option) {
+                case 'h': {
+                    help = true;
+                    break;
+                }
+                case 'c': {
+                    cipherSuite = value;
+                    break;
+                }
+                case 'f': {
+                    format = value;
+                    break;
+                }
+                case 'd': {
+                    duration = util::stringToui32 (value.c_str ());
+                    break;
+                }
+                case 't': {
+                    maxThreads = util::stringToui32 (value.c_str ());
+                    break;
+                }
+                case 's': {
+                    sizes = value;
+                    break;
+                }
+                case 'o': {
+                    operation = value;
+                    break;
+                }
+            }
+        }
+    } options;
+    options.Parse (argc, argv, "hcfdtso");
+    std::vector<std::size_t> sizes;
+    if (options.help || (options.format != "table" && options.format != "json") ||
+            options.maxThreads == 0 || !ParseSizes (options.sizes, sizes)) {
+        std::cout << "usage: " << argv[0] << " [-h] [-c:'" << GetCipherSuites () << "'] "
+            "[-f:table|json] "
+            "[-d:'milliseconds per case (default 1000)'] "
+            "[-t:'all-cores thread count (default cpu count)'] "
+            "[-s:'comma separated sizes (default 16,256,1024,8192,16384)'] "
+            "[-o:Encrypt|EncryptAndFrame|Decrypt|Sign|Verify|KeyExchange|KDF]" << std::endl;
+        return 1;
+    }
+    THEKOGANS_UTIL_TRY {
+        crypto::OpenSSLInit openSSLInit;
+        crypto::CipherSuite cipherSuite (options.cipherSuite);
+        std::cerr << crypto::CPUFeatures::Instance ().architecture << ": " <<
+            crypto::CPUFeatures::Instance ().ToString () << std::endl;
+        std::vector<Benchmark> benchmarks;
+        AddBenchmarks (cipherSuite, benchmarks);
+        // Every case is reported single threaded and on all cores.
+        std::vector<std::size_t> threads;
+        threads.push_back (1);
+        if (options.maxThreads > 1) {
+            threads.push_back (options.maxThreads);
+        }
+        // Unsized operations run once per thread count.
+        std::vector<std::size_t> noSizes (1, 0);
+        bool json = options.format == "json";
+        if (json) {
+            std::cout << "{\"architecture\": \"" << crypto::CPUFeatures::Instance ().architecture <<
+                "\", \"cpu_features\": \"" << crypto::CPUFeatures::Instance ().ToString () <<
+                "\", \"cipher_suite\": \"" << cipherSuite.ToString () <<
+                "\", \"results\": [";
+        }
+        else {
+            std::cout << cipherSuite.ToString () << std::endl;
+            WriteTableHeader ();
+        }
+        bool first = true;
+        for (std::size_t i = 0, count = benchmarks.size (); i < count; ++i) {
+            const Benchmark &benchmark = benchmarks[i];
+            if (!options.operation.empty () && options.operation != benchmark.operation) {
+                continue;
+            }
+            const std::vector<std::size_t> &lengths = benchmark.sized ? sizes : noSizes;
+            for (std::size_t j = 0, lengthCount = lengths.size (); j < lengthCount; ++j) {
+                for (std::size_t k = 0, threadCount = threads.size (); k < threadCount; ++k) {
+                    Result result;
+                    if (RunBenchmark (benchmark, lengths[j], threads[k],
+                            options.duration / 1000.0, result)) {
+                        if (json) {
+                            WriteJSON (result, first);
+                            first = false;
+                        }
+                        else {
+                            WriteTable (result);
+                        }
+                    }
+                }
+            }
+        }
+        if (json) {
+            std::cout << "\n]}" << std::endl;
+        }
+    }
+    THEKOGANS_UTIL_CATCH (util::Exception) {
+        std::cerr << exception.Report () << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -15,30 +15,108 @@
 // You should have received a copy of the GNU General Public License
 // along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
 
+#include <vector>
+#include <algorithm>
 #include "thekogans/util/CommandLineOptions.h"
 #include "thekogans/util/LoggerMgr.h"
 #include "thekogans/util/ConsoleLogger.h"
 #include "thekogans/util/Exception.h"
 #include "thekogans/util/Path.h"
 #include "thekogans/util/File.h"
-#include "thekogans/util/Array.h"
 #include "thekogans/crypto/OpenSSLInit.h"
 #include "thekogans/crypto/KeyRing.h"
 #include "thekogans/crypto/Cipher.h"
 #include "thekogans/crypto/SymmetricKey.h"
+#include "thekogans/crypto/FileDecryptor.h"
+#include "thekogans/crypto/SeekableDecryptor.h"
 
 using namespace thekogans;
 
+namespace {
+    struct FileDecryptor : public crypto::FileDecryptor {
+        FileDecryptor (
+                crypto::SymmetricKey::SharedPtr key,
+                std::size_t workerCount,
+                std::size_t queueDepth) :
+                crypto::FileDecryptor (
+                    key,
+                    THEKOGANS_CRYPTO_DEFAULT_CIPHER,
+                    THEKOGANS_CRYPTO_DEFAULT_MD,
+                    workerCount) {
+            SetQueueDepth (queueDepth);
+        }
+        FileDecryptor (
+                crypto::KeyRing::SharedPtr keyRing,
+                std::size_t workerCount,
+                std::size_t queueDepth) :
+                crypto::FileDecryptor (keyRing, workerCount) {
+            SetQueueDepth (queueDepth);
+        }
+
+    protected:
+        virtual void OnBlockWritten (
+                util::ui64 /*sequenceNumber*/,
+                std::size_t /*ciphertextLength*/,
+                std::size_t /*plaintextLength*/) override {
+            std::cout << ".";
+            std::cout.flush ();
+        }
+    };
+
+    void DecryptRange (
+            crypto::SeekableDecryptor &decryptor,
+            util::ui64 offset,
+            util::ui64 length,
+            const std::string &path) {
+        util::SimpleFile file (
+            util::NetworkEndian,
+            path,
+            util::SimpleFile::ReadWrite |
+            util::SimpleFile::Create |
+            util::SimpleFile::Truncate);
+        std::vector<util::ui8> buffer (decryptor.GetBlockSize ());
+        while (length > 0) {
+            std::size_t bytesRead = decryptor.Read (
+                offset,
+                buffer.data (),
+                (std::size_t)std::min (length, (util::ui64)buffer.size ()));
+            if (bytesRead == 0) {
+                break;
+            }
+            if (file.Write (buffer.data (), bytesRead) != bytesRead) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "Unable to write " THEKOGANS_UTIL_SIZE_T_FORMAT " bytes to %s",
+                    bytesRead,
+                    path.c_str ());
+            }
+            offset += bytesRead;
+            length -= bytesRead;
+            std::cout << ".";
+            std::cout.flush ();
+        }
+    }
+}
+
 int main (
         int argc,
         const char *argv[]) {
     struct Options : public util::CommandLineOptions {
         bool help;
+        util::ui32 workerCount;
+        util::ui32 queueDepth;
+        util::ui64 offset;
+        util::ui64 length;
+        bool range;
         std::string password;
         std::string path;
 
         Options () :
-            help (false) {}
+            help (false),
+            workerCount (0),
+            queueDepth (0),
+            offset (0),
+            length (0),
+            range (false) {}
 
         virtual void DoOption (
                 char option,
@@ -48,6 +126,24 @@ int main (
                     help = true;
                     break;
                 }
+                case 'w': {
+                    workerCount = util::stringToui32 (value.c_str ());
+                    break;
+                }
+                case 'q': {
+                    queueDepth = util::stringToui32 (value.c_str ());
+                    break;
+                }
+                case 'o': {
+                    offset = util::stringToui64 (value.c_str ());
+                    range = true;
+                    break;
+                }
+                case 'l': {
+                    length = util::stringToui64 (value.c_str ());
+                    range = true;
+                    break;
+                }
                 case 'p': {
                     password = value;
                     break;
@@ -58,9 +154,12 @@ int main (
             path = value;
         }
     } options;
-    options.Parse (argc, argv, "hp");
+    options.Parse (argc, argv, "hwqolp");
     if (options.help || options.password.empty () || options.path.empty ()) {
-        std::cout << "usage: " << argv[0] << " [-h] -p:password path" << std::endl;
+        std::cout << "usage: " << argv[0] << " [-h] [-w:'worker count (0 = one per cpu)'] "
+            "[-q:'I/O queue depth (0 = blocking I/O)'] [-o:'plaintext offset'] [-l:'plaintext length (0 = to end of file)'] "
+            "-p:password path" << std::endl;
+        std::cout << "  -o/-l require a file encrypted with encryptfile -s" << std::endl;
         return 1;
     }
     THEKOGANS_UTIL_LOG_INIT (
@@ -71,68 +170,48 @@ int main (
     THEKOGANS_UTIL_TRY {
         crypto::OpenSSLInit openSSLInit;
         std::cout << "Decrypting '" << options.path + ".enc" << "'";
-        util::ReadOnlyFile fromFile (util::NetworkEndian, options.path + ".enc");
-        util::SimpleFile toFile (
-            util::NetworkEndian,
-            options.path,
-            util::SimpleFile::ReadWrite |
-            util::SimpleFile::Create |
-            util::SimpleFile::Truncate);
-        crypto::Cipher::SharedPtr cipher (
-            new crypto::Cipher (
-                crypto::SymmetricKey::FromSecretAndSalt (
-                    options.password.c_str (),
-                    options.password.size ())));
-        crypto::KeyRing::SharedPtr keyRing;
-        if (util::Path (options.path + ".tkr").Exists ()) {
-            keyRing = crypto::KeyRing::Load (options.path + ".tkr", cipher.Get ());
-        }
-        util::ui32 blockSize;
-        fromFile >> blockSize;
-        util::Array<util::ui8> ciphertext (crypto::Cipher::GetMaxBufferLength (blockSize));
-        util::Array<util::ui8> plaintext (blockSize);
-        for (util::ui64 fromSize = fromFile.GetDataAvailableForReading (); fromSize != 0;) {
-            util::ui32 ciphertextLength;
-            if (keyRing.Get () != 0) {
-                crypto::FrameHeader frameHeader;
-                fromFile >> frameHeader;
-                fromSize -= crypto::FrameHeader::SIZE;
-                crypto::SymmetricKey::SharedPtr key = keyRing->GetCipherKey (frameHeader.keyId);
-                if (key.Get () != 0) {
-                    cipher = keyRing->GetCipherSuite ().GetCipher (key);
-                }
-                else {
-                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
-                        "Unable to get key %s",
-                        frameHeader.keyId.ToHexString ().c_str ());
-                }
-                ciphertextLength = frameHeader.ciphertextLength;
+        crypto::SymmetricKey::SharedPtr key =
+            crypto::SymmetricKey::FromSecretAndSalt (
+                options.password.c_str (),
+                options.password.size ());
+        if (crypto::SeekableDecryptor::IsSeekable (options.path + ".enc")) {
+            crypto::SeekableDecryptor::SharedPtr decryptor;
+            if (util::Path (options.path + ".tkr").Exists ()) {
+                crypto::Cipher::SharedPtr cipher (new crypto::Cipher (key));
+                decryptor.Reset (
+                    new crypto::SeekableDecryptor (
+                        options.path + ".enc",
+                        crypto::KeyRing::Load (options.path + ".tkr", cipher.Get ())));
             }
             else {
-                fromFile >> ciphertextLength;
-                fromSize -= util::UI32_SIZE;
+                decryptor.Reset (new crypto::SeekableDecryptor (options.path + ".enc", key));
             }
-            if (fromFile.Read (ciphertext.array, ciphertextLength) == ciphertextLength) {
-                util::ui32 plaintextLength =
-                    (util::ui32)cipher->Decrypt (ciphertext.array, ciphertextLength, 0, 0, plaintext.array);
-                if (toFile.Write (plaintext.array, plaintextLength) == plaintextLength) {
-                    std::cout << ".";
-                    std::cout.flush ();
-                    fromSize -= ciphertextLength;
-                }
-                else {
-                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
-                        "Unable to write %u bytes to %s",
-                        plaintextLength,
-                        toFile.GetPath ().c_str ());
-                }
-            }
-            else {
-                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
-                    "Unable to read %u bytes from %s",
-                    ciphertextLength,
-                    fromFile.GetPath ().c_str ());
+            util::ui64 plaintextLength = decryptor->GetPlaintextLength ();
+            util::ui64 offset = std::min (options.offset, plaintextLength);
+            util::ui64 length = plaintextLength - offset;
+            if (options.length != 0 && options.length < length) {
+                length = options.length;
             }
+            DecryptRange (*decryptor, offset, length, options.path);
+        }
+        else if (options.range) {
+            THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                "%s.enc is not seekable (encrypt it with encryptfile -s)",
+                options.path.c_str ());
+        }
+        else if (util::Path (options.path + ".tkr").Exists ()) {
+            crypto::Cipher::SharedPtr cipher (new crypto::Cipher (key));
+            FileDecryptor (
+                crypto::KeyRing::Load (options.path + ".tkr", cipher.Get ()),
+                options.workerCount,
+                options.queueDepth).Decrypt (
+                    options.path + ".enc",
+                    options.path);
+        }
+        else {
+            FileDecryptor (key, options.workerCount, options.queueDepth).Decrypt (
+                options.path + ".enc",
+                options.path);
         }
         std::cout << "Done" << std::endl;
     }
@@ -22,13 +22,13 @@
 #include "thekogans/util/LoggerMgr.h"
 #include "thekogans/util/ConsoleLogger.h"
 #include "thekogans/util/Exception.h"
-#include "thekogans/util/File.h"
-#include "thekogans/util/Array.h"
 #include "thekogans/crypto/OpenSSLInit.h"
 #include "thekogans/crypto/CipherSuite.h"
 #include "thekogans/crypto/KeyRing.h"
 #include "thekogans/crypto/Cipher.h"
 #include "thekogans/crypto/SymmetricKey.h"
+#include "thekogans/crypto/Compressor.h"
+#include "thekogans/crypto/FileEncryptor.h"
 
 using namespace thekogans;
 
@@ -45,6 +45,33 @@ namespace {
         }
         return cipherSuites_;
     }
+
+    struct FileEncryptor : public crypto::FileEncryptor {
+        FileEncryptor (
+            crypto::SymmetricKey::SharedPtr key,
+            util::ui32 blockSize,
+            std::size_t workerCount) :
+            crypto::FileEncryptor (
+                key,
+                THEKOGANS_CRYPTO_DEFAULT_CIPHER,
+                THEKOGANS_CRYPTO_DEFAULT_MD,
+                blockSize,
+                workerCount) {}
+        FileEncryptor (
+            crypto::KeyRing::SharedPtr keyRing,
+            util::ui32 blockSize,
+            std::size_t workerCount) :
+            crypto::FileEncryptor (keyRing, blockSize, workerCount) {}
+
+    protected:
+        virtual void OnBlockWritten (
+                util::ui64 /*sequenceNumber*/,
+                std::size_t /*plaintextLength*/,
+                std::size_t /*ciphertextLength*/) override {
+            std::cout << ".";
+            std::cout.flush ();
+        }
+    };
 }
 
 int main (
@@ -57,12 +84,27 @@ int main (
         std::string name;
         std::string description;
         util::ui32 blockSize;
+        util::ui32 workerCount;
+        util::ui32 queueDepth;
+        bool numaAware;
+        bool seekable;
+        bool derivedKeys;
+        std::vector<util::ui32> chunkSizes;
+        util::ui8 compression;
+        int compressionLevel;
         std::string password;
         std::string path;
 
         Options () :
             help (false),
-            blockSize (2) {}
+            blockSize (2),
+            workerCount (0),
+            queueDepth (0),
+            numaAware (false),
+            seekable (false),
+            derivedKeys (false),
+            compression (crypto::Compressor::NONE),
+            compressionLevel (crypto::Compressor::DEFAULT_LEVEL) {}
 
         virtual void DoOption (
                 char option,
@@ -92,6 +134,49 @@ int main (
                     blockSize = util::stringToui32 (value.c_str ());
                     break;
                 }
+                case 'w': {
+                    workerCount = util::stringToui32 (value.c_str ());
+                    break;
+                }
+                case 'q': {
+                    queueDepth = util::stringToui32 (value.c_str ());
+                    break;
+                }
+                case 'a': {
+                    numaAware = true;
+                    break;
+                }
+                case 's': {
+                    seekable = true;
+                    break;
+                }
+                case 'k': {
+                    derivedKeys = true;
+                    break;
+                }
+                case 'x': {
+                    // min,avg,max (in KB)
+                    chunkSizes.clear ();
+                    std::string::size_type start = 0;
+                    while (start <= value.size ()) {
+                        std::string::size_type end = value.find (',', start);
+                        if (end == std::string::npos) {
+                            end = value.size ();
+                        }
+                        chunkSizes.push_back (
+                            util::stringToui32 (value.substr (start, end - start).c_str ()));
+                        start = end + 1;
+                    }
+                    break;
+                }
+                case 'z': {
+                    compression = crypto::Compressor::FromString (value);
+                    break;
+                }
+                case 'l': {
+                    compressionLevel = (int)util::stringToui32 (value.c_str ());
+                    break;
+                }
                 case 'p': {
                     password = value;
                     break;
@@ -102,11 +187,19 @@ int main (
             path = value;
         }
     } options;
-    options.Parse (argc, argv, "hcindbp");
-    if (options.help || options.password.empty () || options.path.empty ()) {
+    options.Parse (argc, argv, "hcindbwqaskxzlp");
+    if (options.help || options.password.empty () || options.path.empty () ||
+            (!options.chunkSizes.empty () && options.chunkSizes.size () != 3)) {
         std::cout << "usage: " << argv[0] << " [-h] [-c:'" << GetCipherSuites () << "'] "
             "[-n:'optional key ring name'] [-d:'optional key ring description'] "
-            "[-b:'block size (in MB)'] -p:password path" << std::endl;
+            "[-b:'block size (in MB)'] [-w:'worker count (0 = one per cpu)'] "
+            "[-q:'I/O queue depth (0 = blocking I/O)'] "
+            "[-a (NUMA aware worker placement)] "
+            "[-s (seekable, see decryptfile -o/-l)] "
+            "[-k (derive block keys from one master key, requires -c)] "
+            "[-x:'min,avg,max chunk size (in KB, content defined chunking, requires -c)'] "
+            "[-z:'none | zstd | lz4'] [-l:'compression level (0 = default)'] "
+            "-p:password path" << std::endl;
         return 1;
     }
     THEKOGANS_UTIL_LOG_INIT (
@@ -117,15 +210,8 @@ int main (
     THEKOGANS_UTIL_TRY {
         crypto::OpenSSLInit openSSLInit;
         std::cout << "Encrypting '" << options.path << "'";
-        util::ReadOnlyFile fromFile (util::NetworkEndian, options.path);
-        util::SimpleFile toFile (
-            util::NetworkEndian,
-            options.path + ".enc",
-            util::SimpleFile::ReadWrite |
-            util::SimpleFile::Create |
-            util::SimpleFile::Truncate);
         crypto::KeyRing::SharedPtr keyRing;
-        crypto::Cipher::SharedPtr cipher;
+        util::ui32 blockSize = 1024 * 1024 * options.blockSize;
         if (options.cipherSuite != crypto::CipherSuite::Empty) {
             keyRing.Reset (
                 new crypto::KeyRing (
@@ -133,56 +219,42 @@ int main (
                     options.id,
                     options.name,
                     options.description));
+            FileEncryptor fileEncryptor (keyRing, blockSize, options.workerCount);
+            fileEncryptor.SetCompression (options.compression, options.compressionLevel);
+            fileEncryptor.SetQueueDepth (options.queueDepth);
+            fileEncryptor.SetNUMAAware (options.numaAware);
+            fileEncryptor.SetDerivedKeys (options.derivedKeys);
+            if (!options.chunkSizes.empty ()) {
+                fileEncryptor.SetContentDefinedChunking (
+                    true,
+                    1024 * options.chunkSizes[0],
+                    1024 * options.chunkSizes[1],
+                    1024 * options.chunkSizes[2]);
+            }
+            fileEncryptor.Encrypt (
+                options.path,
+                options.path + ".enc",
+                options.seekable);
         }
         else {
-            cipher.Reset (
-                new crypto::Cipher (
-                    crypto::SymmetricKey::FromSecretAndSalt (
-                        options.password.c_str (),
-                        options.password.size ())));
-        }
-        util::ui32 blockSize = 1024 * 1024 * options.blockSize;
-        toFile << blockSize;
-        util::Array<util::ui8> plaintext (blockSize);
-        util::Array<util::ui8> ciphertext (crypto::Cipher::GetMaxBufferLength (blockSize));
-        for (std::size_t plaintextLength = fromFile.Read (plaintext.array, blockSize);
-                plaintextLength != 0;
-                plaintextLength = fromFile.Read (plaintext.array, blockSize)) {
-            std::size_t ciphertextLength;
-            if (keyRing.Get () != 0) {
-                crypto::SymmetricKey::SharedPtr key =
-                    crypto::SymmetricKey::FromRandom (
-                        crypto::SymmetricKey::MIN_RANDOM_LENGTH,
-                        0,
-                        0,
-                        crypto::GetCipherKeyLength (
-                            options.cipherSuite.GetOpenSSLCipher ()));
-                keyRing->AddCipherKey (key);
-                cipher = keyRing->GetCipherSuite ().GetCipher (key);
-                ciphertextLength =
-                    cipher->EncryptAndFrame (
-                        plaintext.array, plaintextLength, 0, 0, ciphertext.array);
-            }
-            else {
-                ciphertextLength =
-                    cipher->EncryptAndEnlengthen (
-                        plaintext.array, plaintextLength, 0, 0, ciphertext.array);
-            }
-            if (toFile.Write (ciphertext.array, ciphertextLength) == ciphertextLength) {
-                std::cout << ".";
-                std::cout.flush ();
-            }
-            else {
-                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
-                    "Unable to write %u bytes to %s",
-                    ciphertextLength,
-                    toFile.GetPath ().c_str ());
-            }
+            FileEncryptor fileEncryptor (
+                crypto::SymmetricKey::FromSecretAndSalt (
+                    options.password.c_str (),
+                    options.password.size ()),
+                blockSize,
+                options.workerCount);
+            fileEncryptor.SetCompression (options.compression, options.compressionLevel);
+            fileEncryptor.SetQueueDepth (options.queueDepth);
+            fileEncryptor.SetNUMAAware (options.numaAware);
+            fileEncryptor.Encrypt (
+                options.path,
+                options.path + ".enc",
+                options.seekable);
         }
         std::cout << "Done" << std::endl;
         if (keyRing.Get () != 0) {
             std::cout << "Saving key ring...";
-            cipher.Reset (
+            crypto::Cipher::SharedPtr cipher (
                 new crypto::Cipher (
                     crypto::SymmetricKey::FromSecretAndSalt (
                         options.password.c_str (),
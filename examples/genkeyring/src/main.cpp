@@ -15,16 +15,29 @@
 // You should have received a copy of the GNU General Public License
 // along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
 
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <iostream>
+#include "thekogans/util/Types.h"
 #include "thekogans/util/CommandLineOptions.h"
 #include "thekogans/util/LoggerMgr.h"
 #include "thekogans/util/ConsoleLogger.h"
 #include "thekogans/util/Exception.h"
 #include "thekogans/util/RandomSource.h"
 #include "thekogans/util/FixedBuffer.h"
+#include "thekogans/util/File.h"
+#include "thekogans/util/HRTimer.h"
+#include "thekogans/util/StringUtils.h"
 #include "thekogans/crypto/OpenSSLInit.h"
 #include "thekogans/crypto/CipherSuite.h"
 #include "thekogans/crypto/Cipher.h"
 #include "thekogans/crypto/KeyRing.h"
+#include "thekogans/crypto/BlockPipeline.h"
+#include "thekogans/crypto/DH.h"
+#include "thekogans/crypto/DSA.h"
+#include "thekogans/crypto/EC.h"
+#include "thekogans/crypto/RSA.h"
 
 using namespace thekogans;
 
@@ -41,6 +54,304 @@ namespace {
         }
         return cipherSuites_;
     }
+
+    std::string Trim (const std::string &value) {
+        std::size_t first = value.find_first_not_of (" \t\r");
+        return first == std::string::npos ? std::string () :
+            value.substr (first, value.find_last_not_of (" \t\r") - first + 1);
+    }
+
+    // Spec file ("name = value" lines, # starts a comment). Every
+    // count applies to the root ring and to each of it's subrings.
+    struct Spec {
+        enum {
+            KIND_KEY_EXCHANGE_PARAMS,
+            KIND_KEY_EXCHANGE_KEY,
+            KIND_AUTHENTICATOR_PARAMS,
+            KIND_AUTHENTICATOR_KEY,
+            KIND_CIPHER_KEY,
+            KIND_MAC_KEY,
+            KIND_COUNT
+        };
+
+        std::size_t subrings;
+        std::size_t counts[KIND_COUNT];
+        std::size_t dhPrimeLength;
+        std::size_t dsaKeyLength;
+        std::size_t rsaKeyLength;
+        std::string curve;
+
+        Spec () :
+                subrings (0),
+                dhPrimeLength (2048),
+                dsaKeyLength (2048),
+                rsaKeyLength (2048) {
+            for (std::size_t i = 0; i < KIND_COUNT; ++i) {
+                counts[i] = 0;
+            }
+        }
+
+        // One job per object per ring.
+        inline std::size_t GetJobCount () const {
+            std::size_t count = 0;
+            for (std::size_t i = 0; i < KIND_COUNT; ++i) {
+                count += counts[i];
+            }
+            return count * (subrings + 1);
+        }
+
+        void Load (const std::string &path) {
+            util::ReadOnlyFile file (util::NetworkEndian, path);
+            std::string contents ((std::size_t)file.GetSize (), '\0');
+            contents.resize (file.Read (&contents[0], contents.size ()));
+            for (std::size_t start = 0; start < contents.size ();) {
+                std::size_t end = contents.find ('\n', start);
+                if (end == std::string::npos) {
+                    end = contents.size ();
+                }
+                std::string line = Trim (contents.substr (start, end - start));
+                start = end + 1;
+                std::size_t comment = line.find ('#');
+                if (comment != std::string::npos) {
+                    line = Trim (line.substr (0, comment));
+                }
+                if (line.empty ()) {
+                    continue;
+                }
+                std::size_t equal = line.find ('=');
+                if (equal == std::string::npos) {
+                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                        "Invalid spec line: %s", line.c_str ());
+                }
+                std::string name = Trim (line.substr (0, equal));
+                std::string value = Trim (line.substr (equal + 1));
+                if (name == "curve") {
+                    curve = value;
+                    continue;
+                }
+                std::size_t number = (std::size_t)util::stringToui64 (value.c_str ());
+                if (name == "subrings") {
+                    subrings = number;
+                }
+                else if (name == "keyExchangeParams") {
+                    counts[KIND_KEY_EXCHANGE_PARAMS] = number;
+                }
+                else if (name == "keyExchangeKeys") {
+                    counts[KIND_KEY_EXCHANGE_KEY] = number;
+                }
+                else if (name == "authenticatorParams") {
+                    counts[KIND_AUTHENTICATOR_PARAMS] = number;
+                }
+                else if (name == "authenticatorKeys") {
+                    counts[KIND_AUTHENTICATOR_KEY] = number;
+                }
+                else if (name == "cipherKeys") {
+                    counts[KIND_CIPHER_KEY] = number;
+                }
+                else if (name == "macKeys") {
+                    counts[KIND_MAC_KEY] = number;
+                }
+                else if (name == "dhPrimeLength") {
+                    dhPrimeLength = number;
+                }
+                else if (name == "dsaKeyLength") {
+                    dsaKeyLength = number;
+                }
+                else if (name == "rsaKeyLength") {
+                    rsaKeyLength = number;
+                }
+                else {
+                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                        "Unknown spec entry: %s", name.c_str ());
+                }
+            }
+        }
+    };
+
+    // Params and keys are generated on the pipeline workers, and
+    // added to their rings (in job order) on the calling thread.
+    struct RingGenerator : public crypto::BlockPipeline {
+    private:
+        struct Job : public Block {
+            std::size_t ring;
+            std::size_t kind;
+            crypto::Params::SharedPtr params;
+            crypto::AsymmetricKey::SharedPtr asymmetricKey;
+            crypto::SymmetricKey::SharedPtr symmetricKey;
+
+            Job (
+                std::size_t ring_,
+                std::size_t kind_) :
+                Block (0, 0),
+                ring (ring_),
+                kind (kind_) {}
+        };
+
+        const crypto::CipherSuite &cipherSuite;
+        const Spec &spec;
+        std::vector<crypto::KeyRing *> rings;
+        std::size_t jobCount;
+        std::size_t nextJob;
+        std::size_t doneJobs;
+        util::ui64 startTime;
+        util::ui64 lastReportTime;
+
+    public:
+        RingGenerator (
+            const crypto::CipherSuite &cipherSuite_,
+            const Spec &spec_,
+            const std::vector<crypto::KeyRing *> &rings_,
+            std::size_t workerCount) :
+            BlockPipeline (workerCount),
+            cipherSuite (cipherSuite_),
+            spec (spec_),
+            rings (rings_),
+            jobCount (spec.GetJobCount ()),
+            nextJob (0),
+            doneJobs (0),
+            startTime (0),
+            lastReportTime (0) {
+            // Fail before spending hours generating objects the ring won't take.
+            bool rsaKeyExchange =
+                cipherSuite.keyExchange == crypto::CipherSuite::KEY_EXCHANGE_RSA;
+            if ((spec.counts[Spec::KIND_KEY_EXCHANGE_PARAMS] > 0 && rsaKeyExchange) ||
+                    (spec.counts[Spec::KIND_KEY_EXCHANGE_KEY] > 0 && !rsaKeyExchange) ||
+                    (spec.counts[Spec::KIND_AUTHENTICATOR_PARAMS] > 0 &&
+                        cipherSuite.authenticator != crypto::CipherSuite::AUTHENTICATOR_ECDSA &&
+                        cipherSuite.authenticator != crypto::CipherSuite::AUTHENTICATOR_DSA)) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "Spec does not match cipher suite %s",
+                    cipherSuite.ToString ().c_str ());
+            }
+        }
+
+        void Generate () {
+            if (jobCount == 0) {
+                return;
+            }
+            startTime = lastReportTime = util::HRTimer::Click ();
+            Run ();
+            Report (true);
+        }
+
+    protected:
+        // BlockPipeline
+        virtual Block::SharedPtr ReadBlock () override {
+            if (nextJob < jobCount) {
+                // Jobs are laid out ring by ring, kind by kind.
+                std::size_t jobsPerRing = jobCount / rings.size ();
+                std::size_t ring = nextJob / jobsPerRing;
+                std::size_t index = nextJob % jobsPerRing;
+                std::size_t kind = 0;
+                while (index >= spec.counts[kind]) {
+                    index -= spec.counts[kind++];
+                }
+                ++nextJob;
+                return Block::SharedPtr (new Job (ring, kind));
+            }
+            return Block::SharedPtr ();
+        }
+        virtual void ProcessBlock (
+                std::size_t /*workerIndex*/,
+                Block &block) override {
+            Job &job = static_cast<Job &> (block);
+            switch (job.kind) {
+                case Spec::KIND_KEY_EXCHANGE_PARAMS:
+                    job.params = CreateKeyExchangeParams ();
+                    break;
+                case Spec::KIND_KEY_EXCHANGE_KEY:
+                    job.asymmetricKey = crypto::RSA::CreateKey (spec.rsaKeyLength);
+                    break;
+                case Spec::KIND_AUTHENTICATOR_PARAMS:
+                    job.params = CreateAuthenticatorParams ();
+                    break;
+                case Spec::KIND_AUTHENTICATOR_KEY:
+                    job.asymmetricKey = CreateAuthenticatorParams ()->CreateKey ();
+                    break;
+                case Spec::KIND_CIPHER_KEY:
+                case Spec::KIND_MAC_KEY:
+                    job.symmetricKey = crypto::SymmetricKey::FromRandom (
+                        crypto::SymmetricKey::MIN_RANDOM_LENGTH,
+                        0,
+                        0,
+                        crypto::GetCipherKeyLength (cipherSuite.GetOpenSSLCipher ()));
+                    break;
+            }
+        }
+        virtual void WriteBlock (Block &block) override {
+            Job &job = static_cast<Job &> (block);
+            crypto::KeyRing &ring = *rings[job.ring];
+            switch (job.kind) {
+                case Spec::KIND_KEY_EXCHANGE_PARAMS:
+                    ring.AddKeyExchangeParams (job.params);
+                    break;
+                case Spec::KIND_KEY_EXCHANGE_KEY:
+                    ring.AddKeyExchangeKey (job.asymmetricKey);
+                    break;
+                case Spec::KIND_AUTHENTICATOR_PARAMS:
+                    ring.AddAuthenticatorParams (job.params);
+                    break;
+                case Spec::KIND_AUTHENTICATOR_KEY:
+                    ring.AddAuthenticatorKey (job.asymmetricKey);
+                    break;
+                case Spec::KIND_CIPHER_KEY:
+                    ring.AddCipherKey (job.symmetricKey);
+                    break;
+                case Spec::KIND_MAC_KEY:
+                    ring.AddMACKey (job.symmetricKey);
+                    break;
+            }
+            ++doneJobs;
+            Report (false);
+        }
+
+    private:
+        crypto::Params::SharedPtr CreateKeyExchangeParams () const {
+            if (cipherSuite.IsKeyExchangeEC ()) {
+                return spec.curve.empty () ?
+                    crypto::EC::ParamsFromX25519Curve () :
+                    crypto::EC::ParamsFromCurveName (spec.curve);
+            }
+            // This is the slow one the worker pool is for.
+            return crypto::DH::GenerateParams (spec.dhPrimeLength);
+        }
+
+        crypto::Params::SharedPtr CreateAuthenticatorParams () const {
+            if (cipherSuite.authenticator == crypto::CipherSuite::AUTHENTICATOR_Ed25519) {
+                return crypto::EC::ParamsFromEd25519Curve ();
+            }
+            else if (cipherSuite.authenticator == crypto::CipherSuite::AUTHENTICATOR_ECDSA) {
+                return spec.curve.empty () ?
+                    crypto::EC::ParamsFromNamedCurve (NID_X9_62_prime256v1) :
+                    crypto::EC::ParamsFromCurveName (spec.curve);
+            }
+            else if (cipherSuite.authenticator == crypto::CipherSuite::AUTHENTICATOR_DSA) {
+                return crypto::DSA::ParamsFromKeyLength (spec.dsaKeyLength);
+            }
+            return crypto::RSA::ParamsFromKeyLength (spec.rsaKeyLength);
+        }
+
+        // Print progress (at most once a second) and the ETA.
+        void Report (bool done) {
+            util::ui64 now = util::HRTimer::Click ();
+            if (done || util::HRTimer::ToSeconds (
+                    util::HRTimer::ComputeElapsedTime (lastReportTime, now)) >= 1.0) {
+                lastReportTime = now;
+                util::f64 seconds = util::HRTimer::ToSeconds (
+                    util::HRTimer::ComputeElapsedTime (startTime, now));
+                util::f64 rate = seconds > 0.0 ? doneJobs / seconds : 0.0;
+                char line[128];
+                snprintf (line, sizeof (line), "\r%zu of %zu objects (%.1f/s, ETA %.0fs)   ",
+                    doneJobs, jobCount, rate,
+                    rate > 0.0 ? (jobCount - doneJobs) / rate : 0.0);
+                std::cout << line;
+                if (done) {
+                    std::cout << std::endl;
+                }
+                std::cout.flush ();
+            }
+        }
+    };
 }
 
 int main (
@@ -53,10 +364,13 @@ int main (
         std::string name;
         std::string description;
         std::string password;
+        std::string spec;
+        util::ui32 workerCount;
         std::string path;
 
         Options () :
             help (false),
+            workerCount (0),
             cipherSuite (
                 crypto::CipherSuite::KEY_EXCHANGE_ECDHE,
                 crypto::CipherSuite::AUTHENTICATOR_ECDSA,
@@ -91,19 +405,33 @@ int main (
                     password = value;
                     break;
                 }
+                case 's': {
+                    spec = value;
+                    break;
+                }
+                case 'w': {
+                    workerCount = util::stringToui32 (value.c_str ());
+                    break;
+                }
             }
         }
         virtual void DoPath (const std::string &value) {
             path = value;
         }
     } options;
-    options.Parse (argc, argv, "hcindp");
+    options.Parse (argc, argv, "hcindpsw");
     if (options.help ||
             options.password.empty () ||
             options.path.empty ()) {
         std::cout << "usage: " << argv[0] << " [-h] [-c:'" << GetCipherSuites () << "'] "
             "[-n:'optional key ring name'] [-d:'optional key ring description'] "
-            "-p:password path" << std::endl;
+            "[-s:'optional spec file' [-w:'worker count (0 = one per cpu)']] "
+            "-p:password path" << std::endl <<
+            "  -s: populate the key ring (and it's subrings) as described by the spec file:" << std::endl <<
+            "      subrings, keyExchangeParams, keyExchangeKeys, authenticatorParams," << std::endl <<
+            "      authenticatorKeys, cipherKeys, macKeys = count (per ring)" << std::endl <<
+            "      dhPrimeLength, dsaKeyLength, rsaKeyLength = bits (default 2048)" << std::endl <<
+            "      curve = EC curve name (default X25519 (ECDHE), P-256 (ECDSA))" << std::endl;
         return 1;
     }
     THEKOGANS_UTIL_LOG_INIT (
@@ -120,6 +448,28 @@ int main (
                 options.id,
                 options.name,
                 options.description);
+            if (!options.spec.empty ()) {
+                Spec spec;
+                spec.Load (options.spec);
+                std::vector<crypto::KeyRing::SharedPtr> subrings;
+                std::vector<crypto::KeyRing *> rings (1, &keyRing);
+                for (std::size_t i = 0; i < spec.subrings; ++i) {
+                    subrings.push_back (
+                        crypto::KeyRing::SharedPtr (
+                            new crypto::KeyRing (
+                                options.cipherSuite,
+                                crypto::ID (),
+                                options.name + "_" + util::size_tTostring (i))));
+                    keyRing.AddSubring (subrings.back ());
+                    rings.push_back (subrings.back ().Get ());
+                }
+                std::cout << std::endl;
+                RingGenerator (
+                    options.cipherSuite,
+                    spec,
+                    rings,
+                    options.workerCount).Generate ();
+            }
             crypto::Cipher cipher (
                 crypto::SymmetricKey::FromSecretAndSalt (
                     options.password.c_str (),
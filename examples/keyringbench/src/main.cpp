@@ -0,0 +1,556 @@
+// Copyright 2011 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#if defined (TOOLCHAIN_OS_Linux)
+    #include <unistd.h>
+    #include <fstream>
+#elif defined (TOOLCHAIN_OS_OSX)
+    #include <mach/mach.h>
+#endif // defined (TOOLCHAIN_OS_Linux)
+#include <cstdio>
+#include <functional>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <iostream>
+#include "pugixml/pugixml.hpp"
+#include "thekogans/util/Types.h"
+#include "thekogans/util/CommandLineOptions.h"
+#include "thekogans/util/Exception.h"
+#include "thekogans/util/HRTimer.h"
+#include "thekogans/util/File.h"
+#include "thekogans/util/JSON.h"
+#include "thekogans/util/RandomSource.h"
+#include "thekogans/util/StringUtils.h"
+#include "thekogans/crypto/OpenSSLInit.h"
+#include "thekogans/crypto/OpenSSLUtils.h"
+#include "thekogans/crypto/ID.h"
+#include "thekogans/crypto/CipherSuite.h"
+#include "thekogans/crypto/SymmetricKey.h"
+#include "thekogans/crypto/KeyRing.h"
+
+using namespace thekogans;
+
+namespace {
+    // Return the process resident set size (0 = not available on
+    // this platform). Used to report the memory footprint per key.
+    util::ui64 GetResidentMemory () {
+    #if defined (TOOLCHAIN_OS_Linux)
+        std::ifstream statm ("/proc/self/statm");
+        util::ui64 size = 0;
+        util::ui64 resident = 0;
+        if (statm >> size >> resident) {
+            return resident * sysconf (_SC_PAGESIZE);
+        }
+        return 0;
+    #elif defined (TOOLCHAIN_OS_OSX)
+        mach_task_basic_info_data_t info;
+        mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+        return task_info (mach_task_self (), MACH_TASK_BASIC_INFO,
+            (task_info_t)&info, &count) == KERN_SUCCESS ? info.resident_size : 0;
+    #else // defined (TOOLCHAIN_OS_Linux)
+        return 0;
+    #endif // defined (TOOLCHAIN_OS_Linux)
+    }
+
+    struct Result {
+        std::size_t keys;
+        std::size_t rings;
+        std::string operation;
+        util::ui64 ops;
+        util::f64 seconds;
+        util::f64 p50;
+        util::f64 p99;
+        // Bytes written (Save), or the resident memory growth (Build),
+        // 0 = not applicable.
+        util::ui64 bytes;
+
+        Result (
+            std::size_t keys_,
+            std::size_t rings_,
+            const std::string &operation_) :
+            keys (keys_),
+            rings (rings_),
+            operation (operation_),
+            ops (0),
+            seconds (0.0),
+            p50 (0.0),
+            p99 (0.0),
+            bytes (0) {}
+    };
+
+    util::f64 GetPercentile (
+            const std::vector<util::f64> &samples,
+            util::f64 percentile) {
+        return samples.empty () ? 0.0 :
+            samples[(std::size_t)((samples.size () - 1) * percentile / 100.0)];
+    }
+
+    // Time count calls to operation, recording each call's latency.
+    void Measure (
+            std::size_t count,
+            const std::function<void (std::size_t)> &operation,
+            Result &result) {
+        std::vector<util::f64> samples;
+        samples.reserve (count);
+        util::ui64 startTime = util::HRTimer::Click ();
+        util::ui64 lastTime = startTime;
+        for (std::size_t i = 0; i < count; ++i) {
+            operation (i);
+            util::ui64 now = util::HRTimer::Click ();
+            samples.push_back (
+                util::HRTimer::ToSeconds (
+                    util::HRTimer::ComputeElapsedTime (lastTime, now)));
+            lastTime = now;
+        }
+        result.ops = count;
+        result.seconds = util::HRTimer::ToSeconds (
+            util::HRTimer::ComputeElapsedTime (startTime, lastTime));
+        std::sort (samples.begin (), samples.end ());
+        result.p50 = GetPercentile (samples, 50.0);
+        result.p99 = GetPercentile (samples, 99.0);
+    }
+
+    std::string FormatNumber (util::f64 value) {
+        char buffer[64];
+        snprintf (buffer, sizeof (buffer), "%.3f", value);
+        return buffer;
+    }
+
+    struct Writer {
+        bool json;
+        bool first;
+
+        explicit Writer (bool json_) :
+                json (json_),
+                first (true) {
+            if (json) {
+                std::cout << "{\"results\": [";
+            }
+            else {
+                std::cout << "keys,rings,operation,ops,seconds,ops_per_sec,"
+                    "p50_us,p99_us,bytes,bytes_per_key" << std::endl;
+            }
+        }
+        ~Writer () {
+            if (json) {
+                std::cout << "\n]}" << std::endl;
+            }
+        }
+
+        void Write (const Result &result) {
+            util::f64 opsPerSecond = result.seconds > 0.0 ? result.ops / result.seconds : 0.0;
+            std::string bytes = result.bytes > 0 ?
+                util::size_tTostring ((std::size_t)result.bytes) : std::string (json ? "null" : "");
+            std::string bytesPerKey = result.bytes > 0 ?
+                FormatNumber ((util::f64)result.bytes / result.keys) : std::string (json ? "null" : "");
+            if (json) {
+                std::cout << (first ? "\n" : ",\n") <<
+                    "    {\"keys\": " << result.keys << ", " <<
+                    "\"rings\": " << result.rings << ", " <<
+                    "\"operation\": \"" << result.operation << "\", " <<
+                    "\"ops\": " << result.ops << ", " <<
+                    "\"seconds\": " << FormatNumber (result.seconds) << ", " <<
+                    "\"ops_per_sec\": " << FormatNumber (opsPerSecond) << ", " <<
+                    "\"p50_us\": " << FormatNumber (result.p50 * 1e6) << ", " <<
+                    "\"p99_us\": " << FormatNumber (result.p99 * 1e6) << ", " <<
+                    "\"bytes\": " << bytes << ", " <<
+                    "\"bytes_per_key\": " << bytesPerKey << "}";
+                first = false;
+            }
+            else {
+                std::cout <<
+                    result.keys << "," <<
+                    result.rings << "," <<
+                    result.operation << "," <<
+                    result.ops << "," <<
+                    FormatNumber (result.seconds) << "," <<
+                    FormatNumber (opsPerSecond) << "," <<
+                    FormatNumber (result.p50 * 1e6) << "," <<
+                    FormatNumber (result.p99 * 1e6) << "," <<
+                    bytes << "," <<
+                    bytesPerKey << std::endl;
+            }
+            std::cout.flush ();
+        }
+    };
+
+    // Where a key lives: its id and the depth of its ring (0 = root).
+    struct KeyInfo {
+        crypto::ID id;
+        std::size_t depth;
+
+        KeyInfo (
+            const crypto::ID &id_,
+            std::size_t depth_) :
+            id (id_),
+            depth (depth_) {}
+    };
+
+    std::size_t GetRingCount (
+            std::size_t depth,
+            std::size_t fanout) {
+        std::size_t rings = 1;
+        for (std::size_t i = 0, level = 1; i < depth; ++i) {
+            level *= fanout;
+            rings += level;
+        }
+        return rings;
+    }
+
+    // Build a tree of rings depth levels deep, with fanout subrings per
+    // ring, spreading keyCount keys evenly over all of them.
+    crypto::KeyRing::SharedPtr BuildRing (
+            const crypto::CipherSuite &cipherSuite,
+            std::size_t depth,
+            std::size_t maxDepth,
+            std::size_t fanout,
+            std::size_t keysPerRing,
+            std::size_t &keyCount,
+            std::vector<KeyInfo> &keys) {
+        crypto::KeyRing::SharedPtr keyRing (new crypto::KeyRing (cipherSuite));
+        for (std::size_t i = 0; i < keysPerRing && keyCount > 0; ++i, --keyCount) {
+            crypto::SymmetricKey::SharedPtr key = crypto::SymmetricKey::FromRandom (
+                crypto::SymmetricKey::MIN_RANDOM_LENGTH,
+                0,
+                0,
+                crypto::GetCipherKeyLength (cipherSuite.GetOpenSSLCipher ()));
+            keyRing->AddCipherKey (key);
+            keys.push_back (KeyInfo (key->GetId (), depth));
+        }
+        if (depth < maxDepth) {
+            for (std::size_t i = 0; i < fanout; ++i) {
+                keyRing->AddSubring (
+                    BuildRing (cipherSuite, depth + 1, maxDepth, fanout, keysPerRing, keyCount, keys));
+            }
+        }
+        return keyRing;
+    }
+
+    util::ui64 GetFileSize (const std::string &path) {
+        return util::ReadOnlyFile (util::NetworkEndian, path).GetSize ();
+    }
+
+    void WriteTextFile (
+            const std::string &path,
+            const std::string &text) {
+        util::SimpleFile file (
+            util::NetworkEndian,
+            path,
+            util::SimpleFile::ReadWrite |
+            util::SimpleFile::Create |
+            util::SimpleFile::Truncate);
+        file.Write (text.data (), text.size ());
+    }
+
+    std::string ReadTextFile (const std::string &path) {
+        util::ReadOnlyFile file (util::NetworkEndian, path);
+        std::string text ((std::size_t)file.GetSize (), '\0');
+        text.resize (file.Read (&text[0], text.size ()));
+        return text;
+    }
+
+    void RunBenchmark (
+            std::size_t keyCount,
+            std::size_t depth,
+            std::size_t fanout,
+            std::size_t lookups,
+            const std::string &directory,
+            Writer &writer) {
+        const crypto::CipherSuite &cipherSuite = crypto::CipherSuite::Strongest;
+        std::size_t rings = GetRingCount (depth, fanout);
+        std::size_t keysPerRing = (keyCount + rings - 1) / rings;
+        std::vector<KeyInfo> keys;
+        keys.reserve (keyCount);
+        crypto::KeyRing::SharedPtr keyRing;
+        {
+            Result result (keyCount, rings, "Build");
+            util::ui64 residentMemory = GetResidentMemory ();
+            std::size_t remaining = keyCount;
+            Measure (1,
+                [&] (std::size_t) {
+                    keyRing = BuildRing (cipherSuite, 0, depth, fanout, keysPerRing, remaining, keys);
+                },
+                result);
+            util::ui64 growth = GetResidentMemory ();
+            result.bytes = residentMemory > 0 && growth > residentMemory ? growth - residentMemory : 0;
+            // Report per key memory using the actual key count.
+            result.ops = keys.size ();
+            writer.Write (result);
+        }
+        {
+            Result result (keyCount, rings, "SerializedSize");
+            result.bytes = util::Serializable::Size (*keyRing);
+            result.ops = 1;
+            writer.Write (result);
+        }
+        std::string path = directory + "/keyringbench";
+        // Binary
+        {
+            Result result (keyCount, rings, "Save (binary)");
+            Measure (1, [&] (std::size_t) {keyRing->Save (path + ".tkr");}, result);
+            result.bytes = GetFileSize (path + ".tkr");
+            writer.Write (result);
+        }
+        {
+            Result result (keyCount, rings, "Load (binary)");
+            Measure (1, [&] (std::size_t) {crypto::KeyRing::Load (path + ".tkr");}, result);
+            writer.Write (result);
+            std::remove ((path + ".tkr").c_str ());
+        }
+        // XML
+        {
+            Result result (keyCount, rings, "Save (XML)");
+            Measure (1,
+                [&] (std::size_t) {
+                    pugi::xml_document document;
+                    pugi::xml_node node = document.append_child (crypto::KeyRing::TAG_KEY_RING);
+                    node << *keyRing;
+                    document.save_file ((path + ".xml").c_str ());
+                },
+                result);
+            result.bytes = GetFileSize (path + ".xml");
+            writer.Write (result);
+        }
+        {
+            Result result (keyCount, rings, "Load (XML)");
+            Measure (1,
+                [&] (std::size_t) {
+                    pugi::xml_document document;
+                    if (!document.load_file ((path + ".xml").c_str ())) {
+                        THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                            "Unable to load %s.xml", path.c_str ());
+                    }
+                    pugi::xml_node node = document.document_element ();
+                    crypto::KeyRing::SharedPtr loadedRing;
+                    node >> loadedRing;
+                },
+                result);
+            writer.Write (result);
+            std::remove ((path + ".xml").c_str ());
+        }
+        // JSON
+        {
+            Result result (keyCount, rings, "Save (JSON)");
+            Measure (1,
+                [&] (std::size_t) {
+                    util::JSON::Object object;
+                    object << *keyRing;
+                    WriteTextFile (path + ".json", util::JSON::FormatValue (object));
+                },
+                result);
+            result.bytes = GetFileSize (path + ".json");
+            writer.Write (result);
+        }
+        {
+            Result result (keyCount, rings, "Load (JSON)");
+            Measure (1,
+                [&] (std::size_t) {
+                    util::JSON::Object::SharedPtr object =
+                        util::dynamic_refcounted_sharedptr_cast<util::JSON::Object> (
+                            util::JSON::ParseValue (ReadTextFile (path + ".json")));
+                    if (object.Get () == 0) {
+                        THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                            "Unable to parse %s.json", path.c_str ());
+                    }
+                    crypto::KeyRing::SharedPtr loadedRing;
+                    *object >> loadedRing;
+                },
+                result);
+            writer.Write (result);
+            std::remove ((path + ".json").c_str ());
+        }
+        // Lookups. Sample ids up front so the RNG isn't timed.
+        std::vector<crypto::ID> rootIds;
+        std::vector<crypto::ID> deepestIds;
+        std::vector<crypto::ID> allIds;
+        for (std::size_t i = 0; i < lookups; ++i) {
+            allIds.push_back (
+                keys[util::GlobalRandomSource::Instance ().Getui32 () % keys.size ()].id);
+        }
+        for (std::size_t i = 0, count = keys.size (); i < count; ++i) {
+            if (keys[i].depth == 0 && rootIds.size () < lookups) {
+                rootIds.push_back (keys[i].id);
+            }
+        }
+        for (std::size_t i = keys.size (); i-- > 0 && deepestIds.size () < lookups;) {
+            if (keys[i].depth == depth) {
+                deepestIds.push_back (keys[i].id);
+            }
+        }
+        {
+            Result result (keyCount, rings, "GetCipherKey (local)");
+            Measure (rootIds.size (),
+                [&] (std::size_t i) {keyRing->GetCipherKey (rootIds[i], false);},
+                result);
+            writer.Write (result);
+        }
+        {
+            Result result (keyCount, rings, "GetCipherKey (recursive)");
+            Measure (allIds.size (),
+                [&] (std::size_t i) {keyRing->GetCipherKey (allIds[i], true);},
+                result);
+            writer.Write (result);
+        }
+        {
+            Result result (keyCount, rings, "GetCipherKey (recursive deepest)");
+            Measure (deepestIds.size (),
+                [&] (std::size_t i) {keyRing->GetCipherKey (deepestIds[i], true);},
+                result);
+            writer.Write (result);
+        }
+        {
+            // A miss visits every ring.
+            std::vector<crypto::ID> missingIds (std::min (lookups, (std::size_t)1000));
+            Result result (keyCount, rings, "GetCipherKey (miss)");
+            Measure (missingIds.size (),
+                [&] (std::size_t i) {keyRing->GetCipherKey (missingIds[i], true);},
+                result);
+            writer.Write (result);
+        }
+        {
+            // The first GetCipher for a key creates (and caches) its Cipher.
+            Result result (keyCount, rings, "GetCipher (recursive first use)");
+            Measure (allIds.size (),
+                [&] (std::size_t i) {keyRing->GetCipher (allIds[i], true);},
+                result);
+            writer.Write (result);
+        }
+        {
+            Result result (keyCount, rings, "GetCipher (recursive cached)");
+            Measure (allIds.size (),
+                [&] (std::size_t i) {keyRing->GetCipher (allIds[i], true);},
+                result);
+            writer.Write (result);
+        }
+        {
+            // GetRandomCipher is O(1) (the key maps are dense).
+            Result result (keyCount, rings, "GetRandomCipher");
+            Measure (lookups,
+                [&] (std::size_t) {keyRing->GetRandomCipher ();},
+                result);
+            writer.Write (result);
+        }
+        {
+            // Drop last, as it changes the ring. allIds can contain
+            // duplicates, so a drop can miss.
+            Result result (keyCount, rings, "DropCipherKey (recursive)");
+            Measure (allIds.size (),
+                [&] (std::size_t i) {keyRing->DropCipherKey (allIds[i], true);},
+                result);
+            writer.Write (result);
+        }
+    }
+}
+
+int main (
+        int argc,
+        const char *argv[]) {
+    struct Options : public util::CommandLineOptions {
+        bool help;
+        std::string format;
+        util::ui32 minExponent;
+        util::ui32 maxExponent;
+        util::ui32 depth;
+        util::ui32 fanout;
+        util::ui32 lookups;
+        std::string directory;
+
+        Options () :
+            help (false),
+            format ("csv"),
+            minExponent (3),
+            maxExponent (6),
+            depth (2),
+            fanout (4),
+            lookups (10000),
+            directory (".") {}
+
+        virtual void DoOption (
+                char option,
+                const std::string &value) {
+            switch (option) {
+                case 'h': {
+                    help = true;
+                    break;
+                }
+                case 'f': {
+                    format = value;
+                    break;
+                }
+                case 'n': {
+                    minExponent = util::stringToui32 (value.c_str ());
+                    break;
+                }
+                case 'x': {
+                    maxExponent = util::stringToui32 (value.c_str ());
+                    break;
+                }
+                case 'r': {
+                    depth = util::stringToui32 (value.c_str ());
+                    break;
+                }
+                case 's': {
+                    fanout = util::stringToui32 (value.c_str ());
+                    break;
+                }
+                case 'l': {
+                    lookups = util::stringToui32 (value.c_str ());
+                    break;
+                }
+                case 'p': {
+                    directory = value;
+                    break;
+                }
+            }
+        }
+    } options;
+    options.Parse (argc, argv, "hfnxrslp");
+    if (options.help || (options.format != "csv" && options.format != "json") ||
+            options.minExponent == 0 || options.minExponent > options.maxExponent ||
+            options.maxExponent > 9 || options.lookups == 0) {
+        std::cout << "usage: " << argv[0] << " [-h] [-f:csv|json] "
+            "[-n:'min keys exponent (default 3 = 10^3)'] "
+            "[-x:'max keys exponent (default 6 = 10^6)'] "
+            "[-r:'subring depth (default 2)'] [-s:'subrings per ring (default 4)'] "
+            "[-l:'lookups per case (default 10000)'] "
+            "[-p:'scratch directory (default .)']" << std::endl;
+        return 1;
+    }
+    THEKOGANS_UTIL_TRY {
+        crypto::OpenSSLInit openSSLInit;
+        Writer writer (options.format == "json");
+        std::size_t keyCount = 1;
+        for (util::ui32 i = 0; i < options.minExponent; ++i) {
+            keyCount *= 10;
+        }
+        for (util::ui32 i = options.minExponent; i <= options.maxExponent; ++i, keyCount *= 10) {
+            RunBenchmark (
+                keyCount,
+                options.depth,
+                options.fanout,
+                options.lookups,
+                options.directory,
+                writer);
+        }
+    }
+    THEKOGANS_UTIL_CATCH (util::Exception) {
+        std::cerr << exception.Report () << std::endl;
+        return 1;
+    }
+    return 0;
+}
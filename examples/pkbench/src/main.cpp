@@ -0,0 +1,508 @@
+// Copyright 2011 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#include <cstdio>
+#include <memory>
+#include <atomic>
+#include <functional>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <iostream>
+#include <openssl/obj_mac.h>
+#include "thekogans/util/Types.h"
+#include "thekogans/util/CommandLineOptions.h"
+#include "thekogans/util/Exception.h"
+#include "thekogans/util/HRTimer.h"
+#include "thekogans/util/Thread.h"
+#include "thekogans/util/SystemInfo.h"
+#include "thekogans/util/RandomSource.h"
+#include "thekogans/util/StringUtils.h"
+#include "thekogans/crypto/OpenSSLInit.h"
+#include "thekogans/crypto/CPUFeatures.h"
+#include "thekogans/crypto/ID.h"
+#include "thekogans/crypto/Params.h"
+#include "thekogans/crypto/AsymmetricKey.h"
+#include "thekogans/crypto/MessageDigest.h"
+#include "thekogans/crypto/Signer.h"
+#include "thekogans/crypto/Verifier.h"
+#include "thekogans/crypto/RSA.h"
+#include "thekogans/crypto/DSA.h"
+#include "thekogans/crypto/EC.h"
+#include "thekogans/crypto/DH.h"
+#include "thekogans/crypto/DHEKeyExchange.h"
+#include "thekogans/crypto/RSAKeyExchange.h"
+
+using namespace thekogans;
+
+namespace {
+    // A single benchmarked operation. Every worker thread gets its own
+    // (Signer, Verifier and MessageDigest are not thread safe).
+    typedef std::function<void ()> Operation;
+    typedef std::function<Operation ()> OperationFactory;
+
+    // Length of the message signed and verified.
+    const std::size_t MESSAGE_LENGTH = 1024;
+
+    Operation CreateSign (crypto::AsymmetricKey::SharedPtr privateKey) {
+        crypto::Signer::SharedPtr signer = crypto::Signer::Get (
+            privateKey,
+            crypto::MessageDigest::SharedPtr (new crypto::MessageDigest));
+        std::shared_ptr<std::vector<util::ui8>> message (
+            new std::vector<util::ui8> (MESSAGE_LENGTH));
+        util::GlobalRandomSource::Instance ().GetBytes (message->data (), message->size ());
+        return [signer, message] () {
+            signer->Init ();
+            signer->Update (message->data (), message->size ());
+            signer->Final ();
+        };
+    }
+
+    Operation CreateVerify (crypto::AsymmetricKey::SharedPtr privateKey) {
+        std::shared_ptr<std::vector<util::ui8>> message (
+            new std::vector<util::ui8> (MESSAGE_LENGTH));
+        util::GlobalRandomSource::Instance ().GetBytes (message->data (), message->size ());
+        crypto::Signer::SharedPtr signer = crypto::Signer::Get (
+            privateKey,
+            crypto::MessageDigest::SharedPtr (new crypto::MessageDigest));
+        signer->Init ();
+        signer->Update (message->data (), message->size ());
+        std::shared_ptr<util::Buffer> signature (new util::Buffer (signer->Final ()));
+        crypto::Verifier::SharedPtr verifier = crypto::Verifier::Get (
+            privateKey->GetPublicKey (),
+            crypto::MessageDigest::SharedPtr (new crypto::MessageDigest));
+        return [verifier, message, signature] () {
+            verifier->Init ();
+            verifier->Update (message->data (), message->size ());
+            if (!verifier->Final (
+                    signature->GetReadPtr (),
+                    signature->GetDataAvailableForReading ())) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION ("%s", "Signature verification failed.");
+            }
+        };
+    }
+
+    // One complete exchange: both peers' GetParams and
+    // DeriveSharedSymmetricKey (two ephemeral keys and two derivations).
+    Operation CreateDHE (crypto::Params::SharedPtr params) {
+        return [params] () {
+            crypto::DHEKeyExchange initiator (crypto::ID (), params);
+            crypto::KeyExchange::Params::SharedPtr initiatorParams = initiator.GetParams ();
+            crypto::DHEKeyExchange responder (initiatorParams);
+            crypto::KeyExchange::Params::SharedPtr responderParams = responder.GetParams ();
+            initiator.DeriveSharedSymmetricKey (responderParams);
+            responder.DeriveSharedSymmetricKey (initiatorParams);
+        };
+    }
+
+    // One complete exchange: the initiator encrypts a secret with the
+    // public key, the responder decrypts it with the private key.
+    Operation CreateRSAKeyExchange (crypto::AsymmetricKey::SharedPtr privateKey) {
+        crypto::AsymmetricKey::SharedPtr publicKey = privateKey->GetPublicKey ();
+        return [privateKey, publicKey] () {
+            crypto::RSAKeyExchange initiator (crypto::ID (), publicKey);
+            crypto::KeyExchange::Params::SharedPtr initiatorParams = initiator.GetParams ();
+            crypto::RSAKeyExchange responder (privateKey, initiatorParams);
+            crypto::KeyExchange::Params::SharedPtr responderParams = responder.GetParams ();
+            initiator.DeriveSharedSymmetricKey (responderParams);
+            responder.DeriveSharedSymmetricKey (initiatorParams);
+        };
+    }
+
+    Operation CreateKeyGen (crypto::Params::SharedPtr params) {
+        return [params] () {
+            params->CreateKey ();
+        };
+    }
+
+    Operation CreateRSAKeyGen (std::size_t keyLength) {
+        return [keyLength] () {
+            crypto::RSA::CreateKey (keyLength);
+        };
+    }
+
+    // Per thread latency samples are capped. Once the cap is reached
+    // every other sample is dropped and the sampling stride doubles,
+    // so the retained samples stay evenly spread over the run.
+    const std::size_t MAX_LATENCY_SAMPLES = 1 << 16;
+
+    struct Worker : public util::Thread {
+        Operation operation;
+        const std::atomic<bool> &start;
+        util::f64 duration;
+        util::ui64 ops;
+        util::f64 seconds;
+        std::vector<util::f64> samples;
+        std::string error;
+
+        Worker (
+            const Operation &operation_,
+            const std::atomic<bool> &start_,
+            util::f64 duration_) :
+            operation (operation_),
+            start (start_),
+            duration (duration_),
+            ops (0),
+            seconds (0.0) {}
+
+    protected:
+        // util::Thread
+        virtual void Run () throw () override {
+            THEKOGANS_UTIL_TRY {
+                while (!start) {
+                }
+                samples.reserve (MAX_LATENCY_SAMPLES);
+                util::ui64 stride = 1;
+                util::ui64 startTime = util::HRTimer::Click ();
+                util::ui64 lastTime = startTime;
+                // Always run at least one operation (RSA-4096 key
+                // generation can take longer than the duration).
+                do {
+                    operation ();
+                    util::ui64 now = util::HRTimer::Click ();
+                    if (ops++ % stride == 0) {
+                        if (samples.size () == MAX_LATENCY_SAMPLES) {
+                            for (std::size_t i = 0, count = samples.size () / 2; i < count; ++i) {
+                                samples[i] = samples[i * 2];
+                            }
+                            samples.resize (samples.size () / 2);
+                            stride *= 2;
+                        }
+                        samples.push_back (
+                            util::HRTimer::ToSeconds (
+                                util::HRTimer::ComputeElapsedTime (lastTime, now)));
+                    }
+                    lastTime = now;
+                    seconds = util::HRTimer::ToSeconds (
+                        util::HRTimer::ComputeElapsedTime (startTime, now));
+                } while (seconds < duration);
+            }
+            THEKOGANS_UTIL_CATCH (util::Exception) {
+                error = exception.Report ();
+            }
+        }
+    };
+
+    struct Result {
+        std::string operation;
+        std::string algorithm;
+        std::size_t threads;
+        util::ui64 ops;
+        util::f64 seconds;
+        util::f64 opsPerSecond;
+        util::f64 p50;
+        util::f64 p99;
+    };
+
+    util::f64 GetPercentile (
+            const std::vector<util::f64> &samples,
+            util::f64 percentile) {
+        return samples.empty () ? 0.0 :
+            samples[(std::size_t)((samples.size () - 1) * percentile / 100.0)];
+    }
+
+    struct Benchmark {
+        std::string operation;
+        std::string algorithm;
+        OperationFactory factory;
+
+        Benchmark (
+            const std::string &operation_,
+            const std::string &algorithm_,
+            const OperationFactory &factory_) :
+            operation (operation_),
+            algorithm (algorithm_),
+            factory (factory_) {}
+    };
+
+    bool RunBenchmark (
+            const Benchmark &benchmark,
+            std::size_t threads,
+            util::f64 duration,
+            Result &result) {
+        result.operation = benchmark.operation;
+        result.algorithm = benchmark.algorithm;
+        result.threads = threads;
+        result.ops = 0;
+        result.seconds = 0.0;
+        std::atomic<bool> start (false);
+        std::vector<std::unique_ptr<Worker>> workers;
+        THEKOGANS_UTIL_TRY {
+            for (std::size_t i = 0; i < threads; ++i) {
+                workers.push_back (
+                    std::unique_ptr<Worker> (new Worker (benchmark.factory (), start, duration)));
+            }
+        }
+        THEKOGANS_UTIL_CATCH (util::Exception) {
+            std::cerr << benchmark.operation << " " << benchmark.algorithm << ": " <<
+                exception.Report () << std::endl;
+            return false;
+        }
+        for (std::size_t i = 0; i < threads; ++i) {
+            workers[i]->Create ();
+        }
+        start = true;
+        std::vector<util::f64> samples;
+        bool success = true;
+        for (std::size_t i = 0; i < threads; ++i) {
+            workers[i]->Wait ();
+            if (!workers[i]->error.empty ()) {
+                std::cerr << benchmark.operation << " " << benchmark.algorithm << ": " <<
+                    workers[i]->error << std::endl;
+                success = false;
+            }
+            result.ops += workers[i]->ops;
+            result.seconds = std::max (result.seconds, workers[i]->seconds);
+            samples.insert (samples.end (),
+                workers[i]->samples.begin (), workers[i]->samples.end ());
+        }
+        if (success) {
+            std::sort (samples.begin (), samples.end ());
+            result.opsPerSecond = result.seconds > 0.0 ? result.ops / result.seconds : 0.0;
+            result.p50 = GetPercentile (samples, 50.0);
+            result.p99 = GetPercentile (samples, 99.0);
+        }
+        return success;
+    }
+
+    std::string FormatNumber (util::f64 value) {
+        char buffer[64];
+        snprintf (buffer, sizeof (buffer), "%.3f", value);
+        return buffer;
+    }
+
+    void WriteCSVHeader () {
+        std::cout << "operation,algorithm,threads,ops,seconds,ops_per_sec,p50_us,p99_us" << std::endl;
+    }
+
+    void WriteCSV (const Result &result) {
+        std::cout <<
+            result.operation << "," <<
+            result.algorithm << "," <<
+            result.threads << "," <<
+            result.ops << "," <<
+            FormatNumber (result.seconds) << "," <<
+            FormatNumber (result.opsPerSecond) << "," <<
+            FormatNumber (result.p50 * 1e6) << "," <<
+            FormatNumber (result.p99 * 1e6) << std::endl;
+    }
+
+    void WriteJSON (
+            const Result &result,
+            bool first) {
+        std::cout << (first ? "\n" : ",\n") <<
+            "    {\"operation\": \"" << result.operation << "\", " <<
+            "\"algorithm\": \"" << result.algorithm << "\", " <<
+            "\"threads\": " << result.threads << ", " <<
+            "\"ops\": " << result.ops << ", " <<
+            "\"seconds\": " << FormatNumber (result.seconds) << ", " <<
+            "\"ops_per_sec\": " << FormatNumber (result.opsPerSecond) << ", " <<
+            "\"p50_us\": " << FormatNumber (result.p50 * 1e6) << ", " <<
+            "\"p99_us\": " << FormatNumber (result.p99 * 1e6) << "}";
+        std::cout.flush ();
+    }
+
+    struct NamedCurve {
+        const char *name;
+        util::i32 nid;
+    } const namedCurves[] = {
+        {"P-256", NID_X9_62_prime256v1},
+        {"P-384", NID_secp384r1},
+        {"P-521", NID_secp521r1},
+        {"secp256k1", NID_secp256k1}
+    };
+
+    struct DHGroup {
+        const char *name;
+        crypto::Params::SharedPtr (*create) ();
+    } const dhGroups[] = {
+        {"RFC3526-1536", [] () {return crypto::DH::ParamsFromRFC3526Prime (crypto::DH::RFC3526_PRIME_1536);}},
+        {"RFC3526-2048", [] () {return crypto::DH::ParamsFromRFC3526Prime (crypto::DH::RFC3526_PRIME_2048);}},
+        {"RFC3526-3072", [] () {return crypto::DH::ParamsFromRFC3526Prime (crypto::DH::RFC3526_PRIME_3072);}},
+        {"RFC3526-4096", [] () {return crypto::DH::ParamsFromRFC3526Prime (crypto::DH::RFC3526_PRIME_4096);}},
+        {"RFC3526-6144", [] () {return crypto::DH::ParamsFromRFC3526Prime (crypto::DH::RFC3526_PRIME_6144);}},
+        {"RFC3526-8192", [] () {return crypto::DH::ParamsFromRFC3526Prime (crypto::DH::RFC3526_PRIME_8192);}},
+        {"RFC5114-1024", [] () {return crypto::DH::ParamsFromRFC5114Prime (crypto::DH::RFC5114_PRIME_1024);}},
+        {"RFC5114-2048-224", [] () {return crypto::DH::ParamsFromRFC5114Prime (crypto::DH::RFC5114_PRIME_2048_224);}},
+        {"RFC5114-2048-256", [] () {return crypto::DH::ParamsFromRFC5114Prime (crypto::DH::RFC5114_PRIME_2048_256);}}
+    };
+
+    const std::size_t rsaKeyLengths[] = {2048, 3072, 4096};
+
+    // Keys and params are created once, up front, and shared by all
+    // worker threads (they're immutable once created).
+    void AddBenchmarks (std::vector<Benchmark> &benchmarks) {
+        // Signer/Verifier
+        for (std::size_t i = 0; i < sizeof (rsaKeyLengths) / sizeof (rsaKeyLengths[0]); ++i) {
+            std::string name = "RSA-" + util::size_tTostring (rsaKeyLengths[i]);
+            crypto::AsymmetricKey::SharedPtr key = crypto::RSA::CreateKey (rsaKeyLengths[i]);
+            benchmarks.push_back (Benchmark ("Sign", name, [key] () {return CreateSign (key);}));
+            benchmarks.push_back (Benchmark ("Verify", name, [key] () {return CreateVerify (key);}));
+            benchmarks.push_back (Benchmark ("RSAKeyExchange", name,
+                [key] () {return CreateRSAKeyExchange (key);}));
+            std::size_t keyLength = rsaKeyLengths[i];
+            benchmarks.push_back (Benchmark ("KeyGen", name,
+                [keyLength] () {return CreateRSAKeyGen (keyLength);}));
+        }
+        {
+            crypto::Params::SharedPtr params = crypto::DSA::ParamsFromKeyLength (2048);
+            crypto::AsymmetricKey::SharedPtr key = params->CreateKey ();
+            benchmarks.push_back (Benchmark ("Sign", "DSA-2048", [key] () {return CreateSign (key);}));
+            benchmarks.push_back (Benchmark ("Verify", "DSA-2048", [key] () {return CreateVerify (key);}));
+            benchmarks.push_back (Benchmark ("KeyGen", "DSA-2048", [params] () {return CreateKeyGen (params);}));
+        }
+        for (std::size_t i = 0; i < sizeof (namedCurves) / sizeof (namedCurves[0]); ++i) {
+            std::string name = std::string ("ECDSA-") + namedCurves[i].name;
+            crypto::Params::SharedPtr params = crypto::EC::ParamsFromNamedCurve (namedCurves[i].nid);
+            crypto::AsymmetricKey::SharedPtr key = params->CreateKey ();
+            benchmarks.push_back (Benchmark ("Sign", name, [key] () {return CreateSign (key);}));
+            benchmarks.push_back (Benchmark ("Verify", name, [key] () {return CreateVerify (key);}));
+            benchmarks.push_back (Benchmark ("DHEKeyExchange", std::string ("ECDH-") + namedCurves[i].name,
+                [params] () {return CreateDHE (params);}));
+            benchmarks.push_back (Benchmark ("KeyGen", std::string ("EC-") + namedCurves[i].name,
+                [params] () {return CreateKeyGen (params);}));
+        }
+        {
+            crypto::Params::SharedPtr params = crypto::EC::ParamsFromEd25519Curve ();
+            crypto::AsymmetricKey::SharedPtr key = params->CreateKey ();
+            benchmarks.push_back (Benchmark ("Sign", "Ed25519", [key] () {return CreateSign (key);}));
+            benchmarks.push_back (Benchmark ("Verify", "Ed25519", [key] () {return CreateVerify (key);}));
+            benchmarks.push_back (Benchmark ("KeyGen", "Ed25519", [params] () {return CreateKeyGen (params);}));
+        }
+        {
+            crypto::Params::SharedPtr params = crypto::EC::ParamsFromX25519Curve ();
+            benchmarks.push_back (Benchmark ("DHEKeyExchange", "X25519", [params] () {return CreateDHE (params);}));
+            benchmarks.push_back (Benchmark ("KeyGen", "X25519", [params] () {return CreateKeyGen (params);}));
+        }
+        for (std::size_t i = 0; i < sizeof (dhGroups) / sizeof (dhGroups[0]); ++i) {
+            std::string name = std::string ("DH-") + dhGroups[i].name;
+            crypto::Params::SharedPtr params = dhGroups[i].create ();
+            benchmarks.push_back (Benchmark ("DHEKeyExchange", name, [params] () {return CreateDHE (params);}));
+            benchmarks.push_back (Benchmark ("KeyGen", name, [params] () {return CreateKeyGen (params);}));
+        }
+    }
+}
+
+int main (
+        int argc,
+        const char *argv[]) {
+    struct Options : public util::CommandLineOptions {
+        bool help;
+        std::string format;
+        util::ui32 duration;
+        util::ui32 maxThreads;
+        std::string algorithm;
+        std::string operation;
+
+        Options () :
+            help (false),
+            format ("csv"),
+            duration (1000),
+            maxThreads (util::SystemInfo::Instance ().GetCPUCount ()) {}
+
+        virtual void DoOption (
+                char option,
+                const std::string &value) {
+            switch (option) {
+                case 'h': {
+                    help = true;
+                    break;
+                }
+                case 'f': {
+                    format = value;
+                    break;
+                }
+                case 'd': {
+                    duration = util::stringToui32 (value.c_str ());
+                    break;
+                }
+                case 't': {
+                    maxThreads = util::stringToui32 (value.c_str ());
+                    break;
+                }
+                case 'a': {
+                    algorithm = value;
+                    break;
+                }
+                case 'o': {
+                    operation = value;
+                    break;
+                }
+            }
+        }
+    } options;
+    options.Parse (argc, argv, "hfdtao");
+    if (options.help || (options.format != "csv" && options.format != "json") ||
+            options.maxThreads == 0) {
+        std::cout << "usage: " << argv[0] << " [-h] [-f:csv|json] "
+            "[-d:'milliseconds per case (default 1000)'] "
+            "[-t:'all-cores thread count (default cpu count)'] "
+            "[-a:'algorithm (ex: RSA-2048, ECDSA-P-256, Ed25519, X25519, DH-RFC3526-2048)'] "
+            "[-o:Sign|Verify|DHEKeyExchange|RSAKeyExchange|KeyGen]" << std::endl;
+        return 1;
+    }
+    THEKOGANS_UTIL_TRY {
+        crypto::OpenSSLInit openSSLInit;
+        std::cerr << crypto::CPUFeatures::Instance ().architecture << ": " <<
+            crypto::CPUFeatures::Instance ().ToString () << std::endl;
+        std::vector<Benchmark> benchmarks;
+        AddBenchmarks (benchmarks);
+        // Every case is reported single threaded and on all cores.
+        std::vector<std::size_t> threads;
+        threads.push_back (1);
+        if (options.maxThreads > 1) {
+            threads.push_back (options.maxThreads);
+        }
+        bool json = options.format == "json";
+        if (json) {
+            std::cout << "{\"architecture\": \"" << crypto::CPUFeatures::Instance ().architecture <<
+                "\", \"cpu_features\": \"" << crypto::CPUFeatures::Instance ().ToString () <<
+                "\", \"results\": [";
+        }
+        else {
+            WriteCSVHeader ();
+        }
+        bool first = true;
+        for (std::size_t i = 0, count = benchmarks.size (); i < count; ++i) {
+            const Benchmark &benchmark = benchmarks[i];
+            if ((!options.operation.empty () && options.operation != benchmark.operation) ||
+                    (!options.algorithm.empty () && options.algorithm != benchmark.algorithm)) {
+                continue;
+            }
+            for (std::size_t j = 0, threadCount = threads.size (); j < threadCount; ++j) {
+                Result result;
+                if (RunBenchmark (benchmark, threads[j], options.duration / 1000.0, result)) {
+                    if (json) {
+                        WriteJSON (result, first);
+                        first = false;
+                    }
+                    else {
+                        WriteCSV (result);
+                    }
+                }
+            }
+        }
+        if (json) {
+            std::cout << "\n]}" << std::endl;
+        }
+    }
+    THEKOGANS_UTIL_CATCH (util::Exception) {
+        std::cerr << exception.Report () << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -18,18 +18,62 @@
 #if defined (TOOLCHAIN_OS_Windows)
     #include <winsock2.h>
 #endif // defined (TOOLCHAIN_OS_Windows)
+#include <cstring>
+#include <string>
+#include <vector>
+#include <iostream>
 #include "thekogans/util/CommandLineOptions.h"
 #include "thekogans/util/LoggerMgr.h"
 #include "thekogans/util/ConsoleLogger.h"
 #include "thekogans/util/Exception.h"
 #include "thekogans/util/File.h"
-#include "thekogans/util/Base64.h"
+#include "thekogans/util/StringUtils.h"
 #include "thekogans/crypto/OpenSSLInit.h"
+#include "thekogans/crypto/CipherSuite.h"
 #include "thekogans/crypto/OpenSSLAsymmetricKey.h"
 #include "thekogans/crypto/Authenticator.h"
+#include "thekogans/crypto/FileManifest.h"
+#include "thekogans/crypto/SignatureManifest.h"
+#include "thekogans/crypto/TextEncoding.h"
 
 using namespace thekogans;
 
+namespace {
+    util::Buffer ReadFile (const std::string &path) {
+        util::ReadOnlyFile file (util::NetworkEndian, path);
+        util::Buffer buffer (util::NetworkEndian, file.GetSize ());
+        buffer.AdvanceWriteOffset (
+            file.Read (
+                buffer.GetWritePtr (),
+                buffer.GetDataAvailableForWriting ()));
+        return buffer;
+    }
+
+    // Hash all files in one batch (see MessageDigest::HashBatch)
+    // and return their manifest ("hex digest path" lines).
+    std::string CreateManifest (const std::vector<std::string> &paths) {
+        std::vector<util::Buffer> files;
+        files.reserve (paths.size ());
+        std::vector<const void *> buffers;
+        std::vector<std::size_t> lengths;
+        for (std::size_t i = 0, count = paths.size (); i < count; ++i) {
+            files.push_back (ReadFile (paths[i]));
+            buffers.push_back (files.back ().GetReadPtr ());
+            lengths.push_back (files.back ().GetDataAvailableForReading ());
+        }
+        crypto::MessageDigest messageDigest;
+        std::vector<util::Buffer> hashes = messageDigest.HashBatch (
+            buffers.data (), lengths.data (), buffers.size ());
+        std::string manifest;
+        for (std::size_t i = 0, count = paths.size (); i < count; ++i) {
+            manifest += crypto::HexEncode (
+                hashes[i].GetReadPtr (),
+                hashes[i].GetDataAvailableForReading ()) + " " + paths[i] + "\n";
+        }
+        return manifest;
+    }
+}
+
 int main (
         int argc,
         const char *argv[]) {
@@ -37,11 +81,21 @@ int main (
         bool help;
         std::string prefix;
         bool verify;
-        std::string path;
+        std::string manifest;
+        std::string batchManifest;
+        std::vector<std::string> directories;
+        std::vector<std::string> pathLists;
+        bool chunkManifest;
+        util::ui32 chunkSize;
+        util::ui32 workerCount;
+        std::vector<std::string> paths;
 
         Options () :
             help (false),
-            verify (false) {}
+            verify (false),
+            chunkManifest (false),
+            chunkSize (crypto::FileManifest::DEFAULT_CHUNK_SIZE),
+            workerCount (0) {}
 
         virtual void DoOption (
                 char option,
@@ -59,15 +113,63 @@ int main (
                     verify = true;
                     break;
                 }
+                case 'm': {
+                    manifest = value;
+                    break;
+                }
+                case 'b': {
+                    batchManifest = value;
+                    break;
+                }
+                case 'd': {
+                    directories.push_back (value);
+                    break;
+                }
+                case 'l': {
+                    pathLists.push_back (value);
+                    break;
+                }
+                case 'c': {
+                    chunkManifest = true;
+                    if (!value.empty ()) {
+                        chunkSize = util::stringToui32 (value.c_str ());
+                    }
+                    break;
+                }
+                case 'w': {
+                    workerCount = util::stringToui32 (value.c_str ());
+                    break;
+                }
             }
         }
         virtual void DoPath (const std::string &value) {
-            path = value;
+            paths.push_back (value);
         }
     } options;
-    options.Parse (argc, argv, "hpv");
-    if (options.help || options.path.empty ()) {
-        std::cout << "usage: " << argv[0] << " [-h] -p:'private/public key file prefix' path" << std::endl;
+    options.Parse (argc, argv, "hpvmbdlcw");
+    if (options.help || options.chunkSize == 0 ||
+            (options.paths.empty () &&
+                (options.batchManifest.empty () ||
+                    (options.directories.empty () && options.pathLists.empty ()))) ||
+            (options.batchManifest.empty () &&
+                (!options.directories.empty () || !options.pathLists.empty ())) ||
+            (options.manifest.empty () && options.batchManifest.empty () &&
+                options.paths.size () > 1) ||
+            (options.chunkManifest && !options.manifest.empty ()) ||
+            (!options.batchManifest.empty () &&
+                (options.chunkManifest || !options.manifest.empty ()))) {
+        std::cout << "usage: " << argv[0] << " [-h] [-v] -p:'private/public key file prefix' "
+            "[-m:'manifest file' | -b:'signature manifest' [-d:'directory'] [-l:'path list file'] | "
+            "-c[:'chunk size']] [-w:'worker count (0 = one per cpu)'] "
+            "[path ...]" << std::endl <<
+            "  -m: hash all paths as a batch, write their digests to the manifest "
+            "and sign the manifest." << std::endl <<
+            "  -b: hash all paths (and all files under -d, and all paths listed in -l, "
+            "one per line) in parallel and sign them as a batch, with a single signature "
+            "(see verifyfilesignature -b)." << std::endl <<
+            "  -c: write a signed chunk manifest (path.manifest) instead of path.sig, "
+            "so that path can be verified in parallel, in ranges and resumably "
+            "(see verifyfilesignature -c)." << std::endl;
         return 1;
     }
     THEKOGANS_UTIL_LOG_INIT (
@@ -76,48 +178,142 @@ int main (
     THEKOGANS_UTIL_LOG_ADD_LOGGER (util::Logger::SharedPtr (new util::ConsoleLogger));
     THEKOGANS_UTIL_IMPLEMENT_LOG_FLUSHER;
     THEKOGANS_UTIL_TRY {
-        crypto::OpenSSLInit openSSLInit;
+        // signfile is short lived and only ever uses the default digest.
+        crypto::OpenSSLInit::Profile profile (
+            std::vector<std::string> (),
+            std::vector<std::string> (
+                1, crypto::CipherSuite::GetOpenSSLMessageDigestName (THEKOGANS_CRYPTO_DEFAULT_MD)));
+        crypto::OpenSSLInit openSSLInit (
+            true,
+            crypto::OpenSSLInit::DEFAULT_ENTROPY_NEEDED,
+            crypto::OpenSSLInit::DEFAULT_WORKING_SET_SIZE,
+            0,
+            0,
+            &profile);
+        if (!options.batchManifest.empty ()) {
+            for (std::size_t i = 0, count = options.directories.size (); i < count; ++i) {
+                std::vector<std::string> files =
+                    crypto::SignatureManifest::ListFiles (options.directories[i]);
+                options.paths.insert (options.paths.end (), files.begin (), files.end ());
+            }
+            for (std::size_t i = 0, count = options.pathLists.size (); i < count; ++i) {
+                std::vector<std::string> files =
+                    crypto::SignatureManifest::ReadPathList (options.pathLists[i]);
+                options.paths.insert (options.paths.end (), files.begin (), files.end ());
+            }
+            std::cout << "Signing " << options.paths.size () << " files...";
+            crypto::Authenticator signer (
+                crypto::OpenSSLAsymmetricKey::LoadPrivateKeyFromFile (options.prefix + "private_key.pem"),
+                crypto::MessageDigest::SharedPtr (new crypto::MessageDigest));
+            crypto::SignatureManifest::Create (
+                options.paths,
+                signer,
+                THEKOGANS_CRYPTO_DEFAULT_MD,
+                options.workerCount)->Save (options.batchManifest);
+            std::cout << "Done" << std::endl;
+            if (options.verify) {
+                std::cout << "Verifying " << options.paths.size () << " files...";
+                crypto::Authenticator verifier (
+                    crypto::OpenSSLAsymmetricKey::LoadPublicKeyFromFile (options.prefix + "public_key.pem"),
+                    crypto::MessageDigest::SharedPtr (new crypto::MessageDigest));
+                bool result = crypto::SignatureManifest::Load (options.batchManifest)->Verify (
+                    verifier,
+                    options.workerCount);
+                std::cout << (result ? "Passed" : "Failed") << std::endl;
+            }
+            return 0;
+        }
+        std::vector<std::string> files;
+        if (!options.manifest.empty ()) {
+            files.swap (options.paths);
+            std::cout << "Hashing " << files.size () << " files...";
+            std::string manifest = CreateManifest (files);
+            util::SimpleFile manifestFile (
+                util::NetworkEndian,
+                options.manifest,
+                util::SimpleFile::ReadWrite |
+                util::SimpleFile::Create |
+                util::SimpleFile::Truncate);
+            manifestFile.Write (manifest.data (), manifest.size ());
+            std::cout << "Done" << std::endl;
+            options.paths.assign (1, options.manifest);
+        }
+        const std::string &path = options.paths[0];
+        if (options.chunkManifest) {
+            std::cout << "Creating manifest for '" << path << "'...";
+            crypto::Authenticator signer (
+                crypto::OpenSSLAsymmetricKey::LoadPrivateKeyFromFile (options.prefix + "private_key.pem"),
+                crypto::MessageDigest::SharedPtr (new crypto::MessageDigest));
+            crypto::FileManifest::Create (
+                path,
+                signer,
+                options.chunkSize,
+                THEKOGANS_CRYPTO_DEFAULT_MD,
+                options.workerCount)->Save (path + ".manifest");
+            std::cout << "Done" << std::endl;
+            if (options.verify) {
+                std::cout << "Verifying '" << path << "'...";
+                crypto::Authenticator verifier (
+                    crypto::OpenSSLAsymmetricKey::LoadPublicKeyFromFile (options.prefix + "public_key.pem"),
+                    crypto::MessageDigest::SharedPtr (new crypto::MessageDigest));
+                crypto::FileManifestVerifier manifestVerifier (
+                    crypto::FileManifest::Load (path + ".manifest"),
+                    verifier,
+                    options.workerCount);
+                std::cout << (manifestVerifier.Verify (path) ? "Passed" : "Failed") << std::endl;
+            }
+            return 0;
+        }
         {
-            std::cout << "Signing '" << options.path << "'...";
+            std::cout << "Signing '" << path << "'...";
             crypto::Authenticator signer (
                 crypto::OpenSSLAsymmetricKey::LoadPrivateKeyFromFile (options.prefix + "private_key.pem"),
                 crypto::MessageDigest::SharedPtr (new crypto::MessageDigest));
-            util::Buffer signature = signer.SignFile (options.path);
-            util::Buffer encodedSignature =
-                util::Base64::Encode (
+            util::Buffer signature = signer.SignFile (path);
+            std::string encodedSignature =
+                crypto::Base64Encode (
                     signature.GetReadPtr (),
                     signature.GetDataAvailableForReading (),
                     64);
             util::SimpleFile signatureFile (
                 util::NetworkEndian,
-                options.path + ".sig",
+                path + ".sig",
                 util::SimpleFile::ReadWrite |
                 util::SimpleFile::Create |
                 util::SimpleFile::Truncate);
             signatureFile.Write (
-                encodedSignature.GetReadPtr (),
-                encodedSignature.GetDataAvailableForReading ());
+                encodedSignature.data (),
+                encodedSignature.size ());
             std::cout << "Done" << std::endl;
         }
         if (options.verify) {
-            std::cout << "Verifying '" << options.path << "'...";
+            std::cout << "Verifying '" << path << "'...";
             crypto::Authenticator verifier (
                 crypto::OpenSSLAsymmetricKey::LoadPublicKeyFromFile (options.prefix + "public_key.pem"),
                 crypto::MessageDigest::SharedPtr (new crypto::MessageDigest));
-            util::ReadOnlyFile signatureFile (util::NetworkEndian, options.path + ".sig");
+            util::ReadOnlyFile signatureFile (util::NetworkEndian, path + ".sig");
             util::Buffer encodedSignature (util::NetworkEndian, signatureFile.GetSize ());
             encodedSignature.AdvanceWriteOffset (
                 signatureFile.Read (
                     encodedSignature.GetWritePtr (),
                     encodedSignature.GetDataAvailableForWriting ()));
-            util::Buffer signature =
-                util::Base64::Decode (
-                    encodedSignature.GetReadPtr (),
+            std::vector<util::ui8> signature =
+                crypto::Base64Decode (
+                    (const char *)encodedSignature.GetReadPtr (),
                     encodedSignature.GetDataAvailableForReading ());
             bool result = verifier.VerifyFileSignature (
-                options.path,
-                signature.GetReadPtr (),
-                signature.GetDataAvailableForReading ());
+                path,
+                signature.data (),
+                signature.size ());
+            if (result && !files.empty ()) {
+                // The signature covers the manifest. Make sure it still
+                // describes the files.
+                std::cout << "Rehashing " << files.size () << " files...";
+                std::string manifest = CreateManifest (files);
+                util::Buffer signedManifest = ReadFile (path);
+                result = signedManifest.GetDataAvailableForReading () == manifest.size () &&
+                    memcmp (signedManifest.GetReadPtr (), manifest.data (), manifest.size ()) == 0;
+            }
             std::cout << (result ? "Passed" : "Failed") << std::endl;
         }
     }
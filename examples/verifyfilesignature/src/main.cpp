@@ -18,29 +18,83 @@
 #if defined (TOOLCHAIN_OS_Windows)
     #include <winsock2.h>
 #endif // defined (TOOLCHAIN_OS_Windows)
+#include <string>
+#include <vector>
+#include <iostream>
+#include "thekogans/util/Types.h"
 #include "thekogans/util/CommandLineOptions.h"
 #include "thekogans/util/LoggerMgr.h"
 #include "thekogans/util/ConsoleLogger.h"
 #include "thekogans/util/Exception.h"
 #include "thekogans/util/File.h"
-#include "thekogans/util/Base64.h"
+#include "thekogans/util/StringUtils.h"
 #include "thekogans/crypto/OpenSSLInit.h"
 #include "thekogans/crypto/OpenSSLAsymmetricKey.h"
 #include "thekogans/crypto/Authenticator.h"
 #include "thekogans/crypto/MessageDigest.h"
+#include "thekogans/crypto/FileManifest.h"
+#include "thekogans/crypto/SignatureManifest.h"
+#include "thekogans/crypto/TextEncoding.h"
 
 using namespace thekogans;
 
+namespace {
+    // Save the progress every PROGRESS_INTERVAL chunks so that
+    // an interrupted verification can be resumed (-r).
+    struct ManifestVerifier : public crypto::FileManifestVerifier {
+        enum {
+            PROGRESS_INTERVAL = 64
+        };
+
+        std::string progressPath;
+        util::ui64 chunksSinceSave;
+
+        ManifestVerifier (
+            crypto::FileManifest::SharedPtr manifest,
+            crypto::Authenticator &verifier,
+            std::size_t workerCount,
+            const std::string &progressPath_) :
+            crypto::FileManifestVerifier (manifest, verifier, workerCount),
+            progressPath (progressPath_),
+            chunksSinceSave (0) {}
+
+    protected:
+        virtual void OnChunkVerified (
+                util::ui64 chunk,
+                bool valid) override {
+            if (!valid) {
+                std::cout << std::endl << "Chunk " << chunk << " is invalid" << std::endl;
+            }
+            if (!progressPath.empty () && ++chunksSinceSave == PROGRESS_INTERVAL) {
+                SaveProgress (progressPath);
+                chunksSinceSave = 0;
+            }
+        }
+    };
+}
+
 int main (
         int argc,
         const char *argv[]) {
     struct Options : public util::CommandLineOptions {
         bool help;
+        bool chunkManifest;
+        bool batchManifest;
+        bool resume;
+        util::ui32 workerCount;
+        util::ui64 offset;
+        util::ui64 length;
         std::string publicKey;
         std::string path;
 
         Options () :
-            help (false) {}
+            help (false),
+            chunkManifest (false),
+            batchManifest (false),
+            resume (false),
+            workerCount (0),
+            offset (0),
+            length (0) {}
 
         virtual void DoOption (
                 char option,
@@ -50,6 +104,30 @@ int main (
                     help = true;
                     break;
                 }
+                case 'c': {
+                    chunkManifest = true;
+                    break;
+                }
+                case 'b': {
+                    batchManifest = true;
+                    break;
+                }
+                case 'r': {
+                    resume = true;
+                    break;
+                }
+                case 'w': {
+                    workerCount = util::stringToui32 (value.c_str ());
+                    break;
+                }
+                case 'o': {
+                    offset = util::stringToui64 (value.c_str ());
+                    break;
+                }
+                case 'l': {
+                    length = util::stringToui64 (value.c_str ());
+                    break;
+                }
                 case 'p': {
                     publicKey = value;
                     break;
@@ -60,9 +138,18 @@ int main (
             path = value;
         }
     } options;
-    options.Parse (argc, argv, "hp");
-    if (options.help || options.publicKey.empty () || options.path.empty ()) {
-        std::cout << "usage: " << argv[0] << " [-h] -p:'public key path' path" << std::endl;
+    options.Parse (argc, argv, "hcbrwolp");
+    if (options.help || options.publicKey.empty () || options.path.empty () ||
+            (options.chunkManifest && options.batchManifest) ||
+            (!options.chunkManifest &&
+                (options.resume || options.offset != 0 || options.length != 0))) {
+        std::cout << "usage: " << argv[0] << " [-h] [-c [-r] [-o:'offset'] [-l:'length (0 = to end of file)'] | -b] "
+            "[-w:'worker count (0 = one per cpu)'] -p:'public key path' path" << std::endl;
+        std::cout << "  -c: verify against path.manifest (see signfile -c) instead of path.sig" << std::endl;
+        std::cout << "  -b: path is a signature manifest (see signfile -b), verify "
+            "all the files it lists in parallel" << std::endl;
+        std::cout << "  -r: resume (and record the progress of) an interrupted verification "
+            "(path.manifest.progress)" << std::endl;
         return 1;
     }
     THEKOGANS_UTIL_LOG_INIT (
@@ -73,6 +160,44 @@ int main (
     THEKOGANS_UTIL_TRY {
         crypto::OpenSSLInit openSSLInit;
         std::cout << "Verifying '" << options.path << "'...";
+        if (options.batchManifest) {
+            crypto::Authenticator authenticator (
+                crypto::OpenSSLAsymmetricKey::LoadPublicKeyFromFile (options.publicKey),
+                crypto::MessageDigest::SharedPtr (new crypto::MessageDigest));
+            std::vector<std::string> invalidPaths;
+            bool result = crypto::SignatureManifest::Load (options.path)->Verify (
+                authenticator,
+                options.workerCount,
+                true,
+                &invalidPaths);
+            std::cout << (result ? "Passed" : "Failed") << std::endl;
+            for (std::size_t i = 0, count = invalidPaths.size (); i < count; ++i) {
+                std::cout << "'" << invalidPaths[i] << "' is invalid" << std::endl;
+            }
+            return 0;
+        }
+        if (options.chunkManifest) {
+            crypto::Authenticator authenticator (
+                crypto::OpenSSLAsymmetricKey::LoadPublicKeyFromFile (options.publicKey),
+                crypto::MessageDigest::SharedPtr (new crypto::MessageDigest));
+            std::string progressPath = options.resume ?
+                options.path + ".manifest.progress" : std::string ();
+            ManifestVerifier verifier (
+                crypto::FileManifest::Load (options.path + ".manifest"),
+                authenticator,
+                options.workerCount,
+                progressPath);
+            if (options.resume && verifier.LoadProgress (progressPath)) {
+                std::cout << "resuming (" << verifier.GetVerifiedChunkCount () << " of " <<
+                    verifier.GetManifest ()->GetHeader ().chunkCount << " chunks verified)...";
+            }
+            bool result = verifier.Verify (options.path, options.offset, options.length);
+            if (options.resume) {
+                verifier.SaveProgress (progressPath);
+            }
+            std::cout << (result ? "Passed" : "Failed") << std::endl;
+            return 0;
+        }
         crypto::Authenticator authenticator (
             crypto::OpenSSLAsymmetricKey::LoadPublicKeyFromFile (options.publicKey),
             crypto::MessageDigest::SharedPtr (new crypto::MessageDigest));
@@ -82,14 +207,14 @@ int main (
             signatureFile.Read (
                 encodedSignature.GetWritePtr (),
                 encodedSignature.GetDataAvailableForWriting ()));
-        util::Buffer signature =
-            util::Base64::Decode (
-                encodedSignature.GetReadPtr (),
+        std::vector<util::ui8> signature =
+            crypto::Base64Decode (
+                (const char *)encodedSignature.GetReadPtr (),
                 encodedSignature.GetDataAvailableForReading ());
         bool result = authenticator.VerifyFileSignature (
             options.path,
-            signature.GetReadPtr (),
-            signature.GetDataAvailableForReading ());
+            signature.data (),
+            signature.size ());
         std::cout << (result ? "Passed" : "Failed") << std::endl;
     }
     THEKOGANS_UTIL_CATCH_AND_LOG
@@ -0,0 +1,241 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined (__thekogans_crypto_AllocationTracker_h)
+#define __thekogans_crypto_AllocationTracker_h
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include "thekogans/util/Types.h"
+#include "thekogans/crypto/Config.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        /// \struct AllocationTracker AllocationTracker.h thekogans/crypto/AllocationTracker.h
+        ///
+        /// \brief
+        /// AllocationTracker counts allocations per thread, by source, so that tests
+        /// can assert that the documented hot paths (\see{Cipher::Encrypt}/Decrypt into
+        /// a caller buffer, \see{MAC::SignBuffer} into a caller buffer, \see{KeyRing::GetCipher}
+        /// cache hits...) don't allocate. The sources are fed as follows:
+        ///
+        /// SOURCE_OPENSSL: Every OPENSSL_malloc/realloc, once \see{InstallOpenSSLHooks}
+        /// succeeds. Until then, only \see{OpenSSLAllocator::Alloc} is counted.
+        ///
+        /// SOURCE_SECURE: Every Alloc served by a secure \see{ThreadCacheAllocator} or
+        /// \see{BufferPoolAllocator} (cache hits included, this is where \see{Serializable}s
+        /// and secure buffers come from), as well as \see{CompactKeyStore} slabs.
+        ///
+        /// SOURCE_POOL: Every Alloc served by a non secure \see{ThreadCacheAllocator}
+        /// or \see{BufferPoolAllocator} (cache hits included). Misses also show up
+        /// under the source of the underlying allocator.
+        ///
+        /// SOURCE_HEAP: Global operator new. The library can't replace it on the
+        /// application's behalf. Expand \see{THEKOGANS_CRYPTO_IMPLEMENT_ALLOCATION_TRACKER_GLOBAL_NEW}
+        /// in exactly one translation unit of the executable to count it.
+        ///
+        /// Use AllocationTracker::Scope to count the allocations made by a block of code:
+        ///
+        /// \code{.cpp}
+        /// using namespace thekogans;
+        ///
+        /// crypto::AllocationTracker::Scope scope;
+        /// cipher.Encrypt (plaintext, plaintextLength, 0, 0, ciphertext);
+        /// assert (scope.GetCounters ().GetTotal () == 0);
+        /// \endcode
+        ///
+        /// NOTE: Counters are thread local (allocations made by other
+        /// threads are not attributed to the scope) and cost one thread
+        /// local increment per allocation.
+
+        struct _LIB_THEKOGANS_CRYPTO_DECL AllocationTracker {
+            /// \enum
+            /// Allocation sources.
+            enum Source {
+                /// \brief
+                /// OpenSSL allocations.
+                SOURCE_OPENSSL,
+                /// \brief
+                /// Secure allocations.
+                SOURCE_SECURE,
+                /// \brief
+                /// Pooled (non secure) allocations.
+                SOURCE_POOL,
+                /// \brief
+                /// Global operator new.
+                SOURCE_HEAP,
+                /// \brief
+                /// Number of sources.
+                SOURCE_COUNT
+            };
+
+            /// \struct AllocationTracker::Counters AllocationTracker.h thekogans/crypto/AllocationTracker.h
+            ///
+            /// \brief
+            /// Allocation counters (per source).
+            struct _LIB_THEKOGANS_CRYPTO_DECL Counters {
+                /// \brief
+                /// Number of allocations.
+                util::ui64 allocationCount[SOURCE_COUNT];
+                /// \brief
+                /// Number of bytes allocated.
+                util::ui64 byteCount[SOURCE_COUNT];
+
+                /// \brief
+                /// ctor.
+                Counters ();
+
+                /// \brief
+                /// Return the number of allocations from all sources.
+                /// \return Number of allocations from all sources.
+                util::ui64 GetTotal () const;
+
+                /// \brief
+                /// Return the counters accumulated since the given snapshot.
+                /// \param[in] start Earlier snapshot.
+                /// \return this - start.
+                Counters operator - (const Counters &start) const;
+            };
+
+            /// \brief
+            /// Return the given source's name.
+            /// \param[in] source Allocation source.
+            /// \return Source name.
+            static const char *GetSourceName (Source source);
+
+            /// \brief
+            /// Record an allocation.
+            /// \param[in] source Allocation source.
+            /// \param[in] size Allocation size.
+            static void Record (
+                Source source,
+                std::size_t size);
+
+            /// \brief
+            /// Return a snapshot of the calling thread's counters.
+            /// \return Calling thread's counters.
+            static Counters GetThreadCounters ();
+
+            /// \brief
+            /// Route OPENSSL_malloc/realloc/free through counting wrappers
+            /// (CRYPTO_set_mem_functions). OpenSSL only allows this before
+            /// it's first allocation, so call it at the very top of main
+            /// (before \see{OpenSSLInit}).
+            /// \return true == OpenSSL allocations are being counted.
+            static bool InstallOpenSSLHooks ();
+            /// \brief
+            /// Return true if OpenSSL allocations are being counted.
+            /// \return true == OpenSSL allocations are being counted.
+            static bool AreOpenSSLHooksInstalled ();
+
+            /// \struct AllocationTracker::Scope AllocationTracker.h thekogans/crypto/AllocationTracker.h
+            ///
+            /// \brief
+            /// Counts the calling thread's allocations from construction to GetCounters.
+            struct _LIB_THEKOGANS_CRYPTO_DECL Scope {
+            private:
+                /// \brief
+                /// Counters at construction.
+                Counters start;
+
+            public:
+                /// \brief
+                /// ctor.
+                Scope () :
+                    start (GetThreadCounters ()) {}
+
+                /// \brief
+                /// Return the allocations made since construction (or Reset).
+                /// \return Allocations made since construction (or Reset).
+                inline Counters GetCounters () const {
+                    return GetThreadCounters () - start;
+                }
+
+                /// \brief
+                /// Start counting again.
+                inline void Reset () {
+                    start = GetThreadCounters ();
+                }
+
+                /// \brief
+                /// Scope is neither copy constructable, nor assignable.
+                THEKOGANS_CRYPTO_DISALLOW_COPY_AND_ASSIGN (Scope)
+            };
+        };
+
+        /// \def THEKOGANS_CRYPTO_IMPLEMENT_ALLOCATION_TRACKER_GLOBAL_NEW
+        /// Replace the global operator new/delete with versions that
+        /// record every allocation in \see{AllocationTracker} (SOURCE_HEAP).
+        /// Expand it once, at file scope, in the executable (not a library).
+        #define THEKOGANS_CRYPTO_IMPLEMENT_ALLOCATION_TRACKER_GLOBAL_NEW\
+        void *operator new (std::size_t size) {\
+            thekogans::crypto::AllocationTracker::Record (\
+                thekogans::crypto::AllocationTracker::SOURCE_HEAP, size);\
+            void *ptr = malloc (size > 0 ? size : 1);\
+            if (ptr == 0) {\
+                throw std::bad_alloc ();\
+            }\
+            return ptr;\
+        }\
+        void *operator new[] (std::size_t size) {\
+            return operator new (size);\
+        }\
+        void *operator new (\
+                std::size_t size,\
+                const std::nothrow_t &) throw () {\
+            thekogans::crypto::AllocationTracker::Record (\
+                thekogans::crypto::AllocationTracker::SOURCE_HEAP, size);\
+            return malloc (size > 0 ? size : 1);\
+        }\
+        void *operator new[] (\
+                std::size_t size,\
+                const std::nothrow_t &nothrow) throw () {\
+            return operator new (size, nothrow);\
+        }\
+        void operator delete (void *ptr) throw () {\
+            free (ptr);\
+        }\
+        void operator delete[] (void *ptr) throw () {\
+            free (ptr);\
+        }\
+        void operator delete (\
+                void *ptr,\
+                std::size_t) throw () {\
+            free (ptr);\
+        }\
+        void operator delete[] (\
+                void *ptr,\
+                std::size_t) throw () {\
+            free (ptr);\
+        }\
+        void operator delete (\
+                void *ptr,\
+                const std::nothrow_t &) throw () {\
+            free (ptr);\
+        }\
+        void operator delete[] (\
+                void *ptr,\
+                const std::nothrow_t &) throw () {\
+            free (ptr);\
+        }
+
+    } // namespace crypto
+} // namespace thekogans
+
+#endif // !defined (__thekogans_crypto_AllocationTracker_h)
@@ -0,0 +1,255 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined (__thekogans_crypto_Argon2Params_h)
+#define __thekogans_crypto_Argon2Params_h
+
+#if defined (THEKOGANS_CRYPTO_HAVE_ARGON2)
+
+#include <cstddef>
+#include <string>
+#include <argon2.h>
+#include "thekogans/util/Types.h"
+#include "thekogans/util/Serializer.h"
+#include "thekogans/crypto/Config.h"
+#include "thekogans/crypto/Serializable.h"
+#include "thekogans/crypto/SymmetricKey.h"
+#include "thekogans/crypto/OpenSSLUtils.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        /// \struct Argon2Params Argon2Params.h thekogans/crypto/Argon2Params.h
+        ///
+        /// \brief
+        /// Argon2Params packages the Argon2 cost parameters (type, version,
+        /// time and memory cost, lanes and threads) so that they can be chosen
+        /// once (see Calibrate), persisted along side the salt and used to
+        /// reproducibly derive \see{SymmetricKey}s (see DeriveKey) without every
+        /// caller hand filling an argon2_context.
+        ///
+        /// Ex:
+        ///
+        /// \code{.cpp}
+        /// using namespace thekogans;
+        ///
+        /// // Once, at provisioning time (250 ms at 4 threads).
+        /// crypto::Argon2Params::SharedPtr params =
+        ///     crypto::Argon2Params::Calibrate (0.25, 4);
+        /// // Save params (it's a Serializable)...
+        /// ...
+        /// // At login.
+        /// crypto::SymmetricKey::SharedPtr key =
+        ///     params->DeriveKey (password.data (), password.size (), salt.data (), salt.size ());
+        /// \endcode
+
+        struct _LIB_THEKOGANS_CRYPTO_DECL Argon2Params : public Serializable {
+            /// \brief
+            /// Argon2Params is a \see{Serializable}.
+            THEKOGANS_CRYPTO_DECLARE_SERIALIZABLE (Argon2Params)
+
+            enum {
+                /// \brief
+                /// Default number of passes.
+                DEFAULT_TIME_COST = 3,
+                /// \brief
+                /// Default memory cost (in KiB, 64 MiB).
+                DEFAULT_MEMORY_COST = 64 * 1024,
+                /// \brief
+                /// Smallest memory cost Calibrate will consider (in KiB, 8 MiB).
+                MIN_CALIBRATION_MEMORY_COST = 8 * 1024,
+                /// \brief
+                /// Largest memory cost Calibrate will consider by default (in KiB, 1 GiB).
+                MAX_CALIBRATION_MEMORY_COST = 1024 * 1024,
+                /// \brief
+                /// Argon2 requires at least 8 bytes of salt.
+                MIN_SALT_LENGTH = 8
+            };
+
+            /// \brief
+            /// Argon2 variant (Argon2_d, Argon2_i or Argon2_id).
+            util::ui32 type;
+            /// \brief
+            /// Argon2 version (ARGON2_VERSION_NUMBER).
+            util::ui32 version;
+            /// \brief
+            /// Number of passes.
+            util::ui32 timeCost;
+            /// \brief
+            /// Memory cost (in KiB).
+            util::ui32 memoryCost;
+            /// \brief
+            /// Degree of parallelism. Part of the hash; changing
+            /// it changes the derived key.
+            util::ui32 lanes;
+            /// \brief
+            /// Number of threads used to fill the lanes. Doesn't
+            /// affect the derived key, only the time it takes.
+            util::ui32 threads;
+
+            /// \brief
+            /// ctor.
+            /// \param[in] type_ Argon2 variant.
+            /// \param[in] timeCost_ Number of passes.
+            /// \param[in] memoryCost_ Memory cost (in KiB).
+            /// \param[in] lanes_ Degree of parallelism (0 = one per CPU).
+            /// \param[in] threads_ Number of threads (0 = one per lane, up to the CPU count).
+            /// \param[in] id Optional parameters id.
+            /// \param[in] name Optional parameters name.
+            /// \param[in] description Optional parameters description.
+            Argon2Params (
+                argon2_type type_ = Argon2_id,
+                util::ui32 timeCost_ = DEFAULT_TIME_COST,
+                util::ui32 memoryCost_ = DEFAULT_MEMORY_COST,
+                util::ui32 lanes_ = 0,
+                util::ui32 threads_ = 0,
+                const ID &id = ID (),
+                const std::string &name = std::string (),
+                const std::string &description = std::string ());
+
+            /// \brief
+            /// Use the parameters to derive a \see{SymmetricKey} from the given password.
+            /// \param[in] password Password from which to derive the key.
+            /// \param[in] passwordLength Password length.
+            /// \param[in] salt Salt (at least MIN_SALT_LENGTH bytes).
+            /// \param[in] saltLength Salt length.
+            /// \param[in] keyLength Length of the resulting key (in bytes).
+            /// \param[in] keyId Optional key id.
+            /// \param[in] keyName Optional key name.
+            /// \param[in] keyDescription Optional key description.
+            /// \return A new symmetric key.
+            SymmetricKey::SharedPtr DeriveKey (
+                const void *password,
+                std::size_t passwordLength,
+                const void *salt,
+                std::size_t saltLength,
+                std::size_t keyLength = GetCipherKeyLength (),
+                const ID &keyId = ID (),
+                const std::string &keyName = std::string (),
+                const std::string &keyDescription = std::string ()) const;
+
+            /// \brief
+            /// Time one key derivation using these parameters.
+            /// \return Seconds it took to derive a key.
+            util::f64 Measure () const;
+
+            /// \brief
+            /// Benchmark the host and pick the memory and time cost that make
+            /// a key derivation take approximately targetSeconds. Memory is
+            /// grown first (up to maxMemoryCost), followed by the number of passes.
+            /// \param[in] targetSeconds Target key derivation latency.
+            /// \param[in] threads Number of threads (and lanes) to use (0 = one per CPU).
+            /// \param[in] maxMemoryCost Upper bound on memory cost (in KiB).
+            /// \param[in] type Argon2 variant.
+            /// \param[in] id Optional parameters id.
+            /// \param[in] name Optional parameters name.
+            /// \param[in] description Optional parameters description.
+            /// \return Calibrated Argon2Params.
+            static SharedPtr Calibrate (
+                util::f64 targetSeconds = 0.25,
+                util::ui32 threads = 0,
+                util::ui32 maxMemoryCost = MAX_CALIBRATION_MEMORY_COST,
+                argon2_type type = Argon2_id,
+                const ID &id = ID (),
+                const std::string &name = std::string (),
+                const std::string &description = std::string ());
+
+        protected:
+            // Serializable
+            /// \brief
+            /// Return the serialized params size.
+            /// \return Serialized params size.
+            virtual std::size_t Size () const override;
+
+            /// \brief
+            /// Read the params from the given serializer.
+            /// \param[in] header \see{util::Serializable::BinHeader}.
+            /// \param[in] serializer \see{util::Serializer} to read the params from.
+            virtual void Read (
+                const BinHeader &header,
+                util::Serializer &serializer) override;
+            /// \brief
+            /// Write the params to the given serializer.
+            /// \param[out] serializer \see{util::Serializer} to write the params to.
+            virtual void Write (util::Serializer &serializer) const override;
+
+            /// \brief
+            /// "Type"
+            static const char * const ATTR_TYPE;
+            /// \brief
+            /// "Version"
+            static const char * const ATTR_VERSION;
+            /// \brief
+            /// "TimeCost"
+            static const char * const ATTR_TIME_COST;
+            /// \brief
+            /// "MemoryCost"
+            static const char * const ATTR_MEMORY_COST;
+            /// \brief
+            /// "Lanes"
+            static const char * const ATTR_LANES;
+            /// \brief
+            /// "Threads"
+            static const char * const ATTR_THREADS;
+
+            /// \brief
+            /// Read the Serializable from an XML DOM.
+            /// \param[in] header \see{util::Serializable::TextHeader}.
+            /// \param[in] node XML DOM representation of a Serializable.
+            virtual void Read (
+                const TextHeader &header,
+                const pugi::xml_node &node) override;
+            /// \brief
+            /// Write the Serializable to the XML DOM.
+            /// \param[out] node Parent node.
+            virtual void Write (pugi::xml_node &node) const override;
+
+            /// \brief
+            /// Read a Serializable from an JSON DOM.
+            /// \param[in] node JSON DOM representation of a Serializable.
+            virtual void Read (
+                const TextHeader &header,
+                const util::JSON::Object &object) override;
+            /// \brief
+            /// Write a Serializable to the JSON DOM.
+            /// \param[out] node Parent node.
+            virtual void Write (util::JSON::Object &object) const override;
+
+        private:
+            /// \brief
+            /// Throw if the parameters are out of Argon2's range.
+            void Validate () const;
+        };
+
+        /// \brief
+        /// Implement Argon2Params extraction operators.
+        THEKOGANS_UTIL_IMPLEMENT_SERIALIZABLE_EXTRACTION_OPERATORS (Argon2Params)
+
+    } // namespace crypto
+
+    namespace util {
+
+        /// \brief
+        /// Implement Argon2Params value parser.
+        THEKOGANS_UTIL_IMPLEMENT_SERIALIZABLE_VALUE_PARSER (crypto::Argon2Params)
+
+    } // namespace util
+} // namespace thekogans
+
+#endif // defined (THEKOGANS_CRYPTO_HAVE_ARGON2)
+
+#endif // !defined (__thekogans_crypto_Argon2Params_h)
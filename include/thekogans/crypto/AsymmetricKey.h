@@ -72,6 +72,31 @@ namespace thekogans {
             /// \return Key type.
             virtual const char *GetKeyType () const = 0;
 
+            enum {
+                /// \brief
+                /// Max number of distinct key types (\see{InternKeyType}).
+                MAX_KEY_TYPES = 32
+            };
+
+            /// \brief
+            /// Map the given key type to a small integer in [0, MAX_KEY_TYPES)
+            /// suitable for indexing dispatch tables (\see{Signer::Get},
+            /// \see{Verifier::Get}). The same key type always maps to the same
+            /// id. Meant to be called at registration time, or once to
+            /// initialize an id cached by a concrete key (\see{GetKeyTypeId}).
+            /// \param[in] keyType Key type to intern.
+            /// \return Interned key type id.
+            static util::ui32 InternKeyType (const char *keyType);
+
+            /// \brief
+            /// Return the interned (\see{InternKeyType}) key type id.
+            /// NOTE: The default implementation interns GetKeyType () on
+            /// every call. Concrete keys override it to return a cached id.
+            /// \return Interned key type id.
+            virtual util::ui32 GetKeyTypeId () const {
+                return InternKeyType (GetKeyType ());
+            }
+
             /// \brief
             /// Return the key length (in bits).
             /// \return Key length (in bits).
@@ -0,0 +1,699 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+
+#if !defined (__thekogans_crypto_AsyncEngine_h)
+#define __thekogans_crypto_AsyncEngine_h
+
+#include <cstddef>
+#include <string>
+#include <list>
+#include <vector>
+#include "thekogans/util/Types.h"
+#include "thekogans/util/RefCounted.h"
+#include "thekogans/util/Buffer.h"
+#include "thekogans/util/Mutex.h"
+#include "thekogans/util/Condition.h"
+#include "thekogans/util/OwnerVector.h"
+#include "thekogans/crypto/Config.h"
+#include "thekogans/crypto/SymmetricKey.h"
+#include "thekogans/crypto/Cipher.h"
+#include "thekogans/crypto/CipherPool.h"
+#include "thekogans/crypto/Authenticator.h"
+#include "thekogans/crypto/KeyExchange.h"
+#include "thekogans/crypto/Stats.h"
+#include "thekogans/crypto/NUMATopology.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        /// \struct AsyncEngine AsyncEngine.h thekogans/crypto/AsyncEngine.h
+        ///
+        /// \brief
+        /// AsyncEngine runs crypto operations on a pool of worker threads so that
+        /// event loop threads never block on them. Operations are described by
+        /// \see{AsyncEngine::Job} derivatives (\see{AsyncEngine::EncryptJob},
+        /// \see{AsyncEngine::DecryptJob}, \see{AsyncEngine::SignJob},
+        /// \see{AsyncEngine::VerifyJob} and \see{AsyncEngine::DeriveSharedSymmetricKeyJob}).
+        /// Completion is reported through an optional \see{AsyncEngine::Callback}
+        /// (called on the worker thread), or the caller can block on \see{AsyncEngine::Job::Wait}
+        /// (future style).
+        ///
+        /// Symmetric jobs get their \see{Cipher} from a \see{CipherPool}. Adjacent
+        /// small symmetric jobs that share a pool are batched: a worker pulls up to
+        /// maxBatchJobs of them off the queue at once and runs them under a single
+        /// \see{CipherPool::Lease}.
+        ///
+        /// Hardware offload: with an accelerator engine installed (\see{OpenSSLInit::SetEngine},
+        /// \see{CipherSuite::SetEngine}) that supports OpenSSL async jobs (QAT...),
+        /// pass maxInFlightJobs > 0. Each worker then runs its batches as OpenSSL
+        /// async jobs (ASYNC_start_job). When the engine pauses a job (the request
+        /// was handed to the device) the worker moves on to the next batch, keeping
+        /// up to maxInFlightJobs of them outstanding, and resumes them as their
+        /// wait fds become readable. If the device is saturated (all slots busy
+        /// and no progress, or OpenSSL is out of async jobs) the worker runs the
+        /// next batch synchronously inside an \see{OpenSSLInit::SoftwareScope}.
+        ///
+        /// NUMA: pass numaAware = true to give every \see{NUMATopology} node
+        /// it's own job queue and pin each worker to a node (round robin).
+        /// Jobs go to the queue of the node that owns their input (by default
+        /// the node of the enqueuing thread, which is where the job copied it).
+        /// Workers drain their own node's queue first and only then steal from
+        /// the others. \see{AsyncEngine::GetNodeStats} reports per node throughput.
+        ///
+        /// VERY IMPORTANT: \see{Authenticator} and \see{KeyExchange} are not thread
+        /// safe. Don't have more than one job in flight per instance.
+        ///
+        /// Ex:
+        ///
+        /// \code{.cpp}
+        /// using namespace thekogans;
+        ///
+        /// crypto::AsyncEngine engine;
+        /// crypto::AsyncEngine::EncryptJob::SharedPtr job (
+        ///     new crypto::AsyncEngine::EncryptJob (cipherPool, plaintext, plaintextLength));
+        /// engine.Enqueue (job);
+        /// ...
+        /// job->Wait ();
+        /// if (!job->Failed ()) {
+        ///     // job->GetCiphertext ()
+        /// }
+        /// \endcode
+
+        struct _LIB_THEKOGANS_CRYPTO_DECL AsyncEngine : public virtual util::RefCounted {
+            /// \brief
+            /// Declare \see{util::RefCounted} pointers.
+            THEKOGANS_UTIL_DECLARE_REF_COUNTED_POINTERS (AsyncEngine)
+
+            /// \enum
+            /// AsyncEngine constants.
+            enum {
+                /// \brief
+                /// Default max number of symmetric jobs run under one lease.
+                DEFAULT_MAX_BATCH_JOBS = 32,
+                /// \brief
+                /// Default max input length of a batchable symmetric job.
+                DEFAULT_SMALL_JOB_LENGTH = 4096,
+                /// \brief
+                /// How long (in milliseconds) a worker with jobs in flight waits
+                /// on their wait fds before checking the queue again.
+                OFFLOAD_POLL_TIMEOUT = 1
+            };
+
+            struct Job;
+
+            /// \struct AsyncEngine::Callback AsyncEngine.h thekogans/crypto/AsyncEngine.h
+            ///
+            /// \brief
+            /// Implement this interface to be notified when a job completes.
+            struct _LIB_THEKOGANS_CRYPTO_DECL Callback : public virtual util::RefCounted {
+                /// \brief
+                /// Declare \see{util::RefCounted} pointers.
+                THEKOGANS_UTIL_DECLARE_REF_COUNTED_POINTERS (Callback)
+
+                /// \brief
+                /// dtor.
+                virtual ~Callback () {}
+
+                /// \brief
+                /// Called on a worker thread when a job completes (or fails).
+                /// \param[in] job Completed job.
+                virtual void OnJobCompleted (Job & /*job*/) throw () = 0;
+            };
+
+            /// \struct AsyncEngine::Job AsyncEngine.h thekogans/crypto/AsyncEngine.h
+            ///
+            /// \brief
+            /// Base class for all operation descriptors.
+            struct _LIB_THEKOGANS_CRYPTO_DECL Job : public virtual util::RefCounted {
+                /// \brief
+                /// Declare \see{util::RefCounted} pointers.
+                THEKOGANS_UTIL_DECLARE_REF_COUNTED_POINTERS (Job)
+
+            private:
+                /// \brief
+                /// Optional completion callback.
+                Callback::SharedPtr callback;
+                /// \brief
+                /// Error (empty == success).
+                std::string error;
+                /// \brief
+                /// Time the job was enqueued (\see{util::HRTimer::Click}).
+                util::ui64 enqueueTime;
+                /// \brief
+                /// Queue (node) the job was enqueued on.
+                std::size_t node;
+                /// \brief
+                /// Node of the worker that ran the job
+                /// (\see{NUMATopology::NO_NODE} == not run).
+                int workerNode;
+                /// \brief
+                /// true == job has completed.
+                bool completed;
+                /// \brief
+                /// Synchronization mutex.
+                util::Mutex mutex;
+                /// \brief
+                /// Signaled when the job completes.
+                util::Condition completedCondition;
+
+            public:
+                /// \brief
+                /// ctor.
+                /// \param[in] callback_ Optional completion callback.
+                explicit Job (Callback::SharedPtr callback_ = Callback::SharedPtr ());
+                /// \brief
+                /// dtor.
+                virtual ~Job () {}
+
+                /// \brief
+                /// Return true if the job has completed.
+                /// \return true == the job has completed.
+                bool IsCompleted ();
+                /// \brief
+                /// Block until the job completes.
+                void Wait ();
+                /// \brief
+                /// Return true if the job failed (only valid after completion).
+                /// \return true == the job failed.
+                inline bool Failed () const {
+                    return !error.empty ();
+                }
+                /// \brief
+                /// Return the error (only valid after completion).
+                /// \return Error (empty == success).
+                inline const std::string &GetError () const {
+                    return error;
+                }
+
+            protected:
+                /// \brief
+                /// Return the job input length (used for \see{Stats} and batching).
+                /// \return Job input length.
+                virtual std::size_t GetLength () const {
+                    return 0;
+                }
+                /// \brief
+                /// Return the \see{CipherPool} of a symmetric job.
+                /// \return \see{CipherPool} (0 == not a symmetric job).
+                virtual CipherPool *GetCipherPool () const {
+                    return 0;
+                }
+                /// \brief
+                /// Run a non symmetric job.
+                virtual void Execute () {}
+                /// \brief
+                /// Run a symmetric job.
+                /// \param[in] cipher \see{Cipher} leased from GetCipherPool.
+                virtual void Execute (Cipher & /*cipher*/) {}
+
+                /// \brief
+                /// AsyncEngine runs and completes jobs.
+                friend struct AsyncEngine;
+
+                /// \brief
+                /// Job is neither copy constructable, nor assignable.
+                THEKOGANS_CRYPTO_DISALLOW_COPY_AND_ASSIGN (Job)
+            };
+
+            /// \struct AsyncEngine::EncryptJob AsyncEngine.h thekogans/crypto/AsyncEngine.h
+            ///
+            /// \brief
+            /// \see{Cipher::Encrypt} descriptor.
+            struct _LIB_THEKOGANS_CRYPTO_DECL EncryptJob : public Job {
+                /// \brief
+                /// Declare \see{util::RefCounted} pointers.
+                THEKOGANS_UTIL_DECLARE_REF_COUNTED_POINTERS (EncryptJob)
+
+            private:
+                /// \brief
+                /// Where to get the \see{Cipher}.
+                CipherPool::SharedPtr cipherPool;
+                /// \brief
+                /// Plaintext (copied).
+                std::vector<util::ui8> plaintext;
+                /// \brief
+                /// Associated data (copied).
+                std::vector<util::ui8> associatedData;
+                /// \brief
+                /// Result.
+                util::Buffer ciphertext;
+
+            public:
+                /// \brief
+                /// ctor.
+                /// \param[in] cipherPool_ Where to get the \see{Cipher}.
+                /// \param[in] plaintext_ Plaintext to encrypt.
+                /// \param[in] plaintextLength Plaintext length.
+                /// \param[in] associatedData_ Optional associated data (GCM mode only).
+                /// \param[in] associatedDataLength Associated data length.
+                /// \param[in] callback Optional completion callback.
+                EncryptJob (
+                    CipherPool::SharedPtr cipherPool_,
+                    const void *plaintext_,
+                    std::size_t plaintextLength,
+                    const void *associatedData_ = 0,
+                    std::size_t associatedDataLength = 0,
+                    Callback::SharedPtr callback = Callback::SharedPtr ());
+
+                /// \brief
+                /// Return the ciphertext (only valid after successful completion).
+                /// \return Ciphertext.
+                inline util::Buffer &GetCiphertext () {
+                    return ciphertext;
+                }
+
+            protected:
+                // Job
+                /// \brief
+                /// Return the plaintext length.
+                /// \return Plaintext length.
+                virtual std::size_t GetLength () const override {
+                    return plaintext.size ();
+                }
+                /// \brief
+                /// Return the \see{CipherPool}.
+                /// \return \see{CipherPool}.
+                virtual CipherPool *GetCipherPool () const override {
+                    return cipherPool.Get ();
+                }
+                /// \brief
+                /// Encrypt the plaintext.
+                /// \param[in] cipher \see{Cipher} to encrypt with.
+                virtual void Execute (Cipher &cipher) override;
+            };
+
+            /// \struct AsyncEngine::DecryptJob AsyncEngine.h thekogans/crypto/AsyncEngine.h
+            ///
+            /// \brief
+            /// \see{Cipher::Decrypt} descriptor.
+            struct _LIB_THEKOGANS_CRYPTO_DECL DecryptJob : public Job {
+                /// \brief
+                /// Declare \see{util::RefCounted} pointers.
+                THEKOGANS_UTIL_DECLARE_REF_COUNTED_POINTERS (DecryptJob)
+
+            private:
+                /// \brief
+                /// Where to get the \see{Cipher}.
+                CipherPool::SharedPtr cipherPool;
+                /// \brief
+                /// Ciphertext (copied).
+                std::vector<util::ui8> ciphertext;
+                /// \brief
+                /// Associated data (copied).
+                std::vector<util::ui8> associatedData;
+                /// \brief
+                /// true == plaintext goes in to a secure buffer.
+                bool secure;
+                /// \brief
+                /// Result.
+                util::Buffer plaintext;
+
+            public:
+                /// \brief
+                /// ctor.
+                /// \param[in] cipherPool_ Where to get the \see{Cipher}.
+                /// \param[in] ciphertext_ Ciphertext to decrypt.
+                /// \param[in] ciphertextLength Ciphertext length.
+                /// \param[in] associatedData_ Optional associated data (GCM mode only).
+                /// \param[in] associatedDataLength Associated data length.
+                /// \param[in] secure_ true == return the plaintext in a secure buffer.
+                /// \param[in] callback Optional completion callback.
+                DecryptJob (
+                    CipherPool::SharedPtr cipherPool_,
+                    const void *ciphertext_,
+                    std::size_t ciphertextLength,
+                    const void *associatedData_ = 0,
+                    std::size_t associatedDataLength = 0,
+                    bool secure_ = false,
+                    Callback::SharedPtr callback = Callback::SharedPtr ());
+
+                /// \brief
+                /// Return the plaintext (only valid after successful completion).
+                /// \return Plaintext.
+                inline util::Buffer &GetPlaintext () {
+                    return plaintext;
+                }
+
+            protected:
+                // Job
+                /// \brief
+                /// Return the ciphertext length.
+                /// \return Ciphertext length.
+                virtual std::size_t GetLength () const override {
+                    return ciphertext.size ();
+                }
+                /// \brief
+                /// Return the \see{CipherPool}.
+                /// \return \see{CipherPool}.
+                virtual CipherPool *GetCipherPool () const override {
+                    return cipherPool.Get ();
+                }
+                /// \brief
+                /// Decrypt the ciphertext.
+                /// \param[in] cipher \see{Cipher} to decrypt with.
+                virtual void Execute (Cipher &cipher) override;
+            };
+
+            /// \struct AsyncEngine::SignJob AsyncEngine.h thekogans/crypto/AsyncEngine.h
+            ///
+            /// \brief
+            /// \see{Authenticator::SignBuffer} descriptor.
+            struct _LIB_THEKOGANS_CRYPTO_DECL SignJob : public Job {
+                /// \brief
+                /// Declare \see{util::RefCounted} pointers.
+                THEKOGANS_UTIL_DECLARE_REF_COUNTED_POINTERS (SignJob)
+
+            private:
+                /// \brief
+                /// \see{Authenticator} to sign with.
+                Authenticator::SharedPtr authenticator;
+                /// \brief
+                /// Buffer to sign (copied).
+                std::vector<util::ui8> buffer;
+                /// \brief
+                /// Result.
+                util::Buffer signature;
+
+            public:
+                /// \brief
+                /// ctor.
+                /// \param[in] authenticator_ \see{Authenticator} to sign with.
+                /// \param[in] buffer_ Buffer to sign.
+                /// \param[in] bufferLength Buffer length.
+                /// \param[in] callback Optional completion callback.
+                SignJob (
+                    Authenticator::SharedPtr authenticator_,
+                    const void *buffer_,
+                    std::size_t bufferLength,
+                    Callback::SharedPtr callback = Callback::SharedPtr ());
+
+                /// \brief
+                /// Return the signature (only valid after successful completion).
+                /// \return Signature.
+                inline util::Buffer &GetSignature () {
+                    return signature;
+                }
+
+            protected:
+                // Job
+                /// \brief
+                /// Return the buffer length.
+                /// \return Buffer length.
+                virtual std::size_t GetLength () const override {
+                    return buffer.size ();
+                }
+                /// \brief
+                /// Sign the buffer.
+                virtual void Execute () override;
+            };
+
+            /// \struct AsyncEngine::VerifyJob AsyncEngine.h thekogans/crypto/AsyncEngine.h
+            ///
+            /// \brief
+            /// \see{Authenticator::VerifyBufferSignature} descriptor.
+            struct _LIB_THEKOGANS_CRYPTO_DECL VerifyJob : public Job {
+                /// \brief
+                /// Declare \see{util::RefCounted} pointers.
+                THEKOGANS_UTIL_DECLARE_REF_COUNTED_POINTERS (VerifyJob)
+
+            private:
+                /// \brief
+                /// \see{Authenticator} to verify with.
+                Authenticator::SharedPtr authenticator;
+                /// \brief
+                /// Signed buffer (copied).
+                std::vector<util::ui8> buffer;
+                /// \brief
+                /// Signature to verify (copied).
+                std::vector<util::ui8> signature;
+                /// \brief
+                /// Result.
+                bool valid;
+
+            public:
+                /// \brief
+                /// ctor.
+                /// \param[in] authenticator_ \see{Authenticator} to verify with.
+                /// \param[in] buffer_ Signed buffer.
+                /// \param[in] bufferLength Buffer length.
+                /// \param[in] signature_ Signature to verify.
+                /// \param[in] signatureLength Signature length.
+                /// \param[in] callback Optional completion callback.
+                VerifyJob (
+                    Authenticator::SharedPtr authenticator_,
+                    const void *buffer_,
+                    std::size_t bufferLength,
+                    const void *signature_,
+                    std::size_t signatureLength,
+                    Callback::SharedPtr callback = Callback::SharedPtr ());
+
+                /// \brief
+                /// Return true if the signature is valid (only valid after successful completion).
+                /// \return true == valid, false == invalid.
+                inline bool IsValid () const {
+                    return valid;
+                }
+
+            protected:
+                // Job
+                /// \brief
+                /// Return the buffer length.
+                /// \return Buffer length.
+                virtual std::size_t GetLength () const override {
+                    return buffer.size ();
+                }
+                /// \brief
+                /// Verify the signature.
+                virtual void Execute () override;
+            };
+
+            /// \struct AsyncEngine::DeriveSharedSymmetricKeyJob AsyncEngine.h thekogans/crypto/AsyncEngine.h
+            ///
+            /// \brief
+            /// \see{KeyExchange::DeriveSharedSymmetricKey} descriptor.
+            struct _LIB_THEKOGANS_CRYPTO_DECL DeriveSharedSymmetricKeyJob : public Job {
+                /// \brief
+                /// Declare \see{util::RefCounted} pointers.
+                THEKOGANS_UTIL_DECLARE_REF_COUNTED_POINTERS (DeriveSharedSymmetricKeyJob)
+
+            private:
+                /// \brief
+                /// \see{KeyExchange} to derive the key with.
+                KeyExchange::SharedPtr keyExchange;
+                /// \brief
+                /// Peer \see{KeyExchange::Params}.
+                KeyExchange::Params::SharedPtr params;
+                /// \brief
+                /// Result.
+                SymmetricKey::SharedPtr key;
+
+            public:
+                /// \brief
+                /// ctor.
+                /// \param[in] keyExchange_ \see{KeyExchange} to derive the key with.
+                /// \param[in] params_ Peer \see{KeyExchange::Params}.
+                /// \param[in] callback Optional completion callback.
+                DeriveSharedSymmetricKeyJob (
+                    KeyExchange::SharedPtr keyExchange_,
+                    KeyExchange::Params::SharedPtr params_,
+                    Callback::SharedPtr callback = Callback::SharedPtr ());
+
+                /// \brief
+                /// Return the shared key (only valid after successful completion).
+                /// \return Shared \see{SymmetricKey}.
+                inline SymmetricKey::SharedPtr GetKey () const {
+                    return key;
+                }
+
+            protected:
+                // Job
+                /// \brief
+                /// Derive the shared key.
+                virtual void Execute () override;
+            };
+
+        private:
+            /// \brief
+            /// Forward declaration of worker thread.
+            struct Worker;
+            /// \brief
+            /// Max number of symmetric jobs run under one lease.
+            std::size_t maxBatchJobs;
+            /// \brief
+            /// Max input length of a batchable symmetric job.
+            std::size_t smallJobLength;
+            /// \brief
+            /// true == per node queues and node pinned workers.
+            bool numaAware;
+            /// \brief
+            /// Pending jobs (one queue per node if numaAware).
+            std::vector<std::list<Job::SharedPtr>> jobs;
+            /// \brief
+            /// Total number of pending jobs (in all queues).
+            std::size_t jobCount;
+            /// \brief
+            /// High water mark of jobCount.
+            std::size_t maxQueueDepth;
+            /// \brief
+            /// Max number of OpenSSL async jobs in flight per worker
+            /// (0 == run jobs synchronously).
+            std::size_t maxInFlightJobs;
+            /// \brief
+            /// Number of batches (of more than one job) run.
+            util::ui64 batchCount;
+            /// \brief
+            /// Number of batches the engine paused (handed to the device).
+            util::ui64 offloadedBatchCount;
+            /// \brief
+            /// Number of batches run in software because the device was saturated.
+            util::ui64 softwareBatchCount;
+            /// \brief
+            /// Job length and latency (enqueue to completion) statistics.
+            Stats stats;
+            /// \brief
+            /// Per node statistics.
+            std::vector<NUMATopology::NodeStats> nodeStats;
+            /// \brief
+            /// true == the engine is shutting down.
+            bool done;
+            /// \brief
+            /// Synchronization mutex.
+            util::Mutex mutex;
+            /// \brief
+            /// Signaled when jobs are added (or on shutdown).
+            util::Condition jobsCondition;
+            /// \brief
+            /// Worker threads.
+            util::OwnerVector<Worker> workers;
+
+        public:
+            /// \brief
+            /// ctor.
+            /// \param[in] workerCount Number of worker threads (0 == one per cpu).
+            /// \param[in] maxBatchJobs_ Max number of symmetric jobs run under one lease.
+            /// \param[in] smallJobLength_ Max input length of a batchable symmetric job.
+            /// \param[in] maxInFlightJobs_ Max number of OpenSSL async jobs each
+            /// worker keeps in flight (0 == run jobs synchronously). Ignored if
+            /// OpenSSL was built without async support.
+            /// \param[in] numaAware_ true == per node job queues and node
+            /// pinned workers (see \see{NUMATopology}).
+            explicit AsyncEngine (
+                std::size_t workerCount = 0,
+                std::size_t maxBatchJobs_ = DEFAULT_MAX_BATCH_JOBS,
+                std::size_t smallJobLength_ = DEFAULT_SMALL_JOB_LENGTH,
+                std::size_t maxInFlightJobs_ = 0,
+                bool numaAware_ = false);
+            /// \brief
+            /// dtor. Stop the workers. Jobs still in the queue fail.
+            virtual ~AsyncEngine ();
+
+            /// \brief
+            /// Queue a job for execution.
+            /// \param[in] job Job to execute.
+            /// \param[in] node Node whose workers should run the job
+            /// (\see{NUMATopology::NO_NODE} == the node of the calling thread).
+            /// Ignored unless numaAware.
+            void Enqueue (
+                Job::SharedPtr job,
+                int node = NUMATopology::NO_NODE);
+
+            /// \brief
+            /// Return the number of jobs waiting for a worker.
+            /// \return Number of jobs waiting for a worker.
+            std::size_t GetQueueDepth ();
+            /// \brief
+            /// Return the high water mark of the queue depth.
+            /// \return High water mark of the queue depth.
+            std::size_t GetMaxQueueDepth ();
+            /// \brief
+            /// Return the number of batches (of more than one job) run.
+            /// \return Number of batches run.
+            util::ui64 GetBatchCount ();
+            /// \brief
+            /// Return the number of batches the engine paused (offloaded to the device).
+            /// \return Number of offloaded batches.
+            util::ui64 GetOffloadedBatchCount ();
+            /// \brief
+            /// Return the number of batches run in software because the device was saturated.
+            /// \return Number of software fallback batches.
+            util::ui64 GetSoftwareBatchCount ();
+            /// \brief
+            /// Return job length and latency (enqueue to completion) statistics.
+            /// \return Job \see{Stats}.
+            inline const Stats &GetStats () const {
+                return stats;
+            }
+            /// \brief
+            /// Return true if the engine has per node queues and workers.
+            /// \return true == the engine is NUMA aware.
+            inline bool IsNUMAAware () const {
+                return numaAware;
+            }
+            /// \brief
+            /// Return per node worker, job and throughput statistics
+            /// (a single entry unless numaAware).
+            /// \return Per node statistics.
+            std::vector<NUMATopology::NodeStats> GetNodeStats ();
+
+        private:
+            /// \brief
+            /// Called by workers to get the next job (or batch of jobs).
+            /// Jobs come from the worker's node queue first.
+            /// \param[in] node Worker node.
+            /// \param[out] batch Where to put the jobs.
+            /// \param[in] wait true == block until there's a job, false == return
+            /// right away (with an empty batch) if the queue is empty.
+            /// \return false == the engine is shutting down.
+            bool GetJobs (
+                std::size_t node,
+                std::vector<Job::SharedPtr> &batch,
+                bool wait = true);
+            /// \brief
+            /// Add the time a worker spent running jobs to it's node statistics.
+            /// \param[in] node Worker node.
+            /// \param[in] seconds Time spent running jobs.
+            void AddBusyTime (
+                std::size_t node,
+                util::f64 seconds);
+            /// \brief
+            /// Run a batch of jobs.
+            /// \param[in] batch Jobs to run.
+            /// \param[out] errors If not 0, record the job errors here and leave
+            /// the completion to the caller (offloaded batches run on an OpenSSL
+            /// async job stack, too small for callbacks). If 0, complete every
+            /// job as soon as it's run.
+            void ExecuteJobs (
+                std::vector<Job::SharedPtr> &batch,
+                std::vector<std::string> *errors = 0);
+            /// \brief
+            /// Record the job result and notify the waiters.
+            /// \param[in] job Completed job.
+            /// \param[in] error Error (empty == success).
+            void CompleteJob (
+                Job &job,
+                const std::string &error);
+
+            /// \brief
+            /// AsyncEngine is neither copy constructable, nor assignable.
+            THEKOGANS_CRYPTO_DISALLOW_COPY_AND_ASSIGN (AsyncEngine)
+        };
+
+    } // namespace crypto
+} // namespace thekogans
+
+#endif // !defined (__thekogans_crypto_AsyncEngine_h)
@@ -19,13 +19,16 @@
 #define __thekogans_crypto_Authenticator_h
 
 #include <cstddef>
+#include <vector>
 #include "thekogans/util/RefCounted.h"
+#include "thekogans/util/SpinLock.h"
 #include "thekogans/util/Buffer.h"
 #include "thekogans/crypto/Config.h"
 #include "thekogans/crypto/AsymmetricKey.h"
 #include "thekogans/crypto/MessageDigest.h"
 #include "thekogans/crypto/Signer.h"
 #include "thekogans/crypto/Verifier.h"
+#include "thekogans/crypto/FileReader.h"
 
 namespace thekogans {
     namespace crypto {
@@ -40,19 +43,92 @@ namespace thekogans {
         /// as many times as you need and in any order. Authenticator is designed to
         /// be reused. It will reset it's internal state after every sign/verify
         /// operation ready for the next.
+        /// NOTE: Authenticator is thread safe. Every operation leases a
+        /// \see{Signer}/\see{Verifier} from a pool of instances sharing the
+        /// same (read only) \see{AsymmetricKey}, each with it's own
+        /// \see{MessageDigest} context. A new instance is created only if
+        /// all others are busy, so the pool grows to the number of threads
+        /// concurrently using the authenticator. All pooled instances report
+        /// in to the same \see{Stats}.
 
         struct _LIB_THEKOGANS_CRYPTO_DECL Authenticator : public virtual util::RefCounted {
             /// \brief
             /// Declare \see{RefCounted} pointers.
             THEKOGANS_UTIL_DECLARE_REF_COUNTED_POINTERS (Authenticator)
 
+            /// \struct Authenticator::PoolStats Authenticator.h thekogans/crypto/Authenticator.h
+            ///
+            /// \brief
+            /// \see{Signer}/\see{Verifier} pool statistics.
+            struct _LIB_THEKOGANS_CRYPTO_DECL PoolStats {
+                /// \brief
+                /// Number of \see{Signer}/\see{Verifier} instances created.
+                std::size_t instances;
+                /// \brief
+                /// Number of leases granted.
+                util::ui64 leases;
+                /// \brief
+                /// Number of leases that found all instances busy (contention)
+                /// and had to create a new one.
+                util::ui64 misses;
+                /// \brief
+                /// Most leases outstanding at the same time.
+                std::size_t maxConcurrentLeases;
+
+                /// \brief
+                /// ctor.
+                PoolStats () :
+                    instances (0),
+                    leases (0),
+                    misses (0),
+                    maxConcurrentLeases (0) {}
+            };
+
         private:
             /// \brief
-            /// Used if key->IsPrivate ().
+            /// Private (Sign)/Public (Verify) key shared by all pooled instances.
+            AsymmetricKey::SharedPtr key;
+            /// \brief
+            /// Used if key->IsPrivate (). First pooled instance. All others
+            /// are created from it and report in to it's stats.
             Signer::SharedPtr signer;
             /// \brief
-            /// Used if !key->IsPrivate ().
+            /// Used if !key->IsPrivate (). First pooled instance. All others
+            /// are created from it and report in to it's stats.
             Verifier::SharedPtr verifier;
+            /// \brief
+            /// Idle \see{Signer}s.
+            std::vector<Signer::SharedPtr> idleSigners;
+            /// \brief
+            /// Idle \see{Verifier}s.
+            std::vector<Verifier::SharedPtr> idleVerifiers;
+            /// \brief
+            /// \see{VerificationCache} applied to every pooled \see{Verifier}.
+            VerificationCache::SharedPtr verificationCache;
+            /// \brief
+            /// Number of leases currently outstanding.
+            std::size_t activeLeases;
+            /// \brief
+            /// Pool stats.
+            PoolStats poolStats;
+            /// \brief
+            /// Synchronization lock (only held to move instances in and out
+            /// of the pool, never for the duration of an operation).
+            mutable util::SpinLock spinLock;
+
+            /// \brief
+            /// Lease helpers (Authenticator.cpp).
+            struct SignerLease;
+            struct VerifierLease;
+
+            /// \brief
+            /// Account for a new lease. Reserves a new instance if all are
+            /// busy. Must be called with spinLock held.
+            void Lease ();
+            /// \brief
+            /// Account for a returned lease. Must be called with spinLock held.
+            /// \param[in] created false = failed to create the instance reserved by Lease.
+            void Unlease (bool created);
 
         public:
             /// \brief
@@ -67,7 +143,7 @@ namespace thekogans {
             /// Return the key associated with this authenticator.
             /// \return \see{Signer} or \see{Verifier} key (depending on op).
             inline AsymmetricKey::SharedPtr GetKey () const {
-                return signer.Get () != 0 ? signer->GetPrivateKey () : verifier->GetPublicKey ();
+                return key;
             }
             /// \brief
             /// Return the message digest associated with this authenticator.
@@ -75,6 +151,78 @@ namespace thekogans {
             inline MessageDigest::SharedPtr GetMessageDigest () const {
                 return signer.Get () != 0 ? signer->GetMessageDigest () : verifier->GetMessageDigest ();
             }
+            /// \brief
+            /// Return the \see{Signer} (private key) or \see{Verifier}
+            /// (public key) stats.
+            /// \return Reference to stats.
+            inline const Stats &GetStats () const {
+                return signer.Get () != 0 ? signer->GetStats () : verifier->GetStats ();
+            }
+            /// \brief
+            /// Return a snapshot of the \see{Signer}/\see{Verifier} pool stats.
+            /// \return Snapshot of the pool stats.
+            PoolStats GetPoolStats () const;
+
+            /// \brief
+            /// Set the \see{VerificationCache} used by VerifyBufferSignature.
+            /// \param[in] verificationCache \see{VerificationCache} (0 == none).
+            /// NOTE: Only applies to authenticators setup for verify operation.
+            void SetVerificationCache (VerificationCache::SharedPtr verificationCache_);
+
+            /// \struct Authenticator::BatchItem Authenticator.h thekogans/crypto/Authenticator.h
+            ///
+            /// \brief
+            /// One (authenticator, buffer, signature) triple for \see{VerifyBatch}.
+            struct _LIB_THEKOGANS_CRYPTO_DECL BatchItem {
+                /// \brief
+                /// Authenticator setup for verify operation.
+                Authenticator::SharedPtr authenticator;
+                /// \brief
+                /// Buffer whose signature to verify.
+                const void *buffer;
+                /// \brief
+                /// Buffer length.
+                std::size_t bufferLength;
+                /// \brief
+                /// Signature to verify.
+                const void *signature;
+                /// \brief
+                /// Signature length.
+                std::size_t signatureLength;
+
+                /// \brief
+                /// ctor.
+                /// \param[in] authenticator_ Authenticator setup for verify operation.
+                /// \param[in] buffer_ Buffer whose signature to verify.
+                /// \param[in] bufferLength_ Buffer length.
+                /// \param[in] signature_ Signature to verify.
+                /// \param[in] signatureLength_ Signature length.
+                BatchItem (
+                    Authenticator::SharedPtr authenticator_ = Authenticator::SharedPtr (),
+                    const void *buffer_ = 0,
+                    std::size_t bufferLength_ = 0,
+                    const void *signature_ = 0,
+                    std::size_t signatureLength_ = 0) :
+                    authenticator (authenticator_),
+                    buffer (buffer_),
+                    bufferLength (bufferLength_),
+                    signature (signature_),
+                    signatureLength (signatureLength_) {}
+            };
+            /// \brief
+            /// Verify a batch of independent signatures (any mix of key types)
+            /// in parallel. See \see{Verifier::VerifyBatch} for details.
+            /// \param[in] items Items to verify.
+            /// \param[out] results If not 0, receives a per item result.
+            /// \param[in] workerCount Number of threads to use (0 == one per cpu).
+            /// \param[in] stopOnFailure true == stop verifying as soon as one
+            /// signature fails.
+            /// \return true == all signatures match, false == at least one does not.
+            static bool VerifyBatch (
+                const std::vector<BatchItem> &items,
+                std::vector<bool> *results = 0,
+                std::size_t workerCount = 0,
+                bool stopOnFailure = false);
 
             /// \brief
             /// Create a buffer signature.
@@ -100,17 +248,43 @@ namespace thekogans {
             /// \brief
             /// Create a file signature.
             /// \param[in] path File whose signature to create.
+            /// \param[in] map true == memory map the file (see \see{FileReader}).
+            /// \param[in] readBlockSize Read size used if the file is not mapped.
+            /// \return File signature.
+            util::Buffer SignFile (
+                const std::string &path,
+                bool map = true,
+                std::size_t readBlockSize = FileReader::DEFAULT_READ_BLOCK_SIZE);
+            /// \brief
+            /// Create a file signature from an open \see{FileReader}
+            /// (ex: in read ahead mode).
+            /// \param[in] file File whose (remaining) contents to sign.
             /// \return File signature.
-            util::Buffer SignFile (const std::string &path);
+            util::Buffer SignFile (FileReader &file);
             /// \brief
             /// Verify a file signature.
             /// \param[in] path File whose signature to verify.
             /// \param[in] signature Signature to verify.
             /// \param[in] signatureLength Signature length.
+            /// \param[in] map true == memory map the file (see \see{FileReader}).
+            /// \param[in] readBlockSize Read size used if the file is not mapped.
             /// \return true == valid, false == invalid.
             bool VerifyFileSignature (
                 const std::string &path,
                 const void *signature,
+                std::size_t signatureLength,
+                bool map = true,
+                std::size_t readBlockSize = FileReader::DEFAULT_READ_BLOCK_SIZE);
+            /// \brief
+            /// Verify a file signature from an open \see{FileReader}
+            /// (ex: in read ahead mode).
+            /// \param[in] file File whose (remaining) contents to verify.
+            /// \param[in] signature Signature to verify.
+            /// \param[in] signatureLength Signature length.
+            /// \return true == valid, false == invalid.
+            bool VerifyFileSignature (
+                FileReader &file,
+                const void *signature,
                 std::size_t signatureLength);
 
             /// \brief
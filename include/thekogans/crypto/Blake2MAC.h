@@ -0,0 +1,136 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined (__thekogans_crypto_Blake2MAC_h)
+#define __thekogans_crypto_Blake2MAC_h
+
+#if defined (THEKOGANS_CRYPTO_HAVE_BLAKE2)
+
+#include <memory>
+#include <openssl/evp.h>
+#include "thekogans/crypto/Config.h"
+#include "thekogans/crypto/MAC.h"
+#include "thekogans/crypto/SymmetricKey.h"
+#include "thekogans/crypto/OpenSSLUtils.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        /// \struct Blake2MAC Blake2MAC.h thekogans/crypto/Blake2MAC.h
+        ///
+        /// \brief
+        /// Implements the native keyed BLAKE2 MAC (BLAKE2b, BLAKE2bp, BLAKE2s
+        /// and BLAKE2sp). Unlike HMAC, which runs the digest twice over ipad/opad
+        /// blocks, BLAKE2 takes the key as it's first block and MACs in one pass.
+        /// The keyed state is computed once, every MAC operation starts by
+        /// copying it. Keys longer than the variant's max key length (64 bytes
+        /// for BLAKE2b/bp, 32 for BLAKE2s/sp) are hashed down to it first.
+        /// NOTE: The keyed BLAKE2 MAC is not HMAC-BLAKE2. \see{CipherSuite::GetHMAC}
+        /// returns a Blake2MAC for BLAKE2 suites, and signatures produced by
+        /// them will not verify against HMAC-BLAKE2 signatures.
+
+        struct _LIB_THEKOGANS_CRYPTO_DECL Blake2MAC : public MAC {
+        private:
+            /// \brief
+            /// Key used in the MAC operation.
+            SymmetricKey::SharedPtr key;
+            /// \brief
+            /// One of the BLAKE2 EVP_MDs (see Blake2b.h and Blake2s.h).
+            const EVP_MD *md;
+            /// \brief
+            /// Forward declaration of the (blake2.h) state.
+            struct State;
+            /// \brief
+            /// State after absorbing the key.
+            std::unique_ptr<State> keyedState;
+            /// \brief
+            /// State of the current MAC operation.
+            std::unique_ptr<State> state;
+
+        public:
+            /// \brief
+            /// ctor.
+            /// \param[in] key_ Key used in the MAC operation.
+            /// \param[in] md_ One of the BLAKE2 EVP_MDs (see IsBlake2).
+            Blake2MAC (
+                SymmetricKey::SharedPtr key_,
+                const EVP_MD *md_);
+            /// \brief
+            /// dtor.
+            virtual ~Blake2MAC ();
+
+            /// \brief
+            /// Return true if the given message digest is one of the BLAKE2 EVP_MDs.
+            /// \param[in] md OpenSSL message digest object.
+            /// \return true == md is one of the BLAKE2 EVP_MDs.
+            static bool IsBlake2 (const EVP_MD *md);
+
+            /// \brief
+            /// Return the mac key.
+            /// \return MAC \see{SymmetricKey}.
+            inline SymmetricKey::SharedPtr GetKey () const {
+                return key;
+            }
+            /// \brief
+            /// Return the OpenSSL message digest object.
+            /// \return OpenSSL message digest object.
+            inline const EVP_MD *GetMD () const {
+                return md;
+            }
+
+            /// \brief
+            /// Return the MAC type. Blake2MAC is what \see{CipherSuite::GetHMAC}
+            /// returns for BLAKE2 digests.
+            /// \return TYPE_HMAC.
+            virtual Type GetType () const {
+                return TYPE_HMAC;
+            }
+
+            /// \brief
+            /// Return the length of the mac.
+            /// \return Length of the mac.
+            virtual std::size_t GetMACLength () const {
+                return GetMDLength (md);
+            }
+
+            /// \brief
+            /// Initialize the context (ctx) and get it ready for MAC generation.
+            virtual void Init ();
+            /// \brief
+            /// Call this method 1 or more times to generate a MAC.
+            /// \param[in] buffer Buffer whose signature to create.
+            /// \param[in] bufferLength Buffer length.
+            virtual void Update (
+                const void *buffer,
+                std::size_t bufferLength);
+            /// \brief
+            /// Finalize the MAC and return the signature.
+            /// \param[out] signature Where to write the signature.
+            /// \return Number of bytes written to signature.
+            virtual std::size_t Final (util::ui8 *signature);
+
+            /// \brief
+            /// Blake2MAC is neither copy constructable, nor assignable.
+            THEKOGANS_CRYPTO_DISALLOW_COPY_AND_ASSIGN (Blake2MAC)
+        };
+
+    } // namespace crypto
+} // namespace thekogans
+
+#endif // defined (THEKOGANS_CRYPTO_HAVE_BLAKE2)
+
+#endif // !defined (__thekogans_crypto_Blake2MAC_h)
@@ -36,6 +36,9 @@ namespace thekogans {
         /// \brief
         /// Object ID for BLAKE2b 256 bit.
         extern _LIB_THEKOGANS_CRYPTO_DECL const util::i32 NID_blake2b256;
+        /// \brief
+        /// Object ID for BLAKE2bp (4-way parallel) 512 bit.
+        extern _LIB_THEKOGANS_CRYPTO_DECL const util::i32 NID_blake2bp512;
 
         /// \brief
         /// Return the OpenSSL EVP_MD object representing BLAKE2b 512 bit digest.
@@ -46,6 +49,10 @@ namespace thekogans {
         /// \brief
         /// Return the OpenSSL EVP_MD object representing BLAKE2b 256 bit digest.
         _LIB_THEKOGANS_CRYPTO_DECL const EVP_MD * _LIB_THEKOGANS_CRYPTO_API EVP_blake2b256 ();
+        /// \brief
+        /// Return the OpenSSL EVP_MD object representing BLAKE2bp (4-way parallel)
+        /// 512 bit digest. NOTE: BLAKE2bp produces a different digest than BLAKE2b.
+        _LIB_THEKOGANS_CRYPTO_DECL const EVP_MD * _LIB_THEKOGANS_CRYPTO_API EVP_blake2bp512 ();
 
     } // namespace crypto
 } // namespace thekogans
@@ -30,10 +30,17 @@ namespace thekogans {
         /// \brief
         /// Object ID for BLAKE2s 256 bit.
         extern _LIB_THEKOGANS_CRYPTO_DECL const util::i32 NID_blake2s256;
+        /// \brief
+        /// Object ID for BLAKE2sp (8-way parallel) 256 bit.
+        extern _LIB_THEKOGANS_CRYPTO_DECL const util::i32 NID_blake2sp256;
 
         /// \brief
         /// Return the OpenSSL EVP_MD object representing BLAKE2s 256 bit digest.
         _LIB_THEKOGANS_CRYPTO_DECL const EVP_MD * _LIB_THEKOGANS_CRYPTO_API EVP_blake2s256 ();
+        /// \brief
+        /// Return the OpenSSL EVP_MD object representing BLAKE2sp (8-way parallel)
+        /// 256 bit digest. NOTE: BLAKE2sp produces a different digest than BLAKE2s.
+        _LIB_THEKOGANS_CRYPTO_DECL const EVP_MD * _LIB_THEKOGANS_CRYPTO_API EVP_blake2sp256 ();
 
     } // namespace crypto
 } // namespace thekogans
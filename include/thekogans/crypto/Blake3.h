@@ -0,0 +1,258 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined (__thekogans_crypto_Blake3_h)
+#define __thekogans_crypto_Blake3_h
+
+#include <cstddef>
+#include <openssl/evp.h>
+#include "thekogans/util/Types.h"
+#include "thekogans/crypto/Config.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        /// \brief
+        /// Object ID for BLAKE3 256 bit.
+        extern _LIB_THEKOGANS_CRYPTO_DECL const util::i32 NID_blake3_256;
+
+        /// \brief
+        /// Return the OpenSSL EVP_MD object representing BLAKE3 256 bit digest.
+        /// Large updates are hashed on all available cpus (see \see{Blake3}).
+        _LIB_THEKOGANS_CRYPTO_DECL const EVP_MD * _LIB_THEKOGANS_CRYPTO_API EVP_blake3_256 ();
+
+        /// \struct Blake3 Blake3.h thekogans/crypto/Blake3.h
+        ///
+        /// \brief
+        /// Blake3 implements the BLAKE3 hash function in all three of its modes:
+        /// hash, keyed hash (a MAC, used by \see{HMAC}) and derive key (a KDF,
+        /// used by \see{SymmetricKey::FromBlake3}). Final is an XOF, it can
+        /// produce output of any length.
+        ///
+        /// BLAKE3 is a Merkle tree of 1 KB chunks. Whole chunks (and parent
+        /// nodes) are compressed many at a time, one per SIMD lane, with the
+        /// best kernel the cpu supports (SSE4.1: 4, AVX2: 8, AVX-512: 16,
+        /// NEON: 4 lanes). Updates of at least 2 * MIN_PARALLEL_LENGTH bytes are
+        /// also split in to subtrees hashed on up to workerCount threads.
+        /// The digest does not depend on either.
+        ///
+        /// NOTE: Blake3 is the EVP_MD_CTX state of \see{EVP_blake3_256}. It
+        /// has no pointers and must stay trivially copyable, EVP_MD_CTX_copy_ex
+        /// copies it with memcpy.
+        struct _LIB_THEKOGANS_CRYPTO_DECL Blake3 {
+            enum {
+                /// \brief
+                /// Keyed hash key length.
+                KEY_LENGTH = 32,
+                /// \brief
+                /// Default output length.
+                OUT_LENGTH = 32,
+                /// \brief
+                /// Compression function block length.
+                BLOCK_LENGTH = 64,
+                /// \brief
+                /// Tree leaf length.
+                CHUNK_LENGTH = 1024,
+                /// \brief
+                /// Max tree depth (2^64 bytes of input).
+                MAX_DEPTH = 54,
+                /// \brief
+                /// Smallest subtree worth hashing on its own thread.
+                MIN_PARALLEL_LENGTH = 512 * 1024
+            };
+
+            /// \enum
+            /// SIMD kernels.
+            enum Kernel {
+                /// \brief
+                /// Pick the best kernel for this cpu.
+                KERNEL_AUTO,
+                /// \brief
+                /// Portable C++ (1 lane).
+                KERNEL_PORTABLE,
+                /// \brief
+                /// x86 SSE4.1 (4 lanes).
+                KERNEL_SSE41,
+                /// \brief
+                /// ARM NEON (4 lanes).
+                KERNEL_NEON,
+                /// \brief
+                /// x86 AVX2 (8 lanes).
+                KERNEL_AVX2,
+                /// \brief
+                /// x86 AVX-512 (16 lanes).
+                KERNEL_AVX512
+            };
+
+        private:
+            /// \brief
+            /// Key words (IV unless keyed or deriving a key).
+            util::ui32 key[8];
+            /// \brief
+            /// Mode flags (KEYED_HASH, DERIVE_KEY_*).
+            util::ui32 flags;
+            /// \brief
+            /// Chaining value of the current chunk.
+            util::ui32 chunkCV[8];
+            /// \brief
+            /// Index of the current chunk.
+            util::ui64 chunkCounter;
+            /// \brief
+            /// Buffered (not yet compressed) block of the current chunk.
+            util::ui8 block[BLOCK_LENGTH];
+            /// \brief
+            /// Number of bytes in block.
+            util::ui32 blockLength;
+            /// \brief
+            /// Number of blocks of the current chunk already compressed.
+            util::ui32 blocksCompressed;
+            /// \brief
+            /// Chaining values of the completed subtrees.
+            util::ui8 cvStack[(MAX_DEPTH + 1) * OUT_LENGTH];
+            /// \brief
+            /// Number of chaining values in cvStack.
+            util::ui32 cvStackLength;
+            /// \brief
+            /// Max number of threads used by Update (0 == one per cpu).
+            util::ui32 workerCount;
+            /// \brief
+            /// Kernel used to compress many chunks at a time.
+            Kernel kernel;
+
+        public:
+            /// \brief
+            /// ctor. Initialize in hash mode.
+            /// \param[in] workerCount_ Max number of threads used by Update (0 == one per cpu).
+            /// \param[in] kernel_ Kernel used to compress many chunks at a time.
+            explicit Blake3 (
+                std::size_t workerCount_ = 1,
+                Kernel kernel_ = KERNEL_AUTO);
+
+            /// \brief
+            /// Reset the state and (re)initialize in hash mode.
+            void Init ();
+            /// \brief
+            /// Reset the state and (re)initialize in keyed hash mode.
+            /// \param[in] key_ Key.
+            /// \param[in] keyLength Key length (must be KEY_LENGTH).
+            void InitKeyed (
+                const void *key_,
+                std::size_t keyLength);
+            /// \brief
+            /// Reset the state and (re)initialize in derive key mode.
+            /// Follow with Update (key material) and Final (derived key).
+            /// \param[in] context Application specific, hardcoded, globally unique
+            /// context string (ex: "example.com 2019-12-25 16:18:03 session tokens v1").
+            /// \param[in] contextLength Context length.
+            void InitDeriveKey (
+                const void *context,
+                std::size_t contextLength);
+
+            /// \brief
+            /// Hash the given buffer. Call as many times as needed.
+            /// \param[in] buffer Buffer to hash.
+            /// \param[in] length Buffer length.
+            void Update (
+                const void *buffer,
+                std::size_t length);
+            /// \brief
+            /// Produce the output. Final does not change the state. It can be
+            /// called more than once, and Update can continue after it.
+            /// \param[out] out Where to write the output.
+            /// \param[in] outLength Output length (any length).
+            void Final (
+                util::ui8 *out,
+                std::size_t outLength = OUT_LENGTH) const;
+
+            /// \brief
+            /// Return the max number of threads used by Update.
+            /// \return Max number of threads used by Update (0 == one per cpu).
+            inline std::size_t GetWorkerCount () const {
+                return workerCount;
+            }
+            /// \brief
+            /// Set the max number of threads used by Update.
+            /// \param[in] workerCount_ Max number of threads used by Update (0 == one per cpu).
+            inline void SetWorkerCount (std::size_t workerCount_) {
+                workerCount = (util::ui32)workerCount_;
+            }
+
+            /// \brief
+            /// Return the Blake3 state of the given EVP_blake3_256 context.
+            /// Use it to switch an initialized context to keyed hash or derive
+            /// key mode, or to tune its threading.
+            /// \param[in] ctx EVP_MD_CTX initialized with EVP_blake3_256.
+            /// \return Blake3 state of ctx.
+            static Blake3 &FromEVP_MD_CTX (EVP_MD_CTX *ctx);
+
+            /// \brief
+            /// Derive a key (derive key mode in one call).
+            /// \param[in] context Context string (see InitDeriveKey).
+            /// \param[in] contextLength Context length.
+            /// \param[in] keyMaterial Input key material.
+            /// \param[in] keyMaterialLength Input key material length.
+            /// \param[out] key_ Where to write the derived key.
+            /// \param[in] keyLength Derived key length.
+            static void DeriveKey (
+                const void *context,
+                std::size_t contextLength,
+                const void *keyMaterial,
+                std::size_t keyMaterialLength,
+                util::ui8 *key_,
+                std::size_t keyLength);
+
+            /// \brief
+            /// Return true if the given kernel can run on this cpu.
+            /// \param[in] kernel Kernel to check.
+            /// \return true == kernel can run on this cpu.
+            static bool IsKernelSupported (Kernel kernel);
+            /// \brief
+            /// Return the fastest kernel supported by this cpu.
+            /// \return Fastest kernel supported by this cpu.
+            static Kernel GetBestKernel ();
+            /// \brief
+            /// Return the number of chunks the given kernel compresses at a time.
+            /// \param[in] kernel Kernel whose degree to return.
+            /// \return Number of chunks kernel compresses at a time.
+            static std::size_t GetDegree (Kernel kernel = KERNEL_AUTO);
+            /// \brief
+            /// Return the given kernel's name.
+            /// \param[in] kernel Kernel whose name to return.
+            /// \return Kernel name.
+            static const char *KernelToString (Kernel kernel);
+
+        private:
+            /// \brief
+            /// Reset the state keeping the key and mode flags.
+            void Reset ();
+            /// \brief
+            /// Add a (chunk or subtree) chaining value to cvStack.
+            /// \param[in] cv Chaining value to add.
+            /// \param[in] totalChunks Number of chunks hashed before cv's subtree.
+            void PushCV (
+                const util::ui8 *cv,
+                util::ui64 totalChunks);
+            /// \brief
+            /// Merge the completed subtrees at the top of cvStack.
+            /// \param[in] totalChunks Number of chunks hashed so far.
+            void MergeCVStack (util::ui64 totalChunks);
+        };
+
+    } // namespace crypto
+} // namespace thekogans
+
+#endif // !defined (__thekogans_crypto_Blake3_h)
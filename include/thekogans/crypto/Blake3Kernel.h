@@ -0,0 +1,284 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined (__thekogans_crypto_Blake3Kernel_h)
+#define __thekogans_crypto_Blake3Kernel_h
+
+#include <cstddef>
+#include <cstring>
+#include "thekogans/util/Types.h"
+#include "thekogans/crypto/Config.h"
+
+#if defined (__x86_64__) || defined (_M_X64) || defined (__i386__) || defined (_M_IX86)
+    #define THEKOGANS_CRYPTO_BLAKE3_X86
+#elif defined (__ARM_NEON) || defined (__ARM_NEON__) || defined (_M_ARM64)
+    #define THEKOGANS_CRYPTO_BLAKE3_NEON
+#endif // defined (__x86_64__) || defined (_M_X64) || defined (__i386__) || defined (_M_IX86)
+
+// The round function is too big for the compiler to inline on its own,
+// and out of line it spills the whole state (and message) to memory.
+#if defined (_MSC_VER)
+    #define THEKOGANS_CRYPTO_BLAKE3_FORCE_INLINE __forceinline
+#else // defined (_MSC_VER)
+    #define THEKOGANS_CRYPTO_BLAKE3_FORCE_INLINE inline __attribute__ ((always_inline))
+#endif // defined (_MSC_VER)
+
+// NOTE: This header is private to the Blake3*.cpp translation units.
+// Like SHA2MultiBufferKernel.h, each one includes it after switching the
+// target instruction set and instantiates Blake3Kernel with its own
+// (anonymous namespace) Lanes type, so nothing in here may call an inline
+// function or a template that is not parameterized by Lanes.
+
+namespace thekogans {
+    namespace crypto {
+
+        /// \struct Blake3Constants Blake3Kernel.h thekogans/crypto/Blake3Kernel.h
+        ///
+        /// \brief
+        /// BLAKE3 constants (https://github.com/BLAKE3-team/BLAKE3-specs).
+        struct Blake3Constants {
+            enum {
+                ROUNDS = 7,
+                BLOCK_LENGTH = 64,
+                CHUNK_LENGTH = 1024,
+                CHUNK_START = 1 << 0,
+                CHUNK_END = 1 << 1,
+                PARENT = 1 << 2,
+                ROOT = 1 << 3,
+                KEYED_HASH = 1 << 4,
+                DERIVE_KEY_CONTEXT = 1 << 5,
+                DERIVE_KEY_MATERIAL = 1 << 6
+            };
+            /// \brief
+            /// Initialization vector (same as SHA-256).
+            static const util::ui32 IV[8];
+            /// \brief
+            /// Message word order of every round (the
+            /// message permutation applied round times).
+            static const util::ui8 SCHEDULE[ROUNDS][16];
+        };
+
+        /// \struct Blake3Kernel Blake3Kernel.h thekogans/crypto/Blake3Kernel.h
+        ///
+        /// \brief
+        /// Compresses Lanes::COUNT independent inputs (whole chunks or parent
+        /// nodes) at a time, one per lane. This is BLAKE3's hash_many: every
+        /// input is blockCount blocks long and produces a 32 byte chaining value.
+        ///
+        /// Lanes provides:
+        /// typedef Vector; enum {COUNT};
+        /// static Vector Load (const util::ui32 *words); // aligned, COUNT words
+        /// static void Store (util::ui32 *words, Vector v); // aligned, COUNT words
+        /// static Vector Set1 (util::ui32 word);
+        /// static Vector Add (Vector a, Vector b);
+        /// static Vector Xor (Vector a, Vector b);
+        /// static Vector Rotr16/Rotr12/Rotr8/Rotr7 (Vector v);
+        /// // Load (little endian) and transpose one block of every lane,
+        /// // m[i] = word i of all lanes.
+        /// static void LoadMessage (const util::ui8 * const *lanes,
+        ///     std::size_t offset, Vector m[16]);
+        template<typename Lanes>
+        struct Blake3Kernel {
+            typedef typename Lanes::Vector Vector;
+            enum {
+                COUNT = Lanes::COUNT
+            };
+
+            /// \brief
+            /// Compute the chaining values of count inputs.
+            /// \param[in] inputs Inputs to compress (blockCount * 64 bytes each).
+            /// \param[in] count Number of inputs.
+            /// \param[in] blockCount Number of blocks in every input.
+            /// \param[in] key Key words (IV unless keyed).
+            /// \param[in] counter Counter of the first input.
+            /// \param[in] incrementCounter true == input i uses counter + i (chunks),
+            /// false == all inputs use counter (parents).
+            /// \param[in] flags Flags applied to every block.
+            /// \param[in] flagsStart Flags added to the first block of every input.
+            /// \param[in] flagsEnd Flags added to the last block of every input.
+            /// \param[out] out Where to write count * 32 bytes of chaining values.
+            static void HashMany (
+                    const util::ui8 * const *inputs,
+                    std::size_t count,
+                    std::size_t blockCount,
+                    const util::ui32 *key,
+                    util::ui64 counter,
+                    bool incrementCounter,
+                    util::ui32 flags,
+                    util::ui32 flagsStart,
+                    util::ui32 flagsEnd,
+                    util::ui8 *out) {
+                alignas (64) util::ui32 words[8][COUNT];
+                alignas (64) util::ui32 counterLow[COUNT];
+                alignas (64) util::ui32 counterHigh[COUNT];
+                Vector cv[8];
+                for (std::size_t first = 0; first < count; first += COUNT) {
+                    // A partial group keeps all lanes busy by repeating
+                    // its first input. Those results are simply dropped.
+                    std::size_t active = count - first < COUNT ? count - first : (std::size_t)COUNT;
+                    const util::ui8 *lanes[COUNT];
+                    for (std::size_t lane = 0; lane < COUNT; ++lane) {
+                        lanes[lane] = inputs[first + (lane < active ? lane : 0)];
+                        util::ui64 laneCounter = incrementCounter ?
+                            counter + first + (lane < active ? lane : 0) : counter;
+                        counterLow[lane] = (util::ui32)laneCounter;
+                        counterHigh[lane] = (util::ui32)(laneCounter >> 32);
+                    }
+                    for (std::size_t i = 0; i < 8; ++i) {
+                        cv[i] = Lanes::Set1 (key[i]);
+                    }
+                    Vector low = Lanes::Load (counterLow);
+                    Vector high = Lanes::Load (counterHigh);
+                    for (std::size_t block = 0; block < blockCount; ++block) {
+                        Vector m[16];
+                        Lanes::LoadMessage (lanes, block * Blake3Constants::BLOCK_LENGTH, m);
+                        util::ui32 blockFlags = flags |
+                            (block == 0 ? flagsStart : 0) |
+                            (block == blockCount - 1 ? flagsEnd : 0);
+                        Compress (cv, m, low, high, blockFlags);
+                    }
+                    for (std::size_t i = 0; i < 8; ++i) {
+                        Lanes::Store (words[i], cv[i]);
+                    }
+                    for (std::size_t lane = 0; lane < active; ++lane) {
+                        util::ui8 *laneOut = out + (first + lane) * 32;
+                        for (std::size_t i = 0; i < 8; ++i) {
+                            StoreLittleEndian (laneOut + i * 4, words[i][lane]);
+                        }
+                    }
+                }
+            }
+
+        private:
+            static inline void StoreLittleEndian (
+                    util::ui8 *bytes,
+                    util::ui32 word) {
+                bytes[0] = (util::ui8)word;
+                bytes[1] = (util::ui8)(word >> 8);
+                bytes[2] = (util::ui8)(word >> 16);
+                bytes[3] = (util::ui8)(word >> 24);
+            }
+
+            static THEKOGANS_CRYPTO_BLAKE3_FORCE_INLINE void G (
+                    Vector &a,
+                    Vector &b,
+                    Vector &c,
+                    Vector &d,
+                    Vector x,
+                    Vector y) {
+                a = Lanes::Add (Lanes::Add (a, b), x);
+                d = Lanes::Rotr16 (Lanes::Xor (d, a));
+                c = Lanes::Add (c, d);
+                b = Lanes::Rotr12 (Lanes::Xor (b, c));
+                a = Lanes::Add (Lanes::Add (a, b), y);
+                d = Lanes::Rotr8 (Lanes::Xor (d, a));
+                c = Lanes::Add (c, d);
+                b = Lanes::Rotr7 (Lanes::Xor (b, c));
+            }
+
+            static THEKOGANS_CRYPTO_BLAKE3_FORCE_INLINE void Round (
+                    Vector v[16],
+                    const Vector w[16]) {
+                G (v[0], v[4], v[8], v[12], w[0], w[1]);
+                G (v[1], v[5], v[9], v[13], w[2], w[3]);
+                G (v[2], v[6], v[10], v[14], w[4], w[5]);
+                G (v[3], v[7], v[11], v[15], w[6], w[7]);
+                G (v[0], v[5], v[10], v[15], w[8], w[9]);
+                G (v[1], v[6], v[11], v[12], w[10], w[11]);
+                G (v[2], v[7], v[8], v[13], w[12], w[13]);
+                G (v[3], v[4], v[9], v[14], w[14], w[15]);
+            }
+
+            static THEKOGANS_CRYPTO_BLAKE3_FORCE_INLINE void Permute (Vector w[16]) {
+                Vector p[16] = {
+                    w[2], w[6], w[3], w[10], w[7], w[0], w[4], w[13],
+                    w[1], w[11], w[12], w[5], w[9], w[14], w[15], w[8]
+                };
+                for (std::size_t i = 0; i < 16; ++i) {
+                    w[i] = p[i];
+                }
+            }
+
+            static THEKOGANS_CRYPTO_BLAKE3_FORCE_INLINE void Compress (
+                    Vector cv[8],
+                    const Vector m[16],
+                    Vector counterLow,
+                    Vector counterHigh,
+                    util::ui32 flags) {
+                Vector v[16] = {
+                    cv[0], cv[1], cv[2], cv[3], cv[4], cv[5], cv[6], cv[7],
+                    Lanes::Set1 (Blake3Constants::IV[0]),
+                    Lanes::Set1 (Blake3Constants::IV[1]),
+                    Lanes::Set1 (Blake3Constants::IV[2]),
+                    Lanes::Set1 (Blake3Constants::IV[3]),
+                    counterLow,
+                    counterHigh,
+                    Lanes::Set1 (Blake3Constants::BLOCK_LENGTH),
+                    Lanes::Set1 (flags)
+                };
+                // Permuting the message words (instead of indexing them
+                // through SCHEDULE) and unrolling the rounds keeps all
+                // the indices constant, so the state and the message can
+                // live in registers.
+                Vector w[16];
+                for (std::size_t i = 0; i < 16; ++i) {
+                    w[i] = m[i];
+                }
+                Round (v, w);
+                Permute (w);
+                Round (v, w);
+                Permute (w);
+                Round (v, w);
+                Permute (w);
+                Round (v, w);
+                Permute (w);
+                Round (v, w);
+                Permute (w);
+                Round (v, w);
+                Permute (w);
+                Round (v, w);
+                for (std::size_t i = 0; i < 8; ++i) {
+                    cv[i] = Lanes::Xor (v[i], v[i + 8]);
+                }
+            }
+        };
+
+    #if defined (THEKOGANS_CRYPTO_BLAKE3_X86)
+        // Entry points of the x86 kernels (each lives in its own
+        // translation unit compiled for the given instruction set).
+        #define THEKOGANS_CRYPTO_DECLARE_BLAKE3_KERNEL(name)\
+            void name (\
+                const util::ui8 * const *inputs,\
+                std::size_t count,\
+                std::size_t blockCount,\
+                const util::ui32 *key,\
+                util::ui64 counter,\
+                bool incrementCounter,\
+                util::ui32 flags,\
+                util::ui32 flagsStart,\
+                util::ui32 flagsEnd,\
+                util::ui8 *out);
+
+        THEKOGANS_CRYPTO_DECLARE_BLAKE3_KERNEL (Blake3HashManySSE41)
+        THEKOGANS_CRYPTO_DECLARE_BLAKE3_KERNEL (Blake3HashManyAVX2)
+        THEKOGANS_CRYPTO_DECLARE_BLAKE3_KERNEL (Blake3HashManyAVX512)
+    #endif // defined (THEKOGANS_CRYPTO_BLAKE3_X86)
+
+    } // namespace crypto
+} // namespace thekogans
+
+#endif // !defined (__thekogans_crypto_Blake3Kernel_h)
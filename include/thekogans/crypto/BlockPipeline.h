@@ -0,0 +1,291 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined (__thekogans_crypto_BlockPipeline_h)
+#define __thekogans_crypto_BlockPipeline_h
+
+#include <cstddef>
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+#include "thekogans/util/Types.h"
+#include "thekogans/util/RefCounted.h"
+#include "thekogans/util/Buffer.h"
+#include "thekogans/util/Mutex.h"
+#include "thekogans/util/Condition.h"
+#include "thekogans/util/OwnerVector.h"
+#include "thekogans/crypto/Config.h"
+#include "thekogans/crypto/ID.h"
+#include "thekogans/crypto/SymmetricKey.h"
+#include "thekogans/crypto/NUMATopology.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        /// \struct BlockPipeline BlockPipeline.h thekogans/crypto/BlockPipeline.h
+        ///
+        /// \brief
+        /// BlockPipeline is a low level building block used by \see{FileEncryptor}
+        /// and \see{FileDecryptor} (and available to anyone who needs to transform
+        /// a sequential stream of independent blocks in parallel). Blocks are read
+        /// (ReadBlock) and written (WriteBlock) sequentially on the thread calling
+        /// Run, while ProcessBlock is called on a pool of worker threads. A reorder
+        /// buffer guarantees that blocks are written in the same order they were
+        /// read, no matter in which order the workers finish them. At most
+        /// maxPendingBlocks are in flight at any given time, bounding memory use.
+        ///
+        /// NUMA (see SetNUMAAware): the workers are spread over the \see{NUMATopology}
+        /// nodes (and pinned to their node's cpus), and every node gets it's own
+        /// pending queue. Blocks are queued on the node that owns their input
+        /// buffer (ReadBlock implementations call PlaceBlock to spread the blocks
+        /// over the nodes before filling them in). Workers only take blocks from
+        /// another node's queue when their own is empty. Per node throughput is
+        /// reported by GetNodeStats.
+
+        struct _LIB_THEKOGANS_CRYPTO_DECL BlockPipeline {
+            /// \struct BlockPipeline::Block BlockPipeline.h thekogans/crypto/BlockPipeline.h
+            ///
+            /// \brief
+            /// A unit of work flowing through the pipeline.
+            struct _LIB_THEKOGANS_CRYPTO_DECL Block : public virtual util::RefCounted {
+                /// \brief
+                /// Declare \see{RefCounted} pointers.
+                THEKOGANS_UTIL_DECLARE_REF_COUNTED_POINTERS (Block)
+
+                /// \brief
+                /// Block sequence number (assigned by the pipeline).
+                util::ui64 sequenceNumber;
+                /// \brief
+                /// Block input (filled in by ReadBlock).
+                util::Buffer input;
+                /// \brief
+                /// Block output (filled in by ProcessBlock).
+                util::Buffer output;
+                /// \brief
+                /// Optional per block key.
+                SymmetricKey::SharedPtr key;
+                /// \brief
+                /// Content defined chunk id (\see{FileEncryptor}).
+                ID chunkId;
+                /// \brief
+                /// Node whose workers should process the block
+                /// (NUMATopology::NO_NODE == the node owning the input).
+                int node;
+                /// \brief
+                /// If ProcessBlock throws, the exception report is stored here
+                /// and rethrown on the Run thread when the block's turn to be
+                /// written comes up.
+                std::string error;
+
+                /// \brief
+                /// ctor.
+                /// \param[in] inputLength Length of input buffer.
+                /// \param[in] outputLength Length of output buffer.
+                Block (
+                    std::size_t inputLength,
+                    std::size_t outputLength) :
+                    sequenceNumber (0),
+                    input (util::NetworkEndian, inputLength),
+                    output (util::NetworkEndian, outputLength),
+                    chunkId (ID::Empty),
+                    node (NUMATopology::NO_NODE) {}
+                /// \brief
+                /// dtor.
+                virtual ~Block () {}
+
+                /// \brief
+                /// Block is neither copy constructable, nor assignable.
+                THEKOGANS_CRYPTO_DISALLOW_COPY_AND_ASSIGN (Block)
+            };
+
+        private:
+            /// \struct BlockPipeline::Worker BlockPipeline.cpp thekogans/crypto/BlockPipeline.cpp
+            ///
+            /// \brief
+            /// Forward declaration of the worker thread.
+            struct Worker;
+            /// \brief
+            /// Number of worker threads.
+            std::size_t workerCount;
+            /// \brief
+            /// Max number of blocks in flight.
+            std::size_t maxPendingBlocks;
+            /// \brief
+            /// Synchronization lock.
+            util::Mutex mutex;
+            /// \brief
+            /// Signalled when blocks are added to pendingBlocks (or when done).
+            util::Condition pendingCondition;
+            /// \brief
+            /// Signalled when blocks are added to processedBlocks.
+            util::Condition processedCondition;
+            /// \brief
+            /// true == NUMA aware worker placement (see SetNUMAAware).
+            bool numaAware;
+            /// \brief
+            /// Blocks waiting to be processed (one queue per node if numaAware).
+            std::vector<std::list<Block::SharedPtr>> pendingBlocks;
+            /// \brief
+            /// Number of blocks in pendingBlocks.
+            std::size_t pendingBlockCount;
+            /// \brief
+            /// Node PlaceBlock assigns the next block to.
+            std::size_t nextNode;
+            /// \brief
+            /// Per node statistics (one entry if !numaAware).
+            std::vector<NUMATopology::NodeStats> nodeStats;
+            /// \brief
+            /// Reorder buffer. Blocks processed, waiting to be written.
+            std::map<util::ui64, Block::SharedPtr> processedBlocks;
+            /// \brief
+            /// Set to true to tell the workers to exit.
+            bool done;
+
+        public:
+            enum {
+                /// \brief
+                /// Default max number of blocks in flight per worker.
+                DEFAULT_PENDING_BLOCKS_PER_WORKER = 2
+            };
+
+            /// \brief
+            /// ctor.
+            /// \param[in] workerCount_ Number of worker threads (0 == one per cpu).
+            /// \param[in] maxPendingBlocks_ Max number of blocks in flight
+            /// (0 == DEFAULT_PENDING_BLOCKS_PER_WORKER * workerCount).
+            BlockPipeline (
+                std::size_t workerCount_ = 0,
+                std::size_t maxPendingBlocks_ = 0);
+            /// \brief
+            /// dtor.
+            virtual ~BlockPipeline () {}
+
+            /// \brief
+            /// Return the number of worker threads.
+            /// \return Number of worker threads.
+            inline std::size_t GetWorkerCount () const {
+                return workerCount;
+            }
+
+            /// \brief
+            /// Return the max number of blocks in flight.
+            /// \return Max number of blocks in flight.
+            inline std::size_t GetMaxPendingBlocks () const {
+                return maxPendingBlocks;
+            }
+
+            /// \brief
+            /// Turn NUMA aware worker placement on or off (see above). Takes
+            /// effect on the next call to Run. Resets the node statistics.
+            /// \param[in] numaAware_ true == place the workers and blocks
+            /// by \see{NUMATopology} node.
+            void SetNUMAAware (bool numaAware_);
+            /// \brief
+            /// Return true if worker placement is NUMA aware.
+            /// \return true == worker placement is NUMA aware.
+            inline bool IsNUMAAware () const {
+                return numaAware;
+            }
+            /// \brief
+            /// Return the node the given worker is pinned to.
+            /// \param[in] workerIndex Index of worker thread [0, GetWorkerCount ()).
+            /// \return Node the given worker is pinned to (0 if !numaAware).
+            std::size_t GetWorkerNode (std::size_t workerIndex) const;
+            /// \brief
+            /// Return the per node statistics (accumulated over all runs).
+            /// \return Per node statistics (one entry if !numaAware).
+            std::vector<NUMATopology::NodeStats> GetNodeStats ();
+
+            /// \brief
+            /// Run the pipeline until ReadBlock returns a null block and
+            /// all blocks read have been written. If a block fails, the
+            /// workers are stopped and an exception is thrown.
+            void Run ();
+
+        protected:
+            /// \brief
+            /// Called sequentially on the Run thread to read the next block.
+            /// \return Next block to process (null Block::SharedPtr == end of input).
+            virtual Block::SharedPtr ReadBlock () = 0;
+            /// \brief
+            /// Called concurrently on the worker threads to process a block.
+            /// \param[in] workerIndex Index of worker thread [0, GetWorkerCount ()).
+            /// Use it to access per worker state without locking.
+            /// \param[in, out] block Block to process.
+            virtual void ProcessBlock (
+                std::size_t workerIndex,
+                Block &block) = 0;
+            /// \brief
+            /// Called sequentially (in read order) on the Run thread to write a processed block.
+            /// \param[in] block Block to write.
+            virtual void WriteBlock (Block &block) = 0;
+
+            /// \brief
+            /// Call from ReadBlock, before filling in the block, to assign it to
+            /// the next node (round robin) and place it's buffers on that node.
+            /// Does nothing if !numaAware.
+            /// \param[in, out] block Block to place.
+            void PlaceBlock (Block &block);
+
+        private:
+            /// \brief
+            /// Called by workers to get the next block to process.
+            /// \param[in] node Worker node (it's queue is checked first).
+            /// \param[out] remote Set to true if the block came from another node's queue.
+            /// \return Next block to process (null == done).
+            Block::SharedPtr GetPendingBlock (
+                std::size_t node,
+                bool &remote);
+            /// \brief
+            /// Called by workers to add a processed block to the reorder buffer.
+            /// \param[in] block Processed block.
+            /// \param[in] node Worker node.
+            /// \param[in] remote true == the block came from another node's queue.
+            /// \param[in] seconds Time spent processing the block.
+            void AddProcessedBlock (
+                Block::SharedPtr block,
+                std::size_t node,
+                bool remote,
+                util::f64 seconds);
+            /// \brief
+            /// Return the queue a block belongs to.
+            /// \param[in] block Block to queue.
+            /// \return Index in to pendingBlocks.
+            std::size_t GetBlockQueue (const Block &block) const;
+            /// \brief
+            /// Size pendingBlocks and nodeStats for the current placement.
+            void ResetNodes ();
+            /// \brief
+            /// Wait for the block with the given sequence number to be processed.
+            /// \param[in] sequenceNumber Sequence number of block to wait for.
+            /// \return The processed block.
+            Block::SharedPtr GetProcessedBlock (util::ui64 sequenceNumber);
+            /// \brief
+            /// Stop the workers and clear the queues.
+            /// \param[in] workers Workers to stop.
+            void StopWorkers (util::OwnerVector<Worker> &workers);
+
+            /// \brief
+            /// BlockPipeline is neither copy constructable, nor assignable.
+            THEKOGANS_CRYPTO_DISALLOW_COPY_AND_ASSIGN (BlockPipeline)
+        };
+
+    } // namespace crypto
+} // namespace thekogans
+
+#endif // !defined (__thekogans_crypto_BlockPipeline_h)
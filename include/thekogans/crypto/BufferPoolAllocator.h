@@ -0,0 +1,192 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+
+#if !defined (__thekogans_crypto_BufferPoolAllocator_h)
+#define __thekogans_crypto_BufferPoolAllocator_h
+
+#include <cstddef>
+#include <vector>
+#include "thekogans/util/Types.h"
+#include "thekogans/util/Allocator.h"
+#include "thekogans/util/SpinLock.h"
+#include "thekogans/crypto/Config.h"
+#include "thekogans/crypto/NUMATopology.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        /// \struct BufferPoolAllocator BufferPoolAllocator.h thekogans/crypto/BufferPoolAllocator.h
+        ///
+        /// \brief
+        /// BufferPoolAllocator is a size class (powers of two, MIN_BLOCK_SIZE to
+        /// MAX_BLOCK_SIZE) caching allocator meant to be passed to the \see{util::Buffer}
+        /// returning convenience APIs (\see{Cipher::Encrypt}, \see{Cipher::Decrypt},
+        /// \see{MAC::SignBuffer}, \see{MessageDigest::HashBuffer}, \see{Signer::Final}...).
+        /// Freed blocks are kept (up to maxBlocksPerClass per class) and handed back out
+        /// by the next Alloc of the same size class, taking the heap (or, for the secure
+        /// variant, \see{util::SecureAllocator}) off the small message path. Blocks
+        /// larger than MAX_BLOCK_SIZE go straight to the underlying allocator.
+        /// The secure variant clears every block before caching it.
+        ///
+        /// NUMA: a node pool (\see{NodeInstance}, or node_ != NO_NODE) places every
+        /// block it gets from the underlying allocator on it's node (see
+        /// \see{NUMATopology::BindMemory}), so that the workers pinned to that node
+        /// never touch remote memory. Use Reserve to fault in (and, for the secure
+        /// variant, lock) a node's working set up front instead of wherever the
+        /// first touch happens.
+        ///
+        /// Ex:
+        ///
+        /// \code{.cpp}
+        /// using namespace thekogans;
+        ///
+        /// util::Buffer ciphertext = cipher.Encrypt (
+        ///     plaintext, plaintextLength, 0, 0,
+        ///     &crypto::BufferPoolAllocator::Instance ());
+        /// util::Buffer plaintext = cipher.Decrypt (
+        ///     ciphertext.GetReadPtr (), ciphertext.GetDataAvailableForReading (), 0, 0,
+        ///     true, util::NetworkEndian, &crypto::BufferPoolAllocator::SecureInstance ());
+        /// \endcode
+
+        struct _LIB_THEKOGANS_CRYPTO_DECL BufferPoolAllocator : public util::Allocator {
+            /// \brief
+            /// BufferPoolAllocator participates in the \see{util::Allocator} dynamic
+            /// discovery and creation.
+            THEKOGANS_UTIL_DECLARE_ALLOCATOR (BufferPoolAllocator)
+
+            /// \enum
+            /// BufferPoolAllocator constants.
+            enum {
+                /// \brief
+                /// Smallest size class.
+                MIN_BLOCK_SIZE = 64,
+                /// \brief
+                /// Largest size class.
+                MAX_BLOCK_SIZE = 64 * 1024,
+                /// \brief
+                /// Number of size classes.
+                SIZE_CLASS_COUNT = 11,
+                /// \brief
+                /// Default max number of cached blocks per size class.
+                DEFAULT_MAX_BLOCKS_PER_CLASS = 64
+            };
+
+        private:
+            /// \brief
+            /// Underlying allocator.
+            util::Allocator &allocator;
+            /// \brief
+            /// true = clear blocks before caching them.
+            bool secure;
+            /// \brief
+            /// Max number of cached blocks per size class.
+            std::size_t maxBlocksPerClass;
+            /// \brief
+            /// Node to place the blocks on (NUMATopology::NO_NODE == don't place them).
+            int node;
+            /// \brief
+            /// Cached blocks, one list per size class.
+            std::vector<void *> freeBlocks[SIZE_CLASS_COUNT];
+            /// \brief
+            /// Synchronization lock.
+            util::SpinLock spinLock;
+
+        public:
+            /// \brief
+            /// Global (heap backed) BufferPoolAllocator.
+            static BufferPoolAllocator &Instance ();
+            /// \brief
+            /// Global (\see{util::SecureAllocator} backed) BufferPoolAllocator.
+            static BufferPoolAllocator &SecureInstance ();
+            /// \brief
+            /// Global per node BufferPoolAllocator.
+            /// \param[in] node \see{NUMATopology} node (clamped to the node count).
+            /// \param[in] secure true == \see{util::SecureAllocator} backed.
+            static BufferPoolAllocator &NodeInstance (
+                std::size_t node,
+                bool secure = false);
+
+            /// \brief
+            /// ctor.
+            /// \param[in] allocator_ Underlying allocator (0 = \see{util::DefaultAllocator}).
+            /// \param[in] secure_ true = clear blocks before caching them.
+            /// \param[in] maxBlocksPerClass_ Max number of cached blocks per size class.
+            /// \param[in] node_ \see{NUMATopology} node to place the blocks on
+            /// (NUMATopology::NO_NODE == don't place them).
+            BufferPoolAllocator (
+                util::Allocator *allocator_ = 0,
+                bool secure_ = false,
+                std::size_t maxBlocksPerClass_ = DEFAULT_MAX_BLOCKS_PER_CLASS,
+                int node_ = NUMATopology::NO_NODE);
+            /// \brief
+            /// dtor. Return all cached blocks to the underlying allocator.
+            virtual ~BufferPoolAllocator ();
+
+            /// \brief
+            /// Allocate a block.
+            /// NOTE: Allocator policy is to return (void *)0 if size == 0.
+            /// if size > 0 and an error occurs, Allocator will throw an exception.
+            /// \param[in] size Size of block to allocate.
+            /// \return Pointer to the allocated block ((void *)0 if size == 0).
+            virtual void *Alloc (std::size_t size) override;
+            /// \brief
+            /// Free a previously Alloc(ated) block.
+            /// NOTE: Allocator policy is to do nothing if ptr == 0.
+            /// \param[in] ptr Pointer to the block returned by Alloc.
+            /// \param[in] size Same size parameter previously passed in to Alloc.
+            virtual void Free (
+                void *ptr,
+                std::size_t size) override;
+
+            /// \brief
+            /// Return the node the blocks are placed on.
+            /// \return \see{NUMATopology} node (NUMATopology::NO_NODE == not placed).
+            inline int GetNode () const {
+                return node;
+            }
+
+            /// \brief
+            /// Pre allocate (and fault in, on the pool's node) blocks of the given
+            /// size class, so that the first count Allocs of blockSize bytes are
+            /// served locally without touching the underlying allocator.
+            /// \param[in] blockSize Size of blocks to reserve (<= MAX_BLOCK_SIZE).
+            /// \param[in] count Number of blocks to reserve (capped at maxBlocksPerClass).
+            /// \return Number of blocks cached in blockSize's class.
+            std::size_t Reserve (
+                std::size_t blockSize,
+                std::size_t count);
+            /// \brief
+            /// Return all cached blocks to the underlying allocator.
+            void Trim ();
+
+        private:
+            /// \brief
+            /// Allocate a block from the underlying allocator (placing it on node).
+            /// \param[in] size Size of block to allocate.
+            /// \return Pointer to the allocated block.
+            void *AllocBlock (std::size_t size);
+
+            /// \brief
+            /// BufferPoolAllocator is neither copy constructable, nor assignable.
+            THEKOGANS_CRYPTO_DISALLOW_COPY_AND_ASSIGN (BufferPoolAllocator)
+        };
+
+    } // namespace crypto
+} // namespace thekogans
+
+#endif // !defined (__thekogans_crypto_BufferPoolAllocator_h)
@@ -0,0 +1,148 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+
+#if !defined (__thekogans_crypto_BufferedRandomSource_h)
+#define __thekogans_crypto_BufferedRandomSource_h
+
+#include <cstddef>
+#include <openssl/evp.h>
+#include "thekogans/util/Types.h"
+#include "thekogans/crypto/Config.h"
+#include "thekogans/crypto/OpenSSLUtils.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        /// \struct BufferedRandomSource BufferedRandomSource.h thekogans/crypto/BufferedRandomSource.h
+        ///
+        /// \brief
+        /// BufferedRandomSource is a per thread CTR_DRBG style generator (AES-256-CTR
+        /// keystream) seeded from \see{util::GlobalRandomSource}. It produces random
+        /// bytes in large chunks (REFILL_LENGTH) and hands them out from the buffer,
+        /// so that the small requests made on the hot paths (ivs, \see{ID}s, key
+        /// material, salts) don't each pay for a trip to the global random source.
+        /// After every refill the generator is rekeyed from it's own output (so
+        /// compromising it's state does not reveal bytes already handed out), and
+        /// every RESEED_INTERVAL bytes it's reseeded from the global source.
+        /// Use GetThreadInstance to get the calling thread's instance. Instances
+        /// are not shared between threads, so no locking is necessary.
+        /// fork () copies the calling thread's instance in to the child. GetBytes
+        /// notices the pid change, drops the buffered bytes and reseeds, so that
+        /// the parent and the child never hand out the same bytes.
+
+        struct _LIB_THEKOGANS_CRYPTO_DECL BufferedRandomSource {
+            /// \enum
+            /// BufferedRandomSource constants.
+            enum {
+                /// \brief
+                /// Key + iv length.
+                SEED_LENGTH = 32 + 16,
+                /// \brief
+                /// Number of bytes generated per refill.
+                REFILL_LENGTH = 4096,
+                /// \brief
+                /// Reseed from the global source after this many bytes.
+                RESEED_INTERVAL = 1024 * 1024
+            };
+
+            /// \struct BufferedRandomSource::Counters BufferedRandomSource.h
+            /// thekogans/crypto/BufferedRandomSource.h
+            ///
+            /// \brief
+            /// Process wide counters (summed over all threads). Use them
+            /// to monitor the refill rate.
+            struct _LIB_THEKOGANS_CRYPTO_DECL Counters {
+                /// \brief
+                /// Number of refills.
+                util::ui64 refills;
+                /// \brief
+                /// Number of reseeds from \see{util::GlobalRandomSource}.
+                util::ui64 reseeds;
+                /// \brief
+                /// Number of bytes handed out.
+                util::ui64 bytes;
+
+                /// \brief
+                /// ctor.
+                Counters () :
+                    refills (0),
+                    reseeds (0),
+                    bytes (0) {}
+            };
+
+        private:
+            /// \brief
+            /// AES-256-CTR keystream generator.
+            CipherContext context;
+            /// \brief
+            /// Buffered random bytes.
+            util::ui8 buffer[REFILL_LENGTH];
+            /// \brief
+            /// Offset of the next available byte in buffer.
+            std::size_t offset;
+            /// \brief
+            /// Bytes generated since the last reseed.
+            std::size_t bytesSinceReseed;
+            /// \brief
+            /// Id of the process that seeded the keystream.
+            util::ui64 pid;
+
+        public:
+            /// \brief
+            /// ctor. Seed from \see{util::GlobalRandomSource}.
+            BufferedRandomSource ();
+            /// \brief
+            /// dtor. Clear the buffer.
+            ~BufferedRandomSource ();
+
+            /// \brief
+            /// Return the calling thread's instance.
+            /// \return The calling thread's instance.
+            static BufferedRandomSource &GetThreadInstance ();
+
+            /// \brief
+            /// Return a snapshot of the process wide counters.
+            /// \return Snapshot of the process wide counters.
+            static Counters GetCounters ();
+
+            /// \brief
+            /// Fill the given buffer with random bytes.
+            /// \param[out] bytes Where to put the random bytes.
+            /// \param[in] count Number of bytes to return.
+            /// \return Number of bytes returned (count).
+            std::size_t GetBytes (
+                void *bytes,
+                std::size_t count);
+
+        private:
+            /// \brief
+            /// (Re)seed the keystream with bytes from \see{util::GlobalRandomSource}.
+            void Reseed ();
+            /// \brief
+            /// Generate REFILL_LENGTH bytes and rekey from them.
+            void Refill ();
+
+            /// \brief
+            /// BufferedRandomSource is neither copy constructable, nor assignable.
+            THEKOGANS_CRYPTO_DISALLOW_COPY_AND_ASSIGN (BufferedRandomSource)
+        };
+
+    } // namespace crypto
+} // namespace thekogans
+
+#endif // !defined (__thekogans_crypto_BufferedRandomSource_h)
@@ -66,6 +66,13 @@ namespace thekogans {
                 return cipher;
             }
 
+            /// \brief
+            /// Return the MAC type.
+            /// \return TYPE_CMAC.
+            virtual Type GetType () const {
+                return TYPE_CMAC;
+            }
+
             /// \brief
             /// Return the length of the mac.
             /// \return Length of the mac.
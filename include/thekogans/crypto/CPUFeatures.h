@@ -0,0 +1,140 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+
+#if !defined (__thekogans_crypto_CPUFeatures_h)
+#define __thekogans_crypto_CPUFeatures_h
+
+#include <string>
+#include "thekogans/crypto/Config.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        /// \struct CPUFeatures CPUFeatures.h thekogans/crypto/CPUFeatures.h
+        ///
+        /// \brief
+        /// CPUFeatures reports the instruction set extensions OpenSSL's accelerated
+        /// code paths depend on. On x86 the features are read back from OpenSSL's own
+        /// capability vector (OPENSSL_ia32cap_loc), so features masked off with the
+        /// OPENSSL_ia32cap environment variable are reported as absent; i.e. the
+        /// report reflects what OpenSSL will actually use. On ARMv8 the features come
+        /// from the OS (AT_HWCAP on Linux; always present on Apple Silicon).
+        ///
+        /// \see{OpenSSLInit} logs the report (ToString) at startup and \see{CipherSuite}
+        /// uses it to rank cipher suites (\see{CipherSuite::GetRankedCipherSuites}).
+
+        struct _LIB_THEKOGANS_CRYPTO_DECL CPUFeatures {
+            /// \brief
+            /// CPU architecture ("x86_64", "i386", "aarch64", "arm" or "unknown").
+            std::string architecture;
+            /// \brief
+            /// x86 AES-NI.
+            bool aesni;
+            /// \brief
+            /// x86 PCLMULQDQ (GHASH).
+            bool pclmulqdq;
+            /// \brief
+            /// x86 SSSE3 (vector permutation AES and ChaCha20).
+            bool ssse3;
+            /// \brief
+            /// x86 SSE4.1.
+            bool sse41;
+            /// \brief
+            /// x86 AVX.
+            bool avx;
+            /// \brief
+            /// x86 AVX2.
+            bool avx2;
+            /// \brief
+            /// x86 AVX512F.
+            bool avx512f;
+            /// \brief
+            /// x86 VAES (vector AES).
+            bool vaes;
+            /// \brief
+            /// x86 VPCLMULQDQ (vector carry less multiply).
+            bool vpclmulqdq;
+            /// \brief
+            /// x86 SHA extensions (SHA-1/SHA-256).
+            bool shani;
+            /// \brief
+            /// ARMv8 AES instructions.
+            bool armAES;
+            /// \brief
+            /// ARMv8 polynomial multiply (GHASH).
+            bool armPMULL;
+            /// \brief
+            /// ARMv8 SHA-1 instructions.
+            bool armSHA1;
+            /// \brief
+            /// ARMv8 SHA-256 instructions.
+            bool armSHA256;
+            /// \brief
+            /// ARMv8.2 SHA-512 instructions.
+            bool armSHA512;
+
+            /// \brief
+            /// Return the (lazily detected) features of the current CPU.
+            /// \return Features of the current CPU.
+            static const CPUFeatures &Instance ();
+
+            /// \brief
+            /// Return true if AES runs in hardware.
+            /// \return true == AES runs in hardware.
+            inline bool HasAES () const {
+                return aesni || armAES;
+            }
+            /// \brief
+            /// Return true if GHASH (the GCM MAC) runs in hardware.
+            /// \return true == GHASH runs in hardware.
+            inline bool HasGHASH () const {
+                return pclmulqdq || armPMULL;
+            }
+            /// \brief
+            /// Return true if SHA-256 runs in hardware.
+            /// \return true == SHA-256 runs in hardware.
+            inline bool HasSHA256 () const {
+                return shani || armSHA256;
+            }
+            /// \brief
+            /// Return true if AES-GCM is expected to beat ChaCha20-Poly1305.
+            /// \return true == AES and GHASH both run in hardware.
+            inline bool PreferAESGCM () const {
+                return HasAES () && HasGHASH ();
+            }
+
+            /// \brief
+            /// Return a human readable report of the detected features and
+            /// the code paths OpenSSL will pick for the common algorithms.
+            /// \return Feature report.
+            std::string ToString () const;
+
+        private:
+            /// \brief
+            /// ctor. Detect the features.
+            CPUFeatures ();
+
+            /// \brief
+            /// CPUFeatures is neither copy constructable, nor assignable.
+            THEKOGANS_CRYPTO_DISALLOW_COPY_AND_ASSIGN (CPUFeatures)
+        };
+
+    } // namespace crypto
+} // namespace thekogans
+
+#endif // !defined (__thekogans_crypto_CPUFeatures_h)
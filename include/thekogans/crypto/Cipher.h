@@ -22,11 +22,14 @@
 #include <openssl/evp.h>
 #include "thekogans/util/Types.h"
 #include "thekogans/util/RefCounted.h"
+#include "thekogans/util/Allocator.h"
 #include "thekogans/util/Buffer.h"
 #include "thekogans/crypto/Config.h"
 #include "thekogans/crypto/SymmetricKey.h"
+#include "thekogans/crypto/CipherKeySchedule.h"
 #include "thekogans/crypto/Encryptor.h"
 #include "thekogans/crypto/Decryptor.h"
+#include "thekogans/crypto/Metrics.h"
 #include "thekogans/crypto/MAC.h"
 #include "thekogans/crypto/CiphertextHeader.h"
 #include "thekogans/crypto/FrameHeader.h"
@@ -38,6 +41,7 @@ namespace thekogans {
         ///
         /// \brief
         /// Cipher implements symmetric encryption/decryption using AES (CBC or GCM mode)
+        /// or ChaCha20-Poly1305 (AEAD ciphers are treated just like GCM).
         /// Every encryption operation uses a random iv to thwart BEAST. MACs (CBC mode)
         /// are calculated over ciphertext to avoid the Cryptographic Doom Principle:
         /// https://moxie.org/blog/the-cryptographic-doom-principle/. See the description
@@ -60,6 +64,10 @@ namespace thekogans {
             /// OpenSSL message digest object.
             const EVP_MD *md;
             /// \brief
+            /// Key's shared \see{CipherKeySchedule} (encryptor, decryptor
+            /// and mac are copied from it).
+            CipherKeySchedule::SharedPtr schedule;
+            /// \brief
             /// Encapsulates the encryption operation.
             Encryptor encryptor;
             /// \brief
@@ -68,6 +76,38 @@ namespace thekogans {
             /// \brief
             /// \see{MAC} used to sign ciphertext in CBC mode.
             MAC::SharedPtr mac;
+            /// \brief
+            /// Reports in to key's \see{Metrics::Entry}.
+            Metrics::Handle metrics;
+            /// \brief
+            /// true == EnableOrderedChannel was called.
+            bool orderedChannel;
+            /// \brief
+            /// Ordered channel encrypt direction nonce salt.
+            util::ui8 encryptSalt[EVP_MAX_IV_LENGTH];
+            /// \brief
+            /// Ordered channel decrypt direction nonce salt.
+            util::ui8 decryptSalt[EVP_MAX_IV_LENGTH];
+            /// \brief
+            /// Ordered channel next encrypt sequence number.
+            util::ui64 encryptSequenceNumber;
+            /// \brief
+            /// Ordered channel next decrypt sequence number.
+            util::ui64 decryptSequenceNumber;
+            /// \brief
+            /// Plaintext length at or above which AES-GCM encryption
+            /// is split across threads (0 == always serial).
+            std::size_t parallelThreshold;
+            /// \brief
+            /// Max threads used by parallel encryption (0 == one per cpu).
+            std::size_t parallelWorkerCount;
+            /// \brief
+            /// Ciphertext length at or above which CBC decryption
+            /// is split across threads (0 == always serial).
+            std::size_t parallelDecryptThreshold;
+            /// \brief
+            /// Max threads used by parallel decryption (0 == one per cpu).
+            std::size_t parallelDecryptWorkerCount;
 
         public:
             /// \brief
@@ -75,10 +115,13 @@ namespace thekogans {
             /// \param[in] key_ \see{SymmetricKey} used to encrypt/decrypt.
             /// \param[in] cipher_ OpenSSL EVP_CIPHER.
             /// \param[in] md_ OpenSSL EVP_MD (CBC mode only, ignored in GCM mode).
+            /// \param[in] ivPolicy \see{Encryptor::IVPolicy} (IV_POLICY_COUNTER
+            /// is only valid for AEAD ciphers).
             Cipher (
                 SymmetricKey::SharedPtr key_,
                 const EVP_CIPHER *cipher_ = THEKOGANS_CRYPTO_DEFAULT_CIPHER,
-                const EVP_MD *md_ = THEKOGANS_CRYPTO_DEFAULT_MD);
+                const EVP_MD *md_ = THEKOGANS_CRYPTO_DEFAULT_MD,
+                Encryptor::IVPolicy ivPolicy = Encryptor::IV_POLICY_RANDOM);
 
             enum {
                 /// \brief
@@ -93,7 +136,13 @@ namespace thekogans {
                 /// Maximum plaintext length.
                 MAX_PLAINTEXT_LENGTH =
                     util::UI32_MAX -
-                    MAX_FRAMING_OVERHEAD_LENGTH
+                    MAX_FRAMING_OVERHEAD_LENGTH,
+                /// \brief
+                /// Default EnableParallelEncrypt/EnableParallelDecrypt threshold.
+                DEFAULT_PARALLEL_THRESHOLD = 16 * 1024 * 1024,
+                /// \brief
+                /// Parallel encryption/decryption never gives a thread less than this much data.
+                MIN_PARALLEL_STRIPE_LENGTH = 1024 * 1024
             };
 
             /// \brief
@@ -129,6 +178,14 @@ namespace thekogans {
                 return decryptor.GetStats ();
             }
 
+            /// \brief
+            /// Turn the encryptor and decryptor latency histograms on/off.
+            /// \param[in] enabled true = maintain the latency histograms.
+            inline void EnableStatsLatency (bool enabled) {
+                encryptor.GetStats ().EnableLatency (enabled);
+                decryptor.GetStats ().EnableLatency (enabled);
+            }
+
             /// \brief
             /// Encrypt and mac plaintext. This is the workhorse encryption function
             /// used by others below. It writes the following structure in to ciphertext:
@@ -158,12 +215,15 @@ namespace thekogans {
             /// \param[in] plaintextLength Plaintext length.
             /// \param[in] associatedData Optional associated data (GCM mode only).
             /// \param[in] associatedDataLength Length of optional associated data.
+            /// \param[in] allocator Optional allocator for the returned buffer
+            /// (ex: \see{BufferPoolAllocator}, 0 = heap).
             /// \return An encrypted and mac'ed buffer.
             util::Buffer Encrypt (
                 const void *plaintext,
                 std::size_t plaintextLength,
                 const void *associatedData = 0,
-                std::size_t associatedDataLength = 0);
+                std::size_t associatedDataLength = 0,
+                util::Allocator *allocator = 0);
 
             /// \brief
             /// Encrypt, mac, and enlengthen plaintext. It writes the following structure in to ciphertext:
@@ -196,12 +256,15 @@ namespace thekogans {
             /// \param[in] plaintextLength Plaintext length.
             /// \param[in] associatedData Optional associated data (GCM mode only).
             /// \param[in] associatedDataLength Length of optional associated data.
+            /// \param[in] allocator Optional allocator for the returned buffer
+            /// (ex: \see{BufferPoolAllocator}, 0 = heap).
             /// \return An encrypted, mac'ed and framed buffer.
             util::Buffer EncryptAndEnlengthen (
                 const void *plaintext,
                 std::size_t plaintextLength,
                 const void *associatedData,
-                std::size_t associatedDataLength);
+                std::size_t associatedDataLength,
+                util::Allocator *allocator = 0);
 
             /// \brief
             /// Encrypt, mac, and frame plaintext. It writes the following structure in to ciphertext:
@@ -234,12 +297,243 @@ namespace thekogans {
             /// \param[in] plaintextLength Plaintext length.
             /// \param[in] associatedData Optional associated data (GCM mode only).
             /// \param[in] associatedDataLength Length of optional associated data.
+            /// \param[in] allocator Optional allocator for the returned buffer
+            /// (ex: \see{BufferPoolAllocator}, 0 = heap).
             /// \return An encrypted, mac'ed and framed buffer.
             util::Buffer EncryptAndFrame (
                 const void *plaintext,
                 std::size_t plaintextLength,
                 const void *associatedData = 0,
-                std::size_t associatedDataLength = 0);
+                std::size_t associatedDataLength = 0,
+                util::Allocator *allocator = 0);
+
+            /// \brief
+            /// Encrypt, mac, and compact frame plaintext. Meant for small messages
+            /// where the 44 bytes of \see{FrameHeader} and \see{CiphertextHeader}
+            /// dwarf the payload. The key is identified by a short handle (see
+            /// \see{KeyRing::GetCipherKeyTable}), and the iv and mac lengths are
+            /// implied by the cipher. It writes the following structure in to ciphertext:
+            ///
+            /// |-- \see{CompactFrameHeader} --|--------- ciphertext ---------|
+            /// +------------+-------------------+------+---------------+-------+
+            /// | key handle | ciphertext length |  iv  |  ciphertext   |  mac  |
+            /// +------------+-------------------+------+---------------+-------+
+            /// |   varint   |      varint       | iv + ciphertext + mac length |
+            ///
+            /// \param[in] keyHandle Index of this cipher's key in the peers' key table.
+            /// \param[in] plaintext Plaintext to encrypt.
+            /// \param[in] plaintextLength Plaintext length.
+            /// \param[in] associatedData Optional associated data (GCM mode only).
+            /// \param[in] associatedDataLength Length of optional associated data.
+            /// \param[out] ciphertext Where to write encrypted ciphertext
+            /// (at least GetMaxBufferLength (plaintextLength) bytes).
+            /// \return Number of bytes written to ciphertext.
+            std::size_t EncryptAndFrameCompact (
+                util::ui32 keyHandle,
+                const void *plaintext,
+                std::size_t plaintextLength,
+                const void *associatedData,
+                std::size_t associatedDataLength,
+                util::ui8 *ciphertext);
+            /// \brief
+            /// Encrypt, mac and compact frame plaintext. Allocates a buffer
+            /// and calls EncryptAndFrameCompact above.
+            /// \param[in] keyHandle Index of this cipher's key in the peers' key table.
+            /// \param[in] plaintext Plaintext to encrypt.
+            /// \param[in] plaintextLength Plaintext length.
+            /// \param[in] associatedData Optional associated data (GCM mode only).
+            /// \param[in] associatedDataLength Length of optional associated data.
+            /// \param[in] allocator Optional allocator for the returned buffer
+            /// (ex: \see{BufferPoolAllocator}, 0 = heap).
+            /// \return An encrypted, mac'ed and compact framed buffer.
+            util::Buffer EncryptAndFrameCompact (
+                util::ui32 keyHandle,
+                const void *plaintext,
+                std::size_t plaintextLength,
+                const void *associatedData = 0,
+                std::size_t associatedDataLength = 0,
+                util::Allocator *allocator = 0);
+            /// \brief
+            /// Return the iv + mac length implied by the cipher (everything
+            /// a compact frame's ciphertext length covers besides the ciphertext).
+            /// \return iv + mac length.
+            std::size_t GetCompactOverhead () const;
+            /// \brief
+            /// Check the cheap invariants of a ciphertext header against this
+            /// cipher before any of the payload is read or authenticated:
+            /// \see{CiphertextHeader::IsValid}, the iv and mac (tag) lengths implied
+            /// by the cipher, and (CBC mode) block aligned ciphertext. Use it to
+            /// reject forged frames as soon as their header arrives.
+            /// \param[in] ciphertextHeader \see{CiphertextHeader} to check.
+            /// \param[in] maxPayloadLength Max iv + ciphertext + mac length.
+            /// \return true == the header could have been produced by this cipher.
+            bool IsValidCiphertextHeader (
+                const CiphertextHeader &ciphertextHeader,
+                std::size_t maxPayloadLength) const;
+            /// \brief
+            /// Verify the ciphertext MAC and, if matches, decrypt
+            /// the payload of a compact frame.
+            /// \param[in] ciphertext IV, ciphertext and MAC following a \see{CompactFrameHeader}.
+            /// \param[in] ciphertextLength \see{CompactFrameHeader::ciphertextLength}.
+            /// \param[in] associatedData Optional associated data (GCM mode only).
+            /// \param[in] associatedDataLength Length of optional associated data.
+            /// \param[out] plaintext Where to write the decrypted plain text.
+            /// \return Number of bytes written to plaintext.
+            std::size_t DecryptCompact (
+                const void *ciphertext,
+                std::size_t ciphertextLength,
+                const void *associatedData,
+                std::size_t associatedDataLength,
+                util::ui8 *plaintext);
+
+            /// \brief
+            /// Split the encryption of large (threshold bytes or more) plaintexts
+            /// across threads. AES-GCM only. Each thread runs the CTR keystream
+            /// and GHASH over it's own stripe of the message, and the partial
+            /// hashes are combined with powers of H. The output is byte for byte
+            /// what the serial path produces, so receivers are unaffected. Meant
+            /// for single large objects (snapshots, uploads). Applies to every
+            /// api that writes an iv (Encrypt, EncryptAndFrame, EncryptAndEnlengthen,
+            /// EncryptInPlace, EncryptBatch).
+            /// \param[in] threshold Plaintext length at or above which to go
+            /// parallel (0 == always serial).
+            /// \param[in] workerCount Max threads to use (0 == one per cpu).
+            void EnableParallelEncrypt (
+                std::size_t threshold = DEFAULT_PARALLEL_THRESHOLD,
+                std::size_t workerCount = 0);
+            /// \brief
+            /// Return the plaintext length at or above which encryption goes parallel.
+            /// \return Parallel encryption threshold (0 == always serial).
+            inline std::size_t GetParallelThreshold () const {
+                return parallelThreshold;
+            }
+            /// \brief
+            /// Split the decryption of large (threshold bytes or more) CBC
+            /// ciphertexts across threads. CBC decryption only needs the
+            /// previous ciphertext block, so each thread decrypts it's own
+            /// stripe while another verifies the MAC over the whole frame.
+            /// Plaintext is only returned after the MAC passes. If it fails,
+            /// whatever was decrypted is wiped before the exception is thrown.
+            /// Applies to the contiguous Decrypt and DecryptCompact (in place
+            /// and scatter-gather decryption stay serial).
+            /// \param[in] threshold Ciphertext length at or above which to go
+            /// parallel (0 == always serial).
+            /// \param[in] workerCount Max threads to use, MAC included (0 == one per cpu).
+            void EnableParallelDecrypt (
+                std::size_t threshold = DEFAULT_PARALLEL_THRESHOLD,
+                std::size_t workerCount = 0);
+            /// \brief
+            /// Return the ciphertext length at or above which decryption goes parallel.
+            /// \return Parallel decryption threshold (0 == always serial).
+            inline std::size_t GetParallelDecryptThreshold () const {
+                return parallelDecryptThreshold;
+            }
+
+            /// \brief
+            /// Put the cipher in ordered channel mode. Meant for ordered, reliable
+            /// transports (TCP, log segments...). Like TLS 1.3, the iv is never
+            /// transmitted. Both ends derive it from a per direction salt and a
+            /// 64 bit sequence number they advance in lock step:
+            ///
+            /// iv = salt ^ (0 || big endian sequence number)
+            ///
+            /// EncryptAndFrameOrdered writes the following structure in to ciphertext:
+            ///
+            /// +-------------------+--------------+-------+
+            /// | ciphertext length |  ciphertext  |  tag  |
+            /// +-------------------+--------------+-------+
+            /// |         4         | ciphertext length    |
+            ///
+            /// Since the ivs are implied, a frame that's dropped, replayed or
+            /// reordered fails tag verification in DecryptOrdered. AEAD ciphers
+            /// only (CBC requires unpredictable ivs).
+            /// VERY IMPORTANT: The two directions must use different salts (or
+            /// keys). Derive them along with the key (ex: \see{HKDF::Output}
+            /// with a 12 byte length, see \see{KeyExchange::DeriveSharedSymmetricKeys}).
+            /// The peer's encryptSalt is my decryptSalt. Don't mix ordered and
+            /// random iv encryption under the same key.
+            /// VERY IMPORTANT: The sequence numbers live in this Cipher, not the
+            /// key. Use exactly one ordered channel Cipher per key per direction
+            /// and keep it for the life of the channel (a \see{CipherPool} lease
+            /// or a \see{KeyRing::GetCipher} rebuild would restart at 0). This is
+            /// enforced: equal salts, enabling twice, enabling after this Cipher
+            /// has encrypted, or claiming an encrypt salt another Cipher already
+            /// claimed on the same key (\see{SymmetricKey::ClaimOrderedChannelSalt})
+            /// all throw.
+            /// \param[in] encryptSalt_ Salt for frames I send (GetIVLength bytes).
+            /// \param[in] decryptSalt_ Salt for frames I receive (GetIVLength bytes).
+            /// \param[in] saltLength Length of both salts (must be the cipher iv length).
+            void EnableOrderedChannel (
+                const void *encryptSalt_,
+                const void *decryptSalt_,
+                std::size_t saltLength);
+            /// \brief
+            /// Return true if EnableOrderedChannel was called.
+            /// \return true == ordered channel mode.
+            inline bool IsOrderedChannel () const {
+                return orderedChannel;
+            }
+            /// \brief
+            /// Return the sequence number of the next frame EncryptAndFrameOrdered will write.
+            /// \return Next encrypt sequence number.
+            inline util::ui64 GetEncryptSequenceNumber () const {
+                return encryptSequenceNumber;
+            }
+            /// \brief
+            /// Return the sequence number of the next frame DecryptOrdered expects.
+            /// \return Next decrypt sequence number.
+            inline util::ui64 GetDecryptSequenceNumber () const {
+                return decryptSequenceNumber;
+            }
+            /// \brief
+            /// Encrypt and frame plaintext using the next encrypt sequence number
+            /// (see EnableOrderedChannel). No random source is touched.
+            /// \param[in] plaintext Plaintext to encrypt.
+            /// \param[in] plaintextLength Plaintext length.
+            /// \param[in] associatedData Optional associated data.
+            /// \param[in] associatedDataLength Length of optional associated data.
+            /// \param[out] ciphertext Where to write the frame
+            /// (at least GetMaxBufferLength (plaintextLength) bytes).
+            /// \return Number of bytes written to ciphertext.
+            std::size_t EncryptAndFrameOrdered (
+                const void *plaintext,
+                std::size_t plaintextLength,
+                const void *associatedData,
+                std::size_t associatedDataLength,
+                util::ui8 *ciphertext);
+            /// \brief
+            /// Encrypt and frame plaintext using the next encrypt sequence number.
+            /// Allocates a buffer and calls EncryptAndFrameOrdered above.
+            /// \param[in] plaintext Plaintext to encrypt.
+            /// \param[in] plaintextLength Plaintext length.
+            /// \param[in] associatedData Optional associated data.
+            /// \param[in] associatedDataLength Length of optional associated data.
+            /// \param[in] allocator Optional allocator for the returned buffer
+            /// (ex: \see{BufferPoolAllocator}, 0 = heap).
+            /// \return An encrypted and framed buffer.
+            util::Buffer EncryptAndFrameOrdered (
+                const void *plaintext,
+                std::size_t plaintextLength,
+                const void *associatedData = 0,
+                std::size_t associatedDataLength = 0,
+                util::Allocator *allocator = 0);
+            /// \brief
+            /// Verify the tag and, if it matches, decrypt the payload of an ordered
+            /// frame using the next decrypt sequence number. The sequence number
+            /// only advances if the frame verifies, so a frame that arrives out of
+            /// order (or not at all) is rejected (throws).
+            /// \param[in] ciphertext Ciphertext and tag following the ciphertext length.
+            /// \param[in] ciphertextLength Ciphertext length (from the frame).
+            /// \param[in] associatedData Optional associated data.
+            /// \param[in] associatedDataLength Length of optional associated data.
+            /// \param[out] plaintext Where to write the decrypted plain text.
+            /// \return Number of bytes written to plaintext.
+            std::size_t DecryptOrdered (
+                const void *ciphertext,
+                std::size_t ciphertextLength,
+                const void *associatedData,
+                std::size_t associatedDataLength,
+                util::ui8 *plaintext);
 
             /// \brief
             /// Verify the ciphertext MAC and, if matches, decrypt it.
@@ -265,6 +559,8 @@ namespace thekogans {
             /// \param[in] associatedDataLength Length of optional associated data.
             /// \param[in] secure true == return util::SecureBuffer.
             /// \param[in] endianness Resulting plaintext buffer endianness.
+            /// \param[in] allocator Optional allocator for the returned buffer
+            /// (ex: \see{BufferPoolAllocator}, 0 = secure ? util::SecureAllocator : heap).
             /// \return Plaintext.
             util::Buffer Decrypt (
                 const void *ciphertext,
@@ -272,8 +568,390 @@ namespace thekogans {
                 const void *associatedData = 0,
                 std::size_t associatedDataLength = 0,
                 bool secure = false,
-                util::Endianness endianness = util::NetworkEndian);
+                util::Endianness endianness = util::NetworkEndian,
+                util::Allocator *allocator = 0);
+
+            /// \brief
+            /// Return the headroom EncryptInPlace needs in front of the plaintext
+            /// to hold the (optional) \see{FrameHeader}, \see{CiphertextHeader} and iv.
+            /// \param[in] frame true == EncryptInPlace will prepend a \see{FrameHeader}.
+            /// \return Headroom (in bytes).
+            std::size_t GetInPlaceHeadroom (bool frame = false) const;
+            /// \brief
+            /// Return the tailroom EncryptInPlace needs after the plaintext to
+            /// hold the padding (CBC mode) and the mac (or tag in GCM mode).
+            /// \return Tailroom (in bytes).
+            std::size_t GetInPlaceTailroom () const;
+
+            /// \brief
+            /// Encrypt and mac plaintext in place. The plaintext must be placed at
+            /// buffer + GetInPlaceHeadroom (frame) and the buffer must have at least
+            /// GetInPlaceTailroom () bytes after the plaintext. On return buffer contains
+            /// the same structure produced by Encrypt (or EncryptAndFrame if frame == true)
+            /// above, starting at buffer.
+            /// \param[in, out] buffer Buffer containing plaintext (at GetInPlaceHeadroom (frame)).
+            /// \param[in] bufferLength Total buffer length (headroom, plaintext and tailroom).
+            /// \param[in] plaintextLength Plaintext length.
+            /// \param[in] associatedData Optional associated data (GCM mode only).
+            /// \param[in] associatedDataLength Length of optional associated data.
+            /// \param[in] frame true == Prepend a \see{FrameHeader}.
+            /// \return Number of bytes written to buffer.
+            std::size_t EncryptInPlace (
+                util::ui8 *buffer,
+                std::size_t bufferLength,
+                std::size_t plaintextLength,
+                const void *associatedData = 0,
+                std::size_t associatedDataLength = 0,
+                bool frame = false);
+
+            /// \brief
+            /// Verify the ciphertext MAC and, if matches, decrypt it in place.
+            /// No separate plaintext buffer is needed; the plaintext overwrites
+            /// the ciphertext it was decrypted from.
+            /// \param[in, out] ciphertext \see{CiphertextHeader}, IV, ciphertext and
+            /// MAC returned by Encrypt (or EncryptInPlace).
+            /// \param[in] ciphertextLength Length of ciphertext.
+            /// \param[in] associatedData Optional associated data (GCM mode only).
+            /// \param[in] associatedDataLength Length of optional associated data.
+            /// \param[out] plaintext On return points to the plaintext (inside ciphertext).
+            /// \return Plaintext length.
+            std::size_t DecryptInPlace (
+                util::ui8 *ciphertext,
+                std::size_t ciphertextLength,
+                const void *associatedData,
+                std::size_t associatedDataLength,
+                util::ui8 *&plaintext);
+
+            /// \struct Cipher::ConstSegment Cipher.h thekogans/crypto/Cipher.h
+            ///
+            /// \brief
+            /// Describes one read-only segment of a discontiguous (scatter-gather) buffer.
+            struct ConstSegment {
+                /// \brief
+                /// Segment data.
+                const void *buffer;
+                /// \brief
+                /// Segment length.
+                std::size_t length;
+
+                /// \brief
+                /// ctor.
+                /// \param[in] buffer_ Segment data.
+                /// \param[in] length_ Segment length.
+                ConstSegment (
+                    const void *buffer_ = 0,
+                    std::size_t length_ = 0) :
+                    buffer (buffer_),
+                    length (length_) {}
+            };
+
+            /// \struct Cipher::Segment Cipher.h thekogans/crypto/Cipher.h
+            ///
+            /// \brief
+            /// Describes one writable segment of a discontiguous (scatter-gather) buffer.
+            struct Segment {
+                /// \brief
+                /// Segment data.
+                util::ui8 *buffer;
+                /// \brief
+                /// Segment length.
+                std::size_t length;
+
+                /// \brief
+                /// ctor.
+                /// \param[in] buffer_ Segment data.
+                /// \param[in] length_ Segment length.
+                Segment (
+                    util::ui8 *buffer_ = 0,
+                    std::size_t length_ = 0) :
+                    buffer (buffer_),
+                    length (length_) {}
+            };
+
+            /// \brief
+            /// Scatter-gather version of Encrypt. Each plaintext and associated
+            /// data segment is fed directly in to the encryptor (and mac) without
+            /// being staged in a contiguous buffer. The resulting ciphertext has the
+            /// same structure as the one produced by Encrypt above and is written
+            /// across the given ciphertext segments.
+            /// \param[in] plaintext Plaintext segments to encrypt.
+            /// \param[in] plaintextCount Number of plaintext segments.
+            /// \param[in] associatedData Optional associated data segments (GCM mode only).
+            /// \param[in] associatedDataCount Number of associated data segments.
+            /// \param[out] ciphertext Where to write encrypted ciphertext. The combined
+            /// length of all segments must be at least GetMaxBufferLength (plaintextLength).
+            /// \param[in] ciphertextCount Number of ciphertext segments.
+            /// \return Number of bytes written to ciphertext.
+            std::size_t Encrypt (
+                const ConstSegment *plaintext,
+                std::size_t plaintextCount,
+                const ConstSegment *associatedData,
+                std::size_t associatedDataCount,
+                const Segment *ciphertext,
+                std::size_t ciphertextCount);
+            /// \brief
+            /// Scatter-gather version of EncryptAndFrame. See Encrypt above.
+            /// \param[in] plaintext Plaintext segments to encrypt.
+            /// \param[in] plaintextCount Number of plaintext segments.
+            /// \param[in] associatedData Optional associated data segments (GCM mode only).
+            /// \param[in] associatedDataCount Number of associated data segments.
+            /// \param[out] ciphertext Where to write framed ciphertext.
+            /// \param[in] ciphertextCount Number of ciphertext segments.
+            /// \return Number of bytes written to ciphertext.
+            std::size_t EncryptAndFrame (
+                const ConstSegment *plaintext,
+                std::size_t plaintextCount,
+                const ConstSegment *associatedData,
+                std::size_t associatedDataCount,
+                const Segment *ciphertext,
+                std::size_t ciphertextCount);
+            /// \brief
+            /// Scatter-gather version of Decrypt. In CBC mode the mac is verified
+            /// (in place, across segments) before any decryption takes place.
+            /// \param[in] ciphertext Segments containing \see{CiphertextHeader},
+            /// IV, ciphertext and MAC returned by one of the Encrypt above.
+            /// \param[in] ciphertextCount Number of ciphertext segments.
+            /// \param[in] associatedData Optional associated data segments (GCM mode only).
+            /// \param[in] associatedDataCount Number of associated data segments.
+            /// \param[out] plaintext Where to write the decrypted plaintext.
+            /// \param[in] plaintextCount Number of plaintext segments.
+            /// \return Number of bytes written to plaintext.
+            std::size_t Decrypt (
+                const ConstSegment *ciphertext,
+                std::size_t ciphertextCount,
+                const ConstSegment *associatedData,
+                std::size_t associatedDataCount,
+                const Segment *plaintext,
+                std::size_t plaintextCount);
+
+            /// \struct Cipher::EncryptBatchItem Cipher.h thekogans/crypto/Cipher.h
+            ///
+            /// \brief
+            /// Describes one message in a call to EncryptBatch.
+            struct EncryptBatchItem {
+                /// \brief
+                /// Plaintext to encrypt.
+                const void *plaintext;
+                /// \brief
+                /// Plaintext length.
+                std::size_t plaintextLength;
+                /// \brief
+                /// Optional associated data (GCM mode only).
+                const void *associatedData;
+                /// \brief
+                /// Length of optional associated data.
+                std::size_t associatedDataLength;
+                /// \brief
+                /// Where to write encrypted ciphertext (must be at
+                /// least GetMaxBufferLength (plaintextLength) long).
+                util::ui8 *ciphertext;
+                /// \brief
+                /// On return contains the number of bytes written to ciphertext.
+                std::size_t ciphertextLength;
+
+                /// \brief
+                /// ctor.
+                /// \param[in] plaintext_ Plaintext to encrypt.
+                /// \param[in] plaintextLength_ Plaintext length.
+                /// \param[in] associatedData_ Optional associated data (GCM mode only).
+                /// \param[in] associatedDataLength_ Length of optional associated data.
+                /// \param[out] ciphertext_ Where to write encrypted ciphertext.
+                EncryptBatchItem (
+                    const void *plaintext_ = 0,
+                    std::size_t plaintextLength_ = 0,
+                    const void *associatedData_ = 0,
+                    std::size_t associatedDataLength_ = 0,
+                    util::ui8 *ciphertext_ = 0) :
+                    plaintext (plaintext_),
+                    plaintextLength (plaintextLength_),
+                    associatedData (associatedData_),
+                    associatedDataLength (associatedDataLength_),
+                    ciphertext (ciphertext_),
+                    ciphertextLength (0) {}
+            };
+
+            /// \brief
+            /// Encrypt and mac a batch of (usually small) messages in one pass.
+            /// The ivs for the whole batch are generated with a single call to the
+            /// random source (unless the encryptor uses \see{Encryptor::IV_POLICY_COUNTER},
+            /// in which case no random source is needed at all) and the encryptor context
+            /// is reused between messages
+            /// (only the iv is reset). Each item's ciphertext has the same structure
+            /// as produced by Encrypt above.
+            /// \param[in, out] items Messages to encrypt. On return, each
+            /// item's ciphertextLength contains the number of bytes written
+            /// to it's ciphertext.
+            /// \param[in] itemCount Number of items.
+            /// \return Total number of bytes written to all ciphertexts.
+            std::size_t EncryptBatch (
+                EncryptBatchItem *items,
+                std::size_t itemCount);
+
+            /// \struct Cipher::DecryptBatchItem Cipher.h thekogans/crypto/Cipher.h
+            ///
+            /// \brief
+            /// Describes one message in a call to DecryptBatch.
+            struct DecryptBatchItem {
+                /// \brief
+                /// \see{CiphertextHeader}, IV, ciphertext and MAC
+                /// returned by Encrypt or EncryptBatch.
+                const void *ciphertext;
+                /// \brief
+                /// Length of ciphertext.
+                std::size_t ciphertextLength;
+                /// \brief
+                /// Optional associated data (GCM mode only).
+                const void *associatedData;
+                /// \brief
+                /// Length of optional associated data.
+                std::size_t associatedDataLength;
+                /// \brief
+                /// Where to write the decrypted plaintext (must be
+                /// at least ciphertextLength long).
+                util::ui8 *plaintext;
+                /// \brief
+                /// On return contains the number of bytes written to plaintext.
+                std::size_t plaintextLength;
+
+                /// \brief
+                /// ctor.
+                /// \param[in] ciphertext_ Ciphertext to decrypt.
+                /// \param[in] ciphertextLength_ Ciphertext length.
+                /// \param[in] associatedData_ Optional associated data (GCM mode only).
+                /// \param[in] associatedDataLength_ Length of optional associated data.
+                /// \param[out] plaintext_ Where to write the decrypted plaintext.
+                DecryptBatchItem (
+                    const void *ciphertext_ = 0,
+                    std::size_t ciphertextLength_ = 0,
+                    const void *associatedData_ = 0,
+                    std::size_t associatedDataLength_ = 0,
+                    util::ui8 *plaintext_ = 0) :
+                    ciphertext (ciphertext_),
+                    ciphertextLength (ciphertextLength_),
+                    associatedData (associatedData_),
+                    associatedDataLength (associatedDataLength_),
+                    plaintext (plaintext_),
+                    plaintextLength (0) {}
+            };
+
+            /// \brief
+            /// Verify and decrypt a batch of messages in one pass. The decryptor
+            /// context is reused between messages (only the iv is reset).
+            /// NOTE: If any message fails verification an exception is thrown.
+            /// Items preceding the offending one will have been decrypted.
+            /// \param[in, out] items Messages to decrypt. On return, each
+            /// item's plaintextLength contains the number of bytes written
+            /// to it's plaintext.
+            /// \param[in] itemCount Number of items.
+            /// \return Total number of bytes written to all plaintexts.
+            std::size_t DecryptBatch (
+                DecryptBatchItem *items,
+                std::size_t itemCount);
+
+        private:
+            /// \brief
+            /// Forward declaration of scatter-gather helpers.
+            struct SegmentReader;
+            struct SegmentWriter;
+
+            /// \brief
+            /// Helper used by the scatter-gather Encrypt and EncryptAndFrame.
+            /// \param[in] plaintext Plaintext segments to encrypt.
+            /// \param[in] plaintextCount Number of plaintext segments.
+            /// \param[in] associatedData Optional associated data segments (GCM mode only).
+            /// \param[in] associatedDataCount Number of associated data segments.
+            /// \param[in] frame true == Prepend a \see{FrameHeader}.
+            /// \param[out] ciphertext Where to write the ciphertext.
+            /// \return Number of bytes written to ciphertext.
+            std::size_t EncryptSegments (
+                const ConstSegment *plaintext,
+                std::size_t plaintextCount,
+                const ConstSegment *associatedData,
+                std::size_t associatedDataCount,
+                bool frame,
+                SegmentWriter &ciphertext);
+            /// \brief
+            /// Helper used by Encrypt and EncryptBatch. Assumes the encryptor
+            /// has been initialized with the iv found at ciphertext + CiphertextHeader::SIZE.
+            /// \param[in] ivLength Length of iv.
+            /// \param[in] plaintext Plaintext to encrypt.
+            /// \param[in] plaintextLength Plaintext length.
+            /// \param[in] associatedData Optional associated data (GCM mode only).
+            /// \param[in] associatedDataLength Length of optional associated data.
+            /// \param[out] ciphertext Where to write encrypted ciphertext.
+            /// \return Number of bytes written to ciphertext.
+            std::size_t EncryptWithIV (
+                std::size_t ivLength,
+                const void *plaintext,
+                std::size_t plaintextLength,
+                const void *associatedData,
+                std::size_t associatedDataLength,
+                util::ui8 *ciphertext);
+            /// \brief
+            /// Return the number of threads to split the encryption of
+            /// plaintextLength bytes across (see EnableParallelEncrypt).
+            /// \param[in] ivLength Length of the iv.
+            /// \param[in] plaintextLength Length of plaintext to encrypt.
+            /// \return Number of threads (<= 1 == encrypt serially).
+            std::size_t GetParallelWorkerCount (
+                std::size_t ivLength,
+                std::size_t plaintextLength) const;
+            /// \brief
+            /// Helper used by EncryptWithIV to encrypt (AES-GCM) on multiple threads.
+            /// \param[in] iv GCM iv.
+            /// \param[in] workerCount Number of threads to use.
+            /// \param[in] plaintext Plaintext to encrypt.
+            /// \param[in] plaintextLength Plaintext length.
+            /// \param[in] associatedData Optional associated data.
+            /// \param[in] associatedDataLength Length of optional associated data.
+            /// \param[out] ciphertext Where to write the ciphertext followed by the tag.
+            /// \return Tag length.
+            std::size_t EncryptParallel (
+                const util::ui8 *iv,
+                std::size_t workerCount,
+                const void *plaintext,
+                std::size_t plaintextLength,
+                const void *associatedData,
+                std::size_t associatedDataLength,
+                util::ui8 *ciphertext);
+            /// \brief
+            /// Helper used by DecryptWithHeader to decrypt (CBC) on multiple threads.
+            /// \param[in] ciphertextHeader Describes ivCiphertextAndMAC.
+            /// \param[in] ivCiphertextAndMAC IV, ciphertext and MAC.
+            /// \param[in] workerCount Number of threads to use (MAC included).
+            /// \param[out] plaintext Where to write the decrypted plain text.
+            /// \return Number of bytes written to plaintext.
+            std::size_t DecryptParallel (
+                const CiphertextHeader &ciphertextHeader,
+                const util::ui8 *ivCiphertextAndMAC,
+                std::size_t workerCount,
+                util::ui8 *plaintext);
 
+            /// \brief
+            /// Helper used by EncryptAndFrameOrdered and DecryptOrdered.
+            /// \param[in] salt Direction salt.
+            /// \param[in] sequenceNumber Frame sequence number.
+            /// \param[out] iv Where to write the iv (GetIVLength bytes).
+            void GetOrderedIV (
+                const util::ui8 *salt,
+                util::ui64 sequenceNumber,
+                util::ui8 *iv) const;
+            /// \brief
+            /// Helper used by Decrypt and DecryptCompact.
+            /// \param[in] ciphertextHeader Describes ivCiphertextAndMAC.
+            /// \param[in] ivCiphertextAndMAC IV, ciphertext and MAC.
+            /// \param[in] associatedData Optional associated data (GCM mode only).
+            /// \param[in] associatedDataLength Length of optional associated data.
+            /// \param[out] plaintext Where to write the decrypted plain text.
+            /// \return Number of bytes written to plaintext.
+            std::size_t DecryptWithHeader (
+                const CiphertextHeader &ciphertextHeader,
+                const util::ui8 *ivCiphertextAndMAC,
+                const void *associatedData,
+                std::size_t associatedDataLength,
+                util::ui8 *plaintext);
+
+        public:
             /// \brief
             /// Cipher is neither copy constructable, nor assignable.
             THEKOGANS_CRYPTO_DISALLOW_COPY_AND_ASSIGN (Cipher)
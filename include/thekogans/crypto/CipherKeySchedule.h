@@ -0,0 +1,138 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined (__thekogans_crypto_CipherKeySchedule_h)
+#define __thekogans_crypto_CipherKeySchedule_h
+
+#include <openssl/evp.h>
+#include "thekogans/util/RefCounted.h"
+#include "thekogans/crypto/Config.h"
+#include "thekogans/crypto/SymmetricKey.h"
+#include "thekogans/crypto/OpenSSLUtils.h"
+#include "thekogans/crypto/MAC.h"
+#include "thekogans/crypto/HMAC.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        /// \struct CipherKeySchedule CipherKeySchedule.h thekogans/crypto/CipherKeySchedule.h
+        ///
+        /// \brief
+        /// CipherKeySchedule holds everything a \see{Cipher} derives from it's
+        /// \see{SymmetricKey}: the encrypt and decrypt contexts with the key
+        /// schedule already expanded, and (CBC mode) the keyed \see{HMAC}
+        /// (\see{SymmetricKey::FromSecretAndSalt} included). It's computed once
+        /// per key and cached alongside it, so every \see{Cipher} after the first
+        /// (\see{KeyRing::GetCipher} misses, \see{CipherPool}, \see{FileDecryptor}
+        /// workers...) costs a few context copies instead. A CipherKeySchedule is
+        /// immutable, and safe to share among threads. Changing the key bytes
+        /// (\see{SymmetricKey::Set}, Read) drops the cached schedule.
+
+        struct _LIB_THEKOGANS_CRYPTO_DECL CipherKeySchedule : public virtual util::RefCounted {
+            /// \brief
+            /// Declare \see{RefCounted} pointers.
+            THEKOGANS_UTIL_DECLARE_REF_COUNTED_POINTERS (CipherKeySchedule)
+
+        private:
+            /// \brief
+            /// OpenSSL EVP_CIPHER.
+            const EVP_CIPHER *cipher;
+            /// \brief
+            /// OpenSSL EVP_MD (CBC mode only).
+            const EVP_MD *md;
+            /// \brief
+            /// Context keyed for encryption.
+            CipherContext encryptContext;
+            /// \brief
+            /// Context keyed for decryption.
+            CipherContext decryptContext;
+            /// \brief
+            /// Keyed HMAC (CBC mode only, 0 for AEAD ciphers).
+            util::RefCounted::SharedPtr<HMAC> mac;
+
+        public:
+            /// \brief
+            /// ctor. NOTE: The schedule does not hold on to the key
+            /// (it's cached by it). Use Get to find or compute the key's
+            /// cached schedule.
+            /// \param[in] key \see{SymmetricKey} to compute the schedule for.
+            /// \param[in] cipher_ OpenSSL EVP_CIPHER.
+            /// \param[in] md_ OpenSSL EVP_MD (CBC mode only, ignored in AEAD mode).
+            CipherKeySchedule (
+                const SymmetricKey &key,
+                const EVP_CIPHER *cipher_ = THEKOGANS_CRYPTO_DEFAULT_CIPHER,
+                const EVP_MD *md_ = THEKOGANS_CRYPTO_DEFAULT_MD);
+
+            /// \brief
+            /// Return the key's cached schedule for the given cipher/md,
+            /// computing (and caching) it if there isn't one.
+            /// \param[in] key \see{SymmetricKey} whose schedule to return.
+            /// \param[in] cipher OpenSSL EVP_CIPHER.
+            /// \param[in] md OpenSSL EVP_MD (CBC mode only, ignored in AEAD mode).
+            /// \return Key schedule.
+            static SharedPtr Get (
+                SymmetricKey::SharedPtr key,
+                const EVP_CIPHER *cipher = THEKOGANS_CRYPTO_DEFAULT_CIPHER,
+                const EVP_MD *md = THEKOGANS_CRYPTO_DEFAULT_MD);
+
+            /// \brief
+            /// Return the OpenSSL EVP_CIPHER.
+            /// \return OpenSSL EVP_CIPHER.
+            inline const EVP_CIPHER *GetCipher () const {
+                return cipher;
+            }
+            /// \brief
+            /// Return the OpenSSL EVP_MD.
+            /// \return OpenSSL EVP_MD.
+            inline const EVP_MD *GetMD () const {
+                return md;
+            }
+            /// \brief
+            /// Return the context keyed for encryption (copy it, don't use it).
+            /// \return Context keyed for encryption.
+            inline const CipherContext &GetEncryptContext () const {
+                return encryptContext;
+            }
+            /// \brief
+            /// Return the context keyed for decryption (copy it, don't use it).
+            /// \return Context keyed for decryption.
+            inline const CipherContext &GetDecryptContext () const {
+                return decryptContext;
+            }
+            /// \brief
+            /// Return a fresh copy of the keyed HMAC.
+            /// \return Copy of the keyed HMAC (CBC mode), or 0 (AEAD mode).
+            MAC::SharedPtr CloneMAC () const;
+
+            /// \brief
+            /// Return true if this schedule was computed for the given cipher/md.
+            /// \param[in] cipher_ OpenSSL EVP_CIPHER.
+            /// \param[in] md_ OpenSSL EVP_MD (ignored in AEAD mode).
+            /// \return true == Schedule matches.
+            bool Matches (
+                const EVP_CIPHER *cipher_,
+                const EVP_MD *md_) const;
+
+            /// \brief
+            /// CipherKeySchedule is neither copy constructable, nor assignable.
+            THEKOGANS_CRYPTO_DISALLOW_COPY_AND_ASSIGN (CipherKeySchedule)
+        };
+
+    } // namespace crypto
+} // namespace thekogans
+
+#endif // !defined (__thekogans_crypto_CipherKeySchedule_h)
@@ -0,0 +1,215 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+
+#if !defined (__thekogans_crypto_CipherPool_h)
+#define __thekogans_crypto_CipherPool_h
+
+#include <cstddef>
+#include <vector>
+#include <openssl/evp.h>
+#include "thekogans/util/Types.h"
+#include "thekogans/util/RefCounted.h"
+#include "thekogans/util/Mutex.h"
+#include "thekogans/util/Condition.h"
+#include "thekogans/crypto/Config.h"
+#include "thekogans/crypto/SymmetricKey.h"
+#include "thekogans/crypto/Cipher.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        /// \struct CipherPool CipherPool.h thekogans/crypto/CipherPool.h
+        ///
+        /// \brief
+        /// \see{Cipher} is not thread safe (it holds a single encryptor/decryptor
+        /// context and a \see{MAC}). CipherPool lets multiple threads encrypt and
+        /// decrypt with the same \see{SymmetricKey} concurrently by leasing out
+        /// independent \see{Cipher} instances built from it. The pool starts
+        /// empty and grows on demand (every time a lease is requested and no idle
+        /// \see{Cipher} is available) up to maxCiphers. Once maxCiphers are leased
+        /// out, Acquire blocks until one is released. Lease wait times are tracked
+        /// to help size the pool (\see{GetStats}).
+        ///
+        /// Ex:
+        ///
+        /// \code{.cpp}
+        /// using namespace thekogans;
+        ///
+        /// crypto::CipherPool::SharedPtr cipherPool = keyRing.GetCipherPool (keyId);
+        /// ...
+        /// {
+        ///     crypto::CipherPool::Lease cipher (*cipherPool);
+        ///     cipher->Encrypt (...);
+        /// }
+        /// \endcode
+
+        struct _LIB_THEKOGANS_CRYPTO_DECL CipherPool : public virtual util::RefCounted {
+            /// \brief
+            /// Declare \see{RefCounted} pointers.
+            THEKOGANS_UTIL_DECLARE_REF_COUNTED_POINTERS (CipherPool)
+
+            /// \struct CipherPool::Stats CipherPool.h thekogans/crypto/CipherPool.h
+            ///
+            /// \brief
+            /// Lease statistics.
+            struct _LIB_THEKOGANS_CRYPTO_DECL Stats {
+                /// \brief
+                /// Number of \see{Cipher} instances created.
+                std::size_t ciphers;
+                /// \brief
+                /// Number of leases granted.
+                util::ui64 leases;
+                /// \brief
+                /// Number of leases that had to wait for a \see{Cipher} to be released.
+                util::ui64 waits;
+                /// \brief
+                /// Total time (in seconds) spent waiting for leases.
+                util::f64 totalWaitTime;
+                /// \brief
+                /// Longest time (in seconds) spent waiting for a lease.
+                util::f64 maxWaitTime;
+
+                /// \brief
+                /// ctor.
+                Stats () :
+                    ciphers (0),
+                    leases (0),
+                    waits (0),
+                    totalWaitTime (0.0),
+                    maxWaitTime (0.0) {}
+            };
+
+            /// \struct CipherPool::Lease CipherPool.h thekogans/crypto/CipherPool.h
+            ///
+            /// \brief
+            /// Lease is a helper used to acquire a \see{Cipher} from the pool
+            /// in it's ctor and release it back in it's dtor.
+            struct _LIB_THEKOGANS_CRYPTO_DECL Lease {
+            private:
+                /// \brief
+                /// Pool the \see{Cipher} was leased from.
+                CipherPool &pool;
+                /// \brief
+                /// Leased \see{Cipher}.
+                Cipher::SharedPtr cipher;
+
+            public:
+                /// \brief
+                /// ctor.
+                /// \param[in] pool_ Pool to lease the \see{Cipher} from.
+                explicit Lease (CipherPool &pool_) :
+                    pool (pool_),
+                    cipher (pool.Acquire ()) {}
+                /// \brief
+                /// dtor.
+                ~Lease () {
+                    pool.Release (cipher);
+                }
+
+                /// \brief
+                /// Dereference operator.
+                /// \return Leased \see{Cipher}.
+                inline Cipher &operator * () const {
+                    return *cipher;
+                }
+                /// \brief
+                /// Member access operator.
+                /// \return Leased \see{Cipher}.
+                inline Cipher *operator -> () const {
+                    return cipher.Get ();
+                }
+
+                /// \brief
+                /// Lease is neither copy constructable, nor assignable.
+                THEKOGANS_CRYPTO_DISALLOW_COPY_AND_ASSIGN (Lease)
+            };
+
+        private:
+            /// \brief
+            /// \see{SymmetricKey} shared by all pooled \see{Cipher}s.
+            SymmetricKey::SharedPtr key;
+            /// \brief
+            /// OpenSSL cipher.
+            const EVP_CIPHER *cipher;
+            /// \brief
+            /// OpenSSL message digest.
+            const EVP_MD *md;
+            /// \brief
+            /// Max number of \see{Cipher}s the pool will create.
+            std::size_t maxCiphers;
+            /// \brief
+            /// Idle \see{Cipher}s.
+            std::vector<Cipher::SharedPtr> idle;
+            /// \brief
+            /// Lease stats.
+            Stats stats;
+            /// \brief
+            /// Synchronization mutex.
+            util::Mutex mutex;
+            /// \brief
+            /// Signaled when a \see{Cipher} is released.
+            util::Condition idleCondition;
+
+        public:
+            /// \brief
+            /// ctor.
+            /// \param[in] key_ \see{SymmetricKey} shared by all pooled \see{Cipher}s.
+            /// \param[in] cipher_ OpenSSL EVP_CIPHER.
+            /// \param[in] md_ OpenSSL EVP_MD (CBC mode only, ignored (and may be 0) in AEAD modes).
+            /// \param[in] maxCiphers_ Max number of \see{Cipher}s to create
+            /// (0 = two per CPU).
+            CipherPool (
+                SymmetricKey::SharedPtr key_,
+                const EVP_CIPHER *cipher_ = THEKOGANS_CRYPTO_DEFAULT_CIPHER,
+                const EVP_MD *md_ = THEKOGANS_CRYPTO_DEFAULT_MD,
+                std::size_t maxCiphers_ = 0);
+
+            /// \brief
+            /// Return the \see{SymmetricKey} shared by all pooled \see{Cipher}s.
+            /// \return \see{SymmetricKey} shared by all pooled \see{Cipher}s.
+            inline SymmetricKey::SharedPtr GetKey () const {
+                return key;
+            }
+
+            /// \brief
+            /// Lease a \see{Cipher}. If none are idle and less than maxCiphers
+            /// have been created, create a new one. Otherwise, wait for one to
+            /// be released.
+            /// VERY IMPORTANT: Every Acquire must be paired with a Release.
+            /// Use \see{Lease} to make that exception safe.
+            /// \return Leased \see{Cipher}.
+            Cipher::SharedPtr Acquire ();
+            /// \brief
+            /// Return a leased \see{Cipher} to the pool.
+            /// \param[in] cipher \see{Cipher} returned by Acquire.
+            void Release (Cipher::SharedPtr cipher);
+
+            /// \brief
+            /// Return a snapshot of the lease stats.
+            /// \return Snapshot of the lease stats.
+            Stats GetStats ();
+
+            /// \brief
+            /// CipherPool is neither copy constructable, nor assignable.
+            THEKOGANS_CRYPTO_DISALLOW_COPY_AND_ASSIGN (CipherPool)
+        };
+
+    } // namespace crypto
+} // namespace thekogans
+
+#endif // !defined (__thekogans_crypto_CipherPool_h)
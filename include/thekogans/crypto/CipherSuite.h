@@ -25,6 +25,7 @@
 #include <openssl/evp.h>
 #include "thekogans/util/Serializer.h"
 #include "thekogans/crypto/Config.h"
+#include "thekogans/crypto/OpenSSLUtils.h"
 #include "thekogans/crypto/Params.h"
 #include "thekogans/crypto/SymmetricKey.h"
 #include "thekogans/crypto/AsymmetricKey.h"
@@ -70,6 +71,14 @@ namespace thekogans {
         /// Auth = ECDSA.
         /// Enc-Mode = AES-256-CBC.
         /// MD = SHA2-512.
+        ///
+        /// Every ctor (and assignment operator) resolves the four names once, to their
+        /// indexes in the tables returned by GetKeyExchanges/GetAuthenticators/GetCiphers/
+        /// GetMessageDigests and to the OpenSSL EVP_CIPHER/EVP_MD they represent. All the
+        /// factories (GetCipher, GetHMAC...) use the resolved form, no string compares or
+        /// name lookups are done in hot paths (\see{KeyRing::GetCipher}).
+        /// NOTE: If you modify the public name members directly, assign a new CipherSuite
+        /// (or call one of the ctors) to bring the resolved form up to date.
 
         struct _LIB_THEKOGANS_CRYPTO_DECL CipherSuite {
             /// \brief
@@ -113,6 +122,11 @@ namespace thekogans {
             /// \brief
             /// "AES-128-CBC"
             static const char * const CIPHER_AES_128_CBC;
+        #if defined (THEKOGANS_CRYPTO_HAVE_CHACHA20_POLY1305)
+            /// \brief
+            /// "ChaCha20-Poly1305"
+            static const char * const CIPHER_CHACHA20_POLY1305;
+        #endif // defined (THEKOGANS_CRYPTO_HAVE_CHACHA20_POLY1305)
 
         #if defined (THEKOGANS_CRYPTO_HAVE_BLAKE2)
             /// \brief
@@ -127,7 +141,16 @@ namespace thekogans {
             /// \brief
             /// "BLAKE2S-256"
             static const char * const MESSAGE_DIGEST_BLAKE2S_256;
+            /// \brief
+            /// "BLAKE2BP-512" (4-way parallel BLAKE2b)
+            static const char * const MESSAGE_DIGEST_BLAKE2BP_512;
+            /// \brief
+            /// "BLAKE2SP-256" (8-way parallel BLAKE2s)
+            static const char * const MESSAGE_DIGEST_BLAKE2SP_256;
         #endif // defined (THEKOGANS_CRYPTO_HAVE_BLAKE2)
+            /// \brief
+            /// "BLAKE3-256"
+            static const char * const MESSAGE_DIGEST_BLAKE3_256;
 
             /// \brief
             /// "SHA2-512"
@@ -139,6 +162,50 @@ namespace thekogans {
             /// "SHA2-256"
             static const char * const MESSAGE_DIGEST_SHA2_256;
 
+            /// \enum
+            /// Resolved key exchange indexes (\see{GetKeyExchanges}).
+            enum {
+                /// \brief
+                /// KEY_EXCHANGE_ECDHE
+                KEY_EXCHANGE_INDEX_ECDHE,
+                /// \brief
+                /// KEY_EXCHANGE_DHE
+                KEY_EXCHANGE_INDEX_DHE,
+                /// \brief
+                /// KEY_EXCHANGE_RSA
+                KEY_EXCHANGE_INDEX_RSA
+            };
+            /// \enum
+            /// Resolved authenticator indexes (\see{GetAuthenticators}).
+            enum {
+                /// \brief
+                /// AUTHENTICATOR_ECDSA
+                AUTHENTICATOR_INDEX_ECDSA,
+                /// \brief
+                /// AUTHENTICATOR_DSA
+                AUTHENTICATOR_INDEX_DSA,
+                /// \brief
+                /// AUTHENTICATOR_RSA
+                AUTHENTICATOR_INDEX_RSA,
+                /// \brief
+                /// AUTHENTICATOR_Ed25519
+                AUTHENTICATOR_INDEX_Ed25519
+            };
+            /// \enum
+            /// Code of an \see{Empty} (or unknown) cipher suite (\see{GetCode}).
+            enum {
+                /// \brief
+                /// Invalid cipher suite code. Valid codes are never 0.
+                INVALID_CODE = 0
+            };
+            /// \enum
+            /// Index of a component of an \see{Empty} cipher suite.
+            enum {
+                /// \brief
+                /// Unresolved index.
+                INVALID_INDEX = 0xff
+            };
+
             /// \brief
             /// \see{KeyExchange}.
             std::string keyExchange;
@@ -152,9 +219,40 @@ namespace thekogans {
             /// \see{MessageDigest}.
             std::string messageDigest;
 
+        private:
+            /// \brief
+            /// Resolved keyExchange.
+            util::ui8 keyExchangeIndex;
+            /// \brief
+            /// Resolved authenticator.
+            util::ui8 authenticatorIndex;
+            /// \brief
+            /// Resolved cipher.
+            util::ui8 cipherIndex;
+            /// \brief
+            /// Resolved messageDigest.
+            util::ui8 messageDigestIndex;
+            /// \brief
+            /// OpenSSL EVP_CIPHER represented by cipher.
+            const EVP_CIPHER *openSSLCipher;
+            /// \brief
+            /// OpenSSL EVP_MD represented by messageDigest.
+            const EVP_MD *openSSLMessageDigest;
+            /// \brief
+            /// Registry code (\see{GetCode}).
+            util::ui16 code;
+
+        public:
             /// \brief
             /// ctor.
-            CipherSuite () {}
+            CipherSuite () :
+                keyExchangeIndex (INVALID_INDEX),
+                authenticatorIndex (INVALID_INDEX),
+                cipherIndex (INVALID_INDEX),
+                messageDigestIndex (INVALID_INDEX),
+                openSSLCipher (0),
+                openSSLMessageDigest (0),
+                code (INVALID_CODE) {}
             /// \brief
             /// ctor.
             /// \param[in] keyExchange_ \see{KeyExchange}.
@@ -175,7 +273,7 @@ namespace thekogans {
             /// \param[in] cipherSuite String encoded cipher suite: Kx_Auth_Enc_MD.
             explicit CipherSuite (const std::string &cipherSuite);
             /// \brief
-            /// copy ctor.
+            /// copy ctor. The resolved form is copied, not recomputed.
             /// \param[in] cipherSuite Cipher suite to copy.
             CipherSuite (const CipherSuite &cipherSuite);
 
@@ -204,6 +302,88 @@ namespace thekogans {
             /// Return the list of all available cipher suites.
             /// \return The list of all available cipher suites.
             static const std::vector<CipherSuite> &GetCipherSuites ();
+            /// \brief
+            /// Return the list of all available cipher suites ranked for the current
+            /// hardware (see \see{CPUFeatures}); i.e. on CPUs without hardware AES
+            /// ChaCha20-Poly1305 suites come first. Use the first entry as the default.
+            /// \return The list of all available cipher suites, best first.
+            static const std::vector<CipherSuite> &GetRankedCipherSuites ();
+
+            /// \struct CipherSuite::Mask CipherSuite.h thekogans/crypto/CipherSuite.h
+            ///
+            /// \brief
+            /// A set of cipher suites, one bit per entry in \see{GetCipherSuites}.
+            /// Build one from a peer's (decoded) list of codes and pass it to
+            /// \see{Negotiate}. Masks are process local; use \see{EncodeCodes}/
+            /// \see{DecodeCodes} to put suite lists on the wire.
+            struct _LIB_THEKOGANS_CRYPTO_DECL Mask {
+            private:
+                /// \brief
+                /// Bits (GetCipherSuites ().size () of them).
+                std::vector<util::ui64> bits;
+
+            public:
+                /// \brief
+                /// ctor. Create an empty mask.
+                Mask ();
+                /// \brief
+                /// ctor.
+                /// \param[in] codes List of cipher suite codes to set. Unknown codes are ignored.
+                explicit Mask (const std::vector<util::ui16> &codes);
+
+                /// \brief
+                /// Add the given cipher suite code to the mask.
+                /// \param[in] code Cipher suite code to add.
+                /// \return true = added, false = unknown code.
+                bool Set (util::ui16 code);
+                /// \brief
+                /// Check if the given cipher suite code is in the mask.
+                /// \param[in] code Cipher suite code to check.
+                /// \return true = code is in the mask.
+                bool Test (util::ui16 code) const;
+                /// \brief
+                /// Intersect this mask with the given one.
+                /// \param[in] mask Mask to intersect with.
+                /// \return *this.
+                Mask &operator &= (const Mask &mask);
+                /// \brief
+                /// Return true if no suites are set.
+                /// \return true if no suites are set.
+                bool IsEmpty () const;
+            };
+
+            /// \brief
+            /// Return the codes of all available cipher suites in \see{GetRankedCipherSuites} order.
+            /// \return The codes of all available cipher suites, best first.
+            static const std::vector<util::ui16> &GetRankedCipherSuiteCodes ();
+            /// \brief
+            /// Return the cipher suite represented by the given code.
+            /// \param[in] code Cipher suite code (\see{GetCode}).
+            /// \return Cipher suite represented by the given code (\see{Empty} if unknown).
+            static const CipherSuite &GetCipherSuiteByCode (util::ui16 code);
+            /// \brief
+            /// Negotiate a cipher suite. Pick the first of our preferences the peer supports.
+            /// \param[in] preferences Our cipher suite codes, best first.
+            /// \param[in] peer Cipher suites the peer supports.
+            /// \return The negotiated cipher suite code (INVALID_CODE if there's nothing in common).
+            static util::ui16 Negotiate (
+                const std::vector<util::ui16> &preferences,
+                const Mask &peer);
+            /// \brief
+            /// Write a list of cipher suite codes to the given serializer
+            /// (ui16 count followed by count ui16 codes).
+            /// \param[in] serializer Where to write the codes.
+            /// \param[in] codes Cipher suite codes to write.
+            static void EncodeCodes (
+                util::Serializer &serializer,
+                const std::vector<util::ui16> &codes);
+            /// \brief
+            /// Read a list of cipher suite codes written by \see{EncodeCodes}.
+            /// \param[in] serializer Where to read the codes from.
+            /// \param[out] codes Where to put the codes.
+            static void DecodeCodes (
+                util::Serializer &serializer,
+                std::vector<util::ui16> &codes);
 
             /// \brief
             /// Return the list of all available key exchanges.
@@ -247,6 +427,19 @@ namespace thekogans {
             /// \param[in] md OpenSSL EVP_MD whose name to return.
             /// \return Message digest name represented by the given OpenSSL EVP_MD.
             static std::string GetOpenSSLMessageDigestName (const EVP_MD *md);
+            /// \brief
+            /// Route the given algorithm to the given OpenSSL engine (hardware
+            /// offload). Key exchange and authenticator names select the
+            /// underlying public key algorithm (ECDHE and ECDSA share EC, RSA
+            /// key exchange and authenticator share RSA). Ed25519 (and X25519)
+            /// are implemented here, not in OpenSSL, and can't be offloaded.
+            /// See \see{OpenSSLInit::SetEngine}.
+            /// \param[in] algorithm Key exchange, authenticator, cipher or
+            /// message digest name.
+            /// \param[in] engine Engine to use (0 == software).
+            static void SetEngine (
+                const std::string &algorithm,
+                ENGINE *engine);
 
             /// \brief
             /// Return serialized cipher suite size.
@@ -298,10 +491,19 @@ namespace thekogans {
                 const SymmetricKey &key,
                 bool hmac) const;
 
+            /// \brief
+            /// Return the default \see{Params} for keyExchange. For ECDHE that's
+            /// \see{X25519} (\see{EC::ParamsFromX25519Curve}); key exchange then runs
+            /// on the in-library Curve25519 code instead of EVP_PKEY_derive. DHE
+            /// has no default group (0 is returned), and neither does RSA.
+            /// \return Default key exchange \see{Params} (0 if there isn't one).
+            Params::SharedPtr GetDefaultKeyExchangeParams () const;
+
             /// \brief
             /// Return an instance of the \see{DHEKeyExchange} represented by keyExchange (client side [EC]DHE).
             /// \param[in] keyExchangeId \see{KeyExchange::keyExchangeId}.
-            /// \param[in] params DH/EC \see{Params} to use for key exchange.
+            /// \param[in] params DH/EC \see{Params} to use for key exchange
+            /// (0 == \see{GetDefaultKeyExchangeParams}).
             /// \param[in] salt An optional buffer containing salt.
             /// \param[in] saltLength Salt length.
             /// \param[in] count A security counter. Increment the count to slow down
@@ -312,7 +514,7 @@ namespace thekogans {
             /// \return \see{DHEKeyExchange} instance represented by keyExchange.
             KeyExchange::SharedPtr GetDHEKeyExchange (
                 const ID &keyExchangeId,
-                Params::SharedPtr params,
+                Params::SharedPtr params = Params::SharedPtr (),
                 const void *salt = 0,
                 std::size_t saltLength = 0,
                 std::size_t count = 1,
@@ -354,6 +556,7 @@ namespace thekogans {
             Cipher::SharedPtr GetCipher (SymmetricKey::SharedPtr key) const;
             /// \brief
             /// Return the \see{HMAC} instance represented by messageDigest.
+            /// BLAKE2 digests get the native keyed \see{Blake2MAC} instead.
             /// \param[in] key \see{SymmetricKey} used to mac/verify.
             /// \return \see{HMAC} instance represented by messageDigest.
             MAC::SharedPtr GetHMAC (SymmetricKey::SharedPtr key) const;
@@ -363,6 +566,26 @@ namespace thekogans {
             /// \return \see{CMAC} instance represented by cipher.
             MAC::SharedPtr GetCMAC (SymmetricKey::SharedPtr key) const;
             /// \brief
+            /// Return a \see{GMAC} instance. The AES-GCM cipher is picked by
+            /// key length (16, 24 or 32), so GMAC is available whatever the
+            /// suite cipher.
+            /// \param[in] key \see{SymmetricKey} used to mac/verify.
+            /// \return \see{GMAC} instance.
+            MAC::SharedPtr GetGMAC (SymmetricKey::SharedPtr key) const;
+            /// \brief
+            /// Return a \see{Poly1305} instance.
+            /// \param[in] key \see{SymmetricKey} (Poly1305::KEY_LENGTH bytes) used to mac/verify.
+            /// \return \see{Poly1305} instance.
+            MAC::SharedPtr GetPoly1305 (SymmetricKey::SharedPtr key) const;
+            /// \brief
+            /// Return the \see{MAC} instance of the given type.
+            /// \param[in] key \see{SymmetricKey} used to mac/verify.
+            /// \param[in] type \see{MAC::Type} of MAC to return.
+            /// \return \see{MAC} instance of the given type.
+            MAC::SharedPtr GetMAC (
+                SymmetricKey::SharedPtr key,
+                MAC::Type type = MAC::TYPE_HMAC) const;
+            /// \brief
             /// Return the message digest instance represented by messageDigest.
             /// \return Message digest instance represented by messageDigest.
             MessageDigest::SharedPtr GetMessageDigest () const;
@@ -371,14 +594,49 @@ namespace thekogans {
             /// Return true if key exchange is ECDHE.
             /// \return true == key exchange is ECDHE.
             inline bool IsKeyExchangeEC () const {
-                return authenticator == KEY_EXCHANGE_ECDHE;
+                return keyExchangeIndex == KEY_EXCHANGE_INDEX_ECDHE;
             }
 
             /// \brief
             /// Return true if authenticator is ECDSA or Ed25519.
             /// \return true == authenticator is ECDSA or Ed25519.
             inline bool IsAuthenticatorEC () const {
-                return authenticator == AUTHENTICATOR_ECDSA || authenticator == AUTHENTICATOR_Ed25519;
+                return
+                    authenticatorIndex == AUTHENTICATOR_INDEX_ECDSA ||
+                    authenticatorIndex == AUTHENTICATOR_INDEX_Ed25519;
+            }
+
+            /// \brief
+            /// Return the resolved keyExchange (KEY_EXCHANGE_INDEX_*).
+            /// \return Resolved keyExchange (INVALID_INDEX if \see{Empty}).
+            inline std::size_t GetKeyExchangeIndex () const {
+                return keyExchangeIndex;
+            }
+            /// \brief
+            /// Return the resolved authenticator (AUTHENTICATOR_INDEX_*).
+            /// \return Resolved authenticator (INVALID_INDEX if \see{Empty}).
+            inline std::size_t GetAuthenticatorIndex () const {
+                return authenticatorIndex;
+            }
+            /// \brief
+            /// Return the resolved cipher (\see{GetOpenSSLCipherByIndex}).
+            /// \return Resolved cipher (INVALID_INDEX if \see{Empty}).
+            inline std::size_t GetCipherIndex () const {
+                return cipherIndex;
+            }
+            /// \brief
+            /// Return the resolved messageDigest (index in to \see{GetMessageDigests}).
+            /// \return Resolved messageDigest (INVALID_INDEX if \see{Empty}).
+            inline std::size_t GetMessageDigestIndex () const {
+                return messageDigestIndex;
+            }
+            /// \brief
+            /// Return the compact, build independent, 16 bit code of this cipher suite.
+            /// Codes are stable (4 bits per component) and are meant for negotiation
+            /// (\see{Negotiate}, \see{EncodeCodes}). The string forms are for configuration.
+            /// \return Cipher suite code (INVALID_CODE if \see{Empty}).
+            inline util::ui16 GetCode () const {
+                return code;
             }
             /// \brief
             /// Given a key length (in bits), create an DSA or RSA
@@ -412,15 +670,11 @@ namespace thekogans {
             /// \brief
             /// Return the OpenSSL EVP_CIPHER represented by cipher.
             /// \return OpenSSL EVP_CIPHER represented by cipher.
-            inline const EVP_CIPHER *GetOpenSSLCipher () const {
-                return GetOpenSSLCipherByName (cipher);
-            }
+            const EVP_CIPHER *GetOpenSSLCipher () const;
             /// \brief
             /// Return the OpenSSL EVP_MD represented by messageDigest.
             /// \return OpenSSL EVP_MD represented by messageDigest.
-            inline const EVP_MD *GetOpenSSLMessageDigest () const {
-                return GetOpenSSLMessageDigestByName (messageDigest);
-            }
+            const EVP_MD *GetOpenSSLMessageDigest () const;
 
             /// \brief
             /// Return the canonical (Kx_Auth_Enc_MD) representation of a cipher suite.
@@ -434,6 +688,10 @@ namespace thekogans {
             /// Parse a properly formated cipher suite string.
             /// \param[in] cipherSuite String encoded cipher suite: Kx_Auth_Enc_MD.
             void Parse (const std::string &cipherSuite);
+            /// \brief
+            /// Validate the names and compute the resolved form.
+            /// Throws if the cipher suite is invalid.
+            void Resolve ();
         };
 
         /// \brief
@@ -490,11 +748,7 @@ namespace thekogans {
         inline util::Serializer &operator >> (
                 util::Serializer &serializer,
                 CipherSuite &cipherSuite) {
-            serializer >>
-                cipherSuite.keyExchange >>
-                cipherSuite.authenticator >>
-                cipherSuite.cipher >>
-                cipherSuite.messageDigest;
+            cipherSuite = CipherSuite (serializer);
             return serializer;
         }
 
@@ -81,8 +81,11 @@ namespace thekogans {
             /// \param[in] maxPayloadLength Maximum payload length.
             /// \return true = valid, false = invalid.
             inline bool IsValid (util::ui32 maxPayloadLength) const {
+                // GetTotalLength can wrap around for forged lengths,
+                // so compare the pieces instead.
                 return ivLength > 0 && ciphertextLength > 0 && macLength > 0 &&
-                    GetTotalLength () <= maxPayloadLength;
+                    ciphertextLength <= maxPayloadLength &&
+                    (util::ui32)ivLength + macLength <= maxPayloadLength - ciphertextLength;
             }
         };
 
@@ -0,0 +1,270 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined (__thekogans_crypto_CompactKeyStore_h)
+#define __thekogans_crypto_CompactKeyStore_h
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+#include "thekogans/util/Types.h"
+#include "thekogans/crypto/Config.h"
+#include "thekogans/crypto/ID.h"
+#include "thekogans/crypto/IDHashMap.h"
+#include "thekogans/crypto/SymmetricKey.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        /// \struct CompactKeyStore CompactKeyStore.h thekogans/crypto/CompactKeyStore.h
+        ///
+        /// \brief
+        /// CompactKeyStore holds \see{SymmetricKey}s as fixed size (id, length, flags,
+        /// key) records, packed in to slabs of locked (\see{util::SecureAllocator})
+        /// pages. A SymmetricKey object carries a \see{Serializable} base (id, name,
+        /// description, vtable, reference count) around a key buffer, and is page
+        /// allocated. A record is ID::SIZE + 2 + key length bytes, plus an 8 byte slot
+        /// in the same (hash, index) table \see{IDHashMap} uses. The rare name and
+        /// description live in a side table. SymmetricKeys are materialized on demand
+        /// (every Get returns a new object), so a million key \see{KeyRing} that only
+        /// caches the \see{Cipher}s it uses pays for the records alone.
+        ///
+        /// The record key length is fixed by the first key added to an empty store.
+        /// Longer keys are refused (shorter ones are zero padded).
+        ///
+        /// NOTE: Like IDHashMap, Drop moves the last record in to the dropped one's
+        /// place, so record indices are only stable between Add/Drop. CompactKeyStore
+        /// is not thread safe.
+
+        struct _LIB_THEKOGANS_CRYPTO_DECL CompactKeyStore {
+        private:
+            /// \struct CompactKeyStore::Slot CompactKeyStore.h thekogans/crypto/CompactKeyStore.h
+            ///
+            /// \brief
+            /// Slot table entry.
+            struct Slot {
+                /// \brief
+                /// Low 32 bits of the record's id hash.
+                util::ui32 hash;
+                /// \brief
+                /// Record index + 1 (0 == empty slot).
+                util::ui32 index;
+
+                /// \brief
+                /// ctor.
+                Slot () :
+                    hash (0),
+                    index (0) {}
+            };
+
+            enum {
+                /// \brief
+                /// Slab size (allocated from util::SecureAllocator).
+                SLAB_SIZE = 64 * 1024,
+                /// \brief
+                /// Smallest slot table.
+                MIN_SLOTS = 16,
+                /// \brief
+                /// Record id offset.
+                RECORD_ID = 0,
+                /// \brief
+                /// Record key length offset.
+                RECORD_LENGTH = ID::SIZE,
+                /// \brief
+                /// Record flags offset.
+                RECORD_FLAGS = RECORD_LENGTH + 1,
+                /// \brief
+                /// Record key offset.
+                RECORD_KEY = RECORD_FLAGS + 1,
+                /// \brief
+                /// The key has a name and/or description (in names).
+                FLAG_NAMED = 1
+            };
+
+            /// \brief
+            /// Record slabs.
+            std::vector<util::ui8 *> slabs;
+            /// \brief
+            /// Record key length (fixed by the first key).
+            std::size_t keyLength;
+            /// \brief
+            /// Record size (RECORD_KEY + keyLength).
+            std::size_t recordSize;
+            /// \brief
+            /// Number of records in a slab.
+            std::size_t recordsPerSlab;
+            /// \brief
+            /// Number of records.
+            std::size_t count;
+            /// \brief
+            /// Slot table (power of 2 size, at most 3/4 full).
+            std::vector<Slot> slots;
+            /// \brief
+            /// Side table of (name, description) for FLAG_NAMED records.
+            IDHashMap<std::pair<std::string, std::string> > names;
+
+        public:
+            /// \brief
+            /// ctor.
+            CompactKeyStore () :
+                keyLength (0),
+                recordSize (0),
+                recordsPerSlab (0),
+                count (0) {}
+            /// \brief
+            /// dtor. Wipe and free the slabs.
+            ~CompactKeyStore () {
+                Clear ();
+            }
+
+            /// \brief
+            /// Return true if the store is empty.
+            /// \return true == empty.
+            inline bool IsEmpty () const {
+                return count == 0;
+            }
+            /// \brief
+            /// Return the number of keys.
+            /// \return Number of keys.
+            inline std::size_t GetCount () const {
+                return count;
+            }
+            /// \brief
+            /// Return the record key length (0 == no key was added yet).
+            /// \return Record key length.
+            inline std::size_t GetKeyLength () const {
+                return keyLength;
+            }
+
+            /// \brief
+            /// Return true if the given key fits in a record.
+            /// \param[in] key \see{SymmetricKey} to check.
+            /// \return true == Add will take the key (if it's id is new).
+            inline bool CanHold (const SymmetricKey &key) const {
+                return slabs.empty () || key.GetKeyLength () <= keyLength;
+            }
+
+            /// \brief
+            /// Copy the given key in to a new record.
+            /// \param[in] key \see{SymmetricKey} to add.
+            /// \return true == added, false == a key with the same id
+            /// is already in the store, or the key does not fit (CanHold).
+            bool Add (const SymmetricKey &key);
+
+            /// \brief
+            /// Return true if a key with the given id is in the store.
+            /// \param[in] keyId \see{ID} of the key to look for.
+            /// \return true == found.
+            inline bool Contains (const ID &keyId) const {
+                std::size_t slot = FindSlot (keyId, Hash (keyId.data));
+                return slot != slots.size () && slots[slot].index != 0;
+            }
+            /// \brief
+            /// Materialize the key with the given id.
+            /// \param[in] keyId \see{ID} of the key to materialize.
+            /// \return New \see{SymmetricKey} (SymmetricKey::SharedPtr () if not found).
+            SymmetricKey::SharedPtr Get (const ID &keyId) const;
+            /// \brief
+            /// Return the id of the key in the given record.
+            /// \param[in] index Record index (< GetCount ()).
+            /// \return \see{ID} of the key.
+            inline ID GetId (std::size_t index) const {
+                return ID (GetRecord (index) + RECORD_ID);
+            }
+            /// \brief
+            /// Materialize the key in the given record.
+            /// \param[in] index Record index (< GetCount ()).
+            /// \return New \see{SymmetricKey}.
+            SymmetricKey::SharedPtr GetAt (std::size_t index) const;
+
+            /// \brief
+            /// Wipe the record of the key with the given id.
+            /// \param[in] keyId \see{ID} of the key to drop.
+            /// \return true == dropped, false == not found.
+            bool Drop (const ID &keyId);
+            /// \brief
+            /// Wipe and free all records.
+            void Clear ();
+
+            /// \brief
+            /// Return the bytes held by the slabs and the slot table
+            /// (the side table is not included).
+            /// \return Memory used by the store.
+            inline std::size_t GetMemoryUsage () const {
+                return slabs.size () * SLAB_SIZE + slots.size () * sizeof (Slot);
+            }
+
+        private:
+            /// \brief
+            /// Return the record with the given index.
+            /// \param[in] index Record index.
+            /// \return Pointer to the record.
+            inline util::ui8 *GetRecord (std::size_t index) const {
+                return slabs[index / recordsPerSlab] + (index % recordsPerSlab) * recordSize;
+            }
+            /// \brief
+            /// Return the hash used to place the given id (see std::hash<ID> in ID.h).
+            /// \param[in] id \see{ID} bytes.
+            /// \return Low 32 bits of the id hash.
+            static inline util::ui32 Hash (const util::ui8 *id) {
+                std::size_t value;
+                memcpy (&value, id, sizeof (value));
+                return (util::ui32)value;
+            }
+            /// \brief
+            /// Return the slot holding the given id, or the empty slot where it
+            /// would be inserted (slots.size () if the table is empty).
+            /// \param[in] id \see{ID} to find.
+            /// \param[in] hash Hash (id.data).
+            /// \return Slot index.
+            std::size_t FindSlot (
+                const ID &id,
+                util::ui32 hash) const;
+            /// \brief
+            /// Return the slot pointing at the given record.
+            /// \param[in] index Record index + 1.
+            /// \param[in] hash Hash of the record's id.
+            /// \return Slot index.
+            std::size_t FindIndexSlot (
+                util::ui32 index,
+                util::ui32 hash) const;
+            /// \brief
+            /// Empty the given slot, shifting the following entries of it's
+            /// probe sequence back so that no tombstones are needed.
+            /// \param[in] hole Slot to empty.
+            void RemoveSlot (std::size_t hole);
+            /// \brief
+            /// Rebuild the slot table with the given number of slots.
+            /// \param[in] slotCount New slot table size (power of 2).
+            void Rehash (std::size_t slotCount);
+            /// \brief
+            /// Materialize the given record.
+            /// \param[in] record Record to materialize.
+            /// \return New \see{SymmetricKey}.
+            SymmetricKey::SharedPtr Materialize (const util::ui8 *record) const;
+
+            /// \brief
+            /// CompactKeyStore is neither copy constructable, nor assignable.
+            THEKOGANS_CRYPTO_DISALLOW_COPY_AND_ASSIGN (CompactKeyStore)
+        };
+
+    } // namespace crypto
+} // namespace thekogans
+
+#endif // !defined (__thekogans_crypto_CompactKeyStore_h)
@@ -0,0 +1,117 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined (__thekogans_crypto_Compressor_h)
+#define __thekogans_crypto_Compressor_h
+
+#include <cstddef>
+#include <string>
+#include "thekogans/util/Types.h"
+#include "thekogans/crypto/Config.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        /// \struct Compressor Compressor.h thekogans/crypto/Compressor.h
+        ///
+        /// \brief
+        /// Compressor wraps the block compression libraries (zstd and lz4) used to
+        /// shrink plaintext before it's encrypted (see \see{FileEncryptor::SetCompression}).
+        /// Support for each algorithm is compiled in with THEKOGANS_CRYPTO_HAVE_ZSTD
+        /// and THEKOGANS_CRYPTO_HAVE_LZ4 respectively. All methods are stateless
+        /// and thread safe.
+        ///
+        /// NOTE: Compression before encryption leaks information about the plaintext
+        /// through the ciphertext length. It's meant for offline (file) encryption.
+        /// Do not use it on interactive channels mixing secrets with attacker
+        /// controlled data (CRIME/BREACH).
+
+        struct _LIB_THEKOGANS_CRYPTO_DECL Compressor {
+            /// \enum
+            /// Compression algorithms.
+            enum {
+                /// \brief
+                /// Stored as is.
+                NONE = 0,
+                /// \brief
+                /// Zstandard.
+                ZSTD = 1,
+                /// \brief
+                /// LZ4 (level > 1 == LZ4HC).
+                LZ4 = 2
+            };
+            /// \enum
+            /// Compressor constants.
+            enum {
+                /// \brief
+                /// Use the algorithm's default level.
+                DEFAULT_LEVEL = 0
+            };
+
+            /// \brief
+            /// Return true if the given algorithm was compiled in.
+            /// \param[in] algorithm Compression algorithm.
+            /// \return true == algorithm is supported.
+            static bool IsSupported (util::ui8 algorithm);
+            /// \brief
+            /// Convert a string (none | zstd | lz4) to an algorithm.
+            /// \param[in] algorithm Algorithm name.
+            /// \return Compression algorithm.
+            static util::ui8 FromString (const std::string &algorithm);
+            /// \brief
+            /// Convert an algorithm to it's string representation.
+            /// \param[in] algorithm Compression algorithm.
+            /// \return Algorithm name.
+            static std::string ToString (util::ui8 algorithm);
+
+            /// \brief
+            /// Compress a block.
+            /// \param[in] algorithm Compression algorithm.
+            /// \param[in] level Compression level (DEFAULT_LEVEL == algorithm default).
+            /// \param[in] input Block to compress.
+            /// \param[in] inputLength Block length.
+            /// \param[out] output Where to write the compressed block.
+            /// \param[in] outputLength Length of output.
+            /// \return Compressed length (0 == the block did not fit in to outputLength,
+            /// typically because it's incompressible).
+            static std::size_t Compress (
+                util::ui8 algorithm,
+                int level,
+                const void *input,
+                std::size_t inputLength,
+                void *output,
+                std::size_t outputLength);
+            /// \brief
+            /// Decompress a block produced by Compress.
+            /// \param[in] algorithm Compression algorithm.
+            /// \param[in] input Compressed block.
+            /// \param[in] inputLength Compressed block length.
+            /// \param[out] output Where to write the decompressed block.
+            /// \param[in] outputLength Exact decompressed length.
+            /// Throws if the block does not decompress to exactly outputLength bytes.
+            static void Decompress (
+                util::ui8 algorithm,
+                const void *input,
+                std::size_t inputLength,
+                void *output,
+                std::size_t outputLength);
+        };
+
+    } // namespace crypto
+} // namespace thekogans
+
+#endif // !defined (__thekogans_crypto_Compressor_h)
@@ -0,0 +1,347 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined (__thekogans_crypto_ConcurrentKeyRing_h)
+#define __thekogans_crypto_ConcurrentKeyRing_h
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include "thekogans/util/Types.h"
+#include "thekogans/util/RefCounted.h"
+#include "thekogans/util/SpinLock.h"
+#include "thekogans/util/Mutex.h"
+#include "thekogans/crypto/Config.h"
+#include "thekogans/crypto/ID.h"
+#include "thekogans/crypto/IDHashMap.h"
+#include "thekogans/crypto/CipherSuite.h"
+#include "thekogans/crypto/SymmetricKey.h"
+#include "thekogans/crypto/AsymmetricKey.h"
+#include "thekogans/crypto/Cipher.h"
+#include "thekogans/crypto/MAC.h"
+#include "thekogans/crypto/Authenticator.h"
+#include "thekogans/crypto/KeyRing.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        /// \struct ConcurrentKeyRing ConcurrentKeyRing.h thekogans/crypto/ConcurrentKeyRing.h
+        ///
+        /// \brief
+        /// \see{KeyRing} is not thread safe (even it's Get* methods lazily create and cache
+        /// \see{Cipher}, \see{MAC} and \see{Authenticator} instances). ConcurrentKeyRing is
+        /// a read-mostly, thread safe view of the \see{Cipher}, \see{MAC} and \see{Authenticator}
+        /// keys of a \see{KeyRing} designed to be shared by many request threads.
+        ///
+        /// The keys live in an immutable \see{Snapshot}. Readers work against the snapshot
+        /// their thread last saw. As long as no writer published a new one, a read costs an
+        /// atomic load and a thread local hash lookup (no locks and no shared writes). The
+        /// first read after a publication grabs the new snapshot under a spin lock.
+        /// Writers (Add*, Drop*, RotateCipherKey) are serialized, copy the table they
+        /// modify (keys and the tables of the other kinds are shared with the previous
+        /// snapshot) and publish a new version.
+        ///
+        /// \see{Cipher}, \see{MAC} and \see{Authenticator} instances are not thread safe
+        /// either, so GetCipher, GetMAC and GetAuthenticator cache them per thread.
+        /// VERY IMPORTANT: Never hand the instances they return to another thread.
+        ///
+        /// Ex:
+        ///
+        /// \code{.cpp}
+        /// using namespace thekogans;
+        ///
+        /// crypto::ConcurrentKeyRing::SharedPtr keyRing (
+        ///     new crypto::ConcurrentKeyRing (*crypto::KeyRing::Load (path)));
+        /// ...
+        /// // Any thread.
+        /// crypto::Cipher::SharedPtr cipher = keyRing->GetCipher (keyId);
+        /// cipher->Encrypt (...);
+        /// ...
+        /// // Key rotation.
+        /// keyRing->RotateCipherKey (newKey, keyId);
+        /// \endcode
+        ///
+        /// NOTE: Changes are not written back to the \see{KeyRing} the instance was
+        /// seeded from. Use ToKeyRing to get a \see{KeyRing} with the current keys.
+
+        struct _LIB_THEKOGANS_CRYPTO_DECL ConcurrentKeyRing : public virtual util::RefCounted {
+            /// \brief
+            /// Declare \see{RefCounted} pointers.
+            THEKOGANS_UTIL_DECLARE_REF_COUNTED_POINTERS (ConcurrentKeyRing)
+
+            /// \struct ConcurrentKeyRing::SymmetricKeyTable ConcurrentKeyRing.h
+            /// thekogans/crypto/ConcurrentKeyRing.h
+            ///
+            /// \brief
+            /// Immutable (once published) table of \see{SymmetricKey}s.
+            struct _LIB_THEKOGANS_CRYPTO_DECL SymmetricKeyTable : public virtual util::RefCounted {
+                /// \brief
+                /// Declare \see{RefCounted} pointers.
+                THEKOGANS_UTIL_DECLARE_REF_COUNTED_POINTERS (SymmetricKeyTable)
+
+                /// \brief
+                /// Keys.
+                IDHashMap<SymmetricKey::SharedPtr> keys;
+            };
+
+            /// \struct ConcurrentKeyRing::AsymmetricKeyTable ConcurrentKeyRing.h
+            /// thekogans/crypto/ConcurrentKeyRing.h
+            ///
+            /// \brief
+            /// Immutable (once published) table of \see{AsymmetricKey}s.
+            struct _LIB_THEKOGANS_CRYPTO_DECL AsymmetricKeyTable : public virtual util::RefCounted {
+                /// \brief
+                /// Declare \see{RefCounted} pointers.
+                THEKOGANS_UTIL_DECLARE_REF_COUNTED_POINTERS (AsymmetricKeyTable)
+
+                /// \brief
+                /// Keys.
+                IDHashMap<AsymmetricKey::SharedPtr> keys;
+            };
+
+            /// \struct ConcurrentKeyRing::Snapshot ConcurrentKeyRing.h
+            /// thekogans/crypto/ConcurrentKeyRing.h
+            ///
+            /// \brief
+            /// An immutable version of the key ring.
+            struct _LIB_THEKOGANS_CRYPTO_DECL Snapshot : public virtual util::RefCounted {
+                /// \brief
+                /// Declare \see{RefCounted} pointers.
+                THEKOGANS_UTIL_DECLARE_REF_COUNTED_POINTERS (Snapshot)
+
+                /// \brief
+                /// Snapshot version (incremented by every publication).
+                const util::ui64 version;
+                /// \brief
+                /// \see{Cipher} keys.
+                const SymmetricKeyTable::SharedPtr cipherKeys;
+                /// \brief
+                /// \see{MAC} keys.
+                const SymmetricKeyTable::SharedPtr macKeys;
+                /// \brief
+                /// \see{Authenticator} keys.
+                const AsymmetricKeyTable::SharedPtr authenticatorKeys;
+
+                /// \brief
+                /// ctor.
+                /// \param[in] version_ Snapshot version.
+                /// \param[in] cipherKeys_ \see{Cipher} keys.
+                /// \param[in] macKeys_ \see{MAC} keys.
+                /// \param[in] authenticatorKeys_ \see{Authenticator} keys.
+                Snapshot (
+                    util::ui64 version_,
+                    SymmetricKeyTable::SharedPtr cipherKeys_,
+                    SymmetricKeyTable::SharedPtr macKeys_,
+                    AsymmetricKeyTable::SharedPtr authenticatorKeys_) :
+                    version (version_),
+                    cipherKeys (cipherKeys_),
+                    macKeys (macKeys_),
+                    authenticatorKeys (authenticatorKeys_) {}
+
+                /// \brief
+                /// Return the \see{Cipher} key with the given id.
+                /// \param[in] keyId \see{ID} of key to return.
+                /// \return \see{SymmetricKey} (0 = not found).
+                SymmetricKey::SharedPtr GetCipherKey (const ID &keyId) const;
+                /// \brief
+                /// Return the \see{MAC} key with the given id.
+                /// \param[in] keyId \see{ID} of key to return.
+                /// \return \see{SymmetricKey} (0 = not found).
+                SymmetricKey::SharedPtr GetMACKey (const ID &keyId) const;
+                /// \brief
+                /// Return the \see{Authenticator} key with the given id.
+                /// \param[in] keyId \see{ID} of key to return.
+                /// \return \see{AsymmetricKey} (0 = not found).
+                AsymmetricKey::SharedPtr GetAuthenticatorKey (const ID &keyId) const;
+
+                /// \brief
+                /// Snapshot is neither copy constructable, nor assignable.
+                THEKOGANS_CRYPTO_DISALLOW_COPY_AND_ASSIGN (Snapshot)
+            };
+
+        private:
+            /// \brief
+            /// \see{CipherSuite} used to validate keys and create
+            /// \see{Cipher}, \see{MAC} and \see{Authenticator} instances.
+            const CipherSuite cipherSuite;
+            /// \brief
+            /// Unique (process wide) id used to find this instance's thread caches.
+            const util::ui64 instanceId;
+            /// \brief
+            /// Thread caches can outlive this instance. They hold on to a weak
+            /// reference to lifetime so that stale caches can be purged.
+            std::shared_ptr<util::ui8> lifetime;
+            /// \brief
+            /// Version of the current snapshot. Lets readers
+            /// validate their cached snapshot without locking.
+            std::atomic<util::ui64> version;
+            /// \brief
+            /// Current snapshot.
+            Snapshot::SharedPtr snapshot;
+            /// \brief
+            /// Protects snapshot.
+            mutable util::SpinLock spinLock;
+            /// \brief
+            /// Serializes writers.
+            util::Mutex writerMutex;
+            /// \struct ConcurrentKeyRing::ThreadCache ConcurrentKeyRing.h
+            /// thekogans/crypto/ConcurrentKeyRing.h
+            ///
+            /// \brief
+            /// Forward declaration of the per thread state (see ConcurrentKeyRing.cpp).
+            struct ThreadCache;
+
+        public:
+            /// \brief
+            /// ctor. Create an empty key ring.
+            /// \param[in] cipherSuite_ \see{CipherSuite} used to validate keys.
+            explicit ConcurrentKeyRing (const CipherSuite &cipherSuite_ = CipherSuite::Strongest);
+            /// \brief
+            /// ctor. Seed the key ring with the \see{Cipher}, \see{MAC} and
+            /// \see{Authenticator} keys of the given \see{KeyRing}.
+            /// \param[in] keyRing \see{KeyRing} to seed the key ring from.
+            /// \param[in] recursive true = include the keys of sub rings.
+            explicit ConcurrentKeyRing (
+                const KeyRing &keyRing,
+                bool recursive = true);
+
+            /// \brief
+            /// Return the \see{CipherSuite}.
+            /// \return \see{CipherSuite}.
+            inline const CipherSuite &GetCipherSuite () const {
+                return cipherSuite;
+            }
+
+            /// \brief
+            /// Return the current snapshot version.
+            /// \return Current snapshot version.
+            inline util::ui64 GetVersion () const {
+                return version.load (std::memory_order_acquire);
+            }
+
+            /// \brief
+            /// Return the snapshot the calling thread reads from (refreshed
+            /// if a newer one was published). Use it to perform several lookups
+            /// against the same version.
+            /// \return Current \see{Snapshot}.
+            Snapshot::SharedPtr GetSnapshot () const;
+
+            /// \brief
+            /// Return the \see{Cipher} key with the given id.
+            /// \param[in] keyId \see{ID} of key to return.
+            /// \return \see{SymmetricKey} (0 = not found).
+            SymmetricKey::SharedPtr GetCipherKey (const ID &keyId) const;
+            /// \brief
+            /// Return the calling thread's \see{Cipher} for the key with the given id.
+            /// \param[in] keyId \see{ID} of \see{Cipher} key.
+            /// \return \see{Cipher} (0 = not found).
+            Cipher::SharedPtr GetCipher (const ID &keyId) const;
+            /// \brief
+            /// Add a \see{Cipher} key.
+            /// \param[in] key \see{SymmetricKey} to add.
+            /// \return true = added. false = a key with the same id already exists.
+            bool AddCipherKey (SymmetricKey::SharedPtr key);
+            /// \brief
+            /// Drop a \see{Cipher} key.
+            /// \param[in] keyId \see{ID} of key to drop.
+            /// \return true = dropped. false = not found.
+            bool DropCipherKey (const ID &keyId);
+            /// \brief
+            /// Atomically add newKey and drop the key with oldKeyId (readers
+            /// either see the old key or the new key, never neither).
+            /// \param[in] newKey \see{SymmetricKey} to add.
+            /// \param[in] oldKeyId \see{ID} of key to drop.
+            /// \return true = rotated. false = newKey already exists or oldKeyId not found.
+            bool RotateCipherKey (
+                SymmetricKey::SharedPtr newKey,
+                const ID &oldKeyId);
+
+            /// \brief
+            /// Return the \see{MAC} key with the given id.
+            /// \param[in] keyId \see{ID} of key to return.
+            /// \return \see{SymmetricKey} (0 = not found).
+            SymmetricKey::SharedPtr GetMACKey (const ID &keyId) const;
+            /// \brief
+            /// Return the calling thread's \see{MAC} for the key with the given id.
+            /// \param[in] keyId \see{ID} of \see{MAC} key.
+            /// \return \see{MAC} (0 = not found).
+            MAC::SharedPtr GetMAC (const ID &keyId) const;
+            /// \brief
+            /// Add a \see{MAC} key.
+            /// \param[in] key \see{SymmetricKey} to add.
+            /// \return true = added. false = a key with the same id already exists.
+            bool AddMACKey (SymmetricKey::SharedPtr key);
+            /// \brief
+            /// Drop a \see{MAC} key.
+            /// \param[in] keyId \see{ID} of key to drop.
+            /// \return true = dropped. false = not found.
+            bool DropMACKey (const ID &keyId);
+
+            /// \brief
+            /// Return the \see{Authenticator} key with the given id.
+            /// \param[in] keyId \see{ID} of key to return.
+            /// \return \see{AsymmetricKey} (0 = not found).
+            AsymmetricKey::SharedPtr GetAuthenticatorKey (const ID &keyId) const;
+            /// \brief
+            /// Return the calling thread's \see{Authenticator} for the key with the given id.
+            /// \param[in] keyId \see{ID} of \see{Authenticator} key.
+            /// \return \see{Authenticator} (0 = not found).
+            Authenticator::SharedPtr GetAuthenticator (const ID &keyId) const;
+            /// \brief
+            /// Add an \see{Authenticator} key.
+            /// \param[in] key \see{AsymmetricKey} to add.
+            /// \return true = added. false = a key with the same id already exists.
+            bool AddAuthenticatorKey (AsymmetricKey::SharedPtr key);
+            /// \brief
+            /// Drop an \see{Authenticator} key.
+            /// \param[in] keyId \see{ID} of key to drop.
+            /// \return true = dropped. false = not found.
+            bool DropAuthenticatorKey (const ID &keyId);
+
+            /// \brief
+            /// Return a (flat) \see{KeyRing} containing the keys of the current snapshot.
+            /// \return \see{KeyRing}.
+            KeyRing::SharedPtr ToKeyRing () const;
+
+        private:
+            /// \brief
+            /// Return the calling thread's cache, refreshed to the current snapshot.
+            /// \return Calling thread's cache.
+            ThreadCache &GetThreadCache () const;
+            /// \brief
+            /// Publish a new snapshot. Must be called with writerMutex held.
+            /// \param[in] cipherKeys \see{Cipher} keys.
+            /// \param[in] macKeys \see{MAC} keys.
+            /// \param[in] authenticatorKeys \see{Authenticator} keys.
+            void Publish (
+                SymmetricKeyTable::SharedPtr cipherKeys,
+                SymmetricKeyTable::SharedPtr macKeys,
+                AsymmetricKeyTable::SharedPtr authenticatorKeys);
+            /// \brief
+            /// Return the current snapshot (takes the spin lock).
+            /// \return Current snapshot.
+            Snapshot::SharedPtr LoadSnapshot () const;
+
+            /// \brief
+            /// ConcurrentKeyRing is neither copy constructable, nor assignable.
+            THEKOGANS_CRYPTO_DISALLOW_COPY_AND_ASSIGN (ConcurrentKeyRing)
+        };
+
+    } // namespace crypto
+} // namespace thekogans
+
+#endif // !defined (__thekogans_crypto_ConcurrentKeyRing_h)
@@ -53,6 +53,56 @@ private:\
 /// Logging subsystem name.
 #define THEKOGANS_CRYPTO "thekogans_crypto"
 
+/// \def THEKOGANS_CRYPTO_MINIMAL
+/// Algorithm subset build for embedded and serverless targets. Compiles in
+/// only the AEADs (AES-GCM, ChaCha20-Poly1305), X25519 and Ed25519. It's a
+/// shorthand for all of the THEKOGANS_CRYPTO_NO_* features below.
+#if defined (THEKOGANS_CRYPTO_MINIMAL)
+    #if !defined (THEKOGANS_CRYPTO_NO_RSA)
+        #define THEKOGANS_CRYPTO_NO_RSA
+    #endif // !defined (THEKOGANS_CRYPTO_NO_RSA)
+    #if !defined (THEKOGANS_CRYPTO_NO_DSA)
+        #define THEKOGANS_CRYPTO_NO_DSA
+    #endif // !defined (THEKOGANS_CRYPTO_NO_DSA)
+    #if !defined (THEKOGANS_CRYPTO_NO_DH)
+        #define THEKOGANS_CRYPTO_NO_DH
+    #endif // !defined (THEKOGANS_CRYPTO_NO_DH)
+    #if !defined (THEKOGANS_CRYPTO_NO_EC)
+        #define THEKOGANS_CRYPTO_NO_EC
+    #endif // !defined (THEKOGANS_CRYPTO_NO_EC)
+    #if !defined (THEKOGANS_CRYPTO_NO_CBC)
+        #define THEKOGANS_CRYPTO_NO_CBC
+    #endif // !defined (THEKOGANS_CRYPTO_NO_CBC)
+#endif // defined (THEKOGANS_CRYPTO_MINIMAL)
+
+/// \def THEKOGANS_CRYPTO_HAVE_RSA
+/// RSA keys, signatures and key exchange (THEKOGANS_CRYPTO_NO_RSA to leave out).
+#if !defined (THEKOGANS_CRYPTO_NO_RSA)
+    #define THEKOGANS_CRYPTO_HAVE_RSA
+#endif // !defined (THEKOGANS_CRYPTO_NO_RSA)
+/// \def THEKOGANS_CRYPTO_HAVE_DSA
+/// DSA keys and signatures (THEKOGANS_CRYPTO_NO_DSA to leave out).
+#if !defined (THEKOGANS_CRYPTO_NO_DSA)
+    #define THEKOGANS_CRYPTO_HAVE_DSA
+#endif // !defined (THEKOGANS_CRYPTO_NO_DSA)
+/// \def THEKOGANS_CRYPTO_HAVE_DH
+/// Finite field DH (RFC 3526/5114 primes) key exchange
+/// (THEKOGANS_CRYPTO_NO_DH to leave out).
+#if !defined (THEKOGANS_CRYPTO_NO_DH)
+    #define THEKOGANS_CRYPTO_HAVE_DH
+#endif // !defined (THEKOGANS_CRYPTO_NO_DH)
+/// \def THEKOGANS_CRYPTO_HAVE_EC
+/// OpenSSL EC keys: ECDSA and ECDH over named and RFC 5114/5639 curves
+/// (THEKOGANS_CRYPTO_NO_EC to leave out). Ed25519 and X25519 are always in.
+#if !defined (THEKOGANS_CRYPTO_NO_EC)
+    #define THEKOGANS_CRYPTO_HAVE_EC
+#endif // !defined (THEKOGANS_CRYPTO_NO_EC)
+/// \def THEKOGANS_CRYPTO_HAVE_CBC
+/// AES-CBC + HMAC cipher suites (THEKOGANS_CRYPTO_NO_CBC to leave out).
+#if !defined (THEKOGANS_CRYPTO_NO_CBC)
+    #define THEKOGANS_CRYPTO_HAVE_CBC
+#endif // !defined (THEKOGANS_CRYPTO_NO_CBC)
+
 /// \def THEKOGANS_CRYPTO_DEFAULT_CIPHER
 /// Default cipher.
 #define THEKOGANS_CRYPTO_DEFAULT_CIPHER EVP_aes_256_gcm ()
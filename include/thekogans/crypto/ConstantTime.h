@@ -0,0 +1,75 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined (__thekogans_crypto_ConstantTime_h)
+#define __thekogans_crypto_ConstantTime_h
+
+#include <cstddef>
+#include "thekogans/util/Types.h"
+#include "thekogans/crypto/Config.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        /// \brief
+        /// Compare two buffers in time that depends only on length (never on
+        /// the contents). Works 16 bytes at a time (SSE2 on x86, NEON on ARM)
+        /// and accumulates the differences without branching, so it's safe for
+        /// MAC/tag and \see{ID} comparisons. Unlike \see{TimeInsensitiveCompare},
+        /// it does not validate it's arguments (length == 0 compares equal).
+        /// \param[in] buffer1 First buffer to compare.
+        /// \param[in] buffer2 Second buffer to compare.
+        /// \param[in] length Length of both buffers.
+        /// \return true = identical, false = different.
+        _LIB_THEKOGANS_CRYPTO_DECL bool _LIB_THEKOGANS_CRYPTO_API
+            ConstantTimeCompare (
+                const void *buffer1,
+                const void *buffer2,
+                std::size_t length);
+
+        /// \brief
+        /// Branch free select: result = condition ? buffer1 : buffer2. Both
+        /// buffers are read in their entirety no matter what condition is.
+        /// result can alias either buffer.
+        /// \param[in] condition Selector.
+        /// \param[in] buffer1 Selected if condition is true.
+        /// \param[in] buffer2 Selected if condition is false.
+        /// \param[out] result Where to write the selected buffer.
+        /// \param[in] length Length of all three buffers.
+        _LIB_THEKOGANS_CRYPTO_DECL void _LIB_THEKOGANS_CRYPTO_API
+            ConstantTimeSelect (
+                bool condition,
+                const void *buffer1,
+                const void *buffer2,
+                void *result,
+                std::size_t length);
+
+        /// \brief
+        /// Zero a buffer holding secrets. Unlike a plain memset, the stores can't
+        /// be optimized away (even if the buffer is about to go out of scope or
+        /// be freed). Use it in destructors and on stack temporaries.
+        /// \param[in] buffer Buffer to wipe.
+        /// \param[in] length Buffer length.
+        _LIB_THEKOGANS_CRYPTO_DECL void _LIB_THEKOGANS_CRYPTO_API
+            SecureZero (
+                void *buffer,
+                std::size_t length);
+
+    } // namespace crypto
+} // namespace thekogans
+
+#endif // !defined (__thekogans_crypto_ConstantTime_h)
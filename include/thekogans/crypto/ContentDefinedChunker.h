@@ -0,0 +1,125 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined (__thekogans_crypto_ContentDefinedChunker_h)
+#define __thekogans_crypto_ContentDefinedChunker_h
+
+#include <cstddef>
+#include "thekogans/util/Types.h"
+#include "thekogans/crypto/Config.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        /// \struct ContentDefinedChunker ContentDefinedChunker.h thekogans/crypto/ContentDefinedChunker.h
+        ///
+        /// \brief
+        /// ContentDefinedChunker implements FastCDC (Xia et al., USENIX ATC '16).
+        /// A gear rolling hash is run over the data and a chunk boundary is
+        /// declared wherever the hash has a run of zero bits. Since boundaries
+        /// depend only on the (last 64 bytes of) content, inserting or removing
+        /// bytes only changes the chunks around the edit, and every other chunk
+        /// (and it's hash) stays the same. Normalized chunking (a harder mask
+        /// before the average size, an easier one after) keeps the chunk sizes
+        /// tightly distributed around the average. No boundaries are declared
+        /// before minSize, and every chunk is cut at maxSize.
+        /// NOTE: The gear table is part of the chunk boundary definition,
+        /// changing it changes every chunk.
+
+        struct _LIB_THEKOGANS_CRYPTO_DECL ContentDefinedChunker {
+            /// \enum
+            /// ContentDefinedChunker constants.
+            enum {
+                /// \brief
+                /// Smallest allowed minSize.
+                MIN_CHUNK_SIZE = 64,
+                /// \brief
+                /// Default min chunk size (256 KB).
+                DEFAULT_MIN_CHUNK_SIZE = 256 * 1024,
+                /// \brief
+                /// Default average chunk size (1 MB).
+                DEFAULT_AVG_CHUNK_SIZE = 1024 * 1024,
+                /// \brief
+                /// Default max chunk size (4 MB).
+                DEFAULT_MAX_CHUNK_SIZE = 4 * 1024 * 1024
+            };
+
+        private:
+            /// \brief
+            /// No boundaries are declared before minSize.
+            std::size_t minSize;
+            /// \brief
+            /// Target chunk size.
+            std::size_t avgSize;
+            /// \brief
+            /// Chunks are cut at maxSize.
+            std::size_t maxSize;
+            /// \brief
+            /// Mask used before avgSize (harder to match).
+            util::ui64 maskS;
+            /// \brief
+            /// Mask used after avgSize (easier to match).
+            util::ui64 maskL;
+
+        public:
+            /// \brief
+            /// ctor.
+            /// \param[in] minSize_ No boundaries are declared before minSize_.
+            /// \param[in] avgSize_ Target chunk size.
+            /// \param[in] maxSize_ Chunks are cut at maxSize_.
+            ContentDefinedChunker (
+                std::size_t minSize_ = DEFAULT_MIN_CHUNK_SIZE,
+                std::size_t avgSize_ = DEFAULT_AVG_CHUNK_SIZE,
+                std::size_t maxSize_ = DEFAULT_MAX_CHUNK_SIZE);
+
+            /// \brief
+            /// Return the min chunk size.
+            /// \return Min chunk size.
+            inline std::size_t GetMinSize () const {
+                return minSize;
+            }
+            /// \brief
+            /// Return the average chunk size.
+            /// \return Average chunk size.
+            inline std::size_t GetAvgSize () const {
+                return avgSize;
+            }
+            /// \brief
+            /// Return the max chunk size.
+            /// \return Max chunk size.
+            inline std::size_t GetMaxSize () const {
+                return maxSize;
+            }
+
+            /// \brief
+            /// Return the length of the chunk at the beginning of data.
+            /// The rest of the data is chunked by calling FindBoundary again
+            /// with the remainder (which must start with the bytes right after
+            /// the returned chunk). If the data is shorter than maxSize, pass
+            /// all that's left (the last chunk ends where the data does).
+            /// \param[in] data Data to chunk.
+            /// \param[in] length Data length (only the first maxSize bytes are looked at).
+            /// \return Length of the first chunk (0 < length <= maxSize, 0 == length == 0).
+            std::size_t FindBoundary (
+                const util::ui8 *data,
+                std::size_t length) const;
+        };
+
+    } // namespace crypto
+} // namespace thekogans
+
+#endif // !defined (__thekogans_crypto_ContentDefinedChunker_h)
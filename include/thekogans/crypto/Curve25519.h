@@ -34,6 +34,7 @@
 
 #include <cstddef>
 #include "thekogans/util/Types.h"
+#include "thekogans/util/SecureAllocator.h"
 #include "thekogans/crypto/Config.h"
 
 namespace thekogans {
@@ -60,7 +61,70 @@ namespace thekogans {
                 PUBLIC_KEY_LENGTH = 32,
                 /// \brief
                 /// Signature length.
-                SIGNATURE_LENGTH = 64
+                SIGNATURE_LENGTH = 64,
+                /// \brief
+                /// Expanded private key length (clamped scalar,
+                /// nonce prefix and public key).
+                EXPANDED_PRIVATE_KEY_LENGTH = 96,
+                /// \brief
+                /// Max signatures checked by one VerifyBufferSignatureBatch equation.
+                BATCH_CHUNK_SIZE = 64,
+                /// \brief
+                /// PreparedPublicKey table size (in 64 bit words): the 8 odd
+                /// multiples (A, 3A, ..., 15A) of the decompressed, negated public key.
+                PREPARED_PUBLIC_KEY_TABLE_SIZE = 8 * 4 * 5
+            };
+
+            /// \struct Ed25519::ExpandedPrivateKey Curve25519.h thekogans/crypto/Curve25519.h
+            ///
+            /// \brief
+            /// The private key as SignBuffer uses it: SHA512 (seed) with the scalar
+            /// half clamped, followed by the public key. Expanding it is a SHA512
+            /// per signature, so signers that sign repeatedly with the same key
+            /// should expand it once and use the ExpandedPrivateKey SignBuffer overload.
+            /// The expanded key lives in secure memory and is wiped in the dtor.
+            struct _LIB_THEKOGANS_CRYPTO_DECL ExpandedPrivateKey {
+                /// \brief
+                /// Clamped scalar (32 bytes), nonce prefix (32 bytes) and public key (32 bytes).
+                util::SecureVector<util::ui8> key;
+
+                /// \brief
+                /// ctor.
+                /// \param[in] privateKey Private key to expand.
+                explicit ExpandedPrivateKey (const util::ui8 privateKey[PRIVATE_KEY_LENGTH]);
+                /// \brief
+                /// dtor.
+                ~ExpandedPrivateKey ();
+
+                /// \brief
+                /// ExpandedPrivateKey is neither copy constructable, nor assignable.
+                THEKOGANS_CRYPTO_DISALLOW_COPY_AND_ASSIGN (ExpandedPrivateKey)
+            };
+
+            /// \struct Ed25519::PreparedPublicKey Curve25519.h thekogans/crypto/Curve25519.h
+            ///
+            /// \brief
+            /// A public key as VerifyBufferSignature uses it: decompressed (which
+            /// costs a field square root) and expanded into the variable base
+            /// table of the double scalar mult. Verifiers that verify repeatedly
+            /// with the same key should prepare it once and use the
+            /// PreparedPublicKey VerifyBufferSignature overload.
+            struct _LIB_THEKOGANS_CRYPTO_DECL PreparedPublicKey {
+                /// \brief
+                /// Compressed public key.
+                util::ui8 publicKey[PUBLIC_KEY_LENGTH];
+                /// \brief
+                /// false == publicKey is not a valid curve point
+                /// (every signature will fail to verify).
+                bool valid;
+                /// \brief
+                /// Odd multiples of -A (opaque, see Curve25519.cpp).
+                util::ui64 table[PREPARED_PUBLIC_KEY_TABLE_SIZE];
+
+                /// \brief
+                /// ctor.
+                /// \param[in] publicKey_ Public key to prepare.
+                explicit PreparedPublicKey (const util::ui8 publicKey_[PUBLIC_KEY_LENGTH]);
             };
 
             /// \brief
@@ -89,11 +153,28 @@ namespace thekogans {
                 std::size_t bufferLength,
                 const util::ui8 privateKey[PRIVATE_KEY_LENGTH],
                 util::ui8 signature[SIGNATURE_LENGTH]);
+            /// \brief
+            /// SignBuffer sets signature to be a signature of bufferLength bytes from
+            /// buffer using the given (pre)expanded private key.
+            /// \param[in] buffer Buffer to sign.
+            /// \param[in] bufferLength Buffer length.
+            /// \param[in] expandedPrivateKey Expanded private key used for signing.
+            /// \param[out] signature Generated buffer signature.
+            /// \return The number of bytes written to signature (SIGNATURE_LENGTH).
+            static std::size_t SignBuffer (
+                const void *buffer,
+                std::size_t bufferLength,
+                const ExpandedPrivateKey &expandedPrivateKey,
+                util::ui8 signature[SIGNATURE_LENGTH]);
 
             /// \brief
             /// VerifyBufferSignature returns true iff signature is a valid signature
             /// by publicKey of bufferLength bytes from buffer. It returns false
             /// otherwise.
+            /// NOTE: Signatures with s >= L, and public keys or R that are non
+            /// canonical or of small order are rejected. The check is then
+            /// cofactored (8 * (s * B - h * A - R) = 0), so it agrees with
+            /// VerifyBufferSignatureBatch.
             /// \param[in] buffer Buffer whose signature to verify.
             /// \param[in] bufferLength Buffer length.
             /// \param[in] publicKey Public key used to verify the buffer signature.
@@ -104,6 +185,52 @@ namespace thekogans {
                 std::size_t bufferLength,
                 const util::ui8 publicKey[PUBLIC_KEY_LENGTH],
                 const util::ui8 signature[SIGNATURE_LENGTH]);
+            /// \brief
+            /// VerifyBufferSignature returns true iff signature is a valid signature
+            /// by preparedPublicKey of bufferLength bytes from buffer. It returns false
+            /// otherwise.
+            /// \param[in] buffer Buffer whose signature to verify.
+            /// \param[in] bufferLength Buffer length.
+            /// \param[in] preparedPublicKey Prepared public key used to verify the buffer signature.
+            /// \param[in] signature Signature to verify.
+            /// \return true == signature is valid, false == signature is invalid.
+            static bool VerifyBufferSignature (
+                const void *buffer,
+                std::size_t bufferLength,
+                const PreparedPublicKey &preparedPublicKey,
+                const util::ui8 signature[SIGNATURE_LENGTH]);
+            /// \brief
+            /// VerifyBufferSignatureBatch verifies count (buffer, publicKey, signature)
+            /// triples at once. Instead of checking every signature on it's own, the
+            /// batch is checked with a single randomized linear combination:
+            ///
+            /// 8 * ((-sum (z[i] * s[i])) * B + sum (z[i] * R[i]) + sum (z[i] * h[i] * A[i])) = 0
+            ///
+            /// where z[i] are random 128 bit scalars. The point sum is computed by
+            /// interleaved (Straus) multi-scalar multiplication, sharing the doublings
+            /// between all the signatures, which roughly halves (or better) the cost
+            /// per signature. Large batches are checked in chunks of up to
+            /// BATCH_CHUNK_SIZE signatures. If a chunk fails, and results were
+            /// requested, it's signatures are verified one by one (VerifyBufferSignature)
+            /// so that the bad ones can be identified.
+            /// NOTE: The batch equation is cofactored (as allowed by RFC 8032), and so
+            /// is VerifyBufferSignature. Both reject s >= L, and non canonical or small
+            /// order public keys and R, so a signature (even a crafted one) gets the
+            /// same answer whichever path (or batch) it goes through.
+            /// \param[in] buffers Buffers whose signatures to verify.
+            /// \param[in] bufferLengths Buffer lengths.
+            /// \param[in] publicKeys Public keys used to verify the buffer signatures.
+            /// \param[in] signatures Signatures to verify.
+            /// \param[in] count Number of signatures to verify.
+            /// \param[out] results Optional per signature results (true == valid).
+            /// \return true == all signatures are valid, false == at least one is invalid.
+            static bool VerifyBufferSignatureBatch (
+                const void * const *buffers,
+                const std::size_t *bufferLengths,
+                const util::ui8 * const *publicKeys,
+                const util::ui8 * const *signatures,
+                std::size_t count,
+                bool *results = 0);
         };
 
         /// \struct X25519 Curve25519.h thekogans/crypto/Curve25519.h
@@ -159,7 +286,91 @@ namespace thekogans {
                 const util::ui8 privateKey[PRIVATE_KEY_LENGTH],
                 const util::ui8 peersPublicKey[PUBLIC_KEY_LENGTH],
                 util::ui8 sharedSecret[SHARED_SECRET_LENGTH]);
+            /// \brief
+            /// ComputeSharedSecrets computes count shared secrets at once (a reconnect
+            /// storm where every client re-handshakes at the same time). The ladders
+            /// are independent, so they are spread over workerCount threads.
+            /// \param[in] privateKeys My private keys.
+            /// \param[in] peersPublicKeys Peers' public keys.
+            /// \param[out] sharedSecrets Shared secrets computed from privateKeys[i]
+            /// and peersPublicKeys[i].
+            /// \param[in] count Number of shared secrets to compute.
+            /// \param[out] results If not 0, results[i] is set to false if
+            /// peersPublicKeys[i] is a point of small order (the all-zero shared secret).
+            /// If 0, such a point causes an exception to be thrown (as in ComputeSharedSecret).
+            /// \param[in] workerCount Number of threads to use (0 == one per CPU).
+            /// \return The number of shared secrets successfully computed.
+            static std::size_t ComputeSharedSecrets (
+                const util::ui8 * const *privateKeys,
+                const util::ui8 * const *peersPublicKeys,
+                util::ui8 * const *sharedSecrets,
+                std::size_t count,
+                bool *results = 0,
+                std::size_t workerCount = 0);
+        };
+
+    #if defined (THEKOGANS_CRYPTO_HAVE_TESTS)
+        /// \struct Curve25519Ref10 Curve25519.h thekogans/crypto/Curve25519.h
+        ///
+        /// \brief
+        /// Curve25519Ref10 exposes the primitives built on the portable ref10
+        /// (radix 2^25.5) field backend. With THEKOGANS_CRYPTO_HAVE_CURVE25519_FE51,
+        /// \see{Ed25519} and \see{X25519} run on the radix 2^51 backend and ref10
+        /// would otherwise go untested. Curve25519Ref10 lets the tests hold both
+        /// backends to the same known answers. It's only present in test builds.
+
+        struct _LIB_THEKOGANS_CRYPTO_DECL Curve25519Ref10 {
+            /// \brief
+            /// \see{X25519::ComputeSharedSecret}. Unlike X25519::ComputeSharedSecret,
+            /// the all-zero (small order) result is returned, not thrown.
+            /// \param[in] privateKey My private key.
+            /// \param[in] peerPublicKey Peer's public key.
+            /// \param[out] sharedSecret Where to write the shared secret.
+            static void X25519ComputeSharedSecret (
+                const util::ui8 privateKey[X25519::PRIVATE_KEY_LENGTH],
+                const util::ui8 peerPublicKey[X25519::PUBLIC_KEY_LENGTH],
+                util::ui8 sharedSecret[X25519::SHARED_SECRET_LENGTH]);
+            /// \brief
+            /// \see{Ed25519::SignBuffer}.
+            /// \param[in] buffer Buffer whose signature to create.
+            /// \param[in] bufferLength Buffer length.
+            /// \param[in] privateKey Private key used for signing.
+            /// \param[out] signature Where to write the signature.
+            /// \return Number of bytes written to signature.
+            static std::size_t Ed25519SignBuffer (
+                const void *buffer,
+                std::size_t bufferLength,
+                const util::ui8 privateKey[Ed25519::PRIVATE_KEY_LENGTH],
+                util::ui8 signature[Ed25519::SIGNATURE_LENGTH]);
+            /// \brief
+            /// \see{Ed25519::VerifyBufferSignature}.
+            /// \param[in] buffer Buffer whose signature to verify.
+            /// \param[in] bufferLength Buffer length.
+            /// \param[in] publicKey Public key used for signature verification.
+            /// \param[in] signature Signature to verify.
+            /// \return true == the signature is valid, false == the signature is invalid.
+            static bool Ed25519VerifyBufferSignature (
+                const void *buffer,
+                std::size_t bufferLength,
+                const util::ui8 publicKey[Ed25519::PUBLIC_KEY_LENGTH],
+                const util::ui8 signature[Ed25519::SIGNATURE_LENGTH]);
+            /// \brief
+            /// \see{Ed25519::VerifyBufferSignatureBatch}. Runs the multi-scalar
+            /// batch equation only (no culprit search).
+            /// \param[in] buffers Buffers whose signatures to verify.
+            /// \param[in] bufferLengths Buffer lengths.
+            /// \param[in] publicKeys Public keys used for signature verification.
+            /// \param[in] signatures Signatures to verify.
+            /// \param[in] count Number of signatures to verify.
+            /// \return true == all signatures are valid, false == at least one is invalid.
+            static bool Ed25519VerifyBufferSignatureBatch (
+                const void * const *buffers,
+                const std::size_t *bufferLengths,
+                const util::ui8 * const *publicKeys,
+                const util::ui8 * const *signatures,
+                std::size_t count);
         };
+    #endif // defined (THEKOGANS_CRYPTO_HAVE_TESTS)
 
     } // namespace crypto
 } // namespace thekogans
@@ -39,8 +39,11 @@ namespace thekogans {
 
         struct _LIB_THEKOGANS_CRYPTO_DECL DH {
             /// \brief
-            /// Generate a fresh prime given the prime length. This method is by far
-            /// the slowest as finding suitable primes for DH is not easy.
+            /// Return DH parameters for the given prime length and generator. If a
+            /// registered \see{DHParamsCache} holds a validated group matching the
+            /// given prime length and generator, it is returned instantly. Otherwise
+            /// a fresh prime is generated (see GenerateParams). This is by far the
+            /// slowest method as finding suitable primes for DH is not easy.
             /// \param[in] primeLength Length of prime to generate.
             /// \param[in] generator DH generator.
             /// \param[in] id Optional parameters id.
@@ -54,6 +57,31 @@ namespace thekogans {
                 const std::string &name = std::string (),
                 const std::string &description = std::string ());
 
+            /// \brief
+            /// Generate a fresh prime given the prime length. Unlike
+            /// ParamsFromPrimeLengthAndGenerator, this method never consults
+            /// the \see{DHParamsCache}, and can take minutes for 2048+ bit primes.
+            /// \param[in] primeLength Length of prime to generate.
+            /// \param[in] generator DH generator.
+            /// \param[in] id Optional parameters id.
+            /// \param[in] name Optional parameters name.
+            /// \param[in] description Optional parameters description.
+            /// \return DH parameters suitable for key and shared secret generation.
+            static Params::SharedPtr GenerateParams (
+                std::size_t primeLength,
+                std::size_t generator = DH_GENERATOR_2,
+                const ID &id = ID (),
+                const std::string &name = std::string (),
+                const std::string &description = std::string ());
+
+            /// \brief
+            /// Validate DH parameters (DH_check). Checks that the prime is a
+            /// safe prime and that the generator is suitable. Like generation,
+            /// this is slow for large primes.
+            /// \param[in] params DH parameters to validate.
+            /// \return true == params are valid DH parameters.
+            static bool ValidateParams (const Params &params);
+
             /// \brief
             /// Generate DH parameters from a given prime and generator.
             /// WARNING: Not every prime is a DH prime. They are fairly difficult to
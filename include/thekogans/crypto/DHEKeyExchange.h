@@ -20,8 +20,10 @@
 
 #include <cstddef>
 #include <string>
+#include <vector>
 #include "thekogans/util/Serializable.h"
 #include "thekogans/util/SpinLock.h"
+#include "thekogans/util/Buffer.h"
 #include "thekogans/crypto/Config.h"
 #include "thekogans/crypto/KeyExchange.h"
 #include "thekogans/crypto/Params.h"
@@ -131,10 +133,14 @@ namespace thekogans {
                 /// Given the peer's public \see{AsymmetricKey}, verify parameters signature.
                 /// \param[in] publicKey Peer's public key used to verify parameters signature.
                 /// \param[in] messageDigest Message digest object.
+                /// \param[in] validatedParamsCache Optional \see{ValidatedParamsCache}
+                /// consulted before (and updated after) verifying the signature.
                 /// \return true == signature is valid, false == signature is invalid.
                 virtual bool ValidateSignature (
                     AsymmetricKey::SharedPtr publicKey,
-                    MessageDigest::SharedPtr messageDigest) override;
+                    MessageDigest::SharedPtr messageDigest,
+                    ValidatedParamsCache::SharedPtr validatedParamsCache =
+                        ValidatedParamsCache::SharedPtr ()) override;
 
             protected:
                 // util::Serializable
@@ -207,6 +213,138 @@ namespace thekogans {
                 virtual void Write (util::JSON::Object &object) const override;
             };
 
+            /// \struct DHEKeyExchange::CompactDHEParams DHEKeyExchange.h thekogans/crypto/DHEKeyExchange.h
+            ///
+            /// \brief
+            /// A view over the compact (handshake) encoding of \see{DHEParams}
+            /// (\see{GetCompactParams}). The group is sent as a two byte id
+            /// (\see{GetGroupId}) and the public key as raw bytes (the X25519
+            /// key, the uncompressed EC point or the DH public value). Layout:
+            ///
+            /// ui8 version
+            /// id (ID::SIZE bytes)
+            /// ui16 group
+            /// ui8 messageDigestNameLength
+            /// messageDigestName
+            /// ui32 keyLength
+            /// ui32 count
+            /// keyId (ID::SIZE bytes)
+            /// ui8 saltLength
+            /// salt
+            /// publicKeyId (ID::SIZE bytes)
+            /// ui16 publicKeyLength
+            /// publicKey
+            /// signature trailer (\see{KeyExchange::CompactParams})
+            ///
+            /// NOTE: \see{SymmetricKey} name and description are not carried.
+            /// Keys derived from compact parameters have neither.
+            struct _LIB_THEKOGANS_CRYPTO_DECL CompactDHEParams : public CompactParams {
+                /// \brief
+                /// Group id (\see{GetGroupId}).
+                util::ui16 group;
+                /// \brief
+                /// OpenSSL message digest to use for hashing.
+                const char *messageDigestName;
+                /// \brief
+                /// messageDigestName length.
+                std::size_t messageDigestNameLength;
+                /// \brief
+                /// Length of the resulting \see{SymmetricKey} (in bytes).
+                util::ui32 keyLength;
+                /// \brief
+                /// A security counter.
+                util::ui32 count;
+                /// \brief
+                /// \see{SymmetricKey} id (ID::SIZE bytes).
+                const util::ui8 *keyId;
+                /// \brief
+                /// Salt for \see{SymmetricKey} derivation.
+                const util::ui8 *salt;
+                /// \brief
+                /// salt length.
+                std::size_t saltLength;
+                /// \brief
+                /// Public \see{AsymmetricKey} id (ID::SIZE bytes).
+                const util::ui8 *publicKeyId;
+                /// \brief
+                /// Raw public key.
+                const util::ui8 *publicKey;
+                /// \brief
+                /// publicKey length.
+                std::size_t publicKeyLength;
+
+                /// \brief
+                /// ctor.
+                CompactDHEParams () :
+                    group (0),
+                    messageDigestName (0),
+                    messageDigestNameLength (0),
+                    keyLength (0),
+                    count (0),
+                    keyId (0),
+                    salt (0),
+                    saltLength (0),
+                    publicKeyId (0),
+                    publicKey (0),
+                    publicKeyLength (0) {}
+
+                /// \brief
+                /// Parse the compact encoding in place. Nothing is copied; on
+                /// success the fields point in to buffer.
+                /// \param[in] buffer Compact encoding (\see{GetCompactParams}).
+                /// \param[in] length Buffer length.
+                /// \return true == success, false == malformed encoding.
+                bool Parse (
+                    const void *buffer,
+                    std::size_t length);
+
+                /// \brief
+                /// Materialize the \see{DHEParams} to pass to the \see{DHEKeyExchange}
+                /// ctor or \see{DeriveSharedSymmetricKey}. The group \see{Params} come
+                /// from the (cached) well-known group, and the public key is built
+                /// from the raw bytes. The returned \see{DHEParams} are unsigned;
+                /// use \see{KeyExchange::CompactParams::ValidateSignature} first.
+                /// \return \see{DHEParams}.
+                DHEParams::SharedPtr ToDHEParams () const;
+            };
+
+            /// \enum
+            /// Compact group ids (\see{GetGroupId}).
+            enum {
+                /// \brief
+                /// Not a well-known group. These can't be encoded compactly.
+                GROUP_UNKNOWN = 0x0000,
+                /// \brief
+                /// \see{X25519}.
+                GROUP_X25519 = 0x0001,
+                /// \brief
+                /// \see{EC::ParamsFromNamedCurve}. The low 12 bits are the nid.
+                GROUP_EC_NAMED_CURVE = 0x1000,
+                /// \brief
+                /// \see{EC::ParamsFromRFC5114Curve}. The low 8 bits are the curve.
+                GROUP_EC_RFC5114_CURVE = 0x2000,
+                /// \brief
+                /// \see{EC::ParamsFromRFC5639Curve}. The low 8 bits are the curve.
+                GROUP_EC_RFC5639_CURVE = 0x2100,
+                /// \brief
+                /// \see{DH::ParamsFromRFC3526Prime}. The low 8 bits are the prime.
+                GROUP_DH_RFC3526_PRIME = 0x3000,
+                /// \brief
+                /// \see{DH::ParamsFromRFC5114Prime}. The low 8 bits are the prime.
+                GROUP_DH_RFC5114_PRIME = 0x3100
+            };
+
+            /// \brief
+            /// Return the compact group id of the given \see{Params}.
+            /// \param[in] params \see{X25519}, \see{EC} or \see{DH} \see{Params}.
+            /// \return Compact group id (GROUP_UNKNOWN if params are not a well-known group).
+            static util::ui16 GetGroupId (const crypto::Params &params);
+            /// \brief
+            /// Return the \see{Params} represented by the given compact group id.
+            /// \param[in] group Compact group id (\see{GetGroupId}).
+            /// \return \see{Params} (0 if group is unknown).
+            static crypto::Params::SharedPtr GetGroupParams (util::ui16 group);
+
         private:
             /// \brief
             /// true == Initiator of key exchange, false == Receiver of key exchange.
@@ -282,13 +420,99 @@ namespace thekogans {
                 AsymmetricKey::SharedPtr privateKey = AsymmetricKey::SharedPtr (),
                 MessageDigest::SharedPtr messageDigest = MessageDigest::SharedPtr ()) const override;
 
+            /// \brief
+            /// Get the compact encoding of the parameters to send to the key exchange
+            /// peer (\see{CompactDHEParams}). The \see{Params} used to construct this
+            /// DHEKeyExchange must be a well-known group (\see{GetGroupId}).
+            /// \param[in] privateKey Optional my private \see{AsymmetricKey} used to create a signature
+            /// over the parameters.
+            /// \param[in] messageDigest Optional message digest used to hash the parameters.
+            /// \return Compact encoding of the parameters.
+            util::Buffer GetCompactParams (
+                AsymmetricKey::SharedPtr privateKey = AsymmetricKey::SharedPtr (),
+                MessageDigest::SharedPtr messageDigest = MessageDigest::SharedPtr ()) const;
+
             /// \brief
             /// Given the peer's \see{DHEParams}, use my private key
             /// to derive the shared \see{SymmetricKey}.
             /// \param[in] params Peer's \see{DHEParams} parameters.
             /// \return Shared \see{SymmetricKey}.
             virtual SymmetricKey::SharedPtr DeriveSharedSymmetricKey (Params::SharedPtr params) const override;
+            /// \brief
+            /// Same as above, but mix a per session salt (ex: client random ||
+            /// server random, exchanged in the clear) in to the KDF salt. Use it
+            /// when one side reuses it's ephemeral key (\see{SignedDHEParamsCache}),
+            /// so that every session still gets a unique key (and a replayed
+            /// handshake does not reproduce an old one). Both sides must pass the
+            /// same session salt. The key gets an id derived from the full KDF salt,
+            /// so both sides agree on it, and it differs from session to session.
+            /// \param[in] params Peer's \see{DHEParams} parameters.
+            /// \param[in] sessionSalt Per session salt.
+            /// \param[in] sessionSaltLength Per session salt length.
+            /// \return Shared \see{SymmetricKey}.
+            SymmetricKey::SharedPtr DeriveSharedSymmetricKey (
+                Params::SharedPtr params,
+                const void *sessionSalt,
+                std::size_t sessionSaltLength) const;
 
+            /// \struct DHEKeyExchange::PendingDerivation DHEKeyExchange.h thekogans/crypto/DHEKeyExchange.h
+            ///
+            /// \brief
+            /// A pending \see{DeriveSharedSymmetricKey} call, queued to be drained by
+            /// \see{DeriveSharedSymmetricKeys}.
+            struct _LIB_THEKOGANS_CRYPTO_DECL PendingDerivation {
+                /// \brief
+                /// DHEKeyExchange whose private key to use.
+                KeyExchange::SharedPtr keyExchange;
+                /// \brief
+                /// Peer's \see{DHEParams} parameters.
+                Params::SharedPtr params;
+                /// \brief
+                /// On return, the shared \see{SymmetricKey} (0 on error).
+                SymmetricKey::SharedPtr key;
+                /// \brief
+                /// On return, the reason the derivation failed (empty on success).
+                std::string error;
+
+                /// \brief
+                /// ctor.
+                /// \param[in] keyExchange_ DHEKeyExchange whose private key to use.
+                /// \param[in] params_ Peer's \see{DHEParams} parameters.
+                PendingDerivation (
+                    KeyExchange::SharedPtr keyExchange_ = KeyExchange::SharedPtr (),
+                    Params::SharedPtr params_ = Params::SharedPtr ()) :
+                    keyExchange (keyExchange_),
+                    params (params_) {}
+            };
+
+            /// \brief
+            /// Drain a queue of pending derivations. The X25519 shared secrets
+            /// are computed together by \see{X25519::ComputeSharedSecrets}
+            /// (spread over workerCount threads); the rest are derived one by one.
+            /// A failing derivation does not stop the others; check each error.
+            /// \param[in, out] pending Derivations to perform.
+            /// \param[in] workerCount Number of threads to use (0 == one per CPU).
+            static void DeriveSharedSymmetricKeys (
+                std::vector<PendingDerivation> &pending,
+                std::size_t workerCount = 0);
+
+        private:
+            /// \brief
+            /// Run the shared secret through the KDF described by dheParams.
+            /// \param[in] dheParams Peer's \see{DHEParams} parameters.
+            /// \param[in] secret Shared secret.
+            /// \param[in] secretLength Shared secret length.
+            /// \param[in] sessionSalt Optional per session salt.
+            /// \param[in] sessionSaltLength Per session salt length.
+            /// \return Shared \see{SymmetricKey}.
+            SymmetricKey::SharedPtr DeriveKey (
+                const DHEParams &dheParams,
+                const util::ui8 *secret,
+                std::size_t secretLength,
+                const void *sessionSalt = 0,
+                std::size_t sessionSaltLength = 0) const;
+
+        public:
             /// \brief
             /// DHEKeyExchange is neither copy constructable, nor assignable.
             THEKOGANS_CRYPTO_DISALLOW_COPY_AND_ASSIGN (DHEKeyExchange)
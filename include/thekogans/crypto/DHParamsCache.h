@@ -0,0 +1,225 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined (__thekogans_crypto_DHParamsCache_h)
+#define __thekogans_crypto_DHParamsCache_h
+
+#include <cstddef>
+#include <string>
+#include <map>
+#include <deque>
+#include <utility>
+#include <openssl/dh.h>
+#include "thekogans/util/Types.h"
+#include "thekogans/util/RefCounted.h"
+#include "thekogans/util/Mutex.h"
+#include "thekogans/util/Condition.h"
+#include "thekogans/util/OwnerVector.h"
+#include "thekogans/crypto/Config.h"
+#include "thekogans/crypto/Params.h"
+#include "thekogans/crypto/OpenSSLParams.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        /// \struct DHParamsCache DHParamsCache.h thekogans/crypto/DHParamsCache.h
+        ///
+        /// \brief
+        /// Generating a fresh 2048+ bit \see{DH} safe prime takes minutes, and so
+        /// does validating one (DH_check). DHParamsCache moves both off the startup
+        /// path. Call Prepare for every (prime length, generator) group you need.
+        /// Background threads load each group from the cache directory, or generate
+        /// and save it there. Every group is validated before it becomes available.
+        /// Register the cache and \see{DH::ParamsFromPrimeLengthAndGenerator}
+        /// returns a prepared group instantly:
+        ///
+        /// \code{.cpp}
+        /// using namespace thekogans;
+        ///
+        /// crypto::DHParamsCache::SharedPtr cache (
+        ///     new crypto::DHParamsCache ("/var/lib/myapp/dhparams"));
+        /// cache->Prepare (2048);
+        /// crypto::DHParamsCache::Register (cache);
+        /// ...
+        /// // Instant once the group is prepared.
+        /// crypto::Params::SharedPtr params =
+        ///     crypto::DH::ParamsFromPrimeLengthAndGenerator (2048);
+        /// \endcode
+        ///
+        /// To rotate a custom group, delete its file and Prepare it again
+        /// (or point a new cache at an empty directory).
+
+        struct _LIB_THEKOGANS_CRYPTO_DECL DHParamsCache : public virtual util::RefCounted {
+            /// \brief
+            /// Declare \see{RefCounted} pointers.
+            THEKOGANS_UTIL_DECLARE_REF_COUNTED_POINTERS (DHParamsCache)
+
+        private:
+            /// \brief
+            /// Directory where the prepared groups are kept (PEM encoded).
+            std::string directory;
+            /// \brief
+            /// (prime length, generator) pair.
+            typedef std::pair<std::size_t, std::size_t> Group;
+            /// \brief
+            /// Validated groups.
+            std::map<Group, OpenSSLParams::SharedPtr> groups;
+            /// \brief
+            /// Groups waiting to be prepared.
+            std::deque<Group> jobs;
+            /// \brief
+            /// Number of groups being prepared by the workers.
+            std::size_t busy;
+            /// \brief
+            /// Synchronization mutex.
+            util::Mutex mutex;
+            /// \brief
+            /// Signaled when a job is queued (or when done).
+            util::Condition jobsCondition;
+            /// \brief
+            /// Signaled when a worker finishes a job (or when done).
+            util::Condition idleCondition;
+            /// \brief
+            /// true == the cache has been stopped.
+            bool done;
+            /// \struct DHParamsCache::Worker DHParamsCache.cpp thekogans/crypto/DHParamsCache.cpp
+            ///
+            /// \brief
+            /// Background thread that prepares the groups.
+            struct Worker;
+            /// \brief
+            /// Background threads.
+            util::OwnerVector<Worker> workers;
+
+        public:
+            /// \brief
+            /// ctor. Starts the background threads.
+            /// \param[in] directory_ Directory where the prepared groups are kept.
+            /// It must exist.
+            /// \param[in] workerCount Number of background threads.
+            explicit DHParamsCache (
+                const std::string &directory_,
+                std::size_t workerCount = 1);
+            /// \brief
+            /// dtor. Stops the background threads.
+            virtual ~DHParamsCache ();
+
+            /// \brief
+            /// Return the directory where the prepared groups are kept.
+            /// \return Directory where the prepared groups are kept.
+            inline const std::string &GetDirectory () const {
+                return directory;
+            }
+
+            /// \brief
+            /// Queue the given group for preparation. A background thread will
+            /// load it from the cache directory (or generate and save it), and
+            /// validate it. Preparing a group that's already prepared (or
+            /// queued) is a no-op.
+            /// \param[in] primeLength Length of prime.
+            /// \param[in] generator DH generator.
+            void Prepare (
+                std::size_t primeLength,
+                std::size_t generator = DH_GENERATOR_2);
+
+            /// \brief
+            /// Return a prepared group.
+            /// \param[in] primeLength Length of prime.
+            /// \param[in] generator DH generator.
+            /// \param[in] id Optional parameters id.
+            /// \param[in] name Optional parameters name.
+            /// \param[in] description Optional parameters description.
+            /// \return DH parameters (0 == the group is not prepared (yet)).
+            Params::SharedPtr Get (
+                std::size_t primeLength,
+                std::size_t generator = DH_GENERATOR_2,
+                const ID &id = ID (),
+                const std::string &name = std::string (),
+                const std::string &description = std::string ());
+
+            /// \brief
+            /// Block until every queued group has been prepared (or dropped
+            /// because it failed validation).
+            void WaitForIdle ();
+
+            /// \brief
+            /// Stop the background threads. Groups still queued are dropped.
+            /// Prepared groups remain available through Get.
+            void Stop ();
+
+            /// \brief
+            /// Return the path of the file the given group is kept in.
+            /// \param[in] primeLength Length of prime.
+            /// \param[in] generator DH generator.
+            /// \return Path of the file the given group is kept in.
+            std::string GetPath (
+                std::size_t primeLength,
+                std::size_t generator) const;
+
+            /// \brief
+            /// Register a cache. Registered caches are used by
+            /// \see{DH::ParamsFromPrimeLengthAndGenerator}.
+            /// \param[in] cache Cache to register.
+            static void Register (SharedPtr cache);
+            /// \brief
+            /// Unregister a previously registered cache.
+            /// \param[in] cache Cache to unregister.
+            static void Unregister (SharedPtr cache);
+            /// \brief
+            /// Return a prepared group from the first registered cache that has it.
+            /// \param[in] primeLength Length of prime.
+            /// \param[in] generator DH generator.
+            /// \param[in] id Optional parameters id.
+            /// \param[in] name Optional parameters name.
+            /// \param[in] description Optional parameters description.
+            /// \return DH parameters (0 == none of the registered caches have it).
+            static Params::SharedPtr Find (
+                std::size_t primeLength,
+                std::size_t generator,
+                const ID &id = ID (),
+                const std::string &name = std::string (),
+                const std::string &description = std::string ());
+
+        private:
+            /// \brief
+            /// Used by the workers to wait for a job.
+            /// \param[out] group Group to prepare.
+            /// \return true == got a job, false == done.
+            bool GetJob (Group &group);
+            /// \brief
+            /// Used by the workers to report a finished job.
+            /// \param[in] group Group that was prepared.
+            /// \param[in] params Validated params (0 == preparation failed).
+            void FinishJob (
+                const Group &group,
+                OpenSSLParams::SharedPtr params);
+            /// \brief
+            /// Load (or generate and save) and validate the given group.
+            /// Called by the workers without the lock held.
+            /// \param[in] group Group to prepare.
+            /// \return Validated params (0 == validation failed).
+            OpenSSLParams::SharedPtr PrepareGroup (const Group &group) const;
+
+            /// \brief
+            /// DHParamsCache is neither copy constructable, nor assignable.
+            THEKOGANS_CRYPTO_DISALLOW_COPY_AND_ASSIGN (DHParamsCache)
+        };
+
+    } // namespace crypto
+} // namespace thekogans
+
+#endif // !defined (__thekogans_crypto_DHParamsCache_h)
@@ -32,7 +32,8 @@ namespace thekogans {
         /// \struct Decryptor Decryptor.h thekogans/crypto/Decryptor.h
         ///
         /// \brief
-        /// Decryptor implements symmetric decryption using AES (CBC or GCM mode).
+        /// Decryptor implements symmetric decryption using AES (CBC or GCM mode)
+        /// or ChaCha20-Poly1305.
         /// NOTE: Decryptor implements a low level API and is exposed in case you
         /// need to decrypt multiple disjoint buffers. That said, there are a lot
         /// of pitfalls to using it (no \see{MAC} validation...). You are strongly
@@ -48,6 +49,10 @@ namespace thekogans {
             /// \brief
             /// Decryptor stats.
             Stats stats;
+            /// \brief
+            /// \see{util::HRTimer::Click} taken in Init (used to
+            /// compute the operation latency when it's enabled).
+            util::ui64 start;
 
         public:
             /// \brief
@@ -57,6 +62,11 @@ namespace thekogans {
             Decryptor (
                 SymmetricKey::SharedPtr key,
                 const EVP_CIPHER *cipher = THEKOGANS_CRYPTO_DEFAULT_CIPHER);
+            /// \brief
+            /// ctor. Copy an already keyed context instead of expanding
+            /// the key again (\see{CipherKeySchedule}).
+            /// \param[in] prepared Context keyed for decryption (no iv).
+            explicit Decryptor (const CipherContext &prepared);
 
             /// \brief
             /// Return max buffer length needed to decrypt the given amount of ciphertext.
@@ -71,7 +81,7 @@ namespace thekogans {
             /// \param[in] iv Initialization vector used for decryption.
             void Init (const util::ui8 *iv);
             /// \brief
-            /// In GCM mode, call this method 0 or more times to set the
+            /// In AEAD mode (GCM, ChaCha20-Poly1305), call this method 0 or more times to set the
             /// associated data.
             /// VERY IMPORTANT: This method must be called before the first call to Update.
             /// \param[in] associatedData Buffer containing associated data.
@@ -109,6 +119,12 @@ namespace thekogans {
             inline const Stats &GetStats () const {
                 return stats;
             }
+            /// \brief
+            /// Return the reference to stats.
+            /// \return Reference to stats.
+            inline Stats &GetStats () {
+                return stats;
+            }
 
             /// \brief
             /// Decryptor is neither copy constructable, nor assignable.
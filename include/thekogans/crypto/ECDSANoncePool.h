@@ -0,0 +1,317 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined (__thekogans_crypto_ECDSANoncePool_h)
+#define __thekogans_crypto_ECDSANoncePool_h
+
+#include <cstddef>
+#include <memory>
+#include <deque>
+#include <openssl/bn.h>
+#include "thekogans/util/Types.h"
+#include "thekogans/util/RefCounted.h"
+#include "thekogans/util/Mutex.h"
+#include "thekogans/util/Condition.h"
+#include "thekogans/util/OwnerVector.h"
+#include "thekogans/crypto/Config.h"
+#include "thekogans/crypto/OpenSSLUtils.h"
+#include "thekogans/crypto/AsymmetricKey.h"
+#include "thekogans/crypto/HKDF.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        /// \struct ECDSANoncePool ECDSANoncePool.h thekogans/crypto/ECDSANoncePool.h
+        ///
+        /// \brief
+        /// Most of an ECDSA signature is spent on the nonce: k * G and k^-1 mod n.
+        /// Neither depends on the message. ECDSANoncePool splits signing in to
+        /// an offline and an online half. Background threads keep a queue of
+        /// (k^-1, r) pairs for one \see{EC} private key filled to a target depth,
+        /// and the online sign is left with a couple of multiplications mod n.
+        /// Every pair is handed out exactly once (and wiped when it's used, or
+        /// when the pool is stopped). If the pool is empty, Sign computes the
+        /// nonce inline. Hits and misses are tracked to help size the pool
+        /// (\see{GetStats}).
+        ///
+        /// Nonces come from OpenSSL's RNG (ECDSA_sign_setup), or, given a secret
+        /// seed, from HKDF (seed, salt = random pool salt | key id, info = counter).
+        /// A precomputed nonce can't be bound to the message the way RFC 6979 binds
+        /// it, so seeded nonces are hedged: the random salt makes sure that a
+        /// restarted pool never replays the nonces of an earlier one (reusing a
+        /// nonce with a different message reveals the private key), while the seed
+        /// protects against a weak RNG.
+        ///
+        /// A pool is bound to the process that created it. fork () copies the
+        /// queued pairs (and the seeded nonce counter) in to the child, and the
+        /// parent and the child would then sign different messages with the same
+        /// k. Sign (and Stop) notice the pid change and, in the child, drop every
+        /// queued pair, re-salt the seeded HKDF from \see{util::GlobalRandomSource}
+        /// and restart the background threads (which fork does not copy).
+        ///
+        /// Register a pool to have \see{OpenSSLSigner} (and so \see{Authenticator})
+        /// use it for every signer created with the pool's key:
+        ///
+        /// \code{.cpp}
+        /// using namespace thekogans;
+        ///
+        /// crypto::ECDSANoncePool::Register (
+        ///     crypto::ECDSANoncePool::SharedPtr (
+        ///         new crypto::ECDSANoncePool (privateKey)));
+        /// crypto::Authenticator signer (privateKey, messageDigest);
+        /// \endcode
+        ///
+        /// NOTE: Pooled signatures are computed in software by the legacy ECDSA
+        /// entry points (ECDSA_do_sign_ex), bypassing any engine installed for
+        /// EC keys (\see{OpenSSLInit::SetEngine}).
+
+        struct _LIB_THEKOGANS_CRYPTO_DECL ECDSANoncePool : public virtual util::RefCounted {
+            /// \brief
+            /// Declare \see{RefCounted} pointers.
+            THEKOGANS_UTIL_DECLARE_REF_COUNTED_POINTERS (ECDSANoncePool)
+
+            enum {
+                /// \brief
+                /// Default number of nonces to keep in the pool.
+                DEFAULT_DEPTH = 64,
+                /// \brief
+                /// Length of the random salt mixed in to seeded nonces.
+                SALT_LENGTH = 32
+            };
+
+            /// \struct ECDSANoncePool::Stats ECDSANoncePool.h thekogans/crypto/ECDSANoncePool.h
+            ///
+            /// \brief
+            /// Pool statistics.
+            struct _LIB_THEKOGANS_CRYPTO_DECL Stats {
+                /// \brief
+                /// Number of nonces currently in the pool.
+                std::size_t nonces;
+                /// \brief
+                /// Number of nonces generated by the background threads.
+                util::ui64 generated;
+                /// \brief
+                /// Number of signatures made with a precomputed nonce.
+                util::ui64 hits;
+                /// \brief
+                /// Number of signatures that found the pool empty
+                /// (and computed the nonce inline).
+                util::ui64 misses;
+
+                /// \brief
+                /// ctor.
+                Stats () :
+                    nonces (0),
+                    generated (0),
+                    hits (0),
+                    misses (0) {}
+            };
+
+        private:
+            /// \brief
+            /// \see{EC} private key the nonces are for.
+            AsymmetricKey::SharedPtr privateKey;
+            /// \brief
+            /// privateKey's EC_KEY.
+            EC_KEYPtr ecKey;
+            /// \brief
+            /// Number of nonces to keep in the pool.
+            std::size_t depth;
+            /// \brief
+            /// Keyed with the seed (0 == nonces come from OpenSSL's RNG).
+            std::unique_ptr<HKDF> hkdf;
+            /// \brief
+            /// Next seeded nonce index.
+            util::ui64 counter;
+            /// \struct ECDSANoncePool::Nonce ECDSANoncePool.h thekogans/crypto/ECDSANoncePool.h
+            ///
+            /// \brief
+            /// A precomputed (k^-1, r) pair.
+            struct Nonce {
+                /// \brief
+                /// k^-1 mod n.
+                BIGNUM *kinv;
+                /// \brief
+                /// x (k * G) mod n.
+                BIGNUM *r;
+
+                /// \brief
+                /// ctor.
+                /// \param[in] kinv_ k^-1 mod n.
+                /// \param[in] r_ x (k * G) mod n.
+                Nonce (
+                    BIGNUM *kinv_ = 0,
+                    BIGNUM *r_ = 0) :
+                    kinv (kinv_),
+                    r (r_) {}
+
+                /// \brief
+                /// Wipe and free the pair.
+                void Clear ();
+            };
+            /// \brief
+            /// Precomputed nonces.
+            std::deque<Nonce> nonces;
+            /// \brief
+            /// Pool stats.
+            Stats stats;
+            /// \brief
+            /// Synchronization mutex.
+            util::Mutex mutex;
+            /// \brief
+            /// Signaled when a nonce is taken from the pool (or when done).
+            util::Condition refillCondition;
+            /// \brief
+            /// true == the pool has been stopped.
+            bool done;
+            /// \struct ECDSANoncePool::Worker ECDSANoncePool.cpp thekogans/crypto/ECDSANoncePool.cpp
+            ///
+            /// \brief
+            /// Background thread that keeps the pool filled.
+            struct Worker;
+            /// \brief
+            /// Background threads.
+            util::OwnerVector<Worker> workers;
+            /// \brief
+            /// Number of background threads.
+            std::size_t workerCount;
+            /// \brief
+            /// Id of the process that owns the queued nonces and the workers.
+            util::ui64 ownerPid;
+
+        public:
+            /// \brief
+            /// ctor. Starts the background threads.
+            /// \param[in] privateKey_ \see{EC} private key the nonces are for.
+            /// \param[in] depth_ Number of nonces to keep in the pool.
+            /// \param[in] workerCount_ Number of background threads.
+            /// \param[in] seed Optional secret seed (0 == nonces come from OpenSSL's RNG).
+            /// \param[in] seedLength Seed length.
+            ECDSANoncePool (
+                AsymmetricKey::SharedPtr privateKey_,
+                std::size_t depth_ = DEFAULT_DEPTH,
+                std::size_t workerCount_ = 1,
+                const void *seed = 0,
+                std::size_t seedLength = 0);
+            /// \brief
+            /// dtor. Stops the background threads.
+            virtual ~ECDSANoncePool ();
+
+            /// \brief
+            /// Return the private key the nonces are for.
+            /// \return Private key the nonces are for.
+            inline AsymmetricKey::SharedPtr GetPrivateKey () const {
+                return privateKey;
+            }
+            /// \brief
+            /// Return the number of nonces the pool is kept filled to.
+            /// \return Number of nonces the pool is kept filled to.
+            inline std::size_t GetDepth () const {
+                return depth;
+            }
+            /// \brief
+            /// Return true if the nonces are derived from a seed.
+            /// \return true == seeded, false == OpenSSL's RNG.
+            inline bool IsSeeded () const {
+                return hkdf.get () != 0;
+            }
+
+            /// \brief
+            /// Return true if the given key is the pool's key.
+            /// \param[in] key Key to compare to.
+            /// \return true == key matches the pool's key.
+            bool Matches (const AsymmetricKey &key) const;
+
+            /// \brief
+            /// Sign the given digest with the next nonce in the pool (or with
+            /// one computed inline if the pool is empty).
+            /// \param[in] digest Message digest to sign.
+            /// \param[in] digestLength Digest length.
+            /// \param[out] signature Where to write the DER encoded signature
+            /// (at least privateKey->GetKeyLength () bytes).
+            /// \return Number of bytes written to signature.
+            std::size_t Sign (
+                const util::ui8 *digest,
+                std::size_t digestLength,
+                util::ui8 *signature);
+
+            /// \brief
+            /// Return a snapshot of the pool stats.
+            /// \return Snapshot of the pool stats.
+            Stats GetStats ();
+
+            /// \brief
+            /// Stop the background threads and wipe the nonces still in the
+            /// pool. Sign keeps working (computing nonces inline).
+            void Stop ();
+
+            /// \brief
+            /// Register a pool. Registered pools are used by \see{OpenSSLSigner}s
+            /// created after the pool is registered.
+            /// \param[in] pool Pool to register.
+            static void Register (SharedPtr pool);
+            /// \brief
+            /// Unregister a previously registered pool.
+            /// \param[in] pool Pool to unregister.
+            static void Unregister (SharedPtr pool);
+            /// \brief
+            /// Find a registered pool for the given private key.
+            /// \param[in] privateKey Private key to match.
+            /// \return Matching pool (0 == none).
+            static SharedPtr Find (const AsymmetricKey &privateKey);
+
+        private:
+            /// \brief
+            /// Compute a new nonce.
+            /// \return New (k^-1, r) pair.
+            Nonce CreateNonce ();
+            /// \brief
+            /// Derive k from the seed.
+            /// \param[in] order Curve order.
+            /// \param[out] k Where to put k (in [1, order)).
+            /// \param[in] ctx Scratch BN_CTX.
+            void DeriveK (
+                const BIGNUM *order,
+                BIGNUM *k,
+                BN_CTX *ctx);
+            /// \brief
+            /// Start the background threads.
+            void StartWorkers ();
+            /// \brief
+            /// If we're running in a fork ()ed child, drop the parent's nonces
+            /// and worker threads, and re-salt the seeded HKDF.
+            /// VERY IMPORTANT: Must be called with the mutex held.
+            /// \param[in] restart true == start new worker threads.
+            void CheckOwner (bool restart);
+            /// \brief
+            /// Used by the workers to wait for room in the pool.
+            /// \return true == there's room, false == done.
+            bool WaitForRoom ();
+            /// \brief
+            /// Used by the workers to add a freshly computed nonce.
+            /// \param[in] nonce Nonce to add (freed if the pool is done).
+            void AddNonce (Nonce nonce);
+
+            /// \brief
+            /// ECDSANoncePool is neither copy constructable, nor assignable.
+            THEKOGANS_CRYPTO_DISALLOW_COPY_AND_ASSIGN (ECDSANoncePool)
+        };
+
+    } // namespace crypto
+} // namespace thekogans
+
+#endif // !defined (__thekogans_crypto_ECDSANoncePool_h)
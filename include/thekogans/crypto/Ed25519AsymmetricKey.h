@@ -88,6 +88,10 @@ namespace thekogans {
             virtual const char *GetKeyType () const override {
                 return KEY_TYPE;
             }
+            /// \brief
+            /// Return the interned key type id.
+            /// \return Interned key type id.
+            virtual util::ui32 GetKeyTypeId () const override;
 
             /// \brief
             /// Return the key length (in bits).
@@ -22,6 +22,7 @@
 #include "thekogans/crypto/Signer.h"
 #include "thekogans/crypto/AsymmetricKey.h"
 #include "thekogans/crypto/MessageDigest.h"
+#include "thekogans/crypto/Curve25519.h"
 
 namespace thekogans {
     namespace crypto {
@@ -36,6 +37,18 @@ namespace thekogans {
             /// Ed25519Signer is a \see{Signer}.
             THEKOGANS_CRYPTO_DECLARE_SIGNER (Ed25519Signer)
 
+        private:
+            /// \brief
+            /// The private key, expanded once (instead of once per signature).
+            Ed25519::ExpandedPrivateKey expandedPrivateKey;
+
+            /// \brief
+            /// Validate the private key and return it's bytes.
+            /// \param[in] privateKey Private key.
+            /// \return Ed25519 private key bytes.
+            static const util::ui8 *GetPrivateKey (AsymmetricKey::SharedPtr privateKey);
+
+        public:
             /// \brief
             /// ctor.
             /// \param[in] privateKey Private key.
@@ -22,6 +22,7 @@
 #include "thekogans/crypto/Verifier.h"
 #include "thekogans/crypto/AsymmetricKey.h"
 #include "thekogans/crypto/MessageDigest.h"
+#include "thekogans/crypto/Curve25519.h"
 
 namespace thekogans {
     namespace crypto {
@@ -37,6 +38,18 @@ namespace thekogans {
             /// Ed25519Verifier is a \see{Verifier}.
             THEKOGANS_CRYPTO_DECLARE_VERIFIER (Ed25519Verifier)
 
+        private:
+            /// \brief
+            /// The public key, decompressed once (instead of once per signature).
+            Ed25519::PreparedPublicKey preparedPublicKey;
+
+            /// \brief
+            /// Validate the public key and return it's bytes.
+            /// \param[in] publicKey Public key.
+            /// \return Ed25519 public key bytes.
+            static const util::ui8 *GetPublicKeyBytes (AsymmetricKey::SharedPtr publicKey);
+
+        public:
             /// \brief
             /// ctor.
             /// \param[in] publicKey Public key.
@@ -64,6 +77,18 @@ namespace thekogans {
                 const void *signature,
                 std::size_t signatureLength);
 
+            /// \brief
+            /// Used by \see{Verifier::VerifyBatch} to check all Ed25519 items at once.
+            /// \param[in] items Batch items.
+            /// \param[in] indices Indices of the Ed25519 items.
+            /// \param[out] results If not 0, receives a per item result
+            /// (only entries in indices are written).
+            /// \return true == all signatures match, false == at least one does not.
+            static bool VerifyBatch (
+                const std::vector<BatchItem> &items,
+                const std::vector<std::size_t> &indices,
+                std::vector<bool> *results = 0);
+
             /// \brief
             /// Ed25519Verifier is neither copy constructable, nor assignable.
             THEKOGANS_CRYPTO_DISALLOW_COPY_AND_ASSIGN (Ed25519Verifier)
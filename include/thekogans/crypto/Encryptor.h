@@ -33,7 +33,8 @@ namespace thekogans {
         /// \struct Encryptor Encryptor.h thekogans/crypto/Encryptor.h
         ///
         /// \brief
-        /// Encryptor implements symmetric encryption using AES (CBC or GCM mode).
+        /// Encryptor implements symmetric encryption using AES (CBC or GCM mode)
+        /// or ChaCha20-Poly1305.
         /// NOTE: Encryptor implements a low level API and is exposed in case you
         /// need to encrypt multiple disjoint buffers. That said, there are a lot
         /// of pitfalls to using it (no \see{MAC}...). You are strongly encouraged
@@ -42,22 +43,80 @@ namespace thekogans {
         /// is secure.
 
         struct _LIB_THEKOGANS_CRYPTO_DECL Encryptor {
+            /// \enum
+            /// IV generation policies.
+            enum IVPolicy {
+                /// \brief
+                /// Every iv is random (default). Safe for all modes.
+                IV_POLICY_RANDOM,
+                /// \brief
+                /// RFC 5116 (3.2) style ivs: a random per key salt (fixed field)
+                /// followed by a 64 bit monotonically increasing (big endian) counter.
+                /// The salt and counter live in the \see{SymmetricKey}, so all encryptors
+                /// on a key share one sequence (\see{SymmetricKey::GetNextCounterIV}).
+                /// Takes the random source off the per message path. The counter is never
+                /// allowed to wrap. AEAD (GCM, ChaCha20-Poly1305) ciphers only, as CBC
+                /// requires unpredictable ivs.
+                IV_POLICY_COUNTER
+            };
+
+            enum {
+                /// \brief
+                /// Length of IV_POLICY_COUNTER counter.
+                IV_COUNTER_LENGTH = util::UI64_SIZE
+            };
+
         private:
             /// \brief
             /// Cipher context used during encryption.
             CipherContext context;
             /// \brief
+            /// IV generation policy.
+            IVPolicy ivPolicy;
+            /// \brief
+            /// Key whose iv sequence IV_POLICY_COUNTER draws from.
+            SymmetricKey::SharedPtr key;
+            /// \brief
             /// Encryptor stats.
             Stats stats;
+            /// \brief
+            /// \see{util::HRTimer::Click} taken in Init (used to
+            /// compute the operation latency when it's enabled).
+            util::ui64 start;
 
         public:
             /// \brief
             /// ctor.
             /// \param[in] key SymmetricKey used for encryption.
             /// \param[in] cipher Cipher used for encryption.
+            /// \param[in] ivPolicy_ IV generation policy.
             Encryptor (
                 SymmetricKey::SharedPtr key,
-                const EVP_CIPHER *cipher = THEKOGANS_CRYPTO_DEFAULT_CIPHER);
+                const EVP_CIPHER *cipher = THEKOGANS_CRYPTO_DEFAULT_CIPHER,
+                IVPolicy ivPolicy_ = IV_POLICY_RANDOM);
+            /// \brief
+            /// ctor. Copy an already keyed context instead of expanding
+            /// the key again (\see{CipherKeySchedule}).
+            /// \param[in] key_ SymmetricKey the context was keyed with.
+            /// \param[in] prepared Context keyed for encryption (no iv).
+            /// \param[in] ivPolicy_ IV generation policy.
+            Encryptor (
+                SymmetricKey::SharedPtr key_,
+                const CipherContext &prepared,
+                IVPolicy ivPolicy_ = IV_POLICY_RANDOM);
+
+            /// \brief
+            /// Return the iv generation policy.
+            /// \return IV generation policy.
+            inline IVPolicy GetIVPolicy () const {
+                return ivPolicy;
+            }
+            /// \brief
+            /// Return the key's next IV_POLICY_COUNTER counter value.
+            /// \return Key's next IV_POLICY_COUNTER counter value.
+            inline util::ui64 GetIVCounter () const {
+                return key->GetIVCounter ();
+            }
 
             /// \brief
             /// Return the length of the initialization vector (IV) associated with the cipher.
@@ -76,12 +135,20 @@ namespace thekogans {
             }
 
             /// \brief
-            /// Generate a random iv and initialize the encryptor.
+            /// Generate an iv (according to the iv policy) and initialize the encryptor.
             /// \param[out] iv Where to place the generated iv.
             /// \return Number of bytes written to iv.
             std::size_t Init (util::ui8 *iv);
             /// \brief
-            /// In GCM mode, call this method 0 or more times to set the
+            /// Initialize the encryptor with a caller supplied iv. Use this method
+            /// when ivs are generated in bulk (\see{Cipher::EncryptBatch}).
+            /// VERY IMPORTANT: Never reuse an iv with the same key. When using
+            /// IV_POLICY_COUNTER, never mix caller supplied and counter generated ivs.
+            /// \param[in] iv Initialization vector (must be GetIVLength () bytes long).
+            /// \return Length of the iv.
+            std::size_t InitWithIV (const util::ui8 *iv);
+            /// \brief
+            /// In AEAD mode (GCM, ChaCha20-Poly1305), call this method 0 or more times to set the
             /// associated data.
             /// VERY IMPORTANT: This method must be called before the first call to Update.
             /// \param[in] associatedData Buffer containing associated data.
@@ -118,6 +185,18 @@ namespace thekogans {
             inline const Stats &GetStats () const {
                 return stats;
             }
+            /// \brief
+            /// Return the reference to stats.
+            /// \return Reference to stats.
+            inline Stats &GetStats () {
+                return stats;
+            }
+
+        private:
+            /// \brief
+            /// Make sure the iv has room for the IV_POLICY_COUNTER salt and
+            /// counter. Called by the ctors.
+            void ValidateIVPolicy () const;
 
             /// \brief
             /// Encryptor is neither copy constructable, nor assignable.
@@ -0,0 +1,217 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined (__thekogans_crypto_EphemeralKeyPool_h)
+#define __thekogans_crypto_EphemeralKeyPool_h
+
+#include <cstddef>
+#include <deque>
+#include "thekogans/util/Types.h"
+#include "thekogans/util/RefCounted.h"
+#include "thekogans/util/Mutex.h"
+#include "thekogans/util/Condition.h"
+#include "thekogans/util/OwnerVector.h"
+#include "thekogans/crypto/Config.h"
+#include "thekogans/crypto/Params.h"
+#include "thekogans/crypto/AsymmetricKey.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        /// \struct EphemeralKeyPool EphemeralKeyPool.h thekogans/crypto/EphemeralKeyPool.h
+        ///
+        /// \brief
+        /// Generating an ephemeral private key (especially a finite field \see{DH}
+        /// one) is a full modular exponentiation on the handshake critical path.
+        /// EphemeralKeyPool keeps a queue of keys, generated from one set of
+        /// \see{Params}, that background threads keep filled to a target depth.
+        /// Every key is handed out once, and the keys still in the pool are
+        /// dropped (and wiped) when the pool is stopped. If the pool is empty,
+        /// GetKey generates the key inline. Hits and misses are tracked to help
+        /// size the pool (\see{GetStats}).
+        ///
+        /// The pool works with any \see{Params}. Services that provision long
+        /// lived keys on demand (per-tenant \see{RSA} keys, for example) can keep
+        /// a pool of \see{RSA::ParamsFromKeyLength} keys and call GetKey on it
+        /// directly.
+        ///
+        /// Register a pool to have \see{DHEKeyExchange} take it's keys from it:
+        ///
+        /// \code{.cpp}
+        /// using namespace thekogans;
+        ///
+        /// crypto::EphemeralKeyPool::Register (
+        ///     crypto::EphemeralKeyPool::SharedPtr (
+        ///         new crypto::EphemeralKeyPool (
+        ///             crypto::DH::ParamsFromRFC3526Prime (crypto::DH::RFC3526_PRIME_3072))));
+        /// \endcode
+
+        struct _LIB_THEKOGANS_CRYPTO_DECL EphemeralKeyPool : public virtual util::RefCounted {
+            /// \brief
+            /// Declare \see{RefCounted} pointers.
+            THEKOGANS_UTIL_DECLARE_REF_COUNTED_POINTERS (EphemeralKeyPool)
+
+            enum {
+                /// \brief
+                /// Default number of keys to keep in the pool.
+                DEFAULT_DEPTH = 32
+            };
+
+            /// \struct EphemeralKeyPool::Stats EphemeralKeyPool.h thekogans/crypto/EphemeralKeyPool.h
+            ///
+            /// \brief
+            /// Pool statistics.
+            struct _LIB_THEKOGANS_CRYPTO_DECL Stats {
+                /// \brief
+                /// Number of keys currently in the pool.
+                std::size_t keys;
+                /// \brief
+                /// Number of keys generated by the background threads.
+                util::ui64 generated;
+                /// \brief
+                /// Number of GetKey calls satisfied from the pool.
+                util::ui64 hits;
+                /// \brief
+                /// Number of GetKey calls that found the pool empty
+                /// (and generated the key inline).
+                util::ui64 misses;
+
+                /// \brief
+                /// ctor.
+                Stats () :
+                    keys (0),
+                    generated (0),
+                    hits (0),
+                    misses (0) {}
+            };
+
+        private:
+            /// \brief
+            /// Params used to generate the keys.
+            Params::SharedPtr params;
+            /// \brief
+            /// Number of keys to keep in the pool.
+            std::size_t depth;
+            /// \brief
+            /// Pre-generated keys.
+            std::deque<AsymmetricKey::SharedPtr> keys;
+            /// \brief
+            /// Pool stats.
+            Stats stats;
+            /// \brief
+            /// Synchronization mutex.
+            util::Mutex mutex;
+            /// \brief
+            /// Signaled when a key is taken from the pool (or when done).
+            util::Condition refillCondition;
+            /// \brief
+            /// true == the pool has been stopped.
+            bool done;
+            /// \struct EphemeralKeyPool::Worker EphemeralKeyPool.cpp thekogans/crypto/EphemeralKeyPool.cpp
+            ///
+            /// \brief
+            /// Background thread that keeps the pool filled.
+            struct Worker;
+            /// \brief
+            /// Background threads.
+            util::OwnerVector<Worker> workers;
+
+        public:
+            /// \brief
+            /// ctor. Starts the background threads.
+            /// \param[in] params_ Params used to generate the keys.
+            /// \param[in] depth_ Number of keys to keep in the pool.
+            /// \param[in] workerCount Number of background threads.
+            EphemeralKeyPool (
+                Params::SharedPtr params_,
+                std::size_t depth_ = DEFAULT_DEPTH,
+                std::size_t workerCount = 1);
+            /// \brief
+            /// dtor. Stops the background threads.
+            virtual ~EphemeralKeyPool ();
+
+            /// \brief
+            /// Return the params used to generate the keys.
+            /// \return Params used to generate the keys.
+            inline Params::SharedPtr GetParams () const {
+                return params;
+            }
+            /// \brief
+            /// Return the number of keys the pool is kept filled to.
+            /// \return Number of keys the pool is kept filled to.
+            inline std::size_t GetDepth () const {
+                return depth;
+            }
+
+            /// \brief
+            /// Return true if keys generated from the given params are
+            /// interchangeable with the ones in this pool (same key type,
+            /// and for \see{DH}/\see{EC}, same group/curve, for \see{RSA}
+            /// same key length and public exponent).
+            /// \param[in] params_ Params to compare to.
+            /// \return true == params_ matches the pool params.
+            bool Matches (const Params &params_) const;
+
+            /// \brief
+            /// Take a key from the pool. If the pool is empty, generate one.
+            /// The key is removed from the pool, so every key is handed out once.
+            /// \return Private \see{AsymmetricKey}.
+            AsymmetricKey::SharedPtr GetKey ();
+
+            /// \brief
+            /// Return a snapshot of the pool stats.
+            /// \return Snapshot of the pool stats.
+            Stats GetStats ();
+
+            /// \brief
+            /// Stop the background threads and drop the keys still in the pool.
+            /// GetKey keeps working (generating keys inline).
+            void Stop ();
+
+            /// \brief
+            /// Register a pool. Registered pools are used by \see{DHEKeyExchange}.
+            /// \param[in] pool Pool to register.
+            static void Register (SharedPtr pool);
+            /// \brief
+            /// Unregister a previously registered pool.
+            /// \param[in] pool Pool to unregister.
+            static void Unregister (SharedPtr pool);
+            /// \brief
+            /// Find a registered pool matching the given params.
+            /// \param[in] params Params to match.
+            /// \return Matching pool (0 == none).
+            static SharedPtr Find (const Params &params);
+
+        private:
+            /// \brief
+            /// Used by the workers to wait for room in the pool.
+            /// \return true == there's room, false == done.
+            bool WaitForRoom ();
+            /// \brief
+            /// Used by the workers to add a freshly generated key.
+            /// \param[in] key Key to add.
+            void AddKey (AsymmetricKey::SharedPtr key);
+
+            /// \brief
+            /// EphemeralKeyPool is neither copy constructable, nor assignable.
+            THEKOGANS_CRYPTO_DISALLOW_COPY_AND_ASSIGN (EphemeralKeyPool)
+        };
+
+    } // namespace crypto
+} // namespace thekogans
+
+#endif // !defined (__thekogans_crypto_EphemeralKeyPool_h)
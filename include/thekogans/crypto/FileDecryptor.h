@@ -0,0 +1,224 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined (__thekogans_crypto_FileDecryptor_h)
+#define __thekogans_crypto_FileDecryptor_h
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <openssl/evp.h>
+#include "thekogans/util/Types.h"
+#include "thekogans/util/OwnerVector.h"
+#include "thekogans/crypto/Config.h"
+#include "thekogans/crypto/IDHashMap.h"
+#include "thekogans/crypto/SymmetricKey.h"
+#include "thekogans/crypto/Cipher.h"
+#include "thekogans/crypto/KeyRing.h"
+#include "thekogans/crypto/HKDF.h"
+#include "thekogans/crypto/MAC.h"
+#include "thekogans/crypto/BlockPipeline.h"
+#include "thekogans/crypto/FileReader.h"
+#include "thekogans/crypto/FileWriter.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        /// \struct FileDecryptor FileDecryptor.h thekogans/crypto/FileDecryptor.h
+        ///
+        /// \brief
+        /// FileDecryptor decrypts files produced by \see{FileEncryptor} (and the
+        /// encryptfile example) using a pool of worker threads. Frames are parsed
+        /// sequentially, decrypted (and decompressed, see \see{FileEncryptor::SetCompression})
+        /// in parallel and written back in order. The format is detected from the file.
+
+        struct _LIB_THEKOGANS_CRYPTO_DECL FileDecryptor : public BlockPipeline {
+        public:
+            /// \enum
+            /// FileDecryptor constants.
+            enum {
+                /// \brief
+                /// Max \see{Cipher}s cached per worker.
+                MAX_CACHED_CIPHERS = 64
+            };
+
+        private:
+            /// \brief
+            /// Key used to decrypt blocks (if keyRing == 0).
+            SymmetricKey::SharedPtr key;
+            /// \brief
+            /// OpenSSL cipher object.
+            const EVP_CIPHER *cipher;
+            /// \brief
+            /// OpenSSL message digest object.
+            const EVP_MD *md;
+            /// \brief
+            /// If set, every block is framed with the id of the key (found in this ring).
+            KeyRing::SharedPtr keyRing;
+            /// \brief
+            /// Copy of keyRing's \see{CipherSuite}. Used by the workers
+            /// so that they never have to touch the key ring.
+            CipherSuite cipherSuite;
+            /// \brief
+            /// Per worker \see{Cipher}s (used when keyRing == 0).
+            std::vector<Cipher::SharedPtr> ciphers;
+            /// \brief
+            /// Per worker, per key \see{Cipher} caches (used when keyRing != 0).
+            /// Building a Cipher initializes both EVP contexts (and derives
+            /// the CBC HMAC key), so it's only done once per key per worker.
+            /// NOTE: \see{FileEncryptor} uses a fresh key per block, so the
+            /// caches are capped at MAX_CACHED_CIPHERS (and flushed when full).
+            std::vector<IDHashMap<Cipher::SharedPtr>> keyCiphers;
+            /// \brief
+            /// Block size read from the encrypted file.
+            util::ui32 blockSize;
+            /// \brief
+            /// true == the blocks are compressed (see \see{FileEncryptor}).
+            bool compressed;
+            /// \brief
+            /// Per worker decrypted (compressed) block buffers.
+            std::vector<std::vector<util::ui8>> compressionBuffers;
+            /// \brief
+            /// true == the block keys are derived (see \see{FileEncryptor::SetDerivedKeys}).
+            bool derivedKeys;
+            /// \brief
+            /// Per worker \see{HKDF}s (ikm = master key, salt = file id).
+            util::OwnerVector<HKDF> hkdfs;
+            /// \brief
+            /// Index of the next frame (derived keys format).
+            util::ui64 blockIndex;
+            /// \brief
+            /// true == the file uses content defined chunking
+            /// (see \see{FileEncryptor::SetContentDefinedChunking}).
+            bool chunked;
+            /// \brief
+            /// Verifies the trailer (content defined chunking format).
+            MAC::SharedPtr trailerMAC;
+            /// \brief
+            /// Master key id followed by the ids of the chunks read so far.
+            std::vector<util::ui8> chunkIds;
+            /// \brief
+            /// true == the trailer was read and verified.
+            bool trailerVerified;
+            /// \brief
+            /// true == key envelope format (blocks are encrypted with ciphers[i]).
+            bool enveloped;
+            /// \brief
+            /// Read ahead/write behind depth (0 == blocking I/O, see SetQueueDepth).
+            std::size_t queueDepth;
+            /// \brief
+            /// File being decrypted.
+            FileReader *fromFile;
+            /// \brief
+            /// Decrypted file.
+            FileWriter *toFile;
+
+        public:
+            /// \brief
+            /// ctor. Decrypt all blocks using the same key.
+            /// \param[in] key_ \see{SymmetricKey} used to decrypt all blocks.
+            /// \param[in] cipher_ OpenSSL EVP_CIPHER.
+            /// \param[in] md_ OpenSSL EVP_MD (CBC mode only, ignored in GCM mode).
+            /// \param[in] workerCount Number of worker threads (0 == one per cpu).
+            /// \param[in] maxPendingBlocks Max number of blocks in flight.
+            FileDecryptor (
+                SymmetricKey::SharedPtr key_,
+                const EVP_CIPHER *cipher_ = THEKOGANS_CRYPTO_DEFAULT_CIPHER,
+                const EVP_MD *md_ = THEKOGANS_CRYPTO_DEFAULT_MD,
+                std::size_t workerCount = 0,
+                std::size_t maxPendingBlocks = 0);
+            /// \brief
+            /// ctor. Decrypt every block using the key (from the given ring)
+            /// identified by the block \see{FrameHeader}.
+            /// \param[in] keyRing_ \see{KeyRing} containing the block keys.
+            /// \param[in] workerCount Number of worker threads (0 == one per cpu).
+            /// \param[in] maxPendingBlocks Max number of blocks in flight.
+            FileDecryptor (
+                KeyRing::SharedPtr keyRing_,
+                std::size_t workerCount = 0,
+                std::size_t maxPendingBlocks = 0);
+
+            /// \brief
+            /// Overlap the file I/O with the decryption
+            /// (see \see{FileEncryptor::SetQueueDepth}).
+            /// \param[in] queueDepth_ Number of reads (writes) in flight
+            /// (0 == blocking I/O).
+            inline void SetQueueDepth (std::size_t queueDepth_) {
+                queueDepth = queueDepth_;
+            }
+            /// \brief
+            /// Return the read ahead/write behind depth.
+            /// \return Read ahead/write behind depth.
+            inline std::size_t GetQueueDepth () const {
+                return queueDepth;
+            }
+
+            /// \brief
+            /// Decrypt a file.
+            /// \param[in] fromPath File to decrypt.
+            /// \param[in] toPath Where to write the decrypted file.
+            /// \param[in] map true == memory map fromPath (see \see{FileReader},
+            /// ignored if the queue depth is > 0).
+            void Decrypt (
+                const std::string &fromPath,
+                const std::string &toPath,
+                bool map = true);
+
+        protected:
+            /// \brief
+            /// Called after every block is written. Override to report progress.
+            /// \param[in] sequenceNumber Block sequence number.
+            /// \param[in] ciphertextLength Block ciphertext length.
+            /// \param[in] plaintextLength Block plaintext length.
+            virtual void OnBlockWritten (
+                util::ui64 /*sequenceNumber*/,
+                std::size_t /*ciphertextLength*/,
+                std::size_t /*plaintextLength*/) {}
+            /// \brief
+            /// Called (content defined chunking format only) for every chunk that
+            /// was skipped by \see{FileEncryptor::IsChunkStored}. Override to fetch
+            /// the chunk from wherever \see{FileEncryptor::OnChunkWritten} stored it.
+            /// \param[in] chunkId Chunk id.
+            /// \return Chunk \see{Cipher::Encrypt} output.
+            virtual util::Buffer GetStoredChunk (const ID &chunkId);
+
+            // BlockPipeline
+            /// \brief
+            /// Read the next ciphertext frame.
+            /// \return Next block (null == eof).
+            virtual Block::SharedPtr ReadBlock () override;
+            /// \brief
+            /// Decrypt a block.
+            /// \param[in] workerIndex Index of worker thread.
+            /// \param[in, out] block Block to decrypt.
+            virtual void ProcessBlock (
+                std::size_t workerIndex,
+                Block &block) override;
+            /// \brief
+            /// Write a decrypted block.
+            /// \param[in] block Block to write.
+            virtual void WriteBlock (Block &block) override;
+
+            /// \brief
+            /// FileDecryptor is neither copy constructable, nor assignable.
+            THEKOGANS_CRYPTO_DISALLOW_COPY_AND_ASSIGN (FileDecryptor)
+        };
+
+    } // namespace crypto
+} // namespace thekogans
+
+#endif // !defined (__thekogans_crypto_FileDecryptor_h)
@@ -0,0 +1,625 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined (__thekogans_crypto_FileEncryptor_h)
+#define __thekogans_crypto_FileEncryptor_h
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <openssl/evp.h>
+#include "thekogans/util/Types.h"
+#include "thekogans/util/OwnerVector.h"
+#include "thekogans/crypto/Config.h"
+#include "thekogans/crypto/SymmetricKey.h"
+#include "thekogans/crypto/Cipher.h"
+#include "thekogans/crypto/KeyRing.h"
+#include "thekogans/crypto/KeyEnvelope.h"
+#include "thekogans/crypto/HKDF.h"
+#include "thekogans/crypto/MAC.h"
+#include "thekogans/crypto/BlockPipeline.h"
+#include "thekogans/crypto/FileReader.h"
+#include "thekogans/crypto/FileWriter.h"
+#include "thekogans/crypto/SeekableFile.h"
+#include "thekogans/crypto/Compressor.h"
+#include "thekogans/crypto/ContentDefinedChunker.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        /// \struct FileEncryptor FileEncryptor.h thekogans/crypto/FileEncryptor.h
+        ///
+        /// \brief
+        /// FileEncryptor encrypts a file in fixed size blocks using a pool of worker
+        /// threads (one \see{Cipher} per worker). Blocks are read ahead and written back
+        /// in order using a reorder buffer (see \see{BlockPipeline}). The resulting file
+        /// has the following structure:
+        ///
+        /// +------------+---------+---------+-----+---------+
+        /// | block size | block 1 | block 2 | ... | block n |
+        /// +------------+---------+---------+-----+---------+
+        /// |     4      |
+        ///
+        /// If a \see{KeyRing} is given, every block is encrypted with a new random
+        /// key (added to the key ring) and framed (\see{Cipher::EncryptAndFrame}).
+        /// Otherwise, all blocks are encrypted with the given key and enlengthened
+        /// (\see{Cipher::EncryptAndEnlengthen}). Use \see{FileDecryptor} to decrypt.
+        ///
+        /// If seekable is passed to Encrypt, the file is written in the indexed
+        /// format described in SeekableFile.h instead. Use \see{SeekableDecryptor}
+        /// to decrypt arbitrary byte ranges of such files.
+        ///
+        /// If compression is enabled (see SetCompression), every block is compressed
+        /// (by the workers) before it's encrypted, and the file has the following
+        /// structure instead:
+        ///
+        /// +---+------------+---------+---------+-----+---------+
+        /// | 0 | block size | block 1 | block 2 | ... | block n |
+        /// +---+------------+---------+---------+-----+---------+
+        /// | 4 |     4      |
+        ///
+        /// The leading 0 (an invalid block size) tells \see{FileDecryptor} (and keeps
+        /// older versions from misreading the file). Each block plaintext (and so
+        /// the authenticated region) has the following structure:
+        ///
+        /// +-----------+---------------------+---------+
+        /// | algorithm | uncompressed length | payload |
+        /// +-----------+---------------------+---------+
+        /// |     1     |          4          |   ...   |
+        ///
+        /// Blocks that don't shrink are stored with algorithm == \see{Compressor::NONE}.
+        ///
+        /// If derived keys are enabled (see SetDerivedKeys), a single random master
+        /// key is added to the key ring's user data (instead of one cipher key per
+        /// block, see FindMasterKey) and every block key is derived (by the workers)
+        /// with \see{HKDF} (ikm = block key subkey (see DeriveBlockKDFKey), salt =
+        /// file id, info = block index). The file is prefixed with:
+        ///
+        /// +------------+---------------+---------+-----------------------+
+        /// | 0xffffffff | master key id | file id | block size (see above) |
+        /// +------------+---------------+---------+-----------------------+
+        /// |     4      |      32       |   32    |
+        ///
+        /// and every block is framed with it's index instead of a key id:
+        ///
+        /// +-------------+-------------------+------------------------+
+        /// | block index | ciphertext length | \see{Cipher::Encrypt} |
+        /// +-------------+-------------------+------------------------+
+        /// |      8      |         4         |
+        ///
+        /// If content defined chunking is enabled (see SetContentDefinedChunking),
+        /// the input is cut in to variable size chunks at content defined boundaries
+        /// (\see{ContentDefinedChunker}) instead of fixed size blocks, so an edit only
+        /// changes the chunks around it. The master key is never used directly, it's
+        /// expanded in to separate id, trailer and chunk key subkeys (see
+        /// \see{ChunkedFormatKeys}). Every chunk is identified by it's keyed hash
+        /// (chunk id = \see{HMAC} (id key, chunk plaintext)) and encrypted with
+        /// a key derived from it (\see{HKDF}, ikm = chunk key subkey, salt = master
+        /// key id, info = chunk id). Chunk ids and keys depend only on the master key
+        /// and the content, so they are convergent across files encrypted with the same
+        /// master key (see SetMasterKey) and unchanged chunks can be skipped (see
+        /// IsChunkStored).
+        /// The file is prefixed with:
+        ///
+        /// +------------+---------------+------------------------+
+        /// | 0xfffffffe | master key id | block size (see above) |
+        /// +------------+---------------+------------------------+
+        /// |     4      |      32       |
+        ///
+        /// (block size == max chunk size), every chunk is framed with it's id:
+        ///
+        /// +----------+-------------------+------------------------+
+        /// | chunk id | ciphertext length | \see{Cipher::Encrypt} |
+        /// +----------+-------------------+------------------------+
+        /// |    32    |         4         |
+        ///
+        /// (ciphertext length == CHUNK_STORED == the chunk was skipped and
+        /// it's ciphertext is kept elsewhere, see \see{FileDecryptor::GetStoredChunk}),
+        /// and the last frame is a trailer binding the chunk order:
+        ///
+        /// +--------------------------------------------------------+----------------+
+        /// | \see{HMAC} (trailer key, master key id, all chunk ids) | CHUNKS_TRAILER |
+        /// +--------------------------------------------------------+----------------+
+        /// |                           32                           |       4        |
+        ///
+        /// If key encryption keys are given (see AddKeyEncryptionKey), every file
+        /// gets it's own random data key (DEK) that is never added to the key ring.
+        /// Instead, it's wrapped by each key encryption key (KEK) in a \see{KeyEnvelope}
+        /// and all blocks are encrypted with it and enlengthened (as above). The file
+        /// is prefixed with:
+        ///
+        /// +------------+-------------------+------------------+------------------------+
+        /// | 0xfffffffd | envelope capacity | envelope/padding | block size (see above) |
+        /// +------------+-------------------+------------------+------------------------+
+        /// |     4      |         4         |     capacity     |
+        ///
+        /// The envelope slot has a fixed size so that rotating (or revoking) a KEK
+        /// rewrites it in place (see RotateKeyEncryptionKey and WriteEnvelope)
+        /// without touching the blocks.
+
+        struct _LIB_THEKOGANS_CRYPTO_DECL FileEncryptor : public BlockPipeline {
+            enum {
+                /// \brief
+                /// Default block size (1 MB).
+                DEFAULT_BLOCK_SIZE = 1024 * 1024,
+                /// \brief
+                /// Leading marker of the compressed format.
+                COMPRESSED_FORMAT_MARKER = 0,
+                /// \brief
+                /// Compressed block header size (algorithm + uncompressed length).
+                COMPRESSED_BLOCK_HEADER_SIZE = util::UI8_SIZE + util::UI32_SIZE,
+                /// \brief
+                /// Leading marker of the derived keys format.
+                DERIVED_KEYS_FORMAT_MARKER = 0xffffffff,
+                /// \brief
+                /// Derived keys frame header size (block index + ciphertext length).
+                DERIVED_FRAME_HEADER_SIZE = util::UI64_SIZE + util::UI32_SIZE,
+                /// \brief
+                /// Leading marker of the content defined chunking format.
+                CHUNKED_FORMAT_MARKER = 0xfffffffe,
+                /// \brief
+                /// Chunk frame header size (chunk id + ciphertext length).
+                CHUNKED_FRAME_HEADER_SIZE = ID::SIZE + util::UI32_SIZE,
+                /// \brief
+                /// Ciphertext length of a skipped chunk's frame.
+                CHUNK_STORED = 0,
+                /// \brief
+                /// Ciphertext length of the trailer frame.
+                CHUNKS_TRAILER = 0xffffffff,
+                /// \brief
+                /// Leading marker of the key envelope format.
+                ENVELOPE_FORMAT_MARKER = 0xfffffffd,
+                /// \brief
+                /// Default envelope slot size (room for a few RSA-4096 KEKs).
+                DEFAULT_ENVELOPE_CAPACITY = 4096,
+                /// \brief
+                /// Max envelope slot size.
+                MAX_ENVELOPE_CAPACITY = 64 * 1024
+            };
+
+            /// \struct FileEncryptor::ChunkedFormatKeys FileEncryptor.h thekogans/crypto/FileEncryptor.h
+            ///
+            /// \brief
+            /// The content defined chunking format subkeys. An \see{HKDF} (ikm = master
+            /// key, salt = master key id) expands the master key under a separate label
+            /// for every use, so the chunk ids, the trailer and the chunk keys never
+            /// share a key, and the master key itself keys nothing.
+            struct _LIB_THEKOGANS_CRYPTO_DECL ChunkedFormatKeys {
+                /// \brief
+                /// \see{HMAC} key of the chunk ids.
+                SymmetricKey::SharedPtr idKey;
+                /// \brief
+                /// \see{HMAC} key of the trailer.
+                SymmetricKey::SharedPtr trailerKey;
+                /// \brief
+                /// \see{HKDF} ikm of the chunk keys.
+                SymmetricKey::SharedPtr chunkKDFKey;
+
+                /// \brief
+                /// ctor.
+                /// \param[in] masterKey Master key.
+                /// \param[in] md OpenSSL EVP_MD (subkeys are GetMDLength (md) bytes).
+                ChunkedFormatKeys (
+                    const SymmetricKey &masterKey,
+                    const EVP_MD *md);
+            };
+
+            /// \brief
+            /// Return the derived keys format block key subkey (the \see{HKDF} ikm of
+            /// the block keys): the master key expanded (\see{HKDF}, ikm = master key,
+            /// salt = master key id) under it's own label.
+            /// \param[in] masterKey Master key.
+            /// \param[in] md OpenSSL EVP_MD (the subkey is GetMDLength (md) bytes).
+            /// \return Block key subkey.
+            static SymmetricKey::SharedPtr DeriveBlockKDFKey (
+                const SymmetricKey &masterKey,
+                const EVP_MD *md);
+
+            /// \brief
+            /// Return the master key with the given id. Master keys are kept
+            /// in the key ring's user data (never with the \see{Cipher} keys,
+            /// so they can't be used to encrypt).
+            /// \param[in] keyRing \see{KeyRing} to look in.
+            /// \param[in] masterKeyId Master key id.
+            /// \return Master key (0 == not found).
+            static SymmetricKey::SharedPtr FindMasterKey (
+                const KeyRing &keyRing,
+                const ID &masterKeyId);
+
+        private:
+            /// \brief
+            /// Key used to encrypt blocks (if keyRing == 0).
+            SymmetricKey::SharedPtr key;
+            /// \brief
+            /// OpenSSL cipher object.
+            const EVP_CIPHER *cipher;
+            /// \brief
+            /// OpenSSL message digest object.
+            const EVP_MD *md;
+            /// \brief
+            /// If set, every block is encrypted with it's own random key added to this ring.
+            KeyRing::SharedPtr keyRing;
+            /// \brief
+            /// Copy of keyRing's \see{CipherSuite}. Used by the workers
+            /// so that they never have to touch the key ring.
+            CipherSuite cipherSuite;
+            /// \brief
+            /// Block size.
+            util::ui32 blockSize;
+            /// \brief
+            /// Per worker \see{Cipher}s (used when keyRing == 0).
+            std::vector<Cipher::SharedPtr> ciphers;
+            /// \brief
+            /// \see{Compressor} algorithm (\see{Compressor::NONE} == compression off).
+            util::ui8 compression;
+            /// \brief
+            /// \see{Compressor} level.
+            int compressionLevel;
+            /// \brief
+            /// Per worker compressed block buffers.
+            std::vector<std::vector<util::ui8>> compressionBuffers;
+            /// \brief
+            /// true == derive the block keys from masterKey (see SetDerivedKeys).
+            bool derivedKeys;
+            /// \brief
+            /// Master key (created on first use and added to keyRing).
+            SymmetricKey::SharedPtr masterKey;
+            /// \brief
+            /// Per worker \see{HKDF}s (ikm = masterKey, salt = file id).
+            /// HKDF keeps a mutable HMAC context so it can't be shared.
+            util::OwnerVector<HKDF> hkdfs;
+            /// \brief
+            /// true == cut the input at content defined boundaries.
+            bool contentDefinedChunking;
+            /// \brief
+            /// Finds the chunk boundaries (blockSize == max chunk size).
+            ContentDefinedChunker chunker;
+            /// \brief
+            /// Input read ahead of the chunker (at least max chunk size bytes).
+            std::vector<util::ui8> chunkBuffer;
+            /// \brief
+            /// Offset of the first unchunked byte in chunkBuffer.
+            std::size_t chunkBufferOffset;
+            /// \brief
+            /// Number of unchunked bytes in chunkBuffer.
+            std::size_t chunkBufferLength;
+            /// \brief
+            /// true == fromFile has been read to the end.
+            bool chunkEof;
+            /// \brief
+            /// Per worker \see{HMAC}s computing the chunk ids.
+            std::vector<MAC::SharedPtr> chunkMACs;
+            /// \brief
+            /// \see{HMAC} computing the trailer.
+            MAC::SharedPtr trailerMAC;
+            /// \brief
+            /// Ids of the chunks written so far (for the trailer).
+            std::vector<util::ui8> chunkIds;
+            /// \brief
+            /// Symmetric KEKs wrapping the per file DEK (see AddKeyEncryptionKey).
+            std::vector<SymmetricKey::SharedPtr> symmetricKeks;
+            /// \brief
+            /// Asymmetric KEKs wrapping the per file DEK (see AddKeyEncryptionKey).
+            std::vector<AsymmetricKey::SharedPtr> asymmetricKeks;
+            /// \brief
+            /// Envelope slot size.
+            util::ui32 envelopeCapacity;
+            /// \brief
+            /// true == the blocks are encrypted with ciphers keyed by the DEK.
+            bool enveloped;
+            /// \brief
+            /// Read ahead/write behind depth (0 == blocking I/O, see SetQueueDepth).
+            std::size_t queueDepth;
+            /// \brief
+            /// File being encrypted.
+            FileReader *fromFile;
+            /// \brief
+            /// Encrypted file.
+            FileWriter *toFile;
+            /// \brief
+            /// true == write the seekable (indexed) format.
+            bool seekable;
+            /// \brief
+            /// toFile offset of the next block (seekable format).
+            util::ui64 offset;
+            /// \brief
+            /// Index of the blocks written so far (seekable format).
+            std::vector<SeekableBlockInfo> index;
+
+        public:
+            /// \brief
+            /// ctor. Encrypt all blocks using the same key.
+            /// \param[in] key_ \see{SymmetricKey} used to encrypt all blocks.
+            /// \param[in] cipher_ OpenSSL EVP_CIPHER.
+            /// \param[in] md_ OpenSSL EVP_MD (CBC mode only, ignored in GCM mode).
+            /// \param[in] blockSize_ Plaintext block size.
+            /// \param[in] workerCount Number of worker threads (0 == one per cpu).
+            /// \param[in] maxPendingBlocks Max number of blocks in flight.
+            FileEncryptor (
+                SymmetricKey::SharedPtr key_,
+                const EVP_CIPHER *cipher_ = THEKOGANS_CRYPTO_DEFAULT_CIPHER,
+                const EVP_MD *md_ = THEKOGANS_CRYPTO_DEFAULT_MD,
+                util::ui32 blockSize_ = DEFAULT_BLOCK_SIZE,
+                std::size_t workerCount = 0,
+                std::size_t maxPendingBlocks = 0);
+            /// \brief
+            /// ctor. Encrypt every block using it's own random key.
+            /// \param[in] keyRing_ \see{KeyRing} whose \see{CipherSuite} to use,
+            /// and where to add the per block keys.
+            /// \param[in] blockSize_ Plaintext block size.
+            /// \param[in] workerCount Number of worker threads (0 == one per cpu).
+            /// \param[in] maxPendingBlocks Max number of blocks in flight.
+            FileEncryptor (
+                KeyRing::SharedPtr keyRing_,
+                util::ui32 blockSize_ = DEFAULT_BLOCK_SIZE,
+                std::size_t workerCount = 0,
+                std::size_t maxPendingBlocks = 0);
+
+            /// \brief
+            /// Return the block size.
+            /// \return Block size.
+            inline util::ui32 GetBlockSize () const {
+                return blockSize;
+            }
+
+            /// \brief
+            /// Compress blocks before encrypting them (see the compressed
+            /// format above). Not supported by the seekable format.
+            /// \param[in] compression_ \see{Compressor} algorithm
+            /// (\see{Compressor::NONE} == turn compression off).
+            /// \param[in] compressionLevel_ \see{Compressor} level.
+            void SetCompression (
+                util::ui8 compression_,
+                int compressionLevel_ = Compressor::DEFAULT_LEVEL);
+            /// \brief
+            /// Return the \see{Compressor} algorithm.
+            /// \return \see{Compressor} algorithm.
+            inline util::ui8 GetCompression () const {
+                return compression;
+            }
+
+            /// \brief
+            /// Derive the block keys from a single master key instead of
+            /// adding a random key per block to the key ring (see the derived
+            /// keys format above). Requires a \see{KeyRing} and is not
+            /// supported by the seekable format.
+            /// \param[in] derivedKeys_ true == derive the block keys.
+            void SetDerivedKeys (bool derivedKeys_);
+            /// \brief
+            /// Return true if block keys are derived.
+            /// \return true == block keys are derived.
+            inline bool GetDerivedKeys () const {
+                return derivedKeys;
+            }
+
+            /// \brief
+            /// Cut the input at content defined boundaries instead of in to fixed
+            /// size blocks, and identify (and key) each chunk by it's content (see
+            /// the content defined chunking format above). Requires a \see{KeyRing}
+            /// and is not supported by the seekable format or with derived keys.
+            /// The block size becomes maxSize.
+            /// \param[in] contentDefinedChunking_ true == use content defined chunking.
+            /// \param[in] minSize No boundaries are declared before minSize.
+            /// \param[in] avgSize Target chunk size.
+            /// \param[in] maxSize Chunks are cut at maxSize.
+            void SetContentDefinedChunking (
+                bool contentDefinedChunking_,
+                std::size_t minSize = ContentDefinedChunker::DEFAULT_MIN_CHUNK_SIZE,
+                std::size_t avgSize = ContentDefinedChunker::DEFAULT_AVG_CHUNK_SIZE,
+                std::size_t maxSize = ContentDefinedChunker::DEFAULT_MAX_CHUNK_SIZE);
+            /// \brief
+            /// Return true if the input is cut at content defined boundaries.
+            /// \return true == content defined chunking is on.
+            inline bool GetContentDefinedChunking () const {
+                return contentDefinedChunking;
+            }
+
+            /// \brief
+            /// Set the master key used by the derived keys and content defined
+            /// chunking formats (by default a random one is created on first use).
+            /// Chunks are convergent among all files encrypted with the same master
+            /// key, so use one per tenant. The key is added to the key ring by Encrypt
+            /// (if it's not already there). It's kept in the ring's user data
+            /// (see FindMasterKey), not with the \see{Cipher} keys.
+            /// \param[in] masterKey_ Master key.
+            void SetMasterKey (SymmetricKey::SharedPtr masterKey_);
+            /// \brief
+            /// Return the master key (0 == not created yet).
+            /// \return Master key.
+            inline SymmetricKey::SharedPtr GetMasterKey () const {
+                return masterKey;
+            }
+
+            /// \brief
+            /// Wrap the per file DEK with the given symmetric KEK (see the key
+            /// envelope format above). Requires a \see{KeyRing} (it's \see{CipherSuite}
+            /// is used for the DEK) and is not supported by the seekable format, with
+            /// derived keys or with content defined chunking.
+            /// \param[in] kek \see{SymmetricKey} KEK.
+            void AddKeyEncryptionKey (SymmetricKey::SharedPtr kek);
+            /// \brief
+            /// Wrap the per file DEK with the given \see{RSA} or \see{X25519} KEK.
+            /// Only the public part is needed to encrypt.
+            /// \param[in] kek \see{AsymmetricKey} KEK.
+            void AddKeyEncryptionKey (AsymmetricKey::SharedPtr kek);
+            /// \brief
+            /// Set the envelope slot size. Make it large enough for the
+            /// KEKs the envelope will hold over the life of the file.
+            /// \param[in] envelopeCapacity_ Envelope slot size.
+            void SetEnvelopeCapacity (util::ui32 envelopeCapacity_);
+            /// \brief
+            /// Return the envelope slot size.
+            /// \return Envelope slot size.
+            inline util::ui32 GetEnvelopeCapacity () const {
+                return envelopeCapacity;
+            }
+
+            /// \brief
+            /// Read the \see{KeyEnvelope} of a file in the key envelope format.
+            /// \param[in] path File to read the envelope from.
+            /// \return \see{KeyEnvelope}.
+            static KeyEnvelope ReadEnvelope (const std::string &path);
+            /// \brief
+            /// Rewrite the \see{KeyEnvelope} of a file in the key envelope format
+            /// in place. The blocks are not touched. The envelope must fit the
+            /// file's envelope slot.
+            /// \param[in] path File to write the envelope to.
+            /// \param[in] envelope \see{KeyEnvelope} to write.
+            static void WriteEnvelope (
+                const std::string &path,
+                const KeyEnvelope &envelope);
+            /// \brief
+            /// Replace oldKekId with newKek in the envelope of the given file
+            /// (see \see{KeyEnvelope::Rotate}). The cost is independent of the
+            /// file size.
+            /// \param[in] path File whose envelope to rewrap.
+            /// \param[in] keyRing \see{KeyRing} holding (at least one of) the current KEKs.
+            /// \param[in] oldKekId KEK to retire.
+            /// \param[in] newKek \see{SymmetricKey} KEK to replace it with.
+            static void RotateKeyEncryptionKey (
+                const std::string &path,
+                const KeyRing &keyRing,
+                const ID &oldKekId,
+                SymmetricKey::SharedPtr newKek);
+            /// \brief
+            /// Replace oldKekId with newKek in the envelope of the given file.
+            /// \param[in] path File whose envelope to rewrap.
+            /// \param[in] keyRing \see{KeyRing} holding (at least one of) the current KEKs.
+            /// \param[in] oldKekId KEK to retire.
+            /// \param[in] newKek \see{AsymmetricKey} KEK to replace it with.
+            static void RotateKeyEncryptionKey (
+                const std::string &path,
+                const KeyRing &keyRing,
+                const ID &oldKekId,
+                AsymmetricKey::SharedPtr newKek);
+
+            /// \brief
+            /// Overlap the file I/O with the encryption. If queueDepth_ > 0,
+            /// fromPath is read ahead (see \see{FileReader}) and toPath is
+            /// written behind (see \see{FileWriter}) with up to queueDepth_
+            /// reads and writes in flight (io_uring on Linux, an I/O thread
+            /// and synchronous writes elsewhere).
+            /// \param[in] queueDepth_ Number of reads (writes) in flight
+            /// (0 == blocking I/O).
+            inline void SetQueueDepth (std::size_t queueDepth_) {
+                queueDepth = queueDepth_;
+            }
+            /// \brief
+            /// Return the read ahead/write behind depth.
+            /// \return Read ahead/write behind depth.
+            inline std::size_t GetQueueDepth () const {
+                return queueDepth;
+            }
+
+            /// \brief
+            /// Encrypt a file.
+            /// \param[in] fromPath File to encrypt.
+            /// \param[in] toPath Where to write the encrypted file.
+            /// \param[in] seekable_ true == write the seekable (indexed) format
+            /// (see SeekableFile.h). Can't be combined with compression
+            /// or derived keys.
+            /// \param[in] map true == memory map fromPath (see \see{FileReader},
+            /// ignored if the queue depth is > 0).
+            void Encrypt (
+                const std::string &fromPath,
+                const std::string &toPath,
+                bool seekable_ = false,
+                bool map = true);
+
+        protected:
+            /// \brief
+            /// Called after every block is written. Override to report progress.
+            /// \param[in] sequenceNumber Block sequence number.
+            /// \param[in] plaintextLength Block plaintext length.
+            /// \param[in] ciphertextLength Block ciphertext length.
+            virtual void OnBlockWritten (
+                util::ui64 /*sequenceNumber*/,
+                std::size_t /*plaintextLength*/,
+                std::size_t /*ciphertextLength*/) {}
+            /// \brief
+            /// Called (content defined chunking only) before a chunk is encrypted.
+            /// Override to skip chunks that are already stored (ex: uploaded by the
+            /// previous backup). Skipped chunks are not encrypted, and only their
+            /// id is written (see CHUNK_STORED).
+            /// VERY IMPORTANT: This method is called by the worker threads.
+            /// \param[in] chunkId Chunk id.
+            /// \param[in] plaintextLength Chunk plaintext length.
+            /// \return true == skip the chunk.
+            virtual bool IsChunkStored (
+                    const ID & /*chunkId*/,
+                    std::size_t /*plaintextLength*/) {
+                return false;
+            }
+            /// \brief
+            /// Called (content defined chunking only) after every chunk that
+            /// was not skipped is written. Override to store the chunk.
+            /// \param[in] chunkId Chunk id.
+            /// \param[in] ciphertext Chunk \see{Cipher::Encrypt} output.
+            /// \param[in] ciphertextLength Chunk ciphertext length.
+            virtual void OnChunkWritten (
+                const ID & /*chunkId*/,
+                const util::ui8 * /*ciphertext*/,
+                std::size_t /*ciphertextLength*/) {}
+
+            // BlockPipeline
+            /// \brief
+            /// Read the next plaintext block.
+            /// \return Next block (null == eof).
+            virtual Block::SharedPtr ReadBlock () override;
+            /// \brief
+            /// Encrypt a block.
+            /// \param[in] workerIndex Index of worker thread.
+            /// \param[in, out] block Block to encrypt.
+            virtual void ProcessBlock (
+                std::size_t workerIndex,
+                Block &block) override;
+            /// \brief
+            /// Write an encrypted block.
+            /// \param[in] block Block to write.
+            virtual void WriteBlock (Block &block) override;
+
+        private:
+            /// \brief
+            /// Encrypt and write the block index and footer (seekable format).
+            void WriteIndex ();
+            /// \brief
+            /// Read the next content defined chunk.
+            /// \return Next chunk (null == eof).
+            Block::SharedPtr ReadChunk ();
+            /// \brief
+            /// Return the id (keyed hash) of the given chunk.
+            /// \param[in] workerIndex Index of worker thread.
+            /// \param[in] plaintext Chunk plaintext.
+            /// \param[in] plaintextLength Chunk plaintext length.
+            /// \return Chunk id.
+            ID GetChunkId (
+                std::size_t workerIndex,
+                const util::ui8 *plaintext,
+                std::size_t plaintextLength);
+            /// \brief
+            /// Write the trailer (content defined chunking format).
+            void WriteChunksTrailer ();
+
+            /// \brief
+            /// FileEncryptor is neither copy constructable, nor assignable.
+            THEKOGANS_CRYPTO_DISALLOW_COPY_AND_ASSIGN (FileEncryptor)
+        };
+
+    } // namespace crypto
+} // namespace thekogans
+
+#endif // !defined (__thekogans_crypto_FileEncryptor_h)
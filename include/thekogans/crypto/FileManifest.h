@@ -0,0 +1,458 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined (__thekogans_crypto_FileManifest_h)
+#define __thekogans_crypto_FileManifest_h
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <openssl/evp.h>
+#include "thekogans/util/Types.h"
+#include "thekogans/util/RefCounted.h"
+#include "thekogans/util/Buffer.h"
+#include "thekogans/util/Serializer.h"
+#include "thekogans/util/File.h"
+#include "thekogans/crypto/Config.h"
+#include "thekogans/crypto/OpenSSLUtils.h"
+#include "thekogans/crypto/MessageDigest.h"
+#include "thekogans/crypto/Authenticator.h"
+#include "thekogans/crypto/BlockPipeline.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        /// \brief
+        /// Signed chunk manifest layout (all integers are network endian):
+        ///
+        /// +--------------------+
+        /// | FileManifestHeader |
+        /// +--------------------+
+        /// | chunk digest 0     |  H (0x00 || chunk 0)
+        /// +--------------------+
+        /// | ...                |
+        /// +--------------------+
+        /// | chunk digest n - 1 |
+        /// +--------------------+
+        /// | signature length   |  ui32
+        /// +--------------------+
+        /// | signature          |  \see{Authenticator::SignBuffer} (FileManifestHeader || root).
+        /// +--------------------+
+        ///
+        /// The root is the \see{MessageDigest::HashFileTree} of the file
+        /// (leafLength == chunkSize): H (0x01 || chunk digest 0 || ... ||
+        /// chunk digest n - 1 || BE64 (chunkSize) || BE64 (fileSize)).
+        /// Verifying the signature over the root authenticates every chunk
+        /// digest. After that, each chunk can be verified on it's own, in
+        /// any order and in parallel (see \see{FileManifestVerifier}).
+
+        /// \struct FileManifestHeader FileManifest.h thekogans/crypto/FileManifest.h
+        ///
+        /// \brief
+        /// Identifies a manifest and describes the file it covers.
+        struct _LIB_THEKOGANS_CRYPTO_DECL FileManifestHeader {
+            /// \enum
+            /// FileManifestHeader constants.
+            enum {
+                /// \brief
+                /// "TKFM"
+                MAGIC = 0x544b464d,
+                /// \brief
+                /// Current format version.
+                VERSION = 1
+            };
+
+            /// \brief
+            /// MAGIC.
+            util::ui32 magic;
+            /// \brief
+            /// VERSION.
+            util::ui16 version;
+            /// \brief
+            /// Length of every chunk but the last.
+            util::ui32 chunkSize;
+            /// \brief
+            /// Length of the file.
+            util::ui64 fileSize;
+            /// \brief
+            /// Number of chunks (fileSize / chunkSize rounded up).
+            util::ui64 chunkCount;
+            /// \brief
+            /// Name of the message digest used to hash the chunks
+            /// (see \see{CipherSuite::GetMessageDigests}).
+            std::string messageDigest;
+
+            /// \brief
+            /// ctor.
+            /// \param[in] chunkSize_ Length of every chunk but the last.
+            /// \param[in] fileSize_ Length of the file.
+            /// \param[in] messageDigest_ Name of the chunk message digest.
+            FileManifestHeader (
+                util::ui32 chunkSize_ = 0,
+                util::ui64 fileSize_ = 0,
+                const std::string &messageDigest_ = std::string ()) :
+                magic (MAGIC),
+                version (VERSION),
+                chunkSize (chunkSize_),
+                fileSize (fileSize_),
+                chunkCount (chunkSize_ > 0 ? (fileSize_ + chunkSize_ - 1) / chunkSize_ : 0),
+                messageDigest (messageDigest_) {}
+
+            /// \brief
+            /// Return the serialized header size.
+            /// \return Serialized header size.
+            inline std::size_t Size () const {
+                return
+                    util::UI32_SIZE +
+                    util::UI16_SIZE +
+                    util::UI32_SIZE +
+                    util::UI64_SIZE +
+                    util::UI64_SIZE +
+                    util::Serializer::Size (messageDigest);
+            }
+        };
+
+        /// \brief
+        /// Serialize a FileManifestHeader.
+        /// \param[in] serializer Where to write the given header.
+        /// \param[in] header FileManifestHeader to serialize.
+        /// \return serializer.
+        inline util::Serializer &operator << (
+                util::Serializer &serializer,
+                const FileManifestHeader &header) {
+            serializer <<
+                header.magic <<
+                header.version <<
+                header.chunkSize <<
+                header.fileSize <<
+                header.chunkCount <<
+                header.messageDigest;
+            return serializer;
+        }
+
+        /// \brief
+        /// Extract a FileManifestHeader.
+        /// \param[in] serializer Where to read the header from.
+        /// \param[out] header Where to place the extracted header.
+        /// \return serializer.
+        inline util::Serializer &operator >> (
+                util::Serializer &serializer,
+                FileManifestHeader &header) {
+            serializer >>
+                header.magic >>
+                header.version >>
+                header.chunkSize >>
+                header.fileSize >>
+                header.chunkCount >>
+                header.messageDigest;
+            return serializer;
+        }
+
+        /// \struct FileManifest FileManifest.h thekogans/crypto/FileManifest.h
+        ///
+        /// \brief
+        /// FileManifest is a signed list of per chunk digests (see the layout
+        /// above). Unlike \see{Authenticator::SignFile}, which produces one
+        /// signature over a linear hash of the whole file, a manifest lets the
+        /// verifier check the chunks in parallel, resume an interrupted
+        /// verification, and check only the byte ranges it actually needs.
+        ///
+        /// Ex:
+        ///
+        /// \code{.cpp}
+        /// using namespace thekogans;
+        ///
+        /// crypto::Authenticator signer (privateKey, messageDigest);
+        /// crypto::FileManifest::Create (path, signer)->Save (path + ".manifest");
+        /// ...
+        /// crypto::Authenticator verifier (publicKey, messageDigest);
+        /// crypto::FileManifestVerifier manifestVerifier (
+        ///     crypto::FileManifest::Load (path + ".manifest"), verifier);
+        /// bool result = manifestVerifier.Verify (path);
+        /// \endcode
+
+        struct _LIB_THEKOGANS_CRYPTO_DECL FileManifest : public virtual util::RefCounted {
+            /// \brief
+            /// Declare \see{RefCounted} pointers.
+            THEKOGANS_UTIL_DECLARE_REF_COUNTED_POINTERS (FileManifest)
+
+            enum {
+                /// \brief
+                /// Default chunk size (4 MB).
+                DEFAULT_CHUNK_SIZE = 4 * 1024 * 1024
+            };
+
+        private:
+            /// \brief
+            /// Manifest header.
+            FileManifestHeader header;
+            /// \brief
+            /// OpenSSL message digest used to hash the chunks.
+            const EVP_MD *md;
+            /// \brief
+            /// Chunk digests (header.chunkCount * GetDigestLength () bytes).
+            std::vector<util::ui8> chunkDigests;
+            /// \brief
+            /// Signature over the header and the root.
+            util::Buffer signature;
+
+            /// \brief
+            /// ctor. Used by Create and Load.
+            /// \param[in] header_ Manifest header.
+            FileManifest (const FileManifestHeader &header_);
+
+        public:
+            /// \brief
+            /// Hash the given file (in parallel) and sign the resulting manifest.
+            /// \param[in] path File whose manifest to create.
+            /// \param[in] signer \see{Authenticator} setup for sign operation.
+            /// \param[in] chunkSize Chunk size.
+            /// \param[in] md OpenSSL message digest used to hash the chunks.
+            /// \param[in] workerCount Number of hashing threads (0 == one per cpu).
+            /// \param[in] map true == memory map the file (see \see{FileReader}).
+            /// \return Signed manifest.
+            static SharedPtr Create (
+                const std::string &path,
+                Authenticator &signer,
+                util::ui32 chunkSize = DEFAULT_CHUNK_SIZE,
+                const EVP_MD *md = THEKOGANS_CRYPTO_DEFAULT_MD,
+                std::size_t workerCount = 0,
+                bool map = true);
+
+            /// \brief
+            /// Load a manifest from the given file.
+            /// \param[in] path Manifest file.
+            /// \return Manifest (not yet verified, see VerifySignature).
+            static SharedPtr Load (const std::string &path);
+            /// \brief
+            /// Save the manifest to the given file.
+            /// \param[in] path Manifest file.
+            void Save (const std::string &path) const;
+
+            /// \brief
+            /// Return the manifest header.
+            /// \return Manifest header.
+            inline const FileManifestHeader &GetHeader () const {
+                return header;
+            }
+            /// \brief
+            /// Return the chunk digest length.
+            /// \return Chunk digest length.
+            inline std::size_t GetDigestLength () const {
+                return GetMDLength (md);
+            }
+            /// \brief
+            /// Return the OpenSSL message digest used to hash the chunks.
+            /// \return OpenSSL message digest used to hash the chunks.
+            inline const EVP_MD *GetMD () const {
+                return md;
+            }
+            /// \brief
+            /// Return the given chunk's digest.
+            /// \param[in] chunk Chunk index.
+            /// \return Pointer to GetDigestLength () bytes of chunk digest.
+            const util::ui8 *GetChunkDigest (util::ui64 chunk) const;
+            /// \brief
+            /// Return the given chunk's length
+            /// (chunkSize for all but the last chunk).
+            /// \param[in] chunk Chunk index.
+            /// \return Chunk length.
+            std::size_t GetChunkLength (util::ui64 chunk) const;
+
+            /// \brief
+            /// Recompute the root from the chunk digests.
+            /// \return Manifest root (\see{MessageDigest::HashFileTree}).
+            util::Buffer GetRoot () const;
+            /// \brief
+            /// Verify the manifest signature.
+            /// \param[in] verifier \see{Authenticator} setup for verify operation.
+            /// \return true == the header and all chunk digests are authentic.
+            bool VerifySignature (Authenticator &verifier) const;
+            /// \brief
+            /// Verify a single chunk against it's (signed) digest.
+            /// NOTE: Call VerifySignature first.
+            /// \param[in] messageDigest \see{MessageDigest} using GetMD ().
+            /// \param[in] chunk Chunk index.
+            /// \param[in] buffer Chunk contents.
+            /// \param[in] bufferLength Chunk length.
+            /// \return true == valid, false == invalid.
+            bool VerifyChunk (
+                MessageDigest &messageDigest,
+                util::ui64 chunk,
+                const void *buffer,
+                std::size_t bufferLength) const;
+
+        private:
+            /// \brief
+            /// Return the signed data (header || root).
+            /// \return Signed data.
+            util::Buffer GetSignedData () const;
+
+            /// \brief
+            /// FileManifest is neither copy constructable, nor assignable.
+            THEKOGANS_CRYPTO_DISALLOW_COPY_AND_ASSIGN (FileManifest)
+        };
+
+        /// \struct FileManifestVerifier FileManifest.h thekogans/crypto/FileManifest.h
+        ///
+        /// \brief
+        /// FileManifestVerifier verifies a file against a signed \see{FileManifest}.
+        /// Chunks are read sequentially and hashed on a pool of worker threads
+        /// (see \see{BlockPipeline}). The verifier remembers which chunks it has
+        /// already verified, so that repeated (or resumed, see SaveProgress
+        /// and LoadProgress) calls to Verify only read the chunks that are
+        /// still outstanding. Verify can be limited to a byte range, in which
+        /// case only the chunks it overlaps are read.
+        /// NOTE: The progress file is an unauthenticated local cache. Only
+        /// use it on storage you trust as much as the file itself.
+
+        struct _LIB_THEKOGANS_CRYPTO_DECL FileManifestVerifier : public BlockPipeline {
+        private:
+            /// \brief
+            /// Manifest to verify against.
+            FileManifest::SharedPtr manifest;
+            /// \brief
+            /// true == the manifest signature is valid.
+            bool signatureValid;
+            /// \brief
+            /// Per worker \see{MessageDigest}s.
+            std::vector<MessageDigest::SharedPtr> messageDigests;
+            /// \brief
+            /// One entry per chunk, true == verified.
+            std::vector<bool> verifiedChunks;
+            /// \brief
+            /// Number of verified chunks.
+            util::ui64 verifiedChunkCount;
+            /// \brief
+            /// Chunks that failed verification.
+            std::vector<util::ui64> invalidChunks;
+            /// \brief
+            /// File being verified (valid during Verify).
+            util::ReadOnlyFile *file;
+            /// \brief
+            /// Next chunk to consider (valid during Verify).
+            util::ui64 nextChunk;
+            /// \brief
+            /// One past the last chunk to consider (valid during Verify).
+            util::ui64 endChunk;
+
+        public:
+            /// \brief
+            /// ctor. Verify the manifest signature.
+            /// \param[in] manifest_ Manifest to verify against.
+            /// \param[in] verifier \see{Authenticator} setup for verify operation.
+            /// \param[in] workerCount Number of hashing threads (0 == one per cpu).
+            /// \param[in] maxPendingBlocks Max number of chunks in flight.
+            FileManifestVerifier (
+                FileManifest::SharedPtr manifest_,
+                Authenticator &verifier,
+                std::size_t workerCount = 0,
+                std::size_t maxPendingBlocks = 0);
+
+            /// \brief
+            /// Return the manifest.
+            /// \return Manifest.
+            inline FileManifest::SharedPtr GetManifest () const {
+                return manifest;
+            }
+            /// \brief
+            /// Return true if the manifest signature is valid.
+            /// \return true == the manifest signature is valid.
+            inline bool IsSignatureValid () const {
+                return signatureValid;
+            }
+            /// \brief
+            /// Return the number of verified chunks.
+            /// \return Number of verified chunks.
+            inline util::ui64 GetVerifiedChunkCount () const {
+                return verifiedChunkCount;
+            }
+            /// \brief
+            /// Return the chunks that failed verification.
+            /// \return Chunks that failed verification.
+            inline const std::vector<util::ui64> &GetInvalidChunks () const {
+                return invalidChunks;
+            }
+            /// \brief
+            /// Return true if every chunk overlapping the given range was verified.
+            /// \param[in] offset Range offset.
+            /// \param[in] length Range length (0 == to end of file).
+            /// \return true == range verified.
+            bool IsVerified (
+                util::ui64 offset = 0,
+                util::ui64 length = 0) const;
+
+            /// \brief
+            /// Verify the chunks overlapping the given range that
+            /// have not been verified yet.
+            /// \param[in] path File to verify.
+            /// \param[in] offset Range offset.
+            /// \param[in] length Range length (0 == to end of file).
+            /// \return true == the signature and every chunk overlapping the range
+            /// are valid, false == see GetInvalidChunks.
+            bool Verify (
+                const std::string &path,
+                util::ui64 offset = 0,
+                util::ui64 length = 0);
+
+            /// \brief
+            /// Save the set of verified chunks (to resume an interrupted verification).
+            /// \param[in] path Progress file.
+            void SaveProgress (const std::string &path) const;
+            /// \brief
+            /// Load the set of verified chunks saved by SaveProgress.
+            /// \param[in] path Progress file.
+            /// \return true == progress loaded, false == the file does not
+            /// exist or belongs to a different manifest.
+            bool LoadProgress (const std::string &path);
+
+        protected:
+            /// \brief
+            /// Called on the Verify thread after every chunk is checked.
+            /// Override to report progress (or to call SaveProgress periodically).
+            /// \param[in] chunk Chunk index.
+            /// \param[in] valid true == chunk is valid.
+            virtual void OnChunkVerified (
+                util::ui64 /*chunk*/,
+                bool /*valid*/) {}
+
+            // BlockPipeline
+            /// \brief
+            /// Read the next unverified chunk.
+            /// \return Next chunk (null == done).
+            virtual Block::SharedPtr ReadBlock () override;
+            /// \brief
+            /// Hash a chunk.
+            /// \param[in] workerIndex Index of worker thread.
+            /// \param[in, out] block Chunk to hash.
+            virtual void ProcessBlock (
+                std::size_t workerIndex,
+                Block &block) override;
+            /// \brief
+            /// Compare a chunk hash to the manifest.
+            /// \param[in] block Hashed chunk.
+            virtual void WriteBlock (Block &block) override;
+
+            /// \brief
+            /// FileManifestVerifier is neither copy constructable, nor assignable.
+            THEKOGANS_CRYPTO_DISALLOW_COPY_AND_ASSIGN (FileManifestVerifier)
+        };
+
+    } // namespace crypto
+} // namespace thekogans
+
+#endif // !defined (__thekogans_crypto_FileManifest_h)
@@ -0,0 +1,244 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+
+#if !defined (__thekogans_crypto_FileReader_h)
+#define __thekogans_crypto_FileReader_h
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+#include "thekogans/util/Types.h"
+#include "thekogans/util/File.h"
+#include "thekogans/crypto/Config.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        /// \struct FileReader FileReader.h thekogans/crypto/FileReader.h
+        ///
+        /// \brief
+        /// FileReader is the input path used by all file oriented APIs
+        /// (\see{MessageDigest::HashFile}, \see{Authenticator::SignFile},
+        /// \see{Authenticator::VerifyFileSignature}, \see{FileEncryptor} and
+        /// \see{FileDecryptor}). Where possible the file is memory mapped
+        /// (with MADV_SEQUENTIAL and, on Linux, a MADV_HUGEPAGE hint) so that
+        /// it can be consumed without read syscalls or copies. If mapping is
+        /// disabled or fails (empty files, Windows, address space exhaustion)
+        /// the file is read in readBlockSize chunks.
+        ///
+        /// If readAheadBlockCount > 0 the file is streamed instead of mapped.
+        /// An I/O thread fills a ring of readAheadBlockCount readBlockSize
+        /// (1-8MB is a good range) buffers while the caller consumes them,
+        /// so that the disk and the cpu work at the same time. The file is
+        /// opened with sequential access hints (posix_fadvise/F_RDAHEAD) and,
+        /// if direct is true, bypassing the page cache (O_DIRECT/F_NOCACHE).
+        /// On Linux, if io_uring is available (see \see{IOUring}), the ring
+        /// buffers are registered with the kernel and every free buffer has
+        /// a read in flight (the completions are handed to the caller in file
+        /// order). Elsewhere (or if io_uring is disabled) the I/O thread reads
+        /// the blocks one at a time.
+        ///
+        /// Ex:
+        ///
+        /// \code{.cpp}
+        /// using namespace thekogans;
+        ///
+        /// crypto::FileReader reader (path);
+        /// const util::ui8 *chunk;
+        /// for (std::size_t length = reader.Next (chunk);
+        ///         length != 0;
+        ///         length = reader.Next (chunk)) {
+        ///     ...
+        /// }
+        /// \endcode
+
+        struct _LIB_THEKOGANS_CRYPTO_DECL FileReader {
+            /// \enum
+            /// FileReader constants.
+            enum {
+                /// \brief
+                /// Default chunk size used when the file is not mapped.
+                DEFAULT_READ_BLOCK_SIZE = 64 * 1024,
+                /// \brief
+                /// Default chunk size used in read ahead mode.
+                DEFAULT_READ_AHEAD_BLOCK_SIZE = 4 * 1024 * 1024,
+                /// \brief
+                /// Default number of read ahead buffers (double buffering).
+                DEFAULT_READ_AHEAD_BLOCK_COUNT = 2
+            };
+
+            /// \struct FileReader::ReadStats FileReader.h thekogans/crypto/FileReader.h
+            ///
+            /// \brief
+            /// Throughput statistics (see GetStats).
+            struct _LIB_THEKOGANS_CRYPTO_DECL ReadStats {
+                /// \brief
+                /// Number of bytes returned to the caller.
+                util::ui64 bytesRead;
+                /// \brief
+                /// Seconds from construction to the last chunk returned.
+                util::f64 elapsedSeconds;
+                /// \brief
+                /// Seconds spent reading the file (on the I/O thread
+                /// in read ahead mode, 0 if mapped).
+                util::f64 readSeconds;
+                /// \brief
+                /// Seconds the caller spent waiting for data. In read
+                /// ahead mode, this is the I/O not overlapped with work.
+                util::f64 stallSeconds;
+
+                /// \brief
+                /// ctor.
+                ReadStats () :
+                    bytesRead (0),
+                    elapsedSeconds (0.0),
+                    readSeconds (0.0),
+                    stallSeconds (0.0) {}
+
+                /// \brief
+                /// Return the throughput in bytes/second.
+                /// \return Throughput in bytes/second.
+                inline util::f64 GetThroughput () const {
+                    return elapsedSeconds > 0.0 ? bytesRead / elapsedSeconds : 0.0;
+                }
+            };
+
+        private:
+            /// \brief
+            /// File path.
+            std::string path;
+            /// \brief
+            /// Mapped file contents (0 == not mapped).
+            util::ui8 *map;
+            /// \brief
+            /// File size.
+            util::ui64 size;
+            /// \brief
+            /// Offset of the next unread byte.
+            util::ui64 offset;
+            /// \brief
+            /// Fallback (unmapped) file.
+            std::unique_ptr<util::ReadOnlyFile> file;
+            /// \brief
+            /// Fallback chunk size.
+            std::size_t readBlockSize;
+            /// \brief
+            /// Fallback chunk buffer (used by Next).
+            std::vector<util::ui8> buffer;
+            /// \struct FileReader::ReadAhead FileReader.cpp thekogans/crypto/FileReader.cpp
+            ///
+            /// \brief
+            /// Forward declaration of the read ahead I/O thread.
+            struct ReadAhead;
+            /// \brief
+            /// Read ahead I/O thread (0 == not in read ahead mode).
+            std::unique_ptr<ReadAhead> readAhead;
+            /// \brief
+            /// Construction time (see ReadStats::elapsedSeconds).
+            util::ui64 startTime;
+            /// \brief
+            /// Throughput statistics.
+            ReadStats stats;
+
+        public:
+            /// \brief
+            /// ctor.
+            /// \param[in] path_ File to read.
+            /// \param[in] map_ true == try to memory map the file.
+            /// \param[in] readBlockSize_ Chunk size used when the file is not mapped.
+            /// \param[in] readAheadBlockCount Number of read ahead buffers
+            /// (0 == synchronous reads, > 0 == read ahead mode, map_ is ignored).
+            /// \param[in] direct true == bypass the page cache (read ahead mode only).
+            /// \param[in] ioUring true == use io_uring if available (read ahead mode only).
+            explicit FileReader (
+                const std::string &path_,
+                bool map_ = true,
+                std::size_t readBlockSize_ = DEFAULT_READ_BLOCK_SIZE,
+                std::size_t readAheadBlockCount = 0,
+                bool direct = false,
+                bool ioUring = true);
+            /// \brief
+            /// dtor. Unmap the file.
+            ~FileReader ();
+
+            /// \brief
+            /// Return the file path.
+            /// \return File path.
+            inline const std::string &GetPath () const {
+                return path;
+            }
+            /// \brief
+            /// Return true if the file is memory mapped.
+            /// \return true == the file is memory mapped.
+            inline bool IsMapped () const {
+                return map != 0;
+            }
+            /// \brief
+            /// Return true if the file is being read ahead on an I/O thread.
+            /// \return true == read ahead mode.
+            inline bool IsReadAhead () const {
+                return readAhead.get () != 0;
+            }
+            /// \brief
+            /// Return true if the read ahead I/O thread is using io_uring.
+            /// \return true == read ahead mode with io_uring.
+            bool IsIOUring () const;
+            /// \brief
+            /// Return the file size.
+            /// \return File size.
+            inline util::ui64 GetSize () const {
+                return size;
+            }
+            /// \brief
+            /// Return the number of bytes left to read.
+            /// \return Number of bytes left to read.
+            inline util::ui64 GetDataAvailableForReading () const {
+                return size - offset;
+            }
+
+            /// \brief
+            /// Return the next chunk of the file without copying it (if mapped).
+            /// If the file is mapped, the rest of the file is returned at once.
+            /// \param[out] chunk Pointer to the next chunk. Valid until the next
+            /// call to Next or Read.
+            /// \return Chunk length (0 == eof).
+            std::size_t Next (const util::ui8 *&chunk);
+            /// \brief
+            /// Copy the next length bytes of the file in to the given buffer.
+            /// \param[out] buffer Where to place the data.
+            /// \param[in] length Number of bytes to read.
+            /// \return Number of bytes read (less than length at eof).
+            std::size_t Read (
+                void *buffer,
+                std::size_t length);
+
+            /// \brief
+            /// Return the throughput statistics.
+            /// \return \see{ReadStats}.
+            ReadStats GetStats () const;
+
+            /// \brief
+            /// FileReader is neither copy constructable, nor assignable.
+            THEKOGANS_CRYPTO_DISALLOW_COPY_AND_ASSIGN (FileReader)
+        };
+
+    } // namespace crypto
+} // namespace thekogans
+
+#endif // !defined (__thekogans_crypto_FileReader_h)
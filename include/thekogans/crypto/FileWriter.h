@@ -0,0 +1,225 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined (__thekogans_crypto_FileWriter_h)
+#define __thekogans_crypto_FileWriter_h
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+#include "thekogans/util/Types.h"
+#include "thekogans/util/Serializer.h"
+#include "thekogans/util/File.h"
+#include "thekogans/crypto/Config.h"
+#include "thekogans/crypto/IOUring.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        /// \struct FileWriter FileWriter.h thekogans/crypto/FileWriter.h
+        ///
+        /// \brief
+        /// FileWriter is the output path used by \see{FileEncryptor} and
+        /// \see{FileDecryptor} (the counterpart of \see{FileReader}). Writes are
+        /// collected in writeBlockSize buffers. If writeBehindBlockCount > 0 and
+        /// io_uring is available (see \see{IOUring}), the buffers are registered
+        /// with the kernel and full buffers are written asynchronously (up to
+        /// writeBehindBlockCount in flight) while the caller fills the next one.
+        /// Otherwise (or on other platforms) full buffers are written synchronously.
+        /// Since writes complete asynchronously, call Flush to find out if they
+        /// succeeded (the dtor swallows errors).
+        ///
+        /// Ex:
+        ///
+        /// \code{.cpp}
+        /// using namespace thekogans;
+        ///
+        /// crypto::FileWriter writer (path,
+        ///     crypto::FileWriter::DEFAULT_WRITE_BEHIND_BLOCK_SIZE,
+        ///     crypto::FileWriter::DEFAULT_WRITE_BEHIND_BLOCK_COUNT);
+        /// writer << header;
+        /// writer.Write (data, length);
+        /// writer.Flush ();
+        /// \endcode
+
+        struct _LIB_THEKOGANS_CRYPTO_DECL FileWriter : public util::Serializer {
+            /// \enum
+            /// FileWriter constants.
+            enum {
+                /// \brief
+                /// Default buffer size used for synchronous writes.
+                DEFAULT_WRITE_BLOCK_SIZE = 64 * 1024,
+                /// \brief
+                /// Default buffer size used in write behind mode.
+                DEFAULT_WRITE_BEHIND_BLOCK_SIZE = 4 * 1024 * 1024,
+                /// \brief
+                /// Default number of write behind buffers.
+                DEFAULT_WRITE_BEHIND_BLOCK_COUNT = 4
+            };
+
+        private:
+            /// \brief
+            /// File path.
+            std::string path;
+        #if defined (TOOLCHAIN_OS_Windows)
+            /// \brief
+            /// File being written.
+            util::SimpleFile file;
+        #else // defined (TOOLCHAIN_OS_Windows)
+            /// \brief
+            /// File being written.
+            int fd;
+        #endif // defined (TOOLCHAIN_OS_Windows)
+        #if defined (THEKOGANS_CRYPTO_HAVE_IO_URING)
+            /// \brief
+            /// Write behind ring (0 == synchronous writes).
+            std::unique_ptr<IOUring> ring;
+            /// \brief
+            /// true == blocks are registered with ring.
+            bool registered;
+        #endif // defined (THEKOGANS_CRYPTO_HAVE_IO_URING)
+            /// \brief
+            /// Buffer size.
+            std::size_t writeBlockSize;
+            /// \struct FileWriter::Block FileWriter.h thekogans/crypto/FileWriter.h
+            ///
+            /// \brief
+            /// Write buffer.
+            struct Block {
+                /// \brief
+                /// Buffer (writeBlockSize bytes).
+                util::ui8 *data;
+                /// \brief
+                /// Number of bytes in the buffer.
+                std::size_t length;
+                /// \brief
+                /// File offset of the buffer.
+                util::ui64 offset;
+                /// \brief
+                /// Number of bytes written so far (write behind mode).
+                std::size_t written;
+                /// \brief
+                /// true == a write is in flight (write behind mode).
+                bool busy;
+
+                /// \brief
+                /// ctor.
+                Block () :
+                    data (0),
+                    length (0),
+                    offset (0),
+                    written (0),
+                    busy (false) {}
+            };
+            /// \brief
+            /// Write buffers (one if writing synchronously).
+            std::vector<Block> blocks;
+            /// \brief
+            /// Index of the block being filled.
+            std::size_t current;
+            /// \brief
+            /// File offset of the next buffer.
+            util::ui64 offset;
+
+        public:
+            /// \brief
+            /// ctor. Create (truncate) the file.
+            /// \param[in] path_ File to write.
+            /// \param[in] writeBlockSize_ Buffer size.
+            /// \param[in] writeBehindBlockCount Number of write behind buffers
+            /// (0 == synchronous writes).
+            /// \param[in] ioUring true == use io_uring if available (write behind mode only).
+            explicit FileWriter (
+                const std::string &path_,
+                std::size_t writeBlockSize_ = DEFAULT_WRITE_BLOCK_SIZE,
+                std::size_t writeBehindBlockCount = 0,
+                bool ioUring = true);
+            /// \brief
+            /// dtor. Flush (ignoring errors) and close the file.
+            virtual ~FileWriter ();
+
+            /// \brief
+            /// Return the file path.
+            /// \return File path.
+            inline const std::string &GetPath () const {
+                return path;
+            }
+            /// \brief
+            /// Return true if writes are issued asynchronously with io_uring.
+            /// \return true == write behind mode with io_uring.
+            bool IsIOUring () const;
+            /// \brief
+            /// Return the number of bytes written so far (including buffered ones).
+            /// \return Number of bytes written so far.
+            inline util::ui64 GetSize () const {
+                return offset + blocks[current].length;
+            }
+
+            // util::Serializer
+            /// \brief
+            /// FileWriter is write only.
+            /// \return Throws EINVAL.
+            virtual std::size_t Read (
+                void * /*buffer*/,
+                std::size_t /*count*/) override;
+            /// \brief
+            /// Buffer the given data (writing out full buffers).
+            /// \param[in] buffer Data to write.
+            /// \param[in] count Number of bytes to write.
+            /// \return count.
+            virtual std::size_t Write (
+                const void *buffer,
+                std::size_t count) override;
+
+            /// \brief
+            /// Write out the buffered data and wait for all writes to complete.
+            void Flush ();
+
+            /// \brief
+            /// FileWriter is neither copy constructable, nor assignable.
+            THEKOGANS_CRYPTO_DISALLOW_COPY_AND_ASSIGN (FileWriter)
+
+        private:
+            /// \brief
+            /// Write out (or start writing out) the current block
+            /// and make the next one current.
+            void WriteBlock ();
+            /// \brief
+            /// Synchronously write the given data.
+            /// \param[in] data Data to write.
+            /// \param[in] length Number of bytes to write.
+            void WriteAll (
+                const util::ui8 *data,
+                std::size_t length);
+        #if defined (THEKOGANS_CRYPTO_HAVE_IO_URING)
+            /// \brief
+            /// Wait for (and check) a write completion.
+            void CompleteBlock ();
+            /// \brief
+            /// Wait for all writes in flight (ignoring errors).
+            void Drain ();
+        #endif // defined (THEKOGANS_CRYPTO_HAVE_IO_URING)
+            /// \brief
+            /// Release the buffers.
+            void FreeBlocks ();
+        };
+
+    } // namespace crypto
+} // namespace thekogans
+
+#endif // !defined (__thekogans_crypto_FileWriter_h)
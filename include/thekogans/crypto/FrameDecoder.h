@@ -0,0 +1,234 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+
+#if !defined (__thekogans_crypto_FrameDecoder_h)
+#define __thekogans_crypto_FrameDecoder_h
+
+#include <cstddef>
+#include <vector>
+#include "thekogans/util/Types.h"
+#include "thekogans/crypto/Config.h"
+#include "thekogans/crypto/ID.h"
+#include "thekogans/crypto/IDHashMap.h"
+#include "thekogans/crypto/FrameHeader.h"
+#include "thekogans/crypto/Cipher.h"
+#include "thekogans/crypto/KeyRing.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        /// \struct FrameDecoder FrameDecoder.h thekogans/crypto/FrameDecoder.h
+        ///
+        /// \brief
+        /// FrameDecoder turns a byte stream of frames produced by \see{Cipher::EncryptAndFrame}
+        /// in to decrypted plaintext. Data can arrive in arbitrary (socket sized)
+        /// chunks. The decoder accumulates them in it's receive buffer, parses the
+        /// \see{FrameHeader} (and \see{CiphertextHeader}) in place and decrypts complete
+        /// frames directly in the receive buffer (\see{Cipher::DecryptInPlace}). The
+        /// \see{Cipher} is looked up in the \see{KeyRing} only when the frame key id
+        /// changes. No intermediate buffers are allocated per frame.
+        ///
+        /// Forged frames are rejected as early as possible. The frame key is
+        /// resolved and the frame length checked against the (per key) max as soon
+        /// as the \see{FrameHeader} arrives, and the \see{CiphertextHeader} is
+        /// checked (\see{Cipher::IsValidCiphertextHeader}) as soon as it arrives,
+        /// all before the payload is buffered. Frames that still fail
+        /// authentication are charged against an optional pre-auth budget. Use one
+        /// decoder per source (connection) and once the budget is spent the decoder
+        /// refuses to spend any more cycles on that source.
+        ///
+        /// Ex:
+        ///
+        /// \code{.cpp}
+        /// using namespace thekogans;
+        ///
+        /// crypto::FrameDecoder frameDecoder (keyRing);
+        /// while (...) {
+        ///     util::ui8 *buffer = frameDecoder.GetWritePtr (CHUNK_SIZE);
+        ///     frameDecoder.AdvanceWriteOffset (socket.Read (buffer, CHUNK_SIZE));
+        ///     crypto::FrameDecoder::Frame frame;
+        ///     while (frameDecoder.Next (frame)) {
+        ///         // frame.plaintext, frame.plaintextLength
+        ///     }
+        /// }
+        /// \endcode
+
+        struct _LIB_THEKOGANS_CRYPTO_DECL FrameDecoder {
+            /// \enum
+            /// FrameDecoder constants.
+            enum {
+                /// \brief
+                /// Default max frame plaintext length.
+                DEFAULT_MAX_PLAINTEXT_LENGTH = 64 * 1024
+            };
+
+            /// \struct FrameDecoder::Frame FrameDecoder.h thekogans/crypto/FrameDecoder.h
+            ///
+            /// \brief
+            /// A view of a decrypted frame.
+            /// VERY IMPORTANT: plaintext points in to the decoder receive buffer. It's
+            /// only valid until the next call to GetWritePtr, Feed or Reset.
+            struct _LIB_THEKOGANS_CRYPTO_DECL Frame {
+                /// \brief
+                /// \see{ID} of the key used to encrypt the frame.
+                ID keyId;
+                /// \brief
+                /// Decrypted plaintext.
+                const util::ui8 *plaintext;
+                /// \brief
+                /// Decrypted plaintext length.
+                std::size_t plaintextLength;
+
+                /// \brief
+                /// ctor.
+                Frame () :
+                    keyId (ID::Empty),
+                    plaintext (0),
+                    plaintextLength (0) {}
+            };
+
+        private:
+            /// \brief
+            /// \see{KeyRing} used to resolve frame keys.
+            KeyRing::SharedPtr keyRing;
+            /// \brief
+            /// Max acceptable frame (ciphertext) length.
+            std::size_t maxCiphertextLength;
+            /// \brief
+            /// Receive buffer.
+            std::vector<util::ui8> buffer;
+            /// \brief
+            /// Offset of the first unparsed byte in buffer.
+            std::size_t readOffset;
+            /// \brief
+            /// Offset of the first free byte in buffer.
+            std::size_t writeOffset;
+            /// \brief
+            /// Key id of the last decrypted frame.
+            ID keyId;
+            /// \brief
+            /// \see{Cipher} corresponding to keyId.
+            Cipher::SharedPtr cipher;
+            /// \brief
+            /// Per key max frame (ciphertext) lengths (override maxCiphertextLength).
+            IDHashMap<std::size_t> maxKeyCiphertextLengths;
+            /// \brief
+            /// Max number of bytes in frames that failed authentication (0 == unlimited).
+            util::ui64 preAuthBudget;
+            /// \brief
+            /// Number of bytes in frames that failed authentication.
+            util::ui64 preAuthBytes;
+
+        public:
+            /// \brief
+            /// ctor.
+            /// \param[in] keyRing_ \see{KeyRing} used to resolve frame keys.
+            /// \param[in] maxPlaintextLength Frames whose length exceeds
+            /// \see{Cipher::GetMaxBufferLength} (maxPlaintextLength) are rejected.
+            FrameDecoder (
+                KeyRing::SharedPtr keyRing_,
+                std::size_t maxPlaintextLength = DEFAULT_MAX_PLAINTEXT_LENGTH);
+
+            /// \brief
+            /// Return a pointer to at least length bytes of free space in the
+            /// receive buffer (so that the caller can read directly in to it).
+            /// Call AdvanceWriteOffset with the number of bytes actually written.
+            /// NOTE: Invalidates any outstanding \see{Frame} views.
+            /// \param[in] length Number of bytes the caller intends to write.
+            /// \return Pointer to at least length bytes of free space.
+            util::ui8 *GetWritePtr (std::size_t length);
+            /// \brief
+            /// Commit bytes written to the pointer returned by GetWritePtr.
+            /// \param[in] length Number of bytes written.
+            void AdvanceWriteOffset (std::size_t length);
+            /// \brief
+            /// Append a chunk to the receive buffer (convenience wrapper
+            /// around GetWritePtr/AdvanceWriteOffset).
+            /// \param[in] chunk Chunk to append.
+            /// \param[in] length Chunk length.
+            void Feed (
+                const void *chunk,
+                std::size_t length);
+
+            /// \brief
+            /// Set the max frame plaintext length accepted for the given key.
+            /// Use it to keep control channel keys to small frames while letting
+            /// bulk keys use large ones.
+            /// \param[in] keyId \see{ID} of the key the limit applies to.
+            /// \param[in] maxPlaintextLength Frames encrypted with keyId whose length
+            /// exceeds \see{Cipher::GetMaxBufferLength} (maxPlaintextLength) are rejected.
+            void SetMaxPlaintextLength (
+                const ID &keyId,
+                std::size_t maxPlaintextLength);
+
+            /// \brief
+            /// Set the pre-auth budget. Once the frames that failed authentication
+            /// add up to more than preAuthBudget_ bytes, Next throws without
+            /// looking at any more data.
+            /// \param[in] preAuthBudget_ Max number of bytes in frames that failed
+            /// authentication (0 == unlimited).
+            inline void SetPreAuthBudget (util::ui64 preAuthBudget_) {
+                preAuthBudget = preAuthBudget_;
+            }
+            /// \brief
+            /// Return the number of bytes in frames that failed authentication.
+            /// \return Number of bytes in frames that failed authentication.
+            inline util::ui64 GetPreAuthBytes () const {
+                return preAuthBytes;
+            }
+            /// \brief
+            /// Return true if the pre-auth budget has been spent.
+            /// \return true == the pre-auth budget has been spent.
+            inline bool IsPreAuthBudgetExhausted () const {
+                return preAuthBudget > 0 && preAuthBytes > preAuthBudget;
+            }
+
+            /// \brief
+            /// If a complete frame is available, decrypt it in place.
+            /// VERY IMPORTANT: Next throws on frames that fail the header checks
+            /// without consuming them. The stream is unrecoverable at that point
+            /// and the caller should drop the source.
+            /// \param[out] frame Decrypted frame view.
+            /// \param[in] associatedData Optional associated data (AEAD only).
+            /// \param[in] associatedDataLength Length of optional associated data.
+            /// \return true = frame was decrypted, false = need more data.
+            bool Next (
+                Frame &frame,
+                const void *associatedData = 0,
+                std::size_t associatedDataLength = 0);
+
+            /// \brief
+            /// Return the number of buffered (not yet decoded) bytes.
+            /// \return Number of buffered bytes.
+            inline std::size_t GetDataAvailable () const {
+                return writeOffset - readOffset;
+            }
+
+            /// \brief
+            /// Discard all buffered data and reset the pre-auth byte count.
+            void Reset ();
+
+            /// \brief
+            /// FrameDecoder is neither copy constructable, nor assignable.
+            THEKOGANS_CRYPTO_DISALLOW_COPY_AND_ASSIGN (FrameDecoder)
+        };
+
+    } // namespace crypto
+} // namespace thekogans
+
+#endif // !defined (__thekogans_crypto_FrameDecoder_h)
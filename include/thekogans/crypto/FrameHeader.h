@@ -99,6 +99,82 @@ namespace thekogans {
             return serializer;
         }
 
+        /// \struct CompactFrameHeader FrameHeader.h thekogans/crypto/FrameHeader.h
+        ///
+        /// \brief
+        /// CompactFrameHeader is the small message alternative to \see{FrameHeader}
+        /// (see \see{Cipher::EncryptAndFrameCompact}). Instead of a 32 byte key id
+        /// it carries a short key handle (an index in to a key table both peers
+        /// agree on, ex: \see{KeyRing::GetCipherKeyTable}), and both fields are
+        /// encoded as varints (7 bits per byte, least significant group first, high
+        /// bit set on all but the last byte). A frame for a small message using
+        /// one of the first 128 keys has a 2 byte header.
+
+        struct _LIB_THEKOGANS_CRYPTO_DECL CompactFrameHeader {
+            /// \brief
+            /// Index of \see{SymmetricKey} used to encrypt this frame.
+            util::ui32 keyHandle;
+            /// \brief
+            /// Length of following iv, ciphertext and mac.
+            util::ui32 ciphertextLength;
+
+            enum {
+                /// \brief
+                /// Max length of a varint encoded ui32.
+                MAX_VARINT_SIZE = 5,
+                /// \brief
+                /// CompactFrameHeader max serialized size.
+                MAX_SIZE = MAX_VARINT_SIZE + MAX_VARINT_SIZE
+            };
+
+            /// \brief
+            /// ctor.
+            /// \param[in] keyHandle_ Index of \see{SymmetricKey} used to encrypt this frame.
+            /// \param[in] ciphertextLength_ Length of following iv, ciphertext and mac.
+            CompactFrameHeader (
+                util::ui32 keyHandle_ = 0,
+                util::ui32 ciphertextLength_ = 0) :
+                keyHandle (keyHandle_),
+                ciphertextLength (ciphertextLength_) {}
+
+            /// \brief
+            /// Return the varint encoded size of the given value.
+            /// \param[in] value Value whose encoded size to return.
+            /// \return Varint encoded size of value.
+            static inline std::size_t GetVarIntSize (util::ui32 value) {
+                std::size_t size = 1;
+                for (; value >= 0x80; value >>= 7) {
+                    ++size;
+                }
+                return size;
+            }
+
+            /// \brief
+            /// Return the compact frame header size.
+            /// \return Compact frame header size.
+            inline std::size_t Size () const {
+                return GetVarIntSize (keyHandle) + GetVarIntSize (ciphertextLength);
+            }
+        };
+
+        /// \brief
+        /// CompactFrameHeader serializer.
+        /// \param[in] serializer Where to serialize the compact frame header.
+        /// \param[in] frameHeader CompactFrameHeader to serialize.
+        /// \return serializer.
+        _LIB_THEKOGANS_CRYPTO_DECL util::Serializer & _LIB_THEKOGANS_CRYPTO_API operator << (
+            util::Serializer &serializer,
+            const CompactFrameHeader &frameHeader);
+
+        /// \brief
+        /// CompactFrameHeader deserializer.
+        /// \param[in] serializer Where to deserialize the compact frame header.
+        /// \param[in] frameHeader CompactFrameHeader to deserialize.
+        /// \return serializer.
+        _LIB_THEKOGANS_CRYPTO_DECL util::Serializer & _LIB_THEKOGANS_CRYPTO_API operator >> (
+            util::Serializer &serializer,
+            CompactFrameHeader &frameHeader);
+
     } // namespace crypto
 
     namespace util {
@@ -153,6 +229,73 @@ namespace thekogans {
             bool ParseValue (Serializer &serializer);
         };
 
+        /// \struct ValueParser<CompactFrameHeader> FrameHeader.h thekogans/crypto/FrameHeader.h
+        ///
+        /// \brief
+        /// Specialization of \see{util::ValueParser} for \see{CompactFrameHeader}.
+        /// Varints are parsed one byte at a time so that the header can
+        /// be split across any number of reads.
+
+        template<>
+        struct _LIB_THEKOGANS_CRYPTO_DECL ValueParser<crypto::CompactFrameHeader> {
+        private:
+            /// \brief
+            /// Value to parse.
+            crypto::CompactFrameHeader &value;
+            /// \brief
+            /// Next varint byte.
+            ui8 byte;
+            /// \brief
+            /// Parses the varint bytes.
+            ValueParser<ui8> byteParser;
+            /// \brief
+            /// Number of bytes of the current varint parsed so far.
+            std::size_t byteCount;
+            /// \brief
+            /// Value of the current varint parsed so far.
+            ui32 varInt;
+            /// \enum
+            /// \see{CompactFrameHeader} parser is a state machine. These are it's various states.
+            enum {
+                /// \brief
+                /// Next value to parse is the \see{CompactFrameHeader::keyHandle}.
+                STATE_KEY_HANDLE,
+                /// \brief
+                /// Next value to parse is the \see{CompactFrameHeader::ciphertextLength}.
+                STATE_CIPHERTEXT_LENGTH
+            } state;
+
+        public:
+            /// \brief
+            /// ctor.
+            /// \param[out] value_ Value to parse.
+            explicit ValueParser (crypto::CompactFrameHeader &value_) :
+                value (value_),
+                byte (0),
+                byteParser (byte),
+                byteCount (0),
+                varInt (0),
+                state (STATE_KEY_HANDLE) {}
+
+            /// \brief
+            /// Rewind the sub-parsers to get them ready for the next value.
+            void Reset ();
+
+            /// \brief
+            /// Try to parse a \see{CompactFrameHeader} from the given serializer.
+            /// \param[in] serializer Contains a complete or partial \see{CompactFrameHeader}.
+            /// \return true == \see{CompactFrameHeader} was successfully parsed,
+            /// false == call back with more data.
+            bool ParseValue (Serializer &serializer);
+
+        private:
+            /// \brief
+            /// Try to parse the rest of the current varint.
+            /// \param[in] serializer Contains a complete or partial varint.
+            /// \return true == varInt is complete, false == call back with more data.
+            bool ParseVarInt (Serializer &serializer);
+        };
+
     } // namespace util
 } // namespace thekogans
 
@@ -0,0 +1,148 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined (__thekogans_crypto_GMAC_h)
+#define __thekogans_crypto_GMAC_h
+
+#include <openssl/evp.h>
+#include "thekogans/crypto/Config.h"
+#include "thekogans/crypto/MAC.h"
+#include "thekogans/crypto/SymmetricKey.h"
+#include "thekogans/crypto/OpenSSLUtils.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        /// \struct GMAC GMAC.h thekogans/crypto/GMAC.h
+        ///
+        /// \brief
+        /// Implements GMAC (AES-GCM over an empty plaintext, the message
+        /// is fed in as associated data). GMAC is only secure if a nonce is
+        /// never reused with the same key, so every signature gets a fresh
+        /// random nonce and carries it with it:
+        ///
+        /// +-------+-----+
+        /// | nonce | tag |
+        /// +-------+-----+
+        /// |  12   | 16  |
+
+        struct _LIB_THEKOGANS_CRYPTO_DECL GMAC : public MAC {
+            /// \enum
+            /// GMAC constants.
+            enum {
+                /// \brief
+                /// Nonce length.
+                NONCE_LENGTH = 12,
+                /// \brief
+                /// Tag length.
+                TAG_LENGTH = 16,
+                /// \brief
+                /// Signature (nonce + tag) length.
+                SIGNATURE_LENGTH = NONCE_LENGTH + TAG_LENGTH
+            };
+
+        private:
+            /// \brief
+            /// Key used in the MAC operation.
+            SymmetricKey::SharedPtr key;
+            /// \brief
+            /// OpenSSL AES-GCM cipher object.
+            const EVP_CIPHER *cipher;
+            /// \brief
+            /// OpenSSL cipher context (keyed once in the ctor).
+            CipherContext ctx;
+            /// \brief
+            /// Nonce used by the current MAC operation.
+            util::ui8 nonce[NONCE_LENGTH];
+
+        public:
+            /// \brief
+            /// ctor.
+            /// \param[in] key_ Key used in the MAC operation.
+            /// \param[in] cipher_ OpenSSL AES-GCM cipher object whose key
+            /// length matches key_.
+            GMAC (
+                SymmetricKey::SharedPtr key_,
+                const EVP_CIPHER *cipher_);
+
+            /// \brief
+            /// Return the AES-GCM cipher matching the given key length.
+            /// \param[in] keyLength AES key length (16, 24 or 32).
+            /// \return AES-GCM cipher matching the given key length
+            /// (0 if keyLength is not an AES key length).
+            static const EVP_CIPHER *GetCipherFromKeyLength (std::size_t keyLength);
+
+            /// \brief
+            /// Return the mac key.
+            /// \return MAC \see{SymmetricKey}.
+            inline SymmetricKey::SharedPtr GetKey () const {
+                return key;
+            }
+            /// \brief
+            /// Return the OpenSSL cipher object.
+            /// \return OpenSSL cipher object.
+            inline const EVP_CIPHER *GetCipher () const {
+                return cipher;
+            }
+
+            /// \brief
+            /// Return the MAC type.
+            /// \return TYPE_GMAC.
+            virtual Type GetType () const {
+                return TYPE_GMAC;
+            }
+
+            /// \brief
+            /// Return the length of the mac.
+            /// \return Length of the mac.
+            virtual std::size_t GetMACLength () const {
+                return SIGNATURE_LENGTH;
+            }
+
+            /// \brief
+            /// Pick a new random nonce and get the context ready for MAC generation.
+            virtual void Init ();
+            /// \brief
+            /// Get the context ready to recompute the given signature (using it's nonce).
+            /// \param[in] signature Signature that will be verified.
+            /// \param[in] signatureLength Signature length.
+            virtual void InitVerify (
+                const void *signature,
+                std::size_t signatureLength);
+            /// \brief
+            /// Call this method 1 or more times to generate a MAC.
+            /// \param[in] buffer Buffer whose signature to create.
+            /// \param[in] bufferLength Buffer length.
+            virtual void Update (
+                const void *buffer,
+                std::size_t bufferLength);
+            /// \brief
+            /// Finalize the MAC and return the signature (nonce + tag).
+            /// \param[out] signature Where to write the signature.
+            /// \return Number of bytes written to signature.
+            virtual std::size_t Final (util::ui8 *signature);
+
+        private:
+            /// \brief
+            /// Set the nonce on the (keyed) context.
+            void SetNonce ();
+        };
+
+    } // namespace crypto
+} // namespace thekogans
+
+#endif // !defined (__thekogans_crypto_GMAC_h)
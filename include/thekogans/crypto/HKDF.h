@@ -0,0 +1,164 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined (__thekogans_crypto_HKDF_h)
+#define __thekogans_crypto_HKDF_h
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <openssl/evp.h>
+#include "thekogans/util/Types.h"
+#include "thekogans/crypto/Config.h"
+#include "thekogans/crypto/ID.h"
+#include "thekogans/crypto/SymmetricKey.h"
+#include "thekogans/crypto/OpenSSLUtils.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        /// \struct HKDF HKDF.h thekogans/crypto/HKDF.h
+        ///
+        /// \brief
+        /// HKDF (RFC 5869) split in to it's two halves. The ctor runs extract
+        /// once and keys an HMAC context with the resulting PRK. Expand then
+        /// copies that pre-keyed context instead of rekeying HMAC for every
+        /// block, making it cheap to derive a whole key schedule (cipher, MAC,
+        /// per-direction keys...) from one shared secret.
+        ///
+        /// Ex:
+        ///
+        /// \code{.cpp}
+        /// using namespace thekogans;
+        ///
+        /// crypto::HKDF hkdf (secret.data (), secret.size (), salt.data (), salt.size ());
+        /// std::vector<crypto::HKDF::Output> outputs;
+        /// outputs.push_back (crypto::HKDF::Output ("client write key"));
+        /// outputs.push_back (crypto::HKDF::Output ("server write key"));
+        /// std::vector<crypto::SymmetricKey::SharedPtr> keys = hkdf.ExpandKeys (outputs);
+        /// \endcode
+
+        struct _LIB_THEKOGANS_CRYPTO_DECL HKDF {
+            /// \struct HKDF::Output HKDF.h thekogans/crypto/HKDF.h
+            ///
+            /// \brief
+            /// Describes one \see{SymmetricKey} to expand.
+            struct Output {
+                /// \brief
+                /// Expand info (label).
+                std::string info;
+                /// \brief
+                /// Length of the resulting key (in bytes).
+                std::size_t keyLength;
+                /// \brief
+                /// Optional key id.
+                ID id;
+                /// \brief
+                /// Optional key name.
+                std::string name;
+                /// \brief
+                /// Optional key description.
+                std::string description;
+
+                /// \brief
+                /// ctor.
+                /// \param[in] info_ Expand info (label).
+                /// \param[in] keyLength_ Length of the resulting key (in bytes).
+                /// \param[in] id_ Optional key id.
+                /// \param[in] name_ Optional key name.
+                /// \param[in] description_ Optional key description.
+                Output (
+                    const std::string &info_ = std::string (),
+                    std::size_t keyLength_ = GetCipherKeyLength (),
+                    const ID &id_ = ID (),
+                    const std::string &name_ = std::string (),
+                    const std::string &description_ = std::string ()) :
+                    info (info_),
+                    keyLength (keyLength_),
+                    id (id_),
+                    name (name_),
+                    description (description_) {}
+            };
+
+        private:
+            /// \brief
+            /// OpenSSL message digest used by HMAC.
+            const EVP_MD *md;
+            /// \brief
+            /// HMAC context keyed with the PRK.
+            mutable HMACContext prkContext;
+
+        public:
+            /// \brief
+            /// ctor. Extract the PRK.
+            /// \param[in] ikm Input keying material.
+            /// \param[in] ikmLength Input keying material length.
+            /// \param[in] salt Optional salt (0 = HashLen zeros, as per RFC 5869).
+            /// \param[in] saltLength Salt length.
+            /// \param[in] md_ OpenSSL message digest to use for hashing.
+            HKDF (
+                const void *ikm,
+                std::size_t ikmLength,
+                const void *salt = 0,
+                std::size_t saltLength = 0,
+                const EVP_MD *md_ = THEKOGANS_CRYPTO_DEFAULT_MD);
+
+            /// \brief
+            /// Expand the given info in to the given buffer.
+            /// \param[in] info Optional info (label).
+            /// \param[in] infoLength Info length.
+            /// \param[out] key Where to write the output keying material.
+            /// \param[in] keyLength Length of output keying material (at most 255 * HashLen).
+            void Expand (
+                const void *info,
+                std::size_t infoLength,
+                util::ui8 *key,
+                std::size_t keyLength) const;
+
+            /// \brief
+            /// Expand the given info in to a \see{SymmetricKey}.
+            /// \param[in] info Optional info (label).
+            /// \param[in] infoLength Info length.
+            /// \param[in] keyLength Length of the resulting key (in bytes).
+            /// \param[in] id Optional key id.
+            /// \param[in] name Optional key name.
+            /// \param[in] description Optional key description.
+            /// \return A new symmetric key.
+            SymmetricKey::SharedPtr ExpandKey (
+                const void *info,
+                std::size_t infoLength,
+                std::size_t keyLength = GetCipherKeyLength (),
+                const ID &id = ID (),
+                const std::string &name = std::string (),
+                const std::string &description = std::string ()) const;
+
+            /// \brief
+            /// Expand all the given outputs in one call.
+            /// \param[in] outputs Keys to expand.
+            /// \return The new symmetric keys (keys[i] is expanded from outputs[i]).
+            std::vector<SymmetricKey::SharedPtr> ExpandKeys (
+                const std::vector<Output> &outputs) const;
+
+            /// \brief
+            /// HKDF is neither copy constructable, nor assignable.
+            THEKOGANS_CRYPTO_DISALLOW_COPY_AND_ASSIGN (HKDF)
+        };
+
+    } // namespace crypto
+} // namespace thekogans
+
+#endif // !defined (__thekogans_crypto_HKDF_h)
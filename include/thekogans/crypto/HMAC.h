@@ -30,7 +30,16 @@ namespace thekogans {
         /// \struct HMAC HMAC.h thekogans/crypto/HMAC.h
         ///
         /// \brief
-        /// Implements the HMAC (Hash-based Message Authentication Code).
+        /// Implements the HMAC (Hash-based Message Authentication Code, RFC 2104).
+        /// The keyed inner (key ^ ipad) and outer (key ^ opad) digest states are
+        /// computed once, in the ctor. Every message then starts by cloning the
+        /// inner state (EVP_MD_CTX_copy_ex), and Final finishes by cloning the
+        /// outer one, so no per message pre-keying work is done.
+        ///
+        /// NOTE: \see{EVP_blake3_256} is a MAC in its own right. With it, HMAC
+        /// uses BLAKE3's keyed hash mode instead of the ipad/opad construction.
+        /// 32 byte keys are used as is, other lengths are first turned in to
+        /// one with BLAKE3's derive key mode.
 
         struct _LIB_THEKOGANS_CRYPTO_DECL HMAC : public MAC {
         private:
@@ -41,8 +50,17 @@ namespace thekogans {
             /// Message digest object.
             const EVP_MD *md;
             /// \brief
-            /// OpenSSL HMAC context.
-            HMACContext ctx;
+            /// Precomputed keyed inner (key ^ ipad) digest state.
+            MDContext innerContext;
+            /// \brief
+            /// Precomputed keyed outer (key ^ opad) digest state.
+            MDContext outerContext;
+            /// \brief
+            /// Working digest context (cloned from the above per message).
+            MDContext context;
+            /// \brief
+            /// true == BLAKE3 keyed hash (innerContext is keyed, outerContext is unused).
+            bool keyed;
 
         public:
             /// \brief
@@ -66,6 +84,19 @@ namespace thekogans {
                 return md;
             }
 
+            /// \brief
+            /// Return a copy of the precomputed inner and outer states.
+            /// Much cheaper than keying a new HMAC (no digest work is done).
+            /// \return Copy of this HMAC.
+            MAC::SharedPtr Clone () const;
+
+            /// \brief
+            /// Return the MAC type.
+            /// \return TYPE_HMAC.
+            virtual Type GetType () const {
+                return TYPE_HMAC;
+            }
+
             /// \brief
             /// Return the length of the mac.
             /// \return Length of the mac.
@@ -88,6 +119,17 @@ namespace thekogans {
             /// \param[out] signature Where to write the signature.
             /// \return Number of bytes written to signature.
             virtual std::size_t Final (util::ui8 *signature);
+
+        private:
+            /// \brief
+            /// ctor. Used by Clone. Leaves the contexts for Clone to copy.
+            /// \param[in] key_ Key used in the MAC operation.
+            /// \param[in] md_ OpenSSL message digest object.
+            /// \param[in] keyed_ true == BLAKE3 keyed hash.
+            HMAC (
+                SymmetricKey::SharedPtr key_,
+                const EVP_MD *md_,
+                bool keyed_);
         };
 
     } // namespace crypto
@@ -20,6 +20,8 @@
 
 #include <cstddef>
 #include <cstring>
+#include <functional>
+#include <vector>
 #include <openssl/sha.h>
 #include "thekogans/util/Types.h"
 #include "thekogans/util/Serializer.h"
@@ -27,6 +29,8 @@
 #include "thekogans/util/Exception.h"
 #include "thekogans/crypto/Config.h"
 #include "thekogans/crypto/OpenSSLUtils.h"
+#include "thekogans/crypto/ConstantTime.h"
+#include "thekogans/crypto/TextEncoding.h"
 
 namespace thekogans {
     namespace crypto {
@@ -42,20 +46,36 @@ namespace thekogans {
             enum {
                 SIZE = SHA256_DIGEST_LENGTH
             };
+            /// \enum
+            /// Content derived id schemes (see ID (buffer, length, scheme)).
+            enum {
+                /// \brief
+                /// id = SHA-256 (buffer). The default, and the only
+                /// scheme older versions understand.
+                SCHEME_SHA256 = 0,
+                /// \brief
+                /// id = BLAKE2s-256 (buffer). Opt-in, for systems whose
+                /// ids don't need to be SHA-256 compatible.
+                SCHEME_BLAKE2S256 = 1
+            };
             /// \brief
             /// \see{Serializable} ID.
             util::ui8 data[SIZE];
 
             /// \brief
-            /// ctor. Create a random ID using \see{util::RandomSource}.
+            /// ctor. Create a random ID using \see{BufferedRandomSource}.
             ID ();
             /// \brief
             /// ctor.
             /// \param[in] buffer Optional data to hash in to id.
             /// NOTE: if none is provided, ID will use random bytes.
             /// \param[in] length Optional buffer length.
+            /// \param[in] scheme SCHEME_SHA256 or SCHEME_BLAKE2S256.
+            /// NOTE: The digest context is per thread and reused
+            /// across calls, so deriving ids doesn't allocate.
             ID (const void *buffer,
-                std::size_t length);
+                std::size_t length,
+                util::ui8 scheme = SCHEME_SHA256);
             /// \brief
             /// ctor. Initialize to a given value.
             /// \param[in] data_ Value to initialize to.
@@ -83,12 +103,31 @@ namespace thekogans {
             void Serialize (util::Serializer &serializer) const;
 
             static ID FromHexString (const std::string &hexString);
+            /// \brief
+            /// Create an ID for each of the given buffers. The IDs are the same
+            /// ones ID (buffer, length) would create, but the buffers are hashed
+            /// as a batch (\see{MessageDigest::HashBatch}).
+            /// \param[in] buffers Data to hash in to ids.
+            /// \param[in] lengths Buffer lengths.
+            /// \param[in] count Number of buffers.
+            /// \param[in] scheme SCHEME_SHA256 or SCHEME_BLAKE2S256.
+            /// \return IDs (in buffer order).
+            static std::vector<ID> FromBuffers (
+                const void * const *buffers,
+                const std::size_t *lengths,
+                std::size_t count,
+                util::ui8 scheme = SCHEME_SHA256);
+            /// \brief
+            /// Return the message digest used by the given scheme.
+            /// \param[in] scheme SCHEME_SHA256 or SCHEME_BLAKE2S256.
+            /// \return OpenSSL EVP_MD (throws if scheme is not supported).
+            static const EVP_MD *GetSchemeMessageDigest (util::ui8 scheme);
 
             /// \brief
             /// Return a hex string representation of the id.
             /// \return Hex string representation of the id.
             inline std::string ToHexString () const {
-                return util::HexEncodeBuffer (data, SIZE);
+                return HexEncode (data, SIZE);
             }
         };
 
@@ -111,7 +150,7 @@ namespace thekogans {
         inline bool operator == (
                 const ID &id1,
                 const ID &id2) {
-            return TimeInsensitiveCompare (id1.data, id2.data, ID::SIZE);
+            return ConstantTimeCompare (id1.data, id2.data, ID::SIZE);
         }
 
         /// \brief
@@ -122,7 +161,7 @@ namespace thekogans {
         inline bool operator != (
                 const ID &id1,
                 const ID &id2) {
-            return !TimeInsensitiveCompare (id1.data, id2.data, ID::SIZE);
+            return !ConstantTimeCompare (id1.data, id2.data, ID::SIZE);
         }
 
         /// \brief
@@ -158,4 +197,22 @@ namespace thekogans {
     } // namespace crypto
 } // namespace thekogans
 
+namespace std {
+
+    /// \struct hash<thekogans::crypto::ID> ID.h thekogans/crypto/ID.h
+    ///
+    /// \brief
+    /// IDs are SHA-256 digests (or random values) so their first
+    /// sizeof (std::size_t) bytes are already a perfect hash.
+    template<>
+    struct hash<thekogans::crypto::ID> {
+        inline std::size_t operator () (const thekogans::crypto::ID &id) const {
+            std::size_t value;
+            memcpy (&value, id.data, sizeof (value));
+            return value;
+        }
+    };
+
+} // namespace std
+
 #endif // !defined (__thekogans_crypto_ID_h)
@@ -0,0 +1,239 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined (__thekogans_crypto_IDCache_h)
+#define __thekogans_crypto_IDCache_h
+
+#include <cstddef>
+#include "thekogans/util/Types.h"
+#include "thekogans/crypto/Config.h"
+#include "thekogans/crypto/ID.h"
+#include "thekogans/crypto/IDHashMap.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        /// \struct IDCacheStats IDCache.h thekogans/crypto/IDCache.h
+        ///
+        /// \brief
+        /// \see{IDCache} counters.
+        struct _LIB_THEKOGANS_CRYPTO_DECL IDCacheStats {
+            /// \brief
+            /// Lookups that found a cached object.
+            util::ui64 hits;
+            /// \brief
+            /// Lookups that did not.
+            util::ui64 misses;
+            /// \brief
+            /// Objects evicted to stay within capacity.
+            util::ui64 evictions;
+            /// \brief
+            /// Number of cached objects.
+            std::size_t size;
+
+            /// \brief
+            /// ctor.
+            IDCacheStats () :
+                hits (0),
+                misses (0),
+                evictions (0),
+                size (0) {}
+
+            /// \brief
+            /// Accumulate the given stats.
+            /// \param[in] stats Stats to add.
+            /// \return *this.
+            inline IDCacheStats &operator += (const IDCacheStats &stats) {
+                hits += stats.hits;
+                misses += stats.misses;
+                evictions += stats.evictions;
+                size += stats.size;
+                return *this;
+            }
+        };
+
+        /// \struct IDCache IDCache.h thekogans/crypto/IDCache.h
+        ///
+        /// \brief
+        /// IDCache is an \see{IDHashMap} of objects that can be recreated
+        /// on demand (\see{Cipher}s, \see{MAC}s... built from the keys in a
+        /// \see{KeyRing}). When capacity is set, the cache uses CLOCK
+        /// eviction: every hit sets the object's reference bit, and when
+        /// the cache is full the hand sweeps the (dense) entry vector,
+        /// clearing reference bits until it finds an object that has not
+        /// been used since the last sweep. That's LRU quality eviction
+        /// without the list splicing on every hit.
+
+        template<typename T>
+        struct IDCache {
+        private:
+            /// \struct IDCache::Entry IDCache.h thekogans/crypto/IDCache.h
+            ///
+            /// \brief
+            /// Cached object and it's reference bit.
+            struct Entry {
+                /// \brief
+                /// Cached object.
+                T object;
+                /// \brief
+                /// true = used since the hand last passed.
+                bool referenced;
+
+                /// \brief
+                /// ctor.
+                /// \param[in] object_ Object to cache.
+                Entry (const T &object_ = T ()) :
+                    object (object_),
+                    referenced (true) {}
+            };
+            /// \brief
+            /// Cached objects.
+            IDHashMap<Entry> entries;
+            /// \brief
+            /// Max number of cached objects (0 = unbounded).
+            std::size_t capacity;
+            /// \brief
+            /// CLOCK hand (index in to entries).
+            std::size_t hand;
+            /// \brief
+            /// Counters.
+            IDCacheStats stats;
+
+        public:
+            /// \brief
+            /// ctor.
+            /// \param[in] capacity_ Max number of cached objects (0 = unbounded).
+            explicit IDCache (std::size_t capacity_ = 0) :
+                capacity (capacity_),
+                hand (0) {}
+
+            /// \brief
+            /// Return the max number of cached objects.
+            /// \return Max number of cached objects (0 = unbounded).
+            inline std::size_t GetCapacity () const {
+                return capacity;
+            }
+            /// \brief
+            /// Set the max number of cached objects, evicting
+            /// objects if the cache is over the new capacity.
+            /// \param[in] capacity_ Max number of cached objects (0 = unbounded).
+            void SetCapacity (std::size_t capacity_) {
+                capacity = capacity_;
+                Trim (0);
+            }
+            /// \brief
+            /// Return the number of cached objects.
+            /// \return Number of cached objects.
+            inline std::size_t size () const {
+                return entries.size ();
+            }
+            /// \brief
+            /// Return the counters.
+            /// \return IDCacheStats.
+            inline IDCacheStats GetStats () const {
+                IDCacheStats result = stats;
+                result.size = entries.size ();
+                return result;
+            }
+
+            /// \brief
+            /// Lookup the object with the given id. Counts a hit or a miss.
+            /// \param[in] id \see{ID} of object to lookup.
+            /// \param[out] object Where to put the cached object.
+            /// \return true = found, false = not cached.
+            bool Get (
+                    const ID &id,
+                    T &object) {
+                typename IDHashMap<Entry>::iterator it = entries.find (id);
+                if (it != entries.end ()) {
+                    it->second.referenced = true;
+                    object = it->second.object;
+                    ++stats.hits;
+                    return true;
+                }
+                ++stats.misses;
+                return false;
+            }
+            /// \brief
+            /// Cache the given object, evicting another if the cache is full.
+            /// \param[in] id \see{ID} of object to cache.
+            /// \param[in] object Object to cache.
+            /// \return true = cached, false = an object with the given id is already cached.
+            bool Add (
+                    const ID &id,
+                    const T &object) {
+                if (entries.find (id) != entries.end ()) {
+                    return false;
+                }
+                Trim (1);
+                entries.insert (typename IDHashMap<Entry>::value_type (id, Entry (object)));
+                return true;
+            }
+            /// \brief
+            /// Make room for the given number of objects (unbounded caches only;
+            /// bounded caches never grow past capacity).
+            /// \param[in] count Number of objects to make room for.
+            void reserve (std::size_t count) {
+                if (capacity == 0) {
+                    entries.reserve (count);
+                }
+            }
+            /// \brief
+            /// Drop the object with the given id.
+            /// \param[in] id \see{ID} of object to drop.
+            /// \return true = dropped, false = not cached.
+            bool Erase (const ID &id) {
+                return entries.erase (id) == 1;
+            }
+            /// \brief
+            /// Drop all objects (the counters are preserved).
+            void Clear () {
+                entries.clear ();
+                hand = 0;
+            }
+
+        private:
+            /// \brief
+            /// Evict objects until there's room for the given number of new ones.
+            /// \param[in] room Number of new objects to make room for.
+            void Trim (std::size_t room) {
+                if (capacity == 0) {
+                    return;
+                }
+                while (!entries.empty () && entries.size () + room > capacity) {
+                    if (hand >= entries.size ()) {
+                        hand = 0;
+                    }
+                    typename IDHashMap<Entry>::iterator it = entries.begin () + hand;
+                    if (it->second.referenced) {
+                        it->second.referenced = false;
+                        ++hand;
+                    }
+                    else {
+                        // erase moves the last entry under the hand,
+                        // so it will be looked at next.
+                        entries.erase (it);
+                        ++stats.evictions;
+                    }
+                }
+            }
+        };
+
+    } // namespace crypto
+} // namespace thekogans
+
+#endif // !defined (__thekogans_crypto_IDCache_h)
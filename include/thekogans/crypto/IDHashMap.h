@@ -0,0 +1,313 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined (__thekogans_crypto_IDHashMap_h)
+#define __thekogans_crypto_IDHashMap_h
+
+#include <cstddef>
+#include <functional>
+#include <utility>
+#include <vector>
+#include "thekogans/util/Types.h"
+#include "thekogans/crypto/Config.h"
+#include "thekogans/crypto/ID.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        /// \struct IDHashMap IDHashMap.h thekogans/crypto/IDHashMap.h
+        ///
+        /// \brief
+        /// IDHashMap is an open addressing (linear probing) hash map keyed by
+        /// \see{ID}. It implements the subset of the std::map interface used by
+        /// \see{KeyRing} (find, insert, erase, clear, iteration) with O(1) lookups.
+        ///
+        /// The entries (std::pair<ID, T>) are kept in a dense vector, in insertion
+        /// order. The slot table is a separate power of 2 array of 8 byte
+        /// (hash, entry index) pairs, so that a probe touches one cache line and
+        /// only dereferences an entry whose hash matches. IDs are SHA-256 digests
+        /// or random values, so their first bytes are a perfect hash (see
+        /// std::hash<ID> in ID.h). Keys are still compared with ID::operator ==
+        /// (\see{TimeInsensitiveCompare}).
+        ///
+        /// NOTE: Unlike std::map, iteration is in insertion order (not sorted),
+        /// and insert/erase invalidate all iterators. erase moves the last
+        /// entry in to the erased one's place.
+
+        template<typename T>
+        struct IDHashMap {
+            /// \brief
+            /// Map entry.
+            typedef std::pair<ID, T> value_type;
+            /// \brief
+            /// Entry iterator.
+            typedef typename std::vector<value_type>::iterator iterator;
+            /// \brief
+            /// Entry const iterator.
+            typedef typename std::vector<value_type>::const_iterator const_iterator;
+
+        private:
+            /// \struct IDHashMap::Slot IDHashMap.h thekogans/crypto/IDHashMap.h
+            ///
+            /// \brief
+            /// Slot table entry.
+            struct Slot {
+                /// \brief
+                /// Low 32 bits of the entry's hash.
+                util::ui32 hash;
+                /// \brief
+                /// Entry index + 1 (0 == empty slot).
+                util::ui32 index;
+
+                /// \brief
+                /// ctor.
+                Slot () :
+                    hash (0),
+                    index (0) {}
+            };
+
+            /// \brief
+            /// Entries (in insertion order).
+            std::vector<value_type> entries;
+            /// \brief
+            /// Slot table (power of 2 size, at most 3/4 full).
+            std::vector<Slot> slots;
+
+            enum {
+                /// \brief
+                /// Smallest slot table.
+                MIN_SLOTS = 16
+            };
+
+        public:
+            /// \brief
+            /// Return true if the map is empty.
+            /// \return true == empty.
+            inline bool empty () const {
+                return entries.empty ();
+            }
+            /// \brief
+            /// Return the number of entries.
+            /// \return Number of entries.
+            inline std::size_t size () const {
+                return entries.size ();
+            }
+
+            /// \brief
+            /// Return an iterator to the first entry.
+            /// \return Iterator to the first entry.
+            inline iterator begin () {
+                return entries.begin ();
+            }
+            /// \brief
+            /// Return a const iterator to the first entry.
+            /// \return Const iterator to the first entry.
+            inline const_iterator begin () const {
+                return entries.begin ();
+            }
+            /// \brief
+            /// Return an iterator past the last entry.
+            /// \return Iterator past the last entry.
+            inline iterator end () {
+                return entries.end ();
+            }
+            /// \brief
+            /// Return a const iterator past the last entry.
+            /// \return Const iterator past the last entry.
+            inline const_iterator end () const {
+                return entries.end ();
+            }
+
+            /// \brief
+            /// Find the entry with the given id.
+            /// \param[in] id \see{ID} to find.
+            /// \return Iterator to the entry (end () == not found).
+            inline iterator find (const ID &id) {
+                std::size_t slot = FindSlot (id, Hash (id));
+                return slot != slots.size () && slots[slot].index != 0 ?
+                    entries.begin () + (slots[slot].index - 1) : entries.end ();
+            }
+            /// \brief
+            /// Find the entry with the given id.
+            /// \param[in] id \see{ID} to find.
+            /// \return Const iterator to the entry (end () == not found).
+            inline const_iterator find (const ID &id) const {
+                std::size_t slot = FindSlot (id, Hash (id));
+                return slot != slots.size () && slots[slot].index != 0 ?
+                    entries.begin () + (slots[slot].index - 1) : entries.end ();
+            }
+            /// \brief
+            /// Return the number of entries with the given id (0 or 1).
+            /// \param[in] id \see{ID} to count.
+            /// \return 0 or 1.
+            inline std::size_t count (const ID &id) const {
+                return find (id) != end () ? 1 : 0;
+            }
+
+            /// \brief
+            /// Insert a new entry.
+            /// \param[in] value Entry to insert.
+            /// \return std::pair (iterator to the entry with value.first,
+            /// true == inserted, false == the id was already present).
+            std::pair<iterator, bool> insert (const value_type &value) {
+                if ((entries.size () + 1) * 4 > slots.size () * 3) {
+                    Rehash (slots.empty () ? (std::size_t)MIN_SLOTS : slots.size () * 2);
+                }
+                util::ui32 hash = Hash (value.first);
+                std::size_t slot = FindSlot (value.first, hash);
+                if (slots[slot].index != 0) {
+                    return std::pair<iterator, bool> (
+                        entries.begin () + (slots[slot].index - 1), false);
+                }
+                entries.push_back (value);
+                slots[slot].hash = hash;
+                slots[slot].index = (util::ui32)entries.size ();
+                return std::pair<iterator, bool> (entries.end () - 1, true);
+            }
+            /// \brief
+            /// Erase the given entry.
+            /// \param[in] it Iterator to the entry to erase.
+            void erase (iterator it) {
+                std::size_t index = it - entries.begin ();
+                RemoveSlot (FindIndexSlot ((util::ui32)index + 1, Hash (it->first)));
+                std::size_t last = entries.size () - 1;
+                if (index != last) {
+                    // Move the last entry in to the hole.
+                    slots[FindIndexSlot ((util::ui32)last + 1, Hash (entries[last].first))].index =
+                        (util::ui32)index + 1;
+                    entries[index] = entries[last];
+                }
+                entries.pop_back ();
+            }
+            /// \brief
+            /// Erase the entry with the given id.
+            /// \param[in] id \see{ID} of the entry to erase.
+            /// \return Number of entries erased (0 or 1).
+            std::size_t erase (const ID &id) {
+                iterator it = find (id);
+                if (it != end ()) {
+                    erase (it);
+                    return 1;
+                }
+                return 0;
+            }
+            /// \brief
+            /// Make room for the given number of entries, so that inserting
+            /// them does not rehash (or reallocate the entries) along the way.
+            /// \param[in] count Number of entries to make room for.
+            void reserve (std::size_t count) {
+                entries.reserve (count);
+                std::size_t slotCount = slots.empty () ? (std::size_t)MIN_SLOTS : slots.size ();
+                while (count * 4 > slotCount * 3) {
+                    slotCount *= 2;
+                }
+                if (slotCount != slots.size ()) {
+                    Rehash (slotCount);
+                }
+            }
+            /// \brief
+            /// Remove all entries.
+            void clear () {
+                entries.clear ();
+                slots.clear ();
+            }
+
+        private:
+            /// \brief
+            /// Return the hash used to place the given id.
+            /// \param[in] id \see{ID} to hash.
+            /// \return Low 32 bits of std::hash<ID>.
+            static inline util::ui32 Hash (const ID &id) {
+                return (util::ui32)std::hash<ID> () (id);
+            }
+            /// \brief
+            /// Return the slot holding the given id, or the empty slot where it
+            /// would be inserted (slots.size () if the table is empty).
+            /// \param[in] id \see{ID} to find.
+            /// \param[in] hash Hash (id).
+            /// \return Slot index.
+            std::size_t FindSlot (
+                    const ID &id,
+                    util::ui32 hash) const {
+                if (slots.empty ()) {
+                    return 0;
+                }
+                std::size_t mask = slots.size () - 1;
+                for (std::size_t slot = hash & mask;; slot = (slot + 1) & mask) {
+                    const Slot &entry = slots[slot];
+                    if (entry.index == 0 ||
+                            (entry.hash == hash && entries[entry.index - 1].first == id)) {
+                        return slot;
+                    }
+                }
+            }
+            /// \brief
+            /// Return the slot pointing at the given entry.
+            /// \param[in] index Entry index + 1.
+            /// \param[in] hash Hash of the entry's id.
+            /// \return Slot index.
+            std::size_t FindIndexSlot (
+                    util::ui32 index,
+                    util::ui32 hash) const {
+                std::size_t mask = slots.size () - 1;
+                std::size_t slot = hash & mask;
+                while (slots[slot].index != index) {
+                    slot = (slot + 1) & mask;
+                }
+                return slot;
+            }
+            /// \brief
+            /// Empty the given slot, shifting the following entries of it's
+            /// probe sequence back so that no tombstones are needed.
+            /// \param[in] hole Slot to empty.
+            void RemoveSlot (std::size_t hole) {
+                std::size_t mask = slots.size () - 1;
+                for (std::size_t slot = (hole + 1) & mask;
+                        slots[slot].index != 0; slot = (slot + 1) & mask) {
+                    // An entry can move back to the hole if the
+                    // hole is between it's home slot and it.
+                    std::size_t home = slots[slot].hash & mask;
+                    if (((slot - home) & mask) >= ((slot - hole) & mask)) {
+                        slots[hole] = slots[slot];
+                        hole = slot;
+                    }
+                }
+                slots[hole] = Slot ();
+            }
+            /// \brief
+            /// Rebuild the slot table with the given number of slots.
+            /// \param[in] slotCount New slot table size (power of 2).
+            void Rehash (std::size_t slotCount) {
+                std::vector<Slot> newSlots (slotCount);
+                std::size_t mask = slotCount - 1;
+                for (std::size_t i = 0, count = slots.size (); i < count; ++i) {
+                    if (slots[i].index != 0) {
+                        std::size_t slot = slots[i].hash & mask;
+                        while (newSlots[slot].index != 0) {
+                            slot = (slot + 1) & mask;
+                        }
+                        newSlots[slot] = slots[i];
+                    }
+                }
+                slots.swap (newSlots);
+            }
+        };
+
+    } // namespace crypto
+} // namespace thekogans
+
+#endif // !defined (__thekogans_crypto_IDHashMap_h)
@@ -0,0 +1,225 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined (__thekogans_crypto_IOUring_h)
+#define __thekogans_crypto_IOUring_h
+
+#if defined (TOOLCHAIN_OS_Linux) && defined (__has_include)
+    #if __has_include (<linux/io_uring.h>)
+        #define THEKOGANS_CRYPTO_HAVE_IO_URING
+    #endif // __has_include (<linux/io_uring.h>)
+#endif // defined (TOOLCHAIN_OS_Linux) && defined (__has_include)
+
+#if defined (THEKOGANS_CRYPTO_HAVE_IO_URING)
+
+#include <cstddef>
+#include <sys/uio.h>
+#include "thekogans/util/Types.h"
+#include "thekogans/crypto/Config.h"
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+namespace thekogans {
+    namespace crypto {
+
+        /// \struct IOUring IOUring.h thekogans/crypto/IOUring.h
+        ///
+        /// \brief
+        /// IOUring is a minimal Linux io_uring wrapper (raw syscalls, no liburing)
+        /// used by \see{FileReader} (read ahead mode) and \see{FileWriter} to keep
+        /// many reads and writes in flight from a single thread. Buffers can be
+        /// registered with the kernel (RegisterBuffers) so that fixed reads and
+        /// writes skip the per request page pinning.
+        ///
+        /// NOTE: io_uring is frequently disabled (seccomp, kernel.io_uring_disabled,
+        /// kernels older than 5.1). Check IsSupported and fall back to blocking I/O.
+        /// IOUring is not thread safe. Use it from one thread.
+
+        struct _LIB_THEKOGANS_CRYPTO_DECL IOUring {
+            /// \struct IOUring::Completion IOUring.h thekogans/crypto/IOUring.h
+            ///
+            /// \brief
+            /// A completed request.
+            struct Completion {
+                /// \brief
+                /// User data passed to PrepareRead/PrepareWrite.
+                util::ui64 userData;
+                /// \brief
+                /// Bytes transferred (>= 0) or -errno.
+                int result;
+
+                /// \brief
+                /// ctor.
+                Completion () :
+                    userData (0),
+                    result (0) {}
+            };
+
+        private:
+            /// \brief
+            /// Ring file descriptor.
+            int fd;
+            /// \brief
+            /// Submission ring mapping.
+            void *sqRing;
+            /// \brief
+            /// Submission ring mapping size.
+            std::size_t sqRingSize;
+            /// \brief
+            /// Completion ring mapping (== sqRing if IORING_FEAT_SINGLE_MMAP).
+            void *cqRing;
+            /// \brief
+            /// Completion ring mapping size.
+            std::size_t cqRingSize;
+            /// \brief
+            /// Submission queue entries.
+            io_uring_sqe *sqes;
+            /// \brief
+            /// Submission queue entries mapping size.
+            std::size_t sqesSize;
+            /// \brief
+            /// Submission ring head (written by the kernel).
+            unsigned *sqHead;
+            /// \brief
+            /// Submission ring tail (written by us).
+            unsigned *sqTail;
+            /// \brief
+            /// Submission ring mask.
+            unsigned sqMask;
+            /// \brief
+            /// Submission ring index array.
+            unsigned *sqArray;
+            /// \brief
+            /// Completion ring head (written by us).
+            unsigned *cqHead;
+            /// \brief
+            /// Completion ring tail (written by the kernel).
+            unsigned *cqTail;
+            /// \brief
+            /// Completion ring mask.
+            unsigned cqMask;
+            /// \brief
+            /// Completion queue entries.
+            io_uring_cqe *cqes;
+            /// \brief
+            /// Number of prepared requests not yet submitted.
+            unsigned pending;
+            /// \brief
+            /// Number of submitted requests not yet completed.
+            std::size_t inFlight;
+
+        public:
+            /// \brief
+            /// ctor. Create a ring.
+            /// \param[in] entries Submission queue depth.
+            explicit IOUring (unsigned entries);
+            /// \brief
+            /// dtor. Close the ring (outstanding requests are waited for by the kernel).
+            ~IOUring ();
+
+            /// \brief
+            /// Return true if io_uring is usable in this process.
+            /// The answer is computed once (by creating a ring).
+            /// \return true == io_uring is usable.
+            static bool IsSupported ();
+
+            /// \brief
+            /// Register buffers for PrepareRead/PrepareWrite's bufferIndex.
+            /// \param[in] iovecs Buffers to register.
+            /// \param[in] count Number of buffers.
+            /// \return true == registered, false == the kernel refused
+            /// (RLIMIT_MEMLOCK), use bufferIndex == -1.
+            bool RegisterBuffers (
+                const struct iovec *iovecs,
+                unsigned count);
+
+            /// \brief
+            /// Return the number of submitted requests not yet completed.
+            /// \return Number of submitted requests not yet completed.
+            inline std::size_t GetInFlight () const {
+                return inFlight;
+            }
+
+            /// \brief
+            /// Queue a read (call Submit or WaitCompletion to start it).
+            /// \param[in] file File descriptor to read from.
+            /// \param[out] buffer Where to put the data.
+            /// \param[in] length Number of bytes to read.
+            /// \param[in] offset File offset to read from.
+            /// \param[in] bufferIndex Registered buffer index (-1 == not registered).
+            /// \param[in] userData Returned in the \see{Completion}.
+            /// \return false == the submission queue is full.
+            bool PrepareRead (
+                int file,
+                void *buffer,
+                std::size_t length,
+                util::ui64 offset,
+                int bufferIndex,
+                util::ui64 userData);
+            /// \brief
+            /// Queue a write (call Submit or WaitCompletion to start it).
+            /// \param[in] file File descriptor to write to.
+            /// \param[in] buffer Data to write.
+            /// \param[in] length Number of bytes to write.
+            /// \param[in] offset File offset to write to.
+            /// \param[in] bufferIndex Registered buffer index (-1 == not registered).
+            /// \param[in] userData Returned in the \see{Completion}.
+            /// \return false == the submission queue is full.
+            bool PrepareWrite (
+                int file,
+                const void *buffer,
+                std::size_t length,
+                util::ui64 offset,
+                int bufferIndex,
+                util::ui64 userData);
+
+            /// \brief
+            /// Submit the prepared requests.
+            void Submit ();
+            /// \brief
+            /// Submit the prepared requests and wait for a completion.
+            /// \return Next \see{Completion}.
+            Completion WaitCompletion ();
+
+            /// \brief
+            /// IOUring is neither copy constructable, nor assignable.
+            THEKOGANS_CRYPTO_DISALLOW_COPY_AND_ASSIGN (IOUring)
+
+        private:
+            /// \brief
+            /// Fill in the next submission queue entry.
+            bool Prepare (
+                util::ui8 opcode,
+                util::ui8 fixedOpcode,
+                int file,
+                const void *buffer,
+                std::size_t length,
+                util::ui64 offset,
+                int bufferIndex,
+                util::ui64 userData);
+            /// \brief
+            /// Release the mappings and the ring descriptor.
+            void Close ();
+        };
+
+    } // namespace crypto
+} // namespace thekogans
+
+#endif // defined (THEKOGANS_CRYPTO_HAVE_IO_URING)
+
+#endif // !defined (__thekogans_crypto_IOUring_h)
@@ -0,0 +1,346 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined (__thekogans_crypto_JournaledKeyRing_h)
+#define __thekogans_crypto_JournaledKeyRing_h
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include "thekogans/util/Types.h"
+#include "thekogans/util/RefCounted.h"
+#include "thekogans/util/Buffer.h"
+#include "thekogans/util/File.h"
+#include "thekogans/util/Mutex.h"
+#include "thekogans/util/Condition.h"
+#include "thekogans/crypto/Config.h"
+#include "thekogans/crypto/ID.h"
+#include "thekogans/crypto/Serializable.h"
+#include "thekogans/crypto/CipherSuite.h"
+#include "thekogans/crypto/Params.h"
+#include "thekogans/crypto/SymmetricKey.h"
+#include "thekogans/crypto/AsymmetricKey.h"
+#include "thekogans/crypto/Cipher.h"
+#include "thekogans/crypto/KeyRing.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        /// \brief
+        /// Journal file layout (all integers are network endian):
+        ///
+        /// +----------------------+
+        /// | ui32 length          |
+        /// +----------------------+
+        /// | record 0             |  \see{Cipher::Encrypt} (op, type, \see{Serializable} | \see{ID},
+        /// +----------------------+  associated data = record sequence number).
+        /// | ...                  |
+        /// +----------------------+
+        ///
+        /// op is one of JournaledKeyRing::OP_ADD/OP_DROP, and type is one
+        /// of \see{LazyKeyRingEntryInfo} entry types. Binding the sequence
+        /// number to every record detects records that were reordered or
+        /// removed from the middle of the journal.
+
+        /// \struct JournaledKeyRing JournaledKeyRing.h thekogans/crypto/JournaledKeyRing.h
+        ///
+        /// \brief
+        /// \see{KeyRing::Save} rewrites the whole ring, so with a large ring
+        /// adding a single key costs O(ring). JournaledKeyRing keeps the ring
+        /// in a base file (written with \see{KeyRing::Save}, and therefore
+        /// readable with \see{KeyRing::Load}) and appends every Add*/Drop* to
+        /// a journal (path + ".journal") as an individually encrypted record.
+        /// Opening a JournaledKeyRing loads the base file and replays the
+        /// journal. Compact folds the journal in to a new base file. It can
+        /// be called directly, from a background thread (CompactAsync), or
+        /// automatically once the journal grows beyond maxJournalRecords.
+        ///
+        /// Ex:
+        ///
+        /// \code{.cpp}
+        /// using namespace thekogans;
+        ///
+        /// crypto::JournaledKeyRing::SharedPtr keyRing (
+        ///     new crypto::JournaledKeyRing (path, masterCipher, cipherSuite, 1000));
+        /// // O(key), not O(ring).
+        /// keyRing->AddCipherKey (key);
+        /// \endcode
+        ///
+        /// NOTE: Only the root ring is journaled. Changes made to the ring
+        /// returned by GetKeyRing (sub rings included) bypass the journal,
+        /// and are persisted by the next Compact. JournaledKeyRing serializes
+        /// it's own mutators and compaction, but readers of GetKeyRing must
+        /// synchronize with the mutators themselves (see \see{ConcurrentKeyRing}).
+
+        struct _LIB_THEKOGANS_CRYPTO_DECL JournaledKeyRing : public virtual util::RefCounted {
+            /// \brief
+            /// Declare \see{RefCounted} pointers.
+            THEKOGANS_UTIL_DECLARE_REF_COUNTED_POINTERS (JournaledKeyRing)
+
+            /// \enum
+            /// Journal record operations.
+            enum {
+                /// \brief
+                /// Add a \see{Serializable} to the ring.
+                OP_ADD,
+                /// \brief
+                /// Drop an \see{ID} from the ring.
+                OP_DROP
+            };
+
+        private:
+            /// \brief
+            /// Base file path.
+            std::string path;
+            /// \brief
+            /// Optional \see{Cipher} used to encrypt the base file and the
+            /// journal records (0 = plaintext).
+            Cipher::SharedPtr cipher;
+            /// \brief
+            /// Compact once the journal holds this many records (0 = never).
+            std::size_t maxJournalRecords;
+            /// \brief
+            /// In memory ring.
+            KeyRing::SharedPtr keyRing;
+            /// \brief
+            /// Open journal.
+            std::unique_ptr<util::SimpleFile> journal;
+            /// \brief
+            /// Next journal record sequence number.
+            util::ui64 sequence;
+            /// \brief
+            /// Synchronizes the ring, the journal and sequence.
+            util::Mutex mutex;
+            /// \brief
+            /// Serializes compactions.
+            util::Mutex compactionMutex;
+            /// \struct JournaledKeyRing::Compactor JournaledKeyRing.h thekogans/crypto/JournaledKeyRing.h
+            ///
+            /// \brief
+            /// Background compaction thread.
+            struct Compactor;
+            /// \brief
+            /// Last background compaction (0 = none yet).
+            std::unique_ptr<Compactor> compactor;
+            /// \brief
+            /// true = a background compaction is in progress.
+            bool compacting;
+            /// \brief
+            /// Last background compaction error (empty = success).
+            std::string compactionError;
+            /// \brief
+            /// Signalled when a background compaction finishes.
+            util::Condition compactionCondition;
+
+        public:
+            /// \brief
+            /// ctor. Load the base file (if any) and replay the journal.
+            /// \param[in] path_ Base file path.
+            /// \param[in] cipher_ Optional \see{Cipher} used to encrypt the
+            /// base file and the journal records.
+            /// \param[in] cipherSuite \see{CipherSuite} of the ring to create
+            /// if the base file does not exist.
+            /// \param[in] maxJournalRecords_ Compact (in the background) once
+            /// the journal holds this many records (0 = never).
+            JournaledKeyRing (
+                const std::string &path_,
+                Cipher::SharedPtr cipher_ = Cipher::SharedPtr (),
+                const CipherSuite &cipherSuite = CipherSuite::Strongest,
+                std::size_t maxJournalRecords_ = 0);
+            /// \brief
+            /// dtor. Wait for the background compaction (if any) to finish.
+            virtual ~JournaledKeyRing ();
+
+            /// \brief
+            /// Return the in memory ring.
+            /// \return In memory ring.
+            inline KeyRing &GetKeyRing () const {
+                return *keyRing;
+            }
+            /// \brief
+            /// Return the number of records in the journal.
+            /// \return Number of records in the journal.
+            util::ui64 GetJournalRecordCount ();
+
+            /// \brief
+            /// Add a key exchange \see{Params} to the ring.
+            /// \param[in] params Key exchange \see{Params} to add.
+            /// \return true = added, false = already in the ring.
+            bool AddKeyExchangeParams (Params::SharedPtr params);
+            /// \brief
+            /// Drop the key exchange \see{Params} with the given \see{ID}.
+            /// \param[in] paramsId \see{ID} of key exchange \see{Params} to drop.
+            /// \return true = dropped, false = not found.
+            bool DropKeyExchangeParams (const ID &paramsId);
+            /// \brief
+            /// Add a key exchange \see{AsymmetricKey} to the ring.
+            /// \param[in] key Key exchange \see{AsymmetricKey} to add.
+            /// \return true = added, false = already in the ring.
+            bool AddKeyExchangeKey (AsymmetricKey::SharedPtr key);
+            /// \brief
+            /// Drop the key exchange \see{AsymmetricKey} with the given \see{ID}.
+            /// \param[in] keyId \see{ID} of key exchange \see{AsymmetricKey} to drop.
+            /// \return true = dropped, false = not found.
+            bool DropKeyExchangeKey (const ID &keyId);
+            /// \brief
+            /// Add an \see{Authenticator} \see{Params} to the ring.
+            /// \param[in] params \see{Authenticator} \see{Params} to add.
+            /// \return true = added, false = already in the ring.
+            bool AddAuthenticatorParams (Params::SharedPtr params);
+            /// \brief
+            /// Drop the \see{Authenticator} \see{Params} with the given \see{ID}.
+            /// \param[in] paramsId \see{ID} of \see{Authenticator} \see{Params} to drop.
+            /// \return true = dropped, false = not found.
+            bool DropAuthenticatorParams (const ID &paramsId);
+            /// \brief
+            /// Add an \see{Authenticator} \see{AsymmetricKey} to the ring.
+            /// \param[in] key \see{Authenticator} \see{AsymmetricKey} to add.
+            /// \return true = added, false = already in the ring.
+            bool AddAuthenticatorKey (AsymmetricKey::SharedPtr key);
+            /// \brief
+            /// Drop the \see{Authenticator} \see{AsymmetricKey} with the given \see{ID}.
+            /// \param[in] keyId \see{ID} of \see{Authenticator} \see{AsymmetricKey} to drop.
+            /// \return true = dropped, false = not found.
+            bool DropAuthenticatorKey (const ID &keyId);
+            /// \brief
+            /// Add a \see{Cipher} \see{SymmetricKey} to the ring.
+            /// \param[in] key \see{Cipher} \see{SymmetricKey} to add.
+            /// \return true = added, false = already in the ring.
+            bool AddCipherKey (SymmetricKey::SharedPtr key);
+            /// \brief
+            /// Drop the \see{Cipher} \see{SymmetricKey} with the given \see{ID}.
+            /// \param[in] keyId \see{ID} of \see{Cipher} \see{SymmetricKey} to drop.
+            /// \return true = dropped, false = not found.
+            bool DropCipherKey (const ID &keyId);
+            /// \brief
+            /// Add a \see{MAC} \see{SymmetricKey} to the ring.
+            /// \param[in] key \see{MAC} \see{SymmetricKey} to add.
+            /// \return true = added, false = already in the ring.
+            bool AddMACKey (SymmetricKey::SharedPtr key);
+            /// \brief
+            /// Drop the \see{MAC} \see{SymmetricKey} with the given \see{ID}.
+            /// \param[in] keyId \see{ID} of \see{MAC} \see{SymmetricKey} to drop.
+            /// \return true = dropped, false = not found.
+            bool DropMACKey (const ID &keyId);
+            /// \brief
+            /// Add user data to the ring.
+            /// \param[in] userData \see{Serializable} to add.
+            /// \return true = added, false = already in the ring.
+            bool AddUserData (Serializable::SharedPtr userData);
+            /// \brief
+            /// Drop the user data with the given \see{ID}.
+            /// \param[in] id \see{ID} of user data to drop.
+            /// \return true = dropped, false = not found.
+            bool DropUserData (const ID &id);
+
+            /// \brief
+            /// Fold the journal in to a new base file. Mutators are only
+            /// blocked while the ring is serialized (and encrypted); the
+            /// base file is written while new records go to a fresh journal.
+            void Compact ();
+            /// \brief
+            /// Compact on a background thread.
+            /// \return true = compaction started, false = a compaction
+            /// is already in progress.
+            bool CompactAsync ();
+            /// \brief
+            /// Wait for the background compaction (if any) to finish.
+            /// \return Background compaction error (empty = success).
+            std::string WaitForCompaction ();
+
+        private:
+            /// \brief
+            /// Apply the given record to the ring.
+            /// \param[in] record Decrypted journal record.
+            void Apply (util::Buffer &record);
+            /// \brief
+            /// Replay the journal at the given path.
+            /// \param[in] journalPath Journal to replay.
+            /// \param[out] torn true = the journal ends with a partially
+            /// written record.
+            /// \return Number of records replayed.
+            util::ui64 Replay (
+                const std::string &journalPath,
+                bool &torn);
+            /// \brief
+            /// Append a record to the journal. Must be called with mutex held.
+            /// \param[in] record Plaintext record.
+            void Append (const util::Buffer &record);
+            /// \brief
+            /// Start the background compaction if the journal has grown past
+            /// maxJournalRecords. Must be called with mutex held.
+            void CheckJournalSize ();
+            /// \brief
+            /// Start the background compaction. Must be called with mutex held.
+            /// \return true = compaction started, false = a compaction
+            /// is already in progress.
+            bool StartCompaction ();
+            /// \brief
+            /// Serialize (and encrypt) the ring. Must be called with mutex held.
+            /// \return Base file contents.
+            util::Buffer SerializeKeyRing () const;
+            /// \brief
+            /// Atomically replace the base file.
+            /// \param[in] buffer Base file contents.
+            void WriteBaseFile (const util::Buffer &buffer) const;
+            /// \brief
+            /// Open the journal for appending.
+            /// \param[in] truncate true = start a fresh journal.
+            void OpenJournal (bool truncate);
+
+            /// \brief
+            /// Add the given entry to the ring and journal it.
+            /// \param[in] type \see{LazyKeyRingEntryInfo} entry type.
+            /// \param[in] serializable Entry to add.
+            /// \return true = added, false = already in the ring.
+            bool Add (
+                util::ui8 type,
+                Serializable::SharedPtr serializable);
+            /// \brief
+            /// Drop the given entry from the ring and journal it.
+            /// \param[in] type \see{LazyKeyRingEntryInfo} entry type.
+            /// \param[in] id \see{ID} of entry to drop.
+            /// \return true = dropped, false = not found.
+            bool Drop (
+                util::ui8 type,
+                const ID &id);
+            /// \brief
+            /// Add the given entry to the ring (no journaling).
+            /// \param[in] type \see{LazyKeyRingEntryInfo} entry type.
+            /// \param[in] serializable Entry to add.
+            /// \return true = added, false = already in the ring.
+            bool AddToKeyRing (
+                util::ui8 type,
+                Serializable::SharedPtr serializable);
+            /// \brief
+            /// Drop the given entry from the ring (no journaling).
+            /// \param[in] type \see{LazyKeyRingEntryInfo} entry type.
+            /// \param[in] id \see{ID} of entry to drop.
+            /// \return true = dropped, false = not found.
+            bool DropFromKeyRing (
+                util::ui8 type,
+                const ID &id);
+
+            /// \brief
+            /// JournaledKeyRing is neither copy constructable, nor assignable.
+            THEKOGANS_CRYPTO_DISALLOW_COPY_AND_ASSIGN (JournaledKeyRing)
+        };
+
+    } // namespace crypto
+} // namespace thekogans
+
+#endif // !defined (__thekogans_crypto_JournaledKeyRing_h)
@@ -0,0 +1,286 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined (__thekogans_crypto_KeyEnvelope_h)
+#define __thekogans_crypto_KeyEnvelope_h
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "thekogans/util/Types.h"
+#include "thekogans/util/Serializer.h"
+#include "thekogans/crypto/Config.h"
+#include "thekogans/crypto/ID.h"
+#include "thekogans/crypto/SymmetricKey.h"
+#include "thekogans/crypto/AsymmetricKey.h"
+#include "thekogans/crypto/CipherSuite.h"
+#include "thekogans/crypto/KeyRing.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        /// \struct KeyEnvelope KeyEnvelope.h thekogans/crypto/KeyEnvelope.h
+        ///
+        /// \brief
+        /// KeyEnvelope implements envelope encryption. Bulk data is encrypted
+        /// with a random data encryption key (DEK) that is never stored in the
+        /// clear. Instead, the envelope holds one copy of the DEK wrapped by each
+        /// key encryption key (KEK) that should be able to recover it:
+        ///
+        /// - \see{SymmetricKey}: the DEK is encrypted with \see{Cipher} (associated
+        ///   data = KEK id).
+        /// - \see{RSA} \see{AsymmetricKey}: the DEK is encrypted with RSA-OAEP.
+        /// - \see{X25519AsymmetricKey}: the DEK is encrypted with \see{Cipher} using a
+        ///   key derived (\see{HKDF}) from an ephemeral \see{X25519} exchange with the
+        ///   KEK (ECIES). The wrapped key starts with the ephemeral public key.
+        ///
+        /// Because the data never depends on the KEKs, rotating (or revoking) a KEK
+        /// only rewrites the envelope (see Rotate and Remove) and is independent of
+        /// the size of the data it protects. The serialized envelope has the
+        /// following structure:
+        ///
+        /// +--------------+-------+-----------------+-----+-----------------+
+        /// | cipher suite | count | wrapped key 1   | ... | wrapped key n   |
+        /// +--------------+-------+-----------------+-----+-----------------+
+        /// |     ...      |   2   |
+        ///
+        /// where every wrapped key is:
+        ///
+        /// +------+--------+--------+-------------+
+        /// | type | KEK id | length | wrapped DEK |
+        /// +------+--------+--------+-------------+
+        /// |  1   |   32   |   2    |   length    |
+        struct _LIB_THEKOGANS_CRYPTO_DECL KeyEnvelope {
+            /// \enum
+            /// KEK types.
+            enum {
+                /// \brief
+                /// \see{SymmetricKey} KEK.
+                TYPE_SYMMETRIC = 1,
+                /// \brief
+                /// \see{RSA} KEK.
+                TYPE_RSA = 2,
+                /// \brief
+                /// \see{X25519} KEK.
+                TYPE_X25519 = 3
+            };
+
+            /// \struct KeyEnvelope::WrappedKey KeyEnvelope.h thekogans/crypto/KeyEnvelope.h
+            ///
+            /// \brief
+            /// One copy of the DEK wrapped by a KEK.
+            struct _LIB_THEKOGANS_CRYPTO_DECL WrappedKey {
+                /// \brief
+                /// KEK type (TYPE_SYMMETRIC, TYPE_RSA or TYPE_X25519).
+                util::ui8 type;
+                /// \brief
+                /// KEK id.
+                ID kekId;
+                /// \brief
+                /// Wrapped DEK.
+                std::vector<util::ui8> wrappedKey;
+
+                /// \brief
+                /// ctor.
+                /// \param[in] type_ KEK type.
+                /// \param[in] kekId_ KEK id.
+                WrappedKey (
+                    util::ui8 type_ = 0,
+                    const ID &kekId_ = ID::Empty) :
+                    type (type_),
+                    kekId (kekId_) {}
+
+                /// \brief
+                /// Return the serialized wrapped key size.
+                /// \return Serialized wrapped key size.
+                inline std::size_t Size () const {
+                    return
+                        util::UI8_SIZE +
+                        ID::SIZE +
+                        util::UI16_SIZE +
+                        wrappedKey.size ();
+                }
+            };
+
+            /// \brief
+            /// \see{CipherSuite} used to wrap the DEK (and to encrypt the data).
+            CipherSuite cipherSuite;
+            /// \brief
+            /// Wrapped copies of the DEK (one per KEK).
+            std::vector<WrappedKey> wrappedKeys;
+
+            /// \brief
+            /// ctor.
+            /// \param[in] cipherSuite_ \see{CipherSuite} used to wrap the DEK.
+            explicit KeyEnvelope (const CipherSuite &cipherSuite_ = CipherSuite::Strongest) :
+                cipherSuite (cipherSuite_) {}
+
+            /// \brief
+            /// Create a random DEK suitable for cipherSuite.
+            /// \return Random DEK.
+            SymmetricKey::SharedPtr CreateDataKey () const;
+
+            /// \brief
+            /// Wrap the DEK with the given symmetric KEK. If the KEK already
+            /// wraps a copy, it's replaced.
+            /// \param[in] dek DEK to wrap.
+            /// \param[in] kek \see{SymmetricKey} KEK.
+            void Wrap (
+                SymmetricKey::SharedPtr dek,
+                SymmetricKey::SharedPtr kek);
+            /// \brief
+            /// Wrap the DEK with the given asymmetric (\see{RSA} or \see{X25519})
+            /// KEK. Only the public part is used, but the id recorded is kek's
+            /// so pass the key as it appears in the \see{KeyRing} that will unwrap
+            /// it. If the KEK already wraps a copy, it's replaced.
+            /// \param[in] dek DEK to wrap.
+            /// \param[in] kek \see{AsymmetricKey} KEK.
+            void Wrap (
+                SymmetricKey::SharedPtr dek,
+                AsymmetricKey::SharedPtr kek);
+
+            /// \brief
+            /// Unwrap the DEK using the KEKs found in the given \see{KeyRing}
+            /// (cipher keys for symmetric KEKs, private key exchange keys for
+            /// asymmetric ones). A KEK that fails to unwrap it's copy (a stale
+            /// key with the same id in a subring, a damaged copy...) is not
+            /// fatal: every key in the ring (and it's subrings) with a matching
+            /// id is tried, and then the remaining copies. The exception is only
+            /// thrown when all of them fail.
+            /// \param[in] keyRing \see{KeyRing} holding (at least one of) the KEKs.
+            /// \return DEK.
+            SymmetricKey::SharedPtr Unwrap (const KeyRing &keyRing) const;
+            /// \brief
+            /// Unwrap the DEK using the given symmetric KEK.
+            /// \param[in] kek \see{SymmetricKey} KEK.
+            /// \return DEK.
+            SymmetricKey::SharedPtr Unwrap (SymmetricKey::SharedPtr kek) const;
+            /// \brief
+            /// Unwrap the DEK using the given private asymmetric KEK.
+            /// \param[in] kek Private \see{AsymmetricKey} KEK.
+            /// \return DEK.
+            SymmetricKey::SharedPtr Unwrap (AsymmetricKey::SharedPtr kek) const;
+
+            /// \brief
+            /// Return true if the given KEK wraps a copy of the DEK.
+            /// \param[in] kekId KEK id.
+            /// \return true == kekId wraps a copy of the DEK.
+            bool Contains (const ID &kekId) const;
+            /// \brief
+            /// Remove the copy of the DEK wrapped by the given KEK (revocation).
+            /// \param[in] kekId KEK id.
+            /// \return true == removed, false == kekId was not found.
+            bool Remove (const ID &kekId);
+
+            /// \brief
+            /// Replace oldKekId's copy of the DEK with one wrapped by newKek.
+            /// The DEK is unwrapped with the KEKs in keyRing and never changes,
+            /// so the data it protects is left alone.
+            /// \param[in] keyRing \see{KeyRing} holding (at least one of) the current KEKs.
+            /// \param[in] oldKekId KEK to retire.
+            /// \param[in] newKek \see{SymmetricKey} KEK to replace it with.
+            void Rotate (
+                const KeyRing &keyRing,
+                const ID &oldKekId,
+                SymmetricKey::SharedPtr newKek);
+            /// \brief
+            /// Replace oldKekId's copy of the DEK with one wrapped by newKek.
+            /// \param[in] keyRing \see{KeyRing} holding (at least one of) the current KEKs.
+            /// \param[in] oldKekId KEK to retire.
+            /// \param[in] newKek \see{AsymmetricKey} KEK to replace it with.
+            void Rotate (
+                const KeyRing &keyRing,
+                const ID &oldKekId,
+                AsymmetricKey::SharedPtr newKek);
+
+            /// \brief
+            /// Return the serialized envelope size.
+            /// \return Serialized envelope size.
+            std::size_t Size () const;
+
+        private:
+            /// \brief
+            /// Return the index of kekId's wrapped key.
+            /// \param[in] kekId KEK id.
+            /// \return Index of kekId's wrapped key (wrappedKeys.size () == not found).
+            std::size_t Find (const ID &kekId) const;
+            /// \brief
+            /// Add (or replace) a wrapped key.
+            /// \param[in] wrappedKey Wrapped key to add.
+            void Add (const WrappedKey &wrappedKey);
+            /// \brief
+            /// Unwrap the given wrapped key.
+            /// \param[in] wrappedKey Wrapped key to unwrap.
+            /// \param[in] symmetricKek Symmetric KEK (if type == TYPE_SYMMETRIC).
+            /// \param[in] asymmetricKek Private asymmetric KEK (otherwise).
+            /// \return DEK.
+            SymmetricKey::SharedPtr Unwrap (
+                const WrappedKey &wrappedKey,
+                SymmetricKey::SharedPtr symmetricKek,
+                AsymmetricKey::SharedPtr asymmetricKek) const;
+            /// \brief
+            /// Unwrap the given wrapped key, reporting failure instead of throwing.
+            /// \param[in] wrappedKey Wrapped key to unwrap.
+            /// \param[in] symmetricKek Symmetric KEK (if type == TYPE_SYMMETRIC).
+            /// \param[in] asymmetricKek Private asymmetric KEK (otherwise).
+            /// \param[out] error Why the key could not be unwrapped.
+            /// \return DEK (SymmetricKey::SharedPtr () == failed, see error).
+            SymmetricKey::SharedPtr TryUnwrap (
+                const WrappedKey &wrappedKey,
+                SymmetricKey::SharedPtr symmetricKek,
+                AsymmetricKey::SharedPtr asymmetricKek,
+                std::string &error) const;
+        };
+
+        /// \brief
+        /// Serialize a KeyEnvelope::WrappedKey.
+        /// \param[in] serializer Where to write the given wrapped key.
+        /// \param[in] wrappedKey KeyEnvelope::WrappedKey to serialize.
+        /// \return serializer.
+        _LIB_THEKOGANS_CRYPTO_DECL util::Serializer & _LIB_THEKOGANS_CRYPTO_API operator << (
+            util::Serializer &serializer,
+            const KeyEnvelope::WrappedKey &wrappedKey);
+        /// \brief
+        /// Extract a KeyEnvelope::WrappedKey.
+        /// \param[in] serializer Where to read the wrapped key from.
+        /// \param[out] wrappedKey Where to place the extracted wrapped key.
+        /// \return serializer.
+        _LIB_THEKOGANS_CRYPTO_DECL util::Serializer & _LIB_THEKOGANS_CRYPTO_API operator >> (
+            util::Serializer &serializer,
+            KeyEnvelope::WrappedKey &wrappedKey);
+
+        /// \brief
+        /// Serialize a KeyEnvelope.
+        /// \param[in] serializer Where to write the given envelope.
+        /// \param[in] envelope KeyEnvelope to serialize.
+        /// \return serializer.
+        _LIB_THEKOGANS_CRYPTO_DECL util::Serializer & _LIB_THEKOGANS_CRYPTO_API operator << (
+            util::Serializer &serializer,
+            const KeyEnvelope &envelope);
+        /// \brief
+        /// Extract a KeyEnvelope.
+        /// \param[in] serializer Where to read the envelope from.
+        /// \param[out] envelope Where to place the extracted envelope.
+        /// \return serializer.
+        _LIB_THEKOGANS_CRYPTO_DECL util::Serializer & _LIB_THEKOGANS_CRYPTO_API operator >> (
+            util::Serializer &serializer,
+            KeyEnvelope &envelope);
+
+    } // namespace crypto
+} // namespace thekogans
+
+#endif // !defined (__thekogans_crypto_KeyEnvelope_h)
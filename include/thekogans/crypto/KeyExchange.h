@@ -19,13 +19,18 @@
 #define __thekogans_crypto_KeyExchange_h
 
 #include <cstddef>
+#include <vector>
 #include "thekogans/util/RefCounted.h"
 #include "thekogans/util/Serializable.h"
+#include "thekogans/util/Buffer.h"
 #include "thekogans/crypto/Config.h"
 #include "thekogans/crypto/ID.h"
 #include "thekogans/crypto/SymmetricKey.h"
 #include "thekogans/crypto/AsymmetricKey.h"
 #include "thekogans/crypto/MessageDigest.h"
+#include "thekogans/crypto/ValidatedParamsCache.h"
+#include "thekogans/crypto/HKDF.h"
+#include "thekogans/crypto/Stats.h"
 
 namespace thekogans {
     namespace crypto {
@@ -86,10 +91,14 @@ namespace thekogans {
                 /// Given the peer's public \see{AsymmetricKey}, verify parameters signature.
                 /// \param[in] publicKey Peer's public key used to verify parameters signature.
                 /// \param[in] messageDigest Message digest object.
+                /// \param[in] validatedParamsCache Optional \see{ValidatedParamsCache}
+                /// consulted before (and updated after) verifying the signature.
                 /// \return true == signature is valid, false == signature is invalid.
                 virtual bool ValidateSignature (
                     AsymmetricKey::SharedPtr /*publicKey*/,
-                    MessageDigest::SharedPtr /*messageDigest*/) = 0;
+                    MessageDigest::SharedPtr /*messageDigest*/,
+                    ValidatedParamsCache::SharedPtr /*validatedParamsCache*/ =
+                        ValidatedParamsCache::SharedPtr ()) = 0;
 
             protected:
                 // util::Serializable
@@ -147,10 +156,186 @@ namespace thekogans {
                 virtual void Write (util::JSON::Object &object) const;
             };
 
+            /// \struct KeyExchange::CompactParams KeyExchange.h thekogans/crypto/KeyExchange.h
+            ///
+            /// \brief
+            /// Base for the compact (handshake) encodings of \see{Params}. Unlike the
+            /// \see{util::Serializable} form, a compact encoding has a fixed field order,
+            /// carries no type names or per-object headers, and is parsed in place:
+            /// a CompactParams is a view holding pointers in to the receive buffer,
+            /// so that buffer must outlive it. The encoding ends with a signature
+            /// trailer covering every byte that precedes it:
+            ///
+            /// ui16 signatureLength (0 == unsigned)
+            /// ui8 signatureMessageDigestNameLength
+            /// signatureMessageDigestName
+            /// signatureKeyId (ID::SIZE bytes)
+            /// signature
+            ///
+            /// An unsigned trailer is just a zero signatureLength. All integers
+            /// are in network byte order.
+            struct _LIB_THEKOGANS_CRYPTO_DECL CompactParams {
+                /// \enum
+                /// Compact encoding version.
+                enum {
+                    VERSION = 1
+                };
+
+                /// \brief
+                /// KeyExchange id (ID::SIZE bytes).
+                const util::ui8 *id;
+                /// \brief
+                /// Bytes covered by the signature.
+                const util::ui8 *signedData;
+                /// \brief
+                /// signedData length.
+                std::size_t signedDataLength;
+                /// \brief
+                /// OpenSSL message digest used for parameter hashing.
+                const char *signatureMessageDigestName;
+                /// \brief
+                /// signatureMessageDigestName length.
+                std::size_t signatureMessageDigestNameLength;
+                /// \brief
+                /// Signature \see{AsymmetricKey} id (ID::SIZE bytes).
+                const util::ui8 *signatureKeyId;
+                /// \brief
+                /// Signature over signedData.
+                const util::ui8 *signature;
+                /// \brief
+                /// signature length (0 == unsigned).
+                std::size_t signatureLength;
+
+                /// \brief
+                /// ctor.
+                CompactParams () :
+                    id (0),
+                    signedData (0),
+                    signedDataLength (0),
+                    signatureMessageDigestName (0),
+                    signatureMessageDigestNameLength (0),
+                    signatureKeyId (0),
+                    signature (0),
+                    signatureLength (0) {}
+                /// \brief
+                /// dtor.
+                virtual ~CompactParams () {}
+
+                /// \brief
+                /// Return true if the parameters carry a signature.
+                /// \return true == signed, false == unsigned.
+                inline bool IsSigned () const {
+                    return signatureLength > 0;
+                }
+
+                /// \brief
+                /// Given the peer's public \see{AsymmetricKey}, verify parameters signature.
+                /// \param[in] publicKey Peer's public key used to verify parameters signature.
+                /// \param[in] messageDigest Message digest object.
+                /// \param[in] validatedParamsCache Optional \see{ValidatedParamsCache}
+                /// consulted before (and updated after) verifying the signature.
+                /// \return true == signature is valid, false == signature is invalid.
+                bool ValidateSignature (
+                    AsymmetricKey::SharedPtr publicKey,
+                    MessageDigest::SharedPtr messageDigest,
+                    ValidatedParamsCache::SharedPtr validatedParamsCache =
+                        ValidatedParamsCache::SharedPtr ()) const;
+
+            protected:
+                /// \struct KeyExchange::CompactParams::Cursor KeyExchange.h thekogans/crypto/KeyExchange.h
+                ///
+                /// \brief
+                /// Bounds checked, non-allocating reader over the receive buffer.
+                struct Cursor {
+                    /// \brief
+                    /// Next byte to read.
+                    const util::ui8 *ptr;
+                    /// \brief
+                    /// One past the last byte.
+                    const util::ui8 *end;
+
+                    /// \brief
+                    /// ctor.
+                    /// \param[in] buffer Buffer to read.
+                    /// \param[in] length Buffer length.
+                    Cursor (
+                        const void *buffer,
+                        std::size_t length) :
+                        ptr ((const util::ui8 *)buffer),
+                        end ((const util::ui8 *)buffer + length) {}
+
+                    /// \brief
+                    /// Return the number of bytes left to read.
+                    /// \return Number of bytes left to read.
+                    inline std::size_t GetAvailable () const {
+                        return end - ptr;
+                    }
+
+                    /// \brief
+                    /// Point data at the next length bytes and skip over them.
+                    /// \param[in] length Number of bytes.
+                    /// \param[out] data Where to put the pointer.
+                    /// \return true == success, false == buffer too short.
+                    inline bool Get (
+                            std::size_t length,
+                            const util::ui8 *&data) {
+                        if (GetAvailable () >= length) {
+                            data = ptr;
+                            ptr += length;
+                            return true;
+                        }
+                        return false;
+                    }
+                    /// \brief
+                    /// Read a network order integer.
+                    /// \param[out] value Where to put the value.
+                    /// \return true == success, false == buffer too short.
+                    template<typename T>
+                    bool Get (T &value) {
+                        if (GetAvailable () >= sizeof (T)) {
+                            value = 0;
+                            for (std::size_t i = 0; i < sizeof (T); ++i) {
+                                value = (T)((value << 8) | *ptr++);
+                            }
+                            return true;
+                        }
+                        return false;
+                    }
+                };
+
+                /// \brief
+                /// Parse the signature trailer. The signature covers [begin, cursor.ptr).
+                /// The trailer must consume the rest of the buffer.
+                /// \param[in] begin Start of the encoding.
+                /// \param[in, out] cursor Positioned at the trailer.
+                /// \return true == success, false == malformed trailer.
+                bool ParseSignature (
+                    const util::ui8 *begin,
+                    Cursor &cursor);
+
+            public:
+                /// \brief
+                /// Given the body of a compact encoding, append the signature
+                /// trailer. If privateKey or messageDigest are 0, the trailer marks
+                /// the parameters as unsigned.
+                /// \param[in] body Compact encoding body.
+                /// \param[in] privateKey Optional my private \see{AsymmetricKey} used to
+                /// create a signature over the body.
+                /// \param[in] messageDigest Optional message digest used to hash the body.
+                /// \return Complete compact encoding.
+                static util::Buffer AppendSignature (
+                    const util::Buffer &body,
+                    AsymmetricKey::SharedPtr privateKey,
+                    MessageDigest::SharedPtr messageDigest);
+            };
+
         protected:
             /// \brief
             /// KeyExchange id (see \see{KeyRing::AddKeyExchange}).
             ID id;
+            /// \brief
+            /// Key exchange stats (one use per \see{DeriveSharedSymmetricKey}).
+            mutable Stats stats;
 
         public:
             /// \brief
@@ -165,6 +350,12 @@ namespace thekogans {
             inline const ID &GetId () const {
                 return id;
             }
+            /// \brief
+            /// Return the reference to stats.
+            /// \return Reference to stats.
+            inline Stats &GetStats () const {
+                return stats;
+            }
 
             /// \brief
             /// Get the parameters to send to the key exchange peer.
@@ -182,6 +373,19 @@ namespace thekogans {
             /// \param[in] params Peer's parameters.
             /// \return Shared \see{SymmetricKey}.
             virtual SymmetricKey::SharedPtr DeriveSharedSymmetricKey (Params::SharedPtr /*params*/) const = 0;
+            /// \brief
+            /// Derive a whole key schedule from one exchange. The shared
+            /// \see{SymmetricKey} (\see{DeriveSharedSymmetricKey}) is run
+            /// through \see{HKDF} extract once, and the outputs are expanded
+            /// from the resulting PRK. Both peers must ask for the same outputs.
+            /// \param[in] params Peer's parameters.
+            /// \param[in] outputs Keys to derive (info (label), length, id...).
+            /// \param[in] md OpenSSL message digest to use for \see{HKDF}.
+            /// \return Shared \see{SymmetricKey}s (keys[i] corresponds to outputs[i]).
+            std::vector<SymmetricKey::SharedPtr> DeriveSharedSymmetricKeys (
+                Params::SharedPtr params,
+                const std::vector<HKDF::Output> &outputs,
+                const EVP_MD *md = THEKOGANS_CRYPTO_DEFAULT_MD) const;
 
             /// \brief
             /// KeyExchange is neither copy constructable, nor assignable.
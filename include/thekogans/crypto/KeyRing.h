@@ -21,19 +21,25 @@
 #include <cstddef>
 #include <string>
 #include <list>
+#include <vector>
 #include <map>
 #include "thekogans/util/Types.h"
 #include "thekogans/crypto/Config.h"
 #include "thekogans/crypto/ID.h"
+#include "thekogans/crypto/IDHashMap.h"
+#include "thekogans/crypto/IDCache.h"
+#include "thekogans/crypto/ValidatedParamsCache.h"
 #include "thekogans/crypto/Serializable.h"
 #include "thekogans/crypto/CipherSuite.h"
 #include "thekogans/crypto/Params.h"
 #include "thekogans/crypto/SymmetricKey.h"
+#include "thekogans/crypto/CompactKeyStore.h"
 #include "thekogans/crypto/AsymmetricKey.h"
 #include "thekogans/crypto/KeyExchange.h"
 #include "thekogans/crypto/RSAKeyExchange.h"
 #include "thekogans/crypto/Authenticator.h"
 #include "thekogans/crypto/Cipher.h"
+#include "thekogans/crypto/CipherPool.h"
 #include "thekogans/crypto/MAC.h"
 
 namespace thekogans {
@@ -54,6 +60,21 @@ namespace thekogans {
         /// destroy the KeyRing without calling KeyRing::Save. In the later case, create a KeyRing, use
         /// it to generate permanent encryption keys, then call KeyRing::Save. Later call KeyRing::Load and
         /// use it to decrypt the data at rest. See encryptfile and decryptfile examples.
+        ///
+        /// The root of a key ring tree keeps an index of every \see{ID} in the tree
+        /// (mapping it to the ring that owns it), so that recursive lookups and drops
+        /// by \see{ID} are O(1) no matter how many sub rings there are (and a miss
+        /// costs a single hash probe instead of a full traversal). The index is kept
+        /// up to date by the Add* and Drop* methods of every ring in the tree (sub
+        /// rings know their parent). Lookups using an EqualityTest still walk the tree.
+        /// For frequent lookups by name, key type or any other attribute, register an
+        /// attribute index (AddAttributeIndex) and use the AttributeQuery overloads.
+        /// NOTE: A ring can only be a sub ring of one parent.
+
+        /// \brief
+        /// Forward declaration of the streaming XML/JSON reader/writer
+        /// (see \see{KeyRing::LoadXML} and \see{KeyRing::LoadJSON}).
+        struct KeyRingTextStream;
 
         struct _LIB_THEKOGANS_CRYPTO_DECL KeyRing : public Serializable {
             /// \brief
@@ -61,72 +82,225 @@ namespace thekogans {
             THEKOGANS_CRYPTO_DECLARE_SERIALIZABLE (KeyRing)
 
         private:
+            /// \brief
+            /// \see{KeyRingTextStream} reads and writes the maps directly.
+            friend struct KeyRingTextStream;
+
             /// \brief
             /// \see{CipherSuite} associated with this key ring.
             CipherSuite cipherSuite;
             /// \brief
-            /// Convenient typedef for std::map<ID, Params::SharedPtr>.
-            typedef std::map<ID, Params::SharedPtr> ParamsMap;
+            /// Convenient typedef for IDHashMap<Params::SharedPtr>.
+            typedef IDHashMap<Params::SharedPtr> ParamsMap;
             /// \brief
-            /// \see{KeyExchange} \see{Params} map.
-            ParamsMap keyExchangeParamsMap;
+            /// Convenient typedef for IDHashMap<AsymmetricKey::SharedPtr>.
+            typedef IDHashMap<AsymmetricKey::SharedPtr> AsymmetricKeyMap;
+            /// \struct KeyRing::SharedEntries KeyRing.h thekogans/crypto/KeyRing.h
+            ///
             /// \brief
-            /// Convenient typedef for std::map<ID, AsymmetricKeyMap::SharedPtr>.
-            typedef std::map<ID, AsymmetricKey::SharedPtr> AsymmetricKeyMap;
+            /// The (immutable) \see{KeyExchange} and \see{Authenticator} \see{Params}
+            /// and \see{AsymmetricKey}s. Rings created with CreateFromTemplate hold the
+            /// template's SharedEntries (copy on write, see UnshareEntries).
+            struct SharedEntries : public virtual util::RefCounted {
+                /// \brief
+                /// Declare \see{RefCounted} pointers.
+                THEKOGANS_UTIL_DECLARE_REF_COUNTED_POINTERS (SharedEntries)
+
+                /// \brief
+                /// Id of the ring that created these entries (the one that
+                /// serializes them, the others serialize a reference).
+                ID ownerId;
+                /// \brief
+                /// true == (possibly) held by more than one ring.
+                /// Must be copied before being modified.
+                bool shared;
+                /// \brief
+                /// \see{KeyExchange} \see{Params} map.
+                ParamsMap keyExchangeParamsMap;
+                /// \brief
+                /// \see{KeyExchange} \see{AsymmetricKey} map.
+                AsymmetricKeyMap keyExchangeKeyMap;
+                /// \brief
+                /// \see{Authenticator} \see{Params} map.
+                ParamsMap authenticatorParamsMap;
+                /// \brief
+                /// \see{Authenticator} \see{AsymmetricKey} map.
+                AsymmetricKeyMap authenticatorKeyMap;
+
+                /// \brief
+                /// ctor.
+                /// \param[in] ownerId_ Id of the ring creating the entries.
+                explicit SharedEntries (const ID &ownerId_) :
+                    ownerId (ownerId_),
+                    shared (false) {}
+            };
             /// \brief
-            /// \see{KeyExchange} \see{AsymmetricKey} map.
-            AsymmetricKeyMap keyExchangeKeyMap;
+            /// \see{KeyExchange} and \see{Authenticator} \see{Params} and
+            /// \see{AsymmetricKey}s (possibly shared with other rings).
+            SharedEntries::SharedPtr sharedEntries;
             /// \brief
-            /// Convenient typedef for std::map<ID, KeyExchange::SharedPtr>.
-            typedef std::map<ID, KeyExchange::SharedPtr> KeyExchangeMap;
+            /// Convenient typedef for IDHashMap<KeyExchange::SharedPtr>.
+            typedef IDHashMap<KeyExchange::SharedPtr> KeyExchangeMap;
             /// \brief
             /// \see{KeyExchange} map.
             KeyExchangeMap keyExchangeMap;
             /// \brief
-            /// \see{Authenticator} \see{Params} map.
-            ParamsMap authenticatorParamsMap;
-            /// \brief
-            /// \see{Authenticator} \see{AsymmetricKey} map.
-            AsymmetricKeyMap authenticatorKeyMap;
-            /// \brief
-            /// Convenient typedef for std::map<ID, Authenticator::SharedPtr>.
-            typedef std::map<ID, Authenticator::SharedPtr> AuthenticatorMap;
+            /// Convenient typedef for IDCache<Authenticator::SharedPtr>.
+            typedef IDCache<Authenticator::SharedPtr> AuthenticatorMap;
             /// \brief
             /// \see{Authenticator} map.
             AuthenticatorMap authenticatorMap;
             /// \brief
-            /// Convenient typedef for std::map<ID, SymmetricKey::SharedPtr>.
-            typedef std::map<ID, SymmetricKey::SharedPtr> SymmetricKeyMap;
+            /// Convenient typedef for IDHashMap<SymmetricKey::SharedPtr>.
+            typedef IDHashMap<SymmetricKey::SharedPtr> SymmetricKeyMap;
             /// \brief
             /// \see{Cipher} \see{SymmetricKey} map.
             SymmetricKeyMap cipherKeyMap;
             /// \brief
-            /// Convenient typedef for std::map<ID, Cipher::SharedPtr>.
-            typedef std::map<ID, Cipher::SharedPtr> CipherMap;
+            /// \see{Cipher} keys moved in to compact records (see CompactKeys).
+            CompactKeyStore cipherKeyStore;
+            /// \brief
+            /// Convenient typedef for IDCache<Cipher::SharedPtr>.
+            typedef IDCache<Cipher::SharedPtr> CipherMap;
             /// \brief
             /// \see{Cipher} map.
             CipherMap cipherMap;
             /// \brief
+            /// Convenient typedef for IDCache<CipherPool::SharedPtr>.
+            typedef IDCache<CipherPool::SharedPtr> CipherPoolMap;
+            /// \brief
+            /// \see{CipherPool} map.
+            CipherPoolMap cipherPoolMap;
+            /// \brief
             /// \see{MAC} \see{SymmetricKeyMap} map.
             SymmetricKeyMap macKeyMap;
             /// \brief
-            /// Convenient typedef for std::map<ID, MAC::SharedPtr>.
-            typedef std::map<ID, MAC::SharedPtr> MACMap;
+            /// \see{MAC} keys moved in to compact records (see CompactKeys).
+            CompactKeyStore macKeyStore;
+            /// \brief
+            /// Convenient typedef for IDCache<MAC::SharedPtr>.
+            typedef IDCache<MAC::SharedPtr> MACMap;
             /// \brief
             /// \see{MAC} map.
             MACMap macMap;
             /// \brief
-            /// Convenient typedef for std::map<ID, Serializable::SharedPtr>.
-            typedef std::map<ID, Serializable::SharedPtr> SerializableMap;
+            /// Convenient typedef for IDHashMap<Serializable::SharedPtr>.
+            typedef IDHashMap<Serializable::SharedPtr> SerializableMap;
             /// \brief
             /// \see{Serializable} map.
             SerializableMap userDataMap;
             /// \brief
-            /// Convenient typedef for std::map<ID, SharedPtr>.
-            typedef std::map<ID, SharedPtr> KeyRingMap;
+            /// Convenient typedef for IDHashMap<SharedPtr>.
+            typedef IDHashMap<SharedPtr> KeyRingMap;
             /// \brief
             /// Subrings hanging off this key ring.
             KeyRingMap subringMap;
+            /// \brief
+            /// Optional cache of validated \see{KeyExchange::Params} signatures
+            /// (see CreateKeyExchange).
+            ValidatedParamsCache::SharedPtr validatedParamsCache;
+            /// \enum
+            /// Kinds of entries tracked by the \see{ID} index.
+            enum EntryType {
+                /// \brief
+                /// keyExchangeParamsMap entry.
+                ENTRY_KEY_EXCHANGE_PARAMS,
+                /// \brief
+                /// keyExchangeKeyMap entry.
+                ENTRY_KEY_EXCHANGE_KEY,
+                /// \brief
+                /// keyExchangeMap entry.
+                ENTRY_KEY_EXCHANGE,
+                /// \brief
+                /// authenticatorParamsMap entry.
+                ENTRY_AUTHENTICATOR_PARAMS,
+                /// \brief
+                /// authenticatorKeyMap entry.
+                ENTRY_AUTHENTICATOR_KEY,
+                /// \brief
+                /// cipherKeyMap entry (cipherMap and cipherPoolMap are derived from it).
+                ENTRY_CIPHER_KEY,
+                /// \brief
+                /// macKeyMap entry (macMap is derived from it).
+                ENTRY_MAC_KEY,
+                /// \brief
+                /// userDataMap entry.
+                ENTRY_USER_DATA,
+                /// \brief
+                /// subringMap entry.
+                ENTRY_SUBRING
+            };
+            /// \struct KeyRing::IndexEntry KeyRing.h thekogans/crypto/KeyRing.h
+            ///
+            /// \brief
+            /// The ring holding an entry with a given \see{ID}, and it's kind.
+            struct IndexEntry {
+                /// \brief
+                /// Ring whose map holds the entry.
+                KeyRing *owner;
+                /// \brief
+                /// Which of the owner's maps holds the entry.
+                EntryType type;
+
+                /// \brief
+                /// ctor.
+                /// \param[in] owner_ Ring whose map holds the entry.
+                /// \param[in] type_ Which of the owner's maps holds the entry.
+                IndexEntry (
+                    KeyRing *owner_,
+                    EntryType type_) :
+                    owner (owner_),
+                    type (type_) {}
+            };
+            /// \struct KeyRing::Index KeyRing.h thekogans/crypto/KeyRing.h
+            ///
+            /// \brief
+            /// Tree bookkeeping. Every ring knows it's parent, and the
+            /// root maps every \see{ID} in the tree to the rings holding it
+            /// (the same id can live in more than one ring or map).
+            struct Index {
+                /// \brief
+                /// Ring this ring is a sub ring of (0 == root).
+                KeyRing *parent;
+                /// \brief
+                /// id -> entries (root only).
+                IDHashMap<std::vector<IndexEntry> > entries;
+                /// \brief
+                /// false == entries need to be rebuilt before use (root only).
+                bool valid;
+                /// \brief
+                /// Bumped when sub rings come and go (root only). Rings with
+                /// shared entries serialize them, or a reference to them,
+                /// depending on the shape of the tree (see GetSharedEntriesOwner).
+                util::ui64 version;
+                /// \brief
+                /// Cached Size (valid only if sizeValid).
+                std::size_t size;
+                /// \brief
+                /// Outermost ring being serialized when size was computed.
+                const KeyRing *sizeRoot;
+                /// \brief
+                /// Root version when size was computed.
+                util::ui64 sizeVersion;
+                /// \brief
+                /// false == size needs to be recomputed. Cleared on every
+                /// change to this ring or any of it's descendants.
+                bool sizeValid;
+
+                /// \brief
+                /// ctor.
+                Index () :
+                    parent (0),
+                    valid (false),
+                    version (0),
+                    size (0),
+                    sizeRoot (0),
+                    sizeVersion (0),
+                    sizeValid (false) {}
+            };
+            /// \brief
+            /// Tree index and cached size (lazily rebuilt, hence mutable).
+            mutable Index index;
 
         public:
             /// \brief
@@ -141,7 +315,11 @@ namespace thekogans {
                 const std::string &name = std::string (),
                 const std::string &description = std::string ()) :
                 Serializable (id, name, description),
-                cipherSuite (cipherSuite_) {}
+                cipherSuite (cipherSuite_),
+                sharedEntries (new SharedEntries (id)) {}
+            /// \brief
+            /// dtor. Detach the sub rings.
+            virtual ~KeyRing ();
 
             /// \brief
             /// Load a key ring from a file previously written with Save.
@@ -166,6 +344,82 @@ namespace thekogans {
                 const void *associatedData = 0,
                 std::size_t associatedDataLength = 0);
 
+            /// \brief
+            /// Set the number of threads used to deserialize a (binary) ring's
+            /// entries. Rings saved by this version prefix every entry with it's
+            /// size, so when reading from memory (Load) the entries are located
+            /// up front and parsed (OpenSSL DER decoding of asymmetric keys
+            /// included) by a pool of workers. Sub rings are parsed as a whole by
+            /// one worker.
+            /// \param[in] workerCount Number of workers (0 = one per CPU, 1 = sequential).
+            static void SetReadWorkerCount (std::size_t workerCount);
+
+            /// \enum
+            /// Streaming save/load constants.
+            enum {
+                /// \brief
+                /// Default SaveStream chunk (plaintext segment) size.
+                DEFAULT_STREAM_CHUNK_SIZE = 64 * 1024,
+                /// \brief
+                /// Largest chunk size LoadStream will accept.
+                MAX_STREAM_CHUNK_SIZE = 16 * 1024 * 1024
+            };
+            /// \brief
+            /// Load a key ring from a file previously written with SaveStream.
+            /// Decrypts and deserializes the file one chunk at a time, so memory
+            /// use is constant (one chunk), whatever the ring size.
+            /// \param[in] path File name to read the key ring from.
+            /// \param[in] key \see{SymmetricKey} used to decrypt the file data.
+            /// \param[in] cipher OpenSSL AEAD EVP_CIPHER (see \see{StreamCipher}).
+            /// \return Key ring.
+            static SharedPtr LoadStream (
+                const std::string &path,
+                SymmetricKey::SharedPtr key,
+                const EVP_CIPHER *cipher = THEKOGANS_CRYPTO_DEFAULT_CIPHER);
+            /// \brief
+            /// Save the key ring to a file. Unlike Save, the ring is serialized
+            /// straight in to a \see{StreamCipher} and written out one chunk at a
+            /// time, so memory use is constant (one chunk), whatever the ring size.
+            /// File layout: magic, version, chunkSize, \see{StreamCipher} header,
+            /// followed by the segments (associated data = magic, version, chunkSize).
+            /// \param[in] path File name to save the key ring to.
+            /// \param[in] key \see{SymmetricKey} used to encrypt the file data.
+            /// \param[in] cipher OpenSSL AEAD EVP_CIPHER (see \see{StreamCipher}).
+            /// \param[in] chunkSize Plaintext segment size.
+            void SaveStream (
+                const std::string &path,
+                SymmetricKey::SharedPtr key,
+                const EVP_CIPHER *cipher = THEKOGANS_CRYPTO_DEFAULT_CIPHER,
+                std::size_t chunkSize = DEFAULT_STREAM_CHUNK_SIZE);
+
+            /// \brief
+            /// Load a key ring from an XML file. Unlike building a pugixml DOM for the
+            /// whole file and reading the ring from it, the file is read in (secure)
+            /// chunks and the ring is assembled one entry at a time, so memory use is
+            /// constant (one entry), whatever the ring size. \see{SymmetricKey}s are
+            /// decoded straight from the chunks in to util::SecureBuffers. The other
+            /// entries are parsed (in place, from secure memory) as a one entry DOM.
+            /// Reads files written by SaveXML as well as by writing the ring to a
+            /// pugixml DOM.
+            /// \param[in] path File name to read the key ring from.
+            /// \return Key ring.
+            static SharedPtr LoadXML (const std::string &path);
+            /// \brief
+            /// Save the key ring to an XML file one entry at a time (see LoadXML).
+            /// \param[in] path File name to save the key ring to.
+            void SaveXML (const std::string &path) const;
+            /// \brief
+            /// Load a key ring from a JSON file one entry at a time (see LoadXML).
+            /// NOTE: \see{SymmetricKey}s are decoded straight in to util::SecureBuffers.
+            /// The other entries go through a (non secure) one entry util::JSON DOM.
+            /// \param[in] path File name to read the key ring from.
+            /// \return Key ring.
+            static SharedPtr LoadJSON (const std::string &path);
+            /// \brief
+            /// Save the key ring to a JSON file one entry at a time (see LoadXML).
+            /// \param[in] path File name to save the key ring to.
+            void SaveJSON (const std::string &path) const;
+
             /// \brief
             /// Return the \see{CipherSuite} associated with this key ring.
             /// \return \see{CipherSuite} associated with this key ring.
@@ -198,6 +452,91 @@ namespace thekogans {
                 /// \return true == equal.
                 virtual bool operator () (const T & /*t*/) const throw () = 0;
             };
+            /// \struct KeyRing::AttributeExtractor KeyRing.h thekogans/crypto/KeyRing.h
+            ///
+            /// \brief
+            /// Extracts the attribute an attribute index (see AddAttributeIndex)
+            /// files entries under. Derive from it to index by any attribute.
+            struct _LIB_THEKOGANS_CRYPTO_DECL AttributeExtractor : public virtual util::RefCounted {
+                /// \brief
+                /// Declare \see{RefCounted} pointers.
+                THEKOGANS_UTIL_DECLARE_REF_COUNTED_POINTERS (AttributeExtractor)
+
+                /// \brief
+                /// dtor.
+                virtual ~AttributeExtractor () {}
+
+                /// \brief
+                /// Reimplement this function to return the entry's attribute.
+                /// \param[in] entry Params, key, user data or sub ring to index.
+                /// \param[out] value Where to put the attribute.
+                /// \return true == index the entry under value, false == don't index it.
+                virtual bool Extract (
+                    const Serializable & /*entry*/,
+                    std::string & /*value*/) const = 0;
+            };
+            /// \struct KeyRing::NameExtractor KeyRing.h thekogans/crypto/KeyRing.h
+            ///
+            /// \brief
+            /// Index entries by \see{Serializable::GetName} (unnamed entries are skipped).
+            struct _LIB_THEKOGANS_CRYPTO_DECL NameExtractor : public AttributeExtractor {
+                /// \brief
+                /// Return the entry name.
+                /// \param[in] entry Entry to index.
+                /// \param[out] value Entry name.
+                /// \return true == entry has a name.
+                virtual bool Extract (
+                    const Serializable &entry,
+                    std::string &value) const override;
+            };
+            /// \struct KeyRing::KeyTypeExtractor KeyRing.h thekogans/crypto/KeyRing.h
+            ///
+            /// \brief
+            /// Index \see{Params} and \see{AsymmetricKey}s by their key type
+            /// (\see{OPENSSL_PKEY_RSA}...). Other entries are skipped.
+            struct _LIB_THEKOGANS_CRYPTO_DECL KeyTypeExtractor : public AttributeExtractor {
+                /// \brief
+                /// Return the entry key type.
+                /// \param[in] entry Entry to index.
+                /// \param[out] value Entry key type.
+                /// \return true == entry is a \see{Params} or an \see{AsymmetricKey}.
+                virtual bool Extract (
+                    const Serializable &entry,
+                    std::string &value) const override;
+            };
+            /// \struct KeyRing::AttributeQuery KeyRing.h thekogans/crypto/KeyRing.h
+            ///
+            /// \brief
+            /// Names an attribute index and the value to look up in it.
+            /// Use it with the AttributeQuery Get* overloads:
+            ///
+            /// \code{.cpp}
+            /// using namespace thekogans;
+            ///
+            /// keyRing->AddAttributeIndex (
+            ///     "name", crypto::KeyRing::AttributeExtractor::SharedPtr (
+            ///         new crypto::KeyRing::NameExtractor));
+            /// crypto::SymmetricKey::SharedPtr key = keyRing->GetCipherKey (
+            ///     crypto::KeyRing::AttributeQuery ("name", "backup"));
+            /// \endcode
+            struct AttributeQuery {
+                /// \brief
+                /// Name of attribute index to look in.
+                std::string indexName;
+                /// \brief
+                /// Attribute value to look up.
+                std::string value;
+
+                /// \brief
+                /// ctor.
+                /// \param[in] indexName_ Name of attribute index to look in.
+                /// \param[in] value_ Attribute value to look up.
+                AttributeQuery (
+                    const std::string &indexName_,
+                    const std::string &value_) :
+                    indexName (indexName_),
+                    value (value_) {}
+            };
             /// \brief
             /// Return the \see{KeyExchange} \see{Params} matching the given EqualityTest.
             /// \param[in] equalityTest EqualityTest to call for each keyExchangeParamsMap item.
@@ -208,7 +547,23 @@ namespace thekogans {
                 const EqualityTest<Params> &equalityTest,
                 bool recursive = true) const;
             /// \brief
-            /// Return randomly chosen \see{KeyExchange} \see{Params}.
+            /// Return the \see{KeyExchange} \see{Params} matching the given AttributeQuery.
+            /// \param[in] query Attribute index and value to look up.
+            /// \param[in] recursive true = if not found locally, descend down to sub rings.
+            /// \return First \see{KeyExchange} \see{Params} whose attribute matches
+            /// (Params::SharedPtr () if not found).
+            Params::SharedPtr GetKeyExchangeParams (
+                const AttributeQuery &query,
+                bool recursive = true) const;
+            /// \brief
+            /// Append all \see{KeyExchange} \see{Params} to the given list.
+            /// \param[out] params Where to append the params.
+            /// \param[in] recursive true = descend down to sub rings.
+            void GetKeyExchangeParams (
+                std::vector<Params::SharedPtr> &params,
+                bool recursive = true) const;
+            /// \brief
+            /// Return randomly chosen \see{KeyExchange} \see{Params} (in constant time).
             /// \return Randomly chosen \see{KeyExchange} \see{Params}.
             Params::SharedPtr GetRandomKeyExchangeParams () const;
             /// \brief
@@ -249,6 +604,22 @@ namespace thekogans {
                 const EqualityTest<AsymmetricKey> &equalityTest,
                 bool recursive = true) const;
             /// \brief
+            /// Return the \see{KeyExchange} \see{AsymmetricKey} matching the given AttributeQuery.
+            /// \param[in] query Attribute index and value to look up.
+            /// \param[in] recursive true = if not found locally, descend down to sub rings.
+            /// \return First \see{KeyExchange} \see{AsymmetricKey} whose attribute matches
+            /// (AsymmetricKey::SharedPtr () if not found).
+            AsymmetricKey::SharedPtr GetKeyExchangeKey (
+                const AttributeQuery &query,
+                bool recursive = true) const;
+            /// \brief
+            /// Append all \see{KeyExchange} keys to the given list.
+            /// \param[out] keys Where to append the keys.
+            /// \param[in] recursive true = descend down to sub rings.
+            void GetKeyExchangeKeys (
+                std::vector<AsymmetricKey::SharedPtr> &keys,
+                bool recursive = true) const;
+            /// \brief
             /// Add a \see{KeyExchange} \see{AsymmetricKey} to this ring.
             /// \param[in] key \see{KeyExchange} \see{AsymmetricKey} to add.
             /// \return true = key added. false = A key with this \see{ID}
@@ -350,6 +721,22 @@ namespace thekogans {
                 const EqualityTest<Params> &equalityTest,
                 bool recursive = true) const;
             /// \brief
+            /// Return the \see{Authenticator} \see{Params} matching the given AttributeQuery.
+            /// \param[in] query Attribute index and value to look up.
+            /// \param[in] recursive true = if not found locally, descend down to sub rings.
+            /// \return First \see{Authenticator} \see{Params} whose attribute matches
+            /// (Params::SharedPtr () if not found).
+            Params::SharedPtr GetAuthenticatorParams (
+                const AttributeQuery &query,
+                bool recursive = true) const;
+            /// \brief
+            /// Append all \see{Authenticator} \see{Params} to the given list.
+            /// \param[out] params Where to append the params.
+            /// \param[in] recursive true = descend down to sub rings.
+            void GetAuthenticatorParams (
+                std::vector<Params::SharedPtr> &params,
+                bool recursive = true) const;
+            /// \brief
             /// Add a \see{Authenticator} \see{Params} to this ring.
             /// \param[in] params \see{Authenticator} \see{Params} to add.
             /// \return true = params added. false = A \see{Params} with
@@ -387,6 +774,22 @@ namespace thekogans {
                 const EqualityTest<AsymmetricKey> &equalityTest,
                 bool recursive = true) const;
             /// \brief
+            /// Return the \see{Authenticator} \see{AsymmetricKey} matching the given AttributeQuery.
+            /// \param[in] query Attribute index and value to look up.
+            /// \param[in] recursive true = if not found locally, descend down to sub rings.
+            /// \return First \see{Authenticator} \see{AsymmetricKey} whose attribute matches
+            /// (AsymmetricKey::SharedPtr () if not found).
+            AsymmetricKey::SharedPtr GetAuthenticatorKey (
+                const AttributeQuery &query,
+                bool recursive = true) const;
+            /// \brief
+            /// Append all \see{Authenticator} keys to the given list.
+            /// \param[out] keys Where to append the keys.
+            /// \param[in] recursive true = descend down to sub rings.
+            void GetAuthenticatorKeys (
+                std::vector<AsymmetricKey::SharedPtr> &keys,
+                bool recursive = true) const;
+            /// \brief
             /// Return the \see{Authenticator} with the given \see{ID}.
             /// \param[in] keyId \see{ID} of \see{Authenticator} \see{AsymmetricKey}.
             /// \param[in] recursive true = if not found locally, descend down to sub rings.
@@ -436,6 +839,33 @@ namespace thekogans {
                 const EqualityTest<SymmetricKey> &equalityTest,
                 bool recursive = true) const;
             /// \brief
+            /// Return the \see{Cipher} \see{SymmetricKey} matching the given AttributeQuery.
+            /// \param[in] query Attribute index and value to look up.
+            /// \param[in] recursive true = if not found locally, descend down to sub rings.
+            /// \return First \see{Cipher} \see{SymmetricKey} whose attribute matches
+            /// (SymmetricKey::SharedPtr () if not found).
+            SymmetricKey::SharedPtr GetCipherKey (
+                const AttributeQuery &query,
+                bool recursive = true) const;
+            /// \brief
+            /// Append all \see{Cipher} keys to the given list.
+            /// \param[out] keys Where to append the keys.
+            /// \param[in] recursive true = descend down to sub rings.
+            void GetCipherKeys (
+                std::vector<SymmetricKey::SharedPtr> &keys,
+                bool recursive = true) const;
+            /// \brief
+            /// Return the \see{Cipher} key table used by compact framing
+            /// (\see{Cipher::EncryptAndFrameCompact}). The table holds the
+            /// \see{Cipher} key ids sorted in ascending order, so peers sharing
+            /// the same ring derive the same table, and a key's handle is it's
+            /// index in it. Recompute it after adding or dropping \see{Cipher} keys.
+            /// \param[out] keyIds Where to put the sorted key ids.
+            /// \param[in] recursive true = include the keys of the sub rings.
+            void GetCipherKeyTable (
+                std::vector<ID> &keyIds,
+                bool recursive = true) const;
+            /// \brief
             /// Retrieve the \see{Cipher} corresponding to the given key \see{ID}.
             /// \param[in] keyId \see{ID} of \see{Cipher} key.
             /// \param[in] recursive true = if not found locally, descend down to sub rings.
@@ -445,6 +875,19 @@ namespace thekogans {
                 const ID &keyId,
                 bool recursive = true);
             /// \brief
+            /// Retrieve the \see{CipherPool} corresponding to the given key \see{ID}.
+            /// Unlike the \see{Cipher} returned by GetCipher, the pool can be shared
+            /// by multiple threads (each leasing it's own \see{Cipher}).
+            /// NOTE: The pool is created (and cached) on first use. Retrieve it once
+            /// and hand it to the worker threads, as KeyRing itself is not thread safe.
+            /// \param[in] keyId \see{ID} of \see{Cipher} key.
+            /// \param[in] recursive true = if not found locally, descend down to sub rings.
+            /// \return \see{CipherPool} corresponding to the given key \see{ID}
+            /// (\see{CipherPool::SharedPtr} () if not found).
+            CipherPool::SharedPtr GetCipherPool (
+                const ID &keyId,
+                bool recursive = true);
+            /// \brief
             /// Return a \see{Cipher} based on randomly chosen \see{SymmetricKey}.
             /// NOTE: This is a special purpose method meant to be used by communicating
             /// peers that used \see{KeyExchange} to establish shared keys. The sending
@@ -453,7 +896,7 @@ namespace thekogans {
             /// \see{FrameHeader::keyId} to retrieve it's key to decrypt the packet.
             /// This way the peers can rotate keys (for every packet if need be) for
             /// better security.
-            /// WARNING: This method runs in O(cipherKeyMap.size ()).
+            /// NOTE: The key is chosen in constant time.
             /// \return \see{Cipher} based on randomly chosen \see{SymmetricKey}.
             Cipher::SharedPtr GetRandomCipher ();
             /// \brief
@@ -466,6 +909,74 @@ namespace thekogans {
                 SymmetricKey::SharedPtr key,
                 Cipher::SharedPtr cipher = Cipher::SharedPtr ());
             /// \brief
+            /// Add the given \see{Cipher} \see{SymmetricKey}s to the ring in bulk.
+            /// The whole batch is validated before any key is added (all or nothing),
+            /// and the key map is grown once.
+            /// \param[in] keys \see{Cipher} \see{SymmetricKey}s to add.
+            /// \param[in] keyCount Number of keys.
+            /// \param[in] createCiphers true = create (and add) the \see{Cipher}s as well.
+            /// \param[in] workerCount Number of threads used to create the
+            /// \see{Cipher}s (0 = one per CPU).
+            /// \return Number of keys added (keys already in the ring are skipped).
+            std::size_t AddCipherKeys (
+                const SymmetricKey::SharedPtr *keys,
+                std::size_t keyCount,
+                bool createCiphers = false,
+                std::size_t workerCount = 1);
+            /// \brief
+            /// Add the given \see{Cipher} \see{SymmetricKey}s to the ring in bulk.
+            /// \param[in] keys \see{Cipher} \see{SymmetricKey}s to add.
+            /// \param[in] createCiphers true = create (and add) the \see{Cipher}s as well.
+            /// \param[in] workerCount Number of threads used to create the
+            /// \see{Cipher}s (0 = one per CPU).
+            /// \return Number of keys added (keys already in the ring are skipped).
+            inline std::size_t AddCipherKeys (
+                    const std::vector<SymmetricKey::SharedPtr> &keys,
+                    bool createCiphers = false,
+                    std::size_t workerCount = 1) {
+                return AddCipherKeys (
+                    keys.empty () ? 0 : &keys[0],
+                    keys.size (),
+                    createCiphers,
+                    workerCount);
+            }
+            /// \brief
+            /// Create \see{Cipher} \see{SymmetricKey}s from raw key material and add
+            /// them to the ring in bulk. keyMaterialLength must be a multiple of the
+            /// \see{CipherSuite} cipher key length.
+            /// \param[in] keyMaterial Concatenated keys.
+            /// \param[in] keyMaterialLength keyMaterial length.
+            /// \param[out] keyIds Optional list where the new key \see{ID}s are appended.
+            /// \param[in] createCiphers true = create (and add) the \see{Cipher}s as well.
+            /// \param[in] workerCount Number of threads used to create the
+            /// \see{Cipher}s (0 = one per CPU).
+            /// \return Number of keys added.
+            std::size_t AddCipherKeyMaterial (
+                const void *keyMaterial,
+                std::size_t keyMaterialLength,
+                std::vector<ID> *keyIds = 0,
+                bool createCiphers = false,
+                std::size_t workerCount = 1);
+            /// \brief
+            /// Return the length of the buffer needed by ExportCipherKeyMaterial.
+            /// \param[in] recursive true = descend down to sub rings.
+            /// \return Length of all \see{Cipher} keys.
+            std::size_t GetCipherKeyMaterialLength (bool recursive = true) const;
+            /// \brief
+            /// Export the raw \see{Cipher} key material (the inverse of AddCipherKeyMaterial).
+            /// NOTE: keyMaterial holds secrets; use secure memory and wipe it when done.
+            /// \param[out] keyMaterial Where to write the concatenated keys.
+            /// \param[in] keyMaterialLength keyMaterial length (see GetCipherKeyMaterialLength).
+            /// \param[out] keyIds Optional list where the exported key \see{ID}s are appended
+            /// (in keyMaterial order).
+            /// \param[in] recursive true = descend down to sub rings.
+            /// \return Number of bytes written to keyMaterial.
+            std::size_t ExportCipherKeyMaterial (
+                util::ui8 *keyMaterial,
+                std::size_t keyMaterialLength,
+                std::vector<ID> *keyIds = 0,
+                bool recursive = true) const;
+            /// \brief
             /// Given a \see{Cipher} \see{SymmetricKey} \see{ID}, drop the corresponding key
             /// from the key ring.
             /// \param[in] keyId \see{Cipher} \see{SymmetricKey} \see{ID} to drop from the key ring.
@@ -498,13 +1009,39 @@ namespace thekogans {
                 const EqualityTest<SymmetricKey> &equalityTest,
                 bool recursive = true) const;
             /// \brief
+            /// Return the \see{MAC} \see{SymmetricKey} matching the given AttributeQuery.
+            /// \param[in] query Attribute index and value to look up.
+            /// \param[in] recursive true = if not found locally, descend down to sub rings.
+            /// \return First \see{MAC} \see{SymmetricKey} whose attribute matches
+            /// (SymmetricKey::SharedPtr () if not found).
+            SymmetricKey::SharedPtr GetMACKey (
+                const AttributeQuery &query,
+                bool recursive = true) const;
+            /// \brief
+            /// Append all \see{MAC} keys to the given list.
+            /// \param[out] keys Where to append the keys.
+            /// \param[in] recursive true = descend down to sub rings.
+            void GetMACKeys (
+                std::vector<SymmetricKey::SharedPtr> &keys,
+                bool recursive = true) const;
+            /// \brief
             /// Return the \see{MAC} with the given key \see{ID}.
             /// \param[in] keyId \see{ID} of \see{MAC} key.
             /// \param[in] recursive true = if not found locally, descend down to sub rings.
+            /// \param[in] type \see{MAC::Type} (see \see{CipherSuite::GetMAC}). One \see{MAC}
+            /// is cached per key, asking for a different type replaces it.
             /// \return \see{MAC} corresponding to the given keyId (MAC::SharedPtr () if not found).
             MAC::SharedPtr GetMAC (
                 const ID &keyId,
-                bool recursive);
+                bool recursive,
+                MAC::Type type = MAC::TYPE_HMAC);
+            /// \brief
+            /// Return a \see{MAC} based on randomly chosen \see{SymmetricKey}
+            /// (in constant time). \see{GetRandomCipher}.
+            /// \param[in] type \see{MAC::Type} (see \see{CipherSuite::GetMAC}).
+            /// \return \see{MAC} based on randomly chosen \see{SymmetricKey}
+            /// (MAC::SharedPtr () if the ring has no \see{MAC} keys).
+            MAC::SharedPtr GetRandomMAC (MAC::Type type = MAC::TYPE_HMAC);
             /// \brief
             /// Add a \see{MAC} \see{SymmetricKey} to this ring.
             /// \param[in] key \see{MAC} \see{SymmetricKey} to add.
@@ -515,6 +1052,38 @@ namespace thekogans {
                 SymmetricKey::SharedPtr key,
                 MAC::SharedPtr mac = MAC::SharedPtr ());
             /// \brief
+            /// Add the given \see{MAC} \see{SymmetricKey}s to the ring in bulk.
+            /// The whole batch is validated before any key is added (all or nothing),
+            /// and the key map is grown once.
+            /// \param[in] keys \see{MAC} \see{SymmetricKey}s to add.
+            /// \param[in] keyCount Number of keys.
+            /// \param[in] createMACs true = create (and add) the (HMAC) \see{MAC}s as well.
+            /// \param[in] workerCount Number of threads used to create the
+            /// \see{MAC}s (0 = one per CPU).
+            /// \return Number of keys added (keys already in the ring are skipped).
+            std::size_t AddMACKeys (
+                const SymmetricKey::SharedPtr *keys,
+                std::size_t keyCount,
+                bool createMACs = false,
+                std::size_t workerCount = 1);
+            /// \brief
+            /// Add the given \see{MAC} \see{SymmetricKey}s to the ring in bulk.
+            /// \param[in] keys \see{MAC} \see{SymmetricKey}s to add.
+            /// \param[in] createMACs true = create (and add) the (HMAC) \see{MAC}s as well.
+            /// \param[in] workerCount Number of threads used to create the
+            /// \see{MAC}s (0 = one per CPU).
+            /// \return Number of keys added (keys already in the ring are skipped).
+            inline std::size_t AddMACKeys (
+                    const std::vector<SymmetricKey::SharedPtr> &keys,
+                    bool createMACs = false,
+                    std::size_t workerCount = 1) {
+                return AddMACKeys (
+                    keys.empty () ? 0 : &keys[0],
+                    keys.size (),
+                    createMACs,
+                    workerCount);
+            }
+            /// \brief
             /// Drop a \see{MAC} \see{SymmetricKey} with the given \see{ID}.
             /// \param[in] keyId \see{ID} of \see{MAC} \see{SymmetricKey} to delete.
             /// \param[in] recursive true = if not found locally, descend down to sub rings.
@@ -526,6 +1095,17 @@ namespace thekogans {
             /// Drop all \see{MAC} \see{SymmetricKey}.
             /// \param[in] recursive true = descend down to sub rings.
             void DropAllMACKeys (bool recursive = true);
+            /// \brief
+            /// Move the \see{Cipher} and \see{MAC} keys in to compact records
+            /// (\see{CompactKeyStore}). Meant for (million key) rings that are
+            /// filled in bulk (AddCipherKeys, Load...) and then mostly used to
+            /// look up keys. The keys behave like they did, except that the
+            /// \see{SymmetricKey}s (Get*Key) are materialized on demand (a new
+            /// object every time). The \see{Cipher}s and \see{MAC}s are cached as
+            /// before. Keys added later are held as usual until the next call.
+            /// \param[in] recursive true = compact the sub rings too.
+            /// \return Number of keys moved.
+            std::size_t CompactKeys (bool recursive = true);
 
             /// \brief
             /// Return user data with the given \see{ID}.
@@ -546,6 +1126,22 @@ namespace thekogans {
                 const EqualityTest<Serializable> &equalityTest,
                 bool recursive) const;
             /// \brief
+            /// Return the user data matching the given AttributeQuery.
+            /// \param[in] query Attribute index and value to look up.
+            /// \param[in] recursive true = if not found locally, descend down to sub rings.
+            /// \return First user data whose attribute matches
+            /// (Serializable::SharedPtr () if not found).
+            Serializable::SharedPtr GetUserData (
+                const AttributeQuery &query,
+                bool recursive = true) const;
+            /// \brief
+            /// Append all user data to the given list.
+            /// \param[out] userData Where to append the userData.
+            /// \param[in] recursive true = descend down to sub rings.
+            void GetUserData (
+                std::vector<Serializable::SharedPtr> &userData,
+                bool recursive = true) const;
+            /// \brief
             /// Add user data to this ring.
             /// \param[in] userData \see{Serializable} to add.
             /// \return true = user data added. false = user data with this \see{ID}
@@ -581,12 +1177,49 @@ namespace thekogans {
                 const EqualityTest<KeyRing> &equalityTest,
                 bool recursive = true) const;
             /// \brief
-            /// Add a sub ring to this ring.
+            /// Return the sub ring matching the given AttributeQuery.
+            /// \param[in] query Attribute index and value to look up.
+            /// \param[in] recursive true = if not found locally, descend down to sub rings.
+            /// \return First sub ring whose attribute matches
+            /// (SharedPtr () if not found).
+            SharedPtr GetSubring (
+                const AttributeQuery &query,
+                bool recursive = true) const;
+            /// \brief
+            /// Add a sub ring to this ring. NOTE: subring can't already be
+            /// a sub ring of another ring, nor can it be this ring or one of
+            /// it's ancestors (EINVAL is thrown).
             /// \param[in] subring Sub ring to add.
             /// \return true = sub ring added. false = A sub ring with
             /// this id already exists in the ring.
             bool AddSubring (SharedPtr subring);
             /// \brief
+            /// Create a ring (typically a tenant's sub ring) from a template ring. The new
+            /// ring gets the template's \see{CipherSuite}, and shares it's (immutable)
+            /// \see{KeyExchange} and \see{Authenticator} \see{Params} and \see{AsymmetricKey}s.
+            /// Cipher and MAC keys, user data and sub rings are not shared (add the tenant's
+            /// own). The sharing is copy on write. The first Add*/Drop* of one of those
+            /// entries (in any of the rings sharing them) gives that ring a private copy.
+            /// When a template and the rings created from it are serialized in the same tree
+            /// (in any of the formats), the entries are stored once (with the template). The
+            /// other rings store a reference to it.
+            /// \param[in] templateRing Ring whose entries to share.
+            /// \param[in] id Optional key ring id.
+            /// \param[in] name Optional key ring name.
+            /// \param[in] description Optional key ring description.
+            /// \return New key ring.
+            static SharedPtr CreateFromTemplate (
+                const KeyRing &templateRing,
+                const ID &id = ID (),
+                const std::string &name = std::string (),
+                const std::string &description = std::string ());
+            /// \brief
+            /// Return true if this ring shares it's \see{KeyExchange} and \see{Authenticator}
+            /// \see{Params} and \see{AsymmetricKey}s with the given one (see CreateFromTemplate).
+            /// \param[in] keyRing Ring to compare against.
+            /// \return true == the entries are shared.
+            bool SharesEntriesWith (const KeyRing &keyRing) const;
+            /// \brief
             /// Drop a sub ring with the given id.
             /// \param[in] subringId Id of sub ring to delete.
             /// \param[in] recursive true = if not found locally, descend down to sub rings.
@@ -602,10 +1235,262 @@ namespace thekogans {
             /// Drop all params, keys, user data and sub rings.
             void Clear ();
 
+            /// \brief
+            /// Bound the number of cached \see{Cipher}s, \see{CipherPool}s, \see{MAC}s
+            /// and \see{Authenticator}s (each cache is bounded on it's own). These are
+            /// built on demand from the keys, which always stay resident, so evicting
+            /// them (CLOCK) only costs a rebuild on the next Get*. Pending
+            /// \see{KeyExchange}s are not a cache, and are never evicted.
+            /// \param[in] maxCachedObjects Max objects per cache (0 = unbounded).
+            /// \param[in] recursive true = descend down to sub rings.
+            void SetMaxCachedObjects (
+                std::size_t maxCachedObjects,
+                bool recursive = true);
+            /// \brief
+            /// Return the combined hit/miss/eviction counters of the caches above.
+            /// \param[in] recursive true = descend down to sub rings.
+            /// \return IDCacheStats.
+            IDCacheStats GetCacheStats (bool recursive = true) const;
+
+            /// \brief
+            /// Return the \see{ValidatedParamsCache} used by CreateKeyExchange.
+            /// \return \see{ValidatedParamsCache} (0 == none).
+            inline ValidatedParamsCache::SharedPtr GetValidatedParamsCache () const {
+                return validatedParamsCache;
+            }
+            /// \brief
+            /// Set the \see{ValidatedParamsCache} used by CreateKeyExchange to skip
+            /// verifying the signature of params it validated before (peers reconnecting
+            /// with the same long lived signed params).
+            /// \param[in] validatedParamsCache_ \see{ValidatedParamsCache} (0 == none).
+            /// \param[in] recursive true = descend down to sub rings.
+            void SetValidatedParamsCache (
+                ValidatedParamsCache::SharedPtr validatedParamsCache_,
+                bool recursive = true);
+
+            /// \brief
+            /// Set the key ring name. Hides \see{Serializable::SetName}
+            /// so that the cached size (see Size) is invalidated.
+            /// \param[in] name New name to set.
+            void SetName (const std::string &name);
+            /// \brief
+            /// Set the key ring description. Hides \see{Serializable::SetDescription}
+            /// so that the cached size (see Size) is invalidated.
+            /// \param[in] description New description to set.
+            void SetDescription (const std::string &description);
+
+            /// \brief
+            /// Register an attribute index covering this ring and it's sub rings.
+            /// The index is built on first use and kept up to date by the Add*
+            /// and Drop* methods of every ring below this one, turning the
+            /// AttributeQuery lookups in to O(log n) searches. Lookups made on
+            /// a sub ring use the nearest ancestor's index. Attribute indexes
+            /// are not serialized.
+            /// NOTE: Entries are indexed as they're added. If you change an
+            /// indexed attribute (SetName...) of an entry after adding it,
+            /// call InvalidateAttributeIndexes.
+            /// \param[in] indexName Attribute index name (used in AttributeQuery).
+            /// \param[in] extractor \see{AttributeExtractor} to index entries with.
+            void AddAttributeIndex (
+                const std::string &indexName,
+                AttributeExtractor::SharedPtr extractor);
+            /// \brief
+            /// Drop an attribute index registered with AddAttributeIndex.
+            /// \param[in] indexName Attribute index name.
+            /// \return true == dropped, false == not found.
+            bool DropAttributeIndex (const std::string &indexName);
+            /// \brief
+            /// Have the attribute indexes of this ring and it's ancestors
+            /// rebuilt on their next use.
+            void InvalidateAttributeIndexes ();
+
+        private:
+            /// \struct KeyRing::AttributeIndexEntry KeyRing.h thekogans/crypto/KeyRing.h
+            ///
+            /// \brief
+            /// An entry filed in an attribute index.
+            struct AttributeIndexEntry {
+                /// \brief
+                /// Entry \see{ID}.
+                ID id;
+                /// \brief
+                /// Ring and map holding the entry.
+                IndexEntry entry;
+
+                /// \brief
+                /// ctor.
+                /// \param[in] id_ Entry \see{ID}.
+                /// \param[in] entry_ Ring and map holding the entry.
+                AttributeIndexEntry (
+                    const ID &id_,
+                    const IndexEntry &entry_) :
+                    id (id_),
+                    entry (entry_) {}
+            };
+            /// \struct KeyRing::AttributeIndex KeyRing.h thekogans/crypto/KeyRing.h
+            ///
+            /// \brief
+            /// An index registered with AddAttributeIndex.
+            struct AttributeIndex {
+                /// \brief
+                /// Extracts the attribute entries are filed under.
+                AttributeExtractor::SharedPtr extractor;
+                /// \brief
+                /// attribute -> entries.
+                std::multimap<std::string, AttributeIndexEntry> entries;
+                /// \brief
+                /// id -> attributes it's filed under (used to find dropped entries).
+                IDHashMap<std::vector<std::string> > values;
+                /// \brief
+                /// false == entries need to be rebuilt before use.
+                bool valid;
+
+                /// \brief
+                /// ctor.
+                AttributeIndex () :
+                    valid (false) {}
+            };
+            /// \brief
+            /// Convenient typedef for std::map<std::string, AttributeIndex>.
+            typedef std::map<std::string, AttributeIndex> AttributeIndexMap;
+            /// \brief
+            /// Attribute indexes registered on this ring (lazily rebuilt, hence mutable).
+            mutable AttributeIndexMap attributeIndexes;
+            /// \brief
+            /// Return the root of the tree this ring belongs to.
+            /// \return Root ring.
+            KeyRing *GetRoot () const;
+            /// \brief
+            /// Return true if the given ring is a (direct or indirect) sub ring of this one.
+            /// \param[in] ring Ring to check.
+            /// \return true == ring is below this one.
+            bool IsAncestorOf (const KeyRing *ring) const;
+            /// \brief
+            /// Return the first ring below this one holding an entry with the given id.
+            /// \param[in] id \see{ID} to look up.
+            /// \param[in] type Kind of entry to look up.
+            /// \return Owning ring (0 == not found).
+            KeyRing *FindOwner (
+                const ID &id,
+                EntryType type) const;
+            /// \brief
+            /// Record a new entry of this ring in the root index.
+            /// \param[in] id Entry \see{ID}.
+            /// \param[in] type Kind of entry.
+            void IndexEntryAdded (
+                const ID &id,
+                EntryType type);
+            /// \brief
+            /// Remove a dropped entry of this ring from the root index.
+            /// \param[in] id Entry \see{ID}.
+            /// \param[in] type Kind of entry.
+            void IndexEntryDropped (
+                const ID &id,
+                EntryType type);
+            /// \brief
+            /// Add (or remove) every entry of this ring and it's
+            /// sub rings to (from) the given index.
+            /// \param[in, out] entries Index to update.
+            /// \param[in] add true == add, false == remove.
+            void IndexTree (
+                IDHashMap<std::vector<IndexEntry> > &entries,
+                bool add) const;
+            /// \brief
+            /// Called after this ring's maps were changed wholesale (DropAll*, Clear, Read).
+            /// Mark the root index stale so that it's rebuilt on the next lookup.
+            void InvalidateIndex ();
+            /// \brief
+            /// Mark the cached size of this ring and all it's ancestors stale.
+            /// \param[in] treeChanged true == sub rings were added or dropped
+            /// (or entries unshared), bump the root version so that every
+            /// cached size in the tree is recomputed.
+            void InvalidateSize (bool treeChanged = false);
+            /// \brief
+            /// Return this ring's entry with the given id.
+            /// \param[in] id Entry \see{ID}.
+            /// \param[in] type Kind of entry (ENTRY_KEY_EXCHANGE is never indexed).
+            /// \return Entry (0 if not found).
+            Serializable::SharedPtr GetIndexedEntry (
+                const ID &id,
+                EntryType type) const;
+            /// \brief
+            /// Rebuild the given attribute index from this ring and it's sub rings.
+            /// \param[in, out] attributeIndex Attribute index to rebuild.
+            void BuildAttributeIndex (AttributeIndex &attributeIndex) const;
+            /// \brief
+            /// Update the attribute indexes of this ring and it's ancestors
+            /// after an entry was added to (or dropped from) this ring.
+            /// \param[in] id Entry \see{ID}.
+            /// \param[in] type Kind of entry.
+            /// \param[in] add true == added, false == dropped.
+            void UpdateAttributeIndexes (
+                const ID &id,
+                EntryType type,
+                bool add);
+            /// \brief
+            /// Look up an entry in the nearest attribute index named by query.
+            /// \param[in] query Attribute index and value to look up.
+            /// \param[in] type Kind of entry to look up.
+            /// \param[in] recursive true == entries in sub rings match too.
+            /// \param[out] id Where to put the \see{ID} of the entry found.
+            /// \return Ring owning the entry found (0 == not found).
+            KeyRing *FindAttribute (
+                const AttributeQuery &query,
+                EntryType type,
+                bool recursive,
+                ID &id) const;
+            /// \brief
+            /// Give this ring a private copy of it's \see{SharedEntries} (if they're shared).
+            /// Called before modifying them.
+            void UnshareEntries ();
+            /// \brief
+            /// Return the ring (root or one of it's descendants) whose \see{SharedEntries}
+            /// this ring serializes a reference to (instead of the entries).
+            /// \param[in] root Outermost ring being serialized.
+            /// \return Ring owning the \see{SharedEntries} (0 = serialize the entries).
+            const KeyRing *GetSharedEntriesOwner (const KeyRing &root) const;
+            /// \brief
+            /// Called at the end of Read. Point the rings in this tree that were read
+            /// with a \see{SharedEntries} reference at the owner's entries.
+            void ResolveSharedEntries ();
+            /// \brief
+            /// Detach all sub rings (they become roots).
+            void DetachSubrings ();
+            /// \brief
+            /// Add an entry to the given index.
+            /// \param[in, out] entries Index to add the entry to.
+            /// \param[in] id Entry \see{ID}.
+            /// \param[in] entry Entry to add.
+            static void AddIndexEntry (
+                IDHashMap<std::vector<IndexEntry> > &entries,
+                const ID &id,
+                const IndexEntry &entry);
+            /// \brief
+            /// Remove an entry from the given index.
+            /// \param[in, out] entries Index to remove the entry from.
+            /// \param[in] id Entry \see{ID}.
+            /// \param[in] entry Entry to remove.
+            static void RemoveIndexEntry (
+                IDHashMap<std::vector<IndexEntry> > &entries,
+                const ID &id,
+                const IndexEntry &entry);
+
+            /// \brief
+            /// Add an entry parsed by Read to the given map.
+            /// \param[in] map Serialized entry map.
+            /// \param[in] entry Entry to add.
+            void AddReadEntry (
+                util::ui8 map,
+                Serializable::SharedPtr entry);
+
         protected:
             // Serializable
             /// \brief
-            /// Return the serialized key ring size.
+            /// Return the serialized key ring size. The size is cached, and
+            /// only recomputed after this ring (or one of it's descendants)
+            /// was changed through the KeyRing api (entries are treated as
+            /// immutable once added). That way Save walks the tree once
+            /// instead of once per level.
             /// \return Serialized key ring size.
             virtual std::size_t Size () const override;
 
@@ -628,6 +1513,9 @@ namespace thekogans {
             /// "CipherSuite"
             static const char * const ATTR_CIPHER_SUITE;
             /// \brief
+            /// "SharedEntries"
+            static const char * const ATTR_SHARED_ENTRIES;
+            /// \brief
             /// "KeyExchangeParams"
             static const char * const TAG_KEY_EXCHANGE_PARAMS;
             /// \brief
@@ -0,0 +1,501 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined (__thekogans_crypto_LazyKeyRing_h)
+#define __thekogans_crypto_LazyKeyRing_h
+
+#include <cstddef>
+#include <string>
+#include <list>
+#include "thekogans/util/Types.h"
+#include "thekogans/util/RefCounted.h"
+#include "thekogans/util/Serializer.h"
+#include "thekogans/util/File.h"
+#include "thekogans/util/Exception.h"
+#include "thekogans/crypto/Config.h"
+#include "thekogans/crypto/ID.h"
+#include "thekogans/crypto/IDHashMap.h"
+#include "thekogans/crypto/Serializable.h"
+#include "thekogans/crypto/CipherSuite.h"
+#include "thekogans/crypto/Params.h"
+#include "thekogans/crypto/SymmetricKey.h"
+#include "thekogans/crypto/AsymmetricKey.h"
+#include "thekogans/crypto/Cipher.h"
+#include "thekogans/crypto/MAC.h"
+#include "thekogans/crypto/Authenticator.h"
+#include "thekogans/crypto/KeyRing.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        /// \brief
+        /// Lazy key ring file layout (all integers are network endian):
+        ///
+        /// +-------------------+
+        /// | LazyKeyRingHeader |
+        /// +-------------------+
+        /// | entry 0           |  \see{Cipher::Encrypt} (serialized \see{Serializable},
+        /// +-------------------+  associated data = type || id).
+        /// | ...               |
+        /// +-------------------+
+        /// | entry n - 1       |
+        /// +-------------------+
+        /// | index             |  \see{Cipher::Encrypt} (\see{CipherSuite}, n, LazyKeyRingEntryInfo [n]).
+        /// +-------------------+
+        /// | LazyKeyRingFooter |
+        /// +-------------------+
+        ///
+        /// Every entry is encrypted on it's own, so that it can be read and
+        /// decrypted independently of the others. Binding the type and id
+        /// to the entry ciphertext (associated data) detects entries that
+        /// were swapped around on disk.
+
+        /// \struct LazyKeyRingHeader LazyKeyRing.h thekogans/crypto/LazyKeyRing.h
+        ///
+        /// \brief
+        /// Identifies a lazy key ring file.
+        struct _LIB_THEKOGANS_CRYPTO_DECL LazyKeyRingHeader {
+            /// \enum
+            /// LazyKeyRingHeader constants.
+            enum {
+                /// \brief
+                /// "TKLR"
+                MAGIC = 0x544b4c52,
+                /// \brief
+                /// Current format version.
+                VERSION = 1,
+                /// \brief
+                /// Serialized header size.
+                SIZE = util::UI32_SIZE + util::UI16_SIZE
+            };
+
+            /// \brief
+            /// MAGIC.
+            util::ui32 magic;
+            /// \brief
+            /// VERSION.
+            util::ui16 version;
+
+            /// \brief
+            /// ctor.
+            LazyKeyRingHeader () :
+                magic (MAGIC),
+                version (VERSION) {}
+        };
+
+        /// \brief
+        /// Serialize a LazyKeyRingHeader.
+        /// \param[in] serializer Where to write the given header.
+        /// \param[in] header LazyKeyRingHeader to serialize.
+        /// \return serializer.
+        inline util::Serializer &operator << (
+                util::Serializer &serializer,
+                const LazyKeyRingHeader &header) {
+            serializer << header.magic << header.version;
+            return serializer;
+        }
+
+        /// \brief
+        /// Extract a LazyKeyRingHeader.
+        /// \param[in] serializer Where to read the header from.
+        /// \param[out] header Where to place the extracted header.
+        /// \return serializer.
+        inline util::Serializer &operator >> (
+                util::Serializer &serializer,
+                LazyKeyRingHeader &header) {
+            serializer >> header.magic >> header.version;
+            return serializer;
+        }
+
+        /// \struct LazyKeyRingEntryInfo LazyKeyRing.h thekogans/crypto/LazyKeyRing.h
+        ///
+        /// \brief
+        /// Index entry describing one encrypted entry.
+        struct _LIB_THEKOGANS_CRYPTO_DECL LazyKeyRingEntryInfo {
+            /// \enum
+            /// Entry types.
+            enum {
+                /// \brief
+                /// \see{KeyExchange} \see{Params}.
+                KEY_EXCHANGE_PARAMS,
+                /// \brief
+                /// \see{KeyExchange} \see{AsymmetricKey}.
+                KEY_EXCHANGE_KEY,
+                /// \brief
+                /// \see{Authenticator} \see{Params}.
+                AUTHENTICATOR_PARAMS,
+                /// \brief
+                /// \see{Authenticator} \see{AsymmetricKey}.
+                AUTHENTICATOR_KEY,
+                /// \brief
+                /// \see{Cipher} \see{SymmetricKey}.
+                CIPHER_KEY,
+                /// \brief
+                /// \see{MAC} \see{SymmetricKey}.
+                MAC_KEY,
+                /// \brief
+                /// User data \see{Serializable}.
+                USER_DATA,
+                /// \brief
+                /// Number of entry types.
+                TYPE_COUNT
+            };
+            /// \enum
+            /// LazyKeyRingEntryInfo constants.
+            enum {
+                /// \brief
+                /// Serialized entry info size.
+                SIZE = util::UI8_SIZE + ID::SIZE + util::UI64_SIZE + util::UI32_SIZE
+            };
+
+            /// \brief
+            /// Entry type.
+            util::ui8 type;
+            /// \brief
+            /// \see{ID} of the \see{Serializable} stored in the entry.
+            ID id;
+            /// \brief
+            /// File offset of the encrypted entry.
+            util::ui64 offset;
+            /// \brief
+            /// Length of the encrypted entry.
+            util::ui32 length;
+
+            /// \brief
+            /// ctor.
+            /// \param[in] type_ Entry type.
+            /// \param[in] id_ \see{ID} of the \see{Serializable} stored in the entry.
+            /// \param[in] offset_ File offset of the encrypted entry.
+            /// \param[in] length_ Length of the encrypted entry.
+            LazyKeyRingEntryInfo (
+                util::ui8 type_ = TYPE_COUNT,
+                const ID &id_ = ID::Empty,
+                util::ui64 offset_ = 0,
+                util::ui32 length_ = 0) :
+                type (type_),
+                id (id_),
+                offset (offset_),
+                length (length_) {}
+        };
+
+        /// \brief
+        /// Serialize a LazyKeyRingEntryInfo.
+        /// \param[in] serializer Where to write the given entry info.
+        /// \param[in] entryInfo LazyKeyRingEntryInfo to serialize.
+        /// \return serializer.
+        inline util::Serializer &operator << (
+                util::Serializer &serializer,
+                const LazyKeyRingEntryInfo &entryInfo) {
+            serializer << entryInfo.type << entryInfo.id << entryInfo.offset << entryInfo.length;
+            return serializer;
+        }
+
+        /// \brief
+        /// Extract a LazyKeyRingEntryInfo.
+        /// \param[in] serializer Where to read the entry info from.
+        /// \param[out] entryInfo Where to place the extracted entry info.
+        /// \return serializer.
+        inline util::Serializer &operator >> (
+                util::Serializer &serializer,
+                LazyKeyRingEntryInfo &entryInfo) {
+            serializer >> entryInfo.type >> entryInfo.id >> entryInfo.offset >> entryInfo.length;
+            if (entryInfo.type >= LazyKeyRingEntryInfo::TYPE_COUNT) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "Invalid entry type (%u)",
+                    entryInfo.type);
+            }
+            return serializer;
+        }
+
+        /// \struct LazyKeyRingFooter LazyKeyRing.h thekogans/crypto/LazyKeyRing.h
+        ///
+        /// \brief
+        /// Fixed size trailer used to locate the index.
+        struct _LIB_THEKOGANS_CRYPTO_DECL LazyKeyRingFooter {
+            /// \enum
+            /// LazyKeyRingFooter constants.
+            enum {
+                /// \brief
+                /// Serialized footer size.
+                SIZE = util::UI64_SIZE + util::UI32_SIZE + util::UI32_SIZE
+            };
+
+            /// \brief
+            /// File offset of the encrypted index.
+            util::ui64 indexOffset;
+            /// \brief
+            /// Length of the encrypted index.
+            util::ui32 indexLength;
+            /// \brief
+            /// LazyKeyRingHeader::MAGIC (so that the footer can be
+            /// recognized before the index is read).
+            util::ui32 magic;
+
+            /// \brief
+            /// ctor.
+            LazyKeyRingFooter () :
+                indexOffset (0),
+                indexLength (0),
+                magic (LazyKeyRingHeader::MAGIC) {}
+        };
+
+        /// \brief
+        /// Serialize a LazyKeyRingFooter.
+        /// \param[in] serializer Where to write the given footer.
+        /// \param[in] footer LazyKeyRingFooter to serialize.
+        /// \return serializer.
+        inline util::Serializer &operator << (
+                util::Serializer &serializer,
+                const LazyKeyRingFooter &footer) {
+            serializer << footer.indexOffset << footer.indexLength << footer.magic;
+            return serializer;
+        }
+
+        /// \brief
+        /// Extract a LazyKeyRingFooter.
+        /// \param[in] serializer Where to read the footer from.
+        /// \param[out] footer Where to place the extracted footer.
+        /// \return serializer.
+        inline util::Serializer &operator >> (
+                util::Serializer &serializer,
+                LazyKeyRingFooter &footer) {
+            serializer >> footer.indexOffset >> footer.indexLength >> footer.magic;
+            return serializer;
+        }
+
+        /// \struct LazyKeyRing LazyKeyRing.h thekogans/crypto/LazyKeyRing.h
+        ///
+        /// \brief
+        /// \see{KeyRing::Load} decrypts and deserializes the whole ring up front. For
+        /// large rings that means slow startup and a lot of secure memory. LazyKeyRing
+        /// opens a ring written by Save (above layout) and only decrypts the (small)
+        /// index. Params, keys and user data are decrypted and materialized on first
+        /// Get*, and kept in an LRU cache. Setting maxCachedEntries bounds the cache
+        /// (least recently used entries are evicted, along with the \see{Cipher},
+        /// \see{MAC} and \see{Authenticator} instances created for them). Evicted
+        /// entries are simply reloaded on their next Get*.
+        ///
+        /// Ex:
+        ///
+        /// \code{.cpp}
+        /// using namespace thekogans;
+        ///
+        /// // Once.
+        /// crypto::LazyKeyRing::Save (path, *keyRing, *masterCipher);
+        /// ...
+        /// // At startup.
+        /// crypto::LazyKeyRing::SharedPtr lazyKeyRing (
+        ///     new crypto::LazyKeyRing (path, masterCipher, 10000));
+        /// crypto::Cipher::SharedPtr cipher = lazyKeyRing->GetCipher (keyId);
+        /// \endcode
+        ///
+        /// NOTE: Save flattens the sub ring tree (entries with the same
+        /// type and id are written once). Like \see{KeyRing}, LazyKeyRing
+        /// is not thread safe.
+
+        struct _LIB_THEKOGANS_CRYPTO_DECL LazyKeyRing : public virtual util::RefCounted {
+            /// \brief
+            /// Declare \see{RefCounted} pointers.
+            THEKOGANS_UTIL_DECLARE_REF_COUNTED_POINTERS (LazyKeyRing)
+
+        private:
+            /// \brief
+            /// Lazy key ring file.
+            util::ReadOnlyFile file;
+            /// \brief
+            /// \see{Cipher} used to decrypt the index and the entries.
+            Cipher::SharedPtr cipher;
+            /// \brief
+            /// \see{CipherSuite} of the saved \see{KeyRing}.
+            CipherSuite cipherSuite;
+            /// \brief
+            /// Location of every entry (one map per entry type).
+            IDHashMap<LazyKeyRingEntryInfo> index[LazyKeyRingEntryInfo::TYPE_COUNT];
+            /// \struct LazyKeyRing::CacheEntry LazyKeyRing.h thekogans/crypto/LazyKeyRing.h
+            ///
+            /// \brief
+            /// Materialized entry.
+            struct CacheEntry {
+                /// \brief
+                /// Entry type.
+                util::ui8 type;
+                /// \brief
+                /// Deserialized entry.
+                Serializable::SharedPtr serializable;
+                /// \brief
+                /// \see{Cipher} created for a CIPHER_KEY entry.
+                Cipher::SharedPtr cipher;
+                /// \brief
+                /// \see{MAC} created for a MAC_KEY entry.
+                MAC::SharedPtr mac;
+                /// \brief
+                /// \see{Authenticator} created for an AUTHENTICATOR_KEY entry.
+                Authenticator::SharedPtr authenticator;
+
+                /// \brief
+                /// ctor.
+                /// \param[in] type_ Entry type.
+                /// \param[in] serializable_ Deserialized entry.
+                CacheEntry (
+                    util::ui8 type_,
+                    Serializable::SharedPtr serializable_) :
+                    type (type_),
+                    serializable (serializable_) {}
+            };
+            /// \brief
+            /// Convenient typedef for std::list<CacheEntry>.
+            typedef std::list<CacheEntry> CacheList;
+            /// \brief
+            /// Materialized entries (most recently used first).
+            CacheList cacheList;
+            /// \brief
+            /// Cached entries (one map per entry type).
+            IDHashMap<CacheList::iterator> cache[LazyKeyRingEntryInfo::TYPE_COUNT];
+            /// \brief
+            /// Max cached entries (0 = no limit).
+            std::size_t maxCachedEntries;
+
+        public:
+            /// \brief
+            /// ctor. Open a lazy key ring file and load it's index.
+            /// \param[in] path Lazy key ring file written by Save.
+            /// \param[in] cipher_ \see{Cipher} used to Save the file.
+            /// \param[in] maxCachedEntries_ Max materialized entries to keep (0 = no limit).
+            LazyKeyRing (
+                const std::string &path,
+                Cipher::SharedPtr cipher_,
+                std::size_t maxCachedEntries_ = 0);
+
+            /// \brief
+            /// Write the given \see{KeyRing} in the lazy key ring format.
+            /// \param[in] path File to write.
+            /// \param[in] keyRing \see{KeyRing} to write.
+            /// \param[in] cipher \see{Cipher} used to encrypt the index and the entries.
+            /// \param[in] recursive true = include the sub rings' entries.
+            static void Save (
+                const std::string &path,
+                const KeyRing &keyRing,
+                Cipher &cipher,
+                bool recursive = true);
+
+            /// \brief
+            /// Return the \see{CipherSuite} of the saved \see{KeyRing}.
+            /// \return \see{CipherSuite}.
+            inline const CipherSuite &GetCipherSuite () const {
+                return cipherSuite;
+            }
+            /// \brief
+            /// Return the number of entries of the given type.
+            /// \param[in] type LazyKeyRingEntryInfo type.
+            /// \return Number of entries of the given type.
+            std::size_t GetEntryCount (util::ui8 type) const;
+            /// \brief
+            /// Return the number of materialized entries.
+            /// \return Number of materialized entries.
+            inline std::size_t GetCachedEntryCount () const {
+                return cacheList.size ();
+            }
+            /// \brief
+            /// Set the max number of materialized entries (evicting as needed).
+            /// \param[in] maxCachedEntries_ Max materialized entries to keep (0 = no limit).
+            void SetMaxCachedEntries (std::size_t maxCachedEntries_);
+
+            /// \brief
+            /// Return the \see{KeyExchange} \see{Params} with the given \see{ID}.
+            /// \param[in] paramsId \see{ID} of \see{Params} to retrieve.
+            /// \return \see{Params} (0 = not found).
+            Params::SharedPtr GetKeyExchangeParams (const ID &paramsId);
+            /// \brief
+            /// Return the \see{KeyExchange} \see{AsymmetricKey} with the given \see{ID}.
+            /// \param[in] keyId \see{ID} of \see{AsymmetricKey} to retrieve.
+            /// \return \see{AsymmetricKey} (0 = not found).
+            AsymmetricKey::SharedPtr GetKeyExchangeKey (const ID &keyId);
+            /// \brief
+            /// Return the \see{Authenticator} \see{Params} with the given \see{ID}.
+            /// \param[in] paramsId \see{ID} of \see{Params} to retrieve.
+            /// \return \see{Params} (0 = not found).
+            Params::SharedPtr GetAuthenticatorParams (const ID &paramsId);
+            /// \brief
+            /// Return the \see{Authenticator} \see{AsymmetricKey} with the given \see{ID}.
+            /// \param[in] keyId \see{ID} of \see{AsymmetricKey} to retrieve.
+            /// \return \see{AsymmetricKey} (0 = not found).
+            AsymmetricKey::SharedPtr GetAuthenticatorKey (const ID &keyId);
+            /// \brief
+            /// Return the \see{Authenticator} for the key with the given \see{ID}.
+            /// \param[in] keyId \see{ID} of \see{Authenticator} \see{AsymmetricKey}.
+            /// \return \see{Authenticator} (0 = not found).
+            Authenticator::SharedPtr GetAuthenticator (const ID &keyId);
+            /// \brief
+            /// Return the \see{Cipher} \see{SymmetricKey} with the given \see{ID}.
+            /// \param[in] keyId \see{ID} of \see{SymmetricKey} to retrieve.
+            /// \return \see{SymmetricKey} (0 = not found).
+            SymmetricKey::SharedPtr GetCipherKey (const ID &keyId);
+            /// \brief
+            /// Return the \see{Cipher} for the key with the given \see{ID}.
+            /// \param[in] keyId \see{ID} of \see{Cipher} \see{SymmetricKey}.
+            /// \return \see{Cipher} (0 = not found).
+            Cipher::SharedPtr GetCipher (const ID &keyId);
+            /// \brief
+            /// Return the \see{MAC} \see{SymmetricKey} with the given \see{ID}.
+            /// \param[in] keyId \see{ID} of \see{SymmetricKey} to retrieve.
+            /// \return \see{SymmetricKey} (0 = not found).
+            SymmetricKey::SharedPtr GetMACKey (const ID &keyId);
+            /// \brief
+            /// Return the \see{MAC} for the key with the given \see{ID}.
+            /// \param[in] keyId \see{ID} of \see{MAC} \see{SymmetricKey}.
+            /// \return \see{MAC} (0 = not found).
+            MAC::SharedPtr GetMAC (const ID &keyId);
+            /// \brief
+            /// Return the user data with the given \see{ID}.
+            /// \param[in] id \see{ID} of user data to retrieve.
+            /// \return \see{Serializable} (0 = not found).
+            Serializable::SharedPtr GetUserData (const ID &id);
+
+            /// \brief
+            /// Evict a materialized entry.
+            /// \param[in] type LazyKeyRingEntryInfo type.
+            /// \param[in] id \see{ID} of entry to evict.
+            /// \return true = evicted, false = not cached.
+            bool Evict (
+                util::ui8 type,
+                const ID &id);
+            /// \brief
+            /// Evict all materialized entries.
+            void EvictAll ();
+
+        private:
+            /// \brief
+            /// Return the (materialized) entry with the given type and id.
+            /// \param[in] type LazyKeyRingEntryInfo type.
+            /// \param[in] id \see{ID} of entry to retrieve.
+            /// \return Cache entry (0 = not found).
+            CacheEntry *GetEntry (
+                util::ui8 type,
+                const ID &id);
+            /// \brief
+            /// Evict least recently used entries until the cache is within maxCachedEntries.
+            void Trim ();
+
+            /// \brief
+            /// LazyKeyRing is neither copy constructable, nor assignable.
+            THEKOGANS_CRYPTO_DISALLOW_COPY_AND_ASSIGN (LazyKeyRing)
+        };
+
+    } // namespace crypto
+} // namespace thekogans
+
+#endif // !defined (__thekogans_crypto_LazyKeyRing_h)
@@ -21,8 +21,13 @@
 #include <cstddef>
 #include "thekogans/util/Types.h"
 #include "thekogans/util/RefCounted.h"
+#include "thekogans/util/Allocator.h"
 #include "thekogans/util/Buffer.h"
 #include "thekogans/crypto/Config.h"
+#include "thekogans/crypto/ID.h"
+#include "thekogans/crypto/FrameHeader.h"
+#include "thekogans/crypto/Metrics.h"
+#include "thekogans/crypto/Stats.h"
 
 namespace thekogans {
     namespace crypto {
@@ -30,8 +35,8 @@ namespace thekogans {
         /// \struct MAC MAC.h thekogans/crypto/MAC.h
         ///
         /// \brief
-        /// MAC is a base class for \see{HMAC} and \see{CMAC}. It
-        /// implements Message Authentication Codes for \see{Cipher}.
+        /// MAC is a base class for \see{HMAC}, \see{CMAC}, \see{GMAC} and
+        /// \see{Poly1305}. It implements Message Authentication Codes for \see{Cipher}.
         /// NOTE: You can call SignBuffer and VerifyBufferSignature as
         /// many times as you need and in any order. MAC is designed to
         /// be reused. It will reset it's internal state after every
@@ -42,10 +47,60 @@ namespace thekogans {
             /// Declare \see{RefCounted} pointers.
             THEKOGANS_UTIL_DECLARE_REF_COUNTED_POINTERS (MAC)
 
+        protected:
+            /// \brief
+            /// Reports in to key's \see{Metrics::Entry} (set by \see{HMAC}/\see{CMAC}).
+            Metrics::Handle metrics;
+            /// \brief
+            /// MAC stats (one use per SignBuffer, VerifyBufferSignature included).
+            Stats stats;
+
+        public:
+            /// \enum
+            /// MAC types (see \see{CipherSuite::GetMAC} and \see{KeyRing::GetMAC}).
+            enum Type {
+                /// \brief
+                /// \see{HMAC}.
+                TYPE_HMAC,
+                /// \brief
+                /// \see{CMAC}.
+                TYPE_CMAC,
+                /// \brief
+                /// \see{GMAC}.
+                TYPE_GMAC,
+                /// \brief
+                /// \see{Poly1305}.
+                TYPE_POLY1305
+            };
+
             /// \brief
             /// dtor.
             virtual ~MAC () {}
 
+            /// \brief
+            /// Return the \see{Metrics::Handle} this MAC reports in to.
+            /// \return \see{Metrics::Handle} this MAC reports in to.
+            inline Metrics::Handle &GetMetrics () {
+                return metrics;
+            }
+            /// \brief
+            /// Return the reference to stats.
+            /// \return Reference to stats.
+            inline const Stats &GetStats () const {
+                return stats;
+            }
+            /// \brief
+            /// Return the reference to stats.
+            /// \return Reference to stats.
+            inline Stats &GetStats () {
+                return stats;
+            }
+
+            /// \brief
+            /// Return the MAC type.
+            /// \return MAC type.
+            virtual Type GetType () const = 0;
+
             /// \brief
             /// Return the length of the mac.
             /// \return Length of the mac.
@@ -55,6 +110,17 @@ namespace thekogans {
             /// Initialize the context (ctx) and get it ready for MAC generation.
             virtual void Init () = 0;
             /// \brief
+            /// Initialize the context (ctx) and get it ready to recompute the given
+            /// signature. Nonce based MACs (\see{GMAC}, \see{Poly1305}) carry their
+            /// nonce in the signature and pick it up here. The rest just call Init.
+            /// \param[in] signature Signature that will be verified.
+            /// \param[in] signatureLength Signature length.
+            virtual void InitVerify (
+                    const void * /*signature*/,
+                    std::size_t /*signatureLength*/) {
+                Init ();
+            }
+            /// \brief
             /// Call this method 1 or more times to generate a MAC.
             /// \param[in] buffer Buffer whose signature to create.
             /// \param[in] bufferLength Buffer length.
@@ -82,10 +148,13 @@ namespace thekogans {
             /// Create a buffer signature (MAC).
             /// \param[in] buffer Buffer whose signature to create.
             /// \param[in] bufferLength Buffer length.
+            /// \param[in] allocator Optional allocator for the returned buffer
+            /// (ex: \see{BufferPoolAllocator}, 0 = heap).
             /// \return Buffer signature.
             util::Buffer SignBuffer (
                 const void *buffer,
-                std::size_t bufferLength);
+                std::size_t bufferLength,
+                util::Allocator *allocator = 0);
             /// \brief
             /// Verify the given buffer signature (MAC).
             /// \param[in] buffer Buffer whose signature to verify.
@@ -98,6 +167,67 @@ namespace thekogans {
                 std::size_t bufferLength,
                 const void *signature,
                 std::size_t signatureLength);
+
+            /// \brief
+            /// Authenticate (but don't encrypt) and frame a buffer. The authenticate
+            /// only counterpart of \see{Cipher::EncryptAndFrame}, for traffic that
+            /// needs integrity but not confidentiality. It writes the following structure
+            /// in to frame:
+            ///
+            /// |----- \see{FrameHeader} -----|
+            /// +--------+-------------------+--------+-----+
+            /// | key id |  payload length   | buffer | mac |
+            /// +--------+-------------------+--------+-----+
+            /// |   32   |         4         | payload length |
+            ///
+            /// The mac covers the \see{FrameHeader} and the buffer.
+            /// \param[in] keyId \see{ID} of this MAC's key (see \see{KeyRing::GetMAC}).
+            /// \param[in] buffer Buffer to authenticate. Can be frame + FrameHeader::SIZE
+            /// (in place, the buffer is not copied).
+            /// \param[in] bufferLength Buffer length.
+            /// \param[out] frame Where to write the frame (at least
+            /// GetFrameLength (bufferLength) bytes).
+            /// \return Number of bytes written to frame.
+            std::size_t SignAndFrame (
+                const ID &keyId,
+                const void *buffer,
+                std::size_t bufferLength,
+                util::ui8 *frame);
+            /// \brief
+            /// Authenticate and frame a buffer. Allocates a buffer
+            /// and calls SignAndFrame above.
+            /// \param[in] keyId \see{ID} of this MAC's key (see \see{KeyRing::GetMAC}).
+            /// \param[in] buffer Buffer to authenticate.
+            /// \param[in] bufferLength Buffer length.
+            /// \param[in] allocator Optional allocator for the returned buffer
+            /// (ex: \see{BufferPoolAllocator}, 0 = heap).
+            /// \return Authenticated frame.
+            util::Buffer SignAndFrame (
+                const ID &keyId,
+                const void *buffer,
+                std::size_t bufferLength,
+                util::Allocator *allocator = 0);
+            /// \brief
+            /// Verify a frame produced by SignAndFrame. Nothing is copied,
+            /// buffer is set to point in to frame.
+            /// \param[in] frame Frame to verify. Use the \see{FrameHeader} key
+            /// id to pick the MAC (see \see{KeyRing::GetMAC}).
+            /// \param[in] frameLength Frame length.
+            /// \param[out] buffer If verified, the authenticated buffer.
+            /// \param[out] bufferLength If verified, the authenticated buffer length.
+            /// \return true == valid, false == invalid.
+            bool VerifyFrame (
+                const void *frame,
+                std::size_t frameLength,
+                const util::ui8 *&buffer,
+                std::size_t &bufferLength);
+            /// \brief
+            /// Return the length of the frame SignAndFrame will write.
+            /// \param[in] bufferLength Length of buffer to authenticate.
+            /// \return Frame length.
+            inline std::size_t GetFrameLength (std::size_t bufferLength) const {
+                return FrameHeader::SIZE + bufferLength + GetMACLength ();
+            }
         };
 
     } // namespace crypto
@@ -0,0 +1,381 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined (__thekogans_crypto_MappedKeyRing_h)
+#define __thekogans_crypto_MappedKeyRing_h
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+#include "thekogans/util/Types.h"
+#include "thekogans/util/RefCounted.h"
+#include "thekogans/util/Serializer.h"
+#include "thekogans/crypto/Config.h"
+#include "thekogans/crypto/ID.h"
+#include "thekogans/crypto/Serializable.h"
+#include "thekogans/crypto/CipherSuite.h"
+#include "thekogans/crypto/Params.h"
+#include "thekogans/crypto/SymmetricKey.h"
+#include "thekogans/crypto/AsymmetricKey.h"
+#include "thekogans/crypto/FileReader.h"
+#include "thekogans/crypto/KeyRing.h"
+#include "thekogans/crypto/LazyKeyRing.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        /// \brief
+        /// Memory mappable (v2) key ring layout (all integers are network endian):
+        ///
+        /// +---------------------+
+        /// | MappedKeyRingHeader |
+        /// +---------------------+
+        /// | entry record 0      |  MappedKeyRingRecord (fixed size), sorted by (id, type).
+        /// +---------------------+
+        /// | ...                 |
+        /// +---------------------+
+        /// | entry record n - 1  |
+        /// +---------------------+
+        /// | entry 0             |  util::Serializable binary form (header + body),
+        /// +---------------------+  read back through Read (Header, Serializer).
+        /// | ...                 |
+        /// +---------------------+
+        /// | entry n - 1         |
+        /// +---------------------+
+        ///
+        /// The record table is used in place: lookups binary search it straight
+        /// out of the mapping, and only the entry asked for is deserialized.
+        /// Entry types are the same as \see{LazyKeyRingEntryInfo}'s.
+        /// NOTE: Unlike \see{LazyKeyRing}, entries are not encrypted (the whole
+        /// point is to use them in place). Protect the file accordingly.
+
+        /// \struct MappedKeyRingHeader MappedKeyRing.h thekogans/crypto/MappedKeyRing.h
+        ///
+        /// \brief
+        /// Identifies a mappable key ring and locates it's record table.
+        struct _LIB_THEKOGANS_CRYPTO_DECL MappedKeyRingHeader {
+            /// \enum
+            /// MappedKeyRingHeader constants.
+            enum {
+                /// \brief
+                /// "TKR2"
+                MAGIC = 0x544b5232,
+                /// \brief
+                /// Current format version.
+                VERSION = 2
+            };
+
+            /// \brief
+            /// MAGIC.
+            util::ui32 magic;
+            /// \brief
+            /// VERSION.
+            util::ui16 version;
+            /// \brief
+            /// \see{CipherSuite} of the saved \see{KeyRing}.
+            CipherSuite cipherSuite;
+            /// \brief
+            /// Number of entry records.
+            util::ui64 entryCount;
+            /// \brief
+            /// File offset of the first entry record.
+            util::ui64 tableOffset;
+
+            /// \brief
+            /// ctor.
+            /// \param[in] cipherSuite_ \see{CipherSuite} of the saved \see{KeyRing}.
+            /// \param[in] entryCount_ Number of entry records.
+            explicit MappedKeyRingHeader (
+                const CipherSuite &cipherSuite_ = CipherSuite::Empty,
+                util::ui64 entryCount_ = 0) :
+                magic (MAGIC),
+                version (VERSION),
+                cipherSuite (cipherSuite_),
+                entryCount (entryCount_),
+                tableOffset (Size ()) {}
+
+            /// \brief
+            /// Return the serialized header size.
+            /// \return Serialized header size.
+            inline std::size_t Size () const {
+                return
+                    util::UI32_SIZE +
+                    util::UI16_SIZE +
+                    cipherSuite.Size () +
+                    util::UI64_SIZE +
+                    util::UI64_SIZE;
+            }
+        };
+
+        /// \brief
+        /// Serialize a MappedKeyRingHeader.
+        /// \param[in] serializer Where to write the given header.
+        /// \param[in] header MappedKeyRingHeader to serialize.
+        /// \return serializer.
+        inline util::Serializer &operator << (
+                util::Serializer &serializer,
+                const MappedKeyRingHeader &header) {
+            serializer <<
+                header.magic <<
+                header.version <<
+                header.cipherSuite <<
+                header.entryCount <<
+                header.tableOffset;
+            return serializer;
+        }
+
+        /// \brief
+        /// Extract a MappedKeyRingHeader.
+        /// \param[in] serializer Where to read the header from.
+        /// \param[out] header Where to place the extracted header.
+        /// \return serializer.
+        inline util::Serializer &operator >> (
+                util::Serializer &serializer,
+                MappedKeyRingHeader &header) {
+            serializer >>
+                header.magic >>
+                header.version >>
+                header.cipherSuite >>
+                header.entryCount >>
+                header.tableOffset;
+            return serializer;
+        }
+
+        /// \struct MappedKeyRingRecord MappedKeyRing.h thekogans/crypto/MappedKeyRing.h
+        ///
+        /// \brief
+        /// Fixed layout entry record. Records are used in place, so
+        /// the field offsets below are part of the format.
+        struct _LIB_THEKOGANS_CRYPTO_DECL MappedKeyRingRecord {
+            /// \enum
+            /// MappedKeyRingRecord constants.
+            enum {
+                /// \brief
+                /// Offset of the entry \see{ID}.
+                ID_OFFSET = 0,
+                /// \brief
+                /// Offset of the entry type (\see{LazyKeyRingEntryInfo}).
+                TYPE_OFFSET = ID_OFFSET + ID::SIZE,
+                /// \brief
+                /// Offset of the (ui32) entry length.
+                LENGTH_OFFSET = TYPE_OFFSET + 4,
+                /// \brief
+                /// Offset of the (ui64) file offset of the entry.
+                ENTRY_OFFSET = LENGTH_OFFSET + util::UI32_SIZE,
+                /// \brief
+                /// Record size.
+                SIZE = ENTRY_OFFSET + util::UI64_SIZE
+            };
+        };
+
+        /// \struct MappedKeyRing MappedKeyRing.h thekogans/crypto/MappedKeyRing.h
+        ///
+        /// \brief
+        /// Read only view of a key ring saved in the memory mappable (v2) format
+        /// (see above). Opening one maps the file (reading it in to memory if it
+        /// can't be mapped) and parses the header. That's it. The record table is
+        /// binary searched in place, and every Get* deserializes just the entry it
+        /// returns (through the regular \see{Serializable} machinery). Since the
+        /// view is immutable, MappedKeyRing is thread safe. Objects returned by
+        /// Get* are new instances owned by the caller.
+        ///
+        /// Ex:
+        ///
+        /// \code{.cpp}
+        /// using namespace thekogans;
+        ///
+        /// crypto::MappedKeyRing::Save (path, *keyRing);
+        /// ...
+        /// crypto::MappedKeyRing mappedKeyRing (path);
+        /// crypto::SymmetricKey::SharedPtr key = mappedKeyRing.GetCipherKey (keyId);
+        /// \endcode
+
+        struct _LIB_THEKOGANS_CRYPTO_DECL MappedKeyRing : public virtual util::RefCounted {
+            /// \brief
+            /// Declare \see{RefCounted} pointers.
+            THEKOGANS_UTIL_DECLARE_REF_COUNTED_POINTERS (MappedKeyRing)
+
+            /// \struct MappedKeyRing::ImageAllocator MappedKeyRing.h thekogans/crypto/MappedKeyRing.h
+            ///
+            /// \brief
+            /// Provides the memory the image is written to by Save (ImageAllocator...).
+            struct _LIB_THEKOGANS_CRYPTO_DECL ImageAllocator {
+                /// \brief
+                /// dtor.
+                virtual ~ImageAllocator () {}
+
+                /// \brief
+                /// Return size bytes to write the image to.
+                /// \param[in] size Image size.
+                /// \return Pointer to size writable bytes.
+                virtual util::ui8 *Allocate (util::ui64 size) = 0;
+            };
+
+        private:
+            /// \brief
+            /// Maps the file (0 == the view was given to the ctor).
+            std::unique_ptr<FileReader> reader;
+            /// \brief
+            /// File contents if it could not be mapped.
+            std::vector<util::ui8> buffer;
+            /// \brief
+            /// File contents (mapped or in buffer).
+            const util::ui8 *data;
+            /// \brief
+            /// File size.
+            util::ui64 size;
+            /// \brief
+            /// File header.
+            MappedKeyRingHeader header;
+            /// \brief
+            /// First record (in the file contents).
+            const util::ui8 *table;
+
+            /// \brief
+            /// Parse and validate the header.
+            /// \param[in] source Image name to use in error messages.
+            void ParseHeader (const std::string &source);
+
+        public:
+            /// \brief
+            /// ctor. Map the given file.
+            /// \param[in] path File written by Save.
+            explicit MappedKeyRing (const std::string &path);
+
+        protected:
+            /// \brief
+            /// ctor. Use an image already in memory. The memory is not
+            /// copied and must outlive the MappedKeyRing.
+            /// \param[in] data_ Image written by Save (ImageAllocator...).
+            /// \param[in] size_ Image size.
+            /// \param[in] source Image name to use in error messages.
+            MappedKeyRing (
+                const util::ui8 *data_,
+                util::ui64 size_,
+                const std::string &source);
+
+        public:
+
+            /// \brief
+            /// Write the given \see{KeyRing} in the memory mappable format.
+            /// \param[in] path File to write.
+            /// \param[in] keyRing \see{KeyRing} to write.
+            /// \param[in] recursive true = include the sub rings' entries
+            /// (entries with the same type and id are written once).
+            static void Save (
+                const std::string &path,
+                const KeyRing &keyRing,
+                bool recursive = true);
+            /// \brief
+            /// Write the given \see{KeyRing} in the memory mappable format
+            /// to memory provided by the given allocator.
+            /// \param[in] keyRing \see{KeyRing} to write.
+            /// \param[in] allocator Provides the memory to write the image to.
+            /// \param[in] recursive true = include the sub rings' entries
+            /// (entries with the same type and id are written once).
+            /// \return Image size.
+            static util::ui64 Save (
+                const KeyRing &keyRing,
+                ImageAllocator &allocator,
+                bool recursive = true);
+
+            /// \brief
+            /// Return true if the image is memory mapped (or was given to the ctor).
+            /// \return true == the image is memory mapped.
+            inline bool IsMapped () const {
+                return reader.get () == 0 || reader->IsMapped ();
+            }
+            /// \brief
+            /// Return the \see{CipherSuite} of the saved \see{KeyRing}.
+            /// \return \see{CipherSuite}.
+            inline const CipherSuite &GetCipherSuite () const {
+                return header.cipherSuite;
+            }
+            /// \brief
+            /// Return the number of entries.
+            /// \return Number of entries.
+            inline util::ui64 GetEntryCount () const {
+                return header.entryCount;
+            }
+
+            /// \brief
+            /// Locate the serialized entry with the given type and id (no copying).
+            /// \param[in] type \see{LazyKeyRingEntryInfo} type.
+            /// \param[in] id \see{ID} of entry to locate.
+            /// \param[out] entry Serialized entry (in the file contents).
+            /// \param[out] length Serialized entry length.
+            /// \return true = found, false = not found.
+            bool FindEntry (
+                util::ui8 type,
+                const ID &id,
+                const util::ui8 *&entry,
+                std::size_t &length) const;
+            /// \brief
+            /// Deserialize the entry with the given type and id.
+            /// \param[in] type \see{LazyKeyRingEntryInfo} type.
+            /// \param[in] id \see{ID} of entry to deserialize.
+            /// \return \see{Serializable} (0 = not found).
+            Serializable::SharedPtr GetEntry (
+                util::ui8 type,
+                const ID &id) const;
+
+            /// \brief
+            /// Return the \see{KeyExchange} \see{Params} with the given \see{ID}.
+            /// \param[in] paramsId \see{ID} of \see{Params} to retrieve.
+            /// \return \see{Params} (0 = not found).
+            Params::SharedPtr GetKeyExchangeParams (const ID &paramsId) const;
+            /// \brief
+            /// Return the \see{KeyExchange} \see{AsymmetricKey} with the given \see{ID}.
+            /// \param[in] keyId \see{ID} of \see{AsymmetricKey} to retrieve.
+            /// \return \see{AsymmetricKey} (0 = not found).
+            AsymmetricKey::SharedPtr GetKeyExchangeKey (const ID &keyId) const;
+            /// \brief
+            /// Return the \see{Authenticator} \see{Params} with the given \see{ID}.
+            /// \param[in] paramsId \see{ID} of \see{Params} to retrieve.
+            /// \return \see{Params} (0 = not found).
+            Params::SharedPtr GetAuthenticatorParams (const ID &paramsId) const;
+            /// \brief
+            /// Return the \see{Authenticator} \see{AsymmetricKey} with the given \see{ID}.
+            /// \param[in] keyId \see{ID} of \see{AsymmetricKey} to retrieve.
+            /// \return \see{AsymmetricKey} (0 = not found).
+            AsymmetricKey::SharedPtr GetAuthenticatorKey (const ID &keyId) const;
+            /// \brief
+            /// Return the \see{Cipher} \see{SymmetricKey} with the given \see{ID}.
+            /// \param[in] keyId \see{ID} of \see{SymmetricKey} to retrieve.
+            /// \return \see{SymmetricKey} (0 = not found).
+            SymmetricKey::SharedPtr GetCipherKey (const ID &keyId) const;
+            /// \brief
+            /// Return the \see{MAC} \see{SymmetricKey} with the given \see{ID}.
+            /// \param[in] keyId \see{ID} of \see{SymmetricKey} to retrieve.
+            /// \return \see{SymmetricKey} (0 = not found).
+            SymmetricKey::SharedPtr GetMACKey (const ID &keyId) const;
+            /// \brief
+            /// Return the user data with the given \see{ID}.
+            /// \param[in] id \see{ID} of user data to retrieve.
+            /// \return \see{Serializable} (0 = not found).
+            Serializable::SharedPtr GetUserData (const ID &id) const;
+
+            /// \brief
+            /// MappedKeyRing is neither copy constructable, nor assignable.
+            THEKOGANS_CRYPTO_DISALLOW_COPY_AND_ASSIGN (MappedKeyRing)
+        };
+
+    } // namespace crypto
+} // namespace thekogans
+
+#endif // !defined (__thekogans_crypto_MappedKeyRing_h)
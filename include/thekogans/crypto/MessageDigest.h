@@ -20,11 +20,15 @@
 
 #include <cstddef>
 #include <string>
+#include <vector>
 #include <openssl/evp.h>
 #include "thekogans/util/RefCounted.h"
+#include "thekogans/util/Allocator.h"
 #include "thekogans/util/Buffer.h"
 #include "thekogans/crypto/Config.h"
 #include "thekogans/crypto/OpenSSLUtils.h"
+#include "thekogans/crypto/FileReader.h"
+#include "thekogans/crypto/Stats.h"
 
 namespace thekogans {
     namespace crypto {
@@ -50,6 +54,9 @@ namespace thekogans {
             /// \brief
             /// EVP_MD_CTX wrapper.
             MDContext ctx;
+            /// \brief
+            /// Digest stats (one use per Update, one per HashBatch buffer).
+            Stats stats;
 
             /// \brief
             /// \see{OpenSSLSigner} needs access to md and ctx.
@@ -59,6 +66,12 @@ namespace thekogans {
             friend struct OpenSSLVerifier;
 
         public:
+            enum {
+                /// \brief
+                /// Default leaf length used by HashBufferTree/HashFileTree.
+                DEFAULT_TREE_LEAF_LENGTH = 1024 * 1024
+            };
+
             /// \brief
             /// ctor.
             /// \param[in] md_ OpenSSL message digest to use.
@@ -81,6 +94,18 @@ namespace thekogans {
             inline std::size_t GetDigestLength () const {
                 return GetMDLength (md);
             }
+            /// \brief
+            /// Return the reference to stats.
+            /// \return Reference to stats.
+            inline const Stats &GetStats () const {
+                return stats;
+            }
+            /// \brief
+            /// Return the reference to stats.
+            /// \return Reference to stats.
+            inline Stats &GetStats () {
+                return stats;
+            }
 
             // NOTE: This is the low level API used by HashBuffer/HashFile below.
             // It exists so that you can compute a message digest over multiple
@@ -103,19 +128,147 @@ namespace thekogans {
             /// \return Number of bytes written to digest.
             std::size_t Final (util::ui8 *digest);
 
+            // NOTE: Clone/CopyState snapshot the state of a digest computation
+            // in progress (EVP_MD_CTX_copy_ex). Use them to hash a common prefix
+            // once and finish it with many different suffixes. \see{Signer::SavePrefix}
+            // and \see{Verifier::SavePrefix} do the same for signatures.
+
+            /// \brief
+            /// Return a copy of this message digest, including the state
+            /// of the digest computation in progress.
+            /// \return A copy of this message digest.
+            SharedPtr Clone () const;
+            /// \brief
+            /// Replace the state of this message digest with that of the given one.
+            /// \param[in] messageDigest MessageDigest whose state to copy
+            /// (must use the same algorithm).
+            void CopyState (const MessageDigest &messageDigest);
+
             /// \brief
             /// Create a buffer hash (message digest).
             /// \param[in] buffer Buffer whose hash to create.
             /// \param[in] bufferLength Buffer length.
+            /// \param[in] allocator Optional allocator for the returned buffer
+            /// (ex: \see{BufferPoolAllocator}, 0 = heap).
             /// \return Buffer hash.
             util::Buffer HashBuffer (
                 const void *buffer,
-                std::size_t bufferLength);
+                std::size_t bufferLength,
+                util::Allocator *allocator = 0);
             /// \brief
             /// Create a file hash (message digest).
             /// \param[in] path File whose hash to create.
+            /// \param[in] map true == memory map the file (see \see{FileReader}).
+            /// \param[in] readBlockSize Read size used if the file is not mapped.
             /// \return File hash.
-            util::Buffer HashFile (const std::string &path);
+            util::Buffer HashFile (
+                const std::string &path,
+                bool map = true,
+                std::size_t readBlockSize = FileReader::DEFAULT_READ_BLOCK_SIZE);
+            /// \brief
+            /// Create a file hash (message digest) from an open \see{FileReader}.
+            /// Use this overload to hash in read ahead mode (ex:
+            /// FileReader (path, false, FileReader::DEFAULT_READ_AHEAD_BLOCK_SIZE,
+            /// FileReader::DEFAULT_READ_AHEAD_BLOCK_COUNT)) and to get the
+            /// throughput statistics (\see{FileReader::GetStats}).
+            /// \param[in] file File whose (remaining) contents to hash.
+            /// \return File hash.
+            util::Buffer HashFile (FileReader &file);
+
+            // NOTE: HashBatch hashes count independent buffers. For SHA-224/256/384/512
+            // the buffers are hashed in parallel SIMD lanes (\see{SHA2MultiBuffer}).
+            // Other digests, and cpus without a vector kernel, hash them one at a
+            // time. Either way the results are identical to calling HashBuffer on
+            // each buffer. Unlike HashBuffer, empty buffers are allowed. Batches
+            // of small buffers (IDs, key material) benefit the most.
+
+            /// \brief
+            /// Hash count independent buffers.
+            /// \param[in] buffers Buffers to hash.
+            /// \param[in] bufferLengths Buffer lengths.
+            /// \param[in] count Number of buffers.
+            /// \param[out] digests Where to put count * GetDigestLength () bytes
+            /// of digests (in buffer order).
+            void HashBatch (
+                const void * const *buffers,
+                const std::size_t *bufferLengths,
+                std::size_t count,
+                util::ui8 *digests);
+            /// \brief
+            /// Hash count independent buffers.
+            /// \param[in] buffers Buffers to hash.
+            /// \param[in] bufferLengths Buffer lengths.
+            /// \param[in] count Number of buffers.
+            /// \param[in] allocator Optional allocator for the returned buffers
+            /// (ex: \see{BufferPoolAllocator}, 0 = heap).
+            /// \return Buffer hashes (in buffer order).
+            std::vector<util::Buffer> HashBatch (
+                const void * const *buffers,
+                const std::size_t *bufferLengths,
+                std::size_t count,
+                util::Allocator *allocator = 0);
+
+            // NOTE: HashBufferTree/HashFileTree implement a tree hash mode
+            // that scales with the number of cores. The input is split in to
+            // leafLength leaves which are hashed in parallel (each leaf hash
+            // is H (0x00 || leaf)). The root hash is then computed as:
+            // H (0x01 || leaf hash 0 || ... || leaf hash n-1 ||
+            //    BE64 (leafLength) || BE64 (total length)).
+            // The result is therefore different from HashBuffer/HashFile,
+            // and depends on leafLength. Both sides need to agree on it.
+
+            /// \brief
+            /// Create a buffer tree hash (see NOTE above).
+            /// \param[in] buffer Buffer whose hash to create.
+            /// \param[in] bufferLength Buffer length.
+            /// \param[in] leafLength Leaf length.
+            /// \param[in] workerCount Number of hashing threads (0 == one per cpu).
+            /// \param[in] allocator Optional allocator for the returned buffer
+            /// (ex: \see{BufferPoolAllocator}, 0 = heap).
+            /// \return Buffer tree hash.
+            util::Buffer HashBufferTree (
+                const void *buffer,
+                std::size_t bufferLength,
+                std::size_t leafLength = DEFAULT_TREE_LEAF_LENGTH,
+                std::size_t workerCount = 0,
+                util::Allocator *allocator = 0);
+            /// \brief
+            /// Create a file tree hash (see NOTE above).
+            /// \param[in] path File whose hash to create.
+            /// \param[in] leafLength Leaf length.
+            /// \param[in] workerCount Number of hashing threads (0 == one per cpu).
+            /// \param[in] map true == memory map the file (see \see{FileReader}).
+            /// \param[out] leafHashes If not 0, the leaf hashes (in file order)
+            /// are appended here (see \see{FileManifest}).
+            /// \return File tree hash.
+            util::Buffer HashFileTree (
+                const std::string &path,
+                std::size_t leafLength = DEFAULT_TREE_LEAF_LENGTH,
+                std::size_t workerCount = 0,
+                bool map = true,
+                std::vector<util::ui8> *leafHashes = 0);
+            /// \brief
+            /// Compute a single leaf hash, H (0x00 || leaf) (see NOTE above).
+            /// \param[in] leaf Leaf to hash.
+            /// \param[in] leafLength Length of the given leaf.
+            /// \param[out] digest Where to write the leaf hash.
+            /// \return Number of bytes written to digest.
+            std::size_t HashTreeLeaf (
+                const void *leaf,
+                std::size_t leafLength,
+                util::ui8 *digest);
+            /// \brief
+            /// Compute the tree hash from its leaf hashes (see NOTE above).
+            /// \param[in] leafHashes Leaf hashes (in order).
+            /// \param[in] leafHashesLength Combined length of the leaf hashes.
+            /// \param[in] leafLength Leaf length.
+            /// \param[in] totalLength Length of the hashed input.
+            /// \return Tree hash.
+            util::Buffer HashTreeRoot (
+                const void *leafHashes,
+                std::size_t leafHashesLength,
+                util::ui64 leafLength,
+                util::ui64 totalLength);
 
             /// \brief
             /// MessageDigest is neither copy constructable, nor assignable.
@@ -0,0 +1,255 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined (__thekogans_crypto_Metrics_h)
+#define __thekogans_crypto_Metrics_h
+
+#include <cstddef>
+#include <atomic>
+#include <string>
+#include <vector>
+#include "thekogans/util/Types.h"
+#include "thekogans/util/RefCounted.h"
+#include "thekogans/crypto/Config.h"
+#include "thekogans/crypto/ID.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        /// \struct Metrics Metrics.h thekogans/crypto/Metrics.h
+        ///
+        /// \brief
+        /// Metrics is a process wide registry of per key operation counters.
+        /// Every \see{Cipher}, \see{MAC}, \see{Signer} and \see{Verifier} reports
+        /// in to the \see{Metrics::Entry} of its key (shared by every component
+        /// using the same key) through a \see{Metrics::Handle}. Entries outlive
+        /// the components so that counters are monotonic (as Prometheus expects);
+        /// call \see{Prune} to drop the entries of keys no component uses any more. \see{KeyRing} labels the entries
+        /// of the keys it hands out ciphers for with its id and \see{CipherSuite},
+        /// so that \see{GetSnapshot} can aggregate by key, key ring or suite.
+        /// \see{ToOpenMetrics} exports the per key counters in Prometheus/OpenMetrics
+        /// text format (use sum by (ring) or sum by (suite) to aggregate).
+        /// Updating an entry is a pair of relaxed atomic adds.
+
+        struct _LIB_THEKOGANS_CRYPTO_DECL Metrics {
+            /// \enum
+            /// Counted operations.
+            enum Operation {
+                /// \brief
+                /// \see{Cipher} encrypt.
+                OPERATION_ENCRYPT,
+                /// \brief
+                /// \see{Cipher} decrypt.
+                OPERATION_DECRYPT,
+                /// \brief
+                /// \see{MAC} sign/verify.
+                OPERATION_MAC,
+                /// \brief
+                /// \see{Signer} Final.
+                OPERATION_SIGN,
+                /// \brief
+                /// \see{Verifier} Final.
+                OPERATION_VERIFY,
+                /// \brief
+                /// Number of operations.
+                OPERATION_COUNT
+            };
+            /// \enum
+            /// \see{GetSnapshot} aggregation.
+            enum GroupBy {
+                /// \brief
+                /// One sample per key.
+                GROUP_BY_KEY,
+                /// \brief
+                /// One sample per key ring (keys without a ring are grouped together).
+                GROUP_BY_RING,
+                /// \brief
+                /// One sample per \see{CipherSuite} (code).
+                GROUP_BY_SUITE
+            };
+
+            /// \struct Metrics::Entry Metrics.h thekogans/crypto/Metrics.h
+            ///
+            /// \brief
+            /// Counters for all the components using a given key.
+            struct _LIB_THEKOGANS_CRYPTO_DECL Entry : public virtual util::RefCounted {
+                /// \brief
+                /// Declare \see{RefCounted} pointers.
+                THEKOGANS_UTIL_DECLARE_REF_COUNTED_POINTERS (Entry)
+
+                /// \brief
+                /// Key id.
+                const ID keyId;
+
+            private:
+                /// \brief
+                /// Number of operations.
+                std::atomic<util::ui64> counts[OPERATION_COUNT];
+                /// \brief
+                /// Number of bytes processed.
+                std::atomic<util::ui64> byteCounts[OPERATION_COUNT];
+                /// \brief
+                /// Id of the \see{KeyRing} the key belongs to
+                /// (set by \see{Metrics::SetLabels}, under the registry lock).
+                ID ringId;
+                /// \brief
+                /// \see{CipherSuite::GetCode} of the ring (0 == unknown).
+                util::ui16 suite;
+                /// \brief
+                /// Number of \see{Handle}s referencing this entry.
+                std::atomic<util::ui32> handleCount;
+
+            public:
+                /// \brief
+                /// ctor.
+                /// \param[in] keyId_ Key id.
+                explicit Entry (const ID &keyId_);
+
+                /// \brief
+                /// Count a single operation.
+                /// \param[in] operation Operation to count.
+                /// \param[in] byteCount Number of bytes processed.
+                inline void Update (
+                        Operation operation,
+                        std::size_t byteCount) {
+                    counts[operation].fetch_add (1, std::memory_order_relaxed);
+                    byteCounts[operation].fetch_add (byteCount, std::memory_order_relaxed);
+                }
+
+                /// \brief
+                /// Metrics manages the labels.
+                friend struct Metrics;
+
+                /// \brief
+                /// Entry is neither copy constructable, nor assignable.
+                THEKOGANS_CRYPTO_DISALLOW_COPY_AND_ASSIGN (Entry)
+            };
+
+            /// \struct Metrics::Handle Metrics.h thekogans/crypto/Metrics.h
+            ///
+            /// \brief
+            /// Components hold a Handle to their key's entry.
+            struct _LIB_THEKOGANS_CRYPTO_DECL Handle {
+            private:
+                /// \brief
+                /// Entry (null == not reporting).
+                Entry::SharedPtr entry;
+
+            public:
+                /// \brief
+                /// ctor. Create an empty (not reporting) handle.
+                Handle () {}
+                /// \brief
+                /// ctor.
+                /// \param[in] keyId Id of the key whose entry to report in to.
+                explicit Handle (const ID &keyId);
+                /// \brief
+                /// dtor.
+                ~Handle ();
+
+                /// \brief
+                /// Report in to a different key's entry.
+                /// \param[in] keyId Id of the key whose entry to report in to.
+                void Reset (const ID &keyId);
+
+                /// \brief
+                /// Count a single operation.
+                /// \param[in] operation Operation to count.
+                /// \param[in] byteCount Number of bytes processed.
+                inline void Update (
+                        Operation operation,
+                        std::size_t byteCount) {
+                    if (entry.Get () != 0) {
+                        entry->Update (operation, byteCount);
+                    }
+                }
+
+                /// \brief
+                /// Handle is neither copy constructable, nor assignable.
+                THEKOGANS_CRYPTO_DISALLOW_COPY_AND_ASSIGN (Handle)
+            };
+
+            /// \struct Metrics::Sample Metrics.h thekogans/crypto/Metrics.h
+            ///
+            /// \brief
+            /// A point in time copy of (aggregated) entry counters.
+            struct Sample {
+                /// \brief
+                /// Key id (GROUP_BY_KEY only).
+                ID keyId;
+                /// \brief
+                /// Key ring id (GROUP_BY_KEY and GROUP_BY_RING).
+                ID ringId;
+                /// \brief
+                /// \see{CipherSuite::GetCode} (GROUP_BY_KEY and GROUP_BY_SUITE).
+                util::ui16 suite;
+                /// \brief
+                /// Number of operations.
+                util::ui64 counts[OPERATION_COUNT];
+                /// \brief
+                /// Number of bytes processed.
+                util::ui64 byteCounts[OPERATION_COUNT];
+
+                /// \brief
+                /// ctor.
+                Sample ();
+            };
+
+            /// \brief
+            /// Return the entry for the given key (create it if it doesn't exist).
+            /// \param[in] keyId Key id.
+            /// \return Entry for the given key.
+            static Entry::SharedPtr GetEntry (const ID &keyId);
+            /// \brief
+            /// Label the given key's entry with its key ring and cipher suite.
+            /// \param[in] keyId Key id.
+            /// \param[in] ringId Id of the \see{KeyRing} the key belongs to.
+            /// \param[in] suite \see{CipherSuite::GetCode} of the key ring.
+            static void SetLabels (
+                const ID &keyId,
+                const ID &ringId,
+                util::ui16 suite);
+            /// \brief
+            /// Return a snapshot of the counters.
+            /// \param[in] groupBy How to aggregate the entries.
+            /// \return Snapshot of the counters.
+            static std::vector<Sample> GetSnapshot (GroupBy groupBy = GROUP_BY_KEY);
+            /// \brief
+            /// Remove the entries no \see{Handle} references.
+            /// NOTE: Their counters are lost (and restart from 0 if the key comes back).
+            /// \return Number of entries removed.
+            static std::size_t Prune ();
+            /// \brief
+            /// Return the name of the given operation ("encrypt", "sign"...).
+            /// \param[in] operation Operation whose name to return.
+            /// \return Operation name.
+            static const char *OperationToString (Operation operation);
+            /// \brief
+            /// Return the per key counters in OpenMetrics text format. Ex:
+            /// # TYPE thekogans_crypto_operations counter
+            /// thekogans_crypto_operations_total{key="...",ring="...",suite="...",operation="encrypt"} 2
+            /// # TYPE thekogans_crypto_bytes counter
+            /// thekogans_crypto_bytes_total{key="...",ring="...",suite="...",operation="encrypt"} 48
+            /// # EOF
+            /// \return OpenMetrics text.
+            static std::string ToOpenMetrics ();
+        };
+
+    } // namespace crypto
+} // namespace thekogans
+
+#endif // !defined (__thekogans_crypto_Metrics_h)
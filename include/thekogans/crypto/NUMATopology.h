@@ -0,0 +1,182 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined (__thekogans_crypto_NUMATopology_h)
+#define __thekogans_crypto_NUMATopology_h
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "thekogans/util/Types.h"
+#include "thekogans/crypto/Config.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        /// \struct NUMATopology NUMATopology.h thekogans/crypto/NUMATopology.h
+        ///
+        /// \brief
+        /// NUMATopology describes the NUMA nodes (sockets) of the host and provides
+        /// the placement primitives used by the NUMA aware worker pools
+        /// (\see{BlockPipeline::SetNUMAAware}, \see{AsyncEngine}) and per node
+        /// buffer pools (\see{BufferPoolAllocator::NodeInstance}): pinning a thread
+        /// to a node's cpus, finding the node that owns a page and binding memory
+        /// to a node. On Linux the topology comes from /sys/devices/system/node.
+        /// Elsewhere (or if sysfs is not available) the host is described as a
+        /// single node containing every cpu and the placement primitives do nothing.
+
+        struct _LIB_THEKOGANS_CRYPTO_DECL NUMATopology {
+            /// \enum
+            /// NUMATopology constants.
+            enum {
+                /// \brief
+                /// Unknown (or no) node.
+                NO_NODE = -1
+            };
+
+            /// \struct NUMATopology::NodeStats NUMATopology.h thekogans/crypto/NUMATopology.h
+            ///
+            /// \brief
+            /// Per node worker pool statistics (see \see{BlockPipeline::GetNodeStats}
+            /// and \see{AsyncEngine::GetNodeStats}).
+            struct _LIB_THEKOGANS_CRYPTO_DECL NodeStats {
+                /// \brief
+                /// Node.
+                std::size_t node;
+                /// \brief
+                /// Number of workers pinned to the node.
+                std::size_t workerCount;
+                /// \brief
+                /// Number of jobs (blocks) processed by the node's workers.
+                util::ui64 jobCount;
+                /// \brief
+                /// Number of jobs the node's workers took from another node's queue.
+                util::ui64 remoteJobCount;
+                /// \brief
+                /// Number of input bytes processed by the node's workers.
+                util::ui64 byteCount;
+                /// \brief
+                /// Seconds the node's workers spent processing jobs.
+                util::f64 busySeconds;
+
+                /// \brief
+                /// ctor.
+                /// \param[in] node_ Node.
+                explicit NodeStats (std::size_t node_ = 0) :
+                    node (node_),
+                    workerCount (0),
+                    jobCount (0),
+                    remoteJobCount (0),
+                    byteCount (0),
+                    busySeconds (0.0) {}
+
+                /// \brief
+                /// Return the average worker throughput (bytes per busy second).
+                /// Multiply by workerCount for the node throughput.
+                /// \return Average worker throughput in bytes/second.
+                inline util::f64 GetThroughput () const {
+                    return busySeconds > 0.0 ? byteCount / busySeconds : 0.0;
+                }
+            };
+
+        private:
+            /// \brief
+            /// OS ids of the nodes (they need not be contiguous).
+            std::vector<int> nodeIds;
+            /// \brief
+            /// Cpus of every node.
+            std::vector<std::vector<std::size_t>> nodeCPUs;
+            /// \brief
+            /// Node of every cpu (NO_NODE == unknown).
+            std::vector<int> cpuNodes;
+
+        public:
+            /// \brief
+            /// Return the (lazily discovered) host topology.
+            /// \return Host topology.
+            static const NUMATopology &Instance ();
+
+            /// \brief
+            /// Return the number of nodes (>= 1).
+            /// \return Number of nodes.
+            inline std::size_t GetNodeCount () const {
+                return nodeCPUs.size ();
+            }
+            /// \brief
+            /// Return true if the host has more than one node.
+            /// \return true == the host has more than one node.
+            inline bool IsNUMA () const {
+                return nodeCPUs.size () > 1;
+            }
+            /// \brief
+            /// Return the cpus of the given node.
+            /// \param[in] node Node [0, GetNodeCount ()).
+            /// \return Cpus of the given node.
+            const std::vector<std::size_t> &GetNodeCPUs (std::size_t node) const;
+            /// \brief
+            /// Return the node of the given cpu.
+            /// \param[in] cpu Cpu.
+            /// \return Node of the given cpu (NO_NODE == unknown).
+            int GetCPUNode (std::size_t cpu) const;
+            /// \brief
+            /// Return the node the calling thread is running on.
+            /// \return Node the calling thread is running on (0 if unknown).
+            std::size_t GetCurrentNode () const;
+            /// \brief
+            /// Return the node owning the page containing the given address.
+            /// NOTE: This is a system call. Pages that were never touched have no node.
+            /// \param[in] address Address to look up.
+            /// \return Node owning the page (NO_NODE == unknown, or not yet faulted in).
+            int GetAddressNode (const void *address) const;
+
+            /// \brief
+            /// Pin the calling thread to the cpus of the given node.
+            /// \param[in] node Node [0, GetNodeCount ()).
+            /// \return true == pinned, false == not supported (or refused by the OS).
+            bool BindCurrentThread (std::size_t node) const;
+            /// \brief
+            /// Place the pages wholly contained in the given range on the given
+            /// node (moving them if they were already faulted in elsewhere).
+            /// Partial pages are left alone (they are shared with other blocks).
+            /// \param[in] address Start of range.
+            /// \param[in] length Range length.
+            /// \param[in] node Node [0, GetNodeCount ()).
+            /// \return true == bound, false == nothing to bind, or not supported.
+            bool BindMemory (
+                const void *address,
+                std::size_t length,
+                std::size_t node) const;
+
+            /// \brief
+            /// Return a human readable description of the topology.
+            /// \return "node 0: 0-15, node 1: 16-31"...
+            std::string ToString () const;
+
+        private:
+            /// \brief
+            /// ctor. Discover the topology.
+            NUMATopology ();
+
+            /// \brief
+            /// NUMATopology is neither copy constructable, nor assignable.
+            THEKOGANS_CRYPTO_DISALLOW_COPY_AND_ASSIGN (NUMATopology)
+        };
+
+    } // namespace crypto
+} // namespace thekogans
+
+#endif // !defined (__thekogans_crypto_NUMATopology_h)
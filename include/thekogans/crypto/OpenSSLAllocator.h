@@ -22,6 +22,7 @@
 #include "thekogans/util/Allocator.h"
 #include "thekogans/util/Exception.h"
 #include "thekogans/crypto/Config.h"
+#include "thekogans/crypto/ThreadCacheAllocator.h"
 
 namespace thekogans {
     namespace crypto {
@@ -68,17 +69,18 @@ namespace thekogans {
         };
 
         /// \def THEKOGANS_CRYPTO_IMPLEMENT_OPEN_SSL_ALLOCATOR_FUNCTIONS(type)
-        /// Macro to implement OpenSSLAllocator functions.
+        /// Macro to implement OpenSSLAllocator functions. Blocks are cached
+        /// per thread by \see{ThreadCacheAllocator::OpenSSLInstance}.
         #define THEKOGANS_CRYPTO_IMPLEMENT_OPEN_SSL_ALLOCATOR_FUNCTIONS(type)\
         void *type::operator new (std::size_t size) {\
             assert (size == sizeof (type));\
-            return thekogans::crypto::OpenSSLAllocator::Global.Alloc (size);\
+            return thekogans::crypto::ThreadCacheAllocator::OpenSSLInstance ().Alloc (size);\
         }\
         void *type::operator new (\
                 std::size_t size,\
                 std::nothrow_t) throw () {\
             assert (size == sizeof (type));\
-            return thekogans::crypto::OpenSSLAllocator::Global.Alloc (size);\
+            return thekogans::crypto::ThreadCacheAllocator::OpenSSLInstance ().Alloc (size);\
         }\
         void *type::operator new (\
                 std::size_t size,\
@@ -87,12 +89,12 @@ namespace thekogans {
             return ptr;\
         }\
         void type::operator delete (void *ptr) {\
-            thekogans::crypto::OpenSSLAllocator::Global.Free (ptr, sizeof (type));\
+            thekogans::crypto::ThreadCacheAllocator::OpenSSLInstance ().Free (ptr, sizeof (type));\
         }\
         void type::operator delete (\
                 void *ptr,\
                 std::nothrow_t) throw () {\
-            thekogans::crypto::OpenSSLAllocator::Global.Free (ptr, sizeof (type));\
+            thekogans::crypto::ThreadCacheAllocator::OpenSSLInstance ().Free (ptr, sizeof (type));\
         }\
         void type::operator delete (\
             void *,\
@@ -57,6 +57,12 @@ namespace thekogans {
             /// \see{RSA} needs access to key.
             friend struct RSA;
             /// \brief
+            /// \see{RSAEncryptor} needs access to key.
+            friend struct RSAEncryptor;
+            /// \brief
+            /// \see{RSADecryptor} needs access to key.
+            friend struct RSADecryptor;
+            /// \brief
             /// \see{DHEKeyExchange} needs access to key.
             friend struct DHEKeyExchange;
 
@@ -226,6 +232,10 @@ namespace thekogans {
             virtual const char *GetKeyType () const override {
                 return EVP_PKEYtypeTostring (EVP_PKEY_base_id (key.get ()));
             }
+            /// \brief
+            /// Return the interned key type id.
+            /// \return Interned key type id.
+            virtual util::ui32 GetKeyTypeId () const override;
 
             /// \brief
             /// Return the key length (in bits).
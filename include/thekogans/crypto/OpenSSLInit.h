@@ -18,8 +18,12 @@
 #if !defined (__thekogans_crypto_OpenSSLInit_h)
 #define __thekogans_crypto_OpenSSLInit_h
 
+#include <string>
+#include <vector>
+#include <openssl/evp.h>
 #include <openssl/engine.h>
 #include "thekogans/util/Types.h"
+#include "thekogans/util/RefCounted.h"
 #include "thekogans/crypto/Config.h"
 
 namespace thekogans {
@@ -31,6 +35,31 @@ namespace thekogans {
         /// OpenSSLInit encapsulates the details of initializing the OpenSSL
         /// library. Instantiate one of these before making any calls in to
         /// the library proper.
+        ///
+        /// By default every OpenSSL cipher and digest is registered and the
+        /// error strings are loaded up front. Short lived processes (CLI tools)
+        /// can pass a \see{Profile} listing only the ciphers and digests they
+        /// need. Everything else is registered on first lookup through
+        /// \see{CipherSuite::GetOpenSSLCipherByName} and
+        /// \see{CipherSuite::GetOpenSSLMessageDigestByName}, and the error strings
+        /// are loaded by the first \see{OpenSSLException}.
+        ///
+        /// Gathering entropyNeeded bytes of seed can stall for seconds on freshly
+        /// booted VMs and containers. Pass seedAsync = true to return right away
+        /// and seed the OpenSSL PRNG on a background thread. Paths that draw on
+        /// the OpenSSL PRNG (key and params generation, signing, RSA encryption)
+        /// call \see{WaitForSeed} and block only if seeding hasn't finished yet.
+        /// \see{ID}, \see{SymmetricKey::FromRandom} and IVs come from
+        /// \see{BufferedRandomSource} (\see{util::GlobalRandomSource}) and never
+        /// wait for it.
+        ///
+        /// Hardware offload: engine is the default ENGINE (0 == software) handed
+        /// to every EVP init call. \see{SetEngine} (and \see{CipherSuite::SetEngine})
+        /// override it per algorithm (OpenSSL NID), so that, for example, RSA and
+        /// ECDSA go to an accelerator card while AES stays on AES-NI. Code that
+        /// creates EVP contexts gets its engine from \see{GetEngine}. See
+        /// \see{AsyncEngine} for keeping large numbers of offloaded operations
+        /// in flight.
 
         struct _LIB_THEKOGANS_CRYPTO_DECL OpenSSLInit {
             /// \brief
@@ -54,6 +83,55 @@ namespace thekogans {
                 /// your needs.
                 DEFAULT_WORKING_SET_SIZE = 1024 * 1024
             };
+
+            /// \struct OpenSSLInit::Profile OpenSSLInit.h thekogans/crypto/OpenSSLInit.h
+            ///
+            /// \brief
+            /// Lists the algorithms to register at startup.
+            struct _LIB_THEKOGANS_CRYPTO_DECL Profile {
+                /// \brief
+                /// \see{CipherSuite} cipher names.
+                std::vector<std::string> ciphers;
+                /// \brief
+                /// \see{CipherSuite} message digest names.
+                std::vector<std::string> messageDigests;
+                /// \brief
+                /// true = load the error strings at startup.
+                bool loadErrorStrings;
+
+                /// \brief
+                /// ctor.
+                /// \param[in] ciphers_ \see{CipherSuite} cipher names.
+                /// \param[in] messageDigests_ \see{CipherSuite} message digest names.
+                /// \param[in] loadErrorStrings_ true = load the error strings at startup.
+                Profile (
+                    const std::vector<std::string> &ciphers_ = std::vector<std::string> (),
+                    const std::vector<std::string> &messageDigests_ = std::vector<std::string> (),
+                    bool loadErrorStrings_ = false) :
+                    ciphers (ciphers_),
+                    messageDigests (messageDigests_),
+                    loadErrorStrings (loadErrorStrings_) {}
+            };
+
+            /// \struct OpenSSLInit::SeedCallback OpenSSLInit.h thekogans/crypto/OpenSSLInit.h
+            ///
+            /// \brief
+            /// Implement this interface to be notified when asynchronous seeding completes.
+            struct _LIB_THEKOGANS_CRYPTO_DECL SeedCallback : public virtual util::RefCounted {
+                /// \brief
+                /// Declare \see{util::RefCounted} pointers.
+                THEKOGANS_UTIL_DECLARE_REF_COUNTED_POINTERS (SeedCallback)
+
+                /// \brief
+                /// dtor.
+                virtual ~SeedCallback () {}
+
+                /// \brief
+                /// Called (on the seed thread) when seeding completes (or fails).
+                /// \param[in] error Error (empty == success).
+                virtual void OnSeeded (const std::string & /*error*/) throw () = 0;
+            };
+
             /// \brief
             /// ctor.
             /// Initialize the Open SSL library.
@@ -62,15 +140,143 @@ namespace thekogans {
             /// \param[in] workingSetSize Physical pages to reserve.
             /// NOTE: All values are in bytes.
             /// \param[in] engine_ OpenSSL engine object used to accelerate cryptographic operations.
+            /// \param[in] maxWorkingSetSize If > workingSetSize, grow the working set
+            /// on demand up to this many bytes (\see{SecureMemoryStats}).
+            /// \param[in] profile If not 0, register only the listed algorithms
+            /// at startup, and the rest on first use.
+            /// \param[in] seedAsync true = seed the PRNG on a background thread.
             OpenSSLInit (
                 bool multiThreaded = true,
                 util::ui32 entropyNeeded = DEFAULT_ENTROPY_NEEDED,
                 util::ui64 workingSetSize = DEFAULT_WORKING_SET_SIZE,
-                ENGINE *engine_ = 0);
+                ENGINE *engine_ = 0,
+                util::ui64 maxWorkingSetSize = 0,
+                const Profile *profile = 0,
+                bool seedAsync = false);
             /// \brief
             /// \dtor.
             virtual ~OpenSSLInit ();
 
+            /// \brief
+            /// Register the given cipher with OpenSSL (so that it can be found
+            /// by name, used in PEM encryption...), if it hasn't been already.
+            /// Only does work if OpenSSLInit was created with a \see{Profile}.
+            /// \param[in] cipher Cipher to register.
+            static void RegisterCipher (const EVP_CIPHER *cipher);
+            /// \brief
+            /// Register the given message digest with OpenSSL, if it hasn't
+            /// been already. Only does work if OpenSSLInit was created with
+            /// a \see{Profile}.
+            /// \param[in] md Message digest to register.
+            static void RegisterMessageDigest (const EVP_MD *md);
+            /// \brief
+            /// Return true if the PRNG has been seeded (or seeding failed).
+            /// \return true == seeding is done.
+            static bool IsSeeded ();
+            /// \brief
+            /// Block until the PRNG has been seeded. Returns right away
+            /// if OpenSSLInit was not created with seedAsync = true.
+            /// Throws if seeding failed.
+            static void WaitForSeed ();
+            /// \brief
+            /// Call the given callback when seeding completes. If it already
+            /// has, the callback is called right away (on this thread).
+            /// \param[in] callback Callback to call.
+            static void AddSeedCallback (SeedCallback::SharedPtr callback);
+
+            /// \brief
+            /// Load the OpenSSL error strings, if they haven't been already.
+            static void LoadErrorStrings ();
+
+            /// \brief
+            /// Set the provider property query (ex: "provider=default",
+            /// "fips=yes") used to fetch algorithm implementations (OpenSSL 3).
+            /// Implementations fetched with the previous query stay valid (for
+            /// objects already using them) until OpenSSLInit is destroyed.
+            /// \param[in] propertyQuery Property query ("" == OpenSSL's default).
+            static void SetPropertyQuery (const std::string &propertyQuery);
+            /// \brief
+            /// Return the provider property query.
+            /// \return Provider property query.
+            static std::string GetPropertyQuery ();
+        #if OPENSSL_VERSION_NUMBER >= 0x30000000L
+            /// \brief
+            /// Set the library context algorithm implementations are fetched
+            /// from (with its own providers and config). Must outlive OpenSSLInit.
+            /// \param[in] libraryContext Library context (0 == OpenSSL's default).
+            static void SetLibraryContext (OSSL_LIB_CTX *libraryContext);
+            /// \brief
+            /// Return the library context algorithm implementations are fetched from.
+            /// \return Library context (0 == OpenSSL's default).
+            static OSSL_LIB_CTX *GetLibraryContext ();
+        #endif // OPENSSL_VERSION_NUMBER >= 0x30000000L
+            /// \brief
+            /// Under OpenSSL 3, every init with an EVP_aes_256_gcm () style cipher
+            /// does an implicit fetch (name lookup, provider query, method
+            /// construction). FetchCipher does it once per library context and
+            /// property query and caches the result. The returned object is
+            /// only for passing to the EVP init calls; keep using the original
+            /// for comparisons and lookups. Returns cipher unchanged before
+            /// OpenSSL 3, for ciphers offloaded to an engine, and for ciphers
+            /// that have no provider implementation.
+            /// \param[in] cipher Cipher to fetch.
+            /// \return Implementation to init contexts with.
+            static const EVP_CIPHER *FetchCipher (const EVP_CIPHER *cipher);
+            /// \brief
+            /// \see{FetchCipher} for message digests. The Blake2/Blake3
+            /// EVP_MDs implemented here are always returned unchanged.
+            /// \param[in] md Message digest to fetch.
+            /// \return Implementation to init contexts with.
+            static const EVP_MD *FetchMessageDigest (const EVP_MD *md);
+
+            /// \brief
+            /// Use the given engine for the given algorithm instead of the
+            /// default engine. The engine must outlive its use.
+            /// \param[in] nid OpenSSL NID of the algorithm (EVP_CIPHER_nid,
+            /// EVP_MD_type or EVP_PKEY_RSA/DSA/EC/DH).
+            /// \param[in] engine_ Engine to use (0 == software).
+            static void SetEngine (
+                util::i32 nid,
+                ENGINE *engine_);
+            /// \brief
+            /// Remove all per algorithm engine overrides.
+            static void ClearEngines ();
+            /// \brief
+            /// Return the engine to use for the given algorithm: the
+            /// per algorithm override if there's one, the default engine
+            /// otherwise, and 0 inside a \see{SoftwareScope}.
+            /// \param[in] nid OpenSSL NID of the algorithm.
+            /// \return Engine to pass to the EVP init call.
+            static ENGINE *GetEngine (util::i32 nid);
+
+            /// \struct OpenSSLInit::SoftwareScope OpenSSLInit.h thekogans/crypto/OpenSSLInit.h
+            ///
+            /// \brief
+            /// While a SoftwareScope is alive, \see{GetEngine} returns 0 on
+            /// this thread. \see{AsyncEngine} uses it to fall back to software
+            /// when the accelerator is saturated. Only contexts created inside
+            /// the scope are affected (\see{Cipher}s and \see{Authenticator}s
+            /// initialize theirs in their ctors; key exchanges, RSA encryption,
+            /// HKDF... create them per operation).
+            struct _LIB_THEKOGANS_CRYPTO_DECL SoftwareScope {
+            private:
+                /// \brief
+                /// Previous state (scopes nest).
+                bool previous;
+
+            public:
+                /// \brief
+                /// ctor.
+                SoftwareScope ();
+                /// \brief
+                /// dtor.
+                ~SoftwareScope ();
+
+                /// \brief
+                /// SoftwareScope is neither copy constructable, nor assignable.
+                THEKOGANS_CRYPTO_DISALLOW_COPY_AND_ASSIGN (SoftwareScope)
+            };
+
             /// \brief
             /// OpenSSLInit is neither copy constructable, nor assignable.
             THEKOGANS_CRYPTO_DISALLOW_COPY_AND_ASSIGN (OpenSSLInit)
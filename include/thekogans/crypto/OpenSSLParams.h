@@ -50,6 +50,10 @@ namespace thekogans {
             /// OpenSSL EVP_PKEY pointer.
             EVP_PKEYPtr params;
 
+            /// \brief
+            /// \see{EphemeralKeyPool} needs access to params.
+            friend struct EphemeralKeyPool;
+
         public:
             /// \brief
             /// ctor.
@@ -74,6 +78,22 @@ namespace thekogans {
                 return params.get ();
             }
 
+            /// \brief
+            /// Create a new OpenSSLParams that shares (adds a reference to)
+            /// the EVP_PKEY held by the given params. Used by the \see{DH}
+            /// and \see{EC} parameter caches to hand out the same immutable,
+            /// pre-parsed group under a per-call id, name and description.
+            /// \param[in] params OpenSSLParams whose EVP_PKEY to share.
+            /// \param[in] id Optional parameters id.
+            /// \param[in] name Optional parameters name.
+            /// \param[in] description Optional parameters description.
+            /// \return OpenSSLParams sharing params EVP_PKEY.
+            static Params::SharedPtr Share (
+                const OpenSSLParams &params,
+                const ID &id = ID (),
+                const std::string &name = std::string (),
+                const std::string &description = std::string ());
+
             /// \brief
             /// Load a PEM encoded private key parameters from a file.
             /// \param[in] path File containing the private key parameters.
@@ -19,7 +19,9 @@
 #define __thekogans_crypto_OpenSSLSigner_h
 
 #include "thekogans/crypto/Config.h"
+#include "thekogans/crypto/OpenSSLUtils.h"
 #include "thekogans/crypto/Signer.h"
+#include "thekogans/crypto/ECDSANoncePool.h"
 
 namespace thekogans {
     namespace crypto {
@@ -28,13 +30,28 @@ namespace thekogans {
         ///
         /// \brief
         /// OpenSSLSigner implements the public key sign operation using
-        /// various OpenSSL EVP_PKEY keys (RSA, DSA, EC).
+        /// various OpenSSL EVP_PKEY keys (RSA, DSA, EC). If an \see{ECDSANoncePool}
+        /// is registered for an EC key when the signer is created, the signer
+        /// only hashes the message and the pool signs the digest with a
+        /// precomputed nonce.
 
         struct _LIB_THEKOGANS_CRYPTO_DECL OpenSSLSigner : public Signer {
             /// \brief
             /// OpenSSLSigner is a \see{Signer}.
             THEKOGANS_CRYPTO_DECLARE_SIGNER (OpenSSLSigner)
 
+        private:
+            /// \brief
+            /// Context initialized (EVP_DigestSignInit) once in the ctor.
+            /// Init copies it (EVP_MD_CTX_copy_ex) in to the message digest
+            /// context instead of repeating the EVP_PKEY_CTX setup (padding,
+            /// blinding...) for every signature.
+            MDContext prepared;
+            /// \brief
+            /// Precomputed ECDSA nonces (0 == sign with EVP_DigestSignFinal).
+            ECDSANoncePool::SharedPtr noncePool;
+
+        public:
             /// \brief
             /// ctor.
             /// \param[in] privateKey Private key.
@@ -36,6 +36,14 @@
 #include "thekogans/util/Types.h"
 #include "thekogans/crypto/Config.h"
 
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L && \
+        !defined (OPENSSL_NO_CHACHA) && !defined (OPENSSL_NO_POLY1305)
+    /// \def THEKOGANS_CRYPTO_HAVE_CHACHA20_POLY1305
+    /// Defined if OpenSSL provides EVP_chacha20_poly1305.
+    #define THEKOGANS_CRYPTO_HAVE_CHACHA20_POLY1305
+#endif // OPENSSL_VERSION_NUMBER >= 0x10100000L &&
+       // !defined (OPENSSL_NO_CHACHA) && !defined (OPENSSL_NO_POLY1305)
+
 namespace thekogans {
     namespace crypto {
 
@@ -286,6 +294,14 @@ namespace thekogans {
             ~CipherContext () {
                 EVP_CIPHER_CTX_cleanup (this);
             }
+
+            /// \brief
+            /// Return the context to its freshly constructed state
+            /// (keeping it around for reuse).
+            void Reset () {
+                EVP_CIPHER_CTX_cleanup (this);
+                EVP_CIPHER_CTX_init (this);
+            }
         };
 
         /// \struct MDContext OpenSSLUtils.h thekogans/crypto/OpenSSLUtils.h
@@ -303,6 +319,14 @@ namespace thekogans {
             ~MDContext () {
                 EVP_MD_CTX_cleanup (this);
             }
+
+            /// \brief
+            /// Return the context to its freshly constructed state
+            /// (keeping it around for reuse).
+            void Reset () {
+                EVP_MD_CTX_cleanup (this);
+                EVP_MD_CTX_init (this);
+            }
         };
 
         /// \struct HMACContext OpenSSLUtils.h thekogans/crypto/OpenSSLUtils.h
@@ -320,6 +344,14 @@ namespace thekogans {
             ~HMACContext () {
                 HMAC_CTX_cleanup (this);
             }
+
+            /// \brief
+            /// Return the context to its freshly constructed state
+            /// (keeping it around for reuse).
+            void Reset () {
+                HMAC_CTX_cleanup (this);
+                HMAC_CTX_init (this);
+            }
         };
     #else // OPENSSL_VERSION_NUMBER < 0x10100000L
         /// \struct CipherContext OpenSSLUtils.h thekogans/crypto/OpenSSLUtils.h
@@ -347,6 +379,13 @@ namespace thekogans {
             EVP_CIPHER_CTX *operator & () const {
                 return ctx;
             }
+
+            /// \brief
+            /// Return the context to its freshly constructed state
+            /// without reallocating it (EVP_CIPHER_CTX_reset).
+            void Reset () {
+                EVP_CIPHER_CTX_reset (ctx);
+            }
         };
 
         /// \struct MDContext OpenSSLUtils.h thekogans/crypto/OpenSSLUtils.h
@@ -374,6 +413,13 @@ namespace thekogans {
             EVP_MD_CTX *operator & () const {
                 return ctx;
             }
+
+            /// \brief
+            /// Return the context to its freshly constructed state
+            /// without reallocating it (EVP_MD_CTX_reset).
+            void Reset () {
+                EVP_MD_CTX_reset (ctx);
+            }
         };
 
         /// \struct HMACContext OpenSSLUtils.h thekogans/crypto/OpenSSLUtils.h
@@ -401,9 +447,38 @@ namespace thekogans {
             HMAC_CTX *operator & () const {
                 return ctx;
             }
+
+            /// \brief
+            /// Return the context to its freshly constructed state
+            /// without reallocating it (HMAC_CTX_reset).
+            void Reset () {
+                HMAC_CTX_reset (ctx);
+            }
         };
     #endif // OPENSSL_VERSION_NUMBER < 0x10100000L
 
+        /// \struct HMACContextReset OpenSSLUtils.h thekogans/crypto/OpenSSLUtils.h
+        ///
+        /// \brief
+        /// Resets (wiping the key schedule) a reused (thread_local)
+        /// HMACContext on scope exit.
+        struct HMACContextReset {
+            /// \brief
+            /// Context to reset.
+            HMACContext &ctx;
+
+            /// \brief
+            /// ctor.
+            /// \param[in] ctx_ Context to reset.
+            explicit HMACContextReset (HMACContext &ctx_) :
+                ctx (ctx_) {}
+            /// \brief
+            /// dtor.
+            ~HMACContextReset () {
+                ctx.Reset ();
+            }
+        };
+
         /// \struct CMACContext OpenSSLUtils.h thekogans/crypto/OpenSSLUtils.h
         ///
         /// \brief
@@ -446,9 +521,10 @@ namespace thekogans {
             const EVP_CIPHER *cipher = THEKOGANS_CRYPTO_DEFAULT_CIPHER);
 
         /// \brief
-        /// Return the mode (EVP_CIPH_CBC_MODE or EVP_CIPH_GCM_MODE) for a given OpenSSL cipher.
+        /// Return the mode (EVP_CIPH_CBC_MODE, EVP_CIPH_GCM_MODE or EVP_CIPH_STREAM_CIPHER
+        /// (ChaCha20-Poly1305)) for a given OpenSSL cipher.
         /// \param[in] cipher OpenSSL cipher object.
-        /// \return EVP_CIPH_CBC_MODE or EVP_CIPH_GCM_MODE.
+        /// \return EVP_CIPH_CBC_MODE, EVP_CIPH_GCM_MODE or EVP_CIPH_STREAM_CIPHER.
         _LIB_THEKOGANS_CRYPTO_DECL util::i32 _LIB_THEKOGANS_CRYPTO_API GetCipherMode (
             const EVP_CIPHER *cipher = THEKOGANS_CRYPTO_DEFAULT_CIPHER);
 
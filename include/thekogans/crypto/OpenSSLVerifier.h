@@ -19,6 +19,7 @@
 #define __thekogans_crypto_OpenSSLVerifier_h
 
 #include "thekogans/crypto/Config.h"
+#include "thekogans/crypto/OpenSSLUtils.h"
 #include "thekogans/crypto/Verifier.h"
 
 namespace thekogans {
@@ -35,6 +36,15 @@ namespace thekogans {
             /// OpenSSLVerifier is a \see{Verifier}.
             THEKOGANS_CRYPTO_DECLARE_VERIFIER (OpenSSLVerifier)
 
+        private:
+            /// \brief
+            /// Context initialized (EVP_DigestVerifyInit) once in the ctor.
+            /// Init copies it (EVP_MD_CTX_copy_ex) in to the message digest
+            /// context instead of repeating the EVP_PKEY_CTX setup (padding,
+            /// blinding...) for every signature.
+            MDContext prepared;
+
+        public:
             /// \brief
             /// ctor.
             /// \param[in] publicKey Public key.
@@ -18,7 +18,9 @@
 #if !defined (__thekogans_crypto_Params_h)
 #define __thekogans_crypto_Params_h
 
+#include <cstddef>
 #include <string>
+#include <vector>
 #include "thekogans/util/Serializer.h"
 #include "thekogans/crypto/Config.h"
 #include "thekogans/crypto/Serializable.h"
@@ -66,6 +68,18 @@ namespace thekogans {
                 const std::string & /*name*/ = std::string (),
                 const std::string & /*description*/ = std::string ()) const = 0;
 
+            /// \brief
+            /// Create count \see{AsymmetricKey}s spread over workerCount threads.
+            /// Every thread generates whole keys independently (for \see{RSA} and
+            /// \see{DSA} that includes it's own prime search), so the batch takes
+            /// roughly count / workerCount times as long as a single key.
+            /// \param[in] count Number of keys to create.
+            /// \param[in] workerCount Number of threads to use (0 == one per CPU).
+            /// \return count new private \see{AsymmetricKey}s.
+            std::vector<AsymmetricKey::SharedPtr> CreateKeys (
+                std::size_t count,
+                std::size_t workerCount = 0) const;
+
         protected:
             // Serializable
             /// \brief
@@ -0,0 +1,156 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined (__thekogans_crypto_Poly1305_h)
+#define __thekogans_crypto_Poly1305_h
+
+#include <openssl/evp.h>
+#include "thekogans/crypto/Config.h"
+#include "thekogans/crypto/MAC.h"
+#include "thekogans/crypto/SymmetricKey.h"
+#include "thekogans/crypto/OpenSSLUtils.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        /// \struct Poly1305 Poly1305.h thekogans/crypto/Poly1305.h
+        ///
+        /// \brief
+        /// Implements the Poly1305 one-time authenticator. A Poly1305 key
+        /// must never authenticate more than one message, so the (256 bit)
+        /// key is used to derive a one-time key per message, exactly like
+        /// ChaCha20-Poly1305 does (RFC 8439, 2.6: the first 32 bytes of
+        /// the ChaCha20 block 0 for a random nonce). The nonce travels with
+        /// the signature:
+        ///
+        /// +-------+-----+
+        /// | nonce | tag |
+        /// +-------+-----+
+        /// |  12   | 16  |
+        ///
+        /// Poly1305 doesn't need AES, which makes it the MAC of choice on
+        /// hosts without AES-NI.
+
+        struct _LIB_THEKOGANS_CRYPTO_DECL Poly1305 : public MAC {
+            /// \enum
+            /// Poly1305 constants.
+            enum {
+                /// \brief
+                /// Key length.
+                KEY_LENGTH = 32,
+                /// \brief
+                /// Nonce length.
+                NONCE_LENGTH = 12,
+                /// \brief
+                /// Tag length.
+                TAG_LENGTH = 16,
+                /// \brief
+                /// Signature (nonce + tag) length.
+                SIGNATURE_LENGTH = NONCE_LENGTH + TAG_LENGTH
+            };
+
+        private:
+            /// \brief
+            /// Key used to derive the one-time keys.
+            SymmetricKey::SharedPtr key;
+            /// \brief
+            /// ChaCha20 context (keyed once in the ctor) used
+            /// to derive the one-time keys.
+            CipherContext keyContext;
+        #if OPENSSL_VERSION_NUMBER >= 0x30000000L
+            /// \brief
+            /// OpenSSL Poly1305 context (rekeyed for every message).
+            EVP_MAC_CTX *ctx;
+        #else // OPENSSL_VERSION_NUMBER >= 0x30000000L
+            /// \brief
+            /// OpenSSL Poly1305 (DigestSign) context.
+            MDContext ctx;
+        #endif // OPENSSL_VERSION_NUMBER >= 0x30000000L
+            /// \brief
+            /// Nonce used by the current MAC operation.
+            util::ui8 nonce[NONCE_LENGTH];
+
+        public:
+            /// \brief
+            /// ctor.
+            /// \param[in] key_ Key (KEY_LENGTH bytes) used to derive the one-time keys.
+            explicit Poly1305 (SymmetricKey::SharedPtr key_);
+            /// \brief
+            /// dtor.
+            virtual ~Poly1305 ();
+
+            /// \brief
+            /// Return the mac key.
+            /// \return MAC \see{SymmetricKey}.
+            inline SymmetricKey::SharedPtr GetKey () const {
+                return key;
+            }
+
+            /// \brief
+            /// Return the MAC type.
+            /// \return TYPE_POLY1305.
+            virtual Type GetType () const {
+                return TYPE_POLY1305;
+            }
+
+            /// \brief
+            /// Return the length of the mac.
+            /// \return Length of the mac.
+            virtual std::size_t GetMACLength () const {
+                return SIGNATURE_LENGTH;
+            }
+
+            /// \brief
+            /// Pick a new random nonce, derive the one-time key
+            /// and get the context ready for MAC generation.
+            virtual void Init ();
+            /// \brief
+            /// Derive the one-time key from the given signature's nonce
+            /// and get the context ready to recompute it.
+            /// \param[in] signature Signature that will be verified.
+            /// \param[in] signatureLength Signature length.
+            virtual void InitVerify (
+                const void *signature,
+                std::size_t signatureLength);
+            /// \brief
+            /// Call this method 1 or more times to generate a MAC.
+            /// \param[in] buffer Buffer whose signature to create.
+            /// \param[in] bufferLength Buffer length.
+            virtual void Update (
+                const void *buffer,
+                std::size_t bufferLength);
+            /// \brief
+            /// Finalize the MAC and return the signature (nonce + tag).
+            /// \param[out] signature Where to write the signature.
+            /// \return Number of bytes written to signature.
+            virtual std::size_t Final (util::ui8 *signature);
+
+        private:
+            /// \brief
+            /// Derive the one-time key for the current nonce
+            /// and key the Poly1305 context with it.
+            void InitOneTimeKey ();
+
+            /// \brief
+            /// Poly1305 is neither copy constructable, nor assignable.
+            THEKOGANS_CRYPTO_DISALLOW_COPY_AND_ASSIGN (Poly1305)
+        };
+
+    } // namespace crypto
+} // namespace thekogans
+
+#endif // !defined (__thekogans_crypto_Poly1305_h)
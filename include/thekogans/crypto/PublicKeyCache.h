@@ -0,0 +1,164 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined (__thekogans_crypto_PublicKeyCache_h)
+#define __thekogans_crypto_PublicKeyCache_h
+
+#include <cstddef>
+#include <string>
+#include "thekogans/util/Types.h"
+#include "thekogans/util/RefCounted.h"
+#include "thekogans/util/SpinLock.h"
+#include "thekogans/crypto/Config.h"
+#include "thekogans/crypto/ID.h"
+#include "thekogans/crypto/IDCache.h"
+#include "thekogans/crypto/OpenSSLUtils.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        /// \struct PublicKeyCache PublicKeyCache.h thekogans/crypto/PublicKeyCache.h
+        ///
+        /// \brief
+        /// PublicKeyCache is a process wide interning cache of decoded public
+        /// \see{OpenSSLAsymmetricKey}s. Peers send the same (authenticator) public
+        /// keys over and over, and decoding the PEM in to a fresh EVP_PKEY costs
+        /// far more than remembering the last one did. When a public key is read
+        /// (\see{OpenSSLAsymmetricKey::Read}) it's serialized bytes are looked up
+        /// by key \see{ID}. If they match the cached ones byte for byte, the reader
+        /// shares (EVP_PKEY_up_ref) the cached EVP_PKEY and skips decoding. Because
+        /// the bytes are compared, a peer presenting a different key under a known
+        /// id gets it's own key decoded (and cached in place of the old one).
+        /// Private keys are never cached. The cache is bounded, uses \see{IDCache}'s
+        /// CLOCK eviction and is safe to use from multiple threads.
+        ///
+        /// Reading from a \see{util::Buffer} (or a \see{util::TenantReadBuffer}
+        /// wrapping a received packet or a mapped file) decodes the key straight
+        /// out of the buffer, so a cache miss doesn't copy the key either:
+        ///
+        /// \code{.cpp}
+        /// using namespace thekogans;
+        ///
+        /// util::TenantReadBuffer buffer (util::NetworkEndian, packet, packetLength);
+        /// crypto::AsymmetricKey::SharedPtr publicKey;
+        /// buffer >> publicKey;
+        /// \endcode
+
+        struct _LIB_THEKOGANS_CRYPTO_DECL PublicKeyCache {
+            enum {
+                /// \brief
+                /// Default max number of cached keys.
+                DEFAULT_CAPACITY = 1024
+            };
+
+        private:
+            /// \struct PublicKeyCache::Entry PublicKeyCache.h thekogans/crypto/PublicKeyCache.h
+            ///
+            /// \brief
+            /// A decoded key, and the bytes it was decoded from.
+            struct Entry : public virtual util::RefCounted {
+                /// \brief
+                /// Declare \see{RefCounted} pointers.
+                THEKOGANS_UTIL_DECLARE_REF_COUNTED_POINTERS (Entry)
+
+                /// \brief
+                /// Serialized key.
+                std::string keyBuffer;
+                /// \brief
+                /// Decoded key.
+                EVP_PKEYPtr key;
+
+                /// \brief
+                /// ctor.
+                /// \param[in] keyBuffer_ Serialized key.
+                /// \param[in] keyBufferLength Serialized key length.
+                /// \param[in] key_ Decoded key (shared, not copied).
+                Entry (
+                    const char *keyBuffer_,
+                    std::size_t keyBufferLength,
+                    EVP_PKEY &key_);
+            };
+            /// \brief
+            /// id -> cached key.
+            IDCache<Entry::SharedPtr> cache;
+            /// \brief
+            /// Synchronization lock.
+            util::SpinLock spinLock;
+
+        public:
+            /// \brief
+            /// ctor.
+            /// \param[in] capacity Max number of cached keys (0 == don't cache).
+            explicit PublicKeyCache (std::size_t capacity = DEFAULT_CAPACITY);
+
+            /// \brief
+            /// Return the process wide instance used by \see{OpenSSLAsymmetricKey::Read}.
+            /// \return The process wide instance.
+            static PublicKeyCache &Instance ();
+
+            /// \brief
+            /// Return the max number of cached keys.
+            /// \return Max number of cached keys (0 == don't cache).
+            std::size_t GetCapacity ();
+            /// \brief
+            /// Set the max number of cached keys, evicting
+            /// entries if the cache is over the new capacity.
+            /// \param[in] capacity Max number of cached keys (0 == don't cache).
+            void SetCapacity (std::size_t capacity);
+
+            /// \brief
+            /// Return the key with the given id if it was decoded from
+            /// the given bytes before. Counts a hit or a miss.
+            /// \param[in] id Key \see{ID}.
+            /// \param[in] keyBuffer Serialized key.
+            /// \param[in] keyBufferLength Serialized key length.
+            /// \return Shared (EVP_PKEY_up_ref) key (empty == not cached).
+            EVP_PKEYPtr Get (
+                const ID &id,
+                const char *keyBuffer,
+                std::size_t keyBufferLength);
+            /// \brief
+            /// Remember a freshly decoded key (replacing the one cached
+            /// under the same id, if any).
+            /// \param[in] id Key \see{ID}.
+            /// \param[in] keyBuffer Serialized key.
+            /// \param[in] keyBufferLength Serialized key length.
+            /// \param[in] key Decoded key (shared, not copied).
+            void Add (
+                const ID &id,
+                const char *keyBuffer,
+                std::size_t keyBufferLength,
+                EVP_PKEY &key);
+
+            /// \brief
+            /// Return a snapshot of the cache counters.
+            /// \return \see{IDCacheStats}.
+            IDCacheStats GetStats ();
+
+            /// \brief
+            /// Drop all cached keys (the counters are preserved).
+            void Clear ();
+
+            /// \brief
+            /// PublicKeyCache is neither copy constructable, nor assignable.
+            THEKOGANS_CRYPTO_DISALLOW_COPY_AND_ASSIGN (PublicKeyCache)
+        };
+
+    } // namespace crypto
+} // namespace thekogans
+
+#endif // !defined (__thekogans_crypto_PublicKeyCache_h)
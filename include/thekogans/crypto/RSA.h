@@ -22,9 +22,11 @@
 #include <string>
 #include <openssl/rsa.h>
 #include "thekogans/util/ByteSwap.h"
+#include "thekogans/util/RefCounted.h"
 #include "thekogans/util/Buffer.h"
 #include "thekogans/crypto/Config.h"
 #include "thekogans/crypto/AsymmetricKey.h"
+#include "thekogans/crypto/Params.h"
 #include "thekogans/crypto/OpenSSLUtils.h"
 
 namespace thekogans {
@@ -52,6 +54,44 @@ namespace thekogans {
                 const ID &id = ID (),
                 const std::string &name = std::string (),
                 const std::string &description = std::string ());
+            /// \brief
+            /// Create a multi-prime (RFC 8017) RSA key. Private key operations
+            /// (decrypt, sign) with more (smaller) primes use more (cheaper) CRT
+            /// exponentiations. With 3 primes a 3072 bit private key operation
+            /// is roughly twice as fast. Public key operations (and the key's
+            /// wire format) are unchanged. Requires OpenSSL 1.1.1 or newer.
+            /// \param[in] keyLength The length of the key (in bits).
+            /// \param[in] primes Number of primes (2 = a regular key, OpenSSL
+            /// caps it at 3 for keys < 4096 bits, 4 < 8192 and 5 beyond).
+            /// \param[in] publicExponent RSA key public exponent.
+            /// \param[in] id Optional key id.
+            /// \param[in] name Optional key name.
+            /// \param[in] description Optional key description.
+            /// \return A new RSA key.
+            static AsymmetricKey::SharedPtr CreateMultiPrimeKey (
+                std::size_t keyLength,
+                std::size_t primes,
+                BIGNUMPtr publicExponent = BIGNUMFromui32 (65537),
+                const ID &id = ID (),
+                const std::string &name = std::string (),
+                const std::string &description = std::string ());
+
+            /// \brief
+            /// Create \see{RSAParams} that generate keys of the given length. Use them
+            /// with \see{Params::CreateKeys} to generate keys in parallel, or with
+            /// \see{EphemeralKeyPool} to pre-generate them in the background.
+            /// \param[in] keyLength The length of the key (in bits).
+            /// \param[in] publicExponent RSA key public exponent.
+            /// \param[in] id Optional parameters id.
+            /// \param[in] name Optional parameters name.
+            /// \param[in] description Optional parameters description.
+            /// \return \see{RSAParams}.
+            static Params::SharedPtr ParamsFromKeyLength (
+                std::size_t keyLength,
+                util::ui32 publicExponent = 65537,
+                const ID &id = ID (),
+                const std::string &name = std::string (),
+                const std::string &description = std::string ());
 
             /// \brief
             /// Return the max plaintextLength that can be passed to EncryptBuffer below.
@@ -263,6 +303,188 @@ namespace thekogans {
                 bool secure = false,
                 util::Endianness endianness = util::NetworkEndian);
 
+        /// \struct RSAEncryptor RSA.h thekogans/crypto/RSA.h
+        ///
+        /// \brief
+        /// RSAEncryptor sets up the public key context (key, engine, padding)
+        /// once, and then reuses it for any number of \see{RSA::Encrypt}
+        /// equivalent calls. Use it when encrypting many small buffers
+        /// (session keys) to the same recipient.
+        /// NOTE: RSAEncryptor is not thread safe. Give every thread it's
+        /// own \see{Clone}.
+
+        struct _LIB_THEKOGANS_CRYPTO_DECL RSAEncryptor : public virtual util::RefCounted {
+            /// \brief
+            /// Declare \see{RefCounted} pointers.
+            THEKOGANS_UTIL_DECLARE_REF_COUNTED_POINTERS (RSAEncryptor)
+
+        private:
+            /// \brief
+            /// Public key used for encryption.
+            AsymmetricKey::SharedPtr publicKey;
+            /// \brief
+            /// RSA padding type.
+            util::i32 padding;
+            /// \brief
+            /// Prepared public key context.
+            EVP_PKEY_CTXPtr ctx;
+
+        public:
+            /// \brief
+            /// ctor.
+            /// \param[in] publicKey_ Public key used for encryption.
+            /// \param[in] padding_ RSA padding type.
+            explicit RSAEncryptor (
+                AsymmetricKey::SharedPtr publicKey_,
+                util::i32 padding_ = RSA_PKCS1_OAEP_PADDING);
+
+            /// \brief
+            /// Return the public key used for encryption.
+            /// \return Public key used for encryption.
+            inline AsymmetricKey::SharedPtr GetPublicKey () const {
+                return publicKey;
+            }
+            /// \brief
+            /// Return the RSA padding type.
+            /// \return RSA padding type.
+            inline util::i32 GetPadding () const {
+                return padding;
+            }
+
+            /// \brief
+            /// Return a copy of the prepared context for use by another thread.
+            /// \return Copy of this RSAEncryptor.
+            SharedPtr Clone () const;
+
+            /// \brief
+            /// Use the public key to encrypt the plaintext.
+            /// \param[in] plaintext Plaintext to encrypt (at most
+            /// \see{RSA::GetMaxPlaintextLength} bytes).
+            /// \param[in] plaintextLength Length of plaintext.
+            /// \param[out] ciphertext Where to write the ciphertext
+            /// (must be at least public key length / 8 bytes).
+            /// \return Number of bytes written to ciphertext.
+            std::size_t Encrypt (
+                const void *plaintext,
+                std::size_t plaintextLength,
+                util::ui8 *ciphertext);
+            /// \brief
+            /// Allocate a buffer large enough and call Encrypt above.
+            /// \param[in] plaintext Plaintext to encrypt.
+            /// \param[in] plaintextLength Length of plaintext.
+            /// \return Encrypted plaintext.
+            util::Buffer Encrypt (
+                const void *plaintext,
+                std::size_t plaintextLength);
+
+        private:
+            /// \brief
+            /// ctor. Used by Clone.
+            /// \param[in] publicKey_ Public key used for encryption.
+            /// \param[in] padding_ RSA padding type.
+            /// \param[in] ctx_ Duplicate of the prepared context.
+            RSAEncryptor (
+                AsymmetricKey::SharedPtr publicKey_,
+                util::i32 padding_,
+                EVP_PKEY_CTXPtr ctx_);
+
+            /// \brief
+            /// RSAEncryptor is neither copy constructable, nor assignable.
+            THEKOGANS_CRYPTO_DISALLOW_COPY_AND_ASSIGN (RSAEncryptor)
+        };
+
+        /// \struct RSADecryptor RSA.h thekogans/crypto/RSA.h
+        ///
+        /// \brief
+        /// RSADecryptor sets up the private key context (key, engine, padding)
+        /// once, and then reuses it for any number of \see{RSA::Decrypt}
+        /// equivalent calls.
+        /// NOTE: RSADecryptor is not thread safe. Give every thread it's
+        /// own \see{Clone}.
+
+        struct _LIB_THEKOGANS_CRYPTO_DECL RSADecryptor : public virtual util::RefCounted {
+            /// \brief
+            /// Declare \see{RefCounted} pointers.
+            THEKOGANS_UTIL_DECLARE_REF_COUNTED_POINTERS (RSADecryptor)
+
+        private:
+            /// \brief
+            /// Private key used for decryption.
+            AsymmetricKey::SharedPtr privateKey;
+            /// \brief
+            /// RSA padding type.
+            util::i32 padding;
+            /// \brief
+            /// Prepared private key context.
+            EVP_PKEY_CTXPtr ctx;
+
+        public:
+            /// \brief
+            /// ctor.
+            /// \param[in] privateKey_ Private key used for decryption.
+            /// \param[in] padding_ RSA padding type.
+            explicit RSADecryptor (
+                AsymmetricKey::SharedPtr privateKey_,
+                util::i32 padding_ = RSA_PKCS1_OAEP_PADDING);
+
+            /// \brief
+            /// Return the private key used for decryption.
+            /// \return Private key used for decryption.
+            inline AsymmetricKey::SharedPtr GetPrivateKey () const {
+                return privateKey;
+            }
+            /// \brief
+            /// Return the RSA padding type.
+            /// \return RSA padding type.
+            inline util::i32 GetPadding () const {
+                return padding;
+            }
+
+            /// \brief
+            /// Return a copy of the prepared context for use by another thread.
+            /// \return Copy of this RSADecryptor.
+            SharedPtr Clone () const;
+
+            /// \brief
+            /// Use the private key to decrypt the ciphertext.
+            /// \param[in] ciphertext Ciphertext to decrypt.
+            /// \param[in] ciphertextLength Length of ciphertext.
+            /// \param[out] plaintext Where to write decrypted plaintext
+            /// (must be at least private key length / 8 bytes).
+            /// \return Number of bytes written to plaintext.
+            std::size_t Decrypt (
+                const void *ciphertext,
+                std::size_t ciphertextLength,
+                util::ui8 *plaintext);
+            /// \brief
+            /// Allocate a buffer large enough and call Decrypt above.
+            /// \param[in] ciphertext Ciphertext to decrypt.
+            /// \param[in] ciphertextLength Length of ciphertext.
+            /// \param[in] secure true == return util::SecureBuffer.
+            /// \param[in] endianness Endianness type of the resulting plaintext.
+            /// \return Decrypted ciphertext.
+            util::Buffer Decrypt (
+                const void *ciphertext,
+                std::size_t ciphertextLength,
+                bool secure = false,
+                util::Endianness endianness = util::NetworkEndian);
+
+        private:
+            /// \brief
+            /// ctor. Used by Clone.
+            /// \param[in] privateKey_ Private key used for decryption.
+            /// \param[in] padding_ RSA padding type.
+            /// \param[in] ctx_ Duplicate of the prepared context.
+            RSADecryptor (
+                AsymmetricKey::SharedPtr privateKey_,
+                util::i32 padding_,
+                EVP_PKEY_CTXPtr ctx_);
+
+            /// \brief
+            /// RSADecryptor is neither copy constructable, nor assignable.
+            THEKOGANS_CRYPTO_DISALLOW_COPY_AND_ASSIGN (RSADecryptor)
+        };
+
     } // namespace crypto
 } // namespace thekogans
 
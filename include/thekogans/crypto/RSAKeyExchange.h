@@ -23,6 +23,7 @@
 #include <vector>
 #include "thekogans/util/Serializable.h"
 #include "thekogans/util/SpinLock.h"
+#include "thekogans/util/Mutex.h"
 #include "thekogans/crypto/Config.h"
 #include "thekogans/crypto/KeyExchange.h"
 #include "thekogans/crypto/AsymmetricKey.h"
@@ -85,10 +86,14 @@ namespace thekogans {
                 /// Given the peer's public \see{AsymmetricKey}, verify parameters signature.
                 /// \param[in] publicKey Peer's public key used to verify parameters signature.
                 /// \param[in] messageDigest Message digest object.
+                /// \param[in] validatedParamsCache Optional \see{ValidatedParamsCache}
+                /// consulted before (and updated after) verifying the signature.
                 /// \return true == signature is valid, false == signature is invalid.
                 virtual bool ValidateSignature (
                     AsymmetricKey::SharedPtr publicKey,
-                    MessageDigest::SharedPtr messageDigest) override;
+                    MessageDigest::SharedPtr messageDigest,
+                    ValidatedParamsCache::SharedPtr validatedParamsCache =
+                        ValidatedParamsCache::SharedPtr ()) override;
 
             protected:
                 // util::Serializable
@@ -139,13 +144,72 @@ namespace thekogans {
                 virtual void Write (util::JSON::Object &object) const override;
             };
 
+            /// \struct RSAKeyExchange::CompactRSAParams RSAKeyExchange.h thekogans/crypto/RSAKeyExchange.h
+            ///
+            /// \brief
+            /// A view over the compact (handshake) encoding of \see{RSAParams}
+            /// (\see{GetCompactParams}). Layout:
+            ///
+            /// ui8 version
+            /// id (ID::SIZE bytes)
+            /// keyId (ID::SIZE bytes)
+            /// ui16 bufferLength
+            /// buffer
+            /// signature trailer (\see{KeyExchange::CompactParams})
+            struct _LIB_THEKOGANS_CRYPTO_DECL CompactRSAParams : public CompactParams {
+                /// \brief
+                /// Private/Public \see{RSA} \see{AsymmetricKey} id (ID::SIZE bytes).
+                const util::ui8 *keyId;
+                /// \brief
+                /// Encrypted \see{SymmetricKey} (client). \see{SymmetricKey} signature (server).
+                const util::ui8 *buffer;
+                /// \brief
+                /// buffer length.
+                std::size_t bufferLength;
+
+                /// \brief
+                /// ctor.
+                CompactRSAParams () :
+                    keyId (0),
+                    buffer (0),
+                    bufferLength (0) {}
+
+                /// \brief
+                /// Parse the compact encoding in place. Nothing is copied; on
+                /// success the fields point in to buffer_.
+                /// \param[in] buffer_ Compact encoding (\see{GetCompactParams}).
+                /// \param[in] length Buffer length.
+                /// \return true == success, false == malformed encoding.
+                bool Parse (
+                    const void *buffer_,
+                    std::size_t length);
+
+                /// \brief
+                /// Materialize the \see{RSAParams} to pass to the \see{RSAKeyExchange}
+                /// ctor or \see{DeriveSharedSymmetricKey}. The returned \see{RSAParams}
+                /// are unsigned; use \see{KeyExchange::CompactParams::ValidateSignature} first.
+                /// \return \see{RSAParams}.
+                RSAParams::SharedPtr ToRSAParams () const;
+            };
+
         private:
             /// \brief
             /// Private/public \see{AsymmetricKey} used for \see{RSA} \see{SymmetricKey} derivation.
             AsymmetricKey::SharedPtr key;
             /// \brief
             /// Shared \see{SymmetricKey} created by the client and signed by the server.
-            SymmetricKey::SharedPtr symmetricKey;
+            mutable SymmetricKey::SharedPtr symmetricKey;
+            /// \brief
+            /// Server side, the \see{SymmetricKey} as encrypted by the client.
+            /// The (expensive) private key decryption is deferred until the key
+            /// is first needed (\see{GetSymmetricKey}). That way it runs on the
+            /// thread deriving the shared key (ex: an \see{AsyncEngine} worker
+            /// running a \see{AsyncEngine::DeriveSharedSymmetricKeyJob}), and
+            /// not on the one accepting the handshake.
+            mutable std::vector<util::ui8> encryptedSymmetricKey;
+            /// \brief
+            /// Serializes the deferred decryption.
+            mutable util::Mutex mutex;
 
         public:
             /// \enum
@@ -182,6 +246,9 @@ namespace thekogans {
             /// ctor. Used by the receiver of the key exchange request (server).
             /// \param[in] key_ Private \see{AsymmetricKey} used for \see{RSA} \see{SymmetricKey} derivation.
             /// \param[in] params \see{RSAParams} containing the encrypted \see{SymmetricKey}.
+            /// NOTE: The \see{SymmetricKey} is decrypted by the first call to
+            /// \see{DeriveSharedSymmetricKey} (or \see{GetParams}). Decryption
+            /// errors are reported there.
             RSAKeyExchange (
                 AsymmetricKey::SharedPtr key_,
                 Params::SharedPtr params);
@@ -196,12 +263,30 @@ namespace thekogans {
                 AsymmetricKey::SharedPtr privateKey = AsymmetricKey::SharedPtr (),
                 MessageDigest::SharedPtr messageDigest = MessageDigest::SharedPtr ()) const override;
 
+            /// \brief
+            /// Get the compact encoding of the parameters to send to the key exchange
+            /// peer (\see{CompactRSAParams}).
+            /// \param[in] privateKey Optional my private \see{AsymmetricKey} used to create a signature
+            /// over the parameters.
+            /// \param[in] messageDigest Optional message digest used to hash the parameters.
+            /// \return Compact encoding of the parameters.
+            util::Buffer GetCompactParams (
+                AsymmetricKey::SharedPtr privateKey = AsymmetricKey::SharedPtr (),
+                MessageDigest::SharedPtr messageDigest = MessageDigest::SharedPtr ()) const;
+
             /// \brief
             /// Given the peer's \see{RSAParams}, derive the shared \see{SymmetricKey}.
             /// \param[in] params Peer's \see{RSAParams} parameters.
             /// \return Shared \see{SymmetricKey}.
             virtual SymmetricKey::SharedPtr DeriveSharedSymmetricKey (Params::SharedPtr params) const override;
 
+        private:
+            /// \brief
+            /// Return the shared \see{SymmetricKey}, decrypting it first if needed.
+            /// \return Shared \see{SymmetricKey}.
+            SymmetricKey::SharedPtr GetSymmetricKey () const;
+
+        public:
             /// \brief
             /// RSAKeyExchange is neither copy constructable, nor assignable.
             THEKOGANS_CRYPTO_DISALLOW_COPY_AND_ASSIGN (RSAKeyExchange)
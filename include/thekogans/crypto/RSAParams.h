@@ -0,0 +1,159 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined (__thekogans_crypto_RSAParams_h)
+#define __thekogans_crypto_RSAParams_h
+
+#include <cstddef>
+#include <string>
+#include "thekogans/util/Types.h"
+#include "thekogans/util/SizeT.h"
+#include "thekogans/crypto/Config.h"
+#include "thekogans/crypto/Serializable.h"
+#include "thekogans/crypto/OpenSSLUtils.h"
+#include "thekogans/crypto/AsymmetricKey.h"
+#include "thekogans/crypto/Params.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        /// \struct RSAParams RSAParams.h thekogans/crypto/RSAParams.h
+        ///
+        /// \brief
+        /// RSA keys don't have domain parameters. RSAParams captures the key length
+        /// and public exponent so that RSA keys can be generated through the same
+        /// \see{Params} interface as \see{DSA}, \see{EC} and \see{DH} keys
+        /// (\see{Params::CreateKeys}, \see{EphemeralKeyPool}). Create them with
+        /// \see{RSA::ParamsFromKeyLength}.
+
+        struct _LIB_THEKOGANS_CRYPTO_DECL RSAParams : public Params {
+            /// \brief
+            /// RSAParams is a \see{Serializable}.
+            THEKOGANS_CRYPTO_DECLARE_SERIALIZABLE (RSAParams)
+
+            /// \brief
+            /// The length of the key (in bits).
+            util::SizeT keyLength;
+            /// \brief
+            /// RSA key public exponent.
+            util::ui32 publicExponent;
+
+            /// \brief
+            /// ctor.
+            /// \param[in] keyLength_ The length of the key (in bits).
+            /// \param[in] publicExponent_ RSA key public exponent.
+            /// \param[in] id Optional parameters id.
+            /// \param[in] name Optional parameters name.
+            /// \param[in] description Optional parameters description.
+            RSAParams (
+                std::size_t keyLength_ = 0,
+                util::ui32 publicExponent_ = 65537,
+                const ID &id = ID (),
+                const std::string &name = std::string (),
+                const std::string &description = std::string ()) :
+                Params (id, name, description),
+                keyLength (keyLength_),
+                publicExponent (publicExponent_) {}
+
+            /// \brief
+            /// Return the key type.
+            /// \return Key type.
+            virtual const char *GetKeyType () const override {
+                return OPENSSL_PKEY_RSA;
+            }
+
+            /// \brief
+            /// Create an \see{AsymmetricKey} based on parameters.
+            /// \param[in] id Optional key id.
+            /// \param[in] name Optional key name.
+            /// \param[in] description Optional key description.
+            /// \return \see{AsymmetricKey} based on parameters.
+            virtual AsymmetricKey::SharedPtr CreateKey (
+                const ID &id = ID (),
+                const std::string &name = std::string (),
+                const std::string &description = std::string ()) const override;
+
+        protected:
+            // Serializable
+            /// \brief
+            /// Return the serialized params size.
+            /// \return Serialized params size.
+            virtual std::size_t Size () const override;
+
+            /// \brief
+            /// Read the parameters from the given serializer.
+            /// \param[in] header \see{util::Serializable::BinHeader}.
+            /// \param[in] serializer \see{util::Serializer} to read the parameters from.
+            virtual void Read (
+                const BinHeader &header,
+                util::Serializer &serializer) override;
+            /// \brief
+            /// Write the parameters to the given serializer.
+            /// \param[out] serializer \see{util::Serializer} to write the parameters to.
+            virtual void Write (util::Serializer &serializer) const override;
+
+            /// \brief
+            /// "KeyLength"
+            static const char * const ATTR_KEY_LENGTH;
+            /// \brief
+            /// "PublicExponent"
+            static const char * const ATTR_PUBLIC_EXPONENT;
+
+            /// \brief
+            /// Read the Serializable from an XML DOM.
+            /// \param[in] header \see{util::Serializable::TextHeader}.
+            /// \param[in] node XML DOM representation of a Serializable.
+            virtual void Read (
+                const TextHeader &header,
+                const pugi::xml_node &node) override;
+            /// \brief
+            /// Write the Serializable to the XML DOM.
+            /// \param[out] node Parent node.
+            virtual void Write (pugi::xml_node &node) const override;
+
+            /// \brief
+            /// Read a Serializable from an JSON DOM.
+            /// \param[in] node JSON DOM representation of a Serializable.
+            virtual void Read (
+                const TextHeader &header,
+                const util::JSON::Object &object) override;
+            /// \brief
+            /// Write a Serializable to the JSON DOM.
+            /// \param[out] node Parent node.
+            virtual void Write (util::JSON::Object &object) const override;
+
+            /// \brief
+            /// RSAParams is neither copy constructable, nor assignable.
+            THEKOGANS_CRYPTO_DISALLOW_COPY_AND_ASSIGN (RSAParams)
+        };
+
+        /// \brief
+        /// Implement RSAParams extraction operators.
+        THEKOGANS_UTIL_IMPLEMENT_SERIALIZABLE_EXTRACTION_OPERATORS (RSAParams)
+
+    } // namespace crypto
+
+    namespace util {
+
+        /// \brief
+        /// Implement RSAParams value parser.
+        THEKOGANS_UTIL_IMPLEMENT_SERIALIZABLE_VALUE_PARSER (crypto::RSAParams)
+
+    } // namespace util
+} // namespace thekogans
+
+#endif // !defined (__thekogans_crypto_RSAParams_h)
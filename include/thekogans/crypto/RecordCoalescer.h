@@ -0,0 +1,273 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined (__thekogans_crypto_RecordCoalescer_h)
+#define __thekogans_crypto_RecordCoalescer_h
+
+#include <cstddef>
+#include <vector>
+#include "thekogans/util/Types.h"
+#include "thekogans/util/Buffer.h"
+#include "thekogans/crypto/Config.h"
+#include "thekogans/crypto/Cipher.h"
+#include "thekogans/crypto/KeyRing.h"
+#include "thekogans/crypto/FrameDecoder.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        /// \brief
+        /// Coalesced record layout. The record is a regular
+        /// \see{Cipher::EncryptAndFrame} frame whose plaintext is:
+        ///
+        /// +----------------+-----------+-----+--------------------+---------------+
+        /// | message length | message 0 | ... | message length     | message n - 1 |
+        /// +----------------+-----------+-----+--------------------+---------------+
+        /// |       4        |  length   | ... |         4          |    length     |
+        ///
+        /// All lengths are network endian.
+
+        /// \struct RecordCoalescer RecordCoalescer.h thekogans/crypto/RecordCoalescer.h
+        ///
+        /// \brief
+        /// RecordCoalescer gathers small messages and encrypts them as one AEAD
+        /// record. Chatty protocols sending thousands of tiny messages per second
+        /// pay for iv generation, cipher setup, the tag and the framing overhead
+        /// once per record instead of once per message. A record is emitted when
+        /// the pending messages reach maxRecordLength bytes, or when the oldest
+        /// pending message has waited maxDelay microseconds (see Poll). Use
+        /// \see{RecordSplitter} on the receiving end.
+        ///
+        /// Ex:
+        ///
+        /// \code{.cpp}
+        /// using namespace thekogans;
+        ///
+        /// crypto::RecordCoalescer coalescer (cipher);
+        /// std::vector<util::Buffer> records;
+        /// coalescer.Add (message, messageLength, records);
+        /// ...
+        /// // From the event loop timer (see GetTimeToDeadline).
+        /// coalescer.Poll (records);
+        /// for (std::size_t i = 0; i < records.size (); ++i) {
+        ///     socket.Write (records[i].GetReadPtr (), records[i].GetDataAvailableForReading ());
+        /// }
+        /// \endcode
+
+        struct _LIB_THEKOGANS_CRYPTO_DECL RecordCoalescer {
+            /// \enum
+            /// RecordCoalescer constants.
+            enum {
+                /// \brief
+                /// Default max record plaintext length.
+                DEFAULT_MAX_RECORD_LENGTH = 16 * 1024,
+                /// \brief
+                /// Default max time (in microseconds) a message waits for company.
+                DEFAULT_MAX_DELAY = 1000,
+                /// \brief
+                /// Per message overhead (length prefix).
+                MESSAGE_HEADER_SIZE = util::UI32_SIZE
+            };
+
+        private:
+            /// \brief
+            /// \see{Cipher} used to encrypt the records.
+            Cipher::SharedPtr cipher;
+            /// \brief
+            /// Max record plaintext length.
+            std::size_t maxRecordLength;
+            /// \brief
+            /// Max time (in microseconds) a message waits for company.
+            util::ui64 maxDelay;
+            /// \brief
+            /// Length prefixed pending messages (next record plaintext).
+            std::vector<util::ui8> pending;
+            /// \brief
+            /// Number of pending messages.
+            std::size_t pendingCount;
+            /// \brief
+            /// \see{util::HRTimer::Click} when the first pending message was added.
+            util::ui64 firstPendingTime;
+
+        public:
+            /// \brief
+            /// ctor.
+            /// \param[in] cipher_ \see{Cipher} used to encrypt the records.
+            /// \param[in] maxRecordLength_ Max record plaintext length (messages
+            /// longer than maxRecordLength_ - MESSAGE_HEADER_SIZE are rejected).
+            /// \param[in] maxDelay_ Max time (in microseconds) a message waits
+            /// for company (0 = emit every message as soon as it's added).
+            RecordCoalescer (
+                Cipher::SharedPtr cipher_,
+                std::size_t maxRecordLength_ = DEFAULT_MAX_RECORD_LENGTH,
+                util::ui64 maxDelay_ = DEFAULT_MAX_DELAY);
+
+            /// \brief
+            /// Return the number of pending messages.
+            /// \return Number of pending messages.
+            inline std::size_t GetPendingCount () const {
+                return pendingCount;
+            }
+            /// \brief
+            /// Return the pending record plaintext length.
+            /// \return Pending record plaintext length.
+            inline std::size_t GetPendingLength () const {
+                return pending.size ();
+            }
+
+            /// \brief
+            /// Queue a message. Emits the pending record first if the message
+            /// would not fit in it, and the new record if it's full.
+            /// \param[in] message Message to queue.
+            /// \param[in] messageLength Message length.
+            /// \param[out] records Where to append the emitted records.
+            /// \return Number of records emitted.
+            std::size_t Add (
+                const void *message,
+                std::size_t messageLength,
+                std::vector<util::Buffer> &records);
+            /// \brief
+            /// Emit the pending record if the oldest pending message
+            /// has waited at least maxDelay microseconds.
+            /// \param[out] records Where to append the emitted record.
+            /// \return true == a record was emitted.
+            bool Poll (std::vector<util::Buffer> &records);
+            /// \brief
+            /// Emit the pending record (if any) no matter how small.
+            /// \param[out] records Where to append the emitted record.
+            /// \return true == a record was emitted.
+            bool Flush (std::vector<util::Buffer> &records);
+            /// \brief
+            /// Return the time (in microseconds) until Poll will emit the pending
+            /// record. Use it to arm the event loop timer.
+            /// \return Microseconds until the deadline (0 == due now, or nothing pending).
+            util::ui64 GetTimeToDeadline () const;
+
+            /// \brief
+            /// RecordCoalescer is neither copy constructable, nor assignable.
+            THEKOGANS_CRYPTO_DISALLOW_COPY_AND_ASSIGN (RecordCoalescer)
+        };
+
+        /// \struct RecordSplitter RecordCoalescer.h thekogans/crypto/RecordCoalescer.h
+        ///
+        /// \brief
+        /// RecordSplitter turns a byte stream of records produced by
+        /// \see{RecordCoalescer} back in to messages. Every record is
+        /// authenticated and decrypted once (in place, see \see{FrameDecoder}),
+        /// and it's messages are then handed out one at a time.
+        ///
+        /// Ex:
+        ///
+        /// \code{.cpp}
+        /// using namespace thekogans;
+        ///
+        /// crypto::RecordSplitter recordSplitter (keyRing);
+        /// while (...) {
+        ///     util::ui8 *buffer = recordSplitter.GetWritePtr (CHUNK_SIZE);
+        ///     recordSplitter.AdvanceWriteOffset (socket.Read (buffer, CHUNK_SIZE));
+        ///     crypto::RecordSplitter::Message message;
+        ///     while (recordSplitter.Next (message)) {
+        ///         // message.data, message.length
+        ///     }
+        /// }
+        /// \endcode
+
+        struct _LIB_THEKOGANS_CRYPTO_DECL RecordSplitter {
+            /// \struct RecordSplitter::Message RecordCoalescer.h thekogans/crypto/RecordCoalescer.h
+            ///
+            /// \brief
+            /// A view of a message.
+            /// VERY IMPORTANT: data points in to the splitter receive buffer. It's
+            /// only valid until the next call to GetWritePtr, Feed or Reset.
+            struct _LIB_THEKOGANS_CRYPTO_DECL Message {
+                /// \brief
+                /// Message data.
+                const util::ui8 *data;
+                /// \brief
+                /// Message length.
+                std::size_t length;
+
+                /// \brief
+                /// ctor.
+                Message () :
+                    data (0),
+                    length (0) {}
+            };
+
+        private:
+            /// \brief
+            /// Decrypts the records.
+            FrameDecoder frameDecoder;
+            /// \brief
+            /// Current record.
+            FrameDecoder::Frame frame;
+            /// \brief
+            /// Offset of the next message in the current record.
+            std::size_t frameOffset;
+
+        public:
+            /// \brief
+            /// ctor.
+            /// \param[in] keyRing \see{KeyRing} used to resolve record keys.
+            /// \param[in] maxRecordLength Max record plaintext length
+            /// (see \see{FrameDecoder}).
+            RecordSplitter (
+                KeyRing::SharedPtr keyRing,
+                std::size_t maxRecordLength = FrameDecoder::DEFAULT_MAX_PLAINTEXT_LENGTH);
+
+            /// \brief
+            /// Return a pointer to at least length bytes of free space in the
+            /// receive buffer. Call AdvanceWriteOffset with the number of bytes
+            /// actually written.
+            /// NOTE: Invalidates any outstanding \see{Message} views, and
+            /// discards the rest of the current record. Drain Next first.
+            /// \param[in] length Number of bytes the caller intends to write.
+            /// \return Pointer to at least length bytes of free space.
+            util::ui8 *GetWritePtr (std::size_t length);
+            /// \brief
+            /// Commit bytes written to the pointer returned by GetWritePtr.
+            /// \param[in] length Number of bytes written.
+            inline void AdvanceWriteOffset (std::size_t length) {
+                frameDecoder.AdvanceWriteOffset (length);
+            }
+            /// \brief
+            /// Append a chunk to the receive buffer (see GetWritePtr).
+            /// \param[in] chunk Chunk to append.
+            /// \param[in] length Chunk length.
+            void Feed (
+                const void *chunk,
+                std::size_t length);
+
+            /// \brief
+            /// Return the next message, decrypting the next record if needed.
+            /// \param[out] message Message view.
+            /// \return true = message returned, false = need more data.
+            bool Next (Message &message);
+
+            /// \brief
+            /// Discard all buffered data.
+            void Reset ();
+
+            /// \brief
+            /// RecordSplitter is neither copy constructable, nor assignable.
+            THEKOGANS_CRYPTO_DISALLOW_COPY_AND_ASSIGN (RecordSplitter)
+        };
+
+    } // namespace crypto
+} // namespace thekogans
+
+#endif // !defined (__thekogans_crypto_RecordCoalescer_h)
@@ -0,0 +1,255 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+
+#if !defined (__thekogans_crypto_RekeyingCipher_h)
+#define __thekogans_crypto_RekeyingCipher_h
+
+#include <cstddef>
+#include <openssl/evp.h>
+#include "thekogans/util/Types.h"
+#include "thekogans/util/RefCounted.h"
+#include "thekogans/util/Allocator.h"
+#include "thekogans/util/Buffer.h"
+#include "thekogans/crypto/Config.h"
+#include "thekogans/crypto/SymmetricKey.h"
+#include "thekogans/crypto/Cipher.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        /// \struct RekeyingCipher RekeyingCipher.h thekogans/crypto/RekeyingCipher.h
+        ///
+        /// \brief
+        /// RekeyingCipher wraps a \see{Cipher} for long lived channels. It watches the
+        /// encryptor \see{Stats} and, once either the message or the byte count reaches
+        /// it's threshold, derives the next key locally:
+        ///
+        /// key[epoch + 1] = HKDF (key[epoch], salt = epoch + 1, info = "RekeyingCipher")
+        ///
+        /// No public key operations (or round trips) are needed; both peers derive
+        /// the same key sequence from the negotiated key. Every message is prefixed
+        /// with the (network order) epoch that encrypted it:
+        ///
+        /// +-------+-------------------------------------+
+        /// | epoch | \see{Cipher::Encrypt} output        |
+        /// +-------+-------------------------------------+
+        /// |   4   |
+        ///
+        /// When the peer moves to epoch + 1 the decryptor follows (after the message
+        /// authenticates). The previous key is kept for previousKeyLifetime seconds
+        /// so that messages in flight during the switch still decrypt.
+        ///
+        /// NOTE: Like \see{Cipher}, RekeyingCipher is not thread safe.
+
+        struct _LIB_THEKOGANS_CRYPTO_DECL RekeyingCipher : public virtual util::RefCounted {
+            /// \brief
+            /// Declare \see{util::RefCounted} pointers.
+            THEKOGANS_UTIL_DECLARE_REF_COUNTED_POINTERS (RekeyingCipher)
+
+            /// \enum
+            /// RekeyingCipher constants.
+            enum {
+                /// \brief
+                /// Epoch prefix length.
+                EPOCH_LENGTH = util::UI32_SIZE,
+                /// \brief
+                /// Default max messages per key (well below the 2^32
+                /// random 96 bit GCM IV limit).
+                DEFAULT_MAX_MESSAGES = 1 << 30,
+                /// \brief
+                /// Default max gigabytes per key.
+                DEFAULT_MAX_GIGABYTES = 64,
+                /// \brief
+                /// Default previous key lifetime (in seconds).
+                DEFAULT_PREVIOUS_KEY_LIFETIME = 30
+            };
+
+        private:
+            /// \brief
+            /// Current key.
+            SymmetricKey::SharedPtr key;
+            /// \brief
+            /// OpenSSL cipher object.
+            const EVP_CIPHER *cipher;
+            /// \brief
+            /// OpenSSL message digest object.
+            const EVP_MD *md;
+            /// \brief
+            /// Rekey after this many messages.
+            util::ui64 maxMessages;
+            /// \brief
+            /// Rekey after this many bytes.
+            util::ui64 maxBytes;
+            /// \brief
+            /// How long to keep the previous key (in seconds).
+            util::f64 previousKeyLifetime;
+            /// \brief
+            /// Current epoch.
+            util::ui32 epoch;
+            /// \brief
+            /// \see{Cipher} for the current epoch.
+            Cipher::SharedPtr current;
+            /// \brief
+            /// \see{Cipher} for epoch - 1 (if still alive).
+            Cipher::SharedPtr previous;
+            /// \brief
+            /// When previous was retired (\see{util::HRTimer::Click}).
+            util::ui64 previousRetireTime;
+            /// \brief
+            /// Key for epoch + 1 (derived on first use, see GetNextCipher).
+            SymmetricKey::SharedPtr nextKey;
+            /// \brief
+            /// \see{Cipher} for epoch + 1 (derived on first use, see GetNextCipher).
+            Cipher::SharedPtr next;
+
+        public:
+            /// \brief
+            /// ctor.
+            /// \param[in] key_ Negotiated (epoch 0) key.
+            /// \param[in] cipher_ OpenSSL EVP_CIPHER.
+            /// \param[in] md_ OpenSSL EVP_MD (CBC mode only, ignored in GCM mode).
+            /// \param[in] maxMessages_ Rekey after this many messages.
+            /// \param[in] maxBytes_ Rekey after this many bytes.
+            /// \param[in] previousKeyLifetime_ How long to keep the previous key (in seconds).
+            RekeyingCipher (
+                SymmetricKey::SharedPtr key_,
+                const EVP_CIPHER *cipher_ = THEKOGANS_CRYPTO_DEFAULT_CIPHER,
+                const EVP_MD *md_ = THEKOGANS_CRYPTO_DEFAULT_MD,
+                util::ui64 maxMessages_ = DEFAULT_MAX_MESSAGES,
+                util::ui64 maxBytes_ = (util::ui64)DEFAULT_MAX_GIGABYTES << 30,
+                util::f64 previousKeyLifetime_ = DEFAULT_PREVIOUS_KEY_LIFETIME);
+
+            /// \brief
+            /// Return the max buffer length needed to encrypt the given plaintext.
+            /// \param[in] plaintextLength Plaintext length.
+            /// \return Max buffer length.
+            static std::size_t GetMaxBufferLength (std::size_t plaintextLength) {
+                return EPOCH_LENGTH + Cipher::GetMaxBufferLength (plaintextLength);
+            }
+
+            /// \brief
+            /// Return the current epoch.
+            /// \return Current epoch.
+            inline util::ui32 GetEpoch () const {
+                return epoch;
+            }
+            /// \brief
+            /// Return the \see{Cipher} for the current epoch.
+            /// \return \see{Cipher} for the current epoch.
+            inline Cipher::SharedPtr GetCipher () const {
+                return current;
+            }
+
+            /// \brief
+            /// Move to the next epoch now (regardless of the thresholds).
+            void Rekey ();
+
+            /// \brief
+            /// Encrypt (and prefix with the epoch) the given plaintext.
+            /// Rekeys first if a threshold was reached.
+            /// \param[in] plaintext Plaintext to encrypt.
+            /// \param[in] plaintextLength Plaintext length.
+            /// \param[in] associatedData Optional associated data (GCM mode only).
+            /// \param[in] associatedDataLength Associated data length.
+            /// \param[out] ciphertext Where to write the ciphertext
+            /// (GetMaxBufferLength (plaintextLength) bytes).
+            /// \return Number of bytes written to ciphertext.
+            std::size_t Encrypt (
+                const void *plaintext,
+                std::size_t plaintextLength,
+                const void *associatedData,
+                std::size_t associatedDataLength,
+                util::ui8 *ciphertext);
+            /// \brief
+            /// Encrypt (and prefix with the epoch) the given plaintext.
+            /// \param[in] plaintext Plaintext to encrypt.
+            /// \param[in] plaintextLength Plaintext length.
+            /// \param[in] associatedData Optional associated data (GCM mode only).
+            /// \param[in] associatedDataLength Associated data length.
+            /// \param[in] allocator Optional allocator for the returned buffer (0 = heap).
+            /// \return Epoch and ciphertext.
+            util::Buffer Encrypt (
+                const void *plaintext,
+                std::size_t plaintextLength,
+                const void *associatedData = 0,
+                std::size_t associatedDataLength = 0,
+                util::Allocator *allocator = 0);
+
+            /// \brief
+            /// Decrypt a message produced by Encrypt (here or at the peer).
+            /// \param[in] ciphertext Epoch and ciphertext.
+            /// \param[in] ciphertextLength Ciphertext length.
+            /// \param[in] associatedData Optional associated data (GCM mode only).
+            /// \param[in] associatedDataLength Associated data length.
+            /// \param[out] plaintext Where to write the plaintext.
+            /// \return Number of bytes written to plaintext.
+            std::size_t Decrypt (
+                const void *ciphertext,
+                std::size_t ciphertextLength,
+                const void *associatedData,
+                std::size_t associatedDataLength,
+                util::ui8 *plaintext);
+            /// \brief
+            /// Decrypt a message produced by Encrypt (here or at the peer).
+            /// \param[in] ciphertext Epoch and ciphertext.
+            /// \param[in] ciphertextLength Ciphertext length.
+            /// \param[in] associatedData Optional associated data (GCM mode only).
+            /// \param[in] associatedDataLength Associated data length.
+            /// \param[in] secure true == return the plaintext in a secure buffer.
+            /// \return Plaintext.
+            util::Buffer Decrypt (
+                const void *ciphertext,
+                std::size_t ciphertextLength,
+                const void *associatedData = 0,
+                std::size_t associatedDataLength = 0,
+                bool secure = false);
+
+        private:
+            /// \brief
+            /// Derive the key for the next epoch.
+            /// \return Next epoch's \see{SymmetricKey}.
+            SymmetricKey::SharedPtr DeriveNextKey () const;
+            /// \brief
+            /// Return the \see{Cipher} for epoch + 1. The key is derived once
+            /// and cached until Advance, so that a stream of (forged or
+            /// early) next epoch messages doesn't run HKDF for every one.
+            /// \return \see{Cipher} for epoch + 1.
+            Cipher::SharedPtr GetNextCipher ();
+            /// \brief
+            /// Make the next epoch current and retire the current one.
+            void Advance ();
+            /// \brief
+            /// Pick the \see{Cipher} for the given epoch.
+            /// \param[in] ciphertext Epoch and ciphertext.
+            /// \param[in] ciphertextLength Ciphertext length.
+            /// \param[out] messageEpoch Epoch parsed from the ciphertext.
+            /// \return \see{Cipher} for messageEpoch (0 == messageEpoch is epoch + 1).
+            Cipher::SharedPtr GetDecryptCipher (
+                const void *ciphertext,
+                std::size_t ciphertextLength,
+                util::ui32 &messageEpoch);
+
+            /// \brief
+            /// RekeyingCipher is neither copy constructable, nor assignable.
+            THEKOGANS_CRYPTO_DISALLOW_COPY_AND_ASSIGN (RekeyingCipher)
+        };
+
+    } // namespace crypto
+} // namespace thekogans
+
+#endif // !defined (__thekogans_crypto_RekeyingCipher_h)
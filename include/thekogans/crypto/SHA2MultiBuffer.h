@@ -0,0 +1,141 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined (__thekogans_crypto_SHA2MultiBuffer_h)
+#define __thekogans_crypto_SHA2MultiBuffer_h
+
+#include <cstddef>
+#include <openssl/evp.h>
+#include "thekogans/util/Types.h"
+#include "thekogans/crypto/Config.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        /// \struct SHA2MultiBuffer SHA2MultiBuffer.h thekogans/crypto/SHA2MultiBuffer.h
+        ///
+        /// \brief
+        /// SHA2MultiBuffer hashes many independent messages at once by running
+        /// one message per SIMD lane (8/16 SHA-256 lanes and 4/8 SHA-512 lanes
+        /// with AVX2/AVX-512, 4/2 with NEON). SHA-2 is a serial computation, so
+        /// a single message can't use the vector units. Small messages (IDs,
+        /// key material, manifests) are also dominated by per call EVP
+        /// overhead which the batch amortizes. The kernel is picked at runtime
+        /// based on \see{CPUFeatures}. The scalar kernel is there for
+        /// portability and testing; \see{MessageDigest::HashBatch} uses
+        /// OpenSSL instead of it.
+
+        struct _LIB_THEKOGANS_CRYPTO_DECL SHA2MultiBuffer {
+            /// \enum
+            /// Supported algorithms.
+            enum Algorithm {
+                /// \brief
+                /// SHA-224.
+                SHA224,
+                /// \brief
+                /// SHA-256.
+                SHA256,
+                /// \brief
+                /// SHA-384.
+                SHA384,
+                /// \brief
+                /// SHA-512.
+                SHA512
+            };
+
+            /// \enum
+            /// Kernels.
+            enum Kernel {
+                /// \brief
+                /// Best kernel for the algorithm (\see{GetBestKernel}).
+                KERNEL_AUTO,
+                /// \brief
+                /// Portable one lane kernel.
+                KERNEL_SCALAR,
+                /// \brief
+                /// ARM NEON (128 bit).
+                KERNEL_NEON,
+                /// \brief
+                /// x86 AVX2 (256 bit).
+                KERNEL_AVX2,
+                /// \brief
+                /// x86 AVX-512F (512 bit).
+                KERNEL_AVX512
+            };
+
+            /// \brief
+            /// Map an OpenSSL message digest to a SHA2MultiBuffer algorithm.
+            /// \param[in] md OpenSSL message digest.
+            /// \param[out] algorithm The corresponding algorithm.
+            /// \return true == md is supported, false == it's not.
+            static bool GetAlgorithm (
+                const EVP_MD *md,
+                Algorithm &algorithm);
+            /// \brief
+            /// Return the digest length of the given algorithm.
+            /// \param[in] algorithm Algorithm whose digest length to return.
+            /// \return Digest length.
+            static std::size_t GetDigestLength (Algorithm algorithm);
+
+            /// \brief
+            /// Return true if the given kernel can run on this cpu.
+            /// \param[in] kernel Kernel to check.
+            /// \return true == the kernel can run on this cpu.
+            static bool IsKernelSupported (Kernel kernel);
+            /// \brief
+            /// Return the best kernel for the given algorithm. If the cpu
+            /// hashes single messages in hardware faster than the widest
+            /// vector kernel (ARMv8 SHA extensions), KERNEL_SCALAR is returned.
+            /// \param[in] algorithm Algorithm whose best kernel to return.
+            /// \return Best kernel for the given algorithm.
+            static Kernel GetBestKernel (Algorithm algorithm);
+            /// \brief
+            /// Return the number of lanes (messages hashed in parallel).
+            /// \param[in] algorithm Algorithm whose lane count to return.
+            /// \param[in] kernel Kernel whose lane count to return.
+            /// \return Number of lanes.
+            static std::size_t GetLaneCount (
+                Algorithm algorithm,
+                Kernel kernel = KERNEL_AUTO);
+            /// \brief
+            /// Return the kernel name.
+            /// \param[in] kernel Kernel whose name to return.
+            /// \return Kernel name.
+            static const char *KernelToString (Kernel kernel);
+
+            /// \brief
+            /// Hash count independent messages.
+            /// \param[in] algorithm Algorithm to hash with.
+            /// \param[in] buffers Messages to hash.
+            /// \param[in] lengths Message lengths.
+            /// \param[in] count Number of messages.
+            /// \param[out] digests Where to put count * GetDigestLength (algorithm)
+            /// bytes of digests (in message order).
+            /// \param[in] kernel Kernel to use (throws if not supported).
+            static void Hash (
+                Algorithm algorithm,
+                const void * const *buffers,
+                const std::size_t *lengths,
+                std::size_t count,
+                util::ui8 *digests,
+                Kernel kernel = KERNEL_AUTO);
+        };
+
+    } // namespace crypto
+} // namespace thekogans
+
+#endif // !defined (__thekogans_crypto_SHA2MultiBuffer_h)
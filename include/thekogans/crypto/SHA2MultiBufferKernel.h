@@ -0,0 +1,395 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined (__thekogans_crypto_SHA2MultiBufferKernel_h)
+#define __thekogans_crypto_SHA2MultiBufferKernel_h
+
+#include <cstddef>
+#include <cstring>
+#include "thekogans/util/Types.h"
+#include "thekogans/crypto/Config.h"
+
+#if defined (__x86_64__) || defined (_M_X64) || defined (__i386__) || defined (_M_IX86)
+    #define THEKOGANS_CRYPTO_SHA2_MULTI_BUFFER_X86
+#elif defined (__ARM_NEON) || defined (__ARM_NEON__) || defined (_M_ARM64)
+    #define THEKOGANS_CRYPTO_SHA2_MULTI_BUFFER_NEON
+#endif // defined (__x86_64__) || defined (_M_X64) || defined (__i386__) || defined (_M_IX86)
+
+// NOTE: This header is private to the SHA2MultiBuffer*.cpp translation
+// units. Each one includes it after switching the target instruction set
+// (#pragma GCC target/#pragma clang attribute) and instantiates
+// SHA2MultiBufferKernel with its own (anonymous namespace) Lanes type.
+// That gives every instantiation internal linkage, so code compiled for
+// AVX2/AVX-512 can never be picked by the linker for a generic caller.
+// For the same reason, nothing in here may call an inline function or a
+// template (std::min...) that is not parameterized by Lanes.
+
+namespace thekogans {
+    namespace crypto {
+
+        /// \struct SHA2Traits SHA2MultiBufferKernel.h thekogans/crypto/SHA2MultiBufferKernel.h
+        ///
+        /// \brief
+        /// SHA-256 (util::ui32) and SHA-512 (util::ui64) constants (FIPS 180-4).
+        template<typename Word>
+        struct SHA2Traits;
+
+        template<>
+        struct SHA2Traits<util::ui32> {
+            enum {
+                BLOCK_SIZE = 64,
+                LENGTH_SIZE = 8,
+                ROUNDS = 64,
+                S0A = 2, S0B = 13, S0C = 22,
+                S1A = 6, S1B = 11, S1C = 25,
+                s0A = 7, s0B = 18, s0C = 3,
+                s1A = 17, s1B = 19, s1C = 10
+            };
+            /// \brief
+            /// Round constants.
+            static const util::ui32 K[ROUNDS];
+        };
+
+        template<>
+        struct SHA2Traits<util::ui64> {
+            enum {
+                BLOCK_SIZE = 128,
+                LENGTH_SIZE = 16,
+                ROUNDS = 80,
+                S0A = 28, S0B = 34, S0C = 39,
+                S1A = 14, S1B = 18, S1C = 41,
+                s0A = 1, s0B = 8, s0C = 7,
+                s1A = 19, s1B = 61, s1C = 6
+            };
+            /// \brief
+            /// Round constants.
+            static const util::ui64 K[ROUNDS];
+        };
+
+        /// \struct SHA2MultiBufferKernel SHA2MultiBufferKernel.h thekogans/crypto/SHA2MultiBufferKernel.h
+        ///
+        /// \brief
+        /// Hashes independent messages in Lanes::COUNT parallel lanes. Every
+        /// lane runs its own message through the compression function. When
+        /// a lane's message is done, its digest is written out and the lane
+        /// is refilled with the next pending message, so messages of mixed
+        /// lengths keep all lanes busy for as long as there's work.
+        ///
+        /// Lanes provides:
+        /// typedef Word; typedef Vector; enum {COUNT};
+        /// static Vector Load (const Word *words); // aligned, COUNT words
+        /// static void Store (Word *words, Vector v); // aligned, COUNT words
+        /// static Vector Set1 (Word word);
+        /// static Vector Add (Vector a, Vector b);
+        /// static Vector Xor (Vector a, Vector b);
+        /// static Vector And (Vector a, Vector b);
+        /// static Vector Or (Vector a, Vector b);
+        /// template<int N> static Vector Rotr (Vector v);
+        /// template<int N> static Vector Shr (Vector v);
+        template<typename Lanes>
+        struct SHA2MultiBufferKernel {
+            typedef typename Lanes::Word Word;
+            typedef typename Lanes::Vector Vector;
+            typedef SHA2Traits<Word> Traits;
+            enum {
+                COUNT = Lanes::COUNT,
+                BLOCK_SIZE = Traits::BLOCK_SIZE,
+                WORD_SIZE = sizeof (Word)
+            };
+
+            /// \brief
+            /// Hash count messages.
+            /// \param[in] buffers Messages to hash.
+            /// \param[in] lengths Message lengths.
+            /// \param[in] count Number of messages.
+            /// \param[in] iv Initial hash value (8 words).
+            /// \param[in] digestLength Digest length (<= 8 words, SHA-224/384 truncate).
+            /// \param[out] digests count * digestLength bytes.
+            static void Hash (
+                    const util::ui8 * const *buffers,
+                    const std::size_t *lengths,
+                    std::size_t count,
+                    const Word *iv,
+                    std::size_t digestLength,
+                    util::ui8 *digests) {
+                Lane lanes[COUNT];
+                std::size_t next = 0;
+                std::size_t active = 0;
+                for (std::size_t i = 0; i < COUNT; ++i) {
+                    if (lanes[i].Assign (buffers, lengths, count, next, iv)) {
+                        ++active;
+                    }
+                }
+                // Idle lanes hash this block and their result is discarded.
+                static const util::ui8 idleBlock[BLOCK_SIZE] = {0};
+                alignas (64) Word schedule[16][COUNT];
+                alignas (64) Word state[8][COUNT];
+                while (active > 0) {
+                    for (std::size_t i = 0; i < COUNT; ++i) {
+                        const util::ui8 *block = lanes[i].IsActive () ?
+                            lanes[i].GetBlock () : idleBlock;
+                        for (std::size_t t = 0; t < 16; ++t) {
+                            schedule[t][i] = LoadBigEndian (block + t * WORD_SIZE);
+                        }
+                        for (std::size_t j = 0; j < 8; ++j) {
+                            state[j][i] = lanes[i].state[j];
+                        }
+                    }
+                    Compress (schedule, state);
+                    for (std::size_t i = 0; i < COUNT; ++i) {
+                        if (lanes[i].IsActive ()) {
+                            for (std::size_t j = 0; j < 8; ++j) {
+                                lanes[i].state[j] = state[j][i];
+                            }
+                            if (lanes[i].Advance ()) {
+                                lanes[i].Finish (digestLength, digests);
+                                if (!lanes[i].Assign (buffers, lengths, count, next, iv)) {
+                                    --active;
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+
+        private:
+            struct Lane {
+                /// \brief
+                /// Index of the message being hashed (-1 == idle).
+                std::size_t message;
+                /// \brief
+                /// Next full block of the message.
+                const util::ui8 *data;
+                /// \brief
+                /// Full blocks left in data.
+                std::size_t dataBlocks;
+                /// \brief
+                /// Padded last one or two blocks.
+                util::ui8 tail[2 * BLOCK_SIZE];
+                /// \brief
+                /// Tail blocks left.
+                std::size_t tailBlocks;
+                /// \brief
+                /// Index of the next tail block.
+                std::size_t tailIndex;
+                /// \brief
+                /// Chaining value.
+                Word state[8];
+
+                Lane () :
+                    message ((std::size_t)-1),
+                    data (0),
+                    dataBlocks (0),
+                    tailBlocks (0),
+                    tailIndex (0) {}
+
+                inline bool IsActive () const {
+                    return message != (std::size_t)-1;
+                }
+
+                bool Assign (
+                        const util::ui8 * const *buffers,
+                        const std::size_t *lengths,
+                        std::size_t count,
+                        std::size_t &next,
+                        const Word *iv) {
+                    if (next < count) {
+                        message = next++;
+                        std::size_t length = lengths[message];
+                        data = buffers[message];
+                        dataBlocks = length / BLOCK_SIZE;
+                        std::size_t remainder = length % BLOCK_SIZE;
+                        tailBlocks = remainder + 1 + Traits::LENGTH_SIZE <= BLOCK_SIZE ? 1 : 2;
+                        tailIndex = 0;
+                        std::size_t tailLength = tailBlocks * BLOCK_SIZE;
+                        memset (tail, 0, tailLength);
+                        if (remainder > 0) {
+                            memcpy (tail, data + dataBlocks * BLOCK_SIZE, remainder);
+                        }
+                        tail[remainder] = 0x80;
+                        // Big endian bit length (the high 64 bits of SHA-512's
+                        // 128 bit length field are always 0 for in memory messages).
+                        util::ui64 bitLength = (util::ui64)length << 3;
+                        for (std::size_t i = 0; i < 8; ++i) {
+                            tail[tailLength - 1 - i] = (util::ui8)(bitLength >> (i * 8));
+                        }
+                        for (std::size_t i = 0; i < 8; ++i) {
+                            state[i] = iv[i];
+                        }
+                        return true;
+                    }
+                    message = (std::size_t)-1;
+                    return false;
+                }
+
+                inline const util::ui8 *GetBlock () const {
+                    return dataBlocks > 0 ? data : tail + tailIndex * BLOCK_SIZE;
+                }
+
+                // Return true when the last block has been compressed.
+                inline bool Advance () {
+                    if (dataBlocks > 0) {
+                        data += BLOCK_SIZE;
+                        --dataBlocks;
+                        return false;
+                    }
+                    ++tailIndex;
+                    return --tailBlocks == 0;
+                }
+
+                void Finish (
+                        std::size_t digestLength,
+                        util::ui8 *digests) {
+                    util::ui8 *digest = digests + message * digestLength;
+                    for (std::size_t i = 0; i < digestLength; ++i) {
+                        digest[i] = (util::ui8)(state[i / WORD_SIZE] >>
+                            ((WORD_SIZE - 1 - i % WORD_SIZE) * 8));
+                    }
+                }
+            };
+
+            static inline Word LoadBigEndian (const util::ui8 *bytes) {
+                Word word;
+                memcpy (&word, bytes, WORD_SIZE);
+            #if defined (__GNUC__) && defined (__BYTE_ORDER__) &&\
+                    __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+                return WORD_SIZE == 4 ?
+                    (Word)__builtin_bswap32 ((util::ui32)word) :
+                    (Word)__builtin_bswap64 ((util::ui64)word);
+            #else // defined (__GNUC__) && defined (__BYTE_ORDER__) &&
+                  // __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+                word = 0;
+                for (std::size_t i = 0; i < WORD_SIZE; ++i) {
+                    word = (Word)((word << 8) | bytes[i]);
+                }
+                return word;
+            #endif // defined (__GNUC__) && defined (__BYTE_ORDER__) &&
+                   // __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            }
+
+            static inline Vector Sigma0 (Vector x) {
+                return Lanes::Xor (
+                    Lanes::Xor (
+                        Lanes::template Rotr<Traits::S0A> (x),
+                        Lanes::template Rotr<Traits::S0B> (x)),
+                    Lanes::template Rotr<Traits::S0C> (x));
+            }
+            static inline Vector Sigma1 (Vector x) {
+                return Lanes::Xor (
+                    Lanes::Xor (
+                        Lanes::template Rotr<Traits::S1A> (x),
+                        Lanes::template Rotr<Traits::S1B> (x)),
+                    Lanes::template Rotr<Traits::S1C> (x));
+            }
+            static inline Vector sigma0 (Vector x) {
+                return Lanes::Xor (
+                    Lanes::Xor (
+                        Lanes::template Rotr<Traits::s0A> (x),
+                        Lanes::template Rotr<Traits::s0B> (x)),
+                    Lanes::template Shr<Traits::s0C> (x));
+            }
+            static inline Vector sigma1 (Vector x) {
+                return Lanes::Xor (
+                    Lanes::Xor (
+                        Lanes::template Rotr<Traits::s1A> (x),
+                        Lanes::template Rotr<Traits::s1B> (x)),
+                    Lanes::template Shr<Traits::s1C> (x));
+            }
+            // Ch (e, f, g) = (e & f) ^ (~e & g) = g ^ (e & (f ^ g))
+            static inline Vector Ch (
+                    Vector e,
+                    Vector f,
+                    Vector g) {
+                return Lanes::Xor (g, Lanes::And (e, Lanes::Xor (f, g)));
+            }
+            // Maj (a, b, c) = (a & b) | (c & (a | b))
+            static inline Vector Maj (
+                    Vector a,
+                    Vector b,
+                    Vector c) {
+                return Lanes::Or (Lanes::And (a, b), Lanes::And (c, Lanes::Or (a, b)));
+            }
+
+            static void Compress (
+                    const Word schedule[16][COUNT],
+                    Word state[8][COUNT]) {
+                Vector w[16];
+                for (std::size_t t = 0; t < 16; ++t) {
+                    w[t] = Lanes::Load (schedule[t]);
+                }
+                Vector a = Lanes::Load (state[0]);
+                Vector b = Lanes::Load (state[1]);
+                Vector c = Lanes::Load (state[2]);
+                Vector d = Lanes::Load (state[3]);
+                Vector e = Lanes::Load (state[4]);
+                Vector f = Lanes::Load (state[5]);
+                Vector g = Lanes::Load (state[6]);
+                Vector h = Lanes::Load (state[7]);
+                for (std::size_t t = 0; t < Traits::ROUNDS; ++t) {
+                    if (t >= 16) {
+                        w[t & 15] = Lanes::Add (
+                            Lanes::Add (sigma1 (w[(t - 2) & 15]), w[(t - 7) & 15]),
+                            Lanes::Add (sigma0 (w[(t - 15) & 15]), w[t & 15]));
+                    }
+                    Vector t1 = Lanes::Add (
+                        Lanes::Add (h, Sigma1 (e)),
+                        Lanes::Add (
+                            Ch (e, f, g),
+                            Lanes::Add (Lanes::Set1 (Traits::K[t]), w[t & 15])));
+                    Vector t2 = Lanes::Add (Sigma0 (a), Maj (a, b, c));
+                    h = g;
+                    g = f;
+                    f = e;
+                    e = Lanes::Add (d, t1);
+                    d = c;
+                    c = b;
+                    b = a;
+                    a = Lanes::Add (t1, t2);
+                }
+                Lanes::Store (state[0], Lanes::Add (a, Lanes::Load (state[0])));
+                Lanes::Store (state[1], Lanes::Add (b, Lanes::Load (state[1])));
+                Lanes::Store (state[2], Lanes::Add (c, Lanes::Load (state[2])));
+                Lanes::Store (state[3], Lanes::Add (d, Lanes::Load (state[3])));
+                Lanes::Store (state[4], Lanes::Add (e, Lanes::Load (state[4])));
+                Lanes::Store (state[5], Lanes::Add (f, Lanes::Load (state[5])));
+                Lanes::Store (state[6], Lanes::Add (g, Lanes::Load (state[6])));
+                Lanes::Store (state[7], Lanes::Add (h, Lanes::Load (state[7])));
+            }
+        };
+
+    #if defined (THEKOGANS_CRYPTO_SHA2_MULTI_BUFFER_X86)
+        // Entry points of the x86 kernels (each lives in its own
+        // translation unit compiled for the given instruction set).
+        #define THEKOGANS_CRYPTO_DECLARE_SHA2_MULTI_BUFFER_KERNEL(name, Word)\
+            void name (\
+                const util::ui8 * const *buffers,\
+                const std::size_t *lengths,\
+                std::size_t count,\
+                const Word *iv,\
+                std::size_t digestLength,\
+                util::ui8 *digests);
+
+        THEKOGANS_CRYPTO_DECLARE_SHA2_MULTI_BUFFER_KERNEL (SHA256MultiBufferAVX2, util::ui32)
+        THEKOGANS_CRYPTO_DECLARE_SHA2_MULTI_BUFFER_KERNEL (SHA512MultiBufferAVX2, util::ui64)
+        THEKOGANS_CRYPTO_DECLARE_SHA2_MULTI_BUFFER_KERNEL (SHA256MultiBufferAVX512, util::ui32)
+        THEKOGANS_CRYPTO_DECLARE_SHA2_MULTI_BUFFER_KERNEL (SHA512MultiBufferAVX512, util::ui64)
+    #endif // defined (THEKOGANS_CRYPTO_SHA2_MULTI_BUFFER_X86)
+
+    } // namespace crypto
+} // namespace thekogans
+
+#endif // !defined (__thekogans_crypto_SHA2MultiBufferKernel_h)
@@ -0,0 +1,181 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined (__thekogans_crypto_SecureMemoryStats_h)
+#define __thekogans_crypto_SecureMemoryStats_h
+
+#include <cstddef>
+#include <atomic>
+#include <string>
+#include <vector>
+#include "thekogans/util/Types.h"
+#include "thekogans/util/Allocator.h"
+#include "thekogans/crypto/Config.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        /// \struct SecureMemoryAllocator SecureMemoryStats.h thekogans/crypto/SecureMemoryStats.h
+        ///
+        /// \brief
+        /// SecureMemoryAllocator forwards to \see{ThreadCacheAllocator::SecureInstance}
+        /// and keeps track of the secure memory used by one type (or subsystem).
+        /// Every \see{Serializable} gets one (\see{THEKOGANS_CRYPTO_IMPLEMENT_SERIALIZABLE}).
+        /// Use \see{SecureMemoryStats::GetAllocator} to get one for your own types.
+
+        struct _LIB_THEKOGANS_CRYPTO_DECL SecureMemoryAllocator : public util::Allocator {
+            /// \brief
+            /// SecureMemoryAllocator participates in the \see{util::Allocator}
+            /// dynamic discovery and creation.
+            THEKOGANS_UTIL_DECLARE_ALLOCATOR (SecureMemoryAllocator)
+
+        private:
+            /// \brief
+            /// Name of the type whose memory this allocator tracks.
+            std::string name;
+            /// \brief
+            /// Bytes currently allocated.
+            std::atomic<util::ui64> bytesInUse;
+            /// \brief
+            /// Most bytes ever allocated at once.
+            std::atomic<util::ui64> highWaterMark;
+            /// \brief
+            /// Number of calls to Alloc.
+            std::atomic<util::ui64> allocationCount;
+            /// \brief
+            /// Number of calls to Free.
+            std::atomic<util::ui64> freeCount;
+
+        public:
+            /// \brief
+            /// ctor.
+            /// \param[in] name_ Name of the type whose memory this allocator tracks.
+            explicit SecureMemoryAllocator (const std::string &name_ = std::string ()) :
+                name (name_),
+                bytesInUse (0),
+                highWaterMark (0),
+                allocationCount (0),
+                freeCount (0) {}
+
+            /// \brief
+            /// Allocate a block.
+            /// NOTE: Allocator policy is to return (void *)0 if size == 0.
+            /// if size > 0 and an error occurs, Allocator will throw an exception.
+            /// \param[in] size Size of block to allocate.
+            /// \return Pointer to the allocated block ((void *)0 if size == 0).
+            virtual void *Alloc (std::size_t size) override;
+            /// \brief
+            /// Free a previously Alloc(ated) block.
+            /// NOTE: Allocator policy is to do nothing if ptr == 0.
+            /// \param[in] ptr Pointer to the block returned by Alloc.
+            /// \param[in] size Same size parameter previously passed in to Alloc.
+            virtual void Free (
+                void *ptr,
+                std::size_t size) override;
+
+            /// \brief
+            /// SecureMemoryStats needs access to the counters.
+            friend struct SecureMemoryStats;
+
+            /// \brief
+            /// SecureMemoryAllocator is neither copy constructable, nor assignable.
+            THEKOGANS_CRYPTO_DISALLOW_COPY_AND_ASSIGN (SecureMemoryAllocator)
+        };
+
+        /// \struct SecureMemoryStats SecureMemoryStats.h thekogans/crypto/SecureMemoryStats.h
+        ///
+        /// \brief
+        /// SecureMemoryStats reports how much secure memory thekogans_crypto
+        /// is using, in total and per type, and manages the size of the locked
+        /// working set (\see{util::SecureAllocator::ReservePages}). If a max
+        /// working set size is given (\see{SetWorkingSetSize}), the working set
+        /// is doubled (up to the max) whenever the bytes in use exceed it, instead
+        /// of requiring a correct guess at startup.
+        ///
+        /// NOTE: Counters are kept at the page granularity of the \see{Serializable}
+        /// heaps, which is what determines how much memory is locked.
+        /// Allocation rates are computed by diffing two snapshots.
+
+        struct _LIB_THEKOGANS_CRYPTO_DECL SecureMemoryStats {
+            /// \struct SecureMemoryStats::Counters SecureMemoryStats.h thekogans/crypto/SecureMemoryStats.h
+            ///
+            /// \brief
+            /// A snapshot of the secure memory counters.
+            struct _LIB_THEKOGANS_CRYPTO_DECL Counters {
+                /// \brief
+                /// Type name (empty for the totals).
+                std::string name;
+                /// \brief
+                /// Bytes currently allocated.
+                util::ui64 bytesInUse;
+                /// \brief
+                /// Most bytes ever allocated at once.
+                util::ui64 highWaterMark;
+                /// \brief
+                /// Number of calls to Alloc.
+                util::ui64 allocationCount;
+                /// \brief
+                /// Number of calls to Free.
+                util::ui64 freeCount;
+
+                /// \brief
+                /// ctor.
+                Counters () :
+                    bytesInUse (0),
+                    highWaterMark (0),
+                    allocationCount (0),
+                    freeCount (0) {}
+            };
+
+            /// \brief
+            /// Return the allocator tracking the given type. Allocators
+            /// are created on first use and live for the life of the process.
+            /// \param[in] name Type name.
+            /// \return SecureMemoryAllocator tracking the given type.
+            static SecureMemoryAllocator &GetAllocator (const char *name);
+
+            /// \brief
+            /// Return the process wide counters.
+            /// \return Process wide counters.
+            static Counters GetTotals ();
+            /// \brief
+            /// Return the per type counters.
+            /// \return Per type counters, ordered by name.
+            static std::vector<Counters> GetTypeCounters ();
+
+            /// \brief
+            /// Reserve the locked working set.
+            /// \param[in] workingSetSize Bytes to reserve now.
+            /// \param[in] maxWorkingSetSize If > workingSetSize, grow the working
+            /// set on demand up to this many bytes (0 = fixed working set).
+            static void SetWorkingSetSize (
+                util::ui64 workingSetSize,
+                util::ui64 maxWorkingSetSize = 0);
+            /// \brief
+            /// Return the current working set size.
+            /// \return Current working set size.
+            static util::ui64 GetWorkingSetSize ();
+            /// \brief
+            /// Return the max working set size.
+            /// \return Max working set size (0 = fixed working set).
+            static util::ui64 GetMaxWorkingSetSize ();
+        };
+
+    } // namespace crypto
+} // namespace thekogans
+
+#endif // !defined (__thekogans_crypto_SecureMemoryStats_h)
@@ -0,0 +1,175 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+
+#if !defined (__thekogans_crypto_SeekableDecryptor_h)
+#define __thekogans_crypto_SeekableDecryptor_h
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <openssl/evp.h>
+#include "thekogans/util/Types.h"
+#include "thekogans/util/RefCounted.h"
+#include "thekogans/util/File.h"
+#include "thekogans/util/Mutex.h"
+#include "thekogans/crypto/Config.h"
+#include "thekogans/crypto/SymmetricKey.h"
+#include "thekogans/crypto/Cipher.h"
+#include "thekogans/crypto/CipherSuite.h"
+#include "thekogans/crypto/KeyRing.h"
+#include "thekogans/crypto/SeekableFile.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        /// \struct SeekableDecryptor SeekableDecryptor.h thekogans/crypto/SeekableDecryptor.h
+        ///
+        /// \brief
+        /// SeekableDecryptor provides random access to files written by \see{FileEncryptor}
+        /// in the seekable format (see SeekableFile.h). The ctor reads, authenticates and
+        /// validates the block index. Read decrypts only the blocks overlapping the
+        /// requested range. The last decrypted block is cached so that a sequence of
+        /// small reads does not decrypt the same block over and over.
+        ///
+        /// Ex:
+        ///
+        /// \code{.cpp}
+        /// using namespace thekogans;
+        ///
+        /// crypto::SeekableDecryptor decryptor (path, key);
+        /// std::vector<util::ui8> buffer (length);
+        /// buffer.resize (decryptor.Read (offset, buffer.data (), length));
+        /// \endcode
+
+        struct _LIB_THEKOGANS_CRYPTO_DECL SeekableDecryptor : public virtual util::RefCounted {
+            /// \brief
+            /// Declare \see{util::RefCounted} pointers.
+            THEKOGANS_UTIL_DECLARE_REF_COUNTED_POINTERS (SeekableDecryptor)
+
+        private:
+            /// \brief
+            /// Encrypted file.
+            util::ReadOnlyFile file;
+            /// \brief
+            /// Cipher used to decrypt all blocks (if keyRing == 0).
+            Cipher::SharedPtr cipher;
+            /// \brief
+            /// If set, used to look up per block keys.
+            KeyRing::SharedPtr keyRing;
+            /// \brief
+            /// Copy of keyRing's \see{CipherSuite}.
+            CipherSuite cipherSuite;
+            /// \brief
+            /// Plaintext length of every block but the last.
+            util::ui32 blockSize;
+            /// \brief
+            /// Block index.
+            std::vector<SeekableBlockInfo> index;
+            /// \brief
+            /// Total plaintext length.
+            util::ui64 plaintextLength;
+            /// \brief
+            /// Ciphertext read buffer.
+            std::vector<util::ui8> ciphertext;
+            /// \brief
+            /// Plaintext of the cached block.
+            std::vector<util::ui8> plaintext;
+            /// \brief
+            /// Index of the cached block (index.size () == none).
+            std::size_t cachedBlock;
+            /// \brief
+            /// Serializes access to file and the block cache.
+            util::Mutex mutex;
+
+        public:
+            /// \brief
+            /// ctor. All blocks were encrypted with the same key.
+            /// \param[in] path Seekable file to decrypt.
+            /// \param[in] key \see{SymmetricKey} used to encrypt the file.
+            /// \param[in] cipher_ OpenSSL EVP_CIPHER.
+            /// \param[in] md OpenSSL EVP_MD (CBC mode only, ignored in GCM mode).
+            SeekableDecryptor (
+                const std::string &path,
+                SymmetricKey::SharedPtr key,
+                const EVP_CIPHER *cipher_ = THEKOGANS_CRYPTO_DEFAULT_CIPHER,
+                const EVP_MD *md = THEKOGANS_CRYPTO_DEFAULT_MD);
+            /// \brief
+            /// ctor. Every block (and the index) was encrypted with it's own key.
+            /// \param[in] path Seekable file to decrypt.
+            /// \param[in] keyRing_ \see{KeyRing} containing the block keys.
+            SeekableDecryptor (
+                const std::string &path,
+                KeyRing::SharedPtr keyRing_);
+            /// \brief
+            /// dtor. Clear the cached plaintext.
+            virtual ~SeekableDecryptor ();
+
+            /// \brief
+            /// Return true if the given file is in the seekable format.
+            /// \param[in] path File to check.
+            /// \return true == path starts with a \see{SeekableFileHeader}.
+            static bool IsSeekable (const std::string &path);
+
+            /// \brief
+            /// Return the block size.
+            /// \return Block size.
+            inline util::ui32 GetBlockSize () const {
+                return blockSize;
+            }
+            /// \brief
+            /// Return the number of blocks.
+            /// \return Number of blocks.
+            inline std::size_t GetBlockCount () const {
+                return index.size ();
+            }
+            /// \brief
+            /// Return the total plaintext length.
+            /// \return Total plaintext length.
+            inline util::ui64 GetPlaintextLength () const {
+                return plaintextLength;
+            }
+
+            /// \brief
+            /// Decrypt a range of plaintext.
+            /// \param[in] offset Plaintext offset to start reading from.
+            /// \param[out] buffer Where to place the plaintext.
+            /// \param[in] length Number of bytes to read.
+            /// \return Number of bytes read (less than length at the end of file).
+            std::size_t Read (
+                util::ui64 offset,
+                void *buffer,
+                std::size_t length);
+
+        private:
+            /// \brief
+            /// Read, authenticate and validate the index.
+            void ReadIndex ();
+            /// \brief
+            /// Make the given block the cached block.
+            /// \param[in] block Index of block to decrypt.
+            void DecryptBlock (std::size_t block);
+
+            /// \brief
+            /// SeekableDecryptor is neither copy constructable, nor assignable.
+            THEKOGANS_CRYPTO_DISALLOW_COPY_AND_ASSIGN (SeekableDecryptor)
+        };
+
+    } // namespace crypto
+} // namespace thekogans
+
+#endif // !defined (__thekogans_crypto_SeekableDecryptor_h)
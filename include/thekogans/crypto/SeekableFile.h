@@ -0,0 +1,270 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+
+#if !defined (__thekogans_crypto_SeekableFile_h)
+#define __thekogans_crypto_SeekableFile_h
+
+#include <cstring>
+#include <openssl/evp.h>
+#include "thekogans/util/Types.h"
+#include "thekogans/util/Serializer.h"
+#include "thekogans/util/Exception.h"
+#include "thekogans/crypto/Config.h"
+#include "thekogans/crypto/ID.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        /// \brief
+        /// Seekable (indexed) encrypted file layout (all integers are network endian):
+        ///
+        /// +--------------------+
+        /// | SeekableFileHeader |
+        /// +--------------------+
+        /// | block 0            |  Same as the stream format (\see{Cipher::EncryptAndEnlengthen}
+        /// +--------------------+  or \see{Cipher::EncryptAndFrame} output).
+        /// | ...                |
+        /// +--------------------+
+        /// | block n - 1        |
+        /// +--------------------+
+        /// | index              |  \see{Cipher::Encrypt} (blockSize, n, SeekableBlockInfo [n]).
+        /// +--------------------+
+        /// | SeekableFileFooter |
+        /// +--------------------+
+        ///
+        /// The index is encrypted (and therefore authenticated) with the file key
+        /// (or, when using a \see{KeyRing}, a dedicated key whose id is in the footer).
+        /// Every block carries it's own IV in it's \see{CiphertextHeader}. The index
+        /// duplicates it so that blocks that were moved around on disk are detected.
+
+        /// \struct SeekableFileHeader SeekableFile.h thekogans/crypto/SeekableFile.h
+        ///
+        /// \brief
+        /// Identifies a seekable file and records it's block size.
+        struct _LIB_THEKOGANS_CRYPTO_DECL SeekableFileHeader {
+            /// \enum
+            /// SeekableFileHeader constants.
+            enum {
+                /// \brief
+                /// "TKSF"
+                MAGIC = 0x544b5346,
+                /// \brief
+                /// Current format version.
+                VERSION = 1,
+                /// \brief
+                /// Serialized header size.
+                SIZE = util::UI32_SIZE + util::UI16_SIZE + util::UI32_SIZE
+            };
+
+            /// \brief
+            /// MAGIC.
+            util::ui32 magic;
+            /// \brief
+            /// VERSION.
+            util::ui16 version;
+            /// \brief
+            /// Plaintext length of every block but the last.
+            util::ui32 blockSize;
+
+            /// \brief
+            /// ctor.
+            /// \param[in] blockSize_ Plaintext length of every block but the last.
+            explicit SeekableFileHeader (util::ui32 blockSize_ = 0) :
+                magic (MAGIC),
+                version (VERSION),
+                blockSize (blockSize_) {}
+        };
+
+        /// \brief
+        /// Serialize a SeekableFileHeader.
+        /// \param[in] serializer Where to write the given header.
+        /// \param[in] header SeekableFileHeader to serialize.
+        /// \return serializer.
+        inline util::Serializer &operator << (
+                util::Serializer &serializer,
+                const SeekableFileHeader &header) {
+            serializer << header.magic << header.version << header.blockSize;
+            return serializer;
+        }
+
+        /// \brief
+        /// Extract a SeekableFileHeader.
+        /// \param[in] serializer Where to read the header from.
+        /// \param[out] header Where to place the extracted header.
+        /// \return serializer.
+        inline util::Serializer &operator >> (
+                util::Serializer &serializer,
+                SeekableFileHeader &header) {
+            serializer >> header.magic >> header.version >> header.blockSize;
+            return serializer;
+        }
+
+        /// \struct SeekableBlockInfo SeekableFile.h thekogans/crypto/SeekableFile.h
+        ///
+        /// \brief
+        /// Index entry describing one encrypted block.
+        struct _LIB_THEKOGANS_CRYPTO_DECL SeekableBlockInfo {
+            /// \brief
+            /// File offset of the block \see{CiphertextHeader}.
+            util::ui64 offset;
+            /// \brief
+            /// Length of the \see{Cipher::Encrypt} output.
+            util::ui32 ciphertextLength;
+            /// \brief
+            /// Length of the decrypted block.
+            util::ui32 plaintextLength;
+            /// \brief
+            /// \see{ID} of the key that encrypted the block.
+            ID keyId;
+            /// \brief
+            /// Block IV length.
+            util::ui16 ivLength;
+            /// \brief
+            /// Block IV.
+            util::ui8 iv[EVP_MAX_IV_LENGTH];
+
+            /// \brief
+            /// ctor.
+            SeekableBlockInfo () :
+                    offset (0),
+                    ciphertextLength (0),
+                    plaintextLength (0),
+                    keyId (ID::Empty),
+                    ivLength (0) {
+                memset (iv, 0, EVP_MAX_IV_LENGTH);
+            }
+
+            /// \brief
+            /// Return the serialized entry size.
+            /// \return Serialized entry size.
+            inline std::size_t Size () const {
+                return
+                    util::UI64_SIZE +
+                    util::UI32_SIZE +
+                    util::UI32_SIZE +
+                    ID::SIZE +
+                    util::UI16_SIZE +
+                    ivLength;
+            }
+        };
+
+        /// \brief
+        /// Serialize a SeekableBlockInfo.
+        /// \param[in] serializer Where to write the given entry.
+        /// \param[in] blockInfo SeekableBlockInfo to serialize.
+        /// \return serializer.
+        inline util::Serializer &operator << (
+                util::Serializer &serializer,
+                const SeekableBlockInfo &blockInfo) {
+            serializer <<
+                blockInfo.offset <<
+                blockInfo.ciphertextLength <<
+                blockInfo.plaintextLength <<
+                blockInfo.keyId <<
+                blockInfo.ivLength;
+            serializer.Write (blockInfo.iv, blockInfo.ivLength);
+            return serializer;
+        }
+
+        /// \brief
+        /// Extract a SeekableBlockInfo.
+        /// \param[in] serializer Where to read the entry from.
+        /// \param[out] blockInfo Where to place the extracted entry.
+        /// \return serializer.
+        inline util::Serializer &operator >> (
+                util::Serializer &serializer,
+                SeekableBlockInfo &blockInfo) {
+            serializer >>
+                blockInfo.offset >>
+                blockInfo.ciphertextLength >>
+                blockInfo.plaintextLength >>
+                blockInfo.keyId >>
+                blockInfo.ivLength;
+            if (blockInfo.ivLength > EVP_MAX_IV_LENGTH ||
+                    serializer.Read (blockInfo.iv, blockInfo.ivLength) != blockInfo.ivLength) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "Invalid block IV length (%u)",
+                    blockInfo.ivLength);
+            }
+            return serializer;
+        }
+
+        /// \struct SeekableFileFooter SeekableFile.h thekogans/crypto/SeekableFile.h
+        ///
+        /// \brief
+        /// Fixed size trailer used to locate the index.
+        struct _LIB_THEKOGANS_CRYPTO_DECL SeekableFileFooter {
+            /// \enum
+            /// SeekableFileFooter constants.
+            enum {
+                /// \brief
+                /// Serialized footer size.
+                SIZE = util::UI64_SIZE + util::UI32_SIZE + ID::SIZE + util::UI32_SIZE
+            };
+
+            /// \brief
+            /// File offset of the encrypted index.
+            util::ui64 indexOffset;
+            /// \brief
+            /// Length of the encrypted index.
+            util::ui32 indexLength;
+            /// \brief
+            /// \see{ID} of the key that encrypted the index.
+            ID indexKeyId;
+            /// \brief
+            /// SeekableFileHeader::MAGIC (so that the footer can be
+            /// recognized before the index is read).
+            util::ui32 magic;
+
+            /// \brief
+            /// ctor.
+            SeekableFileFooter () :
+                indexOffset (0),
+                indexLength (0),
+                indexKeyId (ID::Empty),
+                magic (SeekableFileHeader::MAGIC) {}
+        };
+
+        /// \brief
+        /// Serialize a SeekableFileFooter.
+        /// \param[in] serializer Where to write the given footer.
+        /// \param[in] footer SeekableFileFooter to serialize.
+        /// \return serializer.
+        inline util::Serializer &operator << (
+                util::Serializer &serializer,
+                const SeekableFileFooter &footer) {
+            serializer << footer.indexOffset << footer.indexLength << footer.indexKeyId << footer.magic;
+            return serializer;
+        }
+
+        /// \brief
+        /// Extract a SeekableFileFooter.
+        /// \param[in] serializer Where to read the footer from.
+        /// \param[out] footer Where to place the extracted footer.
+        /// \return serializer.
+        inline util::Serializer &operator >> (
+                util::Serializer &serializer,
+                SeekableFileFooter &footer) {
+            serializer >> footer.indexOffset >> footer.indexLength >> footer.indexKeyId >> footer.magic;
+            return serializer;
+        }
+
+    } // namespace crypto
+} // namespace thekogans
+
+#endif // !defined (__thekogans_crypto_SeekableFile_h)
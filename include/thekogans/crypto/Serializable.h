@@ -25,6 +25,7 @@
 #include "thekogans/util/SecureAllocator.h"
 #include "thekogans/crypto/Config.h"
 #include "thekogans/crypto/ID.h"
+#include "thekogans/crypto/SecureMemoryStats.h"
 
 namespace thekogans {
     namespace crypto {
@@ -194,7 +195,7 @@ namespace thekogans {
                 version,\
                 thekogans::util::SpinLock,\
                 minSerializablesInPage,\
-                thekogans::util::SecureAllocator::Instance ())
+                thekogans::crypto::SecureMemoryStats::GetAllocator (#type))
 
         /// \brief
         /// Implement Serializable::SharedPtr extraction operators.
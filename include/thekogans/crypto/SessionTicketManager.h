@@ -0,0 +1,188 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined (__thekogans_crypto_SessionTicketManager_h)
+#define __thekogans_crypto_SessionTicketManager_h
+
+#include <cstddef>
+#include <set>
+#include <deque>
+#include <utility>
+#include "thekogans/util/Types.h"
+#include "thekogans/util/RefCounted.h"
+#include "thekogans/util/Buffer.h"
+#include "thekogans/util/Mutex.h"
+#include "thekogans/crypto/Config.h"
+#include "thekogans/crypto/ID.h"
+#include "thekogans/crypto/SymmetricKey.h"
+#include "thekogans/crypto/Cipher.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        /// \struct SessionTicketManager SessionTicketManager.h thekogans/crypto/SessionTicketManager.h
+        ///
+        /// \brief
+        /// SessionTicketManager lets a returning peer skip the public key operations
+        /// of a full \see{DHEKeyExchange} or \see{RSAKeyExchange}. After a successful
+        /// exchange the server issues a ticket: the shared \see{SymmetricKey} material,
+        /// sealed with a server \see{Cipher} (ex: one from the server's \see{KeyRing}).
+        /// The peer keeps the key and the (opaque to it) ticket. To resume, the peer
+        /// sends the ticket along with a fresh random nonce, and both sides derive a
+        /// new key from the ticketed key and the nonce (DeriveResumedKey, HKDF).
+        /// Tickets expire after lifetime seconds, and every ticket can be redeemed
+        /// once. The ids of redeemed tickets are remembered in a bounded replay
+        /// window. A ticket issued no later than the oldest ticket dropped from
+        /// the window is rejected, so a ticket can never be redeemed twice. A
+        /// rejected peer falls back to a full exchange.
+        ///
+        /// \code{.cpp}
+        /// using namespace thekogans;
+        ///
+        /// // Server, after the exchange.
+        /// crypto::SessionTicketManager ticketManager (keyRing->GetCipher (ticketKeyId));
+        /// util::Buffer ticket = ticketManager.IssueTicket (*sharedKey);
+        /// // Client, on reconnect: send ticket and nonce.
+        /// crypto::SymmetricKey::SharedPtr resumedKey =
+        ///     crypto::SessionTicketManager::DeriveResumedKey (*sharedKey, nonce, nonceLength);
+        /// // Server, on reconnect.
+        /// crypto::SymmetricKey::SharedPtr resumedKey = ticketManager.RedeemTicket (
+        ///     ticket.GetReadPtr (), ticket.GetDataAvailableForReading (), nonce, nonceLength);
+        /// if (resumedKey.Get () == 0) {
+        ///     // Full key exchange.
+        /// }
+        /// \endcode
+        ///
+        /// NOTE: As with any resumption scheme, a resumed session is only as forward
+        /// secret as the ticket cipher key. Rotate it at least as often as lifetime.
+
+        struct _LIB_THEKOGANS_CRYPTO_DECL SessionTicketManager : public virtual util::RefCounted {
+            /// \brief
+            /// Declare \see{RefCounted} pointers.
+            THEKOGANS_UTIL_DECLARE_REF_COUNTED_POINTERS (SessionTicketManager)
+
+            enum {
+                /// \brief
+                /// Default ticket lifetime (in seconds).
+                DEFAULT_LIFETIME = 24 * 60 * 60,
+                /// \brief
+                /// Default number of redeemed ticket ids to remember.
+                DEFAULT_REPLAY_WINDOW = 65536,
+                /// \brief
+                /// Minimum nonce length accepted by RedeemTicket/DeriveResumedKey.
+                MIN_NONCE_LENGTH = 16
+            };
+
+        private:
+            /// \brief
+            /// Cipher used to seal the tickets.
+            Cipher::SharedPtr cipher;
+            /// \brief
+            /// Ticket lifetime (in seconds).
+            util::ui64 lifetime;
+            /// \brief
+            /// Max number of redeemed ticket ids to remember.
+            std::size_t replayWindow;
+            /// \brief
+            /// Ids of redeemed tickets.
+            std::set<ID> redeemed;
+            /// \brief
+            /// (issue time, id) of redeemed tickets, in redemption order.
+            std::deque<std::pair<util::ui64, ID>> redeemedOrder;
+            /// \brief
+            /// Tickets issued at or before this time are rejected
+            /// (their ids might have been dropped from the window).
+            util::ui64 replayFloor;
+            /// \brief
+            /// Synchronization mutex (\see{Cipher} is not thread safe).
+            util::Mutex mutex;
+
+        public:
+            /// \brief
+            /// ctor.
+            /// \param[in] cipher_ Cipher used to seal the tickets.
+            /// \param[in] lifetime_ Ticket lifetime (in seconds).
+            /// \param[in] replayWindow_ Max number of redeemed ticket ids to remember.
+            SessionTicketManager (
+                Cipher::SharedPtr cipher_,
+                util::ui64 lifetime_ = DEFAULT_LIFETIME,
+                std::size_t replayWindow_ = DEFAULT_REPLAY_WINDOW);
+
+            /// \brief
+            /// Return the ticket lifetime.
+            /// \return Ticket lifetime (in seconds).
+            inline util::ui64 GetLifetime () const {
+                return lifetime;
+            }
+
+            /// \brief
+            /// Seal the given key in a ticket.
+            /// \param[in] key Key agreed upon by a full key exchange.
+            /// \return Ticket to hand to the peer.
+            util::Buffer IssueTicket (const SymmetricKey &key);
+            /// \brief
+            /// Redeem a ticket issued by IssueTicket.
+            /// \param[in] ticket Ticket returned by IssueTicket.
+            /// \param[in] ticketLength Ticket length.
+            /// \param[in] nonce Peer's fresh random nonce.
+            /// \param[in] nonceLength Nonce length (>= MIN_NONCE_LENGTH).
+            /// \return Resumed key (same as the peer's DeriveResumedKey), 0 ==
+            /// the ticket is invalid, expired or has already been redeemed.
+            SymmetricKey::SharedPtr RedeemTicket (
+                const void *ticket,
+                std::size_t ticketLength,
+                const void *nonce,
+                std::size_t nonceLength);
+
+            /// \brief
+            /// Derive the resumed key from the ticketed key and the nonce.
+            /// \param[in] key Ticketed key.
+            /// \param[in] nonce Fresh random nonce.
+            /// \param[in] nonceLength Nonce length (>= MIN_NONCE_LENGTH).
+            /// \param[in] id Optional key id.
+            /// \param[in] name Optional key name.
+            /// \param[in] description Optional key description.
+            /// \return Resumed key.
+            static SymmetricKey::SharedPtr DeriveResumedKey (
+                const SymmetricKey &key,
+                const void *nonce,
+                std::size_t nonceLength,
+                const ID &id = ID (),
+                const std::string &name = std::string (),
+                const std::string &description = std::string ());
+
+        private:
+            /// \brief
+            /// Record the given ticket as redeemed.
+            /// Must be called with mutex held.
+            /// \param[in] issueTime Ticket issue time.
+            /// \param[in] ticketId Ticket id.
+            /// \return false == the ticket has already been redeemed
+            /// (or might have been).
+            bool Redeem (
+                util::ui64 issueTime,
+                const ID &ticketId);
+
+            /// \brief
+            /// SessionTicketManager is neither copy constructable, nor assignable.
+            THEKOGANS_CRYPTO_DISALLOW_COPY_AND_ASSIGN (SessionTicketManager)
+        };
+
+    } // namespace crypto
+} // namespace thekogans
+
+#endif // !defined (__thekogans_crypto_SessionTicketManager_h)
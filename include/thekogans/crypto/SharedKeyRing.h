@@ -0,0 +1,191 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined (__thekogans_crypto_SharedKeyRing_h)
+#define __thekogans_crypto_SharedKeyRing_h
+
+#if !defined (TOOLCHAIN_OS_Windows)
+    #define THEKOGANS_CRYPTO_HAVE_SHARED_KEY_RING
+#endif // !defined (TOOLCHAIN_OS_Windows)
+
+#if defined (THEKOGANS_CRYPTO_HAVE_SHARED_KEY_RING)
+
+#include <cstddef>
+#include <string>
+#include "thekogans/util/Types.h"
+#include "thekogans/util/RefCounted.h"
+#include "thekogans/util/SpinLock.h"
+#include "thekogans/crypto/Config.h"
+#include "thekogans/crypto/ID.h"
+#include "thekogans/crypto/IDCache.h"
+#include "thekogans/crypto/Cipher.h"
+#include "thekogans/crypto/KeyRing.h"
+#include "thekogans/crypto/MappedKeyRing.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        /// \struct SharedKeyRing SharedKeyRing.h thekogans/crypto/SharedKeyRing.h
+        ///
+        /// \brief
+        /// SharedKeyRing lets a set of worker processes share one decrypted copy
+        /// of a \see{KeyRing}. The loader process decrypts the ring once (Load or
+        /// Create) and writes it, in the memory mappable (v2) format (\see{MappedKeyRing}),
+        /// to a shared memory segment. On Linux the segment is a memfd that's sealed
+        /// (it can't be written to, grown or shrunk) once written. Elsewhere it's an
+        /// (immediately unlinked) POSIX shared memory object, and the handle given out
+        /// is read only. Every other process calls Attach with the handle (inherited
+        /// across fork, or passed over a unix domain socket) and maps the segment read
+        /// only. The pages are shared by all processes (and optionally mlocked), so only
+        /// the \see{Cipher}s built by GetCipher (lazily, from the keys in the segment)
+        /// are per process. Like \see{MappedKeyRing}, SharedKeyRing is thread safe.
+        ///
+        /// Ex:
+        ///
+        /// \code{.cpp}
+        /// using namespace thekogans;
+        ///
+        /// // Loader.
+        /// crypto::SharedKeyRing::SharedPtr keyRing =
+        ///     crypto::SharedKeyRing::Load (path, masterCipher.Get ());
+        /// for (std::size_t i = 0; i < workerCount; ++i) {
+        ///     if (fork () == 0) {
+        ///         // Worker.
+        ///         crypto::SharedKeyRing::SharedPtr workerKeyRing =
+        ///             crypto::SharedKeyRing::Attach (keyRing->GetHandle ());
+        ///         crypto::Cipher::SharedPtr cipher = workerKeyRing->GetCipher (keyId);
+        ///         ...
+        ///     }
+        /// }
+        /// \endcode
+        ///
+        /// NOTE: The handle is close on exec. Clear FD_CLOEXEC before exec'ing
+        /// workers that should attach to an inherited handle.
+
+        struct _LIB_THEKOGANS_CRYPTO_DECL SharedKeyRing : public MappedKeyRing {
+            /// \brief
+            /// Declare \see{RefCounted} pointers.
+            THEKOGANS_UTIL_DECLARE_REF_COUNTED_POINTERS (SharedKeyRing)
+
+        private:
+            /// \brief
+            /// Segment handle (loader only, -1 = attached).
+            int handle;
+            /// \brief
+            /// Read only segment mapping.
+            util::ui8 *map;
+            /// \brief
+            /// Segment size.
+            util::ui64 mapSize;
+            /// \brief
+            /// true == the mapping is mlocked.
+            bool locked;
+            /// \brief
+            /// Convenient typedef for IDCache<Cipher::SharedPtr>.
+            typedef IDCache<Cipher::SharedPtr> CipherMap;
+            /// \brief
+            /// Per process \see{Cipher}s built from the keys in the segment.
+            CipherMap cipherMap;
+            /// \brief
+            /// Synchronize access to cipherMap.
+            util::SpinLock spinLock;
+
+            /// \brief
+            /// ctor.
+            /// \param[in] handle_ Segment handle (-1 = attached).
+            /// \param[in] map_ Read only segment mapping.
+            /// \param[in] mapSize_ Segment size.
+            /// \param[in] locked_ true == the mapping is mlocked.
+            SharedKeyRing (
+                int handle_,
+                util::ui8 *map_,
+                util::ui64 mapSize_,
+                bool locked_);
+
+        public:
+            /// \brief
+            /// dtor. Unmap the segment (and close the handle).
+            virtual ~SharedKeyRing ();
+
+            /// \brief
+            /// Publish the given \see{KeyRing} in a new shared memory segment.
+            /// \param[in] keyRing \see{KeyRing} to publish.
+            /// \param[in] recursive true = include the sub rings' entries.
+            /// \param[in] lock true = mlock the segment (throws if it can't be locked).
+            /// \return SharedKeyRing owning the new segment (use GetHandle to share it).
+            static SharedPtr Create (
+                const KeyRing &keyRing,
+                bool recursive = true,
+                bool lock = true);
+            /// \brief
+            /// Load (and decrypt) a \see{KeyRing} saved by KeyRing::Save and
+            /// publish it. The decrypted heap copy is released before returning.
+            /// \param[in] path File name to load the key ring from.
+            /// \param[in] cipher Optional \see{Cipher} used to decrypt the file data.
+            /// \param[in] associatedData Optional associated data (GCM mode only).
+            /// \param[in] associatedDataLength Length of optional associated data.
+            /// \param[in] recursive true = include the sub rings' entries.
+            /// \param[in] lock true = mlock the segment (throws if it can't be locked).
+            /// \return SharedKeyRing owning the new segment (use GetHandle to share it).
+            static SharedPtr Load (
+                const std::string &path,
+                Cipher *cipher = 0,
+                const void *associatedData = 0,
+                std::size_t associatedDataLength = 0,
+                bool recursive = true,
+                bool lock = true);
+            /// \brief
+            /// Attach to a segment published by Create or Load (in this or another process).
+            /// The handle is not adopted (the caller can close it once Attach returns).
+            /// \param[in] handle Segment handle (\see{GetHandle}).
+            /// \param[in] lock true = mlock the mapping (throws if it can't be locked).
+            /// \return SharedKeyRing mapping the segment.
+            static SharedPtr Attach (
+                int handle,
+                bool lock = true);
+
+            /// \brief
+            /// Return the segment handle to pass to Attach.
+            /// \return Segment handle (-1 = attached).
+            inline int GetHandle () const {
+                return handle;
+            }
+            /// \brief
+            /// Return true if the mapping is mlocked.
+            /// \return true == the mapping is mlocked.
+            inline bool IsLocked () const {
+                return locked;
+            }
+
+            /// \brief
+            /// Return the \see{Cipher} for the \see{SymmetricKey} with the given \see{ID}.
+            /// \see{Cipher}s are built on first use and cached (per process).
+            /// \param[in] keyId \see{ID} of \see{SymmetricKey} to use.
+            /// \return \see{Cipher} (0 = key not found).
+            Cipher::SharedPtr GetCipher (const ID &keyId);
+
+            /// \brief
+            /// SharedKeyRing is neither copy constructable, nor assignable.
+            THEKOGANS_CRYPTO_DISALLOW_COPY_AND_ASSIGN (SharedKeyRing)
+        };
+
+    } // namespace crypto
+} // namespace thekogans
+
+#endif // defined (THEKOGANS_CRYPTO_HAVE_SHARED_KEY_RING)
+
+#endif // !defined (__thekogans_crypto_SharedKeyRing_h)
@@ -0,0 +1,228 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined (__thekogans_crypto_SignatureManifest_h)
+#define __thekogans_crypto_SignatureManifest_h
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <openssl/evp.h>
+#include "thekogans/util/Types.h"
+#include "thekogans/util/RefCounted.h"
+#include "thekogans/util/Buffer.h"
+#include "thekogans/crypto/Config.h"
+#include "thekogans/crypto/OpenSSLUtils.h"
+#include "thekogans/crypto/Authenticator.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        /// \brief
+        /// Signature manifest layout (all integers are network endian):
+        ///
+        /// +--------------------+
+        /// | magic              |  ui32 "TKSM"
+        /// +--------------------+
+        /// | version            |  ui16
+        /// +--------------------+
+        /// | message digest     |  std::string (see \see{CipherSuite::GetMessageDigests})
+        /// +--------------------+
+        /// | entry count        |  ui64
+        /// +--------------------+
+        /// | entry 0            |  path (std::string), size (ui64), H (file 0)
+        /// +--------------------+
+        /// | ...                |
+        /// +--------------------+
+        /// | entry n - 1        |
+        /// +--------------------+
+        /// | signature length   |  ui32
+        /// +--------------------+
+        /// | signature          |  \see{Authenticator::SignBuffer} (everything above).
+        /// +--------------------+
+
+        /// \struct SignatureManifest SignatureManifest.h thekogans/crypto/SignatureManifest.h
+        ///
+        /// \brief
+        /// SignatureManifest signs a whole batch of files with a single signature.
+        /// The files are hashed in parallel on a pool of worker threads (each file
+        /// is read through a memory mapped \see{FileReader}), and only the list of
+        /// (path, size, digest) entries is signed. Signing a directory with
+        /// thousands of files therefore costs one private key operation instead
+        /// of thousands. Verification re-hashes the files in parallel and
+        /// reports which of them don't match.
+        ///
+        /// Ex:
+        ///
+        /// \code{.cpp}
+        /// using namespace thekogans;
+        ///
+        /// crypto::Authenticator signer (privateKey, messageDigest);
+        /// crypto::SignatureManifest::Create (
+        ///     crypto::SignatureManifest::ListFiles (directory), signer)->Save (manifestPath);
+        /// ...
+        /// crypto::Authenticator verifier (publicKey, messageDigest);
+        /// std::vector<std::string> invalidPaths;
+        /// bool result = crypto::SignatureManifest::Load (manifestPath)->Verify (
+        ///     verifier, 0, true, &invalidPaths);
+        /// \endcode
+
+        struct _LIB_THEKOGANS_CRYPTO_DECL SignatureManifest : public virtual util::RefCounted {
+            /// \brief
+            /// Declare \see{RefCounted} pointers.
+            THEKOGANS_UTIL_DECLARE_REF_COUNTED_POINTERS (SignatureManifest)
+
+            /// \enum
+            /// SignatureManifest constants.
+            enum {
+                /// \brief
+                /// "TKSM"
+                MAGIC = 0x544b534d,
+                /// \brief
+                /// Current format version.
+                VERSION = 1
+            };
+
+            /// \struct SignatureManifest::Entry SignatureManifest.h thekogans/crypto/SignatureManifest.h
+            ///
+            /// \brief
+            /// One signed file.
+            struct _LIB_THEKOGANS_CRYPTO_DECL Entry {
+                /// \brief
+                /// File path (as given to Create).
+                std::string path;
+                /// \brief
+                /// File size.
+                util::ui64 size;
+                /// \brief
+                /// File digest (\see{MessageDigest::HashFile}).
+                std::vector<util::ui8> digest;
+
+                /// \brief
+                /// ctor.
+                /// \param[in] path_ File path.
+                explicit Entry (const std::string &path_ = std::string ()) :
+                    path (path_),
+                    size (0) {}
+            };
+
+        private:
+            /// \brief
+            /// OpenSSL message digest used to hash the files.
+            const EVP_MD *md;
+            /// \brief
+            /// Signed files (in the order given to Create).
+            std::vector<Entry> entries;
+            /// \brief
+            /// Signature over the serialized entries.
+            util::Buffer signature;
+
+            /// \brief
+            /// ctor. Used by Create and Load.
+            /// \param[in] md_ OpenSSL message digest used to hash the files.
+            explicit SignatureManifest (const EVP_MD *md_);
+
+        public:
+            /// \brief
+            /// Hash the given files (in parallel) and sign the resulting manifest.
+            /// \param[in] paths Files to sign.
+            /// \param[in] signer \see{Authenticator} setup for sign operation.
+            /// \param[in] md OpenSSL message digest used to hash the files.
+            /// \param[in] workerCount Number of hashing threads (0 == one per cpu).
+            /// \param[in] map true == memory map the files (see \see{FileReader}).
+            /// \return Signed manifest.
+            static SharedPtr Create (
+                const std::vector<std::string> &paths,
+                Authenticator &signer,
+                const EVP_MD *md = THEKOGANS_CRYPTO_DEFAULT_MD,
+                std::size_t workerCount = 0,
+                bool map = true);
+
+            /// \brief
+            /// Load a manifest from the given file.
+            /// \param[in] path Manifest file.
+            /// \return Manifest (not yet verified, see VerifySignature).
+            static SharedPtr Load (const std::string &path);
+            /// \brief
+            /// Save the manifest to the given file.
+            /// \param[in] path Manifest file.
+            void Save (const std::string &path) const;
+
+            /// \brief
+            /// Return the regular files found (recursively) under the given directory.
+            /// \param[in] directory Directory to list.
+            /// \return Sorted list of file paths (prefixed with directory).
+            static std::vector<std::string> ListFiles (const std::string &directory);
+            /// \brief
+            /// Read a list of paths (one per line, blank lines ignored) from the given file.
+            /// \param[in] path File containing the list of paths.
+            /// \return List of paths.
+            static std::vector<std::string> ReadPathList (const std::string &path);
+
+            /// \brief
+            /// Return the signed files.
+            /// \return Signed files.
+            inline const std::vector<Entry> &GetEntries () const {
+                return entries;
+            }
+            /// \brief
+            /// Return the OpenSSL message digest used to hash the files.
+            /// \return OpenSSL message digest used to hash the files.
+            inline const EVP_MD *GetMD () const {
+                return md;
+            }
+            /// \brief
+            /// Return the file digest length.
+            /// \return File digest length.
+            inline std::size_t GetDigestLength () const {
+                return GetMDLength (md);
+            }
+
+            /// \brief
+            /// Verify the manifest signature.
+            /// \param[in] verifier \see{Authenticator} setup for verify operation.
+            /// \return true == every entry is authentic.
+            bool VerifySignature (Authenticator &verifier) const;
+            /// \brief
+            /// Verify the manifest signature, and re-hash (in parallel) every file.
+            /// \param[in] verifier \see{Authenticator} setup for verify operation.
+            /// \param[in] workerCount Number of hashing threads (0 == one per cpu).
+            /// \param[in] map true == memory map the files (see \see{FileReader}).
+            /// \param[out] invalidPaths If not 0, the paths of the files that are
+            /// missing, unreadable or don't match are appended here.
+            /// \return true == the signature and every file are valid.
+            bool Verify (
+                Authenticator &verifier,
+                std::size_t workerCount = 0,
+                bool map = true,
+                std::vector<std::string> *invalidPaths = 0) const;
+
+        private:
+            /// \brief
+            /// Return the signed data (everything but the signature).
+            /// \return Signed data.
+            util::Buffer GetSignedData () const;
+
+            /// \brief
+            /// SignatureManifest is neither copy constructable, nor assignable.
+            THEKOGANS_CRYPTO_DISALLOW_COPY_AND_ASSIGN (SignatureManifest)
+        };
+
+    } // namespace crypto
+} // namespace thekogans
+
+#endif // !defined (__thekogans_crypto_SignatureManifest_h)
@@ -0,0 +1,377 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined (__thekogans_crypto_SignedDHEParamsCache_h)
+#define __thekogans_crypto_SignedDHEParamsCache_h
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <openssl/evp.h>
+#include "thekogans/util/Types.h"
+#include "thekogans/util/RefCounted.h"
+#include "thekogans/util/Mutex.h"
+#include "thekogans/util/Condition.h"
+#include "thekogans/util/OwnerVector.h"
+#include "thekogans/crypto/Config.h"
+#include "thekogans/crypto/OpenSSLUtils.h"
+#include "thekogans/crypto/Params.h"
+#include "thekogans/crypto/AsymmetricKey.h"
+#include "thekogans/crypto/MessageDigest.h"
+#include "thekogans/crypto/SymmetricKey.h"
+#include "thekogans/crypto/KeyExchange.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        /// \struct SignedDHEParamsCache SignedDHEParamsCache.h thekogans/crypto/SignedDHEParamsCache.h
+        ///
+        /// \brief
+        /// Signing \see{DHEKeyExchange::DHEParams} (\see{KeyExchange::Params::CreateSignature})
+        /// is a full \see{RSA}/\see{EC}/\see{Ed25519} signature on every handshake, on
+        /// top of the DH work. SignedDHEParamsCache lets a server reuse one signed,
+        /// ephemeral key bearing \see{DHEKeyExchange::DHEParams} for a bounded window
+        /// (maxAge seconds or maxUses handshakes, whichever comes first), so that the
+        /// signing cost is paid once per window instead of once per connection.
+        /// A background thread keeps the next window's params signed and ready, so
+        /// rotation never happens on the handshake path (unless the thread falls
+        /// behind, in which case Get signs inline and counts a miss).
+        ///
+        /// The server sends the cached params first (it is the \see{DHEKeyExchange}
+        /// initiator). The client creates it's \see{DHEKeyExchange} from them, validates
+        /// the signature and replies with it's own params (and it's random), which the
+        /// server passes to \see{SignedDHEParamsCache::Entry::DeriveSharedSymmetricKey}.
+        /// Mixing the client (and server) random in to the session salt keeps the
+        /// session keys unique even though the server key is shared by the window:
+        ///
+        /// \code{.cpp}
+        /// using namespace thekogans;
+        ///
+        /// crypto::SignedDHEParamsCache::SharedPtr cache (
+        ///     new crypto::SignedDHEParamsCache (
+        ///         crypto::EC::ParamsFromX25519Curve (),
+        ///         serverPrivateKey,
+        ///         crypto::MessageDigest::SharedPtr (new crypto::MessageDigest)));
+        /// ...
+        /// // Per connection.
+        /// crypto::SignedDHEParamsCache::Entry::SharedPtr entry = cache->Get ();
+        /// // Send entry->params and serverRandom to the client,
+        /// // receive clientParams and clientRandom.
+        /// // sessionSalt = clientRandom || serverRandom
+        /// crypto::SymmetricKey::SharedPtr key = entry->DeriveSharedSymmetricKey (
+        ///     clientParams, sessionSalt.data (), sessionSalt.size ());
+        /// // The client calls DHEKeyExchange::DeriveSharedSymmetricKey
+        /// // (serverParams, sessionSalt.data (), sessionSalt.size ()).
+        /// \endcode
+        ///
+        /// WARNING: Reusing the ephemeral key trades forward secrecy for speed:
+        /// a compromise of the window's private key exposes every session keyed
+        /// in that window. Keep the windows short. Expired private keys are dropped
+        /// on the first Get after they expire (call Rotate to drop one right away).
+        /// NOTE: Without a session salt the keys derived in one window share the
+        /// window's \see{SymmetricKey} id, and a replayed client handshake derives
+        /// the same key again. With one, every key gets it's own id.
+
+        struct _LIB_THEKOGANS_CRYPTO_DECL SignedDHEParamsCache : public virtual util::RefCounted {
+            /// \brief
+            /// Declare \see{RefCounted} pointers.
+            THEKOGANS_UTIL_DECLARE_REF_COUNTED_POINTERS (SignedDHEParamsCache)
+
+            enum {
+                /// \brief
+                /// Default window length (in seconds).
+                DEFAULT_MAX_AGE = 60,
+                /// \brief
+                /// Default max number of handshakes per window.
+                DEFAULT_MAX_USES = 1000
+            };
+
+            /// \struct SignedDHEParamsCache::Entry SignedDHEParamsCache.h thekogans/crypto/SignedDHEParamsCache.h
+            ///
+            /// \brief
+            /// One window's key exchange and signed params. Entries are shared by
+            /// every handshake in the window (and by the threads running them),
+            /// and are never modified after they're created.
+            struct _LIB_THEKOGANS_CRYPTO_DECL Entry : public virtual util::RefCounted {
+                /// \brief
+                /// Declare \see{RefCounted} pointers.
+                THEKOGANS_UTIL_DECLARE_REF_COUNTED_POINTERS (Entry)
+
+                /// \brief
+                /// \see{DHEKeyExchange} holding the window's ephemeral private key.
+                KeyExchange::SharedPtr keyExchange;
+                /// \brief
+                /// Signed \see{DHEKeyExchange::DHEParams} to send to the clients.
+                KeyExchange::Params::SharedPtr params;
+
+                /// \brief
+                /// ctor.
+                /// \param[in] keyExchange_ \see{DHEKeyExchange} holding the window's
+                /// ephemeral private key.
+                /// \param[in] params_ Signed \see{DHEKeyExchange::DHEParams}.
+                Entry (
+                    KeyExchange::SharedPtr keyExchange_,
+                    KeyExchange::Params::SharedPtr params_) :
+                    keyExchange (keyExchange_),
+                    params (params_) {}
+
+                /// \brief
+                /// Given a client's \see{DHEKeyExchange::DHEParams}, derive the
+                /// shared \see{SymmetricKey}.
+                /// \param[in] clientParams Client's \see{DHEKeyExchange::DHEParams}.
+                /// \return Shared \see{SymmetricKey}.
+                inline SymmetricKey::SharedPtr DeriveSharedSymmetricKey (
+                        KeyExchange::Params::SharedPtr clientParams) const {
+                    return keyExchange->DeriveSharedSymmetricKey (clientParams);
+                }
+                /// \brief
+                /// Given a client's \see{DHEKeyExchange::DHEParams} and a per session
+                /// salt, derive the shared \see{SymmetricKey}
+                /// (\see{DHEKeyExchange::DeriveSharedSymmetricKey}).
+                /// \param[in] clientParams Client's \see{DHEKeyExchange::DHEParams}.
+                /// \param[in] sessionSalt Per session salt (ex: client random || server random).
+                /// \param[in] sessionSaltLength Per session salt length.
+                /// \return Shared \see{SymmetricKey}.
+                SymmetricKey::SharedPtr DeriveSharedSymmetricKey (
+                    KeyExchange::Params::SharedPtr clientParams,
+                    const void *sessionSalt,
+                    std::size_t sessionSaltLength) const;
+
+                /// \brief
+                /// Entry is neither copy constructable, nor assignable.
+                THEKOGANS_CRYPTO_DISALLOW_COPY_AND_ASSIGN (Entry)
+            };
+
+            /// \struct SignedDHEParamsCache::Stats SignedDHEParamsCache.h thekogans/crypto/SignedDHEParamsCache.h
+            ///
+            /// \brief
+            /// Cache statistics.
+            struct _LIB_THEKOGANS_CRYPTO_DECL Stats {
+                /// \brief
+                /// Number of params signed (one per window, plus the ready one).
+                util::ui64 signatures;
+                /// \brief
+                /// Number of windows started.
+                util::ui64 rotations;
+                /// \brief
+                /// Number of Get calls satisfied by the current window.
+                util::ui64 hits;
+                /// \brief
+                /// Number of Get calls that found no signed params
+                /// ready (and signed them inline).
+                util::ui64 misses;
+                /// \brief
+                /// Number of handshakes in the current window.
+                util::ui64 currentUses;
+                /// \brief
+                /// How long (in seconds) the current window's key has been in use.
+                util::f64 currentAge;
+                /// \brief
+                /// Number of handshakes in the previous window.
+                util::ui64 previousUses;
+                /// \brief
+                /// How long (in seconds) the previous window's key was in use.
+                util::f64 previousAge;
+
+                /// \brief
+                /// ctor.
+                Stats () :
+                    signatures (0),
+                    rotations (0),
+                    hits (0),
+                    misses (0),
+                    currentUses (0),
+                    currentAge (0.0),
+                    previousUses (0),
+                    previousAge (0.0) {}
+            };
+
+        private:
+            /// \brief
+            /// \see{DH}/\see{EC} \see{Params} used to create the ephemeral keys.
+            Params::SharedPtr params;
+            /// \brief
+            /// Private key used to sign the params.
+            AsymmetricKey::SharedPtr privateKey;
+            /// \brief
+            /// Message digest used to hash the params.
+            MessageDigest::SharedPtr messageDigest;
+            /// \brief
+            /// Window length (in seconds, 0 == no limit).
+            std::size_t maxAge;
+            /// \brief
+            /// Max number of handshakes per window (0 == no limit).
+            util::ui64 maxUses;
+            /// \brief
+            /// Salt for \see{SymmetricKey} derivation.
+            std::vector<util::ui8> salt;
+            /// \brief
+            /// Length of the resulting \see{SymmetricKey} (in bytes).
+            std::size_t keyLength;
+            /// \brief
+            /// OpenSSL message digest to use for hashing.
+            const EVP_MD *md;
+            /// \brief
+            /// A security counter.
+            std::size_t count;
+            /// \brief
+            /// \see{SymmetricKey} name.
+            std::string keyName;
+            /// \brief
+            /// \see{SymmetricKey} description.
+            std::string keyDescription;
+            /// \brief
+            /// Current window.
+            Entry::SharedPtr current;
+            /// \brief
+            /// When the current window started (\see{util::HRTimer::Click}).
+            util::ui64 currentStartTime;
+            /// \brief
+            /// Signed and ready to become the current window.
+            Entry::SharedPtr next;
+            /// \brief
+            /// Cache stats.
+            Stats stats;
+            /// \brief
+            /// Synchronization mutex.
+            util::Mutex mutex;
+            /// \brief
+            /// Signaled when next is taken (or when done).
+            util::Condition nextCondition;
+            /// \brief
+            /// true == the cache has been stopped.
+            bool done;
+            /// \struct SignedDHEParamsCache::Worker SignedDHEParamsCache.cpp thekogans/crypto/SignedDHEParamsCache.cpp
+            ///
+            /// \brief
+            /// Background thread that keeps the next window signed.
+            struct Worker;
+            /// \brief
+            /// Background thread.
+            util::OwnerVector<Worker> workers;
+
+        public:
+            /// \brief
+            /// ctor. Starts the background thread.
+            /// \param[in] params_ \see{DH}/\see{EC} \see{Params} used to create the ephemeral keys.
+            /// \param[in] privateKey_ Private key used to sign the params.
+            /// \param[in] messageDigest_ Message digest used to hash the params.
+            /// \param[in] maxAge_ Window length (in seconds, 0 == no limit).
+            /// \param[in] maxUses_ Max number of handshakes per window (0 == no limit).
+            /// At least one of maxAge_ and maxUses_ must be set.
+            /// \param[in] salt_ An optional buffer containing salt.
+            /// \param[in] saltLength_ Salt length.
+            /// \param[in] keyLength_ Length of the resulting \see{SymmetricKey} (in bytes).
+            /// \param[in] md_ OpenSSL message digest to use for hashing.
+            /// \param[in] count_ A security counter. Increment the count to slow down \see{SymmetricKey} derivation.
+            /// \param[in] keyName_ Optional \see{SymmetricKey} name.
+            /// \param[in] keyDescription_ Optional \see{SymmetricKey} description.
+            SignedDHEParamsCache (
+                Params::SharedPtr params_,
+                AsymmetricKey::SharedPtr privateKey_,
+                MessageDigest::SharedPtr messageDigest_,
+                std::size_t maxAge_ = DEFAULT_MAX_AGE,
+                util::ui64 maxUses_ = DEFAULT_MAX_USES,
+                const void *salt_ = 0,
+                std::size_t saltLength_ = 0,
+                std::size_t keyLength_ = GetCipherKeyLength (),
+                const EVP_MD *md_ = THEKOGANS_CRYPTO_DEFAULT_MD,
+                std::size_t count_ = 1,
+                const std::string &keyName_ = std::string (),
+                const std::string &keyDescription_ = std::string ());
+            /// \brief
+            /// dtor. Stops the background thread.
+            virtual ~SignedDHEParamsCache ();
+
+            /// \brief
+            /// Return the window length.
+            /// \return Window length (in seconds, 0 == no limit).
+            inline std::size_t GetMaxAge () const {
+                return maxAge;
+            }
+            /// \brief
+            /// Return the max number of handshakes per window.
+            /// \return Max number of handshakes per window (0 == no limit).
+            inline util::ui64 GetMaxUses () const {
+                return maxUses;
+            }
+
+            /// \brief
+            /// Return the current window's entry, counting one handshake against it.
+            /// If the window is over, the ready entry becomes current (and the
+            /// background thread signs the next one).
+            /// \return Current window's \see{Entry}.
+            Entry::SharedPtr Get ();
+
+            /// \brief
+            /// End the current window now (and drop it's private key). The next
+            /// Get starts a new one.
+            void Rotate ();
+
+            /// \brief
+            /// Return a snapshot of the cache stats (rotations and the current and
+            /// previous windows' uses and ages describe the actual reuse window).
+            /// \return Snapshot of the cache stats.
+            Stats GetStats ();
+
+            /// \brief
+            /// Stop the background thread. Get keeps working
+            /// (signing inline when a window ends).
+            void Stop ();
+
+        private:
+            /// \brief
+            /// Create a new ephemeral key exchange and sign it's params.
+            /// \return New \see{Entry}.
+            Entry::SharedPtr CreateEntry () const;
+            /// \brief
+            /// Return true if the current window is over (or there isn't one).
+            /// Must be called with the mutex held.
+            /// \return true == current needs replacing.
+            bool IsCurrentExpired () const;
+            /// \brief
+            /// Return how long (in seconds) the current window has been open.
+            /// Must be called with the mutex held.
+            /// \return Current window's age.
+            util::f64 GetCurrentAge () const;
+            /// \brief
+            /// End the current window, recording it's stats in previous*.
+            /// Must be called with the mutex held.
+            void EndWindow ();
+            /// \brief
+            /// Make the given entry the current window.
+            /// Must be called with the mutex held.
+            /// \param[in] entry Entry to make current.
+            void StartWindow (Entry::SharedPtr entry);
+            /// \brief
+            /// Used by the worker to wait for next to be taken.
+            /// \return true == next is needed, false == done.
+            bool WaitForRoom ();
+            /// \brief
+            /// Used by the worker to add a freshly signed entry.
+            /// \param[in] entry Entry to add.
+            void SetNext (Entry::SharedPtr entry);
+
+            /// \brief
+            /// SignedDHEParamsCache is neither copy constructable, nor assignable.
+            THEKOGANS_CRYPTO_DISALLOW_COPY_AND_ASSIGN (SignedDHEParamsCache)
+        };
+
+    } // namespace crypto
+} // namespace thekogans
+
+#endif // !defined (__thekogans_crypto_SignedDHEParamsCache_h)
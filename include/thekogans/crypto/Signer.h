@@ -21,8 +21,11 @@
 #include <cstddef>
 #include <memory>
 #include "thekogans/util/RefCounted.h"
+#include "thekogans/util/Allocator.h"
 #include "thekogans/util/Buffer.h"
 #include "thekogans/crypto/Config.h"
+#include "thekogans/crypto/Metrics.h"
+#include "thekogans/crypto/Stats.h"
 #include "thekogans/crypto/AsymmetricKey.h"
 #include "thekogans/crypto/MessageDigest.h"
 
@@ -47,12 +50,18 @@ namespace thekogans {
                 AsymmetricKey::SharedPtr privateKey,
                 MessageDigest::SharedPtr messageDigest);
             /// \brief
-            /// typedef for the Signer map.
-            typedef std::map<std::string, Factory> Map;
+            /// Return the Signer dispatch table. Indexed by interned key
+            /// type id (\see{AsymmetricKey::InternKeyType}). Filled in
+            /// once at registration time, so \see{Get} needs no locks.
+            /// \return Signer dispatch table (AsymmetricKey::MAX_KEY_TYPES entries).
+            static Factory *GetFactories ();
             /// \brief
-            /// Controls Map's lifetime.
-            /// \return Signer map.
-            static Map &GetMap ();
+            /// Register a factory for the given key type.
+            /// \param[in] keyType Signer key type.
+            /// \param[in] factory Signer creation factory.
+            static void RegisterFactory (
+                const char *keyType,
+                Factory factory);
 
         public:
             /// \struct Signer::MapInitializer Signer.h thekogans/crypto/Signer.h
@@ -73,7 +82,7 @@ namespace thekogans {
                 /// \param[in] keyType Signer key type.
                 /// \param[in] factory Signer creation factory.
                 MapInitializer (
-                    const std::string &keyType,
+                    const char *keyType,
                     Factory factory);
             };
 
@@ -82,8 +91,20 @@ namespace thekogans {
             /// Private key.
             AsymmetricKey::SharedPtr privateKey;
             /// \brief
+            /// Reports in to privateKey's \see{Metrics::Entry}.
+            Metrics::Handle metrics;
+            /// \brief
+            /// Signer stats (one use per Final, latency of Final).
+            Stats stats;
+            /// \brief
+            /// If set, report in to these stats instead (\see{ShareStats}).
+            Stats *sharedStats;
+            /// \brief
             /// Message digest.
             MessageDigest::SharedPtr messageDigest;
+            /// \brief
+            /// Message digest state saved by SavePrefix (0 == none).
+            MessageDigest::SharedPtr prefix;
 
         public:
             /// \brief
@@ -128,6 +149,64 @@ namespace thekogans {
                 return messageDigest;
             }
 
+            /// \brief
+            /// Return the reference to stats.
+            /// \return Reference to stats.
+            inline const Stats &GetStats () const {
+                return sharedStats != 0 ? *sharedStats : stats;
+            }
+            /// \brief
+            /// Return the reference to stats.
+            /// \return Reference to stats.
+            inline Stats &GetStats () {
+                return sharedStats != 0 ? *sharedStats : stats;
+            }
+            /// \brief
+            /// Report in to the given stats instead of our own. Used by
+            /// \see{Authenticator} so that all its pooled signers share one
+            /// set of stats. The stats must outlive this Signer.
+            /// \param[in] stats_ Stats to report in to.
+            inline void ShareStats (Stats &stats_) {
+                sharedStats = &stats_;
+            }
+
+            // NOTE: If many messages share a long common prefix (protocol
+            // header, params blob...), hash the prefix once and sign
+            // every message starting from it:
+            //
+            // signer->Init ();
+            // signer->Update (prefix, prefixLength);
+            // signer->SavePrefix ();
+            // for (...) {
+            //     signer->InitFromPrefix ();
+            //     signer->Update (suffix, suffixLength);
+            //     signer->Final (...);
+            // }
+            //
+            // The result is the same as Init; Update (prefix); Update (suffix); Final.
+            // The saved state is a copy of messageDigest (\see{MessageDigest::Clone}),
+            // so concrete signers must keep all their state in messageDigest.
+
+            /// \brief
+            /// Save the current state (after Init and one or more Update
+            /// calls over the common prefix) for InitFromPrefix.
+            void SavePrefix ();
+            /// \brief
+            /// Initialize the signer with the state saved by SavePrefix
+            /// and get it ready for the next signature.
+            void InitFromPrefix ();
+            /// \brief
+            /// Return true if SavePrefix was called.
+            /// \return true == the prefix state has been saved.
+            inline bool HasPrefix () const {
+                return prefix.Get () != 0;
+            }
+            /// \brief
+            /// Discard the state saved by SavePrefix.
+            inline void ClearPrefix () {
+                prefix.Reset ();
+            }
+
             /// \brief
             /// Initialize the signer and get it ready for the next signature.
             virtual void Init () = 0;
@@ -146,8 +225,10 @@ namespace thekogans {
 
             /// \brief
             /// Finalize the signing operation and return the signature.
+            /// \param[in] allocator Optional allocator for the returned buffer
+            /// (ex: \see{BufferPoolAllocator}, 0 = heap).
             /// \return Signature.
-            util::Buffer Final ();
+            util::Buffer Final (util::Allocator *allocator = 0);
         };
 
         /// \def THEKOGANS_CRYPTO_DECLARE_SIGNER_COMMON(type)
@@ -173,12 +254,7 @@ namespace thekogans {
         #define THEKOGANS_CRYPTO_DECLARE_SIGNER(type)\
             THEKOGANS_CRYPTO_DECLARE_SIGNER_COMMON (type)\
             static void StaticInit (const char *keyType) {\
-                std::pair<Map::iterator, bool> result =\
-                    GetMap ().insert (Map::value_type (keyType, type::Create));\
-                if (!result.second) {\
-                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (\
-                        "'%s' is already registered.", keyType);\
-                }\
+                RegisterFactory (keyType, type::Create);\
             }
 
         /// \def THEKOGANS_CRYPTO_IMPLEMENT_SIGNER(type, keyType)
@@ -15,10 +15,12 @@
 // You should have received a copy of the GNU General Public License
 // along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
 
+
 #if !defined (__thekogans_crypto_Stats_h)
 #define __thekogans_crypto_Stats_h
 
 #include <cstddef>
+#include <atomic>
 #include <string>
 #include "thekogans/util/Types.h"
 #include "thekogans/crypto/Config.h"
@@ -30,34 +32,191 @@ namespace thekogans {
         ///
         /// \brief
         /// Keeps track of usage statistics for various key components.
+        /// Stats are safe to update from multiple threads. To keep contention
+        /// (and cache line ping-pong) to a minimum, every thread updates one
+        /// of SHARD_COUNT cache line aligned shards using relaxed atomics.
+        /// The shards are merged on read. Besides the byte counts, Stats can
+        /// optionally (\see{EnableLatency}) maintain an HDR style histogram
+        /// of per operation latencies. Bucket i counts operations that took
+        /// [2^i, 2^(i + 1)) nanoseconds.
+        /// Every \see{Encryptor}, \see{Decryptor}, signer and verifier has
+        /// it's own Stats, so the shards are only allocated on first Update,
+        /// and the (much larger) histogram only when latency is enabled. An
+        /// unused Stats costs a few pointers.
 
         struct _LIB_THEKOGANS_CRYPTO_DECL Stats {
+            /// \enum
+            /// Stats constants.
+            enum {
+                /// \brief
+                /// Number of shards.
+                SHARD_COUNT = 8,
+                /// \brief
+                /// Number of latency histogram buckets (2^40 ns ~ 18 minutes).
+                LATENCY_BUCKET_COUNT = 40
+            };
+
+        private:
+            /// \struct Stats::Shard Stats.h thekogans/crypto/Stats.h
+            ///
+            /// \brief
+            /// Per thread counters.
+            struct alignas (64) Shard {
+                /// \brief
+                /// Number of times this component was used.
+                std::atomic<util::ui64> useCount;
+                /// \brief
+                /// The shortest buffer this component saw.
+                std::atomic<util::ui64> minByteCount;
+                /// \brief
+                /// The longest buffer this component saw.
+                std::atomic<util::ui64> maxByteCount;
+                /// \brief
+                /// Total bytes processed by this component.
+                std::atomic<util::ui64> totalByteCount;
+
+                /// \brief
+                /// ctor.
+                Shard () {
+                    Reset ();
+                }
+
+                /// \brief
+                /// Reset the counters.
+                void Reset ();
+            };
+            /// \struct Stats::LatencyShard Stats.h thekogans/crypto/Stats.h
+            ///
+            /// \brief
+            /// Per thread latency histogram.
+            struct alignas (64) LatencyShard {
+                /// \brief
+                /// Latency histogram.
+                std::atomic<util::ui64> latency[LATENCY_BUCKET_COUNT];
+
+                /// \brief
+                /// ctor.
+                LatencyShard () {
+                    Reset ();
+                }
+
+                /// \brief
+                /// Reset the histogram.
+                void Reset ();
+            };
             /// \brief
-            /// Number of times this component was used.
-            std::size_t useCount;
+            /// SHARD_COUNT shards (0 until the first Update).
+            std::atomic<Shard *> shards;
             /// \brief
-            /// The shortest buffer this component saw.
-            std::size_t minByteCount;
+            /// SHARD_COUNT histogram shards (0 until latency is first enabled).
+            std::atomic<LatencyShard *> latencyShards;
             /// \brief
-            /// The longest buffer this component saw.
-            std::size_t maxByteCount;
+            /// true = maintain the latency histogram.
+            std::atomic<bool> latencyEnabled;
+
+            /// \brief
+            /// Return the shards, allocating them if needed.
+            /// \return Shards.
+            Shard *GetShards ();
             /// \brief
-            /// Total bytes processed by this component.
-            std::size_t totalByteCount;
+            /// Return the histogram shards, allocating them if needed.
+            /// \return Histogram shards.
+            LatencyShard *GetLatencyShards ();
 
+        public:
             /// \brief
             /// ctor.
-            Stats () :
-                useCount (0),
-                minByteCount (0),
-                maxByteCount (0),
-                totalByteCount (0) {}
+            /// \param[in] latencyEnabled_ true = maintain the latency histogram.
+            explicit Stats (bool latencyEnabled_ = false);
+            /// \brief
+            /// dtor.
+            ~Stats ();
 
             /// \brief
             /// Update the usage statistics.
             /// \param[in] byteCount Current buffer length.
             void Update (std::size_t byteCount);
 
+            /// \brief
+            /// Return true if the latency histogram is being maintained.
+            /// \return true if the latency histogram is being maintained.
+            inline bool IsLatencyEnabled () const {
+                return latencyEnabled.load (std::memory_order_relaxed);
+            }
+            /// \brief
+            /// Turn the latency histogram on/off.
+            /// \param[in] enabled true = maintain the latency histogram.
+            void EnableLatency (bool enabled);
+            /// \brief
+            /// Record the latency of a single operation.
+            /// \param[in] nanoseconds Operation latency.
+            void UpdateLatency (util::ui64 nanoseconds);
+            /// \brief
+            /// Record the latency of a single operation.
+            /// \param[in] start \see{util::HRTimer::Click} taken at the start of the operation.
+            void UpdateLatencySince (util::ui64 start);
+
+            /// \struct Stats::Scope Stats.h thekogans/crypto/Stats.h
+            ///
+            /// \brief
+            /// Times a single operation and records it when it goes
+            /// out of scope. Operations that don't know their byte
+            /// count up front can set byteCount before returning.
+            struct _LIB_THEKOGANS_CRYPTO_DECL Scope {
+                /// \brief
+                /// Stats to update.
+                Stats &stats;
+                /// \brief
+                /// Operation byte count.
+                std::size_t byteCount;
+                /// \brief
+                /// \see{util::HRTimer::Click} taken in the ctor (0 if latency is disabled).
+                util::ui64 start;
+
+                /// \brief
+                /// ctor.
+                /// \param[in] stats_ Stats to update.
+                /// \param[in] byteCount_ Operation byte count.
+                Scope (
+                    Stats &stats_,
+                    std::size_t byteCount_ = 0);
+                /// \brief
+                /// dtor. Update the stats.
+                ~Scope ();
+
+                /// \brief
+                /// Scope is neither copy constructable, nor assignable.
+                THEKOGANS_CRYPTO_DISALLOW_COPY_AND_ASSIGN (Scope)
+            };
+
+            /// \brief
+            /// Return the number of times this component was used.
+            /// \return Number of times this component was used.
+            util::ui64 GetUseCount () const;
+            /// \brief
+            /// Return the shortest buffer this component saw.
+            /// \return The shortest buffer this component saw (0 if never used).
+            util::ui64 GetMinByteCount () const;
+            /// \brief
+            /// Return the longest buffer this component saw.
+            /// \return The longest buffer this component saw.
+            util::ui64 GetMaxByteCount () const;
+            /// \brief
+            /// Return the total bytes processed by this component.
+            /// \return Total bytes processed by this component.
+            util::ui64 GetTotalByteCount () const;
+            /// \brief
+            /// Return the merged latency histogram.
+            /// \param[out] buckets Where to put the LATENCY_BUCKET_COUNT buckets.
+            /// \return Total number of recorded operations.
+            util::ui64 GetLatencyHistogram (util::ui64 buckets[LATENCY_BUCKET_COUNT]) const;
+            /// \brief
+            /// Return the (bucket upper bound) latency at the given percentile.
+            /// \param[in] percentile [0.0, 100.0].
+            /// \return Latency (in nanoseconds) at the given percentile (0 if
+            /// no latencies have been recorded).
+            util::ui64 GetLatencyPercentile (util::f64 percentile) const;
+
             /// \brief
             /// Reset the stats to 0.
             void Reset ();
@@ -74,6 +233,9 @@ namespace thekogans {
             /// \brief
             /// "TotalByteCount"
             static const char * const ATTR_TOTAL_BYTE_COUNT;
+            /// \brief
+            /// "Latency"
+            static const char * const ATTR_LATENCY;
 
             /// \brief
             /// Return the XML representation of stats.
@@ -83,6 +245,18 @@ namespace thekogans {
             std::string ToString (
                 std::size_t indentationLevel,
                 const char *tagName) const;
+            /// \brief
+            /// Return the JSON representation of stats. Ex:
+            /// {"UseCount":2,"MinByteCount":16,"MaxByteCount":32,"TotalByteCount":48,
+            /// "Latency":{"Count":1,"P50":2048,"P99":2048,"Buckets":[[2048,1]]}}
+            /// Latency is only present if the histogram is enabled. Buckets
+            /// are [upper bound (ns), count] pairs (empty buckets are omitted).
+            /// \return JSON representation of stats.
+            std::string ToJSON () const;
+
+            /// \brief
+            /// Stats is neither copy constructable, nor assignable.
+            THEKOGANS_CRYPTO_DISALLOW_COPY_AND_ASSIGN (Stats)
         };
 
     } // namespace crypto
@@ -0,0 +1,243 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined (__thekogans_crypto_StreamCipher_h)
+#define __thekogans_crypto_StreamCipher_h
+
+#include <cstddef>
+#include <openssl/evp.h>
+#include "thekogans/util/Types.h"
+#include "thekogans/util/RefCounted.h"
+#include "thekogans/crypto/Config.h"
+#include "thekogans/crypto/SymmetricKey.h"
+#include "thekogans/crypto/Encryptor.h"
+#include "thekogans/crypto/Decryptor.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        /// \struct StreamCipher StreamCipher.h thekogans/crypto/StreamCipher.h
+        ///
+        /// \brief
+        /// StreamCipher implements the STREAM construction (Hoang, Reyhanitabar,
+        /// Rogaway, Vizár: Online Authenticated-Encryption and its Nonce-Reuse
+        /// Misuse-Resistance) on top of an AEAD cipher (GCM). It encrypts and decrypts
+        /// streams of unbounded length using constant memory by breaking them up in to
+        /// segments. Every segment is sealed with it's own nonce:
+        ///
+        /// +--------------+-------------------+-----------+
+        /// | nonce prefix |  segment counter  | last flag |
+        /// +--------------+-------------------+-----------+
+        /// |      7       |         4         |     1     |
+        ///
+        /// The nonce prefix is chosen at random when the stream begins and is
+        /// transmitted in the stream header (see BeginEncryption). Because the
+        /// counter and the last flag are part of every nonce, segments can be
+        /// verified and released as soon as they arrive, while reordering, dropping
+        /// or truncating segments is still detected (reordered or dropped segments
+        /// fail authentication, a truncated stream never sees a last segment; see
+        /// IsFinished).
+        ///
+        /// Every sealed segment looks like this:
+        ///
+        /// +---------------+-------+
+        /// |  ciphertext   |  tag  |
+        /// +---------------+-------+
+        /// | plaintext len |  16   |
+        ///
+        /// NOTE: Segment framing (segment length and which segment is last)
+        /// is left to the caller.
+
+        struct _LIB_THEKOGANS_CRYPTO_DECL StreamCipher :
+                public virtual util::RefCounted {
+            /// \brief
+            /// Declare \see{RefCounted} pointers.
+            THEKOGANS_UTIL_DECLARE_REF_COUNTED_POINTERS (StreamCipher)
+
+            enum {
+                /// \brief
+                /// Nonce prefix length (stream header length).
+                NONCE_PREFIX_LENGTH = 7,
+                /// \brief
+                /// Segment counter length.
+                COUNTER_LENGTH = util::UI32_SIZE,
+                /// \brief
+                /// Nonce length.
+                NONCE_LENGTH = NONCE_PREFIX_LENGTH + COUNTER_LENGTH + 1,
+                /// \brief
+                /// Stream header length.
+                HEADER_LENGTH = NONCE_PREFIX_LENGTH,
+                /// \brief
+                /// Segment tag length.
+                TAG_LENGTH = EVP_GCM_TLS_TAG_LEN,
+                /// \brief
+                /// Max segment plaintext length (OpenSSL EVP
+                /// APIs take an int length).
+                MAX_SEGMENT_PLAINTEXT_LENGTH = 0x7fffffff - TAG_LENGTH
+            };
+
+        private:
+            /// \brief
+            /// \see{SymmetricKey} used to encrypt/decrypt.
+            SymmetricKey::SharedPtr key;
+            /// \brief
+            /// OpenSSL cipher object.
+            const EVP_CIPHER *cipher;
+            /// \brief
+            /// Encapsulates the encryption operation.
+            Encryptor encryptor;
+            /// \brief
+            /// Encapsulates the decryption operation.
+            Decryptor decryptor;
+            /// \brief
+            /// Current segment nonce.
+            util::ui8 nonce[NONCE_LENGTH];
+            /// \brief
+            /// Next segment number.
+            util::ui32 counter;
+            /// \brief
+            /// Stream state.
+            enum {
+                /// \brief
+                /// No stream in progress.
+                Idle,
+                /// \brief
+                /// Encrypting a stream.
+                Encrypting,
+                /// \brief
+                /// Decrypting a stream.
+                Decrypting,
+                /// \brief
+                /// Last segment has been processed.
+                Finished,
+                /// \brief
+                /// A segment failed to decrypt. The stream is dead
+                /// (every subsequent DecryptSegment throws).
+                Failed
+            } state;
+
+        public:
+            /// \brief
+            /// ctor.
+            /// \param[in] key_ \see{SymmetricKey} used to encrypt/decrypt.
+            /// \param[in] cipher_ OpenSSL EVP_CIPHER (must be AEAD).
+            StreamCipher (
+                SymmetricKey::SharedPtr key_,
+                const EVP_CIPHER *cipher_ = THEKOGANS_CRYPTO_DEFAULT_CIPHER);
+            /// \brief
+            /// dtor.
+            virtual ~StreamCipher ();
+
+            /// \brief
+            /// Return the cipher key.
+            /// \return Cipher \see{SymmetricKey}.
+            inline SymmetricKey::SharedPtr GetKey () const {
+                return key;
+            }
+
+            /// \brief
+            /// Return the length of a sealed segment.
+            /// \param[in] plaintextLength Segment plaintext length.
+            /// \return Sealed segment length.
+            static std::size_t GetSegmentLength (std::size_t plaintextLength) {
+                return plaintextLength + TAG_LENGTH;
+            }
+
+            /// \brief
+            /// Begin encrypting a new stream. Generates a random nonce prefix.
+            /// \param[out] header Where to write the stream header (HEADER_LENGTH bytes).
+            /// \return Number of bytes written to header.
+            std::size_t BeginEncryption (util::ui8 *header);
+            /// \brief
+            /// Encrypt the next segment of the stream.
+            /// \param[in] plaintext Segment plaintext (can be 0 if plaintextLength == 0).
+            /// \param[in] plaintextLength Segment plaintext length (only the last
+            /// segment can be empty, max MAX_SEGMENT_PLAINTEXT_LENGTH).
+            /// \param[in] last true == this is the last segment of the stream.
+            /// \param[in] associatedData Optional associated data.
+            /// \param[in] associatedDataLength Length of optional associated data.
+            /// \param[out] ciphertext Where to write the sealed segment
+            /// (must be at least GetSegmentLength (plaintextLength) bytes).
+            /// \return Number of bytes written to ciphertext.
+            std::size_t EncryptSegment (
+                const void *plaintext,
+                std::size_t plaintextLength,
+                bool last,
+                const void *associatedData,
+                std::size_t associatedDataLength,
+                util::ui8 *ciphertext);
+
+            /// \brief
+            /// Begin decrypting a new stream.
+            /// \param[in] header Stream header written by BeginEncryption.
+            /// \param[in] headerLength Stream header length.
+            void BeginDecryption (
+                const void *header,
+                std::size_t headerLength);
+            /// \brief
+            /// Verify and decrypt the next segment of the stream.
+            /// \param[in] ciphertext Sealed segment written by EncryptSegment.
+            /// \param[in] ciphertextLength Sealed segment length.
+            /// \param[in] last true == this is the last segment of the stream.
+            /// \param[in] associatedData Optional associated data.
+            /// \param[in] associatedDataLength Length of optional associated data.
+            /// \param[out] plaintext Where to write the plaintext (must be
+            /// at least ciphertextLength - TAG_LENGTH bytes).
+            /// \return Number of bytes written to plaintext.
+            /// NOTE: If the segment fails to decrypt, the (unverified) plaintext
+            /// is wiped, the stream moves to the failed state (\see{IsFailed})
+            /// and the exception is rethrown.
+            std::size_t DecryptSegment (
+                const void *ciphertext,
+                std::size_t ciphertextLength,
+                bool last,
+                const void *associatedData,
+                std::size_t associatedDataLength,
+                util::ui8 *plaintext);
+
+            /// \brief
+            /// Return true if a segment failed to decrypt. A failed stream stays
+            /// failed (DecryptSegment throws and IsFinished returns false) until
+            /// the next BeginDecryption.
+            /// \return true == A segment failed to decrypt.
+            inline bool IsFailed () const {
+                return state == Failed;
+            }
+            /// \brief
+            /// Return true if the last segment of the stream has been processed.
+            /// A receiver must check this once it runs out of input. If it's false,
+            /// the stream has been truncated.
+            /// \return true == Last segment has been processed.
+            inline bool IsFinished () const {
+                return state == Finished;
+            }
+
+        private:
+            /// \brief
+            /// Update the nonce with the current counter and last flag.
+            /// \param[in] last true == last segment.
+            void UpdateNonce (bool last);
+
+            /// \brief
+            /// StreamCipher is neither copy constructable, nor assignable.
+            THEKOGANS_CRYPTO_DISALLOW_COPY_AND_ASSIGN (StreamCipher)
+        };
+
+    } // namespace crypto
+} // namespace thekogans
+
+#endif // !defined (__thekogans_crypto_StreamCipher_h)
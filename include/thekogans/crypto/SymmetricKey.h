@@ -20,20 +20,29 @@
 
 #include <cstddef>
 #include <string>
+#include <vector>
 #if defined (THEKOGANS_CRYPTO_HAVE_ARGON2)
     #include <argon2.h>
 #endif // defined (THEKOGANS_CRYPTO_HAVE_ARGON2)
 #include <openssl/evp.h>
 #include "thekogans/util/Types.h"
 #include "thekogans/util/FixedBuffer.h"
+#include "thekogans/util/Buffer.h"
+#include "thekogans/util/SpinLock.h"
 #include "thekogans/util/Serializer.h"
 #include "thekogans/crypto/Config.h"
 #include "thekogans/crypto/Serializable.h"
 #include "thekogans/crypto/OpenSSLUtils.h"
+#include "thekogans/crypto/ConstantTime.h"
+#include "thekogans/crypto/Stats.h"
 
 namespace thekogans {
     namespace crypto {
 
+        /// \brief
+        /// Forward declaration of CipherKeySchedule.
+        struct CipherKeySchedule;
+
         /// \struct SymmetricKey SymmetricKey.h thekogans/crypto/SymmetricKey.h
         ///
         /// \brief
@@ -52,6 +61,40 @@ namespace thekogans {
             /// \brief
             /// Symmetric key.
             KeyType key;
+            /// \brief
+            /// Synchronize access to schedule.
+            mutable util::SpinLock scheduleLock;
+            /// \brief
+            /// \see{CipherKeySchedule} last computed for this key
+            /// (cleared whenever the key changes).
+            mutable util::RefCounted::SharedPtr<CipherKeySchedule> schedule;
+            /// \brief
+            /// Synchronize access to the iv sequence below.
+            mutable util::SpinLock ivLock;
+            /// \brief
+            /// Random salt (fixed field) shared by every \see{Encryptor}
+            /// using IV_POLICY_COUNTER with this key.
+            mutable util::ui8 ivSalt[EVP_MAX_IV_LENGTH];
+            /// \brief
+            /// true == ivSalt has been drawn.
+            mutable bool ivSaltValid;
+            /// \brief
+            /// Next iv counter value.
+            mutable util::ui64 ivCounter;
+            /// \brief
+            /// true == ivCounter has been exhausted.
+            mutable bool ivCounterExhausted;
+            /// \brief
+            /// Encrypt salts claimed by ordered channel \see{Cipher}s
+            /// (\see{ClaimOrderedChannelSalt}).
+            mutable std::vector<std::vector<util::ui8>> orderedChannelSalts;
+
+            /// \brief
+            /// \see{KeyRingTextStream} needs ATTR_KEY.
+            friend struct KeyRingTextStream;
+            /// \brief
+            /// \see{CipherKeySchedule} caches itself in schedule.
+            friend struct CipherKeySchedule;
 
         public:
             /// \brief
@@ -66,13 +109,23 @@ namespace thekogans {
                 std::size_t length = 0,
                 const ID &id = ID (),
                 const std::string &name = std::string (),
-                const std::string &description = std::string ()) :
-                Serializable (id, name, description),
-                // FixedBuffer will throw if length > EVP_MAX_KEY_LENGTH.
-                key (util::HostEndian, buffer, length, true) {}
-            ~SymmetricKey () {
-                memset (key.GetDataPtr (), 0, key.GetLength ());
-            }
+                const std::string &description = std::string ());
+            /// \brief
+            /// ctor. Take over the key material in the given buffer. The key
+            /// lives inside the (page allocated) SymmetricKey, so the readable
+            /// bytes are moved in to it and the buffer is wiped and emptied.
+            /// \param[in,out] buffer Buffer containing the key.
+            /// \param[in] id Optional key id.
+            /// \param[in] name Optional key name.
+            /// \param[in] description Optional key description.
+            SymmetricKey (
+                util::SecureBuffer &&buffer,
+                const ID &id = ID (),
+                const std::string &name = std::string (),
+                const std::string &description = std::string ());
+            /// \brief
+            /// dtor.
+            ~SymmetricKey ();
 
             /// \brief
             /// Return the key length (in bytes).
@@ -81,6 +134,42 @@ namespace thekogans {
                 return key.GetDataAvailableForReading ();
             }
 
+            /// \enum
+            /// Key derivation functions (\see{GetKDFStats}).
+            enum KDF {
+                /// \brief
+                /// \see{FromArgon2}.
+                KDF_ARGON2,
+                /// \brief
+                /// \see{FromPBKDF1}.
+                KDF_PBKDF1,
+                /// \brief
+                /// \see{FromPBKDF2}.
+                KDF_PBKDF2,
+                /// \brief
+                /// \see{FromOpenSSLPBKDF2}.
+                KDF_OPENSSL_PBKDF2,
+                /// \brief
+                /// \see{FromHKDF}.
+                KDF_HKDF,
+                /// \brief
+                /// \see{FromBlake3}.
+                KDF_BLAKE3,
+                /// \brief
+                /// \see{FromSecretAndSalt}.
+                KDF_SECRET_AND_SALT,
+                /// \brief
+                /// Number of KDFs.
+                KDF_COUNT
+            };
+
+            /// \brief
+            /// Return the process wide stats of the given KDF (one use
+            /// per derived key, byte counts are key lengths).
+            /// \param[in] kdf KDF whose stats to return.
+            /// \return Reference to stats.
+            static Stats &GetKDFStats (KDF kdf);
+
         #if defined (THEKOGANS_CRYPTO_HAVE_ARGON2)
             /// \brief
             /// Convenient typedef int (*) (argon2_context *context).
@@ -181,6 +270,60 @@ namespace thekogans {
                 const std::string &name = std::string (),
                 const std::string &description = std::string ());
 
+            /// \struct SymmetricKey::PBKDF2Input SymmetricKey.h thekogans/crypto/SymmetricKey.h
+            ///
+            /// \brief
+            /// One (password, salt) pair given to FromPBKDF2Batch.
+            struct PBKDF2Input {
+                /// \brief
+                /// Password from which to derive the key.
+                const void *password;
+                /// \brief
+                /// Password length.
+                std::size_t passwordLength;
+                /// \brief
+                /// An optional buffer containing salt.
+                const void *salt;
+                /// \brief
+                /// Salt length.
+                std::size_t saltLength;
+
+                /// \brief
+                /// ctor.
+                /// \param[in] password_ Password from which to derive the key.
+                /// \param[in] passwordLength_ Password length.
+                /// \param[in] salt_ An optional buffer containing salt.
+                /// \param[in] saltLength_ Salt length.
+                PBKDF2Input (
+                    const void *password_ = 0,
+                    std::size_t passwordLength_ = 0,
+                    const void *salt_ = 0,
+                    std::size_t saltLength_ = 0) :
+                    password (password_),
+                    passwordLength (passwordLength_),
+                    salt (salt_),
+                    saltLength (saltLength_) {}
+            };
+
+            /// \brief
+            /// Generate a key for each of the given (password, salt) pairs using
+            /// PBKDF2 (the same function as FromPBKDF2). The derivations are
+            /// independent, so they are spread across a pool of worker threads.
+            /// All inputs are validated before any work is done.
+            /// \param[in] inputs (password, salt) pairs from which to derive the keys.
+            /// \param[in] keyLength Length of the resulting keys (in bytes).
+            /// \param[in] hash Hash function.
+            /// \param[in] count A security counter. Increment the count to slow down
+            /// key derivation.
+            /// \param[in] workerCount Number of threads (0 = one per CPU).
+            /// \return The new symmetric keys (keys[i] is derived from inputs[i]).
+            static std::vector<SharedPtr> FromPBKDF2Batch (
+                const std::vector<PBKDF2Input> &inputs,
+                std::size_t keyLength = GetCipherKeyLength (),
+                PBKDF2_HMAC hash = PBKDF2_HMAC_SHA256,
+                std::size_t count = 1,
+                std::size_t workerCount = 0);
+
             /// \brief
             /// Generate a key using OpeSSL's implementation of PBKDF2.
             /// \param[in] password Password from which to derive the key.
@@ -251,6 +394,26 @@ namespace thekogans {
                 const std::string &name = std::string (),
                 const std::string &description = std::string ());
 
+            /// \brief
+            /// Generate a key using BLAKE3's derive key mode (see \see{Blake3}).
+            /// \param[in] context Application specific, hardcoded, globally unique
+            /// context string (ex: "example.com 2019-12-25 16:18:03 session tokens v1").
+            /// \param[in] keyMaterial Input key material.
+            /// \param[in] keyMaterialLength Input key material length.
+            /// \param[in] keyLength Length of the resulting key (in bytes).
+            /// \param[in] id Optional key id.
+            /// \param[in] name Optional key name.
+            /// \param[in] description Optional key description.
+            /// \return A new symmetric key.
+            static SharedPtr FromBlake3 (
+                const std::string &context,
+                const void *keyMaterial,
+                std::size_t keyMaterialLength,
+                std::size_t keyLength = GetCipherKeyLength (),
+                const ID &id = ID (),
+                const std::string &name = std::string (),
+                const std::string &description = std::string ());
+
             /// \brief
             /// Generate a key given secret (password) and length.
             /// \param[in] secret Shared secret from which to derive the key.
@@ -322,6 +485,52 @@ namespace thekogans {
                 const void *buffer,
                 std::size_t length);
 
+            /// \brief
+            /// Generate the next \see{Encryptor::IV_POLICY_COUNTER} iv: the key's
+            /// random salt followed by the key's next (big endian, 64 bit) counter
+            /// value. The salt and counter belong to the key, not the \see{Encryptor},
+            /// so every encryptor on this key (\see{CipherPool} leases, \see{KeyRing}
+            /// cache rebuilds...) draws from one sequence and never repeats an iv.
+            /// The counter is never allowed to wrap. Thread safe.
+            /// \param[out] iv Where to write the iv.
+            /// \param[in] ivLength Iv length (> 8).
+            void GetNextCounterIV (
+                util::ui8 *iv,
+                std::size_t ivLength) const;
+            /// \brief
+            /// Return the next iv counter value (\see{GetNextCounterIV}).
+            /// \return Next iv counter value.
+            util::ui64 GetIVCounter () const;
+            /// \brief
+            /// Called by \see{Cipher::EnableOrderedChannel} to reserve an encrypt
+            /// salt. An ordered channel's iv sequence (salt ^ sequence number)
+            /// lives in the \see{Cipher}, so a second ordered channel Cipher
+            /// on this key (\see{CipherPool} lease, \see{KeyRing} cache rebuild...)
+            /// with the same salt would restart at 0 and reuse ivs. The claim lasts
+            /// as long as the key (it's only released when the key changes).
+            /// Once claimed, \see{GetNextCounterIV} refuses to mix counter ivs
+            /// in to the key. Thread safe.
+            /// \param[in] salt Encrypt salt to claim.
+            /// \param[in] saltLength Salt length.
+            /// \return true == salt claimed, false == salt already claimed
+            /// or the key has already handed out counter ivs.
+            bool ClaimOrderedChannelSalt (
+                const void *salt,
+                std::size_t saltLength) const;
+
+        private:
+            /// \brief
+            /// Set the key length and return the key storage. Used by the
+            /// factories to derive keys in place instead of through a
+            /// temporary secure buffer.
+            /// \param[in] length Key length (<= EVP_MAX_KEY_LENGTH).
+            /// \return Pointer to length bytes of key storage.
+            util::ui8 *Resize (std::size_t length);
+            /// \brief
+            /// Drop the cached \see{CipherKeySchedule} and restart the iv
+            /// sequence (new salt). Called whenever the key bytes change.
+            void ClearSchedule ();
+
         protected:
             // Serializable
             /// \brief
@@ -16,6 +16,8 @@
 // along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
 
 #include <list>
+#include <memory>
+#include <string>
 #include <openssl/ssl.h>
 #include "thekogans/util/Singleton.h"
 #include "thekogans/util/SpinLock.h"
@@ -31,6 +33,18 @@ namespace thekogans {
         /// Expose the system CA certificates provided by various OS. On Windows, use
         /// the HCERTSTORE api. On OS X use SecTrustSettingsCopyCertificates api. On
         /// Linux use the various system paths to load certificates and/or bundle files.
+        ///
+        /// Enumerating the system stores is slow (hundreds of milliseconds on OS X).
+        /// Pass a cacheFile to \see{Load} to keep a DER bundle of the certificates,
+        /// along with a cheap fingerprint of the source stores (last write times),
+        /// on disk. Subsequent Loads memory map the bundle if the fingerprint still
+        /// matches and verify it against the stores on a background thread
+        /// (\see{Refresh}), replacing the certificates (and the cache) if they changed.
+        /// The cache is only as trustworthy as it's file: on POSIX systems it's written
+        /// owner read/write only, and ignored unless it's a regular file, owned by
+        /// the effective user and not group or world writable (keep it in a directory
+        /// only that user can write to). Cached certificates that have expired (or
+        /// are not yet valid) are dropped at load, just like the stores drop them.
 
         struct _LIB_THEKOGANS_CRYPTO_DECL SystemCACertificates :
                 public util::Singleton<SystemCACertificates, util::SpinLock> {
@@ -39,22 +53,59 @@ namespace thekogans {
             /// List of system CA certificates.
             std::list<X509Ptr> certificates;
             /// \brief
+            /// X509_STORE built from certificates by \see{Load} and
+            /// shared (by reference) by every SSL_CTX passed to \see{Use}.
+            /// NOTE: Treat it as immutable. Adding certificates to a context's
+            /// store after Use will add them to every context that shares it.
+            X509_STOREPtr store;
+            /// \brief
+            /// Last Load loadSystemRootCACertificatesOnly.
+            bool rootCACertificatesOnly;
+            /// \brief
+            /// Last Load cacheFile.
+            std::string cachePath;
+            /// \struct SystemCACertificates::RefreshThread SystemCACertificates.h
+            /// thekogans/crypto/SystemCACertificates.h
+            ///
+            /// \brief
+            /// Background \see{Refresh}.
+            struct RefreshThread;
+            /// \brief
+            /// Background \see{Refresh} started by \see{Load}.
+            std::unique_ptr<RefreshThread> refreshThread;
+            /// \brief
             /// Synchronization lock.
             util::SpinLock spinLock;
 
         public:
             /// \brief
             /// ctor
-            SystemCACertificates () {}
+            SystemCACertificates ();
+            /// \brief
+            /// dtor. Wait for the background \see{Refresh}.
+            ~SystemCACertificates ();
 
             /// \brief
             /// Load system CA certificates.
             /// \param[in] loadSystemRootCACertificatesOnly Load only root CA (self signed) certificates.
-            void Load (bool loadSystemRootCACertificatesOnly = true);
+            /// \param[in] cacheFile Optional cache file (see above).
+            /// \param[in] refreshInBackground true = if the certificates came from the
+            /// cache, verify them against the stores on a background thread.
+            void Load (
+                bool loadSystemRootCACertificatesOnly = true,
+                const std::string &cacheFile = std::string (),
+                bool refreshInBackground = true);
+            /// \brief
+            /// Re-enumerate the system stores and, if they changed, replace the
+            /// certificates, the shared store and the cache file. Contexts already
+            /// using the old store keep it.
+            /// \return true = the certificates changed.
+            bool Refresh ();
 
             /// \brief
-            /// Load system CA certificates in to the X509_STORE of the given context.
-            /// \param[in] ctx Context where to load the certificates.
+            /// Replace the X509_STORE of the given context with the shared store
+            /// holding the system CA certificates. O(1), no certificates are copied.
+            /// \param[in] ctx Context where to use the certificates.
             void Use (SSL_CTX *ctx);
             /// \brief
             /// Empty the certificates list.
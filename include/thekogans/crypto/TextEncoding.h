@@ -0,0 +1,140 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined (__thekogans_crypto_TextEncoding_h)
+#define __thekogans_crypto_TextEncoding_h
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "thekogans/util/Types.h"
+#include "thekogans/crypto/Config.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        /// \brief
+        /// Vectorized hex and Base64 (RFC 4648, standard alphabet) codecs used to
+        /// text encode ids, keys, params and signatures (XML/JSON serialization,
+        /// signfile...). Hex runs 16 bytes at a time (SSE2 on x86, NEON on ARM).
+        /// Base64 runs 12 (SSSE3, selected at runtime with \see{CPUFeatures}) or
+        /// 48 (AArch64 NEON) bytes at a time. Everything falls back to scalar
+        /// code for the tails and on other cpus. The output is identical to
+        /// util::HexEncodeBuffer/util::Base64 (lower case hex, '=' padding).
+
+        /// \brief
+        /// Hex encode a buffer.
+        /// \param[in] buffer Buffer to encode.
+        /// \param[in] length Buffer length.
+        /// \param[out] hex Where to write the 2 * length (lower case) hex digits.
+        /// \return Number of characters written to hex (2 * length).
+        _LIB_THEKOGANS_CRYPTO_DECL std::size_t _LIB_THEKOGANS_CRYPTO_API
+            HexEncode (
+                const void *buffer,
+                std::size_t length,
+                char *hex);
+        /// \brief
+        /// Hex encode a buffer.
+        /// \param[in] buffer Buffer to encode.
+        /// \param[in] length Buffer length.
+        /// \return Hex encoded buffer.
+        _LIB_THEKOGANS_CRYPTO_DECL std::string _LIB_THEKOGANS_CRYPTO_API
+            HexEncode (
+                const void *buffer,
+                std::size_t length);
+        /// \brief
+        /// Decode a hex (upper or lower case) string. Throws if length
+        /// is odd or the string contains anything but hex digits.
+        /// \param[in] hex Hex digits to decode.
+        /// \param[in] length Number of hex digits.
+        /// \param[out] buffer Where to write the length / 2 decoded bytes.
+        /// \return Number of bytes written to buffer (length / 2).
+        _LIB_THEKOGANS_CRYPTO_DECL std::size_t _LIB_THEKOGANS_CRYPTO_API
+            HexDecode (
+                const char *hex,
+                std::size_t length,
+                util::ui8 *buffer);
+        /// \brief
+        /// Decode a hex (upper or lower case) string.
+        /// \param[in] hex Hex string to decode.
+        /// \return Decoded bytes.
+        _LIB_THEKOGANS_CRYPTO_DECL std::vector<util::ui8> _LIB_THEKOGANS_CRYPTO_API
+            HexDecode (const std::string &hex);
+
+        /// \brief
+        /// Return the Base64 encoded length of the given number of bytes.
+        /// \param[in] length Number of bytes to encode.
+        /// \param[in] lineLength Characters per line (0 = one line).
+        /// \return Encoded length (including line breaks).
+        _LIB_THEKOGANS_CRYPTO_DECL std::size_t _LIB_THEKOGANS_CRYPTO_API
+            GetBase64EncodedLength (
+                std::size_t length,
+                std::size_t lineLength = 0);
+        /// \brief
+        /// Base64 encode a buffer.
+        /// \param[in] buffer Buffer to encode.
+        /// \param[in] length Buffer length.
+        /// \param[out] base64 Where to write the encoded characters
+        /// (GetBase64EncodedLength (length, lineLength) of them).
+        /// \param[in] lineLength If not 0, break the output in to lines of
+        /// lineLength (a multiple of 4) characters separated by '\n'.
+        /// \return Number of characters written to base64.
+        _LIB_THEKOGANS_CRYPTO_DECL std::size_t _LIB_THEKOGANS_CRYPTO_API
+            Base64Encode (
+                const void *buffer,
+                std::size_t length,
+                char *base64,
+                std::size_t lineLength = 0);
+        /// \brief
+        /// Base64 encode a buffer.
+        /// \param[in] buffer Buffer to encode.
+        /// \param[in] length Buffer length.
+        /// \param[in] lineLength If not 0, break the output in to lines of
+        /// lineLength (a multiple of 4) characters separated by '\n'.
+        /// \return Base64 encoded buffer.
+        _LIB_THEKOGANS_CRYPTO_DECL std::string _LIB_THEKOGANS_CRYPTO_API
+            Base64Encode (
+                const void *buffer,
+                std::size_t length,
+                std::size_t lineLength = 0);
+        /// \brief
+        /// Decode Base64. White space (line breaks...) is skipped. Throws
+        /// on characters outside the alphabet and on bad padding.
+        /// \param[in] base64 Characters to decode.
+        /// \param[in] length Number of characters.
+        /// \param[out] buffer Where to write the decoded bytes
+        /// (at least length / 4 * 3 + 3 bytes).
+        /// \return Number of bytes written to buffer.
+        _LIB_THEKOGANS_CRYPTO_DECL std::size_t _LIB_THEKOGANS_CRYPTO_API
+            Base64Decode (
+                const char *base64,
+                std::size_t length,
+                util::ui8 *buffer);
+        /// \brief
+        /// Decode Base64. White space (line breaks...) is skipped.
+        /// \param[in] base64 Characters to decode.
+        /// \param[in] length Number of characters.
+        /// \return Decoded bytes.
+        _LIB_THEKOGANS_CRYPTO_DECL std::vector<util::ui8> _LIB_THEKOGANS_CRYPTO_API
+            Base64Decode (
+                const char *base64,
+                std::size_t length);
+
+    } // namespace crypto
+} // namespace thekogans
+
+#endif // !defined (__thekogans_crypto_TextEncoding_h)
@@ -0,0 +1,143 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined (__thekogans_crypto_ThreadCacheAllocator_h)
+#define __thekogans_crypto_ThreadCacheAllocator_h
+
+#include <cstddef>
+#include "thekogans/util/Types.h"
+#include "thekogans/util/Allocator.h"
+#include "thekogans/crypto/Config.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        /// \struct ThreadCacheAllocator ThreadCacheAllocator.h thekogans/crypto/ThreadCacheAllocator.h
+        ///
+        /// \brief
+        /// ThreadCacheAllocator puts a per-thread, size class (powers of two,
+        /// MIN_BLOCK_SIZE to MAX_BLOCK_SIZE) magazine on top of another allocator.
+        /// Freed blocks go to the freeing thread's magazine (up to maxBlocksPerClass
+        /// per class) and are handed back out by that thread's next Alloc of the
+        /// same size class without taking any locks. Blocks larger than MAX_BLOCK_SIZE,
+        /// and blocks that overflow a full magazine, go straight to the underlying
+        /// allocator. The secure variant clears every block before caching it.
+        /// A thread's magazine is returned to the underlying allocator when the
+        /// thread exits (or calls \see{Trim}).
+        ///
+        /// Unlike \see{BufferPoolAllocator}, which shares one lock protected
+        /// pool among all threads, ThreadCacheAllocator never contends. It does
+        /// so at the cost of retaining up to (SIZE_CLASS_COUNT * maxBlocksPerClass)
+        /// blocks per thread.
+        ///
+        /// NOTE: The underlying allocator has to outlive every thread that
+        /// uses the ThreadCacheAllocator. The global instances below satisfy
+        /// that requirement.
+        ///
+        /// \see{Serializable} derivatives are paged from \see{SecureInstance}
+        /// (through their \see{SecureMemoryAllocator}).
+
+        struct _LIB_THEKOGANS_CRYPTO_DECL ThreadCacheAllocator : public util::Allocator {
+            /// \brief
+            /// ThreadCacheAllocator participates in the \see{util::Allocator}
+            /// dynamic discovery and creation.
+            THEKOGANS_UTIL_DECLARE_ALLOCATOR (ThreadCacheAllocator)
+
+            /// \enum
+            /// ThreadCacheAllocator constants.
+            enum {
+                /// \brief
+                /// Smallest size class.
+                MIN_BLOCK_SIZE = 16,
+                /// \brief
+                /// Largest size class.
+                MAX_BLOCK_SIZE = 64 * 1024,
+                /// \brief
+                /// Number of size classes.
+                SIZE_CLASS_COUNT = 13,
+                /// \brief
+                /// Default max number of cached blocks per size class (per thread).
+                DEFAULT_MAX_BLOCKS_PER_CLASS = 16
+            };
+
+        private:
+            /// \brief
+            /// Underlying allocator.
+            util::Allocator &allocator;
+            /// \brief
+            /// true = clear blocks before caching them.
+            bool secure;
+            /// \brief
+            /// Max number of cached blocks per size class (per thread).
+            std::size_t maxBlocksPerClass;
+            /// \brief
+            /// Unique instance id used to find this allocator's
+            /// magazine in the calling thread's cache list.
+            const util::ui64 instanceId;
+
+        public:
+            /// \brief
+            /// Global \see{util::SecureAllocator} backed ThreadCacheAllocator.
+            static ThreadCacheAllocator &SecureInstance ();
+            /// \brief
+            /// Global \see{OpenSSLAllocator} backed ThreadCacheAllocator.
+            static ThreadCacheAllocator &OpenSSLInstance ();
+
+            /// \brief
+            /// ctor.
+            /// \param[in] allocator_ Underlying allocator (0 = \see{util::DefaultAllocator}).
+            /// \param[in] secure_ true = clear blocks before caching them.
+            /// \param[in] maxBlocksPerClass_ Max number of cached blocks per
+            /// size class (per thread).
+            ThreadCacheAllocator (
+                util::Allocator *allocator_ = 0,
+                bool secure_ = false,
+                std::size_t maxBlocksPerClass_ = DEFAULT_MAX_BLOCKS_PER_CLASS);
+            /// \brief
+            /// dtor. Return the calling thread's magazine to the underlying
+            /// allocator. Other threads' magazines are returned when they exit.
+            virtual ~ThreadCacheAllocator ();
+
+            /// \brief
+            /// Allocate a block.
+            /// NOTE: Allocator policy is to return (void *)0 if size == 0.
+            /// if size > 0 and an error occurs, Allocator will throw an exception.
+            /// \param[in] size Size of block to allocate.
+            /// \return Pointer to the allocated block ((void *)0 if size == 0).
+            virtual void *Alloc (std::size_t size) override;
+            /// \brief
+            /// Free a previously Alloc(ated) block.
+            /// NOTE: Allocator policy is to do nothing if ptr == 0.
+            /// \param[in] ptr Pointer to the block returned by Alloc.
+            /// \param[in] size Same size parameter previously passed in to Alloc.
+            virtual void Free (
+                void *ptr,
+                std::size_t size) override;
+
+            /// \brief
+            /// Return the calling thread's magazine to the underlying allocator.
+            void Trim ();
+
+            /// \brief
+            /// ThreadCacheAllocator is neither copy constructable, nor assignable.
+            THEKOGANS_CRYPTO_DISALLOW_COPY_AND_ASSIGN (ThreadCacheAllocator)
+        };
+
+    } // namespace crypto
+} // namespace thekogans
+
+#endif // !defined (__thekogans_crypto_ThreadCacheAllocator_h)
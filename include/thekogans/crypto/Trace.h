@@ -0,0 +1,290 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined (__thekogans_crypto_Trace_h)
+#define __thekogans_crypto_Trace_h
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "thekogans/util/Types.h"
+#include "thekogans/util/RefCounted.h"
+#include "thekogans/util/SpinLock.h"
+#include "thekogans/crypto/Config.h"
+#include "thekogans/crypto/ID.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        /// \struct Trace Trace.h thekogans/crypto/Trace.h
+        ///
+        /// \brief
+        /// Trace emits begin/end events around the hot crypto operations
+        /// (\see{Cipher} encrypt/decrypt, \see{Signer}/\see{Verifier} Final,
+        /// \see{KeyExchange::DeriveSharedSymmetricKey}, \see{KeyRing} Load/Save
+        /// and the \see{SymmetricKey} KDFs) to a registered \see{Trace::Sink}.
+        /// The hooks (\see{THEKOGANS_CRYPTO_TRACE_SCOPE}) are only compiled in if
+        /// the library is built with THEKOGANS_CRYPTO_HAVE_TRACING. Without it they
+        /// expand to nothing (their arguments aren't even evaluated). With it, an
+        /// operation costs one relaxed atomic load while no sink is registered.
+        /// \see{RingBufferTraceSink} keeps the last N events and exports them
+        /// in Chrome trace (chrome://tracing, Perfetto) format.
+
+        struct _LIB_THEKOGANS_CRYPTO_DECL Trace {
+            /// \enum
+            /// Traced operations.
+            enum Operation {
+                /// \brief
+                /// \see{Cipher} encrypt.
+                OPERATION_ENCRYPT,
+                /// \brief
+                /// \see{Cipher} decrypt.
+                OPERATION_DECRYPT,
+                /// \brief
+                /// \see{Signer::Final}.
+                OPERATION_SIGN,
+                /// \brief
+                /// \see{Verifier::Final}.
+                OPERATION_VERIFY,
+                /// \brief
+                /// \see{KeyExchange::DeriveSharedSymmetricKey}.
+                OPERATION_KEY_EXCHANGE,
+                /// \brief
+                /// \see{KeyRing::Load}.
+                OPERATION_KEY_RING_LOAD,
+                /// \brief
+                /// \see{KeyRing::Save}.
+                OPERATION_KEY_RING_SAVE,
+                /// \brief
+                /// \see{SymmetricKey} derivation (PBKDF1/2, HKDF, Argon2...).
+                OPERATION_KDF
+            };
+            /// \enum
+            /// Event phases.
+            enum Phase {
+                /// \brief
+                /// Operation started.
+                PHASE_BEGIN,
+                /// \brief
+                /// Operation ended.
+                PHASE_END
+            };
+
+            /// \struct Trace::Event Trace.h thekogans/crypto/Trace.h
+            ///
+            /// \brief
+            /// A single begin or end event.
+            struct Event {
+                /// \brief
+                /// PHASE_BEGIN or PHASE_END.
+                Phase phase;
+                /// \brief
+                /// Traced operation.
+                Operation operation;
+                /// \brief
+                /// \see{util::HRTimer::Click} when the event was emitted.
+                util::ui64 timestamp;
+                /// \brief
+                /// Id of the thread that emitted the event.
+                util::ui64 threadId;
+                /// \brief
+                /// Id of the key (or key ring/key exchange) involved.
+                ID keyId;
+                /// \brief
+                /// \see{CipherSuite::GetCode} (0 if not known at the trace point).
+                util::ui16 suite;
+                /// \brief
+                /// Number of bytes processed.
+                util::ui64 byteCount;
+
+                /// \brief
+                /// ctor. NOTE: keyId is initialized to ID::Empty (not random),
+                /// Scope constructs events on every traced call.
+                Event () :
+                    phase (PHASE_BEGIN),
+                    operation (OPERATION_ENCRYPT),
+                    timestamp (0),
+                    threadId (0),
+                    keyId (ID::Empty),
+                    suite (0),
+                    byteCount (0) {}
+            };
+
+            /// \struct Trace::Sink Trace.h thekogans/crypto/Trace.h
+            ///
+            /// \brief
+            /// Register an instance of Sink (\see{SetSink}) to receive events.
+            struct _LIB_THEKOGANS_CRYPTO_DECL Sink : public virtual util::RefCounted {
+                /// \brief
+                /// Declare \see{RefCounted} pointers.
+                THEKOGANS_UTIL_DECLARE_REF_COUNTED_POINTERS (Sink)
+
+                /// \brief
+                /// dtor.
+                virtual ~Sink () {}
+
+                /// \brief
+                /// Called on the thread doing the work, keep it short.
+                /// \param[in] event Begin or end event.
+                virtual void OnEvent (const Event &event) throw () = 0;
+            };
+
+            /// \brief
+            /// Register the sink to receive events (null == stop tracing).
+            /// \param[in] sink \see{Sink} to receive events.
+            static void SetSink (Sink::SharedPtr sink);
+            /// \brief
+            /// Return the registered sink.
+            /// \return Registered sink (null if tracing is off).
+            static Sink::SharedPtr GetSink ();
+            /// \brief
+            /// Return true if a sink is registered.
+            /// \return true if a sink is registered.
+            static bool IsEnabled ();
+
+            /// \brief
+            /// Return the name of the given operation ("Encrypt", "Sign"...).
+            /// \param[in] operation Operation whose name to return.
+            /// \return Operation name.
+            static const char *OperationToString (Operation operation);
+            /// \brief
+            /// Format the given events as a Chrome trace (JSON Object Format),
+            /// loadable by chrome://tracing and https://ui.perfetto.dev.
+            /// Timestamps are microseconds relative to the first event.
+            /// \param[in] events Events (in the order they were emitted).
+            /// \return Chrome trace JSON.
+            static std::string ToChromeTrace (const std::vector<Event> &events);
+
+            /// \struct Trace::Scope Trace.h thekogans/crypto/Trace.h
+            ///
+            /// \brief
+            /// Emit the begin event in the ctor and the end event in the dtor.
+            /// Don't use directly, use \see{THEKOGANS_CRYPTO_TRACE_SCOPE}.
+            struct _LIB_THEKOGANS_CRYPTO_DECL Scope {
+            private:
+                /// \brief
+                /// Sink that got the begin event (null if tracing was off).
+                Sink::SharedPtr sink;
+                /// \brief
+                /// The end event.
+                Event event;
+
+            public:
+                /// \brief
+                /// ctor.
+                /// \param[in] operation Traced operation.
+                /// \param[in] keyId Id of the key involved.
+                /// \param[in] suite \see{CipherSuite::GetCode}.
+                /// \param[in] byteCount Number of bytes processed.
+                Scope (
+                    Operation operation,
+                    const ID &keyId,
+                    util::ui16 suite,
+                    util::ui64 byteCount);
+                /// \brief
+                /// dtor.
+                ~Scope ();
+
+                /// \brief
+                /// Scope is neither copy constructable, nor assignable.
+                THEKOGANS_CRYPTO_DISALLOW_COPY_AND_ASSIGN (Scope)
+            };
+        };
+
+        /// \struct RingBufferTraceSink Trace.h thekogans/crypto/Trace.h
+        ///
+        /// \brief
+        /// A \see{Trace::Sink} that keeps the last capacity events.
+
+        struct _LIB_THEKOGANS_CRYPTO_DECL RingBufferTraceSink : public Trace::Sink {
+            /// \brief
+            /// Declare \see{RefCounted} pointers.
+            THEKOGANS_UTIL_DECLARE_REF_COUNTED_POINTERS (RingBufferTraceSink)
+
+            /// \enum
+            /// RingBufferTraceSink constants.
+            enum {
+                /// \brief
+                /// Default number of events to keep.
+                DEFAULT_CAPACITY = 64 * 1024
+            };
+
+        private:
+            /// \brief
+            /// Event ring.
+            std::vector<Trace::Event> events;
+            /// \brief
+            /// Where the next event goes.
+            std::size_t head;
+            /// \brief
+            /// Number of events in the ring.
+            std::size_t count;
+            /// \brief
+            /// Number of events overwritten.
+            util::ui64 droppedCount;
+            /// \brief
+            /// Synchronization lock.
+            mutable util::SpinLock spinLock;
+
+        public:
+            /// \brief
+            /// ctor.
+            /// \param[in] capacity Number of events to keep.
+            explicit RingBufferTraceSink (std::size_t capacity = DEFAULT_CAPACITY);
+
+            /// \brief
+            /// Return the events in the ring, oldest first.
+            /// \return Events in the ring, oldest first.
+            std::vector<Trace::Event> GetEvents () const;
+            /// \brief
+            /// Return the number of events that were overwritten.
+            /// \return Number of events that were overwritten.
+            util::ui64 GetDroppedCount () const;
+            /// \brief
+            /// Empty the ring.
+            void Clear ();
+            /// \brief
+            /// Return the events in the ring in Chrome trace format (\see{Trace::ToChromeTrace}).
+            /// \return Chrome trace JSON.
+            std::string ToChromeTrace () const;
+
+            // Trace::Sink
+            /// \brief
+            /// Add the event to the ring.
+            /// \param[in] event Event to add.
+            virtual void OnEvent (const Trace::Event &event) throw () override;
+
+            /// \brief
+            /// RingBufferTraceSink is neither copy constructable, nor assignable.
+            THEKOGANS_CRYPTO_DISALLOW_COPY_AND_ASSIGN (RingBufferTraceSink)
+        };
+
+    } // namespace crypto
+} // namespace thekogans
+
+/// \def THEKOGANS_CRYPTO_TRACE_SCOPE(operation, keyId, suite, byteCount)
+/// Trace the rest of the enclosing scope as the given operation (\see{Trace}).
+/// Expands to nothing unless built with THEKOGANS_CRYPTO_HAVE_TRACING.
+#if defined (THEKOGANS_CRYPTO_HAVE_TRACING)
+    #define THEKOGANS_CRYPTO_TRACE_SCOPE(operation, keyId, suite, byteCount)\
+        thekogans::crypto::Trace::Scope traceScope (\
+            thekogans::crypto::Trace::operation, keyId, suite, byteCount)
+#else // defined (THEKOGANS_CRYPTO_HAVE_TRACING)
+    #define THEKOGANS_CRYPTO_TRACE_SCOPE(operation, keyId, suite, byteCount)
+#endif // defined (THEKOGANS_CRYPTO_HAVE_TRACING)
+
+#endif // !defined (__thekogans_crypto_Trace_h)
@@ -0,0 +1,370 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+
+#if !defined (__thekogans_crypto_TypedCipher_h)
+#define __thekogans_crypto_TypedCipher_h
+
+#include <cstddef>
+#include <openssl/evp.h>
+#include "thekogans/util/Types.h"
+#include "thekogans/util/Buffer.h"
+#include "thekogans/util/Exception.h"
+#include "thekogans/crypto/Config.h"
+#include "thekogans/crypto/OpenSSLUtils.h"
+#include "thekogans/crypto/SymmetricKey.h"
+#include "thekogans/crypto/FrameHeader.h"
+#include "thekogans/crypto/CiphertextHeader.h"
+#include "thekogans/crypto/Encryptor.h"
+#include "thekogans/crypto/Decryptor.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        /// \struct AES256GCM TypedCipher.h thekogans/crypto/TypedCipher.h
+        ///
+        /// \brief
+        /// \see{TypedCipher} traits for AES-256-GCM.
+        struct AES256GCM {
+            /// \enum
+            /// Algorithm constants.
+            enum {
+                /// \brief
+                /// Key length.
+                KEY_LENGTH = 32,
+                /// \brief
+                /// IV length.
+                IV_LENGTH = 12,
+                /// \brief
+                /// Tag length.
+                TAG_LENGTH = 16
+            };
+            /// \brief
+            /// Return the OpenSSL cipher.
+            /// \return OpenSSL cipher.
+            static const EVP_CIPHER *GetCipher () {
+                return EVP_aes_256_gcm ();
+            }
+        };
+
+        /// \struct AES192GCM TypedCipher.h thekogans/crypto/TypedCipher.h
+        ///
+        /// \brief
+        /// \see{TypedCipher} traits for AES-192-GCM.
+        struct AES192GCM {
+            /// \enum
+            /// Algorithm constants.
+            enum {
+                /// \brief
+                /// Key length.
+                KEY_LENGTH = 24,
+                /// \brief
+                /// IV length.
+                IV_LENGTH = 12,
+                /// \brief
+                /// Tag length.
+                TAG_LENGTH = 16
+            };
+            /// \brief
+            /// Return the OpenSSL cipher.
+            /// \return OpenSSL cipher.
+            static const EVP_CIPHER *GetCipher () {
+                return EVP_aes_192_gcm ();
+            }
+        };
+
+        /// \struct AES128GCM TypedCipher.h thekogans/crypto/TypedCipher.h
+        ///
+        /// \brief
+        /// \see{TypedCipher} traits for AES-128-GCM.
+        struct AES128GCM {
+            /// \enum
+            /// Algorithm constants.
+            enum {
+                /// \brief
+                /// Key length.
+                KEY_LENGTH = 16,
+                /// \brief
+                /// IV length.
+                IV_LENGTH = 12,
+                /// \brief
+                /// Tag length.
+                TAG_LENGTH = 16
+            };
+            /// \brief
+            /// Return the OpenSSL cipher.
+            /// \return OpenSSL cipher.
+            static const EVP_CIPHER *GetCipher () {
+                return EVP_aes_128_gcm ();
+            }
+        };
+
+    #if defined (THEKOGANS_CRYPTO_HAVE_CHACHA20_POLY1305)
+        /// \struct ChaCha20Poly1305 TypedCipher.h thekogans/crypto/TypedCipher.h
+        ///
+        /// \brief
+        /// \see{TypedCipher} traits for ChaCha20-Poly1305.
+        struct ChaCha20Poly1305 {
+            /// \enum
+            /// Algorithm constants.
+            enum {
+                /// \brief
+                /// Key length.
+                KEY_LENGTH = 32,
+                /// \brief
+                /// IV length.
+                IV_LENGTH = 12,
+                /// \brief
+                /// Tag length.
+                TAG_LENGTH = 16
+            };
+            /// \brief
+            /// Return the OpenSSL cipher.
+            /// \return OpenSSL cipher.
+            static const EVP_CIPHER *GetCipher () {
+                return EVP_chacha20_poly1305 ();
+            }
+        };
+    #endif // defined (THEKOGANS_CRYPTO_HAVE_CHACHA20_POLY1305)
+
+        /// \struct TypedCipher TypedCipher.h thekogans/crypto/TypedCipher.h
+        ///
+        /// \brief
+        /// TypedCipher is a compile time specialization of \see{Cipher} for services
+        /// whose suite is fixed at build time. All sizes (iv, tag, framing overhead)
+        /// are compile time constants, GetMaxBufferLength is exact and the encrypt and
+        /// decrypt paths carry no mode (AEAD vs CBC + HMAC) branches. The wire format
+        /// is identical to \see{Cipher}, so the two interoperate byte for byte (a
+        /// TypedCipher<AES256GCM> can decrypt what a \see{Cipher} using EVP_aes_256_gcm
+        /// encrypted, and vice versa).
+        /// NOTE: Only AEAD algorithms are provided. CBC needs an HMAC and is best
+        /// served by \see{Cipher}.
+        ///
+        /// Ex:
+        ///
+        /// \code{.cpp}
+        /// using namespace thekogans;
+        ///
+        /// crypto::TypedCipher<crypto::AES256GCM> cipher (key);
+        /// util::ui8 ciphertext[
+        ///     crypto::TypedCipher<crypto::AES256GCM>::GetMaxBufferLength (PLAINTEXT_LENGTH)];
+        /// std::size_t ciphertextLength = cipher.Encrypt (
+        ///     plaintext, PLAINTEXT_LENGTH, 0, 0, ciphertext);
+        /// \endcode
+
+        template<typename Algorithm>
+        struct TypedCipher {
+            /// \enum
+            /// TypedCipher constants.
+            enum {
+                /// \brief
+                /// IV length.
+                IV_LENGTH = Algorithm::IV_LENGTH,
+                /// \brief
+                /// Tag length.
+                TAG_LENGTH = Algorithm::TAG_LENGTH,
+                /// \brief
+                /// Exact unframed overhead length.
+                OVERHEAD_LENGTH = CiphertextHeader::SIZE + IV_LENGTH + TAG_LENGTH,
+                /// \brief
+                /// Exact framed overhead length.
+                FRAMED_OVERHEAD_LENGTH = FrameHeader::SIZE + OVERHEAD_LENGTH,
+                /// \brief
+                /// Maximum plaintext length.
+                MAX_PLAINTEXT_LENGTH = util::UI32_MAX - FRAMED_OVERHEAD_LENGTH
+            };
+
+        private:
+            /// \brief
+            /// Key used for encryption and decryption.
+            SymmetricKey::SharedPtr key;
+            /// \brief
+            /// Encryptor.
+            Encryptor encryptor;
+            /// \brief
+            /// Decryptor.
+            Decryptor decryptor;
+
+        public:
+            /// \brief
+            /// ctor.
+            /// \param[in] key_ \see{SymmetricKey} used for encryption and decryption.
+            /// \param[in] ivPolicy \see{Encryptor::IVPolicy}.
+            explicit TypedCipher (
+                    SymmetricKey::SharedPtr key_,
+                    Encryptor::IVPolicy ivPolicy = Encryptor::IV_POLICY_RANDOM) :
+                    key (key_),
+                    encryptor (key, Algorithm::GetCipher (), ivPolicy),
+                    decryptor (key, Algorithm::GetCipher ()) {
+                // Make sure the traits agree with OpenSSL (once, here, so
+                // that the hot path can rely on them).
+                if (key->GetKeyLength () != Algorithm::KEY_LENGTH ||
+                        encryptor.GetIVLength () != IV_LENGTH) {
+                    THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                        THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+                }
+            }
+
+            /// \brief
+            /// Return exact buffer length needed to encrypt the given amount of plaintext.
+            /// \param[in] plaintextLength Amount of plaintext to encrypt.
+            /// \return Exact buffer length needed to encrypt the given amount of plaintext.
+            static constexpr std::size_t GetMaxBufferLength (std::size_t plaintextLength) {
+                return OVERHEAD_LENGTH + plaintextLength;
+            }
+            /// \brief
+            /// Return exact buffer length needed to encrypt and frame the given
+            /// amount of plaintext.
+            /// \param[in] plaintextLength Amount of plaintext to encrypt.
+            /// \return Exact buffer length needed to encrypt and frame the given
+            /// amount of plaintext.
+            static constexpr std::size_t GetMaxFramedBufferLength (std::size_t plaintextLength) {
+                return FRAMED_OVERHEAD_LENGTH + plaintextLength;
+            }
+
+            /// \brief
+            /// Return the key associated with this cipher.
+            /// \return Key associated with this cipher.
+            inline SymmetricKey::SharedPtr GetKey () const {
+                return key;
+            }
+
+            /// \brief
+            /// Encrypt the plaintext (\see{Cipher::Encrypt} wire format).
+            /// \param[in] plaintext Plaintext to encrypt.
+            /// \param[in] plaintextLength Plaintext length.
+            /// \param[in] associatedData Optional associated data.
+            /// \param[in] associatedDataLength Length of optional associated data.
+            /// \param[out] ciphertext Where to write the ciphertext (must be
+            /// GetMaxBufferLength (plaintextLength) long).
+            /// \return Number of bytes written to ciphertext.
+            std::size_t Encrypt (
+                    const void *plaintext,
+                    std::size_t plaintextLength,
+                    const void *associatedData,
+                    std::size_t associatedDataLength,
+                    util::ui8 *ciphertext) {
+                if (plaintext != 0 && plaintextLength > 0 &&
+                        plaintextLength <= MAX_PLAINTEXT_LENGTH && ciphertext != 0) {
+                    util::ui8 *iv = ciphertext + CiphertextHeader::SIZE;
+                    encryptor.Init (iv);
+                    if (associatedData != 0 && associatedDataLength > 0) {
+                        encryptor.SetAssociatedData (associatedData, associatedDataLength);
+                    }
+                    // AEAD ciphers are stream ciphers, Final produces no output.
+                    std::size_t ciphertextLength =
+                        encryptor.Update (plaintext, plaintextLength, iv + IV_LENGTH);
+                    ciphertextLength += encryptor.Final (iv + IV_LENGTH + ciphertextLength);
+                    encryptor.GetTag (iv + IV_LENGTH + ciphertextLength);
+                    util::TenantWriteBuffer buffer (
+                        util::NetworkEndian, ciphertext, CiphertextHeader::SIZE);
+                    buffer << CiphertextHeader (
+                        (util::ui16)IV_LENGTH,
+                        (util::ui32)ciphertextLength,
+                        (util::ui16)TAG_LENGTH);
+                    return OVERHEAD_LENGTH + ciphertextLength;
+                }
+                else {
+                    THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                        THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+                }
+            }
+            /// \brief
+            /// Encrypt and frame the plaintext (\see{Cipher::EncryptAndFrame} wire format).
+            /// \param[in] plaintext Plaintext to encrypt.
+            /// \param[in] plaintextLength Plaintext length.
+            /// \param[in] associatedData Optional associated data.
+            /// \param[in] associatedDataLength Length of optional associated data.
+            /// \param[out] ciphertext Where to write the framed ciphertext (must be
+            /// GetMaxFramedBufferLength (plaintextLength) long).
+            /// \return Number of bytes written to ciphertext.
+            std::size_t EncryptAndFrame (
+                    const void *plaintext,
+                    std::size_t plaintextLength,
+                    const void *associatedData,
+                    std::size_t associatedDataLength,
+                    util::ui8 *ciphertext) {
+                std::size_t ciphertextLength = Encrypt (
+                    plaintext,
+                    plaintextLength,
+                    associatedData,
+                    associatedDataLength,
+                    ciphertext + FrameHeader::SIZE);
+                util::TenantWriteBuffer buffer (
+                    util::NetworkEndian, ciphertext, FrameHeader::SIZE);
+                buffer << FrameHeader (key->GetId (), (util::ui32)ciphertextLength);
+                return FrameHeader::SIZE + ciphertextLength;
+            }
+
+            /// \brief
+            /// Decrypt ciphertext produced by Encrypt (or \see{Cipher::Encrypt}).
+            /// \param[in] ciphertext \see{CiphertextHeader}, iv, ciphertext and tag.
+            /// \param[in] ciphertextLength Length of ciphertext.
+            /// \param[in] associatedData Optional associated data.
+            /// \param[in] associatedDataLength Length of optional associated data.
+            /// \param[out] plaintext Where to write the plaintext (must be at least
+            /// ciphertextLength - OVERHEAD_LENGTH long).
+            /// \return Number of bytes written to plaintext.
+            std::size_t Decrypt (
+                    const void *ciphertext,
+                    std::size_t ciphertextLength,
+                    const void *associatedData,
+                    std::size_t associatedDataLength,
+                    util::ui8 *plaintext) {
+                if (ciphertext != 0 && ciphertextLength > OVERHEAD_LENGTH && plaintext != 0) {
+                    const util::ui8 *header = (const util::ui8 *)ciphertext;
+                    CiphertextHeader ciphertextHeader;
+                    util::TenantReadBuffer buffer (
+                        util::NetworkEndian, header, CiphertextHeader::SIZE);
+                    buffer >> ciphertextHeader;
+                    // The header must describe exactly what we produce.
+                    if (ciphertextHeader.ivLength != IV_LENGTH ||
+                            ciphertextHeader.macLength != TAG_LENGTH ||
+                            ciphertextHeader.ciphertextLength != ciphertextLength - OVERHEAD_LENGTH) {
+                        THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                            THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+                    }
+                    const util::ui8 *iv = header + CiphertextHeader::SIZE;
+                    decryptor.Init (iv);
+                    if (associatedData != 0 && associatedDataLength > 0) {
+                        decryptor.SetAssociatedData (associatedData, associatedDataLength);
+                    }
+                    std::size_t plaintextLength = decryptor.Update (
+                        iv + IV_LENGTH,
+                        ciphertextHeader.ciphertextLength,
+                        plaintext);
+                    decryptor.SetTag (
+                        iv + IV_LENGTH + ciphertextHeader.ciphertextLength,
+                        TAG_LENGTH);
+                    plaintextLength += decryptor.Final (plaintext + plaintextLength);
+                    return plaintextLength;
+                }
+                else {
+                    THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                        THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+                }
+            }
+
+            /// \brief
+            /// TypedCipher is neither copy constructable, nor assignable.
+            THEKOGANS_CRYPTO_DISALLOW_COPY_AND_ASSIGN (TypedCipher)
+        };
+
+    } // namespace crypto
+} // namespace thekogans
+
+#endif // !defined (__thekogans_crypto_TypedCipher_h)
@@ -0,0 +1,147 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined (__thekogans_crypto_ValidatedParamsCache_h)
+#define __thekogans_crypto_ValidatedParamsCache_h
+
+#include <cstddef>
+#include <string>
+#include "thekogans/util/Types.h"
+#include "thekogans/util/RefCounted.h"
+#include "thekogans/util/SpinLock.h"
+#include "thekogans/crypto/Config.h"
+#include "thekogans/crypto/ID.h"
+#include "thekogans/crypto/IDCache.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        /// \struct ValidatedParamsCache ValidatedParamsCache.h thekogans/crypto/ValidatedParamsCache.h
+        ///
+        /// \brief
+        /// ValidatedParamsCache remembers (for ttl seconds) signed \see{KeyExchange::Params}
+        /// whose signature validated. Clients receive the same long lived server
+        /// \see{DHEKeyExchange::DHEParams}/\see{RSAKeyExchange::RSAParams} on every
+        /// reconnect, and with a cache a repeat costs a \see{Blake3} hash instead of a
+        /// public key verify. Entries are keyed by a Blake3 hash of the params \see{ID},
+        /// the signature key id, message digest name, signature and the signed data (so
+        /// that the same signature over different data is never accepted). Only successful
+        /// validations are cached. The cache is bounded, uses \see{IDCache}'s CLOCK eviction
+        /// and is safe to share among threads and \see{KeyRing}s:
+        ///
+        /// \code{.cpp}
+        /// using namespace thekogans;
+        ///
+        /// crypto::ValidatedParamsCache::SharedPtr cache (new crypto::ValidatedParamsCache);
+        /// keyRing->SetValidatedParamsCache (cache);
+        /// // Or:
+        /// params->ValidateSignature (publicKey, messageDigest, cache);
+        /// \endcode
+
+        struct _LIB_THEKOGANS_CRYPTO_DECL ValidatedParamsCache : public virtual util::RefCounted {
+            /// \brief
+            /// Declare \see{RefCounted} pointers.
+            THEKOGANS_UTIL_DECLARE_REF_COUNTED_POINTERS (ValidatedParamsCache)
+
+            enum {
+                /// \brief
+                /// Default number of seconds a validation is remembered for.
+                DEFAULT_TTL = 3600,
+                /// \brief
+                /// Default max number of cached validations.
+                DEFAULT_CAPACITY = 1024
+            };
+
+        private:
+            /// \brief
+            /// Number of seconds a validation is remembered for.
+            std::size_t ttl;
+            /// \brief
+            /// Cached validations (the value is the \see{util::HRTimer::Click}
+            /// when the params were validated).
+            IDCache<util::ui64> cache;
+            /// \brief
+            /// Synchronization lock.
+            util::SpinLock spinLock;
+
+        public:
+            /// \brief
+            /// ctor.
+            /// \param[in] ttl_ Number of seconds a validation is remembered for (> 0).
+            /// \param[in] capacity Max number of cached validations (> 0).
+            explicit ValidatedParamsCache (
+                std::size_t ttl_ = DEFAULT_TTL,
+                std::size_t capacity = DEFAULT_CAPACITY);
+
+            /// \brief
+            /// Return the number of seconds a validation is remembered for.
+            /// \return Number of seconds a validation is remembered for.
+            std::size_t GetTTL ();
+            /// \brief
+            /// Set the number of seconds a validation is remembered for.
+            /// \param[in] ttl_ Number of seconds a validation is remembered for (> 0).
+            void SetTTL (std::size_t ttl_);
+
+            /// \brief
+            /// Return the cache key for the given params signature.
+            /// \param[in] paramsId Params \see{ID}.
+            /// \param[in] signatureKeyId Signature \see{AsymmetricKey} id.
+            /// \param[in] signatureMessageDigestName Message digest used to hash the params.
+            /// \param[in] signedData Signed params data.
+            /// \param[in] signedDataLength Signed params data length.
+            /// \param[in] signature Signature to validate.
+            /// \param[in] signatureLength Signature length.
+            /// \return Cache key.
+            static ID GetKey (
+                const ID &paramsId,
+                const ID &signatureKeyId,
+                const std::string &signatureMessageDigestName,
+                const void *signedData,
+                std::size_t signedDataLength,
+                const void *signature,
+                std::size_t signatureLength);
+
+            /// \brief
+            /// Return true if the params with the given key validated less
+            /// than ttl seconds ago. Counts a hit or a miss. Expired entries
+            /// are dropped.
+            /// \param[in] key Cache key (\see{GetKey}).
+            /// \return true == cached.
+            bool Contains (const ID &key);
+            /// \brief
+            /// Remember a successful validation.
+            /// \param[in] key Cache key (\see{GetKey}).
+            void Add (const ID &key);
+
+            /// \brief
+            /// Return a snapshot of the cache counters.
+            /// \return \see{IDCacheStats}.
+            IDCacheStats GetStats ();
+
+            /// \brief
+            /// Drop all cached validations (the counters are preserved).
+            void Clear ();
+
+            /// \brief
+            /// ValidatedParamsCache is neither copy constructable, nor assignable.
+            THEKOGANS_CRYPTO_DISALLOW_COPY_AND_ASSIGN (ValidatedParamsCache)
+        };
+
+    } // namespace crypto
+} // namespace thekogans
+
+#endif // !defined (__thekogans_crypto_ValidatedParamsCache_h)
@@ -0,0 +1,140 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined (__thekogans_crypto_VerificationCache_h)
+#define __thekogans_crypto_VerificationCache_h
+
+#include <cstddef>
+#include "thekogans/util/Types.h"
+#include "thekogans/util/RefCounted.h"
+#include "thekogans/util/SpinLock.h"
+#include "thekogans/crypto/Config.h"
+#include "thekogans/crypto/ID.h"
+#include "thekogans/crypto/IDCache.h"
+#include "thekogans/crypto/AsymmetricKey.h"
+#include "thekogans/crypto/MessageDigest.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        /// \struct VerificationCache VerificationCache.h thekogans/crypto/VerificationCache.h
+        ///
+        /// \brief
+        /// VerificationCache remembers successful signature verifications so that
+        /// a (public key, message digest, buffer, signature) tuple seen again (as
+        /// gossiped messages are) costs a \see{Blake3} hash instead of a public key
+        /// operation. Only successful verifications are cached. Entries are keyed by
+        /// a Blake3 hash of the serialized public key (key material included), key
+        /// type, message digest name, buffer and signature. Keys are not identified
+        /// by their \see{ID} alone (it's chosen by whoever serializes the key), so a
+        /// key presented under another key's id can't borrow it's cached entries.
+        /// The cache is bounded, and uses \see{IDCache}'s CLOCK eviction. It is safe
+        /// to share among threads and \see{Verifier}s:
+        ///
+        /// \code{.cpp}
+        /// using namespace thekogans;
+        ///
+        /// crypto::VerificationCache::SharedPtr cache (new crypto::VerificationCache);
+        /// authenticator1->SetVerificationCache (cache);
+        /// authenticator2->SetVerificationCache (cache);
+        /// \endcode
+
+        struct _LIB_THEKOGANS_CRYPTO_DECL VerificationCache : public virtual util::RefCounted {
+            /// \brief
+            /// Declare \see{RefCounted} pointers.
+            THEKOGANS_UTIL_DECLARE_REF_COUNTED_POINTERS (VerificationCache)
+
+            enum {
+                /// \brief
+                /// Default max number of cached verifications.
+                DEFAULT_CAPACITY = 16384
+            };
+
+        private:
+            /// \brief
+            /// Cached verifications (the value is unused).
+            IDCache<bool> cache;
+            /// \brief
+            /// Synchronization lock.
+            util::SpinLock spinLock;
+
+        public:
+            /// \brief
+            /// ctor.
+            /// \param[in] capacity Max number of cached verifications (> 0).
+            explicit VerificationCache (std::size_t capacity = DEFAULT_CAPACITY);
+
+            /// \brief
+            /// Return the max number of cached verifications.
+            /// \return Max number of cached verifications.
+            std::size_t GetCapacity ();
+            /// \brief
+            /// Set the max number of cached verifications, evicting
+            /// entries if the cache is over the new capacity.
+            /// \param[in] capacity Max number of cached verifications (> 0).
+            void SetCapacity (std::size_t capacity);
+
+            /// \brief
+            /// Return the cache key for the given verification.
+            /// \param[in] publicKey Public key used to verify the signature.
+            /// \param[in] messageDigest Message digest used to hash the buffer.
+            /// \param[in] buffer Buffer whose signature to verify.
+            /// \param[in] bufferLength Buffer length.
+            /// \param[in] signature Signature to verify.
+            /// \param[in] signatureLength Signature length.
+            /// \return Cache key.
+            static ID GetKey (
+                const AsymmetricKey &publicKey,
+                const MessageDigest &messageDigest,
+                const void *buffer,
+                std::size_t bufferLength,
+                const void *signature,
+                std::size_t signatureLength);
+
+            /// \brief
+            /// Return true if the verification with the given key
+            /// succeeded before. Counts a hit or a miss.
+            /// \param[in] key Cache key (\see{GetKey}).
+            /// \return true == cached.
+            bool Contains (const ID &key);
+            /// \brief
+            /// Remember a successful verification.
+            /// \param[in] key Cache key (\see{GetKey}).
+            void Add (const ID &key);
+
+            /// \brief
+            /// Return a snapshot of the cache counters.
+            /// \return \see{IDCacheStats}.
+            IDCacheStats GetStats ();
+            /// \brief
+            /// Return the fraction of lookups that were hits.
+            /// \return [0.0, 1.0] (0.0 if there were no lookups).
+            util::f64 GetHitRate ();
+
+            /// \brief
+            /// Drop all cached verifications (the counters are preserved).
+            void Clear ();
+
+            /// \brief
+            /// VerificationCache is neither copy constructable, nor assignable.
+            THEKOGANS_CRYPTO_DISALLOW_COPY_AND_ASSIGN (VerificationCache)
+        };
+
+    } // namespace crypto
+} // namespace thekogans
+
+#endif // !defined (__thekogans_crypto_VerificationCache_h)
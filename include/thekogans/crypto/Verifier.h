@@ -20,10 +20,14 @@
 
 #include <cstddef>
 #include <memory>
+#include <vector>
 #include "thekogans/util/RefCounted.h"
 #include "thekogans/crypto/Config.h"
+#include "thekogans/crypto/Metrics.h"
+#include "thekogans/crypto/Stats.h"
 #include "thekogans/crypto/AsymmetricKey.h"
 #include "thekogans/crypto/MessageDigest.h"
+#include "thekogans/crypto/VerificationCache.h"
 
 namespace thekogans {
     namespace crypto {
@@ -46,12 +50,18 @@ namespace thekogans {
                 AsymmetricKey::SharedPtr publicKey,
                 MessageDigest::SharedPtr messageDigest);
             /// \brief
-            /// typedef for the Verifier map.
-            typedef std::map<std::string, Factory> Map;
+            /// Return the Verifier dispatch table. Indexed by interned key
+            /// type id (\see{AsymmetricKey::InternKeyType}). Filled in
+            /// once at registration time, so \see{Get} needs no locks.
+            /// \return Verifier dispatch table (AsymmetricKey::MAX_KEY_TYPES entries).
+            static Factory *GetFactories ();
             /// \brief
-            /// Controls Map's lifetime.
-            /// \return Verifier map.
-            static Map &GetMap ();
+            /// Register a factory for the given key type.
+            /// \param[in] keyType Verifier key type.
+            /// \param[in] factory Verifier creation factory.
+            static void RegisterFactory (
+                const char *keyType,
+                Factory factory);
 
         public:
             /// \struct Verifier::MapInitializer Verifier.h thekogans/crypto/Verifier.h
@@ -72,7 +82,7 @@ namespace thekogans {
                 /// \param[in] keyType Verifier key type.
                 /// \param[in] factory Verifier creation factory.
                 MapInitializer (
-                    const std::string &keyType,
+                    const char *keyType,
                     Factory factory);
             };
 
@@ -81,8 +91,24 @@ namespace thekogans {
             /// Public key.
             AsymmetricKey::SharedPtr publicKey;
             /// \brief
+            /// Reports in to publicKey's \see{Metrics::Entry}.
+            Metrics::Handle metrics;
+            /// \brief
+            /// Verifier stats (one use per Final, latency of Final).
+            Stats stats;
+            /// \brief
+            /// If set, report in to these stats instead (\see{ShareStats}).
+            Stats *sharedStats;
+            /// \brief
             /// Message digest object.
             MessageDigest::SharedPtr messageDigest;
+            /// \brief
+            /// Message digest state saved by SavePrefix (0 == none).
+            MessageDigest::SharedPtr prefix;
+            /// \brief
+            /// Optional cache of successful verifications used
+            /// by VerifyBufferSignature (0 == none).
+            VerificationCache::SharedPtr verificationCache;
 
         public:
             /// \brief
@@ -104,6 +130,67 @@ namespace thekogans {
             static SharedPtr Get (
                 AsymmetricKey::SharedPtr publicKey,
                 MessageDigest::SharedPtr messageDigest);
+            /// \struct Verifier::BatchItem Verifier.h thekogans/crypto/Verifier.h
+            ///
+            /// \brief
+            /// One (verifier, buffer, signature) triple for \see{VerifyBatch}.
+            struct _LIB_THEKOGANS_CRYPTO_DECL BatchItem {
+                /// \brief
+                /// Verifier holding the public key and message digest.
+                Verifier::SharedPtr verifier;
+                /// \brief
+                /// Buffer whose signature to verify.
+                const void *buffer;
+                /// \brief
+                /// Buffer length.
+                std::size_t bufferLength;
+                /// \brief
+                /// Signature to verify.
+                const void *signature;
+                /// \brief
+                /// Signature length.
+                std::size_t signatureLength;
+
+                /// \brief
+                /// ctor.
+                /// \param[in] verifier_ Verifier holding the public key and message digest.
+                /// \param[in] buffer_ Buffer whose signature to verify.
+                /// \param[in] bufferLength_ Buffer length.
+                /// \param[in] signature_ Signature to verify.
+                /// \param[in] signatureLength_ Signature length.
+                BatchItem (
+                    Verifier::SharedPtr verifier_ = Verifier::SharedPtr (),
+                    const void *buffer_ = 0,
+                    std::size_t bufferLength_ = 0,
+                    const void *signature_ = 0,
+                    std::size_t signatureLength_ = 0) :
+                    verifier (verifier_),
+                    buffer (buffer_),
+                    bufferLength (bufferLength_),
+                    signature (signature_),
+                    signatureLength (signatureLength_) {}
+            };
+
+            /// \brief
+            /// Verify a batch of signatures. \see{Ed25519} items are checked
+            /// together (\see{Ed25519::VerifyBufferSignatureBatch}), which is
+            /// roughly twice as fast as verifying them one by one. All other
+            /// key types are verified individually (VerifyBufferSignature) by
+            /// workerCount threads. Workers pull the next unverified item as
+            /// they finish the previous one, so a mix of cheap (ECDSA) and
+            /// expensive (RSA) items stays balanced. Items sharing a verifier
+            /// are verified one after another by the same worker.
+            /// \param[in] items Items to verify.
+            /// \param[out] results If not 0, receives a per item result.
+            /// \param[in] workerCount Number of threads to use (0 == one per cpu).
+            /// \param[in] stopOnFailure true == stop verifying as soon as one
+            /// signature fails. The remaining items are reported as failed.
+            /// \return true == all signatures match, false == at least one does not.
+            static bool VerifyBatch (
+                const std::vector<BatchItem> &items,
+                std::vector<bool> *results = 0,
+                std::size_t workerCount = 1,
+                bool stopOnFailure = false);
         #if defined (THEKOGANS_CRYPTO_TYPE_Static)
             /// \brief
             /// Because Verifier uses dynamic initialization, when using
@@ -127,6 +214,93 @@ namespace thekogans {
                 return messageDigest;
             }
 
+            /// \brief
+            /// Return the reference to stats.
+            /// \return Reference to stats.
+            inline const Stats &GetStats () const {
+                return sharedStats != 0 ? *sharedStats : stats;
+            }
+            /// \brief
+            /// Return the reference to stats.
+            /// \return Reference to stats.
+            inline Stats &GetStats () {
+                return sharedStats != 0 ? *sharedStats : stats;
+            }
+            /// \brief
+            /// Report in to the given stats instead of our own. Used by
+            /// \see{Authenticator} so that all its pooled verifiers share one
+            /// set of stats. The stats must outlive this Verifier.
+            /// \param[in] stats_ Stats to report in to.
+            inline void ShareStats (Stats &stats_) {
+                sharedStats = &stats_;
+            }
+
+            /// \brief
+            /// Return the verification cache.
+            /// \return \see{VerificationCache} (0 == none).
+            inline VerificationCache::SharedPtr GetVerificationCache () const {
+                return verificationCache;
+            }
+            /// \brief
+            /// Set the verification cache used by VerifyBufferSignature.
+            /// \param[in] verificationCache_ \see{VerificationCache} (0 == none).
+            inline void SetVerificationCache (VerificationCache::SharedPtr verificationCache_) {
+                verificationCache = verificationCache_;
+            }
+
+            /// \brief
+            /// Verify the given buffer signature (Init; Update; Final). If a
+            /// \see{VerificationCache} is set, a tuple that verified before is
+            /// accepted without the public key operation, and a successful
+            /// verification is added to the cache.
+            /// \param[in] buffer Buffer whose signature to verify.
+            /// \param[in] bufferLength Buffer length.
+            /// \param[in] signature Signature to verify.
+            /// \param[in] signatureLength Signature length.
+            /// \return true == signature matches, false == signature does not match.
+            bool VerifyBufferSignature (
+                const void *buffer,
+                std::size_t bufferLength,
+                const void *signature,
+                std::size_t signatureLength);
+
+            // NOTE: If many messages share a long common prefix (protocol
+            // header, params blob...), hash the prefix once and verify
+            // every message starting from it:
+            //
+            // verifier->Init ();
+            // verifier->Update (prefix, prefixLength);
+            // verifier->SavePrefix ();
+            // for (...) {
+            //     verifier->InitFromPrefix ();
+            //     verifier->Update (suffix, suffixLength);
+            //     verifier->Final (...);
+            // }
+            //
+            // The result is the same as Init; Update (prefix); Update (suffix); Final.
+            // The saved state is a copy of messageDigest (\see{MessageDigest::Clone}),
+            // so concrete verifiers must keep all their state in messageDigest.
+
+            /// \brief
+            /// Save the current state (after Init and one or more Update
+            /// calls over the common prefix) for InitFromPrefix.
+            void SavePrefix ();
+            /// \brief
+            /// Initialize the verifier with the state saved by SavePrefix
+            /// and get it ready for the next signature verification.
+            void InitFromPrefix ();
+            /// \brief
+            /// Return true if SavePrefix was called.
+            /// \return true == the prefix state has been saved.
+            inline bool HasPrefix () const {
+                return prefix.Get () != 0;
+            }
+            /// \brief
+            /// Discard the state saved by SavePrefix.
+            inline void ClearPrefix () {
+                prefix.Reset ();
+            }
+
             /// \brief
             /// Initialize the verifier and get it ready for the next signature verification.
             virtual void Init () = 0;
@@ -170,12 +344,7 @@ namespace thekogans {
         #define THEKOGANS_CRYPTO_DECLARE_VERIFIER(type)\
             THEKOGANS_CRYPTO_DECLARE_VERIFIER_COMMON (type)\
             static void StaticInit (const char *keyType) {\
-                std::pair<Map::iterator, bool> result =\
-                    GetMap ().insert (Map::value_type (keyType, type::Create));\
-                if (!result.second) {\
-                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (\
-                        "'%s' is already registered.", keyType);\
-                }\
+                RegisterFactory (keyType, type::Create);\
             }
 
         /// \def THEKOGANS_CRYPTO_IMPLEMENT_VERIFIER(type, keyType)
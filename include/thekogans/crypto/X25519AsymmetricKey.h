@@ -47,6 +47,9 @@ namespace thekogans {
             /// \brief
             /// \see{DHEKeyExchange} needs access to key.
             friend struct DHEKeyExchange;
+            /// \brief
+            /// \see{KeyEnvelope} needs access to key.
+            friend struct KeyEnvelope;
 
         public:
             /// \brief
@@ -62,6 +65,9 @@ namespace thekogans {
                 const ID &id = ID (),
                 const std::string &name = std::string (),
                 const std::string &description = std::string ());
+            /// \brief
+            /// dtor. Wipes the key.
+            virtual ~X25519AsymmetricKey ();
 
             /// \brief
             /// "KeyType"
@@ -73,6 +79,10 @@ namespace thekogans {
             virtual const char *GetKeyType () const override {
                 return KEY_TYPE;
             }
+            /// \brief
+            /// Return the interned key type id.
+            /// \return Interned key type id.
+            virtual util::ui32 GetKeyTypeId () const override;
 
             /// \brief
             /// Return the key length (in bits).
@@ -0,0 +1,136 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#include <cstdlib>
+#include <atomic>
+#include <openssl/crypto.h>
+#include "thekogans/crypto/AllocationTracker.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        namespace {
+            // PODs, so that they're usable (and need no
+            // destruction) for the whole life of every thread.
+            thread_local util::ui64 allocationCount[AllocationTracker::SOURCE_COUNT];
+            thread_local util::ui64 byteCount[AllocationTracker::SOURCE_COUNT];
+
+            std::atomic<bool> openSSLHooksInstalled (false);
+
+        #if OPENSSL_VERSION_NUMBER >= 0x10100000L
+            // NOTE: These can't forward to CRYPTO_malloc and friends,
+            // as those would call right back in to them.
+            void *OpenSSLMalloc (
+                    size_t size,
+                    const char * /*file*/,
+                    int /*line*/) {
+                AllocationTracker::Record (AllocationTracker::SOURCE_OPENSSL, size);
+                return malloc (size);
+            }
+
+            void *OpenSSLRealloc (
+                    void *ptr,
+                    size_t size,
+                    const char * /*file*/,
+                    int /*line*/) {
+                AllocationTracker::Record (AllocationTracker::SOURCE_OPENSSL, size);
+                return realloc (ptr, size);
+            }
+
+            void OpenSSLFree (
+                    void *ptr,
+                    const char * /*file*/,
+                    int /*line*/) {
+                free (ptr);
+            }
+        #endif // OPENSSL_VERSION_NUMBER >= 0x10100000L
+        }
+
+        AllocationTracker::Counters::Counters () {
+            for (std::size_t i = 0; i < SOURCE_COUNT; ++i) {
+                allocationCount[i] = 0;
+                byteCount[i] = 0;
+            }
+        }
+
+        util::ui64 AllocationTracker::Counters::GetTotal () const {
+            util::ui64 total = 0;
+            for (std::size_t i = 0; i < SOURCE_COUNT; ++i) {
+                total += allocationCount[i];
+            }
+            return total;
+        }
+
+        AllocationTracker::Counters AllocationTracker::Counters::operator - (
+                const Counters &start) const {
+            Counters counters;
+            for (std::size_t i = 0; i < SOURCE_COUNT; ++i) {
+                counters.allocationCount[i] = allocationCount[i] - start.allocationCount[i];
+                counters.byteCount[i] = byteCount[i] - start.byteCount[i];
+            }
+            return counters;
+        }
+
+        const char *AllocationTracker::GetSourceName (Source source) {
+            switch (source) {
+                case SOURCE_OPENSSL:
+                    return "OpenSSL";
+                case SOURCE_SECURE:
+                    return "Secure";
+                case SOURCE_POOL:
+                    return "Pool";
+                case SOURCE_HEAP:
+                    return "Heap";
+                default:
+                    return "Unknown";
+            }
+        }
+
+        void AllocationTracker::Record (
+                Source source,
+                std::size_t size) {
+            if (source < SOURCE_COUNT) {
+                ++allocationCount[source];
+                byteCount[source] += size;
+            }
+        }
+
+        AllocationTracker::Counters AllocationTracker::GetThreadCounters () {
+            Counters counters;
+            for (std::size_t i = 0; i < SOURCE_COUNT; ++i) {
+                counters.allocationCount[i] = allocationCount[i];
+                counters.byteCount[i] = byteCount[i];
+            }
+            return counters;
+        }
+
+        bool AllocationTracker::InstallOpenSSLHooks () {
+        #if OPENSSL_VERSION_NUMBER >= 0x10100000L
+            if (!openSSLHooksInstalled &&
+                    CRYPTO_set_mem_functions (OpenSSLMalloc, OpenSSLRealloc, OpenSSLFree) == 1) {
+                openSSLHooksInstalled = true;
+            }
+        #endif // OPENSSL_VERSION_NUMBER >= 0x10100000L
+            return openSSLHooksInstalled;
+        }
+
+        bool AllocationTracker::AreOpenSSLHooksInstalled () {
+            return openSSLHooksInstalled;
+        }
+
+    } // namespace crypto
+} // namespace thekogans
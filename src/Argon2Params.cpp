@@ -0,0 +1,268 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#if defined (THEKOGANS_CRYPTO_HAVE_ARGON2)
+
+#include <algorithm>
+#include <argon2.h>
+#include "thekogans/util/SizeT.h"
+#include "thekogans/util/HRTimer.h"
+#include "thekogans/util/SystemInfo.h"
+#include "thekogans/util/StringUtils.h"
+#include "thekogans/crypto/Argon2Params.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        #if !defined (THEKOGANS_CRYPTO_MIN_ARGON2_PARAMS_IN_PAGE)
+            #define THEKOGANS_CRYPTO_MIN_ARGON2_PARAMS_IN_PAGE 16
+        #endif // !defined (THEKOGANS_CRYPTO_MIN_ARGON2_PARAMS_IN_PAGE)
+
+        THEKOGANS_CRYPTO_IMPLEMENT_SERIALIZABLE (
+            Argon2Params,
+            1,
+            THEKOGANS_CRYPTO_MIN_ARGON2_PARAMS_IN_PAGE)
+
+        namespace {
+            SymmetricKey::argon2_ctx_fptr GetArgon2Ctx (util::ui32 type) {
+                switch (type) {
+                    case Argon2_d:
+                        return argon2d_ctx;
+                    case Argon2_i:
+                        return argon2i_ctx;
+                    case Argon2_id:
+                        return argon2id_ctx;
+                }
+                return 0;
+            }
+
+            util::ui32 GetCPUCount () {
+                util::ui32 cpuCount = util::SystemInfo::Instance ().GetCPUCount ();
+                return cpuCount > 0 ? cpuCount : 1;
+            }
+        }
+
+        Argon2Params::Argon2Params (
+                argon2_type type_,
+                util::ui32 timeCost_,
+                util::ui32 memoryCost_,
+                util::ui32 lanes_,
+                util::ui32 threads_,
+                const ID &id,
+                const std::string &name,
+                const std::string &description) :
+                Serializable (id, name, description),
+                type (type_),
+                version (ARGON2_VERSION_NUMBER),
+                timeCost (timeCost_),
+                memoryCost (memoryCost_),
+                lanes (lanes_ > 0 ? lanes_ : GetCPUCount ()),
+                threads (threads_ > 0 ? threads_ : std::min (lanes, GetCPUCount ())) {
+            // Threads beyond the lane count would sit idle.
+            if (threads > lanes) {
+                threads = lanes;
+            }
+            Validate ();
+        }
+
+        SymmetricKey::SharedPtr Argon2Params::DeriveKey (
+                const void *password,
+                std::size_t passwordLength,
+                const void *salt,
+                std::size_t saltLength,
+                std::size_t keyLength,
+                const ID &keyId,
+                const std::string &keyName,
+                const std::string &keyDescription) const {
+            if (password != 0 && passwordLength > 0 &&
+                    salt != 0 && saltLength >= MIN_SALT_LENGTH) {
+                argon2_context context = {
+                    0, 0,
+                    (uint8_t *)password,
+                    (uint32_t)passwordLength,
+                    (uint8_t *)salt,
+                    (uint32_t)saltLength,
+                    0, 0,
+                    0, 0,
+                    timeCost,
+                    memoryCost,
+                    lanes,
+                    threads,
+                    version,
+                    0, 0,
+                    ARGON2_DEFAULT_FLAGS
+                };
+                return SymmetricKey::FromArgon2 (
+                    context,
+                    keyLength,
+                    GetArgon2Ctx (type),
+                    keyId,
+                    keyName,
+                    keyDescription);
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        util::f64 Argon2Params::Measure () const {
+            // The timing doesn't depend on the inputs.
+            const util::ui8 password[MIN_SALT_LENGTH] = {0};
+            const util::ui8 salt[MIN_SALT_LENGTH] = {0};
+            util::ui64 start = util::HRTimer::Click ();
+            DeriveKey (password, sizeof (password), salt, sizeof (salt));
+            return util::HRTimer::ToSeconds (
+                util::HRTimer::ComputeElapsedTime (start, util::HRTimer::Click ()));
+        }
+
+        Argon2Params::SharedPtr Argon2Params::Calibrate (
+                util::f64 targetSeconds,
+                util::ui32 threads,
+                util::ui32 maxMemoryCost,
+                argon2_type type,
+                const ID &id,
+                const std::string &name,
+                const std::string &description) {
+            if (threads == 0) {
+                threads = GetCPUCount ();
+            }
+            util::ui32 memoryCost = std::max (
+                (util::ui32)MIN_CALIBRATION_MEMORY_COST,
+                (util::ui32)(ARGON2_SYNC_POINTS * 2 * threads));
+            if (targetSeconds > 0.0 && memoryCost <= maxMemoryCost) {
+                SharedPtr params (
+                    new Argon2Params (type, 1, memoryCost, threads, threads, id, name, description));
+                // Memory hardness is what makes Argon2 expensive to attack,
+                // so spend the budget on memory first...
+                util::f64 elapsed = params->Measure ();
+                while (elapsed * 2.0 <= targetSeconds &&
+                        params->memoryCost <= maxMemoryCost / 2) {
+                    params->memoryCost *= 2;
+                    elapsed = params->Measure ();
+                }
+                // ...and whatever is left on passes (each one
+                // costs about as much as the first).
+                if (elapsed > 0.0 && elapsed < targetSeconds) {
+                    params->timeCost = (util::ui32)(targetSeconds / elapsed);
+                    if (params->timeCost < ARGON2_MIN_TIME) {
+                        params->timeCost = ARGON2_MIN_TIME;
+                    }
+                }
+                return params;
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        std::size_t Argon2Params::Size () const {
+            return
+                Serializable::Size () +
+                util::Serializer::Size (type) +
+                util::Serializer::Size (version) +
+                util::Serializer::Size (timeCost) +
+                util::Serializer::Size (memoryCost) +
+                util::Serializer::Size (lanes) +
+                util::Serializer::Size (threads);
+        }
+
+        void Argon2Params::Read (
+                const BinHeader &header,
+                util::Serializer &serializer) {
+            Serializable::Read (header, serializer);
+            serializer >> type >> version >> timeCost >> memoryCost >> lanes >> threads;
+            Validate ();
+        }
+
+        void Argon2Params::Write (util::Serializer &serializer) const {
+            Serializable::Write (serializer);
+            serializer << type << version << timeCost << memoryCost << lanes << threads;
+        }
+
+        const char * const Argon2Params::ATTR_TYPE = "Type";
+        const char * const Argon2Params::ATTR_VERSION = "Version";
+        const char * const Argon2Params::ATTR_TIME_COST = "TimeCost";
+        const char * const Argon2Params::ATTR_MEMORY_COST = "MemoryCost";
+        const char * const Argon2Params::ATTR_LANES = "Lanes";
+        const char * const Argon2Params::ATTR_THREADS = "Threads";
+
+        void Argon2Params::Read (
+                const TextHeader &header,
+                const pugi::xml_node &node) {
+            Serializable::Read (header, node);
+            type = (util::ui32)util::stringToui64 (node.attribute (ATTR_TYPE).value ());
+            version = (util::ui32)util::stringToui64 (node.attribute (ATTR_VERSION).value ());
+            timeCost = (util::ui32)util::stringToui64 (node.attribute (ATTR_TIME_COST).value ());
+            memoryCost = (util::ui32)util::stringToui64 (node.attribute (ATTR_MEMORY_COST).value ());
+            lanes = (util::ui32)util::stringToui64 (node.attribute (ATTR_LANES).value ());
+            threads = (util::ui32)util::stringToui64 (node.attribute (ATTR_THREADS).value ());
+            Validate ();
+        }
+
+        void Argon2Params::Write (pugi::xml_node &node) const {
+            Serializable::Write (node);
+            node.append_attribute (ATTR_TYPE).set_value (util::ui64Tostring (type).c_str ());
+            node.append_attribute (ATTR_VERSION).set_value (util::ui64Tostring (version).c_str ());
+            node.append_attribute (ATTR_TIME_COST).set_value (util::ui64Tostring (timeCost).c_str ());
+            node.append_attribute (ATTR_MEMORY_COST).set_value (util::ui64Tostring (memoryCost).c_str ());
+            node.append_attribute (ATTR_LANES).set_value (util::ui64Tostring (lanes).c_str ());
+            node.append_attribute (ATTR_THREADS).set_value (util::ui64Tostring (threads).c_str ());
+        }
+
+        void Argon2Params::Read (
+                const TextHeader &header,
+                const util::JSON::Object &object) {
+            Serializable::Read (header, object);
+            type = (util::ui32)object.Get<util::JSON::Number> (ATTR_TYPE)->To<util::SizeT> ();
+            version = (util::ui32)object.Get<util::JSON::Number> (ATTR_VERSION)->To<util::SizeT> ();
+            timeCost = (util::ui32)object.Get<util::JSON::Number> (ATTR_TIME_COST)->To<util::SizeT> ();
+            memoryCost = (util::ui32)object.Get<util::JSON::Number> (ATTR_MEMORY_COST)->To<util::SizeT> ();
+            lanes = (util::ui32)object.Get<util::JSON::Number> (ATTR_LANES)->To<util::SizeT> ();
+            threads = (util::ui32)object.Get<util::JSON::Number> (ATTR_THREADS)->To<util::SizeT> ();
+            Validate ();
+        }
+
+        void Argon2Params::Write (util::JSON::Object &object) const {
+            Serializable::Write (object);
+            object.Add<const util::SizeT &> (ATTR_TYPE, util::SizeT (type));
+            object.Add<const util::SizeT &> (ATTR_VERSION, util::SizeT (version));
+            object.Add<const util::SizeT &> (ATTR_TIME_COST, util::SizeT (timeCost));
+            object.Add<const util::SizeT &> (ATTR_MEMORY_COST, util::SizeT (memoryCost));
+            object.Add<const util::SizeT &> (ATTR_LANES, util::SizeT (lanes));
+            object.Add<const util::SizeT &> (ATTR_THREADS, util::SizeT (threads));
+        }
+
+        void Argon2Params::Validate () const {
+            if (GetArgon2Ctx (type) == 0 ||
+                    (version != ARGON2_VERSION_10 && version != ARGON2_VERSION_13) ||
+                    timeCost < ARGON2_MIN_TIME ||
+                    lanes < ARGON2_MIN_LANES || lanes > ARGON2_MAX_LANES ||
+                    threads < ARGON2_MIN_THREADS || threads > ARGON2_MAX_THREADS ||
+                    memoryCost < ARGON2_SYNC_POINTS * 2 * lanes) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "Invalid Argon2 parameters (type: %u, version: 0x%x, time cost: %u, "
+                    "memory cost: %u, lanes: %u, threads: %u).",
+                    type, version, timeCost, memoryCost, lanes, threads);
+            }
+        }
+
+    } // namespace crypto
+} // namespace thekogans
+
+#endif // defined (THEKOGANS_CRYPTO_HAVE_ARGON2)
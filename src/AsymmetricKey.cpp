@@ -15,12 +15,42 @@
 // You should have received a copy of the GNU General Public License
 // along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
 
+#include <map>
+#include <string>
 #include "thekogans/util/StringUtils.h"
+#include "thekogans/util/SpinLock.h"
+#include "thekogans/util/LockGuard.h"
+#include "thekogans/util/Exception.h"
 #include "thekogans/crypto/AsymmetricKey.h"
 
 namespace thekogans {
     namespace crypto {
 
+        util::ui32 AsymmetricKey::InternKeyType (const char *keyType) {
+            if (keyType != 0) {
+                typedef std::map<std::string, util::ui32> Map;
+                // Leaked on purpose so that it outlives static dtors.
+                static Map *keyTypes = new Map;
+                static util::SpinLock spinLock;
+                util::LockGuard<util::SpinLock> guard (spinLock);
+                Map::const_iterator it = keyTypes->find (keyType);
+                if (it != keyTypes->end ()) {
+                    return it->second;
+                }
+                if (keyTypes->size () < MAX_KEY_TYPES) {
+                    util::ui32 keyTypeId = (util::ui32)keyTypes->size ();
+                    keyTypes->insert (Map::value_type (keyType, keyTypeId));
+                    return keyTypeId;
+                }
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "Too many key types, unable to intern '%s'.", keyType);
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
         std::size_t AsymmetricKey::Size () const {
             return
                 Serializable::Size () +
@@ -0,0 +1,722 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <algorithm>
+#include <openssl/opensslv.h>
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L && !defined (OPENSSL_NO_ASYNC)
+    #define THEKOGANS_CRYPTO_HAVE_OPENSSL_ASYNC
+    #if defined (TOOLCHAIN_OS_Windows)
+        #include <windows.h>
+    #else // defined (TOOLCHAIN_OS_Windows)
+        #include <poll.h>
+    #endif // defined (TOOLCHAIN_OS_Windows)
+    #include <openssl/async.h>
+#endif // OPENSSL_VERSION_NUMBER >= 0x10100000L && !defined (OPENSSL_NO_ASYNC)
+#include "thekogans/util/Exception.h"
+#include "thekogans/util/LockGuard.h"
+#include "thekogans/util/Thread.h"
+#include "thekogans/util/HRTimer.h"
+#include "thekogans/util/SystemInfo.h"
+#include "thekogans/util/LoggerMgr.h"
+#include "thekogans/crypto/OpenSSLInit.h"
+#include "thekogans/crypto/OpenSSLException.h"
+#include "thekogans/crypto/AsyncEngine.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        namespace {
+            inline void Copy (
+                    std::vector<util::ui8> &to,
+                    const void *from,
+                    std::size_t length) {
+                if (from != 0 && length > 0) {
+                    to.assign ((const util::ui8 *)from, (const util::ui8 *)from + length);
+                }
+            }
+        }
+
+        AsyncEngine::Job::Job (Callback::SharedPtr callback_) :
+            callback (callback_),
+            enqueueTime (0),
+            node (0),
+            workerNode (NUMATopology::NO_NODE),
+            completed (false),
+            completedCondition (mutex) {}
+
+        bool AsyncEngine::Job::IsCompleted () {
+            util::LockGuard<util::Mutex> guard (mutex);
+            return completed;
+        }
+
+        void AsyncEngine::Job::Wait () {
+            util::LockGuard<util::Mutex> guard (mutex);
+            while (!completed) {
+                completedCondition.Wait ();
+            }
+        }
+
+        AsyncEngine::EncryptJob::EncryptJob (
+                CipherPool::SharedPtr cipherPool_,
+                const void *plaintext_,
+                std::size_t plaintextLength,
+                const void *associatedData_,
+                std::size_t associatedDataLength,
+                Callback::SharedPtr callback) :
+                Job (callback),
+                cipherPool (cipherPool_) {
+            if (cipherPool.Get () != 0 && plaintext_ != 0 && plaintextLength > 0) {
+                Copy (plaintext, plaintext_, plaintextLength);
+                Copy (associatedData, associatedData_, associatedDataLength);
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        void AsyncEngine::EncryptJob::Execute (Cipher &cipher) {
+            ciphertext = cipher.Encrypt (
+                plaintext.data (),
+                plaintext.size (),
+                associatedData.empty () ? 0 : associatedData.data (),
+                associatedData.size ());
+        }
+
+        AsyncEngine::DecryptJob::DecryptJob (
+                CipherPool::SharedPtr cipherPool_,
+                const void *ciphertext_,
+                std::size_t ciphertextLength,
+                const void *associatedData_,
+                std::size_t associatedDataLength,
+                bool secure_,
+                Callback::SharedPtr callback) :
+                Job (callback),
+                cipherPool (cipherPool_),
+                secure (secure_) {
+            if (cipherPool.Get () != 0 && ciphertext_ != 0 && ciphertextLength > 0) {
+                Copy (ciphertext, ciphertext_, ciphertextLength);
+                Copy (associatedData, associatedData_, associatedDataLength);
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        void AsyncEngine::DecryptJob::Execute (Cipher &cipher) {
+            plaintext = cipher.Decrypt (
+                ciphertext.data (),
+                ciphertext.size (),
+                associatedData.empty () ? 0 : associatedData.data (),
+                associatedData.size (),
+                secure);
+        }
+
+        AsyncEngine::SignJob::SignJob (
+                Authenticator::SharedPtr authenticator_,
+                const void *buffer_,
+                std::size_t bufferLength,
+                Callback::SharedPtr callback) :
+                Job (callback),
+                authenticator (authenticator_) {
+            if (authenticator.Get () != 0 && buffer_ != 0 && bufferLength > 0) {
+                Copy (buffer, buffer_, bufferLength);
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        void AsyncEngine::SignJob::Execute () {
+            signature = authenticator->SignBuffer (buffer.data (), buffer.size ());
+        }
+
+        AsyncEngine::VerifyJob::VerifyJob (
+                Authenticator::SharedPtr authenticator_,
+                const void *buffer_,
+                std::size_t bufferLength,
+                const void *signature_,
+                std::size_t signatureLength,
+                Callback::SharedPtr callback) :
+                Job (callback),
+                authenticator (authenticator_),
+                valid (false) {
+            if (authenticator.Get () != 0 &&
+                    buffer_ != 0 && bufferLength > 0 &&
+                    signature_ != 0 && signatureLength > 0) {
+                Copy (buffer, buffer_, bufferLength);
+                Copy (signature, signature_, signatureLength);
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        void AsyncEngine::VerifyJob::Execute () {
+            valid = authenticator->VerifyBufferSignature (
+                buffer.data (),
+                buffer.size (),
+                signature.data (),
+                signature.size ());
+        }
+
+        AsyncEngine::DeriveSharedSymmetricKeyJob::DeriveSharedSymmetricKeyJob (
+                KeyExchange::SharedPtr keyExchange_,
+                KeyExchange::Params::SharedPtr params_,
+                Callback::SharedPtr callback) :
+                Job (callback),
+                keyExchange (keyExchange_),
+                params (params_) {
+            if (keyExchange.Get () == 0 || params.Get () == 0) {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        void AsyncEngine::DeriveSharedSymmetricKeyJob::Execute () {
+            key = keyExchange->DeriveSharedSymmetricKey (params);
+        }
+
+        struct AsyncEngine::Worker : public util::Thread {
+        private:
+            AsyncEngine &engine;
+            std::size_t node;
+        #if defined (THEKOGANS_CRYPTO_HAVE_OPENSSL_ASYNC)
+            // A batch running on an OpenSSL async job.
+            struct Offload {
+                AsyncEngine &engine;
+                std::vector<Job::SharedPtr> batch;
+                std::vector<std::string> errors;
+                ASYNC_JOB *job;
+                ASYNC_WAIT_CTX *waitCtx;
+                bool paused;
+
+                Offload (
+                        AsyncEngine &engine_,
+                        std::vector<Job::SharedPtr> &batch_) :
+                        engine (engine_),
+                        job (0),
+                        waitCtx (ASYNC_WAIT_CTX_new ()),
+                        paused (false) {
+                    if (waitCtx == 0) {
+                        THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
+                    }
+                    batch.swap (batch_);
+                }
+                ~Offload () {
+                    ASYNC_WAIT_CTX_free (waitCtx);
+                }
+
+                // Runs on the async job stack.
+                static int Run (void *args) {
+                    Offload &offload = **(Offload **)args;
+                    try {
+                        offload.engine.ExecuteJobs (offload.batch, &offload.errors);
+                    }
+                    catch (...) {
+                        // Nothing may unwind past the async job stack.
+                        offload.errors.resize (offload.batch.size (), "Unknown error.");
+                    }
+                    return 1;
+                }
+
+                THEKOGANS_CRYPTO_DISALLOW_COPY_AND_ASSIGN (Offload)
+            };
+            std::list<Offload *> inFlight;
+        #endif // defined (THEKOGANS_CRYPTO_HAVE_OPENSSL_ASYNC)
+
+        public:
+            Worker (
+                AsyncEngine &engine_,
+                std::size_t node_) :
+                engine (engine_),
+                node (node_) {}
+
+        protected:
+            // util::Thread
+            virtual void Run () throw () override {
+                if (engine.numaAware) {
+                    NUMATopology::Instance ().BindCurrentThread (node);
+                }
+            #if defined (THEKOGANS_CRYPTO_HAVE_OPENSSL_ASYNC)
+                if (engine.maxInFlightJobs > 0 && ASYNC_is_capable () &&
+                        ASYNC_init_thread (engine.maxInFlightJobs, 0) == 1) {
+                    RunOffloaded ();
+                    ASYNC_cleanup_thread ();
+                    return;
+                }
+            #endif // defined (THEKOGANS_CRYPTO_HAVE_OPENSSL_ASYNC)
+                std::vector<Job::SharedPtr> batch;
+                while (engine.GetJobs (node, batch)) {
+                    util::ui64 start = util::HRTimer::Click ();
+                    engine.ExecuteJobs (batch);
+                    engine.AddBusyTime (node,
+                        util::HRTimer::ToSeconds (
+                            util::HRTimer::ComputeElapsedTime (start, util::HRTimer::Click ())));
+                    batch.clear ();
+                }
+            }
+
+        #if defined (THEKOGANS_CRYPTO_HAVE_OPENSSL_ASYNC)
+        private:
+            void RunOffloaded () {
+                std::vector<Job::SharedPtr> batch;
+                for (;;) {
+                    if (inFlight.size () < engine.maxInFlightJobs) {
+                        // Only block for new work if there's nothing to resume.
+                        if (!engine.GetJobs (node, batch, inFlight.empty ())) {
+                            break;
+                        }
+                        if (!batch.empty ()) {
+                            Start (batch);
+                            continue;
+                        }
+                    }
+                    if (!Poll () && inFlight.size () >= engine.maxInFlightJobs) {
+                        // The device is saturated. Rather than let the queue
+                        // build, run the next batch in software.
+                        if (!engine.GetJobs (node, batch, false)) {
+                            break;
+                        }
+                        if (!batch.empty ()) {
+                            RunInSoftware (batch);
+                        }
+                    }
+                }
+                // Let the jobs in flight finish before ASYNC_cleanup_thread.
+                while (!inFlight.empty ()) {
+                    Poll ();
+                }
+            }
+
+            void Start (std::vector<Job::SharedPtr> &batch) {
+                Offload *offload = 0;
+                THEKOGANS_UTIL_TRY {
+                    offload = new Offload (engine, batch);
+                }
+                THEKOGANS_UTIL_CATCH (util::Exception) {
+                    THEKOGANS_UTIL_LOG_ERROR ("%s\n", exception.Report ().c_str ());
+                    RunInSoftware (batch);
+                    return;
+                }
+                if (!Resume (*offload)) {
+                    inFlight.push_back (offload);
+                }
+            }
+
+            // Start or resume the async job. Returns true if the
+            // offload is done (and its jobs completed).
+            bool Resume (Offload &offload) {
+                bool started = offload.job != 0;
+                Offload *args = &offload;
+                int ret = 0;
+                switch (ASYNC_start_job (&offload.job, offload.waitCtx, &ret,
+                        Offload::Run, &args, sizeof (args))) {
+                    case ASYNC_PAUSE: {
+                        if (!offload.paused) {
+                            offload.paused = true;
+                            util::LockGuard<util::Mutex> guard (engine.mutex);
+                            ++engine.offloadedBatchCount;
+                        }
+                        return false;
+                    }
+                    case ASYNC_FINISH: {
+                        Complete (offload, std::string ());
+                        break;
+                    }
+                    case ASYNC_NO_JOBS: {
+                        // Out of async jobs (the device is saturated).
+                        RunInSoftware (offload.batch);
+                        break;
+                    }
+                    default: {
+                        if (!started) {
+                            RunInSoftware (offload.batch);
+                        }
+                        else {
+                            Complete (offload, "OpenSSL async job failed.");
+                        }
+                        break;
+                    }
+                }
+                delete &offload;
+                return true;
+            }
+
+            // Wait (at most OFFLOAD_POLL_TIMEOUT) for jobs in flight to
+            // become ready and resume them. Returns true if any finished.
+            bool Poll () {
+                std::vector<OSSL_ASYNC_FD> fds;
+                std::vector<Offload *> owners;
+                std::vector<Offload *> ready;
+                for (std::list<Offload *>::const_iterator
+                        it = inFlight.begin (),
+                        end = inFlight.end (); it != end; ++it) {
+                    std::size_t count = 0;
+                    if (ASYNC_WAIT_CTX_get_all_fds ((*it)->waitCtx, 0, &count) == 1 && count > 0) {
+                        std::size_t offset = fds.size ();
+                        fds.resize (offset + count);
+                        ASYNC_WAIT_CTX_get_all_fds ((*it)->waitCtx, &fds[offset], &count);
+                        owners.resize (offset + count, *it);
+                    }
+                    else {
+                        // Engines that don't use wait fds expect to be polled.
+                        ready.push_back (*it);
+                    }
+                }
+                if (!fds.empty ()) {
+                    int timeout = ready.empty () ? OFFLOAD_POLL_TIMEOUT : 0;
+                #if defined (TOOLCHAIN_OS_Windows)
+                    DWORD count = (DWORD)(fds.size () < MAXIMUM_WAIT_OBJECTS ?
+                        fds.size () : MAXIMUM_WAIT_OBJECTS);
+                    DWORD result = WaitForMultipleObjects (count, fds.data (), FALSE, (DWORD)timeout);
+                    if (result < WAIT_OBJECT_0 + count) {
+                        // Only the first signaled handle is reported. Resume
+                        // everybody, the ones that aren't ready just pause again.
+                        ready.insert (ready.end (), owners.begin (), owners.end ());
+                    }
+                #else // defined (TOOLCHAIN_OS_Windows)
+                    std::vector<pollfd> pollFds (fds.size ());
+                    for (std::size_t i = 0, count = fds.size (); i < count; ++i) {
+                        pollFds[i].fd = fds[i];
+                        pollFds[i].events = POLLIN;
+                        pollFds[i].revents = 0;
+                    }
+                    if (poll (pollFds.data (), (nfds_t)pollFds.size (), timeout) > 0) {
+                        for (std::size_t i = 0, count = pollFds.size (); i < count; ++i) {
+                            if (pollFds[i].revents != 0 &&
+                                    std::find (ready.begin (), ready.end (), owners[i]) == ready.end ()) {
+                                ready.push_back (owners[i]);
+                            }
+                        }
+                    }
+                #endif // defined (TOOLCHAIN_OS_Windows)
+                }
+                bool finished = false;
+                for (std::size_t i = 0, count = ready.size (); i < count; ++i) {
+                    Offload *offload = ready[i];
+                    // Resume deletes the offload when it's done.
+                    inFlight.remove (offload);
+                    if (Resume (*offload)) {
+                        finished = true;
+                    }
+                    else {
+                        inFlight.push_back (offload);
+                    }
+                }
+                return finished;
+            }
+
+            void RunInSoftware (std::vector<Job::SharedPtr> &batch) {
+                {
+                    util::LockGuard<util::Mutex> guard (engine.mutex);
+                    ++engine.softwareBatchCount;
+                }
+                OpenSSLInit::SoftwareScope softwareScope;
+                util::ui64 start = util::HRTimer::Click ();
+                engine.ExecuteJobs (batch);
+                engine.AddBusyTime (node,
+                    util::HRTimer::ToSeconds (
+                        util::HRTimer::ComputeElapsedTime (start, util::HRTimer::Click ())));
+                batch.clear ();
+            }
+
+            void Complete (
+                    Offload &offload,
+                    const std::string &error) {
+                for (std::size_t i = 0, count = offload.batch.size (); i < count; ++i) {
+                    engine.CompleteJob (*offload.batch[i],
+                        !error.empty () ? error :
+                        i < offload.errors.size () ? offload.errors[i] : std::string ());
+                }
+            }
+        #endif // defined (THEKOGANS_CRYPTO_HAVE_OPENSSL_ASYNC)
+        };
+
+        AsyncEngine::AsyncEngine (
+                std::size_t workerCount,
+                std::size_t maxBatchJobs_,
+                std::size_t smallJobLength_,
+                std::size_t maxInFlightJobs_,
+                bool numaAware_) :
+                maxBatchJobs (maxBatchJobs_ > 0 ? maxBatchJobs_ : 1),
+                smallJobLength (smallJobLength_),
+                numaAware (numaAware_),
+                jobCount (0),
+                maxQueueDepth (0),
+                maxInFlightJobs (maxInFlightJobs_),
+                batchCount (0),
+                offloadedBatchCount (0),
+                softwareBatchCount (0),
+                stats (true),
+                done (false),
+                jobsCondition (mutex) {
+            if (workerCount == 0) {
+                workerCount = util::SystemInfo::Instance ().GetCPUCount ();
+                if (workerCount == 0) {
+                    workerCount = 1;
+                }
+            }
+            std::size_t nodeCount = numaAware ? NUMATopology::Instance ().GetNodeCount () : 1;
+            jobs.resize (nodeCount);
+            for (std::size_t i = 0; i < nodeCount; ++i) {
+                nodeStats.push_back (NUMATopology::NodeStats (i));
+            }
+            workers.reserve (workerCount);
+            for (std::size_t i = 0; i < workerCount; ++i) {
+                // Round robin, so that any worker count is spread evenly.
+                std::size_t node = i % nodeCount;
+                ++nodeStats[node].workerCount;
+                workers.push_back (new Worker (*this, node));
+                workers.back ()->Create ();
+            }
+        }
+
+        AsyncEngine::~AsyncEngine () {
+            std::list<Job::SharedPtr> pendingJobs;
+            {
+                util::LockGuard<util::Mutex> guard (mutex);
+                done = true;
+                for (std::size_t i = 0, count = jobs.size (); i < count; ++i) {
+                    pendingJobs.splice (pendingJobs.end (), jobs[i]);
+                }
+                jobCount = 0;
+                jobsCondition.SignalAll ();
+            }
+            for (std::size_t i = 0, count = workers.size (); i < count; ++i) {
+                workers[i]->Wait ();
+            }
+            workers.deleteAndClear ();
+            // Don't leave anyone blocked in Job::Wait.
+            for (std::list<Job::SharedPtr>::iterator
+                    it = pendingJobs.begin (),
+                    end = pendingJobs.end (); it != end; ++it) {
+                CompleteJob (**it, "AsyncEngine stopped.");
+            }
+        }
+
+        void AsyncEngine::Enqueue (
+                Job::SharedPtr job,
+                int node) {
+            if (job.Get () != 0) {
+                job->enqueueTime = util::HRTimer::Click ();
+                job->node = 0;
+                if (numaAware) {
+                    // The job copied it's input in the calling
+                    // thread, so that's where the pages live.
+                    if (node == NUMATopology::NO_NODE) {
+                        node = (int)NUMATopology::Instance ().GetCurrentNode ();
+                    }
+                    if (node >= 0 && (std::size_t)node < jobs.size ()) {
+                        job->node = (std::size_t)node;
+                    }
+                }
+                util::LockGuard<util::Mutex> guard (mutex);
+                if (!done) {
+                    jobs[job->node].push_back (job);
+                    if (maxQueueDepth < ++jobCount) {
+                        maxQueueDepth = jobCount;
+                    }
+                    // Any worker can take it, so with more than one
+                    // queue wake them all up (the owning node's
+                    // workers get first dibs).
+                    if (jobs.size () > 1) {
+                        jobsCondition.SignalAll ();
+                    }
+                    else {
+                        jobsCondition.Signal ();
+                    }
+                }
+                else {
+                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                        "%s", "AsyncEngine stopped.");
+                }
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        std::size_t AsyncEngine::GetQueueDepth () {
+            util::LockGuard<util::Mutex> guard (mutex);
+            return jobCount;
+        }
+
+        std::size_t AsyncEngine::GetMaxQueueDepth () {
+            util::LockGuard<util::Mutex> guard (mutex);
+            return maxQueueDepth;
+        }
+
+        util::ui64 AsyncEngine::GetBatchCount () {
+            util::LockGuard<util::Mutex> guard (mutex);
+            return batchCount;
+        }
+
+        util::ui64 AsyncEngine::GetOffloadedBatchCount () {
+            util::LockGuard<util::Mutex> guard (mutex);
+            return offloadedBatchCount;
+        }
+
+        util::ui64 AsyncEngine::GetSoftwareBatchCount () {
+            util::LockGuard<util::Mutex> guard (mutex);
+            return softwareBatchCount;
+        }
+
+        std::vector<NUMATopology::NodeStats> AsyncEngine::GetNodeStats () {
+            util::LockGuard<util::Mutex> guard (mutex);
+            return nodeStats;
+        }
+
+        bool AsyncEngine::GetJobs (
+                std::size_t node,
+                std::vector<Job::SharedPtr> &batch,
+                bool wait) {
+            util::LockGuard<util::Mutex> guard (mutex);
+            while (wait && !done && jobCount == 0) {
+                jobsCondition.Wait ();
+            }
+            if (done) {
+                return false;
+            }
+            if (jobCount == 0) {
+                return true;
+            }
+            // Own queue first, then the other nodes' in order.
+            std::size_t queueCount = jobs.size ();
+            std::list<Job::SharedPtr> *queue = &jobs[node % queueCount];
+            for (std::size_t i = 1; queue->empty () && i < queueCount; ++i) {
+                queue = &jobs[(node + i) % queueCount];
+            }
+            batch.push_back (queue->front ());
+            queue->pop_front ();
+            // Pull in adjacent small jobs that share the same
+            // cipher pool so that they can run under one lease.
+            CipherPool *cipherPool = batch[0]->GetCipherPool ();
+            if (cipherPool != 0 && batch[0]->GetLength () <= smallJobLength) {
+                while (batch.size () < maxBatchJobs && !queue->empty () &&
+                        queue->front ()->GetCipherPool () == cipherPool &&
+                        queue->front ()->GetLength () <= smallJobLength) {
+                    batch.push_back (queue->front ());
+                    queue->pop_front ();
+                }
+                if (batch.size () > 1) {
+                    ++batchCount;
+                }
+            }
+            jobCount -= batch.size ();
+            for (std::size_t i = 0, count = batch.size (); i < count; ++i) {
+                batch[i]->workerNode = (int)node;
+            }
+            return true;
+        }
+
+        void AsyncEngine::AddBusyTime (
+                std::size_t node,
+                util::f64 seconds) {
+            util::LockGuard<util::Mutex> guard (mutex);
+            nodeStats[node].busySeconds += seconds;
+        }
+
+        void AsyncEngine::ExecuteJobs (
+                std::vector<Job::SharedPtr> &batch,
+                std::vector<std::string> *errors) {
+            CipherPool *cipherPool = batch[0]->GetCipherPool ();
+            if (cipherPool != 0) {
+                std::size_t completedJobs = 0;
+                THEKOGANS_UTIL_TRY {
+                    CipherPool::Lease lease (*cipherPool);
+                    for (std::size_t count = batch.size ();
+                            completedJobs < count; ++completedJobs) {
+                        std::string error;
+                        THEKOGANS_UTIL_TRY {
+                            batch[completedJobs]->Execute (*lease);
+                        }
+                        THEKOGANS_UTIL_CATCH (util::Exception) {
+                            error = exception.Report ();
+                        }
+                        if (errors != 0) {
+                            errors->push_back (error);
+                        }
+                        else {
+                            CompleteJob (*batch[completedJobs], error);
+                        }
+                    }
+                }
+                THEKOGANS_UTIL_CATCH (util::Exception) {
+                    // Unable to lease a cipher. Fail the rest of the batch.
+                    for (std::size_t count = batch.size ();
+                            completedJobs < count; ++completedJobs) {
+                        if (errors != 0) {
+                            errors->push_back (exception.Report ());
+                        }
+                        else {
+                            CompleteJob (*batch[completedJobs], exception.Report ());
+                        }
+                    }
+                }
+            }
+            else {
+                for (std::size_t i = 0, count = batch.size (); i < count; ++i) {
+                    std::string error;
+                    THEKOGANS_UTIL_TRY {
+                        batch[i]->Execute ();
+                    }
+                    THEKOGANS_UTIL_CATCH (util::Exception) {
+                        error = exception.Report ();
+                    }
+                    if (errors != 0) {
+                        errors->push_back (error);
+                    }
+                    else {
+                        CompleteJob (*batch[i], error);
+                    }
+                }
+            }
+        }
+
+        void AsyncEngine::CompleteJob (
+                Job &job,
+                const std::string &error) {
+            job.error = error;
+            stats.Update (job.GetLength ());
+            stats.UpdateLatencySince (job.enqueueTime);
+            if (job.workerNode != NUMATopology::NO_NODE) {
+                util::LockGuard<util::Mutex> guard (mutex);
+                NUMATopology::NodeStats &workerStats = nodeStats[job.workerNode];
+                ++workerStats.jobCount;
+                if ((std::size_t)job.workerNode != job.node) {
+                    ++workerStats.remoteJobCount;
+                }
+                workerStats.byteCount += job.GetLength ();
+            }
+            // Run the callback before waking the waiters so that by
+            // the time Wait returns the callback has finished.
+            if (job.callback.Get () != 0) {
+                job.callback->OnJobCompleted (job);
+            }
+            util::LockGuard<util::Mutex> guard (job.mutex);
+            job.completed = true;
+            job.completedCondition.SignalAll ();
+        }
+
+    } // namespace crypto
+} // namespace thekogans
@@ -15,21 +15,117 @@
 // You should have received a copy of the GNU General Public License
 // along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
 
+#include <map>
 #if defined (TOOLCHAIN_OS_Windows)
     #include <winsock2.h>
 #endif // defined (TOOLCHAIN_OS_Windows)
 #include "thekogans/util/Exception.h"
-#include "thekogans/util/FixedArray.h"
-#include "thekogans/util/File.h"
+#include "thekogans/util/LockGuard.h"
+#include "thekogans/util/OwnerVector.h"
 #include "thekogans/crypto/OpenSSLInit.h"
 #include "thekogans/crypto/Authenticator.h"
 
 namespace thekogans {
     namespace crypto {
 
+        struct Authenticator::SignerLease {
+            Authenticator &authenticator;
+            Signer::SharedPtr signer;
+
+            explicit SignerLease (Authenticator &authenticator_) :
+                    authenticator (authenticator_) {
+                if (authenticator.signer.Get () == 0) {
+                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                        "%s", "Authenticator is setup for verify operation.");
+                }
+                {
+                    util::LockGuard<util::SpinLock> guard (authenticator.spinLock);
+                    authenticator.Lease ();
+                    if (!authenticator.idleSigners.empty ()) {
+                        signer = authenticator.idleSigners.back ();
+                        authenticator.idleSigners.pop_back ();
+                        return;
+                    }
+                }
+                // All busy, create a new one outside the lock.
+                THEKOGANS_UTIL_TRY {
+                    signer = Signer::Get (
+                        authenticator.key,
+                        authenticator.signer->GetMessageDigest ()->Clone ());
+                    signer->ShareStats (authenticator.signer->GetStats ());
+                }
+                THEKOGANS_UTIL_CATCH (util::Exception) {
+                    util::LockGuard<util::SpinLock> guard (authenticator.spinLock);
+                    authenticator.Unlease (false);
+                    THEKOGANS_UTIL_RETHROW_EXCEPTION (exception);
+                }
+            }
+            ~SignerLease () {
+                util::LockGuard<util::SpinLock> guard (authenticator.spinLock);
+                authenticator.idleSigners.push_back (signer);
+                authenticator.Unlease (true);
+            }
+
+            inline Signer *operator -> () const {
+                return signer.Get ();
+            }
+
+            THEKOGANS_CRYPTO_DISALLOW_COPY_AND_ASSIGN (SignerLease)
+        };
+
+        struct Authenticator::VerifierLease {
+            Authenticator &authenticator;
+            Verifier::SharedPtr verifier;
+
+            explicit VerifierLease (Authenticator &authenticator_) :
+                    authenticator (authenticator_) {
+                if (authenticator.verifier.Get () == 0) {
+                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                        "%s", "Authenticator is setup for sign operation.");
+                }
+                {
+                    util::LockGuard<util::SpinLock> guard (authenticator.spinLock);
+                    authenticator.Lease ();
+                    if (!authenticator.idleVerifiers.empty ()) {
+                        verifier = authenticator.idleVerifiers.back ();
+                        authenticator.idleVerifiers.pop_back ();
+                        verifier->SetVerificationCache (authenticator.verificationCache);
+                        return;
+                    }
+                }
+                // All busy, create a new one outside the lock.
+                THEKOGANS_UTIL_TRY {
+                    verifier = Verifier::Get (
+                        authenticator.key,
+                        authenticator.verifier->GetMessageDigest ()->Clone ());
+                    verifier->ShareStats (authenticator.verifier->GetStats ());
+                    util::LockGuard<util::SpinLock> guard (authenticator.spinLock);
+                    verifier->SetVerificationCache (authenticator.verificationCache);
+                }
+                THEKOGANS_UTIL_CATCH (util::Exception) {
+                    util::LockGuard<util::SpinLock> guard (authenticator.spinLock);
+                    authenticator.Unlease (false);
+                    THEKOGANS_UTIL_RETHROW_EXCEPTION (exception);
+                }
+            }
+            ~VerifierLease () {
+                util::LockGuard<util::SpinLock> guard (authenticator.spinLock);
+                authenticator.idleVerifiers.push_back (verifier);
+                authenticator.Unlease (true);
+            }
+
+            inline Verifier *operator -> () const {
+                return verifier.Get ();
+            }
+
+            THEKOGANS_CRYPTO_DISALLOW_COPY_AND_ASSIGN (VerifierLease)
+        };
+
         Authenticator::Authenticator (
-                AsymmetricKey::SharedPtr key,
-                MessageDigest::SharedPtr messageDigest) {
+                AsymmetricKey::SharedPtr key_,
+                MessageDigest::SharedPtr messageDigest) :
+                key (key_),
+                activeLeases (0) {
             if (key.Get () != 0 && messageDigest.Get () != 0) {
                 if (key->IsPrivate ()) {
                     signer = Signer::Get (key, messageDigest);
@@ -39,6 +135,7 @@ namespace thekogans {
                             key->GetKeyType (),
                             messageDigest->GetName ().c_str ());
                     }
+                    idleSigners.push_back (signer);
                 }
                 else {
                     verifier = Verifier::Get (key, messageDigest);
@@ -48,27 +145,51 @@ namespace thekogans {
                             key->GetKeyType (),
                             messageDigest->GetName ().c_str ());
                     }
+                    idleVerifiers.push_back (verifier);
                 }
             }
             else {
                 THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
                     THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
             }
+            poolStats.instances = 1;
+        }
+
+        Authenticator::PoolStats Authenticator::GetPoolStats () const {
+            util::LockGuard<util::SpinLock> guard (spinLock);
+            return poolStats;
+        }
+
+        void Authenticator::Lease () {
+            ++poolStats.leases;
+            if (poolStats.maxConcurrentLeases < ++activeLeases) {
+                poolStats.maxConcurrentLeases = activeLeases;
+            }
+            if (activeLeases > poolStats.instances) {
+                // Reserve a new instance.
+                ++poolStats.misses;
+                ++poolStats.instances;
+            }
+        }
+
+        void Authenticator::Unlease (bool created) {
+            --activeLeases;
+            if (!created) {
+                // Failed to create the reserved instance.
+                --poolStats.instances;
+                --poolStats.misses;
+                --poolStats.leases;
+            }
         }
 
         util::Buffer Authenticator::SignBuffer (
                 const void *buffer,
                 std::size_t bufferLength) {
             if (buffer != 0 && bufferLength > 0) {
-                if (signer.Get () != 0) {
-                    signer->Init ();
-                    signer->Update (buffer, bufferLength);
-                    return signer->Final ();
-                }
-                else {
-                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
-                        "%s", "Authenticator is setup for verify operation.");
-                }
+                SignerLease signer (*this);
+                signer->Init ();
+                signer->Update (buffer, bufferLength);
+                return signer->Final ();
             }
             else {
                 THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
@@ -76,6 +197,18 @@ namespace thekogans {
             }
         }
 
+        void Authenticator::SetVerificationCache (VerificationCache::SharedPtr verificationCache_) {
+            if (verifier.Get () != 0) {
+                // Idle verifiers pick it up when leased.
+                util::LockGuard<util::SpinLock> guard (spinLock);
+                verificationCache = verificationCache_;
+            }
+            else {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "%s", "Authenticator is setup for sign operation.");
+            }
+        }
+
         bool Authenticator::VerifyBufferSignature (
                 const void *buffer,
                 std::size_t bufferLength,
@@ -83,15 +216,9 @@ namespace thekogans {
                 std::size_t signatureLength) {
             if (buffer != 0 && bufferLength > 0 &&
                     signature != 0 && signatureLength > 0) {
-                if (verifier.Get () != 0) {
-                    verifier->Init ();
-                    verifier->Update (buffer, bufferLength);
-                    return verifier->Final (signature, signatureLength);
-                }
-                else {
-                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
-                        "%s", "Authenticator is setup for sign operation.");
-                }
+                VerifierLease verifier (*this);
+                return verifier->VerifyBufferSignature (
+                    buffer, bufferLength, signature, signatureLength);
             }
             else {
                 THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
@@ -99,44 +226,85 @@ namespace thekogans {
             }
         }
 
-        util::Buffer Authenticator::SignFile (const std::string &path) {
-            if (signer.Get () != 0) {
-                signer->Init ();
-                util::ReadOnlyFile file (util::HostEndian, path);
-                util::FixedArray<util::ui8, 4096> buffer;
-                for (std::size_t count = file.Read (buffer, 4096);
-                        count != 0;
-                        count = file.Read (buffer, 4096)) {
-                    signer->Update (buffer, count);
+        bool Authenticator::VerifyBatch (
+                const std::vector<BatchItem> &items,
+                std::vector<bool> *results,
+                std::size_t workerCount,
+                bool stopOnFailure) {
+            std::vector<Verifier::BatchItem> verifierItems;
+            verifierItems.reserve (items.size ());
+            // Lease one verifier per distinct authenticator for the
+            // duration of the batch.
+            typedef std::map<Authenticator *, VerifierLease *> LeaseMap;
+            LeaseMap leaseMap;
+            util::OwnerVector<VerifierLease> leases;
+            for (std::size_t i = 0, count = items.size (); i < count; ++i) {
+                const BatchItem &item = items[i];
+                if (item.authenticator.Get () == 0) {
+                    THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                        THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
                 }
-                return signer->Final ();
+                LeaseMap::const_iterator it = leaseMap.find (item.authenticator.Get ());
+                if (it == leaseMap.end ()) {
+                    leases.push_back (new VerifierLease (*item.authenticator));
+                    it = leaseMap.insert (
+                        LeaseMap::value_type (item.authenticator.Get (), leases.back ())).first;
+                }
+                verifierItems.push_back (
+                    Verifier::BatchItem (
+                        it->second->verifier,
+                        item.buffer,
+                        item.bufferLength,
+                        item.signature,
+                        item.signatureLength));
             }
-            else {
-                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
-                    "%s", "Authenticator is setup for verify operation.");
+            return Verifier::VerifyBatch (verifierItems, results, workerCount, stopOnFailure);
+        }
+
+        util::Buffer Authenticator::SignFile (
+                const std::string &path,
+                bool map,
+                std::size_t readBlockSize) {
+            FileReader file (path, map, readBlockSize);
+            return SignFile (file);
+        }
+
+        util::Buffer Authenticator::SignFile (FileReader &file) {
+            SignerLease signer (*this);
+            signer->Init ();
+            const util::ui8 *chunk;
+            for (std::size_t count = file.Next (chunk);
+                    count != 0;
+                    count = file.Next (chunk)) {
+                signer->Update (chunk, count);
             }
+            return signer->Final ();
         }
 
         bool Authenticator::VerifyFileSignature (
                 const std::string &path,
                 const void *signature,
+                std::size_t signatureLength,
+                bool map,
+                std::size_t readBlockSize) {
+            FileReader file (path, map, readBlockSize);
+            return VerifyFileSignature (file, signature, signatureLength);
+        }
+
+        bool Authenticator::VerifyFileSignature (
+                FileReader &file,
+                const void *signature,
                 std::size_t signatureLength) {
             if (signature != 0 && signatureLength > 0) {
-                if (verifier.Get () != 0) {
-                    verifier->Init ();
-                    util::ReadOnlyFile file (util::HostEndian, path);
-                    util::FixedArray<util::ui8, 4096> buffer;
-                    for (std::size_t count = file.Read (buffer, 4096);
-                            count != 0;
-                            count = file.Read (buffer, 4096)) {
-                        verifier->Update (buffer, count);
-                    }
-                    return verifier->Final (signature, signatureLength);
-                }
-                else {
-                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
-                        "%s", "Authenticator is setup for sign operation.");
+                VerifierLease verifier (*this);
+                verifier->Init ();
+                const util::ui8 *chunk;
+                for (std::size_t count = file.Next (chunk);
+                        count != 0;
+                        count = file.Next (chunk)) {
+                    verifier->Update (chunk, count);
                 }
+                return verifier->Final (signature, signatureLength);
             }
             else {
                 THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
@@ -0,0 +1,237 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#if defined (THEKOGANS_CRYPTO_HAVE_BLAKE2)
+
+#include <cstring>
+#include <blake2.h>
+#include <openssl/evp.h>
+#include "thekogans/util/Exception.h"
+#include "thekogans/crypto/SymmetricKey.h"
+#include "thekogans/crypto/ConstantTime.h"
+#include "thekogans/crypto/Blake2b.h"
+#include "thekogans/crypto/Blake2s.h"
+#include "thekogans/crypto/Blake2MAC.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        struct Blake2MAC::State {
+            /// \brief
+            /// BLAKE2 variants.
+            enum Variant {
+                /// \brief
+                /// BLAKE2b (64 bit words).
+                BLAKE2B,
+                /// \brief
+                /// BLAKE2bp (4-way parallel BLAKE2b).
+                BLAKE2BP,
+                /// \brief
+                /// BLAKE2s (32 bit words).
+                BLAKE2S,
+                /// \brief
+                /// BLAKE2sp (8-way parallel BLAKE2s).
+                BLAKE2SP
+            } variant;
+            /// \brief
+            /// Digest (mac) length.
+            std::size_t length;
+            /// \brief
+            /// Variant state.
+            union {
+                blake2b_state b;
+                blake2bp_state bp;
+                blake2s_state s;
+                blake2sp_state sp;
+            } u;
+
+            State (
+                Variant variant_,
+                std::size_t length_) :
+                variant (variant_),
+                length (length_) {}
+            ~State () {
+                SecureZero (&u, sizeof (u));
+            }
+
+            inline std::size_t GetMaxKeyLength () const {
+                return variant == BLAKE2B || variant == BLAKE2BP ?
+                    (std::size_t)BLAKE2B_KEYBYTES : (std::size_t)BLAKE2S_KEYBYTES;
+            }
+
+            bool InitKey (
+                    const util::ui8 *key,
+                    std::size_t keyLength) {
+                switch (variant) {
+                    case BLAKE2B:
+                        return blake2b_init_key (&u.b, length, key, keyLength) == 0;
+                    case BLAKE2BP:
+                        return blake2bp_init_key (&u.bp, length, key, keyLength) == 0;
+                    case BLAKE2S:
+                        return blake2s_init_key (&u.s, length, key, keyLength) == 0;
+                    case BLAKE2SP:
+                        return blake2sp_init_key (&u.sp, length, key, keyLength) == 0;
+                }
+                return false;
+            }
+
+            // Unkeyed hash (of variant's max key length) used to shorten long keys.
+            bool HashKey (
+                    const util::ui8 *key,
+                    std::size_t keyLength,
+                    util::ui8 *hash) {
+                std::size_t hashLength = GetMaxKeyLength ();
+                switch (variant) {
+                    case BLAKE2B:
+                        return blake2b_init (&u.b, hashLength) == 0 &&
+                            blake2b_update (&u.b, key, keyLength) == 0 &&
+                            blake2b_final (&u.b, hash, hashLength) == 0;
+                    case BLAKE2BP:
+                        return blake2bp_init (&u.bp, hashLength) == 0 &&
+                            blake2bp_update (&u.bp, key, keyLength) == 0 &&
+                            blake2bp_final (&u.bp, hash, hashLength) == 0;
+                    case BLAKE2S:
+                        return blake2s_init (&u.s, hashLength) == 0 &&
+                            blake2s_update (&u.s, key, keyLength) == 0 &&
+                            blake2s_final (&u.s, hash, hashLength) == 0;
+                    case BLAKE2SP:
+                        return blake2sp_init (&u.sp, hashLength) == 0 &&
+                            blake2sp_update (&u.sp, key, keyLength) == 0 &&
+                            blake2sp_final (&u.sp, hash, hashLength) == 0;
+                }
+                return false;
+            }
+
+            bool Update (
+                    const void *buffer,
+                    std::size_t bufferLength) {
+                const util::ui8 *data = (const util::ui8 *)buffer;
+                switch (variant) {
+                    case BLAKE2B:
+                        return blake2b_update (&u.b, data, bufferLength) == 0;
+                    case BLAKE2BP:
+                        return blake2bp_update (&u.bp, data, bufferLength) == 0;
+                    case BLAKE2S:
+                        return blake2s_update (&u.s, data, bufferLength) == 0;
+                    case BLAKE2SP:
+                        return blake2sp_update (&u.sp, data, bufferLength) == 0;
+                }
+                return false;
+            }
+
+            bool Final (util::ui8 *mac) {
+                switch (variant) {
+                    case BLAKE2B:
+                        return blake2b_final (&u.b, mac, length) == 0;
+                    case BLAKE2BP:
+                        return blake2bp_final (&u.bp, mac, length) == 0;
+                    case BLAKE2S:
+                        return blake2s_final (&u.s, mac, length) == 0;
+                    case BLAKE2SP:
+                        return blake2sp_final (&u.sp, mac, length) == 0;
+                }
+                return false;
+            }
+
+            THEKOGANS_CRYPTO_DISALLOW_COPY_AND_ASSIGN (State)
+        };
+
+        Blake2MAC::Blake2MAC (
+                SymmetricKey::SharedPtr key_,
+                const EVP_MD *md_) :
+                key (key_),
+                md (md_) {
+            if (key.Get () != 0 && key->GetKeyLength () > 0 && IsBlake2 (md)) {
+                metrics.Reset (key->GetId ());
+                State::Variant variant =
+                    md == EVP_blake2bp512 () ? State::BLAKE2BP :
+                    md == EVP_blake2s256 () ? State::BLAKE2S :
+                    md == EVP_blake2sp256 () ? State::BLAKE2SP : State::BLAKE2B;
+                keyedState.reset (new State (variant, GetMDLength (md)));
+                state.reset (new State (variant, GetMDLength (md)));
+                const util::ui8 *keyData = key->Get ().GetReadPtr ();
+                std::size_t keyLength = key->Get ().GetDataAvailableForReading ();
+                util::ui8 keyHash[BLAKE2B_KEYBYTES];
+                bool success = true;
+                if (keyLength > keyedState->GetMaxKeyLength ()) {
+                    success = keyedState->HashKey (keyData, keyLength, keyHash);
+                    keyData = keyHash;
+                    keyLength = keyedState->GetMaxKeyLength ();
+                }
+                success = success && keyedState->InitKey (keyData, keyLength);
+                SecureZero (keyHash, BLAKE2B_KEYBYTES);
+                if (!success) {
+                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION ("%s", "Unable to key BLAKE2.");
+                }
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        Blake2MAC::~Blake2MAC () {
+        }
+
+        bool Blake2MAC::IsBlake2 (const EVP_MD *md) {
+            return md != 0 &&
+                (md == EVP_blake2b512 () ||
+                    md == EVP_blake2b384 () ||
+                    md == EVP_blake2b256 () ||
+                    md == EVP_blake2bp512 () ||
+                    md == EVP_blake2s256 () ||
+                    md == EVP_blake2sp256 ());
+        }
+
+        void Blake2MAC::Init () {
+            // The key block is already absorbed in to keyedState.
+            state->u = keyedState->u;
+        }
+
+        void Blake2MAC::Update (
+                const void *buffer,
+                std::size_t bufferLength) {
+            if (buffer != 0 && bufferLength > 0) {
+                if (!state->Update (buffer, bufferLength)) {
+                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION ("%s", "BLAKE2 update failed.");
+                }
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        std::size_t Blake2MAC::Final (util::ui8 *signature) {
+            if (signature != 0) {
+                if (state->Final (signature)) {
+                    return state->length;
+                }
+                else {
+                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION ("%s", "BLAKE2 final failed.");
+                }
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+    } // namespace crypto
+} // namespace thekogans
+
+#endif // defined (THEKOGANS_CRYPTO_HAVE_BLAKE2)
@@ -39,6 +39,12 @@ namespace thekogans {
             "1.3.6.1.4.1.1722.12.2.1.32",
             "BLAKE2 Cryptographic Hash and MAC (256 bit)",
             "blake2b256");
+        // NOTE: BLAKE2bp has no registered OID. This one extends the
+        // BLAKE2 arc above and is only meaningful to this library.
+        _LIB_THEKOGANS_CRYPTO_DECL const util::i32 NID_blake2bp512 = OBJ_create (
+            "1.3.6.1.4.1.1722.12.2.3.64",
+            "BLAKE2bp 4-way parallel Cryptographic Hash (512 bit)",
+            "blake2bp512");
 
         namespace {
         #if OPENSSL_VERSION_NUMBER < 0x10100000L
@@ -83,6 +89,34 @@ namespace thekogans {
                     md,
                     EVP_MD_CTX_size (ctx)) == 0 ? 1 : 0;
             }
+
+            // BLAKE2bp hashes 4 interleaved BLAKE2b lanes which the
+            // blake2 toolchain's SSE/AVX2/NEON builds compute in SIMD
+            // registers, and combines them in to a root node.
+            int bp_init (EVP_MD_CTX *ctx) {
+                return blake2bp_init (
+                    (blake2bp_state *)EVP_MD_CTX_md_data (ctx),
+                    EVP_MD_CTX_size (ctx)) == 0 ? 1 : 0;
+            }
+
+            int bp_update (
+                    EVP_MD_CTX *ctx,
+                    const void *data,
+                    size_t count) {
+                return blake2bp_update (
+                    (blake2bp_state *)EVP_MD_CTX_md_data (ctx),
+                    data,
+                    count) == 0 ? 1 : 0;
+            }
+
+            int bp_final (
+                    EVP_MD_CTX *ctx,
+                    unsigned char *md) {
+                return blake2bp_final (
+                    (blake2bp_state *)EVP_MD_CTX_md_data (ctx),
+                    md,
+                    EVP_MD_CTX_size (ctx)) == 0 ? 1 : 0;
+            }
         }
 
         _LIB_THEKOGANS_CRYPTO_DECL const EVP_MD * _LIB_THEKOGANS_CRYPTO_API EVP_blake2b512 () {
@@ -148,6 +182,27 @@ namespace thekogans {
             return &blake2b256;
         }
 
+        _LIB_THEKOGANS_CRYPTO_DECL const EVP_MD * _LIB_THEKOGANS_CRYPTO_API EVP_blake2bp512 () {
+            static const EVP_MD blake2bp512 = {
+                NID_blake2bp512,
+                NID_undef,
+                64,
+                0,
+                bp_init,
+                bp_update,
+                bp_final,
+                0,
+                0,
+                0,
+                0,
+                {NID_undef, NID_undef, 0, 0, 0},
+                BLAKE2B_BLOCKBYTES,
+                sizeof (blake2bp_state),
+                0
+            };
+            return &blake2bp512;
+        }
+
     } // namespace crypto
 } // namespace thekogans
 
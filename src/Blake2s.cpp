@@ -31,6 +31,12 @@ namespace thekogans {
             "1.3.6.1.4.1.1722.12.2.2.32",
             "BLAKE2 Cryptographic Hash and MAC (256 bit)",
             "blake2s256");
+        // NOTE: BLAKE2sp has no registered OID. This one extends the
+        // BLAKE2 arc above and is only meaningful to this library.
+        _LIB_THEKOGANS_CRYPTO_DECL const util::i32 NID_blake2sp256 = OBJ_create (
+            "1.3.6.1.4.1.1722.12.2.4.32",
+            "BLAKE2sp 8-way parallel Cryptographic Hash (256 bit)",
+            "blake2sp256");
 
         namespace {
         #if OPENSSL_VERSION_NUMBER < 0x10100000L
@@ -74,6 +80,34 @@ namespace thekogans {
                     md,
                     EVP_MD_CTX_size (ctx)) == 0 ? 1 : 0;
             }
+
+            // BLAKE2sp hashes 8 interleaved BLAKE2s lanes which the
+            // blake2 toolchain's SSE/AVX2/NEON builds compute in SIMD
+            // registers, and combines them in to a root node.
+            int sp_init (EVP_MD_CTX *ctx) {
+                return blake2sp_init (
+                    (blake2sp_state *)EVP_MD_CTX_md_data (ctx),
+                    EVP_MD_CTX_size (ctx)) == 0 ? 1 : 0;
+            }
+
+            int sp_update (
+                    EVP_MD_CTX *ctx,
+                    const void *data,
+                    size_t count) {
+                return blake2sp_update (
+                    (blake2sp_state *)EVP_MD_CTX_md_data (ctx),
+                    data,
+                    count) == 0 ? 1 : 0;
+            }
+
+            int sp_final (
+                    EVP_MD_CTX *ctx,
+                    unsigned char *md) {
+                return blake2sp_final (
+                    (blake2sp_state *)EVP_MD_CTX_md_data (ctx),
+                    md,
+                    EVP_MD_CTX_size (ctx)) == 0 ? 1 : 0;
+            }
         }
 
         _LIB_THEKOGANS_CRYPTO_DECL const EVP_MD * _LIB_THEKOGANS_CRYPTO_API EVP_blake2s256 () {
@@ -97,6 +131,27 @@ namespace thekogans {
             return &blake2s256;
         }
 
+        _LIB_THEKOGANS_CRYPTO_DECL const EVP_MD * _LIB_THEKOGANS_CRYPTO_API EVP_blake2sp256 () {
+            static const EVP_MD blake2sp256 = {
+                NID_blake2sp256,
+                NID_undef,
+                32,
+                0,
+                sp_init,
+                sp_update,
+                sp_final,
+                0,
+                0,
+                0,
+                0,
+                {NID_undef, NID_undef, 0, 0, 0},
+                BLAKE2S_BLOCKBYTES,
+                sizeof (blake2sp_state),
+                0
+            };
+            return &blake2sp256;
+        }
+
     } // namespace crypto
 } // namespace thekogans
 
@@ -0,0 +1,914 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#include <cstring>
+#include <new>
+#include <vector>
+#include <openssl/evp.h>
+#include <openssl/objects.h>
+#include "thekogans/util/Exception.h"
+#include "thekogans/util/Thread.h"
+#include "thekogans/util/SystemInfo.h"
+#include "thekogans/util/OwnerVector.h"
+#include "thekogans/crypto/CPUFeatures.h"
+#include "thekogans/crypto/Blake3Kernel.h"
+#if defined (THEKOGANS_CRYPTO_BLAKE3_NEON)
+    #include <arm_neon.h>
+#endif // defined (THEKOGANS_CRYPTO_BLAKE3_NEON)
+#include "thekogans/crypto/Blake3.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        // NOTE: BLAKE3 has no registered OID. This one extends the
+        // BLAKE2 arc (see Blake2b.cpp) and is only meaningful to this
+        // library.
+        _LIB_THEKOGANS_CRYPTO_DECL const util::i32 NID_blake3_256 = OBJ_create (
+            "1.3.6.1.4.1.1722.12.2.5.32",
+            "BLAKE3 Cryptographic Hash, MAC and KDF (256 bit)",
+            "blake3-256");
+
+        const util::ui32 Blake3Constants::IV[8] = {
+            0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+            0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+        };
+
+        const util::ui8 Blake3Constants::SCHEDULE[ROUNDS][16] = {
+            {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+            {2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8},
+            {3, 4, 10, 12, 13, 2, 7, 14, 6, 5, 9, 0, 11, 15, 8, 1},
+            {10, 7, 12, 9, 14, 3, 13, 15, 4, 0, 11, 2, 5, 8, 1, 6},
+            {12, 13, 9, 11, 15, 10, 14, 8, 7, 2, 5, 3, 0, 1, 6, 4},
+            {9, 14, 11, 5, 8, 12, 15, 1, 13, 3, 0, 10, 2, 6, 4, 7},
+            {11, 15, 5, 0, 1, 9, 8, 6, 14, 10, 2, 12, 3, 4, 7, 13}
+        };
+
+        namespace {
+        #if OPENSSL_VERSION_NUMBER < 0x10100000L
+            void *EVP_MD_CTX_md_data (const EVP_MD_CTX *ctx) {
+                return ctx->md_data;
+            }
+        #endif // OPENSSL_VERSION_NUMBER < 0x10100000L
+
+            inline util::ui32 LoadLittleEndian (const util::ui8 *bytes) {
+                return
+                    (util::ui32)bytes[0] |
+                    ((util::ui32)bytes[1] << 8) |
+                    ((util::ui32)bytes[2] << 16) |
+                    ((util::ui32)bytes[3] << 24);
+            }
+
+            inline void StoreLittleEndian (
+                    util::ui8 *bytes,
+                    util::ui32 word) {
+                bytes[0] = (util::ui8)word;
+                bytes[1] = (util::ui8)(word >> 8);
+                bytes[2] = (util::ui8)(word >> 16);
+                bytes[3] = (util::ui8)(word >> 24);
+            }
+
+            struct PortableLanes {
+                typedef util::ui32 Vector;
+                enum {
+                    COUNT = 1
+                };
+
+                static inline Vector Load (const util::ui32 *words) {
+                    return *words;
+                }
+                static inline void Store (
+                        util::ui32 *words,
+                        Vector v) {
+                    *words = v;
+                }
+                static inline Vector Set1 (util::ui32 word) {
+                    return word;
+                }
+                static inline Vector Add (
+                        Vector a,
+                        Vector b) {
+                    return a + b;
+                }
+                static inline Vector Xor (
+                        Vector a,
+                        Vector b) {
+                    return a ^ b;
+                }
+                static inline Vector Rotr16 (Vector v) {
+                    return (v >> 16) | (v << 16);
+                }
+                static inline Vector Rotr12 (Vector v) {
+                    return (v >> 12) | (v << 20);
+                }
+                static inline Vector Rotr8 (Vector v) {
+                    return (v >> 8) | (v << 24);
+                }
+                static inline Vector Rotr7 (Vector v) {
+                    return (v >> 7) | (v << 25);
+                }
+                static inline void LoadMessage (
+                        const util::ui8 * const *lanes,
+                        std::size_t offset,
+                        Vector m[16]) {
+                    for (std::size_t i = 0; i < 16; ++i) {
+                        m[i] = LoadLittleEndian (lanes[0] + offset + i * 4);
+                    }
+                }
+            };
+
+        #if defined (THEKOGANS_CRYPTO_BLAKE3_NEON)
+            struct NEONLanes {
+                typedef uint32x4_t Vector;
+                enum {
+                    COUNT = 4
+                };
+
+                static inline Vector Load (const util::ui32 *words) {
+                    return vld1q_u32 (words);
+                }
+                static inline void Store (
+                        util::ui32 *words,
+                        Vector v) {
+                    vst1q_u32 (words, v);
+                }
+                static inline Vector Set1 (util::ui32 word) {
+                    return vdupq_n_u32 (word);
+                }
+                static inline Vector Add (
+                        Vector a,
+                        Vector b) {
+                    return vaddq_u32 (a, b);
+                }
+                static inline Vector Xor (
+                        Vector a,
+                        Vector b) {
+                    return veorq_u32 (a, b);
+                }
+                static inline Vector Rotr16 (Vector v) {
+                    return vreinterpretq_u32_u16 (vrev32q_u16 (vreinterpretq_u16_u32 (v)));
+                }
+                static inline Vector Rotr12 (Vector v) {
+                    return vsriq_n_u32 (vshlq_n_u32 (v, 20), v, 12);
+                }
+                static inline Vector Rotr8 (Vector v) {
+                    return vsriq_n_u32 (vshlq_n_u32 (v, 24), v, 8);
+                }
+                static inline Vector Rotr7 (Vector v) {
+                    return vsriq_n_u32 (vshlq_n_u32 (v, 25), v, 7);
+                }
+                static inline void LoadMessage (
+                        const util::ui8 * const *lanes,
+                        std::size_t offset,
+                        Vector m[16]) {
+                    alignas (16) util::ui32 words[16][COUNT];
+                    for (std::size_t lane = 0; lane < COUNT; ++lane) {
+                        for (std::size_t i = 0; i < 16; ++i) {
+                            words[i][lane] = LoadLittleEndian (lanes[lane] + offset + i * 4);
+                        }
+                    }
+                    for (std::size_t i = 0; i < 16; ++i) {
+                        m[i] = vld1q_u32 (words[i]);
+                    }
+                }
+            };
+        #endif // defined (THEKOGANS_CRYPTO_BLAKE3_NEON)
+
+            inline util::ui32 Rotr (
+                    util::ui32 word,
+                    util::ui32 count) {
+                return (word >> count) | (word << (32 - count));
+            }
+
+            inline void G (
+                    util::ui32 *v,
+                    std::size_t a,
+                    std::size_t b,
+                    std::size_t c,
+                    std::size_t d,
+                    util::ui32 x,
+                    util::ui32 y) {
+                v[a] = v[a] + v[b] + x;
+                v[d] = Rotr (v[d] ^ v[a], 16);
+                v[c] = v[c] + v[d];
+                v[b] = Rotr (v[b] ^ v[c], 12);
+                v[a] = v[a] + v[b] + y;
+                v[d] = Rotr (v[d] ^ v[a], 8);
+                v[c] = v[c] + v[d];
+                v[b] = Rotr (v[b] ^ v[c], 7);
+            }
+
+            // Compress a single (possibly partial) block. The first
+            // eight words of state are the new chaining value, all
+            // sixteen are root (XOF) output.
+            void Compress (
+                    const util::ui32 cv[8],
+                    const util::ui8 block[Blake3::BLOCK_LENGTH],
+                    util::ui32 blockLength,
+                    util::ui64 counter,
+                    util::ui32 flags,
+                    util::ui32 state[16]) {
+                util::ui32 m[16];
+                for (std::size_t i = 0; i < 16; ++i) {
+                    m[i] = LoadLittleEndian (block + i * 4);
+                }
+                util::ui32 *v = state;
+                for (std::size_t i = 0; i < 8; ++i) {
+                    v[i] = cv[i];
+                }
+                v[8] = Blake3Constants::IV[0];
+                v[9] = Blake3Constants::IV[1];
+                v[10] = Blake3Constants::IV[2];
+                v[11] = Blake3Constants::IV[3];
+                v[12] = (util::ui32)counter;
+                v[13] = (util::ui32)(counter >> 32);
+                v[14] = blockLength;
+                v[15] = flags;
+                for (std::size_t round = 0; round < Blake3Constants::ROUNDS; ++round) {
+                    const util::ui8 *s = Blake3Constants::SCHEDULE[round];
+                    G (v, 0, 4, 8, 12, m[s[0]], m[s[1]]);
+                    G (v, 1, 5, 9, 13, m[s[2]], m[s[3]]);
+                    G (v, 2, 6, 10, 14, m[s[4]], m[s[5]]);
+                    G (v, 3, 7, 11, 15, m[s[6]], m[s[7]]);
+                    G (v, 0, 5, 10, 15, m[s[8]], m[s[9]]);
+                    G (v, 1, 6, 11, 12, m[s[10]], m[s[11]]);
+                    G (v, 2, 7, 8, 13, m[s[12]], m[s[13]]);
+                    G (v, 3, 4, 9, 14, m[s[14]], m[s[15]]);
+                }
+                for (std::size_t i = 0; i < 8; ++i) {
+                    v[i] ^= v[i + 8];
+                    v[i + 8] ^= cv[i];
+                }
+            }
+
+            // The last node (chunk or parent) of a tree, before it
+            // is known whether it's the root.
+            struct Output {
+                util::ui32 cv[8];
+                util::ui8 block[Blake3::BLOCK_LENGTH];
+                util::ui32 blockLength;
+                util::ui64 counter;
+                util::ui32 flags;
+
+                void GetChainingValue (util::ui8 chainingValue[Blake3::OUT_LENGTH]) const {
+                    util::ui32 state[16];
+                    Compress (cv, block, blockLength, counter, flags, state);
+                    for (std::size_t i = 0; i < 8; ++i) {
+                        StoreLittleEndian (chainingValue + i * 4, state[i]);
+                    }
+                }
+
+                void GetRootBytes (
+                        util::ui8 *out,
+                        std::size_t outLength) const {
+                    for (util::ui64 outputCounter = 0; outLength > 0; ++outputCounter) {
+                        util::ui32 state[16];
+                        Compress (cv, block, blockLength, outputCounter,
+                            flags | Blake3Constants::ROOT, state);
+                        for (std::size_t i = 0; i < 16 && outLength > 0; ++i) {
+                            util::ui8 word[4];
+                            StoreLittleEndian (word, state[i]);
+                            std::size_t count = outLength < 4 ? outLength : 4;
+                            memcpy (out, word, count);
+                            out += count;
+                            outLength -= count;
+                        }
+                    }
+                }
+            };
+
+            void MakeParentOutput (
+                    const util::ui8 *left,
+                    const util::ui8 *right,
+                    const util::ui32 key[8],
+                    util::ui32 flags,
+                    Output &output) {
+                memcpy (output.cv, key, sizeof (output.cv));
+                memcpy (output.block, left, Blake3::OUT_LENGTH);
+                memcpy (output.block + Blake3::OUT_LENGTH, right, Blake3::OUT_LENGTH);
+                output.blockLength = Blake3::BLOCK_LENGTH;
+                output.counter = 0;
+                output.flags = flags | Blake3Constants::PARENT;
+            }
+
+            void HashMany (
+                    Blake3::Kernel kernel,
+                    const util::ui8 * const *inputs,
+                    std::size_t count,
+                    std::size_t blockCount,
+                    const util::ui32 *key,
+                    util::ui64 counter,
+                    bool incrementCounter,
+                    util::ui32 flags,
+                    util::ui32 flagsStart,
+                    util::ui32 flagsEnd,
+                    util::ui8 *out) {
+                // There's nothing to gain from idle lanes.
+                if (count == 1) {
+                    kernel = Blake3::KERNEL_PORTABLE;
+                }
+                switch (kernel) {
+                #if defined (THEKOGANS_CRYPTO_BLAKE3_X86)
+                    case Blake3::KERNEL_AVX512:
+                        Blake3HashManyAVX512 (inputs, count, blockCount, key, counter,
+                            incrementCounter, flags, flagsStart, flagsEnd, out);
+                        break;
+                    case Blake3::KERNEL_AVX2:
+                        Blake3HashManyAVX2 (inputs, count, blockCount, key, counter,
+                            incrementCounter, flags, flagsStart, flagsEnd, out);
+                        break;
+                    case Blake3::KERNEL_SSE41:
+                        Blake3HashManySSE41 (inputs, count, blockCount, key, counter,
+                            incrementCounter, flags, flagsStart, flagsEnd, out);
+                        break;
+                #endif // defined (THEKOGANS_CRYPTO_BLAKE3_X86)
+                #if defined (THEKOGANS_CRYPTO_BLAKE3_NEON)
+                    case Blake3::KERNEL_NEON:
+                        Blake3Kernel<NEONLanes>::HashMany (inputs, count, blockCount, key, counter,
+                            incrementCounter, flags, flagsStart, flagsEnd, out);
+                        break;
+                #endif // defined (THEKOGANS_CRYPTO_BLAKE3_NEON)
+                    default:
+                        Blake3Kernel<PortableLanes>::HashMany (inputs, count, blockCount, key, counter,
+                            incrementCounter, flags, flagsStart, flagsEnd, out);
+                        break;
+                }
+            }
+
+            // Hashes complete power of 2 sized subtrees.
+            struct SubtreeHasher {
+                enum {
+                    // Chunks compressed per HashMany call (2 KB of chaining values).
+                    BATCH_CHUNKS = 64
+                };
+
+                Blake3::Kernel kernel;
+                const util::ui32 *key;
+                util::ui32 flags;
+
+                SubtreeHasher (
+                    Blake3::Kernel kernel_,
+                    const util::ui32 *key_,
+                    util::ui32 flags_) :
+                    kernel (kernel_),
+                    key (key_),
+                    flags (flags_) {}
+
+                // Reduce count (power of 2) chaining values, in place,
+                // until only targetCount are left.
+                void ReduceParents (
+                        util::ui8 *cvs,
+                        std::size_t count,
+                        std::size_t targetCount) const {
+                    const util::ui8 *parents[BATCH_CHUNKS / 2];
+                    while (count > targetCount) {
+                        std::size_t parentCount = count / 2;
+                        // Every batch only overwrites chaining values
+                        // the batches before it have already consumed.
+                        for (std::size_t first = 0; first < parentCount; first += BATCH_CHUNKS / 2) {
+                            std::size_t batchCount = parentCount - first < BATCH_CHUNKS / 2 ?
+                                parentCount - first : (std::size_t)BATCH_CHUNKS / 2;
+                            for (std::size_t i = 0; i < batchCount; ++i) {
+                                parents[i] = cvs + (first + i) * 2 * Blake3::OUT_LENGTH;
+                            }
+                            HashMany (kernel, parents, batchCount, 1, key, 0, false,
+                                flags | Blake3Constants::PARENT, 0, 0,
+                                cvs + first * Blake3::OUT_LENGTH);
+                        }
+                        count = parentCount;
+                    }
+                }
+
+                // Chaining value of a chunkCount (power of 2) chunk subtree.
+                void HashSubtree (
+                        const util::ui8 *input,
+                        std::size_t chunkCount,
+                        util::ui64 chunkCounter,
+                        util::ui8 cv[Blake3::OUT_LENGTH]) const {
+                    if (chunkCount <= BATCH_CHUNKS) {
+                        const util::ui8 *chunks[BATCH_CHUNKS];
+                        for (std::size_t i = 0; i < chunkCount; ++i) {
+                            chunks[i] = input + i * Blake3::CHUNK_LENGTH;
+                        }
+                        util::ui8 cvs[BATCH_CHUNKS * Blake3::OUT_LENGTH];
+                        HashMany (kernel, chunks, chunkCount,
+                            Blake3::CHUNK_LENGTH / Blake3::BLOCK_LENGTH, key, chunkCounter, true,
+                            flags, Blake3Constants::CHUNK_START, Blake3Constants::CHUNK_END, cvs);
+                        ReduceParents (cvs, chunkCount, 1);
+                        memcpy (cv, cvs, Blake3::OUT_LENGTH);
+                    }
+                    else {
+                        std::size_t halfCount = chunkCount / 2;
+                        util::ui8 children[2 * Blake3::OUT_LENGTH];
+                        HashSubtree (input, halfCount, chunkCounter, children);
+                        HashSubtree (input + halfCount * Blake3::CHUNK_LENGTH,
+                            halfCount, chunkCounter + halfCount, children + Blake3::OUT_LENGTH);
+                        ReduceParents (children, 2, 1);
+                        memcpy (cv, children, Blake3::OUT_LENGTH);
+                    }
+                }
+            };
+
+            struct SubtreeWorker : public util::Thread {
+            private:
+                const SubtreeHasher &hasher;
+                const util::ui8 *input;
+                std::size_t chunkCount;
+                util::ui64 chunkCounter;
+                util::ui8 *cv;
+
+            public:
+                SubtreeWorker (
+                    const SubtreeHasher &hasher_,
+                    const util::ui8 *input_,
+                    std::size_t chunkCount_,
+                    util::ui64 chunkCounter_,
+                    util::ui8 *cv_) :
+                    hasher (hasher_),
+                    input (input_),
+                    chunkCount (chunkCount_),
+                    chunkCounter (chunkCounter_),
+                    cv (cv_) {}
+
+            protected:
+                // util::Thread
+                virtual void Run () throw () override {
+                    hasher.HashSubtree (input, chunkCount, chunkCounter, cv);
+                }
+            };
+
+            void WaitForWorkers (util::OwnerVector<SubtreeWorker> &workers) {
+                for (std::size_t i = 0, count = workers.size (); i < count; ++i) {
+                    workers[i]->Wait ();
+                }
+            }
+
+            // Compute the two child chaining values of a chunkCount (power
+            // of 2, > 1) chunk subtree. Large subtrees are split in to
+            // (power of 2) pieces hashed in parallel, whose chaining values
+            // are then reduced to the two children. Each piece is itself a
+            // complete subtree, so the result is the same as hashing serially.
+            void HashSubtreeChildren (
+                    const SubtreeHasher &hasher,
+                    std::size_t workerCount,
+                    const util::ui8 *input,
+                    std::size_t chunkCount,
+                    util::ui64 chunkCounter,
+                    util::ui8 children[2 * Blake3::OUT_LENGTH]) {
+                enum {
+                    MIN_PIECE_CHUNKS = Blake3::MIN_PARALLEL_LENGTH / Blake3::CHUNK_LENGTH
+                };
+                std::size_t pieceCount = 1;
+                while (pieceCount * 2 <= workerCount &&
+                        chunkCount / (pieceCount * 2) >= MIN_PIECE_CHUNKS) {
+                    pieceCount *= 2;
+                }
+                if (pieceCount < 2) {
+                    std::size_t halfCount = chunkCount / 2;
+                    hasher.HashSubtree (input, halfCount, chunkCounter, children);
+                    hasher.HashSubtree (input + halfCount * Blake3::CHUNK_LENGTH,
+                        halfCount, chunkCounter + halfCount, children + Blake3::OUT_LENGTH);
+                }
+                else {
+                    std::size_t pieceChunks = chunkCount / pieceCount;
+                    std::vector<util::ui8> cvs (pieceCount * Blake3::OUT_LENGTH);
+                    util::OwnerVector<SubtreeWorker> workers;
+                    workers.reserve (pieceCount - 1);
+                    THEKOGANS_UTIL_TRY {
+                        // The calling thread hashes the first piece.
+                        for (std::size_t i = 1; i < pieceCount; ++i) {
+                            workers.push_back (
+                                new SubtreeWorker (
+                                    hasher,
+                                    input + i * pieceChunks * Blake3::CHUNK_LENGTH,
+                                    pieceChunks,
+                                    chunkCounter + i * pieceChunks,
+                                    &cvs[i * Blake3::OUT_LENGTH]));
+                            workers.back ()->Create ();
+                        }
+                        hasher.HashSubtree (input, pieceChunks, chunkCounter, &cvs[0]);
+                        WaitForWorkers (workers);
+                    }
+                    THEKOGANS_UTIL_CATCH (util::Exception) {
+                        WaitForWorkers (workers);
+                        THEKOGANS_UTIL_RETHROW_EXCEPTION (exception);
+                    }
+                    hasher.ReduceParents (&cvs[0], pieceCount, 2);
+                    memcpy (children, &cvs[0], 2 * Blake3::OUT_LENGTH);
+                }
+            }
+
+            inline util::ui32 PopCount (util::ui64 value) {
+                util::ui32 count = 0;
+                for (; value != 0; value &= value - 1) {
+                    ++count;
+                }
+                return count;
+            }
+
+            inline util::ui64 RoundDownToPowerOf2 (util::ui64 value) {
+                util::ui64 power = 1;
+                while (power <= value / 2) {
+                    power *= 2;
+                }
+                return power;
+            }
+
+            int init (EVP_MD_CTX *ctx) {
+                // Large updates (mapped files, read ahead blocks) are
+                // hashed on all cpus. Use Blake3::FromEVP_MD_CTX to
+                // change that after initializing the context.
+                new (EVP_MD_CTX_md_data (ctx)) Blake3 (0);
+                return 1;
+            }
+
+            int update (
+                    EVP_MD_CTX *ctx,
+                    const void *data,
+                    size_t count) {
+                ((Blake3 *)EVP_MD_CTX_md_data (ctx))->Update (data, count);
+                return 1;
+            }
+
+            int final (
+                    EVP_MD_CTX *ctx,
+                    unsigned char *md) {
+                ((Blake3 *)EVP_MD_CTX_md_data (ctx))->Final (md, Blake3::OUT_LENGTH);
+                return 1;
+            }
+        }
+
+        _LIB_THEKOGANS_CRYPTO_DECL const EVP_MD * _LIB_THEKOGANS_CRYPTO_API EVP_blake3_256 () {
+            static const EVP_MD blake3_256 = {
+                NID_blake3_256,
+                NID_undef,
+                Blake3::OUT_LENGTH,
+                0,
+                init,
+                update,
+                final,
+                0,
+                0,
+                0,
+                0,
+                {NID_undef, NID_undef, 0, 0, 0},
+                Blake3::BLOCK_LENGTH,
+                sizeof (Blake3),
+                0
+            };
+            return &blake3_256;
+        }
+
+        Blake3::Blake3 (
+                std::size_t workerCount_,
+                Kernel kernel_) :
+                flags (0),
+                workerCount ((util::ui32)workerCount_),
+                kernel (kernel_) {
+            if (kernel != KERNEL_AUTO && !IsKernelSupported (kernel)) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "The %s kernel is not supported on this cpu.",
+                    KernelToString (kernel));
+            }
+            Init ();
+        }
+
+        void Blake3::Init () {
+            memcpy (key, Blake3Constants::IV, sizeof (key));
+            flags = 0;
+            Reset ();
+        }
+
+        void Blake3::InitKeyed (
+                const void *key_,
+                std::size_t keyLength) {
+            if (key_ != 0 && keyLength == KEY_LENGTH) {
+                for (std::size_t i = 0; i < 8; ++i) {
+                    key[i] = LoadLittleEndian ((const util::ui8 *)key_ + i * 4);
+                }
+                flags = Blake3Constants::KEYED_HASH;
+                Reset ();
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        void Blake3::InitDeriveKey (
+                const void *context,
+                std::size_t contextLength) {
+            if (context != 0 && contextLength > 0) {
+                Blake3 contextHasher (1, kernel);
+                contextHasher.flags = Blake3Constants::DERIVE_KEY_CONTEXT;
+                contextHasher.Update (context, contextLength);
+                util::ui8 contextKey[KEY_LENGTH];
+                contextHasher.Final (contextKey, KEY_LENGTH);
+                for (std::size_t i = 0; i < 8; ++i) {
+                    key[i] = LoadLittleEndian (contextKey + i * 4);
+                }
+                memset (contextKey, 0, KEY_LENGTH);
+                flags = Blake3Constants::DERIVE_KEY_MATERIAL;
+                Reset ();
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        void Blake3::Update (
+                const void *buffer,
+                std::size_t length) {
+            if (buffer == 0 && length > 0) {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+            const util::ui8 *input = (const util::ui8 *)buffer;
+            Kernel bestKernel = kernel == KERNEL_AUTO ? GetBestKernel () : kernel;
+            while (length > 0) {
+                // Finish the current chunk. If more input follows,
+                // it's not the root, and can be pushed on the stack.
+                std::size_t chunkLength = blocksCompressed * BLOCK_LENGTH + blockLength;
+                if (chunkLength == CHUNK_LENGTH) {
+                    Output output;
+                    memcpy (output.cv, chunkCV, sizeof (output.cv));
+                    memcpy (output.block, block, BLOCK_LENGTH);
+                    output.blockLength = blockLength;
+                    output.counter = chunkCounter;
+                    output.flags = flags | Blake3Constants::CHUNK_END;
+                    util::ui8 cv[OUT_LENGTH];
+                    output.GetChainingValue (cv);
+                    PushCV (cv, chunkCounter);
+                    ++chunkCounter;
+                    memcpy (chunkCV, key, sizeof (chunkCV));
+                    memset (block, 0, BLOCK_LENGTH);
+                    blockLength = 0;
+                    blocksCompressed = 0;
+                    chunkLength = 0;
+                }
+                if (chunkLength == 0 && length > CHUNK_LENGTH) {
+                    // Whole subtrees can go straight to the kernel. The
+                    // largest one that fits and is aligned with what came
+                    // before is pushed as two children, so the root is
+                    // never compressed as a parent prematurely.
+                    util::ui64 subtreeLength = RoundDownToPowerOf2 (length);
+                    while (((subtreeLength - 1) & (chunkCounter * CHUNK_LENGTH)) != 0) {
+                        subtreeLength /= 2;
+                    }
+                    util::ui64 subtreeChunks = subtreeLength / CHUNK_LENGTH;
+                    SubtreeHasher hasher (bestKernel, key, flags);
+                    if (subtreeChunks == 1) {
+                        util::ui8 cv[OUT_LENGTH];
+                        hasher.HashSubtree (input, 1, chunkCounter, cv);
+                        PushCV (cv, chunkCounter);
+                    }
+                    else {
+                        util::ui8 children[2 * OUT_LENGTH];
+                        HashSubtreeChildren (
+                            hasher,
+                            workerCount > 0 ? workerCount :
+                                util::SystemInfo::Instance ().GetCPUCount (),
+                            input,
+                            (std::size_t)subtreeChunks,
+                            chunkCounter,
+                            children);
+                        PushCV (children, chunkCounter);
+                        PushCV (children + OUT_LENGTH, chunkCounter + subtreeChunks / 2);
+                    }
+                    chunkCounter += subtreeChunks;
+                    input += subtreeLength;
+                    length -= (std::size_t)subtreeLength;
+                    continue;
+                }
+                // Buffer the input a block at a time. The last block of
+                // a chunk stays buffered, it needs the CHUNK_END flag.
+                while (length > 0 && chunkLength < CHUNK_LENGTH) {
+                    if (blockLength == BLOCK_LENGTH) {
+                        util::ui32 state[16];
+                        Compress (chunkCV, block, BLOCK_LENGTH, chunkCounter,
+                            flags | (blocksCompressed == 0 ? Blake3Constants::CHUNK_START : 0),
+                            state);
+                        memcpy (chunkCV, state, sizeof (chunkCV));
+                        ++blocksCompressed;
+                        // A partial last block is zero padded.
+                        memset (block, 0, BLOCK_LENGTH);
+                        blockLength = 0;
+                    }
+                    std::size_t count = BLOCK_LENGTH - blockLength;
+                    if (count > length) {
+                        count = length;
+                    }
+                    memcpy (block + blockLength, input, count);
+                    blockLength += (util::ui32)count;
+                    chunkLength += count;
+                    input += count;
+                    length -= count;
+                }
+                // The current chunk is not empty, so none of the
+                // completed subtrees can be the root. Merge them.
+                MergeCVStack (chunkCounter);
+            }
+        }
+
+        void Blake3::Final (
+                util::ui8 *out,
+                std::size_t outLength) const {
+            if (out == 0 && outLength > 0) {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+            // The current chunk is the rightmost leaf. Fold the stack
+            // in to it from the right, the last node is the root.
+            Output output;
+            util::ui32 stackLength = cvStackLength;
+            std::size_t chunkLength = blocksCompressed * BLOCK_LENGTH + blockLength;
+            if (chunkLength > 0 || stackLength == 0) {
+                memcpy (output.cv, chunkCV, sizeof (output.cv));
+                memcpy (output.block, block, BLOCK_LENGTH);
+                output.blockLength = blockLength;
+                output.counter = chunkCounter;
+                output.flags = flags | Blake3Constants::CHUNK_END |
+                    (blocksCompressed == 0 ? Blake3Constants::CHUNK_START : 0);
+            }
+            else {
+                stackLength -= 2;
+                MakeParentOutput (
+                    cvStack + stackLength * OUT_LENGTH,
+                    cvStack + (stackLength + 1) * OUT_LENGTH,
+                    key,
+                    flags,
+                    output);
+            }
+            while (stackLength > 0) {
+                --stackLength;
+                util::ui8 cv[OUT_LENGTH];
+                output.GetChainingValue (cv);
+                MakeParentOutput (cvStack + stackLength * OUT_LENGTH, cv, key, flags, output);
+            }
+            output.GetRootBytes (out, outLength);
+        }
+
+        Blake3 &Blake3::FromEVP_MD_CTX (EVP_MD_CTX *ctx) {
+            if (ctx != 0 && EVP_MD_CTX_md (ctx) == EVP_blake3_256 ()) {
+                return *(Blake3 *)EVP_MD_CTX_md_data (ctx);
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        void Blake3::DeriveKey (
+                const void *context,
+                std::size_t contextLength,
+                const void *keyMaterial,
+                std::size_t keyMaterialLength,
+                util::ui8 *key_,
+                std::size_t keyLength) {
+            if (keyMaterial != 0 && keyMaterialLength > 0 && key_ != 0 && keyLength > 0) {
+                Blake3 blake3;
+                blake3.InitDeriveKey (context, contextLength);
+                blake3.Update (keyMaterial, keyMaterialLength);
+                blake3.Final (key_, keyLength);
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        bool Blake3::IsKernelSupported (Kernel kernel) {
+            switch (kernel) {
+                case KERNEL_AUTO:
+                case KERNEL_PORTABLE:
+                    return true;
+                case KERNEL_NEON:
+                #if defined (THEKOGANS_CRYPTO_BLAKE3_NEON)
+                    return true;
+                #else // defined (THEKOGANS_CRYPTO_BLAKE3_NEON)
+                    return false;
+                #endif // defined (THEKOGANS_CRYPTO_BLAKE3_NEON)
+                case KERNEL_SSE41:
+                #if defined (THEKOGANS_CRYPTO_BLAKE3_X86)
+                    return CPUFeatures::Instance ().sse41;
+                #else // defined (THEKOGANS_CRYPTO_BLAKE3_X86)
+                    return false;
+                #endif // defined (THEKOGANS_CRYPTO_BLAKE3_X86)
+                case KERNEL_AVX2:
+                #if defined (THEKOGANS_CRYPTO_BLAKE3_X86)
+                    return CPUFeatures::Instance ().avx2;
+                #else // defined (THEKOGANS_CRYPTO_BLAKE3_X86)
+                    return false;
+                #endif // defined (THEKOGANS_CRYPTO_BLAKE3_X86)
+                case KERNEL_AVX512:
+                #if defined (THEKOGANS_CRYPTO_BLAKE3_X86)
+                    return CPUFeatures::Instance ().avx512f;
+                #else // defined (THEKOGANS_CRYPTO_BLAKE3_X86)
+                    return false;
+                #endif // defined (THEKOGANS_CRYPTO_BLAKE3_X86)
+            }
+            return false;
+        }
+
+        Blake3::Kernel Blake3::GetBestKernel () {
+            static const Kernel kernels[] = {
+                KERNEL_AVX512,
+                KERNEL_AVX2,
+                KERNEL_SSE41,
+                KERNEL_NEON
+            };
+            for (std::size_t i = 0; i < THEKOGANS_UTIL_ARRAY_SIZE (kernels); ++i) {
+                if (IsKernelSupported (kernels[i])) {
+                    return kernels[i];
+                }
+            }
+            return KERNEL_PORTABLE;
+        }
+
+        std::size_t Blake3::GetDegree (Kernel kernel) {
+            if (kernel == KERNEL_AUTO) {
+                kernel = GetBestKernel ();
+            }
+            switch (kernel) {
+                case KERNEL_AUTO:
+                case KERNEL_PORTABLE:
+                    return 1;
+                case KERNEL_SSE41:
+                case KERNEL_NEON:
+                    return 4;
+                case KERNEL_AVX2:
+                    return 8;
+                case KERNEL_AVX512:
+                    return 16;
+            }
+            return 1;
+        }
+
+        const char *Blake3::KernelToString (Kernel kernel) {
+            switch (kernel) {
+                case KERNEL_AUTO:
+                    return "auto";
+                case KERNEL_PORTABLE:
+                    return "portable";
+                case KERNEL_SSE41:
+                    return "sse4.1";
+                case KERNEL_NEON:
+                    return "neon";
+                case KERNEL_AVX2:
+                    return "avx2";
+                case KERNEL_AVX512:
+                    return "avx512";
+            }
+            return "unknown";
+        }
+
+        void Blake3::Reset () {
+            memcpy (chunkCV, key, sizeof (chunkCV));
+            chunkCounter = 0;
+            memset (block, 0, BLOCK_LENGTH);
+            blockLength = 0;
+            blocksCompressed = 0;
+            cvStackLength = 0;
+        }
+
+        void Blake3::PushCV (
+                const util::ui8 *cv,
+                util::ui64 totalChunks) {
+            MergeCVStack (totalChunks);
+            memcpy (cvStack + cvStackLength * OUT_LENGTH, cv, OUT_LENGTH);
+            ++cvStackLength;
+        }
+
+        void Blake3::MergeCVStack (util::ui64 totalChunks) {
+            // A (lazily merged) stack holds one entry per set bit
+            // of the number of chunks hashed so far.
+            util::ui32 mergedLength = PopCount (totalChunks);
+            while (cvStackLength > mergedLength) {
+                Output output;
+                MakeParentOutput (
+                    cvStack + (cvStackLength - 2) * OUT_LENGTH,
+                    cvStack + (cvStackLength - 1) * OUT_LENGTH,
+                    key,
+                    flags,
+                    output);
+                output.GetChainingValue (cvStack + (cvStackLength - 2) * OUT_LENGTH);
+                --cvStackLength;
+            }
+        }
+
+    } // namespace crypto
+} // namespace thekogans
@@ -0,0 +1,140 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+// NOTE: Every header this file needs, other than Blake3Kernel.h and the
+// intrinsics, has to be included before the target pragma below (see
+// Blake3Kernel.h).
+#include <cstddef>
+#include <cstring>
+#include "thekogans/util/Types.h"
+#include "thekogans/crypto/Config.h"
+
+#if defined (__x86_64__) || defined (_M_X64) || defined (__i386__) || defined (_M_IX86)
+
+#if defined (__clang__)
+    #pragma clang attribute push (__attribute__ ((target ("avx2"))), apply_to = function)
+#elif defined (__GNUC__)
+    #pragma GCC push_options
+    #pragma GCC target ("avx2")
+#endif // defined (__clang__)
+
+#include <immintrin.h>
+#include "thekogans/crypto/Blake3Kernel.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        namespace {
+            struct AVX2Lanes {
+                typedef __m256i Vector;
+                enum {
+                    COUNT = 8
+                };
+
+                static inline Vector Load (const util::ui32 *words) {
+                    return _mm256_load_si256 ((const __m256i *)words);
+                }
+                static inline void Store (
+                        util::ui32 *words,
+                        Vector v) {
+                    _mm256_store_si256 ((__m256i *)words, v);
+                }
+                static inline Vector Set1 (util::ui32 word) {
+                    return _mm256_set1_epi32 ((int)word);
+                }
+                static inline Vector Add (
+                        Vector a,
+                        Vector b) {
+                    return _mm256_add_epi32 (a, b);
+                }
+                static inline Vector Xor (
+                        Vector a,
+                        Vector b) {
+                    return _mm256_xor_si256 (a, b);
+                }
+                static inline Vector Rotr16 (Vector v) {
+                    return _mm256_shuffle_epi8 (v, _mm256_set_epi8 (
+                        13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2,
+                        13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2));
+                }
+                static inline Vector Rotr12 (Vector v) {
+                    return _mm256_or_si256 (_mm256_srli_epi32 (v, 12), _mm256_slli_epi32 (v, 20));
+                }
+                static inline Vector Rotr8 (Vector v) {
+                    return _mm256_shuffle_epi8 (v, _mm256_set_epi8 (
+                        12, 15, 14, 13, 8, 11, 10, 9, 4, 7, 6, 5, 0, 3, 2, 1,
+                        12, 15, 14, 13, 8, 11, 10, 9, 4, 7, 6, 5, 0, 3, 2, 1));
+                }
+                static inline Vector Rotr7 (Vector v) {
+                    return _mm256_or_si256 (_mm256_srli_epi32 (v, 7), _mm256_slli_epi32 (v, 25));
+                }
+                static inline void LoadMessage (
+                        const util::ui8 * const *lanes,
+                        std::size_t offset,
+                        Vector m[16]) {
+                    // Two 8x8 transposes, one per half block.
+                    for (std::size_t i = 0; i < 16; i += 8) {
+                        __m256i t[8];
+                        for (std::size_t j = 0; j < 8; j += 2) {
+                            __m256i r0 = _mm256_loadu_si256 ((const __m256i *)(lanes[j] + offset + i * 4));
+                            __m256i r1 = _mm256_loadu_si256 ((const __m256i *)(lanes[j + 1] + offset + i * 4));
+                            t[j] = _mm256_unpacklo_epi32 (r0, r1);
+                            t[j + 1] = _mm256_unpackhi_epi32 (r0, r1);
+                        }
+                        // u[4 * g + c], 128 bit lane k = word 4 * k + c of rows 4 * g..4 * g + 3.
+                        __m256i u[8];
+                        for (std::size_t g = 0; g < 2; ++g) {
+                            u[4 * g] = _mm256_unpacklo_epi64 (t[4 * g], t[4 * g + 2]);
+                            u[4 * g + 1] = _mm256_unpackhi_epi64 (t[4 * g], t[4 * g + 2]);
+                            u[4 * g + 2] = _mm256_unpacklo_epi64 (t[4 * g + 1], t[4 * g + 3]);
+                            u[4 * g + 3] = _mm256_unpackhi_epi64 (t[4 * g + 1], t[4 * g + 3]);
+                        }
+                        for (std::size_t c = 0; c < 4; ++c) {
+                            m[i + c] = _mm256_permute2x128_si256 (u[c], u[4 + c], 0x20);
+                            m[i + 4 + c] = _mm256_permute2x128_si256 (u[c], u[4 + c], 0x31);
+                        }
+                    }
+                }
+            };
+        }
+
+        void Blake3HashManyAVX2 (
+                const util::ui8 * const *inputs,
+                std::size_t count,
+                std::size_t blockCount,
+                const util::ui32 *key,
+                util::ui64 counter,
+                bool incrementCounter,
+                util::ui32 flags,
+                util::ui32 flagsStart,
+                util::ui32 flagsEnd,
+                util::ui8 *out) {
+            Blake3Kernel<AVX2Lanes>::HashMany (
+                inputs, count, blockCount, key, counter,
+                incrementCounter, flags, flagsStart, flagsEnd, out);
+        }
+
+    } // namespace crypto
+} // namespace thekogans
+
+#if defined (__clang__)
+    #pragma clang attribute pop
+#elif defined (__GNUC__)
+    #pragma GCC pop_options
+#endif // defined (__clang__)
+
+#endif // defined (__x86_64__) || defined (_M_X64) || defined (__i386__) || defined (_M_IX86)
@@ -0,0 +1,141 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+// NOTE: Every header this file needs, other than Blake3Kernel.h and the
+// intrinsics, has to be included before the target pragma below (see
+// Blake3Kernel.h).
+#include <cstddef>
+#include <cstring>
+#include "thekogans/util/Types.h"
+#include "thekogans/crypto/Config.h"
+
+#if defined (__x86_64__) || defined (_M_X64) || defined (__i386__) || defined (_M_IX86)
+
+#if defined (__clang__)
+    #pragma clang attribute push (__attribute__ ((target ("avx512f"))), apply_to = function)
+#elif defined (__GNUC__)
+    #pragma GCC push_options
+    #pragma GCC target ("avx512f")
+#endif // defined (__clang__)
+
+#include <immintrin.h>
+#include "thekogans/crypto/Blake3Kernel.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        namespace {
+            struct AVX512Lanes {
+                typedef __m512i Vector;
+                enum {
+                    COUNT = 16
+                };
+
+                static inline Vector Load (const util::ui32 *words) {
+                    return _mm512_load_si512 ((const void *)words);
+                }
+                static inline void Store (
+                        util::ui32 *words,
+                        Vector v) {
+                    _mm512_store_si512 ((void *)words, v);
+                }
+                static inline Vector Set1 (util::ui32 word) {
+                    return _mm512_set1_epi32 ((int)word);
+                }
+                static inline Vector Add (
+                        Vector a,
+                        Vector b) {
+                    return _mm512_add_epi32 (a, b);
+                }
+                static inline Vector Xor (
+                        Vector a,
+                        Vector b) {
+                    return _mm512_xor_si512 (a, b);
+                }
+                static inline Vector Rotr16 (Vector v) {
+                    return _mm512_ror_epi32 (v, 16);
+                }
+                static inline Vector Rotr12 (Vector v) {
+                    return _mm512_ror_epi32 (v, 12);
+                }
+                static inline Vector Rotr8 (Vector v) {
+                    return _mm512_ror_epi32 (v, 8);
+                }
+                static inline Vector Rotr7 (Vector v) {
+                    return _mm512_ror_epi32 (v, 7);
+                }
+                static inline void LoadMessage (
+                        const util::ui8 * const *lanes,
+                        std::size_t offset,
+                        Vector m[16]) {
+                    // A 16x16 transpose.
+                    __m512i t[16];
+                    for (std::size_t j = 0; j < 16; j += 2) {
+                        __m512i r0 = _mm512_loadu_si512 ((const void *)(lanes[j] + offset));
+                        __m512i r1 = _mm512_loadu_si512 ((const void *)(lanes[j + 1] + offset));
+                        t[j] = _mm512_unpacklo_epi32 (r0, r1);
+                        t[j + 1] = _mm512_unpackhi_epi32 (r0, r1);
+                    }
+                    // u[4 * g + c], 128 bit lane k = word 4 * k + c of rows 4 * g..4 * g + 3.
+                    __m512i u[16];
+                    for (std::size_t g = 0; g < 4; ++g) {
+                        u[4 * g] = _mm512_unpacklo_epi64 (t[4 * g], t[4 * g + 2]);
+                        u[4 * g + 1] = _mm512_unpackhi_epi64 (t[4 * g], t[4 * g + 2]);
+                        u[4 * g + 2] = _mm512_unpacklo_epi64 (t[4 * g + 1], t[4 * g + 3]);
+                        u[4 * g + 3] = _mm512_unpackhi_epi64 (t[4 * g + 1], t[4 * g + 3]);
+                    }
+                    // Transpose the 128 bit lanes.
+                    for (std::size_t c = 0; c < 4; ++c) {
+                        __m512i v0 = _mm512_shuffle_i32x4 (u[c], u[4 + c], 0x44);
+                        __m512i v1 = _mm512_shuffle_i32x4 (u[c], u[4 + c], 0xee);
+                        __m512i v2 = _mm512_shuffle_i32x4 (u[8 + c], u[12 + c], 0x44);
+                        __m512i v3 = _mm512_shuffle_i32x4 (u[8 + c], u[12 + c], 0xee);
+                        m[c] = _mm512_shuffle_i32x4 (v0, v2, 0x88);
+                        m[4 + c] = _mm512_shuffle_i32x4 (v0, v2, 0xdd);
+                        m[8 + c] = _mm512_shuffle_i32x4 (v1, v3, 0x88);
+                        m[12 + c] = _mm512_shuffle_i32x4 (v1, v3, 0xdd);
+                    }
+                }
+            };
+        }
+
+        void Blake3HashManyAVX512 (
+                const util::ui8 * const *inputs,
+                std::size_t count,
+                std::size_t blockCount,
+                const util::ui32 *key,
+                util::ui64 counter,
+                bool incrementCounter,
+                util::ui32 flags,
+                util::ui32 flagsStart,
+                util::ui32 flagsEnd,
+                util::ui8 *out) {
+            Blake3Kernel<AVX512Lanes>::HashMany (
+                inputs, count, blockCount, key, counter,
+                incrementCounter, flags, flagsStart, flagsEnd, out);
+        }
+
+    } // namespace crypto
+} // namespace thekogans
+
+#if defined (__clang__)
+    #pragma clang attribute pop
+#elif defined (__GNUC__)
+    #pragma GCC pop_options
+#endif // defined (__clang__)
+
+#endif // defined (__x86_64__) || defined (_M_X64) || defined (__i386__) || defined (_M_IX86)
@@ -0,0 +1,129 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+// NOTE: Every header this file needs, other than Blake3Kernel.h and the
+// intrinsics, has to be included before the target pragma below (see
+// Blake3Kernel.h).
+#include <cstddef>
+#include <cstring>
+#include "thekogans/util/Types.h"
+#include "thekogans/crypto/Config.h"
+
+#if defined (__x86_64__) || defined (_M_X64) || defined (__i386__) || defined (_M_IX86)
+
+#if defined (__clang__)
+    #pragma clang attribute push (__attribute__ ((target ("sse4.1"))), apply_to = function)
+#elif defined (__GNUC__)
+    #pragma GCC push_options
+    #pragma GCC target ("sse4.1")
+#endif // defined (__clang__)
+
+#include <smmintrin.h>
+#include "thekogans/crypto/Blake3Kernel.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        namespace {
+            struct SSE41Lanes {
+                typedef __m128i Vector;
+                enum {
+                    COUNT = 4
+                };
+
+                static inline Vector Load (const util::ui32 *words) {
+                    return _mm_load_si128 ((const __m128i *)words);
+                }
+                static inline void Store (
+                        util::ui32 *words,
+                        Vector v) {
+                    _mm_store_si128 ((__m128i *)words, v);
+                }
+                static inline Vector Set1 (util::ui32 word) {
+                    return _mm_set1_epi32 ((int)word);
+                }
+                static inline Vector Add (
+                        Vector a,
+                        Vector b) {
+                    return _mm_add_epi32 (a, b);
+                }
+                static inline Vector Xor (
+                        Vector a,
+                        Vector b) {
+                    return _mm_xor_si128 (a, b);
+                }
+                static inline Vector Rotr16 (Vector v) {
+                    return _mm_shuffle_epi8 (v, _mm_set_epi8 (13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2));
+                }
+                static inline Vector Rotr12 (Vector v) {
+                    return _mm_or_si128 (_mm_srli_epi32 (v, 12), _mm_slli_epi32 (v, 20));
+                }
+                static inline Vector Rotr8 (Vector v) {
+                    return _mm_shuffle_epi8 (v, _mm_set_epi8 (12, 15, 14, 13, 8, 11, 10, 9, 4, 7, 6, 5, 0, 3, 2, 1));
+                }
+                static inline Vector Rotr7 (Vector v) {
+                    return _mm_or_si128 (_mm_srli_epi32 (v, 7), _mm_slli_epi32 (v, 25));
+                }
+                static inline void LoadMessage (
+                        const util::ui8 * const *lanes,
+                        std::size_t offset,
+                        Vector m[16]) {
+                    // Four 4x4 transposes, one per quarter block.
+                    for (std::size_t i = 0; i < 16; i += 4) {
+                        __m128i r0 = _mm_loadu_si128 ((const __m128i *)(lanes[0] + offset + i * 4));
+                        __m128i r1 = _mm_loadu_si128 ((const __m128i *)(lanes[1] + offset + i * 4));
+                        __m128i r2 = _mm_loadu_si128 ((const __m128i *)(lanes[2] + offset + i * 4));
+                        __m128i r3 = _mm_loadu_si128 ((const __m128i *)(lanes[3] + offset + i * 4));
+                        __m128i t0 = _mm_unpacklo_epi32 (r0, r1);
+                        __m128i t1 = _mm_unpackhi_epi32 (r0, r1);
+                        __m128i t2 = _mm_unpacklo_epi32 (r2, r3);
+                        __m128i t3 = _mm_unpackhi_epi32 (r2, r3);
+                        m[i] = _mm_unpacklo_epi64 (t0, t2);
+                        m[i + 1] = _mm_unpackhi_epi64 (t0, t2);
+                        m[i + 2] = _mm_unpacklo_epi64 (t1, t3);
+                        m[i + 3] = _mm_unpackhi_epi64 (t1, t3);
+                    }
+                }
+            };
+        }
+
+        void Blake3HashManySSE41 (
+                const util::ui8 * const *inputs,
+                std::size_t count,
+                std::size_t blockCount,
+                const util::ui32 *key,
+                util::ui64 counter,
+                bool incrementCounter,
+                util::ui32 flags,
+                util::ui32 flagsStart,
+                util::ui32 flagsEnd,
+                util::ui8 *out) {
+            Blake3Kernel<SSE41Lanes>::HashMany (
+                inputs, count, blockCount, key, counter,
+                incrementCounter, flags, flagsStart, flagsEnd, out);
+        }
+
+    } // namespace crypto
+} // namespace thekogans
+
+#if defined (__clang__)
+    #pragma clang attribute pop
+#elif defined (__GNUC__)
+    #pragma GCC pop_options
+#endif // defined (__clang__)
+
+#endif // defined (__x86_64__) || defined (_M_X64) || defined (__i386__) || defined (_M_IX86)
@@ -0,0 +1,276 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#include "thekogans/util/Exception.h"
+#include "thekogans/util/LockGuard.h"
+#include "thekogans/util/Thread.h"
+#include "thekogans/util/HRTimer.h"
+#include "thekogans/util/SystemInfo.h"
+#include "thekogans/crypto/BlockPipeline.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        struct BlockPipeline::Worker : public util::Thread {
+        private:
+            BlockPipeline &pipeline;
+            std::size_t workerIndex;
+            std::size_t node;
+
+        public:
+            Worker (
+                BlockPipeline &pipeline_,
+                std::size_t workerIndex_) :
+                pipeline (pipeline_),
+                workerIndex (workerIndex_),
+                node (pipeline.GetWorkerNode (workerIndex)) {}
+
+        protected:
+            // util::Thread
+            virtual void Run () throw () override {
+                if (pipeline.numaAware) {
+                    // A hint. If the OS refuses, the worker still
+                    // prefers it's node's blocks.
+                    NUMATopology::Instance ().BindCurrentThread (node);
+                }
+                bool remote;
+                for (Block::SharedPtr block = pipeline.GetPendingBlock (node, remote);
+                        block.Get () != 0; block = pipeline.GetPendingBlock (node, remote)) {
+                    util::ui64 start = util::HRTimer::Click ();
+                    THEKOGANS_UTIL_TRY {
+                        pipeline.ProcessBlock (workerIndex, *block);
+                    }
+                    THEKOGANS_UTIL_CATCH (util::Exception) {
+                        block->error = exception.Report ();
+                    }
+                    pipeline.AddProcessedBlock (block, node, remote,
+                        util::HRTimer::ToSeconds (
+                            util::HRTimer::ComputeElapsedTime (start, util::HRTimer::Click ())));
+                }
+            }
+        };
+
+        BlockPipeline::BlockPipeline (
+                std::size_t workerCount_,
+                std::size_t maxPendingBlocks_) :
+                workerCount (workerCount_ > 0 ?
+                    workerCount_ : util::SystemInfo::Instance ().GetCPUCount ()),
+                maxPendingBlocks (maxPendingBlocks_ > 0 ?
+                    maxPendingBlocks_ : DEFAULT_PENDING_BLOCKS_PER_WORKER * workerCount),
+                pendingCondition (mutex),
+                processedCondition (mutex),
+                numaAware (false),
+                pendingBlockCount (0),
+                nextNode (0),
+                done (false) {
+            if (workerCount == 0) {
+                workerCount = 1;
+            }
+            if (maxPendingBlocks < workerCount) {
+                maxPendingBlocks = workerCount;
+            }
+            ResetNodes ();
+        }
+
+        void BlockPipeline::SetNUMAAware (bool numaAware_) {
+            util::LockGuard<util::Mutex> guard (mutex);
+            numaAware = numaAware_;
+            ResetNodes ();
+        }
+
+        std::size_t BlockPipeline::GetWorkerNode (std::size_t workerIndex) const {
+            // Round robin, so that any worker count is spread evenly.
+            return numaAware ? workerIndex % NUMATopology::Instance ().GetNodeCount () : 0;
+        }
+
+        std::vector<NUMATopology::NodeStats> BlockPipeline::GetNodeStats () {
+            util::LockGuard<util::Mutex> guard (mutex);
+            return nodeStats;
+        }
+
+        void BlockPipeline::PlaceBlock (Block &block) {
+            if (numaAware) {
+                const NUMATopology &topology = NUMATopology::Instance ();
+                std::size_t node = nextNode++ % topology.GetNodeCount ();
+                block.node = (int)node;
+                // Untouched pages are placed where they'll be used, instead
+                // of wherever the first touch (ReadBlock) happens.
+                topology.BindMemory (
+                    block.input.GetWritePtr (),
+                    block.input.GetDataAvailableForWriting (),
+                    node);
+                topology.BindMemory (
+                    block.output.GetWritePtr (),
+                    block.output.GetDataAvailableForWriting (),
+                    node);
+            }
+        }
+
+        void BlockPipeline::Run () {
+            {
+                util::LockGuard<util::Mutex> guard (mutex);
+                done = false;
+            }
+            util::OwnerVector<Worker> workers;
+            workers.reserve (workerCount);
+            THEKOGANS_UTIL_TRY {
+                for (std::size_t i = 0; i < workerCount; ++i) {
+                    workers.push_back (new Worker (*this, i));
+                    workers.back ()->Create ();
+                }
+                util::ui64 readSequenceNumber = 0;
+                util::ui64 writeSequenceNumber = 0;
+                bool eof = false;
+                while (1) {
+                    while (!eof && readSequenceNumber - writeSequenceNumber < maxPendingBlocks) {
+                        Block::SharedPtr block = ReadBlock ();
+                        if (block.Get () != 0) {
+                            block->sequenceNumber = readSequenceNumber++;
+                            std::size_t queue = GetBlockQueue (*block);
+                            util::LockGuard<util::Mutex> guard (mutex);
+                            pendingBlocks[queue].push_back (block);
+                            ++pendingBlockCount;
+                            // Any worker can take it, so wake them all up
+                            // (the owning node's workers get first dibs).
+                            pendingCondition.SignalAll ();
+                        }
+                        else {
+                            eof = true;
+                        }
+                    }
+                    if (writeSequenceNumber == readSequenceNumber) {
+                        break;
+                    }
+                    Block::SharedPtr block = GetProcessedBlock (writeSequenceNumber++);
+                    if (!block->error.empty ()) {
+                        THEKOGANS_UTIL_THROW_STRING_EXCEPTION ("%s", block->error.c_str ());
+                    }
+                    WriteBlock (*block);
+                }
+                StopWorkers (workers);
+            }
+            THEKOGANS_UTIL_CATCH (util::Exception) {
+                StopWorkers (workers);
+                THEKOGANS_UTIL_RETHROW_EXCEPTION (exception);
+            }
+        }
+
+        BlockPipeline::Block::SharedPtr BlockPipeline::GetPendingBlock (
+                std::size_t node,
+                bool &remote) {
+            util::LockGuard<util::Mutex> guard (mutex);
+            while (!done && pendingBlockCount == 0) {
+                pendingCondition.Wait ();
+            }
+            Block::SharedPtr block;
+            if (!done) {
+                // Own queue first, then the other nodes' in order.
+                std::size_t queueCount = pendingBlocks.size ();
+                for (std::size_t i = 0; i < queueCount; ++i) {
+                    std::list<Block::SharedPtr> &queue = pendingBlocks[(node + i) % queueCount];
+                    if (!queue.empty ()) {
+                        block = queue.front ();
+                        queue.pop_front ();
+                        --pendingBlockCount;
+                        remote = i > 0;
+                        break;
+                    }
+                }
+            }
+            return block;
+        }
+
+        void BlockPipeline::AddProcessedBlock (
+                Block::SharedPtr block,
+                std::size_t node,
+                bool remote,
+                util::f64 seconds) {
+            util::LockGuard<util::Mutex> guard (mutex);
+            if (node < nodeStats.size ()) {
+                NUMATopology::NodeStats &stats = nodeStats[node];
+                ++stats.jobCount;
+                if (remote) {
+                    ++stats.remoteJobCount;
+                }
+                stats.byteCount += block->input.GetDataAvailableForReading ();
+                stats.busySeconds += seconds;
+            }
+            processedBlocks[block->sequenceNumber] = block;
+            processedCondition.SignalAll ();
+        }
+
+        std::size_t BlockPipeline::GetBlockQueue (const Block &block) const {
+            if (pendingBlocks.size () > 1) {
+                int node = block.node;
+                if (node == NUMATopology::NO_NODE) {
+                    node = NUMATopology::Instance ().GetAddressNode (
+                        block.input.GetReadPtr ());
+                }
+                if (node >= 0 && (std::size_t)node < pendingBlocks.size ()) {
+                    return (std::size_t)node;
+                }
+            }
+            return 0;
+        }
+
+        void BlockPipeline::ResetNodes () {
+            std::size_t nodeCount = numaAware ? NUMATopology::Instance ().GetNodeCount () : 1;
+            pendingBlocks.clear ();
+            pendingBlocks.resize (nodeCount);
+            pendingBlockCount = 0;
+            nextNode = 0;
+            nodeStats.clear ();
+            for (std::size_t i = 0; i < nodeCount; ++i) {
+                nodeStats.push_back (NUMATopology::NodeStats (i));
+            }
+            for (std::size_t i = 0; i < workerCount; ++i) {
+                ++nodeStats[GetWorkerNode (i)].workerCount;
+            }
+        }
+
+        BlockPipeline::Block::SharedPtr BlockPipeline::GetProcessedBlock (
+                util::ui64 sequenceNumber) {
+            util::LockGuard<util::Mutex> guard (mutex);
+            std::map<util::ui64, Block::SharedPtr>::iterator it;
+            while ((it = processedBlocks.find (sequenceNumber)) == processedBlocks.end ()) {
+                processedCondition.Wait ();
+            }
+            Block::SharedPtr block = it->second;
+            processedBlocks.erase (it);
+            return block;
+        }
+
+        void BlockPipeline::StopWorkers (util::OwnerVector<Worker> &workers) {
+            {
+                util::LockGuard<util::Mutex> guard (mutex);
+                done = true;
+                pendingCondition.SignalAll ();
+            }
+            for (std::size_t i = 0, count = workers.size (); i < count; ++i) {
+                workers[i]->Wait ();
+            }
+            workers.deleteAndClear ();
+            util::LockGuard<util::Mutex> guard (mutex);
+            for (std::size_t i = 0, count = pendingBlocks.size (); i < count; ++i) {
+                pendingBlocks[i].clear ();
+            }
+            pendingBlockCount = 0;
+            processedBlocks.clear ();
+        }
+
+    } // namespace crypto
+} // namespace thekogans
@@ -0,0 +1,207 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <cstring>
+#include "thekogans/util/Exception.h"
+#include "thekogans/util/DefaultAllocator.h"
+#include "thekogans/util/SecureAllocator.h"
+#include "thekogans/util/LockGuard.h"
+#include "thekogans/util/SpinLock.h"
+#include "thekogans/crypto/AllocationTracker.h"
+#include "thekogans/crypto/ConstantTime.h"
+#include "thekogans/crypto/BufferPoolAllocator.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        THEKOGANS_UTIL_IMPLEMENT_ALLOCATOR (BufferPoolAllocator)
+
+        namespace {
+            // Return the index of the smallest size class that can hold size
+            // bytes (SIZE_CLASS_COUNT if size > MAX_BLOCK_SIZE).
+            inline std::size_t GetSizeClass (std::size_t size) {
+                std::size_t sizeClass = 0;
+                std::size_t blockSize = BufferPoolAllocator::MIN_BLOCK_SIZE;
+                while (blockSize < size && sizeClass < BufferPoolAllocator::SIZE_CLASS_COUNT) {
+                    blockSize <<= 1;
+                    ++sizeClass;
+                }
+                return sizeClass;
+            }
+
+            inline std::size_t GetClassBlockSize (std::size_t sizeClass) {
+                return (std::size_t)BufferPoolAllocator::MIN_BLOCK_SIZE << sizeClass;
+            }
+        }
+
+        BufferPoolAllocator &BufferPoolAllocator::Instance () {
+            static BufferPoolAllocator *instance = new BufferPoolAllocator;
+            return *instance;
+        }
+
+        BufferPoolAllocator &BufferPoolAllocator::SecureInstance () {
+            static BufferPoolAllocator *instance =
+                new BufferPoolAllocator (&util::SecureAllocator::Instance (), true);
+            return *instance;
+        }
+
+        BufferPoolAllocator &BufferPoolAllocator::NodeInstance (
+                std::size_t node,
+                bool secure) {
+            // Created on first use and never destroyed (like Instance).
+            static util::SpinLock spinLock;
+            static std::vector<BufferPoolAllocator *> instances[2];
+            const NUMATopology &topology = NUMATopology::Instance ();
+            if (node >= topology.GetNodeCount ()) {
+                node = topology.GetNodeCount () - 1;
+            }
+            util::LockGuard<util::SpinLock> guard (spinLock);
+            std::vector<BufferPoolAllocator *> &nodeInstances = instances[secure ? 1 : 0];
+            if (nodeInstances.empty ()) {
+                nodeInstances.resize (topology.GetNodeCount (), 0);
+            }
+            if (nodeInstances[node] == 0) {
+                nodeInstances[node] = new BufferPoolAllocator (
+                    secure ?
+                        (util::Allocator *)&util::SecureAllocator::Instance () :
+                        (util::Allocator *)&util::DefaultAllocator::Instance (),
+                    secure,
+                    DEFAULT_MAX_BLOCKS_PER_CLASS,
+                    (int)node);
+            }
+            return *nodeInstances[node];
+        }
+
+        BufferPoolAllocator::BufferPoolAllocator (
+                util::Allocator *allocator_,
+                bool secure_,
+                std::size_t maxBlocksPerClass_,
+                int node_) :
+                allocator (allocator_ != 0 ? *allocator_ : util::DefaultAllocator::Instance ()),
+                secure (secure_),
+                maxBlocksPerClass (maxBlocksPerClass_),
+                node (node_) {}
+
+        BufferPoolAllocator::~BufferPoolAllocator () {
+            Trim ();
+        }
+
+        void *BufferPoolAllocator::Alloc (std::size_t size) {
+            if (size == 0) {
+                return 0;
+            }
+            AllocationTracker::Record (
+                secure ? AllocationTracker::SOURCE_SECURE : AllocationTracker::SOURCE_POOL,
+                size);
+            std::size_t sizeClass = GetSizeClass (size);
+            if (sizeClass == SIZE_CLASS_COUNT) {
+                return AllocBlock (size);
+            }
+            {
+                util::LockGuard<util::SpinLock> guard (spinLock);
+                if (!freeBlocks[sizeClass].empty ()) {
+                    void *ptr = freeBlocks[sizeClass].back ();
+                    freeBlocks[sizeClass].pop_back ();
+                    return ptr;
+                }
+            }
+            return AllocBlock (GetClassBlockSize (sizeClass));
+        }
+
+        void BufferPoolAllocator::Free (
+                void *ptr,
+                std::size_t size) {
+            if (ptr != 0) {
+                std::size_t sizeClass = GetSizeClass (size);
+                if (sizeClass == SIZE_CLASS_COUNT) {
+                    allocator.Free (ptr, size);
+                    return;
+                }
+                if (secure) {
+                    // memset of a buffer that's never read again can be elided.
+                    SecureZero (ptr, GetClassBlockSize (sizeClass));
+                }
+                {
+                    util::LockGuard<util::SpinLock> guard (spinLock);
+                    if (freeBlocks[sizeClass].size () < maxBlocksPerClass) {
+                        freeBlocks[sizeClass].push_back (ptr);
+                        return;
+                    }
+                }
+                allocator.Free (ptr, GetClassBlockSize (sizeClass));
+            }
+        }
+
+        std::size_t BufferPoolAllocator::Reserve (
+                std::size_t blockSize,
+                std::size_t count) {
+            std::size_t sizeClass = GetSizeClass (blockSize);
+            if (blockSize == 0 || sizeClass == SIZE_CLASS_COUNT) {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+            std::size_t classBlockSize = GetClassBlockSize (sizeClass);
+            std::size_t cachedCount;
+            {
+                util::LockGuard<util::SpinLock> guard (spinLock);
+                cachedCount = freeBlocks[sizeClass].size ();
+            }
+            if (count > maxBlocksPerClass) {
+                count = maxBlocksPerClass;
+            }
+            for (; cachedCount < count; ++cachedCount) {
+                void *ptr = AllocBlock (classBlockSize);
+                // Fault the pages in now (on node, if placed).
+                if (secure) {
+                    SecureZero (ptr, classBlockSize);
+                }
+                else {
+                    memset (ptr, 0, classBlockSize);
+                }
+                util::LockGuard<util::SpinLock> guard (spinLock);
+                if (freeBlocks[sizeClass].size () >= maxBlocksPerClass) {
+                    allocator.Free (ptr, classBlockSize);
+                    break;
+                }
+                freeBlocks[sizeClass].push_back (ptr);
+            }
+            util::LockGuard<util::SpinLock> guard (spinLock);
+            return freeBlocks[sizeClass].size ();
+        }
+
+        void BufferPoolAllocator::Trim () {
+            util::LockGuard<util::SpinLock> guard (spinLock);
+            for (std::size_t i = 0; i < SIZE_CLASS_COUNT; ++i) {
+                for (std::size_t j = 0, count = freeBlocks[i].size (); j < count; ++j) {
+                    allocator.Free (freeBlocks[i][j], GetClassBlockSize (i));
+                }
+                freeBlocks[i].clear ();
+            }
+        }
+
+        void *BufferPoolAllocator::AllocBlock (std::size_t size) {
+            void *ptr = allocator.Alloc (size);
+            if (node != NUMATopology::NO_NODE) {
+                // A hint. If the OS refuses, first touch decides.
+                NUMATopology::Instance ().BindMemory (ptr, size, (std::size_t)node);
+            }
+            return ptr;
+        }
+
+    } // namespace crypto
+} // namespace thekogans
@@ -0,0 +1,153 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+
+#if defined (TOOLCHAIN_OS_Windows)
+    #include <windows.h>
+#else // defined (TOOLCHAIN_OS_Windows)
+    #include <sys/types.h>
+    #include <unistd.h>
+#endif // defined (TOOLCHAIN_OS_Windows)
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include "thekogans/util/Exception.h"
+#include "thekogans/util/RandomSource.h"
+#include "thekogans/crypto/OpenSSLException.h"
+#include "thekogans/crypto/ConstantTime.h"
+#include "thekogans/crypto/BufferedRandomSource.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        namespace {
+            std::atomic<util::ui64> refills (0);
+            std::atomic<util::ui64> reseeds (0);
+            std::atomic<util::ui64> bytes (0);
+
+            util::ui64 GetCurrentPid () {
+            #if defined (TOOLCHAIN_OS_Windows)
+                return (util::ui64)GetCurrentProcessId ();
+            #else // defined (TOOLCHAIN_OS_Windows)
+                return (util::ui64)getpid ();
+            #endif // defined (TOOLCHAIN_OS_Windows)
+            }
+
+            void InitKeystream (
+                    EVP_CIPHER_CTX *context,
+                    const util::ui8 *seed) {
+                // AES-256-CTR: 32 byte key followed by 16 byte iv.
+                if (EVP_EncryptInit_ex (context, EVP_aes_256_ctr (), 0, seed, seed + 32) != 1) {
+                    THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
+                }
+            }
+        }
+
+        BufferedRandomSource::BufferedRandomSource () :
+                offset (REFILL_LENGTH),
+                bytesSinceReseed (0),
+                pid (0) {
+            Reseed ();
+        }
+
+        BufferedRandomSource::~BufferedRandomSource () {
+            SecureZero (buffer, REFILL_LENGTH);
+        }
+
+        BufferedRandomSource &BufferedRandomSource::GetThreadInstance () {
+            static thread_local BufferedRandomSource instance;
+            return instance;
+        }
+
+        BufferedRandomSource::Counters BufferedRandomSource::GetCounters () {
+            Counters counters;
+            counters.refills = refills;
+            counters.reseeds = reseeds;
+            counters.bytes = bytes;
+            return counters;
+        }
+
+        std::size_t BufferedRandomSource::GetBytes (
+                void *bytes_,
+                std::size_t count) {
+            if (bytes_ != 0 && count > 0) {
+                if (pid != GetCurrentPid ()) {
+                    // We're in a fork ()ed child. The parent has (and will
+                    // hand out) the same buffered bytes and keystream.
+                    SecureZero (buffer, REFILL_LENGTH);
+                    offset = REFILL_LENGTH;
+                    Reseed ();
+                }
+                util::ui8 *ptr = (util::ui8 *)bytes_;
+                std::size_t remaining = count;
+                while (remaining > 0) {
+                    if (offset == REFILL_LENGTH) {
+                        Refill ();
+                    }
+                    std::size_t length = std::min (remaining, (std::size_t)(REFILL_LENGTH - offset));
+                    memcpy (ptr, buffer + offset, length);
+                    // Never hand out the same bytes twice.
+                    memset (buffer + offset, 0, length);
+                    offset += length;
+                    ptr += length;
+                    remaining -= length;
+                }
+                bytes += count;
+                return count;
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        void BufferedRandomSource::Reseed () {
+            util::ui8 seed[SEED_LENGTH];
+            if (util::GlobalRandomSource::Instance ().GetBytes (seed, SEED_LENGTH) != SEED_LENGTH) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "Unable to get %u random bytes for seed.",
+                    SEED_LENGTH);
+            }
+            InitKeystream (&context, seed);
+            memset (seed, 0, SEED_LENGTH);
+            bytesSinceReseed = 0;
+            pid = GetCurrentPid ();
+            ++reseeds;
+        }
+
+        void BufferedRandomSource::Refill () {
+            if (bytesSinceReseed >= RESEED_INTERVAL) {
+                Reseed ();
+            }
+            // Keystream = encrypted zeros.
+            memset (buffer, 0, REFILL_LENGTH);
+            int length = 0;
+            if (EVP_EncryptUpdate (&context, buffer, &length, buffer, REFILL_LENGTH) != 1 ||
+                    length != REFILL_LENGTH) {
+                THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
+            }
+            // Rekey from the first SEED_LENGTH bytes (backtracking resistance),
+            // and never hand them out.
+            InitKeystream (&context, buffer);
+            memset (buffer, 0, SEED_LENGTH);
+            offset = SEED_LENGTH;
+            bytesSinceReseed += REFILL_LENGTH;
+            ++refills;
+        }
+
+    } // namespace crypto
+} // namespace thekogans
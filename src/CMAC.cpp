@@ -32,12 +32,13 @@ namespace thekogans {
                 key (key_),
                 cipher (cipher_) {
             if (key.Get () != 0 && cipher != 0) {
+                metrics.Reset (key->GetId ());
                 if (CMAC_Init (
                         &ctx,
                         key->Get ().GetReadPtr (),
                         key->Get ().GetDataAvailableForReading (),
-                        cipher,
-                        OpenSSLInit::engine) != 1) {
+                        OpenSSLInit::FetchCipher (cipher),
+                        OpenSSLInit::GetEngine (EVP_CIPHER_nid (cipher))) != 1) {
                     THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
                 }
             }
@@ -48,6 +49,9 @@ namespace thekogans {
         }
 
         void CMAC::Init () {
+            // NOTE: The subkeys (K1, K2) and the keyed cipher context were derived
+            // in the ctor. Restarting with all null arguments only resets the
+            // chaining value, which is cheaper than cloning with CMAC_CTX_copy.
             if (CMAC_Init (&ctx, 0, 0, 0, 0) != 1) {
                 THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
             }
@@ -0,0 +1,225 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+
+#if defined (__x86_64__) || defined (_M_X64) || defined (__i386__) || defined (_M_IX86)
+    #define THEKOGANS_CRYPTO_CPU_X86
+    #if defined (_MSC_VER)
+        #include <intrin.h>
+    #else // defined (_MSC_VER)
+        #include <cpuid.h>
+    #endif // defined (_MSC_VER)
+#elif defined (__aarch64__) || defined (_M_ARM64) || defined (__arm__)
+    #define THEKOGANS_CRYPTO_CPU_ARM
+    #if defined (TOOLCHAIN_OS_Linux)
+        #include <sys/auxv.h>
+    #endif // defined (TOOLCHAIN_OS_Linux)
+#endif // defined (__x86_64__) || defined (_M_X64) || defined (__i386__) || defined (_M_IX86)
+#include <openssl/crypto.h>
+#include <openssl/opensslv.h>
+#include "thekogans/crypto/CPUFeatures.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        namespace {
+        #if defined (THEKOGANS_CRYPTO_CPU_X86)
+            void CPUID (
+                    unsigned int leaf,
+                    unsigned int subleaf,
+                    unsigned int registers[4]) {
+            #if defined (_MSC_VER)
+                int info[4];
+                __cpuidex (info, (int)leaf, (int)subleaf);
+                for (int i = 0; i < 4; ++i) {
+                    registers[i] = (unsigned int)info[i];
+                }
+            #else // defined (_MSC_VER)
+                if (__get_cpuid_max (0, 0) >= leaf) {
+                    __cpuid_count (leaf, subleaf,
+                        registers[0], registers[1], registers[2], registers[3]);
+                }
+                else {
+                    registers[0] = registers[1] = registers[2] = registers[3] = 0;
+                }
+            #endif // defined (_MSC_VER)
+            }
+
+            inline bool IsBitSet (
+                    unsigned int value,
+                    unsigned int bit) {
+                return (value & (1u << bit)) != 0;
+            }
+        #endif // defined (THEKOGANS_CRYPTO_CPU_X86)
+
+            inline const char *YesNo (bool value) {
+                return value ? "yes" : "no";
+            }
+        }
+
+        const CPUFeatures &CPUFeatures::Instance () {
+            static CPUFeatures *instance = new CPUFeatures;
+            return *instance;
+        }
+
+        CPUFeatures::CPUFeatures () :
+                architecture ("unknown"),
+                aesni (false),
+                pclmulqdq (false),
+                ssse3 (false),
+                sse41 (false),
+                avx (false),
+                avx2 (false),
+                avx512f (false),
+                vaes (false),
+                vpclmulqdq (false),
+                shani (false),
+                armAES (false),
+                armPMULL (false),
+                armSHA1 (false),
+                armSHA256 (false),
+                armSHA512 (false) {
+        #if defined (THEKOGANS_CRYPTO_CPU_X86)
+        #if defined (__x86_64__) || defined (_M_X64)
+            architecture = "x86_64";
+        #else // defined (__x86_64__) || defined (_M_X64)
+            architecture = "i386";
+        #endif // defined (__x86_64__) || defined (_M_X64)
+            // ecx of leaf 1, ebx and ecx of leaf 7.
+            unsigned int leaf1ecx;
+            unsigned int leaf7ebx;
+            unsigned int leaf7ecx;
+            {
+                unsigned int registers[4];
+                CPUID (1, 0, registers);
+                leaf1ecx = registers[2];
+                CPUID (7, 0, registers);
+                leaf7ebx = registers[1];
+                leaf7ecx = registers[2];
+            }
+            // Prefer OpenSSL's view. It masks off features the OS doesn't
+            // support (AVX state saving) and honors OPENSSL_ia32cap.
+            const unsigned int *ia32cap = OPENSSL_ia32cap_loc ();
+            if (ia32cap != 0) {
+                leaf1ecx = ia32cap[1];
+            #if OPENSSL_VERSION_NUMBER >= 0x10100000L
+                leaf7ebx = ia32cap[2];
+                leaf7ecx = ia32cap[3];
+            #endif // OPENSSL_VERSION_NUMBER >= 0x10100000L
+            }
+            pclmulqdq = IsBitSet (leaf1ecx, 1);
+            ssse3 = IsBitSet (leaf1ecx, 9);
+            sse41 = IsBitSet (leaf1ecx, 19);
+            aesni = IsBitSet (leaf1ecx, 25);
+            avx = IsBitSet (leaf1ecx, 28);
+            avx2 = IsBitSet (leaf7ebx, 5);
+            avx512f = IsBitSet (leaf7ebx, 16);
+            shani = IsBitSet (leaf7ebx, 29);
+            vaes = IsBitSet (leaf7ecx, 9);
+            vpclmulqdq = IsBitSet (leaf7ecx, 10);
+        #elif defined (THEKOGANS_CRYPTO_CPU_ARM)
+        #if defined (__aarch64__) || defined (_M_ARM64)
+            architecture = "aarch64";
+        #if defined (TOOLCHAIN_OS_Linux)
+            unsigned long hwcap = getauxval (AT_HWCAP);
+            armAES = (hwcap & (1ul << 3)) != 0;
+            armPMULL = (hwcap & (1ul << 4)) != 0;
+            armSHA1 = (hwcap & (1ul << 5)) != 0;
+            armSHA256 = (hwcap & (1ul << 6)) != 0;
+            armSHA512 = (hwcap & (1ul << 21)) != 0;
+        #elif defined (TOOLCHAIN_OS_OSX) || defined (TOOLCHAIN_OS_Windows)
+            // Every Apple Silicon and Windows on ARM part has the crypto extensions.
+            armAES = armPMULL = armSHA1 = armSHA256 = true;
+        #if defined (TOOLCHAIN_OS_OSX)
+            armSHA512 = true;
+        #endif // defined (TOOLCHAIN_OS_OSX)
+        #endif // defined (TOOLCHAIN_OS_Linux)
+        #else // defined (__aarch64__) || defined (_M_ARM64)
+            architecture = "arm";
+        #if defined (TOOLCHAIN_OS_Linux) && defined (AT_HWCAP2)
+            unsigned long hwcap2 = getauxval (AT_HWCAP2);
+            armAES = (hwcap2 & (1ul << 0)) != 0;
+            armPMULL = (hwcap2 & (1ul << 1)) != 0;
+            armSHA1 = (hwcap2 & (1ul << 2)) != 0;
+            armSHA256 = (hwcap2 & (1ul << 3)) != 0;
+        #endif // defined (TOOLCHAIN_OS_Linux) && defined (AT_HWCAP2)
+        #endif // defined (__aarch64__) || defined (_M_ARM64)
+        #endif // defined (THEKOGANS_CRYPTO_CPU_X86)
+        }
+
+        std::string CPUFeatures::ToString () const {
+            std::string features;
+        #if defined (THEKOGANS_CRYPTO_CPU_X86)
+            features =
+                std::string ("AES-NI: ") + YesNo (aesni) +
+                ", PCLMULQDQ: " + YesNo (pclmulqdq) +
+                ", SSSE3: " + YesNo (ssse3) +
+                ", SSE4.1: " + YesNo (sse41) +
+                ", AVX: " + YesNo (avx) +
+                ", AVX2: " + YesNo (avx2) +
+                ", AVX512F: " + YesNo (avx512f) +
+                ", VAES: " + YesNo (vaes) +
+                ", VPCLMULQDQ: " + YesNo (vpclmulqdq) +
+                ", SHA-NI: " + YesNo (shani);
+        #elif defined (THEKOGANS_CRYPTO_CPU_ARM)
+            features =
+                std::string ("AES: ") + YesNo (armAES) +
+                ", PMULL: " + YesNo (armPMULL) +
+                ", SHA1: " + YesNo (armSHA1) +
+                ", SHA256: " + YesNo (armSHA256) +
+                ", SHA512: " + YesNo (armSHA512);
+        #endif // defined (THEKOGANS_CRYPTO_CPU_X86)
+            std::string aesPath;
+            if (HasAES ()) {
+                aesPath = aesni ?
+                    (vaes && vpclmulqdq && avx512f ?
+                        "AES-NI + VAES/VPCLMULQDQ (AVX512)" :
+                        pclmulqdq ? "AES-NI + PCLMULQDQ" : "AES-NI") :
+                    armPMULL ? "ARMv8 AES + PMULL" : "ARMv8 AES";
+            }
+            else {
+                aesPath = ssse3 ? "software (SSSE3 vector permutation)" :
+                    architecture == "aarch64" ? "software (NEON vector permutation)" :
+                    "software (table based)";
+            }
+            std::string chachaPath =
+                avx512f ? "AVX512" :
+                avx2 ? "AVX2" :
+                ssse3 ? "SSSE3" :
+                architecture == "aarch64" ? "NEON" : "scalar";
+            std::string sha256Path =
+                HasSHA256 () ? (shani ? "SHA-NI" : "ARMv8 SHA256") :
+                avx2 ? "AVX2" :
+                avx ? "AVX" :
+                ssse3 ? "SSSE3" :
+                architecture == "aarch64" ? "NEON" : "scalar";
+            return
+                std::string ("Architecture: ") + architecture + "\n"
+            #if OPENSSL_VERSION_NUMBER >= 0x10100000L
+                "OpenSSL: " + OpenSSL_version (OPENSSL_VERSION) + "\n"
+            #else // OPENSSL_VERSION_NUMBER >= 0x10100000L
+                "OpenSSL: " + SSLeay_version (SSLEAY_VERSION) + "\n"
+            #endif // OPENSSL_VERSION_NUMBER >= 0x10100000L
+                "Features: " + (features.empty () ? std::string ("none detected") : features) + "\n"
+                "AES-GCM/CBC: " + aesPath + "\n"
+                "ChaCha20-Poly1305: " + chachaPath + "\n"
+                "SHA-256: " + sha256Path + "\n"
+                "Preferred AEAD: " + (PreferAESGCM () ? "AES-GCM" : "ChaCha20-Poly1305") + "\n";
+        }
+
+    } // namespace crypto
+} // namespace thekogans
@@ -15,50 +15,605 @@
 // You should have received a copy of the GNU General Public License
 // along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
 
+#include <cstring>
+#include <algorithm>
+#include <string>
+#include "thekogans/util/DefaultAllocator.h"
 #include "thekogans/util/SecureAllocator.h"
+#include "thekogans/util/Array.h"
 #include "thekogans/util/RandomSource.h"
+#include "thekogans/util/Exception.h"
+#include "thekogans/util/Thread.h"
+#include "thekogans/util/OwnerVector.h"
+#include "thekogans/util/SystemInfo.h"
 #include "thekogans/crypto/OpenSSLInit.h"
 #include "thekogans/crypto/OpenSSLUtils.h"
+#include "thekogans/crypto/OpenSSLException.h"
+#include "thekogans/crypto/ConstantTime.h"
 #include "thekogans/crypto/HMAC.h"
 #include "thekogans/crypto/SymmetricKey.h"
+#include "thekogans/crypto/Trace.h"
 #include "thekogans/crypto/Cipher.h"
 
 namespace thekogans {
     namespace crypto {
 
-        Cipher::Cipher (
-                SymmetricKey::SharedPtr key_,
-                const EVP_CIPHER *cipher_,
-                const EVP_MD *md_) :
-                key (key_),
-                cipher (cipher_),
-                md (md_),
-                encryptor (key, cipher),
-                decryptor (key, cipher) {
-            if (key.Get () != 0 && cipher != 0 &&
-                    key->GetKeyLength () == GetCipherKeyLength (cipher)) {
-                if (GetCipherMode (cipher) != EVP_CIPH_GCM_MODE) {
-                    if (md != 0) {
-                        mac.Reset (
-                            new HMAC (
-                                SymmetricKey::FromSecretAndSalt (
-                                    key->Get ().GetReadPtr (),
-                                    key->Get ().GetDataAvailableForReading (),
-                                    0,
-                                    0,
-                                    GetMDLength (md),
-                                    md),
-                                md));
+        namespace {
+            // Size of the pieces the CBC encrypt-then-MAC path works on.
+            // Small enough for the plaintext, ciphertext and digest state
+            // to stay in L1, and a multiple of every cipher block size.
+            const std::size_t MAC_INTERLEAVE_LENGTH = 4096;
+
+            template<typename T>
+            std::size_t GetSegmentsLength (
+                    const T *segments,
+                    std::size_t segmentCount) {
+                std::size_t length = 0;
+                if (segments != 0) {
+                    for (std::size_t i = 0; i < segmentCount; ++i) {
+                        length += segments[i].length;
                     }
-                    else {
+                }
+                return length;
+            }
+
+            // Length of ciphertext produced by encrypting plaintextLength
+            // bytes. Block ciphers (CBC) use PKCS padding.
+            inline std::size_t GetPaddedLength (
+                    const EVP_CIPHER *cipher,
+                    std::size_t plaintextLength) {
+                std::size_t blockSize = (std::size_t)EVP_CIPHER_block_size (cipher);
+                return blockSize > 1 ?
+                    plaintextLength + blockSize - plaintextLength % blockSize :
+                    plaintextLength;
+            }
+
+            enum {
+                GCM_BLOCK_LENGTH = 16,
+                GCM_IV_LENGTH = 12
+            };
+
+            // GF(2^128) element in GCM bit order (NIST SP 800-38D):
+            // block bytes loaded as two big endian halves.
+            struct GHASHBlock {
+                util::ui64 hi;
+                util::ui64 lo;
+
+                GHASHBlock (
+                    util::ui64 hi_ = 0,
+                    util::ui64 lo_ = 0) :
+                    hi (hi_),
+                    lo (lo_) {}
+                explicit GHASHBlock (const util::ui8 *block) :
+                        hi (0),
+                        lo (0) {
+                    for (std::size_t i = 0; i < 8; ++i) {
+                        hi = (hi << 8) | block[i];
+                        lo = (lo << 8) | block[i + 8];
+                    }
+                }
+
+                void Store (util::ui8 *block) const {
+                    for (std::size_t i = 0; i < 8; ++i) {
+                        block[i] = (util::ui8)(hi >> (56 - 8 * i));
+                        block[i + 8] = (util::ui8)(lo >> (56 - 8 * i));
+                    }
+                }
+
+                inline GHASHBlock &operator ^= (const GHASHBlock &block) {
+                    hi ^= block.hi;
+                    lo ^= block.lo;
+                    return *this;
+                }
+            };
+
+            // Bit serial multiply. Only used a handful of times per
+            // message to combine the partial hashes computed by OpenSSL.
+            GHASHBlock Multiply (
+                    const GHASHBlock &x,
+                    const GHASHBlock &y) {
+                GHASHBlock z;
+                GHASHBlock v = y;
+                for (std::size_t i = 0; i < 128; ++i) {
+                    if (((i < 64 ? x.hi >> (63 - i) : x.lo >> (127 - i)) & 1) != 0) {
+                        z ^= v;
+                    }
+                    bool carry = (v.lo & 1) != 0;
+                    v.lo = (v.lo >> 1) | (v.hi << 63);
+                    v.hi >>= 1;
+                    if (carry) {
+                        v.hi ^= 0xe100000000000000ULL;
+                    }
+                }
+                return z;
+            }
+
+            GHASHBlock Power (
+                    GHASHBlock h,
+                    util::ui64 exponent) {
+                // 1 in GCM bit order.
+                GHASHBlock result (0x8000000000000000ULL, 0);
+                while (exponent != 0) {
+                    if ((exponent & 1) != 0) {
+                        result = Multiply (result, h);
+                    }
+                    h = Multiply (h, h);
+                    exponent >>= 1;
+                }
+                return result;
+            }
+
+            // Largest length handed to a single EVP_*Update.
+            const std::size_t MAX_UPDATE_LENGTH = 1 << 30;
+
+            void EncryptBlock (
+                    const EVP_CIPHER *ecb,
+                    const util::ui8 *key,
+                    const util::ui8 *in,
+                    util::ui8 *out) {
+                CipherContext context;
+                util::i32 length = 0;
+                if (EVP_EncryptInit_ex (&context, ecb, 0, key, 0) != 1 ||
+                        EVP_CIPHER_CTX_set_padding (&context, 0) != 1 ||
+                        EVP_EncryptUpdate (&context, out, &length, in, GCM_BLOCK_LENGTH) != 1) {
+                    THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
+                }
+            }
+
+            // CTR half of GCM: counter blocks iv || (2 + firstBlock + i).
+            void EncryptCTR (
+                    const EVP_CIPHER *ctr,
+                    const util::ui8 *key,
+                    const util::ui8 *iv,
+                    util::ui64 firstBlock,
+                    const util::ui8 *plaintext,
+                    std::size_t length,
+                    util::ui8 *ciphertext) {
+                util::ui8 counter[GCM_BLOCK_LENGTH];
+                memcpy (counter, iv, GCM_IV_LENGTH);
+                util::ui32 block = (util::ui32)(firstBlock + 2);
+                for (std::size_t i = GCM_BLOCK_LENGTH; i-- > GCM_IV_LENGTH;) {
+                    counter[i] = (util::ui8)block;
+                    block >>= 8;
+                }
+                CipherContext context;
+                if (EVP_EncryptInit_ex (&context, ctr, 0, key, counter) != 1) {
+                    THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
+                }
+                for (std::size_t offset = 0; offset < length;) {
+                    util::i32 chunkLength = (util::i32)std::min (length - offset, MAX_UPDATE_LENGTH);
+                    util::i32 updateLength = 0;
+                    if (EVP_EncryptUpdate (&context, ciphertext + offset, &updateLength,
+                            plaintext + offset, chunkLength) != 1 || updateLength != chunkLength) {
+                        THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
+                    }
+                    offset += chunkLength;
+                }
+            }
+
+            // GHASH half of GCM. Passing data as associated data (and no
+            // plaintext) makes OpenSSL's (accelerated) GCM compute
+            // tag = GHASH (pad (data) || bitlen (data) || 0) ^ E (J0).
+            GHASHBlock HashData (
+                    const EVP_CIPHER *gcm,
+                    const util::ui8 *key,
+                    const util::ui8 *iv,
+                    const GHASHBlock &encryptedJ0,
+                    const util::ui8 *data,
+                    std::size_t length) {
+                CipherContext context;
+                if (EVP_EncryptInit_ex (&context, gcm, 0, key, iv) != 1) {
+                    THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
+                }
+                for (std::size_t offset = 0; offset < length;) {
+                    util::i32 chunkLength = (util::i32)std::min (length - offset, MAX_UPDATE_LENGTH);
+                    util::i32 updateLength = 0;
+                    if (EVP_EncryptUpdate (&context, 0, &updateLength, data + offset, chunkLength) != 1) {
+                        THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
+                    }
+                    offset += chunkLength;
+                }
+                util::ui8 tag[GCM_BLOCK_LENGTH];
+                util::i32 finalLength = 0;
+                if (EVP_EncryptFinal_ex (&context, tag, &finalLength) != 1 ||
+                        EVP_CIPHER_CTX_ctrl (&context, EVP_CTRL_GCM_GET_TAG, GCM_BLOCK_LENGTH, tag) != 1) {
+                    THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
+                }
+                GHASHBlock hash (tag);
+                hash ^= encryptedJ0;
+                return hash;
+            }
+
+            // Fold the hash of a piece ending at block (1 based) last in
+            // to a message of blockCount blocks (length block included).
+            // hash = H * (piece blocks hashed on their own) + lengthBlock * H,
+            // and the piece's share of the message hash is
+            // H^(blockCount - last) * (piece blocks hashed on their own).
+            void FoldHash (
+                    GHASHBlock &messageHash,
+                    const GHASHBlock &h,
+                    util::ui64 blockCount,
+                    util::ui64 last,
+                    GHASHBlock hash,
+                    std::size_t length) {
+                hash ^= Multiply (GHASHBlock ((util::ui64)length * 8, 0), h);
+                messageHash ^= Multiply (Power (h, blockCount - last - 1), hash);
+            }
+
+            // Return the CTR and ECB flavors of the given AES-GCM cipher
+            // (false == not AES-GCM).
+            bool GetAESCiphers (
+                    const EVP_CIPHER *gcm,
+                    const EVP_CIPHER *&ctr,
+                    const EVP_CIPHER *&ecb) {
+                switch (EVP_CIPHER_nid (gcm)) {
+                    case NID_aes_128_gcm:
+                        ctr = EVP_aes_128_ctr ();
+                        ecb = EVP_aes_128_ecb ();
+                        return true;
+                    case NID_aes_192_gcm:
+                        ctr = EVP_aes_192_ctr ();
+                        ecb = EVP_aes_192_ecb ();
+                        return true;
+                    case NID_aes_256_gcm:
+                        ctr = EVP_aes_256_ctr ();
+                        ecb = EVP_aes_256_ecb ();
+                        return true;
+                }
+                return false;
+            }
+
+            // Encrypts (and hashes) one stripe of a parallel GCM message.
+            struct GCMStripeEncryptor : public util::Thread {
+                const EVP_CIPHER *ctr;
+                const EVP_CIPHER *gcm;
+                const util::ui8 *key;
+                const util::ui8 *iv;
+                GHASHBlock encryptedJ0;
+                const util::ui8 *plaintext;
+                std::size_t length;
+                util::ui64 firstBlock;
+                util::ui8 *ciphertext;
+                GHASHBlock hash;
+                std::string error;
+
+                GCMStripeEncryptor (
+                    const EVP_CIPHER *ctr_,
+                    const EVP_CIPHER *gcm_,
+                    const util::ui8 *key_,
+                    const util::ui8 *iv_,
+                    const GHASHBlock &encryptedJ0_,
+                    const util::ui8 *plaintext_,
+                    std::size_t length_,
+                    util::ui64 firstBlock_,
+                    util::ui8 *ciphertext_) :
+                    ctr (ctr_),
+                    gcm (gcm_),
+                    key (key_),
+                    iv (iv_),
+                    encryptedJ0 (encryptedJ0_),
+                    plaintext (plaintext_),
+                    length (length_),
+                    firstBlock (firstBlock_),
+                    ciphertext (ciphertext_) {}
+
+                void Encrypt () {
+                    EncryptCTR (ctr, key, iv, firstBlock, plaintext, length, ciphertext);
+                    hash = HashData (gcm, key, iv, encryptedJ0, ciphertext, length);
+                }
+
+            protected:
+                // util::Thread
+                virtual void Run () throw () override {
+                    THEKOGANS_UTIL_TRY {
+                        Encrypt ();
+                    }
+                    THEKOGANS_UTIL_CATCH (util::Exception) {
+                        error = exception.Report ();
+                    }
+                }
+            };
+
+            // Decrypts one stripe of a parallel CBC message. Each stripe
+            // is chained off of the ciphertext block that precedes it (the
+            // iv for the first), and only the last one is padded.
+            struct CBCStripeDecryptor : public util::Thread {
+                const EVP_CIPHER *cipher;
+                const util::ui8 *key;
+                const util::ui8 *iv;
+                const util::ui8 *ciphertext;
+                std::size_t length;
+                bool last;
+                util::ui8 *plaintext;
+                std::size_t plaintextLength;
+                std::string error;
+
+                CBCStripeDecryptor (
+                    const EVP_CIPHER *cipher_,
+                    const util::ui8 *key_,
+                    const util::ui8 *iv_,
+                    const util::ui8 *ciphertext_,
+                    std::size_t length_,
+                    bool last_,
+                    util::ui8 *plaintext_) :
+                    cipher (cipher_),
+                    key (key_),
+                    iv (iv_),
+                    ciphertext (ciphertext_),
+                    length (length_),
+                    last (last_),
+                    plaintext (plaintext_),
+                    plaintextLength (0) {}
+
+                void Decrypt () {
+                    CipherContext context;
+                    if (EVP_DecryptInit_ex (&context, cipher, 0, key, iv) != 1 ||
+                            EVP_CIPHER_CTX_set_padding (&context, last ? 1 : 0) != 1) {
+                        THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
+                    }
+                    for (std::size_t offset = 0; offset < length;) {
+                        util::i32 chunkLength = (util::i32)std::min (length - offset, MAX_UPDATE_LENGTH);
+                        util::i32 updateLength = 0;
+                        if (EVP_DecryptUpdate (&context, plaintext + plaintextLength, &updateLength,
+                                ciphertext + offset, chunkLength) != 1) {
+                            THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
+                        }
+                        plaintextLength += updateLength;
+                        offset += chunkLength;
+                    }
+                    util::i32 finalLength = 0;
+                    if (EVP_DecryptFinal_ex (&context, plaintext + plaintextLength, &finalLength) != 1) {
+                        THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
+                    }
+                    plaintextLength += finalLength;
+                }
+
+            protected:
+                // util::Thread
+                virtual void Run () throw () override {
+                    THEKOGANS_UTIL_TRY {
+                        Decrypt ();
+                    }
+                    THEKOGANS_UTIL_CATCH (util::Exception) {
+                        error = exception.Report ();
+                    }
+                }
+            };
+
+            // Verifies the mac of a parallel CBC message while the
+            // stripes are being decrypted.
+            struct MACVerifier : public util::Thread {
+                MAC &mac;
+                const util::ui8 *data;
+                std::size_t length;
+                const util::ui8 *tag;
+                std::size_t tagLength;
+                bool verified;
+                std::string error;
+
+                MACVerifier (
+                    MAC &mac_,
+                    const util::ui8 *data_,
+                    std::size_t length_,
+                    const util::ui8 *tag_,
+                    std::size_t tagLength_) :
+                    mac (mac_),
+                    data (data_),
+                    length (length_),
+                    tag (tag_),
+                    tagLength (tagLength_),
+                    verified (false) {}
+
+            protected:
+                // util::Thread
+                virtual void Run () throw () override {
+                    THEKOGANS_UTIL_TRY {
+                        verified = mac.VerifyBufferSignature (data, length, tag, tagLength);
+                    }
+                    THEKOGANS_UTIL_CATCH (util::Exception) {
+                        error = exception.Report ();
+                    }
+                }
+            };
+
+            // Return the number of threads to split length bytes across
+            // (<= 1 == serial).
+            std::size_t GetStripeCount (
+                    std::size_t threshold,
+                    std::size_t workerCount,
+                    std::size_t length) {
+                if (threshold == 0 || length < threshold) {
+                    return 1;
+                }
+                if (workerCount == 0) {
+                    workerCount = util::SystemInfo::Instance ().GetCPUCount ();
+                }
+                return std::min (workerCount, length / Cipher::MIN_PARALLEL_STRIPE_LENGTH);
+            }
+        }
+
+        /// \struct Cipher::SegmentReader Cipher.cpp thekogans/crypto/Cipher.cpp
+        ///
+        /// \brief
+        /// Sequentially reads from a list of \see{Cipher::ConstSegment}.
+        struct Cipher::SegmentReader {
+            /// \brief
+            /// Segments to read from.
+            const ConstSegment *segments;
+            /// \brief
+            /// Number of segments.
+            std::size_t segmentCount;
+            /// \brief
+            /// Current segment.
+            std::size_t index;
+            /// \brief
+            /// Offset in to the current segment.
+            std::size_t offset;
+
+            /// \brief
+            /// ctor.
+            /// \param[in] segments_ Segments to read from.
+            /// \param[in] segmentCount_ Number of segments.
+            SegmentReader (
+                    const ConstSegment *segments_,
+                    std::size_t segmentCount_) :
+                    segments (segments_),
+                    segmentCount (segmentCount_),
+                    index (0),
+                    offset (0) {
+                Advance (0);
+            }
+
+            /// \brief
+            /// Return the number of contiguous bytes available in the current segment.
+            /// \return Number of contiguous bytes available in the current segment.
+            inline std::size_t GetAvailable () const {
+                return index < segmentCount ? segments[index].length - offset : 0;
+            }
+            /// \brief
+            /// Return the current read position.
+            /// \return Current read position.
+            inline const util::ui8 *GetReadPtr () const {
+                return (const util::ui8 *)segments[index].buffer + offset;
+            }
+            /// \brief
+            /// Advance the read position, skipping over exhausted (and empty) segments.
+            /// \param[in] length Number of bytes to advance.
+            void Advance (std::size_t length) {
+                offset += length;
+                while (index < segmentCount && offset == segments[index].length) {
+                    ++index;
+                    offset = 0;
+                }
+            }
+            /// \brief
+            /// Gather length bytes in to the given buffer.
+            /// \param[out] buffer Where to copy the bytes.
+            /// \param[in] length Number of bytes to copy.
+            void Read (
+                    util::ui8 *buffer,
+                    std::size_t length) {
+                while (length > 0) {
+                    std::size_t available = GetAvailable ();
+                    if (available == 0) {
                         THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
                             THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
                     }
+                    std::size_t chunkLength = std::min (length, available);
+                    memcpy (buffer, GetReadPtr (), chunkLength);
+                    Advance (chunkLength);
+                    buffer += chunkLength;
+                    length -= chunkLength;
                 }
             }
-            else {
-                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
-                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+        };
+
+        /// \struct Cipher::SegmentWriter Cipher.cpp thekogans/crypto/Cipher.cpp
+        ///
+        /// \brief
+        /// Sequentially writes to a list of \see{Cipher::Segment}.
+        struct Cipher::SegmentWriter {
+            /// \brief
+            /// Segments to write to.
+            const Segment *segments;
+            /// \brief
+            /// Number of segments.
+            std::size_t segmentCount;
+            /// \brief
+            /// Current segment.
+            std::size_t index;
+            /// \brief
+            /// Offset in to the current segment.
+            std::size_t offset;
+            /// \brief
+            /// Total number of bytes written.
+            std::size_t totalLength;
+
+            /// \brief
+            /// ctor.
+            /// \param[in] segments_ Segments to write to.
+            /// \param[in] segmentCount_ Number of segments.
+            SegmentWriter (
+                    const Segment *segments_,
+                    std::size_t segmentCount_) :
+                    segments (segments_),
+                    segmentCount (segmentCount_),
+                    index (0),
+                    offset (0),
+                    totalLength (0) {
+                Advance (0);
+            }
+
+            /// \brief
+            /// Return the number of contiguous bytes available in the current segment.
+            /// \return Number of contiguous bytes available in the current segment.
+            inline std::size_t GetAvailable () const {
+                return index < segmentCount ? segments[index].length - offset : 0;
+            }
+            /// \brief
+            /// Return the current write position.
+            /// \return Current write position.
+            inline util::ui8 *GetWritePtr () const {
+                return segments[index].buffer + offset;
+            }
+            /// \brief
+            /// Advance the write position, skipping over exhausted (and empty) segments.
+            /// \param[in] length Number of bytes to advance.
+            void Advance (std::size_t length) {
+                offset += length;
+                totalLength += length;
+                while (index < segmentCount && offset == segments[index].length) {
+                    ++index;
+                    offset = 0;
+                }
+            }
+            /// \brief
+            /// Scatter length bytes from the given buffer.
+            /// \param[in] buffer Bytes to write.
+            /// \param[in] length Number of bytes to write.
+            void Write (
+                    const util::ui8 *buffer,
+                    std::size_t length) {
+                while (length > 0) {
+                    std::size_t available = GetAvailable ();
+                    if (available == 0) {
+                        THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                            THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+                    }
+                    std::size_t chunkLength = std::min (length, available);
+                    memcpy (GetWritePtr (), buffer, chunkLength);
+                    Advance (chunkLength);
+                    buffer += chunkLength;
+                    length -= chunkLength;
+                }
+            }
+        };
+
+        Cipher::Cipher (
+                SymmetricKey::SharedPtr key_,
+                const EVP_CIPHER *cipher_,
+                const EVP_MD *md_,
+                Encryptor::IVPolicy ivPolicy) :
+                key (key_),
+                cipher (cipher_),
+                md (md_),
+                // Throws if key/cipher/md don't go together.
+                schedule (CipherKeySchedule::Get (key, cipher, md)),
+                encryptor (key, schedule->GetEncryptContext (), ivPolicy),
+                decryptor (schedule->GetDecryptContext ()),
+                orderedChannel (false),
+                encryptSequenceNumber (0),
+                decryptSequenceNumber (0),
+                parallelThreshold (0),
+                parallelWorkerCount (0),
+                parallelDecryptThreshold (0),
+                parallelDecryptWorkerCount (0) {
+            metrics.Reset (key->GetId ());
+            // AEAD ciphers (GCM, ChaCha20-Poly1305) produce their own tags.
+            mac = schedule->CloneMAC ();
+            if (mac.Get () != 0) {
+                // Count the CBC MACs against the cipher key.
+                mac->GetMetrics ().Reset (key->GetId ());
             }
         }
 
@@ -80,43 +635,13 @@ namespace thekogans {
             if (plaintext != 0 && plaintextLength > 0 && plaintextLength < MAX_PLAINTEXT_LENGTH &&
                     (IsCipherAEAD (cipher) || (associatedData == 0 && associatedDataLength == 0)) &&
                     ciphertext != 0) {
-                util::ui8 *ivCiphertextAndMAC = ciphertext + CiphertextHeader::SIZE;
-                CiphertextHeader ciphertextHeader;
-                ciphertextHeader.ivLength =
-                    (util::ui16)encryptor.Init (ivCiphertextAndMAC);
-                if (associatedData != 0) {
-                    encryptor.SetAssociatedData (
-                        associatedData,
-                        associatedDataLength);
-                }
-                std::size_t updateLength = encryptor.Update (
+                return EncryptWithIV (
+                    encryptor.Init (ciphertext + CiphertextHeader::SIZE),
                     plaintext,
                     plaintextLength,
-                    ivCiphertextAndMAC + ciphertextHeader.ivLength);
-                std::size_t finalLength = encryptor.Final (
-                    ivCiphertextAndMAC + ciphertextHeader.ivLength + updateLength);
-                ciphertextHeader.ciphertextLength =
-                    (util::ui32)(updateLength + finalLength);
-                if (mac.Get () != 0) {
-                    ciphertextHeader.macLength =
-                        (util::ui16)mac->SignBuffer (
-                            ivCiphertextAndMAC,
-                            ciphertextHeader.ivLength +
-                                ciphertextHeader.ciphertextLength,
-                            ivCiphertextAndMAC +
-                                ciphertextHeader.ivLength +
-                                ciphertextHeader.ciphertextLength);
-                }
-                else {
-                    ciphertextHeader.macLength =
-                        (util::ui16)encryptor.GetTag (
-                            ivCiphertextAndMAC +
-                            ciphertextHeader.ivLength +
-                            ciphertextHeader.ciphertextLength);
-                }
-                util::TenantWriteBuffer buffer (util::NetworkEndian, ciphertext, CiphertextHeader::SIZE);
-                buffer << ciphertextHeader;
-                return CiphertextHeader::SIZE + ciphertextHeader.GetTotalLength ();
+                    associatedData,
+                    associatedDataLength,
+                    ciphertext);
             }
             else {
                 THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
@@ -128,10 +653,16 @@ namespace thekogans {
                 const void *plaintext,
                 std::size_t plaintextLength,
                 const void *associatedData,
-                std::size_t associatedDataLength) {
+                std::size_t associatedDataLength,
+                util::Allocator *allocator) {
             if (plaintext != 0 && plaintextLength > 0 && plaintextLength < MAX_PLAINTEXT_LENGTH &&
                     (IsCipherAEAD (cipher) || (associatedData == 0 && associatedDataLength == 0))) {
-                util::Buffer ciphertext (util::NetworkEndian, GetMaxBufferLength (plaintextLength));
+                util::Buffer ciphertext (
+                    util::NetworkEndian,
+                    GetMaxBufferLength (plaintextLength),
+                    0,
+                    0,
+                    allocator != 0 ? allocator : &util::DefaultAllocator::Instance ());
                 ciphertext.AdvanceWriteOffset (
                     Encrypt (
                         plaintext,
@@ -176,10 +707,16 @@ namespace thekogans {
                 const void *plaintext,
                 std::size_t plaintextLength,
                 const void *associatedData,
-                std::size_t associatedDataLength) {
+                std::size_t associatedDataLength,
+                util::Allocator *allocator) {
             if (plaintext != 0 && plaintextLength > 0 && plaintextLength < MAX_PLAINTEXT_LENGTH &&
                     (IsCipherAEAD (cipher) || (associatedData == 0 && associatedDataLength == 0))) {
-                util::Buffer ciphertext (util::NetworkEndian, GetMaxBufferLength (plaintextLength));
+                util::Buffer ciphertext (
+                    util::NetworkEndian,
+                    GetMaxBufferLength (plaintextLength),
+                    0,
+                    0,
+                    allocator != 0 ? allocator : &util::DefaultAllocator::Instance ());
                 ciphertext.AdvanceWriteOffset (
                     EncryptAndEnlengthen (
                         plaintext,
@@ -224,10 +761,16 @@ namespace thekogans {
                 const void *plaintext,
                 std::size_t plaintextLength,
                 const void *associatedData,
-                std::size_t associatedDataLength) {
+                std::size_t associatedDataLength,
+                util::Allocator *allocator) {
             if (plaintext != 0 && plaintextLength > 0 && plaintextLength < MAX_PLAINTEXT_LENGTH &&
                     (IsCipherAEAD (cipher) || (associatedData == 0 && associatedDataLength == 0))) {
-                util::Buffer ciphertext (util::NetworkEndian, GetMaxBufferLength (plaintextLength));
+                util::Buffer ciphertext (
+                    util::NetworkEndian,
+                    GetMaxBufferLength (plaintextLength),
+                    0,
+                    0,
+                    allocator != 0 ? allocator : &util::DefaultAllocator::Instance ());
                 ciphertext.AdvanceWriteOffset (
                     EncryptAndFrame (
                         plaintext,
@@ -249,44 +792,25 @@ namespace thekogans {
                 const void *associatedData,
                 std::size_t associatedDataLength,
                 util::ui8 *plaintext) {
+            THEKOGANS_CRYPTO_TRACE_SCOPE (OPERATION_DECRYPT, key->GetId (), 0, ciphertextLength);
+            metrics.Update (Metrics::OPERATION_DECRYPT, ciphertextLength);
             if (ciphertext != 0 && ciphertextLength > 0 &&
                     (IsCipherAEAD (cipher) || (associatedData == 0 && associatedDataLength == 0)) &&
                     plaintext != 0) {
                 util::TenantReadBuffer buffer (util::NetworkEndian, ciphertext, ciphertextLength);
                 CiphertextHeader ciphertextHeader;
                 buffer >> ciphertextHeader;
-                // If we're in CBC mode, verify the MAC before attempting to
-                // decrypt, as per the Cryptographic Doom Principle:
-                // https://moxie.org/blog/the-cryptographic-doom-principle/
-                if (mac.Get () != 0 &&
-                        !mac->VerifyBufferSignature (
-                            buffer.GetReadPtr (),
-                            ciphertextHeader.ivLength +
-                                ciphertextHeader.ciphertextLength,
-                            buffer.GetReadPtr () +
-                                ciphertextHeader.ivLength +
-                                ciphertextHeader.ciphertextLength,
-                            ciphertextHeader.macLength)) {
-                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
-                        "%s", "Ciphertext failed mac verifacion.");
-                }
-                decryptor.Init (buffer.GetReadPtr ());
-                buffer.AdvanceReadOffset (ciphertextHeader.ivLength);
-                if (associatedData != 0 && associatedDataLength > 0) {
-                    decryptor.SetAssociatedData (associatedData, associatedDataLength);
+                // Reject forged headers before touching (or authenticating) the payload.
+                if (!IsValidCiphertextHeader (ciphertextHeader, buffer.GetDataAvailableForReading ())) {
+                    THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                        THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
                 }
-                std::size_t updateLength = decryptor.Update (
+                return DecryptWithHeader (
+                    ciphertextHeader,
                     buffer.GetReadPtr (),
-                    ciphertextHeader.ciphertextLength,
+                    associatedData,
+                    associatedDataLength,
                     plaintext);
-                buffer.AdvanceReadOffset (ciphertextHeader.ciphertextLength);
-                if (mac.Get () == 0) {
-                    decryptor.SetTag (
-                        buffer.GetReadPtr (),
-                        ciphertextHeader.macLength);
-                }
-                std::size_t finalLength = decryptor.Final (plaintext + updateLength);
-                return updateLength + finalLength;
             }
             else {
                 THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
@@ -300,12 +824,19 @@ namespace thekogans {
                 const void *associatedData,
                 std::size_t associatedDataLength,
                 bool secure,
-                util::Endianness endianness) {
+                util::Endianness endianness,
+                util::Allocator *allocator) {
             if (ciphertext != 0 && ciphertextLength > 0 &&
                     (IsCipherAEAD (cipher) || (associatedData == 0 && associatedDataLength == 0))) {
-                util::Buffer plaintext = secure ?
-                    util::SecureBuffer (endianness, ciphertextLength) :
-                    util::Buffer (endianness, ciphertextLength);
+                util::Buffer plaintext (
+                    endianness,
+                    ciphertextLength,
+                    0,
+                    0,
+                    allocator != 0 ? allocator :
+                        secure ?
+                            (util::Allocator *)&util::SecureAllocator::Instance () :
+                            (util::Allocator *)&util::DefaultAllocator::Instance ());
                 plaintext.AdvanceWriteOffset (
                     Decrypt (
                         ciphertext,
@@ -321,5 +852,1067 @@ namespace thekogans {
             }
         }
 
+        std::size_t Cipher::EncryptAndFrameCompact (
+                util::ui32 keyHandle,
+                const void *plaintext,
+                std::size_t plaintextLength,
+                const void *associatedData,
+                std::size_t associatedDataLength,
+                util::ui8 *ciphertext) {
+            if (plaintext != 0 && plaintextLength > 0 && plaintextLength < MAX_PLAINTEXT_LENGTH &&
+                    (IsCipherAEAD (cipher) || (associatedData == 0 && associatedDataLength == 0)) &&
+                    ciphertext != 0) {
+                // Encrypt far enough in that the largest compact header fits, then
+                // drop the CiphertextHeader and slide the payload up against the
+                // real (usually 2 byte) header. For small messages the move is
+                // cheaper than working out the padded length up front.
+                util::ui8 *encrypted = ciphertext + CompactFrameHeader::MAX_SIZE - CiphertextHeader::SIZE;
+                std::size_t encryptedLength = Encrypt (
+                    plaintext,
+                    plaintextLength,
+                    associatedData,
+                    associatedDataLength,
+                    encrypted) - CiphertextHeader::SIZE;
+                CompactFrameHeader frameHeader (keyHandle, (util::ui32)encryptedLength);
+                std::size_t frameHeaderSize = frameHeader.Size ();
+                util::TenantWriteBuffer buffer (util::NetworkEndian, ciphertext, frameHeaderSize);
+                buffer << frameHeader;
+                memmove (
+                    ciphertext + frameHeaderSize,
+                    encrypted + CiphertextHeader::SIZE,
+                    encryptedLength);
+                return frameHeaderSize + encryptedLength;
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        util::Buffer Cipher::EncryptAndFrameCompact (
+                util::ui32 keyHandle,
+                const void *plaintext,
+                std::size_t plaintextLength,
+                const void *associatedData,
+                std::size_t associatedDataLength,
+                util::Allocator *allocator) {
+            if (plaintext != 0 && plaintextLength > 0 && plaintextLength < MAX_PLAINTEXT_LENGTH &&
+                    (IsCipherAEAD (cipher) || (associatedData == 0 && associatedDataLength == 0))) {
+                util::Buffer ciphertext (
+                    util::NetworkEndian,
+                    GetMaxBufferLength (plaintextLength),
+                    0,
+                    0,
+                    allocator != 0 ? allocator : &util::DefaultAllocator::Instance ());
+                ciphertext.AdvanceWriteOffset (
+                    EncryptAndFrameCompact (
+                        keyHandle,
+                        plaintext,
+                        plaintextLength,
+                        associatedData,
+                        associatedDataLength,
+                        ciphertext.GetWritePtr ()));
+                return ciphertext;
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        std::size_t Cipher::GetCompactOverhead () const {
+            return encryptor.GetIVLength () +
+                (mac.Get () != 0 ? mac->GetMACLength () : (std::size_t)EVP_GCM_TLS_TAG_LEN);
+        }
+
+        bool Cipher::IsValidCiphertextHeader (
+                const CiphertextHeader &ciphertextHeader,
+                std::size_t maxPayloadLength) const {
+            if (mac.Get () != 0) {
+                std::size_t blockSize = (std::size_t)EVP_CIPHER_block_size (cipher);
+                if (blockSize > 1 && ciphertextHeader.ciphertextLength % blockSize != 0) {
+                    return false;
+                }
+            }
+            return ciphertextHeader.IsValid (
+                    (util::ui32)std::min (maxPayloadLength, (std::size_t)util::UI32_MAX)) &&
+                ciphertextHeader.ivLength == encryptor.GetIVLength () &&
+                ciphertextHeader.macLength ==
+                    (mac.Get () != 0 ? mac->GetMACLength () : (std::size_t)EVP_GCM_TLS_TAG_LEN);
+        }
+
+        std::size_t Cipher::DecryptCompact (
+                const void *ciphertext,
+                std::size_t ciphertextLength,
+                const void *associatedData,
+                std::size_t associatedDataLength,
+                util::ui8 *plaintext) {
+            THEKOGANS_CRYPTO_TRACE_SCOPE (OPERATION_DECRYPT, key->GetId (), 0, ciphertextLength);
+            metrics.Update (Metrics::OPERATION_DECRYPT, ciphertextLength);
+            std::size_t overhead = GetCompactOverhead ();
+            if (ciphertext != 0 && ciphertextLength > overhead &&
+                    (IsCipherAEAD (cipher) || (associatedData == 0 && associatedDataLength == 0)) &&
+                    plaintext != 0) {
+                CiphertextHeader ciphertextHeader;
+                ciphertextHeader.ivLength = (util::ui16)encryptor.GetIVLength ();
+                ciphertextHeader.ciphertextLength = (util::ui32)(ciphertextLength - overhead);
+                ciphertextHeader.macLength = (util::ui16)(overhead - ciphertextHeader.ivLength);
+                if (!IsValidCiphertextHeader (ciphertextHeader, ciphertextLength)) {
+                    THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                        THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+                }
+                return DecryptWithHeader (
+                    ciphertextHeader,
+                    (const util::ui8 *)ciphertext,
+                    associatedData,
+                    associatedDataLength,
+                    plaintext);
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        void Cipher::EnableParallelEncrypt (
+                std::size_t threshold,
+                std::size_t workerCount) {
+            const EVP_CIPHER *ctr;
+            const EVP_CIPHER *ecb;
+            if (threshold == 0 || GetAESCiphers (cipher, ctr, ecb)) {
+                parallelThreshold = threshold;
+                parallelWorkerCount = workerCount;
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        void Cipher::EnableParallelDecrypt (
+                std::size_t threshold,
+                std::size_t workerCount) {
+            if (threshold == 0 ||
+                    (mac.Get () != 0 && EVP_CIPHER_mode (cipher) == EVP_CIPH_CBC_MODE)) {
+                parallelDecryptThreshold = threshold;
+                parallelDecryptWorkerCount = workerCount;
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        void Cipher::EnableOrderedChannel (
+                const void *encryptSalt_,
+                const void *decryptSalt_,
+                std::size_t saltLength) {
+            if (IsCipherAEAD (cipher) && encryptSalt_ != 0 && decryptSalt_ != 0 &&
+                    saltLength == encryptor.GetIVLength () &&
+                    saltLength >= util::UI64_SIZE && saltLength <= EVP_MAX_IV_LENGTH) {
+                // Equal salts would have both directions walk the same iv sequence.
+                if (memcmp (encryptSalt_, decryptSalt_, saltLength) == 0) {
+                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                        "Ordered channel encrypt and decrypt salts must differ (key %s).",
+                        key->GetId ().ToHexString ().c_str ());
+                }
+                // Re-enabling would reset the sequence numbers and reuse ivs.
+                if (orderedChannel) {
+                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                        "Ordered channel already enabled (key %s).",
+                        key->GetId ().ToHexString ().c_str ());
+                }
+                if (encryptor.GetStats ().GetUseCount () > 0) {
+                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                        "Cipher already encrypted with random ivs (key %s).",
+                        key->GetId ().ToHexString ().c_str ());
+                }
+                if (!key->ClaimOrderedChannelSalt (encryptSalt_, saltLength)) {
+                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                        "Ordered channel encrypt salt already claimed, or counter ivs "
+                        "already drawn, on key %s.",
+                        key->GetId ().ToHexString ().c_str ());
+                }
+                memcpy (encryptSalt, encryptSalt_, saltLength);
+                memcpy (decryptSalt, decryptSalt_, saltLength);
+                encryptSequenceNumber = 0;
+                decryptSequenceNumber = 0;
+                orderedChannel = true;
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        std::size_t Cipher::EncryptAndFrameOrdered (
+                const void *plaintext,
+                std::size_t plaintextLength,
+                const void *associatedData,
+                std::size_t associatedDataLength,
+                util::ui8 *ciphertext) {
+            if (orderedChannel && plaintext != 0 && plaintextLength > 0 &&
+                    plaintextLength < MAX_PLAINTEXT_LENGTH && ciphertext != 0) {
+                // Never let the sequence number (and with it the iv) wrap.
+                if (encryptSequenceNumber == util::UI64_MAX) {
+                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                        "Ordered channel sequence number exhausted for key %s, rekey.",
+                        key->GetId ().ToHexString ().c_str ());
+                }
+                THEKOGANS_CRYPTO_TRACE_SCOPE (OPERATION_ENCRYPT, key->GetId (), 0, plaintextLength);
+                metrics.Update (Metrics::OPERATION_ENCRYPT, plaintextLength);
+                util::ui8 iv[EVP_MAX_IV_LENGTH];
+                GetOrderedIV (encryptSalt, encryptSequenceNumber, iv);
+                encryptor.InitWithIV (iv);
+                if (associatedData != 0 && associatedDataLength > 0) {
+                    encryptor.SetAssociatedData (associatedData, associatedDataLength);
+                }
+                util::ui8 *out = ciphertext + util::UI32_SIZE;
+                std::size_t ciphertextLength = encryptor.Update (plaintext, plaintextLength, out);
+                ciphertextLength += encryptor.Final (out + ciphertextLength);
+                ciphertextLength += encryptor.GetTag (out + ciphertextLength);
+                util::TenantWriteBuffer buffer (util::NetworkEndian, ciphertext, util::UI32_SIZE);
+                buffer << (util::ui32)ciphertextLength;
+                ++encryptSequenceNumber;
+                return util::UI32_SIZE + ciphertextLength;
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        util::Buffer Cipher::EncryptAndFrameOrdered (
+                const void *plaintext,
+                std::size_t plaintextLength,
+                const void *associatedData,
+                std::size_t associatedDataLength,
+                util::Allocator *allocator) {
+            if (orderedChannel && plaintext != 0 && plaintextLength > 0 &&
+                    plaintextLength < MAX_PLAINTEXT_LENGTH) {
+                util::Buffer ciphertext (
+                    util::NetworkEndian,
+                    GetMaxBufferLength (plaintextLength),
+                    0,
+                    0,
+                    allocator != 0 ? allocator : &util::DefaultAllocator::Instance ());
+                ciphertext.AdvanceWriteOffset (
+                    EncryptAndFrameOrdered (
+                        plaintext,
+                        plaintextLength,
+                        associatedData,
+                        associatedDataLength,
+                        ciphertext.GetWritePtr ()));
+                return ciphertext;
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        std::size_t Cipher::DecryptOrdered (
+                const void *ciphertext,
+                std::size_t ciphertextLength,
+                const void *associatedData,
+                std::size_t associatedDataLength,
+                util::ui8 *plaintext) {
+            THEKOGANS_CRYPTO_TRACE_SCOPE (OPERATION_DECRYPT, key->GetId (), 0, ciphertextLength);
+            metrics.Update (Metrics::OPERATION_DECRYPT, ciphertextLength);
+            if (orderedChannel && ciphertext != 0 &&
+                    ciphertextLength > EVP_GCM_TLS_TAG_LEN && plaintext != 0) {
+                util::ui8 iv[EVP_MAX_IV_LENGTH];
+                GetOrderedIV (decryptSalt, decryptSequenceNumber, iv);
+                decryptor.Init (iv);
+                if (associatedData != 0 && associatedDataLength > 0) {
+                    decryptor.SetAssociatedData (associatedData, associatedDataLength);
+                }
+                std::size_t payloadLength = ciphertextLength - EVP_GCM_TLS_TAG_LEN;
+                std::size_t plaintextLength = decryptor.Update (
+                    ciphertext,
+                    payloadLength,
+                    plaintext);
+                decryptor.SetTag (
+                    (const util::ui8 *)ciphertext + payloadLength,
+                    EVP_GCM_TLS_TAG_LEN);
+                // Final throws if the tag (and with it the sequence number) doesn't match.
+                plaintextLength += decryptor.Final (plaintext + plaintextLength);
+                ++decryptSequenceNumber;
+                return plaintextLength;
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        std::size_t Cipher::GetInPlaceHeadroom (bool frame) const {
+            return (frame ? FrameHeader::SIZE : 0) +
+                CiphertextHeader::SIZE +
+                encryptor.GetIVLength ();
+        }
+
+        std::size_t Cipher::GetInPlaceTailroom () const {
+            std::size_t blockSize = (std::size_t)EVP_CIPHER_block_size (cipher);
+            return (blockSize > 1 ? blockSize : 0) +
+                (mac.Get () != 0 ? mac->GetMACLength () : EVP_GCM_TLS_TAG_LEN);
+        }
+
+        std::size_t Cipher::EncryptInPlace (
+                util::ui8 *buffer,
+                std::size_t bufferLength,
+                std::size_t plaintextLength,
+                const void *associatedData,
+                std::size_t associatedDataLength,
+                bool frame) {
+            std::size_t headroom = GetInPlaceHeadroom (frame);
+            if (buffer != 0 && plaintextLength > 0 && plaintextLength < MAX_PLAINTEXT_LENGTH &&
+                    bufferLength >= headroom + plaintextLength + GetInPlaceTailroom () &&
+                    (IsCipherAEAD (cipher) || (associatedData == 0 && associatedDataLength == 0))) {
+                // OpenSSL supports fully overlapping (in == out) encryption.
+                // Since the plaintext was placed immediately after the iv,
+                // the layout produced by EncryptWithIV falls out naturally.
+                util::ui8 *ciphertext = frame ? buffer + FrameHeader::SIZE : buffer;
+                util::ui8 *plaintext = buffer + headroom;
+                std::size_t ciphertextLength = EncryptWithIV (
+                    encryptor.Init (ciphertext + CiphertextHeader::SIZE),
+                    plaintext,
+                    plaintextLength,
+                    associatedData,
+                    associatedDataLength,
+                    ciphertext);
+                if (frame) {
+                    util::TenantWriteBuffer frameBuffer (util::NetworkEndian, buffer, FrameHeader::SIZE);
+                    frameBuffer << FrameHeader (key->GetId (), (util::ui32)ciphertextLength);
+                    ciphertextLength += FrameHeader::SIZE;
+                }
+                return ciphertextLength;
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        std::size_t Cipher::DecryptInPlace (
+                util::ui8 *ciphertext,
+                std::size_t ciphertextLength,
+                const void *associatedData,
+                std::size_t associatedDataLength,
+                util::ui8 *&plaintext) {
+            THEKOGANS_CRYPTO_TRACE_SCOPE (OPERATION_DECRYPT, key->GetId (), 0, ciphertextLength);
+            metrics.Update (Metrics::OPERATION_DECRYPT, ciphertextLength);
+            if (ciphertext != 0 && ciphertextLength > CiphertextHeader::SIZE &&
+                    (IsCipherAEAD (cipher) || (associatedData == 0 && associatedDataLength == 0))) {
+                CiphertextHeader ciphertextHeader;
+                {
+                    util::TenantReadBuffer buffer (util::NetworkEndian, ciphertext, CiphertextHeader::SIZE);
+                    buffer >> ciphertextHeader;
+                }
+                if (!IsValidCiphertextHeader (
+                        ciphertextHeader, ciphertextLength - CiphertextHeader::SIZE)) {
+                    THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                        THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+                }
+                const util::ui8 *iv = ciphertext + CiphertextHeader::SIZE;
+                util::ui8 *payload = ciphertext + CiphertextHeader::SIZE + ciphertextHeader.ivLength;
+                const util::ui8 *tag = payload + ciphertextHeader.ciphertextLength;
+                // If we're in CBC mode, verify the MAC before attempting to
+                // decrypt, as per the Cryptographic Doom Principle:
+                // https://moxie.org/blog/the-cryptographic-doom-principle/
+                if (mac.Get () != 0 &&
+                        !mac->VerifyBufferSignature (
+                            iv,
+                            ciphertextHeader.ivLength +
+                                ciphertextHeader.ciphertextLength,
+                            tag,
+                            ciphertextHeader.macLength)) {
+                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                        "%s", "Ciphertext failed mac verifacion.");
+                }
+                decryptor.Init (iv);
+                if (associatedData != 0 && associatedDataLength > 0) {
+                    decryptor.SetAssociatedData (associatedData, associatedDataLength);
+                }
+                // NOTE: A single call to Update is what makes this safe in CBC
+                // mode. The decryptor holds back the last (padded) block and
+                // Final writes it right where its ciphertext used to be.
+                std::size_t updateLength = decryptor.Update (
+                    payload,
+                    ciphertextHeader.ciphertextLength,
+                    payload);
+                if (mac.Get () == 0) {
+                    decryptor.SetTag (tag, ciphertextHeader.macLength);
+                }
+                std::size_t finalLength = decryptor.Final (payload + updateLength);
+                plaintext = payload;
+                return updateLength + finalLength;
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        std::size_t Cipher::Encrypt (
+                const ConstSegment *plaintext,
+                std::size_t plaintextCount,
+                const ConstSegment *associatedData,
+                std::size_t associatedDataCount,
+                const Segment *ciphertext,
+                std::size_t ciphertextCount) {
+            std::size_t plaintextLength = GetSegmentsLength (plaintext, plaintextCount);
+            if (plaintextLength > 0 && plaintextLength < MAX_PLAINTEXT_LENGTH &&
+                    (IsCipherAEAD (cipher) || (associatedData == 0 && associatedDataCount == 0)) &&
+                    ciphertext != 0 && ciphertextCount > 0) {
+                SegmentWriter writer (ciphertext, ciphertextCount);
+                return EncryptSegments (
+                    plaintext,
+                    plaintextCount,
+                    associatedData,
+                    associatedDataCount,
+                    false,
+                    writer);
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        std::size_t Cipher::EncryptAndFrame (
+                const ConstSegment *plaintext,
+                std::size_t plaintextCount,
+                const ConstSegment *associatedData,
+                std::size_t associatedDataCount,
+                const Segment *ciphertext,
+                std::size_t ciphertextCount) {
+            std::size_t plaintextLength = GetSegmentsLength (plaintext, plaintextCount);
+            if (plaintextLength > 0 && plaintextLength < MAX_PLAINTEXT_LENGTH &&
+                    (IsCipherAEAD (cipher) || (associatedData == 0 && associatedDataCount == 0)) &&
+                    ciphertext != 0 && ciphertextCount > 0) {
+                SegmentWriter writer (ciphertext, ciphertextCount);
+                return EncryptSegments (
+                    plaintext,
+                    plaintextCount,
+                    associatedData,
+                    associatedDataCount,
+                    true,
+                    writer);
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        std::size_t Cipher::Decrypt (
+                const ConstSegment *ciphertext,
+                std::size_t ciphertextCount,
+                const ConstSegment *associatedData,
+                std::size_t associatedDataCount,
+                const Segment *plaintext,
+                std::size_t plaintextCount) {
+            std::size_t ciphertextLength = GetSegmentsLength (ciphertext, ciphertextCount);
+            THEKOGANS_CRYPTO_TRACE_SCOPE (OPERATION_DECRYPT, key->GetId (), 0, ciphertextLength);
+            metrics.Update (Metrics::OPERATION_DECRYPT, ciphertextLength);
+            if (ciphertextLength > CiphertextHeader::SIZE &&
+                    (IsCipherAEAD (cipher) || (associatedData == 0 && associatedDataCount == 0)) &&
+                    plaintext != 0 && plaintextCount > 0) {
+                SegmentReader reader (ciphertext, ciphertextCount);
+                CiphertextHeader ciphertextHeader;
+                {
+                    util::ui8 header[CiphertextHeader::SIZE];
+                    reader.Read (header, CiphertextHeader::SIZE);
+                    util::TenantReadBuffer buffer (util::NetworkEndian, header, CiphertextHeader::SIZE);
+                    buffer >> ciphertextHeader;
+                }
+                if (!IsValidCiphertextHeader (
+                        ciphertextHeader, ciphertextLength - CiphertextHeader::SIZE) ||
+                        ciphertextHeader.ivLength > EVP_MAX_IV_LENGTH ||
+                        ciphertextHeader.macLength > EVP_MAX_MD_SIZE) {
+                    THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                        THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+                }
+                util::ui8 iv[EVP_MAX_IV_LENGTH];
+                reader.Read (iv, ciphertextHeader.ivLength);
+                util::ui8 tag[EVP_MAX_MD_SIZE];
+                // If we're in CBC mode, verify the MAC before attempting to
+                // decrypt, as per the Cryptographic Doom Principle:
+                // https://moxie.org/blog/the-cryptographic-doom-principle/
+                if (mac.Get () != 0) {
+                    mac->Init ();
+                    mac->Update (iv, ciphertextHeader.ivLength);
+                    SegmentReader macReader = reader;
+                    for (std::size_t length = ciphertextHeader.ciphertextLength; length > 0;) {
+                        std::size_t chunkLength = std::min (length, macReader.GetAvailable ());
+                        mac->Update (macReader.GetReadPtr (), chunkLength);
+                        macReader.Advance (chunkLength);
+                        length -= chunkLength;
+                    }
+                    macReader.Read (tag, ciphertextHeader.macLength);
+                    util::ui8 computedTag[EVP_MAX_MD_SIZE];
+                    if (mac->Final (computedTag) != ciphertextHeader.macLength ||
+                            !TimeInsensitiveCompare (tag, computedTag, ciphertextHeader.macLength)) {
+                        THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                            "%s", "Ciphertext failed mac verifacion.");
+                    }
+                }
+                decryptor.Init (iv);
+                for (std::size_t i = 0; i < associatedDataCount; ++i) {
+                    if (associatedData[i].length > 0) {
+                        decryptor.SetAssociatedData (
+                            associatedData[i].buffer,
+                            associatedData[i].length);
+                    }
+                }
+                SegmentWriter writer (plaintext, plaintextCount);
+                // Decrypting n bytes can produce up to n + blockSize
+                // bytes (the decryptor holds back the last block).
+                std::size_t blockSize = (std::size_t)EVP_CIPHER_block_size (cipher);
+                std::size_t slack = blockSize > 1 ? blockSize : 0;
+                util::ui8 staging[2 * EVP_MAX_BLOCK_LENGTH];
+                for (std::size_t length = ciphertextHeader.ciphertextLength; length > 0;) {
+                    std::size_t chunkLength = std::min (length, reader.GetAvailable ());
+                    std::size_t available = writer.GetAvailable ();
+                    if (available > slack) {
+                        chunkLength = std::min (chunkLength, available - slack);
+                        writer.Advance (
+                            decryptor.Update (reader.GetReadPtr (), chunkLength, writer.GetWritePtr ()));
+                    }
+                    else {
+                        chunkLength = std::min (chunkLength, (std::size_t)EVP_MAX_BLOCK_LENGTH);
+                        writer.Write (
+                            staging,
+                            decryptor.Update (reader.GetReadPtr (), chunkLength, staging));
+                    }
+                    reader.Advance (chunkLength);
+                    length -= chunkLength;
+                }
+                if (mac.Get () == 0) {
+                    reader.Read (tag, ciphertextHeader.macLength);
+                    decryptor.SetTag (tag, ciphertextHeader.macLength);
+                }
+                writer.Write (staging, decryptor.Final (staging));
+                return writer.totalLength;
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        std::size_t Cipher::EncryptBatch (
+                EncryptBatchItem *items,
+                std::size_t itemCount) {
+            if (items != 0 && itemCount > 0) {
+                for (std::size_t i = 0; i < itemCount; ++i) {
+                    if (items[i].plaintext == 0 || items[i].plaintextLength == 0 ||
+                            items[i].plaintextLength >= MAX_PLAINTEXT_LENGTH ||
+                            (!IsCipherAEAD (cipher) &&
+                                (items[i].associatedData != 0 || items[i].associatedDataLength != 0)) ||
+                            items[i].ciphertext == 0) {
+                        THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                            THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+                    }
+                }
+                if (encryptor.GetIVPolicy () == Encryptor::IV_POLICY_COUNTER) {
+                    std::size_t totalLength = 0;
+                    for (std::size_t i = 0; i < itemCount; ++i) {
+                        items[i].ciphertextLength = EncryptWithIV (
+                            encryptor.Init (items[i].ciphertext + CiphertextHeader::SIZE),
+                            items[i].plaintext,
+                            items[i].plaintextLength,
+                            items[i].associatedData,
+                            items[i].associatedDataLength,
+                            items[i].ciphertext);
+                        totalLength += items[i].ciphertextLength;
+                    }
+                    return totalLength;
+                }
+                // Generate all the ivs in one shot. This amortizes the
+                // cost of calling in to the random source over the batch.
+                std::size_t ivLength = encryptor.GetIVLength ();
+                std::size_t ivsLength = ivLength * itemCount;
+                util::Array<util::ui8> ivs (ivsLength);
+                if (util::GlobalRandomSource::Instance ().GetBytes (ivs.array, ivsLength) != ivsLength) {
+                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                        "Unable to get " THEKOGANS_UTIL_SIZE_T_FORMAT " random bytes for ivs.",
+                        ivsLength);
+                }
+                std::size_t totalLength = 0;
+                for (std::size_t i = 0; i < itemCount; ++i) {
+                    const util::ui8 *iv = ivs.array + i * ivLength;
+                    memcpy (items[i].ciphertext + CiphertextHeader::SIZE, iv, ivLength);
+                    items[i].ciphertextLength = EncryptWithIV (
+                        encryptor.InitWithIV (iv),
+                        items[i].plaintext,
+                        items[i].plaintextLength,
+                        items[i].associatedData,
+                        items[i].associatedDataLength,
+                        items[i].ciphertext);
+                    totalLength += items[i].ciphertextLength;
+                }
+                return totalLength;
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        std::size_t Cipher::DecryptBatch (
+                DecryptBatchItem *items,
+                std::size_t itemCount) {
+            if (items != 0 && itemCount > 0) {
+                std::size_t totalLength = 0;
+                for (std::size_t i = 0; i < itemCount; ++i) {
+                    items[i].plaintextLength = Decrypt (
+                        items[i].ciphertext,
+                        items[i].ciphertextLength,
+                        items[i].associatedData,
+                        items[i].associatedDataLength,
+                        items[i].plaintext);
+                    totalLength += items[i].plaintextLength;
+                }
+                return totalLength;
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        std::size_t Cipher::EncryptSegments (
+                const ConstSegment *plaintext,
+                std::size_t plaintextCount,
+                const ConstSegment *associatedData,
+                std::size_t associatedDataCount,
+                bool frame,
+                SegmentWriter &ciphertext) {
+            std::size_t plaintextLength = GetSegmentsLength (plaintext, plaintextCount);
+            THEKOGANS_CRYPTO_TRACE_SCOPE (OPERATION_ENCRYPT, key->GetId (), 0, plaintextLength);
+            metrics.Update (Metrics::OPERATION_ENCRYPT, plaintextLength);
+            // Since the lengths of all the pieces are known up front,
+            // the headers can be written before the ciphertext.
+            util::ui8 iv[EVP_MAX_IV_LENGTH];
+            CiphertextHeader ciphertextHeader (
+                (util::ui16)encryptor.Init (iv),
+                (util::ui32)GetPaddedLength (cipher, plaintextLength),
+                (util::ui16)(mac.Get () != 0 ? mac->GetMACLength () : EVP_GCM_TLS_TAG_LEN));
+            {
+                util::ui8 header[FrameHeader::SIZE + CiphertextHeader::SIZE];
+                util::TenantWriteBuffer buffer (
+                    util::NetworkEndian,
+                    header,
+                    FrameHeader::SIZE + CiphertextHeader::SIZE);
+                if (frame) {
+                    buffer << FrameHeader (
+                        key->GetId (),
+                        CiphertextHeader::SIZE + ciphertextHeader.GetTotalLength ());
+                }
+                buffer << ciphertextHeader;
+                ciphertext.Write (header, buffer.GetDataAvailableForReading ());
+            }
+            ciphertext.Write (iv, ciphertextHeader.ivLength);
+            if (mac.Get () != 0) {
+                mac->Init ();
+                mac->Update (iv, ciphertextHeader.ivLength);
+            }
+            for (std::size_t i = 0; i < associatedDataCount; ++i) {
+                if (associatedData[i].length > 0) {
+                    encryptor.SetAssociatedData (
+                        associatedData[i].buffer,
+                        associatedData[i].length);
+                }
+            }
+            // Encrypting n bytes can produce up to n + blockSize - 1
+            // bytes. When the current ciphertext segment can't hold
+            // that much, encrypt a small chunk in to a staging buffer
+            // and scatter it across the segment boundary.
+            std::size_t slack = (std::size_t)EVP_CIPHER_block_size (cipher) - 1;
+            util::ui8 staging[2 * EVP_MAX_BLOCK_LENGTH];
+            for (std::size_t i = 0; i < plaintextCount; ++i) {
+                const util::ui8 *buffer = (const util::ui8 *)plaintext[i].buffer;
+                for (std::size_t length = plaintext[i].length; length > 0;) {
+                    std::size_t chunkLength;
+                    std::size_t available = ciphertext.GetAvailable ();
+                    if (available > slack) {
+                        chunkLength = std::min (length, available - slack);
+                        util::ui8 *ptr = ciphertext.GetWritePtr ();
+                        std::size_t updateLength = encryptor.Update (buffer, chunkLength, ptr);
+                        if (mac.Get () != 0 && updateLength > 0) {
+                            mac->Update (ptr, updateLength);
+                        }
+                        ciphertext.Advance (updateLength);
+                    }
+                    else {
+                        chunkLength = std::min (length, (std::size_t)EVP_MAX_BLOCK_LENGTH);
+                        std::size_t updateLength = encryptor.Update (buffer, chunkLength, staging);
+                        if (mac.Get () != 0 && updateLength > 0) {
+                            mac->Update (staging, updateLength);
+                        }
+                        ciphertext.Write (staging, updateLength);
+                    }
+                    buffer += chunkLength;
+                    length -= chunkLength;
+                }
+            }
+            std::size_t finalLength = encryptor.Final (staging);
+            if (mac.Get () != 0 && finalLength > 0) {
+                mac->Update (staging, finalLength);
+            }
+            ciphertext.Write (staging, finalLength);
+            util::ui8 tag[EVP_MAX_MD_SIZE];
+            std::size_t tagLength = mac.Get () != 0 ?
+                mac->Final (tag) : encryptor.GetTag (tag);
+            if (tagLength != ciphertextHeader.macLength) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "Incorrect tag length: " THEKOGANS_UTIL_SIZE_T_FORMAT
+                    " (expecting %u).",
+                    tagLength,
+                    ciphertextHeader.macLength);
+            }
+            ciphertext.Write (tag, tagLength);
+            return ciphertext.totalLength;
+        }
+
+        void Cipher::GetOrderedIV (
+                const util::ui8 *salt,
+                util::ui64 sequenceNumber,
+                util::ui8 *iv) const {
+            std::size_t ivLength = encryptor.GetIVLength ();
+            memcpy (iv, salt, ivLength);
+            // XOR the big endian sequence number in to the last 8 bytes.
+            for (std::size_t i = 0; i < util::UI64_SIZE; ++i) {
+                iv[ivLength - 1 - i] ^= (util::ui8)(sequenceNumber >> (8 * i));
+            }
+        }
+
+        std::size_t Cipher::DecryptWithHeader (
+                const CiphertextHeader &ciphertextHeader,
+                const util::ui8 *ivCiphertextAndMAC,
+                const void *associatedData,
+                std::size_t associatedDataLength,
+                util::ui8 *plaintext) {
+            const util::ui8 *ciphertext = ivCiphertextAndMAC + ciphertextHeader.ivLength;
+            std::size_t workerCount = mac.Get () != 0 &&
+                ciphertextHeader.ciphertextLength % EVP_CIPHER_block_size (cipher) == 0 ?
+                GetStripeCount (
+                    parallelDecryptThreshold,
+                    parallelDecryptWorkerCount,
+                    ciphertextHeader.ciphertextLength) : 1;
+            // Stripes chain off of the ciphertext blocks preceding them,
+            // so the plaintext can't overlap the ciphertext.
+            if (workerCount > 1 &&
+                    (plaintext + ciphertextHeader.ciphertextLength <= ivCiphertextAndMAC ||
+                        ivCiphertextAndMAC + ciphertextHeader.GetTotalLength () <= plaintext)) {
+                return DecryptParallel (
+                    ciphertextHeader,
+                    ivCiphertextAndMAC,
+                    workerCount,
+                    plaintext);
+            }
+            // If we're in CBC mode, verify the MAC before attempting to
+            // decrypt, as per the Cryptographic Doom Principle:
+            // https://moxie.org/blog/the-cryptographic-doom-principle/
+            if (mac.Get () != 0 &&
+                    !mac->VerifyBufferSignature (
+                        ivCiphertextAndMAC,
+                        ciphertextHeader.ivLength +
+                            ciphertextHeader.ciphertextLength,
+                        ciphertext + ciphertextHeader.ciphertextLength,
+                        ciphertextHeader.macLength)) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "%s", "Ciphertext failed mac verifacion.");
+            }
+            decryptor.Init (ivCiphertextAndMAC);
+            if (associatedData != 0 && associatedDataLength > 0) {
+                decryptor.SetAssociatedData (associatedData, associatedDataLength);
+            }
+            std::size_t updateLength = decryptor.Update (
+                ciphertext,
+                ciphertextHeader.ciphertextLength,
+                plaintext);
+            if (mac.Get () == 0) {
+                decryptor.SetTag (
+                    ciphertext + ciphertextHeader.ciphertextLength,
+                    ciphertextHeader.macLength);
+            }
+            std::size_t finalLength = decryptor.Final (plaintext + updateLength);
+            return updateLength + finalLength;
+        }
+
+        std::size_t Cipher::EncryptWithIV (
+                std::size_t ivLength,
+                const void *plaintext,
+                std::size_t plaintextLength,
+                const void *associatedData,
+                std::size_t associatedDataLength,
+                util::ui8 *ciphertext) {
+            THEKOGANS_CRYPTO_TRACE_SCOPE (OPERATION_ENCRYPT, key->GetId (), 0, plaintextLength);
+            metrics.Update (Metrics::OPERATION_ENCRYPT, plaintextLength);
+            util::ui8 *ivCiphertextAndMAC = ciphertext + CiphertextHeader::SIZE;
+            CiphertextHeader ciphertextHeader;
+            ciphertextHeader.ivLength = (util::ui16)ivLength;
+            if (associatedData != 0) {
+                encryptor.SetAssociatedData (
+                    associatedData,
+                    associatedDataLength);
+            }
+            std::size_t workerCount = mac.Get () == 0 ?
+                GetParallelWorkerCount (ivLength, plaintextLength) : 1;
+            if (mac.Get () != 0) {
+                // Encrypt-then-MAC in one pass: encrypt MAC_INTERLEAVE_LENGTH
+                // bytes at a time and MAC each piece of ciphertext while it's
+                // still in L1. The result is identical to MACing iv + ciphertext
+                // after the fact.
+                mac->Init ();
+                mac->Update (ivCiphertextAndMAC, ciphertextHeader.ivLength);
+                util::ui8 *out = ivCiphertextAndMAC + ciphertextHeader.ivLength;
+                const util::ui8 *in = (const util::ui8 *)plaintext;
+                std::size_t ciphertextLength = 0;
+                for (std::size_t offset = 0; offset < plaintextLength;) {
+                    std::size_t length = std::min (
+                        plaintextLength - offset, MAC_INTERLEAVE_LENGTH);
+                    std::size_t updateLength = encryptor.Update (
+                        in + offset, length, out + ciphertextLength);
+                    if (updateLength > 0) {
+                        mac->Update (out + ciphertextLength, updateLength);
+                        ciphertextLength += updateLength;
+                    }
+                    offset += length;
+                }
+                std::size_t finalLength = encryptor.Final (out + ciphertextLength);
+                if (finalLength > 0) {
+                    mac->Update (out + ciphertextLength, finalLength);
+                    ciphertextLength += finalLength;
+                }
+                ciphertextHeader.ciphertextLength = (util::ui32)ciphertextLength;
+                ciphertextHeader.macLength = (util::ui16)mac->Final (
+                    out + ciphertextLength);
+            }
+            else if (workerCount > 1) {
+                ciphertextHeader.ciphertextLength = (util::ui32)plaintextLength;
+                ciphertextHeader.macLength = (util::ui16)EncryptParallel (
+                    ivCiphertextAndMAC,
+                    workerCount,
+                    plaintext,
+                    plaintextLength,
+                    associatedData,
+                    associatedDataLength,
+                    ivCiphertextAndMAC + ciphertextHeader.ivLength);
+            }
+            else {
+                std::size_t updateLength = encryptor.Update (
+                    plaintext,
+                    plaintextLength,
+                    ivCiphertextAndMAC + ciphertextHeader.ivLength);
+                std::size_t finalLength = encryptor.Final (
+                    ivCiphertextAndMAC + ciphertextHeader.ivLength + updateLength);
+                ciphertextHeader.ciphertextLength =
+                    (util::ui32)(updateLength + finalLength);
+                ciphertextHeader.macLength =
+                    (util::ui16)encryptor.GetTag (
+                        ivCiphertextAndMAC +
+                        ciphertextHeader.ivLength +
+                        ciphertextHeader.ciphertextLength);
+            }
+            util::TenantWriteBuffer buffer (util::NetworkEndian, ciphertext, CiphertextHeader::SIZE);
+            buffer << ciphertextHeader;
+            return CiphertextHeader::SIZE + ciphertextHeader.GetTotalLength ();
+        }
+
+        std::size_t Cipher::GetParallelWorkerCount (
+                std::size_t ivLength,
+                std::size_t plaintextLength) const {
+            return ivLength == GCM_IV_LENGTH ?
+                GetStripeCount (parallelThreshold, parallelWorkerCount, plaintextLength) : 1;
+        }
+
+        std::size_t Cipher::EncryptParallel (
+                const util::ui8 *iv,
+                std::size_t workerCount,
+                const void *plaintext,
+                std::size_t plaintextLength,
+                const void *associatedData,
+                std::size_t associatedDataLength,
+                util::ui8 *ciphertext) {
+            const EVP_CIPHER *ctr;
+            const EVP_CIPHER *ecb;
+            if (!GetAESCiphers (cipher, ctr, ecb)) {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+            ctr = OpenSSLInit::FetchCipher (ctr);
+            ecb = OpenSSLInit::FetchCipher (ecb);
+            const EVP_CIPHER *gcm = OpenSSLInit::FetchCipher (cipher);
+            const util::ui8 *keyData = key->Get ().GetReadPtr ();
+            // H = E (0), J0 = iv || 1.
+            util::ui8 block[GCM_BLOCK_LENGTH] = {0};
+            EncryptBlock (ecb, keyData, block, block);
+            GHASHBlock h (block);
+            memcpy (block, iv, GCM_IV_LENGTH);
+            memset (block + GCM_IV_LENGTH, 0, GCM_BLOCK_LENGTH - GCM_IV_LENGTH);
+            block[GCM_BLOCK_LENGTH - 1] = 1;
+            EncryptBlock (ecb, keyData, block, block);
+            GHASHBlock encryptedJ0 (block);
+            memset (block, 0, GCM_BLOCK_LENGTH);
+            if (associatedData == 0) {
+                associatedDataLength = 0;
+            }
+            // Stripes are whole blocks (but the last), so that each
+            // starts on it's own counter block and hashes unpadded.
+            std::size_t stripeLength = (plaintextLength + workerCount - 1) / workerCount;
+            stripeLength = (stripeLength + GCM_BLOCK_LENGTH - 1) & ~(std::size_t)(GCM_BLOCK_LENGTH - 1);
+            util::OwnerVector<GCMStripeEncryptor> stripes;
+            stripes.reserve (workerCount);
+            for (std::size_t offset = 0; offset < plaintextLength; offset += stripeLength) {
+                stripes.push_back (
+                    new GCMStripeEncryptor (
+                        ctr,
+                        gcm,
+                        keyData,
+                        iv,
+                        encryptedJ0,
+                        (const util::ui8 *)plaintext + offset,
+                        std::min (stripeLength, plaintextLength - offset),
+                        offset / GCM_BLOCK_LENGTH,
+                        ciphertext + offset));
+            }
+            // The calling thread takes the first stripe.
+            for (std::size_t i = 1, count = stripes.size (); i < count; ++i) {
+                stripes[i]->Create ();
+            }
+            std::string error;
+            THEKOGANS_UTIL_TRY {
+                stripes[0]->Encrypt ();
+            }
+            THEKOGANS_UTIL_CATCH (util::Exception) {
+                error = exception.Report ();
+            }
+            for (std::size_t i = 1, count = stripes.size (); i < count; ++i) {
+                stripes[i]->Wait ();
+                if (error.empty ()) {
+                    error = stripes[i]->error;
+                }
+            }
+            if (!error.empty ()) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION ("%s", error.c_str ());
+            }
+            // Fold the associated data and stripe hashes in to the message
+            // hash: pad (ad) || pad (ciphertext) || bitlen (ad) || bitlen (ciphertext).
+            util::ui64 associatedDataBlocks =
+                (associatedDataLength + GCM_BLOCK_LENGTH - 1) / GCM_BLOCK_LENGTH;
+            util::ui64 blockCount = associatedDataBlocks +
+                (plaintextLength + GCM_BLOCK_LENGTH - 1) / GCM_BLOCK_LENGTH + 1;
+            GHASHBlock messageHash;
+            if (associatedDataLength > 0) {
+                FoldHash (
+                    messageHash,
+                    h,
+                    blockCount,
+                    associatedDataBlocks,
+                    HashData (
+                        gcm,
+                        keyData,
+                        iv,
+                        encryptedJ0,
+                        (const util::ui8 *)associatedData,
+                        associatedDataLength),
+                    associatedDataLength);
+            }
+            for (std::size_t i = 0, count = stripes.size (); i < count; ++i) {
+                std::size_t end = (std::size_t)(stripes[i]->ciphertext - ciphertext) + stripes[i]->length;
+                FoldHash (
+                    messageHash,
+                    h,
+                    blockCount,
+                    associatedDataBlocks + (end + GCM_BLOCK_LENGTH - 1) / GCM_BLOCK_LENGTH,
+                    stripes[i]->hash,
+                    stripes[i]->length);
+            }
+            messageHash ^= Multiply (
+                GHASHBlock (
+                    (util::ui64)associatedDataLength * 8,
+                    (util::ui64)plaintextLength * 8),
+                h);
+            messageHash ^= encryptedJ0;
+            messageHash.Store (ciphertext + plaintextLength);
+            return GCM_BLOCK_LENGTH;
+        }
+
+        std::size_t Cipher::DecryptParallel (
+                const CiphertextHeader &ciphertextHeader,
+                const util::ui8 *ivCiphertextAndMAC,
+                std::size_t workerCount,
+                util::ui8 *plaintext) {
+            const EVP_CIPHER *cbc = OpenSSLInit::FetchCipher (cipher);
+            const util::ui8 *keyData = key->Get ().GetReadPtr ();
+            const util::ui8 *ciphertext = ivCiphertextAndMAC + ciphertextHeader.ivLength;
+            std::size_t ciphertextLength = ciphertextHeader.ciphertextLength;
+            std::size_t blockSize = (std::size_t)EVP_CIPHER_block_size (cbc);
+            // The MAC gets a thread of it's own, the stripes split the rest.
+            MACVerifier verifier (
+                *mac,
+                ivCiphertextAndMAC,
+                ciphertextHeader.ivLength + ciphertextLength,
+                ciphertext + ciphertextLength,
+                ciphertextHeader.macLength);
+            std::size_t stripeCount = workerCount - 1;
+            std::size_t stripeLength = (ciphertextLength + stripeCount - 1) / stripeCount;
+            stripeLength = (stripeLength + blockSize - 1) / blockSize * blockSize;
+            util::OwnerVector<CBCStripeDecryptor> stripes;
+            stripes.reserve (stripeCount);
+            for (std::size_t offset = 0; offset < ciphertextLength; offset += stripeLength) {
+                std::size_t length = std::min (stripeLength, ciphertextLength - offset);
+                stripes.push_back (
+                    new CBCStripeDecryptor (
+                        cbc,
+                        keyData,
+                        offset == 0 ? ivCiphertextAndMAC : ciphertext + offset - blockSize,
+                        ciphertext + offset,
+                        length,
+                        offset + length == ciphertextLength,
+                        plaintext + offset));
+            }
+            verifier.Create ();
+            // The calling thread takes the first stripe.
+            for (std::size_t i = 1, count = stripes.size (); i < count; ++i) {
+                stripes[i]->Create ();
+            }
+            std::string error;
+            THEKOGANS_UTIL_TRY {
+                stripes[0]->Decrypt ();
+            }
+            THEKOGANS_UTIL_CATCH (util::Exception) {
+                error = exception.Report ();
+            }
+            for (std::size_t i = 1, count = stripes.size (); i < count; ++i) {
+                stripes[i]->Wait ();
+                if (error.empty ()) {
+                    error = stripes[i]->error;
+                }
+            }
+            verifier.Wait ();
+            // The MAC takes precedence. A frame that fails it never
+            // gets to report a padding error (or release plaintext).
+            if (!verifier.error.empty ()) {
+                error = verifier.error;
+            }
+            else if (!verifier.verified) {
+                error = "Ciphertext failed mac verifacion.";
+            }
+            if (!error.empty ()) {
+                SecureZero (plaintext, ciphertextLength);
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION ("%s", error.c_str ());
+            }
+            std::size_t plaintextLength = 0;
+            for (std::size_t i = 0, count = stripes.size (); i < count; ++i) {
+                plaintextLength += stripes[i]->plaintextLength;
+            }
+            return plaintextLength;
+        }
+
     } // namespace crypto
 } // namespace thekogans
@@ -0,0 +1,122 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#include "thekogans/util/Exception.h"
+#include "thekogans/util/LockGuard.h"
+#include "thekogans/crypto/OpenSSLInit.h"
+#include "thekogans/crypto/OpenSSLException.h"
+#include "thekogans/crypto/CipherKeySchedule.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        CipherKeySchedule::CipherKeySchedule (
+                const SymmetricKey &key,
+                const EVP_CIPHER *cipher_,
+                const EVP_MD *md_) :
+                cipher (cipher_),
+                md (md_) {
+            if (cipher != 0 && key.GetKeyLength () == GetCipherKeyLength (cipher)) {
+                const EVP_CIPHER *fetchedCipher = OpenSSLInit::FetchCipher (cipher);
+                ENGINE *engine = OpenSSLInit::GetEngine (EVP_CIPHER_nid (cipher));
+                if (EVP_EncryptInit_ex (
+                            &encryptContext,
+                            fetchedCipher,
+                            engine,
+                            key.Get ().GetReadPtr (),
+                            0) != 1 ||
+                        EVP_DecryptInit_ex (
+                            &decryptContext,
+                            fetchedCipher,
+                            engine,
+                            key.Get ().GetReadPtr (),
+                            0) != 1 ||
+                        (GetCipherMode (cipher) == EVP_CIPH_GCM_MODE &&
+                            (EVP_CIPHER_CTX_ctrl (
+                                &encryptContext,
+                                EVP_CTRL_GCM_SET_IVLEN,
+                                EVP_CIPHER_CTX_iv_length (&encryptContext),
+                                0) != 1 ||
+                            EVP_CIPHER_CTX_ctrl (
+                                &decryptContext,
+                                EVP_CTRL_GCM_SET_IVLEN,
+                                EVP_CIPHER_CTX_iv_length (&decryptContext),
+                                0) != 1))) {
+                    THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
+                }
+                // AEAD ciphers (GCM, ChaCha20-Poly1305) produce their own tags.
+                if (!IsCipherAEAD (cipher)) {
+                    if (md != 0) {
+                        mac.Reset (
+                            new HMAC (
+                                SymmetricKey::FromSecretAndSalt (
+                                    key.Get ().GetReadPtr (),
+                                    key.Get ().GetDataAvailableForReading (),
+                                    0,
+                                    0,
+                                    GetMDLength (md),
+                                    md),
+                                md));
+                    }
+                    else {
+                        THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                            THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+                    }
+                }
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        CipherKeySchedule::SharedPtr CipherKeySchedule::Get (
+                SymmetricKey::SharedPtr key,
+                const EVP_CIPHER *cipher,
+                const EVP_MD *md) {
+            if (key.Get () != 0) {
+                {
+                    util::LockGuard<util::SpinLock> guard (key->scheduleLock);
+                    if (key->schedule.Get () != 0 && key->schedule->Matches (cipher, md)) {
+                        return key->schedule;
+                    }
+                }
+                // Compute it outside the lock. If two threads race, both
+                // schedules are equivalent and the last one is kept.
+                SharedPtr schedule (new CipherKeySchedule (*key, cipher, md));
+                util::LockGuard<util::SpinLock> guard (key->scheduleLock);
+                key->schedule = schedule;
+                return schedule;
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        MAC::SharedPtr CipherKeySchedule::CloneMAC () const {
+            return mac.Get () != 0 ? mac->Clone () : MAC::SharedPtr ();
+        }
+
+        bool CipherKeySchedule::Matches (
+                const EVP_CIPHER *cipher_,
+                const EVP_MD *md_) const {
+            return cipher == cipher_ && (mac.Get () == 0 || md == md_);
+        }
+
+    } // namespace crypto
+} // namespace thekogans
@@ -0,0 +1,100 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "thekogans/util/Exception.h"
+#include "thekogans/util/LockGuard.h"
+#include "thekogans/util/HRTimer.h"
+#include "thekogans/util/SystemInfo.h"
+#include "thekogans/crypto/OpenSSLUtils.h"
+#include "thekogans/crypto/CipherPool.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        CipherPool::CipherPool (
+                SymmetricKey::SharedPtr key_,
+                const EVP_CIPHER *cipher_,
+                const EVP_MD *md_,
+                std::size_t maxCiphers_) :
+                key (key_),
+                cipher (cipher_),
+                md (md_),
+                maxCiphers (maxCiphers_ > 0 ?
+                    maxCiphers_ : util::SystemInfo::Instance ().GetCPUCount () * 2),
+                idleCondition (mutex) {
+            // AEAD ciphers produce their own tags, md is only needed for CBC.
+            if (key.Get () == 0 || cipher == 0 || (md == 0 && !IsCipherAEAD (cipher))) {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        Cipher::SharedPtr CipherPool::Acquire () {
+            {
+                util::LockGuard<util::Mutex> guard (mutex);
+                if (idle.empty () && stats.ciphers == maxCiphers) {
+                    util::ui64 start = util::HRTimer::Click ();
+                    // A failed Cipher creation frees up a slot, so
+                    // recheck both conditions after every wakeup.
+                    do {
+                        idleCondition.Wait ();
+                    } while (idle.empty () && stats.ciphers == maxCiphers);
+                    util::f64 waitTime = util::HRTimer::ToSeconds (
+                        util::HRTimer::ComputeElapsedTime (start, util::HRTimer::Click ()));
+                    ++stats.waits;
+                    stats.totalWaitTime += waitTime;
+                    if (stats.maxWaitTime < waitTime) {
+                        stats.maxWaitTime = waitTime;
+                    }
+                }
+                ++stats.leases;
+                if (!idle.empty ()) {
+                    Cipher::SharedPtr cipher = idle.back ();
+                    idle.pop_back ();
+                    return cipher;
+                }
+                // Reserve the slot now, create the cipher outside the lock.
+                ++stats.ciphers;
+            }
+            THEKOGANS_UTIL_TRY {
+                return Cipher::SharedPtr (new Cipher (key, cipher, md));
+            }
+            THEKOGANS_UTIL_CATCH (util::Exception) {
+                util::LockGuard<util::Mutex> guard (mutex);
+                --stats.ciphers;
+                --stats.leases;
+                idleCondition.Signal ();
+                THEKOGANS_UTIL_RETHROW_EXCEPTION (exception);
+            }
+        }
+
+        void CipherPool::Release (Cipher::SharedPtr cipher) {
+            if (cipher.Get () != 0) {
+                util::LockGuard<util::Mutex> guard (mutex);
+                idle.push_back (cipher);
+                idleCondition.Signal ();
+            }
+        }
+
+        CipherPool::Stats CipherPool::GetStats () {
+            util::LockGuard<util::Mutex> guard (mutex);
+            return stats;
+        }
+
+    } // namespace crypto
+} // namespace thekogans
@@ -15,19 +15,27 @@
 // You should have received a copy of the GNU General Public License
 // along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
 
+#include <algorithm>
+#include <utility>
 #include "thekogans/crypto/DHEKeyExchange.h"
 #include "thekogans/crypto/RSAKeyExchange.h"
 #include "thekogans/crypto/X25519AsymmetricKey.h"
 #include "thekogans/crypto/Ed25519AsymmetricKey.h"
 #include "thekogans/crypto/HMAC.h"
 #include "thekogans/crypto/CMAC.h"
+#include "thekogans/crypto/GMAC.h"
+#include "thekogans/crypto/Poly1305.h"
 #include "thekogans/crypto/DSA.h"
 #include "thekogans/crypto/RSA.h"
 #include "thekogans/crypto/EC.h"
+#include "thekogans/crypto/CPUFeatures.h"
+#include "thekogans/crypto/OpenSSLInit.h"
 #if defined (THEKOGANS_CRYPTO_HAVE_BLAKE2)
     #include "thekogans/crypto/Blake2b.h"
     #include "thekogans/crypto/Blake2s.h"
+    #include "thekogans/crypto/Blake2MAC.h"
 #endif // defined (THEKOGANS_CRYPTO_HAVE_BLAKE2)
+#include "thekogans/crypto/Blake3.h"
 #include "thekogans/crypto/CipherSuite.h"
 
 namespace thekogans {
@@ -48,13 +56,19 @@ namespace thekogans {
         const char * const CipherSuite::CIPHER_AES_256_CBC = "AES-256-CBC";
         const char * const CipherSuite::CIPHER_AES_192_CBC = "AES-192-CBC";
         const char * const CipherSuite::CIPHER_AES_128_CBC = "AES-128-CBC";
+    #if defined (THEKOGANS_CRYPTO_HAVE_CHACHA20_POLY1305)
+        const char * const CipherSuite::CIPHER_CHACHA20_POLY1305 = "ChaCha20-Poly1305";
+    #endif // defined (THEKOGANS_CRYPTO_HAVE_CHACHA20_POLY1305)
 
     #if defined (THEKOGANS_CRYPTO_HAVE_BLAKE2)
         const char * const CipherSuite::MESSAGE_DIGEST_BLAKE2B_512 = "BLAKE2B-512";
         const char * const CipherSuite::MESSAGE_DIGEST_BLAKE2B_384 = "BLAKE2B-384";
         const char * const CipherSuite::MESSAGE_DIGEST_BLAKE2B_256 = "BLAKE2B-256";
         const char * const CipherSuite::MESSAGE_DIGEST_BLAKE2S_256 = "BLAKE2S-256";
+        const char * const CipherSuite::MESSAGE_DIGEST_BLAKE2BP_512 = "BLAKE2BP-512";
+        const char * const CipherSuite::MESSAGE_DIGEST_BLAKE2SP_256 = "BLAKE2SP-256";
     #endif // defined (THEKOGANS_CRYPTO_HAVE_BLAKE2)
+        const char * const CipherSuite::MESSAGE_DIGEST_BLAKE3_256 = "BLAKE3-256";
 
         const char * const CipherSuite::MESSAGE_DIGEST_SHA2_512 = "SHA2-512";
         const char * const CipherSuite::MESSAGE_DIGEST_SHA2_384 = "SHA2-384";
@@ -69,20 +83,12 @@ namespace thekogans {
                 authenticator (authenticator_),
                 cipher (cipher_),
                 messageDigest (messageDigest_) {
-            if (!IsValid ()) {
-                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
-                    "Invalid cipher suite: %s",
-                    ToString ().c_str ());
-            }
+            Resolve ();
         }
 
         CipherSuite::CipherSuite (util::Serializer &serializer) {
             serializer >> keyExchange >> authenticator >> cipher >> messageDigest;
-            if (!IsValid ()) {
-                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
-                    "Invalid cipher suite: %s",
-                    ToString ().c_str ());
-            }
+            Resolve ();
         }
 
         CipherSuite::CipherSuite (const std::string &cipherSuite) {
@@ -93,12 +99,14 @@ namespace thekogans {
                 keyExchange (cipherSuite.keyExchange),
                 authenticator (cipherSuite.authenticator),
                 cipher (cipherSuite.cipher),
-                messageDigest (cipherSuite.messageDigest) {
-            if (!IsValid ()) {
-                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
-                    "Invalid cipher suite: %s",
-                    ToString ().c_str ());
-            }
+                messageDigest (cipherSuite.messageDigest),
+                keyExchangeIndex (cipherSuite.keyExchangeIndex),
+                authenticatorIndex (cipherSuite.authenticatorIndex),
+                cipherIndex (cipherSuite.cipherIndex),
+                messageDigestIndex (cipherSuite.messageDigestIndex),
+                openSSLCipher (cipherSuite.openSSLCipher),
+                openSSLMessageDigest (cipherSuite.openSSLMessageDigest),
+                code (cipherSuite.code) {}
         }
 
         CipherSuite &CipherSuite::operator = (const std::string &cipherSuite) {
@@ -112,11 +120,13 @@ namespace thekogans {
                 authenticator = cipherSuite.authenticator;
                 cipher = cipherSuite.cipher;
                 messageDigest = cipherSuite.messageDigest;
-                if (!IsValid ()) {
-                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
-                        "Invalid cipher suite: %s",
-                        ToString ().c_str ());
-                }
+                keyExchangeIndex = cipherSuite.keyExchangeIndex;
+                authenticatorIndex = cipherSuite.authenticatorIndex;
+                cipherIndex = cipherSuite.cipherIndex;
+                messageDigestIndex = cipherSuite.messageDigestIndex;
+                openSSLCipher = cipherSuite.openSSLCipher;
+                openSSLMessageDigest = cipherSuite.openSSLMessageDigest;
+                code = cipherSuite.code;
             }
             return *this;
         }
@@ -146,7 +156,12 @@ namespace thekogans {
                 {CipherSuite::CIPHER_AES_128_GCM, EVP_aes_128_gcm ()},
                 {CipherSuite::CIPHER_AES_256_CBC, EVP_aes_256_cbc ()},
                 {CipherSuite::CIPHER_AES_192_CBC, EVP_aes_192_cbc ()},
-                {CipherSuite::CIPHER_AES_128_CBC, EVP_aes_128_cbc ()}
+                {CipherSuite::CIPHER_AES_128_CBC, EVP_aes_128_cbc ()},
+            // NOTE: Cipher indexes are serialized (see RSA.cpp).
+            // New ciphers must only ever be appended to this list.
+            #if defined (THEKOGANS_CRYPTO_HAVE_CHACHA20_POLY1305)
+                {CipherSuite::CIPHER_CHACHA20_POLY1305, EVP_chacha20_poly1305 ()}
+            #endif // defined (THEKOGANS_CRYPTO_HAVE_CHACHA20_POLY1305)
             };
             const std::size_t ciphersSize = THEKOGANS_UTIL_ARRAY_SIZE (ciphers);
 
@@ -159,13 +174,100 @@ namespace thekogans {
                 {CipherSuite::MESSAGE_DIGEST_BLAKE2B_384, EVP_blake2b384 ()},
                 {CipherSuite::MESSAGE_DIGEST_BLAKE2B_256, EVP_blake2b256 ()},
                 {CipherSuite::MESSAGE_DIGEST_BLAKE2S_256, EVP_blake2s256 ()},
+                {CipherSuite::MESSAGE_DIGEST_BLAKE2BP_512, EVP_blake2bp512 ()},
+                {CipherSuite::MESSAGE_DIGEST_BLAKE2SP_256, EVP_blake2sp256 ()},
             #endif // defined (THEKOGANS_CRYPTO_HAVE_BLAKE2)
+                {CipherSuite::MESSAGE_DIGEST_BLAKE3_256, EVP_blake3_256 ()},
                 {CipherSuite::MESSAGE_DIGEST_SHA2_512, EVP_sha512 ()},
                 {CipherSuite::MESSAGE_DIGEST_SHA2_384, EVP_sha384 ()},
                 {CipherSuite::MESSAGE_DIGEST_SHA2_256, EVP_sha256 ()}
             };
             const std::size_t messageDigestsSize = THEKOGANS_UTIL_ARRAY_SIZE (messageDigests);
 
+            // Message digest code points. Unlike the messageDigests table
+            // above, this list does not depend on the build, so that codes
+            // are the same everywhere. Like ciphers, append only.
+            const char *messageDigestCodes[] = {
+                "BLAKE2B-512",
+                "BLAKE2B-384",
+                "BLAKE2B-256",
+                "BLAKE2S-256",
+                "BLAKE2BP-512",
+                "BLAKE2SP-256",
+                CipherSuite::MESSAGE_DIGEST_BLAKE3_256,
+                CipherSuite::MESSAGE_DIGEST_SHA2_512,
+                CipherSuite::MESSAGE_DIGEST_SHA2_384,
+                CipherSuite::MESSAGE_DIGEST_SHA2_256
+            };
+            const std::size_t messageDigestCodesSize = THEKOGANS_UTIL_ARRAY_SIZE (messageDigestCodes);
+
+            // Code layout: Kx:4 | Auth:4 | Enc:4 | MD:4, each 1 based so that
+            // 0 (INVALID_CODE) is never a valid suite.
+            util::ui16 MakeCode (
+                    std::size_t keyExchangeIndex,
+                    std::size_t authenticatorIndex,
+                    std::size_t cipherIndex,
+                    const std::string &messageDigest) {
+                for (std::size_t i = 0; i < messageDigestCodesSize; ++i) {
+                    if (messageDigest == messageDigestCodes[i]) {
+                        return (util::ui16)(
+                            ((keyExchangeIndex + 1) << 12) |
+                            ((authenticatorIndex + 1) << 8) |
+                            ((cipherIndex + 1) << 4) |
+                            (i + 1));
+                    }
+                }
+                return CipherSuite::INVALID_CODE;
+            }
+
+            // Algorithm subset builds (see Config.h) keep the tables above
+            // intact (their indexes are serialized) and drop the suites
+            // whose algorithms were left out.
+            bool IsAlgorithmEnabled (const std::string &algorithm) {
+            #if !defined (THEKOGANS_CRYPTO_HAVE_RSA)
+                if (algorithm == CipherSuite::KEY_EXCHANGE_RSA ||
+                        algorithm == CipherSuite::AUTHENTICATOR_RSA) {
+                    return false;
+                }
+            #endif // !defined (THEKOGANS_CRYPTO_HAVE_RSA)
+            #if !defined (THEKOGANS_CRYPTO_HAVE_DSA)
+                if (algorithm == CipherSuite::AUTHENTICATOR_DSA) {
+                    return false;
+                }
+            #endif // !defined (THEKOGANS_CRYPTO_HAVE_DSA)
+            #if !defined (THEKOGANS_CRYPTO_HAVE_DH)
+                if (algorithm == CipherSuite::KEY_EXCHANGE_DHE) {
+                    return false;
+                }
+            #endif // !defined (THEKOGANS_CRYPTO_HAVE_DH)
+            #if !defined (THEKOGANS_CRYPTO_HAVE_CBC)
+                if (algorithm == CipherSuite::CIPHER_AES_256_CBC ||
+                        algorithm == CipherSuite::CIPHER_AES_192_CBC ||
+                        algorithm == CipherSuite::CIPHER_AES_128_CBC) {
+                    return false;
+                }
+            #endif // !defined (THEKOGANS_CRYPTO_HAVE_CBC)
+                return true;
+            }
+
+            // Same as above for OpenSSL key types.
+            inline bool IsKeyTypeEnabled (const char *type) {
+                return
+                #if !defined (THEKOGANS_CRYPTO_HAVE_RSA)
+                    type != OPENSSL_PKEY_RSA &&
+                #endif // !defined (THEKOGANS_CRYPTO_HAVE_RSA)
+                #if !defined (THEKOGANS_CRYPTO_HAVE_DSA)
+                    type != OPENSSL_PKEY_DSA &&
+                #endif // !defined (THEKOGANS_CRYPTO_HAVE_DSA)
+                #if !defined (THEKOGANS_CRYPTO_HAVE_DH)
+                    type != OPENSSL_PKEY_DH &&
+                #endif // !defined (THEKOGANS_CRYPTO_HAVE_DH)
+                #if !defined (THEKOGANS_CRYPTO_HAVE_EC)
+                    type != OPENSSL_PKEY_EC &&
+                #endif // !defined (THEKOGANS_CRYPTO_HAVE_EC)
+                    type != 0;
+            }
+
             // Certain algorithms cannot be combined in to a cipher suite.
             // This method will contain a never ending list of exceptions.
             bool ValidateAlgorithms (
@@ -182,7 +284,9 @@ namespace thekogans {
                     return false;
                 }
                 // FIXME: Add other exceptions above this comment.
-                return true;
+                return IsAlgorithmEnabled (keyExchange) &&
+                    IsAlgorithmEnabled (authenticator) &&
+                    IsAlgorithmEnabled (cipher);
             }
 
             std::vector<CipherSuite> *BuildCipherSuites () {
@@ -210,6 +314,102 @@ namespace thekogans {
                 return cipherSuites;
             }
 
+            // Lower is better. AEADs come before CBC. Whether AES-GCM or
+            // ChaCha20-Poly1305 goes first depends on the hardware; without
+            // AES-NI/PCLMULQDQ (or ARMv8 AES/PMULL) ChaCha is several times
+            // faster and has no cache timing side channels.
+            std::size_t GetCipherRank (const std::string &cipher) {
+                static const char *aesFirst[] = {
+                    CipherSuite::CIPHER_AES_256_GCM,
+                    CipherSuite::CIPHER_AES_192_GCM,
+                    CipherSuite::CIPHER_AES_128_GCM,
+                #if defined (THEKOGANS_CRYPTO_HAVE_CHACHA20_POLY1305)
+                    CipherSuite::CIPHER_CHACHA20_POLY1305,
+                #endif // defined (THEKOGANS_CRYPTO_HAVE_CHACHA20_POLY1305)
+                    CipherSuite::CIPHER_AES_256_CBC,
+                    CipherSuite::CIPHER_AES_192_CBC,
+                    CipherSuite::CIPHER_AES_128_CBC
+                };
+                static const char *chachaFirst[] = {
+                #if defined (THEKOGANS_CRYPTO_HAVE_CHACHA20_POLY1305)
+                    CipherSuite::CIPHER_CHACHA20_POLY1305,
+                #endif // defined (THEKOGANS_CRYPTO_HAVE_CHACHA20_POLY1305)
+                    CipherSuite::CIPHER_AES_256_GCM,
+                    CipherSuite::CIPHER_AES_192_GCM,
+                    CipherSuite::CIPHER_AES_128_GCM,
+                    CipherSuite::CIPHER_AES_256_CBC,
+                    CipherSuite::CIPHER_AES_192_CBC,
+                    CipherSuite::CIPHER_AES_128_CBC
+                };
+                const char **order = CPUFeatures::Instance ().PreferAESGCM () ?
+                    aesFirst : chachaFirst;
+                const std::size_t orderSize = THEKOGANS_UTIL_ARRAY_SIZE (aesFirst);
+                for (std::size_t i = 0; i < orderSize; ++i) {
+                    if (cipher == order[i]) {
+                        return i;
+                    }
+                }
+                return orderSize;
+            }
+
+            struct CipherRankLess {
+                bool operator () (
+                        const CipherSuite &cipherSuite1,
+                        const CipherSuite &cipherSuite2) const {
+                    return GetCipherRank (cipherSuite1.cipher) <
+                        GetCipherRank (cipherSuite2.cipher);
+                }
+            };
+
+            std::vector<CipherSuite> *BuildRankedCipherSuites () {
+                std::vector<CipherSuite> *cipherSuites =
+                    new std::vector<CipherSuite> (CipherSuite::GetCipherSuites ());
+                // Stable, so that within a cipher the original (strongest
+                // first) key exchange/authenticator/digest order is kept.
+                std::stable_sort (cipherSuites->begin (), cipherSuites->end (), CipherRankLess ());
+                return cipherSuites;
+            }
+
+            // Sorted (code, GetCipherSuites index) pairs.
+            typedef std::vector<std::pair<util::ui16, std::size_t>> CodeIndex;
+
+            CodeIndex *BuildCodeIndex () {
+                CodeIndex *codeIndex = new CodeIndex;
+                const std::vector<CipherSuite> &cipherSuites = CipherSuite::GetCipherSuites ();
+                codeIndex->reserve (cipherSuites.size ());
+                for (std::size_t i = 0, count = cipherSuites.size (); i < count; ++i) {
+                    codeIndex->push_back (std::make_pair (cipherSuites[i].GetCode (), i));
+                }
+                std::sort (codeIndex->begin (), codeIndex->end ());
+                return codeIndex;
+            }
+
+            const CodeIndex &GetCodeIndex () {
+                static CodeIndex *codeIndex = BuildCodeIndex ();
+                return *codeIndex;
+            }
+
+            const std::size_t NO_INDEX = -1;
+
+            std::size_t GetCipherSuiteIndex (util::ui16 code) {
+                const CodeIndex &codeIndex = GetCodeIndex ();
+                CodeIndex::const_iterator it = std::lower_bound (
+                    codeIndex.begin (),
+                    codeIndex.end (),
+                    std::make_pair (code, (std::size_t)0));
+                return it != codeIndex.end () && it->first == code ? it->second : NO_INDEX;
+            }
+
+            std::vector<util::ui16> *BuildRankedCipherSuiteCodes () {
+                const std::vector<CipherSuite> &cipherSuites = CipherSuite::GetRankedCipherSuites ();
+                std::vector<util::ui16> *codes = new std::vector<util::ui16>;
+                codes->reserve (cipherSuites.size ());
+                for (std::size_t i = 0, count = cipherSuites.size (); i < count; ++i) {
+                    codes->push_back (cipherSuites[i].GetCode ());
+                }
+                return codes;
+            }
+
             std::vector<std::string> *BuildKeyExchanges () {
                 std::vector<std::string> *keyExchanges_ = new std::vector<std::string>;
                 for (std::size_t i = 0; i < keyExchangesSize; ++i) {
@@ -260,6 +460,98 @@ namespace thekogans {
             return *cipherSuites;
         }
 
+        const std::vector<CipherSuite> &CipherSuite::GetRankedCipherSuites () {
+            static std::vector<CipherSuite> *cipherSuites = BuildRankedCipherSuites ();
+            return *cipherSuites;
+        }
+
+        CipherSuite::Mask::Mask () :
+            bits ((GetCipherSuites ().size () + 63) / 64, 0) {}
+
+        CipherSuite::Mask::Mask (const std::vector<util::ui16> &codes) :
+                bits ((GetCipherSuites ().size () + 63) / 64, 0) {
+            for (std::size_t i = 0, count = codes.size (); i < count; ++i) {
+                Set (codes[i]);
+            }
+        }
+
+        bool CipherSuite::Mask::Set (util::ui16 code) {
+            std::size_t index = GetCipherSuiteIndex (code);
+            if (index != NO_INDEX) {
+                bits[index >> 6] |= (util::ui64)1 << (index & 63);
+                return true;
+            }
+            return false;
+        }
+
+        bool CipherSuite::Mask::Test (util::ui16 code) const {
+            std::size_t index = GetCipherSuiteIndex (code);
+            return index != NO_INDEX && (bits[index >> 6] & ((util::ui64)1 << (index & 63))) != 0;
+        }
+
+        CipherSuite::Mask &CipherSuite::Mask::operator &= (const Mask &mask) {
+            for (std::size_t i = 0, count = bits.size (); i < count; ++i) {
+                bits[i] &= mask.bits[i];
+            }
+            return *this;
+        }
+
+        bool CipherSuite::Mask::IsEmpty () const {
+            for (std::size_t i = 0, count = bits.size (); i < count; ++i) {
+                if (bits[i] != 0) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        const std::vector<util::ui16> &CipherSuite::GetRankedCipherSuiteCodes () {
+            static std::vector<util::ui16> *codes = BuildRankedCipherSuiteCodes ();
+            return *codes;
+        }
+
+        const CipherSuite &CipherSuite::GetCipherSuiteByCode (util::ui16 code) {
+            std::size_t index = GetCipherSuiteIndex (code);
+            return index != NO_INDEX ? GetCipherSuites ()[index] : Empty;
+        }
+
+        util::ui16 CipherSuite::Negotiate (
+                const std::vector<util::ui16> &preferences,
+                const Mask &peer) {
+            for (std::size_t i = 0, count = preferences.size (); i < count; ++i) {
+                if (peer.Test (preferences[i])) {
+                    return preferences[i];
+                }
+            }
+            return INVALID_CODE;
+        }
+
+        void CipherSuite::EncodeCodes (
+                util::Serializer &serializer,
+                const std::vector<util::ui16> &codes) {
+            if (codes.size () <= 0xffff) {
+                serializer << (util::ui16)codes.size ();
+                for (std::size_t i = 0, count = codes.size (); i < count; ++i) {
+                    serializer << codes[i];
+                }
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        void CipherSuite::DecodeCodes (
+                util::Serializer &serializer,
+                std::vector<util::ui16> &codes) {
+            util::ui16 count;
+            serializer >> count;
+            codes.resize (count);
+            for (util::ui16 i = 0; i < count; ++i) {
+                serializer >> codes[i];
+            }
+        }
+
         const std::vector<std::string> &CipherSuite::GetKeyExchanges () {
             static std::vector<std::string> *keyExchanges = BuildKeyExchanges ();
             return *keyExchanges;
@@ -283,6 +575,7 @@ namespace thekogans {
         const EVP_CIPHER *CipherSuite::GetOpenSSLCipherByName (const std::string &cipherName) {
             for (std::size_t i = 0; i < ciphersSize; ++i) {
                 if (ciphers[i].name == cipherName) {
+                    OpenSSLInit::RegisterCipher (ciphers[i].cipher);
                     return ciphers[i].cipher;
                 }
             }
@@ -290,7 +583,11 @@ namespace thekogans {
         }
 
         const EVP_CIPHER *CipherSuite::GetOpenSSLCipherByIndex (std::size_t cipherIndex) {
-            return cipherIndex < ciphersSize ? ciphers[cipherIndex].cipher : 0;
+            if (cipherIndex < ciphersSize) {
+                OpenSSLInit::RegisterCipher (ciphers[cipherIndex].cipher);
+                return ciphers[cipherIndex].cipher;
+            }
+            return 0;
         }
 
         std::string CipherSuite::GetOpenSSLCipherName (const EVP_CIPHER *cipher) {
@@ -305,6 +602,7 @@ namespace thekogans {
         const EVP_MD *CipherSuite::GetOpenSSLMessageDigestByName (const std::string &messageDigestName) {
             for (std::size_t i = 0; i < messageDigestsSize; ++i) {
                 if (messageDigests[i].name == messageDigestName) {
+                    OpenSSLInit::RegisterMessageDigest (messageDigests[i].md);
                     return messageDigests[i].md;
                 }
             }
@@ -320,41 +618,78 @@ namespace thekogans {
             return std::string ();
         }
 
+        void CipherSuite::SetEngine (
+                const std::string &algorithm,
+                ENGINE *engine) {
+            util::i32 nid = NID_undef;
+            if (algorithm == KEY_EXCHANGE_ECDHE || algorithm == AUTHENTICATOR_ECDSA) {
+                nid = EVP_PKEY_EC;
+            }
+            else if (algorithm == KEY_EXCHANGE_DHE) {
+                nid = EVP_PKEY_DH;
+            }
+            else if (algorithm == KEY_EXCHANGE_RSA || algorithm == AUTHENTICATOR_RSA) {
+                nid = EVP_PKEY_RSA;
+            }
+            else if (algorithm == AUTHENTICATOR_DSA) {
+                nid = EVP_PKEY_DSA;
+            }
+            else {
+                const EVP_CIPHER *cipher = GetOpenSSLCipherByName (algorithm);
+                if (cipher != 0) {
+                    nid = EVP_CIPHER_nid (cipher);
+                }
+                else {
+                    const EVP_MD *md = GetOpenSSLMessageDigestByName (algorithm);
+                    if (md != 0) {
+                        nid = EVP_MD_type (md);
+                    }
+                }
+            }
+            if (nid != NID_undef) {
+                OpenSSLInit::SetEngine (nid, engine);
+            }
+            else {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "Algorithm %s can't be offloaded.", algorithm.c_str ());
+            }
+        }
+
         namespace {
-            bool IsValidKeyExchange (const std::string &keyExchange) {
+            util::ui8 FindKeyExchange (const std::string &keyExchange) {
                 for (std::size_t i = 0; i < keyExchangesSize; ++i) {
                     if (keyExchanges[i] == keyExchange) {
-                        return true;
+                        return (util::ui8)i;
                     }
                 }
-                return false;
+                return CipherSuite::INVALID_INDEX;
             }
 
-            bool IsValidAuthenticator (const std::string &authenticator) {
+            util::ui8 FindAuthenticator (const std::string &authenticator) {
                 for (std::size_t i = 0; i < authenticatorsSize; ++i) {
                     if (authenticators[i] == authenticator) {
-                        return true;
+                        return (util::ui8)i;
                     }
                 }
-                return false;
+                return CipherSuite::INVALID_INDEX;
             }
 
-            bool IsValidCipher (const std::string &cipher) {
+            util::ui8 FindCipher (const std::string &cipher) {
                 for (std::size_t i = 0; i < ciphersSize; ++i) {
                     if (ciphers[i].name == cipher) {
-                        return true;
+                        return (util::ui8)i;
                     }
                 }
-                return false;
+                return CipherSuite::INVALID_INDEX;
             }
 
-            bool IsValidMessageDigest (const std::string &messageDigest) {
+            util::ui8 FindMessageDigest (const std::string &messageDigest) {
                 for (std::size_t i = 0; i < messageDigestsSize; ++i) {
                     if (messageDigests[i].name == messageDigest) {
-                        return true;
+                        return (util::ui8)i;
                     }
                 }
-                return false;
+                return CipherSuite::INVALID_INDEX;
             }
         }
 
@@ -364,46 +699,58 @@ namespace thekogans {
                 authenticator.empty () &&
                 cipher.empty () &&
                 messageDigest.empty ()) ||
-                (IsValidKeyExchange (keyExchange) &&
-                IsValidAuthenticator (authenticator) &&
-                IsValidCipher (cipher) &&
-                IsValidMessageDigest (messageDigest) &&
+                (FindKeyExchange (keyExchange) != INVALID_INDEX &&
+                FindAuthenticator (authenticator) != INVALID_INDEX &&
+                FindCipher (cipher) != INVALID_INDEX &&
+                FindMessageDigest (messageDigest) != INVALID_INDEX &&
                 ValidateAlgorithms (keyExchange, authenticator, cipher, messageDigest));
         }
 
+        const EVP_CIPHER *CipherSuite::GetOpenSSLCipher () const {
+            OpenSSLInit::RegisterCipher (openSSLCipher);
+            return openSSLCipher;
+        }
+
+        const EVP_MD *CipherSuite::GetOpenSSLMessageDigest () const {
+            OpenSSLInit::RegisterMessageDigest (openSSLMessageDigest);
+            return openSSLMessageDigest;
+        }
+
         bool CipherSuite::VerifyKeyExchangeParams (const Params &params) const {
             const char *type = params.GetKeyType ();
-            return
-                (keyExchange == CipherSuite::KEY_EXCHANGE_ECDHE &&
+            return IsKeyTypeEnabled (type) && (
+                (keyExchangeIndex == KEY_EXCHANGE_INDEX_ECDHE &&
                     (type == OPENSSL_PKEY_EC || type == X25519AsymmetricKey::KEY_TYPE)) ||
-                (keyExchange == CipherSuite::KEY_EXCHANGE_DHE && type == OPENSSL_PKEY_DH);
+                (keyExchangeIndex == KEY_EXCHANGE_INDEX_DHE && type == OPENSSL_PKEY_DH));
         }
 
         bool CipherSuite::VerifyKeyExchangeKey (const AsymmetricKey &key) const {
             const char *type = key.GetKeyType ();
-            return keyExchange == CipherSuite::KEY_EXCHANGE_RSA && type == OPENSSL_PKEY_RSA;
+            return IsKeyTypeEnabled (type) && (
+                keyExchangeIndex == KEY_EXCHANGE_INDEX_RSA && type == OPENSSL_PKEY_RSA);
         }
 
         bool CipherSuite::VerifyAuthenticatorParams (const Params &params) const {
             const char *type = params.GetKeyType ();
-            return
-                (authenticator == CipherSuite::AUTHENTICATOR_ECDSA &&
+            return IsKeyTypeEnabled (type) && (
+                (authenticatorIndex == AUTHENTICATOR_INDEX_ECDSA &&
                     (type == OPENSSL_PKEY_EC || type == Ed25519AsymmetricKey::KEY_TYPE)) ||
-                (authenticator == CipherSuite::AUTHENTICATOR_DSA && type == OPENSSL_PKEY_DSA);
+                (authenticatorIndex == AUTHENTICATOR_INDEX_DSA && type == OPENSSL_PKEY_DSA));
         }
 
         bool CipherSuite::VerifyAuthenticatorKey (const AsymmetricKey &key) const {
             const char *type = key.GetKeyType ();
-            return
-                (authenticator == CipherSuite::AUTHENTICATOR_ECDSA &&
+            return IsKeyTypeEnabled (type) && (
+                (authenticatorIndex == AUTHENTICATOR_INDEX_ECDSA &&
                     (type == OPENSSL_PKEY_EC || type == Ed25519AsymmetricKey::KEY_TYPE)) ||
-                (authenticator == CipherSuite::AUTHENTICATOR_DSA && type == OPENSSL_PKEY_DSA) ||
-                (authenticator == CipherSuite::AUTHENTICATOR_RSA && type == OPENSSL_PKEY_RSA) ||
-                (authenticator == CipherSuite::AUTHENTICATOR_Ed25519 && type == Ed25519AsymmetricKey::KEY_TYPE);
+                (authenticatorIndex == AUTHENTICATOR_INDEX_DSA && type == OPENSSL_PKEY_DSA) ||
+                (authenticatorIndex == AUTHENTICATOR_INDEX_RSA && type == OPENSSL_PKEY_RSA) ||
+                (authenticatorIndex == AUTHENTICATOR_INDEX_Ed25519 &&
+                    type == Ed25519AsymmetricKey::KEY_TYPE));
         }
 
         bool CipherSuite::VerifyCipherKey (const SymmetricKey &key) const {
-            return GetCipherKeyLength (GetOpenSSLCipherByName (cipher)) == key.GetKeyLength ();
+            return openSSLCipher != 0 && GetCipherKeyLength (openSSLCipher) == key.GetKeyLength ();
         }
 
         bool CipherSuite::VerifyMACKey (
@@ -412,6 +759,11 @@ namespace thekogans {
             return hmac || VerifyCipherKey (key);
         }
 
+        Params::SharedPtr CipherSuite::GetDefaultKeyExchangeParams () const {
+            return keyExchangeIndex == KEY_EXCHANGE_INDEX_ECDHE ?
+                EC::ParamsFromX25519Curve () : Params::SharedPtr ();
+        }
+
         KeyExchange::SharedPtr CipherSuite::GetDHEKeyExchange (
                 const ID &keyExchangeId,
                 Params::SharedPtr params,
@@ -421,6 +773,9 @@ namespace thekogans {
                 const ID &keyId,
                 const std::string &keyName,
                 const std::string &keyDescription) const {
+            if (params.Get () == 0) {
+                params = GetDefaultKeyExchangeParams ();
+            }
             if (params.Get () != 0 && VerifyKeyExchangeParams (*params)) {
                 return KeyExchange::SharedPtr (
                     new DHEKeyExchange (
@@ -451,6 +806,7 @@ namespace thekogans {
                 const ID &keyId,
                 const std::string &keyName,
                 const std::string &keyDescription) const {
+        #if defined (THEKOGANS_CRYPTO_HAVE_RSA)
             if (key.Get () != 0 && VerifyKeyExchangeKey (*key)) {
                 return KeyExchange::SharedPtr (
                     new RSAKeyExchange (
@@ -470,6 +826,11 @@ namespace thekogans {
                 THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
                     THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
             }
+        #else // defined (THEKOGANS_CRYPTO_HAVE_RSA)
+            THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                "%s key exchange is not compiled in.",
+                KEY_EXCHANGE_RSA);
+        #endif // defined (THEKOGANS_CRYPTO_HAVE_RSA)
         }
 
         Authenticator::SharedPtr CipherSuite::GetAuthenticator (AsymmetricKey::SharedPtr key) const {
@@ -488,8 +849,8 @@ namespace thekogans {
                 return Cipher::SharedPtr (
                     new Cipher (
                         key,
-                        GetOpenSSLCipherByName (cipher),
-                        GetOpenSSLMessageDigestByName (messageDigest)));
+                        GetOpenSSLCipher (),
+                        GetOpenSSLMessageDigest ()));
             }
             else {
                 THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
@@ -499,6 +860,12 @@ namespace thekogans {
 
         MAC::SharedPtr CipherSuite::GetHMAC (SymmetricKey::SharedPtr key) const {
             if (key.Get () != 0 && VerifyMACKey (*key, true)) {
+            #if defined (THEKOGANS_CRYPTO_HAVE_BLAKE2)
+                // BLAKE2 has native keyed hashing, one pass instead of HMAC's two.
+                if (Blake2MAC::IsBlake2 (GetOpenSSLMessageDigest ())) {
+                    return MAC::SharedPtr (new Blake2MAC (key, GetOpenSSLMessageDigest ()));
+                }
+            #endif // defined (THEKOGANS_CRYPTO_HAVE_BLAKE2)
                 return MAC::SharedPtr (new HMAC (key, GetOpenSSLMessageDigest ()));
             }
             else {
@@ -517,9 +884,48 @@ namespace thekogans {
             }
         }
 
+        MAC::SharedPtr CipherSuite::GetGMAC (SymmetricKey::SharedPtr key) const {
+            if (key.Get () != 0 &&
+                    GMAC::GetCipherFromKeyLength (key->GetKeyLength ()) != 0) {
+                return MAC::SharedPtr (
+                    new GMAC (key, GMAC::GetCipherFromKeyLength (key->GetKeyLength ())));
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        MAC::SharedPtr CipherSuite::GetPoly1305 (SymmetricKey::SharedPtr key) const {
+            if (key.Get () != 0 && key->GetKeyLength () == Poly1305::KEY_LENGTH) {
+                return MAC::SharedPtr (new Poly1305 (key));
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        MAC::SharedPtr CipherSuite::GetMAC (
+                SymmetricKey::SharedPtr key,
+                MAC::Type type) const {
+            switch (type) {
+                case MAC::TYPE_HMAC:
+                    return GetHMAC (key);
+                case MAC::TYPE_CMAC:
+                    return GetCMAC (key);
+                case MAC::TYPE_GMAC:
+                    return GetGMAC (key);
+                case MAC::TYPE_POLY1305:
+                    return GetPoly1305 (key);
+            }
+            THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+        }
+
         MessageDigest::SharedPtr CipherSuite::GetMessageDigest () const {
             return MessageDigest::SharedPtr (
-                new MessageDigest (GetOpenSSLMessageDigestByName (messageDigest)));
+                new MessageDigest (GetOpenSSLMessageDigest ()));
         }
 
         AsymmetricKey::SharedPtr CipherSuite::CreateAuthenticatorKey (
@@ -529,18 +935,20 @@ namespace thekogans {
                 const std::string &name,
                 const std::string &description) const {
             if (!IsAuthenticatorEC ()) {
-                if (authenticator == AUTHENTICATOR_DSA) {
+            #if defined (THEKOGANS_CRYPTO_HAVE_DSA)
+                if (authenticatorIndex == AUTHENTICATOR_INDEX_DSA) {
                     return crypto::DSA::ParamsFromKeyLength (keyLength, id, name, description)->CreateKey ();
                 }
-                else if (authenticator == AUTHENTICATOR_RSA) {
+            #endif // defined (THEKOGANS_CRYPTO_HAVE_DSA)
+            #if defined (THEKOGANS_CRYPTO_HAVE_RSA)
+                if (authenticatorIndex == AUTHENTICATOR_INDEX_RSA) {
                     return crypto::RSA::CreateKey (keyLength,
                         std::move (RSAPublicExponent), id, name, description);
                 }
-                else {
-                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
-                        "Unknown authenticator: %s",
-                        authenticator.c_str ());
-                }
+            #endif // defined (THEKOGANS_CRYPTO_HAVE_RSA)
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "Unknown authenticator: %s",
+                    authenticator.c_str ());
             }
             else {
                 THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
@@ -555,7 +963,8 @@ namespace thekogans {
                 const std::string &name,
                 const std::string &description) const {
             if (IsAuthenticatorEC ()) {
-                if (authenticator == AUTHENTICATOR_ECDSA || authenticator == AUTHENTICATOR_Ed25519) {
+                if (authenticatorIndex == AUTHENTICATOR_INDEX_ECDSA ||
+                        authenticatorIndex == AUTHENTICATOR_INDEX_Ed25519) {
                     return EC::ParamsFromCurveName (curveName)->CreateKey ();
                 }
                 else {
@@ -589,11 +998,39 @@ namespace thekogans {
                 authenticatorSeparator,
                 cipherSeparator++ - authenticatorSeparator);
             messageDigest = cipherSuite.substr (cipherSeparator);
-            if (!IsValid ()) {
+            Resolve ();
+        }
+
+        void CipherSuite::Resolve () {
+            if (keyExchange.empty () &&
+                    authenticator.empty () &&
+                    cipher.empty () &&
+                    messageDigest.empty ()) {
+                keyExchangeIndex = INVALID_INDEX;
+                authenticatorIndex = INVALID_INDEX;
+                cipherIndex = INVALID_INDEX;
+                messageDigestIndex = INVALID_INDEX;
+                openSSLCipher = 0;
+                openSSLMessageDigest = 0;
+                code = INVALID_CODE;
+                return;
+            }
+            keyExchangeIndex = FindKeyExchange (keyExchange);
+            authenticatorIndex = FindAuthenticator (authenticator);
+            cipherIndex = FindCipher (cipher);
+            messageDigestIndex = FindMessageDigest (messageDigest);
+            if (keyExchangeIndex == INVALID_INDEX ||
+                    authenticatorIndex == INVALID_INDEX ||
+                    cipherIndex == INVALID_INDEX ||
+                    messageDigestIndex == INVALID_INDEX ||
+                    !ValidateAlgorithms (keyExchange, authenticator, cipher, messageDigest)) {
                 THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
                     "Invalid cipher suite: %s",
-                    cipherSuite.c_str ());
+                    ToString ().c_str ());
             }
+            openSSLCipher = ciphers[cipherIndex].cipher;
+            openSSLMessageDigest = messageDigests[messageDigestIndex].md;
+            code = MakeCode (keyExchangeIndex, authenticatorIndex, cipherIndex, messageDigest);
         }
 
     } // namespace crypto
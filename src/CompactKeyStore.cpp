@@ -0,0 +1,207 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#include <cstring>
+#include "thekogans/util/Exception.h"
+#include "thekogans/util/SecureAllocator.h"
+#include "thekogans/crypto/ConstantTime.h"
+#include "thekogans/crypto/AllocationTracker.h"
+#include "thekogans/crypto/CompactKeyStore.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        bool CompactKeyStore::Add (const SymmetricKey &key) {
+            if (slabs.empty ()) {
+                // The first key fixes the record size.
+                keyLength = key.GetKeyLength ();
+                recordSize = RECORD_KEY + keyLength;
+                recordsPerSlab = SLAB_SIZE / recordSize;
+            }
+            else if (key.GetKeyLength () > keyLength) {
+                return false;
+            }
+            if ((count + 1) * 4 > slots.size () * 3) {
+                Rehash (slots.empty () ? (std::size_t)MIN_SLOTS : slots.size () * 2);
+            }
+            util::ui32 hash = Hash (key.GetId ().data);
+            std::size_t slot = FindSlot (key.GetId (), hash);
+            if (slots[slot].index != 0) {
+                return false;
+            }
+            if (count == slabs.size () * recordsPerSlab) {
+                AllocationTracker::Record (AllocationTracker::SOURCE_SECURE, SLAB_SIZE);
+                slabs.push_back (
+                    (util::ui8 *)util::SecureAllocator::Instance ().Alloc (SLAB_SIZE));
+            }
+            util::ui8 *record = GetRecord (count);
+            memcpy (record + RECORD_ID, key.GetId ().data, ID::SIZE);
+            record[RECORD_LENGTH] = (util::ui8)key.GetKeyLength ();
+            record[RECORD_FLAGS] = 0;
+            memcpy (record + RECORD_KEY, key.Get ().GetReadPtr (), key.GetKeyLength ());
+            memset (record + RECORD_KEY + key.GetKeyLength (), 0, keyLength - key.GetKeyLength ());
+            if (!key.GetName ().empty () || !key.GetDescription ().empty ()) {
+                names.insert (
+                    IDHashMap<std::pair<std::string, std::string> >::value_type (
+                        key.GetId (),
+                        std::pair<std::string, std::string> (
+                            key.GetName (), key.GetDescription ())));
+                record[RECORD_FLAGS] |= FLAG_NAMED;
+            }
+            slots[slot].hash = hash;
+            slots[slot].index = (util::ui32)++count;
+            return true;
+        }
+
+        SymmetricKey::SharedPtr CompactKeyStore::Get (const ID &keyId) const {
+            std::size_t slot = FindSlot (keyId, Hash (keyId.data));
+            return slot != slots.size () && slots[slot].index != 0 ?
+                Materialize (GetRecord (slots[slot].index - 1)) : SymmetricKey::SharedPtr ();
+        }
+
+        SymmetricKey::SharedPtr CompactKeyStore::GetAt (std::size_t index) const {
+            if (index >= count) {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+            return Materialize (GetRecord (index));
+        }
+
+        bool CompactKeyStore::Drop (const ID &keyId) {
+            util::ui32 hash = Hash (keyId.data);
+            std::size_t slot = FindSlot (keyId, hash);
+            if (slot == slots.size () || slots[slot].index == 0) {
+                return false;
+            }
+            std::size_t index = slots[slot].index - 1;
+            util::ui8 *record = GetRecord (index);
+            if ((record[RECORD_FLAGS] & FLAG_NAMED) != 0) {
+                names.erase (keyId);
+            }
+            RemoveSlot (slot);
+            std::size_t last = --count;
+            if (index != last) {
+                // Move the last record in to the hole.
+                const util::ui8 *lastRecord = GetRecord (last);
+                slots[FindIndexSlot ((util::ui32)last + 1, Hash (lastRecord + RECORD_ID))].index =
+                    (util::ui32)index + 1;
+                memcpy (record, lastRecord, recordSize);
+            }
+            SecureZero (GetRecord (last), recordSize);
+            // Keep one spare slab, so that an Add/Drop
+            // at a slab boundary does not thrash.
+            while (slabs.size () > count / recordsPerSlab + 2) {
+                util::SecureAllocator::Instance ().Free (slabs.back (), SLAB_SIZE);
+                slabs.pop_back ();
+            }
+            return true;
+        }
+
+        void CompactKeyStore::Clear () {
+            for (std::size_t i = 0, slabCount = slabs.size (); i < slabCount; ++i) {
+                SecureZero (slabs[i], SLAB_SIZE);
+                util::SecureAllocator::Instance ().Free (slabs[i], SLAB_SIZE);
+            }
+            slabs.clear ();
+            keyLength = 0;
+            recordSize = 0;
+            recordsPerSlab = 0;
+            count = 0;
+            slots.clear ();
+            names.clear ();
+        }
+
+        std::size_t CompactKeyStore::FindSlot (
+                const ID &id,
+                util::ui32 hash) const {
+            if (slots.empty ()) {
+                return 0;
+            }
+            std::size_t mask = slots.size () - 1;
+            for (std::size_t slot = hash & mask;; slot = (slot + 1) & mask) {
+                const Slot &entry = slots[slot];
+                if (entry.index == 0 ||
+                        (entry.hash == hash &&
+                            ConstantTimeCompare (
+                                GetRecord (entry.index - 1) + RECORD_ID, id.data, ID::SIZE))) {
+                    return slot;
+                }
+            }
+        }
+
+        std::size_t CompactKeyStore::FindIndexSlot (
+                util::ui32 index,
+                util::ui32 hash) const {
+            std::size_t mask = slots.size () - 1;
+            std::size_t slot = hash & mask;
+            while (slots[slot].index != index) {
+                slot = (slot + 1) & mask;
+            }
+            return slot;
+        }
+
+        void CompactKeyStore::RemoveSlot (std::size_t hole) {
+            std::size_t mask = slots.size () - 1;
+            for (std::size_t slot = (hole + 1) & mask;
+                    slots[slot].index != 0; slot = (slot + 1) & mask) {
+                // An entry can move back to the hole if the
+                // hole is between it's home slot and it.
+                std::size_t home = slots[slot].hash & mask;
+                if (((slot - home) & mask) >= ((slot - hole) & mask)) {
+                    slots[hole] = slots[slot];
+                    hole = slot;
+                }
+            }
+            slots[hole] = Slot ();
+        }
+
+        void CompactKeyStore::Rehash (std::size_t slotCount) {
+            std::vector<Slot> newSlots (slotCount);
+            std::size_t mask = slotCount - 1;
+            for (std::size_t i = 0, slotsCount = slots.size (); i < slotsCount; ++i) {
+                if (slots[i].index != 0) {
+                    std::size_t slot = slots[i].hash & mask;
+                    while (newSlots[slot].index != 0) {
+                        slot = (slot + 1) & mask;
+                    }
+                    newSlots[slot] = slots[i];
+                }
+            }
+            slots.swap (newSlots);
+        }
+
+        SymmetricKey::SharedPtr CompactKeyStore::Materialize (const util::ui8 *record) const {
+            ID id (record + RECORD_ID);
+            if ((record[RECORD_FLAGS] & FLAG_NAMED) != 0) {
+                IDHashMap<std::pair<std::string, std::string> >::const_iterator it =
+                    names.find (id);
+                if (it != names.end ()) {
+                    return SymmetricKey::SharedPtr (
+                        new SymmetricKey (
+                            record + RECORD_KEY,
+                            record[RECORD_LENGTH],
+                            id,
+                            it->second.first,
+                            it->second.second));
+                }
+            }
+            return SymmetricKey::SharedPtr (
+                new SymmetricKey (record + RECORD_KEY, record[RECORD_LENGTH], id));
+        }
+
+    } // namespace crypto
+} // namespace thekogans
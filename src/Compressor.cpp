@@ -0,0 +1,202 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#include <cstring>
+#if defined (THEKOGANS_CRYPTO_HAVE_ZSTD)
+    #include <zstd.h>
+#endif // defined (THEKOGANS_CRYPTO_HAVE_ZSTD)
+#if defined (THEKOGANS_CRYPTO_HAVE_LZ4)
+    #include <lz4.h>
+    #include <lz4hc.h>
+#endif // defined (THEKOGANS_CRYPTO_HAVE_LZ4)
+#include "thekogans/util/Exception.h"
+#include "thekogans/crypto/Compressor.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        bool Compressor::IsSupported (util::ui8 algorithm) {
+            switch (algorithm) {
+                case NONE:
+                    return true;
+            #if defined (THEKOGANS_CRYPTO_HAVE_ZSTD)
+                case ZSTD:
+                    return true;
+            #endif // defined (THEKOGANS_CRYPTO_HAVE_ZSTD)
+            #if defined (THEKOGANS_CRYPTO_HAVE_LZ4)
+                case LZ4:
+                    return true;
+            #endif // defined (THEKOGANS_CRYPTO_HAVE_LZ4)
+            }
+            return false;
+        }
+
+        util::ui8 Compressor::FromString (const std::string &algorithm) {
+            if (algorithm == "none") {
+                return NONE;
+            }
+            if (algorithm == "zstd") {
+                return ZSTD;
+            }
+            if (algorithm == "lz4") {
+                return LZ4;
+            }
+            THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                "Unknown compression algorithm: %s",
+                algorithm.c_str ());
+        }
+
+        std::string Compressor::ToString (util::ui8 algorithm) {
+            return algorithm == NONE ? "none" :
+                algorithm == ZSTD ? "zstd" :
+                algorithm == LZ4 ? "lz4" : "unknown";
+        }
+
+        std::size_t Compressor::Compress (
+                util::ui8 algorithm,
+                int level,
+                const void *input,
+                std::size_t inputLength,
+                void *output,
+                std::size_t outputLength) {
+            if (input == 0 || output == 0) {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+            switch (algorithm) {
+                case NONE: {
+                    if (inputLength > outputLength) {
+                        return 0;
+                    }
+                    memcpy (output, input, inputLength);
+                    return inputLength;
+                }
+            #if defined (THEKOGANS_CRYPTO_HAVE_ZSTD)
+                case ZSTD: {
+                    std::size_t result = ZSTD_compress (
+                        output,
+                        outputLength,
+                        input,
+                        inputLength,
+                        level == DEFAULT_LEVEL ? ZSTD_CLEVEL_DEFAULT : level);
+                    // A full destination buffer is the expected
+                    // outcome for incompressible blocks.
+                    return ZSTD_isError (result) ? 0 : result;
+                }
+            #endif // defined (THEKOGANS_CRYPTO_HAVE_ZSTD)
+            #if defined (THEKOGANS_CRYPTO_HAVE_LZ4)
+                case LZ4: {
+                    if (inputLength > (std::size_t)LZ4_MAX_INPUT_SIZE) {
+                        THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                            THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+                    }
+                    int capacity = outputLength > (std::size_t)LZ4_MAX_INPUT_SIZE ?
+                        LZ4_MAX_INPUT_SIZE : (int)outputLength;
+                    int result = level > 1 ?
+                        LZ4_compress_HC (
+                            (const char *)input,
+                            (char *)output,
+                            (int)inputLength,
+                            capacity,
+                            level) :
+                        LZ4_compress_default (
+                            (const char *)input,
+                            (char *)output,
+                            (int)inputLength,
+                            capacity);
+                    return result > 0 ? (std::size_t)result : 0;
+                }
+            #endif // defined (THEKOGANS_CRYPTO_HAVE_LZ4)
+            }
+            THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                "Unsupported compression algorithm: %u",
+                algorithm);
+        }
+
+        void Compressor::Decompress (
+                util::ui8 algorithm,
+                const void *input,
+                std::size_t inputLength,
+                void *output,
+                std::size_t outputLength) {
+            if (input == 0 || output == 0) {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+            std::size_t decompressedLength = 0;
+            switch (algorithm) {
+                case NONE: {
+                    if (inputLength == outputLength) {
+                        memcpy (output, input, inputLength);
+                        decompressedLength = inputLength;
+                    }
+                    break;
+                }
+            #if defined (THEKOGANS_CRYPTO_HAVE_ZSTD)
+                case ZSTD: {
+                    std::size_t result = ZSTD_decompress (
+                        output,
+                        outputLength,
+                        input,
+                        inputLength);
+                    if (ZSTD_isError (result)) {
+                        THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                            "ZSTD_decompress failed: %s",
+                            ZSTD_getErrorName (result));
+                    }
+                    decompressedLength = result;
+                    break;
+                }
+            #endif // defined (THEKOGANS_CRYPTO_HAVE_ZSTD)
+            #if defined (THEKOGANS_CRYPTO_HAVE_LZ4)
+                case LZ4: {
+                    if (inputLength > (std::size_t)LZ4_MAX_INPUT_SIZE ||
+                            outputLength > (std::size_t)LZ4_MAX_INPUT_SIZE) {
+                        THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                            THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+                    }
+                    int result = LZ4_decompress_safe (
+                        (const char *)input,
+                        (char *)output,
+                        (int)inputLength,
+                        (int)outputLength);
+                    if (result < 0) {
+                        THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                            "LZ4_decompress_safe failed: %d",
+                            result);
+                    }
+                    decompressedLength = (std::size_t)result;
+                    break;
+                }
+            #endif // defined (THEKOGANS_CRYPTO_HAVE_LZ4)
+                default: {
+                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                        "Unsupported compression algorithm: %u",
+                        algorithm);
+                }
+            }
+            if (decompressedLength != outputLength) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "Decompressed length mismatch (" THEKOGANS_UTIL_SIZE_T_FORMAT
+                    " != " THEKOGANS_UTIL_SIZE_T_FORMAT ")",
+                    decompressedLength,
+                    outputLength);
+            }
+        }
+
+    } // namespace crypto
+} // namespace thekogans
@@ -0,0 +1,397 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#include <map>
+#include "thekogans/util/Exception.h"
+#include "thekogans/util/LockGuard.h"
+#include "thekogans/crypto/ConcurrentKeyRing.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        namespace {
+            // Thread caches are keyed on instance ids (not addresses)
+            // so that a new instance can never pick up a dead one's cache.
+            std::atomic<util::ui64> nextInstanceId (1);
+
+            template<typename Table>
+            typename Table::SharedPtr CopyTable (const Table &table) {
+                typename Table::SharedPtr copy (new Table);
+                copy->keys = table.keys;
+                return copy;
+            }
+
+            template<typename Key>
+            Key FindKey (
+                    const IDHashMap<Key> &keys,
+                    const ID &keyId) {
+                typename IDHashMap<Key>::const_iterator it = keys.find (keyId);
+                return it != keys.end () ? it->second : Key ();
+            }
+
+            // Drop cached instances whose keys are not in the new table.
+            template<typename Cache, typename Keys>
+            void PruneCache (
+                    Cache &cache,
+                    const Keys &keys) {
+                for (typename Cache::iterator it = cache.begin (); it != cache.end ();) {
+                    if (keys.find (it->first) == keys.end ()) {
+                        // IDHashMap::erase moves the last entry in to it's place.
+                        cache.erase (it);
+                    }
+                    else {
+                        ++it;
+                    }
+                }
+            }
+        }
+
+        SymmetricKey::SharedPtr ConcurrentKeyRing::Snapshot::GetCipherKey (
+                const ID &keyId) const {
+            return FindKey (cipherKeys->keys, keyId);
+        }
+
+        SymmetricKey::SharedPtr ConcurrentKeyRing::Snapshot::GetMACKey (
+                const ID &keyId) const {
+            return FindKey (macKeys->keys, keyId);
+        }
+
+        AsymmetricKey::SharedPtr ConcurrentKeyRing::Snapshot::GetAuthenticatorKey (
+                const ID &keyId) const {
+            return FindKey (authenticatorKeys->keys, keyId);
+        }
+
+        struct ConcurrentKeyRing::ThreadCache {
+            std::weak_ptr<util::ui8> lifetime;
+            Snapshot::SharedPtr snapshot;
+            IDHashMap<Cipher::SharedPtr> ciphers;
+            IDHashMap<MAC::SharedPtr> macs;
+            IDHashMap<Authenticator::SharedPtr> authenticators;
+        };
+
+        ConcurrentKeyRing::ConcurrentKeyRing (const CipherSuite &cipherSuite_) :
+                cipherSuite (cipherSuite_),
+                instanceId (nextInstanceId++),
+                lifetime (new util::ui8 (0)),
+                version (0),
+                snapshot (
+                    new Snapshot (
+                        0,
+                        SymmetricKeyTable::SharedPtr (new SymmetricKeyTable),
+                        SymmetricKeyTable::SharedPtr (new SymmetricKeyTable),
+                        AsymmetricKeyTable::SharedPtr (new AsymmetricKeyTable))) {}
+
+        ConcurrentKeyRing::ConcurrentKeyRing (
+                const KeyRing &keyRing,
+                bool recursive) :
+                cipherSuite (keyRing.GetCipherSuite ()),
+                instanceId (nextInstanceId++),
+                lifetime (new util::ui8 (0)),
+                version (0) {
+            SymmetricKeyTable::SharedPtr cipherKeys (new SymmetricKeyTable);
+            {
+                std::vector<SymmetricKey::SharedPtr> keys;
+                keyRing.GetCipherKeys (keys, recursive);
+                for (std::size_t i = 0, count = keys.size (); i < count; ++i) {
+                    cipherKeys->keys.insert (
+                        IDHashMap<SymmetricKey::SharedPtr>::value_type (keys[i]->GetId (), keys[i]));
+                }
+            }
+            SymmetricKeyTable::SharedPtr macKeys (new SymmetricKeyTable);
+            {
+                std::vector<SymmetricKey::SharedPtr> keys;
+                keyRing.GetMACKeys (keys, recursive);
+                for (std::size_t i = 0, count = keys.size (); i < count; ++i) {
+                    macKeys->keys.insert (
+                        IDHashMap<SymmetricKey::SharedPtr>::value_type (keys[i]->GetId (), keys[i]));
+                }
+            }
+            AsymmetricKeyTable::SharedPtr authenticatorKeys (new AsymmetricKeyTable);
+            {
+                std::vector<AsymmetricKey::SharedPtr> keys;
+                keyRing.GetAuthenticatorKeys (keys, recursive);
+                for (std::size_t i = 0, count = keys.size (); i < count; ++i) {
+                    authenticatorKeys->keys.insert (
+                        IDHashMap<AsymmetricKey::SharedPtr>::value_type (keys[i]->GetId (), keys[i]));
+                }
+            }
+            snapshot.Reset (new Snapshot (0, cipherKeys, macKeys, authenticatorKeys));
+        }
+
+        ConcurrentKeyRing::Snapshot::SharedPtr ConcurrentKeyRing::GetSnapshot () const {
+            return GetThreadCache ().snapshot;
+        }
+
+        SymmetricKey::SharedPtr ConcurrentKeyRing::GetCipherKey (const ID &keyId) const {
+            return GetThreadCache ().snapshot->GetCipherKey (keyId);
+        }
+
+        Cipher::SharedPtr ConcurrentKeyRing::GetCipher (const ID &keyId) const {
+            ThreadCache &threadCache = GetThreadCache ();
+            IDHashMap<Cipher::SharedPtr>::const_iterator it = threadCache.ciphers.find (keyId);
+            if (it != threadCache.ciphers.end ()) {
+                return it->second;
+            }
+            SymmetricKey::SharedPtr key = threadCache.snapshot->GetCipherKey (keyId);
+            if (key.Get () != 0) {
+                Cipher::SharedPtr cipher = cipherSuite.GetCipher (key);
+                threadCache.ciphers.insert (
+                    IDHashMap<Cipher::SharedPtr>::value_type (keyId, cipher));
+                return cipher;
+            }
+            return Cipher::SharedPtr ();
+        }
+
+        bool ConcurrentKeyRing::AddCipherKey (SymmetricKey::SharedPtr key) {
+            if (key.Get () != 0 && cipherSuite.VerifyCipherKey (*key)) {
+                util::LockGuard<util::Mutex> guard (writerMutex);
+                if (snapshot->GetCipherKey (key->GetId ()).Get () == 0) {
+                    SymmetricKeyTable::SharedPtr cipherKeys = CopyTable (*snapshot->cipherKeys);
+                    cipherKeys->keys.insert (
+                        IDHashMap<SymmetricKey::SharedPtr>::value_type (key->GetId (), key));
+                    Publish (cipherKeys, snapshot->macKeys, snapshot->authenticatorKeys);
+                    return true;
+                }
+                return false;
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        bool ConcurrentKeyRing::DropCipherKey (const ID &keyId) {
+            util::LockGuard<util::Mutex> guard (writerMutex);
+            if (snapshot->GetCipherKey (keyId).Get () != 0) {
+                SymmetricKeyTable::SharedPtr cipherKeys = CopyTable (*snapshot->cipherKeys);
+                cipherKeys->keys.erase (keyId);
+                Publish (cipherKeys, snapshot->macKeys, snapshot->authenticatorKeys);
+                return true;
+            }
+            return false;
+        }
+
+        bool ConcurrentKeyRing::RotateCipherKey (
+                SymmetricKey::SharedPtr newKey,
+                const ID &oldKeyId) {
+            if (newKey.Get () != 0 && cipherSuite.VerifyCipherKey (*newKey)) {
+                util::LockGuard<util::Mutex> guard (writerMutex);
+                if (snapshot->GetCipherKey (newKey->GetId ()).Get () == 0 &&
+                        snapshot->GetCipherKey (oldKeyId).Get () != 0) {
+                    SymmetricKeyTable::SharedPtr cipherKeys = CopyTable (*snapshot->cipherKeys);
+                    cipherKeys->keys.erase (oldKeyId);
+                    cipherKeys->keys.insert (
+                        IDHashMap<SymmetricKey::SharedPtr>::value_type (newKey->GetId (), newKey));
+                    Publish (cipherKeys, snapshot->macKeys, snapshot->authenticatorKeys);
+                    return true;
+                }
+                return false;
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        SymmetricKey::SharedPtr ConcurrentKeyRing::GetMACKey (const ID &keyId) const {
+            return GetThreadCache ().snapshot->GetMACKey (keyId);
+        }
+
+        MAC::SharedPtr ConcurrentKeyRing::GetMAC (const ID &keyId) const {
+            ThreadCache &threadCache = GetThreadCache ();
+            IDHashMap<MAC::SharedPtr>::const_iterator it = threadCache.macs.find (keyId);
+            if (it != threadCache.macs.end ()) {
+                return it->second;
+            }
+            SymmetricKey::SharedPtr key = threadCache.snapshot->GetMACKey (keyId);
+            if (key.Get () != 0) {
+                MAC::SharedPtr mac = cipherSuite.GetHMAC (key);
+                threadCache.macs.insert (
+                    IDHashMap<MAC::SharedPtr>::value_type (keyId, mac));
+                return mac;
+            }
+            return MAC::SharedPtr ();
+        }
+
+        bool ConcurrentKeyRing::AddMACKey (SymmetricKey::SharedPtr key) {
+            if (key.Get () != 0 && cipherSuite.VerifyMACKey (*key, true)) {
+                util::LockGuard<util::Mutex> guard (writerMutex);
+                if (snapshot->GetMACKey (key->GetId ()).Get () == 0) {
+                    SymmetricKeyTable::SharedPtr macKeys = CopyTable (*snapshot->macKeys);
+                    macKeys->keys.insert (
+                        IDHashMap<SymmetricKey::SharedPtr>::value_type (key->GetId (), key));
+                    Publish (snapshot->cipherKeys, macKeys, snapshot->authenticatorKeys);
+                    return true;
+                }
+                return false;
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        bool ConcurrentKeyRing::DropMACKey (const ID &keyId) {
+            util::LockGuard<util::Mutex> guard (writerMutex);
+            if (snapshot->GetMACKey (keyId).Get () != 0) {
+                SymmetricKeyTable::SharedPtr macKeys = CopyTable (*snapshot->macKeys);
+                macKeys->keys.erase (keyId);
+                Publish (snapshot->cipherKeys, macKeys, snapshot->authenticatorKeys);
+                return true;
+            }
+            return false;
+        }
+
+        AsymmetricKey::SharedPtr ConcurrentKeyRing::GetAuthenticatorKey (const ID &keyId) const {
+            return GetThreadCache ().snapshot->GetAuthenticatorKey (keyId);
+        }
+
+        Authenticator::SharedPtr ConcurrentKeyRing::GetAuthenticator (const ID &keyId) const {
+            ThreadCache &threadCache = GetThreadCache ();
+            IDHashMap<Authenticator::SharedPtr>::const_iterator it =
+                threadCache.authenticators.find (keyId);
+            if (it != threadCache.authenticators.end ()) {
+                return it->second;
+            }
+            AsymmetricKey::SharedPtr key = threadCache.snapshot->GetAuthenticatorKey (keyId);
+            if (key.Get () != 0) {
+                Authenticator::SharedPtr authenticator = cipherSuite.GetAuthenticator (key);
+                threadCache.authenticators.insert (
+                    IDHashMap<Authenticator::SharedPtr>::value_type (keyId, authenticator));
+                return authenticator;
+            }
+            return Authenticator::SharedPtr ();
+        }
+
+        bool ConcurrentKeyRing::AddAuthenticatorKey (AsymmetricKey::SharedPtr key) {
+            if (key.Get () != 0 && cipherSuite.VerifyAuthenticatorKey (*key)) {
+                util::LockGuard<util::Mutex> guard (writerMutex);
+                if (snapshot->GetAuthenticatorKey (key->GetId ()).Get () == 0) {
+                    AsymmetricKeyTable::SharedPtr authenticatorKeys =
+                        CopyTable (*snapshot->authenticatorKeys);
+                    authenticatorKeys->keys.insert (
+                        IDHashMap<AsymmetricKey::SharedPtr>::value_type (key->GetId (), key));
+                    Publish (snapshot->cipherKeys, snapshot->macKeys, authenticatorKeys);
+                    return true;
+                }
+                return false;
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        bool ConcurrentKeyRing::DropAuthenticatorKey (const ID &keyId) {
+            util::LockGuard<util::Mutex> guard (writerMutex);
+            if (snapshot->GetAuthenticatorKey (keyId).Get () != 0) {
+                AsymmetricKeyTable::SharedPtr authenticatorKeys =
+                    CopyTable (*snapshot->authenticatorKeys);
+                authenticatorKeys->keys.erase (keyId);
+                Publish (snapshot->cipherKeys, snapshot->macKeys, authenticatorKeys);
+                return true;
+            }
+            return false;
+        }
+
+        KeyRing::SharedPtr ConcurrentKeyRing::ToKeyRing () const {
+            Snapshot::SharedPtr current = LoadSnapshot ();
+            KeyRing::SharedPtr keyRing (new KeyRing (cipherSuite));
+            for (IDHashMap<SymmetricKey::SharedPtr>::const_iterator
+                    it = current->cipherKeys->keys.begin (),
+                    end = current->cipherKeys->keys.end (); it != end; ++it) {
+                keyRing->AddCipherKey (it->second);
+            }
+            for (IDHashMap<SymmetricKey::SharedPtr>::const_iterator
+                    it = current->macKeys->keys.begin (),
+                    end = current->macKeys->keys.end (); it != end; ++it) {
+                keyRing->AddMACKey (it->second);
+            }
+            for (IDHashMap<AsymmetricKey::SharedPtr>::const_iterator
+                    it = current->authenticatorKeys->keys.begin (),
+                    end = current->authenticatorKeys->keys.end (); it != end; ++it) {
+                keyRing->AddAuthenticatorKey (it->second);
+            }
+            return keyRing;
+        }
+
+        ConcurrentKeyRing::ThreadCache &ConcurrentKeyRing::GetThreadCache () const {
+            typedef std::map<util::ui64, ThreadCache> ThreadCaches;
+            static thread_local ThreadCaches threadCaches;
+            ThreadCaches::iterator it = threadCaches.find (instanceId);
+            if (it == threadCaches.end ()) {
+                // First time this thread sees this instance. Take the
+                // opportunity to purge caches of instances that are gone.
+                for (it = threadCaches.begin (); it != threadCaches.end ();) {
+                    if (it->second.lifetime.expired ()) {
+                        threadCaches.erase (it++);
+                    }
+                    else {
+                        ++it;
+                    }
+                }
+                it = threadCaches.insert (
+                    ThreadCaches::value_type (instanceId, ThreadCache ())).first;
+                it->second.lifetime = lifetime;
+            }
+            ThreadCache &threadCache = it->second;
+            // Steady state: no writer published since this thread last
+            // looked, and the cached snapshot is used as is.
+            if (threadCache.snapshot.Get () == 0 ||
+                    threadCache.snapshot->version != version.load (std::memory_order_acquire)) {
+                Snapshot::SharedPtr current = LoadSnapshot ();
+                if (threadCache.snapshot.Get () != 0) {
+                    // Tables are shared between versions. Only
+                    // prune the caches whose tables changed.
+                    if (threadCache.snapshot->cipherKeys.Get () != current->cipherKeys.Get ()) {
+                        PruneCache (threadCache.ciphers, current->cipherKeys->keys);
+                    }
+                    if (threadCache.snapshot->macKeys.Get () != current->macKeys.Get ()) {
+                        PruneCache (threadCache.macs, current->macKeys->keys);
+                    }
+                    if (threadCache.snapshot->authenticatorKeys.Get () !=
+                            current->authenticatorKeys.Get ()) {
+                        PruneCache (threadCache.authenticators, current->authenticatorKeys->keys);
+                    }
+                }
+                threadCache.snapshot = current;
+            }
+            return threadCache;
+        }
+
+        void ConcurrentKeyRing::Publish (
+                SymmetricKeyTable::SharedPtr cipherKeys,
+                SymmetricKeyTable::SharedPtr macKeys,
+                AsymmetricKeyTable::SharedPtr authenticatorKeys) {
+            Snapshot::SharedPtr newSnapshot (
+                new Snapshot (
+                    snapshot->version + 1,
+                    cipherKeys,
+                    macKeys,
+                    authenticatorKeys));
+            util::LockGuard<util::SpinLock> guard (spinLock);
+            snapshot = newSnapshot;
+            version.store (newSnapshot->version, std::memory_order_release);
+        }
+
+        ConcurrentKeyRing::Snapshot::SharedPtr ConcurrentKeyRing::LoadSnapshot () const {
+            util::LockGuard<util::SpinLock> guard (spinLock);
+            return snapshot;
+        }
+
+    } // namespace crypto
+} // namespace thekogans
@@ -0,0 +1,151 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#include <cstring>
+#if defined (__x86_64__) || defined (_M_X64) || defined (__SSE2__) || \
+        (defined (_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define THEKOGANS_CRYPTO_CONSTANT_TIME_SSE2
+    #include <emmintrin.h>
+#elif defined (__ARM_NEON) || defined (__ARM_NEON__) || defined (_M_ARM64)
+    #define THEKOGANS_CRYPTO_CONSTANT_TIME_NEON
+    #include <arm_neon.h>
+#endif // defined (__x86_64__) || defined (_M_X64) || defined (__SSE2__) || ...
+#include "thekogans/crypto/ConstantTime.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        namespace {
+            enum {
+                VECTOR_LENGTH = 16
+            };
+
+            // Calling memset through a volatile pointer keeps the
+            // compiler from proving the stores dead (MSVC has no
+            // inline asm barrier on x64).
+            void *(*const volatile memsetPtr) (void *, int, std::size_t) = memset;
+        }
+
+        _LIB_THEKOGANS_CRYPTO_DECL bool _LIB_THEKOGANS_CRYPTO_API
+        ConstantTimeCompare (
+                const void *buffer1,
+                const void *buffer2,
+                std::size_t length) {
+            const util::ui8 *ptr1 = (const util::ui8 *)buffer1;
+            const util::ui8 *ptr2 = (const util::ui8 *)buffer2;
+            util::ui64 difference = 0;
+        #if defined (THEKOGANS_CRYPTO_CONSTANT_TIME_SSE2)
+            if (length >= VECTOR_LENGTH) {
+                __m128i accumulator = _mm_setzero_si128 ();
+                do {
+                    accumulator = _mm_or_si128 (
+                        accumulator,
+                        _mm_xor_si128 (
+                            _mm_loadu_si128 ((const __m128i *)ptr1),
+                            _mm_loadu_si128 ((const __m128i *)ptr2)));
+                    ptr1 += VECTOR_LENGTH;
+                    ptr2 += VECTOR_LENGTH;
+                    length -= VECTOR_LENGTH;
+                } while (length >= VECTOR_LENGTH);
+                // One bit per byte that differs (0 == identical).
+                difference = (util::ui64)(util::ui32)(_mm_movemask_epi8 (
+                    _mm_cmpeq_epi8 (accumulator, _mm_setzero_si128 ())) ^ 0xffff);
+            }
+        #elif defined (THEKOGANS_CRYPTO_CONSTANT_TIME_NEON)
+            if (length >= VECTOR_LENGTH) {
+                uint8x16_t accumulator = vdupq_n_u8 (0);
+                do {
+                    accumulator = vorrq_u8 (
+                        accumulator,
+                        veorq_u8 (vld1q_u8 (ptr1), vld1q_u8 (ptr2)));
+                    ptr1 += VECTOR_LENGTH;
+                    ptr2 += VECTOR_LENGTH;
+                    length -= VECTOR_LENGTH;
+                } while (length >= VECTOR_LENGTH);
+                uint64x2_t accumulator64 = vreinterpretq_u64_u8 (accumulator);
+                difference = vgetq_lane_u64 (accumulator64, 0) | vgetq_lane_u64 (accumulator64, 1);
+            }
+        #endif // defined (THEKOGANS_CRYPTO_CONSTANT_TIME_SSE2)
+            for (; length >= util::UI64_SIZE; length -= util::UI64_SIZE) {
+                util::ui64 word1;
+                util::ui64 word2;
+                memcpy (&word1, ptr1, util::UI64_SIZE);
+                memcpy (&word2, ptr2, util::UI64_SIZE);
+                difference |= word1 ^ word2;
+                ptr1 += util::UI64_SIZE;
+                ptr2 += util::UI64_SIZE;
+            }
+            while (length-- > 0) {
+                difference |= *ptr1++ ^ *ptr2++;
+            }
+            return difference == 0;
+        }
+
+        _LIB_THEKOGANS_CRYPTO_DECL void _LIB_THEKOGANS_CRYPTO_API
+        ConstantTimeSelect (
+                bool condition,
+                const void *buffer1,
+                const void *buffer2,
+                void *result,
+                std::size_t length) {
+            const util::ui8 *ptr1 = (const util::ui8 *)buffer1;
+            const util::ui8 *ptr2 = (const util::ui8 *)buffer2;
+            util::ui8 *out = (util::ui8 *)result;
+            // 0xff if condition is true, 0x00 otherwise.
+            util::ui8 mask = (util::ui8)(0 - (util::ui8)condition);
+        #if defined (THEKOGANS_CRYPTO_CONSTANT_TIME_SSE2)
+            __m128i mask128 = _mm_set1_epi8 ((char)mask);
+            for (; length >= VECTOR_LENGTH; length -= VECTOR_LENGTH) {
+                _mm_storeu_si128 (
+                    (__m128i *)out,
+                    _mm_or_si128 (
+                        _mm_and_si128 (mask128, _mm_loadu_si128 ((const __m128i *)ptr1)),
+                        _mm_andnot_si128 (mask128, _mm_loadu_si128 ((const __m128i *)ptr2))));
+                ptr1 += VECTOR_LENGTH;
+                ptr2 += VECTOR_LENGTH;
+                out += VECTOR_LENGTH;
+            }
+        #elif defined (THEKOGANS_CRYPTO_CONSTANT_TIME_NEON)
+            uint8x16_t mask128 = vdupq_n_u8 (mask);
+            for (; length >= VECTOR_LENGTH; length -= VECTOR_LENGTH) {
+                vst1q_u8 (out, vbslq_u8 (mask128, vld1q_u8 (ptr1), vld1q_u8 (ptr2)));
+                ptr1 += VECTOR_LENGTH;
+                ptr2 += VECTOR_LENGTH;
+                out += VECTOR_LENGTH;
+            }
+        #endif // defined (THEKOGANS_CRYPTO_CONSTANT_TIME_SSE2)
+            while (length-- > 0) {
+                *out++ = (util::ui8)((*ptr1++ & mask) | (*ptr2++ & ~mask));
+            }
+        }
+
+        _LIB_THEKOGANS_CRYPTO_DECL void _LIB_THEKOGANS_CRYPTO_API
+        SecureZero (
+                void *buffer,
+                std::size_t length) {
+            if (buffer != 0 && length > 0) {
+                // memset is already vectorized (and tuned per cpu) by the C
+                // runtime. All that's needed is to keep it from being elided.
+                memsetPtr (buffer, 0, length);
+            #if defined (__GNUC__) || defined (__clang__)
+                __asm__ __volatile__ ("" : : "r" (buffer) : "memory");
+            #endif // defined (__GNUC__) || defined (__clang__)
+            }
+        }
+
+    } // namespace crypto
+} // namespace thekogans
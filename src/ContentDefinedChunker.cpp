@@ -0,0 +1,111 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#include "thekogans/util/Exception.h"
+#include "thekogans/crypto/ContentDefinedChunker.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        namespace {
+            // FastCDC's gear table is just 256 random 64 bit values.
+            // They are generated (SplitMix64, fixed seed) instead of
+            // spelled out, but must never change (see the class doc).
+            struct GearTable {
+                util::ui64 gear[256];
+
+                GearTable () {
+                    util::ui64 state = 0x746865636f67616eULL;
+                    for (std::size_t i = 0; i < 256; ++i) {
+                        util::ui64 z = (state += 0x9e3779b97f4a7c15ULL);
+                        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+                        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+                        gear[i] = z ^ (z >> 31);
+                    }
+                }
+            };
+
+            const GearTable &GetGearTable () {
+                static const GearTable gearTable;
+                return gearTable;
+            }
+
+            // Top bitCount bits set. The top bits of the gear hash
+            // depend on the most bytes (the last 64).
+            inline util::ui64 GetMask (std::size_t bitCount) {
+                return bitCount == 0 ? 0 : ~util::ui64 (0) << (64 - bitCount);
+            }
+        }
+
+        ContentDefinedChunker::ContentDefinedChunker (
+                std::size_t minSize_,
+                std::size_t avgSize_,
+                std::size_t maxSize_) :
+                minSize (minSize_),
+                avgSize (avgSize_),
+                maxSize (maxSize_),
+                maskS (0),
+                maskL (0) {
+            if (minSize >= MIN_CHUNK_SIZE && minSize <= avgSize && avgSize <= maxSize) {
+                std::size_t bitCount = 0;
+                while (((std::size_t)2 << bitCount) <= avgSize) {
+                    ++bitCount;
+                }
+                // Normalization level 1 (one bit harder before
+                // the average size, one bit easier after).
+                maskS = GetMask (bitCount + 1);
+                maskL = GetMask (bitCount > 1 ? bitCount - 1 : 1);
+                // Make sure the gear table is built before
+                // (possibly concurrent) FindBoundary calls.
+                GetGearTable ();
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        std::size_t ContentDefinedChunker::FindBoundary (
+                const util::ui8 *data,
+                std::size_t length) const {
+            if (length <= minSize) {
+                return length;
+            }
+            if (length > maxSize) {
+                length = maxSize;
+            }
+            const util::ui64 *gear = GetGearTable ().gear;
+            std::size_t normalSize = avgSize < length ? avgSize : length;
+            util::ui64 hash = 0;
+            std::size_t i = minSize;
+            for (; i < normalSize; ++i) {
+                hash = (hash << 1) + gear[data[i]];
+                if ((hash & maskS) == 0) {
+                    return i + 1;
+                }
+            }
+            for (; i < length; ++i) {
+                hash = (hash << 1) + gear[data[i]];
+                if ((hash & maskL) == 0) {
+                    return i + 1;
+                }
+            }
+            return length;
+        }
+
+    } // namespace crypto
+} // namespace thekogans
@@ -0,0 +1,23 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+// Build the portable ref10 field backend next to the one Curve25519.cpp
+// picked, and expose it through Curve25519Ref10 (test builds only). The
+// definitions in Curve25519.cpp all have internal linkage, so the two
+// backends don't collide.
+#define THEKOGANS_CRYPTO_CURVE25519_REF10
+#include "Curve25519.cpp"
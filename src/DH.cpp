@@ -15,12 +15,18 @@
 // You should have received a copy of the GNU General Public License
 // along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
 
+#include <map>
 #include <openssl/opensslv.h>
+#include "thekogans/util/Mutex.h"
+#include "thekogans/util/LockGuard.h"
 #include "thekogans/crypto/OpenSSLParams.h"
 #include "thekogans/crypto/OpenSSLInit.h"
 #include "thekogans/crypto/OpenSSLException.h"
+#include "thekogans/crypto/DHParamsCache.h"
 #include "thekogans/crypto/DH.h"
 
+#if defined (THEKOGANS_CRYPTO_HAVE_DH)
+
 namespace thekogans {
     namespace crypto {
 
@@ -30,9 +36,22 @@ namespace thekogans {
                 const ID &id,
                 const std::string &name,
                 const std::string &description) {
+            Params::SharedPtr params =
+                DHParamsCache::Find (primeLength, generator, id, name, description);
+            return params.Get () != 0 ? params :
+                GenerateParams (primeLength, generator, id, name, description);
+        }
+
+        Params::SharedPtr DH::GenerateParams (
+                std::size_t primeLength,
+                std::size_t generator,
+                const ID &id,
+                const std::string &name,
+                const std::string &description) {
+            OpenSSLInit::WaitForSeed ();
             EVP_PKEY *params = 0;
             EVP_PKEY_CTXPtr ctx (
-                EVP_PKEY_CTX_new_id (EVP_PKEY_DH, OpenSSLInit::engine));
+                EVP_PKEY_CTX_new_id (EVP_PKEY_DH, OpenSSLInit::GetEngine (EVP_PKEY_DH)));
             if (ctx.get () != 0 &&
                     EVP_PKEY_paramgen_init (ctx.get ()) == 1 &&
                     EVP_PKEY_CTX_set_dh_paramgen_prime_len (ctx.get (), (util::i32)primeLength) == 1 &&
@@ -45,6 +64,24 @@ namespace thekogans {
             }
         }
 
+        bool DH::ValidateParams (const Params &params) {
+            const OpenSSLParams *openSSLParams = dynamic_cast<const OpenSSLParams *> (&params);
+            if (openSSLParams != 0 && params.GetKeyType () == OPENSSL_PKEY_DH) {
+                DHPtr dhParams (EVP_PKEY_get1_DH (openSSLParams->Get ()));
+                if (dhParams.get () != 0) {
+                    util::i32 codes = 0;
+                    return DH_check (dhParams.get (), &codes) == 1 && codes == 0;
+                }
+                else {
+                    THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
+                }
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
     #if OPENSSL_VERSION_NUMBER < 0x10100000L
         namespace {
             int DH_set0_pqg (
@@ -102,21 +139,52 @@ namespace thekogans {
                 util::i32 generatorLength;
             };
 
+            // Parsing the well known groups (BN_bin2bn, DH_set0_pqg...)
+            // is done once per process. The resulting EVP_PKEY is
+            // immutable and is shared by every OpenSSLParams handed
+            // out for that group.
+            struct ParamsCache {
+                typedef std::map<const DHParams *, OpenSSLParams::SharedPtr> Map;
+                Map map;
+                util::Mutex mutex;
+
+                static ParamsCache &Instance () {
+                    // NOTE: The cache is intentionally leaked. Its EVP_PKEYs
+                    // must not be freed after OpenSSL has been torn down.
+                    static ParamsCache *instance = new ParamsCache;
+                    return *instance;
+                }
+
+                const OpenSSLParams &Get (const DHParams &params) {
+                    util::LockGuard<util::Mutex> guard (mutex);
+                    Map::const_iterator it = map.find (&params);
+                    if (it == map.end ()) {
+                        BIGNUMPtr prime (BN_new ());
+                        BIGNUMPtr generator (BN_new ());
+                        if (prime.get () != 0 && generator.get () != 0) {
+                            BN_bin2bn (params.prime, params.primeLength, prime.get ());
+                            BN_bin2bn (params.generator, params.generatorLength, generator.get ());
+                            it = map.insert (
+                                Map::value_type (
+                                    &params,
+                                    util::dynamic_refcounted_sharedptr_cast<OpenSSLParams> (
+                                        DH::ParamsFromPrimeAndGenerator (*prime, *generator)))).first;
+                        }
+                        else {
+                            THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
+                        }
+                    }
+                    return *it->second;
+                }
+            };
+
             Params::SharedPtr ParamsFromDHParams (
                     const DHParams &params,
                     const ID &id,
                     const std::string &name,
                     const std::string &description) {
-                BIGNUMPtr prime (BN_new ());
-                BIGNUMPtr generator (BN_new ());
-                if (prime.get () != 0 && generator.get () != 0) {
-                    BN_bin2bn (params.prime, params.primeLength, prime.get ());
-                    BN_bin2bn (params.generator, params.generatorLength, generator.get ());
-                    return DH::ParamsFromPrimeAndGenerator (*prime, *generator, id, name, description);
-                }
-                else {
-                    THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
-                }
+                return OpenSSLParams::Share (
+                    ParamsCache::Instance ().Get (params), id, name, description);
             }
 
             const util::ui8 RFC3526_PRIME_1536[192] = {
@@ -540,3 +608,5 @@ namespace thekogans {
 
     } // namespace crypto
 } // namespace thekogans
+
+#endif // defined (THEKOGANS_CRYPTO_HAVE_DH)
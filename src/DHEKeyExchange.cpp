@@ -15,6 +15,11 @@
 // You should have received a copy of the GNU General Public License
 // along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
 
+#include <memory>
+#include <vector>
+#include <utility>
+#include <openssl/opensslv.h>
+#include <openssl/crypto.h>
 #include "thekogans/util/SecureAllocator.h"
 #include "thekogans/util/DefaultAllocator.h"
 #include "thekogans/util/Serializable.h"
@@ -23,8 +28,14 @@
 #include "thekogans/crypto/OpenSSLInit.h"
 #include "thekogans/crypto/OpenSSLException.h"
 #include "thekogans/crypto/OpenSSLAsymmetricKey.h"
+#include "thekogans/crypto/OpenSSLParams.h"
 #include "thekogans/crypto/X25519AsymmetricKey.h"
 #include "thekogans/crypto/OpenSSLUtils.h"
+#include "thekogans/crypto/EphemeralKeyPool.h"
+#include "thekogans/crypto/DH.h"
+#include "thekogans/crypto/EC.h"
+#include "thekogans/crypto/Trace.h"
+#include "thekogans/crypto/TextEncoding.h"
 #include "thekogans/crypto/DHEKeyExchange.h"
 
 namespace thekogans {
@@ -79,7 +90,8 @@ namespace thekogans {
 
         bool DHEKeyExchange::DHEParams::ValidateSignature (
                 AsymmetricKey::SharedPtr publicKey,
-                MessageDigest::SharedPtr messageDigest) {
+                MessageDigest::SharedPtr messageDigest,
+                ValidatedParamsCache::SharedPtr validatedParamsCache) {
             if (publicKey.Get () != 0 && messageDigest.Get () != 0 &&
                     publicKey->GetId () == signatureKeyId &&
                     messageDigest->GetName () == signatureMessageDigestName) {
@@ -107,12 +119,30 @@ namespace thekogans {
                         keyName <<
                         keyDescription <<
                         *this->publicKey;
+                    ID key;
+                    if (validatedParamsCache.Get () != 0) {
+                        key = ValidatedParamsCache::GetKey (
+                            id,
+                            signatureKeyId,
+                            signatureMessageDigestName,
+                            paramsBuffer.GetReadPtr (),
+                            paramsBuffer.GetDataAvailableForReading (),
+                            signature.data (),
+                            signature.size ());
+                        if (validatedParamsCache->Contains (key)) {
+                            return true;
+                        }
+                    }
                     Authenticator authenticator (publicKey, messageDigest);
-                    return authenticator.VerifyBufferSignature (
+                    bool result = authenticator.VerifyBufferSignature (
                         paramsBuffer.GetReadPtr (),
                         paramsBuffer.GetDataAvailableForReading (),
                         signature.data (),
                         signature.size ());
+                    if (result && validatedParamsCache.Get () != 0) {
+                        validatedParamsCache->Add (key);
+                    }
+                    return result;
                 }
                 else {
                     THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
@@ -184,7 +214,7 @@ namespace thekogans {
                 const TextHeader &header,
                 const pugi::xml_node &node) {
             Params::Read (header, node);
-            salt = util::HexDecodestring (node.attribute (ATTR_SALT).value ());
+            salt = HexDecode (node.attribute (ATTR_SALT).value ());
             keyLength = util::stringToui64 (node.attribute (ATTR_KEY_LENGTH).value ());
             messageDigestName = node.attribute (ATTR_MESSAGE_DIGEST_NAME).value ();
             count = util::stringToui64 (node.attribute (ATTR_COUNT).value ());
@@ -199,7 +229,7 @@ namespace thekogans {
 
         void DHEKeyExchange::DHEParams::Write (pugi::xml_node &node) const {
             Params::Write (node);
-            node.append_attribute (ATTR_SALT).set_value (util::HexEncodeBuffer (salt.data (), salt.size ()).c_str ());
+            node.append_attribute (ATTR_SALT).set_value (HexEncode (salt.data (), salt.size ()).c_str ());
             node.append_attribute (ATTR_KEY_LENGTH).set_value (util::ui64Tostring (keyLength).c_str ());
             node.append_attribute (ATTR_MESSAGE_DIGEST_NAME).set_value (messageDigestName.c_str ());
             node.append_attribute (ATTR_COUNT).set_value (util::ui64Tostring (count).c_str ());
@@ -216,7 +246,7 @@ namespace thekogans {
                 const TextHeader &header,
                 const util::JSON::Object &object) {
             Params::Read (header, object);
-            salt = util::HexDecodestring (object.Get<util::JSON::String> (ATTR_SALT)->value);
+            salt = HexDecode (object.Get<util::JSON::String> (ATTR_SALT)->value);
             keyLength = object.Get<util::JSON::Number> (ATTR_KEY_LENGTH)->To<util::SizeT> ();
             messageDigestName = object.Get<util::JSON::String> (ATTR_MESSAGE_DIGEST_NAME)->value;
             count = object.Get<util::JSON::Number> (ATTR_COUNT)->To<util::SizeT> ();
@@ -231,7 +261,7 @@ namespace thekogans {
 
         void DHEKeyExchange::DHEParams::Write (util::JSON::Object &object) const {
             Params::Write (object);
-            object.Add<const std::string &> (ATTR_SALT, util::HexEncodeBuffer (salt.data (), salt.size ()));
+            object.Add<const std::string &> (ATTR_SALT, HexEncode (salt.data (), salt.size ()));
             object.Add<const util::SizeT &> (ATTR_KEY_LENGTH, keyLength);
             object.Add<const std::string &> (ATTR_MESSAGE_DIGEST_NAME, messageDigestName);
             object.Add<const util::SizeT &> (ATTR_COUNT, count);
@@ -246,13 +276,309 @@ namespace thekogans {
             object.Add (TAG_PUBLIC_KEY, publicKeyObject);
         }
 
+    #if OPENSSL_VERSION_NUMBER < 0x10100000L
+        namespace {
+            void DH_get0_key (
+                    const ::DH *dh,
+                    const BIGNUM **pub_key,
+                    const BIGNUM **priv_key) {
+                if (pub_key != 0) {
+                    *pub_key = dh->pub_key;
+                }
+                if (priv_key != 0) {
+                    *priv_key = dh->priv_key;
+                }
+            }
+
+            int DH_set0_key (
+                    ::DH *dh,
+                    BIGNUM *pub_key,
+                    BIGNUM *priv_key) {
+                if (pub_key != 0) {
+                    BN_free (dh->pub_key);
+                    dh->pub_key = pub_key;
+                }
+                if (priv_key != 0) {
+                    BN_free (dh->priv_key);
+                    dh->priv_key = priv_key;
+                }
+                return 1;
+            }
+        }
+    #endif // OPENSSL_VERSION_NUMBER < 0x10100000L
+
+        namespace {
+            bool IsSameGroup (
+                    const OpenSSLParams &params1,
+                    crypto::Params::SharedPtr params2) {
+                const OpenSSLParams *openSSLParams2 =
+                    dynamic_cast<const OpenSSLParams *> (params2.Get ());
+                // The group caches hand out the same EVP_PKEY,
+                // so most of the time the pointers match.
+                return openSSLParams2 != 0 &&
+                    (params1.Get () == openSSLParams2->Get () ||
+                        EVP_PKEY_cmp_parameters (params1.Get (), openSSLParams2->Get ()) == 1);
+            }
+
+            // Raw public key: the uncompressed EC point, or the DH public
+            // value left padded to the prime length.
+            std::vector<util::ui8> GetRawPublicKey (
+                    const char *keyType,
+                    EVP_PKEY &key) {
+                if (keyType == OPENSSL_PKEY_EC) {
+                    EC_KEYPtr ecKey (EVP_PKEY_get1_EC_KEY (&key));
+                    if (ecKey.get () != 0) {
+                        const EC_GROUP *group = EC_KEY_get0_group (ecKey.get ());
+                        const EC_POINT *point = EC_KEY_get0_public_key (ecKey.get ());
+                        std::size_t length = group != 0 && point != 0 ?
+                            EC_POINT_point2oct (group, point, POINT_CONVERSION_UNCOMPRESSED, 0, 0, 0) : 0;
+                        if (length > 0) {
+                            std::vector<util::ui8> publicKey (length);
+                            if (EC_POINT_point2oct (group, point, POINT_CONVERSION_UNCOMPRESSED,
+                                    publicKey.data (), length, 0) == length) {
+                                return publicKey;
+                            }
+                        }
+                    }
+                }
+                else if (keyType == OPENSSL_PKEY_DH) {
+                    DHPtr dh (EVP_PKEY_get1_DH (&key));
+                    if (dh.get () != 0) {
+                        const BIGNUM *publicValue = 0;
+                        DH_get0_key (dh.get (), &publicValue, 0);
+                        util::i32 length = DH_size (dh.get ());
+                        if (publicValue != 0 && length > 0 && BN_num_bytes (publicValue) <= length) {
+                            std::vector<util::ui8> publicKey (length, 0);
+                            BN_bn2bin (publicValue, publicKey.data () + length - BN_num_bytes (publicValue));
+                            return publicKey;
+                        }
+                    }
+                }
+                THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
+            }
+
+            AsymmetricKey::SharedPtr PublicKeyFromRaw (
+                    const crypto::Params &params,
+                    const util::ui8 *publicKey,
+                    std::size_t publicKeyLength,
+                    const ID &id) {
+                const char *keyType = params.GetKeyType ();
+                if (keyType == X25519AsymmetricKey::KEY_TYPE) {
+                    if (publicKeyLength == X25519::KEY_LENGTH) {
+                        return AsymmetricKey::SharedPtr (
+                            new X25519AsymmetricKey (publicKey, false, id));
+                    }
+                }
+                else {
+                    const OpenSSLParams *openSSLParams = dynamic_cast<const OpenSSLParams *> (&params);
+                    EVP_PKEYPtr key (EVP_PKEY_new ());
+                    if (openSSLParams == 0 || key.get () == 0) {
+                        THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
+                    }
+                    if (keyType == OPENSSL_PKEY_EC) {
+                        EC_KEYPtr ecParams (EVP_PKEY_get1_EC_KEY (openSSLParams->Get ()));
+                        const EC_GROUP *group = ecParams.get () != 0 ?
+                            EC_KEY_get0_group (ecParams.get ()) : 0;
+                        EC_KEYPtr ecKey (EC_KEY_new ());
+                        EC_POINTPtr point (group != 0 ? EC_POINT_new (group) : 0);
+                        // EC_POINT_oct2point rejects points that are not on the curve.
+                        if (ecKey.get () == 0 || point.get () == 0 ||
+                                EC_KEY_set_group (ecKey.get (), group) != 1 ||
+                                EC_POINT_oct2point (group, point.get (), publicKey, publicKeyLength, 0) != 1 ||
+                                EC_KEY_set_public_key (ecKey.get (), point.get ()) != 1 ||
+                                EVP_PKEY_assign_EC_KEY (key.get (), ecKey.get ()) != 1) {
+                            THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
+                        }
+                        ecKey.release ();
+                        return AsymmetricKey::SharedPtr (
+                            new OpenSSLAsymmetricKey (std::move (key), false, id));
+                    }
+                    else if (keyType == OPENSSL_PKEY_DH) {
+                        DHPtr dhParams (EVP_PKEY_get1_DH (openSSLParams->Get ()));
+                        DHPtr dh (dhParams.get () != 0 ? DHparams_dup (dhParams.get ()) : 0);
+                        BIGNUMPtr publicValue (BN_bin2bn (publicKey, (int)publicKeyLength, 0));
+                        if (dh.get () == 0 || publicValue.get () == 0 ||
+                                DH_set0_key (dh.get (), publicValue.get (), 0) != 1) {
+                            THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
+                        }
+                        const BIGNUM *value = publicValue.release ();
+                        // Reject 0, 1, p - 1 and values outside the group.
+                        util::i32 codes = 0;
+                        if (DH_check_pub_key (dh.get (), value, &codes) != 1 || codes != 0) {
+                            THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                                "Invalid DH public key (%d).", codes);
+                        }
+                        if (EVP_PKEY_assign_DH (key.get (), dh.get ()) != 1) {
+                            THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
+                        }
+                        dh.release ();
+                        return AsymmetricKey::SharedPtr (
+                            new OpenSSLAsymmetricKey (std::move (key), false, id));
+                    }
+                }
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        bool DHEKeyExchange::CompactDHEParams::Parse (
+                const void *buffer,
+                std::size_t length) {
+            if (buffer == 0) {
+                return false;
+            }
+            Cursor cursor (buffer, length);
+            const util::ui8 *begin = cursor.ptr;
+            util::ui8 version = 0;
+            util::ui8 messageDigestNameLength_ = 0;
+            const util::ui8 *messageDigestName_ = 0;
+            util::ui8 saltLength_ = 0;
+            util::ui16 publicKeyLength_ = 0;
+            if (!cursor.Get (version) || version != VERSION ||
+                    !cursor.Get (ID::SIZE, id) ||
+                    !cursor.Get (group) ||
+                    !cursor.Get (messageDigestNameLength_) ||
+                    !cursor.Get (messageDigestNameLength_, messageDigestName_) ||
+                    !cursor.Get (keyLength) ||
+                    !cursor.Get (count) ||
+                    !cursor.Get (ID::SIZE, keyId) ||
+                    !cursor.Get (saltLength_) ||
+                    !cursor.Get (saltLength_, salt) ||
+                    !cursor.Get (ID::SIZE, publicKeyId) ||
+                    !cursor.Get (publicKeyLength_) || publicKeyLength_ == 0 ||
+                    !cursor.Get (publicKeyLength_, publicKey) ||
+                    !ParseSignature (begin, cursor)) {
+                return false;
+            }
+            messageDigestName = (const char *)messageDigestName_;
+            messageDigestNameLength = messageDigestNameLength_;
+            saltLength = saltLength_;
+            publicKeyLength = publicKeyLength_;
+            return true;
+        }
+
+        DHEKeyExchange::DHEParams::SharedPtr DHEKeyExchange::CompactDHEParams::ToDHEParams () const {
+            crypto::Params::SharedPtr params = id != 0 ? GetGroupParams (group) : crypto::Params::SharedPtr ();
+            std::string messageDigestName_ (messageDigestName, messageDigestNameLength);
+            if (params.Get () != 0 &&
+                    CipherSuite::GetOpenSSLMessageDigestByName (messageDigestName_) != 0) {
+                return DHEParams::SharedPtr (
+                    new DHEParams (
+                        ID (id),
+                        params,
+                        std::vector<util::ui8> (salt, salt + saltLength),
+                        keyLength,
+                        messageDigestName_,
+                        count,
+                        ID (keyId),
+                        std::string (),
+                        std::string (),
+                        PublicKeyFromRaw (*params, publicKey, publicKeyLength, ID (publicKeyId))));
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        util::ui16 DHEKeyExchange::GetGroupId (const crypto::Params &params) {
+            const char *keyType = params.GetKeyType ();
+            if (keyType == X25519AsymmetricKey::KEY_TYPE) {
+                return GROUP_X25519;
+            }
+            const OpenSSLParams *openSSLParams = dynamic_cast<const OpenSSLParams *> (&params);
+            if (openSSLParams != 0) {
+            #if defined (THEKOGANS_CRYPTO_HAVE_EC)
+                if (keyType == OPENSSL_PKEY_EC) {
+                    EC_KEYPtr ecParams (EVP_PKEY_get1_EC_KEY (openSSLParams->Get ()));
+                    util::i32 nid = ecParams.get () != 0 ?
+                        EC_GROUP_get_curve_name (EC_KEY_get0_group (ecParams.get ())) : NID_undef;
+                    if (nid > 0 && nid < 0x1000 &&
+                            IsSameGroup (*openSSLParams, EC::ParamsFromNamedCurve (nid))) {
+                        return (util::ui16)(GROUP_EC_NAMED_CURVE | nid);
+                    }
+                    for (util::i32 curve = EC::RFC5114_CURVE_192;
+                            curve <= EC::RFC5114_CURVE_521; ++curve) {
+                        if (IsSameGroup (*openSSLParams,
+                                EC::ParamsFromRFC5114Curve ((EC::RFC5114Curve)curve))) {
+                            return (util::ui16)(GROUP_EC_RFC5114_CURVE + curve);
+                        }
+                    }
+                    for (util::i32 curve = EC::RFC5639_CURVE_160;
+                            curve <= EC::RFC5639_CURVE_512_T; ++curve) {
+                        if (IsSameGroup (*openSSLParams,
+                                EC::ParamsFromRFC5639Curve ((EC::RFC5639Curve)curve))) {
+                            return (util::ui16)(GROUP_EC_RFC5639_CURVE + curve);
+                        }
+                    }
+                }
+            #endif // defined (THEKOGANS_CRYPTO_HAVE_EC)
+            #if defined (THEKOGANS_CRYPTO_HAVE_DH)
+                if (keyType == OPENSSL_PKEY_DH) {
+                    for (util::i32 prime = DH::RFC3526_PRIME_1536;
+                            prime <= DH::RFC3526_PRIME_8192; ++prime) {
+                        if (IsSameGroup (*openSSLParams,
+                                DH::ParamsFromRFC3526Prime ((DH::RFC3526Prime)prime))) {
+                            return (util::ui16)(GROUP_DH_RFC3526_PRIME + prime);
+                        }
+                    }
+                    for (util::i32 prime = DH::RFC5114_PRIME_1024;
+                            prime <= DH::RFC5114_PRIME_2048_256; ++prime) {
+                        if (IsSameGroup (*openSSLParams,
+                                DH::ParamsFromRFC5114Prime ((DH::RFC5114Prime)prime))) {
+                            return (util::ui16)(GROUP_DH_RFC5114_PRIME + prime);
+                        }
+                    }
+                }
+            #endif // defined (THEKOGANS_CRYPTO_HAVE_DH)
+            }
+            return GROUP_UNKNOWN;
+        }
+
+        crypto::Params::SharedPtr DHEKeyExchange::GetGroupParams (util::ui16 group) {
+            util::i32 index = group & 0xff;
+            if (group == GROUP_X25519) {
+                return EC::ParamsFromX25519Curve ();
+            }
+        #if defined (THEKOGANS_CRYPTO_HAVE_EC)
+            else if ((group & 0xf000) == GROUP_EC_NAMED_CURVE && (group & 0x0fff) != NID_undef) {
+                return EC::ParamsFromNamedCurve (group & 0x0fff);
+            }
+            else if ((group & 0xff00) == GROUP_EC_RFC5114_CURVE && index <= EC::RFC5114_CURVE_521) {
+                return EC::ParamsFromRFC5114Curve ((EC::RFC5114Curve)index);
+            }
+            else if ((group & 0xff00) == GROUP_EC_RFC5639_CURVE && index <= EC::RFC5639_CURVE_512_T) {
+                return EC::ParamsFromRFC5639Curve ((EC::RFC5639Curve)index);
+            }
+        #endif // defined (THEKOGANS_CRYPTO_HAVE_EC)
+        #if defined (THEKOGANS_CRYPTO_HAVE_DH)
+            else if ((group & 0xff00) == GROUP_DH_RFC3526_PRIME && index <= DH::RFC3526_PRIME_8192) {
+                return DH::ParamsFromRFC3526Prime ((DH::RFC3526Prime)index);
+            }
+            else if ((group & 0xff00) == GROUP_DH_RFC5114_PRIME && index <= DH::RFC5114_PRIME_2048_256) {
+                return DH::ParamsFromRFC5114Prime ((DH::RFC5114Prime)index);
+            }
+        #endif // defined (THEKOGANS_CRYPTO_HAVE_DH)
+            return crypto::Params::SharedPtr ();
+        }
+
         namespace {
             inline bool ValidateParamsKeyType (const char *keyType) {
                 return
+                #if defined (THEKOGANS_CRYPTO_HAVE_DH)
                     keyType == OPENSSL_PKEY_DH ||
+                #endif // defined (THEKOGANS_CRYPTO_HAVE_DH)
+                #if defined (THEKOGANS_CRYPTO_HAVE_EC)
                     keyType == OPENSSL_PKEY_EC ||
+                #endif // defined (THEKOGANS_CRYPTO_HAVE_EC)
                     keyType == X25519AsymmetricKey::KEY_TYPE;
             }
+
+            // Take the ephemeral key from a registered pool if there is one.
+            AsymmetricKey::SharedPtr CreateEphemeralKey (const Params &params) {
+                EphemeralKeyPool::SharedPtr pool = EphemeralKeyPool::Find (params);
+                return pool.Get () != 0 ? pool->GetKey () : params.CreateKey ();
+            }
         }
 
         DHEKeyExchange::DHEKeyExchange (
@@ -282,7 +608,7 @@ namespace thekogans {
                 keyName (keyName_),
                 keyDescription (keyDescription_) {
             if (params.Get () != 0 && ValidateParamsKeyType (params->GetKeyType ())) {
-                privateKey = params->CreateKey ();
+                privateKey = CreateEphemeralKey (*params);
                 publicKey = privateKey->GetPublicKey ();
             }
             else {
@@ -307,7 +633,7 @@ namespace thekogans {
                 keyId = dheParams->keyId;
                 keyName = dheParams->keyName;
                 keyDescription = dheParams->keyDescription;
-                privateKey = this->params->CreateKey ();
+                privateKey = CreateEphemeralKey (*this->params);
                 publicKey = privateKey->GetPublicKey ();
             }
             else {
@@ -337,32 +663,123 @@ namespace thekogans {
             return dheParams;
         }
 
+        util::Buffer DHEKeyExchange::GetCompactParams (
+                AsymmetricKey::SharedPtr privateKey,
+                MessageDigest::SharedPtr messageDigest) const {
+            util::ui16 group = GetGroupId (*params);
+            if (group != GROUP_UNKNOWN &&
+                    messageDigestName.size () <= util::UI8_MAX &&
+                    salt.size () <= util::UI8_MAX &&
+                    keyLength <= util::UI32_MAX &&
+                    count <= util::UI32_MAX) {
+                std::vector<util::ui8> rawPublicKey;
+                if (publicKey->GetKeyType () == X25519AsymmetricKey::KEY_TYPE) {
+                    const util::ui8 *key = ((X25519AsymmetricKey *)publicKey.Get ())->key.GetReadPtr ();
+                    rawPublicKey.assign (key, key + X25519::KEY_LENGTH);
+                }
+                else {
+                    rawPublicKey = GetRawPublicKey (
+                        publicKey->GetKeyType (),
+                        *((OpenSSLAsymmetricKey *)publicKey.Get ())->key);
+                }
+                if (rawPublicKey.size () > util::UI16_MAX) {
+                    THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                        THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+                }
+                util::Buffer body (
+                    util::NetworkEndian,
+                    util::UI8_SIZE + // version
+                    ID::SIZE + // id
+                    util::UI16_SIZE + // group
+                    util::UI8_SIZE + messageDigestName.size () + // messageDigestName
+                    util::UI32_SIZE + // keyLength
+                    util::UI32_SIZE + // count
+                    ID::SIZE + // keyId
+                    util::UI8_SIZE + salt.size () + // salt
+                    ID::SIZE + // publicKeyId
+                    util::UI16_SIZE + rawPublicKey.size ()); // publicKey
+                body << (util::ui8)CompactParams::VERSION;
+                body.Write (id.data, ID::SIZE);
+                body << group << (util::ui8)messageDigestName.size ();
+                body.Write (messageDigestName.data (), messageDigestName.size ());
+                body << (util::ui32)keyLength << (util::ui32)count;
+                body.Write (keyId.data, ID::SIZE);
+                body << (util::ui8)salt.size ();
+                if (!salt.empty ()) {
+                    body.Write (salt.data (), salt.size ());
+                }
+                body.Write (publicKey->GetId ().data, ID::SIZE);
+                body << (util::ui16)rawPublicKey.size ();
+                body.Write (rawPublicKey.data (), rawPublicKey.size ());
+                return CompactParams::AppendSignature (body, privateKey, messageDigest);
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
         namespace {
             util::Buffer GetSalt (
                     const std::vector<util::ui8> &salt,
                     const AsymmetricKey &publicKey1,
-                    const AsymmetricKey &publicKey2) {
+                    const AsymmetricKey &publicKey2,
+                    const void *sessionSalt,
+                    std::size_t sessionSaltLength) {
                 util::Buffer buffer (
                     util::NetworkEndian,
                     util::Serializer::Size (salt) +
                     util::Serializable::Size (publicKey1) +
-                    util::Serializable::Size (publicKey2));
+                    util::Serializable::Size (publicKey2) +
+                    sessionSaltLength);
                 buffer << salt << publicKey1 << publicKey2;
+                if (sessionSalt != 0 && sessionSaltLength > 0) {
+                    buffer.Write (sessionSalt, sessionSaltLength);
+                }
                 return buffer;
             }
         }
 
         SymmetricKey::SharedPtr DHEKeyExchange::DeriveSharedSymmetricKey (Params::SharedPtr params) const {
+            return DeriveSharedSymmetricKey (params, 0, 0);
+        }
+
+        SymmetricKey::SharedPtr DHEKeyExchange::DeriveSharedSymmetricKey (
+                Params::SharedPtr params,
+                const void *sessionSalt,
+                std::size_t sessionSaltLength) const {
+            THEKOGANS_CRYPTO_TRACE_SCOPE (OPERATION_KEY_EXCHANGE, GetId (), 0, 0);
+            Stats::Scope statsScope (stats);
             DHEParams::SharedPtr dheParams =
                 util::dynamic_refcounted_sharedptr_cast<DHEParams> (params);
             if (dheParams.Get () != 0) {
-                util::SecureVector<util::ui8> secret;
                 const char *keyType = privateKey->GetKeyType ();
+                if (keyType == X25519AsymmetricKey::KEY_TYPE) {
+                    // The native Curve25519 path keeps the secret on the stack.
+                    util::ui8 secret[X25519::SHARED_SECRET_LENGTH];
+                    SymmetricKey::SharedPtr key;
+                    THEKOGANS_UTIL_TRY {
+                        X25519::ComputeSharedSecret (
+                            ((X25519AsymmetricKey *)privateKey.Get ())->key.GetReadPtr (),
+                            ((X25519AsymmetricKey *)dheParams->publicKey.Get ())->key.GetReadPtr (),
+                            secret);
+                        key = DeriveKey (*dheParams, secret, X25519::SHARED_SECRET_LENGTH,
+                            sessionSalt, sessionSaltLength);
+                    }
+                    THEKOGANS_UTIL_CATCH (util::Exception) {
+                        OPENSSL_cleanse (secret, X25519::SHARED_SECRET_LENGTH);
+                        THEKOGANS_UTIL_RETHROW_EXCEPTION (exception);
+                    }
+                    OPENSSL_cleanse (secret, X25519::SHARED_SECRET_LENGTH);
+                    return key;
+                }
+                util::SecureVector<util::ui8> secret;
                 if (keyType == OPENSSL_PKEY_DH || keyType == OPENSSL_PKEY_EC) {
                     EVP_PKEY_CTXPtr ctx (
                         EVP_PKEY_CTX_new (
                             ((OpenSSLAsymmetricKey *)privateKey.Get ())->key.get (),
-                            OpenSSLInit::engine));
+                            OpenSSLInit::GetEngine (
+                                EVP_PKEY_base_id (((OpenSSLAsymmetricKey *)privateKey.Get ())->key.get ()))));
                     if (ctx.get () != 0) {
                         std::size_t secretLength = 0;
                         if (EVP_PKEY_derive_init (ctx.get ()) == 1 &&
@@ -381,27 +798,8 @@ namespace thekogans {
                         THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
                     }
                 }
-                else if (keyType == X25519AsymmetricKey::KEY_TYPE) {
-                    secret.resize (X25519::SHARED_SECRET_LENGTH);
-                    X25519::ComputeSharedSecret (
-                        ((X25519AsymmetricKey *)privateKey.Get ())->key.GetReadPtr (),
-                        ((X25519AsymmetricKey *)dheParams->publicKey.Get ())->key.GetReadPtr (),
-                        secret.data ());
-                }
-                util::Buffer salt = initiator ?
-                    GetSalt (dheParams->salt, *publicKey, *dheParams->publicKey) :
-                    GetSalt (dheParams->salt, *dheParams->publicKey, *publicKey);
-                return SymmetricKey::FromSecretAndSalt (
-                    secret.data (),
-                    secret.size (),
-                    salt.GetReadPtr (),
-                    salt.GetDataAvailableForReading (),
-                    dheParams->keyLength,
-                    CipherSuite::GetOpenSSLMessageDigestByName (dheParams->messageDigestName),
-                    dheParams->count,
-                    dheParams->keyId,
-                    dheParams->keyName,
-                    dheParams->keyDescription);
+                return DeriveKey (*dheParams, secret.data (), secret.size (),
+                    sessionSalt, sessionSaltLength);
             }
             else {
                 THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
@@ -409,5 +807,101 @@ namespace thekogans {
             }
         }
 
+        void DHEKeyExchange::DeriveSharedSymmetricKeys (
+                std::vector<PendingDerivation> &pending,
+                std::size_t workerCount) {
+            // Pick out the X25519 derivations, and do the rest one by one.
+            std::vector<std::size_t> x25519;
+            std::vector<const util::ui8 *> privateKeys;
+            std::vector<const util::ui8 *> peersPublicKeys;
+            for (std::size_t i = 0, count = pending.size (); i < count; ++i) {
+                PendingDerivation &derivation = pending[i];
+                derivation.key = SymmetricKey::SharedPtr ();
+                derivation.error.clear ();
+                THEKOGANS_UTIL_TRY {
+                    const DHEKeyExchange *keyExchange =
+                        dynamic_cast<const DHEKeyExchange *> (derivation.keyExchange.Get ());
+                    DHEParams::SharedPtr dheParams =
+                        util::dynamic_refcounted_sharedptr_cast<DHEParams> (derivation.params);
+                    if (keyExchange == 0 || dheParams.Get () == 0) {
+                        THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                            THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+                    }
+                    if (keyExchange->privateKey->GetKeyType () == X25519AsymmetricKey::KEY_TYPE &&
+                            dheParams->publicKey->GetKeyType () == X25519AsymmetricKey::KEY_TYPE) {
+                        x25519.push_back (i);
+                        privateKeys.push_back (
+                            ((X25519AsymmetricKey *)keyExchange->privateKey.Get ())->key.GetReadPtr ());
+                        peersPublicKeys.push_back (
+                            ((X25519AsymmetricKey *)dheParams->publicKey.Get ())->key.GetReadPtr ());
+                    }
+                    else {
+                        derivation.key = keyExchange->DeriveSharedSymmetricKey (dheParams);
+                    }
+                }
+                THEKOGANS_UTIL_CATCH (util::Exception) {
+                    derivation.error = exception.Report ();
+                }
+            }
+            if (!x25519.empty ()) {
+                util::SecureVector<util::ui8> secrets (x25519.size () * X25519::SHARED_SECRET_LENGTH);
+                std::vector<util::ui8 *> sharedSecrets (x25519.size ());
+                for (std::size_t i = 0, count = x25519.size (); i < count; ++i) {
+                    sharedSecrets[i] = &secrets[i * X25519::SHARED_SECRET_LENGTH];
+                }
+                std::unique_ptr<bool []> results (new bool[x25519.size ()]);
+                X25519::ComputeSharedSecrets (
+                    privateKeys.data (),
+                    peersPublicKeys.data (),
+                    sharedSecrets.data (),
+                    x25519.size (),
+                    results.get (),
+                    workerCount);
+                for (std::size_t i = 0, count = x25519.size (); i < count; ++i) {
+                    PendingDerivation &derivation = pending[x25519[i]];
+                    THEKOGANS_UTIL_TRY {
+                        if (!results[i]) {
+                            THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                                THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+                        }
+                        derivation.key =
+                            dynamic_cast<const DHEKeyExchange *> (derivation.keyExchange.Get ())->DeriveKey (
+                                *dynamic_cast<const DHEParams *> (derivation.params.Get ()),
+                                sharedSecrets[i],
+                                X25519::SHARED_SECRET_LENGTH);
+                    }
+                    THEKOGANS_UTIL_CATCH (util::Exception) {
+                        derivation.error = exception.Report ();
+                    }
+                }
+            }
+        }
+
+        SymmetricKey::SharedPtr DHEKeyExchange::DeriveKey (
+                const DHEParams &dheParams,
+                const util::ui8 *secret,
+                std::size_t secretLength,
+                const void *sessionSalt,
+                std::size_t sessionSaltLength) const {
+            util::Buffer salt = initiator ?
+                GetSalt (dheParams.salt, *publicKey, *dheParams.publicKey,
+                    sessionSalt, sessionSaltLength) :
+                GetSalt (dheParams.salt, *dheParams.publicKey, *publicKey,
+                    sessionSalt, sessionSaltLength);
+            return SymmetricKey::FromSecretAndSalt (
+                secret,
+                secretLength,
+                salt.GetReadPtr (),
+                salt.GetDataAvailableForReading (),
+                dheParams.keyLength,
+                CipherSuite::GetOpenSSLMessageDigestByName (dheParams.messageDigestName),
+                dheParams.count,
+                sessionSalt != 0 && sessionSaltLength > 0 ?
+                    ID (salt.GetReadPtr (), salt.GetDataAvailableForReading ()) :
+                    dheParams.keyId,
+                dheParams.keyName,
+                dheParams.keyDescription);
+        }
+
     } // namespace crypto
 } // namespace thekogans
@@ -0,0 +1,267 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#include <cstdio>
+#include <algorithm>
+#include <vector>
+#include <openssl/evp.h>
+#include "thekogans/util/Exception.h"
+#include "thekogans/util/LockGuard.h"
+#include "thekogans/util/SpinLock.h"
+#include "thekogans/util/Thread.h"
+#include "thekogans/util/Path.h"
+#include "thekogans/util/StringUtils.h"
+#include "thekogans/util/LoggerMgr.h"
+#include "thekogans/crypto/DH.h"
+#include "thekogans/crypto/DHParamsCache.h"
+
+#if defined (THEKOGANS_CRYPTO_HAVE_DH)
+
+namespace thekogans {
+    namespace crypto {
+
+        struct DHParamsCache::Worker : public util::Thread {
+        private:
+            DHParamsCache &cache;
+
+        public:
+            explicit Worker (DHParamsCache &cache_) :
+                cache (cache_) {}
+
+        protected:
+            // util::Thread
+            virtual void Run () throw () override {
+                Group group;
+                while (cache.GetJob (group)) {
+                    OpenSSLParams::SharedPtr params;
+                    THEKOGANS_UTIL_TRY {
+                        // Load/generate and validate outside the lock;
+                        // this is the expensive part.
+                        params = cache.PrepareGroup (group);
+                    }
+                    THEKOGANS_UTIL_CATCH (util::Exception) {
+                        THEKOGANS_UTIL_LOG_ERROR ("%s\n", exception.Report ().c_str ());
+                    }
+                    cache.FinishJob (group, params);
+                }
+            }
+        };
+
+        DHParamsCache::DHParamsCache (
+                const std::string &directory_,
+                std::size_t workerCount) :
+                directory (directory_),
+                busy (0),
+                jobsCondition (mutex),
+                idleCondition (mutex),
+                done (false) {
+            if (directory.empty () || workerCount == 0) {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+            workers.reserve (workerCount);
+            for (std::size_t i = 0; i < workerCount; ++i) {
+                workers.push_back (new Worker (*this));
+                workers.back ()->Create ();
+            }
+        }
+
+        DHParamsCache::~DHParamsCache () {
+            Stop ();
+        }
+
+        void DHParamsCache::Prepare (
+                std::size_t primeLength,
+                std::size_t generator) {
+            if (primeLength == 0 || generator < 2) {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+            Group group (primeLength, generator);
+            util::LockGuard<util::Mutex> guard (mutex);
+            if (!done && groups.find (group) == groups.end () &&
+                    std::find (jobs.begin (), jobs.end (), group) == jobs.end ()) {
+                jobs.push_back (group);
+                jobsCondition.Signal ();
+            }
+        }
+
+        Params::SharedPtr DHParamsCache::Get (
+                std::size_t primeLength,
+                std::size_t generator,
+                const ID &id,
+                const std::string &name,
+                const std::string &description) {
+            util::LockGuard<util::Mutex> guard (mutex);
+            std::map<Group, OpenSSLParams::SharedPtr>::const_iterator it =
+                groups.find (Group (primeLength, generator));
+            return it != groups.end () ?
+                OpenSSLParams::Share (*it->second, id, name, description) :
+                Params::SharedPtr ();
+        }
+
+        void DHParamsCache::WaitForIdle () {
+            util::LockGuard<util::Mutex> guard (mutex);
+            while (!done && (!jobs.empty () || busy > 0)) {
+                idleCondition.Wait ();
+            }
+        }
+
+        void DHParamsCache::Stop () {
+            {
+                util::LockGuard<util::Mutex> guard (mutex);
+                done = true;
+                jobs.clear ();
+                jobsCondition.SignalAll ();
+                idleCondition.SignalAll ();
+            }
+            // NOTE: A worker in the middle of generating a prime
+            // will finish it (and save it) before exiting.
+            for (std::size_t i = 0, count = workers.size (); i < count; ++i) {
+                workers[i]->Wait ();
+            }
+            workers.deleteAndClear ();
+        }
+
+        std::string DHParamsCache::GetPath (
+                std::size_t primeLength,
+                std::size_t generator) const {
+            return util::MakePath (
+                directory,
+                util::FormatString (
+                    "dh_" THEKOGANS_UTIL_SIZE_T_FORMAT "_" THEKOGANS_UTIL_SIZE_T_FORMAT ".pem",
+                    primeLength,
+                    generator));
+        }
+
+        namespace {
+            std::vector<DHParamsCache::SharedPtr> &GetCaches () {
+                static std::vector<DHParamsCache::SharedPtr> *caches =
+                    new std::vector<DHParamsCache::SharedPtr>;
+                return *caches;
+            }
+
+            util::SpinLock &GetCachesSpinLock () {
+                static util::SpinLock *spinLock = new util::SpinLock;
+                return *spinLock;
+            }
+        }
+
+        void DHParamsCache::Register (SharedPtr cache) {
+            if (cache.Get () != 0) {
+                util::LockGuard<util::SpinLock> guard (GetCachesSpinLock ());
+                std::vector<SharedPtr> &caches = GetCaches ();
+                if (std::find (caches.begin (), caches.end (), cache) == caches.end ()) {
+                    caches.push_back (cache);
+                }
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        void DHParamsCache::Unregister (SharedPtr cache) {
+            util::LockGuard<util::SpinLock> guard (GetCachesSpinLock ());
+            std::vector<SharedPtr> &caches = GetCaches ();
+            std::vector<SharedPtr>::iterator it = std::find (caches.begin (), caches.end (), cache);
+            if (it != caches.end ()) {
+                caches.erase (it);
+            }
+        }
+
+        Params::SharedPtr DHParamsCache::Find (
+                std::size_t primeLength,
+                std::size_t generator,
+                const ID &id,
+                const std::string &name,
+                const std::string &description) {
+            util::LockGuard<util::SpinLock> guard (GetCachesSpinLock ());
+            std::vector<SharedPtr> &caches = GetCaches ();
+            for (std::size_t i = 0, count = caches.size (); i < count; ++i) {
+                Params::SharedPtr params =
+                    caches[i]->Get (primeLength, generator, id, name, description);
+                if (params.Get () != 0) {
+                    return params;
+                }
+            }
+            return Params::SharedPtr ();
+        }
+
+        bool DHParamsCache::GetJob (Group &group) {
+            util::LockGuard<util::Mutex> guard (mutex);
+            while (!done && jobs.empty ()) {
+                jobsCondition.Wait ();
+            }
+            if (!done) {
+                group = jobs.front ();
+                jobs.pop_front ();
+                ++busy;
+                return true;
+            }
+            return false;
+        }
+
+        void DHParamsCache::FinishJob (
+                const Group &group,
+                OpenSSLParams::SharedPtr params) {
+            util::LockGuard<util::Mutex> guard (mutex);
+            if (params.Get () != 0) {
+                groups[group] = params;
+            }
+            --busy;
+            idleCondition.SignalAll ();
+        }
+
+        OpenSSLParams::SharedPtr DHParamsCache::PrepareGroup (const Group &group) const {
+            std::string path = GetPath (group.first, group.second);
+            if (util::Path (path).Exists ()) {
+                OpenSSLParams::SharedPtr params =
+                    OpenSSLParams::LoadFromFile (path, EVP_PKEY_DH);
+                // A file holding the wrong size group, or one that fails
+                // validation, is replaced with a freshly generated one.
+                if ((std::size_t)EVP_PKEY_bits (params->Get ()) == group.first &&
+                        DH::ValidateParams (*params)) {
+                    return params;
+                }
+                THEKOGANS_UTIL_LOG_WARNING (
+                    "%s is not a valid " THEKOGANS_UTIL_SIZE_T_FORMAT " bit DH group, regenerating.\n",
+                    path.c_str (),
+                    group.first);
+            }
+            OpenSSLParams::SharedPtr params =
+                util::dynamic_refcounted_sharedptr_cast<OpenSSLParams> (
+                    DH::GenerateParams (group.first, group.second));
+            if (params.Get () != 0 && DH::ValidateParams (*params)) {
+                // Write to a temporary and rename so that a crash
+                // mid write never leaves a truncated group behind.
+                std::string tempPath = path + ".tmp";
+                params->Save (tempPath);
+                std::remove (path.c_str ());
+                if (std::rename (tempPath.c_str (), path.c_str ()) != 0) {
+                    THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                        THEKOGANS_UTIL_OS_ERROR_CODE);
+                }
+                return params;
+            }
+            return OpenSSLParams::SharedPtr ();
+        }
+
+    } // namespace crypto
+} // namespace thekogans
+
+#endif // defined (THEKOGANS_CRYPTO_HAVE_DH)
@@ -22,6 +22,8 @@
 #include "thekogans/crypto/OpenSSLException.h"
 #include "thekogans/crypto/DSA.h"
 
+#if defined (THEKOGANS_CRYPTO_HAVE_DSA)
+
 namespace thekogans {
     namespace crypto {
 
@@ -31,9 +33,10 @@ namespace thekogans {
                 const std::string &name,
                 const std::string &description) {
             if (keyLength > 0) {
+                OpenSSLInit::WaitForSeed ();
                 EVP_PKEY *params = 0;
                 EVP_PKEY_CTXPtr ctx (
-                    EVP_PKEY_CTX_new_id (EVP_PKEY_DSA, OpenSSLInit::engine));
+                    EVP_PKEY_CTX_new_id (EVP_PKEY_DSA, OpenSSLInit::GetEngine (EVP_PKEY_DSA)));
                 if (ctx.get () != 0 &&
                         EVP_PKEY_paramgen_init (ctx.get ()) == 1 &&
                         EVP_PKEY_CTX_set_dsa_paramgen_bits (ctx.get (), (util::i32)keyLength) == 1 &&
@@ -52,3 +55,5 @@ namespace thekogans {
 
     } // namespace crypto
 } // namespace thekogans
+
+#endif // defined (THEKOGANS_CRYPTO_HAVE_DSA)
@@ -16,6 +16,7 @@
 // along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
 
 #include "thekogans/util/Exception.h"
+#include "thekogans/util/HRTimer.h"
 #include "thekogans/crypto/OpenSSLInit.h"
 #include "thekogans/crypto/OpenSSLException.h"
 #include "thekogans/crypto/OpenSSLUtils.h"
@@ -26,13 +27,14 @@ namespace thekogans {
 
         Decryptor::Decryptor (
                 SymmetricKey::SharedPtr key,
-                const EVP_CIPHER *cipher) {
+                const EVP_CIPHER *cipher) :
+                start (0) {
             if (key.Get () != 0 && cipher != 0 &&
                     key->GetKeyLength () == GetCipherKeyLength (cipher)) {
                 if (EVP_DecryptInit_ex (
                             &context,
-                            cipher,
-                            OpenSSLInit::engine,
+                            OpenSSLInit::FetchCipher (cipher),
+                            OpenSSLInit::GetEngine (EVP_CIPHER_nid (cipher)),
                             key->Get ().GetReadPtr (),
                             0) != 1 ||
                         (GetCipherMode (cipher) == EVP_CIPH_GCM_MODE &&
@@ -50,8 +52,22 @@ namespace thekogans {
             }
         }
 
+        Decryptor::Decryptor (const CipherContext &prepared) :
+                start (0) {
+            if (EVP_CIPHER_CTX_cipher (&prepared) != 0) {
+                if (EVP_CIPHER_CTX_copy (&context, &prepared) != 1) {
+                    THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
+                }
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
         void Decryptor::Init (const util::ui8 *iv) {
             if (iv != 0) {
+                start = stats.IsLatencyEnabled () ? util::HRTimer::Click () : 0;
                 if (EVP_DecryptInit_ex (&context, 0, 0, 0, iv) != 1) {
                     THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
                 }
@@ -111,6 +127,8 @@ namespace thekogans {
                 const void *tag,
                 std::size_t tagLength) {
             if (tag != 0 && tagLength > 0) {
+                // NOTE: EVP_CTRL_GCM_SET_TAG == EVP_CTRL_AEAD_SET_TAG. It works
+                // for all AEAD ciphers (GCM, ChaCha20-Poly1305).
                 if (EVP_CIPHER_CTX_ctrl (
                         &context,
                         EVP_CTRL_GCM_SET_TAG,
@@ -136,6 +154,10 @@ namespace thekogans {
                         plaintext,
                         &finalLength) == 1) {
                     stats.Update (finalLength);
+                    if (start != 0) {
+                        stats.UpdateLatencySince (start);
+                        start = 0;
+                    }
                     return (std::size_t)finalLength;
                 }
                 else {
@@ -15,7 +15,10 @@
 // You should have received a copy of the GNU General Public License
 // along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
 
+#include <map>
 #include "thekogans/util/Exception.h"
+#include "thekogans/util/Mutex.h"
+#include "thekogans/util/LockGuard.h"
 #include "thekogans/crypto/OpenSSLInit.h"
 #include "thekogans/crypto/OpenSSLException.h"
 #include "thekogans/crypto/OpenSSLParams.h"
@@ -26,6 +29,8 @@
 namespace thekogans {
     namespace crypto {
 
+    #if defined (THEKOGANS_CRYPTO_HAVE_EC)
+
     #if OPENSSL_VERSION_NUMBER < 0x10100000L
         #define OPENSSL_EC_EXPLICIT_CURVE 0x000
     #endif // OPENSSL_VERSION_NUMBER < 0x10100000L
@@ -82,23 +87,80 @@ namespace thekogans {
             }
         }
 
+        namespace {
+            // Building the groups (EVP_PKEY_paramgen, BN_bin2bn,
+            // EC_GROUP_new_curve_GFp...) is done once per process. The
+            // resulting EVP_PKEY is immutable and is shared by every
+            // OpenSSLParams handed out for that group.
+            template<typename Key>
+            struct ParamsCache {
+                typedef std::map<Key, OpenSSLParams::SharedPtr> Map;
+                Map map;
+                util::Mutex mutex;
+
+                static ParamsCache &Instance () {
+                    // NOTE: The cache is intentionally leaked. Its EVP_PKEYs
+                    // must not be freed after OpenSSL has been torn down.
+                    static ParamsCache *instance = new ParamsCache;
+                    return *instance;
+                }
+
+                // Return the cached params for the given key, or 0.
+                // Must be called with mutex held.
+                const OpenSSLParams *Find (Key key) const {
+                    typename Map::const_iterator it = map.find (key);
+                    return it != map.end () ? it->second.Get () : 0;
+                }
+
+                // Precompute the generator multiples once so that every
+                // key generated from these params (EC_KEY_set_group dups
+                // the group along with its precomputed table) benefits.
+                // Must be called with mutex held.
+                const OpenSSLParams &Add (
+                        Key key,
+                        Params::SharedPtr params) {
+                    OpenSSLParams::SharedPtr openSSLParams =
+                        util::dynamic_refcounted_sharedptr_cast<OpenSSLParams> (params);
+                #if OPENSSL_VERSION_NUMBER < 0x30000000L
+                    EC_KEYPtr ecParams (EVP_PKEY_get1_EC_KEY (openSSLParams->Get ()));
+                    if (ecParams.get () != 0) {
+                        // NOTE: Failure here is not fatal, the group
+                        // will just compute the multiples on the fly.
+                        EC_GROUP_precompute_mult (
+                            const_cast<EC_GROUP *> (EC_KEY_get0_group (ecParams.get ())), 0);
+                    }
+                #endif // OPENSSL_VERSION_NUMBER < 0x30000000L
+                    return *map.insert (typename Map::value_type (key, openSSLParams)).first->second;
+                }
+            };
+
+            Params::SharedPtr CreateNamedCurveParams (util::i32 nid) {
+                EVP_PKEY *params = 0;
+                EVP_PKEY_CTXPtr ctx (EVP_PKEY_CTX_new_id (EVP_PKEY_EC, OpenSSLInit::GetEngine (EVP_PKEY_EC)));
+                if (ctx.get () != 0 &&
+                        EVP_PKEY_paramgen_init (ctx.get ()) == 1 &&
+                        EVP_PKEY_CTX_set_ec_paramgen_curve_nid (ctx.get (), nid) == 1 &&
+                        EVP_PKEY_CTX_set_ec_param_enc (ctx.get (), OPENSSL_EC_NAMED_CURVE) == 1 &&
+                        EVP_PKEY_paramgen (ctx.get (), &params) == 1) {
+                    return Params::SharedPtr (new OpenSSLParams (EVP_PKEYPtr (params)));
+                }
+                else {
+                    THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
+                }
+            }
+        }
+
         Params::SharedPtr EC::ParamsFromNamedCurve (
                 util::i32 nid,
                 const ID &id,
                 const std::string &name,
                 const std::string &description) {
-            EVP_PKEY *params = 0;
-            EVP_PKEY_CTXPtr ctx (EVP_PKEY_CTX_new_id (EVP_PKEY_EC, OpenSSLInit::engine));
-            if (ctx.get () != 0 &&
-                    EVP_PKEY_paramgen_init (ctx.get ()) == 1 &&
-                    EVP_PKEY_CTX_set_ec_paramgen_curve_nid (ctx.get (), nid) == 1 &&
-                    EVP_PKEY_CTX_set_ec_param_enc (ctx.get (), OPENSSL_EC_NAMED_CURVE) == 1 &&
-                    EVP_PKEY_paramgen (ctx.get (), &params) == 1) {
-                return Params::SharedPtr (new OpenSSLParams (EVP_PKEYPtr (params), id, name, description));
-            }
-            else {
-                THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
-            }
+            ParamsCache<util::i32> &cache = ParamsCache<util::i32>::Instance ();
+            util::LockGuard<util::Mutex> guard (cache.mutex);
+            const OpenSSLParams *params = cache.Find (nid);
+            return OpenSSLParams::Share (
+                params != 0 ? *params : cache.Add (nid, CreateNamedCurveParams (nid)),
+                id, name, description);
         }
 
         namespace {
@@ -119,11 +181,7 @@ namespace thekogans {
                 util::i32 cLength;
             };
 
-            Params::SharedPtr ParamsFromEllipticCurve (
-                    const EllipticCurve &curve,
-                    const ID &id,
-                    const std::string &name,
-                    const std::string &description) {
+            Params::SharedPtr ParamsFromEllipticCurve (const EllipticCurve &curve) {
                 BIGNUMPtr p (BN_new ());
                 BIGNUMPtr a (BN_new ());
                 BIGNUMPtr b (BN_new ());
@@ -143,13 +201,27 @@ namespace thekogans {
                     BN_bin2bn (curve.gy, curve.gyLength, gy.get ());
                     BN_bin2bn (curve.n, curve.nLength, n.get ());
                     BN_bin2bn (curve.c, curve.cLength, c.get ());
-                    return EC::ParamsFromGFpCurve (*p, *a, *b, *gx, *gy, *n, *c, id, name, description);
+                    return EC::ParamsFromGFpCurve (*p, *a, *b, *gx, *gy, *n, *c);
                 }
                 else {
                     THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
                 }
             }
 
+            Params::SharedPtr ParamsFromEllipticCurve (
+                    const EllipticCurve &curve,
+                    const ID &id,
+                    const std::string &name,
+                    const std::string &description) {
+                ParamsCache<const EllipticCurve *> &cache =
+                    ParamsCache<const EllipticCurve *>::Instance ();
+                util::LockGuard<util::Mutex> guard (cache.mutex);
+                const OpenSSLParams *params = cache.Find (&curve);
+                return OpenSSLParams::Share (
+                    params != 0 ? *params : cache.Add (&curve, ParamsFromEllipticCurve (curve)),
+                    id, name, description);
+            }
+
             // RFC5114_CURVE_192
             const util::ui8 RFC5114_192_P[24] = {
                 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
@@ -1254,6 +1326,7 @@ namespace thekogans {
                 const std::string &description) {
             return ParamsFromEllipticCurve (rfc5639curves[curve], id, name, description);
         }
+    #endif // defined (THEKOGANS_CRYPTO_HAVE_EC)
 
         Params::SharedPtr EC::ParamsFromEd25519Curve (
                 const ID &id,
@@ -1274,6 +1347,7 @@ namespace thekogans {
                 const ID &id,
                 const std::string &name,
                 const std::string &description) {
+        #if defined (THEKOGANS_CRYPTO_HAVE_EC)
             if (curveName == "RFC5114_CURVE_192") {
                 return ParamsFromRFC5114Curve (RFC5114_CURVE_192, id, name, description);
             }
@@ -1331,7 +1405,9 @@ namespace thekogans {
             else if (curveName == "RFC5639_CURVE_512_T") {
                 return ParamsFromRFC5639Curve (RFC5639_CURVE_512_T, id, name, description);
             }
-            else if (curveName == Ed25519AsymmetricKey::KEY_TYPE) {
+            else
+        #endif // defined (THEKOGANS_CRYPTO_HAVE_EC)
+            if (curveName == Ed25519AsymmetricKey::KEY_TYPE) {
                 return ParamsFromEd25519Curve (id, name, description);
             }
             else if (curveName == X25519AsymmetricKey::KEY_TYPE) {
@@ -0,0 +1,401 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#if defined (TOOLCHAIN_OS_Windows)
+    #include <windows.h>
+#else // defined (TOOLCHAIN_OS_Windows)
+    #include <sys/types.h>
+    #include <unistd.h>
+#endif // defined (TOOLCHAIN_OS_Windows)
+#include <cstring>
+#include <algorithm>
+#include <vector>
+#include <openssl/evp.h>
+#include <openssl/ec.h>
+#include <openssl/ecdsa.h>
+#include "thekogans/util/Exception.h"
+#include "thekogans/util/LockGuard.h"
+#include "thekogans/util/SpinLock.h"
+#include "thekogans/util/Thread.h"
+#include "thekogans/util/SecureAllocator.h"
+#include "thekogans/util/RandomSource.h"
+#include "thekogans/crypto/OpenSSLInit.h"
+#include "thekogans/crypto/OpenSSLException.h"
+#include "thekogans/crypto/OpenSSLAsymmetricKey.h"
+#include "thekogans/crypto/BufferedRandomSource.h"
+#include "thekogans/crypto/ECDSANoncePool.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        namespace {
+            util::ui64 GetCurrentPid () {
+            #if defined (TOOLCHAIN_OS_Windows)
+                return (util::ui64)GetCurrentProcessId ();
+            #else // defined (TOOLCHAIN_OS_Windows)
+                return (util::ui64)getpid ();
+            #endif // defined (TOOLCHAIN_OS_Windows)
+            }
+
+            const char * const FORK_INFO = "ECDSANoncePool fork";
+
+            // BIGNUMPtr frees, this wipes (k must not linger in freed memory).
+            struct BIGNUMClearer {
+                BIGNUM *bn;
+                explicit BIGNUMClearer (BIGNUM *bn_) :
+                    bn (bn_) {}
+                ~BIGNUMClearer () {
+                    BN_clear (bn);
+                }
+            };
+        }
+
+        void ECDSANoncePool::Nonce::Clear () {
+            BN_clear_free (kinv);
+            kinv = 0;
+            BN_clear_free (r);
+            r = 0;
+        }
+
+        struct ECDSANoncePool::Worker : public util::Thread {
+        private:
+            ECDSANoncePool &pool;
+
+        public:
+            explicit Worker (ECDSANoncePool &pool_) :
+                pool (pool_) {}
+
+        protected:
+            // util::Thread
+            virtual void Run () throw () override {
+                THEKOGANS_UTIL_TRY {
+                    while (pool.WaitForRoom ()) {
+                        // Compute outside the lock; this is the expensive part.
+                        pool.AddNonce (pool.CreateNonce ());
+                    }
+                }
+                THEKOGANS_UTIL_CATCH (util::Exception) {
+                    // If the key can't compute nonces, Sign will
+                    // throw the same exception when it tries inline.
+                }
+            }
+        };
+
+        ECDSANoncePool::ECDSANoncePool (
+                AsymmetricKey::SharedPtr privateKey_,
+                std::size_t depth_,
+                std::size_t workerCount_,
+                const void *seed,
+                std::size_t seedLength) :
+                privateKey (privateKey_),
+                depth (depth_),
+                counter (0),
+                refillCondition (mutex),
+                done (false),
+                workerCount (workerCount_),
+                ownerPid (GetCurrentPid ()) {
+            if (privateKey.Get () == 0 || !privateKey->IsPrivate () ||
+                    privateKey->GetKeyType () != OPENSSL_PKEY_EC ||
+                    depth == 0 || workerCount == 0 ||
+                    (seed == 0) != (seedLength == 0)) {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+            ecKey.reset (EVP_PKEY_get1_EC_KEY (
+                ((OpenSSLAsymmetricKey *)privateKey.Get ())->key.get ()));
+            if (ecKey.get () == 0) {
+                THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
+            }
+            // Random nonces (and the salt below) need a seeded RNG.
+            OpenSSLInit::WaitForSeed ();
+            if (seed != 0) {
+                std::vector<util::ui8> salt (SALT_LENGTH + ID::SIZE);
+                if (BufferedRandomSource::GetThreadInstance ().GetBytes (
+                        salt.data (), SALT_LENGTH) != SALT_LENGTH) {
+                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                        "Unable to get %u random bytes for salt.", SALT_LENGTH);
+                }
+                std::copy (
+                    privateKey->GetId ().data,
+                    privateKey->GetId ().data + ID::SIZE,
+                    salt.begin () + SALT_LENGTH);
+                hkdf.reset (new HKDF (seed, seedLength, salt.data (), salt.size ()));
+            }
+            StartWorkers ();
+        }
+
+        ECDSANoncePool::~ECDSANoncePool () {
+            Stop ();
+        }
+
+        bool ECDSANoncePool::Matches (const AsymmetricKey &key) const {
+            return &key == privateKey.Get () ||
+                (key.GetKeyType () == OPENSSL_PKEY_EC &&
+                    EVP_PKEY_cmp (
+                        ((const OpenSSLAsymmetricKey &)key).key.get (),
+                        ((OpenSSLAsymmetricKey *)privateKey.Get ())->key.get ()) == 1);
+        }
+
+        std::size_t ECDSANoncePool::Sign (
+                const util::ui8 *digest,
+                std::size_t digestLength,
+                util::ui8 *signature) {
+            if (digest != 0 && digestLength > 0 && signature != 0) {
+                Nonce nonce;
+                {
+                    util::LockGuard<util::Mutex> guard (mutex);
+                    CheckOwner (!done);
+                    if (!nonces.empty ()) {
+                        nonce = nonces.front ();
+                        nonces.pop_front ();
+                        ++stats.hits;
+                        refillCondition.Signal ();
+                    }
+                    else {
+                        ++stats.misses;
+                    }
+                }
+                // With kinv = r = 0 ECDSA_do_sign_ex computes the nonce inline.
+                ECDSA_SIG *sig = ECDSA_do_sign_ex (
+                    digest, (int)digestLength, nonce.kinv, nonce.r, ecKey.get ());
+                if (sig == 0 && nonce.kinv != 0) {
+                    // The pair produced s == 0 (vanishingly unlikely).
+                    // It's spent either way; get a fresh one.
+                    sig = ECDSA_do_sign_ex (digest, (int)digestLength, 0, 0, ecKey.get ());
+                }
+                nonce.Clear ();
+                if (sig != 0) {
+                    int signatureLength = i2d_ECDSA_SIG (sig, &signature);
+                    ECDSA_SIG_free (sig);
+                    if (signatureLength > 0) {
+                        return (std::size_t)signatureLength;
+                    }
+                }
+                THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        ECDSANoncePool::Stats ECDSANoncePool::GetStats () {
+            util::LockGuard<util::Mutex> guard (mutex);
+            Stats snapshot = stats;
+            snapshot.nonces = nonces.size ();
+            return snapshot;
+        }
+
+        void ECDSANoncePool::Stop () {
+            {
+                util::LockGuard<util::Mutex> guard (mutex);
+                // The parent's workers don't exist in a child.
+                CheckOwner (false);
+                done = true;
+                refillCondition.SignalAll ();
+            }
+            for (std::size_t i = 0, count = workers.size (); i < count; ++i) {
+                workers[i]->Wait ();
+            }
+            workers.deleteAndClear ();
+            util::LockGuard<util::Mutex> guard (mutex);
+            for (std::size_t i = 0, count = nonces.size (); i < count; ++i) {
+                nonces[i].Clear ();
+            }
+            nonces.clear ();
+        }
+
+        namespace {
+            std::vector<ECDSANoncePool::SharedPtr> &GetPools () {
+                static std::vector<ECDSANoncePool::SharedPtr> *pools =
+                    new std::vector<ECDSANoncePool::SharedPtr>;
+                return *pools;
+            }
+
+            util::SpinLock &GetPoolsSpinLock () {
+                static util::SpinLock *spinLock = new util::SpinLock;
+                return *spinLock;
+            }
+        }
+
+        void ECDSANoncePool::Register (SharedPtr pool) {
+            if (pool.Get () != 0) {
+                util::LockGuard<util::SpinLock> guard (GetPoolsSpinLock ());
+                std::vector<SharedPtr> &pools = GetPools ();
+                if (std::find (pools.begin (), pools.end (), pool) == pools.end ()) {
+                    pools.push_back (pool);
+                }
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        void ECDSANoncePool::Unregister (SharedPtr pool) {
+            util::LockGuard<util::SpinLock> guard (GetPoolsSpinLock ());
+            std::vector<SharedPtr> &pools = GetPools ();
+            std::vector<SharedPtr>::iterator it = std::find (pools.begin (), pools.end (), pool);
+            if (it != pools.end ()) {
+                pools.erase (it);
+            }
+        }
+
+        ECDSANoncePool::SharedPtr ECDSANoncePool::Find (const AsymmetricKey &privateKey) {
+            util::LockGuard<util::SpinLock> guard (GetPoolsSpinLock ());
+            std::vector<SharedPtr> &pools = GetPools ();
+            for (std::size_t i = 0, count = pools.size (); i < count; ++i) {
+                if (pools[i]->Matches (privateKey)) {
+                    return pools[i];
+                }
+            }
+            return SharedPtr ();
+        }
+
+        ECDSANoncePool::Nonce ECDSANoncePool::CreateNonce () {
+            BN_CTXPtr ctx (BN_CTX_new ());
+            if (ctx.get () == 0) {
+                THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
+            }
+            BIGNUM *kinv = 0;
+            BIGNUM *r = 0;
+            if (hkdf.get () == 0) {
+                if (ECDSA_sign_setup (ecKey.get (), ctx.get (), &kinv, &r) != 1) {
+                    THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
+                }
+                return Nonce (kinv, r);
+            }
+            const EC_GROUP *group = EC_KEY_get0_group (ecKey.get ());
+            const BIGNUM *order = EC_GROUP_get0_order (group);
+            BIGNUMPtr k (BN_new ());
+            BIGNUMPtr x (BN_new ());
+            EC_POINTPtr point (EC_POINT_new (group));
+            if (order == 0 || k.get () == 0 || x.get () == 0 || point.get () == 0) {
+                THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
+            }
+            BIGNUMClearer kClearer (k.get ());
+            // Same as ECDSA_sign_setup: r = x (k * G) mod n, retried if 0.
+            do {
+                DeriveK (order, k.get (), ctx.get ());
+                if (EC_POINT_mul (group, point.get (), k.get (), 0, 0, ctx.get ()) != 1 ||
+                        EC_POINT_get_affine_coordinates (
+                            group, point.get (), x.get (), 0, ctx.get ()) != 1 ||
+                        BN_nnmod (x.get (), x.get (), order, ctx.get ()) != 1) {
+                    THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
+                }
+            } while (BN_is_zero (x.get ()));
+            kinv = BN_mod_inverse (0, k.get (), order, ctx.get ());
+            if (kinv == 0) {
+                THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
+            }
+            return Nonce (kinv, x.release ());
+        }
+
+        void ECDSANoncePool::DeriveK (
+                const BIGNUM *order,
+                BIGNUM *k,
+                BN_CTX *ctx) {
+            // 64 extra bits make the bias of the reduction mod n negligible.
+            util::SecureVector<util::ui8> bytes (BN_num_bytes (order) + 8);
+            do {
+                util::ui64 index;
+                {
+                    util::LockGuard<util::Mutex> guard (mutex);
+                    index = counter++;
+                }
+                util::ui8 info[util::UI64_SIZE];
+                for (std::size_t i = 0; i < util::UI64_SIZE; ++i) {
+                    info[i] = (util::ui8)(index >> (8 * (util::UI64_SIZE - 1 - i)));
+                }
+                hkdf->Expand (info, util::UI64_SIZE, bytes.data (), bytes.size ());
+                if (BN_bin2bn (bytes.data (), (int)bytes.size (), k) == 0 ||
+                        BN_nnmod (k, k, order, ctx) != 1) {
+                    THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
+                }
+                // Keep k off the variable time paths (EC_POINT_mul, BN_mod_inverse).
+                BN_set_flags (k, BN_FLG_CONSTTIME);
+            } while (BN_is_zero (k));
+        }
+
+        void ECDSANoncePool::StartWorkers () {
+            workers.reserve (workerCount);
+            for (std::size_t i = 0; i < workerCount; ++i) {
+                workers.push_back (new Worker (*this));
+                workers.back ()->Create ();
+            }
+        }
+
+        void ECDSANoncePool::CheckOwner (bool restart) {
+            util::ui64 pid = GetCurrentPid ();
+            if (ownerPid == pid) {
+                return;
+            }
+            ownerPid = pid;
+            // The parent holds (and will use) the same pairs.
+            for (std::size_t i = 0, count = nonces.size (); i < count; ++i) {
+                nonces[i].Clear ();
+            }
+            nonces.clear ();
+            // fork () only copies the calling thread. The worker objects
+            // describe the parent's threads and can't be joined (or
+            // deleted) here. Leak them.
+            workers.clear ();
+            if (hkdf.get () != 0) {
+                // Same seed (the new ikm is derived from it), fresh salt.
+                // The counter stays as it is, the salt keeps the child's
+                // nonces apart from the parent's (and from other children).
+                util::SecureVector<util::ui8> ikm (EVP_MAX_MD_SIZE);
+                hkdf->Expand (FORK_INFO, strlen (FORK_INFO), ikm.data (), ikm.size ());
+                std::vector<util::ui8> salt (SALT_LENGTH + ID::SIZE);
+                if (util::GlobalRandomSource::Instance ().GetBytes (
+                        salt.data (), SALT_LENGTH) != SALT_LENGTH) {
+                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                        "Unable to get %u random bytes for salt.", SALT_LENGTH);
+                }
+                std::copy (
+                    privateKey->GetId ().data,
+                    privateKey->GetId ().data + ID::SIZE,
+                    salt.begin () + SALT_LENGTH);
+                hkdf.reset (new HKDF (ikm.data (), ikm.size (), salt.data (), salt.size ()));
+            }
+            if (restart) {
+                // They block on the mutex until the caller releases it.
+                StartWorkers ();
+            }
+        }
+
+        bool ECDSANoncePool::WaitForRoom () {
+            util::LockGuard<util::Mutex> guard (mutex);
+            while (!done && nonces.size () >= depth) {
+                refillCondition.Wait ();
+            }
+            return !done;
+        }
+
+        void ECDSANoncePool::AddNonce (Nonce nonce) {
+            util::LockGuard<util::Mutex> guard (mutex);
+            if (!done) {
+                nonces.push_back (nonce);
+                ++stats.generated;
+            }
+            else {
+                nonce.Clear ();
+            }
+        }
+
+    } // namespace crypto
+} // namespace thekogans
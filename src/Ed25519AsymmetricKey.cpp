@@ -17,6 +17,7 @@
 
 #include <cstring>
 #include "thekogans/crypto/OpenSSLUtils.h"
+#include "thekogans/crypto/TextEncoding.h"
 #include "thekogans/crypto/Ed25519AsymmetricKey.h"
 
 namespace thekogans {
@@ -55,6 +56,11 @@ namespace thekogans {
 
         const char * const Ed25519AsymmetricKey::KEY_TYPE = "Ed25519";
 
+        util::ui32 Ed25519AsymmetricKey::GetKeyTypeId () const {
+            static const util::ui32 keyTypeId = InternKeyType (KEY_TYPE);
+            return keyTypeId;
+        }
+
         AsymmetricKey::SharedPtr Ed25519AsymmetricKey::GetPublicKey (
                 const ID &id,
                 const std::string &name,
@@ -123,7 +129,7 @@ namespace thekogans {
             if (IsPrivate ()) {
                 std::string privateKey = node.attribute (ATTR_KEY).value ();
                 if (privateKey.size () == Ed25519::PRIVATE_KEY_LENGTH * 2) {
-                    util::HexDecodestring (privateKey, key.privateKey);
+                    HexDecode (privateKey.data (), privateKey.size (), key.privateKey);
                 }
                 else {
                     THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
@@ -136,7 +142,7 @@ namespace thekogans {
             else {
                 std::string publicKey = node.attribute (ATTR_KEY).value ();
                 if (publicKey.size () == Ed25519::PUBLIC_KEY_LENGTH * 2) {
-                    util::HexDecodestring (publicKey, key.publicKey.value);
+                    HexDecode (publicKey.data (), publicKey.size (), key.publicKey.value);
                 }
                 else {
                     THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
@@ -152,11 +158,11 @@ namespace thekogans {
             AsymmetricKey::Write (node);
             if (IsPrivate ()) {
                 node.append_attribute (ATTR_KEY).set_value (
-                    util::HexEncodeBuffer (key.privateKey, Ed25519::PRIVATE_KEY_LENGTH).c_str ());
+                    HexEncode (key.privateKey, Ed25519::PRIVATE_KEY_LENGTH).c_str ());
             }
             else {
                 node.append_attribute (ATTR_KEY).set_value (
-                    util::HexEncodeBuffer (key.publicKey.value, Ed25519::PUBLIC_KEY_LENGTH).c_str ());
+                    HexEncode (key.publicKey.value, Ed25519::PUBLIC_KEY_LENGTH).c_str ());
             }
         }
 
@@ -167,7 +173,7 @@ namespace thekogans {
             if (IsPrivate ()) {
                 std::string privateKey = object.Get<util::JSON::String> (ATTR_KEY)->value;
                 if (privateKey.size () == Ed25519::PRIVATE_KEY_LENGTH * 2) {
-                    util::HexDecodestring (privateKey, key.privateKey);
+                    HexDecode (privateKey.data (), privateKey.size (), key.privateKey);
                 }
                 else {
                     THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
@@ -180,7 +186,7 @@ namespace thekogans {
             else {
                 std::string publicKey = object.Get<util::JSON::String> (ATTR_KEY)->value;
                 if (publicKey.size () == Ed25519::PUBLIC_KEY_LENGTH * 2) {
-                    util::HexDecodestring (publicKey, key.publicKey.value);
+                    HexDecode (publicKey.data (), publicKey.size (), key.publicKey.value);
                 }
                 else {
                     THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
@@ -197,12 +203,12 @@ namespace thekogans {
             if (IsPrivate ()) {
                 object.Add<const std::string &> (
                     ATTR_KEY,
-                    util::HexEncodeBuffer (key.privateKey, Ed25519::PRIVATE_KEY_LENGTH));
+                    HexEncode (key.privateKey, Ed25519::PRIVATE_KEY_LENGTH));
             }
             else {
                 object.Add<const std::string &> (
                     ATTR_KEY,
-                    util::HexEncodeBuffer (key.publicKey.value, Ed25519::PUBLIC_KEY_LENGTH));
+                    HexEncode (key.publicKey.value, Ed25519::PUBLIC_KEY_LENGTH));
             }
         }
 
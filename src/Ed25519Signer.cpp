@@ -15,10 +15,10 @@
 // You should have received a copy of the GNU General Public License
 // along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
 
-#include <vector>
 #include "thekogans/util/Types.h"
 #include "thekogans/crypto/Curve25519.h"
 #include "thekogans/crypto/Ed25519AsymmetricKey.h"
+#include "thekogans/crypto/Trace.h"
 #include "thekogans/crypto/Ed25519Signer.h"
 
 namespace thekogans {
@@ -29,10 +29,9 @@ namespace thekogans {
         Ed25519Signer::Ed25519Signer (
                 AsymmetricKey::SharedPtr privateKey,
                 MessageDigest::SharedPtr messageDigest) :
-                Signer (privateKey, messageDigest) {
-            if (privateKey.Get () == 0 || !privateKey->IsPrivate () ||
-                    privateKey->GetKeyType () != Ed25519AsymmetricKey::KEY_TYPE ||
-                    messageDigest.Get () == 0) {
+                Signer (privateKey, messageDigest),
+                expandedPrivateKey (GetPrivateKey (privateKey)) {
+            if (messageDigest.Get () == 0) {
                 THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
                     THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
             }
@@ -55,14 +54,18 @@ namespace thekogans {
         }
 
         std::size_t Ed25519Signer::Final (util::ui8 *signature) {
+            THEKOGANS_CRYPTO_TRACE_SCOPE (OPERATION_SIGN, privateKey->GetId (), 0, 0);
+            metrics.Update (Metrics::OPERATION_SIGN, 0);
             if (signature != 0) {
-                std::vector<util::ui8> digest (messageDigest->GetDigestLength ());
-                messageDigest->Final (digest.data ());
-                return Ed25519::SignBuffer (
-                    digest.data (),
-                    digest.size (),
-                    ((Ed25519AsymmetricKey *)privateKey.Get ())->key.privateKey,
+                util::ui8 digest[EVP_MAX_MD_SIZE];
+                Stats::Scope statsScope (GetStats ());
+                std::size_t digestLength = messageDigest->Final (digest);
+                statsScope.byteCount = Ed25519::SignBuffer (
+                    digest,
+                    digestLength,
+                    expandedPrivateKey,
                     signature);
+                return statsScope.byteCount;
             }
             else {
                 THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
@@ -70,5 +73,14 @@ namespace thekogans {
             }
         }
 
+        const util::ui8 *Ed25519Signer::GetPrivateKey (AsymmetricKey::SharedPtr privateKey) {
+            if (privateKey.Get () == 0 || !privateKey->IsPrivate () ||
+                    privateKey->GetKeyType () != Ed25519AsymmetricKey::KEY_TYPE) {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+            return ((Ed25519AsymmetricKey *)privateKey.Get ())->key.privateKey;
+        }
+
     } // namespace crypto
 } // namespace thekogans
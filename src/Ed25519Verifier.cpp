@@ -15,8 +15,11 @@
 // You should have received a copy of the GNU General Public License
 // along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
 
+#include <memory>
+#include <vector>
 #include "thekogans/crypto/Curve25519.h"
 #include "thekogans/crypto/Ed25519AsymmetricKey.h"
+#include "thekogans/crypto/Trace.h"
 #include "thekogans/crypto/Ed25519Verifier.h"
 
 namespace thekogans {
@@ -27,12 +30,8 @@ namespace thekogans {
         Ed25519Verifier::Ed25519Verifier (
                 AsymmetricKey::SharedPtr publicKey,
                 MessageDigest::SharedPtr messageDigest) :
-                Verifier (publicKey, messageDigest) {
-            if (publicKey.Get () == 0 || publicKey->IsPrivate () ||
-                    publicKey->GetKeyType () != Ed25519AsymmetricKey::KEY_TYPE) {
-                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
-                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
-            }
+                Verifier (publicKey, messageDigest),
+                preparedPublicKey (GetPublicKeyBytes (publicKey)) {
         }
 
         void Ed25519Verifier::Init () {
@@ -54,13 +53,16 @@ namespace thekogans {
         bool Ed25519Verifier::Final (
                 const void *signature,
                 std::size_t signatureLength) {
+            THEKOGANS_CRYPTO_TRACE_SCOPE (OPERATION_VERIFY, publicKey->GetId (), 0, signatureLength);
+            metrics.Update (Metrics::OPERATION_VERIFY, signatureLength);
             if (signature != 0 && signatureLength == Ed25519::SIGNATURE_LENGTH) {
-                std::vector<util::ui8> digest (messageDigest->GetDigestLength ());
-                messageDigest->Final (digest.data ());
+                Stats::Scope statsScope (GetStats (), signatureLength);
+                util::ui8 digest[EVP_MAX_MD_SIZE];
+                std::size_t digestLength = messageDigest->Final (digest);
                 return Ed25519::VerifyBufferSignature (
-                    digest.data (),
-                    digest.size (),
-                    ((Ed25519AsymmetricKey *)publicKey.Get ())->key.publicKey.value,
+                    digest,
+                    digestLength,
+                    preparedPublicKey,
                     (const util::ui8 *)signature);
             }
             else {
@@ -69,5 +71,63 @@ namespace thekogans {
             }
         }
 
+        bool Ed25519Verifier::VerifyBatch (
+                const std::vector<BatchItem> &items,
+                const std::vector<std::size_t> &indices,
+                std::vector<bool> *results) {
+            std::size_t count = indices.size ();
+            if (count == 0) {
+                return true;
+            }
+            // Hash every message with its own verifier's digest, then
+            // hand the digests to Ed25519 as one batch.
+            std::vector<std::vector<util::ui8>> digests (count);
+            std::vector<const void *> buffers (count);
+            std::vector<std::size_t> bufferLengths (count);
+            std::vector<const util::ui8 *> publicKeys (count);
+            std::vector<const util::ui8 *> signatures (count);
+            for (std::size_t i = 0; i < count; ++i) {
+                const BatchItem &item = items[indices[i]];
+                if (item.verifier->GetPublicKey ()->GetKeyType () != Ed25519AsymmetricKey::KEY_TYPE ||
+                        item.signature == 0 || item.signatureLength != Ed25519::SIGNATURE_LENGTH) {
+                    THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                        THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+                }
+                item.verifier->Init ();
+                item.verifier->Update (item.buffer, item.bufferLength);
+                MessageDigest::SharedPtr messageDigest = item.verifier->GetMessageDigest ();
+                digests[i].resize (messageDigest->GetDigestLength ());
+                messageDigest->Final (digests[i].data ());
+                buffers[i] = digests[i].data ();
+                bufferLengths[i] = digests[i].size ();
+                publicKeys[i] = ((Ed25519AsymmetricKey *)item.verifier->GetPublicKey ().Get ())->
+                    key.publicKey.value;
+                signatures[i] = (const util::ui8 *)item.signature;
+            }
+            std::unique_ptr<bool []> batchResults (results != 0 ? new bool[count] : 0);
+            bool valid = Ed25519::VerifyBufferSignatureBatch (
+                buffers.data (),
+                bufferLengths.data (),
+                publicKeys.data (),
+                signatures.data (),
+                count,
+                batchResults.get ());
+            if (results != 0) {
+                for (std::size_t i = 0; i < count; ++i) {
+                    (*results)[indices[i]] = batchResults[i];
+                }
+            }
+            return valid;
+        }
+
+        const util::ui8 *Ed25519Verifier::GetPublicKeyBytes (AsymmetricKey::SharedPtr publicKey) {
+            if (publicKey.Get () == 0 || publicKey->IsPrivate () ||
+                    publicKey->GetKeyType () != Ed25519AsymmetricKey::KEY_TYPE) {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+            return ((Ed25519AsymmetricKey *)publicKey.Get ())->key.publicKey.value;
+        }
+
     } // namespace crypto
 } // namespace thekogans
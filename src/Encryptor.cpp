@@ -15,25 +15,33 @@
 // You should have received a copy of the GNU General Public License
 // along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
 
-#include "thekogans/util/RandomSource.h"
+#include <cstring>
 #include "thekogans/util/Exception.h"
+#include "thekogans/util/HRTimer.h"
 #include "thekogans/crypto/OpenSSLInit.h"
 #include "thekogans/crypto/OpenSSLException.h"
 #include "thekogans/crypto/OpenSSLUtils.h"
+#include "thekogans/crypto/BufferedRandomSource.h"
 #include "thekogans/crypto/Encryptor.h"
 
 namespace thekogans {
     namespace crypto {
 
         Encryptor::Encryptor (
-                SymmetricKey::SharedPtr key,
-                const EVP_CIPHER *cipher) {
+                SymmetricKey::SharedPtr key_,
+                const EVP_CIPHER *cipher,
+                IVPolicy ivPolicy_) :
+                ivPolicy (ivPolicy_),
+                key (key_),
+                start (0) {
             if (key.Get () != 0 && cipher != 0 &&
-                    key->GetKeyLength () == GetCipherKeyLength (cipher)) {
+                    key->GetKeyLength () == GetCipherKeyLength (cipher) &&
+                    (ivPolicy == IV_POLICY_RANDOM ||
+                        (ivPolicy == IV_POLICY_COUNTER && IsCipherAEAD (cipher)))) {
                 if (EVP_EncryptInit_ex (
                             &context,
-                            cipher,
-                            OpenSSLInit::engine,
+                            OpenSSLInit::FetchCipher (cipher),
+                            OpenSSLInit::GetEngine (EVP_CIPHER_nid (cipher)),
                             key->Get ().GetReadPtr (),
                             0) != 1 ||
                         (GetCipherMode (cipher) == EVP_CIPH_GCM_MODE &&
@@ -44,6 +52,7 @@ namespace thekogans {
                                 0) != 1)) {
                     THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
                 }
+                ValidateIVPolicy ();
             }
             else {
                 THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
@@ -51,12 +60,55 @@ namespace thekogans {
             }
         }
 
+        Encryptor::Encryptor (
+                SymmetricKey::SharedPtr key_,
+                const CipherContext &prepared,
+                IVPolicy ivPolicy_) :
+                ivPolicy (ivPolicy_),
+                key (key_),
+                start (0) {
+            const EVP_CIPHER *cipher = EVP_CIPHER_CTX_cipher (&prepared);
+            if (key.Get () != 0 && cipher != 0 &&
+                    (ivPolicy == IV_POLICY_RANDOM ||
+                        (ivPolicy == IV_POLICY_COUNTER && IsCipherAEAD (cipher)))) {
+                if (EVP_CIPHER_CTX_copy (&context, &prepared) != 1) {
+                    THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
+                }
+                // The iv sequence is shared, it lives in the key.
+                ValidateIVPolicy ();
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        void Encryptor::ValidateIVPolicy () const {
+            if (ivPolicy == IV_POLICY_COUNTER) {
+                std::size_t ivLength = GetIVLength ();
+                if (ivLength <= IV_COUNTER_LENGTH || ivLength > EVP_MAX_IV_LENGTH) {
+                    THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                        THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+                }
+            }
+        }
+
         std::size_t Encryptor::Init (util::ui8 *iv) {
             if (iv != 0) {
+                std::size_t ivLength = GetIVLength ();
+                if (ivPolicy == IV_POLICY_COUNTER) {
+                    // Throws if the key's counter is exhausted.
+                    key->GetNextCounterIV (iv, ivLength);
+                    start = stats.IsLatencyEnabled () ? util::HRTimer::Click () : 0;
+                    if (EVP_EncryptInit_ex (&context, 0, 0, 0, iv) != 1) {
+                        THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
+                    }
+                    return ivLength;
+                }
                 // An explicit iv for each frame will thwart BEAST.
                 // http://www.slideshare.net/danrlde/20120418-luedtke-ssltlscbcbeast
-                std::size_t ivLength = GetIVLength ();
-                if (util::GlobalRandomSource::Instance ().GetBytes (iv, ivLength) == ivLength) {
+                if (BufferedRandomSource::GetThreadInstance ().GetBytes (iv, ivLength) == ivLength) {
+                    start = stats.IsLatencyEnabled () ? util::HRTimer::Click () : 0;
                     if (EVP_EncryptInit_ex (&context, 0, 0, 0, iv) != 1) {
                         THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
                     }
@@ -73,6 +125,20 @@ namespace thekogans {
             }
         }
 
+        std::size_t Encryptor::InitWithIV (const util::ui8 *iv) {
+            if (iv != 0) {
+                start = stats.IsLatencyEnabled () ? util::HRTimer::Click () : 0;
+                if (EVP_EncryptInit_ex (&context, 0, 0, 0, iv) != 1) {
+                    THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
+                }
+                return GetIVLength ();
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
         void Encryptor::SetAssociatedData (
                 const void *associatedData,
                 std::size_t associatedDataLength) {
@@ -126,6 +192,10 @@ namespace thekogans {
                         ciphertext,
                         &finalLength) == 1) {
                     stats.Update (finalLength);
+                    if (start != 0) {
+                        stats.UpdateLatencySince (start);
+                        start = 0;
+                    }
                     return (std::size_t)finalLength;
                 }
                 else {
@@ -140,6 +210,9 @@ namespace thekogans {
 
         std::size_t Encryptor::GetTag (util::ui8 *tag) {
             if (tag != 0) {
+                // NOTE: EVP_CTRL_GCM_GET_TAG == EVP_CTRL_AEAD_GET_TAG. It works
+                // for all AEAD ciphers (GCM, ChaCha20-Poly1305), all of which
+                // use a 16 byte tag.
                 if (EVP_CIPHER_CTX_ctrl (
                         &context,
                         EVP_CTRL_GCM_GET_TAG,
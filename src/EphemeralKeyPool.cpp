@@ -0,0 +1,202 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#include <algorithm>
+#include <vector>
+#include <openssl/evp.h>
+#include "thekogans/util/Exception.h"
+#include "thekogans/util/LockGuard.h"
+#include "thekogans/util/SpinLock.h"
+#include "thekogans/util/Thread.h"
+#include "thekogans/crypto/OpenSSLParams.h"
+#include "thekogans/crypto/RSAParams.h"
+#include "thekogans/crypto/EphemeralKeyPool.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        struct EphemeralKeyPool::Worker : public util::Thread {
+        private:
+            EphemeralKeyPool &pool;
+
+        public:
+            explicit Worker (EphemeralKeyPool &pool_) :
+                pool (pool_) {}
+
+        protected:
+            // util::Thread
+            virtual void Run () throw () override {
+                THEKOGANS_UTIL_TRY {
+                    while (pool.WaitForRoom ()) {
+                        // Generate outside the lock; this is the expensive part.
+                        pool.AddKey (pool.params->CreateKey ());
+                    }
+                }
+                THEKOGANS_UTIL_CATCH (util::Exception) {
+                    // If the params can't generate keys, GetKey will
+                    // throw the same exception when it tries inline.
+                }
+            }
+        };
+
+        EphemeralKeyPool::EphemeralKeyPool (
+                Params::SharedPtr params_,
+                std::size_t depth_,
+                std::size_t workerCount) :
+                params (params_),
+                depth (depth_),
+                refillCondition (mutex),
+                done (false) {
+            if (params.Get () == 0 || depth == 0 || workerCount == 0) {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+            workers.reserve (workerCount);
+            for (std::size_t i = 0; i < workerCount; ++i) {
+                workers.push_back (new Worker (*this));
+                workers.back ()->Create ();
+            }
+        }
+
+        EphemeralKeyPool::~EphemeralKeyPool () {
+            Stop ();
+        }
+
+        bool EphemeralKeyPool::Matches (const Params &params_) const {
+            if (params_.GetKeyType () != params->GetKeyType ()) {
+                return false;
+            }
+        #if defined (THEKOGANS_CRYPTO_HAVE_RSA)
+            const RSAParams *rsaParams1 = dynamic_cast<const RSAParams *> (&params_);
+            const RSAParams *rsaParams2 = dynamic_cast<const RSAParams *> (params.Get ());
+            if (rsaParams1 != 0 || rsaParams2 != 0) {
+                return rsaParams1 != 0 && rsaParams2 != 0 &&
+                    rsaParams1->keyLength == rsaParams2->keyLength &&
+                    rsaParams1->publicExponent == rsaParams2->publicExponent;
+            }
+        #endif // defined (THEKOGANS_CRYPTO_HAVE_RSA)
+            const OpenSSLParams *openSSLParams1 = dynamic_cast<const OpenSSLParams *> (&params_);
+            const OpenSSLParams *openSSLParams2 = dynamic_cast<const OpenSSLParams *> (params.Get ());
+            return openSSLParams1 == 0 || openSSLParams2 == 0 ?
+                openSSLParams1 == openSSLParams2 :
+                EVP_PKEY_cmp_parameters (
+                    openSSLParams1->params.get (),
+                    openSSLParams2->params.get ()) == 1;
+        }
+
+        AsymmetricKey::SharedPtr EphemeralKeyPool::GetKey () {
+            {
+                util::LockGuard<util::Mutex> guard (mutex);
+                if (!keys.empty ()) {
+                    AsymmetricKey::SharedPtr key = keys.front ();
+                    keys.pop_front ();
+                    ++stats.hits;
+                    refillCondition.Signal ();
+                    return key;
+                }
+                ++stats.misses;
+            }
+            return params->CreateKey ();
+        }
+
+        EphemeralKeyPool::Stats EphemeralKeyPool::GetStats () {
+            util::LockGuard<util::Mutex> guard (mutex);
+            Stats snapshot = stats;
+            snapshot.keys = keys.size ();
+            return snapshot;
+        }
+
+        void EphemeralKeyPool::Stop () {
+            {
+                util::LockGuard<util::Mutex> guard (mutex);
+                done = true;
+                refillCondition.SignalAll ();
+            }
+            for (std::size_t i = 0, count = workers.size (); i < count; ++i) {
+                workers[i]->Wait ();
+            }
+            workers.deleteAndClear ();
+            // Releasing the last reference to each key wipes it.
+            util::LockGuard<util::Mutex> guard (mutex);
+            keys.clear ();
+        }
+
+        namespace {
+            std::vector<EphemeralKeyPool::SharedPtr> &GetPools () {
+                static std::vector<EphemeralKeyPool::SharedPtr> *pools =
+                    new std::vector<EphemeralKeyPool::SharedPtr>;
+                return *pools;
+            }
+
+            util::SpinLock &GetPoolsSpinLock () {
+                static util::SpinLock *spinLock = new util::SpinLock;
+                return *spinLock;
+            }
+        }
+
+        void EphemeralKeyPool::Register (SharedPtr pool) {
+            if (pool.Get () != 0) {
+                util::LockGuard<util::SpinLock> guard (GetPoolsSpinLock ());
+                std::vector<SharedPtr> &pools = GetPools ();
+                if (std::find (pools.begin (), pools.end (), pool) == pools.end ()) {
+                    pools.push_back (pool);
+                }
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        void EphemeralKeyPool::Unregister (SharedPtr pool) {
+            util::LockGuard<util::SpinLock> guard (GetPoolsSpinLock ());
+            std::vector<SharedPtr> &pools = GetPools ();
+            std::vector<SharedPtr>::iterator it = std::find (pools.begin (), pools.end (), pool);
+            if (it != pools.end ()) {
+                pools.erase (it);
+            }
+        }
+
+        EphemeralKeyPool::SharedPtr EphemeralKeyPool::Find (const Params &params) {
+            util::LockGuard<util::SpinLock> guard (GetPoolsSpinLock ());
+            std::vector<SharedPtr> &pools = GetPools ();
+            for (std::size_t i = 0, count = pools.size (); i < count; ++i) {
+                if (pools[i]->Matches (params)) {
+                    return pools[i];
+                }
+            }
+            return SharedPtr ();
+        }
+
+        bool EphemeralKeyPool::WaitForRoom () {
+            util::LockGuard<util::Mutex> guard (mutex);
+            while (!done && keys.size () >= depth) {
+                refillCondition.Wait ();
+            }
+            return !done;
+        }
+
+        void EphemeralKeyPool::AddKey (AsymmetricKey::SharedPtr key) {
+            util::LockGuard<util::Mutex> guard (mutex);
+            if (!done) {
+                keys.push_back (key);
+                ++stats.generated;
+            }
+        }
+
+    } // namespace crypto
+} // namespace thekogans
@@ -0,0 +1,560 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#include "thekogans/util/Exception.h"
+#include "thekogans/crypto/FrameHeader.h"
+#include "thekogans/crypto/HMAC.h"
+#include "thekogans/crypto/ConstantTime.h"
+#include "thekogans/crypto/Compressor.h"
+#include "thekogans/crypto/KeyEnvelope.h"
+#include "thekogans/crypto/FileEncryptor.h"
+#include "thekogans/crypto/FileDecryptor.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        FileDecryptor::FileDecryptor (
+                SymmetricKey::SharedPtr key_,
+                const EVP_CIPHER *cipher_,
+                const EVP_MD *md_,
+                std::size_t workerCount,
+                std::size_t maxPendingBlocks) :
+                BlockPipeline (workerCount, maxPendingBlocks),
+                key (key_),
+                cipher (cipher_),
+                md (md_),
+                blockSize (0),
+                compressed (false),
+                derivedKeys (false),
+                blockIndex (0),
+                chunked (false),
+                trailerVerified (false),
+                enveloped (false),
+                queueDepth (0),
+                fromFile (0),
+                toFile (0) {
+            if (key.Get () != 0 && cipher != 0) {
+                // Each worker gets it's own cipher so that
+                // blocks can be decrypted without locking.
+                ciphers.resize (GetWorkerCount ());
+                for (std::size_t i = 0, count = ciphers.size (); i < count; ++i) {
+                    ciphers[i].Reset (new Cipher (key, cipher, md));
+                }
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        FileDecryptor::FileDecryptor (
+                KeyRing::SharedPtr keyRing_,
+                std::size_t workerCount,
+                std::size_t maxPendingBlocks) :
+                BlockPipeline (workerCount, maxPendingBlocks),
+                cipher (0),
+                md (0),
+                keyRing (keyRing_),
+                cipherSuite (keyRing_.Get () != 0 ? keyRing_->GetCipherSuite () : CipherSuite::Empty),
+                blockSize (0),
+                compressed (false),
+                derivedKeys (false),
+                blockIndex (0),
+                chunked (false),
+                trailerVerified (false),
+                enveloped (false),
+                queueDepth (0),
+                fromFile (0),
+                toFile (0) {
+            if (keyRing.Get () != 0) {
+                keyCiphers.resize (GetWorkerCount ());
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        void FileDecryptor::Decrypt (
+                const std::string &fromPath,
+                const std::string &toPath,
+                bool map) {
+            FileReader fromFile_ (
+                fromPath,
+                map && queueDepth == 0,
+                queueDepth > 0 ?
+                    FileReader::DEFAULT_READ_AHEAD_BLOCK_SIZE :
+                    FileReader::DEFAULT_READ_BLOCK_SIZE,
+                queueDepth);
+            FileWriter toFile_ (
+                toPath,
+                queueDepth > 0 ?
+                    FileWriter::DEFAULT_WRITE_BEHIND_BLOCK_SIZE :
+                    FileWriter::DEFAULT_WRITE_BLOCK_SIZE,
+                queueDepth);
+            {
+                util::ui8 header[util::UI32_SIZE];
+                if (fromFile_.Read (header, util::UI32_SIZE) != util::UI32_SIZE) {
+                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                        "Unable to read block size from %s",
+                        fromPath.c_str ());
+                }
+                util::TenantReadBuffer buffer (util::NetworkEndian, header, util::UI32_SIZE);
+                buffer >> blockSize;
+                // An all ones block size marks the derived keys format
+                // (followed by the master key id and the file id).
+                derivedKeys = blockSize == FileEncryptor::DERIVED_KEYS_FORMAT_MARKER;
+                // As does 0xfffffffe the content defined chunking
+                // format (followed by the master key id).
+                chunked = blockSize == FileEncryptor::CHUNKED_FORMAT_MARKER;
+                // And 0xfffffffd the key envelope format (followed
+                // by the envelope slot).
+                enveloped = blockSize == FileEncryptor::ENVELOPE_FORMAT_MARKER;
+                blockIndex = 0;
+                hkdfs.deleteAndClear ();
+                trailerMAC.Reset ();
+                chunkIds.clear ();
+                trailerVerified = false;
+                if (chunked) {
+                    if (keyRing.Get () == 0) {
+                        THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                            "%s uses content defined chunking and requires a key ring.",
+                            fromPath.c_str ());
+                    }
+                    util::ui8 masterKeyIdData[ID::SIZE];
+                    if (fromFile_.Read (masterKeyIdData, ID::SIZE) != ID::SIZE ||
+                            fromFile_.Read (header, util::UI32_SIZE) != util::UI32_SIZE) {
+                        THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                            "Unable to read content defined chunking header from %s",
+                            fromPath.c_str ());
+                    }
+                    ID masterKeyId (masterKeyIdData);
+                    SymmetricKey::SharedPtr masterKey =
+                        FileEncryptor::FindMasterKey (*keyRing, masterKeyId);
+                    if (masterKey.Get () == 0) {
+                        THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                            "Unable to get key %s",
+                            masterKeyId.ToHexString ().c_str ());
+                    }
+                    // Chunk keys are derived from the chunk ids (see FileEncryptor).
+                    FileEncryptor::ChunkedFormatKeys chunkedFormatKeys (
+                        *masterKey, cipherSuite.GetOpenSSLMessageDigest ());
+                    hkdfs.reserve (GetWorkerCount ());
+                    for (std::size_t i = 0, count = GetWorkerCount (); i < count; ++i) {
+                        hkdfs.push_back (
+                            new HKDF (
+                                chunkedFormatKeys.chunkKDFKey->Get ().GetReadPtr (),
+                                chunkedFormatKeys.chunkKDFKey->GetKeyLength (),
+                                masterKeyIdData,
+                                ID::SIZE,
+                                cipherSuite.GetOpenSSLMessageDigest ()));
+                    }
+                    trailerMAC.Reset (
+                        new HMAC (
+                            chunkedFormatKeys.trailerKey,
+                            cipherSuite.GetOpenSSLMessageDigest ()));
+                    chunkIds.assign (masterKeyIdData, masterKeyIdData + ID::SIZE);
+                    util::TenantReadBuffer blockSizeBuffer (
+                        util::NetworkEndian, header, util::UI32_SIZE);
+                    blockSizeBuffer >> blockSize;
+                }
+                else if (enveloped) {
+                    if (keyRing.Get () == 0) {
+                        THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                            "%s uses a key envelope and requires a key ring.",
+                            fromPath.c_str ());
+                    }
+                    util::ui32 envelopeCapacity;
+                    if (fromFile_.Read (header, util::UI32_SIZE) != util::UI32_SIZE) {
+                        THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                            "Unable to read key envelope header from %s",
+                            fromPath.c_str ());
+                    }
+                    {
+                        util::TenantReadBuffer capacityBuffer (
+                            util::NetworkEndian, header, util::UI32_SIZE);
+                        capacityBuffer >> envelopeCapacity;
+                    }
+                    if (envelopeCapacity == 0 ||
+                            envelopeCapacity > FileEncryptor::MAX_ENVELOPE_CAPACITY) {
+                        THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                            "Invalid key envelope capacity (%u) in %s",
+                            envelopeCapacity,
+                            fromPath.c_str ());
+                    }
+                    util::Buffer slot (util::NetworkEndian, envelopeCapacity);
+                    if (slot.AdvanceWriteOffset (
+                            fromFile_.Read (slot.GetWritePtr (), envelopeCapacity)) != envelopeCapacity ||
+                            fromFile_.Read (header, util::UI32_SIZE) != util::UI32_SIZE) {
+                        THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                            "Unable to read key envelope from %s",
+                            fromPath.c_str ());
+                    }
+                    KeyEnvelope envelope;
+                    slot >> envelope;
+                    // The DEK only lives in the ciphers.
+                    SymmetricKey::SharedPtr dek = envelope.Unwrap (*keyRing);
+                    ciphers.resize (GetWorkerCount ());
+                    for (std::size_t i = 0, count = ciphers.size (); i < count; ++i) {
+                        ciphers[i] = envelope.cipherSuite.GetCipher (dek);
+                    }
+                    util::TenantReadBuffer blockSizeBuffer (
+                        util::NetworkEndian, header, util::UI32_SIZE);
+                    blockSizeBuffer >> blockSize;
+                }
+                else if (derivedKeys) {
+                    if (keyRing.Get () == 0) {
+                        THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                            "%s uses derived keys and requires a key ring.",
+                            fromPath.c_str ());
+                    }
+                    util::ui8 ids[ID::SIZE + ID::SIZE];
+                    if (fromFile_.Read (ids, ID::SIZE + ID::SIZE) != ID::SIZE + ID::SIZE ||
+                            fromFile_.Read (header, util::UI32_SIZE) != util::UI32_SIZE) {
+                        THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                            "Unable to read derived keys header from %s",
+                            fromPath.c_str ());
+                    }
+                    ID masterKeyId (ids);
+                    SymmetricKey::SharedPtr masterKey =
+                        FileEncryptor::FindMasterKey (*keyRing, masterKeyId);
+                    if (masterKey.Get () == 0) {
+                        THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                            "Unable to get key %s",
+                            masterKeyId.ToHexString ().c_str ());
+                    }
+                    // Each worker gets it's own HKDF so that
+                    // block keys can be derived without locking.
+                    SymmetricKey::SharedPtr blockKDFKey = FileEncryptor::DeriveBlockKDFKey (
+                        *masterKey, cipherSuite.GetOpenSSLMessageDigest ());
+                    hkdfs.reserve (GetWorkerCount ());
+                    for (std::size_t i = 0, count = GetWorkerCount (); i < count; ++i) {
+                        hkdfs.push_back (
+                            new HKDF (
+                                blockKDFKey->Get ().GetReadPtr (),
+                                blockKDFKey->GetKeyLength (),
+                                ids + ID::SIZE,
+                                ID::SIZE,
+                                cipherSuite.GetOpenSSLMessageDigest ()));
+                    }
+                    util::TenantReadBuffer blockSizeBuffer (
+                        util::NetworkEndian, header, util::UI32_SIZE);
+                    blockSizeBuffer >> blockSize;
+                }
+                // A 0 block size marks the compressed format (followed by the real one).
+                compressed = blockSize == FileEncryptor::COMPRESSED_FORMAT_MARKER;
+                if (compressed) {
+                    if (fromFile_.Read (header, util::UI32_SIZE) != util::UI32_SIZE) {
+                        THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                            "Unable to read block size from %s",
+                            fromPath.c_str ());
+                    }
+                    util::TenantReadBuffer blockSizeBuffer (
+                        util::NetworkEndian, header, util::UI32_SIZE);
+                    blockSizeBuffer >> blockSize;
+                }
+            }
+            if (blockSize == 0 || blockSize >= Cipher::MAX_PLAINTEXT_LENGTH -
+                    (compressed ? FileEncryptor::COMPRESSED_BLOCK_HEADER_SIZE : 0)) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "Invalid block size (%u) in %s",
+                    blockSize,
+                    fromPath.c_str ());
+            }
+            if (compressed) {
+                // Each worker gets it's own buffer so that
+                // blocks can be decompressed without locking.
+                compressionBuffers.resize (GetWorkerCount ());
+                for (std::size_t i = 0, count = compressionBuffers.size (); i < count; ++i) {
+                    compressionBuffers[i].resize (
+                        Cipher::GetMaxBufferLength (
+                            FileEncryptor::COMPRESSED_BLOCK_HEADER_SIZE + blockSize));
+                }
+            }
+            else {
+                compressionBuffers.clear ();
+            }
+            fromFile = &fromFile_;
+            toFile = &toFile_;
+            THEKOGANS_UTIL_TRY {
+                Run ();
+                toFile_.Flush ();
+                fromFile = 0;
+                toFile = 0;
+                hkdfs.deleteAndClear ();
+                if (enveloped) {
+                    ciphers.clear ();
+                }
+            }
+            THEKOGANS_UTIL_CATCH (util::Exception) {
+                fromFile = 0;
+                toFile = 0;
+                hkdfs.deleteAndClear ();
+                if (enveloped) {
+                    ciphers.clear ();
+                }
+                THEKOGANS_UTIL_RETHROW_EXCEPTION (exception);
+            }
+        }
+
+        BlockPipeline::Block::SharedPtr FileDecryptor::ReadBlock () {
+            if (trailerVerified) {
+                return Block::SharedPtr ();
+            }
+            if (fromFile->GetDataAvailableForReading () == 0) {
+                if (chunked) {
+                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                        "%s is truncated (missing chunks trailer)",
+                        fromFile->GetPath ().c_str ());
+                }
+                return Block::SharedPtr ();
+            }
+            util::ui32 ciphertextLength;
+            SymmetricKey::SharedPtr blockKey;
+            ID chunkId (ID::Empty);
+            // FileReader is not a serializer. Read the frame
+            // (or length) header and parse it in place.
+            util::ui8 header[FrameHeader::SIZE];
+            std::size_t headerLength = chunked ?
+                (std::size_t)FileEncryptor::CHUNKED_FRAME_HEADER_SIZE :
+                derivedKeys ?
+                (std::size_t)FileEncryptor::DERIVED_FRAME_HEADER_SIZE :
+                keyRing.Get () != 0 && !enveloped ?
+                    (std::size_t)FrameHeader::SIZE : (std::size_t)util::UI32_SIZE;
+            if (fromFile->Read (header, headerLength) != headerLength) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "Unable to read " THEKOGANS_UTIL_SIZE_T_FORMAT " bytes from %s",
+                    headerLength,
+                    fromFile->GetPath ().c_str ());
+            }
+            util::TenantReadBuffer buffer (util::NetworkEndian, header, headerLength);
+            if (chunked) {
+                chunkId = ID (header);
+                buffer.AdvanceReadOffset (ID::SIZE);
+                buffer >> ciphertextLength;
+                if (ciphertextLength == FileEncryptor::CHUNKS_TRAILER) {
+                    // Chunk keys are bound to their content, not their position.
+                    // The trailer is what catches reordered or dropped chunks.
+                    // The trailer holds the (possibly truncated) mac.
+                    util::ui8 signature[EVP_MAX_MD_SIZE];
+                    if (trailerMAC->SignBuffer (&chunkIds[0], chunkIds.size (), signature) < ID::SIZE ||
+                            !ConstantTimeCompare (signature, header, ID::SIZE) ||
+                            fromFile->GetDataAvailableForReading () != 0) {
+                        THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                            "Invalid chunks trailer in %s",
+                            fromFile->GetPath ().c_str ());
+                    }
+                    trailerVerified = true;
+                    return Block::SharedPtr ();
+                }
+                chunkIds.insert (chunkIds.end (), chunkId.data, chunkId.data + ID::SIZE);
+                if (ciphertextLength == FileEncryptor::CHUNK_STORED) {
+                    util::Buffer ciphertext = GetStoredChunk (chunkId);
+                    ciphertextLength = (util::ui32)ciphertext.GetDataAvailableForReading ();
+                    if (ciphertextLength == 0 ||
+                            ciphertextLength > Cipher::GetMaxBufferLength (
+                                compressed ?
+                                    FileEncryptor::COMPRESSED_BLOCK_HEADER_SIZE + blockSize : blockSize)) {
+                        THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                            "Invalid stored chunk %s length (%u)",
+                            chunkId.ToHexString ().c_str (),
+                            ciphertextLength);
+                    }
+                    Block::SharedPtr block (
+                        new Block (ciphertextLength, compressed ? blockSize : ciphertextLength));
+                    PlaceBlock (*block);
+                    block->input.Write (ciphertext.GetReadPtr (), ciphertextLength);
+                    block->chunkId = chunkId;
+                    return block;
+                }
+            }
+            else if (derivedKeys) {
+                // Frames must appear in the order they were written. The block
+                // key is derived from the index so a mismatch would only fail
+                // later (and less helpfully) during authentication.
+                util::ui64 frameIndex;
+                buffer >> frameIndex >> ciphertextLength;
+                if (frameIndex != blockIndex) {
+                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                        "Unexpected block index (" THEKOGANS_UTIL_UI64_FORMAT
+                        ") in %s (expected: " THEKOGANS_UTIL_UI64_FORMAT ")",
+                        frameIndex,
+                        fromFile->GetPath ().c_str (),
+                        blockIndex);
+                }
+                ++blockIndex;
+            }
+            else if (keyRing.Get () != 0 && !enveloped) {
+                FrameHeader frameHeader;
+                buffer >> frameHeader;
+                // The key ring is only touched from the Run thread.
+                blockKey = keyRing->GetCipherKey (frameHeader.keyId);
+                if (blockKey.Get () == 0) {
+                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                        "Unable to get key %s",
+                        frameHeader.keyId.ToHexString ().c_str ());
+                }
+                ciphertextLength = frameHeader.ciphertextLength;
+            }
+            else {
+                buffer >> ciphertextLength;
+            }
+            // Reject frames that could not have been produced by FileEncryptor
+            // before allocating a buffer for them.
+            if (ciphertextLength == 0 ||
+                    ciphertextLength > Cipher::GetMaxBufferLength (
+                        compressed ?
+                            FileEncryptor::COMPRESSED_BLOCK_HEADER_SIZE + blockSize : blockSize)) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "Invalid frame length (%u) in %s (block size: %u)",
+                    ciphertextLength,
+                    fromFile->GetPath ().c_str (),
+                    blockSize);
+            }
+            Block::SharedPtr block (
+                new Block (ciphertextLength, compressed ? blockSize : ciphertextLength));
+            PlaceBlock (*block);
+            if (fromFile->Read (block->input.GetWritePtr (), ciphertextLength) == ciphertextLength) {
+                block->input.AdvanceWriteOffset (ciphertextLength);
+                block->key = blockKey;
+                block->chunkId = chunkId;
+                return block;
+            }
+            else {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "Unable to read %u bytes from %s",
+                    ciphertextLength,
+                    fromFile->GetPath ().c_str ());
+            }
+        }
+
+        void FileDecryptor::ProcessBlock (
+                std::size_t workerIndex,
+                Block &block) {
+            Cipher::SharedPtr blockCipher;
+            if (chunked) {
+                // A chunk from the wrong place (or store) gets the
+                // wrong key and fails to authenticate.
+                blockCipher = cipherSuite.GetCipher (
+                    hkdfs[workerIndex]->ExpandKey (
+                        block.chunkId.data,
+                        ID::SIZE,
+                        GetCipherKeyLength (cipherSuite.GetOpenSSLCipher ()),
+                        ID::Empty));
+            }
+            else if (derivedKeys) {
+                // Block keys are never reused, so they bypass the cipher cache.
+                util::ui8 info[util::UI64_SIZE];
+                util::TenantWriteBuffer infoBuffer (util::NetworkEndian, info, util::UI64_SIZE);
+                infoBuffer << block.sequenceNumber;
+                blockCipher = cipherSuite.GetCipher (
+                    hkdfs[workerIndex]->ExpandKey (
+                        info,
+                        util::UI64_SIZE,
+                        GetCipherKeyLength (cipherSuite.GetOpenSSLCipher ()),
+                        ID::Empty));
+            }
+            else if (block.key.Get () != 0) {
+                // Each worker has its own cache, so no locking is needed.
+                IDHashMap<Cipher::SharedPtr> &cache = keyCiphers[workerIndex];
+                IDHashMap<Cipher::SharedPtr>::iterator it = cache.find (block.key->GetId ());
+                if (it != cache.end ()) {
+                    blockCipher = it->second;
+                }
+                else {
+                    blockCipher = cipherSuite.GetCipher (block.key);
+                    if (cache.size () == MAX_CACHED_CIPHERS) {
+                        cache.clear ();
+                    }
+                    cache.insert (
+                        IDHashMap<Cipher::SharedPtr>::value_type (block.key->GetId (), blockCipher));
+                }
+            }
+            else {
+                blockCipher = ciphers[workerIndex];
+            }
+            if (compressed) {
+                std::vector<util::ui8> &compressionBuffer = compressionBuffers[workerIndex];
+                std::size_t plaintextLength = blockCipher->Decrypt (
+                    block.input.GetReadPtr (),
+                    block.input.GetDataAvailableForReading (),
+                    0,
+                    0,
+                    &compressionBuffer[0]);
+                if (plaintextLength < FileEncryptor::COMPRESSED_BLOCK_HEADER_SIZE) {
+                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                        "Truncated compressed block (" THEKOGANS_UTIL_SIZE_T_FORMAT " bytes)",
+                        plaintextLength);
+                }
+                // The header was authenticated along with the payload.
+                util::TenantReadBuffer header (
+                    util::NetworkEndian,
+                    &compressionBuffer[0],
+                    FileEncryptor::COMPRESSED_BLOCK_HEADER_SIZE);
+                util::ui8 algorithm;
+                util::ui32 uncompressedLength;
+                header >> algorithm >> uncompressedLength;
+                if (uncompressedLength == 0 || uncompressedLength > blockSize) {
+                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                        "Invalid uncompressed block length (%u), block size: %u",
+                        uncompressedLength,
+                        blockSize);
+                }
+                Compressor::Decompress (
+                    algorithm,
+                    &compressionBuffer[FileEncryptor::COMPRESSED_BLOCK_HEADER_SIZE],
+                    plaintextLength - FileEncryptor::COMPRESSED_BLOCK_HEADER_SIZE,
+                    block.output.GetWritePtr (),
+                    uncompressedLength);
+                block.output.AdvanceWriteOffset (uncompressedLength);
+            }
+            else {
+                block.output.AdvanceWriteOffset (
+                    blockCipher->Decrypt (
+                        block.input.GetReadPtr (),
+                        block.input.GetDataAvailableForReading (),
+                        0,
+                        0,
+                        block.output.GetWritePtr ()));
+            }
+        }
+
+        void FileDecryptor::WriteBlock (Block &block) {
+            std::size_t plaintextLength = block.output.GetDataAvailableForReading ();
+            if (toFile->Write (block.output.GetReadPtr (), plaintextLength) == plaintextLength) {
+                OnBlockWritten (
+                    block.sequenceNumber,
+                    block.input.GetDataAvailableForReading (),
+                    plaintextLength);
+            }
+            else {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "Unable to write " THEKOGANS_UTIL_SIZE_T_FORMAT " bytes to %s",
+                    plaintextLength,
+                    toFile->GetPath ().c_str ());
+            }
+        }
+
+        util::Buffer FileDecryptor::GetStoredChunk (const ID &chunkId) {
+            THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                "Chunk %s is not in %s (override GetStoredChunk to provide it)",
+                chunkId.ToHexString ().c_str (),
+                fromFile != 0 ? fromFile->GetPath ().c_str () : "");
+        }
+
+    } // namespace crypto
+} // namespace thekogans
@@ -0,0 +1,795 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#include <cstring>
+#include "thekogans/util/Exception.h"
+#include "thekogans/util/File.h"
+#include "thekogans/crypto/OpenSSLUtils.h"
+#include "thekogans/crypto/CiphertextHeader.h"
+#include "thekogans/crypto/FrameHeader.h"
+#include "thekogans/crypto/HMAC.h"
+#include "thekogans/crypto/FileEncryptor.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        namespace {
+            // Read the envelope format prefix (marker, capacity and slot).
+            util::ui32 ReadEnvelopeSlot (
+                    const std::string &path,
+                    KeyEnvelope &envelope) {
+                util::ReadOnlyFile file (util::NetworkEndian, path);
+                util::ui32 marker;
+                util::ui32 envelopeCapacity;
+                file >> marker >> envelopeCapacity;
+                if (marker != FileEncryptor::ENVELOPE_FORMAT_MARKER ||
+                        envelopeCapacity == 0 ||
+                        envelopeCapacity > FileEncryptor::MAX_ENVELOPE_CAPACITY) {
+                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                        "%s is not in the key envelope format.",
+                        path.c_str ());
+                }
+                util::Buffer slot (util::NetworkEndian, envelopeCapacity);
+                if (slot.AdvanceWriteOffset (
+                        file.Read (slot.GetWritePtr (), envelopeCapacity)) != envelopeCapacity) {
+                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                        "Unable to read the key envelope from %s",
+                        path.c_str ());
+                }
+                slot >> envelope;
+                return envelopeCapacity;
+            }
+
+            // Serialize the envelope format prefix. The slot is
+            // zero padded to envelopeCapacity.
+            util::Buffer WriteEnvelopeSlot (
+                    const KeyEnvelope &envelope,
+                    util::ui32 envelopeCapacity) {
+                if (envelope.Size () > envelopeCapacity) {
+                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                        "Key envelope (" THEKOGANS_UTIL_SIZE_T_FORMAT
+                        " bytes) does not fit it's slot (%u bytes).",
+                        envelope.Size (),
+                        envelopeCapacity);
+                }
+                util::Buffer buffer (
+                    util::NetworkEndian,
+                    util::UI32_SIZE + util::UI32_SIZE + envelopeCapacity);
+                buffer << (util::ui32)FileEncryptor::ENVELOPE_FORMAT_MARKER << envelopeCapacity << envelope;
+                std::size_t padding = buffer.GetDataAvailableForWriting ();
+                memset (buffer.GetWritePtr (), 0, padding);
+                buffer.AdvanceWriteOffset (padding);
+                return buffer;
+            }
+
+            // Content defined chunking subkey labels (see ChunkedFormatKeys).
+            const char CHUNK_ID_LABEL[] = "thekogans chunk id";
+            const char CHUNK_TRAILER_LABEL[] = "thekogans chunk trailer";
+            const char CHUNK_KEY_LABEL[] = "thekogans chunk key";
+            // Derived keys block key subkey label (see DeriveBlockKDFKey).
+            const char BLOCK_KEY_LABEL[] = "thekogans block key";
+        }
+
+        FileEncryptor::ChunkedFormatKeys::ChunkedFormatKeys (
+                const SymmetricKey &masterKey,
+                const EVP_MD *md) {
+            std::size_t keyLength = GetMDLength (md);
+            HKDF hkdf (
+                masterKey.Get ().GetReadPtr (),
+                masterKey.GetKeyLength (),
+                masterKey.GetId ().data,
+                ID::SIZE,
+                md);
+            idKey = hkdf.ExpandKey (
+                CHUNK_ID_LABEL, sizeof (CHUNK_ID_LABEL) - 1, keyLength, ID::Empty);
+            trailerKey = hkdf.ExpandKey (
+                CHUNK_TRAILER_LABEL, sizeof (CHUNK_TRAILER_LABEL) - 1, keyLength, ID::Empty);
+            chunkKDFKey = hkdf.ExpandKey (
+                CHUNK_KEY_LABEL, sizeof (CHUNK_KEY_LABEL) - 1, keyLength, ID::Empty);
+        }
+
+        SymmetricKey::SharedPtr FileEncryptor::DeriveBlockKDFKey (
+                const SymmetricKey &masterKey,
+                const EVP_MD *md) {
+            HKDF hkdf (
+                masterKey.Get ().GetReadPtr (),
+                masterKey.GetKeyLength (),
+                masterKey.GetId ().data,
+                ID::SIZE,
+                md);
+            return hkdf.ExpandKey (
+                BLOCK_KEY_LABEL, sizeof (BLOCK_KEY_LABEL) - 1, GetMDLength (md), ID::Empty);
+        }
+
+        SymmetricKey::SharedPtr FileEncryptor::FindMasterKey (
+                const KeyRing &keyRing,
+                const ID &masterKeyId) {
+            return util::dynamic_refcounted_sharedptr_cast<SymmetricKey> (
+                keyRing.GetUserData (masterKeyId, true));
+        }
+
+        FileEncryptor::FileEncryptor (
+                SymmetricKey::SharedPtr key_,
+                const EVP_CIPHER *cipher_,
+                const EVP_MD *md_,
+                util::ui32 blockSize_,
+                std::size_t workerCount,
+                std::size_t maxPendingBlocks) :
+                BlockPipeline (workerCount, maxPendingBlocks),
+                key (key_),
+                cipher (cipher_),
+                md (md_),
+                blockSize (blockSize_),
+                compression (Compressor::NONE),
+                compressionLevel (Compressor::DEFAULT_LEVEL),
+                derivedKeys (false),
+                contentDefinedChunking (false),
+                chunkBufferOffset (0),
+                chunkBufferLength (0),
+                chunkEof (false),
+                envelopeCapacity (DEFAULT_ENVELOPE_CAPACITY),
+                enveloped (false),
+                queueDepth (0),
+                fromFile (0),
+                toFile (0),
+                seekable (false),
+                offset (0) {
+            if (key.Get () != 0 && cipher != 0 &&
+                    blockSize > 0 && blockSize < Cipher::MAX_PLAINTEXT_LENGTH) {
+                // Each worker gets it's own cipher so that
+                // blocks can be encrypted without locking.
+                ciphers.resize (GetWorkerCount ());
+                for (std::size_t i = 0, count = ciphers.size (); i < count; ++i) {
+                    ciphers[i].Reset (new Cipher (key, cipher, md));
+                }
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        FileEncryptor::FileEncryptor (
+                KeyRing::SharedPtr keyRing_,
+                util::ui32 blockSize_,
+                std::size_t workerCount,
+                std::size_t maxPendingBlocks) :
+                BlockPipeline (workerCount, maxPendingBlocks),
+                cipher (0),
+                md (0),
+                keyRing (keyRing_),
+                cipherSuite (keyRing_.Get () != 0 ? keyRing_->GetCipherSuite () : CipherSuite::Empty),
+                blockSize (blockSize_),
+                compression (Compressor::NONE),
+                compressionLevel (Compressor::DEFAULT_LEVEL),
+                derivedKeys (false),
+                contentDefinedChunking (false),
+                chunkBufferOffset (0),
+                chunkBufferLength (0),
+                chunkEof (false),
+                envelopeCapacity (DEFAULT_ENVELOPE_CAPACITY),
+                enveloped (false),
+                queueDepth (0),
+                fromFile (0),
+                toFile (0),
+                seekable (false),
+                offset (0) {
+            if (keyRing.Get () != 0 &&
+                    blockSize > 0 && blockSize < Cipher::MAX_PLAINTEXT_LENGTH) {
+                cipher = cipherSuite.GetOpenSSLCipher ();
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        void FileEncryptor::SetCompression (
+                util::ui8 compression_,
+                int compressionLevel_) {
+            if (!Compressor::IsSupported (compression_) ||
+                    (compression_ != Compressor::NONE &&
+                        blockSize >= Cipher::MAX_PLAINTEXT_LENGTH - COMPRESSED_BLOCK_HEADER_SIZE)) {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+            compression = compression_;
+            compressionLevel = compressionLevel_;
+            if (compression != Compressor::NONE) {
+                // Each worker gets it's own buffer so that
+                // blocks can be compressed without locking.
+                compressionBuffers.resize (GetWorkerCount ());
+                for (std::size_t i = 0, count = compressionBuffers.size (); i < count; ++i) {
+                    compressionBuffers[i].resize (COMPRESSED_BLOCK_HEADER_SIZE + blockSize);
+                }
+            }
+            else {
+                compressionBuffers.clear ();
+            }
+        }
+
+        void FileEncryptor::SetDerivedKeys (bool derivedKeys_) {
+            if (derivedKeys_ && (keyRing.Get () == 0 || contentDefinedChunking)) {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+            derivedKeys = derivedKeys_;
+        }
+
+        void FileEncryptor::SetContentDefinedChunking (
+                bool contentDefinedChunking_,
+                std::size_t minSize,
+                std::size_t avgSize,
+                std::size_t maxSize) {
+            if (contentDefinedChunking_) {
+                if (keyRing.Get () == 0 || derivedKeys || maxSize >= Cipher::MAX_PLAINTEXT_LENGTH) {
+                    THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                        THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+                }
+                chunker = ContentDefinedChunker (minSize, avgSize, maxSize);
+                blockSize = (util::ui32)maxSize;
+                // Resize (and revalidate) the compression buffers.
+                SetCompression (compression, compressionLevel);
+            }
+            contentDefinedChunking = contentDefinedChunking_;
+        }
+
+        void FileEncryptor::SetMasterKey (SymmetricKey::SharedPtr masterKey_) {
+            if (masterKey_.Get () == 0 || keyRing.Get () == 0) {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+            masterKey = masterKey_;
+        }
+
+        void FileEncryptor::AddKeyEncryptionKey (SymmetricKey::SharedPtr kek) {
+            if (kek.Get () == 0 || keyRing.Get () == 0 || !cipherSuite.VerifyCipherKey (*kek)) {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+            symmetricKeks.push_back (kek);
+        }
+
+        void FileEncryptor::AddKeyEncryptionKey (AsymmetricKey::SharedPtr kek) {
+            if (kek.Get () == 0 || keyRing.Get () == 0) {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+            asymmetricKeks.push_back (kek);
+        }
+
+        void FileEncryptor::SetEnvelopeCapacity (util::ui32 envelopeCapacity_) {
+            if (envelopeCapacity_ == 0 || envelopeCapacity_ > MAX_ENVELOPE_CAPACITY) {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+            envelopeCapacity = envelopeCapacity_;
+        }
+
+        KeyEnvelope FileEncryptor::ReadEnvelope (const std::string &path) {
+            KeyEnvelope envelope;
+            ReadEnvelopeSlot (path, envelope);
+            return envelope;
+        }
+
+        void FileEncryptor::WriteEnvelope (
+                const std::string &path,
+                const KeyEnvelope &envelope) {
+            KeyEnvelope current;
+            util::Buffer buffer = WriteEnvelopeSlot (envelope, ReadEnvelopeSlot (path, current));
+            // Only the prefix is overwritten, the blocks stay as they are.
+            util::SimpleFile file (
+                util::NetworkEndian,
+                path,
+                util::SimpleFile::ReadWrite);
+            if (file.Write (
+                    buffer.GetReadPtr (),
+                    buffer.GetDataAvailableForReading ()) != buffer.GetDataAvailableForReading ()) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "Unable to write the key envelope to %s",
+                    path.c_str ());
+            }
+            file.Flush ();
+        }
+
+        void FileEncryptor::RotateKeyEncryptionKey (
+                const std::string &path,
+                const KeyRing &keyRing,
+                const ID &oldKekId,
+                SymmetricKey::SharedPtr newKek) {
+            KeyEnvelope envelope = ReadEnvelope (path);
+            envelope.Rotate (keyRing, oldKekId, newKek);
+            WriteEnvelope (path, envelope);
+        }
+
+        void FileEncryptor::RotateKeyEncryptionKey (
+                const std::string &path,
+                const KeyRing &keyRing,
+                const ID &oldKekId,
+                AsymmetricKey::SharedPtr newKek) {
+            KeyEnvelope envelope = ReadEnvelope (path);
+            envelope.Rotate (keyRing, oldKekId, newKek);
+            WriteEnvelope (path, envelope);
+        }
+
+        void FileEncryptor::Encrypt (
+                const std::string &fromPath,
+                const std::string &toPath,
+                bool seekable_,
+                bool map) {
+            if (seekable_ && compression != Compressor::NONE) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION ("%s",
+                    "Compression is not supported by the seekable format.");
+            }
+            if (seekable_ && derivedKeys) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION ("%s",
+                    "Derived keys are not supported by the seekable format.");
+            }
+            if (seekable_ && contentDefinedChunking) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION ("%s",
+                    "Content defined chunking is not supported by the seekable format.");
+            }
+            enveloped = !symmetricKeks.empty () || !asymmetricKeks.empty ();
+            if (enveloped && (seekable_ || derivedKeys || contentDefinedChunking)) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION ("%s",
+                    "Key envelopes are not supported by the seekable format, "
+                    "with derived keys or with content defined chunking.");
+            }
+            FileReader fromFile_ (
+                fromPath,
+                map && queueDepth == 0,
+                queueDepth > 0 ?
+                    (std::size_t)FileReader::DEFAULT_READ_AHEAD_BLOCK_SIZE :
+                    (std::size_t)blockSize,
+                queueDepth);
+            FileWriter toFile_ (
+                toPath,
+                queueDepth > 0 ?
+                    FileWriter::DEFAULT_WRITE_BEHIND_BLOCK_SIZE :
+                    FileWriter::DEFAULT_WRITE_BLOCK_SIZE,
+                queueDepth);
+            seekable = seekable_;
+            index.clear ();
+            hkdfs.deleteAndClear ();
+            chunkMACs.clear ();
+            trailerMAC.Reset ();
+            chunkIds.clear ();
+            if (derivedKeys || contentDefinedChunking) {
+                // One master key per encryptor (unless one was given).
+                if (masterKey.Get () == 0) {
+                    masterKey = SymmetricKey::FromRandom (
+                        SymmetricKey::MIN_RANDOM_LENGTH,
+                        0,
+                        0,
+                        GetCipherKeyLength (cipher));
+                }
+                // Kept out of the cipher keys, the master key keys nothing.
+                if (keyRing->GetUserData (masterKey->GetId (), false).Get () == 0) {
+                    keyRing->AddUserData (masterKey);
+                }
+            }
+            if (contentDefinedChunking) {
+                // Chunk keys don't depend on the file (salt = master key id),
+                // that's what makes them convergent. Each worker gets it's own
+                // HKDF and HMAC so that chunks can be keyed without locking.
+                ChunkedFormatKeys chunkedFormatKeys (
+                    *masterKey, cipherSuite.GetOpenSSLMessageDigest ());
+                hkdfs.reserve (GetWorkerCount ());
+                chunkMACs.resize (GetWorkerCount ());
+                for (std::size_t i = 0, count = GetWorkerCount (); i < count; ++i) {
+                    hkdfs.push_back (
+                        new HKDF (
+                            chunkedFormatKeys.chunkKDFKey->Get ().GetReadPtr (),
+                            chunkedFormatKeys.chunkKDFKey->GetKeyLength (),
+                            masterKey->GetId ().data,
+                            ID::SIZE,
+                            cipherSuite.GetOpenSSLMessageDigest ()));
+                    chunkMACs[i].Reset (
+                        new HMAC (
+                            chunkedFormatKeys.idKey,
+                            cipherSuite.GetOpenSSLMessageDigest ()));
+                }
+                trailerMAC.Reset (
+                    new HMAC (
+                        chunkedFormatKeys.trailerKey,
+                        cipherSuite.GetOpenSSLMessageDigest ()));
+                // The trailer mac starts with the master key id (so that
+                // it's never empty), followed by every chunk id.
+                chunkIds.assign (masterKey->GetId ().data, masterKey->GetId ().data + ID::SIZE);
+                chunkBuffer.resize (blockSize);
+                chunkBufferOffset = 0;
+                chunkBufferLength = 0;
+                chunkEof = false;
+                toFile_ << (util::ui32)CHUNKED_FORMAT_MARKER << masterKey->GetId ();
+            }
+            else if (derivedKeys) {
+                // One (random) salt per file.
+                ID fileId;
+                // Each worker gets it's own HKDF so that
+                // block keys can be derived without locking.
+                SymmetricKey::SharedPtr blockKDFKey =
+                    DeriveBlockKDFKey (*masterKey, cipherSuite.GetOpenSSLMessageDigest ());
+                hkdfs.reserve (GetWorkerCount ());
+                for (std::size_t i = 0, count = GetWorkerCount (); i < count; ++i) {
+                    hkdfs.push_back (
+                        new HKDF (
+                            blockKDFKey->Get ().GetReadPtr (),
+                            blockKDFKey->GetKeyLength (),
+                            fileId.data,
+                            ID::SIZE,
+                            cipherSuite.GetOpenSSLMessageDigest ()));
+                }
+                toFile_ << (util::ui32)DERIVED_KEYS_FORMAT_MARKER << masterKey->GetId () << fileId;
+            }
+            else if (enveloped) {
+                // One (random) DEK per file, never stored in the clear.
+                KeyEnvelope envelope (cipherSuite);
+                SymmetricKey::SharedPtr dek = envelope.CreateDataKey ();
+                for (std::size_t i = 0, count = symmetricKeks.size (); i < count; ++i) {
+                    envelope.Wrap (dek, symmetricKeks[i]);
+                }
+                for (std::size_t i = 0, count = asymmetricKeks.size (); i < count; ++i) {
+                    envelope.Wrap (dek, asymmetricKeks[i]);
+                }
+                util::Buffer slot = WriteEnvelopeSlot (envelope, envelopeCapacity);
+                toFile_.Write (slot.GetReadPtr (), slot.GetDataAvailableForReading ());
+                // Each worker gets it's own cipher so that
+                // blocks can be encrypted without locking.
+                ciphers.resize (GetWorkerCount ());
+                for (std::size_t i = 0, count = ciphers.size (); i < count; ++i) {
+                    ciphers[i] = cipherSuite.GetCipher (dek);
+                }
+            }
+            if (seekable) {
+                toFile_ << SeekableFileHeader (blockSize);
+                offset = SeekableFileHeader::SIZE;
+            }
+            else if (compression != Compressor::NONE) {
+                toFile_ << (util::ui32)COMPRESSED_FORMAT_MARKER << blockSize;
+            }
+            else {
+                toFile_ << blockSize;
+            }
+            fromFile = &fromFile_;
+            toFile = &toFile_;
+            THEKOGANS_UTIL_TRY {
+                Run ();
+                if (seekable) {
+                    WriteIndex ();
+                }
+                else if (contentDefinedChunking) {
+                    WriteChunksTrailer ();
+                }
+                toFile_.Flush ();
+                fromFile = 0;
+                toFile = 0;
+                hkdfs.deleteAndClear ();
+                chunkMACs.clear ();
+                trailerMAC.Reset ();
+                if (enveloped) {
+                    ciphers.clear ();
+                }
+            }
+            THEKOGANS_UTIL_CATCH (util::Exception) {
+                fromFile = 0;
+                toFile = 0;
+                hkdfs.deleteAndClear ();
+                chunkMACs.clear ();
+                trailerMAC.Reset ();
+                if (enveloped) {
+                    ciphers.clear ();
+                }
+                THEKOGANS_UTIL_RETHROW_EXCEPTION (exception);
+            }
+        }
+
+        BlockPipeline::Block::SharedPtr FileEncryptor::ReadBlock () {
+            if (contentDefinedChunking) {
+                return ReadChunk ();
+            }
+            Block::SharedPtr block (
+                new Block (
+                    blockSize,
+                    // EncryptAndFrame has a larger header than EncryptAndEnlengthen.
+                    Cipher::GetMaxBufferLength (
+                        compression != Compressor::NONE ?
+                            COMPRESSED_BLOCK_HEADER_SIZE + blockSize : blockSize)));
+            PlaceBlock (*block);
+            std::size_t plaintextLength = fromFile->Read (block->input.GetWritePtr (), blockSize);
+            if (plaintextLength > 0) {
+                block->input.AdvanceWriteOffset (plaintextLength);
+                return block;
+            }
+            return Block::SharedPtr ();
+        }
+
+        void FileEncryptor::ProcessBlock (
+                std::size_t workerIndex,
+                Block &block) {
+            const util::ui8 *plaintext = block.input.GetReadPtr ();
+            std::size_t plaintextLength = block.input.GetDataAvailableForReading ();
+            if (contentDefinedChunking) {
+                // The id covers the chunk content (not it's compressed form).
+                block.chunkId = GetChunkId (workerIndex, plaintext, plaintextLength);
+                if (IsChunkStored (block.chunkId, plaintextLength)) {
+                    block.output.Write (block.chunkId.data, ID::SIZE);
+                    block.output << (util::ui32)CHUNK_STORED;
+                    return;
+                }
+            }
+            if (compression != Compressor::NONE) {
+                // Compress in to the worker buffer (behind the header),
+                // falling back to storing blocks that don't shrink.
+                std::vector<util::ui8> &compressionBuffer = compressionBuffers[workerIndex];
+                util::ui8 algorithm = compression;
+                std::size_t payloadLength = Compressor::Compress (
+                    algorithm,
+                    compressionLevel,
+                    plaintext,
+                    plaintextLength,
+                    &compressionBuffer[COMPRESSED_BLOCK_HEADER_SIZE],
+                    plaintextLength - 1);
+                if (payloadLength == 0) {
+                    algorithm = Compressor::NONE;
+                    payloadLength = plaintextLength;
+                    memcpy (&compressionBuffer[COMPRESSED_BLOCK_HEADER_SIZE], plaintext, plaintextLength);
+                }
+                util::TenantWriteBuffer header (
+                    util::NetworkEndian,
+                    &compressionBuffer[0],
+                    COMPRESSED_BLOCK_HEADER_SIZE);
+                header << algorithm << (util::ui32)plaintextLength;
+                plaintext = &compressionBuffer[0];
+                plaintextLength = COMPRESSED_BLOCK_HEADER_SIZE + payloadLength;
+            }
+            if (contentDefinedChunking) {
+                // Identical chunks get identical keys. Chunk keys are never
+                // reused for different content, so they bypass the cipher cache.
+                SymmetricKey::SharedPtr chunkKey = hkdfs[workerIndex]->ExpandKey (
+                    block.chunkId.data,
+                    ID::SIZE,
+                    GetCipherKeyLength (cipher),
+                    ID::Empty);
+                std::size_t ciphertextLength = cipherSuite.GetCipher (chunkKey)->Encrypt (
+                    plaintext,
+                    plaintextLength,
+                    0,
+                    0,
+                    block.output.GetWritePtr () + CHUNKED_FRAME_HEADER_SIZE);
+                block.output.Write (block.chunkId.data, ID::SIZE);
+                block.output << (util::ui32)ciphertextLength;
+                block.output.AdvanceWriteOffset (ciphertextLength);
+            }
+            else if (derivedKeys) {
+                // The block key is bound to it's position in the file, so
+                // reordered (or transplanted) blocks fail to authenticate.
+                util::ui8 info[util::UI64_SIZE];
+                util::TenantWriteBuffer infoBuffer (util::NetworkEndian, info, util::UI64_SIZE);
+                infoBuffer << block.sequenceNumber;
+                SymmetricKey::SharedPtr blockKey = hkdfs[workerIndex]->ExpandKey (
+                    info,
+                    util::UI64_SIZE,
+                    GetCipherKeyLength (cipher),
+                    ID::Empty);
+                std::size_t ciphertextLength = cipherSuite.GetCipher (blockKey)->Encrypt (
+                    plaintext,
+                    plaintextLength,
+                    0,
+                    0,
+                    block.output.GetWritePtr () + DERIVED_FRAME_HEADER_SIZE);
+                block.output << block.sequenceNumber << (util::ui32)ciphertextLength;
+                block.output.AdvanceWriteOffset (ciphertextLength);
+            }
+            else if (keyRing.Get () != 0 && !enveloped) {
+                block.key = SymmetricKey::FromRandom (
+                    SymmetricKey::MIN_RANDOM_LENGTH,
+                    0,
+                    0,
+                    GetCipherKeyLength (cipher));
+                block.output.AdvanceWriteOffset (
+                    cipherSuite.GetCipher (block.key)->EncryptAndFrame (
+                        plaintext,
+                        plaintextLength,
+                        0,
+                        0,
+                        block.output.GetWritePtr ()));
+            }
+            else {
+                block.output.AdvanceWriteOffset (
+                    ciphers[workerIndex]->EncryptAndEnlengthen (
+                        plaintext,
+                        plaintextLength,
+                        0,
+                        0,
+                        block.output.GetWritePtr ()));
+            }
+        }
+
+        void FileEncryptor::WriteBlock (Block &block) {
+            std::size_t ciphertextLength = block.output.GetDataAvailableForReading ();
+            if (toFile->Write (block.output.GetReadPtr (), ciphertextLength) == ciphertextLength) {
+                // The key ring is only touched from the Run thread.
+                if (block.key.Get () != 0) {
+                    keyRing->AddCipherKey (block.key);
+                }
+                if (contentDefinedChunking) {
+                    chunkIds.insert (
+                        chunkIds.end (),
+                        block.chunkId.data,
+                        block.chunkId.data + ID::SIZE);
+                    if (ciphertextLength > CHUNKED_FRAME_HEADER_SIZE) {
+                        OnChunkWritten (
+                            block.chunkId,
+                            block.output.GetReadPtr () + CHUNKED_FRAME_HEADER_SIZE,
+                            ciphertextLength - CHUNKED_FRAME_HEADER_SIZE);
+                    }
+                }
+                else if (seekable) {
+                    // Skip the length/frame header. The index points
+                    // directly at the Cipher::Encrypt output.
+                    std::size_t headerLength = block.key.Get () != 0 ?
+                        (std::size_t)FrameHeader::SIZE : (std::size_t)util::UI32_SIZE;
+                    const util::ui8 *ciphertext = block.output.GetReadPtr () + headerLength;
+                    CiphertextHeader ciphertextHeader;
+                    util::TenantReadBuffer buffer (
+                        util::NetworkEndian,
+                        ciphertext,
+                        CiphertextHeader::SIZE);
+                    buffer >> ciphertextHeader;
+                    SeekableBlockInfo blockInfo;
+                    blockInfo.offset = offset + headerLength;
+                    blockInfo.ciphertextLength = (util::ui32)(ciphertextLength - headerLength);
+                    blockInfo.plaintextLength =
+                        (util::ui32)block.input.GetDataAvailableForReading ();
+                    blockInfo.keyId = block.key.Get () != 0 ? block.key->GetId () : key->GetId ();
+                    blockInfo.ivLength = ciphertextHeader.ivLength;
+                    memcpy (blockInfo.iv, ciphertext + CiphertextHeader::SIZE, blockInfo.ivLength);
+                    index.push_back (blockInfo);
+                    offset += ciphertextLength;
+                }
+                OnBlockWritten (
+                    block.sequenceNumber,
+                    block.input.GetDataAvailableForReading (),
+                    ciphertextLength);
+            }
+            else {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "Unable to write " THEKOGANS_UTIL_SIZE_T_FORMAT " bytes to %s",
+                    ciphertextLength,
+                    toFile->GetPath ().c_str ());
+            }
+        }
+
+        void FileEncryptor::WriteIndex () {
+            SymmetricKey::SharedPtr indexKey;
+            Cipher::SharedPtr indexCipher;
+            if (keyRing.Get () != 0) {
+                indexKey = SymmetricKey::FromRandom (
+                    SymmetricKey::MIN_RANDOM_LENGTH,
+                    0,
+                    0,
+                    GetCipherKeyLength (cipher));
+                indexCipher = cipherSuite.GetCipher (indexKey);
+            }
+            else {
+                indexKey = key;
+                indexCipher = ciphers[0];
+            }
+            std::size_t indexLength = util::UI32_SIZE + util::UI64_SIZE;
+            for (std::size_t i = 0, count = index.size (); i < count; ++i) {
+                indexLength += index[i].Size ();
+            }
+            util::Buffer plaintext (util::NetworkEndian, indexLength);
+            plaintext << blockSize << (util::ui64)index.size ();
+            for (std::size_t i = 0, count = index.size (); i < count; ++i) {
+                plaintext << index[i];
+            }
+            util::Buffer ciphertext = indexCipher->Encrypt (
+                plaintext.GetReadPtr (),
+                plaintext.GetDataAvailableForReading (),
+                0,
+                0);
+            std::size_t ciphertextLength = ciphertext.GetDataAvailableForReading ();
+            if (toFile->Write (ciphertext.GetReadPtr (), ciphertextLength) != ciphertextLength) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "Unable to write " THEKOGANS_UTIL_SIZE_T_FORMAT " bytes to %s",
+                    ciphertextLength,
+                    toFile->GetPath ().c_str ());
+            }
+            SeekableFileFooter footer;
+            footer.indexOffset = offset;
+            footer.indexLength = (util::ui32)ciphertextLength;
+            footer.indexKeyId = indexKey->GetId ();
+            *toFile << footer;
+            if (keyRing.Get () != 0) {
+                keyRing->AddCipherKey (indexKey);
+            }
+        }
+
+        BlockPipeline::Block::SharedPtr FileEncryptor::ReadChunk () {
+            // Keep a max chunk's worth of input buffered (unless at eof) so that
+            // the chunker sees every byte the next boundary could depend on.
+            if (chunkBufferLength < blockSize && !chunkEof) {
+                if (chunkBufferOffset > 0) {
+                    memmove (&chunkBuffer[0], &chunkBuffer[chunkBufferOffset], chunkBufferLength);
+                    chunkBufferOffset = 0;
+                }
+                while (chunkBufferLength < blockSize) {
+                    std::size_t length = fromFile->Read (
+                        &chunkBuffer[chunkBufferLength],
+                        blockSize - chunkBufferLength);
+                    if (length == 0) {
+                        chunkEof = true;
+                        break;
+                    }
+                    chunkBufferLength += length;
+                }
+            }
+            std::size_t chunkLength = chunker.FindBoundary (
+                &chunkBuffer[chunkBufferOffset],
+                chunkBufferLength);
+            if (chunkLength > 0) {
+                Block::SharedPtr block (
+                    new Block (
+                        chunkLength,
+                        Cipher::GetMaxBufferLength (
+                            compression != Compressor::NONE ?
+                                COMPRESSED_BLOCK_HEADER_SIZE + chunkLength : chunkLength)));
+                PlaceBlock (*block);
+                block->input.Write (&chunkBuffer[chunkBufferOffset], chunkLength);
+                chunkBufferOffset += chunkLength;
+                chunkBufferLength -= chunkLength;
+                return block;
+            }
+            return Block::SharedPtr ();
+        }
+
+        ID FileEncryptor::GetChunkId (
+                std::size_t workerIndex,
+                const util::ui8 *plaintext,
+                std::size_t plaintextLength) {
+            util::ui8 signature[EVP_MAX_MD_SIZE];
+            // Ids are ID::SIZE bytes (a truncated mac if the digest is longer).
+            if (chunkMACs[workerIndex]->SignBuffer (plaintext, plaintextLength, signature) < ID::SIZE) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION ("%s",
+                    "Chunk ids require a digest of at least 256 bits.");
+            }
+            return ID (signature);
+        }
+
+        void FileEncryptor::WriteChunksTrailer () {
+            // The trailer mac covers the chunk ids in order, so
+            // reordered, dropped or truncated chunks are detected.
+            util::ui8 trailer[CHUNKED_FRAME_HEADER_SIZE];
+            util::ui8 signature[EVP_MAX_MD_SIZE];
+            trailerMAC->SignBuffer (&chunkIds[0], chunkIds.size (), signature);
+            memcpy (trailer, signature, ID::SIZE);
+            util::TenantWriteBuffer buffer (
+                util::NetworkEndian,
+                trailer + ID::SIZE,
+                util::UI32_SIZE);
+            buffer << (util::ui32)CHUNKS_TRAILER;
+            if (toFile->Write (trailer, CHUNKED_FRAME_HEADER_SIZE) != CHUNKED_FRAME_HEADER_SIZE) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "Unable to write %u bytes to %s",
+                    (unsigned int)CHUNKED_FRAME_HEADER_SIZE,
+                    toFile->GetPath ().c_str ());
+            }
+        }
+
+    } // namespace crypto
+} // namespace thekogans
@@ -0,0 +1,442 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#if defined (TOOLCHAIN_OS_Windows)
+    #include <winsock2.h>
+#endif // defined (TOOLCHAIN_OS_Windows)
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include "thekogans/util/Exception.h"
+#include "thekogans/util/Path.h"
+#include "thekogans/crypto/CipherSuite.h"
+#include "thekogans/crypto/OpenSSLUtils.h"
+#include "thekogans/crypto/FileManifest.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        FileManifest::FileManifest (const FileManifestHeader &header_) :
+                header (header_),
+                md (CipherSuite::GetOpenSSLMessageDigestByName (header.messageDigest)) {
+            if (header.magic != FileManifestHeader::MAGIC ||
+                    header.version != FileManifestHeader::VERSION ||
+                    header.chunkSize == 0 || md == 0 ||
+                    header.chunkCount != (header.fileSize + header.chunkSize - 1) / header.chunkSize) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "%s", "Invalid file manifest header.");
+            }
+        }
+
+        FileManifest::SharedPtr FileManifest::Create (
+                const std::string &path,
+                Authenticator &signer,
+                util::ui32 chunkSize,
+                const EVP_MD *md,
+                std::size_t workerCount,
+                bool map) {
+            if (chunkSize > 0 && md != 0) {
+                util::ui64 fileSize = util::ReadOnlyFile (util::NetworkEndian, path).GetSize ();
+                SharedPtr manifest (
+                    new FileManifest (
+                        FileManifestHeader (
+                            chunkSize,
+                            fileSize,
+                            CipherSuite::GetOpenSSLMessageDigestName (md))));
+                MessageDigest messageDigest (md);
+                util::Buffer root = messageDigest.HashFileTree (
+                    path,
+                    chunkSize,
+                    workerCount,
+                    map,
+                    &manifest->chunkDigests);
+                // HashFileTree covers the length it actually read. If it
+                // disagrees with the header, the file changed under us.
+                util::Buffer expectedRoot = manifest->GetRoot ();
+                if (manifest->chunkDigests.size () !=
+                        manifest->header.chunkCount * manifest->GetDigestLength () ||
+                        root.GetDataAvailableForReading () != expectedRoot.GetDataAvailableForReading () ||
+                        memcmp (
+                            root.GetReadPtr (),
+                            expectedRoot.GetReadPtr (),
+                            root.GetDataAvailableForReading ()) != 0) {
+                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                        "%s changed while it was being hashed.",
+                        path.c_str ());
+                }
+                util::Buffer signedData = manifest->GetSignedData ();
+                manifest->signature = signer.SignBuffer (
+                    signedData.GetReadPtr (),
+                    signedData.GetDataAvailableForReading ());
+                return manifest;
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        FileManifest::SharedPtr FileManifest::Load (const std::string &path) {
+            util::ReadOnlyFile file (util::NetworkEndian, path);
+            util::Buffer buffer (util::NetworkEndian, (std::size_t)file.GetSize ());
+            buffer.AdvanceWriteOffset (
+                file.Read (
+                    buffer.GetWritePtr (),
+                    buffer.GetDataAvailableForWriting ()));
+            FileManifestHeader header;
+            buffer >> header;
+            SharedPtr manifest (new FileManifest (header));
+            // Don't trust chunkCount before checking it against
+            // the amount of data actually present.
+            util::ui64 digestsLength = manifest->GetDigestLength ();
+            if (header.chunkCount > buffer.GetDataAvailableForReading () / digestsLength) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "Invalid file manifest %s",
+                    path.c_str ());
+            }
+            digestsLength *= header.chunkCount;
+            manifest->chunkDigests.resize ((std::size_t)digestsLength);
+            if (digestsLength > 0) {
+                buffer.Read (manifest->chunkDigests.data (), (std::size_t)digestsLength);
+            }
+            util::ui32 signatureLength;
+            buffer >> signatureLength;
+            if (signatureLength == 0 || signatureLength != buffer.GetDataAvailableForReading ()) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "Invalid file manifest signature in %s",
+                    path.c_str ());
+            }
+            manifest->signature = util::Buffer (util::NetworkEndian, signatureLength);
+            manifest->signature.AdvanceWriteOffset (
+                buffer.Read (manifest->signature.GetWritePtr (), signatureLength));
+            return manifest;
+        }
+
+        void FileManifest::Save (const std::string &path) const {
+            util::Buffer buffer (
+                util::NetworkEndian,
+                header.Size () +
+                chunkDigests.size () +
+                util::UI32_SIZE +
+                signature.GetDataAvailableForReading ());
+            buffer << header;
+            if (!chunkDigests.empty ()) {
+                buffer.Write (chunkDigests.data (), chunkDigests.size ());
+            }
+            buffer << (util::ui32)signature.GetDataAvailableForReading ();
+            buffer.Write (signature.GetReadPtr (), signature.GetDataAvailableForReading ());
+            util::SimpleFile file (
+                util::NetworkEndian,
+                path,
+                util::SimpleFile::ReadWrite |
+                util::SimpleFile::Create |
+                util::SimpleFile::Truncate);
+            file.Write (
+                buffer.GetReadPtr (),
+                buffer.GetDataAvailableForReading ());
+        }
+
+        const util::ui8 *FileManifest::GetChunkDigest (util::ui64 chunk) const {
+            if (chunk < header.chunkCount) {
+                return &chunkDigests[(std::size_t)(chunk * GetDigestLength ())];
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        std::size_t FileManifest::GetChunkLength (util::ui64 chunk) const {
+            if (chunk < header.chunkCount) {
+                return (std::size_t)std::min (
+                    (util::ui64)header.chunkSize,
+                    header.fileSize - chunk * header.chunkSize);
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        util::Buffer FileManifest::GetRoot () const {
+            return MessageDigest (md).HashTreeRoot (
+                chunkDigests.data (),
+                chunkDigests.size (),
+                header.chunkSize,
+                header.fileSize);
+        }
+
+        bool FileManifest::VerifySignature (Authenticator &verifier) const {
+            util::Buffer signedData = GetSignedData ();
+            return verifier.VerifyBufferSignature (
+                signedData.GetReadPtr (),
+                signedData.GetDataAvailableForReading (),
+                signature.GetReadPtr (),
+                signature.GetDataAvailableForReading ());
+        }
+
+        bool FileManifest::VerifyChunk (
+                MessageDigest &messageDigest,
+                util::ui64 chunk,
+                const void *buffer,
+                std::size_t bufferLength) const {
+            if (messageDigest.GetDigestLength () == GetDigestLength () &&
+                    chunk < header.chunkCount && bufferLength == GetChunkLength (chunk)) {
+                util::ui8 digest[EVP_MAX_MD_SIZE];
+                messageDigest.HashTreeLeaf (buffer, bufferLength, digest);
+                return TimeInsensitiveCompare (digest, GetChunkDigest (chunk), GetDigestLength ());
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        util::Buffer FileManifest::GetSignedData () const {
+            util::Buffer root = GetRoot ();
+            util::Buffer signedData (
+                util::NetworkEndian,
+                header.Size () + root.GetDataAvailableForReading ());
+            signedData << header;
+            signedData.Write (root.GetReadPtr (), root.GetDataAvailableForReading ());
+            return signedData;
+        }
+
+        namespace {
+            // Chunks are not read in order (verified chunks are
+            // skipped), so every block remembers it's chunk index.
+            struct ChunkBlock : public BlockPipeline::Block {
+                util::ui64 chunk;
+
+                ChunkBlock (
+                    util::ui64 chunk_,
+                    std::size_t inputLength,
+                    std::size_t outputLength) :
+                    Block (inputLength, outputLength),
+                    chunk (chunk_) {}
+            };
+
+            // Progress file layout: MAGIC, root length, root,
+            // chunk count, one bit per chunk (1 == verified).
+            const util::ui32 PROGRESS_MAGIC = 0x544b4650; // "TKFP"
+        }
+
+        FileManifestVerifier::FileManifestVerifier (
+                FileManifest::SharedPtr manifest_,
+                Authenticator &verifier,
+                std::size_t workerCount,
+                std::size_t maxPendingBlocks) :
+                BlockPipeline (workerCount, maxPendingBlocks),
+                manifest (manifest_),
+                signatureValid (false),
+                verifiedChunkCount (0),
+                file (0),
+                nextChunk (0),
+                endChunk (0) {
+            if (manifest.Get () != 0) {
+                signatureValid = manifest->VerifySignature (verifier);
+                verifiedChunks.resize ((std::size_t)manifest->GetHeader ().chunkCount, false);
+                // Each worker gets it's own digest so that
+                // chunks can be hashed without locking.
+                messageDigests.resize (GetWorkerCount ());
+                for (std::size_t i = 0, count = messageDigests.size (); i < count; ++i) {
+                    messageDigests[i].Reset (new MessageDigest (manifest->GetMD ()));
+                }
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        bool FileManifestVerifier::IsVerified (
+                util::ui64 offset,
+                util::ui64 length) const {
+            const FileManifestHeader &header = manifest->GetHeader ();
+            if (!signatureValid) {
+                return false;
+            }
+            if (offset >= header.fileSize) {
+                return true;
+            }
+            util::ui64 end = length == 0 || length > header.fileSize - offset ?
+                header.fileSize : offset + length;
+            for (util::ui64 chunk = offset / header.chunkSize,
+                    lastChunk = (end - 1) / header.chunkSize; chunk <= lastChunk; ++chunk) {
+                if (!verifiedChunks[(std::size_t)chunk]) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        bool FileManifestVerifier::Verify (
+                const std::string &path,
+                util::ui64 offset,
+                util::ui64 length) {
+            if (!signatureValid) {
+                return false;
+            }
+            const FileManifestHeader &header = manifest->GetHeader ();
+            util::ReadOnlyFile file_ (util::NetworkEndian, path);
+            if (file_.GetSize () != header.fileSize) {
+                return false;
+            }
+            if (offset >= header.fileSize) {
+                return true;
+            }
+            util::ui64 end = length == 0 || length > header.fileSize - offset ?
+                header.fileSize : offset + length;
+            nextChunk = offset / header.chunkSize;
+            endChunk = (end - 1) / header.chunkSize + 1;
+            invalidChunks.clear ();
+            file = &file_;
+            THEKOGANS_UTIL_TRY {
+                Run ();
+                file = 0;
+            }
+            THEKOGANS_UTIL_CATCH (util::Exception) {
+                file = 0;
+                THEKOGANS_UTIL_RETHROW_EXCEPTION (exception);
+            }
+            return invalidChunks.empty ();
+        }
+
+        void FileManifestVerifier::SaveProgress (const std::string &path) const {
+            util::Buffer root = manifest->GetRoot ();
+            std::vector<util::ui8> bitmap ((verifiedChunks.size () + 7) / 8, 0);
+            for (std::size_t i = 0, count = verifiedChunks.size (); i < count; ++i) {
+                if (verifiedChunks[i]) {
+                    bitmap[i / 8] |= (util::ui8)(1 << (i % 8));
+                }
+            }
+            util::Buffer buffer (
+                util::NetworkEndian,
+                util::UI32_SIZE +
+                util::UI32_SIZE +
+                root.GetDataAvailableForReading () +
+                util::UI64_SIZE +
+                bitmap.size ());
+            buffer << PROGRESS_MAGIC << (util::ui32)root.GetDataAvailableForReading ();
+            buffer.Write (root.GetReadPtr (), root.GetDataAvailableForReading ());
+            buffer << (util::ui64)verifiedChunks.size ();
+            if (!bitmap.empty ()) {
+                buffer.Write (bitmap.data (), bitmap.size ());
+            }
+            util::SimpleFile file (
+                util::NetworkEndian,
+                path,
+                util::SimpleFile::ReadWrite |
+                util::SimpleFile::Create |
+                util::SimpleFile::Truncate);
+            file.Write (
+                buffer.GetReadPtr (),
+                buffer.GetDataAvailableForReading ());
+        }
+
+        bool FileManifestVerifier::LoadProgress (const std::string &path) {
+            if (!util::Path (path).Exists ()) {
+                return false;
+            }
+            util::ReadOnlyFile file (util::NetworkEndian, path);
+            util::Buffer buffer (util::NetworkEndian, (std::size_t)file.GetSize ());
+            buffer.AdvanceWriteOffset (
+                file.Read (
+                    buffer.GetWritePtr (),
+                    buffer.GetDataAvailableForWriting ()));
+            util::Buffer root = manifest->GetRoot ();
+            // Bind the progress to the manifest it was created with.
+            util::ui32 magic;
+            util::ui32 rootLength;
+            if (buffer.GetDataAvailableForReading () < util::UI32_SIZE + util::UI32_SIZE) {
+                return false;
+            }
+            buffer >> magic >> rootLength;
+            if (magic != PROGRESS_MAGIC ||
+                    rootLength != root.GetDataAvailableForReading () ||
+                    buffer.GetDataAvailableForReading () < rootLength + util::UI64_SIZE ||
+                    memcmp (buffer.GetReadPtr (), root.GetReadPtr (), rootLength) != 0) {
+                return false;
+            }
+            buffer.AdvanceReadOffset (rootLength);
+            util::ui64 chunkCount;
+            buffer >> chunkCount;
+            if (chunkCount != verifiedChunks.size () ||
+                    buffer.GetDataAvailableForReading () != (verifiedChunks.size () + 7) / 8) {
+                return false;
+            }
+            const util::ui8 *bitmap = buffer.GetReadPtr ();
+            verifiedChunkCount = 0;
+            for (std::size_t i = 0, count = verifiedChunks.size (); i < count; ++i) {
+                verifiedChunks[i] = (bitmap[i / 8] & (1 << (i % 8))) != 0;
+                if (verifiedChunks[i]) {
+                    ++verifiedChunkCount;
+                }
+            }
+            return true;
+        }
+
+        BlockPipeline::Block::SharedPtr FileManifestVerifier::ReadBlock () {
+            while (nextChunk < endChunk && verifiedChunks[(std::size_t)nextChunk]) {
+                ++nextChunk;
+            }
+            if (nextChunk < endChunk) {
+                std::size_t chunkLength = manifest->GetChunkLength (nextChunk);
+                Block::SharedPtr block (
+                    new ChunkBlock (nextChunk, chunkLength, manifest->GetDigestLength ()));
+                file->Seek (nextChunk * manifest->GetHeader ().chunkSize, SEEK_SET);
+                if (file->Read (block->input.GetWritePtr (), chunkLength) != chunkLength) {
+                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                        "Unable to read " THEKOGANS_UTIL_SIZE_T_FORMAT " bytes from %s",
+                        chunkLength,
+                        file->GetPath ().c_str ());
+                }
+                block->input.AdvanceWriteOffset (chunkLength);
+                ++nextChunk;
+                return block;
+            }
+            return Block::SharedPtr ();
+        }
+
+        void FileManifestVerifier::ProcessBlock (
+                std::size_t workerIndex,
+                Block &block) {
+            block.output.AdvanceWriteOffset (
+                messageDigests[workerIndex]->HashTreeLeaf (
+                    block.input.GetReadPtr (),
+                    block.input.GetDataAvailableForReading (),
+                    block.output.GetWritePtr ()));
+        }
+
+        void FileManifestVerifier::WriteBlock (Block &block) {
+            util::ui64 chunk = static_cast<ChunkBlock &> (block).chunk;
+            bool valid = TimeInsensitiveCompare (
+                block.output.GetReadPtr (),
+                manifest->GetChunkDigest (chunk),
+                manifest->GetDigestLength ());
+            if (valid) {
+                verifiedChunks[(std::size_t)chunk] = true;
+                ++verifiedChunkCount;
+            }
+            else {
+                invalidChunks.push_back (chunk);
+            }
+            OnChunkVerified (chunk, valid);
+        }
+
+    } // namespace crypto
+} // namespace thekogans
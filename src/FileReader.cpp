@@ -0,0 +1,634 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined (TOOLCHAIN_OS_Windows)
+    #include <sys/types.h>
+    #include <sys/stat.h>
+    #include <sys/mman.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <cerrno>
+    #include <cstdlib>
+#endif // !defined (TOOLCHAIN_OS_Windows)
+#include <cstring>
+#include <algorithm>
+#include "thekogans/util/Exception.h"
+#include "thekogans/util/HRTimer.h"
+#include "thekogans/util/Thread.h"
+#include "thekogans/util/Mutex.h"
+#include "thekogans/util/Condition.h"
+#include "thekogans/util/LockGuard.h"
+#include "thekogans/crypto/IOUring.h"
+#include "thekogans/crypto/FileReader.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        namespace {
+            inline util::f64 GetElapsedSeconds (
+                    util::ui64 start,
+                    util::ui64 end) {
+                return util::HRTimer::ToSeconds (
+                    util::HRTimer::ComputeElapsedTime (start, end));
+            }
+
+            // O_DIRECT requires the buffers, offsets and lengths
+            // to be aligned to the logical block size.
+            const std::size_t DIRECT_IO_ALIGNMENT = 4096;
+
+        #if defined (THEKOGANS_CRYPTO_HAVE_IO_URING)
+            // io_uring read lengths are 32 bits (and the kernel caps
+            // them at MAX_RW_COUNT anyway).
+            const std::size_t MAX_IO_URING_BLOCK_SIZE = 1024 * 1024 * 1024;
+        #endif // defined (THEKOGANS_CRYPTO_HAVE_IO_URING)
+        }
+
+        // The ring holds blocks.size () buffers. The I/O thread fills them
+        // in order (tail) while the caller consumes them in order (head).
+        // The block the caller is currently consuming stays filled until
+        // the caller asks for the next one. A zero length block marks eof.
+        // With io_uring, every block the caller doesn't hold has a read in
+        // flight. Reads complete in any order, but are published (tail) in
+        // file order.
+        struct FileReader::ReadAhead : public util::Thread {
+        private:
+            struct Block {
+                util::ui8 *data;
+                std::size_t length;
+                // io_uring state.
+                util::ui64 offset;
+                bool complete;
+
+                Block () :
+                    data (0),
+                    length (0),
+                    offset (0),
+                    complete (false) {}
+            };
+            std::size_t blockSize;
+            std::vector<Block> blocks;
+            bool direct;
+        #if defined (TOOLCHAIN_OS_Windows)
+            util::ReadOnlyFile file;
+        #else // defined (TOOLCHAIN_OS_Windows)
+            int fd;
+        #endif // defined (TOOLCHAIN_OS_Windows)
+            util::ui64 size;
+        #if defined (THEKOGANS_CRYPTO_HAVE_IO_URING)
+            std::unique_ptr<IOUring> ring;
+            bool registered;
+        #endif // defined (THEKOGANS_CRYPTO_HAVE_IO_URING)
+            util::Mutex mutex;
+            util::Condition filledCondition;
+            util::Condition emptiedCondition;
+            std::size_t head;
+            std::size_t tail;
+            std::size_t filled;
+            bool done;
+            std::string error;
+            util::f64 readSeconds;
+            // Caller side state (only touched by the consuming thread).
+            bool holding;
+            bool eof;
+            std::size_t blockOffset;
+
+        public:
+            ReadAhead (
+                    const std::string &path,
+                    std::size_t blockSize_,
+                    std::size_t blockCount,
+                    bool direct_,
+                    bool ioUring) :
+                    blockSize (blockSize_),
+                    blocks (blockCount),
+                    direct (false),
+                #if defined (TOOLCHAIN_OS_Windows)
+                    file (util::HostEndian, path),
+                #else // defined (TOOLCHAIN_OS_Windows)
+                    fd (-1),
+                #endif // defined (TOOLCHAIN_OS_Windows)
+                    size (0),
+                #if defined (THEKOGANS_CRYPTO_HAVE_IO_URING)
+                    registered (false),
+                #endif // defined (THEKOGANS_CRYPTO_HAVE_IO_URING)
+                    filledCondition (mutex),
+                    emptiedCondition (mutex),
+                    head (0),
+                    tail (0),
+                    filled (0),
+                    done (false),
+                    readSeconds (0.0),
+                    holding (false),
+                    eof (false),
+                    blockOffset (0) {
+            #if defined (TOOLCHAIN_OS_Windows)
+                size = file.GetSize ();
+            #else // defined (TOOLCHAIN_OS_Windows)
+            #if defined (O_DIRECT)
+                if (direct_) {
+                    // Not all file systems support O_DIRECT (tmpfs).
+                    fd = open (path.c_str (), O_RDONLY | O_DIRECT);
+                    direct = fd != -1;
+                }
+            #endif // defined (O_DIRECT)
+                if (fd == -1) {
+                    fd = open (path.c_str (), O_RDONLY);
+                    if (fd == -1) {
+                        THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                            THEKOGANS_UTIL_OS_ERROR_CODE);
+                    }
+                #if defined (F_NOCACHE)
+                    if (direct_) {
+                        direct = fcntl (fd, F_NOCACHE, 1) != -1;
+                    }
+                #endif // defined (F_NOCACHE)
+                }
+                struct stat st;
+                if (fstat (fd, &st) != 0) {
+                    THEKOGANS_UTIL_ERROR_CODE errorCode = THEKOGANS_UTIL_OS_ERROR_CODE;
+                    close (fd);
+                    THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (errorCode);
+                }
+                size = (util::ui64)st.st_size;
+                // These are hints. Failure is harmless.
+            #if defined (POSIX_FADV_SEQUENTIAL)
+                posix_fadvise (fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+            #elif defined (F_RDAHEAD)
+                fcntl (fd, F_RDAHEAD, 1);
+            #endif // defined (POSIX_FADV_SEQUENTIAL)
+                if (direct) {
+                    blockSize = (blockSize + DIRECT_IO_ALIGNMENT - 1) &
+                        ~(DIRECT_IO_ALIGNMENT - 1);
+                }
+                for (std::size_t i = 0, count = blocks.size (); i < count; ++i) {
+                    void *data = 0;
+                    if (posix_memalign (&data, DIRECT_IO_ALIGNMENT, blockSize) != 0) {
+                        FreeBlocks ();
+                        close (fd);
+                        THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                            THEKOGANS_UTIL_OS_ERROR_CODE_ENOMEM);
+                    }
+                    blocks[i].data = (util::ui8 *)data;
+                }
+            #if defined (THEKOGANS_CRYPTO_HAVE_IO_URING)
+                if (ioUring && blockSize <= MAX_IO_URING_BLOCK_SIZE && IOUring::IsSupported ()) {
+                    THEKOGANS_UTIL_TRY {
+                        ring.reset (new IOUring ((unsigned)blocks.size ()));
+                        std::vector<struct iovec> iovecs (blocks.size ());
+                        for (std::size_t i = 0, count = blocks.size (); i < count; ++i) {
+                            iovecs[i].iov_base = blocks[i].data;
+                            iovecs[i].iov_len = blockSize;
+                        }
+                        // Registration fails if the buffers exceed RLIMIT_MEMLOCK.
+                        // Unregistered reads still work (they just pin the pages
+                        // on every request).
+                        registered = ring->RegisterBuffers (
+                            iovecs.data (), (unsigned)iovecs.size ());
+                    }
+                    THEKOGANS_UTIL_CATCH (util::Exception) {
+                        // Fall back to blocking reads.
+                        ring.reset ();
+                    }
+                }
+            #endif // defined (THEKOGANS_CRYPTO_HAVE_IO_URING)
+            #endif // defined (TOOLCHAIN_OS_Windows)
+            #if defined (TOOLCHAIN_OS_Windows)
+                for (std::size_t i = 0, count = blocks.size (); i < count; ++i) {
+                    blocks[i].data = new util::ui8[blockSize];
+                }
+            #endif // defined (TOOLCHAIN_OS_Windows)
+                Create ();
+            }
+            ~ReadAhead () {
+                {
+                    util::LockGuard<util::Mutex> guard (mutex);
+                    done = true;
+                    emptiedCondition.Signal ();
+                }
+                Wait ();
+                FreeBlocks ();
+            #if !defined (TOOLCHAIN_OS_Windows)
+                close (fd);
+            #endif // !defined (TOOLCHAIN_OS_Windows)
+            }
+
+            inline util::ui64 GetSize () const {
+                return size;
+            }
+
+            inline bool IsIOUring () const {
+            #if defined (THEKOGANS_CRYPTO_HAVE_IO_URING)
+                return ring.get () != 0;
+            #else // defined (THEKOGANS_CRYPTO_HAVE_IO_URING)
+                return false;
+            #endif // defined (THEKOGANS_CRYPTO_HAVE_IO_URING)
+            }
+
+            util::f64 GetReadSeconds () {
+                util::LockGuard<util::Mutex> guard (mutex);
+                return readSeconds;
+            }
+
+            // Return the rest of the current block, or the next block
+            // (waiting for the I/O thread if it's not ready yet).
+            std::size_t Next (
+                    const util::ui8 *&chunk,
+                    util::f64 &stallSeconds) {
+                if (holding) {
+                    const Block &block = blocks[head];
+                    if (blockOffset < block.length) {
+                        chunk = block.data + blockOffset;
+                        std::size_t length = block.length - blockOffset;
+                        blockOffset = block.length;
+                        return length;
+                    }
+                }
+                if (eof) {
+                    return 0;
+                }
+                util::LockGuard<util::Mutex> guard (mutex);
+                if (holding) {
+                    holding = false;
+                    head = (head + 1) % blocks.size ();
+                    --filled;
+                    emptiedCondition.Signal ();
+                }
+                if (filled == 0) {
+                    util::ui64 start = util::HRTimer::Click ();
+                    while (filled == 0) {
+                        filledCondition.Wait ();
+                    }
+                    stallSeconds += GetElapsedSeconds (start, util::HRTimer::Click ());
+                }
+                const Block &block = blocks[head];
+                if (block.length == 0) {
+                    eof = true;
+                    if (!error.empty ()) {
+                        THEKOGANS_UTIL_THROW_STRING_EXCEPTION ("%s", error.c_str ());
+                    }
+                    return 0;
+                }
+                holding = true;
+                blockOffset = block.length;
+                chunk = block.data;
+                return block.length;
+            }
+
+            std::size_t Read (
+                    void *buffer,
+                    std::size_t length,
+                    util::f64 &stallSeconds) {
+                std::size_t count = 0;
+                while (count < length) {
+                    // Put back the part of the block Next returns that we don't use.
+                    const util::ui8 *chunk;
+                    std::size_t chunkLength = Next (chunk, stallSeconds);
+                    if (chunkLength == 0) {
+                        break;
+                    }
+                    std::size_t copyLength = std::min (chunkLength, length - count);
+                    memcpy ((util::ui8 *)buffer + count, chunk, copyLength);
+                    blockOffset -= chunkLength - copyLength;
+                    count += copyLength;
+                }
+                return count;
+            }
+
+        protected:
+            // util::Thread
+            virtual void Run () throw () override {
+            #if defined (THEKOGANS_CRYPTO_HAVE_IO_URING)
+                if (ring.get () != 0) {
+                    RunIOUring ();
+                    return;
+                }
+            #endif // defined (THEKOGANS_CRYPTO_HAVE_IO_URING)
+                while (1) {
+                    {
+                        util::LockGuard<util::Mutex> guard (mutex);
+                        while (!done && filled == blocks.size ()) {
+                            emptiedCondition.Wait ();
+                        }
+                        if (done) {
+                            break;
+                        }
+                    }
+                    // tail is only modified by this thread, and the block
+                    // it points to is not visible to the caller until filled
+                    // is incremented below, so it's safe to read in to it
+                    // without holding the lock.
+                    Block &block = blocks[tail];
+                    std::string readError;
+                    util::ui64 start = util::HRTimer::Click ();
+                    THEKOGANS_UTIL_TRY {
+                        block.length = ReadBlock (block.data);
+                    }
+                    THEKOGANS_UTIL_CATCH (util::Exception) {
+                        block.length = 0;
+                        readError = exception.Report ();
+                    }
+                    util::f64 seconds = GetElapsedSeconds (start, util::HRTimer::Click ());
+                    util::LockGuard<util::Mutex> guard (mutex);
+                    readSeconds += seconds;
+                    error = readError;
+                    tail = (tail + 1) % blocks.size ();
+                    ++filled;
+                    filledCondition.Signal ();
+                    if (block.length == 0) {
+                        break;
+                    }
+                }
+            }
+
+        private:
+        #if defined (THEKOGANS_CRYPTO_HAVE_IO_URING)
+            void RunIOUring () {
+                std::size_t count = blocks.size ();
+                // Blocks (starting at tail) with a read in flight, or
+                // completed but waiting for an earlier block.
+                std::size_t issued = 0;
+                util::ui64 nextOffset = 0;
+                std::string readError;
+                THEKOGANS_UTIL_TRY {
+                    while (1) {
+                        std::size_t available;
+                        {
+                            util::LockGuard<util::Mutex> guard (mutex);
+                            while (!done && issued == 0 && filled == count) {
+                                emptiedCondition.Wait ();
+                            }
+                            if (done) {
+                                Drain ();
+                                return;
+                            }
+                            available = count - filled - issued;
+                        }
+                        for (; available > 0 && nextOffset < size; --available) {
+                            std::size_t index = (tail + issued) % count;
+                            Block &block = blocks[index];
+                            block.length = 0;
+                            block.offset = nextOffset;
+                            block.complete = false;
+                            if (!ring->PrepareRead (fd, block.data, blockSize, nextOffset,
+                                    registered ? (int)index : -1, index)) {
+                                break;
+                            }
+                            nextOffset += blockSize;
+                            ++issued;
+                        }
+                        if (issued == 0) {
+                            // Everything has been read and handed to the caller.
+                            break;
+                        }
+                        util::ui64 start = util::HRTimer::Click ();
+                        CompleteBlock (ring->WaitCompletion ());
+                        util::f64 seconds = GetElapsedSeconds (start, util::HRTimer::Click ());
+                        std::size_t ready = 0;
+                        while (ready < issued && blocks[(tail + ready) % count].complete) {
+                            ++ready;
+                        }
+                        util::LockGuard<util::Mutex> guard (mutex);
+                        readSeconds += seconds;
+                        if (ready > 0) {
+                            tail = (tail + ready) % count;
+                            filled += ready;
+                            issued -= ready;
+                            filledCondition.Signal ();
+                        }
+                    }
+                }
+                THEKOGANS_UTIL_CATCH (util::Exception) {
+                    // The kernel may still be writing in to the blocks.
+                    Drain ();
+                    readError = exception.Report ();
+                }
+                // tail belongs to this thread (either it's free, or
+                // it's read failed), so it can carry eof (and the error).
+                util::LockGuard<util::Mutex> guard (mutex);
+                blocks[tail].length = 0;
+                error = readError;
+                tail = (tail + 1) % count;
+                ++filled;
+                filledCondition.Signal ();
+            }
+
+            void CompleteBlock (const IOUring::Completion &completion) {
+                std::size_t index = (std::size_t)completion.userData;
+                Block &block = blocks[index];
+                if (completion.result < 0) {
+                    if (completion.result != -EINTR && completion.result != -EAGAIN) {
+                        THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (-completion.result);
+                    }
+                }
+                else {
+                    block.length += (std::size_t)completion.result;
+                    // A short read before eof (signals, MAX_RW_COUNT) is
+                    // resumed. A short direct read means eof (see ReadBlock).
+                    if (completion.result == 0 || block.length == blockSize ||
+                            block.offset + block.length >= size ||
+                            (direct && (block.length & (DIRECT_IO_ALIGNMENT - 1)) != 0)) {
+                        block.complete = true;
+                        return;
+                    }
+                }
+                if (!ring->PrepareRead (fd, block.data + block.length,
+                        blockSize - block.length, block.offset + block.length,
+                        registered ? (int)index : -1, index)) {
+                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION ("%s",
+                        "io_uring submission queue is full.");
+                }
+            }
+
+            void Drain () {
+                THEKOGANS_UTIL_TRY {
+                    while (ring->GetInFlight () > 0) {
+                        ring->WaitCompletion ();
+                    }
+                }
+                THEKOGANS_UTIL_CATCH (util::Exception) {
+                    // Nothing more can be done. Closing the ring cancels the rest.
+                    ring.reset ();
+                }
+            }
+        #endif // defined (THEKOGANS_CRYPTO_HAVE_IO_URING)
+
+            std::size_t ReadBlock (util::ui8 *data) {
+            #if defined (TOOLCHAIN_OS_Windows)
+                return file.Read (data, blockSize);
+            #else // defined (TOOLCHAIN_OS_Windows)
+                std::size_t count = 0;
+                while (count < blockSize) {
+                    ssize_t result = read (fd, data + count, blockSize - count);
+                    if (result > 0) {
+                        count += (std::size_t)result;
+                        // A short direct read means eof (the next read
+                        // would be at an unaligned offset).
+                        if (direct && (count & (DIRECT_IO_ALIGNMENT - 1)) != 0) {
+                            break;
+                        }
+                    }
+                    else if (result == 0) {
+                        break;
+                    }
+                    else if (errno != EINTR) {
+                        THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                            THEKOGANS_UTIL_OS_ERROR_CODE);
+                    }
+                }
+                return count;
+            #endif // defined (TOOLCHAIN_OS_Windows)
+            }
+
+            void FreeBlocks () {
+                for (std::size_t i = 0, count = blocks.size (); i < count; ++i) {
+                #if defined (TOOLCHAIN_OS_Windows)
+                    delete [] blocks[i].data;
+                #else // defined (TOOLCHAIN_OS_Windows)
+                    free (blocks[i].data);
+                #endif // defined (TOOLCHAIN_OS_Windows)
+                    blocks[i].data = 0;
+                }
+            }
+        };
+
+        FileReader::FileReader (
+                const std::string &path_,
+                bool map_,
+                std::size_t readBlockSize_,
+                std::size_t readAheadBlockCount,
+                bool direct,
+                bool ioUring) :
+                path (path_),
+                map (0),
+                size (0),
+                offset (0),
+                readBlockSize (readBlockSize_),
+                startTime (util::HRTimer::Click ()) {
+            if (readBlockSize == 0) {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+            if (readAheadBlockCount > 0) {
+                readAhead.reset (new ReadAhead (
+                    path, readBlockSize, readAheadBlockCount, direct, ioUring));
+                size = readAhead->GetSize ();
+                return;
+            }
+        #if !defined (TOOLCHAIN_OS_Windows)
+            if (map_) {
+                int fd = open (path.c_str (), O_RDONLY);
+                if (fd != -1) {
+                    struct stat st;
+                    // Files that don't fit in the address space are read instead.
+                    if (fstat (fd, &st) == 0 && st.st_size > 0 &&
+                            (util::ui64)st.st_size <= (util::ui64)(std::size_t)-1) {
+                        void *ptr = mmap (0, (std::size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                        if (ptr != MAP_FAILED) {
+                            map = (util::ui8 *)ptr;
+                            size = (util::ui64)st.st_size;
+                            // These are hints. Failure is harmless.
+                            madvise (ptr, (std::size_t)size, MADV_SEQUENTIAL);
+                        #if defined (MADV_HUGEPAGE)
+                            madvise (ptr, (std::size_t)size, MADV_HUGEPAGE);
+                        #endif // defined (MADV_HUGEPAGE)
+                        }
+                    }
+                    // The mapping outlives the descriptor.
+                    close (fd);
+                }
+            }
+        #endif // !defined (TOOLCHAIN_OS_Windows)
+            if (map == 0) {
+                file.reset (new util::ReadOnlyFile (util::HostEndian, path));
+                size = file->GetSize ();
+            }
+        }
+
+        FileReader::~FileReader () {
+        #if !defined (TOOLCHAIN_OS_Windows)
+            if (map != 0) {
+                munmap (map, (std::size_t)size);
+            }
+        #endif // !defined (TOOLCHAIN_OS_Windows)
+        }
+
+        std::size_t FileReader::Next (const util::ui8 *&chunk) {
+            if (readAhead.get () != 0) {
+                std::size_t length = readAhead->Next (chunk, stats.stallSeconds);
+                offset += length;
+                stats.bytesRead += length;
+                stats.elapsedSeconds = GetElapsedSeconds (startTime, util::HRTimer::Click ());
+                return length;
+            }
+            if (map != 0) {
+                chunk = map + offset;
+                std::size_t length = (std::size_t)(size - offset);
+                offset = size;
+                stats.bytesRead += length;
+                stats.elapsedSeconds = GetElapsedSeconds (startTime, util::HRTimer::Click ());
+                return length;
+            }
+            buffer.resize (readBlockSize);
+            chunk = buffer.data ();
+            return Read (buffer.data (), readBlockSize);
+        }
+
+        std::size_t FileReader::Read (
+                void *buffer_,
+                std::size_t length) {
+            if (buffer_ != 0) {
+                std::size_t count;
+                if (readAhead.get () != 0) {
+                    count = readAhead->Read (buffer_, length, stats.stallSeconds);
+                }
+                else if (map != 0) {
+                    count = (std::size_t)std::min ((util::ui64)length, size - offset);
+                    memcpy (buffer_, map + offset, count);
+                }
+                else {
+                    util::ui64 start = util::HRTimer::Click ();
+                    count = file->Read (buffer_, length);
+                    util::f64 seconds = GetElapsedSeconds (start, util::HRTimer::Click ());
+                    // Synchronous reads stall the caller for their whole duration.
+                    stats.readSeconds += seconds;
+                    stats.stallSeconds += seconds;
+                }
+                offset += count;
+                stats.bytesRead += count;
+                stats.elapsedSeconds = GetElapsedSeconds (startTime, util::HRTimer::Click ());
+                return count;
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        bool FileReader::IsIOUring () const {
+            return readAhead.get () != 0 && readAhead->IsIOUring ();
+        }
+
+        FileReader::ReadStats FileReader::GetStats () const {
+            ReadStats readStats = stats;
+            if (readAhead.get () != 0) {
+                readStats.readSeconds = readAhead->GetReadSeconds ();
+            }
+            return readStats;
+        }
+
+    } // namespace crypto
+} // namespace thekogans
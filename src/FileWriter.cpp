@@ -0,0 +1,310 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined (TOOLCHAIN_OS_Windows)
+    #include <sys/types.h>
+    #include <sys/stat.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <cerrno>
+    #include <cstdlib>
+#endif // !defined (TOOLCHAIN_OS_Windows)
+#include <cstring>
+#include <algorithm>
+#include "thekogans/util/Exception.h"
+#include "thekogans/crypto/FileWriter.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        namespace {
+            // Registered (and O_DIRECT friendly) buffer alignment.
+            const std::size_t BUFFER_ALIGNMENT = 4096;
+
+        #if defined (THEKOGANS_CRYPTO_HAVE_IO_URING)
+            // io_uring write lengths are 32 bits (and the kernel caps
+            // them at MAX_RW_COUNT anyway).
+            const std::size_t MAX_IO_URING_BLOCK_SIZE = 1024 * 1024 * 1024;
+        #endif // defined (THEKOGANS_CRYPTO_HAVE_IO_URING)
+        }
+
+        FileWriter::FileWriter (
+                const std::string &path_,
+                std::size_t writeBlockSize_,
+                std::size_t writeBehindBlockCount,
+                bool ioUring) :
+                util::Serializer (util::NetworkEndian),
+                path (path_),
+            #if defined (TOOLCHAIN_OS_Windows)
+                file (
+                    util::NetworkEndian,
+                    path,
+                    util::SimpleFile::ReadWrite |
+                    util::SimpleFile::Create |
+                    util::SimpleFile::Truncate),
+            #else // defined (TOOLCHAIN_OS_Windows)
+                fd (-1),
+            #endif // defined (TOOLCHAIN_OS_Windows)
+            #if defined (THEKOGANS_CRYPTO_HAVE_IO_URING)
+                registered (false),
+            #endif // defined (THEKOGANS_CRYPTO_HAVE_IO_URING)
+                writeBlockSize (writeBlockSize_),
+                current (0),
+                offset (0) {
+            if (writeBlockSize == 0) {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        #if !defined (TOOLCHAIN_OS_Windows)
+            fd = open (path.c_str (), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd == -1) {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE);
+            }
+        #endif // !defined (TOOLCHAIN_OS_Windows)
+        #if defined (THEKOGANS_CRYPTO_HAVE_IO_URING)
+            if (writeBehindBlockCount > 0 && ioUring &&
+                    writeBlockSize <= MAX_IO_URING_BLOCK_SIZE && IOUring::IsSupported ()) {
+                THEKOGANS_UTIL_TRY {
+                    ring.reset (new IOUring ((unsigned)writeBehindBlockCount));
+                    blocks.resize (writeBehindBlockCount);
+                }
+                THEKOGANS_UTIL_CATCH (util::Exception) {
+                    // Fall back to synchronous writes.
+                    ring.reset ();
+                }
+            }
+        #endif // defined (THEKOGANS_CRYPTO_HAVE_IO_URING)
+            if (blocks.empty ()) {
+                blocks.resize (1);
+            }
+            for (std::size_t i = 0, count = blocks.size (); i < count; ++i) {
+            #if defined (TOOLCHAIN_OS_Windows)
+                blocks[i].data = new util::ui8[writeBlockSize];
+            #else // defined (TOOLCHAIN_OS_Windows)
+                void *data = 0;
+                if (posix_memalign (&data, BUFFER_ALIGNMENT, writeBlockSize) != 0) {
+                    FreeBlocks ();
+                    close (fd);
+                    THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                        THEKOGANS_UTIL_OS_ERROR_CODE_ENOMEM);
+                }
+                blocks[i].data = (util::ui8 *)data;
+            #endif // defined (TOOLCHAIN_OS_Windows)
+            }
+        #if defined (THEKOGANS_CRYPTO_HAVE_IO_URING)
+            if (ring.get () != 0) {
+                std::vector<struct iovec> iovecs (blocks.size ());
+                for (std::size_t i = 0, count = blocks.size (); i < count; ++i) {
+                    iovecs[i].iov_base = blocks[i].data;
+                    iovecs[i].iov_len = writeBlockSize;
+                }
+                // Registration fails if the buffers exceed RLIMIT_MEMLOCK.
+                // Unregistered writes still work (they just pin the pages
+                // on every request).
+                registered = ring->RegisterBuffers (
+                    iovecs.data (), (unsigned)iovecs.size ());
+            }
+        #endif // defined (THEKOGANS_CRYPTO_HAVE_IO_URING)
+        }
+
+        FileWriter::~FileWriter () {
+            THEKOGANS_UTIL_TRY {
+                Flush ();
+            }
+            THEKOGANS_UTIL_CATCH (util::Exception) {
+            #if defined (THEKOGANS_CRYPTO_HAVE_IO_URING)
+                // The kernel may still be reading from the blocks.
+                if (ring.get () != 0) {
+                    Drain ();
+                }
+            #endif // defined (THEKOGANS_CRYPTO_HAVE_IO_URING)
+            }
+        #if defined (THEKOGANS_CRYPTO_HAVE_IO_URING)
+            ring.reset ();
+        #endif // defined (THEKOGANS_CRYPTO_HAVE_IO_URING)
+            FreeBlocks ();
+        #if !defined (TOOLCHAIN_OS_Windows)
+            close (fd);
+        #endif // !defined (TOOLCHAIN_OS_Windows)
+        }
+
+        bool FileWriter::IsIOUring () const {
+        #if defined (THEKOGANS_CRYPTO_HAVE_IO_URING)
+            return ring.get () != 0;
+        #else // defined (THEKOGANS_CRYPTO_HAVE_IO_URING)
+            return false;
+        #endif // defined (THEKOGANS_CRYPTO_HAVE_IO_URING)
+        }
+
+        std::size_t FileWriter::Read (
+                void * /*buffer*/,
+                std::size_t /*count*/) {
+            THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+        }
+
+        std::size_t FileWriter::Write (
+                const void *buffer,
+                std::size_t count) {
+            if (buffer != 0) {
+                const util::ui8 *ptr = (const util::ui8 *)buffer;
+                for (std::size_t left = count; left > 0;) {
+                    Block &block = blocks[current];
+                    std::size_t length = std::min (left, writeBlockSize - block.length);
+                    memcpy (block.data + block.length, ptr, length);
+                    block.length += length;
+                    ptr += length;
+                    left -= length;
+                    if (block.length == writeBlockSize) {
+                        WriteBlock ();
+                    }
+                }
+                return count;
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        void FileWriter::Flush () {
+            if (blocks[current].length > 0) {
+                WriteBlock ();
+            }
+        #if defined (THEKOGANS_CRYPTO_HAVE_IO_URING)
+            if (ring.get () != 0) {
+                while (ring->GetInFlight () > 0) {
+                    CompleteBlock ();
+                }
+            }
+        #endif // defined (THEKOGANS_CRYPTO_HAVE_IO_URING)
+        }
+
+        void FileWriter::WriteBlock () {
+            Block &block = blocks[current];
+            block.offset = offset;
+            offset += block.length;
+        #if defined (THEKOGANS_CRYPTO_HAVE_IO_URING)
+            if (ring.get () != 0) {
+                block.written = 0;
+                block.busy = true;
+                if (!ring->PrepareWrite (fd, block.data, block.length, block.offset,
+                        registered ? (int)current : -1, current)) {
+                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION ("%s",
+                        "io_uring submission queue is full.");
+                }
+                ring->Submit ();
+                current = (current + 1) % blocks.size ();
+                // Blocks are written in order, so waiting for the
+                // next one to complete never waits on a later one.
+                while (blocks[current].busy) {
+                    CompleteBlock ();
+                }
+                blocks[current].length = 0;
+                return;
+            }
+        #endif // defined (THEKOGANS_CRYPTO_HAVE_IO_URING)
+            WriteAll (block.data, block.length);
+            block.length = 0;
+        }
+
+        void FileWriter::WriteAll (
+                const util::ui8 *data,
+                std::size_t length) {
+        #if defined (TOOLCHAIN_OS_Windows)
+            if (file.Write (data, length) != length) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "Unable to write " THEKOGANS_UTIL_SIZE_T_FORMAT " bytes to %s",
+                    length,
+                    path.c_str ());
+            }
+        #else // defined (TOOLCHAIN_OS_Windows)
+            while (length > 0) {
+                ssize_t result = write (fd, data, length);
+                if (result > 0) {
+                    data += result;
+                    length -= (std::size_t)result;
+                }
+                else if (result < 0 && errno != EINTR) {
+                    THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                        THEKOGANS_UTIL_OS_ERROR_CODE);
+                }
+            }
+        #endif // defined (TOOLCHAIN_OS_Windows)
+        }
+
+    #if defined (THEKOGANS_CRYPTO_HAVE_IO_URING)
+        void FileWriter::CompleteBlock () {
+            IOUring::Completion completion = ring->WaitCompletion ();
+            std::size_t index = (std::size_t)completion.userData;
+            Block &block = blocks[index];
+            if (completion.result < 0) {
+                if (completion.result != -EINTR && completion.result != -EAGAIN) {
+                    block.busy = false;
+                    THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (-completion.result);
+                }
+            }
+            else if (completion.result == 0) {
+                block.busy = false;
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "Unable to write " THEKOGANS_UTIL_SIZE_T_FORMAT " bytes to %s",
+                    block.length - block.written,
+                    path.c_str ());
+            }
+            else {
+                block.written += (std::size_t)completion.result;
+                if (block.written == block.length) {
+                    block.busy = false;
+                    return;
+                }
+            }
+            // Resume a short (or interrupted) write.
+            if (!ring->PrepareWrite (fd, block.data + block.written,
+                    block.length - block.written, block.offset + block.written,
+                    registered ? (int)index : -1, index)) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION ("%s",
+                    "io_uring submission queue is full.");
+            }
+            ring->Submit ();
+        }
+
+        void FileWriter::Drain () {
+            THEKOGANS_UTIL_TRY {
+                while (ring->GetInFlight () > 0) {
+                    ring->WaitCompletion ();
+                }
+            }
+            THEKOGANS_UTIL_CATCH (util::Exception) {
+                // Nothing more can be done. Closing the ring cancels the rest.
+            }
+        }
+    #endif // defined (THEKOGANS_CRYPTO_HAVE_IO_URING)
+
+        void FileWriter::FreeBlocks () {
+            for (std::size_t i = 0, count = blocks.size (); i < count; ++i) {
+            #if defined (TOOLCHAIN_OS_Windows)
+                delete [] blocks[i].data;
+            #else // defined (TOOLCHAIN_OS_Windows)
+                free (blocks[i].data);
+            #endif // defined (TOOLCHAIN_OS_Windows)
+                blocks[i].data = 0;
+            }
+        }
+
+    } // namespace crypto
+} // namespace thekogans
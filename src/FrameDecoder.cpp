@@ -0,0 +1,207 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <cstring>
+#include "thekogans/util/Exception.h"
+#include "thekogans/util/Buffer.h"
+#include "thekogans/crypto/CiphertextHeader.h"
+#include "thekogans/crypto/FrameDecoder.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        FrameDecoder::FrameDecoder (
+                KeyRing::SharedPtr keyRing_,
+                std::size_t maxPlaintextLength) :
+                keyRing (keyRing_),
+                maxCiphertextLength (Cipher::GetMaxBufferLength (maxPlaintextLength)),
+                readOffset (0),
+                writeOffset (0),
+                keyId (ID::Empty),
+                preAuthBudget (0),
+                preAuthBytes (0) {
+            if (keyRing.Get () == 0 || maxPlaintextLength == 0) {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        util::ui8 *FrameDecoder::GetWritePtr (std::size_t length) {
+            if (buffer.size () - writeOffset < length) {
+                // Move the partial frame to the front before growing.
+                if (readOffset > 0) {
+                    std::size_t available = GetDataAvailable ();
+                    if (available > 0) {
+                        memmove (&buffer[0], &buffer[readOffset], available);
+                    }
+                    readOffset = 0;
+                    writeOffset = available;
+                }
+                if (buffer.size () - writeOffset < length) {
+                    buffer.resize (writeOffset + length);
+                }
+            }
+            return &buffer[writeOffset];
+        }
+
+        void FrameDecoder::AdvanceWriteOffset (std::size_t length) {
+            if (length <= buffer.size () - writeOffset) {
+                writeOffset += length;
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        void FrameDecoder::Feed (
+                const void *chunk,
+                std::size_t length) {
+            if (chunk != 0 && length > 0) {
+                memcpy (GetWritePtr (length), chunk, length);
+                writeOffset += length;
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        void FrameDecoder::SetMaxPlaintextLength (
+                const ID &keyId,
+                std::size_t maxPlaintextLength) {
+            if (maxPlaintextLength > 0) {
+                std::size_t maxKeyCiphertextLength =
+                    Cipher::GetMaxBufferLength (maxPlaintextLength);
+                IDHashMap<std::size_t>::iterator it = maxKeyCiphertextLengths.find (keyId);
+                if (it != maxKeyCiphertextLengths.end ()) {
+                    it->second = maxKeyCiphertextLength;
+                }
+                else {
+                    maxKeyCiphertextLengths.insert (
+                        IDHashMap<std::size_t>::value_type (keyId, maxKeyCiphertextLength));
+                }
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        bool FrameDecoder::Next (
+                Frame &frame,
+                const void *associatedData,
+                std::size_t associatedDataLength) {
+            if (IsPreAuthBudgetExhausted ()) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "Pre-auth budget exhausted (" THEKOGANS_UTIL_UI64_FORMAT " bytes).",
+                    preAuthBudget);
+            }
+            std::size_t available = GetDataAvailable ();
+            if (available < FrameHeader::SIZE) {
+                return false;
+            }
+            util::ui8 *header = &buffer[readOffset];
+            FrameHeader frameHeader;
+            util::TenantReadBuffer headerBuffer (util::NetworkEndian, header, FrameHeader::SIZE);
+            headerBuffer >> frameHeader;
+            // Everything below is checked before waiting for (and buffering)
+            // the rest of the frame. Start with the key, so that frames for
+            // unknown keys are rejected outright.
+            if (cipher.Get () == 0 || keyId != frameHeader.keyId) {
+                cipher = keyRing->GetCipher (frameHeader.keyId);
+                if (cipher.Get () == 0) {
+                    keyId = ID::Empty;
+                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                        "Unable to get cipher for key %s",
+                        frameHeader.keyId.ToHexString ().c_str ());
+                }
+                keyId = frameHeader.keyId;
+            }
+            std::size_t maxFrameCiphertextLength = maxCiphertextLength;
+            if (!maxKeyCiphertextLengths.empty ()) {
+                IDHashMap<std::size_t>::const_iterator it =
+                    maxKeyCiphertextLengths.find (frameHeader.keyId);
+                if (it != maxKeyCiphertextLengths.end ()) {
+                    maxFrameCiphertextLength = it->second;
+                }
+            }
+            if (frameHeader.ciphertextLength <= CiphertextHeader::SIZE ||
+                    frameHeader.ciphertextLength > maxFrameCiphertextLength) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "Invalid frame length (%u), max: " THEKOGANS_UTIL_SIZE_T_FORMAT,
+                    frameHeader.ciphertextLength,
+                    maxFrameCiphertextLength);
+            }
+            if (available < FrameHeader::SIZE + CiphertextHeader::SIZE) {
+                return false;
+            }
+            CiphertextHeader ciphertextHeader;
+            {
+                util::TenantReadBuffer ciphertextHeaderBuffer (
+                    util::NetworkEndian,
+                    header + FrameHeader::SIZE,
+                    CiphertextHeader::SIZE);
+                ciphertextHeaderBuffer >> ciphertextHeader;
+            }
+            std::size_t payloadLength = frameHeader.ciphertextLength - CiphertextHeader::SIZE;
+            if (!cipher->IsValidCiphertextHeader (ciphertextHeader, payloadLength) ||
+                    ciphertextHeader.GetTotalLength () != payloadLength) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "Invalid ciphertext header for frame length (%u)",
+                    frameHeader.ciphertextLength);
+            }
+            if (available < FrameHeader::SIZE + frameHeader.ciphertextLength) {
+                return false;
+            }
+            // Consume the frame before decrypting it so that a frame
+            // that fails authentication does not wedge the stream.
+            readOffset += FrameHeader::SIZE + frameHeader.ciphertextLength;
+            if (readOffset == writeOffset) {
+                // Drained. The next write can start at the front.
+                readOffset = writeOffset = 0;
+            }
+            util::ui8 *plaintext = 0;
+            std::size_t plaintextLength = 0;
+            THEKOGANS_UTIL_TRY {
+                plaintextLength = cipher->DecryptInPlace (
+                    header + FrameHeader::SIZE,
+                    frameHeader.ciphertextLength,
+                    associatedData,
+                    associatedDataLength,
+                    plaintext);
+            }
+            THEKOGANS_UTIL_CATCH (util::Exception) {
+                preAuthBytes += FrameHeader::SIZE + frameHeader.ciphertextLength;
+                THEKOGANS_UTIL_RETHROW_EXCEPTION (exception);
+            }
+            frame.keyId = keyId;
+            frame.plaintext = plaintext;
+            frame.plaintextLength = plaintextLength;
+            return true;
+        }
+
+        void FrameDecoder::Reset () {
+            readOffset = writeOffset = 0;
+            keyId = ID::Empty;
+            cipher = Cipher::SharedPtr ();
+            preAuthBytes = 0;
+        }
+
+    } // namespace crypto
+} // namespace thekogans
@@ -15,9 +15,61 @@
 // You should have received a copy of the GNU General Public License
 // along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
 
+#include "thekogans/util/Exception.h"
 #include "thekogans/crypto/FrameHeader.h"
 
 namespace thekogans {
+    namespace crypto {
+
+        namespace {
+            void WriteVarInt (
+                    util::Serializer &serializer,
+                    util::ui32 value) {
+                for (; value >= 0x80; value >>= 7) {
+                    serializer << (util::ui8)((value & 0x7f) | 0x80);
+                }
+                serializer << (util::ui8)value;
+            }
+
+            util::ui32 ReadVarInt (util::Serializer &serializer) {
+                util::ui32 value = 0;
+                for (std::size_t i = 0; i < CompactFrameHeader::MAX_VARINT_SIZE; ++i) {
+                    util::ui8 byte;
+                    serializer >> byte;
+                    // The fifth byte only has room for the top 4 bits.
+                    if (i == CompactFrameHeader::MAX_VARINT_SIZE - 1 && byte > 0x0f) {
+                        break;
+                    }
+                    value |= (util::ui32)(byte & 0x7f) << (7 * i);
+                    if ((byte & 0x80) == 0) {
+                        return value;
+                    }
+                }
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "%s", "Invalid compact frame header varint.");
+            }
+        }
+
+        _LIB_THEKOGANS_CRYPTO_DECL util::Serializer & _LIB_THEKOGANS_CRYPTO_API
+        operator << (
+                util::Serializer &serializer,
+                const CompactFrameHeader &frameHeader) {
+            WriteVarInt (serializer, frameHeader.keyHandle);
+            WriteVarInt (serializer, frameHeader.ciphertextLength);
+            return serializer;
+        }
+
+        _LIB_THEKOGANS_CRYPTO_DECL util::Serializer & _LIB_THEKOGANS_CRYPTO_API
+        operator >> (
+                util::Serializer &serializer,
+                CompactFrameHeader &frameHeader) {
+            frameHeader.keyHandle = ReadVarInt (serializer);
+            frameHeader.ciphertextLength = ReadVarInt (serializer);
+            return serializer;
+        }
+
+    } // namespace crypto
+
     namespace util {
 
         void ValueParser<crypto::FrameHeader>::Reset () {
@@ -41,5 +93,46 @@ namespace thekogans {
             return false;
         }
 
+        void ValueParser<crypto::CompactFrameHeader>::Reset () {
+            byteParser.Reset ();
+            byteCount = 0;
+            varInt = 0;
+            state = STATE_KEY_HANDLE;
+        }
+
+        bool ValueParser<crypto::CompactFrameHeader>::ParseValue (Serializer &serializer) {
+            if (state == STATE_KEY_HANDLE) {
+                if (ParseVarInt (serializer)) {
+                    value.keyHandle = varInt;
+                    byteCount = 0;
+                    varInt = 0;
+                    state = STATE_CIPHERTEXT_LENGTH;
+                }
+            }
+            if (state == STATE_CIPHERTEXT_LENGTH) {
+                if (ParseVarInt (serializer)) {
+                    value.ciphertextLength = varInt;
+                    Reset ();
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        bool ValueParser<crypto::CompactFrameHeader>::ParseVarInt (Serializer &serializer) {
+            while (byteParser.ParseValue (serializer)) {
+                if (byteCount == crypto::CompactFrameHeader::MAX_VARINT_SIZE - 1 && byte > 0x0f) {
+                    Reset ();
+                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                        "%s", "Invalid compact frame header varint.");
+                }
+                varInt |= (ui32)(byte & 0x7f) << (7 * byteCount++);
+                if ((byte & 0x80) == 0) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
     } // namespace util
 } // namespace thekogans
@@ -0,0 +1,134 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#include <cstring>
+#include <openssl/evp.h>
+#include "thekogans/util/Exception.h"
+#include "thekogans/crypto/SymmetricKey.h"
+#include "thekogans/crypto/OpenSSLInit.h"
+#include "thekogans/crypto/OpenSSLException.h"
+#include "thekogans/crypto/OpenSSLUtils.h"
+#include "thekogans/crypto/BufferedRandomSource.h"
+#include "thekogans/crypto/GMAC.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        GMAC::GMAC (
+                SymmetricKey::SharedPtr key_,
+                const EVP_CIPHER *cipher_) :
+                key (key_),
+                cipher (cipher_) {
+            if (key.Get () != 0 && cipher != 0 &&
+                    GetCipherMode (cipher) == EVP_CIPH_GCM_MODE &&
+                    key->GetKeyLength () == GetCipherKeyLength (cipher)) {
+                metrics.Reset (key->GetId ());
+                // NOTE: The AES key schedule and the GHASH key (H) are
+                // computed once here. Every MAC operation only sets the nonce.
+                if (EVP_EncryptInit_ex (
+                            &ctx,
+                            OpenSSLInit::FetchCipher (cipher),
+                            OpenSSLInit::GetEngine (EVP_CIPHER_nid (cipher)),
+                            key->Get ().GetReadPtr (),
+                            0) != 1 ||
+                        EVP_CIPHER_CTX_ctrl (&ctx, EVP_CTRL_GCM_SET_IVLEN, NONCE_LENGTH, 0) != 1) {
+                    THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
+                }
+                memset (nonce, 0, NONCE_LENGTH);
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        const EVP_CIPHER *GMAC::GetCipherFromKeyLength (std::size_t keyLength) {
+            return
+                keyLength == 16 ? EVP_aes_128_gcm () :
+                keyLength == 24 ? EVP_aes_192_gcm () :
+                keyLength == 32 ? EVP_aes_256_gcm () : 0;
+        }
+
+        void GMAC::Init () {
+            if (BufferedRandomSource::GetThreadInstance ().GetBytes (
+                    nonce, NONCE_LENGTH) == NONCE_LENGTH) {
+                SetNonce ();
+            }
+            else {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "Unable to get %u random bytes for nonce.", NONCE_LENGTH);
+            }
+        }
+
+        void GMAC::InitVerify (
+                const void *signature,
+                std::size_t signatureLength) {
+            if (signature != 0 && signatureLength == SIGNATURE_LENGTH) {
+                memcpy (nonce, signature, NONCE_LENGTH);
+                SetNonce ();
+            }
+            else {
+                // The length mismatch will fail the verification.
+                Init ();
+            }
+        }
+
+        void GMAC::Update (
+                const void *buffer,
+                std::size_t bufferLength) {
+            if (buffer != 0 && bufferLength > 0) {
+                // A null output turns the buffer in to associated data.
+                int updateLength = 0;
+                if (EVP_EncryptUpdate (&ctx, 0, &updateLength,
+                        (const util::ui8 *)buffer, (int)bufferLength) != 1) {
+                    THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
+                }
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        std::size_t GMAC::Final (util::ui8 *signature) {
+            if (signature != 0) {
+                util::ui8 ciphertext[EVP_MAX_BLOCK_LENGTH];
+                int finalLength = 0;
+                if (EVP_EncryptFinal_ex (&ctx, ciphertext, &finalLength) == 1 &&
+                        EVP_CIPHER_CTX_ctrl (&ctx, EVP_CTRL_GCM_GET_TAG,
+                            TAG_LENGTH, signature + NONCE_LENGTH) == 1) {
+                    memcpy (signature, nonce, NONCE_LENGTH);
+                    return SIGNATURE_LENGTH;
+                }
+                else {
+                    THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
+                }
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        void GMAC::SetNonce () {
+            if (EVP_EncryptInit_ex (&ctx, 0, 0, 0, nonce) != 1) {
+                THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
+            }
+        }
+
+    } // namespace crypto
+} // namespace thekogans
@@ -0,0 +1,135 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#include <cstring>
+#include <algorithm>
+#include <openssl/hmac.h>
+#include "thekogans/util/SecureAllocator.h"
+#include "thekogans/crypto/OpenSSLInit.h"
+#include "thekogans/crypto/OpenSSLException.h"
+#include "thekogans/crypto/ConstantTime.h"
+#include "thekogans/crypto/HKDF.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        HKDF::HKDF (
+                const void *ikm,
+                std::size_t ikmLength,
+                const void *salt,
+                std::size_t saltLength,
+                const EVP_MD *md_) :
+                md (md_) {
+            if (ikm != 0 && ikmLength > 0 && md != 0) {
+                // RFC 5869: If not provided, salt is set to a string of HashLen zeros.
+                util::SecureVector<util::ui8> zeros;
+                if (salt == 0 || saltLength == 0) {
+                    zeros.resize (GetMDLength (md), 0);
+                    salt = zeros.data ();
+                    saltLength = zeros.size ();
+                }
+                util::SecureVector<util::ui8> prk (EVP_MAX_MD_SIZE);
+                util::ui32 prkLength = 0;
+                const EVP_MD *fetchedMD = OpenSSLInit::FetchMessageDigest (md);
+                if (::HMAC (fetchedMD,
+                        salt,
+                        (int)saltLength,
+                        (const util::ui8 *)ikm,
+                        ikmLength,
+                        prk.data (),
+                        &prkLength) == 0 ||
+                        HMAC_Init_ex (
+                            &prkContext,
+                            prk.data (),
+                            (int)prkLength,
+                            fetchedMD,
+                            OpenSSLInit::GetEngine (EVP_MD_type (md))) != 1) {
+                    THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
+                }
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        void HKDF::Expand (
+                const void *info,
+                std::size_t infoLength,
+                util::ui8 *key,
+                std::size_t keyLength) const {
+            std::size_t digestLength = GetMDLength (md);
+            if ((info != 0 || infoLength == 0) &&
+                    key != 0 && keyLength > 0 && keyLength <= 255 * digestLength) {
+                util::ui8 digest[EVP_MAX_MD_SIZE];
+                // Reuse the per thread context (allocation) across calls.
+                static thread_local HMACContext ctx;
+                HMACContextReset reset (ctx);
+                // T(i) = HMAC (PRK, T(i - 1) | info | i)
+                for (std::size_t i = 1, offset = 0; offset < keyLength; ++i) {
+                    const util::ui8 counter = (util::ui8)i;
+                    if (HMAC_CTX_copy (&ctx, &prkContext) != 1 ||
+                            (i > 1 && HMAC_Update (&ctx, digest, digestLength) != 1) ||
+                            HMAC_Update (&ctx, (const util::ui8 *)info, infoLength) != 1 ||
+                            HMAC_Update (&ctx, &counter, 1) != 1 ||
+                            HMAC_Final (&ctx, digest, 0) != 1) {
+                        THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
+                    }
+                    std::size_t length = std::min (digestLength, keyLength - offset);
+                    memcpy (key + offset, digest, length);
+                    offset += length;
+                }
+                SecureZero (digest, sizeof (digest));
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        SymmetricKey::SharedPtr HKDF::ExpandKey (
+                const void *info,
+                std::size_t infoLength,
+                std::size_t keyLength,
+                const ID &id,
+                const std::string &name,
+                const std::string &description) const {
+            util::SecureVector<util::ui8> key (keyLength);
+            Expand (info, infoLength, key.data (), key.size ());
+            return SymmetricKey::SharedPtr (
+                new SymmetricKey (key.data (), key.size (), id, name, description));
+        }
+
+        std::vector<SymmetricKey::SharedPtr> HKDF::ExpandKeys (
+                const std::vector<Output> &outputs) const {
+            std::vector<SymmetricKey::SharedPtr> keys;
+            keys.reserve (outputs.size ());
+            for (std::size_t i = 0, count = outputs.size (); i < count; ++i) {
+                keys.push_back (
+                    ExpandKey (
+                        outputs[i].info.data (),
+                        outputs[i].info.size (),
+                        outputs[i].keyLength,
+                        outputs[i].id,
+                        outputs[i].name,
+                        outputs[i].description));
+            }
+            return keys;
+        }
+
+    } // namespace crypto
+} // namespace thekogans
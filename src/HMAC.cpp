@@ -15,11 +15,15 @@
 // You should have received a copy of the GNU General Public License
 // along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
 
+#include <cstring>
 #include <openssl/evp.h>
+#include <openssl/hmac.h>
 #include "thekogans/crypto/SymmetricKey.h"
 #include "thekogans/crypto/OpenSSLInit.h"
 #include "thekogans/crypto/OpenSSLException.h"
+#include "thekogans/crypto/ConstantTime.h"
 #include "thekogans/crypto/OpenSSLAsymmetricKey.h"
+#include "thekogans/crypto/Blake3.h"
 #include "thekogans/crypto/HMAC.h"
 
 namespace thekogans {
@@ -29,14 +33,84 @@ namespace thekogans {
                 SymmetricKey::SharedPtr key_,
                 const EVP_MD *md_) :
                 key (key_),
-                md (md_) {
-            if (key.Get () != 0 && md != 0) {
-                if (HMAC_Init_ex (
-                        &ctx,
+                md (md_),
+                keyed (md == EVP_blake3_256 ()) {
+            if (key.Get () != 0) {
+                metrics.Reset (key->GetId ());
+            }
+            if (key.Get () != 0 && md != 0 && keyed) {
+                util::ui8 keyBlock[Blake3::KEY_LENGTH];
+                std::size_t keyLength = key->Get ().GetDataAvailableForReading ();
+                if (keyLength == Blake3::KEY_LENGTH) {
+                    memcpy (keyBlock, key->Get ().GetReadPtr (), keyLength);
+                }
+                else {
+                    static const char * const CONTEXT = "thekogans crypto 2026-10-14 HMAC BLAKE3 key";
+                    Blake3::DeriveKey (
+                        CONTEXT,
+                        strlen (CONTEXT),
                         key->Get ().GetReadPtr (),
-                        (int)key->Get ().GetDataAvailableForReading (),
-                        md,
-                        OpenSSLInit::engine) != 1) {
+                        keyLength,
+                        keyBlock,
+                        Blake3::KEY_LENGTH);
+                }
+                bool success = EVP_DigestInit_ex (&innerContext, md, OpenSSLInit::GetEngine (EVP_MD_type (md))) == 1;
+                if (success) {
+                    Blake3::FromEVP_MD_CTX (&innerContext).InitKeyed (keyBlock, Blake3::KEY_LENGTH);
+                    success = EVP_MD_CTX_copy_ex (&context, &innerContext) == 1;
+                }
+                SecureZero (keyBlock, Blake3::KEY_LENGTH);
+                if (!success) {
+                    THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
+                }
+            }
+            else if (key.Get () != 0 && md != 0) {
+                std::size_t blockSize = EVP_MD_block_size (md);
+                if (blockSize == 0 || blockSize > HMAC_MAX_MD_CBLOCK) {
+                    THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                        THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+                }
+                // RFC 2104: keys longer than the block size are hashed first,
+                // shorter ones are padded with zeros.
+                util::ui8 keyBlock[HMAC_MAX_MD_CBLOCK];
+                memset (keyBlock, 0, HMAC_MAX_MD_CBLOCK);
+                std::size_t keyLength = key->Get ().GetDataAvailableForReading ();
+                const EVP_MD *fetchedMD = OpenSSLInit::FetchMessageDigest (md);
+                ENGINE *engine = OpenSSLInit::GetEngine (EVP_MD_type (md));
+                if (keyLength > blockSize) {
+                    util::ui32 digestLength = 0;
+                    if (EVP_Digest (
+                            key->Get ().GetReadPtr (),
+                            keyLength,
+                            keyBlock,
+                            &digestLength,
+                            fetchedMD,
+                            engine) != 1) {
+                        THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
+                    }
+                }
+                else if (keyLength > 0) {
+                    memcpy (keyBlock, key->Get ().GetReadPtr (), keyLength);
+                }
+                util::ui8 pad[HMAC_MAX_MD_CBLOCK];
+                for (std::size_t i = 0; i < blockSize; ++i) {
+                    pad[i] = keyBlock[i] ^ 0x36;
+                }
+                bool success =
+                    EVP_DigestInit_ex (&innerContext, fetchedMD, engine) == 1 &&
+                    EVP_DigestUpdate (&innerContext, pad, blockSize) == 1;
+                if (success) {
+                    for (std::size_t i = 0; i < blockSize; ++i) {
+                        pad[i] = keyBlock[i] ^ 0x5c;
+                    }
+                    success =
+                        EVP_DigestInit_ex (&outerContext, fetchedMD, engine) == 1 &&
+                        EVP_DigestUpdate (&outerContext, pad, blockSize) == 1 &&
+                        EVP_MD_CTX_copy_ex (&context, &innerContext) == 1;
+                }
+                SecureZero (keyBlock, HMAC_MAX_MD_CBLOCK);
+                SecureZero (pad, HMAC_MAX_MD_CBLOCK);
+                if (!success) {
                     THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
                 }
             }
@@ -46,8 +120,31 @@ namespace thekogans {
             }
         }
 
+        MAC::SharedPtr HMAC::Clone () const {
+            HMAC *hmac = new HMAC (key, md, keyed);
+            MAC::SharedPtr mac (hmac);
+            if (EVP_MD_CTX_copy_ex (&hmac->innerContext, &innerContext) != 1 ||
+                    (!keyed && EVP_MD_CTX_copy_ex (&hmac->outerContext, &outerContext) != 1) ||
+                    EVP_MD_CTX_copy_ex (&hmac->context, &innerContext) != 1) {
+                THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
+            }
+            return mac;
+        }
+
+        HMAC::HMAC (
+                SymmetricKey::SharedPtr key_,
+                const EVP_MD *md_,
+                bool keyed_) :
+                key (key_),
+                md (md_),
+                keyed (keyed_) {
+            if (key.Get () != 0) {
+                metrics.Reset (key->GetId ());
+            }
+        }
+
         void HMAC::Init () {
-            if (HMAC_Init_ex (&ctx, 0, 0, 0, 0) != 1) {
+            if (EVP_MD_CTX_copy_ex (&context, &innerContext) != 1) {
                 THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
             }
         }
@@ -56,7 +153,7 @@ namespace thekogans {
                 const void *buffer,
                 std::size_t bufferLength) {
             if (buffer != 0 && bufferLength > 0) {
-                if (HMAC_Update (&ctx, (const util::ui8 *)buffer, bufferLength) != 1) {
+                if (EVP_DigestUpdate (&context, buffer, bufferLength) != 1) {
                     THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
                 }
             }
@@ -67,9 +164,28 @@ namespace thekogans {
         }
 
         std::size_t HMAC::Final (util::ui8 *signature) {
-            if (signature != 0) {
+            if (signature != 0 && keyed) {
+                util::ui32 signatureLength = 0;
+                if (EVP_DigestFinal_ex (&context, signature, &signatureLength) == 1) {
+                    return signatureLength;
+                }
+                else {
+                    THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
+                }
+            }
+            else if (signature != 0) {
+                util::ui8 innerDigest[EVP_MAX_MD_SIZE];
+                util::ui32 innerDigestLength = 0;
                 util::ui32 signatureLength = 0;
-                if (HMAC_Final (&ctx, signature, &signatureLength) == 1) {
+                bool success =
+                    EVP_DigestFinal_ex (&context, innerDigest, &innerDigestLength) == 1 &&
+                    EVP_MD_CTX_copy_ex (&context, &outerContext) == 1 &&
+                    EVP_DigestUpdate (&context, innerDigest, innerDigestLength) == 1 &&
+                    EVP_DigestFinal_ex (&context, signature, &signatureLength) == 1;
+                // The inner digest is derived from the key, don't
+                // leave it on the stack.
+                SecureZero (innerDigest, sizeof (innerDigest));
+                if (success) {
                     return signatureLength;
                 }
                 else {
@@ -15,8 +15,14 @@
 // You should have received a copy of the GNU General Public License
 // along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
 
-#include "thekogans/util/RandomSource.h"
+#include "thekogans/crypto/BufferedRandomSource.h"
+#include "thekogans/crypto/OpenSSLInit.h"
+#include "thekogans/crypto/OpenSSLException.h"
 #include "thekogans/crypto/MessageDigest.h"
+#if defined (THEKOGANS_CRYPTO_HAVE_BLAKE2)
+    #include "thekogans/crypto/Blake2s.h"
+#endif // defined (THEKOGANS_CRYPTO_HAVE_BLAKE2)
+#include "thekogans/crypto/TextEncoding.h"
 #include "thekogans/crypto/ID.h"
 
 namespace thekogans {
@@ -34,24 +40,34 @@ namespace thekogans {
         const ID ID::Empty (emptyIdData);
 
         ID::ID () {
-            if (util::GlobalRandomSource::Instance ().GetBytes (data, SIZE) != SIZE) {
+            if (BufferedRandomSource::GetThreadInstance ().GetBytes (data, SIZE) != SIZE) {
                 THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
                     "Unable to get " THEKOGANS_UTIL_SIZE_T_FORMAT " random bytes for ID.", SIZE);
             }
         }
 
         ID::ID (const void *buffer,
-                std::size_t length) {
+                std::size_t length,
+                util::ui8 scheme) {
             if (buffer != 0 && length > 0) {
-                MessageDigest messageDigest (EVP_sha256 ());
-                messageDigest.Init ();
-                messageDigest.Update (buffer, length);
-                length = messageDigest.Final (data);
-                if (length != ID::SIZE) {
+                const EVP_MD *md = GetSchemeMessageDigest (scheme);
+                // Ids are derived for every key, params and piece of key
+                // material in bulk operations. Reuse the per thread
+                // context (allocation) instead of creating a MessageDigest.
+                static thread_local MDContext ctx;
+                util::ui32 digestLength = 0;
+                if (EVP_DigestInit_ex (
+                        &ctx,
+                        OpenSSLInit::FetchMessageDigest (md),
+                        OpenSSLInit::GetEngine (EVP_MD_type (md))) != 1 ||
+                        EVP_DigestUpdate (&ctx, buffer, length) != 1 ||
+                        EVP_DigestFinal_ex (&ctx, data, &digestLength) != 1) {
+                    THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
+                }
+                if (digestLength != ID::SIZE) {
                     THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
-                        "Incorrect ID length (" THEKOGANS_UTIL_SIZE_T_FORMAT ", "
-                        THEKOGANS_UTIL_SIZE_T_FORMAT ").",
-                        length, ID::SIZE);
+                        "Incorrect ID length (%u, %u).",
+                        digestLength, ID::SIZE);
                 }
             }
             else {
@@ -77,7 +93,7 @@ namespace thekogans {
         ID ID::FromHexString (const std::string &hexString) {
             if (hexString.size () == SIZE * 2) {
                 util::ui8 data[SIZE];
-                if (util::HexDecodestring (hexString, data) == SIZE) {
+                if (HexDecode (hexString.data (), hexString.size (), data) == SIZE) {
                     return ID (data);
                 }
                 else {
@@ -91,5 +107,38 @@ namespace thekogans {
             }
         }
 
+        std::vector<ID> ID::FromBuffers (
+                const void * const *buffers,
+                const std::size_t *lengths,
+                std::size_t count,
+                util::ui8 scheme) {
+            std::vector<util::ui8> digests (count * SIZE);
+            MessageDigest messageDigest (GetSchemeMessageDigest (scheme));
+            messageDigest.HashBatch (buffers, lengths, count, digests.data ());
+            std::vector<ID> ids;
+            ids.reserve (count);
+            for (std::size_t i = 0; i < count; ++i) {
+                ids.push_back (ID (digests.data () + i * SIZE));
+            }
+            return ids;
+        }
+
+        const EVP_MD *ID::GetSchemeMessageDigest (util::ui8 scheme) {
+            switch (scheme) {
+                case SCHEME_SHA256:
+                    return EVP_sha256 ();
+                case SCHEME_BLAKE2S256:
+                #if defined (THEKOGANS_CRYPTO_HAVE_BLAKE2)
+                    return EVP_blake2s256 ();
+                #elif OPENSSL_VERSION_NUMBER >= 0x10100000L && !defined (OPENSSL_NO_BLAKE2)
+                    return ::EVP_blake2s256 ();
+                #else // OPENSSL_VERSION_NUMBER >= 0x10100000L && !defined (OPENSSL_NO_BLAKE2)
+                    break;
+                #endif // defined (THEKOGANS_CRYPTO_HAVE_BLAKE2)
+            }
+            THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                "Unsupported ID scheme: %u.", (unsigned int)scheme);
+        }
+
     } // namespace crypto
 } // namespace thekogans
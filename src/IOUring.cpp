@@ -0,0 +1,293 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#include "thekogans/crypto/IOUring.h"
+
+#if defined (THEKOGANS_CRYPTO_HAVE_IO_URING)
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <linux/io_uring.h>
+#include "thekogans/util/Exception.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        namespace {
+            // Raw syscalls (liburing is not a dependency).
+            inline int io_uring_setup (
+                    unsigned entries,
+                    io_uring_params *params) {
+                return (int)syscall (__NR_io_uring_setup, entries, params);
+            }
+
+            inline int io_uring_enter (
+                    int fd,
+                    unsigned toSubmit,
+                    unsigned minComplete,
+                    unsigned flags) {
+                return (int)syscall (__NR_io_uring_enter,
+                    fd, toSubmit, minComplete, flags, 0, 0);
+            }
+
+            inline int io_uring_register (
+                    int fd,
+                    unsigned opcode,
+                    const void *arg,
+                    unsigned count) {
+                return (int)syscall (__NR_io_uring_register, fd, opcode, arg, count);
+            }
+
+            bool ProbeIOUring () {
+                io_uring_params params;
+                memset (&params, 0, sizeof (params));
+                int fd = io_uring_setup (1, &params);
+                if (fd >= 0) {
+                    close (fd);
+                    return true;
+                }
+                return false;
+            }
+
+            // The kernel updates the ring heads and tails concurrently.
+            inline unsigned LoadAcquire (const unsigned *value) {
+                return __atomic_load_n (value, __ATOMIC_ACQUIRE);
+            }
+
+            inline void StoreRelease (
+                    unsigned *value,
+                    unsigned newValue) {
+                __atomic_store_n (value, newValue, __ATOMIC_RELEASE);
+            }
+        }
+
+        IOUring::IOUring (unsigned entries) :
+                fd (-1),
+                sqRing (MAP_FAILED),
+                sqRingSize (0),
+                cqRing (MAP_FAILED),
+                cqRingSize (0),
+                sqes ((io_uring_sqe *)MAP_FAILED),
+                sqesSize (0),
+                sqHead (0),
+                sqTail (0),
+                sqMask (0),
+                sqArray (0),
+                cqHead (0),
+                cqTail (0),
+                cqMask (0),
+                cqes (0),
+                pending (0),
+                inFlight (0) {
+            if (entries == 0) {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+            io_uring_params params;
+            memset (&params, 0, sizeof (params));
+            fd = io_uring_setup (entries, &params);
+            if (fd < 0) {
+                fd = -1;
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE);
+            }
+            sqRingSize = params.sq_off.array + params.sq_entries * sizeof (unsigned);
+            cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof (io_uring_cqe);
+            bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+            if (singleMap && cqRingSize > sqRingSize) {
+                sqRingSize = cqRingSize;
+            }
+            sqRing = mmap (0, sqRingSize, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+            if (sqRing == MAP_FAILED) {
+                THEKOGANS_UTIL_ERROR_CODE errorCode = THEKOGANS_UTIL_OS_ERROR_CODE;
+                Close ();
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (errorCode);
+            }
+            if (singleMap) {
+                cqRing = sqRing;
+            }
+            else {
+                cqRing = mmap (0, cqRingSize, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+                if (cqRing == MAP_FAILED) {
+                    THEKOGANS_UTIL_ERROR_CODE errorCode = THEKOGANS_UTIL_OS_ERROR_CODE;
+                    Close ();
+                    THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (errorCode);
+                }
+            }
+            sqesSize = params.sq_entries * sizeof (io_uring_sqe);
+            sqes = (io_uring_sqe *)mmap (0, sqesSize, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+            if (sqes == MAP_FAILED) {
+                THEKOGANS_UTIL_ERROR_CODE errorCode = THEKOGANS_UTIL_OS_ERROR_CODE;
+                Close ();
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (errorCode);
+            }
+            util::ui8 *sq = (util::ui8 *)sqRing;
+            sqHead = (unsigned *)(sq + params.sq_off.head);
+            sqTail = (unsigned *)(sq + params.sq_off.tail);
+            sqMask = *(unsigned *)(sq + params.sq_off.ring_mask);
+            sqArray = (unsigned *)(sq + params.sq_off.array);
+            util::ui8 *cq = (util::ui8 *)cqRing;
+            cqHead = (unsigned *)(cq + params.cq_off.head);
+            cqTail = (unsigned *)(cq + params.cq_off.tail);
+            cqMask = *(unsigned *)(cq + params.cq_off.ring_mask);
+            cqes = (io_uring_cqe *)(cq + params.cq_off.cqes);
+        }
+
+        IOUring::~IOUring () {
+            Close ();
+        }
+
+        bool IOUring::IsSupported () {
+            // Creating a ring is the only reliable test (seccomp
+            // filters and kernel.io_uring_disabled return EPERM/ENOSYS).
+            static const bool supported = ProbeIOUring ();
+            return supported;
+        }
+
+        bool IOUring::RegisterBuffers (
+                const struct iovec *iovecs,
+                unsigned count) {
+            if (iovecs != 0 && count > 0) {
+                return io_uring_register (fd, IORING_REGISTER_BUFFERS, iovecs, count) == 0;
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        bool IOUring::PrepareRead (
+                int file,
+                void *buffer,
+                std::size_t length,
+                util::ui64 offset,
+                int bufferIndex,
+                util::ui64 userData) {
+            return Prepare (IORING_OP_READ, IORING_OP_READ_FIXED,
+                file, buffer, length, offset, bufferIndex, userData);
+        }
+
+        bool IOUring::PrepareWrite (
+                int file,
+                const void *buffer,
+                std::size_t length,
+                util::ui64 offset,
+                int bufferIndex,
+                util::ui64 userData) {
+            return Prepare (IORING_OP_WRITE, IORING_OP_WRITE_FIXED,
+                file, buffer, length, offset, bufferIndex, userData);
+        }
+
+        void IOUring::Submit () {
+            while (pending > 0) {
+                int result = io_uring_enter (fd, pending, 0, 0);
+                if (result >= 0) {
+                    pending -= (unsigned)result;
+                    inFlight += (std::size_t)result;
+                }
+                else if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+                    THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                        THEKOGANS_UTIL_OS_ERROR_CODE);
+                }
+            }
+        }
+
+        IOUring::Completion IOUring::WaitCompletion () {
+            Submit ();
+            if (inFlight == 0) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION ("%s",
+                    "No requests in flight.");
+            }
+            while (1) {
+                unsigned head = *cqHead;
+                if (head != LoadAcquire (cqTail)) {
+                    const io_uring_cqe &cqe = cqes[head & cqMask];
+                    Completion completion;
+                    completion.userData = cqe.user_data;
+                    completion.result = cqe.res;
+                    StoreRelease (cqHead, head + 1);
+                    --inFlight;
+                    return completion;
+                }
+                if (io_uring_enter (fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 &&
+                        errno != EINTR) {
+                    THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                        THEKOGANS_UTIL_OS_ERROR_CODE);
+                }
+            }
+        }
+
+        bool IOUring::Prepare (
+                util::ui8 opcode,
+                util::ui8 fixedOpcode,
+                int file,
+                const void *buffer,
+                std::size_t length,
+                util::ui64 offset,
+                int bufferIndex,
+                util::ui64 userData) {
+            unsigned tail = *sqTail;
+            if (tail - LoadAcquire (sqHead) > sqMask) {
+                return false;
+            }
+            unsigned index = tail & sqMask;
+            io_uring_sqe &sqe = sqes[index];
+            memset (&sqe, 0, sizeof (sqe));
+            sqe.opcode = bufferIndex >= 0 ? fixedOpcode : opcode;
+            sqe.fd = file;
+            sqe.off = offset;
+            sqe.addr = (util::ui64)(std::size_t)buffer;
+            sqe.len = (util::ui32)length;
+            if (bufferIndex >= 0) {
+                sqe.buf_index = (util::ui16)bufferIndex;
+            }
+            sqe.user_data = userData;
+            sqArray[index] = index;
+            StoreRelease (sqTail, tail + 1);
+            ++pending;
+            return true;
+        }
+
+        void IOUring::Close () {
+            if (sqes != MAP_FAILED) {
+                munmap (sqes, sqesSize);
+                sqes = (io_uring_sqe *)MAP_FAILED;
+            }
+            if (cqRing != MAP_FAILED && cqRing != sqRing) {
+                munmap (cqRing, cqRingSize);
+            }
+            cqRing = MAP_FAILED;
+            if (sqRing != MAP_FAILED) {
+                munmap (sqRing, sqRingSize);
+                sqRing = MAP_FAILED;
+            }
+            if (fd != -1) {
+                close (fd);
+                fd = -1;
+            }
+        }
+
+    } // namespace crypto
+} // namespace thekogans
+
+#endif // defined (THEKOGANS_CRYPTO_HAVE_IO_URING)
@@ -0,0 +1,543 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#include <cstdio>
+#include "thekogans/util/Path.h"
+#include "thekogans/util/Thread.h"
+#include "thekogans/util/LockGuard.h"
+#include "thekogans/util/Exception.h"
+#include "thekogans/crypto/LazyKeyRing.h"
+#include "thekogans/crypto/JournaledKeyRing.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        namespace {
+            inline std::string GetJournalPath (const std::string &path) {
+                return path + ".journal";
+            }
+
+            inline std::string GetCompactingJournalPath (const std::string &path) {
+                return path + ".journal.compacting";
+            }
+
+            // Records are bound to their position in the journal.
+            struct SequenceAssociatedData {
+                util::ui8 data[util::UI64_SIZE];
+
+                explicit SequenceAssociatedData (util::ui64 sequence) {
+                    for (std::size_t i = util::UI64_SIZE; i-- > 0;) {
+                        data[i] = (util::ui8)sequence;
+                        sequence >>= 8;
+                    }
+                }
+            };
+
+            // Return the root ring entry with the given type and id.
+            Serializable::SharedPtr Find (
+                    const KeyRing &keyRing,
+                    util::ui8 type,
+                    const ID &id) {
+                switch (type) {
+                    case LazyKeyRingEntryInfo::KEY_EXCHANGE_PARAMS:
+                        return keyRing.GetKeyExchangeParams (id, false);
+                    case LazyKeyRingEntryInfo::KEY_EXCHANGE_KEY:
+                        return keyRing.GetKeyExchangeKey (id, false);
+                    case LazyKeyRingEntryInfo::AUTHENTICATOR_PARAMS:
+                        return keyRing.GetAuthenticatorParams (id, false);
+                    case LazyKeyRingEntryInfo::AUTHENTICATOR_KEY:
+                        return keyRing.GetAuthenticatorKey (id, false);
+                    case LazyKeyRingEntryInfo::CIPHER_KEY:
+                        return keyRing.GetCipherKey (id, false);
+                    case LazyKeyRingEntryInfo::MAC_KEY:
+                        return keyRing.GetMACKey (id, false);
+                    case LazyKeyRingEntryInfo::USER_DATA:
+                        return keyRing.GetUserData (id, false);
+                }
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "Invalid entry type (%u)",
+                    type);
+            }
+        }
+
+        struct JournaledKeyRing::Compactor : public util::Thread {
+        private:
+            JournaledKeyRing &keyRing;
+
+        public:
+            explicit Compactor (JournaledKeyRing &keyRing_) :
+                keyRing (keyRing_) {}
+
+        protected:
+            // util::Thread
+            virtual void Run () throw () override {
+                std::string error;
+                THEKOGANS_UTIL_TRY {
+                    keyRing.Compact ();
+                }
+                THEKOGANS_UTIL_CATCH (util::Exception) {
+                    error = exception.Report ();
+                }
+                util::LockGuard<util::Mutex> guard (keyRing.mutex);
+                keyRing.compactionError = error;
+                keyRing.compacting = false;
+                keyRing.compactionCondition.SignalAll ();
+            }
+        };
+
+        JournaledKeyRing::JournaledKeyRing (
+                const std::string &path_,
+                Cipher::SharedPtr cipher_,
+                const CipherSuite &cipherSuite,
+                std::size_t maxJournalRecords_) :
+                path (path_),
+                cipher (cipher_),
+                maxJournalRecords (maxJournalRecords_),
+                sequence (0),
+                compacting (false),
+                compactionCondition (mutex) {
+            keyRing = util::Path (path).Exists () ?
+                KeyRing::Load (path, cipher.Get ()) :
+                KeyRing::SharedPtr (new KeyRing (cipherSuite));
+            // A leftover compacting journal means we crashed after
+            // rotating the journal, but before the new base file hit
+            // the disk. Replaying it is safe either way (every record
+            // is idempotent, and the last record for a given id wins).
+            bool torn = false;
+            bool foldJournal = false;
+            if (util::Path (GetCompactingJournalPath (path)).Exists ()) {
+                Replay (GetCompactingJournalPath (path), torn);
+                foldJournal = true;
+            }
+            if (util::Path (GetJournalPath (path)).Exists ()) {
+                sequence = Replay (GetJournalPath (path), torn);
+            }
+            if (foldJournal || torn) {
+                // Torn records are dropped by writing a clean base file.
+                WriteBaseFile (SerializeKeyRing ());
+                std::remove (GetCompactingJournalPath (path).c_str ());
+                OpenJournal (true);
+                sequence = 0;
+            }
+            else {
+                OpenJournal (false);
+            }
+        }
+
+        JournaledKeyRing::~JournaledKeyRing () {
+            WaitForCompaction ();
+            if (compactor.get () != 0) {
+                compactor->Wait ();
+            }
+        }
+
+        util::ui64 JournaledKeyRing::GetJournalRecordCount () {
+            util::LockGuard<util::Mutex> guard (mutex);
+            return sequence;
+        }
+
+        bool JournaledKeyRing::AddKeyExchangeParams (Params::SharedPtr params) {
+            return Add (LazyKeyRingEntryInfo::KEY_EXCHANGE_PARAMS, params);
+        }
+
+        bool JournaledKeyRing::DropKeyExchangeParams (const ID &paramsId) {
+            return Drop (LazyKeyRingEntryInfo::KEY_EXCHANGE_PARAMS, paramsId);
+        }
+
+        bool JournaledKeyRing::AddKeyExchangeKey (AsymmetricKey::SharedPtr key) {
+            return Add (LazyKeyRingEntryInfo::KEY_EXCHANGE_KEY, key);
+        }
+
+        bool JournaledKeyRing::DropKeyExchangeKey (const ID &keyId) {
+            return Drop (LazyKeyRingEntryInfo::KEY_EXCHANGE_KEY, keyId);
+        }
+
+        bool JournaledKeyRing::AddAuthenticatorParams (Params::SharedPtr params) {
+            return Add (LazyKeyRingEntryInfo::AUTHENTICATOR_PARAMS, params);
+        }
+
+        bool JournaledKeyRing::DropAuthenticatorParams (const ID &paramsId) {
+            return Drop (LazyKeyRingEntryInfo::AUTHENTICATOR_PARAMS, paramsId);
+        }
+
+        bool JournaledKeyRing::AddAuthenticatorKey (AsymmetricKey::SharedPtr key) {
+            return Add (LazyKeyRingEntryInfo::AUTHENTICATOR_KEY, key);
+        }
+
+        bool JournaledKeyRing::DropAuthenticatorKey (const ID &keyId) {
+            return Drop (LazyKeyRingEntryInfo::AUTHENTICATOR_KEY, keyId);
+        }
+
+        bool JournaledKeyRing::AddCipherKey (SymmetricKey::SharedPtr key) {
+            return Add (LazyKeyRingEntryInfo::CIPHER_KEY, key);
+        }
+
+        bool JournaledKeyRing::DropCipherKey (const ID &keyId) {
+            return Drop (LazyKeyRingEntryInfo::CIPHER_KEY, keyId);
+        }
+
+        bool JournaledKeyRing::AddMACKey (SymmetricKey::SharedPtr key) {
+            return Add (LazyKeyRingEntryInfo::MAC_KEY, key);
+        }
+
+        bool JournaledKeyRing::DropMACKey (const ID &keyId) {
+            return Drop (LazyKeyRingEntryInfo::MAC_KEY, keyId);
+        }
+
+        bool JournaledKeyRing::AddUserData (Serializable::SharedPtr userData) {
+            return Add (LazyKeyRingEntryInfo::USER_DATA, userData);
+        }
+
+        bool JournaledKeyRing::DropUserData (const ID &id) {
+            return Drop (LazyKeyRingEntryInfo::USER_DATA, id);
+        }
+
+        void JournaledKeyRing::Compact () {
+            util::LockGuard<util::Mutex> compactionGuard (compactionMutex);
+            util::Buffer buffer;
+            {
+                util::LockGuard<util::Mutex> guard (mutex);
+                buffer = SerializeKeyRing ();
+                // From here on, new records go to a fresh journal. The
+                // old one is kept until the new base file is in place.
+                journal.reset ();
+                if (std::rename (
+                        GetJournalPath (path).c_str (),
+                        GetCompactingJournalPath (path).c_str ()) != 0) {
+                    OpenJournal (false);
+                    THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                        THEKOGANS_UTIL_OS_ERROR_CODE);
+                }
+                OpenJournal (true);
+                sequence = 0;
+            }
+            WriteBaseFile (buffer);
+            std::remove (GetCompactingJournalPath (path).c_str ());
+        }
+
+        bool JournaledKeyRing::CompactAsync () {
+            util::LockGuard<util::Mutex> guard (mutex);
+            return StartCompaction ();
+        }
+
+        std::string JournaledKeyRing::WaitForCompaction () {
+            util::LockGuard<util::Mutex> guard (mutex);
+            while (compacting) {
+                compactionCondition.Wait ();
+            }
+            return compactionError;
+        }
+
+        void JournaledKeyRing::Apply (util::Buffer &record) {
+            util::ui8 op;
+            util::ui8 type;
+            record >> op >> type;
+            if (op == OP_ADD) {
+                Serializable::SharedPtr serializable;
+                record >> serializable;
+                if (serializable.Get () == 0) {
+                    THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                        THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+                }
+                // Replaying a journal over a base file that already
+                // has it's effects is harmless.
+                DropFromKeyRing (type, serializable->GetId ());
+                AddToKeyRing (type, serializable);
+            }
+            else if (op == OP_DROP) {
+                ID id;
+                record >> id;
+                DropFromKeyRing (type, id);
+            }
+            else {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "Invalid journal record op (%u)",
+                    op);
+            }
+        }
+
+        util::ui64 JournaledKeyRing::Replay (
+                const std::string &journalPath,
+                bool &torn) {
+            util::ReadOnlyFile file (util::NetworkEndian, journalPath);
+            util::Buffer buffer (util::NetworkEndian, (std::size_t)file.GetSize ());
+            buffer.AdvanceWriteOffset (
+                file.Read (
+                    buffer.GetWritePtr (),
+                    buffer.GetDataAvailableForWriting ()));
+            util::ui64 count = 0;
+            while (buffer.GetDataAvailableForReading () > 0) {
+                // A short record is the result of a crash in the middle of an Append.
+                if (buffer.GetDataAvailableForReading () < util::UI32_SIZE) {
+                    torn = true;
+                    break;
+                }
+                util::ui32 length;
+                buffer >> length;
+                if (buffer.GetDataAvailableForReading () < length) {
+                    torn = true;
+                    break;
+                }
+                SequenceAssociatedData associatedData (count);
+                util::Buffer record;
+                if (cipher.Get () != 0) {
+                    record = cipher->Decrypt (
+                        buffer.GetReadPtr (),
+                        length,
+                        associatedData.data,
+                        util::UI64_SIZE,
+                        true);
+                }
+                else {
+                    record = util::Buffer (util::NetworkEndian, length);
+                    record.Write (buffer.GetReadPtr (), length);
+                }
+                buffer.AdvanceReadOffset (length);
+                Apply (record);
+                ++count;
+            }
+            return count;
+        }
+
+        void JournaledKeyRing::Append (const util::Buffer &record) {
+            SequenceAssociatedData associatedData (sequence);
+            util::Buffer ciphertext;
+            if (cipher.Get () != 0) {
+                ciphertext = cipher->Encrypt (
+                    record.GetReadPtr (),
+                    record.GetDataAvailableForReading (),
+                    associatedData.data,
+                    util::UI64_SIZE);
+            }
+            else {
+                ciphertext = util::Buffer (
+                    util::NetworkEndian,
+                    record.GetDataAvailableForReading ());
+                ciphertext.Write (
+                    record.GetReadPtr (),
+                    record.GetDataAvailableForReading ());
+            }
+            // Write the length and the record in one go, so
+            // that a crash can only ever tear the last record.
+            util::Buffer frame (
+                util::NetworkEndian,
+                util::UI32_SIZE + ciphertext.GetDataAvailableForReading ());
+            frame << (util::ui32)ciphertext.GetDataAvailableForReading ();
+            frame.Write (
+                ciphertext.GetReadPtr (),
+                ciphertext.GetDataAvailableForReading ());
+            journal->Write (
+                frame.GetReadPtr (),
+                frame.GetDataAvailableForReading ());
+            ++sequence;
+        }
+
+        void JournaledKeyRing::CheckJournalSize () {
+            if (maxJournalRecords != 0 && sequence >= maxJournalRecords) {
+                StartCompaction ();
+            }
+        }
+
+        bool JournaledKeyRing::StartCompaction () {
+            if (compacting) {
+                return false;
+            }
+            // The previous compactor is done (compacting is reset last
+            // thing in Run), so this Wait only reaps the thread.
+            if (compactor.get () != 0) {
+                compactor->Wait ();
+            }
+            compactor.reset (new Compactor (*this));
+            compacting = true;
+            compactionError.clear ();
+            compactor->Create ();
+            return true;
+        }
+
+        util::Buffer JournaledKeyRing::SerializeKeyRing () const {
+            util::Buffer buffer (
+                util::NetworkEndian,
+                util::Serializable::Size (*keyRing));
+            buffer << *keyRing;
+            if (cipher.Get () != 0) {
+                buffer = cipher->Encrypt (
+                    buffer.GetReadPtr (),
+                    buffer.GetDataAvailableForReading ());
+            }
+            return buffer;
+        }
+
+        void JournaledKeyRing::WriteBaseFile (const util::Buffer &buffer) const {
+            std::string tempPath = path + ".tmp";
+            {
+                util::SimpleFile file (
+                    util::NetworkEndian,
+                    tempPath,
+                    util::SimpleFile::ReadWrite |
+                    util::SimpleFile::Create |
+                    util::SimpleFile::Truncate);
+                file.Write (
+                    buffer.GetReadPtr (),
+                    buffer.GetDataAvailableForReading ());
+            }
+            if (std::rename (tempPath.c_str (), path.c_str ()) != 0) {
+                // Windows won't rename over an existing file.
+                std::remove (path.c_str ());
+                if (std::rename (tempPath.c_str (), path.c_str ()) != 0) {
+                    THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                        THEKOGANS_UTIL_OS_ERROR_CODE);
+                }
+            }
+        }
+
+        void JournaledKeyRing::OpenJournal (bool truncate) {
+            journal.reset (
+                new util::SimpleFile (
+                    util::NetworkEndian,
+                    GetJournalPath (path),
+                    util::SimpleFile::ReadWrite |
+                    util::SimpleFile::Create |
+                    (truncate ? util::SimpleFile::Truncate : 0)));
+            journal->Seek (0, SEEK_END);
+        }
+
+        bool JournaledKeyRing::Add (
+                util::ui8 type,
+                Serializable::SharedPtr serializable) {
+            if (serializable.Get () == 0) {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+            util::LockGuard<util::Mutex> guard (mutex);
+            if (Find (*keyRing, type, serializable->GetId ()).Get () != 0) {
+                return false;
+            }
+            util::Buffer record (
+                util::NetworkEndian,
+                util::UI8_SIZE + util::UI8_SIZE + util::Serializable::Size (*serializable));
+            record << (util::ui8)OP_ADD << type << *serializable;
+            // Journal first, so that the ring never gets ahead of the disk.
+            Append (record);
+            AddToKeyRing (type, serializable);
+            CheckJournalSize ();
+            return true;
+        }
+
+        bool JournaledKeyRing::Drop (
+                util::ui8 type,
+                const ID &id) {
+            util::LockGuard<util::Mutex> guard (mutex);
+            if (Find (*keyRing, type, id).Get () == 0) {
+                return false;
+            }
+            util::Buffer record (
+                util::NetworkEndian,
+                util::UI8_SIZE + util::UI8_SIZE + ID::SIZE);
+            record << (util::ui8)OP_DROP << type << id;
+            Append (record);
+            DropFromKeyRing (type, id);
+            CheckJournalSize ();
+            return true;
+        }
+
+        bool JournaledKeyRing::AddToKeyRing (
+                util::ui8 type,
+                Serializable::SharedPtr serializable) {
+            switch (type) {
+                case LazyKeyRingEntryInfo::KEY_EXCHANGE_PARAMS: {
+                    Params::SharedPtr params =
+                        util::dynamic_refcounted_sharedptr_cast<Params> (serializable);
+                    if (params.Get () != 0) {
+                        return keyRing->AddKeyExchangeParams (params);
+                    }
+                    break;
+                }
+                case LazyKeyRingEntryInfo::KEY_EXCHANGE_KEY: {
+                    AsymmetricKey::SharedPtr key =
+                        util::dynamic_refcounted_sharedptr_cast<AsymmetricKey> (serializable);
+                    if (key.Get () != 0) {
+                        return keyRing->AddKeyExchangeKey (key);
+                    }
+                    break;
+                }
+                case LazyKeyRingEntryInfo::AUTHENTICATOR_PARAMS: {
+                    Params::SharedPtr params =
+                        util::dynamic_refcounted_sharedptr_cast<Params> (serializable);
+                    if (params.Get () != 0) {
+                        return keyRing->AddAuthenticatorParams (params);
+                    }
+                    break;
+                }
+                case LazyKeyRingEntryInfo::AUTHENTICATOR_KEY: {
+                    AsymmetricKey::SharedPtr key =
+                        util::dynamic_refcounted_sharedptr_cast<AsymmetricKey> (serializable);
+                    if (key.Get () != 0) {
+                        return keyRing->AddAuthenticatorKey (key);
+                    }
+                    break;
+                }
+                case LazyKeyRingEntryInfo::CIPHER_KEY: {
+                    SymmetricKey::SharedPtr key =
+                        util::dynamic_refcounted_sharedptr_cast<SymmetricKey> (serializable);
+                    if (key.Get () != 0) {
+                        return keyRing->AddCipherKey (key);
+                    }
+                    break;
+                }
+                case LazyKeyRingEntryInfo::MAC_KEY: {
+                    SymmetricKey::SharedPtr key =
+                        util::dynamic_refcounted_sharedptr_cast<SymmetricKey> (serializable);
+                    if (key.Get () != 0) {
+                        return keyRing->AddMACKey (key);
+                    }
+                    break;
+                }
+                case LazyKeyRingEntryInfo::USER_DATA:
+                    return keyRing->AddUserData (serializable);
+            }
+            THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                "Invalid entry (type: %u, id: %s)",
+                type,
+                serializable->GetId ().ToHexString ().c_str ());
+        }
+
+        bool JournaledKeyRing::DropFromKeyRing (
+                util::ui8 type,
+                const ID &id) {
+            switch (type) {
+                case LazyKeyRingEntryInfo::KEY_EXCHANGE_PARAMS:
+                    return keyRing->DropKeyExchangeParams (id, false);
+                case LazyKeyRingEntryInfo::KEY_EXCHANGE_KEY:
+                    return keyRing->DropKeyExchangeKey (id, false);
+                case LazyKeyRingEntryInfo::AUTHENTICATOR_PARAMS:
+                    return keyRing->DropAuthenticatorParams (id, false);
+                case LazyKeyRingEntryInfo::AUTHENTICATOR_KEY:
+                    return keyRing->DropAuthenticatorKey (id, false);
+                case LazyKeyRingEntryInfo::CIPHER_KEY:
+                    return keyRing->DropCipherKey (id, false);
+                case LazyKeyRingEntryInfo::MAC_KEY:
+                    return keyRing->DropMACKey (id, false);
+                case LazyKeyRingEntryInfo::USER_DATA:
+                    return keyRing->DropUserData (id, false);
+            }
+            THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                "Invalid entry type (%u)",
+                type);
+        }
+
+    } // namespace crypto
+} // namespace thekogans
@@ -0,0 +1,491 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#include <cstring>
+#include <string>
+#include <vector>
+#include <openssl/crypto.h>
+#include "thekogans/util/Exception.h"
+#include "thekogans/util/Buffer.h"
+#include "thekogans/crypto/OpenSSLUtils.h"
+#include "thekogans/crypto/Cipher.h"
+#include "thekogans/crypto/HKDF.h"
+#include "thekogans/crypto/RSA.h"
+#include "thekogans/crypto/Curve25519.h"
+#include "thekogans/crypto/X25519AsymmetricKey.h"
+#include "thekogans/crypto/KeyEnvelope.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        namespace {
+            const util::ui16 MAX_WRAPPED_KEYS = 0xffff;
+
+            // ECIES wrapping key = HKDF (ikm = shared secret,
+            // salt = ephemeral public key || KEK public key, info = KEK id).
+            SymmetricKey::SharedPtr DeriveWrappingKey (
+                    const CipherSuite &cipherSuite,
+                    const util::ui8 *privateKey,
+                    const util::ui8 *peersPublicKey,
+                    const util::ui8 publicKeys[X25519::PUBLIC_KEY_LENGTH * 2],
+                    const ID &kekId) {
+                util::ui8 secret[X25519::SHARED_SECRET_LENGTH];
+                SymmetricKey::SharedPtr wrappingKey;
+                THEKOGANS_UTIL_TRY {
+                    X25519::ComputeSharedSecret (privateKey, peersPublicKey, secret);
+                    wrappingKey = HKDF (
+                        secret,
+                        X25519::SHARED_SECRET_LENGTH,
+                        publicKeys,
+                        X25519::PUBLIC_KEY_LENGTH * 2,
+                        cipherSuite.GetOpenSSLMessageDigest ()).ExpandKey (
+                            kekId.data,
+                            ID::SIZE,
+                            GetCipherKeyLength (cipherSuite.GetOpenSSLCipher ()),
+                            ID::Empty);
+                }
+                THEKOGANS_UTIL_CATCH (util::Exception) {
+                    OPENSSL_cleanse (secret, X25519::SHARED_SECRET_LENGTH);
+                    THEKOGANS_UTIL_RETHROW_EXCEPTION (exception);
+                }
+                OPENSSL_cleanse (secret, X25519::SHARED_SECRET_LENGTH);
+                return wrappingKey;
+            }
+
+            SymmetricKey::SharedPtr ToDataKey (const util::Buffer &plaintext) {
+                return SymmetricKey::SharedPtr (
+                    new SymmetricKey (
+                        plaintext.GetReadPtr (),
+                        plaintext.GetDataAvailableForReading (),
+                        ID::Empty));
+            }
+        }
+
+        SymmetricKey::SharedPtr KeyEnvelope::CreateDataKey () const {
+            return SymmetricKey::FromRandom (
+                SymmetricKey::MIN_RANDOM_LENGTH,
+                0,
+                0,
+                GetCipherKeyLength (cipherSuite.GetOpenSSLCipher ()),
+                cipherSuite.GetOpenSSLMessageDigest (),
+                1,
+                ID::Empty);
+        }
+
+        void KeyEnvelope::Wrap (
+                SymmetricKey::SharedPtr dek,
+                SymmetricKey::SharedPtr kek) {
+            if (dek.Get () != 0 && kek.Get () != 0) {
+                // The KEK id is authenticated along with the DEK, so
+                // a wrapped key can't be passed off as another KEK's.
+                util::Buffer ciphertext = cipherSuite.GetCipher (kek)->Encrypt (
+                    dek->Get ().GetReadPtr (),
+                    dek->GetKeyLength (),
+                    kek->GetId ().data,
+                    ID::SIZE);
+                WrappedKey wrappedKey (TYPE_SYMMETRIC, kek->GetId ());
+                wrappedKey.wrappedKey.assign (
+                    ciphertext.GetReadPtr (),
+                    ciphertext.GetReadPtr () + ciphertext.GetDataAvailableForReading ());
+                Add (wrappedKey);
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        void KeyEnvelope::Wrap (
+                SymmetricKey::SharedPtr dek,
+                AsymmetricKey::SharedPtr kek) {
+            if (dek.Get () != 0 && kek.Get () != 0) {
+                const char *keyType = kek->GetKeyType ();
+            #if defined (THEKOGANS_CRYPTO_HAVE_RSA)
+                if (keyType == OPENSSL_PKEY_RSA) {
+                    util::Buffer ciphertext = RSA::Encrypt (
+                        dek->Get ().GetReadPtr (),
+                        dek->GetKeyLength (),
+                        kek->IsPrivate () ? kek->GetPublicKey (ID::Empty) : kek);
+                    WrappedKey wrappedKey (TYPE_RSA, kek->GetId ());
+                    wrappedKey.wrappedKey.assign (
+                        ciphertext.GetReadPtr (),
+                        ciphertext.GetReadPtr () + ciphertext.GetDataAvailableForReading ());
+                    Add (wrappedKey);
+                }
+                else
+            #endif // defined (THEKOGANS_CRYPTO_HAVE_RSA)
+                if (keyType == X25519AsymmetricKey::KEY_TYPE) {
+                    util::ui8 ephemeralPrivateKey[X25519::PRIVATE_KEY_LENGTH];
+                    util::ui8 publicKeys[X25519::PUBLIC_KEY_LENGTH * 2];
+                    X25519::CreateKey (ephemeralPrivateKey);
+                    X25519::GetPublicKey (ephemeralPrivateKey, publicKeys);
+                    const util::ui8 *key = ((X25519AsymmetricKey *)kek.Get ())->key.GetReadPtr ();
+                    if (kek->IsPrivate ()) {
+                        X25519::GetPublicKey (key, publicKeys + X25519::PUBLIC_KEY_LENGTH);
+                    }
+                    else {
+                        memcpy (publicKeys + X25519::PUBLIC_KEY_LENGTH, key, X25519::PUBLIC_KEY_LENGTH);
+                    }
+                    SymmetricKey::SharedPtr wrappingKey;
+                    THEKOGANS_UTIL_TRY {
+                        wrappingKey = DeriveWrappingKey (
+                            cipherSuite,
+                            ephemeralPrivateKey,
+                            publicKeys + X25519::PUBLIC_KEY_LENGTH,
+                            publicKeys,
+                            kek->GetId ());
+                    }
+                    THEKOGANS_UTIL_CATCH (util::Exception) {
+                        OPENSSL_cleanse (ephemeralPrivateKey, X25519::PRIVATE_KEY_LENGTH);
+                        THEKOGANS_UTIL_RETHROW_EXCEPTION (exception);
+                    }
+                    OPENSSL_cleanse (ephemeralPrivateKey, X25519::PRIVATE_KEY_LENGTH);
+                    util::Buffer ciphertext = cipherSuite.GetCipher (wrappingKey)->Encrypt (
+                        dek->Get ().GetReadPtr (),
+                        dek->GetKeyLength (),
+                        kek->GetId ().data,
+                        ID::SIZE);
+                    WrappedKey wrappedKey (TYPE_X25519, kek->GetId ());
+                    wrappedKey.wrappedKey.assign (publicKeys, publicKeys + X25519::PUBLIC_KEY_LENGTH);
+                    wrappedKey.wrappedKey.insert (
+                        wrappedKey.wrappedKey.end (),
+                        ciphertext.GetReadPtr (),
+                        ciphertext.GetReadPtr () + ciphertext.GetDataAvailableForReading ());
+                    Add (wrappedKey);
+                }
+                else {
+                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                        "Unsupported KEK type: %s.", keyType);
+                }
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        SymmetricKey::SharedPtr KeyEnvelope::Unwrap (const KeyRing &keyRing) const {
+            // The fast (hash) lookup returns the first key with a given id.
+            // Should it fail to unwrap, fall back to every key with that id
+            // (the full lists are only gathered then).
+            std::vector<SymmetricKey::SharedPtr> cipherKeys;
+            std::vector<AsymmetricKey::SharedPtr> keyExchangeKeys;
+            bool keysGathered = false;
+            bool kekFound = false;
+            std::string error;
+            for (std::size_t i = 0, count = wrappedKeys.size (); i < count; ++i) {
+                const WrappedKey &wrappedKey = wrappedKeys[i];
+                if (wrappedKey.type == TYPE_SYMMETRIC) {
+                    SymmetricKey::SharedPtr kek = keyRing.GetCipherKey (wrappedKey.kekId);
+                    if (kek.Get () != 0) {
+                        kekFound = true;
+                        SymmetricKey::SharedPtr dek =
+                            TryUnwrap (wrappedKey, kek, AsymmetricKey::SharedPtr (), error);
+                        if (dek.Get () != 0) {
+                            return dek;
+                        }
+                        if (!keysGathered) {
+                            keyRing.GetCipherKeys (cipherKeys);
+                            keyRing.GetKeyExchangeKeys (keyExchangeKeys);
+                            keysGathered = true;
+                        }
+                        for (std::size_t j = 0, keyCount = cipherKeys.size (); j < keyCount; ++j) {
+                            if (cipherKeys[j].Get () != kek.Get () &&
+                                    cipherKeys[j]->GetId () == wrappedKey.kekId) {
+                                dek = TryUnwrap (
+                                    wrappedKey, cipherKeys[j], AsymmetricKey::SharedPtr (), error);
+                                if (dek.Get () != 0) {
+                                    return dek;
+                                }
+                            }
+                        }
+                    }
+                }
+                else {
+                    AsymmetricKey::SharedPtr kek = keyRing.GetKeyExchangeKey (wrappedKey.kekId);
+                    if (kek.Get () != 0) {
+                        SymmetricKey::SharedPtr dek;
+                        if (kek->IsPrivate ()) {
+                            kekFound = true;
+                            dek = TryUnwrap (wrappedKey, SymmetricKey::SharedPtr (), kek, error);
+                            if (dek.Get () != 0) {
+                                return dek;
+                            }
+                        }
+                        if (!keysGathered) {
+                            keyRing.GetCipherKeys (cipherKeys);
+                            keyRing.GetKeyExchangeKeys (keyExchangeKeys);
+                            keysGathered = true;
+                        }
+                        for (std::size_t j = 0, keyCount = keyExchangeKeys.size (); j < keyCount; ++j) {
+                            if (keyExchangeKeys[j].Get () != kek.Get () &&
+                                    keyExchangeKeys[j]->GetId () == wrappedKey.kekId &&
+                                    keyExchangeKeys[j]->IsPrivate ()) {
+                                kekFound = true;
+                                dek = TryUnwrap (
+                                    wrappedKey, SymmetricKey::SharedPtr (), keyExchangeKeys[j], error);
+                                if (dek.Get () != 0) {
+                                    return dek;
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+            if (kekFound) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "None of the KEKs in the key ring could unwrap the data key (last error: %s).",
+                    error.c_str ());
+            }
+            THEKOGANS_UTIL_THROW_STRING_EXCEPTION ("%s",
+                "None of the KEKs wrapping the data key are in the key ring.");
+        }
+
+        SymmetricKey::SharedPtr KeyEnvelope::Unwrap (SymmetricKey::SharedPtr kek) const {
+            if (kek.Get () != 0) {
+                std::size_t index = Find (kek->GetId ());
+                if (index < wrappedKeys.size () && wrappedKeys[index].type == TYPE_SYMMETRIC) {
+                    return Unwrap (wrappedKeys[index], kek, AsymmetricKey::SharedPtr ());
+                }
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "KEK %s does not wrap the data key.",
+                    kek->GetId ().ToHexString ().c_str ());
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        SymmetricKey::SharedPtr KeyEnvelope::Unwrap (AsymmetricKey::SharedPtr kek) const {
+            if (kek.Get () != 0 && kek->IsPrivate ()) {
+                std::size_t index = Find (kek->GetId ());
+                if (index < wrappedKeys.size () && wrappedKeys[index].type != TYPE_SYMMETRIC) {
+                    return Unwrap (wrappedKeys[index], SymmetricKey::SharedPtr (), kek);
+                }
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "KEK %s does not wrap the data key.",
+                    kek->GetId ().ToHexString ().c_str ());
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        bool KeyEnvelope::Contains (const ID &kekId) const {
+            return Find (kekId) < wrappedKeys.size ();
+        }
+
+        bool KeyEnvelope::Remove (const ID &kekId) {
+            std::size_t index = Find (kekId);
+            if (index < wrappedKeys.size ()) {
+                wrappedKeys.erase (wrappedKeys.begin () + index);
+                return true;
+            }
+            return false;
+        }
+
+        void KeyEnvelope::Rotate (
+                const KeyRing &keyRing,
+                const ID &oldKekId,
+                SymmetricKey::SharedPtr newKek) {
+            if (!Contains (oldKekId)) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "KEK %s does not wrap the data key.",
+                    oldKekId.ToHexString ().c_str ());
+            }
+            SymmetricKey::SharedPtr dek = Unwrap (keyRing);
+            Remove (oldKekId);
+            Wrap (dek, newKek);
+        }
+
+        void KeyEnvelope::Rotate (
+                const KeyRing &keyRing,
+                const ID &oldKekId,
+                AsymmetricKey::SharedPtr newKek) {
+            if (!Contains (oldKekId)) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "KEK %s does not wrap the data key.",
+                    oldKekId.ToHexString ().c_str ());
+            }
+            SymmetricKey::SharedPtr dek = Unwrap (keyRing);
+            Remove (oldKekId);
+            Wrap (dek, newKek);
+        }
+
+        std::size_t KeyEnvelope::Size () const {
+            std::size_t size = cipherSuite.Size () + util::UI16_SIZE;
+            for (std::size_t i = 0, count = wrappedKeys.size (); i < count; ++i) {
+                size += wrappedKeys[i].Size ();
+            }
+            return size;
+        }
+
+        std::size_t KeyEnvelope::Find (const ID &kekId) const {
+            std::size_t index = 0;
+            for (std::size_t count = wrappedKeys.size (); index < count; ++index) {
+                if (wrappedKeys[index].kekId == kekId) {
+                    break;
+                }
+            }
+            return index;
+        }
+
+        void KeyEnvelope::Add (const WrappedKey &wrappedKey) {
+            std::size_t index = Find (wrappedKey.kekId);
+            if (index < wrappedKeys.size ()) {
+                wrappedKeys[index] = wrappedKey;
+            }
+            else if (wrappedKeys.size () < MAX_WRAPPED_KEYS) {
+                wrappedKeys.push_back (wrappedKey);
+            }
+            else {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "Too many KEKs (%u).", (unsigned int)MAX_WRAPPED_KEYS);
+            }
+        }
+
+        SymmetricKey::SharedPtr KeyEnvelope::Unwrap (
+                const WrappedKey &wrappedKey,
+                SymmetricKey::SharedPtr symmetricKek,
+                AsymmetricKey::SharedPtr asymmetricKek) const {
+            if (wrappedKey.wrappedKey.empty ()) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "Empty wrapped key for KEK %s.",
+                    wrappedKey.kekId.ToHexString ().c_str ());
+            }
+            const util::ui8 *ciphertext = &wrappedKey.wrappedKey[0];
+            std::size_t ciphertextLength = wrappedKey.wrappedKey.size ();
+            if (wrappedKey.type == TYPE_SYMMETRIC && symmetricKek.Get () != 0) {
+                return ToDataKey (
+                    cipherSuite.GetCipher (symmetricKek)->Decrypt (
+                        ciphertext,
+                        ciphertextLength,
+                        wrappedKey.kekId.data,
+                        ID::SIZE,
+                        true));
+            }
+        #if defined (THEKOGANS_CRYPTO_HAVE_RSA)
+            else if (wrappedKey.type == TYPE_RSA && asymmetricKek.Get () != 0 &&
+                    asymmetricKek->GetKeyType () == OPENSSL_PKEY_RSA) {
+                return ToDataKey (
+                    RSA::Decrypt (
+                        ciphertext,
+                        ciphertextLength,
+                        asymmetricKek,
+                        RSA_PKCS1_OAEP_PADDING,
+                        true));
+            }
+        #endif // defined (THEKOGANS_CRYPTO_HAVE_RSA)
+            else if (wrappedKey.type == TYPE_X25519 && asymmetricKek.Get () != 0 &&
+                    asymmetricKek->GetKeyType () == X25519AsymmetricKey::KEY_TYPE &&
+                    ciphertextLength > X25519::PUBLIC_KEY_LENGTH) {
+                // Recompute the salt (ephemeral public key || KEK public key)
+                // and the shared secret from the KEK's side.
+                const util::ui8 *key =
+                    ((X25519AsymmetricKey *)asymmetricKek.Get ())->key.GetReadPtr ();
+                util::ui8 publicKeys[X25519::PUBLIC_KEY_LENGTH * 2];
+                memcpy (publicKeys, ciphertext, X25519::PUBLIC_KEY_LENGTH);
+                X25519::GetPublicKey (key, publicKeys + X25519::PUBLIC_KEY_LENGTH);
+                SymmetricKey::SharedPtr wrappingKey = DeriveWrappingKey (
+                    cipherSuite, key, publicKeys, publicKeys, wrappedKey.kekId);
+                return ToDataKey (
+                    cipherSuite.GetCipher (wrappingKey)->Decrypt (
+                        ciphertext + X25519::PUBLIC_KEY_LENGTH,
+                        ciphertextLength - X25519::PUBLIC_KEY_LENGTH,
+                        wrappedKey.kekId.data,
+                        ID::SIZE,
+                        true));
+            }
+            THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                "Unable to unwrap KEK %s key (type: %u).",
+                wrappedKey.kekId.ToHexString ().c_str (),
+                (unsigned int)wrappedKey.type);
+        }
+
+        _LIB_THEKOGANS_CRYPTO_DECL util::Serializer & _LIB_THEKOGANS_CRYPTO_API
+        operator << (
+                util::Serializer &serializer,
+                const KeyEnvelope::WrappedKey &wrappedKey) {
+            serializer <<
+                wrappedKey.type <<
+                wrappedKey.kekId <<
+                (util::ui16)wrappedKey.wrappedKey.size ();
+            if (!wrappedKey.wrappedKey.empty ()) {
+                serializer.Write (&wrappedKey.wrappedKey[0], wrappedKey.wrappedKey.size ());
+            }
+            return serializer;
+        }
+
+        _LIB_THEKOGANS_CRYPTO_DECL util::Serializer & _LIB_THEKOGANS_CRYPTO_API
+        operator >> (
+                util::Serializer &serializer,
+                KeyEnvelope::WrappedKey &wrappedKey) {
+            util::ui16 length;
+            serializer >> wrappedKey.type >> wrappedKey.kekId >> length;
+            wrappedKey.wrappedKey.resize (length);
+            if (length > 0 && serializer.Read (&wrappedKey.wrappedKey[0], length) != length) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "Read (wrappedKey, %u) != %u",
+                    (unsigned int)length,
+                    (unsigned int)length);
+            }
+            return serializer;
+        }
+
+        _LIB_THEKOGANS_CRYPTO_DECL util::Serializer & _LIB_THEKOGANS_CRYPTO_API
+        operator << (
+                util::Serializer &serializer,
+                const KeyEnvelope &envelope) {
+            serializer << envelope.cipherSuite << (util::ui16)envelope.wrappedKeys.size ();
+            for (std::size_t i = 0, count = envelope.wrappedKeys.size (); i < count; ++i) {
+                serializer << envelope.wrappedKeys[i];
+            }
+            return serializer;
+        }
+
+        _LIB_THEKOGANS_CRYPTO_DECL util::Serializer & _LIB_THEKOGANS_CRYPTO_API
+        operator >> (
+                util::Serializer &serializer,
+                KeyEnvelope &envelope) {
+            util::ui16 count;
+            serializer >> envelope.cipherSuite >> count;
+            envelope.wrappedKeys.resize (count);
+            for (std::size_t i = 0; i < count; ++i) {
+                serializer >> envelope.wrappedKeys[i];
+            }
+            return serializer;
+        }
+
+
+        SymmetricKey::SharedPtr KeyEnvelope::TryUnwrap (
+                const WrappedKey &wrappedKey,
+                SymmetricKey::SharedPtr symmetricKek,
+                AsymmetricKey::SharedPtr asymmetricKek,
+                std::string &error) const {
+            THEKOGANS_UTIL_TRY {
+                return Unwrap (wrappedKey, symmetricKek, asymmetricKek);
+            }
+            THEKOGANS_UTIL_CATCH (util::Exception) {
+                error = exception.Report ();
+                return SymmetricKey::SharedPtr ();
+            }
+        }
+
+    } // namespace crypto
+} // namespace thekogans
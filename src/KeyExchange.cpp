@@ -17,6 +17,8 @@
 
 #include "thekogans/util/Serializer.h"
 #include "thekogans/util/StringUtils.h"
+#include "thekogans/crypto/Authenticator.h"
+#include "thekogans/crypto/TextEncoding.h"
 #include "thekogans/crypto/KeyExchange.h"
 
 namespace thekogans {
@@ -49,7 +51,7 @@ namespace thekogans {
                 const TextHeader & /*header*/,
                 const pugi::xml_node &node) {
             id = ID::FromHexString (node.attribute (ATTR_ID).value ());
-            signature = util::HexDecodestring (node.attribute (ATTR_SIGNATURE).value ());
+            signature = HexDecode (node.attribute (ATTR_SIGNATURE).value ());
             signatureKeyId = ID::FromHexString (node.attribute (ATTR_SIGNATURE_KEY_ID).value ());
             signatureMessageDigestName = node.attribute (ATTR_SIGNATURE_MESSAGE_DIGEST_NAME).value ();
         }
@@ -57,7 +59,7 @@ namespace thekogans {
         void KeyExchange::Params::Write (pugi::xml_node &node) const {
             node.append_attribute (ATTR_ID).set_value (id.ToHexString ().c_str ());
             node.append_attribute (ATTR_SIGNATURE).set_value (
-                util::HexEncodeBuffer (signature.data (), signature.size ()).c_str ());
+                HexEncode (signature.data (), signature.size ()).c_str ());
             node.append_attribute (ATTR_SIGNATURE_KEY_ID).set_value (signatureKeyId.ToHexString ().c_str ());
             node.append_attribute (ATTR_SIGNATURE_MESSAGE_DIGEST_NAME).set_value (signatureMessageDigestName.c_str ());
         }
@@ -66,7 +68,7 @@ namespace thekogans {
                 const TextHeader & /*header*/,
                 const util::JSON::Object &object) {
             id = ID::FromHexString (object.Get<util::JSON::String> (ATTR_ID)->value);
-            signature = util::HexDecodestring (object.Get<util::JSON::String> (ATTR_SIGNATURE)->value);
+            signature = HexDecode (object.Get<util::JSON::String> (ATTR_SIGNATURE)->value);
             signatureKeyId = ID::FromHexString (object.Get<util::JSON::String> (ATTR_SIGNATURE_KEY_ID)->value);
             signatureMessageDigestName = object.Get<util::JSON::String> (ATTR_SIGNATURE_MESSAGE_DIGEST_NAME)->value;
         }
@@ -77,7 +79,7 @@ namespace thekogans {
                 id.ToHexString ());
             object.Add<const std::string &> (
                 ATTR_SIGNATURE,
-                util::HexEncodeBuffer (signature.data (), signature.size ()));
+                HexEncode (signature.data (), signature.size ()));
             object.Add<const std::string &> (
                 ATTR_SIGNATURE_KEY_ID,
                 signatureKeyId.ToHexString ());
@@ -86,5 +88,138 @@ namespace thekogans {
                 signatureMessageDigestName);
         }
 
+        bool KeyExchange::CompactParams::ValidateSignature (
+                AsymmetricKey::SharedPtr publicKey,
+                MessageDigest::SharedPtr messageDigest,
+                ValidatedParamsCache::SharedPtr validatedParamsCache) const {
+            if (publicKey.Get () != 0 && messageDigest.Get () != 0 &&
+                    signedData != 0 && (signatureLength == 0 ||
+                        (publicKey->GetId () == ID (signatureKeyId) &&
+                            messageDigest->GetName () == std::string (
+                                signatureMessageDigestName,
+                                signatureMessageDigestNameLength)))) {
+                if (signatureLength > 0) {
+                    ID key;
+                    if (validatedParamsCache.Get () != 0) {
+                        key = ValidatedParamsCache::GetKey (
+                            ID (id),
+                            ID (signatureKeyId),
+                            std::string (
+                                signatureMessageDigestName,
+                                signatureMessageDigestNameLength),
+                            signedData,
+                            signedDataLength,
+                            signature,
+                            signatureLength);
+                        if (validatedParamsCache->Contains (key)) {
+                            return true;
+                        }
+                    }
+                    Authenticator authenticator (publicKey, messageDigest);
+                    bool result = authenticator.VerifyBufferSignature (
+                        signedData,
+                        signedDataLength,
+                        signature,
+                        signatureLength);
+                    if (result && validatedParamsCache.Get () != 0) {
+                        validatedParamsCache->Add (key);
+                    }
+                    return result;
+                }
+                else {
+                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                        "Params (%s) are not signed.",
+                        ID (id).ToHexString ().c_str ());
+                }
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        bool KeyExchange::CompactParams::ParseSignature (
+                const util::ui8 *begin,
+                Cursor &cursor) {
+            signedData = begin;
+            signedDataLength = cursor.ptr - begin;
+            util::ui16 signatureLength_ = 0;
+            if (!cursor.Get (signatureLength_)) {
+                return false;
+            }
+            signatureLength = signatureLength_;
+            if (signatureLength > 0) {
+                util::ui8 signatureMessageDigestNameLength_ = 0;
+                const util::ui8 *signatureMessageDigestName_ = 0;
+                if (!cursor.Get (signatureMessageDigestNameLength_) ||
+                        !cursor.Get (signatureMessageDigestNameLength_, signatureMessageDigestName_) ||
+                        !cursor.Get (ID::SIZE, signatureKeyId) ||
+                        !cursor.Get (signatureLength, signature)) {
+                    return false;
+                }
+                signatureMessageDigestName = (const char *)signatureMessageDigestName_;
+                signatureMessageDigestNameLength = signatureMessageDigestNameLength_;
+            }
+            return cursor.GetAvailable () == 0;
+        }
+
+        util::Buffer KeyExchange::CompactParams::AppendSignature (
+                const util::Buffer &body,
+                AsymmetricKey::SharedPtr privateKey,
+                MessageDigest::SharedPtr messageDigest) {
+            util::Buffer signature;
+            std::string signatureMessageDigestName;
+            if (privateKey.Get () != 0 && messageDigest.Get () != 0) {
+                Authenticator authenticator (privateKey, messageDigest);
+                signature = authenticator.SignBuffer (
+                    body.GetReadPtr (),
+                    body.GetDataAvailableForReading ());
+                signatureMessageDigestName = messageDigest->GetName ();
+                if (signature.GetDataAvailableForReading () == 0 ||
+                        signature.GetDataAvailableForReading () > util::UI16_MAX ||
+                        signatureMessageDigestName.size () > util::UI8_MAX) {
+                    THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                        THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+                }
+            }
+            std::size_t signatureLength = signature.GetDataAvailableForReading ();
+            util::Buffer buffer (
+                util::NetworkEndian,
+                body.GetDataAvailableForReading () +
+                util::UI16_SIZE +
+                (signatureLength > 0 ?
+                    util::UI8_SIZE + signatureMessageDigestName.size () + ID::SIZE + signatureLength :
+                    0));
+            buffer.Write (body.GetReadPtr (), body.GetDataAvailableForReading ());
+            buffer << (util::ui16)signatureLength;
+            if (signatureLength > 0) {
+                buffer << (util::ui8)signatureMessageDigestName.size ();
+                buffer.Write (signatureMessageDigestName.data (), signatureMessageDigestName.size ());
+                buffer.Write (privateKey->GetId ().data, ID::SIZE);
+                buffer.Write (signature.GetReadPtr (), signatureLength);
+            }
+            return buffer;
+        }
+
+        std::vector<SymmetricKey::SharedPtr> KeyExchange::DeriveSharedSymmetricKeys (
+                Params::SharedPtr params,
+                const std::vector<HKDF::Output> &outputs,
+                const EVP_MD *md) const {
+            SymmetricKey::SharedPtr key = DeriveSharedSymmetricKey (params);
+            if (key.Get () != 0) {
+                HKDF hkdf (
+                    key->Get ().GetReadPtr (),
+                    key->Get ().GetDataAvailableForReading (),
+                    0,
+                    0,
+                    md);
+                return hkdf.ExpandKeys (outputs);
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
     } // namespace crypto
 } // namespace thekogans
@@ -15,15 +15,25 @@
 // You should have received a copy of the GNU General Public License
 // along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
 
+#include <cstring>
+#include <algorithm>
+#include <atomic>
 #include "thekogans/util/Types.h"
 #include "thekogans/util/File.h"
 #include "thekogans/util/ByteSwap.h"
 #include "thekogans/util/Buffer.h"
+#include "thekogans/util/SecureAllocator.h"
 #include "thekogans/util/RandomSource.h"
 #include "thekogans/util/Exception.h"
 #include "thekogans/util/XMLUtils.h"
+#include "thekogans/util/Thread.h"
+#include "thekogans/util/OwnerVector.h"
+#include "thekogans/util/SystemInfo.h"
 #include "thekogans/crypto/DHEKeyExchange.h"
 #include "thekogans/crypto/RSA.h"
+#include "thekogans/crypto/StreamCipher.h"
+#include "thekogans/crypto/Trace.h"
+#include "thekogans/crypto/Metrics.h"
 #include "thekogans/crypto/KeyRing.h"
 
 namespace thekogans {
@@ -33,16 +43,501 @@ namespace thekogans {
             #define THEKOGANS_CRYPTO_MIN_KEY_RINGS_IN_PAGE 16
         #endif // !defined (THEKOGANS_CRYPTO_MIN_KEY_RINGS_IN_PAGE)
 
+        // Version 2 prefixes every entry with it's serialized size (see Read).
+        // Version 3 adds the id of the ring owning the shared entries (see
+        // CreateFromTemplate).
         THEKOGANS_CRYPTO_IMPLEMENT_SERIALIZABLE (
             KeyRing,
-            1,
+            3,
             THEKOGANS_CRYPTO_MIN_KEY_RINGS_IN_PAGE)
 
+        namespace {
+            // Creates the Ciphers (or HMACs) for a stripe of keys
+            // (bulk AddCipherKeys/AddMACKeys).
+            struct KeyObjectFactory : public util::Thread {
+                const CipherSuite &cipherSuite;
+                const std::vector<SymmetricKey::SharedPtr> &keys;
+                std::size_t begin;
+                std::size_t end;
+                std::vector<Cipher::SharedPtr> *ciphers;
+                std::vector<MAC::SharedPtr> *macs;
+                std::string error;
+
+                KeyObjectFactory (
+                    const CipherSuite &cipherSuite_,
+                    const std::vector<SymmetricKey::SharedPtr> &keys_,
+                    std::size_t begin_,
+                    std::size_t end_,
+                    std::vector<Cipher::SharedPtr> *ciphers_,
+                    std::vector<MAC::SharedPtr> *macs_) :
+                    cipherSuite (cipherSuite_),
+                    keys (keys_),
+                    begin (begin_),
+                    end (end_),
+                    ciphers (ciphers_),
+                    macs (macs_) {}
+
+                void CreateKeyObjects () {
+                    for (std::size_t i = begin; i < end; ++i) {
+                        if (ciphers != 0) {
+                            (*ciphers)[i] = cipherSuite.GetCipher (keys[i]);
+                        }
+                        else {
+                            (*macs)[i] = cipherSuite.GetHMAC (keys[i]);
+                        }
+                    }
+                }
+
+            protected:
+                // util::Thread
+                virtual void Run () throw () override {
+                    THEKOGANS_UTIL_TRY {
+                        CreateKeyObjects ();
+                    }
+                    THEKOGANS_UTIL_CATCH (util::Exception) {
+                        error = exception.Report ();
+                    }
+                }
+            };
+
+            void CreateKeyObjects (
+                    const CipherSuite &cipherSuite,
+                    const std::vector<SymmetricKey::SharedPtr> &keys,
+                    std::size_t workerCount,
+                    std::vector<Cipher::SharedPtr> *ciphers,
+                    std::vector<MAC::SharedPtr> *macs) {
+                if (ciphers != 0) {
+                    ciphers->resize (keys.size ());
+                }
+                else {
+                    macs->resize (keys.size ());
+                }
+                if (workerCount == 0) {
+                    workerCount = util::SystemInfo::Instance ().GetCPUCount ();
+                }
+                if (workerCount > keys.size ()) {
+                    workerCount = keys.size ();
+                }
+                if (workerCount <= 1) {
+                    KeyObjectFactory (cipherSuite, keys, 0, keys.size (), ciphers, macs).CreateKeyObjects ();
+                    return;
+                }
+                util::OwnerVector<KeyObjectFactory> workers;
+                workers.reserve (workerCount);
+                std::size_t stripe = (keys.size () + workerCount - 1) / workerCount;
+                for (std::size_t begin = 0; begin < keys.size (); begin += stripe) {
+                    workers.push_back (
+                        new KeyObjectFactory (
+                            cipherSuite,
+                            keys,
+                            begin,
+                            std::min (begin + stripe, keys.size ()),
+                            ciphers,
+                            macs));
+                    workers.back ()->Create ();
+                }
+                for (std::size_t i = 0, count = workers.size (); i < count; ++i) {
+                    workers[i]->Wait ();
+                }
+                for (std::size_t i = 0, count = workers.size (); i < count; ++i) {
+                    if (!workers[i]->error.empty ()) {
+                        THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                            "%s",
+                            workers[i]->error.c_str ());
+                    }
+                }
+            }
+
+            // The maps are dense (\see{IDHashMap}), so a random entry
+            // is an index away.
+            inline std::size_t GetRandomIndex (std::size_t count) {
+                return count > 1 ?
+                    util::GlobalRandomSource::Instance ().Getui32 () % count : 0;
+            }
+
+            // Serialized entry maps (version 2 Read/Write order).
+            enum {
+                ENTRY_MAP_KEY_EXCHANGE_PARAMS,
+                ENTRY_MAP_KEY_EXCHANGE_KEY,
+                ENTRY_MAP_AUTHENTICATOR_PARAMS,
+                ENTRY_MAP_AUTHENTICATOR_KEY,
+                ENTRY_MAP_CIPHER_KEY,
+                ENTRY_MAP_MAC_KEY,
+                ENTRY_MAP_USER_DATA,
+                ENTRY_MAP_SUBRING,
+                ENTRY_MAP_COUNT
+            };
+
+            inline std::size_t GetEntrySize (const util::Serializable &entry) {
+                std::size_t size = util::Serializable::Size (entry);
+                return util::SizeT (size).Size () + size;
+            }
+
+            inline void WriteEntry (
+                    util::Serializer &serializer,
+                    const util::Serializable &entry) {
+                serializer << util::SizeT (util::Serializable::Size (entry)) << entry;
+            }
+
+            // Move the keys that fit (CompactKeyStore::CanHold)
+            // from the map in to the store (see KeyRing::CompactKeys).
+            std::size_t CompactKeyMap (
+                    IDHashMap<SymmetricKey::SharedPtr> &map,
+                    CompactKeyStore &store) {
+                std::size_t compacted = 0;
+                IDHashMap<SymmetricKey::SharedPtr> keys;
+                for (IDHashMap<SymmetricKey::SharedPtr>::const_iterator
+                        it = map.begin (),
+                        end = map.end (); it != end; ++it) {
+                    if (store.Add (*it->second)) {
+                        ++compacted;
+                    }
+                    else {
+                        keys.insert (*it);
+                    }
+                }
+                std::swap (map, keys);
+                return compacted;
+            }
+
+            // Rings with fewer entries are not worth the threads.
+            enum {
+                MIN_PARALLEL_READ_ENTRIES = 64
+            };
+
+            std::atomic<std::size_t> readWorkerCount (0);
+            // Set on EntryReader threads, so that sub rings parsed
+            // by a worker don't spawn workers of their own.
+            thread_local bool readingEntries = false;
+
+            // Outermost ring being serialized. Rings sharing the entries of
+            // a ring outside of it have to serialize the entries themselves
+            // (see KeyRing::GetSharedEntriesOwner).
+            thread_local const KeyRing *writeRoot = 0;
+
+            // Source of KeyRing::Index::version values. Globally unique
+            // so that a ring moved to another tree (or detached) never
+            // matches a version it cached it's size against.
+            std::atomic<util::ui64> treeVersion (0);
+
+            struct WriteRootScope {
+                bool outermost;
+
+                explicit WriteRootScope (const KeyRing &keyRing) :
+                        outermost (writeRoot == 0) {
+                    if (outermost) {
+                        writeRoot = &keyRing;
+                    }
+                }
+                ~WriteRootScope () {
+                    if (outermost) {
+                        writeRoot = 0;
+                    }
+                }
+            };
+
+            // A size prefixed entry located (but not yet parsed) by Read.
+            struct EntryReadJob {
+                util::ui8 map;
+                const util::ui8 *data;
+                std::size_t length;
+                Serializable::SharedPtr entry;
+
+                EntryReadJob (
+                    util::ui8 map_,
+                    const util::ui8 *data_,
+                    std::size_t length_) :
+                    map (map_),
+                    data (data_),
+                    length (length_) {}
+            };
+
+            void ReadEntries (
+                    std::vector<EntryReadJob> &jobs,
+                    std::size_t begin,
+                    std::size_t end,
+                    util::Endianness endianness) {
+                for (std::size_t i = begin; i < end; ++i) {
+                    util::TenantReadBuffer buffer (
+                        endianness,
+                        (util::ui8 *)jobs[i].data,
+                        jobs[i].length);
+                    buffer >> jobs[i].entry;
+                }
+            }
+
+            struct EntryReader : public util::Thread {
+                std::vector<EntryReadJob> &jobs;
+                std::size_t begin;
+                std::size_t end;
+                util::Endianness endianness;
+                std::string error;
+
+                EntryReader (
+                    std::vector<EntryReadJob> &jobs_,
+                    std::size_t begin_,
+                    std::size_t end_,
+                    util::Endianness endianness_) :
+                    jobs (jobs_),
+                    begin (begin_),
+                    end (end_),
+                    endianness (endianness_) {}
+
+            protected:
+                // util::Thread
+                virtual void Run () throw () override {
+                    readingEntries = true;
+                    THEKOGANS_UTIL_TRY {
+                        ReadEntries (jobs, begin, end, endianness);
+                    }
+                    THEKOGANS_UTIL_CATCH (util::Exception) {
+                        error = exception.Report ();
+                    }
+                }
+            };
+
+            void ReadEntries (
+                    std::vector<EntryReadJob> &jobs,
+                    util::Endianness endianness) {
+                std::size_t workerCount = readWorkerCount;
+                if (workerCount == 0) {
+                    workerCount = util::SystemInfo::Instance ().GetCPUCount ();
+                }
+                if (readingEntries || jobs.size () < MIN_PARALLEL_READ_ENTRIES) {
+                    workerCount = 1;
+                }
+                if (workerCount > jobs.size ()) {
+                    workerCount = jobs.size ();
+                }
+                if (workerCount <= 1) {
+                    ReadEntries (jobs, 0, jobs.size (), endianness);
+                    return;
+                }
+                util::OwnerVector<EntryReader> workers;
+                workers.reserve (workerCount);
+                std::size_t stripe = (jobs.size () + workerCount - 1) / workerCount;
+                for (std::size_t begin = 0; begin < jobs.size (); begin += stripe) {
+                    workers.push_back (
+                        new EntryReader (
+                            jobs,
+                            begin,
+                            std::min (begin + stripe, jobs.size ()),
+                            endianness));
+                    workers.back ()->Create ();
+                }
+                for (std::size_t i = 0, count = workers.size (); i < count; ++i) {
+                    workers[i]->Wait ();
+                }
+                for (std::size_t i = 0, count = workers.size (); i < count; ++i) {
+                    if (!workers[i]->error.empty ()) {
+                        THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                            "%s",
+                            workers[i]->error.c_str ());
+                    }
+                }
+            }
+
+            // SaveStream/LoadStream file prefix (also the
+            // associated data of every segment).
+            struct KeyRingStreamHeader {
+                enum {
+                    // "TKRS"
+                    MAGIC = 0x544b5253,
+                    VERSION = 1,
+                    SIZE = util::UI32_SIZE + util::UI16_SIZE + util::UI32_SIZE
+                };
+
+                util::ui8 data[SIZE];
+
+                explicit KeyRingStreamHeader (util::ui32 chunkSize = 0) {
+                    util::TenantWriteBuffer buffer (util::NetworkEndian, data, SIZE);
+                    buffer << (util::ui32)MAGIC << (util::ui16)VERSION << chunkSize;
+                }
+
+                util::ui32 GetChunkSize () const {
+                    util::TenantReadBuffer buffer (util::NetworkEndian, (util::ui8 *)data, SIZE);
+                    util::ui32 magic;
+                    util::ui16 version;
+                    util::ui32 chunkSize;
+                    buffer >> magic >> version >> chunkSize;
+                    if (magic != MAGIC || version != VERSION ||
+                            chunkSize == 0 || chunkSize > KeyRing::MAX_STREAM_CHUNK_SIZE) {
+                        THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                            "%s",
+                            "Invalid key ring stream header.");
+                    }
+                    return chunkSize;
+                }
+            };
+
+            // Serializer that encrypts everything written to it in
+            // chunkSize segments, and writes them to the given file.
+            struct KeyRingStreamWriter : public util::Serializer {
+                util::File &file;
+                StreamCipher &streamCipher;
+                const KeyRingStreamHeader &header;
+                std::size_t chunkSize;
+                util::SecureBuffer plaintext;
+                std::size_t plaintextLength;
+                util::Buffer ciphertext;
+
+                KeyRingStreamWriter (
+                    util::File &file_,
+                    StreamCipher &streamCipher_,
+                    const KeyRingStreamHeader &header_,
+                    std::size_t chunkSize_) :
+                    util::Serializer (util::NetworkEndian),
+                    file (file_),
+                    streamCipher (streamCipher_),
+                    header (header_),
+                    chunkSize (chunkSize_),
+                    plaintext (util::NetworkEndian, chunkSize),
+                    plaintextLength (0),
+                    ciphertext (util::NetworkEndian, StreamCipher::GetSegmentLength (chunkSize)) {}
+
+                virtual std::size_t Read (
+                        void * /*buffer*/,
+                        std::size_t /*count*/) override {
+                    THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                        THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+                }
+
+                virtual std::size_t Write (
+                        const void *buffer,
+                        std::size_t count) override {
+                    const util::ui8 *ptr = (const util::ui8 *)buffer;
+                    for (std::size_t left = count; left > 0;) {
+                        // A full chunk is only flushed when more data arrives,
+                        // so that the last segment can always be flagged as such.
+                        if (plaintextLength == chunkSize) {
+                            WriteSegment (false);
+                        }
+                        std::size_t length = std::min (left, chunkSize - plaintextLength);
+                        memcpy (plaintext.GetWritePtr () + plaintextLength, ptr, length);
+                        plaintextLength += length;
+                        ptr += length;
+                        left -= length;
+                    }
+                    return count;
+                }
+
+                void Finish () {
+                    WriteSegment (true);
+                }
+
+                void WriteSegment (bool last) {
+                    std::size_t ciphertextLength = streamCipher.EncryptSegment (
+                        plaintext.GetWritePtr (),
+                        plaintextLength,
+                        last,
+                        header.data,
+                        KeyRingStreamHeader::SIZE,
+                        ciphertext.GetWritePtr ());
+                    if (file.Write (ciphertext.GetWritePtr (), ciphertextLength) != ciphertextLength) {
+                        THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                            THEKOGANS_UTIL_OS_ERROR_CODE);
+                    }
+                    plaintextLength = 0;
+                }
+            };
+
+            // Serializer that reads and decrypts chunkSize segments
+            // from the given file as they are needed.
+            struct KeyRingStreamReader : public util::Serializer {
+                util::File &file;
+                StreamCipher &streamCipher;
+                const KeyRingStreamHeader &header;
+                util::ui64 remaining;
+                std::size_t segmentLength;
+                util::SecureBuffer plaintext;
+                std::size_t plaintextOffset;
+                std::size_t plaintextLength;
+                util::Buffer ciphertext;
+
+                KeyRingStreamReader (
+                    util::File &file_,
+                    StreamCipher &streamCipher_,
+                    const KeyRingStreamHeader &header_,
+                    std::size_t chunkSize,
+                    util::ui64 remaining_) :
+                    util::Serializer (util::NetworkEndian),
+                    file (file_),
+                    streamCipher (streamCipher_),
+                    header (header_),
+                    remaining (remaining_),
+                    segmentLength (StreamCipher::GetSegmentLength (chunkSize)),
+                    plaintext (util::NetworkEndian, chunkSize),
+                    plaintextOffset (0),
+                    plaintextLength (0),
+                    ciphertext (util::NetworkEndian, segmentLength) {}
+
+                virtual std::size_t Read (
+                        void *buffer,
+                        std::size_t count) override {
+                    util::ui8 *ptr = (util::ui8 *)buffer;
+                    for (std::size_t left = count; left > 0;) {
+                        if (plaintextOffset == plaintextLength) {
+                            if (streamCipher.IsFinished ()) {
+                                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                                    "%s",
+                                    "Unexpected end of key ring stream.");
+                            }
+                            ReadSegment ();
+                            continue;
+                        }
+                        std::size_t length = std::min (left, plaintextLength - plaintextOffset);
+                        memcpy (ptr, plaintext.GetWritePtr () + plaintextOffset, length);
+                        plaintextOffset += length;
+                        ptr += length;
+                        left -= length;
+                    }
+                    return count;
+                }
+
+                virtual std::size_t Write (
+                        const void * /*buffer*/,
+                        std::size_t /*count*/) override {
+                    THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                        THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+                }
+
+                // Every segment but the last is exactly segmentLength
+                // long, and the last one ends the file.
+                void ReadSegment () {
+                    bool last = remaining <= segmentLength;
+                    std::size_t length = last ? (std::size_t)remaining : segmentLength;
+                    if (file.Read (ciphertext.GetWritePtr (), length) != length) {
+                        THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                            "%s",
+                            "Unexpected end of key ring stream.");
+                    }
+                    remaining -= length;
+                    plaintextLength = streamCipher.DecryptSegment (
+                        ciphertext.GetWritePtr (),
+                        length,
+                        last,
+                        header.data,
+                        KeyRingStreamHeader::SIZE,
+                        plaintext.GetWritePtr ());
+                    plaintextOffset = 0;
+                }
+
+                bool IsAtEnd () const {
+                    return streamCipher.IsFinished () && plaintextOffset == plaintextLength;
+                }
+            };
+        }
+
+        KeyRing::~KeyRing () {
+            DetachSubrings ();
+        }
+
         KeyRing::SharedPtr KeyRing::Load (
                 const std::string &path,
                 Cipher *cipher,
                 const void *associatedData,
                 std::size_t associatedDataLength) {
+            THEKOGANS_CRYPTO_TRACE_SCOPE (OPERATION_KEY_RING_LOAD, ID::Empty, 0, 0);
             util::ReadOnlyFile file (util::NetworkEndian, path);
             util::Buffer buffer (util::NetworkEndian, (std::size_t)file.GetSize ());
             buffer.AdvanceWriteOffset (
@@ -67,6 +562,7 @@ namespace thekogans {
                 Cipher *cipher,
                 const void *associatedData,
                 std::size_t associatedDataLength) {
+            THEKOGANS_CRYPTO_TRACE_SCOPE (OPERATION_KEY_RING_SAVE, GetId (), cipherSuite.GetCode (), 0);
             util::Buffer buffer (
                 util::NetworkEndian,
                 util::Serializable::Size (*this));
@@ -89,22 +585,81 @@ namespace thekogans {
                 buffer.GetDataAvailableForReading ());
         }
 
+        void KeyRing::SetReadWorkerCount (std::size_t workerCount) {
+            readWorkerCount = workerCount;
+        }
+
+        KeyRing::SharedPtr KeyRing::LoadStream (
+                const std::string &path,
+                SymmetricKey::SharedPtr key,
+                const EVP_CIPHER *cipher) {
+            util::ReadOnlyFile file (util::NetworkEndian, path);
+            util::ui64 fileSize = file.GetSize ();
+            KeyRingStreamHeader header;
+            util::ui8 streamHeader[StreamCipher::HEADER_LENGTH];
+            if (fileSize < KeyRingStreamHeader::SIZE + StreamCipher::HEADER_LENGTH ||
+                    file.Read (header.data, KeyRingStreamHeader::SIZE) != KeyRingStreamHeader::SIZE ||
+                    file.Read (streamHeader, StreamCipher::HEADER_LENGTH) != StreamCipher::HEADER_LENGTH) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "%s is not a key ring stream.",
+                    path.c_str ());
+            }
+            StreamCipher streamCipher (key, cipher);
+            streamCipher.BeginDecryption (streamHeader, StreamCipher::HEADER_LENGTH);
+            KeyRingStreamReader reader (
+                file,
+                streamCipher,
+                header,
+                header.GetChunkSize (),
+                fileSize - KeyRingStreamHeader::SIZE - StreamCipher::HEADER_LENGTH);
+            SharedPtr keyRing;
+            reader >> keyRing;
+            // Make sure nothing was appended to (or chopped off) the ring.
+            if (!reader.IsAtEnd ()) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "Trailing data in key ring stream %s.",
+                    path.c_str ());
+            }
+            return keyRing;
+        }
+
+        void KeyRing::SaveStream (
+                const std::string &path,
+                SymmetricKey::SharedPtr key,
+                const EVP_CIPHER *cipher,
+                std::size_t chunkSize) {
+            if (chunkSize == 0 || chunkSize > MAX_STREAM_CHUNK_SIZE) {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+            StreamCipher streamCipher (key, cipher);
+            KeyRingStreamHeader header ((util::ui32)chunkSize);
+            util::ui8 streamHeader[StreamCipher::HEADER_LENGTH];
+            streamCipher.BeginEncryption (streamHeader);
+            util::SimpleFile file (
+                util::NetworkEndian,
+                path,
+                util::SimpleFile::ReadWrite |
+                util::SimpleFile::Create |
+                util::SimpleFile::Truncate);
+            file.Write (header.data, KeyRingStreamHeader::SIZE);
+            file.Write (streamHeader, StreamCipher::HEADER_LENGTH);
+            KeyRingStreamWriter writer (file, streamCipher, header, chunkSize);
+            writer << *this;
+            writer.Finish ();
+        }
+
         Params::SharedPtr KeyRing::GetKeyExchangeParams (
                 const ID &paramsId,
                 bool recursive) const {
-            ParamsMap::const_iterator it = keyExchangeParamsMap.find (paramsId);
-            if (it != keyExchangeParamsMap.end ()) {
+            ParamsMap::const_iterator it = sharedEntries->keyExchangeParamsMap.find (paramsId);
+            if (it != sharedEntries->keyExchangeParamsMap.end ()) {
                 return it->second;
             }
             if (recursive) {
-                for (KeyRingMap::const_iterator
-                        it = subringMap.begin (),
-                        end = subringMap.end (); it != end; ++it) {
-                    Params::SharedPtr params =
-                        it->second->GetKeyExchangeParams (paramsId, recursive);
-                    if (params.Get () != 0) {
-                        return params;
-                    }
+                KeyRing *owner = FindOwner (paramsId, ENTRY_KEY_EXCHANGE_PARAMS);
+                if (owner != 0) {
+                    return owner->GetKeyExchangeParams (paramsId, false);
                 }
             }
             return Params::SharedPtr ();
@@ -114,8 +669,8 @@ namespace thekogans {
                 const EqualityTest<Params> &equalityTest,
                 bool recursive) const {
             for (ParamsMap::const_iterator
-                    it = keyExchangeParamsMap.begin (),
-                    end = keyExchangeParamsMap.end (); it != end; ++it) {
+                    it = sharedEntries->keyExchangeParamsMap.begin (),
+                    end = sharedEntries->keyExchangeParamsMap.end (); it != end; ++it) {
                 if (equalityTest (*it->second)) {
                     return it->second;
                 }
@@ -134,16 +689,36 @@ namespace thekogans {
             return Params::SharedPtr ();
         }
 
+        Params::SharedPtr KeyRing::GetKeyExchangeParams (
+                const AttributeQuery &query,
+                bool recursive) const {
+            ID id;
+            KeyRing *owner = FindAttribute (query, ENTRY_KEY_EXCHANGE_PARAMS, recursive, id);
+            return owner != 0 ? owner->GetKeyExchangeParams (id, false) : Params::SharedPtr ();
+        }
+
+        void KeyRing::GetKeyExchangeParams (
+                std::vector<Params::SharedPtr> &params,
+                bool recursive) const {
+            for (ParamsMap::const_iterator
+                    it = sharedEntries->keyExchangeParamsMap.begin (),
+                    end = sharedEntries->keyExchangeParamsMap.end (); it != end; ++it) {
+                params.push_back (it->second);
+            }
+            if (recursive) {
+                for (KeyRingMap::const_iterator
+                        it = subringMap.begin (),
+                        end = subringMap.end (); it != end; ++it) {
+                    it->second->GetKeyExchangeParams (params, recursive);
+                }
+            }
+        }
+
         Params::SharedPtr KeyRing::GetRandomKeyExchangeParams () const {
             Params::SharedPtr params;
-            if (!keyExchangeParamsMap.empty ()) {
-                ParamsMap::const_iterator it = keyExchangeParamsMap.begin ();
-                if (keyExchangeParamsMap.size () > 1) {
-                    std::advance (
-                        it,
-                        util::GlobalRandomSource::Instance ().Getui32 () % keyExchangeParamsMap.size ());
-                }
-                params = it->second;
+            if (!sharedEntries->keyExchangeParamsMap.empty ()) {
+                params = (sharedEntries->keyExchangeParamsMap.begin () +
+                    GetRandomIndex (sharedEntries->keyExchangeParamsMap.size ()))->second;
             }
             return params;
         }
@@ -151,9 +726,13 @@ namespace thekogans {
         bool KeyRing::AddKeyExchangeParams (Params::SharedPtr params) {
             if (params.Get () != 0 &&
                     cipherSuite.VerifyKeyExchangeParams (*params)) {
+                UnshareEntries ();
                 std::pair<ParamsMap::iterator, bool> result =
-                    keyExchangeParamsMap.insert (
+                    sharedEntries->keyExchangeParamsMap.insert (
                         ParamsMap::value_type (params->GetId (), params));
+                if (result.second) {
+                    IndexEntryAdded (params->GetId (), ENTRY_KEY_EXCHANGE_PARAMS);
+                }
                 return result.second;
             }
             else {
@@ -165,25 +744,24 @@ namespace thekogans {
         bool KeyRing::DropKeyExchangeParams (
                 const ID &paramsId,
                 bool recursive) {
-            ParamsMap::iterator it = keyExchangeParamsMap.find (paramsId);
-            if (it != keyExchangeParamsMap.end ()) {
-                keyExchangeParamsMap.erase (it);
+            if (sharedEntries->keyExchangeParamsMap.find (paramsId) != sharedEntries->keyExchangeParamsMap.end ()) {
+                UnshareEntries ();
+                sharedEntries->keyExchangeParamsMap.erase (paramsId);
+                IndexEntryDropped (paramsId, ENTRY_KEY_EXCHANGE_PARAMS);
                 return true;
             }
             else if (recursive) {
-                for (KeyRingMap::const_iterator
-                        it = subringMap.begin (),
-                        end = subringMap.end (); it != end; ++it) {
-                    if (it->second->DropKeyExchangeParams (paramsId, recursive)) {
-                        return true;
-                    }
+                KeyRing *owner = FindOwner (paramsId, ENTRY_KEY_EXCHANGE_PARAMS);
+                if (owner != 0) {
+                    return owner->DropKeyExchangeParams (paramsId, false);
                 }
             }
             return false;
         }
 
         void KeyRing::DropAllKeyExchangeParams (bool recursive) {
-            keyExchangeParamsMap.clear ();
+            UnshareEntries ();
+            sharedEntries->keyExchangeParamsMap.clear ();
             if (recursive) {
                 for (KeyRingMap::const_iterator
                         it = subringMap.begin (),
@@ -191,24 +769,20 @@ namespace thekogans {
                     it->second->DropAllKeyExchangeParams (recursive);
                 }
             }
+            InvalidateIndex ();
         }
 
         AsymmetricKey::SharedPtr KeyRing::GetKeyExchangeKey (
                 const ID &keyId,
                 bool recursive) const {
-            AsymmetricKeyMap::const_iterator it = keyExchangeKeyMap.find (keyId);
-            if (it != keyExchangeKeyMap.end ()) {
+            AsymmetricKeyMap::const_iterator it = sharedEntries->keyExchangeKeyMap.find (keyId);
+            if (it != sharedEntries->keyExchangeKeyMap.end ()) {
                 return it->second;
             }
             if (recursive) {
-                for (KeyRingMap::const_iterator
-                        it = subringMap.begin (),
-                        end = subringMap.end (); it != end; ++it) {
-                    AsymmetricKey::SharedPtr key =
-                        it->second->GetKeyExchangeKey (keyId, recursive);
-                    if (key.Get () != 0) {
-                        return key;
-                    }
+                KeyRing *owner = FindOwner (keyId, ENTRY_KEY_EXCHANGE_KEY);
+                if (owner != 0) {
+                    return owner->GetKeyExchangeKey (keyId, false);
                 }
             }
             return AsymmetricKey::SharedPtr ();
@@ -218,8 +792,8 @@ namespace thekogans {
                 const EqualityTest<AsymmetricKey> &equalityTest,
                 bool recursive) const {
             for (AsymmetricKeyMap::const_iterator
-                    it = keyExchangeKeyMap.begin (),
-                    end = keyExchangeKeyMap.end (); it != end; ++it) {
+                    it = sharedEntries->keyExchangeKeyMap.begin (),
+                    end = sharedEntries->keyExchangeKeyMap.end (); it != end; ++it) {
                 if (equalityTest (*it->second)) {
                     return it->second;
                 }
@@ -238,11 +812,40 @@ namespace thekogans {
             return AsymmetricKey::SharedPtr ();
         }
 
+        AsymmetricKey::SharedPtr KeyRing::GetKeyExchangeKey (
+                const AttributeQuery &query,
+                bool recursive) const {
+            ID id;
+            KeyRing *owner = FindAttribute (query, ENTRY_KEY_EXCHANGE_KEY, recursive, id);
+            return owner != 0 ? owner->GetKeyExchangeKey (id, false) : AsymmetricKey::SharedPtr ();
+        }
+
+        void KeyRing::GetKeyExchangeKeys (
+                std::vector<AsymmetricKey::SharedPtr> &keys,
+                bool recursive) const {
+            for (AsymmetricKeyMap::const_iterator
+                    it = sharedEntries->keyExchangeKeyMap.begin (),
+                    end = sharedEntries->keyExchangeKeyMap.end (); it != end; ++it) {
+                keys.push_back (it->second);
+            }
+            if (recursive) {
+                for (KeyRingMap::const_iterator
+                        it = subringMap.begin (),
+                        end = subringMap.end (); it != end; ++it) {
+                    it->second->GetKeyExchangeKeys (keys, recursive);
+                }
+            }
+        }
+
         bool KeyRing::AddKeyExchangeKey (AsymmetricKey::SharedPtr key) {
             if (key.Get () != 0 && cipherSuite.VerifyKeyExchangeKey (*key)) {
+                UnshareEntries ();
                 std::pair<AsymmetricKeyMap::iterator, bool> result =
-                    keyExchangeKeyMap.insert (
+                    sharedEntries->keyExchangeKeyMap.insert (
                         AsymmetricKeyMap::value_type (key->GetId (), key));
+                if (result.second) {
+                    IndexEntryAdded (key->GetId (), ENTRY_KEY_EXCHANGE_KEY);
+                }
                 return result.second;
             }
             else {
@@ -254,25 +857,24 @@ namespace thekogans {
         bool KeyRing::DropKeyExchangeKey (
                 const ID &keyId,
                 bool recursive) {
-            AsymmetricKeyMap::iterator it = keyExchangeKeyMap.find (keyId);
-            if (it != keyExchangeKeyMap.end ()) {
-                keyExchangeKeyMap.erase (it);
+            if (sharedEntries->keyExchangeKeyMap.find (keyId) != sharedEntries->keyExchangeKeyMap.end ()) {
+                UnshareEntries ();
+                sharedEntries->keyExchangeKeyMap.erase (keyId);
+                IndexEntryDropped (keyId, ENTRY_KEY_EXCHANGE_KEY);
                 return true;
             }
             else if (recursive) {
-                for (KeyRingMap::const_iterator
-                        it = subringMap.begin (),
-                        end = subringMap.end (); it != end; ++it) {
-                    if (it->second->DropKeyExchangeKey (keyId, recursive)) {
-                        return true;
-                    }
+                KeyRing *owner = FindOwner (keyId, ENTRY_KEY_EXCHANGE_KEY);
+                if (owner != 0) {
+                    return owner->DropKeyExchangeKey (keyId, false);
                 }
             }
             return false;
         }
 
         void KeyRing::DropAllKeyExchangeKeys (bool recursive) {
-            keyExchangeKeyMap.clear ();
+            UnshareEntries ();
+            sharedEntries->keyExchangeKeyMap.clear ();
             if (recursive) {
                 for (KeyRingMap::const_iterator
                         it = subringMap.begin (),
@@ -280,6 +882,7 @@ namespace thekogans {
                     it->second->DropAllKeyExchangeKeys (recursive);
                 }
             }
+            InvalidateIndex ();
         }
 
         KeyExchange::SharedPtr KeyRing::AddKeyExchange (
@@ -293,8 +896,8 @@ namespace thekogans {
                 const std::string &description,
                 bool recursive) {
             crypto::KeyExchange::SharedPtr keyExchange;
-            if (cipherSuite.keyExchange == CipherSuite::KEY_EXCHANGE_ECDHE ||
-                    cipherSuite.keyExchange == CipherSuite::KEY_EXCHANGE_DHE) {
+            if (cipherSuite.GetKeyExchangeIndex () == CipherSuite::KEY_EXCHANGE_INDEX_ECDHE ||
+                    cipherSuite.GetKeyExchangeIndex () == CipherSuite::KEY_EXCHANGE_INDEX_DHE) {
                 crypto::Params::SharedPtr params = paramsOrKeyId != ID::Empty ?
                     GetKeyExchangeParams (paramsOrKeyId) :
                     GetRandomKeyExchangeParams ();
@@ -318,7 +921,8 @@ namespace thekogans {
                         paramsOrKeyId.ToHexString ().c_str ());
                 }
             }
-            else if (cipherSuite.keyExchange == CipherSuite::KEY_EXCHANGE_RSA) {
+        #if defined (THEKOGANS_CRYPTO_HAVE_RSA)
+            else if (cipherSuite.GetKeyExchangeIndex () == CipherSuite::KEY_EXCHANGE_INDEX_RSA) {
                 crypto::AsymmetricKey::SharedPtr key = GetKeyExchangeKey (paramsOrKeyId);
                 if (key.Get () != 0 && !key->IsPrivate ()) {
                     keyExchange.Reset (
@@ -341,6 +945,7 @@ namespace thekogans {
                         paramsOrKeyId.ToHexString ().c_str ());
                 }
             }
+        #endif // defined (THEKOGANS_CRYPTO_HAVE_RSA)
             else {
                 THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
                     "Unknown key exchange type: %s",
@@ -355,6 +960,7 @@ namespace thekogans {
                         "Unable to add a KeyExchange: %s.",
                         keyExchange->GetId ().ToHexString ().c_str ());
                 }
+                IndexEntryAdded (keyExchange->GetId (), ENTRY_KEY_EXCHANGE);
             }
             else if (recursive) {
                 for (KeyRingMap::const_iterator
@@ -393,7 +999,8 @@ namespace thekogans {
                                 CipherSuite::GetOpenSSLMessageDigestByName (
                                     params->signatureMessageDigestName)));
                         if (messageDigest.Get () != 0) {
-                            if (!params->ValidateSignature (publicKey, messageDigest)) {
+                            if (!params->ValidateSignature (
+                                    publicKey, messageDigest, validatedParamsCache)) {
                                 THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
                                     "Params failed signature validation: %s",
                                     params->id.ToHexString ().c_str ());
@@ -411,11 +1018,12 @@ namespace thekogans {
                             params->signatureKeyId.ToHexString ().c_str ());
                     }
                 }
-                if (cipherSuite.keyExchange == CipherSuite::KEY_EXCHANGE_ECDHE ||
-                        cipherSuite.keyExchange == CipherSuite::KEY_EXCHANGE_DHE) {
+                if (cipherSuite.GetKeyExchangeIndex () == CipherSuite::KEY_EXCHANGE_INDEX_ECDHE ||
+                        cipherSuite.GetKeyExchangeIndex () == CipherSuite::KEY_EXCHANGE_INDEX_DHE) {
                     return KeyExchange::SharedPtr (new DHEKeyExchange (params));
                 }
-                else if (cipherSuite.keyExchange == CipherSuite::KEY_EXCHANGE_RSA) {
+            #if defined (THEKOGANS_CRYPTO_HAVE_RSA)
+                else if (cipherSuite.GetKeyExchangeIndex () == CipherSuite::KEY_EXCHANGE_INDEX_RSA) {
                     RSAKeyExchange::RSAParams::SharedPtr rsaParams =
                         util::dynamic_refcounted_sharedptr_cast<RSAKeyExchange::RSAParams> (params);
                     if (rsaParams.Get () != 0) {
@@ -436,6 +1044,7 @@ namespace thekogans {
                             params->GetType ().c_str ());
                     }
                 }
+            #endif // defined (THEKOGANS_CRYPTO_HAVE_RSA)
                 else {
                     THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
                         "Unknown key exchange type: %s",
@@ -458,16 +1067,12 @@ namespace thekogans {
             }
             if (keyExchange.Get () != 0) {
                 keyExchangeMap.erase (it);
+                IndexEntryDropped (keyExchangeId, ENTRY_KEY_EXCHANGE);
             }
             else if (recursive) {
-                for (KeyRingMap::const_iterator
-                        it = subringMap.begin (),
-                        end = subringMap.end (); it != end; ++it) {
-                    keyExchange =
-                        it->second->GetKeyExchange (keyExchangeId, recursive);
-                    if (keyExchange.Get () != 0) {
-                        break;
-                    }
+                KeyRing *owner = FindOwner (keyExchangeId, ENTRY_KEY_EXCHANGE);
+                if (owner != 0) {
+                    keyExchange = owner->GetKeyExchange (keyExchangeId, false);
                 }
             }
             return keyExchange;
@@ -476,19 +1081,14 @@ namespace thekogans {
         Params::SharedPtr KeyRing::GetAuthenticatorParams (
                 const ID &paramsId,
                 bool recursive) const {
-            ParamsMap::const_iterator it = authenticatorParamsMap.find (paramsId);
-            if (it != authenticatorParamsMap.end ()) {
+            ParamsMap::const_iterator it = sharedEntries->authenticatorParamsMap.find (paramsId);
+            if (it != sharedEntries->authenticatorParamsMap.end ()) {
                 return it->second;
             }
             if (recursive) {
-                for (KeyRingMap::const_iterator
-                        it = subringMap.begin (),
-                        end = subringMap.end (); it != end; ++it) {
-                    Params::SharedPtr params =
-                        it->second->GetAuthenticatorParams (paramsId, recursive);
-                    if (params.Get () != 0) {
-                        return params;
-                    }
+                KeyRing *owner = FindOwner (paramsId, ENTRY_AUTHENTICATOR_PARAMS);
+                if (owner != 0) {
+                    return owner->GetAuthenticatorParams (paramsId, false);
                 }
             }
             return Params::SharedPtr ();
@@ -498,8 +1098,8 @@ namespace thekogans {
                 const EqualityTest<Params> &equalityTest,
                 bool recursive) const {
             for (ParamsMap::const_iterator
-                    it = authenticatorParamsMap.begin (),
-                    end = authenticatorParamsMap.end (); it != end; ++it) {
+                    it = sharedEntries->authenticatorParamsMap.begin (),
+                    end = sharedEntries->authenticatorParamsMap.end (); it != end; ++it) {
                 if (equalityTest (*it->second)) {
                     return it->second;
                 }
@@ -518,11 +1118,40 @@ namespace thekogans {
             return Params::SharedPtr ();
         }
 
+        Params::SharedPtr KeyRing::GetAuthenticatorParams (
+                const AttributeQuery &query,
+                bool recursive) const {
+            ID id;
+            KeyRing *owner = FindAttribute (query, ENTRY_AUTHENTICATOR_PARAMS, recursive, id);
+            return owner != 0 ? owner->GetAuthenticatorParams (id, false) : Params::SharedPtr ();
+        }
+
+        void KeyRing::GetAuthenticatorParams (
+                std::vector<Params::SharedPtr> &params,
+                bool recursive) const {
+            for (ParamsMap::const_iterator
+                    it = sharedEntries->authenticatorParamsMap.begin (),
+                    end = sharedEntries->authenticatorParamsMap.end (); it != end; ++it) {
+                params.push_back (it->second);
+            }
+            if (recursive) {
+                for (KeyRingMap::const_iterator
+                        it = subringMap.begin (),
+                        end = subringMap.end (); it != end; ++it) {
+                    it->second->GetAuthenticatorParams (params, recursive);
+                }
+            }
+        }
+
         bool KeyRing::AddAuthenticatorParams (Params::SharedPtr params) {
             if (params.Get () != 0 && cipherSuite.VerifyAuthenticatorParams (*params)) {
+                UnshareEntries ();
                 std::pair<ParamsMap::iterator, bool> result =
-                    authenticatorParamsMap.insert (
+                    sharedEntries->authenticatorParamsMap.insert (
                         ParamsMap::value_type (params->GetId (), params));
+                if (result.second) {
+                    IndexEntryAdded (params->GetId (), ENTRY_AUTHENTICATOR_PARAMS);
+                }
                 return result.second;
             }
             else {
@@ -534,25 +1163,24 @@ namespace thekogans {
         bool KeyRing::DropAuthenticatorParams (
                 const ID &paramsId,
                 bool recursive) {
-            ParamsMap::iterator it = authenticatorParamsMap.find (paramsId);
-            if (it != authenticatorParamsMap.end ()) {
-                authenticatorParamsMap.erase (it);
+            if (sharedEntries->authenticatorParamsMap.find (paramsId) != sharedEntries->authenticatorParamsMap.end ()) {
+                UnshareEntries ();
+                sharedEntries->authenticatorParamsMap.erase (paramsId);
+                IndexEntryDropped (paramsId, ENTRY_AUTHENTICATOR_PARAMS);
                 return true;
             }
             else if (recursive) {
-                for (KeyRingMap::const_iterator
-                        it = subringMap.begin (),
-                        end = subringMap.end (); it != end; ++it) {
-                    if (it->second->DropAuthenticatorParams (paramsId, recursive)) {
-                        return true;
-                    }
+                KeyRing *owner = FindOwner (paramsId, ENTRY_AUTHENTICATOR_PARAMS);
+                if (owner != 0) {
+                    return owner->DropAuthenticatorParams (paramsId, false);
                 }
             }
             return false;
         }
 
         void KeyRing::DropAllAuthenticatorParams (bool recursive) {
-            authenticatorParamsMap.clear ();
+            UnshareEntries ();
+            sharedEntries->authenticatorParamsMap.clear ();
             if (recursive) {
                 for (KeyRingMap::const_iterator
                         it = subringMap.begin (),
@@ -560,24 +1188,20 @@ namespace thekogans {
                     it->second->DropAllAuthenticatorParams (recursive);
                 }
             }
+            InvalidateIndex ();
         }
 
         AsymmetricKey::SharedPtr KeyRing::GetAuthenticatorKey (
                 const ID &keyId,
                 bool recursive) const {
-            AsymmetricKeyMap::const_iterator it = authenticatorKeyMap.find (keyId);
-            if (it != authenticatorKeyMap.end ()) {
+            AsymmetricKeyMap::const_iterator it = sharedEntries->authenticatorKeyMap.find (keyId);
+            if (it != sharedEntries->authenticatorKeyMap.end ()) {
                 return it->second;
             }
             if (recursive) {
-                for (KeyRingMap::const_iterator
-                        it = subringMap.begin (),
-                        end = subringMap.end (); it != end; ++it) {
-                    AsymmetricKey::SharedPtr key =
-                        it->second->GetAuthenticatorKey (keyId, recursive);
-                    if (key.Get () != 0) {
-                        return key;
-                    }
+                KeyRing *owner = FindOwner (keyId, ENTRY_AUTHENTICATOR_KEY);
+                if (owner != 0) {
+                    return owner->GetAuthenticatorKey (keyId, false);
                 }
             }
             return AsymmetricKey::SharedPtr ();
@@ -587,8 +1211,8 @@ namespace thekogans {
                 const EqualityTest<AsymmetricKey> &equalityTest,
                 bool recursive) const {
             for (AsymmetricKeyMap::const_iterator
-                    it = authenticatorKeyMap.begin (),
-                    end = authenticatorKeyMap.end (); it != end; ++it) {
+                    it = sharedEntries->authenticatorKeyMap.begin (),
+                    end = sharedEntries->authenticatorKeyMap.end (); it != end; ++it) {
                 if (equalityTest (*it->second)) {
                     return it->second;
                 }
@@ -607,21 +1231,42 @@ namespace thekogans {
             return AsymmetricKey::SharedPtr ();
         }
 
+        AsymmetricKey::SharedPtr KeyRing::GetAuthenticatorKey (
+                const AttributeQuery &query,
+                bool recursive) const {
+            ID id;
+            KeyRing *owner = FindAttribute (query, ENTRY_AUTHENTICATOR_KEY, recursive, id);
+            return owner != 0 ? owner->GetAuthenticatorKey (id, false) : AsymmetricKey::SharedPtr ();
+        }
+
+        void KeyRing::GetAuthenticatorKeys (
+                std::vector<AsymmetricKey::SharedPtr> &keys,
+                bool recursive) const {
+            for (AsymmetricKeyMap::const_iterator
+                    it = sharedEntries->authenticatorKeyMap.begin (),
+                    end = sharedEntries->authenticatorKeyMap.end (); it != end; ++it) {
+                keys.push_back (it->second);
+            }
+            if (recursive) {
+                for (KeyRingMap::const_iterator
+                        it = subringMap.begin (),
+                        end = subringMap.end (); it != end; ++it) {
+                    it->second->GetAuthenticatorKeys (keys, recursive);
+                }
+            }
+        }
+
         Authenticator::SharedPtr KeyRing::GetAuthenticator (
                 const ID &keyId,
                 bool recursive) {
-            AuthenticatorMap::const_iterator it = authenticatorMap.find (keyId);
-            if (it != authenticatorMap.end ()) {
-                return it->second;
+            Authenticator::SharedPtr authenticator;
+            if (authenticatorMap.Get (keyId, authenticator)) {
+                return authenticator;
             }
             AsymmetricKey::SharedPtr key = GetAuthenticatorKey (keyId, false);
             if (key.Get () != 0) {
-                Authenticator::SharedPtr authenticator =
-                    cipherSuite.GetAuthenticator (key);
-                std::pair<AuthenticatorMap::iterator, bool> result =
-                    authenticatorMap.insert (
-                        AuthenticatorMap::value_type (keyId, authenticator));
-                if (!result.second) {
+                authenticator = cipherSuite.GetAuthenticator (key);
+                if (!authenticatorMap.Add (keyId, authenticator)) {
                     THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
                         "Unable to add an Authenticator: %s.",
                         keyId.ToHexString ().c_str ());
@@ -629,14 +1274,9 @@ namespace thekogans {
                 return authenticator;
             }
             if (recursive) {
-                for (KeyRingMap::const_iterator
-                        it = subringMap.begin (),
-                        end = subringMap.end (); it != end; ++it) {
-                    Authenticator::SharedPtr authenticator =
-                        it->second->GetAuthenticator (keyId, recursive);
-                    if (authenticator.Get () != 0) {
-                        return authenticator;
-                    }
+                KeyRing *owner = FindOwner (keyId, ENTRY_AUTHENTICATOR_KEY);
+                if (owner != 0) {
+                    return owner->GetAuthenticator (keyId, false);
                 }
             }
             return Authenticator::SharedPtr ();
@@ -646,16 +1286,15 @@ namespace thekogans {
                 AsymmetricKey::SharedPtr key,
                 Authenticator::SharedPtr authenticator) {
             if (key.Get () != 0 && cipherSuite.VerifyAuthenticatorKey (*key)) {
+                UnshareEntries ();
                 std::pair<AsymmetricKeyMap::iterator, bool> result =
-                    authenticatorKeyMap.insert (
+                    sharedEntries->authenticatorKeyMap.insert (
                         AsymmetricKeyMap::value_type (key->GetId (), key));
+                if (result.second) {
+                    IndexEntryAdded (key->GetId (), ENTRY_AUTHENTICATOR_KEY);
+                }
                 if (result.second && authenticator.Get () != 0) {
-                    std::pair<AuthenticatorMap::iterator, bool> result =
-                        authenticatorMap.insert (
-                            AuthenticatorMap::value_type (
-                                key->GetId (),
-                                authenticator));
-                    if (!result.second) {
+                    if (!authenticatorMap.Add (key->GetId (), authenticator)) {
                         THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
                             "Unable to add an Authenticator: %s.",
                             key->GetId ().ToHexString ().c_str ());
@@ -672,30 +1311,26 @@ namespace thekogans {
         bool KeyRing::DropAuthenticatorKey (
                 const ID &keyId,
                 bool recursive) {
-            AsymmetricKeyMap::iterator it = authenticatorKeyMap.find (keyId);
-            if (it != authenticatorKeyMap.end ()) {
-                authenticatorKeyMap.erase (it);
-                AuthenticatorMap::iterator it = authenticatorMap.find (keyId);
-                if (it != authenticatorMap.end ()) {
-                    authenticatorMap.erase (it);
-                }
+            if (sharedEntries->authenticatorKeyMap.find (keyId) != sharedEntries->authenticatorKeyMap.end ()) {
+                UnshareEntries ();
+                sharedEntries->authenticatorKeyMap.erase (keyId);
+                IndexEntryDropped (keyId, ENTRY_AUTHENTICATOR_KEY);
+                authenticatorMap.Erase (keyId);
                 return true;
             }
             else if (recursive) {
-                for (KeyRingMap::const_iterator
-                        it = subringMap.begin (),
-                        end = subringMap.end (); it != end; ++it) {
-                    if (it->second->DropAuthenticatorKey (keyId, recursive)) {
-                        return true;
-                    }
+                KeyRing *owner = FindOwner (keyId, ENTRY_AUTHENTICATOR_KEY);
+                if (owner != 0) {
+                    return owner->DropAuthenticatorKey (keyId, false);
                 }
             }
             return false;
         }
 
         void KeyRing::DropAllAuthenticatorKeys (bool recursive) {
-            authenticatorKeyMap.clear ();
-            authenticatorMap.clear ();
+            UnshareEntries ();
+            sharedEntries->authenticatorKeyMap.clear ();
+            authenticatorMap.Clear ();
             if (recursive) {
                 for (KeyRingMap::const_iterator
                         it = subringMap.begin (),
@@ -703,6 +1338,7 @@ namespace thekogans {
                     it->second->DropAllAuthenticatorKeys (recursive);
                 }
             }
+            InvalidateIndex ();
         }
 
         SymmetricKey::SharedPtr KeyRing::GetCipherKey (
@@ -712,14 +1348,16 @@ namespace thekogans {
             if (it != cipherKeyMap.end ()) {
                 return it->second;
             }
+            if (!cipherKeyStore.IsEmpty ()) {
+                SymmetricKey::SharedPtr key = cipherKeyStore.Get (keyId);
+                if (key.Get () != 0) {
+                    return key;
+                }
+            }
             if (recursive) {
-                for (KeyRingMap::const_iterator
-                        it = subringMap.begin (),
-                        end = subringMap.end (); it != end; ++it) {
-                    SymmetricKey::SharedPtr key = it->second->GetCipherKey (keyId, recursive);
-                    if (key.Get () != 0) {
-                        return key;
-                    }
+                KeyRing *owner = FindOwner (keyId, ENTRY_CIPHER_KEY);
+                if (owner != 0) {
+                    return owner->GetCipherKey (keyId, false);
                 }
             }
             return SymmetricKey::SharedPtr ();
@@ -735,6 +1373,12 @@ namespace thekogans {
                     return it->second;
                 }
             }
+            for (std::size_t i = 0, count = cipherKeyStore.GetCount (); i < count; ++i) {
+                SymmetricKey::SharedPtr key = cipherKeyStore.GetAt (i);
+                if (equalityTest (*key)) {
+                    return key;
+                }
+            }
             if (recursive) {
                 for (KeyRingMap::const_iterator
                         it = subringMap.begin (),
@@ -748,21 +1392,59 @@ namespace thekogans {
             return SymmetricKey::SharedPtr ();
         }
 
+        SymmetricKey::SharedPtr KeyRing::GetCipherKey (
+                const AttributeQuery &query,
+                bool recursive) const {
+            ID id;
+            KeyRing *owner = FindAttribute (query, ENTRY_CIPHER_KEY, recursive, id);
+            return owner != 0 ? owner->GetCipherKey (id, false) : SymmetricKey::SharedPtr ();
+        }
+
+        void KeyRing::GetCipherKeys (
+                std::vector<SymmetricKey::SharedPtr> &keys,
+                bool recursive) const {
+            for (SymmetricKeyMap::const_iterator
+                    it = cipherKeyMap.begin (),
+                    end = cipherKeyMap.end (); it != end; ++it) {
+                keys.push_back (it->second);
+            }
+            for (std::size_t i = 0, count = cipherKeyStore.GetCount (); i < count; ++i) {
+                keys.push_back (cipherKeyStore.GetAt (i));
+            }
+            if (recursive) {
+                for (KeyRingMap::const_iterator
+                        it = subringMap.begin (),
+                        end = subringMap.end (); it != end; ++it) {
+                    it->second->GetCipherKeys (keys, recursive);
+                }
+            }
+        }
+
+        void KeyRing::GetCipherKeyTable (
+                std::vector<ID> &keyIds,
+                bool recursive) const {
+            std::vector<SymmetricKey::SharedPtr> keys;
+            GetCipherKeys (keys, recursive);
+            keyIds.clear ();
+            keyIds.reserve (keys.size ());
+            for (std::size_t i = 0, count = keys.size (); i < count; ++i) {
+                keyIds.push_back (keys[i]->GetId ());
+            }
+            std::sort (keyIds.begin (), keyIds.end ());
+        }
+
         Cipher::SharedPtr KeyRing::GetCipher (
                 const ID &keyId,
                 bool recursive) {
-            CipherMap::const_iterator it = cipherMap.find (keyId);
-            if (it != cipherMap.end ()) {
-                return it->second;
+            Cipher::SharedPtr cipher;
+            if (cipherMap.Get (keyId, cipher)) {
+                return cipher;
             }
             SymmetricKey::SharedPtr key = GetCipherKey (keyId, false);
             if (key.Get () != 0) {
-                Cipher::SharedPtr cipher =
-                    cipherSuite.GetCipher (key);
-                std::pair<CipherMap::iterator, bool> result =
-                    cipherMap.insert (
-                        CipherMap::value_type (keyId, cipher));
-                if (!result.second) {
+                cipher = cipherSuite.GetCipher (key);
+                Metrics::SetLabels (keyId, GetId (), cipherSuite.GetCode ());
+                if (!cipherMap.Add (keyId, cipher)) {
                     THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
                         "Unable to add a Cipher: %s.",
                         keyId.ToHexString ().c_str ());
@@ -770,43 +1452,69 @@ namespace thekogans {
                 return cipher;
             }
             if (recursive) {
-                for (KeyRingMap::const_iterator
-                        it = subringMap.begin (),
-                        end = subringMap.end (); it != end; ++it) {
-                    Cipher::SharedPtr cipher =
-                        it->second->GetCipher (keyId, recursive);
-                    if (cipher.Get () != 0) {
-                        return cipher;
-                    }
+                KeyRing *owner = FindOwner (keyId, ENTRY_CIPHER_KEY);
+                if (owner != 0) {
+                    return owner->GetCipher (keyId, false);
                 }
             }
             return Cipher::SharedPtr ();
         }
 
+        CipherPool::SharedPtr KeyRing::GetCipherPool (
+                const ID &keyId,
+                bool recursive) {
+            CipherPool::SharedPtr cipherPool;
+            if (cipherPoolMap.Get (keyId, cipherPool)) {
+                return cipherPool;
+            }
+            SymmetricKey::SharedPtr key = GetCipherKey (keyId, false);
+            if (key.Get () != 0) {
+                if (!cipherSuite.VerifyCipherKey (*key)) {
+                    THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                        THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+                }
+                cipherPool = CipherPool::SharedPtr (
+                    new CipherPool (
+                        key,
+                        cipherSuite.GetOpenSSLCipher (),
+                        cipherSuite.GetOpenSSLMessageDigest ()));
+                if (!cipherPoolMap.Add (keyId, cipherPool)) {
+                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                        "Unable to add a CipherPool: %s.",
+                        keyId.ToHexString ().c_str ());
+                }
+                return cipherPool;
+            }
+            if (recursive) {
+                KeyRing *owner = FindOwner (keyId, ENTRY_CIPHER_KEY);
+                if (owner != 0) {
+                    return owner->GetCipherPool (keyId, false);
+                }
+            }
+            return CipherPool::SharedPtr ();
+        }
+
         Cipher::SharedPtr KeyRing::GetRandomCipher () {
             Cipher::SharedPtr cipher;
-            if (!cipherKeyMap.empty ()) {
-                SymmetricKeyMap::const_iterator keyIt = cipherKeyMap.begin ();
-                if (cipherKeyMap.size () > 1) {
-                    std::advance (
-                        keyIt,
-                        util::GlobalRandomSource::Instance ().Getui32 () % cipherKeyMap.size ());
-                }
-                CipherMap::iterator cipherIt = cipherMap.find (keyIt->second->GetId ());
-                if (cipherIt == cipherMap.end ()) {
-                    cipher = cipherSuite.GetCipher (keyIt->second);
-                    std::pair<CipherMap::iterator, bool> result =
-                        cipherMap.insert (
-                            CipherMap::value_type (keyIt->second->GetId (), cipher));
-                    if (!result.second) {
+            std::size_t keyCount = cipherKeyMap.size () + cipherKeyStore.GetCount ();
+            if (keyCount != 0) {
+                // The compact keys follow the map keys.
+                std::size_t index = GetRandomIndex (keyCount);
+                ID keyId = index < cipherKeyMap.size () ?
+                    (cipherKeyMap.begin () + index)->first :
+                    cipherKeyStore.GetId (index - cipherKeyMap.size ());
+                if (!cipherMap.Get (keyId, cipher)) {
+                    cipher = cipherSuite.GetCipher (
+                        index < cipherKeyMap.size () ?
+                            (cipherKeyMap.begin () + index)->second :
+                            cipherKeyStore.GetAt (index - cipherKeyMap.size ()));
+                    Metrics::SetLabels (keyId, GetId (), cipherSuite.GetCode ());
+                    if (!cipherMap.Add (keyId, cipher)) {
                         THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
                             "Unable to add a Cipher: %s.",
-                            keyIt->second->GetId ().ToHexString ().c_str ());
+                            keyId.ToHexString ().c_str ());
                     }
                 }
-                else {
-                    cipher = cipherIt->second;
-                }
             }
             return cipher;
         }
@@ -815,14 +1523,17 @@ namespace thekogans {
                 SymmetricKey::SharedPtr key,
                 Cipher::SharedPtr cipher) {
             if (key.Get () != 0 && cipherSuite.VerifyCipherKey (*key)) {
+                if (cipherKeyStore.Contains (key->GetId ())) {
+                    return false;
+                }
                 std::pair<SymmetricKeyMap::iterator, bool> result =
                     cipherKeyMap.insert (
                         SymmetricKeyMap::value_type (key->GetId (), key));
+                if (result.second) {
+                    IndexEntryAdded (key->GetId (), ENTRY_CIPHER_KEY);
+                }
                 if (result.second && cipher.Get () != 0) {
-                    std::pair<CipherMap::iterator, bool> result =
-                        cipherMap.insert (
-                            CipherMap::value_type (key->GetId (), cipher));
-                    if (!result.second) {
+                    if (!cipherMap.Add (key->GetId (), cipher)) {
                         THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
                             "Unable to add a Cipher: %s.",
                             key->GetId ().ToHexString ().c_str ());
@@ -836,25 +1547,144 @@ namespace thekogans {
             }
         }
 
+        std::size_t KeyRing::AddCipherKeys (
+                const SymmetricKey::SharedPtr *keys,
+                std::size_t keyCount,
+                bool createCiphers,
+                std::size_t workerCount) {
+            if (keyCount == 0) {
+                return 0;
+            }
+            if (keys == 0) {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+            // Validate the whole batch before touching the ring. Every
+            // key must have the same length, so look it up only once.
+            std::size_t keyLength = GetCipherKeyLength (cipherSuite.GetOpenSSLCipher ());
+            std::vector<SymmetricKey::SharedPtr> newKeys;
+            newKeys.reserve (keyCount);
+            for (std::size_t i = 0; i < keyCount; ++i) {
+                if (keys[i].Get () == 0 || keys[i]->GetKeyLength () != keyLength) {
+                    THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                        THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+                }
+                if (cipherKeyMap.find (keys[i]->GetId ()) == cipherKeyMap.end () &&
+                        !cipherKeyStore.Contains (keys[i]->GetId ())) {
+                    newKeys.push_back (keys[i]);
+                }
+            }
+            // Create the Ciphers before adding the keys, so that
+            // a failure leaves the ring untouched.
+            std::vector<Cipher::SharedPtr> ciphers;
+            if (createCiphers) {
+                CreateKeyObjects (cipherSuite, newKeys, workerCount, &ciphers, 0);
+                cipherMap.reserve (cipherMap.size () + newKeys.size ());
+            }
+            cipherKeyMap.reserve (cipherKeyMap.size () + newKeys.size ());
+            std::size_t added = 0;
+            for (std::size_t i = 0, count = newKeys.size (); i < count; ++i) {
+                // The batch itself can contain duplicates.
+                if (cipherKeyMap.insert (
+                        SymmetricKeyMap::value_type (newKeys[i]->GetId (), newKeys[i])).second) {
+                    IndexEntryAdded (newKeys[i]->GetId (), ENTRY_CIPHER_KEY);
+                    if (createCiphers) {
+                        cipherMap.Add (newKeys[i]->GetId (), ciphers[i]);
+                    }
+                    ++added;
+                }
+            }
+            return added;
+        }
+
+        std::size_t KeyRing::AddCipherKeyMaterial (
+                const void *keyMaterial,
+                std::size_t keyMaterialLength,
+                std::vector<ID> *keyIds,
+                bool createCiphers,
+                std::size_t workerCount) {
+            std::size_t keyLength = GetCipherKeyLength (cipherSuite.GetOpenSSLCipher ());
+            if ((keyMaterial == 0 && keyMaterialLength != 0) ||
+                    keyLength == 0 || keyMaterialLength % keyLength != 0) {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+            std::size_t keyCount = keyMaterialLength / keyLength;
+            std::vector<SymmetricKey::SharedPtr> keys;
+            keys.reserve (keyCount);
+            const util::ui8 *key = (const util::ui8 *)keyMaterial;
+            for (std::size_t i = 0; i < keyCount; ++i, key += keyLength) {
+                keys.push_back (SymmetricKey::SharedPtr (new SymmetricKey (key, keyLength)));
+            }
+            std::size_t added = AddCipherKeys (keys, createCiphers, workerCount);
+            if (keyIds != 0) {
+                keyIds->reserve (keyIds->size () + keys.size ());
+                for (std::size_t i = 0; i < keyCount; ++i) {
+                    keyIds->push_back (keys[i]->GetId ());
+                }
+            }
+            return added;
+        }
+
+        std::size_t KeyRing::GetCipherKeyMaterialLength (bool recursive) const {
+            std::vector<SymmetricKey::SharedPtr> keys;
+            GetCipherKeys (keys, recursive);
+            std::size_t length = 0;
+            for (std::size_t i = 0, count = keys.size (); i < count; ++i) {
+                length += keys[i]->GetKeyLength ();
+            }
+            return length;
+        }
+
+        std::size_t KeyRing::ExportCipherKeyMaterial (
+                util::ui8 *keyMaterial,
+                std::size_t keyMaterialLength,
+                std::vector<ID> *keyIds,
+                bool recursive) const {
+            std::vector<SymmetricKey::SharedPtr> keys;
+            GetCipherKeys (keys, recursive);
+            std::size_t length = 0;
+            for (std::size_t i = 0, count = keys.size (); i < count; ++i) {
+                length += keys[i]->GetKeyLength ();
+            }
+            if (keyMaterial == 0 || keyMaterialLength < length) {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+            if (keyIds != 0) {
+                keyIds->reserve (keyIds->size () + keys.size ());
+            }
+            util::ui8 *key = keyMaterial;
+            for (std::size_t i = 0, count = keys.size (); i < count; ++i) {
+                memcpy (key, keys[i]->Get ().GetReadPtr (), keys[i]->GetKeyLength ());
+                key += keys[i]->GetKeyLength ();
+                if (keyIds != 0) {
+                    keyIds->push_back (keys[i]->GetId ());
+                }
+            }
+            return length;
+        }
+
         bool KeyRing::DropCipherKey (
                 const ID &keyId,
                 bool recursive) {
             SymmetricKeyMap::iterator it = cipherKeyMap.find (keyId);
-            if (it != cipherKeyMap.end ()) {
-                cipherKeyMap.erase (it);
-                CipherMap::iterator it = cipherMap.find (keyId);
-                if (it != cipherMap.end ()) {
-                    cipherMap.erase (it);
+            if (it != cipherKeyMap.end () || cipherKeyStore.Contains (keyId)) {
+                if (it != cipherKeyMap.end ()) {
+                    cipherKeyMap.erase (it);
+                }
+                else {
+                    cipherKeyStore.Drop (keyId);
                 }
+                IndexEntryDropped (keyId, ENTRY_CIPHER_KEY);
+                cipherMap.Erase (keyId);
+                cipherPoolMap.Erase (keyId);
                 return true;
             }
             else if (recursive) {
-                for (KeyRingMap::const_iterator
-                        it = subringMap.begin (),
-                        end = subringMap.end (); it != end; ++it) {
-                    if (it->second->DropCipherKey (keyId, recursive)) {
-                        return true;
-                    }
+                KeyRing *owner = FindOwner (keyId, ENTRY_CIPHER_KEY);
+                if (owner != 0) {
+                    return owner->DropCipherKey (keyId, false);
                 }
             }
             return false;
@@ -862,7 +1692,9 @@ namespace thekogans {
 
         void KeyRing::DropAllCipherKeys (bool recursive) {
             cipherKeyMap.clear ();
-            cipherMap.clear ();
+            cipherKeyStore.Clear ();
+            cipherMap.Clear ();
+            cipherPoolMap.Clear ();
             if (recursive) {
                 for (KeyRingMap::const_iterator
                         it = subringMap.begin (),
@@ -870,6 +1702,7 @@ namespace thekogans {
                     it->second->DropAllCipherKeys (recursive);
                 }
             }
+            InvalidateIndex ();
         }
 
         SymmetricKey::SharedPtr KeyRing::GetMACKey (
@@ -879,15 +1712,16 @@ namespace thekogans {
             if (it != macKeyMap.end ()) {
                 return it->second;
             }
+            if (!macKeyStore.IsEmpty ()) {
+                SymmetricKey::SharedPtr key = macKeyStore.Get (keyId);
+                if (key.Get () != 0) {
+                    return key;
+                }
+            }
             if (recursive) {
-                for (KeyRingMap::const_iterator
-                        it = subringMap.begin (),
-                        end = subringMap.end (); it != end; ++it) {
-                    SymmetricKey::SharedPtr key =
-                        it->second->GetMACKey (keyId, recursive);
-                    if (key.Get () != 0) {
-                        return key;
-                    }
+                KeyRing *owner = FindOwner (keyId, ENTRY_MAC_KEY);
+                if (owner != 0) {
+                    return owner->GetMACKey (keyId, false);
                 }
             }
             return SymmetricKey::SharedPtr ();
@@ -903,6 +1737,12 @@ namespace thekogans {
                     return it->second;
                 }
             }
+            for (std::size_t i = 0, count = macKeyStore.GetCount (); i < count; ++i) {
+                SymmetricKey::SharedPtr key = macKeyStore.GetAt (i);
+                if (equalityTest (*key)) {
+                    return key;
+                }
+            }
             if (recursive) {
                 for (KeyRingMap::const_iterator
                         it = subringMap.begin (),
@@ -917,20 +1757,50 @@ namespace thekogans {
             return SymmetricKey::SharedPtr ();
         }
 
+        SymmetricKey::SharedPtr KeyRing::GetMACKey (
+                const AttributeQuery &query,
+                bool recursive) const {
+            ID id;
+            KeyRing *owner = FindAttribute (query, ENTRY_MAC_KEY, recursive, id);
+            return owner != 0 ? owner->GetMACKey (id, false) : SymmetricKey::SharedPtr ();
+        }
+
+        void KeyRing::GetMACKeys (
+                std::vector<SymmetricKey::SharedPtr> &keys,
+                bool recursive) const {
+            for (SymmetricKeyMap::const_iterator
+                    it = macKeyMap.begin (),
+                    end = macKeyMap.end (); it != end; ++it) {
+                keys.push_back (it->second);
+            }
+            for (std::size_t i = 0, count = macKeyStore.GetCount (); i < count; ++i) {
+                keys.push_back (macKeyStore.GetAt (i));
+            }
+            if (recursive) {
+                for (KeyRingMap::const_iterator
+                        it = subringMap.begin (),
+                        end = subringMap.end (); it != end; ++it) {
+                    it->second->GetMACKeys (keys, recursive);
+                }
+            }
+        }
+
         MAC::SharedPtr KeyRing::GetMAC (
                 const ID &keyId,
-                bool recursive) {
-            MACMap::const_iterator it = macMap.find (keyId);
-            if (it != macMap.end ()) {
-                return it->second;
+                bool recursive,
+                MAC::Type type) {
+            MAC::SharedPtr mac;
+            if (macMap.Get (keyId, mac)) {
+                if (mac->GetType () == type) {
+                    return mac;
+                }
+                macMap.Erase (keyId);
             }
             SymmetricKey::SharedPtr key = GetMACKey (keyId, false);
             if (key.Get () != 0) {
-                MAC::SharedPtr mac = cipherSuite.GetHMAC (key);
-                std::pair<MACMap::iterator, bool> result =
-                    macMap.insert (
-                        MACMap::value_type (keyId, mac));
-                if (!result.second) {
+                mac = cipherSuite.GetMAC (key, type);
+                Metrics::SetLabels (keyId, GetId (), cipherSuite.GetCode ());
+                if (!macMap.Add (keyId, mac)) {
                     THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
                         "Unable to add a MAC: %s.",
                         keyId.ToHexString ().c_str ());
@@ -938,30 +1808,59 @@ namespace thekogans {
                 return mac;
             }
             if (recursive) {
-                for (KeyRingMap::const_iterator
-                        it = subringMap.begin (),
-                        end = subringMap.end (); it != end; ++it) {
-                    MAC::SharedPtr mac =
-                        it->second->GetMAC (keyId, recursive);
-                    if (mac.Get () != 0) {
-                        return mac;
-                    }
+                KeyRing *owner = FindOwner (keyId, ENTRY_MAC_KEY);
+                if (owner != 0) {
+                    return owner->GetMAC (keyId, false, type);
                 }
             }
             return MAC::SharedPtr ();
         }
 
+        MAC::SharedPtr KeyRing::GetRandomMAC (MAC::Type type) {
+            MAC::SharedPtr mac;
+            std::size_t keyCount = macKeyMap.size () + macKeyStore.GetCount ();
+            if (keyCount != 0) {
+                // The compact keys follow the map keys.
+                std::size_t index = GetRandomIndex (keyCount);
+                ID keyId = index < macKeyMap.size () ?
+                    (macKeyMap.begin () + index)->first :
+                    macKeyStore.GetId (index - macKeyMap.size ());
+                if (macMap.Get (keyId, mac) && mac->GetType () != type) {
+                    macMap.Erase (keyId);
+                    mac = MAC::SharedPtr ();
+                }
+                if (mac.Get () == 0) {
+                    mac = cipherSuite.GetMAC (
+                        index < macKeyMap.size () ?
+                            (macKeyMap.begin () + index)->second :
+                            macKeyStore.GetAt (index - macKeyMap.size ()),
+                        type);
+                    Metrics::SetLabels (keyId, GetId (), cipherSuite.GetCode ());
+                    if (!macMap.Add (keyId, mac)) {
+                        THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                            "Unable to add a MAC: %s.",
+                            keyId.ToHexString ().c_str ());
+                    }
+                }
+            }
+            return mac;
+        }
+
         bool KeyRing::AddMACKey (
                 SymmetricKey::SharedPtr key,
                 MAC::SharedPtr mac) {
             if (key.Get () != 0 && cipherSuite.VerifyMACKey (*key, true)) {
+                if (macKeyStore.Contains (key->GetId ())) {
+                    return false;
+                }
                 std::pair<SymmetricKeyMap::iterator, bool> result =
                     macKeyMap.insert (
                         SymmetricKeyMap::value_type (key->GetId (), key));
+                if (result.second) {
+                    IndexEntryAdded (key->GetId (), ENTRY_MAC_KEY);
+                }
                 if (result.second && mac.Get () != 0) {
-                    std::pair<MACMap::iterator, bool> result =
-                        macMap.insert (MACMap::value_type (key->GetId (), mac));
-                    if (!result.second) {
+                    if (!macMap.Add (key->GetId (), mac)) {
                         THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
                             "Unable to add a MAC: %s.",
                             key->GetId ().ToHexString ().c_str ());
@@ -975,25 +1874,69 @@ namespace thekogans {
             }
         }
 
+        std::size_t KeyRing::AddMACKeys (
+                const SymmetricKey::SharedPtr *keys,
+                std::size_t keyCount,
+                bool createMACs,
+                std::size_t workerCount) {
+            if (keyCount == 0) {
+                return 0;
+            }
+            if (keys == 0) {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+            std::vector<SymmetricKey::SharedPtr> newKeys;
+            newKeys.reserve (keyCount);
+            for (std::size_t i = 0; i < keyCount; ++i) {
+                if (keys[i].Get () == 0 || !cipherSuite.VerifyMACKey (*keys[i], true)) {
+                    THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                        THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+                }
+                if (macKeyMap.find (keys[i]->GetId ()) == macKeyMap.end () &&
+                        !macKeyStore.Contains (keys[i]->GetId ())) {
+                    newKeys.push_back (keys[i]);
+                }
+            }
+            std::vector<MAC::SharedPtr> macs;
+            if (createMACs) {
+                CreateKeyObjects (cipherSuite, newKeys, workerCount, 0, &macs);
+                macMap.reserve (macMap.size () + newKeys.size ());
+            }
+            macKeyMap.reserve (macKeyMap.size () + newKeys.size ());
+            std::size_t added = 0;
+            for (std::size_t i = 0, count = newKeys.size (); i < count; ++i) {
+                if (macKeyMap.insert (
+                        SymmetricKeyMap::value_type (newKeys[i]->GetId (), newKeys[i])).second) {
+                    IndexEntryAdded (newKeys[i]->GetId (), ENTRY_MAC_KEY);
+                    if (createMACs) {
+                        macMap.Add (newKeys[i]->GetId (), macs[i]);
+                    }
+                    ++added;
+                }
+            }
+            return added;
+        }
+
         bool KeyRing::DropMACKey (
                 const ID &keyId,
                 bool recursive) {
             SymmetricKeyMap::iterator it = macKeyMap.find (keyId);
-            if (it != macKeyMap.end ()) {
-                macKeyMap.erase (it);
-                MACMap::iterator it = macMap.find (keyId);
-                if (it != macMap.end ()) {
-                    macMap.erase (it);
+            if (it != macKeyMap.end () || macKeyStore.Contains (keyId)) {
+                if (it != macKeyMap.end ()) {
+                    macKeyMap.erase (it);
+                }
+                else {
+                    macKeyStore.Drop (keyId);
                 }
+                IndexEntryDropped (keyId, ENTRY_MAC_KEY);
+                macMap.Erase (keyId);
                 return true;
             }
             else if (recursive) {
-                for (KeyRingMap::const_iterator
-                        it = subringMap.begin (),
-                        end = subringMap.end (); it != end; ++it) {
-                    if (it->second->DropMACKey (keyId, recursive)) {
-                        return true;
-                    }
+                KeyRing *owner = FindOwner (keyId, ENTRY_MAC_KEY);
+                if (owner != 0) {
+                    return owner->DropMACKey (keyId, false);
                 }
             }
             return false;
@@ -1001,7 +1944,8 @@ namespace thekogans {
 
         void KeyRing::DropAllMACKeys (bool recursive) {
             macKeyMap.clear ();
-            macMap.clear ();
+            macKeyStore.Clear ();
+            macMap.Clear ();
             if (recursive) {
                 for (KeyRingMap::const_iterator
                         it = subringMap.begin (),
@@ -1009,6 +1953,26 @@ namespace thekogans {
                     it->second->DropAllMACKeys (recursive);
                 }
             }
+            InvalidateIndex ();
+        }
+
+        std::size_t KeyRing::CompactKeys (bool recursive) {
+            // The index (and the Cipher/MAC caches) are keyed by id,
+            // and the keys stay in the same ring, so they stay valid.
+            std::size_t compacted =
+                CompactKeyMap (cipherKeyMap, cipherKeyStore) +
+                CompactKeyMap (macKeyMap, macKeyStore);
+            if (compacted > 0) {
+                InvalidateSize ();
+            }
+            if (recursive) {
+                for (KeyRingMap::const_iterator
+                        it = subringMap.begin (),
+                        end = subringMap.end (); it != end; ++it) {
+                    compacted += it->second->CompactKeys (recursive);
+                }
+            }
+            return compacted;
         }
 
         Serializable::SharedPtr KeyRing::GetUserData (
@@ -1019,14 +1983,9 @@ namespace thekogans {
                 return it->second;
             }
             if (recursive) {
-                for (KeyRingMap::const_iterator
-                        it = subringMap.begin (),
-                        end = subringMap.end (); it != end; ++it) {
-                    Serializable::SharedPtr userData =
-                        it->second->GetUserData (id, recursive);
-                    if (userData.Get () != 0) {
-                        return userData;
-                    }
+                KeyRing *owner = FindOwner (id, ENTRY_USER_DATA);
+                if (owner != 0) {
+                    return owner->GetUserData (id, false);
                 }
             }
             return Serializable::SharedPtr ();
@@ -1056,11 +2015,39 @@ namespace thekogans {
             return Serializable::SharedPtr ();
         }
 
+        Serializable::SharedPtr KeyRing::GetUserData (
+                const AttributeQuery &query,
+                bool recursive) const {
+            ID id;
+            KeyRing *owner = FindAttribute (query, ENTRY_USER_DATA, recursive, id);
+            return owner != 0 ? owner->GetUserData (id, false) : Serializable::SharedPtr ();
+        }
+
+        void KeyRing::GetUserData (
+                std::vector<Serializable::SharedPtr> &userData,
+                bool recursive) const {
+            for (SerializableMap::const_iterator
+                    it = userDataMap.begin (),
+                    end = userDataMap.end (); it != end; ++it) {
+                userData.push_back (it->second);
+            }
+            if (recursive) {
+                for (KeyRingMap::const_iterator
+                        it = subringMap.begin (),
+                        end = subringMap.end (); it != end; ++it) {
+                    it->second->GetUserData (userData, recursive);
+                }
+            }
+        }
+
         bool KeyRing::AddUserData (Serializable::SharedPtr userData) {
             if (userData.Get () != 0) {
                 std::pair<SerializableMap::iterator, bool> result =
                     userDataMap.insert (
                         SerializableMap::value_type (userData->GetId (), userData));
+                if (result.second) {
+                    IndexEntryAdded (userData->GetId (), ENTRY_USER_DATA);
+                }
                 return result.second;
             }
             else {
@@ -1075,15 +2062,13 @@ namespace thekogans {
             SerializableMap::iterator it = userDataMap.find (id);
             if (it != userDataMap.end ()) {
                 userDataMap.erase (it);
+                IndexEntryDropped (id, ENTRY_USER_DATA);
                 return true;
             }
             else if (recursive) {
-                for (KeyRingMap::const_iterator
-                        it = subringMap.begin (),
-                        end = subringMap.end (); it != end; ++it) {
-                    if (it->second->DropUserData (id, recursive)) {
-                        return true;
-                    }
+                KeyRing *owner = FindOwner (id, ENTRY_USER_DATA);
+                if (owner != 0) {
+                    return owner->DropUserData (id, false);
                 }
             }
             return false;
@@ -1098,6 +2083,7 @@ namespace thekogans {
                     it->second->DropAllUserData (recursive);
                 }
             }
+            InvalidateIndex ();
         }
 
         KeyRing::SharedPtr KeyRing::GetSubring (
@@ -1108,13 +2094,9 @@ namespace thekogans {
                 return it->second;
             }
             if (recursive) {
-                for (KeyRingMap::const_iterator
-                        it = subringMap.begin (),
-                        end = subringMap.end (); it != end; ++it) {
-                    SharedPtr subring = it->second->GetSubring (subringId, recursive);
-                    if (subring.Get () != 0) {
-                        return subring;
-                    }
+                KeyRing *owner = FindOwner (subringId, ENTRY_SUBRING);
+                if (owner != 0) {
+                    return owner->GetSubring (subringId, false);
                 }
             }
             return SharedPtr ();
@@ -1143,11 +2125,31 @@ namespace thekogans {
             return SharedPtr ();
         }
 
+        KeyRing::SharedPtr KeyRing::GetSubring (
+                const AttributeQuery &query,
+                bool recursive) const {
+            ID id;
+            KeyRing *owner = FindAttribute (query, ENTRY_SUBRING, recursive, id);
+            return owner != 0 ? owner->GetSubring (id, false) : KeyRing::SharedPtr ();
+        }
+
         bool KeyRing::AddSubring (SharedPtr subring) {
-            if (subring.Get () != 0) {
+            // A ring can only have one parent, and cycles are not allowed.
+            if (subring.Get () != 0 && subring.Get () != this &&
+                    subring->index.parent == 0 && !subring->IsAncestorOf (this)) {
                 std::pair<KeyRingMap::iterator, bool> result =
                     subringMap.insert (
                         KeyRingMap::value_type (subring->GetId (), subring));
+                if (result.second) {
+                    subring->index.parent = this;
+                    subring->index.entries.clear ();
+                    subring->index.valid = false;
+                    IndexEntryAdded (subring->GetId (), ENTRY_SUBRING);
+                    KeyRing *root = GetRoot ();
+                    if (root->index.valid) {
+                        subring->IndexTree (root->index.entries, true);
+                    }
+                }
                 return result.second;
             }
             else {
@@ -1161,90 +2163,653 @@ namespace thekogans {
                 bool recursive) {
             KeyRingMap::iterator it = subringMap.find (subringId);
             if (it != subringMap.end ()) {
+                KeyRing *root = GetRoot ();
+                if (root->index.valid) {
+                    it->second->IndexTree (root->index.entries, false);
+                }
+                IndexEntryDropped (subringId, ENTRY_SUBRING);
+                it->second->index.parent = 0;
+                it->second->index.version = ++treeVersion;
                 subringMap.erase (it);
                 return true;
             }
             else if (recursive) {
-                for (KeyRingMap::const_iterator
-                        it = subringMap.begin (),
-                        end = subringMap.end (); it != end; ++it) {
-                    if (it->second->DropSubring (subringId, recursive)) {
-                        return true;
-                    }
+                KeyRing *owner = FindOwner (subringId, ENTRY_SUBRING);
+                if (owner != 0) {
+                    return owner->DropSubring (subringId, false);
                 }
             }
             return false;
         }
 
         void KeyRing::DropAllSubrings () {
+            DetachSubrings ();
             subringMap.clear ();
+            InvalidateIndex ();
         }
 
         void KeyRing::Clear () {
-            keyExchangeParamsMap.clear ();
-            keyExchangeKeyMap.clear ();
+            sharedEntries = SharedEntries::SharedPtr (new SharedEntries (GetId ()));
             keyExchangeMap.clear ();
-            authenticatorParamsMap.clear ();
-            authenticatorKeyMap.clear ();
-            authenticatorMap.clear ();
+            authenticatorMap.Clear ();
             cipherKeyMap.clear ();
-            cipherMap.clear ();
+            cipherKeyStore.Clear ();
+            cipherMap.Clear ();
+            cipherPoolMap.Clear ();
             macKeyMap.clear ();
-            macMap.clear ();
+            macKeyStore.Clear ();
+            macMap.Clear ();
             userDataMap.clear ();
+            DetachSubrings ();
             subringMap.clear ();
+            InvalidateIndex ();
         }
 
-        std::size_t KeyRing::Size () const {
-            std::size_t size = Serializable::Size () + cipherSuite.Size ();
-            size += util::SizeT (keyExchangeParamsMap.size ()).Size ();
+        void KeyRing::SetMaxCachedObjects (
+                std::size_t maxCachedObjects,
+                bool recursive) {
+            authenticatorMap.SetCapacity (maxCachedObjects);
+            cipherMap.SetCapacity (maxCachedObjects);
+            cipherPoolMap.SetCapacity (maxCachedObjects);
+            macMap.SetCapacity (maxCachedObjects);
+            if (recursive) {
+                for (KeyRingMap::const_iterator
+                        it = subringMap.begin (),
+                        end = subringMap.end (); it != end; ++it) {
+                    it->second->SetMaxCachedObjects (maxCachedObjects, recursive);
+                }
+            }
+        }
+
+        IDCacheStats KeyRing::GetCacheStats (bool recursive) const {
+            IDCacheStats stats;
+            stats += authenticatorMap.GetStats ();
+            stats += cipherMap.GetStats ();
+            stats += cipherPoolMap.GetStats ();
+            stats += macMap.GetStats ();
+            if (recursive) {
+                for (KeyRingMap::const_iterator
+                        it = subringMap.begin (),
+                        end = subringMap.end (); it != end; ++it) {
+                    stats += it->second->GetCacheStats (recursive);
+                }
+            }
+            return stats;
+        }
+
+        void KeyRing::SetValidatedParamsCache (
+                ValidatedParamsCache::SharedPtr validatedParamsCache_,
+                bool recursive) {
+            validatedParamsCache = validatedParamsCache_;
+            if (recursive) {
+                for (KeyRingMap::const_iterator
+                        it = subringMap.begin (),
+                        end = subringMap.end (); it != end; ++it) {
+                    it->second->SetValidatedParamsCache (validatedParamsCache_, recursive);
+                }
+            }
+        }
+
+        void KeyRing::SetName (const std::string &name) {
+            Serializable::SetName (name);
+            InvalidateSize ();
+        }
+
+        void KeyRing::SetDescription (const std::string &description) {
+            Serializable::SetDescription (description);
+            InvalidateSize ();
+        }
+
+        KeyRing *KeyRing::GetRoot () const {
+            const KeyRing *ring = this;
+            while (ring->index.parent != 0) {
+                ring = ring->index.parent;
+            }
+            return const_cast<KeyRing *> (ring);
+        }
+
+        bool KeyRing::IsAncestorOf (const KeyRing *ring) const {
+            while (ring != 0 && ring->index.parent != 0) {
+                if (ring->index.parent == this) {
+                    return true;
+                }
+                ring = ring->index.parent;
+            }
+            return false;
+        }
+
+        KeyRing *KeyRing::FindOwner (
+                const ID &id,
+                EntryType type) const {
+            KeyRing *root = GetRoot ();
+            if (!root->index.valid) {
+                root->index.entries.clear ();
+                root->IndexTree (root->index.entries, true);
+                root->index.valid = true;
+            }
+            IDHashMap<std::vector<IndexEntry> >::const_iterator it =
+                root->index.entries.find (id);
+            if (it != root->index.entries.end ()) {
+                for (std::size_t i = 0, count = it->second.size (); i < count; ++i) {
+                    const IndexEntry &entry = it->second[i];
+                    if (entry.type == type && IsAncestorOf (entry.owner)) {
+                        return entry.owner;
+                    }
+                }
+            }
+            return 0;
+        }
+
+        void KeyRing::IndexEntryAdded (
+                const ID &id,
+                EntryType type) {
+            if (type == ENTRY_CIPHER_KEY ||
+                    type == ENTRY_MAC_KEY ||
+                    type == ENTRY_AUTHENTICATOR_KEY) {
+                Metrics::SetLabels (id, GetId (), cipherSuite.GetCode ());
+            }
+            InvalidateSize (type == ENTRY_SUBRING);
+            KeyRing *root = GetRoot ();
+            if (root->index.valid) {
+                AddIndexEntry (root->index.entries, id, IndexEntry (this, type));
+            }
+            UpdateAttributeIndexes (id, type, true);
+        }
+
+        void KeyRing::IndexEntryDropped (
+                const ID &id,
+                EntryType type) {
+            InvalidateSize (type == ENTRY_SUBRING);
+            KeyRing *root = GetRoot ();
+            if (root->index.valid) {
+                RemoveIndexEntry (root->index.entries, id, IndexEntry (this, type));
+            }
+            UpdateAttributeIndexes (id, type, false);
+        }
+
+        void KeyRing::IndexTree (
+                IDHashMap<std::vector<IndexEntry> > &entries,
+                bool add) const {
+            void (*update) (
+                IDHashMap<std::vector<IndexEntry> > &,
+                const ID &,
+                const IndexEntry &) = add ? AddIndexEntry : RemoveIndexEntry;
+            KeyRing *owner = const_cast<KeyRing *> (this);
             for (ParamsMap::const_iterator
-                    it = keyExchangeParamsMap.begin (),
-                    end = keyExchangeParamsMap.end (); it != end; ++it) {
-                size += util::Serializable::Size (*it->second);
+                    it = sharedEntries->keyExchangeParamsMap.begin (),
+                    end = sharedEntries->keyExchangeParamsMap.end (); it != end; ++it) {
+                update (entries, it->first, IndexEntry (owner, ENTRY_KEY_EXCHANGE_PARAMS));
             }
-            size += util::SizeT (keyExchangeKeyMap.size ()).Size ();
             for (AsymmetricKeyMap::const_iterator
-                    it = keyExchangeKeyMap.begin (),
-                    end = keyExchangeKeyMap.end (); it != end; ++it) {
-                size += util::Serializable::Size (*it->second);
+                    it = sharedEntries->keyExchangeKeyMap.begin (),
+                    end = sharedEntries->keyExchangeKeyMap.end (); it != end; ++it) {
+                update (entries, it->first, IndexEntry (owner, ENTRY_KEY_EXCHANGE_KEY));
+            }
+            for (KeyExchangeMap::const_iterator
+                    it = keyExchangeMap.begin (),
+                    end = keyExchangeMap.end (); it != end; ++it) {
+                update (entries, it->first, IndexEntry (owner, ENTRY_KEY_EXCHANGE));
             }
-            size += util::SizeT (authenticatorParamsMap.size ()).Size ();
             for (ParamsMap::const_iterator
-                    it = authenticatorParamsMap.begin (),
-                    end = authenticatorParamsMap.end (); it != end; ++it) {
-                size += util::Serializable::Size (*it->second);
+                    it = sharedEntries->authenticatorParamsMap.begin (),
+                    end = sharedEntries->authenticatorParamsMap.end (); it != end; ++it) {
+                update (entries, it->first, IndexEntry (owner, ENTRY_AUTHENTICATOR_PARAMS));
             }
-            size += util::SizeT (authenticatorKeyMap.size ()).Size ();
             for (AsymmetricKeyMap::const_iterator
-                    it = authenticatorKeyMap.begin (),
-                    end = authenticatorKeyMap.end (); it != end; ++it) {
-                size += util::Serializable::Size (*it->second);
+                    it = sharedEntries->authenticatorKeyMap.begin (),
+                    end = sharedEntries->authenticatorKeyMap.end (); it != end; ++it) {
+                update (entries, it->first, IndexEntry (owner, ENTRY_AUTHENTICATOR_KEY));
             }
-            size += util::SizeT (cipherKeyMap.size ()).Size ();
             for (SymmetricKeyMap::const_iterator
                     it = cipherKeyMap.begin (),
                     end = cipherKeyMap.end (); it != end; ++it) {
-                size += util::Serializable::Size (*it->second);
+                update (entries, it->first, IndexEntry (owner, ENTRY_CIPHER_KEY));
+            }
+            for (std::size_t i = 0, count = cipherKeyStore.GetCount (); i < count; ++i) {
+                update (entries, cipherKeyStore.GetId (i), IndexEntry (owner, ENTRY_CIPHER_KEY));
             }
-            size += util::SizeT (macKeyMap.size ()).Size ();
             for (SymmetricKeyMap::const_iterator
                     it = macKeyMap.begin (),
                     end = macKeyMap.end (); it != end; ++it) {
-                size += util::Serializable::Size (*it->second);
+                update (entries, it->first, IndexEntry (owner, ENTRY_MAC_KEY));
+            }
+            for (std::size_t i = 0, count = macKeyStore.GetCount (); i < count; ++i) {
+                update (entries, macKeyStore.GetId (i), IndexEntry (owner, ENTRY_MAC_KEY));
+            }
+            for (SerializableMap::const_iterator
+                    it = userDataMap.begin (),
+                    end = userDataMap.end (); it != end; ++it) {
+                update (entries, it->first, IndexEntry (owner, ENTRY_USER_DATA));
+            }
+            for (KeyRingMap::const_iterator
+                    it = subringMap.begin (),
+                    end = subringMap.end (); it != end; ++it) {
+                update (entries, it->first, IndexEntry (owner, ENTRY_SUBRING));
+                it->second->IndexTree (entries, add);
+            }
+        }
+
+        void KeyRing::InvalidateIndex () {
+            KeyRing *root = GetRoot ();
+            root->index.entries.clear ();
+            root->index.valid = false;
+            InvalidateSize (true);
+            InvalidateAttributeIndexes ();
+        }
+
+        Serializable::SharedPtr KeyRing::GetIndexedEntry (
+                const ID &id,
+                EntryType type) const {
+            switch (type) {
+                case ENTRY_KEY_EXCHANGE_PARAMS:
+                    return Serializable::SharedPtr (GetKeyExchangeParams (id, false).Get ());
+                case ENTRY_KEY_EXCHANGE_KEY:
+                    return Serializable::SharedPtr (GetKeyExchangeKey (id, false).Get ());
+                case ENTRY_AUTHENTICATOR_PARAMS:
+                    return Serializable::SharedPtr (GetAuthenticatorParams (id, false).Get ());
+                case ENTRY_AUTHENTICATOR_KEY:
+                    return Serializable::SharedPtr (GetAuthenticatorKey (id, false).Get ());
+                case ENTRY_CIPHER_KEY:
+                    return Serializable::SharedPtr (GetCipherKey (id, false).Get ());
+                case ENTRY_MAC_KEY:
+                    return Serializable::SharedPtr (GetMACKey (id, false).Get ());
+                case ENTRY_USER_DATA:
+                    return GetUserData (id, false);
+                case ENTRY_SUBRING:
+                    return Serializable::SharedPtr (GetSubring (id, false).Get ());
+                default:
+                    break;
+            }
+            return Serializable::SharedPtr ();
+        }
+
+        void KeyRing::BuildAttributeIndex (AttributeIndex &attributeIndex) const {
+            attributeIndex.entries.clear ();
+            attributeIndex.values.clear ();
+            // Let IndexTree enumerate the tree, then file every entry.
+            IDHashMap<std::vector<IndexEntry> > entries;
+            IndexTree (entries, true);
+            for (IDHashMap<std::vector<IndexEntry> >::const_iterator
+                    it = entries.begin (),
+                    end = entries.end (); it != end; ++it) {
+                for (std::size_t i = 0, count = it->second.size (); i < count; ++i) {
+                    const IndexEntry &entry = it->second[i];
+                    Serializable::SharedPtr serializable =
+                        entry.owner->GetIndexedEntry (it->first, entry.type);
+                    std::string value;
+                    if (serializable.Get () != 0 &&
+                            attributeIndex.extractor->Extract (*serializable, value)) {
+                        attributeIndex.entries.insert (
+                            std::multimap<std::string, AttributeIndexEntry>::value_type (
+                                value, AttributeIndexEntry (it->first, entry)));
+                        attributeIndex.values[it->first].push_back (value);
+                    }
+                }
+            }
+            attributeIndex.valid = true;
+        }
+
+        void KeyRing::UpdateAttributeIndexes (
+                const ID &id,
+                EntryType type,
+                bool add) {
+            // Sub rings come and go with all their entries.
+            // Let the next lookup rebuild the indexes instead.
+            if (type == ENTRY_SUBRING) {
+                InvalidateAttributeIndexes ();
+                return;
+            }
+            Serializable::SharedPtr serializable;
+            if (add) {
+                serializable = GetIndexedEntry (id, type);
+            }
+            IndexEntry indexEntry (this, type);
+            for (KeyRing *ring = this; ring != 0; ring = ring->index.parent) {
+                for (AttributeIndexMap::iterator
+                        it = ring->attributeIndexes.begin (),
+                        end = ring->attributeIndexes.end (); it != end; ++it) {
+                    AttributeIndex &attributeIndex = it->second;
+                    if (!attributeIndex.valid) {
+                        continue;
+                    }
+                    if (add) {
+                        std::string value;
+                        if (serializable.Get () != 0 &&
+                                attributeIndex.extractor->Extract (*serializable, value)) {
+                            attributeIndex.entries.insert (
+                                std::multimap<std::string, AttributeIndexEntry>::value_type (
+                                    value, AttributeIndexEntry (id, indexEntry)));
+                            attributeIndex.values[id].push_back (value);
+                        }
+                    }
+                    else {
+                        // values remembers what the (now gone) entry was filed under.
+                        IDHashMap<std::vector<std::string> >::iterator
+                            values = attributeIndex.values.find (id);
+                        if (values != attributeIndex.values.end ()) {
+                            bool erased = false;
+                            for (std::size_t i = 0, count = values->second.size ();
+                                    !erased && i < count; ++i) {
+                                std::pair<
+                                    std::multimap<std::string, AttributeIndexEntry>::iterator,
+                                    std::multimap<std::string, AttributeIndexEntry>::iterator> range =
+                                        attributeIndex.entries.equal_range (values->second[i]);
+                                for (; range.first != range.second; ++range.first) {
+                                    const AttributeIndexEntry &entry = range.first->second;
+                                    if (entry.id == id &&
+                                            entry.entry.owner == this &&
+                                            entry.entry.type == type) {
+                                        attributeIndex.entries.erase (range.first);
+                                        values->second.erase (values->second.begin () + i);
+                                        erased = true;
+                                        break;
+                                    }
+                                }
+                            }
+                            if (values->second.empty ()) {
+                                attributeIndex.values.erase (values);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+        KeyRing *KeyRing::FindAttribute (
+                const AttributeQuery &query,
+                EntryType type,
+                bool recursive,
+                ID &id) const {
+            // Use the nearest index (ours or an ancestor's).
+            const KeyRing *ring = this;
+            AttributeIndexMap::iterator it;
+            while (ring != 0 &&
+                    (it = ring->attributeIndexes.find (query.indexName)) ==
+                        ring->attributeIndexes.end ()) {
+                ring = ring->index.parent;
+            }
+            if (ring == 0) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "Unknown attribute index: %s.",
+                    query.indexName.c_str ());
+            }
+            AttributeIndex &attributeIndex = it->second;
+            if (!attributeIndex.valid) {
+                ring->BuildAttributeIndex (attributeIndex);
+            }
+            std::pair<
+                std::multimap<std::string, AttributeIndexEntry>::const_iterator,
+                std::multimap<std::string, AttributeIndexEntry>::const_iterator> range =
+                    attributeIndex.entries.equal_range (query.value);
+            for (; range.first != range.second; ++range.first) {
+                const AttributeIndexEntry &entry = range.first->second;
+                if (entry.entry.type == type &&
+                        (entry.entry.owner == this ||
+                            (recursive && IsAncestorOf (entry.entry.owner)))) {
+                    id = entry.id;
+                    return entry.entry.owner;
+                }
+            }
+            return 0;
+        }
+
+        void KeyRing::AddAttributeIndex (
+                const std::string &indexName,
+                AttributeExtractor::SharedPtr extractor) {
+            if (!indexName.empty () && extractor.Get () != 0) {
+                AttributeIndex &attributeIndex = attributeIndexes[indexName];
+                attributeIndex.extractor = extractor;
+                attributeIndex.entries.clear ();
+                attributeIndex.values.clear ();
+                attributeIndex.valid = false;
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        bool KeyRing::DropAttributeIndex (const std::string &indexName) {
+            return attributeIndexes.erase (indexName) > 0;
+        }
+
+        void KeyRing::InvalidateAttributeIndexes () {
+            for (KeyRing *ring = this; ring != 0; ring = ring->index.parent) {
+                for (AttributeIndexMap::iterator
+                        it = ring->attributeIndexes.begin (),
+                        end = ring->attributeIndexes.end (); it != end; ++it) {
+                    it->second.entries.clear ();
+                    it->second.values.clear ();
+                    it->second.valid = false;
+                }
+            }
+        }
+
+        bool KeyRing::NameExtractor::Extract (
+                const Serializable &entry,
+                std::string &value) const {
+            value = entry.GetName ();
+            return !value.empty ();
+        }
+
+        bool KeyRing::KeyTypeExtractor::Extract (
+                const Serializable &entry,
+                std::string &value) const {
+            const Params *params = dynamic_cast<const Params *> (&entry);
+            if (params != 0) {
+                value = params->GetKeyType ();
+                return true;
+            }
+            const AsymmetricKey *key = dynamic_cast<const AsymmetricKey *> (&entry);
+            if (key != 0) {
+                value = key->GetKeyType ();
+                return true;
+            }
+            return false;
+        }
+
+        void KeyRing::InvalidateSize (bool treeChanged) {
+            KeyRing *ring = this;
+            while (ring->index.parent != 0) {
+                ring->index.sizeValid = false;
+                ring = ring->index.parent;
+            }
+            ring->index.sizeValid = false;
+            if (treeChanged) {
+                ring->index.version = ++treeVersion;
+            }
+        }
+
+        KeyRing::SharedPtr KeyRing::CreateFromTemplate (
+                const KeyRing &templateRing,
+                const ID &id,
+                const std::string &name,
+                const std::string &description) {
+            SharedPtr keyRing (new KeyRing (templateRing.cipherSuite, id, name, description));
+            templateRing.sharedEntries->shared = true;
+            keyRing->sharedEntries = templateRing.sharedEntries;
+            return keyRing;
+        }
+
+        bool KeyRing::SharesEntriesWith (const KeyRing &keyRing) const {
+            return sharedEntries.Get () == keyRing.sharedEntries.Get ();
+        }
+
+        void KeyRing::UnshareEntries () {
+            if (sharedEntries->shared) {
+                // Rings that serialized a reference to our entries
+                // now have to serialize the entries themselves.
+                InvalidateSize (true);
+                SharedEntries::SharedPtr entries (new SharedEntries (GetId ()));
+                entries->keyExchangeParamsMap = sharedEntries->keyExchangeParamsMap;
+                entries->keyExchangeKeyMap = sharedEntries->keyExchangeKeyMap;
+                entries->authenticatorParamsMap = sharedEntries->authenticatorParamsMap;
+                entries->authenticatorKeyMap = sharedEntries->authenticatorKeyMap;
+                sharedEntries = entries;
+            }
+        }
+
+        const KeyRing *KeyRing::GetSharedEntriesOwner (const KeyRing &root) const {
+            if (sharedEntries->shared && sharedEntries->ownerId != GetId ()) {
+                const KeyRing *owner = root.GetId () == sharedEntries->ownerId ?
+                    &root : root.GetSubring (sharedEntries->ownerId, true).Get ();
+                if (owner != 0 && owner != this &&
+                        owner->sharedEntries.Get () == sharedEntries.Get ()) {
+                    return owner;
+                }
+            }
+            return 0;
+        }
+
+        void KeyRing::ResolveSharedEntries () {
+            // Rings read with a reference hold an (unshared) empty
+            // placeholder with the owner's id.
+            std::vector<KeyRing *> rings (1, this);
+            bool pending = false;
+            for (std::size_t i = 0; i < rings.size (); ++i) {
+                KeyRing *ring = rings[i];
+                if (!ring->sharedEntries->shared &&
+                        ring->sharedEntries->ownerId != ring->GetId ()) {
+                    pending = true;
+                }
+                for (KeyRingMap::const_iterator
+                        it = ring->subringMap.begin (),
+                        end = ring->subringMap.end (); it != end; ++it) {
+                    rings.push_back (it->second.Get ());
+                }
+            }
+            if (pending) {
+                IDHashMap<KeyRing *> owners;
+                for (std::size_t i = 0, count = rings.size (); i < count; ++i) {
+                    if (rings[i]->sharedEntries->ownerId == rings[i]->GetId ()) {
+                        owners.insert (IDHashMap<KeyRing *>::value_type (rings[i]->GetId (), rings[i]));
+                    }
+                }
+                for (std::size_t i = 0, count = rings.size (); i < count; ++i) {
+                    KeyRing *ring = rings[i];
+                    if (!ring->sharedEntries->shared &&
+                            ring->sharedEntries->ownerId != ring->GetId ()) {
+                        IDHashMap<KeyRing *>::const_iterator owner =
+                            owners.find (ring->sharedEntries->ownerId);
+                        if (owner != owners.end ()) {
+                            owner->second->sharedEntries->shared = true;
+                            ring->sharedEntries = owner->second->sharedEntries;
+                        }
+                    }
+                }
+            }
+        }
+
+        void KeyRing::DetachSubrings () {
+            for (KeyRingMap::const_iterator
+                    it = subringMap.begin (),
+                    end = subringMap.end (); it != end; ++it) {
+                it->second->index.parent = 0;
+                it->second->index.entries.clear ();
+                it->second->index.valid = false;
+                it->second->index.version = ++treeVersion;
+            }
+        }
+
+        void KeyRing::AddIndexEntry (
+                IDHashMap<std::vector<IndexEntry> > &entries,
+                const ID &id,
+                const IndexEntry &entry) {
+            entries.insert (
+                IDHashMap<std::vector<IndexEntry> >::value_type (
+                    id, std::vector<IndexEntry> ())).first->second.push_back (entry);
+        }
+
+        void KeyRing::RemoveIndexEntry (
+                IDHashMap<std::vector<IndexEntry> > &entries,
+                const ID &id,
+                const IndexEntry &entry) {
+            IDHashMap<std::vector<IndexEntry> >::iterator it = entries.find (id);
+            if (it != entries.end ()) {
+                for (std::size_t i = 0, count = it->second.size (); i < count; ++i) {
+                    if (it->second[i].owner == entry.owner && it->second[i].type == entry.type) {
+                        it->second.erase (it->second.begin () + i);
+                        break;
+                    }
+                }
+                if (it->second.empty ()) {
+                    entries.erase (it);
+                }
+            }
+        }
+
+        std::size_t KeyRing::Size () const {
+            WriteRootScope writeRootScope (*this);
+            // Save (and every parent ring's Size and Write) asks for our
+            // size. Unless something changed since, reuse the last answer
+            // instead of walking the whole sub tree again.
+            util::ui64 version = GetRoot ()->index.version;
+            if (index.sizeValid &&
+                    index.sizeRoot == writeRoot &&
+                    index.sizeVersion == version) {
+                return index.size;
+            }
+            std::size_t size = Serializable::Size () + cipherSuite.Size () + ID::SIZE;
+            if (GetSharedEntriesOwner (*writeRoot) == 0) {
+                size += util::SizeT (sharedEntries->keyExchangeParamsMap.size ()).Size ();
+                for (ParamsMap::const_iterator
+                        it = sharedEntries->keyExchangeParamsMap.begin (),
+                        end = sharedEntries->keyExchangeParamsMap.end (); it != end; ++it) {
+                    size += GetEntrySize (*it->second);
+                }
+                size += util::SizeT (sharedEntries->keyExchangeKeyMap.size ()).Size ();
+                for (AsymmetricKeyMap::const_iterator
+                        it = sharedEntries->keyExchangeKeyMap.begin (),
+                        end = sharedEntries->keyExchangeKeyMap.end (); it != end; ++it) {
+                    size += GetEntrySize (*it->second);
+                }
+                size += util::SizeT (sharedEntries->authenticatorParamsMap.size ()).Size ();
+                for (ParamsMap::const_iterator
+                        it = sharedEntries->authenticatorParamsMap.begin (),
+                        end = sharedEntries->authenticatorParamsMap.end (); it != end; ++it) {
+                    size += GetEntrySize (*it->second);
+                }
+                size += util::SizeT (sharedEntries->authenticatorKeyMap.size ()).Size ();
+                for (AsymmetricKeyMap::const_iterator
+                        it = sharedEntries->authenticatorKeyMap.begin (),
+                        end = sharedEntries->authenticatorKeyMap.end (); it != end; ++it) {
+                    size += GetEntrySize (*it->second);
+                }
+            }
+            size += util::SizeT (cipherKeyMap.size () + cipherKeyStore.GetCount ()).Size ();
+            for (SymmetricKeyMap::const_iterator
+                    it = cipherKeyMap.begin (),
+                    end = cipherKeyMap.end (); it != end; ++it) {
+                size += GetEntrySize (*it->second);
+            }
+            for (std::size_t i = 0, count = cipherKeyStore.GetCount (); i < count; ++i) {
+                size += GetEntrySize (*cipherKeyStore.GetAt (i));
+            }
+            size += util::SizeT (macKeyMap.size () + macKeyStore.GetCount ()).Size ();
+            for (SymmetricKeyMap::const_iterator
+                    it = macKeyMap.begin (),
+                    end = macKeyMap.end (); it != end; ++it) {
+                size += GetEntrySize (*it->second);
+            }
+            for (std::size_t i = 0, count = macKeyStore.GetCount (); i < count; ++i) {
+                size += GetEntrySize (*macKeyStore.GetAt (i));
             }
             size += util::SizeT (userDataMap.size ()).Size ();
             for (SerializableMap::const_iterator
                     it = userDataMap.begin (),
                     end = userDataMap.end (); it != end; ++it) {
-                size += util::Serializable::Size (*it->second);
+                size += GetEntrySize (*it->second);
             }
             size += util::SizeT (subringMap.size ()).Size ();
             for (KeyRingMap::const_iterator
                     it = subringMap.begin (),
                     end = subringMap.end (); it != end; ++it) {
-                size += util::Serializable::Size (*it->second);
+                size += GetEntrySize (*it->second);
             }
+            index.size = size;
+            index.sizeRoot = writeRoot;
+            index.sizeVersion = version;
+            index.sizeValid = true;
             return size;
         }
 
@@ -1252,184 +2817,239 @@ namespace thekogans {
                 const BinHeader &header,
                 util::Serializer &serializer) {
             Serializable::Read (header, serializer);
+            InvalidateIndex ();
             serializer >> cipherSuite;
-            util::SizeT keyExchangeParamsCount;
-            serializer >> keyExchangeParamsCount;
-            keyExchangeParamsMap.clear ();
-            while (keyExchangeParamsCount-- > 0) {
-                Params::SharedPtr params;
-                serializer >> params;
-                std::pair<ParamsMap::iterator, bool> result =
-                    keyExchangeParamsMap.insert (
-                        ParamsMap::value_type (params->GetId (), params));
-                if (!result.second) {
-                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
-                        "Unable to instert KeyExchange params: %s",
-                        params->GetName ().c_str ());
+            // Version 3 rings sharing (CreateFromTemplate) the entries of
+            // another ring in the tree store its id instead of the entries.
+            ID sharedEntriesOwnerId = header.version >= 3 ? ID (serializer) : GetId ();
+            sharedEntries = SharedEntries::SharedPtr (new SharedEntries (sharedEntriesOwnerId));
+            cipherKeyMap.clear ();
+            cipherKeyStore.Clear ();
+            macKeyMap.clear ();
+            macKeyStore.Clear ();
+            userDataMap.clear ();
+            DetachSubrings ();
+            subringMap.clear ();
+            // Version 2 entries are size prefixed. When reading from
+            // memory that lets us locate them all up front (without
+            // parsing them), and parse them on a pool of workers
+            // (OpenSSL DER decoding of asymmetric keys dominates).
+            util::Buffer *buffer = header.version >= 2 ?
+                dynamic_cast<util::Buffer *> (&serializer) : 0;
+            std::vector<EntryReadJob> jobs;
+            for (util::ui8 map = sharedEntries->ownerId == GetId () ?
+                        ENTRY_MAP_KEY_EXCHANGE_PARAMS : ENTRY_MAP_CIPHER_KEY;
+                    map < ENTRY_MAP_COUNT; ++map) {
+                util::SizeT count;
+                serializer >> count;
+                while (count-- > 0) {
+                    if (header.version >= 2) {
+                        util::SizeT length;
+                        serializer >> length;
+                        if (buffer != 0) {
+                            if (length > buffer->GetDataAvailableForReading ()) {
+                                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                                    "Invalid key ring entry length: " THEKOGANS_UTIL_SIZE_T_FORMAT,
+                                    (std::size_t)length);
+                            }
+                            jobs.push_back (EntryReadJob (map, buffer->GetReadPtr (), length));
+                            buffer->AdvanceReadOffset (length);
+                            continue;
+                        }
+                    }
+                    Serializable::SharedPtr entry;
+                    serializer >> entry;
+                    AddReadEntry (map, entry);
                 }
             }
-            util::SizeT keyExchangeKeyCount;
-            serializer >> keyExchangeKeyCount;
-            keyExchangeKeyMap.clear ();
-            while (keyExchangeKeyCount-- > 0) {
-                AsymmetricKey::SharedPtr key;
-                serializer >> key;
-                std::pair<AsymmetricKeyMap::iterator, bool> result =
-                    keyExchangeKeyMap.insert (
-                        AsymmetricKeyMap::value_type (key->GetId (), key));
-                if (!result.second) {
-                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
-                        "Unable to instert KeyExchange key: %s",
-                        key->GetName ().c_str ());
+            if (!jobs.empty ()) {
+                ReadEntries (jobs, serializer.endianness);
+                for (std::size_t i = 0, count = jobs.size (); i < count; ++i) {
+                    AddReadEntry (jobs[i].map, jobs[i].entry);
                 }
             }
-            util::SizeT authenticatorParamsCount;
-            serializer >> authenticatorParamsCount;
-            authenticatorParamsMap.clear ();
-            while (authenticatorParamsCount-- > 0) {
-                Params::SharedPtr params;
-                serializer >> params;
-                std::pair<ParamsMap::iterator, bool> result =
-                    authenticatorParamsMap.insert (
-                        ParamsMap::value_type (params->GetId (), params));
-                if (!result.second) {
-                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
-                        "Unable to instert Authenticator params: %s",
-                        params->GetName ().c_str ());
-                }
+            ResolveSharedEntries ();
+        }
+
+        void KeyRing::AddReadEntry (
+                util::ui8 map,
+                Serializable::SharedPtr entry) {
+            if (entry.Get () == 0) {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
             }
-            util::SizeT authenticatorKeyCount;
-            serializer >> authenticatorKeyCount;
-            authenticatorKeyMap.clear ();
-            while (authenticatorKeyCount-- > 0) {
-                AsymmetricKey::SharedPtr key;
-                serializer >> key;
-                std::pair<AsymmetricKeyMap::iterator, bool> result =
-                    authenticatorKeyMap.insert (
-                        AsymmetricKeyMap::value_type (key->GetId (), key));
-                if (!result.second) {
-                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
-                        "Unable to instert Authenticator key: %s",
-                        key->GetName ().c_str ());
+            switch (map) {
+                case ENTRY_MAP_KEY_EXCHANGE_PARAMS: {
+                    Params::SharedPtr params =
+                        util::dynamic_refcounted_sharedptr_cast<Params> (entry);
+                    if (params.Get () == 0 ||
+                            !sharedEntries->keyExchangeParamsMap.insert (
+                                ParamsMap::value_type (params->GetId (), params)).second) {
+                        THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                            "Unable to instert KeyExchange params: %s",
+                            entry->GetName ().c_str ());
+                    }
+                    break;
                 }
-            }
-            util::SizeT cipherKeyCount;
-            serializer >> cipherKeyCount;
-            cipherKeyMap.clear ();
-            while (cipherKeyCount-- > 0) {
-                SymmetricKey::SharedPtr key;
-                serializer >> key;
-                std::pair<SymmetricKeyMap::iterator, bool> result =
-                    cipherKeyMap.insert (
-                        SymmetricKeyMap::value_type (key->GetId (), key));
-                if (!result.second) {
-                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
-                        "Unable to instert Cipher key: %s",
-                        key->GetName ().c_str ());
+                case ENTRY_MAP_KEY_EXCHANGE_KEY: {
+                    AsymmetricKey::SharedPtr key =
+                        util::dynamic_refcounted_sharedptr_cast<AsymmetricKey> (entry);
+                    if (key.Get () == 0 ||
+                            !sharedEntries->keyExchangeKeyMap.insert (
+                                AsymmetricKeyMap::value_type (key->GetId (), key)).second) {
+                        THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                            "Unable to instert KeyExchange key: %s",
+                            entry->GetName ().c_str ());
+                    }
+                    break;
                 }
-            }
-            util::SizeT macKeyCount;
-            serializer >> macKeyCount;
-            macKeyMap.clear ();
-            while (macKeyCount-- > 0) {
-                SymmetricKey::SharedPtr key;
-                serializer >> key;
-                std::pair<SymmetricKeyMap::iterator, bool> result =
-                    macKeyMap.insert (
-                        SymmetricKeyMap::value_type (key->GetId (), key));
-                if (!result.second) {
-                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
-                        "Unable to instert MAC key: %s",
-                        key->GetName ().c_str ());
+                case ENTRY_MAP_AUTHENTICATOR_PARAMS: {
+                    Params::SharedPtr params =
+                        util::dynamic_refcounted_sharedptr_cast<Params> (entry);
+                    if (params.Get () == 0 ||
+                            !sharedEntries->authenticatorParamsMap.insert (
+                                ParamsMap::value_type (params->GetId (), params)).second) {
+                        THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                            "Unable to instert Authenticator params: %s",
+                            entry->GetName ().c_str ());
+                    }
+                    break;
                 }
-            }
-            util::SizeT userDataCount;
-            serializer >> userDataCount;
-            userDataMap.clear ();
-            while (userDataCount-- > 0) {
-                Serializable::SharedPtr userData;
-                serializer >> userData;
-                std::pair<SerializableMap::iterator, bool> result =
-                    userDataMap.insert (
-                        SerializableMap::value_type (userData->GetId (), userData));
-                if (!result.second) {
-                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
-                        "Unable to instert user data: %s",
-                        userData->GetName ().c_str ());
+                case ENTRY_MAP_AUTHENTICATOR_KEY: {
+                    AsymmetricKey::SharedPtr key =
+                        util::dynamic_refcounted_sharedptr_cast<AsymmetricKey> (entry);
+                    if (key.Get () == 0 ||
+                            !sharedEntries->authenticatorKeyMap.insert (
+                                AsymmetricKeyMap::value_type (key->GetId (), key)).second) {
+                        THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                            "Unable to instert Authenticator key: %s",
+                            entry->GetName ().c_str ());
+                    }
+                    break;
                 }
-            }
-            util::SizeT subringCount;
-            serializer >> subringCount;
-            subringMap.clear ();
-            while (subringCount-- > 0) {
-                SharedPtr subring;
-                serializer >> subring;
-                std::pair<KeyRingMap::iterator, bool> result =
-                    subringMap.insert (
-                        KeyRingMap::value_type (subring->GetId (), subring));
-                if (!result.second) {
-                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
-                        "Unable to instert subring: %s",
-                        subring->GetName ().c_str ());
+                case ENTRY_MAP_CIPHER_KEY: {
+                    SymmetricKey::SharedPtr key =
+                        util::dynamic_refcounted_sharedptr_cast<SymmetricKey> (entry);
+                    if (key.Get () == 0 ||
+                            !cipherKeyMap.insert (
+                                SymmetricKeyMap::value_type (key->GetId (), key)).second) {
+                        THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                            "Unable to instert Cipher key: %s",
+                            entry->GetName ().c_str ());
+                    }
+                    break;
+                }
+                case ENTRY_MAP_MAC_KEY: {
+                    SymmetricKey::SharedPtr key =
+                        util::dynamic_refcounted_sharedptr_cast<SymmetricKey> (entry);
+                    if (key.Get () == 0 ||
+                            !macKeyMap.insert (
+                                SymmetricKeyMap::value_type (key->GetId (), key)).second) {
+                        THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                            "Unable to instert MAC key: %s",
+                            entry->GetName ().c_str ());
+                    }
+                    break;
+                }
+                case ENTRY_MAP_USER_DATA: {
+                    if (!userDataMap.insert (
+                            SerializableMap::value_type (entry->GetId (), entry)).second) {
+                        THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                            "Unable to instert user data: %s",
+                            entry->GetName ().c_str ());
+                    }
+                    break;
                 }
+                case ENTRY_MAP_SUBRING: {
+                    SharedPtr subring = util::dynamic_refcounted_sharedptr_cast<KeyRing> (entry);
+                    if (subring.Get () == 0 ||
+                            !subringMap.insert (
+                                KeyRingMap::value_type (subring->GetId (), subring)).second) {
+                        THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                            "Unable to instert subring: %s",
+                            entry->GetName ().c_str ());
+                    }
+                    subring->index.parent = this;
+                    break;
+                }
+                default:
+                    THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                        THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
             }
         }
 
         void KeyRing::Write (util::Serializer &serializer) const {
+            WriteRootScope writeRootScope (*this);
             Serializable::Write (serializer);
             serializer << cipherSuite;
-            serializer << util::SizeT (keyExchangeParamsMap.size ());
-            for (ParamsMap::const_iterator
-                    it = keyExchangeParamsMap.begin (),
-                    end = keyExchangeParamsMap.end (); it != end; ++it) {
-                serializer << *it->second;
-            }
-            serializer << util::SizeT (keyExchangeKeyMap.size ());
-            for (AsymmetricKeyMap::const_iterator
-                    it = keyExchangeKeyMap.begin (),
-                    end = keyExchangeKeyMap.end (); it != end; ++it) {
-                serializer << *it->second;
-            }
-            serializer << util::SizeT (authenticatorParamsMap.size ());
-            for (ParamsMap::const_iterator
-                    it = authenticatorParamsMap.begin (),
-                    end = authenticatorParamsMap.end (); it != end; ++it) {
-                serializer << *it->second;
+            // Rings sharing (CreateFromTemplate) the entries of another
+            // ring in the tree store its id instead of the entries.
+            const KeyRing *sharedEntriesOwner = GetSharedEntriesOwner (*writeRoot);
+            if (sharedEntriesOwner != 0) {
+                serializer << sharedEntriesOwner->GetId ();
             }
-            serializer << util::SizeT (authenticatorKeyMap.size ());
-            for (AsymmetricKeyMap::const_iterator
-                    it = authenticatorKeyMap.begin (),
-                    end = authenticatorKeyMap.end (); it != end; ++it) {
-                serializer << *it->second;
+            else {
+                serializer << GetId ();
+                serializer << util::SizeT (sharedEntries->keyExchangeParamsMap.size ());
+                for (ParamsMap::const_iterator
+                        it = sharedEntries->keyExchangeParamsMap.begin (),
+                        end = sharedEntries->keyExchangeParamsMap.end (); it != end; ++it) {
+                    WriteEntry (serializer, *it->second);
+                }
+                serializer << util::SizeT (sharedEntries->keyExchangeKeyMap.size ());
+                for (AsymmetricKeyMap::const_iterator
+                        it = sharedEntries->keyExchangeKeyMap.begin (),
+                        end = sharedEntries->keyExchangeKeyMap.end (); it != end; ++it) {
+                    WriteEntry (serializer, *it->second);
+                }
+                serializer << util::SizeT (sharedEntries->authenticatorParamsMap.size ());
+                for (ParamsMap::const_iterator
+                        it = sharedEntries->authenticatorParamsMap.begin (),
+                        end = sharedEntries->authenticatorParamsMap.end (); it != end; ++it) {
+                    WriteEntry (serializer, *it->second);
+                }
+                serializer << util::SizeT (sharedEntries->authenticatorKeyMap.size ());
+                for (AsymmetricKeyMap::const_iterator
+                        it = sharedEntries->authenticatorKeyMap.begin (),
+                        end = sharedEntries->authenticatorKeyMap.end (); it != end; ++it) {
+                    WriteEntry (serializer, *it->second);
+                }
             }
-            serializer << util::SizeT (cipherKeyMap.size ());
+            serializer << util::SizeT (cipherKeyMap.size () + cipherKeyStore.GetCount ());
             for (SymmetricKeyMap::const_iterator
                     it = cipherKeyMap.begin (),
                     end = cipherKeyMap.end (); it != end; ++it) {
-                serializer << *it->second;
+                WriteEntry (serializer, *it->second);
+            }
+            for (std::size_t i = 0, count = cipherKeyStore.GetCount (); i < count; ++i) {
+                WriteEntry (serializer, *cipherKeyStore.GetAt (i));
             }
-            serializer << util::SizeT (macKeyMap.size ());
+            serializer << util::SizeT (macKeyMap.size () + macKeyStore.GetCount ());
             for (SymmetricKeyMap::const_iterator
                     it = macKeyMap.begin (),
                     end = macKeyMap.end (); it != end; ++it) {
-                serializer << *it->second;
+                WriteEntry (serializer, *it->second);
+            }
+            for (std::size_t i = 0, count = macKeyStore.GetCount (); i < count; ++i) {
+                WriteEntry (serializer, *macKeyStore.GetAt (i));
             }
             serializer << util::SizeT (userDataMap.size ());
             for (SerializableMap::const_iterator
                     it = userDataMap.begin (),
                     end = userDataMap.end (); it != end; ++it) {
-                serializer << *it->second;
+                WriteEntry (serializer, *it->second);
             }
             serializer << util::SizeT (subringMap.size ());
             for (KeyRingMap::const_iterator
                     it = subringMap.begin (),
                     end = subringMap.end (); it != end; ++it) {
-                serializer << *it->second;
+                WriteEntry (serializer, *it->second);
             }
         }
 
         const char * const KeyRing::TAG_KEY_RING = "KeyRing";
         const char * const KeyRing::ATTR_CIPHER_SUITE = "CipherSuite";
+        const char * const KeyRing::ATTR_SHARED_ENTRIES = "SharedEntries";
         const char * const KeyRing::TAG_KEY_EXCHANGE_PARAMS = "KeyExchangeParams";
         const char * const KeyRing::TAG_KEY_EXCHANGE_PARAM = "KeyExchangeParam";
         const char * const KeyRing::TAG_KEY_EXCHANGE_KEYS = "KeyExchangeKeys";
@@ -1451,8 +3071,15 @@ namespace thekogans {
                 const TextHeader &header,
                 const pugi::xml_node &node) {
             Serializable::Read (header, node);
+            InvalidateIndex ();
             cipherSuite = node.attribute (ATTR_CIPHER_SUITE).value ();
-            keyExchangeParamsMap.clear ();
+            // Rings sharing (CreateFromTemplate) the entries of another
+            // ring in the tree store its id instead of the entries.
+            pugi::xml_attribute sharedEntriesOwnerId = node.attribute (ATTR_SHARED_ENTRIES);
+            sharedEntries = SharedEntries::SharedPtr (
+                new SharedEntries (
+                    sharedEntriesOwnerId.empty () ?
+                        GetId () : ID::FromHexString (sharedEntriesOwnerId.value ())));
             pugi::xml_node keyExchangeParams = node.child (TAG_KEY_EXCHANGE_PARAMS);
             for (pugi::xml_node child = keyExchangeParams.first_child ();
                     !child.empty (); child = child.next_sibling ()) {
@@ -1462,7 +3089,7 @@ namespace thekogans {
                         Params::SharedPtr params;
                         child >> params;
                         std::pair<ParamsMap::iterator, bool> result =
-                            keyExchangeParamsMap.insert (
+                            sharedEntries->keyExchangeParamsMap.insert (
                                 ParamsMap::value_type (params->GetId (), params));
                         if (!result.second) {
                             THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
@@ -1472,7 +3099,6 @@ namespace thekogans {
                     }
                 }
             }
-            keyExchangeKeyMap.clear ();
             pugi::xml_node keyExchangeKeys = node.child (TAG_KEY_EXCHANGE_KEYS);
             for (pugi::xml_node child = keyExchangeKeys.first_child ();
                     !child.empty (); child = child.next_sibling ()) {
@@ -1482,7 +3108,7 @@ namespace thekogans {
                         AsymmetricKey::SharedPtr key;
                         child >> key;
                         std::pair<AsymmetricKeyMap::iterator, bool> result =
-                            keyExchangeKeyMap.insert (
+                            sharedEntries->keyExchangeKeyMap.insert (
                                 AsymmetricKeyMap::value_type (key->GetId (), key));
                         if (!result.second) {
                             THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
@@ -1492,7 +3118,6 @@ namespace thekogans {
                     }
                 }
             }
-            authenticatorParamsMap.clear ();
             pugi::xml_node authenticatorParams = node.child (TAG_AUTHENTICATOR_PARAMS);
             for (pugi::xml_node child = authenticatorParams.first_child ();
                     !child.empty (); child = child.next_sibling ()) {
@@ -1502,7 +3127,7 @@ namespace thekogans {
                         Params::SharedPtr params;
                         child >> params;
                         std::pair<ParamsMap::iterator, bool> result =
-                            authenticatorParamsMap.insert (
+                            sharedEntries->authenticatorParamsMap.insert (
                                 ParamsMap::value_type (params->GetId (), params));
                         if (!result.second) {
                             THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
@@ -1512,7 +3137,6 @@ namespace thekogans {
                     }
                 }
             }
-            authenticatorKeyMap.clear ();
             pugi::xml_node authenticatorKeys = node.child (TAG_AUTHENTICATOR_KEYS);
             for (pugi::xml_node child = authenticatorKeys.first_child ();
                     !child.empty (); child = child.next_sibling ()) {
@@ -1522,7 +3146,7 @@ namespace thekogans {
                         AsymmetricKey::SharedPtr key;
                         child >> key;
                         std::pair<AsymmetricKeyMap::iterator, bool> result =
-                            authenticatorKeyMap.insert (
+                            sharedEntries->authenticatorKeyMap.insert (
                                 AsymmetricKeyMap::value_type (key->GetId (), key));
                         if (!result.second) {
                             THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
@@ -1533,6 +3157,7 @@ namespace thekogans {
                 }
             }
             cipherKeyMap.clear ();
+            cipherKeyStore.Clear ();
             pugi::xml_node cipherKeys = node.child (TAG_CIPHER_KEYS);
             for (pugi::xml_node child = cipherKeys.first_child ();
                     !child.empty (); child = child.next_sibling ()) {
@@ -1553,6 +3178,7 @@ namespace thekogans {
                 }
             }
             macKeyMap.clear ();
+            macKeyStore.Clear ();
             pugi::xml_node macKeys = node.child (TAG_MAC_KEYS);
             for (pugi::xml_node child = macKeys.first_child ();
                     !child.empty (); child = child.next_sibling ()) {
@@ -1592,6 +3218,7 @@ namespace thekogans {
                     }
                 }
             }
+            DetachSubrings ();
             subringMap.clear ();
             pugi::xml_node subrings = node.child (TAG_SUB_RINGS);
             for (pugi::xml_node child = subrings.first_child ();
@@ -1609,56 +3236,66 @@ namespace thekogans {
                                 "Unable to instert subring: %s",
                                 subring->GetName ().c_str ());
                         }
+                        subring->index.parent = this;
                     }
                 }
             }
+            ResolveSharedEntries ();
         }
 
         void KeyRing::Write (pugi::xml_node &node) const {
+            WriteRootScope writeRootScope (*this);
             Serializable::Write (node);
             node.append_attribute (ATTR_CIPHER_SUITE).set_value (cipherSuite.ToString ().c_str ());
-            {
-                pugi::xml_node keyExchangeParams =
-                    node.append_child (TAG_KEY_EXCHANGE_PARAMS);
-                for (ParamsMap::const_iterator
-                        it = keyExchangeParamsMap.begin (),
-                        end = keyExchangeParamsMap.end (); it != end; ++it) {
-                    pugi::xml_node keyExchangeParam =
-                        keyExchangeParams.append_child (TAG_KEY_EXCHANGE_PARAM);
-                    keyExchangeParam << *it->second;
-                }
+            const KeyRing *sharedEntriesOwner = GetSharedEntriesOwner (*writeRoot);
+            if (sharedEntriesOwner != 0) {
+                node.append_attribute (ATTR_SHARED_ENTRIES).set_value (
+                    sharedEntriesOwner->GetId ().ToHexString ().c_str ());
             }
-            {
-                pugi::xml_node keyExchangeKeys =
-                    node.append_child (TAG_KEY_EXCHANGE_KEYS);
-                for (AsymmetricKeyMap::const_iterator
-                        it = keyExchangeKeyMap.begin (),
-                        end = keyExchangeKeyMap.end (); it != end; ++it) {
-                    pugi::xml_node keyExchangeKey =
-                        keyExchangeKeys.append_child (TAG_KEY_EXCHANGE_KEY);
-                    keyExchangeKey << *it->second;
+            else {
+                {
+                    pugi::xml_node keyExchangeParams =
+                        node.append_child (TAG_KEY_EXCHANGE_PARAMS);
+                    for (ParamsMap::const_iterator
+                            it = sharedEntries->keyExchangeParamsMap.begin (),
+                            end = sharedEntries->keyExchangeParamsMap.end (); it != end; ++it) {
+                        pugi::xml_node keyExchangeParam =
+                            keyExchangeParams.append_child (TAG_KEY_EXCHANGE_PARAM);
+                        keyExchangeParam << *it->second;
+                    }
                 }
-            }
-            {
-                pugi::xml_node authenticatorParams =
-                    node.append_child (TAG_AUTHENTICATOR_PARAMS);
-                for (ParamsMap::const_iterator
-                        it = authenticatorParamsMap.begin (),
-                        end = authenticatorParamsMap.end (); it != end; ++it) {
-                    pugi::xml_node authenticatorParam =
-                        authenticatorParams.append_child (TAG_AUTHENTICATOR_PARAM);
-                    authenticatorParam << *it->second;
+                {
+                    pugi::xml_node keyExchangeKeys =
+                        node.append_child (TAG_KEY_EXCHANGE_KEYS);
+                    for (AsymmetricKeyMap::const_iterator
+                            it = sharedEntries->keyExchangeKeyMap.begin (),
+                            end = sharedEntries->keyExchangeKeyMap.end (); it != end; ++it) {
+                        pugi::xml_node keyExchangeKey =
+                            keyExchangeKeys.append_child (TAG_KEY_EXCHANGE_KEY);
+                        keyExchangeKey << *it->second;
+                    }
                 }
-            }
-            {
-                pugi::xml_node authenticatorKeys =
-                    node.append_child (TAG_AUTHENTICATOR_KEYS);
-                for (AsymmetricKeyMap::const_iterator
-                        it = authenticatorKeyMap.begin (),
-                        end = authenticatorKeyMap.end (); it != end; ++it) {
-                    pugi::xml_node authenticatorKey =
-                        authenticatorKeys.append_child (TAG_AUTHENTICATOR_KEY);
-                    authenticatorKey << *it->second;
+                {
+                    pugi::xml_node authenticatorParams =
+                        node.append_child (TAG_AUTHENTICATOR_PARAMS);
+                    for (ParamsMap::const_iterator
+                            it = sharedEntries->authenticatorParamsMap.begin (),
+                            end = sharedEntries->authenticatorParamsMap.end (); it != end; ++it) {
+                        pugi::xml_node authenticatorParam =
+                            authenticatorParams.append_child (TAG_AUTHENTICATOR_PARAM);
+                        authenticatorParam << *it->second;
+                    }
+                }
+                {
+                    pugi::xml_node authenticatorKeys =
+                        node.append_child (TAG_AUTHENTICATOR_KEYS);
+                    for (AsymmetricKeyMap::const_iterator
+                            it = sharedEntries->authenticatorKeyMap.begin (),
+                            end = sharedEntries->authenticatorKeyMap.end (); it != end; ++it) {
+                        pugi::xml_node authenticatorKey =
+                            authenticatorKeys.append_child (TAG_AUTHENTICATOR_KEY);
+                        authenticatorKey << *it->second;
+                    }
                 }
             }
             {
@@ -1669,15 +3306,23 @@ namespace thekogans {
                     pugi::xml_node cipherKey = cipherKeys.append_child (TAG_CIPHER_KEY);
                     cipherKey << *it->second;
                 }
+                for (std::size_t i = 0, count = cipherKeyStore.GetCount (); i < count; ++i) {
+                    pugi::xml_node cipherKey = cipherKeys.append_child (TAG_CIPHER_KEY);
+                    cipherKey << *cipherKeyStore.GetAt (i);
+                }
             }
             {
                 pugi::xml_node macKeys = node.append_child (TAG_MAC_KEYS);
                 for (SymmetricKeyMap::const_iterator
                         it = macKeyMap.begin (),
                         end = macKeyMap.end (); it != end; ++it) {
-                    pugi::xml_node macKey = macKeys.append_child (TAG_CIPHER_KEY);
+                    pugi::xml_node macKey = macKeys.append_child (TAG_MAC_KEY);
                     macKey << *it->second;
                 }
+                for (std::size_t i = 0, count = macKeyStore.GetCount (); i < count; ++i) {
+                    pugi::xml_node macKey = macKeys.append_child (TAG_MAC_KEY);
+                    macKey << *macKeyStore.GetAt (i);
+                }
             }
             {
                 pugi::xml_node userDatas = node.append_child (TAG_USER_DATAS);
@@ -1703,8 +3348,16 @@ namespace thekogans {
                 const TextHeader &header,
                 const util::JSON::Object &object) {
             Serializable::Read (header, object);
+            InvalidateIndex ();
             cipherSuite = object.Get<util::JSON::String> (ATTR_CIPHER_SUITE)->value;
-            keyExchangeParamsMap.clear ();
+            // Rings sharing (CreateFromTemplate) the entries of another
+            // ring in the tree store its id instead of the entries.
+            util::JSON::String::SharedPtr sharedEntriesOwnerId =
+                object.Get<util::JSON::String> (ATTR_SHARED_ENTRIES);
+            sharedEntries = SharedEntries::SharedPtr (
+                new SharedEntries (
+                    sharedEntriesOwnerId.Get () == 0 ?
+                        GetId () : ID::FromHexString (sharedEntriesOwnerId->value)));
             util::JSON::Array::SharedPtr keyExchangeParams =
                 object.Get<util::JSON::Array> (TAG_KEY_EXCHANGE_PARAMS);
             if (keyExchangeParams.Get () != 0) {
@@ -1714,7 +3367,7 @@ namespace thekogans {
                     Params::SharedPtr params;
                     *keyExchangeParam >> params;
                     std::pair<ParamsMap::iterator, bool> result =
-                        keyExchangeParamsMap.insert (
+                        sharedEntries->keyExchangeParamsMap.insert (
                             ParamsMap::value_type (params->GetId (), params));
                     if (!result.second) {
                         THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
@@ -1723,7 +3376,6 @@ namespace thekogans {
                     }
                 }
             }
-            keyExchangeKeyMap.clear ();
             util::JSON::Array::SharedPtr keyExchangeKeys =
                 object.Get<util::JSON::Array> (TAG_KEY_EXCHANGE_KEYS);
             if (keyExchangeKeys.Get () != 0) {
@@ -1733,7 +3385,7 @@ namespace thekogans {
                     AsymmetricKey::SharedPtr key;
                     *keyExchangeKey >> key;
                     std::pair<AsymmetricKeyMap::iterator, bool> result =
-                        keyExchangeKeyMap.insert (
+                        sharedEntries->keyExchangeKeyMap.insert (
                             AsymmetricKeyMap::value_type (key->GetId (), key));
                     if (!result.second) {
                         THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
@@ -1742,7 +3394,6 @@ namespace thekogans {
                     }
                 }
             }
-            authenticatorParamsMap.clear ();
             util::JSON::Array::SharedPtr authenticatorParams =
                 object.Get<util::JSON::Array> (TAG_AUTHENTICATOR_PARAMS);
             if (authenticatorParams.Get () != 0) {
@@ -1752,7 +3403,7 @@ namespace thekogans {
                     Params::SharedPtr params;
                     *authenticatorParam >> params;
                     std::pair<ParamsMap::iterator, bool> result =
-                        authenticatorParamsMap.insert (
+                        sharedEntries->authenticatorParamsMap.insert (
                             ParamsMap::value_type (params->GetId (), params));
                     if (!result.second) {
                         THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
@@ -1761,7 +3412,6 @@ namespace thekogans {
                     }
                 }
             }
-            authenticatorKeyMap.clear ();
             util::JSON::Array::SharedPtr authenticatorKeys =
                 object.Get<util::JSON::Array> (TAG_AUTHENTICATOR_KEYS);
             if (authenticatorKeys.Get () != 0) {
@@ -1771,7 +3421,7 @@ namespace thekogans {
                     AsymmetricKey::SharedPtr key;
                     *authenticatorKey >> key;
                     std::pair<AsymmetricKeyMap::iterator, bool> result =
-                        authenticatorKeyMap.insert (
+                        sharedEntries->authenticatorKeyMap.insert (
                             AsymmetricKeyMap::value_type (key->GetId (), key));
                     if (!result.second) {
                         THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
@@ -1781,6 +3431,7 @@ namespace thekogans {
                 }
             }
             cipherKeyMap.clear ();
+            cipherKeyStore.Clear ();
             util::JSON::Array::SharedPtr cipherKeys =
                 object.Get<util::JSON::Array> (TAG_CIPHER_KEYS);
             if (cipherKeys.Get () != 0) {
@@ -1800,6 +3451,7 @@ namespace thekogans {
                 }
             }
             macKeyMap.clear ();
+            macKeyStore.Clear ();
             util::JSON::Array::SharedPtr macKeys = object.Get<util::JSON::Array> (TAG_MAC_KEYS);
             if (macKeys.Get () != 0) {
                 for (std::size_t i = 0, count = macKeys->GetValueCount (); i < count; ++i) {
@@ -1833,6 +3485,7 @@ namespace thekogans {
                     }
                 }
             }
+            DetachSubrings ();
             subringMap.clear ();
             util::JSON::Array::SharedPtr subrings = object.Get<util::JSON::Array> (TAG_SUB_RINGS);
             if (subrings.Get () != 0) {
@@ -1848,56 +3501,67 @@ namespace thekogans {
                             "Unable to instert subring: %s",
                             keyRing->GetName ().c_str ());
                     }
+                    keyRing->index.parent = this;
                 }
             }
+            ResolveSharedEntries ();
         }
 
         void KeyRing::Write (util::JSON::Object &object) const {
+            WriteRootScope writeRootScope (*this);
             Serializable::Write (object);
             object.Add<const std::string &> (ATTR_CIPHER_SUITE, cipherSuite.ToString ());
-            {
-                util::JSON::Array::SharedPtr keyExchangeParams (new util::JSON::Array);
-                for (ParamsMap::const_iterator
-                        it = keyExchangeParamsMap.begin (),
-                        end = keyExchangeParamsMap.end (); it != end; ++it) {
-                    util::JSON::Object::SharedPtr keyExchangeParam (new util::JSON::Object);
-                    *keyExchangeParam << *it->second;
-                    keyExchangeParams->Add (keyExchangeParam);
-                }
-                object.Add (TAG_KEY_EXCHANGE_PARAMS, keyExchangeParams);
-            }
-            {
-                util::JSON::Array::SharedPtr keyExchangeKeys (new util::JSON::Array);
-                for (AsymmetricKeyMap::const_iterator
-                        it = keyExchangeKeyMap.begin (),
-                        end = keyExchangeKeyMap.end (); it != end; ++it) {
-                    util::JSON::Object::SharedPtr keyExchangeKey (new util::JSON::Object);
-                    *keyExchangeKey << *it->second;
-                    keyExchangeKeys->Add (keyExchangeKey);
-                }
-                object.Add (TAG_KEY_EXCHANGE_KEYS, keyExchangeKeys);
+            const KeyRing *sharedEntriesOwner = GetSharedEntriesOwner (*writeRoot);
+            if (sharedEntriesOwner != 0) {
+                object.Add<const std::string &> (
+                    ATTR_SHARED_ENTRIES,
+                    sharedEntriesOwner->GetId ().ToHexString ());
             }
-            {
-                util::JSON::Array::SharedPtr authenticatorParams (new util::JSON::Array);
-                for (ParamsMap::const_iterator
-                        it = authenticatorParamsMap.begin (),
-                        end = authenticatorParamsMap.end (); it != end; ++it) {
-                    util::JSON::Object::SharedPtr authenticatorParam (new util::JSON::Object);
-                    *authenticatorParam << *it->second;
-                    authenticatorParams->Add (authenticatorParam);
-                }
-                object.Add (TAG_AUTHENTICATOR_PARAMS, authenticatorParams);
-            }
-            {
-                util::JSON::Array::SharedPtr authenticatorKeys (new util::JSON::Array);
-                for (AsymmetricKeyMap::const_iterator
-                        it = authenticatorKeyMap.begin (),
-                        end = authenticatorKeyMap.end (); it != end; ++it) {
-                    util::JSON::Object::SharedPtr authenticatorKey (new util::JSON::Object);
-                    *authenticatorKey << *it->second;
-                    authenticatorKeys->Add (authenticatorKey);
+            else {
+                {
+                    util::JSON::Array::SharedPtr keyExchangeParams (new util::JSON::Array);
+                    for (ParamsMap::const_iterator
+                            it = sharedEntries->keyExchangeParamsMap.begin (),
+                            end = sharedEntries->keyExchangeParamsMap.end (); it != end; ++it) {
+                        util::JSON::Object::SharedPtr keyExchangeParam (new util::JSON::Object);
+                        *keyExchangeParam << *it->second;
+                        keyExchangeParams->Add (keyExchangeParam);
+                    }
+                    object.Add (TAG_KEY_EXCHANGE_PARAMS, keyExchangeParams);
+                }
+                {
+                    util::JSON::Array::SharedPtr keyExchangeKeys (new util::JSON::Array);
+                    for (AsymmetricKeyMap::const_iterator
+                            it = sharedEntries->keyExchangeKeyMap.begin (),
+                            end = sharedEntries->keyExchangeKeyMap.end (); it != end; ++it) {
+                        util::JSON::Object::SharedPtr keyExchangeKey (new util::JSON::Object);
+                        *keyExchangeKey << *it->second;
+                        keyExchangeKeys->Add (keyExchangeKey);
+                    }
+                    object.Add (TAG_KEY_EXCHANGE_KEYS, keyExchangeKeys);
+                }
+                {
+                    util::JSON::Array::SharedPtr authenticatorParams (new util::JSON::Array);
+                    for (ParamsMap::const_iterator
+                            it = sharedEntries->authenticatorParamsMap.begin (),
+                            end = sharedEntries->authenticatorParamsMap.end (); it != end; ++it) {
+                        util::JSON::Object::SharedPtr authenticatorParam (new util::JSON::Object);
+                        *authenticatorParam << *it->second;
+                        authenticatorParams->Add (authenticatorParam);
+                    }
+                    object.Add (TAG_AUTHENTICATOR_PARAMS, authenticatorParams);
+                }
+                {
+                    util::JSON::Array::SharedPtr authenticatorKeys (new util::JSON::Array);
+                    for (AsymmetricKeyMap::const_iterator
+                            it = sharedEntries->authenticatorKeyMap.begin (),
+                            end = sharedEntries->authenticatorKeyMap.end (); it != end; ++it) {
+                        util::JSON::Object::SharedPtr authenticatorKey (new util::JSON::Object);
+                        *authenticatorKey << *it->second;
+                        authenticatorKeys->Add (authenticatorKey);
+                    }
+                    object.Add (TAG_AUTHENTICATOR_KEYS, authenticatorKeys);
                 }
-                object.Add (TAG_AUTHENTICATOR_KEYS, authenticatorKeys);
             }
             {
                 util::JSON::Array::SharedPtr cipherKeys (new util::JSON::Array);
@@ -1908,6 +3572,11 @@ namespace thekogans {
                     *cipherKey << *it->second;
                     cipherKeys->Add (cipherKey);
                 }
+                for (std::size_t i = 0, count = cipherKeyStore.GetCount (); i < count; ++i) {
+                    util::JSON::Object::SharedPtr cipherKey (new util::JSON::Object);
+                    *cipherKey << *cipherKeyStore.GetAt (i);
+                    cipherKeys->Add (cipherKey);
+                }
                 object.Add (TAG_CIPHER_KEYS, cipherKeys);
             }
             {
@@ -1919,6 +3588,11 @@ namespace thekogans {
                     *macKey << *it->second;
                     macKeys->Add (macKey);
                 }
+                for (std::size_t i = 0, count = macKeyStore.GetCount (); i < count; ++i) {
+                    util::JSON::Object::SharedPtr macKey (new util::JSON::Object);
+                    *macKey << *macKeyStore.GetAt (i);
+                    macKeys->Add (macKey);
+                }
                 object.Add (TAG_MAC_KEYS, macKeys);
             }
             {
@@ -0,0 +1,1474 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include "thekogans/util/Types.h"
+#include "thekogans/util/File.h"
+#include "thekogans/util/Buffer.h"
+#include "thekogans/util/SecureAllocator.h"
+#include "thekogans/util/Exception.h"
+#include "thekogans/util/XMLUtils.h"
+#include "thekogans/util/JSON.h"
+#include "thekogans/crypto/ConstantTime.h"
+#include "thekogans/crypto/TextEncoding.h"
+#include "thekogans/crypto/CompactKeyStore.h"
+#include "thekogans/crypto/KeyRing.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        namespace {
+            enum {
+                /// \brief
+                /// Key ring text files are read and written in chunks of this size.
+                TEXT_CHUNK_SIZE = 64 * 1024
+            };
+
+            // Character source. Reads a file in TEXT_CHUNK_SIZE (secure)
+            // chunks, or walks a block of memory. If capture != 0, every
+            // character consumed is appended to it.
+            struct TextSource {
+                util::ReadOnlyFile *file;
+                util::ui64 remaining;
+                util::SecureBuffer chunk;
+                const char *ptr;
+                const char *end;
+                util::SecureString *capture;
+
+                explicit TextSource (util::ReadOnlyFile &file_) :
+                    file (&file_),
+                    remaining (file_.GetSize ()),
+                    chunk (util::HostEndian, TEXT_CHUNK_SIZE),
+                    ptr (0),
+                    end (0),
+                    capture (0) {}
+                TextSource (
+                    const char *text,
+                    std::size_t length) :
+                    file (0),
+                    remaining (0),
+                    chunk (util::HostEndian, (std::size_t)0),
+                    ptr (text),
+                    end (text + length),
+                    capture (0) {}
+
+                inline int Peek () {
+                    return Fill () ? (util::ui8)*ptr : EOF;
+                }
+
+                char Get () {
+                    if (!Fill ()) {
+                        THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                            "%s",
+                            "Unexpected end of key ring text.");
+                    }
+                    char c = *ptr++;
+                    if (capture != 0) {
+                        capture->push_back (c);
+                    }
+                    return c;
+                }
+
+                void Expect (char expected) {
+                    if (Get () != expected) {
+                        THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                            "Malformed key ring text, expecting '%c'.",
+                            expected);
+                    }
+                }
+
+            private:
+                bool Fill () {
+                    if (ptr == end && file != 0 && remaining > 0) {
+                        std::size_t length =
+                            (std::size_t)std::min<util::ui64> (remaining, TEXT_CHUNK_SIZE);
+                        util::ui8 *data = chunk.GetWritePtr ();
+                        if (file->Read (data, length) != length) {
+                            THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                                "%s",
+                                "Unexpected end of key ring text.");
+                        }
+                        remaining -= length;
+                        ptr = (const char *)data;
+                        end = ptr + length;
+                    }
+                    return ptr != end;
+                }
+            };
+
+            // Append everything consumed from the source to text
+            // for the duration of the scope.
+            struct CaptureScope {
+                TextSource &source;
+
+                CaptureScope (
+                        TextSource &source_,
+                        util::SecureString &text) :
+                        source (source_) {
+                    source.capture = &text;
+                }
+                ~CaptureScope () {
+                    source.capture = 0;
+                }
+            };
+
+            // Buffers the text in a TEXT_CHUNK_SIZE (secure) chunk
+            // and writes it to the file a chunk at a time.
+            struct TextSink {
+                util::SimpleFile file;
+                util::SecureBuffer chunk;
+                util::ui8 *data;
+                std::size_t length;
+
+                explicit TextSink (const std::string &path) :
+                    file (
+                        util::HostEndian,
+                        path,
+                        util::SimpleFile::ReadWrite |
+                        util::SimpleFile::Create |
+                        util::SimpleFile::Truncate),
+                    chunk (util::HostEndian, TEXT_CHUNK_SIZE),
+                    data (chunk.GetWritePtr ()),
+                    length (0) {}
+
+                void Write (
+                        const char *text,
+                        std::size_t count) {
+                    while (count > 0) {
+                        std::size_t available =
+                            std::min<std::size_t> (TEXT_CHUNK_SIZE - length, count);
+                        memcpy (data + length, text, available);
+                        length += available;
+                        text += available;
+                        count -= available;
+                        if (length == TEXT_CHUNK_SIZE) {
+                            Flush ();
+                        }
+                    }
+                }
+                inline void Write (const char *text) {
+                    Write (text, strlen (text));
+                }
+                inline void Write (const std::string &text) {
+                    Write (text.data (), text.size ());
+                }
+
+                void Flush () {
+                    if (length > 0) {
+                        if (file.Write (data, length) != length) {
+                            THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                                THEKOGANS_UTIL_OS_ERROR_CODE);
+                        }
+                        length = 0;
+                    }
+                }
+            };
+
+            // Routes pugixml output to a TextSink.
+            struct XMLSinkWriter : public pugi::xml_writer {
+                TextSink &sink;
+
+                explicit XMLSinkWriter (TextSink &sink_) :
+                    sink (sink_) {}
+
+                virtual void write (
+                        const void *data,
+                        size_t size) {
+                    sink.Write ((const char *)data, size);
+                }
+            };
+
+            // Collects pugixml output in a string.
+            struct XMLStringWriter : public pugi::xml_writer {
+                std::string &text;
+
+                explicit XMLStringWriter (std::string &text_) :
+                    text (text_) {}
+
+                virtual void write (
+                        const void *data,
+                        size_t size) {
+                    text.append ((const char *)data, size);
+                }
+            };
+
+            // Append the UTF-8 encoding of the given code point.
+            void AppendUTF8 (
+                    util::ui32 codePoint,
+                    util::SecureString &text) {
+                if (codePoint < 0x80) {
+                    text.push_back ((char)codePoint);
+                }
+                else if (codePoint < 0x800) {
+                    text.push_back ((char)(0xc0 | (codePoint >> 6)));
+                    text.push_back ((char)(0x80 | (codePoint & 0x3f)));
+                }
+                else if (codePoint < 0x10000) {
+                    text.push_back ((char)(0xe0 | (codePoint >> 12)));
+                    text.push_back ((char)(0x80 | ((codePoint >> 6) & 0x3f)));
+                    text.push_back ((char)(0x80 | (codePoint & 0x3f)));
+                }
+                else if (codePoint < 0x110000) {
+                    text.push_back ((char)(0xf0 | (codePoint >> 18)));
+                    text.push_back ((char)(0x80 | ((codePoint >> 12) & 0x3f)));
+                    text.push_back ((char)(0x80 | ((codePoint >> 6) & 0x3f)));
+                    text.push_back ((char)(0x80 | (codePoint & 0x3f)));
+                }
+                else {
+                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                        "Invalid code point: %u.",
+                        codePoint);
+                }
+            }
+
+            inline bool IsXMLWhiteSpace (int c) {
+                return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+            }
+
+            // Minimal pull parser for the subset of XML pugixml writes
+            // (elements, attributes, text, comments, CDATA, declarations).
+            struct XMLPullParser {
+                TextSource &source;
+
+                enum Markup {
+                    /// \brief
+                    /// Start tag (the '<' has been consumed).
+                    MARKUP_START,
+                    /// \brief
+                    /// End tag (the "</" has been consumed).
+                    MARKUP_END,
+                    /// \brief
+                    /// End of text.
+                    MARKUP_EOF
+                };
+
+                typedef std::map<std::string, util::SecureString> Attributes;
+
+                explicit XMLPullParser (TextSource &source_) :
+                    source (source_) {}
+
+                // Skip text, comments, CDATA, processing instructions and
+                // declarations up to the next start or end tag.
+                Markup NextMarkup () {
+                    for (;;) {
+                        if (source.Peek () == EOF) {
+                            return MARKUP_EOF;
+                        }
+                        if (source.Get () == '<') {
+                            int c = source.Peek ();
+                            if (c == '/') {
+                                source.Get ();
+                                return MARKUP_END;
+                            }
+                            else if (c == '?') {
+                                SkipPast ("?>");
+                            }
+                            else if (c == '!') {
+                                source.Get ();
+                                if (source.Peek () == '-') {
+                                    SkipPast ("-->");
+                                }
+                                else if (source.Peek () == '[') {
+                                    SkipPast ("]]>");
+                                }
+                                else {
+                                    SkipDeclaration ();
+                                }
+                            }
+                            else {
+                                return MARKUP_START;
+                            }
+                        }
+                    }
+                }
+
+                // Read the rest of a start tag. Returns true if the element
+                // is empty (<name .../>). If attributes == 0, values are skipped.
+                bool ReadStartTag (
+                        std::string &name,
+                        Attributes *attributes) {
+                    name = ReadName ();
+                    for (;;) {
+                        SkipWhiteSpace ();
+                        char c = source.Get ();
+                        if (c == '/') {
+                            source.Expect ('>');
+                            return true;
+                        }
+                        else if (c == '>') {
+                            return false;
+                        }
+                        std::string attributeName (1, c);
+                        attributeName += ReadName ();
+                        SkipWhiteSpace ();
+                        source.Expect ('=');
+                        SkipWhiteSpace ();
+                        util::SecureString value;
+                        ReadAttributeValue (value);
+                        if (attributes != 0) {
+                            (*attributes)[attributeName] = value;
+                        }
+                    }
+                }
+
+                // Read the rest of an end tag, making sure it closes name.
+                void ReadEndTag (const std::string &name) {
+                    if (ReadName () != name) {
+                        THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                            "Malformed key ring text, expecting </%s>.",
+                            name.c_str ());
+                    }
+                    SkipWhiteSpace ();
+                    source.Expect ('>');
+                }
+
+                // Skip the contents and end tag of the given element.
+                void SkipElement (const std::string &name) {
+                    for (;;) {
+                        Markup markup = NextMarkup ();
+                        if (markup == MARKUP_START) {
+                            std::string childName;
+                            if (!ReadStartTag (childName, 0)) {
+                                SkipElement (childName);
+                            }
+                        }
+                        else if (markup == MARKUP_END) {
+                            ReadEndTag (name);
+                            break;
+                        }
+                        else {
+                            THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                                "Malformed key ring text, missing </%s>.",
+                                name.c_str ());
+                        }
+                    }
+                }
+
+            private:
+                inline void SkipWhiteSpace () {
+                    while (IsXMLWhiteSpace (source.Peek ())) {
+                        source.Get ();
+                    }
+                }
+
+                std::string ReadName () {
+                    std::string name;
+                    for (int c = source.Peek ();
+                            c != EOF && !IsXMLWhiteSpace (c) &&
+                            c != '/' && c != '>' && c != '='; c = source.Peek ()) {
+                        name.push_back (source.Get ());
+                    }
+                    return name;
+                }
+
+                void ReadAttributeValue (util::SecureString &value) {
+                    char quote = source.Get ();
+                    if (quote != '"' && quote != '\'') {
+                        THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                            "%s",
+                            "Malformed key ring text, expecting a quoted attribute value.");
+                    }
+                    for (char c = source.Get (); c != quote; c = source.Get ()) {
+                        if (c == '&') {
+                            ReadEntity (value);
+                        }
+                        else {
+                            // Attribute value normalization.
+                            value.push_back (IsXMLWhiteSpace (c) ? ' ' : c);
+                        }
+                    }
+                }
+
+                void ReadEntity (util::SecureString &value) {
+                    std::string entity;
+                    for (char c = source.Get (); c != ';'; c = source.Get ()) {
+                        if (entity.size () == 16) {
+                            THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                                "%s",
+                                "Malformed key ring text, invalid entity.");
+                        }
+                        entity.push_back (c);
+                    }
+                    if (entity == "amp") {
+                        value.push_back ('&');
+                    }
+                    else if (entity == "lt") {
+                        value.push_back ('<');
+                    }
+                    else if (entity == "gt") {
+                        value.push_back ('>');
+                    }
+                    else if (entity == "quot") {
+                        value.push_back ('"');
+                    }
+                    else if (entity == "apos") {
+                        value.push_back ('\'');
+                    }
+                    else if (entity.size () > 1 && entity[0] == '#') {
+                        bool hex = entity[1] == 'x' || entity[1] == 'X';
+                        const char *digits = entity.c_str () + (hex ? 2 : 1);
+                        char *digitsEnd = 0;
+                        unsigned long codePoint = strtoul (digits, &digitsEnd, hex ? 16 : 10);
+                        if (*digits == '\0' || *digitsEnd != '\0') {
+                            THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                                "Malformed key ring text, invalid entity: &%s;",
+                                entity.c_str ());
+                        }
+                        AppendUTF8 ((util::ui32)codePoint, value);
+                    }
+                    else {
+                        THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                            "Malformed key ring text, unknown entity: &%s;",
+                            entity.c_str ());
+                    }
+                }
+
+                // terminator can be at most 3 characters long.
+                void SkipPast (const char *terminator) {
+                    std::size_t length = strlen (terminator);
+                    char window[3] = {0, 0, 0};
+                    for (std::size_t count = 1;; ++count) {
+                        window[0] = window[1];
+                        window[1] = window[2];
+                        window[2] = source.Get ();
+                        if (count >= length && memcmp (window + 3 - length, terminator, length) == 0) {
+                            break;
+                        }
+                    }
+                }
+
+                // <!DOCTYPE ...> (with an optional [internal subset]).
+                void SkipDeclaration () {
+                    std::size_t depth = 0;
+                    for (char c = source.Get (); c != '>' || depth > 0; c = source.Get ()) {
+                        if (c == '[') {
+                            ++depth;
+                        }
+                        else if (c == ']' && depth > 0) {
+                            --depth;
+                        }
+                    }
+                }
+            };
+
+            inline bool IsJSONWhiteSpace (int c) {
+                return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+            }
+
+            // Minimal JSON pull parser.
+            struct JSONPullParser {
+                TextSource &source;
+
+                explicit JSONPullParser (TextSource &source_) :
+                    source (source_) {}
+
+                inline void SkipWhiteSpace () {
+                    while (IsJSONWhiteSpace (source.Peek ())) {
+                        source.Get ();
+                    }
+                }
+
+                inline int Peek () {
+                    SkipWhiteSpace ();
+                    return source.Peek ();
+                }
+
+                bool Accept (char c) {
+                    if (Peek () == (util::ui8)c) {
+                        source.Get ();
+                        return true;
+                    }
+                    return false;
+                }
+
+                inline void Expect (char c) {
+                    SkipWhiteSpace ();
+                    source.Expect (c);
+                }
+
+                void ReadString (util::SecureString &value) {
+                    Expect ('"');
+                    for (char c = source.Get (); c != '"'; c = source.Get ()) {
+                        if (c == '\\') {
+                            c = source.Get ();
+                            switch (c) {
+                                case '"':
+                                case '\\':
+                                case '/':
+                                    value.push_back (c);
+                                    break;
+                                case 'b':
+                                    value.push_back ('\b');
+                                    break;
+                                case 'f':
+                                    value.push_back ('\f');
+                                    break;
+                                case 'n':
+                                    value.push_back ('\n');
+                                    break;
+                                case 'r':
+                                    value.push_back ('\r');
+                                    break;
+                                case 't':
+                                    value.push_back ('\t');
+                                    break;
+                                case 'u': {
+                                    util::ui32 codePoint = ReadHex4 ();
+                                    if (codePoint >= 0xd800 && codePoint <= 0xdbff) {
+                                        source.Expect ('\\');
+                                        source.Expect ('u');
+                                        util::ui32 low = ReadHex4 ();
+                                        if (low < 0xdc00 || low > 0xdfff) {
+                                            THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                                                "%s",
+                                                "Malformed key ring text, invalid surrogate pair.");
+                                        }
+                                        codePoint = 0x10000 + ((codePoint - 0xd800) << 10) + (low - 0xdc00);
+                                    }
+                                    AppendUTF8 (codePoint, value);
+                                    break;
+                                }
+                                default:
+                                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                                        "Malformed key ring text, invalid escape: \\%c.",
+                                        c);
+                            }
+                        }
+                        else {
+                            value.push_back (c);
+                        }
+                    }
+                }
+
+                inline std::string ReadString () {
+                    util::SecureString value;
+                    ReadString (value);
+                    return std::string (value.begin (), value.end ());
+                }
+
+                void SkipValue () {
+                    int c = Peek ();
+                    if (c == '{') {
+                        source.Get ();
+                        if (!Accept ('}')) {
+                            do {
+                                SkipString ();
+                                Expect (':');
+                                SkipValue ();
+                            } while (Accept (','));
+                            Expect ('}');
+                        }
+                    }
+                    else if (c == '[') {
+                        source.Get ();
+                        if (!Accept (']')) {
+                            do {
+                                SkipValue ();
+                            } while (Accept (','));
+                            Expect (']');
+                        }
+                    }
+                    else if (c == '"') {
+                        SkipString ();
+                    }
+                    else {
+                        // Numbers and literals (true, false, null).
+                        std::size_t length = 0;
+                        for (; c != EOF && (isalnum (c) || c == '+' || c == '-' || c == '.');
+                                c = source.Peek (), ++length) {
+                            source.Get ();
+                        }
+                        if (length == 0) {
+                            THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                                "%s",
+                                "Malformed key ring text, expecting a value.");
+                        }
+                    }
+                }
+
+            private:
+                inline void SkipString () {
+                    util::SecureString value;
+                    ReadString (value);
+                }
+
+                util::ui32 ReadHex4 () {
+                    util::ui32 value = 0;
+                    for (std::size_t i = 0; i < 4; ++i) {
+                        char c = source.Get ();
+                        value <<= 4;
+                        if (c >= '0' && c <= '9') {
+                            value |= c - '0';
+                        }
+                        else if (c >= 'a' && c <= 'f') {
+                            value |= c - 'a' + 10;
+                        }
+                        else if (c >= 'A' && c <= 'F') {
+                            value |= c - 'A' + 10;
+                        }
+                        else {
+                            THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                                "%s",
+                                "Malformed key ring text, invalid \\u escape.");
+                        }
+                    }
+                    return value;
+                }
+            };
+
+            // Split a (formatted) JSON object in to it's members
+            // (name, raw "name":value text).
+            void GetJSONMembers (
+                    const std::string &text,
+                    std::vector<std::pair<std::string, std::string> > &members) {
+                TextSource source (text.data (), text.size ());
+                JSONPullParser parser (source);
+                parser.Expect ('{');
+                if (!parser.Accept ('}')) {
+                    do {
+                        parser.SkipWhiteSpace ();
+                        util::SecureString raw;
+                        std::string name;
+                        {
+                            CaptureScope captureScope (source, raw);
+                            name = parser.ReadString ();
+                            parser.Expect (':');
+                            parser.SkipValue ();
+                        }
+                        members.push_back (
+                            std::pair<std::string, std::string> (
+                                name, std::string (raw.begin (), raw.end ())));
+                    } while (parser.Accept (','));
+                    parser.Expect ('}');
+                }
+            }
+
+            // Zeroed \see{SymmetricKey} with the same length, id, name and description
+            // as the given one. It's written to the DOM in place of the real key, so
+            // that the key material never leaves secure memory.
+            SymmetricKey::SharedPtr GetTemplateKey (const SymmetricKey &key) {
+                util::ui8 zeros[EVP_MAX_KEY_LENGTH];
+                memset (zeros, 0, EVP_MAX_KEY_LENGTH);
+                return SymmetricKey::SharedPtr (
+                    new SymmetricKey (
+                        zeros,
+                        key.GetKeyLength (),
+                        key.GetId (),
+                        key.GetName (),
+                        key.GetDescription ()));
+            }
+
+            void WriteHexKey (
+                    TextSink &sink,
+                    const SymmetricKey &key) {
+                util::SecureString hex (2 * key.GetKeyLength (), '\0');
+                HexEncode (key.Get ().GetReadPtr (), key.GetKeyLength (), &hex[0]);
+                sink.Write (hex.data (), hex.size ());
+            }
+        }
+
+        /// \struct KeyRingTextStream KeyRingTextStream.cpp
+        ///
+        /// \brief
+        /// Streaming XML/JSON \see{KeyRing} reader and writer
+        /// (see \see{KeyRing::LoadXML}).
+        struct KeyRingTextStream {
+            static bool IsSection (const std::string &name) {
+                return
+                    name == KeyRing::TAG_KEY_EXCHANGE_PARAMS ||
+                    name == KeyRing::TAG_KEY_EXCHANGE_KEYS ||
+                    name == KeyRing::TAG_AUTHENTICATOR_PARAMS ||
+                    name == KeyRing::TAG_AUTHENTICATOR_KEYS ||
+                    name == KeyRing::TAG_CIPHER_KEYS ||
+                    name == KeyRing::TAG_MAC_KEYS ||
+                    name == KeyRing::TAG_USER_DATAS ||
+                    name == KeyRing::TAG_SUB_RINGS;
+            }
+
+            template<typename T>
+            static void Insert (
+                    IDHashMap<T> &map,
+                    const T &entry,
+                    const char *entryName) {
+                std::pair<typename IDHashMap<T>::iterator, bool> result =
+                    map.insert (typename IDHashMap<T>::value_type (entry->GetId (), entry));
+                if (!result.second) {
+                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                        "Unable to insert %s: %s",
+                        entryName,
+                        entry->GetName ().c_str ());
+                }
+            }
+
+            // XML
+
+            static void ReadXMLHeader (
+                    KeyRing &keyRing,
+                    const XMLPullParser::Attributes &attributes) {
+                XMLPullParser::Attributes::const_iterator it =
+                    attributes.find (KeyRing::ATTR_ID);
+                if (it != attributes.end ()) {
+                    keyRing.id = ID::FromHexString (
+                        std::string (it->second.begin (), it->second.end ()));
+                }
+                // Resolved (KeyRing::ResolveSharedEntries) once the whole tree is read.
+                it = attributes.find (KeyRing::ATTR_SHARED_ENTRIES);
+                keyRing.sharedEntries = KeyRing::SharedEntries::SharedPtr (
+                    new KeyRing::SharedEntries (
+                        it != attributes.end () ?
+                            ID::FromHexString (std::string (it->second.begin (), it->second.end ())) :
+                            keyRing.id));
+                it = attributes.find (KeyRing::ATTR_NAME);
+                if (it != attributes.end ()) {
+                    keyRing.name.assign (it->second.begin (), it->second.end ());
+                }
+                it = attributes.find (KeyRing::ATTR_DESCRIPTION);
+                if (it != attributes.end ()) {
+                    keyRing.description.assign (it->second.begin (), it->second.end ());
+                }
+                it = attributes.find (KeyRing::ATTR_CIPHER_SUITE);
+                if (it == attributes.end ()) {
+                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                        "Key ring is missing the %s attribute.",
+                        KeyRing::ATTR_CIPHER_SUITE);
+                }
+                keyRing.cipherSuite = std::string (it->second.begin (), it->second.end ());
+            }
+
+            // Every entry is captured (in secure memory) and parsed in place
+            // (pugixml leaves the names and values in the captured text).
+            template<typename T>
+            static void ReadXMLEntries (
+                    XMLPullParser &parser,
+                    const std::string &section,
+                    const char *entryTag,
+                    const char *alternateEntryTag,
+                    IDHashMap<T> &map,
+                    const char *entryName) {
+                for (;;) {
+                    XMLPullParser::Markup markup = parser.NextMarkup ();
+                    if (markup == XMLPullParser::MARKUP_START) {
+                        util::SecureString text (1, '<');
+                        std::string name;
+                        {
+                            CaptureScope captureScope (parser.source, text);
+                            if (!parser.ReadStartTag (name, 0)) {
+                                parser.SkipElement (name);
+                            }
+                        }
+                        if (name == entryTag ||
+                                (alternateEntryTag != 0 && name == alternateEntryTag)) {
+                            pugi::xml_document document;
+                            pugi::xml_parse_result result = document.load_buffer_inplace (
+                                &text[0], text.size (), pugi::parse_default, pugi::encoding_utf8);
+                            if (!result) {
+                                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                                    "Unable to parse %s: %s",
+                                    entryName,
+                                    result.description ());
+                            }
+                            pugi::xml_node node = document.document_element ();
+                            T entry;
+                            node >> entry;
+                            Insert (map, entry, entryName);
+                        }
+                    }
+                    else if (markup == XMLPullParser::MARKUP_END) {
+                        parser.ReadEndTag (section);
+                        break;
+                    }
+                    else {
+                        THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                            "Malformed key ring text, missing </%s>.",
+                            section.c_str ());
+                    }
+                }
+            }
+
+            static void ReadXMLRing (
+                    XMLPullParser &parser,
+                    KeyRing &keyRing,
+                    const std::string &tag,
+                    const XMLPullParser::Attributes &attributes,
+                    bool empty) {
+                ReadXMLHeader (keyRing, attributes);
+                if (empty) {
+                    return;
+                }
+                for (;;) {
+                    XMLPullParser::Markup markup = parser.NextMarkup ();
+                    if (markup == XMLPullParser::MARKUP_START) {
+                        std::string section;
+                        if (parser.ReadStartTag (section, 0)) {
+                            continue;
+                        }
+                        if (section == KeyRing::TAG_KEY_EXCHANGE_PARAMS) {
+                            ReadXMLEntries (parser, section,
+                                KeyRing::TAG_KEY_EXCHANGE_PARAM, 0,
+                                keyRing.sharedEntries->keyExchangeParamsMap, "KeyExchange params");
+                        }
+                        else if (section == KeyRing::TAG_KEY_EXCHANGE_KEYS) {
+                            ReadXMLEntries (parser, section,
+                                KeyRing::TAG_KEY_EXCHANGE_KEY, 0,
+                                keyRing.sharedEntries->keyExchangeKeyMap, "KeyExchange key");
+                        }
+                        else if (section == KeyRing::TAG_AUTHENTICATOR_PARAMS) {
+                            ReadXMLEntries (parser, section,
+                                KeyRing::TAG_AUTHENTICATOR_PARAM, 0,
+                                keyRing.sharedEntries->authenticatorParamsMap, "Authenticator params");
+                        }
+                        else if (section == KeyRing::TAG_AUTHENTICATOR_KEYS) {
+                            ReadXMLEntries (parser, section,
+                                KeyRing::TAG_AUTHENTICATOR_KEY, 0,
+                                keyRing.sharedEntries->authenticatorKeyMap, "Authenticator key");
+                        }
+                        else if (section == KeyRing::TAG_CIPHER_KEYS) {
+                            ReadXMLEntries (parser, section,
+                                KeyRing::TAG_CIPHER_KEY, 0,
+                                keyRing.cipherKeyMap, "Cipher key");
+                        }
+                        else if (section == KeyRing::TAG_MAC_KEYS) {
+                            // Older KeyRing::Write (pugi::xml_node &)
+                            // wrote MAC keys as TAG_CIPHER_KEY.
+                            ReadXMLEntries (parser, section,
+                                KeyRing::TAG_MAC_KEY, KeyRing::TAG_CIPHER_KEY,
+                                keyRing.macKeyMap, "MAC key");
+                        }
+                        else if (section == KeyRing::TAG_USER_DATAS) {
+                            ReadXMLEntries (parser, section,
+                                KeyRing::TAG_USER_DATA, 0,
+                                keyRing.userDataMap, "user data");
+                        }
+                        else if (section == KeyRing::TAG_SUB_RINGS) {
+                            ReadXMLSubrings (parser, keyRing, section);
+                        }
+                        else {
+                            parser.SkipElement (section);
+                        }
+                    }
+                    else if (markup == XMLPullParser::MARKUP_END) {
+                        parser.ReadEndTag (tag);
+                        break;
+                    }
+                    else {
+                        THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                            "Malformed key ring text, missing </%s>.",
+                            tag.c_str ());
+                    }
+                }
+            }
+
+            static void ReadXMLSubrings (
+                    XMLPullParser &parser,
+                    KeyRing &keyRing,
+                    const std::string &section) {
+                for (;;) {
+                    XMLPullParser::Markup markup = parser.NextMarkup ();
+                    if (markup == XMLPullParser::MARKUP_START) {
+                        std::string name;
+                        XMLPullParser::Attributes attributes;
+                        bool empty = parser.ReadStartTag (name, &attributes);
+                        if (name == KeyRing::TAG_SUB_RING) {
+                            KeyRing::SharedPtr subring (new KeyRing (CipherSuite ()));
+                            ReadXMLRing (parser, *subring, name, attributes, empty);
+                            Insert (keyRing.subringMap, subring, "subring");
+                            subring->index.parent = &keyRing;
+                        }
+                        else if (!empty) {
+                            parser.SkipElement (name);
+                        }
+                    }
+                    else if (markup == XMLPullParser::MARKUP_END) {
+                        parser.ReadEndTag (section);
+                        break;
+                    }
+                    else {
+                        THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                            "Malformed key ring text, missing </%s>.",
+                            section.c_str ());
+                    }
+                }
+            }
+
+            template<typename T>
+            static void WriteXMLEntries (
+                    TextSink &sink,
+                    const char *section,
+                    const char *entryTag,
+                    const IDHashMap<T> &map) {
+                sink.Write ("<");
+                sink.Write (section);
+                sink.Write (">\n");
+                XMLSinkWriter writer (sink);
+                for (typename IDHashMap<T>::const_iterator
+                        it = map.begin (),
+                        end = map.end (); it != end; ++it) {
+                    pugi::xml_document document;
+                    pugi::xml_node node = document.append_child (entryTag);
+                    node << *it->second;
+                    node.print (writer, "", pugi::format_raw, pugi::encoding_utf8);
+                    sink.Write ("\n");
+                }
+                sink.Write ("</");
+                sink.Write (section);
+                sink.Write (">\n");
+            }
+
+            // The DOM only ever sees a zeroed template of the key (see GetTemplateKey).
+            // The hex encoded key goes straight from the key to the sink.
+            static void WriteXMLKey (
+                    TextSink &sink,
+                    const char *entryTag,
+                    const std::string &keyAttribute,
+                    const SymmetricKey &symmetricKey) {
+                pugi::xml_document document;
+                pugi::xml_node node = document.append_child (entryTag);
+                node << *GetTemplateKey (symmetricKey);
+                std::string text;
+                XMLStringWriter writer (text);
+                node.print (writer, "", pugi::format_raw, pugi::encoding_utf8);
+                std::size_t hexLength = 2 * symmetricKey.GetKeyLength ();
+                std::string::size_type key = text.rfind (keyAttribute);
+                if (key == std::string::npos ||
+                        key + keyAttribute.size () + hexLength > text.size ()) {
+                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                        "Unable to write key: %s",
+                        symmetricKey.GetName ().c_str ());
+                }
+                key += keyAttribute.size ();
+                sink.Write (text.data (), key);
+                WriteHexKey (sink, symmetricKey);
+                sink.Write (text.data () + key + hexLength, text.size () - key - hexLength);
+                sink.Write ("\n");
+            }
+
+            static void WriteXMLKeys (
+                    TextSink &sink,
+                    const char *section,
+                    const char *entryTag,
+                    const KeyRing::SymmetricKeyMap &map,
+                    const CompactKeyStore &store) {
+                sink.Write ("<");
+                sink.Write (section);
+                sink.Write (">\n");
+                std::string keyAttribute = std::string (" ") + SymmetricKey::ATTR_KEY + "=\"";
+                for (KeyRing::SymmetricKeyMap::const_iterator
+                        it = map.begin (),
+                        end = map.end (); it != end; ++it) {
+                    WriteXMLKey (sink, entryTag, keyAttribute, *it->second);
+                }
+                for (std::size_t i = 0, count = store.GetCount (); i < count; ++i) {
+                    WriteXMLKey (sink, entryTag, keyAttribute, *store.GetAt (i));
+                }
+                sink.Write ("</");
+                sink.Write (section);
+                sink.Write (">\n");
+            }
+
+            static void WriteXMLRing (
+                    TextSink &sink,
+                    const KeyRing &root,
+                    const KeyRing &keyRing,
+                    const char *tag) {
+                const KeyRing *sharedEntriesOwner = keyRing.GetSharedEntriesOwner (root);
+                {
+                    // The header (and the ring attributes) of an empty ring.
+                    KeyRing::SharedPtr header (
+                        new KeyRing (
+                            keyRing.cipherSuite,
+                            keyRing.id,
+                            keyRing.name,
+                            keyRing.description));
+                    pugi::xml_document document;
+                    pugi::xml_node node = document.append_child (tag);
+                    node << *header;
+                    while (!node.first_child ().empty ()) {
+                        node.remove_child (node.first_child ());
+                    }
+                    if (sharedEntriesOwner != 0) {
+                        node.append_attribute (KeyRing::ATTR_SHARED_ENTRIES).set_value (
+                            sharedEntriesOwner->id.ToHexString ().c_str ());
+                    }
+                    std::string text;
+                    XMLStringWriter writer (text);
+                    node.print (writer, "", pugi::format_raw, pugi::encoding_utf8);
+                    // <tag .../> -> <tag ...>
+                    std::string::size_type length = text.rfind ("/>");
+                    if (length == std::string::npos) {
+                        THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                            "Unable to write key ring: %s",
+                            keyRing.name.c_str ());
+                    }
+                    while (length > 0 && text[length - 1] == ' ') {
+                        --length;
+                    }
+                    sink.Write (text.data (), length);
+                    sink.Write (">\n");
+                }
+                if (sharedEntriesOwner == 0) {
+                    WriteXMLEntries (sink,
+                        KeyRing::TAG_KEY_EXCHANGE_PARAMS, KeyRing::TAG_KEY_EXCHANGE_PARAM,
+                        keyRing.sharedEntries->keyExchangeParamsMap);
+                    WriteXMLEntries (sink,
+                        KeyRing::TAG_KEY_EXCHANGE_KEYS, KeyRing::TAG_KEY_EXCHANGE_KEY,
+                        keyRing.sharedEntries->keyExchangeKeyMap);
+                    WriteXMLEntries (sink,
+                        KeyRing::TAG_AUTHENTICATOR_PARAMS, KeyRing::TAG_AUTHENTICATOR_PARAM,
+                        keyRing.sharedEntries->authenticatorParamsMap);
+                    WriteXMLEntries (sink,
+                        KeyRing::TAG_AUTHENTICATOR_KEYS, KeyRing::TAG_AUTHENTICATOR_KEY,
+                        keyRing.sharedEntries->authenticatorKeyMap);
+                }
+                WriteXMLKeys (sink,
+                    KeyRing::TAG_CIPHER_KEYS, KeyRing::TAG_CIPHER_KEY,
+                    keyRing.cipherKeyMap, keyRing.cipherKeyStore);
+                WriteXMLKeys (sink,
+                    KeyRing::TAG_MAC_KEYS, KeyRing::TAG_MAC_KEY,
+                    keyRing.macKeyMap, keyRing.macKeyStore);
+                WriteXMLEntries (sink,
+                    KeyRing::TAG_USER_DATAS, KeyRing::TAG_USER_DATA,
+                    keyRing.userDataMap);
+                sink.Write ("<");
+                sink.Write (KeyRing::TAG_SUB_RINGS);
+                sink.Write (">\n");
+                for (KeyRing::KeyRingMap::const_iterator
+                        it = keyRing.subringMap.begin (),
+                        end = keyRing.subringMap.end (); it != end; ++it) {
+                    WriteXMLRing (sink, root, *it->second, KeyRing::TAG_SUB_RING);
+                }
+                sink.Write ("</");
+                sink.Write (KeyRing::TAG_SUB_RINGS);
+                sink.Write (">\n</");
+                sink.Write (tag);
+                sink.Write (">\n");
+            }
+
+            // JSON
+
+            // Every entry is captured (in secure memory) and parsed as a one
+            // entry util::JSON DOM. The transient std::string copy is wiped.
+            template<typename T>
+            static void ReadJSONEntries (
+                    JSONPullParser &parser,
+                    IDHashMap<T> &map,
+                    const char *entryName) {
+                if (parser.Peek () != '[') {
+                    parser.SkipValue ();
+                    return;
+                }
+                parser.Expect ('[');
+                if (!parser.Accept (']')) {
+                    do {
+                        parser.SkipWhiteSpace ();
+                        util::SecureString text;
+                        {
+                            CaptureScope captureScope (parser.source, text);
+                            parser.SkipValue ();
+                        }
+                        std::string json (text.begin (), text.end ());
+                        util::JSON::Object::SharedPtr object;
+                        try {
+                            object = util::dynamic_refcounted_sharedptr_cast<util::JSON::Object> (
+                                util::JSON::ParseValue (json));
+                        }
+                        catch (...) {
+                            SecureZero (&json[0], json.size ());
+                            throw;
+                        }
+                        SecureZero (&json[0], json.size ());
+                        if (object.Get () == 0) {
+                            THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                                "Unable to parse %s.",
+                                entryName);
+                        }
+                        T entry;
+                        *object >> entry;
+                        Insert (map, entry, entryName);
+                    } while (parser.Accept (','));
+                    parser.Expect (']');
+                }
+            }
+
+            // The key is decoded straight from the text in to a util::SecureBuffer.
+            static void ReadJSONKeys (
+                    JSONPullParser &parser,
+                    KeyRing::SymmetricKeyMap &map,
+                    const char *entryName) {
+                if (parser.Peek () != '[') {
+                    parser.SkipValue ();
+                    return;
+                }
+                parser.Expect ('[');
+                if (!parser.Accept (']')) {
+                    do {
+                        ID id;
+                        std::string name;
+                        std::string description;
+                        util::SecureString hexKey;
+                        parser.Expect ('{');
+                        if (!parser.Accept ('}')) {
+                            do {
+                                std::string member = parser.ReadString ();
+                                parser.Expect (':');
+                                if (member == SymmetricKey::ATTR_ID) {
+                                    id = ID::FromHexString (parser.ReadString ());
+                                }
+                                else if (member == SymmetricKey::ATTR_NAME) {
+                                    name = parser.ReadString ();
+                                }
+                                else if (member == SymmetricKey::ATTR_DESCRIPTION) {
+                                    description = parser.ReadString ();
+                                }
+                                else if (member == SymmetricKey::ATTR_KEY) {
+                                    hexKey.clear ();
+                                    parser.ReadString (hexKey);
+                                }
+                                else {
+                                    parser.SkipValue ();
+                                }
+                            } while (parser.Accept (','));
+                            parser.Expect ('}');
+                        }
+                        std::size_t length = hexKey.size () / 2;
+                        if (length == 0 || length > EVP_MAX_KEY_LENGTH) {
+                            THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                                "Invalid key size " THEKOGANS_UTIL_SIZE_T_FORMAT ".", length);
+                        }
+                        util::SecureBuffer buffer (util::HostEndian, length);
+                        if (buffer.AdvanceWriteOffset (
+                                HexDecode (
+                                    hexKey.data (),
+                                    hexKey.size (),
+                                    buffer.GetWritePtr ())) != length) {
+                            THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                                "Unable to decode " THEKOGANS_UTIL_SIZE_T_FORMAT " bytes for key.",
+                                length);
+                        }
+                        Insert (
+                            map,
+                            SymmetricKey::SharedPtr (
+                                new SymmetricKey (std::move (buffer), id, name, description)),
+                            entryName);
+                    } while (parser.Accept (','));
+                    parser.Expect (']');
+                }
+            }
+
+            static void ReadJSONSubrings (
+                    JSONPullParser &parser,
+                    KeyRing &keyRing) {
+                if (parser.Peek () != '[') {
+                    parser.SkipValue ();
+                    return;
+                }
+                parser.Expect ('[');
+                if (!parser.Accept (']')) {
+                    do {
+                        KeyRing::SharedPtr subring (new KeyRing (CipherSuite ()));
+                        ReadJSONRing (parser, *subring);
+                        Insert (keyRing.subringMap, subring, "subring");
+                        subring->index.parent = &keyRing;
+                    } while (parser.Accept (','));
+                    parser.Expect (']');
+                }
+            }
+
+            static void ReadJSONRing (
+                    JSONPullParser &parser,
+                    KeyRing &keyRing) {
+                bool haveCipherSuite = false;
+                bool haveSharedEntries = false;
+                parser.Expect ('{');
+                if (!parser.Accept ('}')) {
+                    do {
+                        std::string member = parser.ReadString ();
+                        parser.Expect (':');
+                        if (member == KeyRing::ATTR_ID) {
+                            keyRing.id = ID::FromHexString (parser.ReadString ());
+                        }
+                        else if (member == KeyRing::ATTR_NAME) {
+                            keyRing.name = parser.ReadString ();
+                        }
+                        else if (member == KeyRing::ATTR_DESCRIPTION) {
+                            keyRing.description = parser.ReadString ();
+                        }
+                        else if (member == KeyRing::ATTR_CIPHER_SUITE) {
+                            keyRing.cipherSuite = parser.ReadString ();
+                            haveCipherSuite = true;
+                        }
+                        else if (member == KeyRing::ATTR_SHARED_ENTRIES) {
+                            // Resolved (KeyRing::ResolveSharedEntries) once the whole tree is read.
+                            keyRing.sharedEntries->ownerId = ID::FromHexString (parser.ReadString ());
+                            haveSharedEntries = true;
+                        }
+                        else if (member == KeyRing::TAG_KEY_EXCHANGE_PARAMS) {
+                            ReadJSONEntries (parser,
+                                keyRing.sharedEntries->keyExchangeParamsMap, "KeyExchange params");
+                        }
+                        else if (member == KeyRing::TAG_KEY_EXCHANGE_KEYS) {
+                            ReadJSONEntries (parser,
+                                keyRing.sharedEntries->keyExchangeKeyMap, "KeyExchange key");
+                        }
+                        else if (member == KeyRing::TAG_AUTHENTICATOR_PARAMS) {
+                            ReadJSONEntries (parser,
+                                keyRing.sharedEntries->authenticatorParamsMap, "Authenticator params");
+                        }
+                        else if (member == KeyRing::TAG_AUTHENTICATOR_KEYS) {
+                            ReadJSONEntries (parser,
+                                keyRing.sharedEntries->authenticatorKeyMap, "Authenticator key");
+                        }
+                        else if (member == KeyRing::TAG_CIPHER_KEYS) {
+                            ReadJSONKeys (parser, keyRing.cipherKeyMap, "Cipher key");
+                        }
+                        else if (member == KeyRing::TAG_MAC_KEYS) {
+                            ReadJSONKeys (parser, keyRing.macKeyMap, "MAC key");
+                        }
+                        else if (member == KeyRing::TAG_USER_DATAS) {
+                            ReadJSONEntries (parser, keyRing.userDataMap, "user data");
+                        }
+                        else if (member == KeyRing::TAG_SUB_RINGS) {
+                            ReadJSONSubrings (parser, keyRing);
+                        }
+                        else {
+                            parser.SkipValue ();
+                        }
+                    } while (parser.Accept (','));
+                    parser.Expect ('}');
+                }
+                if (!haveCipherSuite) {
+                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                        "Key ring is missing the %s member.",
+                        KeyRing::ATTR_CIPHER_SUITE);
+                }
+                // The members can come in any order.
+                if (!haveSharedEntries) {
+                    keyRing.sharedEntries->ownerId = keyRing.id;
+                }
+            }
+
+            static void WriteJSONName (
+                    TextSink &sink,
+                    const char *name) {
+                sink.Write ("\"");
+                sink.Write (name);
+                sink.Write ("\":");
+            }
+
+            template<typename T>
+            static void WriteJSONEntries (
+                    TextSink &sink,
+                    const char *section,
+                    const IDHashMap<T> &map) {
+                sink.Write (",\n");
+                WriteJSONName (sink, section);
+                sink.Write ("[");
+                for (typename IDHashMap<T>::const_iterator
+                        begin = map.begin (),
+                        it = begin,
+                        end = map.end (); it != end; ++it) {
+                    if (it != begin) {
+                        sink.Write (",");
+                    }
+                    sink.Write ("\n");
+                    util::JSON::Object object;
+                    object << *it->second;
+                    sink.Write (util::JSON::FormatValue (object));
+                }
+                sink.Write ("]");
+            }
+
+            // The DOM only ever sees a zeroed template of the key (see GetTemplateKey).
+            // The hex encoded key goes straight from the key to the sink.
+            static void WriteJSONKey (
+                    TextSink &sink,
+                    const SymmetricKey &key) {
+                sink.Write ("\n{");
+                util::JSON::Object object;
+                object << *GetTemplateKey (key);
+                std::vector<std::pair<std::string, std::string> > members;
+                GetJSONMembers (util::JSON::FormatValue (object), members);
+                for (std::size_t i = 0, count = members.size (); i < count; ++i) {
+                    if (i > 0) {
+                        sink.Write (",");
+                    }
+                    if (members[i].first == SymmetricKey::ATTR_KEY) {
+                        WriteJSONName (sink, SymmetricKey::ATTR_KEY);
+                        sink.Write ("\"");
+                        WriteHexKey (sink, key);
+                        sink.Write ("\"");
+                    }
+                    else {
+                        sink.Write (members[i].second);
+                    }
+                }
+                sink.Write ("}");
+            }
+
+            static void WriteJSONKeys (
+                    TextSink &sink,
+                    const char *section,
+                    const KeyRing::SymmetricKeyMap &map,
+                    const CompactKeyStore &store) {
+                sink.Write (",\n");
+                WriteJSONName (sink, section);
+                sink.Write ("[");
+                for (KeyRing::SymmetricKeyMap::const_iterator
+                        begin = map.begin (),
+                        it = begin,
+                        end = map.end (); it != end; ++it) {
+                    if (it != begin) {
+                        sink.Write (",");
+                    }
+                    WriteJSONKey (sink, *it->second);
+                }
+                for (std::size_t i = 0, count = store.GetCount (); i < count; ++i) {
+                    if (i > 0 || !map.empty ()) {
+                        sink.Write (",");
+                    }
+                    WriteJSONKey (sink, *store.GetAt (i));
+                }
+                sink.Write ("]");
+            }
+
+            static void WriteJSONRing (
+                    TextSink &sink,
+                    const KeyRing &root,
+                    const KeyRing &keyRing) {
+                const KeyRing *sharedEntriesOwner = keyRing.GetSharedEntriesOwner (root);
+                sink.Write ("{");
+                {
+                    // The header (and the ring members) of an empty ring.
+                    KeyRing::SharedPtr header (
+                        new KeyRing (
+                            keyRing.cipherSuite,
+                            keyRing.id,
+                            keyRing.name,
+                            keyRing.description));
+                    util::JSON::Object object;
+                    object << *header;
+                    if (sharedEntriesOwner != 0) {
+                        object.Add<const std::string &> (
+                            KeyRing::ATTR_SHARED_ENTRIES,
+                            sharedEntriesOwner->id.ToHexString ());
+                    }
+                    std::vector<std::pair<std::string, std::string> > members;
+                    GetJSONMembers (util::JSON::FormatValue (object), members);
+                    bool first = true;
+                    for (std::size_t i = 0, count = members.size (); i < count; ++i) {
+                        if (!IsSection (members[i].first)) {
+                            if (!first) {
+                                sink.Write (",");
+                            }
+                            sink.Write (members[i].second);
+                            first = false;
+                        }
+                    }
+                    if (first) {
+                        THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                            "Unable to write key ring: %s",
+                            keyRing.name.c_str ());
+                    }
+                }
+                if (sharedEntriesOwner == 0) {
+                    WriteJSONEntries (sink, KeyRing::TAG_KEY_EXCHANGE_PARAMS, keyRing.sharedEntries->keyExchangeParamsMap);
+                    WriteJSONEntries (sink, KeyRing::TAG_KEY_EXCHANGE_KEYS, keyRing.sharedEntries->keyExchangeKeyMap);
+                    WriteJSONEntries (sink, KeyRing::TAG_AUTHENTICATOR_PARAMS, keyRing.sharedEntries->authenticatorParamsMap);
+                    WriteJSONEntries (sink, KeyRing::TAG_AUTHENTICATOR_KEYS, keyRing.sharedEntries->authenticatorKeyMap);
+                }
+                WriteJSONKeys (sink, KeyRing::TAG_CIPHER_KEYS, keyRing.cipherKeyMap, keyRing.cipherKeyStore);
+                WriteJSONKeys (sink, KeyRing::TAG_MAC_KEYS, keyRing.macKeyMap, keyRing.macKeyStore);
+                WriteJSONEntries (sink, KeyRing::TAG_USER_DATAS, keyRing.userDataMap);
+                sink.Write (",\n");
+                WriteJSONName (sink, KeyRing::TAG_SUB_RINGS);
+                sink.Write ("[");
+                for (KeyRing::KeyRingMap::const_iterator
+                        begin = keyRing.subringMap.begin (),
+                        it = begin,
+                        end = keyRing.subringMap.end (); it != end; ++it) {
+                    if (it != begin) {
+                        sink.Write (",");
+                    }
+                    sink.Write ("\n");
+                    WriteJSONRing (sink, root, *it->second);
+                }
+                sink.Write ("]}");
+            }
+        };
+
+        KeyRing::SharedPtr KeyRing::LoadXML (const std::string &path) {
+            util::ReadOnlyFile file (util::HostEndian, path);
+            TextSource source (file);
+            XMLPullParser parser (source);
+            if (parser.NextMarkup () != XMLPullParser::MARKUP_START) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "%s is not an XML key ring.",
+                    path.c_str ());
+            }
+            std::string tag;
+            XMLPullParser::Attributes attributes;
+            bool empty = parser.ReadStartTag (tag, &attributes);
+            SharedPtr keyRing (new KeyRing (CipherSuite ()));
+            KeyRingTextStream::ReadXMLRing (parser, *keyRing, tag, attributes, empty);
+            if (parser.NextMarkup () != XMLPullParser::MARKUP_EOF) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "Trailing data in XML key ring %s.",
+                    path.c_str ());
+            }
+            keyRing->ResolveSharedEntries ();
+            keyRing->InvalidateIndex ();
+            return keyRing;
+        }
+
+        void KeyRing::SaveXML (const std::string &path) const {
+            TextSink sink (path);
+            sink.Write ("<?xml version=\"1.0\"?>\n");
+            KeyRingTextStream::WriteXMLRing (sink, *this, *this, TAG_KEY_RING);
+            sink.Flush ();
+        }
+
+        KeyRing::SharedPtr KeyRing::LoadJSON (const std::string &path) {
+            util::ReadOnlyFile file (util::HostEndian, path);
+            TextSource source (file);
+            JSONPullParser parser (source);
+            SharedPtr keyRing (new KeyRing (CipherSuite ()));
+            KeyRingTextStream::ReadJSONRing (parser, *keyRing);
+            if (parser.Peek () != EOF) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "Trailing data in JSON key ring %s.",
+                    path.c_str ());
+            }
+            keyRing->ResolveSharedEntries ();
+            keyRing->InvalidateIndex ();
+            return keyRing;
+        }
+
+        void KeyRing::SaveJSON (const std::string &path) const {
+            TextSink sink (path);
+            KeyRingTextStream::WriteJSONRing (sink, *this, *this);
+            sink.Write ("\n");
+            sink.Flush ();
+        }
+
+    } // namespace crypto
+} // namespace thekogans
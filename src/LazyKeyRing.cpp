@@ -0,0 +1,414 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include "thekogans/util/Buffer.h"
+#include "thekogans/util/Exception.h"
+#include "thekogans/crypto/LazyKeyRing.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        namespace {
+            enum {
+                ASSOCIATED_DATA_SIZE = util::UI8_SIZE + ID::SIZE
+            };
+
+            // Bind an entry's type and id to it's ciphertext.
+            void GetAssociatedData (
+                    util::ui8 type,
+                    const ID &id,
+                    util::ui8 associatedData[ASSOCIATED_DATA_SIZE]) {
+                associatedData[0] = type;
+                memcpy (associatedData + util::UI8_SIZE, id.data, ID::SIZE);
+            }
+
+            struct Writer {
+                util::SimpleFile &file;
+                Cipher &cipher;
+                util::ui64 offset;
+                std::vector<LazyKeyRingEntryInfo> entries;
+                IDHashMap<bool> written[LazyKeyRingEntryInfo::TYPE_COUNT];
+
+                Writer (
+                    util::SimpleFile &file_,
+                    Cipher &cipher_) :
+                    file (file_),
+                    cipher (cipher_),
+                    offset (LazyKeyRingHeader::SIZE) {}
+
+                template<typename T>
+                void Write (
+                        util::ui8 type,
+                        const std::vector<T> &serializables) {
+                    for (std::size_t i = 0, count = serializables.size (); i < count; ++i) {
+                        const Serializable &serializable = *serializables[i];
+                        // Flattening sub rings can produce duplicates.
+                        if (written[type].insert (
+                                IDHashMap<bool>::value_type (serializable.GetId (), true)).second) {
+                            util::Buffer plaintext (
+                                util::NetworkEndian,
+                                util::Serializable::Size (serializable));
+                            plaintext << serializable;
+                            util::ui8 associatedData[ASSOCIATED_DATA_SIZE];
+                            GetAssociatedData (type, serializable.GetId (), associatedData);
+                            util::Buffer ciphertext = cipher.Encrypt (
+                                plaintext.GetReadPtr (),
+                                plaintext.GetDataAvailableForReading (),
+                                associatedData,
+                                ASSOCIATED_DATA_SIZE);
+                            util::ui32 length = (util::ui32)ciphertext.GetDataAvailableForReading ();
+                            file.Write (ciphertext.GetReadPtr (), length);
+                            entries.push_back (
+                                LazyKeyRingEntryInfo (type, serializable.GetId (), offset, length));
+                            offset += length;
+                        }
+                    }
+                }
+            };
+        }
+
+        LazyKeyRing::LazyKeyRing (
+                const std::string &path,
+                Cipher::SharedPtr cipher_,
+                std::size_t maxCachedEntries_) :
+                file (util::NetworkEndian, path),
+                cipher (cipher_),
+                cipherSuite (CipherSuite::Empty),
+                maxCachedEntries (maxCachedEntries_) {
+            if (cipher.Get () == 0) {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+            util::ui64 fileSize = file.GetSize ();
+            if (fileSize < LazyKeyRingHeader::SIZE + LazyKeyRingFooter::SIZE) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "%s is not a lazy key ring file",
+                    path.c_str ());
+            }
+            LazyKeyRingHeader header;
+            file >> header;
+            if (header.magic != LazyKeyRingHeader::MAGIC ||
+                    header.version != LazyKeyRingHeader::VERSION) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "Invalid lazy key ring header in %s",
+                    path.c_str ());
+            }
+            file.Seek (fileSize - LazyKeyRingFooter::SIZE, SEEK_SET);
+            LazyKeyRingFooter footer;
+            file >> footer;
+            if (footer.magic != LazyKeyRingHeader::MAGIC ||
+                    footer.indexOffset < LazyKeyRingHeader::SIZE ||
+                    footer.indexOffset + footer.indexLength + LazyKeyRingFooter::SIZE != fileSize) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "Invalid lazy key ring footer in %s",
+                    path.c_str ());
+            }
+            std::vector<util::ui8> indexCiphertext (footer.indexLength);
+            file.Seek (footer.indexOffset, SEEK_SET);
+            if (file.Read (indexCiphertext.data (), footer.indexLength) != footer.indexLength) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "Unable to read %u bytes from %s",
+                    footer.indexLength,
+                    path.c_str ());
+            }
+            // Decrypt throws if the index was tampered with.
+            util::Buffer indexPlaintext = cipher->Decrypt (
+                indexCiphertext.data (),
+                indexCiphertext.size (),
+                0,
+                0,
+                true);
+            util::ui64 entryCount;
+            indexPlaintext >> cipherSuite >> entryCount;
+            if (entryCount > indexPlaintext.GetDataAvailableForReading () / LazyKeyRingEntryInfo::SIZE) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "Invalid lazy key ring index in %s",
+                    path.c_str ());
+            }
+            util::ui64 nextOffset = LazyKeyRingHeader::SIZE;
+            for (util::ui64 i = 0; i < entryCount; ++i) {
+                LazyKeyRingEntryInfo entryInfo;
+                indexPlaintext >> entryInfo;
+                // Entries are laid out in order, and all of them precede the index.
+                if (entryInfo.offset != nextOffset ||
+                        entryInfo.length <= CiphertextHeader::SIZE ||
+                        entryInfo.offset + entryInfo.length > footer.indexOffset ||
+                        !index[entryInfo.type].insert (
+                            IDHashMap<LazyKeyRingEntryInfo>::value_type (entryInfo.id, entryInfo)).second) {
+                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                        "Invalid index entry " THEKOGANS_UTIL_SIZE_T_FORMAT " in %s",
+                        (std::size_t)i,
+                        path.c_str ());
+                }
+                nextOffset = entryInfo.offset + entryInfo.length;
+            }
+        }
+
+        void LazyKeyRing::Save (
+                const std::string &path,
+                const KeyRing &keyRing,
+                Cipher &cipher,
+                bool recursive) {
+            util::SimpleFile file (
+                util::NetworkEndian,
+                path,
+                util::SimpleFile::ReadWrite |
+                util::SimpleFile::Create |
+                util::SimpleFile::Truncate);
+            file << LazyKeyRingHeader ();
+            Writer writer (file, cipher);
+            {
+                std::vector<Params::SharedPtr> params;
+                keyRing.GetKeyExchangeParams (params, recursive);
+                writer.Write (LazyKeyRingEntryInfo::KEY_EXCHANGE_PARAMS, params);
+            }
+            {
+                std::vector<AsymmetricKey::SharedPtr> keys;
+                keyRing.GetKeyExchangeKeys (keys, recursive);
+                writer.Write (LazyKeyRingEntryInfo::KEY_EXCHANGE_KEY, keys);
+            }
+            {
+                std::vector<Params::SharedPtr> params;
+                keyRing.GetAuthenticatorParams (params, recursive);
+                writer.Write (LazyKeyRingEntryInfo::AUTHENTICATOR_PARAMS, params);
+            }
+            {
+                std::vector<AsymmetricKey::SharedPtr> keys;
+                keyRing.GetAuthenticatorKeys (keys, recursive);
+                writer.Write (LazyKeyRingEntryInfo::AUTHENTICATOR_KEY, keys);
+            }
+            {
+                std::vector<SymmetricKey::SharedPtr> keys;
+                keyRing.GetCipherKeys (keys, recursive);
+                writer.Write (LazyKeyRingEntryInfo::CIPHER_KEY, keys);
+            }
+            {
+                std::vector<SymmetricKey::SharedPtr> keys;
+                keyRing.GetMACKeys (keys, recursive);
+                writer.Write (LazyKeyRingEntryInfo::MAC_KEY, keys);
+            }
+            {
+                std::vector<Serializable::SharedPtr> userData;
+                keyRing.GetUserData (userData, recursive);
+                writer.Write (LazyKeyRingEntryInfo::USER_DATA, userData);
+            }
+            util::Buffer indexPlaintext (
+                util::NetworkEndian,
+                keyRing.GetCipherSuite ().Size () +
+                util::UI64_SIZE +
+                writer.entries.size () * LazyKeyRingEntryInfo::SIZE);
+            indexPlaintext << keyRing.GetCipherSuite () << (util::ui64)writer.entries.size ();
+            for (std::size_t i = 0, count = writer.entries.size (); i < count; ++i) {
+                indexPlaintext << writer.entries[i];
+            }
+            util::Buffer indexCiphertext = cipher.Encrypt (
+                indexPlaintext.GetReadPtr (),
+                indexPlaintext.GetDataAvailableForReading ());
+            LazyKeyRingFooter footer;
+            footer.indexOffset = writer.offset;
+            footer.indexLength = (util::ui32)indexCiphertext.GetDataAvailableForReading ();
+            file.Write (indexCiphertext.GetReadPtr (), footer.indexLength);
+            file << footer;
+        }
+
+        std::size_t LazyKeyRing::GetEntryCount (util::ui8 type) const {
+            if (type < LazyKeyRingEntryInfo::TYPE_COUNT) {
+                return index[type].size ();
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        void LazyKeyRing::SetMaxCachedEntries (std::size_t maxCachedEntries_) {
+            maxCachedEntries = maxCachedEntries_;
+            Trim ();
+        }
+
+        Params::SharedPtr LazyKeyRing::GetKeyExchangeParams (const ID &paramsId) {
+            CacheEntry *entry = GetEntry (LazyKeyRingEntryInfo::KEY_EXCHANGE_PARAMS, paramsId);
+            return entry != 0 ?
+                util::dynamic_refcounted_sharedptr_cast<Params> (entry->serializable) :
+                Params::SharedPtr ();
+        }
+
+        AsymmetricKey::SharedPtr LazyKeyRing::GetKeyExchangeKey (const ID &keyId) {
+            CacheEntry *entry = GetEntry (LazyKeyRingEntryInfo::KEY_EXCHANGE_KEY, keyId);
+            return entry != 0 ?
+                util::dynamic_refcounted_sharedptr_cast<AsymmetricKey> (entry->serializable) :
+                AsymmetricKey::SharedPtr ();
+        }
+
+        Params::SharedPtr LazyKeyRing::GetAuthenticatorParams (const ID &paramsId) {
+            CacheEntry *entry = GetEntry (LazyKeyRingEntryInfo::AUTHENTICATOR_PARAMS, paramsId);
+            return entry != 0 ?
+                util::dynamic_refcounted_sharedptr_cast<Params> (entry->serializable) :
+                Params::SharedPtr ();
+        }
+
+        AsymmetricKey::SharedPtr LazyKeyRing::GetAuthenticatorKey (const ID &keyId) {
+            CacheEntry *entry = GetEntry (LazyKeyRingEntryInfo::AUTHENTICATOR_KEY, keyId);
+            return entry != 0 ?
+                util::dynamic_refcounted_sharedptr_cast<AsymmetricKey> (entry->serializable) :
+                AsymmetricKey::SharedPtr ();
+        }
+
+        Authenticator::SharedPtr LazyKeyRing::GetAuthenticator (const ID &keyId) {
+            CacheEntry *entry = GetEntry (LazyKeyRingEntryInfo::AUTHENTICATOR_KEY, keyId);
+            if (entry != 0) {
+                if (entry->authenticator.Get () == 0) {
+                    entry->authenticator = cipherSuite.GetAuthenticator (
+                        util::dynamic_refcounted_sharedptr_cast<AsymmetricKey> (entry->serializable));
+                }
+                return entry->authenticator;
+            }
+            return Authenticator::SharedPtr ();
+        }
+
+        SymmetricKey::SharedPtr LazyKeyRing::GetCipherKey (const ID &keyId) {
+            CacheEntry *entry = GetEntry (LazyKeyRingEntryInfo::CIPHER_KEY, keyId);
+            return entry != 0 ?
+                util::dynamic_refcounted_sharedptr_cast<SymmetricKey> (entry->serializable) :
+                SymmetricKey::SharedPtr ();
+        }
+
+        Cipher::SharedPtr LazyKeyRing::GetCipher (const ID &keyId) {
+            CacheEntry *entry = GetEntry (LazyKeyRingEntryInfo::CIPHER_KEY, keyId);
+            if (entry != 0) {
+                if (entry->cipher.Get () == 0) {
+                    entry->cipher = cipherSuite.GetCipher (
+                        util::dynamic_refcounted_sharedptr_cast<SymmetricKey> (entry->serializable));
+                }
+                return entry->cipher;
+            }
+            return Cipher::SharedPtr ();
+        }
+
+        SymmetricKey::SharedPtr LazyKeyRing::GetMACKey (const ID &keyId) {
+            CacheEntry *entry = GetEntry (LazyKeyRingEntryInfo::MAC_KEY, keyId);
+            return entry != 0 ?
+                util::dynamic_refcounted_sharedptr_cast<SymmetricKey> (entry->serializable) :
+                SymmetricKey::SharedPtr ();
+        }
+
+        MAC::SharedPtr LazyKeyRing::GetMAC (const ID &keyId) {
+            CacheEntry *entry = GetEntry (LazyKeyRingEntryInfo::MAC_KEY, keyId);
+            if (entry != 0) {
+                if (entry->mac.Get () == 0) {
+                    entry->mac = cipherSuite.GetHMAC (
+                        util::dynamic_refcounted_sharedptr_cast<SymmetricKey> (entry->serializable));
+                }
+                return entry->mac;
+            }
+            return MAC::SharedPtr ();
+        }
+
+        Serializable::SharedPtr LazyKeyRing::GetUserData (const ID &id) {
+            CacheEntry *entry = GetEntry (LazyKeyRingEntryInfo::USER_DATA, id);
+            return entry != 0 ? entry->serializable : Serializable::SharedPtr ();
+        }
+
+        bool LazyKeyRing::Evict (
+                util::ui8 type,
+                const ID &id) {
+            if (type < LazyKeyRingEntryInfo::TYPE_COUNT) {
+                IDHashMap<CacheList::iterator>::iterator it = cache[type].find (id);
+                if (it != cache[type].end ()) {
+                    cacheList.erase (it->second);
+                    cache[type].erase (it);
+                    return true;
+                }
+                return false;
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        void LazyKeyRing::EvictAll () {
+            for (std::size_t i = 0; i < LazyKeyRingEntryInfo::TYPE_COUNT; ++i) {
+                cache[i].clear ();
+            }
+            cacheList.clear ();
+        }
+
+        LazyKeyRing::CacheEntry *LazyKeyRing::GetEntry (
+                util::ui8 type,
+                const ID &id) {
+            {
+                IDHashMap<CacheList::iterator>::iterator it = cache[type].find (id);
+                if (it != cache[type].end ()) {
+                    // Move to the front (most recently used).
+                    cacheList.splice (cacheList.begin (), cacheList, it->second);
+                    return &*it->second;
+                }
+            }
+            IDHashMap<LazyKeyRingEntryInfo>::const_iterator it = index[type].find (id);
+            if (it == index[type].end ()) {
+                return 0;
+            }
+            const LazyKeyRingEntryInfo &entryInfo = it->second;
+            std::vector<util::ui8> ciphertext (entryInfo.length);
+            file.Seek (entryInfo.offset, SEEK_SET);
+            if (file.Read (ciphertext.data (), entryInfo.length) != entryInfo.length) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "Unable to read %u bytes from %s",
+                    entryInfo.length,
+                    file.GetPath ().c_str ());
+            }
+            util::ui8 associatedData[ASSOCIATED_DATA_SIZE];
+            GetAssociatedData (type, id, associatedData);
+            // Decrypt throws if the entry was tampered with (or moved).
+            util::Buffer plaintext = cipher->Decrypt (
+                ciphertext.data (),
+                ciphertext.size (),
+                associatedData,
+                ASSOCIATED_DATA_SIZE,
+                true);
+            Serializable::SharedPtr serializable;
+            plaintext >> serializable;
+            if (serializable.Get () == 0 || serializable->GetId () != id) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "Entry %s in %s does not match the index",
+                    id.ToHexString ().c_str (),
+                    file.GetPath ().c_str ());
+            }
+            cacheList.push_front (CacheEntry (type, serializable));
+            cache[type].insert (
+                IDHashMap<CacheList::iterator>::value_type (id, cacheList.begin ()));
+            // Trim evicts from the back, so the new entry stays.
+            if (maxCachedEntries > 0) {
+                Trim ();
+            }
+            return &cacheList.front ();
+        }
+
+        void LazyKeyRing::Trim () {
+            while (maxCachedEntries > 0 && cacheList.size () > maxCachedEntries) {
+                const CacheEntry &entry = cacheList.back ();
+                cache[entry.type].erase (entry.serializable->GetId ());
+                cacheList.pop_back ();
+            }
+        }
+
+    } // namespace crypto
+} // namespace thekogans
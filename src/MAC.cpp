@@ -15,9 +15,12 @@
 // You should have received a copy of the GNU General Public License
 // along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
 
+#include <cstring>
 #include <openssl/evp.h>
 #include "thekogans/util/Exception.h"
+#include "thekogans/util/DefaultAllocator.h"
 #include "thekogans/crypto/OpenSSLUtils.h"
+#include "thekogans/crypto/ConstantTime.h"
 #include "thekogans/crypto/MAC.h"
 
 namespace thekogans {
@@ -28,6 +31,8 @@ namespace thekogans {
                 std::size_t bufferLength,
                 util::ui8 *signature) {
             if (buffer != 0 && bufferLength > 0 && signature != 0) {
+                metrics.Update (Metrics::OPERATION_MAC, bufferLength);
+                Stats::Scope statsScope (stats, bufferLength);
                 Init ();
                 Update (buffer, bufferLength);
                 return Final (signature);
@@ -40,9 +45,15 @@ namespace thekogans {
 
         util::Buffer MAC::SignBuffer (
                 const void *buffer,
-                std::size_t bufferLength) {
+                std::size_t bufferLength,
+                util::Allocator *allocator) {
             if (buffer != 0 && bufferLength > 0) {
-                util::Buffer signature (util::HostEndian, GetMACLength ());
+                util::Buffer signature (
+                    util::HostEndian,
+                    GetMACLength (),
+                    0,
+                    0,
+                    allocator != 0 ? allocator : &util::DefaultAllocator::Instance ());
                 if (signature.AdvanceWriteOffset (
                         SignBuffer (buffer, bufferLength, signature.GetWritePtr ())) == GetMACLength ()) {
                     return signature;
@@ -68,11 +79,14 @@ namespace thekogans {
                 std::size_t signatureLength) {
             if (buffer != 0 && bufferLength > 0 &&
                     signature != 0 && signatureLength > 0) {
+                metrics.Update (Metrics::OPERATION_MAC, bufferLength);
+                Stats::Scope statsScope (stats, bufferLength);
                 util::ui8 computedSignature[EVP_MAX_MD_SIZE];
-                std::size_t computedSignatureLength =
-                    SignBuffer (buffer, bufferLength, computedSignature);
+                InitVerify (signature, signatureLength);
+                Update (buffer, bufferLength);
+                std::size_t computedSignatureLength = Final (computedSignature);
                 return signatureLength == computedSignatureLength &&
-                    TimeInsensitiveCompare (
+                    ConstantTimeCompare (
                         signature,
                         computedSignature,
                         signatureLength);
@@ -83,5 +97,93 @@ namespace thekogans {
             }
         }
 
+        std::size_t MAC::SignAndFrame (
+                const ID &keyId,
+                const void *buffer,
+                std::size_t bufferLength,
+                util::ui8 *frame) {
+            std::size_t macLength = GetMACLength ();
+            if (buffer != 0 && bufferLength > 0 &&
+                    bufferLength < util::UI32_MAX - FrameHeader::SIZE - macLength &&
+                    frame != 0) {
+                metrics.Update (Metrics::OPERATION_MAC, bufferLength);
+                Stats::Scope statsScope (stats, bufferLength);
+                util::ui8 *payload = frame + FrameHeader::SIZE;
+                if (buffer != payload) {
+                    memmove (payload, buffer, bufferLength);
+                }
+                util::TenantWriteBuffer header (util::NetworkEndian, frame, FrameHeader::SIZE);
+                header << FrameHeader (keyId, (util::ui32)(bufferLength + macLength));
+                // Header and payload are contiguous, so they're mac'ed in one go.
+                Init ();
+                Update (frame, FrameHeader::SIZE + bufferLength);
+                return FrameHeader::SIZE + bufferLength + Final (payload + bufferLength);
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        util::Buffer MAC::SignAndFrame (
+                const ID &keyId,
+                const void *buffer,
+                std::size_t bufferLength,
+                util::Allocator *allocator) {
+            if (buffer != 0 && bufferLength > 0) {
+                util::Buffer frame (
+                    util::NetworkEndian,
+                    GetFrameLength (bufferLength),
+                    0,
+                    0,
+                    allocator != 0 ? allocator : &util::DefaultAllocator::Instance ());
+                frame.AdvanceWriteOffset (
+                    SignAndFrame (keyId, buffer, bufferLength, frame.GetWritePtr ()));
+                return frame;
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        bool MAC::VerifyFrame (
+                const void *frame,
+                std::size_t frameLength,
+                const util::ui8 *&buffer,
+                std::size_t &bufferLength) {
+            if (frame != 0 && frameLength > FrameHeader::SIZE) {
+                std::size_t macLength = GetMACLength ();
+                FrameHeader frameHeader;
+                util::TenantReadBuffer header (util::NetworkEndian, frame, FrameHeader::SIZE);
+                header >> frameHeader;
+                if (frameHeader.ciphertextLength != frameLength - FrameHeader::SIZE ||
+                        frameHeader.ciphertextLength <= macLength) {
+                    return false;
+                }
+                std::size_t payloadLength = frameHeader.ciphertextLength - macLength;
+                const util::ui8 *payload = (const util::ui8 *)frame + FrameHeader::SIZE;
+                metrics.Update (Metrics::OPERATION_MAC, payloadLength);
+                Stats::Scope statsScope (stats, payloadLength);
+                util::ui8 computedSignature[EVP_MAX_MD_SIZE];
+                InitVerify (payload + payloadLength, macLength);
+                Update (frame, FrameHeader::SIZE + payloadLength);
+                if (Final (computedSignature) == macLength &&
+                        ConstantTimeCompare (
+                            payload + payloadLength,
+                            computedSignature,
+                            macLength)) {
+                    buffer = payload;
+                    bufferLength = payloadLength;
+                    return true;
+                }
+                return false;
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
     } // namespace crypto
 } // namespace thekogans
@@ -0,0 +1,371 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#include <cstring>
+#include <algorithm>
+#include "thekogans/util/Buffer.h"
+#include "thekogans/util/File.h"
+#include "thekogans/util/StringUtils.h"
+#include "thekogans/util/Exception.h"
+#include "thekogans/crypto/MappedKeyRing.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        namespace {
+            struct Entry {
+                util::ui8 type;
+                Serializable::SharedPtr serializable;
+
+                Entry (
+                    util::ui8 type_,
+                    Serializable::SharedPtr serializable_) :
+                    type (type_),
+                    serializable (serializable_) {}
+
+                // Record table order.
+                bool operator < (const Entry &entry) const {
+                    int result = memcmp (
+                        serializable->GetId ().data,
+                        entry.serializable->GetId ().data,
+                        ID::SIZE);
+                    return result < 0 || (result == 0 && type < entry.type);
+                }
+                bool operator == (const Entry &entry) const {
+                    return type == entry.type &&
+                        memcmp (
+                            serializable->GetId ().data,
+                            entry.serializable->GetId ().data,
+                            ID::SIZE) == 0;
+                }
+            };
+
+            template<typename T>
+            void AddEntries (
+                    util::ui8 type,
+                    const std::vector<T> &serializables,
+                    std::vector<Entry> &entries) {
+                for (std::size_t i = 0, count = serializables.size (); i < count; ++i) {
+                    entries.push_back (Entry (type, serializables[i]));
+                }
+            }
+
+            inline util::ui32 GetUI32 (const util::ui8 *ptr) {
+                return
+                    ((util::ui32)ptr[0] << 24) |
+                    ((util::ui32)ptr[1] << 16) |
+                    ((util::ui32)ptr[2] << 8) |
+                    (util::ui32)ptr[3];
+            }
+
+            inline util::ui64 GetUI64 (const util::ui8 *ptr) {
+                return ((util::ui64)GetUI32 (ptr) << 32) | GetUI32 (ptr + 4);
+            }
+
+            void CollectEntries (
+                    const KeyRing &keyRing,
+                    bool recursive,
+                    std::vector<Entry> &entries) {
+                {
+                    std::vector<Params::SharedPtr> params;
+                    keyRing.GetKeyExchangeParams (params, recursive);
+                    AddEntries (LazyKeyRingEntryInfo::KEY_EXCHANGE_PARAMS, params, entries);
+                }
+                {
+                    std::vector<AsymmetricKey::SharedPtr> keys;
+                    keyRing.GetKeyExchangeKeys (keys, recursive);
+                    AddEntries (LazyKeyRingEntryInfo::KEY_EXCHANGE_KEY, keys, entries);
+                }
+                {
+                    std::vector<Params::SharedPtr> params;
+                    keyRing.GetAuthenticatorParams (params, recursive);
+                    AddEntries (LazyKeyRingEntryInfo::AUTHENTICATOR_PARAMS, params, entries);
+                }
+                {
+                    std::vector<AsymmetricKey::SharedPtr> keys;
+                    keyRing.GetAuthenticatorKeys (keys, recursive);
+                    AddEntries (LazyKeyRingEntryInfo::AUTHENTICATOR_KEY, keys, entries);
+                }
+                {
+                    std::vector<SymmetricKey::SharedPtr> keys;
+                    keyRing.GetCipherKeys (keys, recursive);
+                    AddEntries (LazyKeyRingEntryInfo::CIPHER_KEY, keys, entries);
+                }
+                {
+                    std::vector<SymmetricKey::SharedPtr> keys;
+                    keyRing.GetMACKeys (keys, recursive);
+                    AddEntries (LazyKeyRingEntryInfo::MAC_KEY, keys, entries);
+                }
+                {
+                    std::vector<Serializable::SharedPtr> userData;
+                    keyRing.GetUserData (userData, recursive);
+                    AddEntries (LazyKeyRingEntryInfo::USER_DATA, userData, entries);
+                }
+                // Flattening sub rings can produce duplicates.
+                std::sort (entries.begin (), entries.end ());
+                entries.erase (std::unique (entries.begin (), entries.end ()), entries.end ());
+            }
+
+            // Fills in lengths with the entry sizes and returns the image size.
+            util::ui64 GetImageSize (
+                    const MappedKeyRingHeader &header,
+                    const std::vector<Entry> &entries,
+                    std::vector<util::ui32> &lengths) {
+                lengths.resize (entries.size ());
+                util::ui64 size = header.tableOffset + entries.size () * MappedKeyRingRecord::SIZE;
+                for (std::size_t i = 0, count = entries.size (); i < count; ++i) {
+                    lengths[i] = (util::ui32)util::Serializable::Size (*entries[i].serializable);
+                    size += lengths[i];
+                }
+                return size;
+            }
+
+            void WriteTable (
+                    const MappedKeyRingHeader &header,
+                    const std::vector<Entry> &entries,
+                    const std::vector<util::ui32> &lengths,
+                    util::Serializer &serializer) {
+                util::ui64 offset = header.tableOffset + entries.size () * MappedKeyRingRecord::SIZE;
+                for (std::size_t i = 0, count = entries.size (); i < count; ++i) {
+                    serializer.Write (entries[i].serializable->GetId ().data, ID::SIZE);
+                    serializer << entries[i].type << util::ui8 (0) << util::ui8 (0) << util::ui8 (0) <<
+                        lengths[i] << offset;
+                    offset += lengths[i];
+                }
+            }
+        }
+
+        MappedKeyRing::MappedKeyRing (const std::string &path) :
+                reader (new FileReader (path, true)),
+                data (0),
+                size (reader->GetSize ()),
+                table (0) {
+            if (size < header.Size () || size > (util::ui64)(std::size_t)-1) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "%s is not a mappable key ring file",
+                    path.c_str ());
+            }
+            if (reader->IsMapped ()) {
+                reader->Next (data);
+            }
+            else {
+                buffer.resize ((std::size_t)size);
+                if (reader->Read (buffer.data (), buffer.size ()) != buffer.size ()) {
+                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                        "Unable to read " THEKOGANS_UTIL_SIZE_T_FORMAT " bytes from %s",
+                        buffer.size (),
+                        path.c_str ());
+                }
+                data = buffer.data ();
+            }
+            ParseHeader (path);
+        }
+
+        MappedKeyRing::MappedKeyRing (
+                const util::ui8 *data_,
+                util::ui64 size_,
+                const std::string &source) :
+                data (data_),
+                size (size_),
+                table (0) {
+            if (data == 0 || size < header.Size () || size > (util::ui64)(std::size_t)-1) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "%s is not a mappable key ring image",
+                    source.c_str ());
+            }
+            ParseHeader (source);
+        }
+
+        void MappedKeyRing::ParseHeader (const std::string &source) {
+            util::TenantReadBuffer headerBuffer (
+                util::NetworkEndian,
+                (util::ui8 *)data,
+                (std::size_t)size);
+            headerBuffer >> header;
+            // Don't trust entryCount before checking it against
+            // the amount of data actually present.
+            if (header.magic != MappedKeyRingHeader::MAGIC ||
+                    header.version != MappedKeyRingHeader::VERSION ||
+                    header.tableOffset < header.Size () ||
+                    header.tableOffset > size ||
+                    header.entryCount > (size - header.tableOffset) / MappedKeyRingRecord::SIZE) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "Invalid mappable key ring header in %s",
+                    source.c_str ());
+            }
+            table = data + header.tableOffset;
+        }
+
+        void MappedKeyRing::Save (
+                const std::string &path,
+                const KeyRing &keyRing,
+                bool recursive) {
+            std::vector<Entry> entries;
+            CollectEntries (keyRing, recursive, entries);
+            MappedKeyRingHeader header (keyRing.GetCipherSuite (), entries.size ());
+            std::vector<util::ui32> lengths;
+            GetImageSize (header, entries, lengths);
+            util::Buffer table (
+                util::NetworkEndian,
+                entries.size () * MappedKeyRingRecord::SIZE);
+            WriteTable (header, entries, lengths, table);
+            util::SimpleFile file (
+                util::NetworkEndian,
+                path,
+                util::SimpleFile::ReadWrite |
+                util::SimpleFile::Create |
+                util::SimpleFile::Truncate);
+            file << header;
+            file.Write (table.GetReadPtr (), table.GetDataAvailableForReading ());
+            for (std::size_t i = 0, count = entries.size (); i < count; ++i) {
+                util::Buffer entry (
+                    util::NetworkEndian,
+                    util::Serializable::Size (*entries[i].serializable));
+                entry << *entries[i].serializable;
+                file.Write (entry.GetReadPtr (), entry.GetDataAvailableForReading ());
+            }
+        }
+
+        util::ui64 MappedKeyRing::Save (
+                const KeyRing &keyRing,
+                ImageAllocator &allocator,
+                bool recursive) {
+            std::vector<Entry> entries;
+            CollectEntries (keyRing, recursive, entries);
+            MappedKeyRingHeader header (keyRing.GetCipherSuite (), entries.size ());
+            std::vector<util::ui32> lengths;
+            util::ui64 size = GetImageSize (header, entries, lengths);
+            if (size > (util::ui64)(std::size_t)-1) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "Key ring image is too big (%s bytes)",
+                    util::ui64Tostring (size).c_str ());
+            }
+            util::ui8 *image = allocator.Allocate (size);
+            if (image == 0) {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_ENOMEM);
+            }
+            // The entries are serialized straight in to the image.
+            util::TenantWriteBuffer buffer (
+                util::NetworkEndian,
+                image,
+                (std::size_t)size);
+            buffer << header;
+            WriteTable (header, entries, lengths, buffer);
+            for (std::size_t i = 0, count = entries.size (); i < count; ++i) {
+                buffer << *entries[i].serializable;
+            }
+            return size;
+        }
+
+        bool MappedKeyRing::FindEntry (
+                util::ui8 type,
+                const ID &id,
+                const util::ui8 *&entry,
+                std::size_t &length) const {
+            util::ui64 low = 0;
+            util::ui64 high = header.entryCount;
+            while (low < high) {
+                util::ui64 middle = low + (high - low) / 2;
+                const util::ui8 *record = table + middle * MappedKeyRingRecord::SIZE;
+                int result = memcmp (record + MappedKeyRingRecord::ID_OFFSET, id.data, ID::SIZE);
+                if (result == 0) {
+                    result = (int)record[MappedKeyRingRecord::TYPE_OFFSET] - (int)type;
+                }
+                if (result < 0) {
+                    low = middle + 1;
+                }
+                else if (result > 0) {
+                    high = middle;
+                }
+                else {
+                    util::ui32 entryLength = GetUI32 (record + MappedKeyRingRecord::LENGTH_OFFSET);
+                    util::ui64 entryOffset = GetUI64 (record + MappedKeyRingRecord::ENTRY_OFFSET);
+                    // Records are validated when used (validating them
+                    // all up front would defeat the purpose).
+                    if (entryOffset < header.tableOffset + header.entryCount * MappedKeyRingRecord::SIZE ||
+                            entryOffset > size || entryLength > size - entryOffset) {
+                        THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                            "Invalid record for %s",
+                            id.ToHexString ().c_str ());
+                    }
+                    entry = data + entryOffset;
+                    length = entryLength;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        Serializable::SharedPtr MappedKeyRing::GetEntry (
+                util::ui8 type,
+                const ID &id) const {
+            const util::ui8 *entry;
+            std::size_t length;
+            if (FindEntry (type, id, entry, length)) {
+                util::TenantReadBuffer buffer (
+                    util::NetworkEndian,
+                    (util::ui8 *)entry,
+                    length);
+                Serializable::SharedPtr serializable;
+                buffer >> serializable;
+                if (serializable.Get () == 0 || serializable->GetId () != id) {
+                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                        "Entry %s does not match it's record",
+                        id.ToHexString ().c_str ());
+                }
+                return serializable;
+            }
+            return Serializable::SharedPtr ();
+        }
+
+        Params::SharedPtr MappedKeyRing::GetKeyExchangeParams (const ID &paramsId) const {
+            return util::dynamic_refcounted_sharedptr_cast<Params> (
+                GetEntry (LazyKeyRingEntryInfo::KEY_EXCHANGE_PARAMS, paramsId));
+        }
+
+        AsymmetricKey::SharedPtr MappedKeyRing::GetKeyExchangeKey (const ID &keyId) const {
+            return util::dynamic_refcounted_sharedptr_cast<AsymmetricKey> (
+                GetEntry (LazyKeyRingEntryInfo::KEY_EXCHANGE_KEY, keyId));
+        }
+
+        Params::SharedPtr MappedKeyRing::GetAuthenticatorParams (const ID &paramsId) const {
+            return util::dynamic_refcounted_sharedptr_cast<Params> (
+                GetEntry (LazyKeyRingEntryInfo::AUTHENTICATOR_PARAMS, paramsId));
+        }
+
+        AsymmetricKey::SharedPtr MappedKeyRing::GetAuthenticatorKey (const ID &keyId) const {
+            return util::dynamic_refcounted_sharedptr_cast<AsymmetricKey> (
+                GetEntry (LazyKeyRingEntryInfo::AUTHENTICATOR_KEY, keyId));
+        }
+
+        SymmetricKey::SharedPtr MappedKeyRing::GetCipherKey (const ID &keyId) const {
+            return util::dynamic_refcounted_sharedptr_cast<SymmetricKey> (
+                GetEntry (LazyKeyRingEntryInfo::CIPHER_KEY, keyId));
+        }
+
+        SymmetricKey::SharedPtr MappedKeyRing::GetMACKey (const ID &keyId) const {
+            return util::dynamic_refcounted_sharedptr_cast<SymmetricKey> (
+                GetEntry (LazyKeyRingEntryInfo::MAC_KEY, keyId));
+        }
+
+        Serializable::SharedPtr MappedKeyRing::GetUserData (const ID &id) const {
+            return GetEntry (LazyKeyRingEntryInfo::USER_DATA, id);
+        }
+
+    } // namespace crypto
+} // namespace thekogans
@@ -16,12 +16,15 @@
 // along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
 
 #include <cstring>
+#include <vector>
+#include <algorithm>
 #include <openssl/evp.h>
-#include "thekogans/util/File.h"
-#include "thekogans/util/FixedArray.h"
+#include "thekogans/util/DefaultAllocator.h"
+#include "thekogans/crypto/BlockPipeline.h"
 #include "thekogans/crypto/CipherSuite.h"
 #include "thekogans/crypto/OpenSSLInit.h"
 #include "thekogans/crypto/OpenSSLException.h"
+#include "thekogans/crypto/SHA2MultiBuffer.h"
 #include "thekogans/crypto/MessageDigest.h"
 
 namespace thekogans {
@@ -30,7 +33,10 @@ namespace thekogans {
         MessageDigest::MessageDigest (const EVP_MD *md_) :
                 md (md_) {
             if (md != 0) {
-                if (EVP_DigestInit_ex (&ctx, md, OpenSSLInit::engine) != 1) {
+                if (EVP_DigestInit_ex (
+                        &ctx,
+                        OpenSSLInit::FetchMessageDigest (md),
+                        OpenSSLInit::GetEngine (EVP_MD_type (md))) != 1) {
                     THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
                 }
             }
@@ -65,6 +71,7 @@ namespace thekogans {
                 const void *buffer,
                 std::size_t bufferLength) {
             if (buffer != 0 && bufferLength > 0) {
+                Stats::Scope statsScope (stats, bufferLength);
                 if (EVP_DigestUpdate (&ctx, buffer, bufferLength) != 1) {
                     THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
                 }
@@ -91,13 +98,39 @@ namespace thekogans {
             }
         }
 
+        MessageDigest::SharedPtr MessageDigest::Clone () const {
+            SharedPtr messageDigest (new MessageDigest (md));
+            messageDigest->CopyState (*this);
+            return messageDigest;
+        }
+
+        void MessageDigest::CopyState (const MessageDigest &messageDigest) {
+            if (&messageDigest != this) {
+                if (messageDigest.md == md) {
+                    if (EVP_MD_CTX_copy_ex (&ctx, &messageDigest.ctx) != 1) {
+                        THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
+                    }
+                }
+                else {
+                    THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                        THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+                }
+            }
+        }
+
         util::Buffer MessageDigest::HashBuffer (
                 const void *buffer,
-                std::size_t bufferLength) {
+                std::size_t bufferLength,
+                util::Allocator *allocator) {
             if (buffer != 0 && bufferLength > 0) {
                 Init ();
                 Update (buffer, bufferLength);
-                util::Buffer hash (util::HostEndian, GetMDLength (md));
+                util::Buffer hash (
+                    util::HostEndian,
+                    GetMDLength (md),
+                    0,
+                    0,
+                    allocator != 0 ? allocator : &util::DefaultAllocator::Instance ());
                 hash.AdvanceWriteOffset (Final (hash.GetWritePtr ()));
                 assert (hash.GetDataAvailableForWriting () == 0);
                 return hash;
@@ -108,14 +141,21 @@ namespace thekogans {
             }
         }
 
-        util::Buffer MessageDigest::HashFile (const std::string &path) {
-            util::ReadOnlyFile file (util::HostEndian, path);
+        util::Buffer MessageDigest::HashFile (
+                const std::string &path,
+                bool map,
+                std::size_t readBlockSize) {
+            FileReader file (path, map, readBlockSize);
+            return HashFile (file);
+        }
+
+        util::Buffer MessageDigest::HashFile (FileReader &file) {
             Init ();
-            util::FixedArray<util::ui8, 4096> buffer;
-            for (std::size_t count = file.Read (buffer, 4096);
+            const util::ui8 *chunk;
+            for (std::size_t count = file.Next (chunk);
                     count != 0;
-                    count = file.Read (buffer, 4096)) {
-                Update (buffer, count);
+                    count = file.Next (chunk)) {
+                Update (chunk, count);
             }
             util::Buffer hash (util::HostEndian, GetMDLength (md));
             hash.AdvanceWriteOffset (Final (hash.GetWritePtr ()));
@@ -123,5 +163,264 @@ namespace thekogans {
             return hash;
         }
 
+        void MessageDigest::HashBatch (
+                const void * const *buffers,
+                const std::size_t *bufferLengths,
+                std::size_t count,
+                util::ui8 *digests) {
+            if ((buffers != 0 && bufferLengths != 0 && digests != 0) || count == 0) {
+                for (std::size_t i = 0; i < count; ++i) {
+                    if (buffers[i] == 0 && bufferLengths[i] > 0) {
+                        THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                            THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+                    }
+                }
+                SHA2MultiBuffer::Algorithm algorithm;
+                if (count > 1 && SHA2MultiBuffer::GetAlgorithm (md, algorithm) &&
+                        SHA2MultiBuffer::GetLaneCount (algorithm) > 1) {
+                    SHA2MultiBuffer::Hash (algorithm, buffers, bufferLengths, count, digests);
+                    for (std::size_t i = 0; i < count; ++i) {
+                        stats.Update (bufferLengths[i]);
+                    }
+                }
+                else {
+                    std::size_t digestLength = GetMDLength (md);
+                    for (std::size_t i = 0; i < count; ++i) {
+                        Init ();
+                        if (bufferLengths[i] > 0) {
+                            Update (buffers[i], bufferLengths[i]);
+                        }
+                        Final (digests + i * digestLength);
+                    }
+                }
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        std::vector<util::Buffer> MessageDigest::HashBatch (
+                const void * const *buffers,
+                const std::size_t *bufferLengths,
+                std::size_t count,
+                util::Allocator *allocator) {
+            std::size_t digestLength = GetMDLength (md);
+            std::vector<util::ui8> digests (count * digestLength);
+            HashBatch (buffers, bufferLengths, count, digests.data ());
+            std::vector<util::Buffer> hashes;
+            hashes.reserve (count);
+            for (std::size_t i = 0; i < count; ++i) {
+                util::Buffer hash (
+                    util::HostEndian,
+                    digestLength,
+                    0,
+                    0,
+                    allocator != 0 ? allocator : &util::DefaultAllocator::Instance ());
+                memcpy (hash.GetWritePtr (), digests.data () + i * digestLength, digestLength);
+                hash.AdvanceWriteOffset (digestLength);
+                hashes.push_back (hash);
+            }
+            return hashes;
+        }
+
+        namespace {
+            const util::ui8 TREE_LEAF_PREFIX = 0x00;
+            const util::ui8 TREE_ROOT_PREFIX = 0x01;
+
+            // Leaves are read sequentially (from memory or from a file),
+            // hashed on the pipeline workers, and their hashes are fed
+            // to the root digest in order.
+            struct TreeHasher : public BlockPipeline {
+            private:
+                MessageDigest &root;
+                std::size_t leafLength;
+                const util::ui8 *buffer;
+                std::size_t bufferLength;
+                FileReader *file;
+                std::vector<util::ui8> *leafHashes;
+                util::ui64 totalLength;
+                std::vector<MessageDigest::SharedPtr> leafDigests;
+
+            public:
+                TreeHasher (
+                        MessageDigest &root_,
+                        const EVP_MD *md,
+                        std::size_t leafLength_,
+                        std::size_t workerCount,
+                        const util::ui8 *buffer_,
+                        std::size_t bufferLength_,
+                        FileReader *file_,
+                        std::vector<util::ui8> *leafHashes_ = 0) :
+                        BlockPipeline (workerCount),
+                        root (root_),
+                        leafLength (leafLength_),
+                        buffer (buffer_),
+                        bufferLength (bufferLength_),
+                        file (file_),
+                        leafHashes (leafHashes_),
+                        totalLength (0) {
+                    // Each worker gets it's own digest so that
+                    // leaves can be hashed without locking.
+                    leafDigests.resize (GetWorkerCount ());
+                    for (std::size_t i = 0, count = leafDigests.size (); i < count; ++i) {
+                        leafDigests[i].Reset (new MessageDigest (md));
+                    }
+                }
+
+                std::size_t Hash (util::ui8 *digest) {
+                    root.Init ();
+                    root.Update (&TREE_ROOT_PREFIX, 1);
+                    Run ();
+                    util::Buffer trailer (util::NetworkEndian, util::UI64_SIZE + util::UI64_SIZE);
+                    trailer << (util::ui64)leafLength << totalLength;
+                    root.Update (trailer.GetReadPtr (), trailer.GetDataAvailableForReading ());
+                    return root.Final (digest);
+                }
+
+            protected:
+                // BlockPipeline
+                virtual Block::SharedPtr ReadBlock () override {
+                    Block::SharedPtr block (new Block (leafLength, root.GetDigestLength ()));
+                    std::size_t length = 0;
+                    if (file != 0) {
+                        length = file->Read (block->input.GetWritePtr (), leafLength);
+                    }
+                    else if (totalLength < bufferLength) {
+                        length = (std::size_t)std::min (
+                            (util::ui64)leafLength, bufferLength - totalLength);
+                        memcpy (block->input.GetWritePtr (), buffer + totalLength, length);
+                    }
+                    if (length > 0) {
+                        block->input.AdvanceWriteOffset (length);
+                        totalLength += length;
+                        return block;
+                    }
+                    return Block::SharedPtr ();
+                }
+                virtual void ProcessBlock (
+                        std::size_t workerIndex,
+                        Block &block) override {
+                    block.output.AdvanceWriteOffset (
+                        leafDigests[workerIndex]->HashTreeLeaf (
+                            block.input.GetReadPtr (),
+                            block.input.GetDataAvailableForReading (),
+                            block.output.GetWritePtr ()));
+                }
+                virtual void WriteBlock (Block &block) override {
+                    root.Update (
+                        block.output.GetReadPtr (),
+                        block.output.GetDataAvailableForReading ());
+                    if (leafHashes != 0) {
+                        leafHashes->insert (
+                            leafHashes->end (),
+                            block.output.GetReadPtr (),
+                            block.output.GetReadPtr () + block.output.GetDataAvailableForReading ());
+                    }
+                }
+            };
+        }
+
+        util::Buffer MessageDigest::HashBufferTree (
+                const void *buffer,
+                std::size_t bufferLength,
+                std::size_t leafLength,
+                std::size_t workerCount,
+                util::Allocator *allocator) {
+            if (buffer != 0 && bufferLength > 0 && leafLength > 0) {
+                util::Buffer hash (
+                    util::HostEndian,
+                    GetMDLength (md),
+                    0,
+                    0,
+                    allocator != 0 ? allocator : &util::DefaultAllocator::Instance ());
+                hash.AdvanceWriteOffset (
+                    TreeHasher (
+                        *this,
+                        md,
+                        leafLength,
+                        workerCount,
+                        (const util::ui8 *)buffer,
+                        bufferLength,
+                        0).Hash (hash.GetWritePtr ()));
+                assert (hash.GetDataAvailableForWriting () == 0);
+                return hash;
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        util::Buffer MessageDigest::HashFileTree (
+                const std::string &path,
+                std::size_t leafLength,
+                std::size_t workerCount,
+                bool map,
+                std::vector<util::ui8> *leafHashes) {
+            if (leafLength > 0) {
+                FileReader file (path, map);
+                util::Buffer hash (util::HostEndian, GetMDLength (md));
+                hash.AdvanceWriteOffset (
+                    TreeHasher (
+                        *this,
+                        md,
+                        leafLength,
+                        workerCount,
+                        0,
+                        0,
+                        &file,
+                        leafHashes).Hash (hash.GetWritePtr ()));
+                assert (hash.GetDataAvailableForWriting () == 0);
+                return hash;
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        std::size_t MessageDigest::HashTreeLeaf (
+                const void *leaf,
+                std::size_t leafLength,
+                util::ui8 *digest) {
+            if ((leaf != 0 || leafLength == 0) && digest != 0) {
+                Init ();
+                Update (&TREE_LEAF_PREFIX, 1);
+                if (leafLength > 0) {
+                    Update (leaf, leafLength);
+                }
+                return Final (digest);
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        util::Buffer MessageDigest::HashTreeRoot (
+                const void *leafHashes,
+                std::size_t leafHashesLength,
+                util::ui64 leafLength,
+                util::ui64 totalLength) {
+            if ((leafHashes != 0 || leafHashesLength == 0) && leafLength > 0) {
+                Init ();
+                Update (&TREE_ROOT_PREFIX, 1);
+                if (leafHashesLength > 0) {
+                    Update (leafHashes, leafHashesLength);
+                }
+                util::Buffer trailer (util::NetworkEndian, util::UI64_SIZE + util::UI64_SIZE);
+                trailer << leafLength << totalLength;
+                Update (trailer.GetReadPtr (), trailer.GetDataAvailableForReading ());
+                util::Buffer hash (util::HostEndian, GetMDLength (md));
+                hash.AdvanceWriteOffset (Final (hash.GetWritePtr ()));
+                return hash;
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
     } // namespace crypto
 } // namespace thekogans
@@ -0,0 +1,240 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#include <map>
+#include <sstream>
+#include "thekogans/util/SpinLock.h"
+#include "thekogans/util/LockGuard.h"
+#include "thekogans/crypto/IDHashMap.h"
+#include "thekogans/crypto/CipherSuite.h"
+#include "thekogans/crypto/Metrics.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        namespace {
+            typedef IDHashMap<Metrics::Entry::SharedPtr> EntryMap;
+
+            // Leaked on purpose, so that components destroyed
+            // during static destruction can still report.
+            struct Registry {
+                util::SpinLock spinLock;
+                EntryMap entries;
+            };
+
+            Registry &GetRegistry () {
+                static Registry *registry = new Registry;
+                return *registry;
+            }
+
+            void Accumulate (
+                    Metrics::Sample &sample,
+                    const Metrics::Sample &entrySample) {
+                for (std::size_t i = 0; i < Metrics::OPERATION_COUNT; ++i) {
+                    sample.counts[i] += entrySample.counts[i];
+                    sample.byteCounts[i] += entrySample.byteCounts[i];
+                }
+            }
+        }
+
+        Metrics::Entry::Entry (const ID &keyId_) :
+                keyId (keyId_),
+                ringId (ID::Empty),
+                suite (CipherSuite::INVALID_CODE),
+                handleCount (0) {
+            for (std::size_t i = 0; i < OPERATION_COUNT; ++i) {
+                counts[i] = 0;
+                byteCounts[i] = 0;
+            }
+        }
+
+        Metrics::Handle::Handle (const ID &keyId) :
+                entry (GetEntry (keyId)) {
+            entry->handleCount.fetch_add (1, std::memory_order_relaxed);
+        }
+
+        Metrics::Handle::~Handle () {
+            if (entry.Get () != 0) {
+                entry->handleCount.fetch_sub (1, std::memory_order_relaxed);
+            }
+        }
+
+        void Metrics::Handle::Reset (const ID &keyId) {
+            Entry::SharedPtr newEntry = GetEntry (keyId);
+            newEntry->handleCount.fetch_add (1, std::memory_order_relaxed);
+            if (entry.Get () != 0) {
+                entry->handleCount.fetch_sub (1, std::memory_order_relaxed);
+            }
+            entry = newEntry;
+        }
+
+        Metrics::Sample::Sample () :
+                keyId (ID::Empty),
+                ringId (ID::Empty),
+                suite (CipherSuite::INVALID_CODE) {
+            for (std::size_t i = 0; i < OPERATION_COUNT; ++i) {
+                counts[i] = 0;
+                byteCounts[i] = 0;
+            }
+        }
+
+        Metrics::Entry::SharedPtr Metrics::GetEntry (const ID &keyId) {
+            Registry &registry = GetRegistry ();
+            util::LockGuard<util::SpinLock> guard (registry.spinLock);
+            EntryMap::iterator it = registry.entries.find (keyId);
+            if (it == registry.entries.end ()) {
+                it = registry.entries.insert (
+                    EntryMap::value_type (keyId, Entry::SharedPtr (new Entry (keyId)))).first;
+            }
+            return it->second;
+        }
+
+        void Metrics::SetLabels (
+                const ID &keyId,
+                const ID &ringId,
+                util::ui16 suite) {
+            Entry::SharedPtr entry = GetEntry (keyId);
+            Registry &registry = GetRegistry ();
+            util::LockGuard<util::SpinLock> guard (registry.spinLock);
+            entry->ringId = ringId;
+            entry->suite = suite;
+        }
+
+        std::vector<Metrics::Sample> Metrics::GetSnapshot (GroupBy groupBy) {
+            std::vector<Sample> samples;
+            {
+                Registry &registry = GetRegistry ();
+                util::LockGuard<util::SpinLock> guard (registry.spinLock);
+                samples.reserve (registry.entries.size ());
+                for (EntryMap::const_iterator
+                        it = registry.entries.begin (),
+                        end = registry.entries.end (); it != end; ++it) {
+                    const Entry &entry = *it->second;
+                    Sample sample;
+                    bool used = false;
+                    sample.keyId = entry.keyId;
+                    sample.ringId = entry.ringId;
+                    sample.suite = entry.suite;
+                    for (std::size_t i = 0; i < OPERATION_COUNT; ++i) {
+                        sample.counts[i] = entry.counts[i].load (std::memory_order_relaxed);
+                        sample.byteCounts[i] = entry.byteCounts[i].load (std::memory_order_relaxed);
+                        used = used || sample.counts[i] > 0;
+                    }
+                    // Skip entries that never counted anything.
+                    if (used) {
+                        samples.push_back (sample);
+                    }
+                }
+            }
+            if (groupBy == GROUP_BY_RING) {
+                std::map<ID, Sample> rings;
+                for (std::size_t i = 0, count = samples.size (); i < count; ++i) {
+                    Sample &ring = rings[samples[i].ringId];
+                    ring.ringId = samples[i].ringId;
+                    Accumulate (ring, samples[i]);
+                }
+                samples.clear ();
+                for (std::map<ID, Sample>::const_iterator
+                        it = rings.begin (),
+                        end = rings.end (); it != end; ++it) {
+                    samples.push_back (it->second);
+                }
+            }
+            else if (groupBy == GROUP_BY_SUITE) {
+                std::map<util::ui16, Sample> suites;
+                for (std::size_t i = 0, count = samples.size (); i < count; ++i) {
+                    Sample &suite = suites[samples[i].suite];
+                    suite.suite = samples[i].suite;
+                    Accumulate (suite, samples[i]);
+                }
+                samples.clear ();
+                for (std::map<util::ui16, Sample>::const_iterator
+                        it = suites.begin (),
+                        end = suites.end (); it != end; ++it) {
+                    samples.push_back (it->second);
+                }
+            }
+            return samples;
+        }
+
+        std::size_t Metrics::Prune () {
+            std::size_t count = 0;
+            Registry &registry = GetRegistry ();
+            util::LockGuard<util::SpinLock> guard (registry.spinLock);
+            // NOTE: erase moves the last entry in to the erased one's place.
+            for (std::size_t i = 0; i < registry.entries.size ();) {
+                EntryMap::iterator it = registry.entries.begin () + i;
+                if (it->second->handleCount.load (std::memory_order_relaxed) == 0) {
+                    registry.entries.erase (it);
+                    ++count;
+                }
+                else {
+                    ++i;
+                }
+            }
+            return count;
+        }
+
+        const char *Metrics::OperationToString (Operation operation) {
+            switch (operation) {
+                case OPERATION_ENCRYPT:
+                    return "encrypt";
+                case OPERATION_DECRYPT:
+                    return "decrypt";
+                case OPERATION_MAC:
+                    return "mac";
+                case OPERATION_SIGN:
+                    return "sign";
+                case OPERATION_VERIFY:
+                    return "verify";
+                case OPERATION_COUNT:
+                    break;
+            }
+            return "unknown";
+        }
+
+        std::string Metrics::ToOpenMetrics () {
+            std::vector<Sample> samples = GetSnapshot (GROUP_BY_KEY);
+            const char *names[] = {
+                "thekogans_crypto_operations",
+                "thekogans_crypto_bytes"
+            };
+            std::stringstream stream;
+            for (std::size_t i = 0; i < 2; ++i) {
+                stream << "# TYPE " << names[i] << " counter\n";
+                for (std::size_t j = 0, count = samples.size (); j < count; ++j) {
+                    const Sample &sample = samples[j];
+                    for (std::size_t k = 0; k < OPERATION_COUNT; ++k) {
+                        util::ui64 value = i == 0 ? sample.counts[k] : sample.byteCounts[k];
+                        if (value > 0) {
+                            stream << names[i] <<
+                                "_total{key=\"" << sample.keyId.ToHexString () <<
+                                "\",ring=\"" << sample.ringId.ToHexString () <<
+                                "\",suite=\"" <<
+                                CipherSuite::GetCipherSuiteByCode (sample.suite).ToString () <<
+                                "\",operation=\"" << OperationToString ((Operation)k) <<
+                                "\"} " << value << "\n";
+                        }
+                    }
+                }
+            }
+            stream << "# EOF\n";
+            return stream.str ();
+        }
+
+    } // namespace crypto
+} // namespace thekogans
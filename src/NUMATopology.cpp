@@ -0,0 +1,263 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#if defined (TOOLCHAIN_OS_Linux)
+    #include <sched.h>
+    #include <pthread.h>
+    #include <unistd.h>
+    #include <sys/syscall.h>
+    #include <cerrno>
+    #include <cstdio>
+    #include <cstdlib>
+#endif // defined (TOOLCHAIN_OS_Linux)
+#include <algorithm>
+#include "thekogans/util/SystemInfo.h"
+#include "thekogans/util/StringUtils.h"
+#include "thekogans/crypto/NUMATopology.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        namespace {
+        #if defined (TOOLCHAIN_OS_Linux)
+            // linux/mempolicy.h
+            const int MEMORY_POLICY_PREFERRED = 1;
+            const unsigned MEMORY_POLICY_MOVE = 1 << 1;
+
+            const char *NODE_DIRECTORY = "/sys/devices/system/node";
+
+            bool ReadLine (
+                    const std::string &path,
+                    std::string &line) {
+                FILE *file = fopen (path.c_str (), "r");
+                if (file != 0) {
+                    char buffer[4096];
+                    bool result = fgets (buffer, sizeof (buffer), file) != 0;
+                    fclose (file);
+                    if (result) {
+                        line = buffer;
+                        while (!line.empty () && (line.back () == '\n' || line.back () == ' ')) {
+                            line.pop_back ();
+                        }
+                    }
+                    return result;
+                }
+                return false;
+            }
+
+            // Parse a sysfs list ("0-3,8,10-11").
+            std::vector<std::size_t> ParseList (const std::string &list) {
+                std::vector<std::size_t> values;
+                const char *ptr = list.c_str ();
+                while (*ptr != '\0') {
+                    char *end;
+                    unsigned long first = strtoul (ptr, &end, 10);
+                    if (end == ptr) {
+                        break;
+                    }
+                    unsigned long last = first;
+                    ptr = end;
+                    if (*ptr == '-') {
+                        last = strtoul (ptr + 1, &end, 10);
+                        ptr = end;
+                    }
+                    for (unsigned long value = first; value <= last; ++value) {
+                        values.push_back ((std::size_t)value);
+                    }
+                    if (*ptr == ',') {
+                        ++ptr;
+                    }
+                    else {
+                        break;
+                    }
+                }
+                return values;
+            }
+
+            std::string FormatList (const std::vector<std::size_t> &values) {
+                std::string list;
+                for (std::size_t i = 0, count = values.size (); i < count;) {
+                    std::size_t j = i;
+                    while (j + 1 < count && values[j + 1] == values[j] + 1) {
+                        ++j;
+                    }
+                    if (!list.empty ()) {
+                        list += ",";
+                    }
+                    list += util::ui64Tostring ((util::ui64)values[i]);
+                    if (j > i) {
+                        list += "-" + util::ui64Tostring ((util::ui64)values[j]);
+                    }
+                    i = j + 1;
+                }
+                return list;
+            }
+        #endif // defined (TOOLCHAIN_OS_Linux)
+        }
+
+        const NUMATopology &NUMATopology::Instance () {
+            static NUMATopology *instance = new NUMATopology;
+            return *instance;
+        }
+
+        NUMATopology::NUMATopology () {
+        #if defined (TOOLCHAIN_OS_Linux)
+            std::string online;
+            if (ReadLine (std::string (NODE_DIRECTORY) + "/online", online)) {
+                std::vector<std::size_t> nodes = ParseList (online);
+                for (std::size_t i = 0, count = nodes.size (); i < count; ++i) {
+                    std::string cpuList;
+                    // Memory only nodes (no cpus) can't run workers.
+                    if (ReadLine (std::string (NODE_DIRECTORY) + "/node" +
+                                util::ui64Tostring ((util::ui64)nodes[i]) + "/cpulist", cpuList) &&
+                            !cpuList.empty ()) {
+                        std::vector<std::size_t> cpus = ParseList (cpuList);
+                        if (!cpus.empty ()) {
+                            for (std::size_t j = 0, cpuCount = cpus.size (); j < cpuCount; ++j) {
+                                if (cpuNodes.size () <= cpus[j]) {
+                                    cpuNodes.resize (cpus[j] + 1, NO_NODE);
+                                }
+                                cpuNodes[cpus[j]] = (int)nodeCPUs.size ();
+                            }
+                            nodeIds.push_back ((int)nodes[i]);
+                            nodeCPUs.push_back (cpus);
+                        }
+                    }
+                }
+            }
+        #endif // defined (TOOLCHAIN_OS_Linux)
+            if (nodeCPUs.empty ()) {
+                std::size_t cpuCount = util::SystemInfo::Instance ().GetCPUCount ();
+                if (cpuCount == 0) {
+                    cpuCount = 1;
+                }
+                nodeIds.assign (1, 0);
+                nodeCPUs.resize (1);
+                for (std::size_t i = 0; i < cpuCount; ++i) {
+                    nodeCPUs[0].push_back (i);
+                }
+                cpuNodes.assign (cpuCount, 0);
+            }
+        }
+
+        const std::vector<std::size_t> &NUMATopology::GetNodeCPUs (std::size_t node) const {
+            return nodeCPUs[node < nodeCPUs.size () ? node : 0];
+        }
+
+        int NUMATopology::GetCPUNode (std::size_t cpu) const {
+            return cpu < cpuNodes.size () ? cpuNodes[cpu] : (int)NO_NODE;
+        }
+
+        std::size_t NUMATopology::GetCurrentNode () const {
+        #if defined (TOOLCHAIN_OS_Linux)
+            if (IsNUMA ()) {
+                int cpu = sched_getcpu ();
+                if (cpu >= 0) {
+                    int node = GetCPUNode ((std::size_t)cpu);
+                    if (node != NO_NODE) {
+                        return (std::size_t)node;
+                    }
+                }
+            }
+        #endif // defined (TOOLCHAIN_OS_Linux)
+            return 0;
+        }
+
+        int NUMATopology::GetAddressNode (const void *address) const {
+        #if defined (TOOLCHAIN_OS_Linux)
+            if (address != 0) {
+                if (!IsNUMA ()) {
+                    return 0;
+                }
+                std::size_t pageSize = (std::size_t)sysconf (_SC_PAGESIZE);
+                void *page = (void *)((std::size_t)address & ~(pageSize - 1));
+                int status = -1;
+                // nodes == 0 == query (don't move).
+                if (syscall (__NR_move_pages, 0, 1UL, &page, (const int *)0, &status, 0) == 0 &&
+                        status >= 0) {
+                    std::vector<int>::const_iterator it =
+                        std::find (nodeIds.begin (), nodeIds.end (), status);
+                    if (it != nodeIds.end ()) {
+                        return (int)(it - nodeIds.begin ());
+                    }
+                }
+            }
+            return NO_NODE;
+        #else // defined (TOOLCHAIN_OS_Linux)
+            return address != 0 ? 0 : (int)NO_NODE;
+        #endif // defined (TOOLCHAIN_OS_Linux)
+        }
+
+        bool NUMATopology::BindCurrentThread (std::size_t node) const {
+        #if defined (TOOLCHAIN_OS_Linux)
+            if (node < nodeCPUs.size ()) {
+                const std::vector<std::size_t> &cpus = nodeCPUs[node];
+                cpu_set_t cpuSet;
+                CPU_ZERO (&cpuSet);
+                for (std::size_t i = 0, count = cpus.size (); i < count; ++i) {
+                    if (cpus[i] < CPU_SETSIZE) {
+                        CPU_SET (cpus[i], &cpuSet);
+                    }
+                }
+                return pthread_setaffinity_np (pthread_self (), sizeof (cpuSet), &cpuSet) == 0;
+            }
+        #endif // defined (TOOLCHAIN_OS_Linux)
+            return false;
+        }
+
+        bool NUMATopology::BindMemory (
+                const void *address,
+                std::size_t length,
+                std::size_t node) const {
+        #if defined (TOOLCHAIN_OS_Linux)
+            if (IsNUMA () && address != 0 && node < nodeIds.size ()) {
+                std::size_t pageSize = (std::size_t)sysconf (_SC_PAGESIZE);
+                std::size_t start = ((std::size_t)address + pageSize - 1) & ~(pageSize - 1);
+                std::size_t end = ((std::size_t)address + length) & ~(pageSize - 1);
+                if (start < end) {
+                    const std::size_t BITS_PER_WORD = sizeof (unsigned long) * 8;
+                    std::size_t nodeId = (std::size_t)nodeIds[node];
+                    std::vector<unsigned long> nodeMask (nodeId / BITS_PER_WORD + 1, 0);
+                    nodeMask[nodeId / BITS_PER_WORD] |= 1UL << (nodeId % BITS_PER_WORD);
+                    // The kernel ignores the last bit of maxnode.
+                    return syscall (__NR_mbind, start, end - start, MEMORY_POLICY_PREFERRED,
+                        nodeMask.data (), nodeMask.size () * BITS_PER_WORD + 1,
+                        MEMORY_POLICY_MOVE) == 0;
+                }
+            }
+        #endif // defined (TOOLCHAIN_OS_Linux)
+            return false;
+        }
+
+        std::string NUMATopology::ToString () const {
+            std::string description;
+            for (std::size_t i = 0, count = nodeCPUs.size (); i < count; ++i) {
+                if (!description.empty ()) {
+                    description += ", ";
+                }
+                description += "node " + util::ui64Tostring ((util::ui64)i) + ": ";
+            #if defined (TOOLCHAIN_OS_Linux)
+                description += FormatList (nodeCPUs[i]);
+            #else // defined (TOOLCHAIN_OS_Linux)
+                description += util::ui64Tostring ((util::ui64)nodeCPUs[i].size ()) + " cpus";
+            #endif // defined (TOOLCHAIN_OS_Linux)
+            }
+            return description;
+        }
+
+    } // namespace crypto
+} // namespace thekogans
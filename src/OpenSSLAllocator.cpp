@@ -16,6 +16,7 @@
 // along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
 
 #include <openssl/crypto.h>
+#include "thekogans/crypto/AllocationTracker.h"
 #include "thekogans/crypto/OpenSSLAllocator.h"
 
 namespace thekogans {
@@ -29,7 +30,14 @@ namespace thekogans {
         }
 
         void *OpenSSLAllocator::Alloc (std::size_t size) {
-            return size > 0 ? OPENSSL_malloc (size) : 0;
+            if (size == 0) {
+                return 0;
+            }
+            // Once the OpenSSL hooks are in, OPENSSL_malloc counts itself.
+            if (!AllocationTracker::AreOpenSSLHooksInstalled ()) {
+                AllocationTracker::Record (AllocationTracker::SOURCE_OPENSSL, size);
+            }
+            return OPENSSL_malloc (size);
         }
 
         void OpenSSLAllocator::Free (
@@ -26,6 +26,7 @@
 #include "thekogans/util/XMLUtils.h"
 #include "thekogans/crypto/OpenSSLInit.h"
 #include "thekogans/crypto/OpenSSLException.h"
+#include "thekogans/crypto/PublicKeyCache.h"
 #include "thekogans/crypto/OpenSSLAsymmetricKey.h"
 
 namespace thekogans {
@@ -66,6 +67,24 @@ namespace thekogans {
             }
         }
 
+        util::ui32 OpenSSLAsymmetricKey::GetKeyTypeId () const {
+            static const util::ui32 rsaKeyTypeId = InternKeyType (OPENSSL_PKEY_RSA);
+            static const util::ui32 dsaKeyTypeId = InternKeyType (OPENSSL_PKEY_DSA);
+            static const util::ui32 dhKeyTypeId = InternKeyType (OPENSSL_PKEY_DH);
+            static const util::ui32 ecKeyTypeId = InternKeyType (OPENSSL_PKEY_EC);
+            switch (EVP_PKEY_base_id (key.get ())) {
+                case EVP_PKEY_RSA:
+                    return rsaKeyTypeId;
+                case EVP_PKEY_DSA:
+                    return dsaKeyTypeId;
+                case EVP_PKEY_DH:
+                    return dhKeyTypeId;
+                case EVP_PKEY_EC:
+                    return ecKeyTypeId;
+            }
+            return AsymmetricKey::GetKeyTypeId ();
+        }
+
         AsymmetricKey::SharedPtr OpenSSLAsymmetricKey::LoadPrivateKeyFromBuffer (
                 const void *buffer,
                 std::size_t length,
@@ -296,15 +315,55 @@ namespace thekogans {
                     THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
                 }
             }
+
+            // Public keys seen before (same id, same bytes)
+            // are shared instead of decoded (see PublicKeyCache).
+            EVP_PKEYPtr ReadKey (
+                    bool isPrivate,
+                    const ID &id,
+                    const char *keyBuffer,
+                    std::size_t keyBufferLength) {
+                if (isPrivate) {
+                    return ReadKey (isPrivate, keyBuffer, keyBufferLength);
+                }
+                EVP_PKEYPtr key = PublicKeyCache::Instance ().Get (id, keyBuffer, keyBufferLength);
+                if (key.get () == 0) {
+                    key = ReadKey (isPrivate, keyBuffer, keyBufferLength);
+                    if (key.get () != 0) {
+                        PublicKeyCache::Instance ().Add (id, keyBuffer, keyBufferLength, *key);
+                    }
+                }
+                return key;
+            }
         }
 
         void OpenSSLAsymmetricKey::Read (
                 const BinHeader &header,
                 util::Serializer &serializer) {
             AsymmetricKey::Read (header, serializer);
-            util::SecureString keyBuffer;
-            serializer >> keyBuffer;
-            key = ReadKey (IsPrivate (), keyBuffer.data (), keyBuffer.size ());
+            // In memory serializers (util::Buffer, util::TenantReadBuffer
+            // over a received packet or a mapped file) let us decode the
+            // key in place instead of copying it out first.
+            util::Buffer *buffer = dynamic_cast<util::Buffer *> (&serializer);
+            if (buffer != 0) {
+                util::SizeT length;
+                serializer >> length;
+                if (length <= buffer->GetDataAvailableForReading ()) {
+                    key = ReadKey (IsPrivate (), GetId (),
+                        (const char *)buffer->GetReadPtr (), length);
+                    buffer->AdvanceReadOffset (length);
+                }
+                else {
+                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                        "Unable to read " THEKOGANS_UTIL_SIZE_T_FORMAT " bytes for key.",
+                        (std::size_t)length);
+                }
+            }
+            else {
+                util::SecureString keyBuffer;
+                serializer >> keyBuffer;
+                key = ReadKey (IsPrivate (), GetId (), keyBuffer.data (), keyBuffer.size ());
+            }
         }
 
         void OpenSSLAsymmetricKey::Write (util::Serializer &serializer) const {
@@ -316,7 +375,7 @@ namespace thekogans {
                 const TextHeader &header,
                 const pugi::xml_node &node) {
             AsymmetricKey::Read (header, node);
-            key = ReadKey (IsPrivate (), node.text ().get (), strlen (node.text ().get ()));
+            key = ReadKey (IsPrivate (), GetId (), node.text ().get (), strlen (node.text ().get ()));
         }
 
         void OpenSSLAsymmetricKey::Write (pugi::xml_node &node) const {
@@ -331,7 +390,7 @@ namespace thekogans {
                 const util::JSON::Object &object) {
             AsymmetricKey::Read (header, object);
             std::string keyBuffer = object.Get<util::JSON::Array> (TAG_KEY)->ToString ();
-            key = ReadKey (IsPrivate (), keyBuffer.data (), keyBuffer.size ());
+            key = ReadKey (IsPrivate (), GetId (), keyBuffer.data (), keyBuffer.size ());
         }
 
         void OpenSSLAsymmetricKey::Write (util::JSON::Object &object) const {
@@ -16,6 +16,7 @@
 // along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
 
 #include <openssl/err.h>
+#include "thekogans/crypto/OpenSSLInit.h"
 #include "thekogans/crypto/OpenSSLException.h"
 
 namespace thekogans {
@@ -29,6 +30,8 @@ namespace thekogans {
                 const char *buildTime,
                 const char *message) {
             if (file != 0 && function != 0 && buildTime != 0 && message != 0) {
+                // Error strings are loaded lazily (see OpenSSLInit::Profile).
+                OpenSSLInit::LoadErrorStrings ();
                 THEKOGANS_UTIL_ERROR_CODE errorCode = ERR_get_error ();
                 char buffer[256];
                 ERR_error_string_n (errorCode, buffer, sizeof (buffer));
@@ -18,6 +18,12 @@
 #if defined (TOOLCHAIN_OS_Windows)
     #include <winsock2.h>
 #endif // defined (TOOLCHAIN_OS_Windows)
+#include <atomic>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
 #include <openssl/ssl.h>
 #include <openssl/err.h>
 #include <openssl/evp.h>
@@ -26,20 +32,29 @@
 #include "thekogans/util/OwnerVector.h"
 #include "thekogans/util/Buffer.h"
 #include "thekogans/util/SpinLock.h"
+#include "thekogans/util/LockGuard.h"
+#include "thekogans/util/Mutex.h"
+#include "thekogans/util/Condition.h"
 #include "thekogans/util/Thread.h"
 #include "thekogans/util/RandomSource.h"
 #include "thekogans/util/Exception.h"
+#include "thekogans/util/LoggerMgr.h"
 #if defined (THEKOGANS_CRYPTO_HAVE_BLAKE2)
     #include "thekogans/crypto/Blake2b.h"
     #include "thekogans/crypto/Blake2s.h"
 #endif // defined (THEKOGANS_CRYPTO_HAVE_BLAKE2)
+#include "thekogans/crypto/Blake3.h"
 #if defined (THEKOGANS_CRYPTO_TYPE_Static)
     #include "thekogans/crypto/OpenSSLAllocator.h"
+    #include "thekogans/crypto/ThreadCacheAllocator.h"
     #include "thekogans/crypto/Serializable.h"
     #include "thekogans/crypto/Signer.h"
     #include "thekogans/crypto/Verifier.h"
 #endif // defined (THEKOGANS_CRYPTO_TYPE_Static)
 #include "thekogans/crypto/OpenSSLUtils.h"
+#include "thekogans/crypto/CPUFeatures.h"
+#include "thekogans/crypto/SecureMemoryStats.h"
+#include "thekogans/crypto/CipherSuite.h"
 #include "thekogans/crypto/OpenSSLInit.h"
 
 namespace thekogans {
@@ -47,6 +62,169 @@ namespace thekogans {
 
         ENGINE *OpenSSLInit::engine = 0;
 
+        namespace {
+            // Lazy algorithm registration (see OpenSSLInit::Profile).
+            util::SpinLock registrationSpinLock;
+            std::atomic<bool> lazyRegistration (false);
+            std::set<const void *> registered;
+            std::atomic<bool> errorStringsLoaded (false);
+
+            // Per algorithm engines (see OpenSSLInit::SetEngine).
+            util::SpinLock enginesSpinLock;
+            std::atomic<bool> haveEngines (false);
+            std::map<util::i32, ENGINE *> engines;
+            // OpenSSLInit::SoftwareScope.
+            thread_local bool softwareOnly = false;
+
+            // Fetched algorithm cache (see OpenSSLInit::FetchCipher).
+            util::SpinLock fetchSpinLock;
+            std::string propertyQuery;
+        #if OPENSSL_VERSION_NUMBER >= 0x30000000L
+            OSSL_LIB_CTX *libraryContext = 0;
+            // A 0 value means no implementation (use the legacy object).
+            std::map<const EVP_CIPHER *, EVP_CIPHER *> fetchedCiphers;
+            std::map<const EVP_MD *, EVP_MD *> fetchedMDs;
+            // Fetched before the last SetPropertyQuery/SetLibraryContext.
+            // Contexts created with them may still be alive, so they're
+            // only freed by ~OpenSSLInit.
+            std::vector<EVP_CIPHER *> retiredCiphers;
+            std::vector<EVP_MD *> retiredMDs;
+
+            // Only OpenSSL's own algorithms have provider implementations.
+            bool IsFetchable (const EVP_CIPHER *cipher) {
+                return
+                    cipher == EVP_aes_128_gcm () ||
+                    cipher == EVP_aes_192_gcm () ||
+                    cipher == EVP_aes_256_gcm () ||
+                    cipher == EVP_aes_128_cbc () ||
+                    cipher == EVP_aes_192_cbc () ||
+                    cipher == EVP_aes_256_cbc () ||
+                    cipher == EVP_aes_128_ctr () ||
+                    cipher == EVP_aes_192_ctr () ||
+            #if defined (THEKOGANS_CRYPTO_HAVE_CHACHA20_POLY1305)
+                    cipher == EVP_chacha20_poly1305 () ||
+            #endif // defined (THEKOGANS_CRYPTO_HAVE_CHACHA20_POLY1305)
+                    cipher == EVP_aes_256_ctr ();
+            }
+
+            bool IsFetchable (const EVP_MD *md) {
+                return
+                    md == EVP_sha1 () ||
+                    md == EVP_sha224 () ||
+                    md == EVP_sha256 () ||
+                    md == EVP_sha384 () ||
+                    md == EVP_sha512 ();
+            }
+
+            // Must be called with fetchSpinLock held.
+            void RetireFetched () {
+                for (std::map<const EVP_CIPHER *, EVP_CIPHER *>::const_iterator
+                        it = fetchedCiphers.begin (),
+                        end = fetchedCiphers.end (); it != end; ++it) {
+                    if (it->second != 0) {
+                        retiredCiphers.push_back (it->second);
+                    }
+                }
+                fetchedCiphers.clear ();
+                for (std::map<const EVP_MD *, EVP_MD *>::const_iterator
+                        it = fetchedMDs.begin (),
+                        end = fetchedMDs.end (); it != end; ++it) {
+                    if (it->second != 0) {
+                        retiredMDs.push_back (it->second);
+                    }
+                }
+                fetchedMDs.clear ();
+            }
+
+            void FreeFetched () {
+                util::LockGuard<util::SpinLock> guard (fetchSpinLock);
+                RetireFetched ();
+                for (std::size_t i = 0, count = retiredCiphers.size (); i < count; ++i) {
+                    EVP_CIPHER_free (retiredCiphers[i]);
+                }
+                retiredCiphers.clear ();
+                for (std::size_t i = 0, count = retiredMDs.size (); i < count; ++i) {
+                    EVP_MD_free (retiredMDs[i]);
+                }
+                retiredMDs.clear ();
+            }
+
+            inline const char *GetPropertyQueryCStr () {
+                return propertyQuery.empty () ? 0 : propertyQuery.c_str ();
+            }
+        #endif // OPENSSL_VERSION_NUMBER >= 0x30000000L
+
+            void SeedPRNG (util::ui32 entropyNeeded) {
+                util::SecureBuffer entropy (util::HostEndian, entropyNeeded);
+                // Start by trying to get seed bytes.
+                entropy.AdvanceWriteOffset (
+                    util::GlobalRandomSource::Instance ().GetSeed (
+                        entropy.GetWritePtr (),
+                        entropy.GetDataAvailableForWriting ()));
+                // If entropy couldn't be satisfied with seed bytes,
+                // get random bytes.
+                if (entropy.GetDataAvailableForWriting () > 0) {
+                    entropy.AdvanceWriteOffset (
+                        util::GlobalRandomSource::Instance ().GetBytes (
+                            entropy.GetWritePtr (),
+                            entropy.GetDataAvailableForWriting ()));
+                }
+                if (entropy.GetDataAvailableForWriting () == 0) {
+                    RAND_seed (
+                        entropy.GetReadPtr (),
+                        (util::i32)entropy.GetDataAvailableForReading ());
+                }
+                else {
+                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                        "Unable to get " THEKOGANS_UTIL_SIZE_T_FORMAT " random bytes for seed.",
+                        entropyNeeded);
+                }
+            }
+
+            // Asynchronous seeding (see OpenSSLInit::WaitForSeed).
+            util::Mutex seedMutex;
+            util::Condition seedCondition (seedMutex);
+            std::atomic<bool> seeded (true);
+            std::string seedError;
+            std::vector<OpenSSLInit::SeedCallback::SharedPtr> seedCallbacks;
+
+            void CompleteSeeding (const std::string &error) {
+                std::vector<OpenSSLInit::SeedCallback::SharedPtr> callbacks;
+                {
+                    util::LockGuard<util::Mutex> guard (seedMutex);
+                    seedError = error;
+                    seeded.store (true, std::memory_order_release);
+                    callbacks.swap (seedCallbacks);
+                    seedCondition.SignalAll ();
+                }
+                for (std::size_t i = 0, count = callbacks.size (); i < count; ++i) {
+                    callbacks[i]->OnSeeded (error);
+                }
+            }
+
+            struct SeedThread : public util::Thread {
+                util::ui32 entropyNeeded;
+
+                explicit SeedThread (util::ui32 entropyNeeded_) :
+                    entropyNeeded (entropyNeeded_) {}
+
+            protected:
+                // util::Thread
+                virtual void Run () throw () override {
+                    std::string error;
+                    THEKOGANS_UTIL_TRY {
+                        SeedPRNG (entropyNeeded);
+                    }
+                    THEKOGANS_UTIL_CATCH (util::Exception) {
+                        THEKOGANS_UTIL_LOG_ERROR ("%s\n", exception.Report ().c_str ());
+                        error = exception.Report ();
+                    }
+                    CompleteSeeding (error);
+                }
+            };
+            std::unique_ptr<SeedThread> seedThread;
+        }
+
     #if OPENSSL_VERSION_NUMBER < 0x10100000L
         namespace {
             util::OwnerVector<util::SpinLock> staticLocks;
@@ -107,14 +285,19 @@ namespace thekogans {
                 bool multiThreaded,
                 util::ui32 entropyNeeded,
                 util::ui64 workingSetSize,
-                ENGINE *engine_) {
+                ENGINE *engine_,
+                util::ui64 maxWorkingSetSize,
+                const Profile *profile,
+                bool seedAsync) {
         #if defined (THEKOGANS_CRYPTO_TYPE_Static)
             OpenSSLAllocator::StaticInit ();
+            ThreadCacheAllocator::StaticInit ();
+            SecureMemoryAllocator::StaticInit ();
             Serializable::StaticInit ();
             Signer::StaticInit ();
             Verifier::StaticInit ();
         #endif // defined (THEKOGANS_CRYPTO_TYPE_Static)
-            util::SecureAllocator::ReservePages (workingSetSize, workingSetSize);
+            SecureMemoryStats::SetWorkingSetSize (workingSetSize, maxWorkingSetSize);
         #if OPENSSL_VERSION_NUMBER < 0x10100000L
             if (multiThreaded) {
                 util::i32 lockCount = CRYPTO_num_locks ();
@@ -133,39 +316,62 @@ namespace thekogans {
                 CRYPTO_set_dynlock_destroy_callback (DynlockDestroyFunction);
             }
         #endif // OPENSSL_VERSION_NUMBER < 0x10100000L
-            SSL_library_init ();
-            SSL_load_error_strings ();
-            OpenSSL_add_all_algorithms ();
-        #if defined (THEKOGANS_CRYPTO_HAVE_BLAKE2)
-            EVP_add_digest (EVP_blake2b512 ());
-            EVP_add_digest (EVP_blake2b384 ());
-            EVP_add_digest (EVP_blake2b256 ());
-            EVP_add_digest (EVP_blake2s256 ());
-        #endif // defined (THEKOGANS_CRYPTO_HAVE_BLAKE2)
-            if (entropyNeeded >= MIN_ENTROPY_NEEDED) {
-                util::SecureBuffer entropy (util::HostEndian, entropyNeeded);
-                // Start by trying to get seed bytes.
-                entropy.AdvanceWriteOffset (
-                    util::GlobalRandomSource::Instance ().GetSeed (
-                        entropy.GetWritePtr (),
-                        entropy.GetDataAvailableForWriting ()));
-                // If entropy couldn't be satisfied with seed bytes,
-                // get random bytes.
-                if (entropy.GetDataAvailableForWriting () > 0) {
-                    entropy.AdvanceWriteOffset (
-                        util::GlobalRandomSource::Instance ().GetBytes (
-                            entropy.GetWritePtr (),
-                            entropy.GetDataAvailableForWriting ()));
+            if (profile == 0) {
+                SSL_library_init ();
+                LoadErrorStrings ();
+                OpenSSL_add_all_algorithms ();
+            #if defined (THEKOGANS_CRYPTO_HAVE_BLAKE2)
+                EVP_add_digest (EVP_blake2b512 ());
+                EVP_add_digest (EVP_blake2b384 ());
+                EVP_add_digest (EVP_blake2b256 ());
+                EVP_add_digest (EVP_blake2s256 ());
+                EVP_add_digest (EVP_blake2bp512 ());
+                EVP_add_digest (EVP_blake2sp256 ());
+            #endif // defined (THEKOGANS_CRYPTO_HAVE_BLAKE2)
+                EVP_add_digest (EVP_blake3_256 ());
+            }
+            else {
+            #if OPENSSL_VERSION_NUMBER < 0x10100000L
+                SSL_library_init ();
+            #else // OPENSSL_VERSION_NUMBER < 0x10100000L
+                // Tell OpenSSL not to register everything behind our back
+                // (on its own implicit initialization).
+                OPENSSL_init_ssl (
+                    OPENSSL_INIT_NO_LOAD_SSL_STRINGS |
+                    OPENSSL_INIT_NO_LOAD_CRYPTO_STRINGS |
+                    OPENSSL_INIT_NO_ADD_ALL_CIPHERS |
+                    OPENSSL_INIT_NO_ADD_ALL_DIGESTS,
+                    0);
+            #endif // OPENSSL_VERSION_NUMBER < 0x10100000L
+                lazyRegistration = true;
+                if (profile->loadErrorStrings) {
+                    LoadErrorStrings ();
                 }
-                if (entropy.GetDataAvailableForWriting () == 0) {
-                    RAND_seed (
-                        entropy.GetReadPtr (),
-                        (util::i32)entropy.GetDataAvailableForReading ());
+                for (std::size_t i = 0, count = profile->ciphers.size (); i < count; ++i) {
+                    if (CipherSuite::GetOpenSSLCipherByName (profile->ciphers[i]) == 0) {
+                        THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                            "Unknown cipher: %s", profile->ciphers[i].c_str ());
+                    }
+                }
+                for (std::size_t i = 0, count = profile->messageDigests.size (); i < count; ++i) {
+                    if (CipherSuite::GetOpenSSLMessageDigestByName (profile->messageDigests[i]) == 0) {
+                        THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                            "Unknown message digest: %s", profile->messageDigests[i].c_str ());
+                    }
+                }
+            }
+            if (entropyNeeded >= MIN_ENTROPY_NEEDED) {
+                if (seedAsync) {
+                    {
+                        util::LockGuard<util::Mutex> guard (seedMutex);
+                        seeded = false;
+                        seedError.clear ();
+                    }
+                    seedThread.reset (new SeedThread (entropyNeeded));
+                    seedThread->Create ();
                 }
                 else {
-                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
-                        "Unable to get " THEKOGANS_UTIL_SIZE_T_FORMAT " random bytes for seed.",
-                        entropyNeeded);
+                    SeedPRNG (entropyNeeded);
                 }
             }
             else {
@@ -175,6 +381,11 @@ namespace thekogans {
                     MIN_ENTROPY_NEEDED);
             }
             engine = engine_;
+            // Make the accelerated code paths visible. A silent fall
+            // back to software AES is otherwise very hard to diagnose.
+            THEKOGANS_UTIL_LOG_INFO (
+                "%s",
+                CPUFeatures::Instance ().ToString ().c_str ());
             // FIXME: load a CRL.
         #if OPENSSL_VERSION_NUMBER < 0x10100000L
             util::Thread::AddExitFunc (ExitFunc);
@@ -182,6 +393,11 @@ namespace thekogans {
         }
 
         OpenSSLInit::~OpenSSLInit () {
+            // Don't pull OpenSSL out from under the seed thread.
+            if (seedThread.get () != 0) {
+                seedThread->Wait ();
+                seedThread.reset ();
+            }
         #if OPENSSL_VERSION_NUMBER < 0x10100000L
             CRYPTO_set_dynlock_destroy_callback (0);
             CRYPTO_set_dynlock_lock_callback (0);
@@ -192,11 +408,203 @@ namespace thekogans {
         #endif // OPENSSL_VERSION_NUMBER < 0x10100000L
             ERR_free_strings ();
             EVP_cleanup ();
+            {
+                util::LockGuard<util::SpinLock> guard (registrationSpinLock);
+                lazyRegistration = false;
+                registered.clear ();
+                errorStringsLoaded = false;
+            }
+            ClearEngines ();
+        #if OPENSSL_VERSION_NUMBER >= 0x30000000L
+            FreeFetched ();
+        #endif // OPENSSL_VERSION_NUMBER >= 0x30000000L
         #if defined (THEKOGANS_CRYPTO_HAVE_BLAKE2)
             // WARNING: Do not uncomment!!!
             //OBJ_cleanup ();
         #endif // defined (THEKOGANS_CRYPTO_HAVE_BLAKE2)
         }
 
+        void OpenSSLInit::RegisterCipher (const EVP_CIPHER *cipher) {
+            if (cipher != 0 && lazyRegistration) {
+                util::LockGuard<util::SpinLock> guard (registrationSpinLock);
+                if (registered.insert (cipher).second) {
+                    EVP_add_cipher (cipher);
+                }
+            }
+        }
+
+        void OpenSSLInit::RegisterMessageDigest (const EVP_MD *md) {
+            if (md != 0 && lazyRegistration) {
+                util::LockGuard<util::SpinLock> guard (registrationSpinLock);
+                if (registered.insert (md).second) {
+                    EVP_add_digest (md);
+                }
+            }
+        }
+
+        bool OpenSSLInit::IsSeeded () {
+            return seeded.load (std::memory_order_acquire);
+        }
+
+        void OpenSSLInit::WaitForSeed () {
+            if (!seeded.load (std::memory_order_acquire)) {
+                util::LockGuard<util::Mutex> guard (seedMutex);
+                while (!seeded.load (std::memory_order_acquire)) {
+                    seedCondition.Wait ();
+                }
+            }
+            if (!seedError.empty ()) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION ("%s", seedError.c_str ());
+            }
+        }
+
+        void OpenSSLInit::AddSeedCallback (SeedCallback::SharedPtr callback) {
+            if (callback.Get () != 0) {
+                std::string error;
+                {
+                    util::LockGuard<util::Mutex> guard (seedMutex);
+                    if (!seeded.load (std::memory_order_acquire)) {
+                        seedCallbacks.push_back (callback);
+                        return;
+                    }
+                    error = seedError;
+                }
+                callback->OnSeeded (error);
+            }
+        }
+
+        void OpenSSLInit::LoadErrorStrings () {
+            if (!errorStringsLoaded) {
+                util::LockGuard<util::SpinLock> guard (registrationSpinLock);
+                if (!errorStringsLoaded) {
+                    SSL_load_error_strings ();
+                    errorStringsLoaded = true;
+                }
+            }
+        }
+
+        void OpenSSLInit::SetPropertyQuery (const std::string &propertyQuery_) {
+            util::LockGuard<util::SpinLock> guard (fetchSpinLock);
+            if (propertyQuery != propertyQuery_) {
+                propertyQuery = propertyQuery_;
+            #if OPENSSL_VERSION_NUMBER >= 0x30000000L
+                RetireFetched ();
+            #endif // OPENSSL_VERSION_NUMBER >= 0x30000000L
+            }
+        }
+
+        std::string OpenSSLInit::GetPropertyQuery () {
+            util::LockGuard<util::SpinLock> guard (fetchSpinLock);
+            return propertyQuery;
+        }
+
+    #if OPENSSL_VERSION_NUMBER >= 0x30000000L
+        void OpenSSLInit::SetLibraryContext (OSSL_LIB_CTX *libraryContext_) {
+            util::LockGuard<util::SpinLock> guard (fetchSpinLock);
+            if (libraryContext != libraryContext_) {
+                libraryContext = libraryContext_;
+                RetireFetched ();
+            }
+        }
+
+        OSSL_LIB_CTX *OpenSSLInit::GetLibraryContext () {
+            util::LockGuard<util::SpinLock> guard (fetchSpinLock);
+            return libraryContext;
+        }
+    #endif // OPENSSL_VERSION_NUMBER >= 0x30000000L
+
+        const EVP_CIPHER *OpenSSLInit::FetchCipher (const EVP_CIPHER *cipher) {
+        #if OPENSSL_VERSION_NUMBER >= 0x30000000L
+            if (cipher != 0 &&
+                    GetEngine (EVP_CIPHER_nid (cipher)) == 0 && IsFetchable (cipher)) {
+                util::LockGuard<util::SpinLock> guard (fetchSpinLock);
+                std::map<const EVP_CIPHER *, EVP_CIPHER *>::const_iterator it =
+                    fetchedCiphers.find (cipher);
+                if (it == fetchedCiphers.end ()) {
+                    it = fetchedCiphers.insert (
+                        std::map<const EVP_CIPHER *, EVP_CIPHER *>::value_type (cipher,
+                            EVP_CIPHER_fetch (libraryContext,
+                                OBJ_nid2sn (EVP_CIPHER_nid (cipher)),
+                                GetPropertyQueryCStr ()))).first;
+                    if (it->second == 0) {
+                        ERR_clear_error ();
+                    }
+                }
+                if (it->second != 0) {
+                    return it->second;
+                }
+            }
+        #endif // OPENSSL_VERSION_NUMBER >= 0x30000000L
+            return cipher;
+        }
+
+        const EVP_MD *OpenSSLInit::FetchMessageDigest (const EVP_MD *md) {
+        #if OPENSSL_VERSION_NUMBER >= 0x30000000L
+            if (md != 0 &&
+                    GetEngine (EVP_MD_type (md)) == 0 && IsFetchable (md)) {
+                util::LockGuard<util::SpinLock> guard (fetchSpinLock);
+                std::map<const EVP_MD *, EVP_MD *>::const_iterator it =
+                    fetchedMDs.find (md);
+                if (it == fetchedMDs.end ()) {
+                    it = fetchedMDs.insert (
+                        std::map<const EVP_MD *, EVP_MD *>::value_type (md,
+                            EVP_MD_fetch (libraryContext,
+                                OBJ_nid2sn (EVP_MD_type (md)),
+                                GetPropertyQueryCStr ()))).first;
+                    if (it->second == 0) {
+                        ERR_clear_error ();
+                    }
+                }
+                if (it->second != 0) {
+                    return it->second;
+                }
+            }
+        #endif // OPENSSL_VERSION_NUMBER >= 0x30000000L
+            return md;
+        }
+
+        void OpenSSLInit::SetEngine (
+                util::i32 nid,
+                ENGINE *engine_) {
+            if (nid != NID_undef) {
+                util::LockGuard<util::SpinLock> guard (enginesSpinLock);
+                engines[nid] = engine_;
+                haveEngines = true;
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        void OpenSSLInit::ClearEngines () {
+            util::LockGuard<util::SpinLock> guard (enginesSpinLock);
+            engines.clear ();
+            haveEngines = false;
+        }
+
+        ENGINE *OpenSSLInit::GetEngine (util::i32 nid) {
+            if (softwareOnly) {
+                return 0;
+            }
+            if (haveEngines) {
+                util::LockGuard<util::SpinLock> guard (enginesSpinLock);
+                std::map<util::i32, ENGINE *>::const_iterator it = engines.find (nid);
+                if (it != engines.end ()) {
+                    return it->second;
+                }
+            }
+            return engine;
+        }
+
+        OpenSSLInit::SoftwareScope::SoftwareScope () :
+                previous (softwareOnly) {
+            softwareOnly = true;
+        }
+
+        OpenSSLInit::SoftwareScope::~SoftwareScope () {
+            softwareOnly = previous;
+        }
+
     } // namespace crypto
 } // namespace thekogans
@@ -16,6 +16,8 @@
 // along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
 
 #include <sstream>
+#include <openssl/opensslv.h>
+#include <openssl/crypto.h>
 #include <openssl/evp.h>
 #include <openssl/ec.h>
 #include "thekogans/util/Types.h"
@@ -26,6 +28,7 @@
 #include "thekogans/crypto/OpenSSLInit.h"
 #include "thekogans/crypto/OpenSSLException.h"
 #include "thekogans/crypto/OpenSSLAsymmetricKey.h"
+#include "thekogans/crypto/TextEncoding.h"
 #include "thekogans/crypto/OpenSSLParams.h"
 
 namespace thekogans {
@@ -64,9 +67,10 @@ namespace thekogans {
                 const ID &id,
                 const std::string &name,
                 const std::string &description) const {
+            OpenSSLInit::WaitForSeed ();
             EVP_PKEY *key = 0;
             EVP_PKEY_CTXPtr ctx (
-                EVP_PKEY_CTX_new (params.get (), OpenSSLInit::engine));
+                EVP_PKEY_CTX_new (params.get (), OpenSSLInit::GetEngine (EVP_PKEY_base_id (params.get ()))));
             if (ctx.get () != 0 &&
                     EVP_PKEY_keygen_init (ctx.get ()) == 1 &&
                     EVP_PKEY_keygen (ctx.get (), &key) == 1) {
@@ -78,6 +82,19 @@ namespace thekogans {
             }
         }
 
+        Params::SharedPtr OpenSSLParams::Share (
+                const OpenSSLParams &params,
+                const ID &id,
+                const std::string &name,
+                const std::string &description) {
+        #if OPENSSL_VERSION_NUMBER < 0x10100000L
+            CRYPTO_add (&params.Get ()->references, 1, CRYPTO_LOCK_EVP_PKEY);
+        #else // OPENSSL_VERSION_NUMBER < 0x10100000L
+            EVP_PKEY_up_ref (params.Get ());
+        #endif // OPENSSL_VERSION_NUMBER < 0x10100000L
+            return Params::SharedPtr (new OpenSSLParams (EVP_PKEYPtr (params.Get ()), id, name, description));
+        }
+
         OpenSSLParams::SharedPtr OpenSSLParams::LoadFromFile (
                 const std::string &path,
                 util::i32 paramsType,
@@ -267,7 +284,7 @@ namespace thekogans {
                 if (params.get () != 0) {
                     if (paramsType == OPENSSL_PKEY_DH || paramsType == OPENSSL_PKEY_DSA || paramsType == OPENSSL_PKEY_EC) {
                         util::SecureVector<util::ui8> decodedParams (paramsBuffer.size () / 2);
-                        util::HexDecodeBuffer (paramsBuffer.data (), paramsBuffer.size (), decodedParams.data ());
+                        HexDecode (paramsBuffer.data (), paramsBuffer.size (), decodedParams.data ());
                         const util::ui8 *paramsData = decodedParams.data ();
                         if (paramsType == OPENSSL_PKEY_DH) {
                             DHPtr dhParams (d2i_DHparams (0, &paramsData, (long)decodedParams.size ()));
@@ -395,7 +412,7 @@ namespace thekogans {
                 }
                 util::SecureString encodedParams;
                 encodedParams.resize (paramsBuffer.size () * 2);
-                util::HexEncodeBuffer (paramsBuffer.data (), paramsBuffer.size (), &encodedParams[0]);
+                HexEncode (paramsBuffer.data (), paramsBuffer.size (), &encodedParams[0]);
                 return encodedParams;
             }
         }
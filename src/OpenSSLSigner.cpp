@@ -19,14 +19,21 @@
 #include "thekogans/crypto/OpenSSLInit.h"
 #include "thekogans/crypto/OpenSSLException.h"
 #include "thekogans/crypto/OpenSSLAsymmetricKey.h"
+#include "thekogans/crypto/Trace.h"
 #include "thekogans/crypto/OpenSSLSigner.h"
 
 namespace thekogans {
     namespace crypto {
 
+    #if defined (THEKOGANS_CRYPTO_HAVE_RSA)
         THEKOGANS_CRYPTO_IMPLEMENT_SIGNER (OpenSSLSigner, OPENSSL_PKEY_RSA)
+    #endif // defined (THEKOGANS_CRYPTO_HAVE_RSA)
+    #if defined (THEKOGANS_CRYPTO_HAVE_DSA)
         THEKOGANS_CRYPTO_IMPLEMENT_SIGNER (OpenSSLSigner, OPENSSL_PKEY_DSA)
+    #endif // defined (THEKOGANS_CRYPTO_HAVE_DSA)
+    #if defined (THEKOGANS_CRYPTO_HAVE_EC)
         THEKOGANS_CRYPTO_IMPLEMENT_SIGNER (OpenSSLSigner, OPENSSL_PKEY_EC)
+    #endif // defined (THEKOGANS_CRYPTO_HAVE_EC)
 
         OpenSSLSigner::OpenSSLSigner (
                 AsymmetricKey::SharedPtr privateKey,
@@ -38,14 +45,21 @@ namespace thekogans {
                         privateKey->GetKeyType () == OPENSSL_PKEY_DSA ||
                         privateKey->GetKeyType () == OPENSSL_PKEY_EC) &&
                     messageDigest.Get () != 0) {
-                if (EVP_DigestSignInit (
-                        &messageDigest->ctx,
+                if (privateKey->GetKeyType () == OPENSSL_PKEY_EC) {
+                    noncePool = ECDSANoncePool::Find (*privateKey);
+                }
+                // DSA and ECDSA signatures use random nonces.
+                OpenSSLInit::WaitForSeed ();
+                if (noncePool.Get () == 0 && EVP_DigestSignInit (
+                        &prepared,
                         0,
                         messageDigest->md,
-                        OpenSSLInit::engine,
+                        OpenSSLInit::GetEngine (
+                            EVP_PKEY_base_id (((OpenSSLAsymmetricKey *)privateKey.Get ())->key.get ())),
                         ((OpenSSLAsymmetricKey *)privateKey.Get ())->key.get ()) != 1) {
                     THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
                 }
+                Init ();
             }
             else {
                 THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
@@ -54,12 +68,13 @@ namespace thekogans {
         }
 
         void OpenSSLSigner::Init () {
-            if (EVP_DigestSignInit (
-                    &messageDigest->ctx,
-                    0,
-                    messageDigest->md,
-                    0,
-                    0) != 1) {
+            if (noncePool.Get () != 0) {
+                // The pool signs the digest, so just hash.
+                if (EVP_DigestInit_ex (&messageDigest->ctx, messageDigest->md, 0) != 1) {
+                    THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
+                }
+            }
+            else if (EVP_MD_CTX_copy_ex (&messageDigest->ctx, &prepared) != 1) {
                 THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
             }
         }
@@ -68,10 +83,15 @@ namespace thekogans {
                 const void *buffer,
                 std::size_t bufferLength) {
             if (buffer != 0 && bufferLength > 0) {
-                if (EVP_DigestSignUpdate (
-                        &messageDigest->ctx,
-                        buffer,
-                        bufferLength) != 1) {
+                if ((noncePool.Get () != 0 ?
+                        EVP_DigestUpdate (
+                            &messageDigest->ctx,
+                            buffer,
+                            bufferLength) :
+                        EVP_DigestSignUpdate (
+                            &messageDigest->ctx,
+                            buffer,
+                            bufferLength)) != 1) {
                     THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
                 }
             }
@@ -82,12 +102,25 @@ namespace thekogans {
         }
 
         std::size_t OpenSSLSigner::Final (util::ui8 *signature) {
+            THEKOGANS_CRYPTO_TRACE_SCOPE (OPERATION_SIGN, privateKey->GetId (), 0, 0);
+            metrics.Update (Metrics::OPERATION_SIGN, 0);
             if (signature != 0) {
+                Stats::Scope statsScope (GetStats ());
+                if (noncePool.Get () != 0) {
+                    util::ui8 digest[EVP_MAX_MD_SIZE];
+                    util::ui32 digestLength = 0;
+                    if (EVP_DigestFinal_ex (&messageDigest->ctx, digest, &digestLength) != 1) {
+                        THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
+                    }
+                    statsScope.byteCount = noncePool->Sign (digest, digestLength, signature);
+                    return statsScope.byteCount;
+                }
                 std::size_t signatureLength = privateKey->GetKeyLength ();
                 if (EVP_DigestSignFinal (
                         &messageDigest->ctx,
                         signature,
                         &signatureLength) == 1) {
+                    statsScope.byteCount = signatureLength;
                     return signatureLength;
                 }
                 else {
@@ -23,6 +23,7 @@
 #include "thekogans/util/SecureAllocator.h"
 #include "thekogans/crypto/OpenSSLInit.h"
 #include "thekogans/crypto/OpenSSLException.h"
+#include "thekogans/crypto/ConstantTime.h"
 #include "thekogans/crypto/OpenSSLUtils.h"
 
 namespace thekogans {
@@ -682,13 +683,7 @@ namespace thekogans {
                 const void *buffer2,
                 std::size_t length) {
             if (buffer1 != 0 && buffer2 != 0 && length > 0) {
-                const util::ui8 *ptr1 = (const util::ui8 *)buffer1;
-                const util::ui8 *ptr2 = (const util::ui8 *)buffer2;
-                util::ui32 total = 0;
-                while (length-- > 0) {
-                    total += *ptr1++ ^ *ptr2++;
-                }
-                return total == 0;
+                return ConstantTimeCompare (buffer1, buffer2, length);
             }
             else {
                 THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
@@ -19,14 +19,21 @@
 #include "thekogans/crypto/OpenSSLInit.h"
 #include "thekogans/crypto/OpenSSLException.h"
 #include "thekogans/crypto/OpenSSLAsymmetricKey.h"
+#include "thekogans/crypto/Trace.h"
 #include "thekogans/crypto/OpenSSLVerifier.h"
 
 namespace thekogans {
     namespace crypto {
 
+    #if defined (THEKOGANS_CRYPTO_HAVE_RSA)
         THEKOGANS_CRYPTO_IMPLEMENT_VERIFIER (OpenSSLVerifier, OPENSSL_PKEY_RSA)
+    #endif // defined (THEKOGANS_CRYPTO_HAVE_RSA)
+    #if defined (THEKOGANS_CRYPTO_HAVE_DSA)
         THEKOGANS_CRYPTO_IMPLEMENT_VERIFIER (OpenSSLVerifier, OPENSSL_PKEY_DSA)
+    #endif // defined (THEKOGANS_CRYPTO_HAVE_DSA)
+    #if defined (THEKOGANS_CRYPTO_HAVE_EC)
         THEKOGANS_CRYPTO_IMPLEMENT_VERIFIER (OpenSSLVerifier, OPENSSL_PKEY_EC)
+    #endif // defined (THEKOGANS_CRYPTO_HAVE_EC)
 
         OpenSSLVerifier::OpenSSLVerifier (
                 AsymmetricKey::SharedPtr publicKey,
@@ -39,13 +46,15 @@ namespace thekogans {
                         publicKey->GetKeyType () == OPENSSL_PKEY_EC) &&
                     messageDigest.Get () != 0) {
                 if (EVP_DigestVerifyInit (
-                        &messageDigest->ctx,
+                        &prepared,
                         0,
                         messageDigest->md,
-                        OpenSSLInit::engine,
+                        OpenSSLInit::GetEngine (
+                            EVP_PKEY_base_id (((OpenSSLAsymmetricKey *)publicKey.Get ())->key.get ())),
                         ((OpenSSLAsymmetricKey *)publicKey.Get ())->key.get ()) != 1) {
                     THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
                 }
+                Init ();
             }
             else {
                 THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
@@ -54,12 +63,7 @@ namespace thekogans {
         }
 
         void OpenSSLVerifier::Init () {
-            if (EVP_DigestVerifyInit (
-                    &messageDigest->ctx,
-                    0,
-                    messageDigest->md,
-                    0,
-                    0) != 1) {
+            if (EVP_MD_CTX_copy_ex (&messageDigest->ctx, &prepared) != 1) {
                 THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
             }
         }
@@ -84,7 +88,10 @@ namespace thekogans {
         bool OpenSSLVerifier::Final (
                 const void *signature,
                 std::size_t signatureLength) {
+            THEKOGANS_CRYPTO_TRACE_SCOPE (OPERATION_VERIFY, publicKey->GetId (), 0, signatureLength);
+            metrics.Update (Metrics::OPERATION_VERIFY, signatureLength);
             if (signature != 0 && signatureLength > 0) {
+                Stats::Scope statsScope (GetStats (), signatureLength);
                 return EVP_DigestVerifyFinal (
                     &messageDigest->ctx,
                     (const util::ui8 *)signature,
@@ -15,11 +15,90 @@
 // You should have received a copy of the GNU General Public License
 // along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
 
+#include <atomic>
+#include <string>
+#include <vector>
+#include "thekogans/util/Exception.h"
+#include "thekogans/util/Thread.h"
+#include "thekogans/util/OwnerVector.h"
+#include "thekogans/util/SystemInfo.h"
 #include "thekogans/crypto/Params.h"
 
 namespace thekogans {
     namespace crypto {
 
+        namespace {
+            // Creates keys until there are none left to create
+            // (or one of the workers fails).
+            struct KeyWorker : public util::Thread {
+                const Params &params;
+                std::vector<AsymmetricKey::SharedPtr> &keys;
+                std::atomic<std::size_t> &nextKey;
+                std::string error;
+
+                KeyWorker (
+                    const Params &params_,
+                    std::vector<AsymmetricKey::SharedPtr> &keys_,
+                    std::atomic<std::size_t> &nextKey_) :
+                    params (params_),
+                    keys (keys_),
+                    nextKey (nextKey_) {}
+
+                void CreateKeys () {
+                    for (std::size_t key = nextKey++; key < keys.size (); key = nextKey++) {
+                        keys[key] = params.CreateKey ();
+                    }
+                }
+
+            protected:
+                // util::Thread
+                virtual void Run () throw () override {
+                    THEKOGANS_UTIL_TRY {
+                        CreateKeys ();
+                    }
+                    THEKOGANS_UTIL_CATCH (util::Exception) {
+                        error = exception.Report ();
+                        // Make the other workers run out of keys.
+                        nextKey = keys.size ();
+                    }
+                }
+            };
+        }
+
+        std::vector<AsymmetricKey::SharedPtr> Params::CreateKeys (
+                std::size_t count,
+                std::size_t workerCount) const {
+            std::vector<AsymmetricKey::SharedPtr> keys (count);
+            std::atomic<std::size_t> nextKey (0);
+            if (workerCount == 0) {
+                workerCount = util::SystemInfo::Instance ().GetCPUCount ();
+            }
+            if (workerCount > count) {
+                workerCount = count;
+            }
+            if (workerCount <= 1) {
+                KeyWorker (*this, keys, nextKey).CreateKeys ();
+            }
+            else {
+                util::OwnerVector<KeyWorker> workers;
+                workers.reserve (workerCount);
+                for (std::size_t i = 0; i < workerCount; ++i) {
+                    workers.push_back (new KeyWorker (*this, keys, nextKey));
+                    workers.back ()->Create ();
+                }
+                for (std::size_t i = 0; i < workerCount; ++i) {
+                    workers[i]->Wait ();
+                }
+                for (std::size_t i = 0; i < workerCount; ++i) {
+                    if (!workers[i]->error.empty ()) {
+                        THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                            "%s", workers[i]->error.c_str ());
+                    }
+                }
+            }
+            return keys;
+        }
+
         std::size_t Params::Size () const {
             return Serializable::Size ();
         }
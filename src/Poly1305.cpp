@@ -0,0 +1,171 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#include <cstring>
+#include <string>
+#include <openssl/evp.h>
+#include "thekogans/util/Exception.h"
+#include "thekogans/crypto/SymmetricKey.h"
+#include "thekogans/crypto/OpenSSLInit.h"
+#include "thekogans/crypto/OpenSSLException.h"
+#include "thekogans/crypto/OpenSSLUtils.h"
+#include "thekogans/crypto/ConstantTime.h"
+#include "thekogans/crypto/BufferedRandomSource.h"
+#include "thekogans/crypto/Poly1305.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        Poly1305::Poly1305 (SymmetricKey::SharedPtr key_) :
+                key (key_) {
+            if (key.Get () != 0 && key->GetKeyLength () == KEY_LENGTH) {
+                metrics.Reset (key->GetId ());
+                if (EVP_EncryptInit_ex (
+                        &keyContext,
+                        EVP_chacha20 (),
+                        OpenSSLInit::GetEngine (NID_chacha20),
+                        key->Get ().GetReadPtr (),
+                        0) != 1) {
+                    THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
+                }
+            #if OPENSSL_VERSION_NUMBER >= 0x30000000L
+                ctx = 0;
+                std::string propertyQuery = OpenSSLInit::GetPropertyQuery ();
+                EVP_MAC *mac = EVP_MAC_fetch (
+                    OpenSSLInit::GetLibraryContext (),
+                    "POLY1305",
+                    !propertyQuery.empty () ? propertyQuery.c_str () : 0);
+                if (mac != 0) {
+                    ctx = EVP_MAC_CTX_new (mac);
+                    // The context holds it's own reference.
+                    EVP_MAC_free (mac);
+                }
+                if (ctx == 0) {
+                    THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
+                }
+            #endif // OPENSSL_VERSION_NUMBER >= 0x30000000L
+                memset (nonce, 0, NONCE_LENGTH);
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        Poly1305::~Poly1305 () {
+        #if OPENSSL_VERSION_NUMBER >= 0x30000000L
+            EVP_MAC_CTX_free (ctx);
+        #endif // OPENSSL_VERSION_NUMBER >= 0x30000000L
+        }
+
+        void Poly1305::Init () {
+            if (BufferedRandomSource::GetThreadInstance ().GetBytes (
+                    nonce, NONCE_LENGTH) == NONCE_LENGTH) {
+                InitOneTimeKey ();
+            }
+            else {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "Unable to get %u random bytes for nonce.", NONCE_LENGTH);
+            }
+        }
+
+        void Poly1305::InitVerify (
+                const void *signature,
+                std::size_t signatureLength) {
+            if (signature != 0 && signatureLength == SIGNATURE_LENGTH) {
+                memcpy (nonce, signature, NONCE_LENGTH);
+                InitOneTimeKey ();
+            }
+            else {
+                // The length mismatch will fail the verification.
+                Init ();
+            }
+        }
+
+        void Poly1305::Update (
+                const void *buffer,
+                std::size_t bufferLength) {
+            if (buffer != 0 && bufferLength > 0) {
+            #if OPENSSL_VERSION_NUMBER >= 0x30000000L
+                if (EVP_MAC_update (ctx, (const util::ui8 *)buffer, bufferLength) != 1) {
+            #else // OPENSSL_VERSION_NUMBER >= 0x30000000L
+                if (EVP_DigestSignUpdate (&ctx, buffer, bufferLength) != 1) {
+            #endif // OPENSSL_VERSION_NUMBER >= 0x30000000L
+                    THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
+                }
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        std::size_t Poly1305::Final (util::ui8 *signature) {
+            if (signature != 0) {
+                std::size_t tagLength = TAG_LENGTH;
+            #if OPENSSL_VERSION_NUMBER >= 0x30000000L
+                if (EVP_MAC_final (ctx, signature + NONCE_LENGTH, &tagLength, TAG_LENGTH) == 1 &&
+            #else // OPENSSL_VERSION_NUMBER >= 0x30000000L
+                if (EVP_DigestSignFinal (&ctx, signature + NONCE_LENGTH, &tagLength) == 1 &&
+            #endif // OPENSSL_VERSION_NUMBER >= 0x30000000L
+                        tagLength == TAG_LENGTH) {
+                    memcpy (signature, nonce, NONCE_LENGTH);
+                    return SIGNATURE_LENGTH;
+                }
+                else {
+                    THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
+                }
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        void Poly1305::InitOneTimeKey () {
+            // ChaCha20 iv = 32 bit (little endian) block counter (0) + nonce.
+            util::ui8 iv[4 + NONCE_LENGTH];
+            memset (iv, 0, 4);
+            memcpy (iv + 4, nonce, NONCE_LENGTH);
+            static const util::ui8 zeros[KEY_LENGTH] = {0};
+            util::ui8 oneTimeKey[KEY_LENGTH];
+            int oneTimeKeyLength = 0;
+            bool success =
+                EVP_EncryptInit_ex (&keyContext, 0, 0, 0, iv) == 1 &&
+                EVP_EncryptUpdate (&keyContext, oneTimeKey, &oneTimeKeyLength,
+                    zeros, KEY_LENGTH) == 1 &&
+                oneTimeKeyLength == KEY_LENGTH;
+            if (success) {
+            #if OPENSSL_VERSION_NUMBER >= 0x30000000L
+                success = EVP_MAC_init (ctx, oneTimeKey, KEY_LENGTH, 0) == 1;
+            #else // OPENSSL_VERSION_NUMBER >= 0x30000000L
+                EVP_PKEYPtr oneTimePKey (
+                    EVP_PKEY_new_raw_private_key (
+                        EVP_PKEY_POLY1305, 0, oneTimeKey, KEY_LENGTH));
+                ctx.Reset ();
+                success = oneTimePKey.get () != 0 &&
+                    EVP_DigestSignInit (&ctx, 0, 0, 0, oneTimePKey.get ()) == 1;
+            #endif // OPENSSL_VERSION_NUMBER >= 0x30000000L
+            }
+            SecureZero (oneTimeKey, KEY_LENGTH);
+            if (!success) {
+                THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
+            }
+        }
+
+    } // namespace crypto
+} // namespace thekogans
@@ -0,0 +1,108 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#include <cstring>
+#include "thekogans/util/LockGuard.h"
+#include "thekogans/crypto/PublicKeyCache.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        namespace {
+            inline EVP_PKEYPtr ShareKey (EVP_PKEY &key) {
+            #if OPENSSL_VERSION_NUMBER < 0x10100000L
+                CRYPTO_add (&key.references, 1, CRYPTO_LOCK_EVP_PKEY);
+            #else // OPENSSL_VERSION_NUMBER < 0x10100000L
+                EVP_PKEY_up_ref (&key);
+            #endif // OPENSSL_VERSION_NUMBER < 0x10100000L
+                return EVP_PKEYPtr (&key);
+            }
+        }
+
+        PublicKeyCache::Entry::Entry (
+                const char *keyBuffer_,
+                std::size_t keyBufferLength,
+                EVP_PKEY &key_) :
+                keyBuffer (keyBuffer_, keyBufferLength),
+                key (ShareKey (key_)) {}
+
+        PublicKeyCache::PublicKeyCache (std::size_t capacity) :
+                cache (capacity) {}
+
+        PublicKeyCache &PublicKeyCache::Instance () {
+            static PublicKeyCache *instance = new PublicKeyCache;
+            return *instance;
+        }
+
+        std::size_t PublicKeyCache::GetCapacity () {
+            util::LockGuard<util::SpinLock> guard (spinLock);
+            return cache.GetCapacity ();
+        }
+
+        void PublicKeyCache::SetCapacity (std::size_t capacity) {
+            util::LockGuard<util::SpinLock> guard (spinLock);
+            // IDCache treats 0 as unbounded.
+            if (capacity == 0) {
+                cache.Clear ();
+            }
+            cache.SetCapacity (capacity);
+        }
+
+        EVP_PKEYPtr PublicKeyCache::Get (
+                const ID &id,
+                const char *keyBuffer,
+                std::size_t keyBufferLength) {
+            if (keyBuffer != 0 && keyBufferLength > 0) {
+                util::LockGuard<util::SpinLock> guard (spinLock);
+                Entry::SharedPtr entry;
+                if (cache.GetCapacity () > 0 && cache.Get (id, entry) &&
+                        entry->keyBuffer.size () == keyBufferLength &&
+                        memcmp (entry->keyBuffer.data (), keyBuffer, keyBufferLength) == 0) {
+                    return ShareKey (*entry->key);
+                }
+            }
+            return EVP_PKEYPtr ();
+        }
+
+        void PublicKeyCache::Add (
+                const ID &id,
+                const char *keyBuffer,
+                std::size_t keyBufferLength,
+                EVP_PKEY &key) {
+            if (keyBuffer != 0 && keyBufferLength > 0) {
+                // Build the entry outside the lock.
+                Entry::SharedPtr entry (new Entry (keyBuffer, keyBufferLength, key));
+                util::LockGuard<util::SpinLock> guard (spinLock);
+                if (cache.GetCapacity () > 0) {
+                    cache.Erase (id);
+                    cache.Add (id, entry);
+                }
+            }
+        }
+
+        IDCacheStats PublicKeyCache::GetStats () {
+            util::LockGuard<util::SpinLock> guard (spinLock);
+            return cache.GetStats ();
+        }
+
+        void PublicKeyCache::Clear () {
+            util::LockGuard<util::SpinLock> guard (spinLock);
+            cache.Clear ();
+        }
+
+    } // namespace crypto
+} // namespace thekogans
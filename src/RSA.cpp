@@ -15,6 +15,7 @@
 // You should have received a copy of the GNU General Public License
 // along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
 
+#include <utility>
 #if defined (TOOLCHAIN_OS_Windows)
     #include <winsock2.h>
 #endif // defined (TOOLCHAIN_OS_Windows)
@@ -26,8 +27,11 @@
 #include "thekogans/crypto/OpenSSLInit.h"
 #include "thekogans/crypto/OpenSSLException.h"
 #include "thekogans/crypto/OpenSSLAsymmetricKey.h"
+#include "thekogans/crypto/RSAParams.h"
 #include "thekogans/crypto/RSA.h"
 
+#if defined (THEKOGANS_CRYPTO_HAVE_RSA)
+
 namespace thekogans {
     namespace crypto {
 
@@ -38,9 +42,10 @@ namespace thekogans {
                 const std::string &name,
                 const std::string &description) {
             if (keyLength > 0 && (keyLength & ~3) == keyLength && publicExponent.get () != 0) {
+                OpenSSLInit::WaitForSeed ();
                 EVP_PKEY *key = 0;
                 EVP_PKEY_CTXPtr ctx (
-                    EVP_PKEY_CTX_new_id (EVP_PKEY_RSA, OpenSSLInit::engine));
+                    EVP_PKEY_CTX_new_id (EVP_PKEY_RSA, OpenSSLInit::GetEngine (EVP_PKEY_RSA)));
                 if (ctx.get () != 0 &&
                         EVP_PKEY_keygen_init (ctx.get ()) == 1 &&
                         EVP_PKEY_CTX_set_rsa_keygen_bits (ctx.get (), (util::i32)keyLength) == 1 &&
@@ -60,6 +65,63 @@ namespace thekogans {
             }
         }
 
+        AsymmetricKey::SharedPtr RSA::CreateMultiPrimeKey (
+                std::size_t keyLength,
+                std::size_t primes,
+                BIGNUMPtr publicExponent,
+                const ID &id,
+                const std::string &name,
+                const std::string &description) {
+            if (primes == 2) {
+                return CreateKey (keyLength, std::move (publicExponent), id, name, description);
+            }
+        #if OPENSSL_VERSION_NUMBER >= 0x10101000L
+            if (keyLength > 0 && (keyLength & ~3) == keyLength &&
+                    primes > 2 && publicExponent.get () != 0) {
+                OpenSSLInit::WaitForSeed ();
+                EVP_PKEY *key = 0;
+                EVP_PKEY_CTXPtr ctx (
+                    EVP_PKEY_CTX_new_id (EVP_PKEY_RSA, OpenSSLInit::GetEngine (EVP_PKEY_RSA)));
+                if (ctx.get () != 0 &&
+                        EVP_PKEY_keygen_init (ctx.get ()) == 1 &&
+                        EVP_PKEY_CTX_set_rsa_keygen_bits (ctx.get (), (util::i32)keyLength) == 1 &&
+                        EVP_PKEY_CTX_set_rsa_keygen_primes (ctx.get (), (util::i32)primes) == 1 &&
+                        EVP_PKEY_CTX_set_rsa_keygen_pubexp (ctx.get (), publicExponent.get ()) == 1 &&
+                        EVP_PKEY_keygen (ctx.get (), &key) == 1) {
+                    publicExponent.release ();
+                    return AsymmetricKey::SharedPtr (
+                        new OpenSSLAsymmetricKey (EVP_PKEYPtr (key), true, id, name, description));
+                }
+                else {
+                    THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
+                }
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        #else // OPENSSL_VERSION_NUMBER >= 0x10101000L
+            THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                "%s", "Multi-prime RSA keys require OpenSSL 1.1.1 or newer.");
+        #endif // OPENSSL_VERSION_NUMBER >= 0x10101000L
+        }
+
+        Params::SharedPtr RSA::ParamsFromKeyLength (
+                std::size_t keyLength,
+                util::ui32 publicExponent,
+                const ID &id,
+                const std::string &name,
+                const std::string &description) {
+            if (keyLength > 0 && (keyLength & ~3) == keyLength && publicExponent > 1) {
+                return Params::SharedPtr (
+                    new RSAParams (keyLength, publicExponent, id, name, description));
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
         namespace {
             inline bool IsValidPadding (util::i32 padding) {
                 return padding == RSA_PKCS1_PADDING ||
@@ -95,27 +157,8 @@ namespace thekogans {
                     publicKey->GetKeyType () == OPENSSL_PKEY_RSA &&
                     IsValidPadding (padding) &&
                     ciphertext != 0) {
-                EVP_PKEY_CTXPtr ctx (
-                    EVP_PKEY_CTX_new (
-                        ((OpenSSLAsymmetricKey *)publicKey.Get ())->key.get (),
-                        OpenSSLInit::engine));
-                if (ctx.get () != 0 &&
-                        EVP_PKEY_encrypt_init (ctx.get ()) == 1 &&
-                        EVP_PKEY_CTX_set_rsa_padding (ctx.get (), padding) == 1) {
-                    size_t ciphertextLength = 0;
-                    if (EVP_PKEY_encrypt (ctx.get (), 0, &ciphertextLength,
-                                (const util::ui8 *)plaintext, plaintextLength) == 1 &&
-                            EVP_PKEY_encrypt (ctx.get (), ciphertext, &ciphertextLength,
-                                (const util::ui8 *)plaintext, plaintextLength) == 1) {
-                        return ciphertextLength;
-                    }
-                    else {
-                        THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
-                    }
-                }
-                else {
-                    THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
-                }
+                return RSAEncryptor (publicKey, padding).Encrypt (
+                    plaintext, plaintextLength, ciphertext);
             }
             else {
                 THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
@@ -273,25 +316,8 @@ namespace thekogans {
                     privateKey->GetKeyType () == OPENSSL_PKEY_RSA &&
                     IsValidPadding (padding) &&
                     plaintext != 0) {
-                EVP_PKEY_CTXPtr ctx (
-                    EVP_PKEY_CTX_new (
-                        ((OpenSSLAsymmetricKey *)privateKey.Get ())->key.get (),
-                        OpenSSLInit::engine));
-                if (ctx.get () != 0 &&
-                        EVP_PKEY_decrypt_init (ctx.get ()) == 1 &&
-                        EVP_PKEY_CTX_set_rsa_padding (ctx.get (), padding) == 1) {
-                    size_t plaintextLength = privateKey->GetKeyLength ();
-                    if (EVP_PKEY_decrypt (ctx.get (), plaintext, &plaintextLength,
-                            (const util::ui8 *)ciphertext, ciphertextLength) == 1) {
-                        return plaintextLength;
-                    }
-                    else {
-                        THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
-                    }
-                }
-                else {
-                    THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
-                }
+                return RSADecryptor (privateKey, padding).Decrypt (
+                    ciphertext, ciphertextLength, plaintext);
             }
             else {
                 THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
@@ -571,5 +597,166 @@ namespace thekogans {
             }
         }
 
+        RSAEncryptor::RSAEncryptor (
+                AsymmetricKey::SharedPtr publicKey_,
+                util::i32 padding_) :
+                publicKey (publicKey_),
+                padding (padding_) {
+            if (publicKey.Get () != 0 && !publicKey->IsPrivate () &&
+                    publicKey->GetKeyType () == OPENSSL_PKEY_RSA &&
+                    IsValidPadding (padding)) {
+                ctx.reset (
+                    EVP_PKEY_CTX_new (
+                        ((OpenSSLAsymmetricKey *)publicKey.Get ())->key.get (),
+                        OpenSSLInit::GetEngine (EVP_PKEY_RSA)));
+                if (ctx.get () == 0 ||
+                        EVP_PKEY_encrypt_init (ctx.get ()) != 1 ||
+                        EVP_PKEY_CTX_set_rsa_padding (ctx.get (), padding) != 1) {
+                    THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
+                }
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        RSAEncryptor::RSAEncryptor (
+                AsymmetricKey::SharedPtr publicKey_,
+                util::i32 padding_,
+                EVP_PKEY_CTXPtr ctx_) :
+                publicKey (publicKey_),
+                padding (padding_),
+                ctx (std::move (ctx_)) {
+            if (ctx.get () == 0) {
+                THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
+            }
+        }
+
+        RSAEncryptor::SharedPtr RSAEncryptor::Clone () const {
+            return SharedPtr (
+                new RSAEncryptor (
+                    publicKey,
+                    padding,
+                    EVP_PKEY_CTXPtr (EVP_PKEY_CTX_dup (ctx.get ()))));
+        }
+
+        std::size_t RSAEncryptor::Encrypt (
+                const void *plaintext,
+                std::size_t plaintextLength,
+                util::ui8 *ciphertext) {
+            if (plaintext != 0 && plaintextLength > 0 && ciphertext != 0) {
+                // Padding is random.
+                OpenSSLInit::WaitForSeed ();
+                size_t ciphertextLength = (size_t)EVP_PKEY_size (
+                    ((OpenSSLAsymmetricKey *)publicKey.Get ())->key.get ());
+                if (EVP_PKEY_encrypt (ctx.get (), ciphertext, &ciphertextLength,
+                        (const util::ui8 *)plaintext, plaintextLength) == 1) {
+                    return ciphertextLength;
+                }
+                else {
+                    THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
+                }
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        util::Buffer RSAEncryptor::Encrypt (
+                const void *plaintext,
+                std::size_t plaintextLength) {
+            util::Buffer ciphertext (
+                util::NetworkEndian,
+                (std::size_t)EVP_PKEY_size (
+                    ((OpenSSLAsymmetricKey *)publicKey.Get ())->key.get ()));
+            ciphertext.AdvanceWriteOffset (
+                Encrypt (plaintext, plaintextLength, ciphertext.GetWritePtr ()));
+            return ciphertext;
+        }
+
+        RSADecryptor::RSADecryptor (
+                AsymmetricKey::SharedPtr privateKey_,
+                util::i32 padding_) :
+                privateKey (privateKey_),
+                padding (padding_) {
+            if (privateKey.Get () != 0 && privateKey->IsPrivate () &&
+                    privateKey->GetKeyType () == OPENSSL_PKEY_RSA &&
+                    IsValidPadding (padding)) {
+                ctx.reset (
+                    EVP_PKEY_CTX_new (
+                        ((OpenSSLAsymmetricKey *)privateKey.Get ())->key.get (),
+                        OpenSSLInit::GetEngine (EVP_PKEY_RSA)));
+                if (ctx.get () == 0 ||
+                        EVP_PKEY_decrypt_init (ctx.get ()) != 1 ||
+                        EVP_PKEY_CTX_set_rsa_padding (ctx.get (), padding) != 1) {
+                    THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
+                }
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        RSADecryptor::RSADecryptor (
+                AsymmetricKey::SharedPtr privateKey_,
+                util::i32 padding_,
+                EVP_PKEY_CTXPtr ctx_) :
+                privateKey (privateKey_),
+                padding (padding_),
+                ctx (std::move (ctx_)) {
+            if (ctx.get () == 0) {
+                THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
+            }
+        }
+
+        RSADecryptor::SharedPtr RSADecryptor::Clone () const {
+            return SharedPtr (
+                new RSADecryptor (
+                    privateKey,
+                    padding,
+                    EVP_PKEY_CTXPtr (EVP_PKEY_CTX_dup (ctx.get ()))));
+        }
+
+        std::size_t RSADecryptor::Decrypt (
+                const void *ciphertext,
+                std::size_t ciphertextLength,
+                util::ui8 *plaintext) {
+            if (ciphertext != 0 && ciphertextLength > 0 && plaintext != 0) {
+                size_t plaintextLength = (size_t)EVP_PKEY_size (
+                    ((OpenSSLAsymmetricKey *)privateKey.Get ())->key.get ());
+                if (EVP_PKEY_decrypt (ctx.get (), plaintext, &plaintextLength,
+                        (const util::ui8 *)ciphertext, ciphertextLength) == 1) {
+                    return plaintextLength;
+                }
+                else {
+                    THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
+                }
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        util::Buffer RSADecryptor::Decrypt (
+                const void *ciphertext,
+                std::size_t ciphertextLength,
+                bool secure,
+                util::Endianness endianness) {
+            std::size_t plaintextLength = (std::size_t)EVP_PKEY_size (
+                ((OpenSSLAsymmetricKey *)privateKey.Get ())->key.get ());
+            util::Buffer plaintext = secure ?
+                util::SecureBuffer (endianness, plaintextLength) :
+                util::Buffer (endianness, plaintextLength);
+            plaintext.AdvanceWriteOffset (
+                Decrypt (ciphertext, ciphertextLength, plaintext.GetWritePtr ()));
+            return plaintext;
+        }
+
     } // namespace crypto
 } // namespace thekogans
+
+#endif // defined (THEKOGANS_CRYPTO_HAVE_RSA)
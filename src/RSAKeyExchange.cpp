@@ -22,12 +22,17 @@
 #include "thekogans/util/RandomSource.h"
 #include "thekogans/util/Buffer.h"
 #include "thekogans/util/Serializer.h"
+#include "thekogans/util/LockGuard.h"
 #include "thekogans/crypto/RSA.h"
 #include "thekogans/crypto/CipherSuite.h"
 #include "thekogans/crypto/Authenticator.h"
 #include "thekogans/crypto/SymmetricKey.h"
+#include "thekogans/crypto/Trace.h"
+#include "thekogans/crypto/TextEncoding.h"
 #include "thekogans/crypto/RSAKeyExchange.h"
 
+#if defined (THEKOGANS_CRYPTO_HAVE_RSA)
+
 namespace thekogans {
     namespace crypto {
 
@@ -63,7 +68,8 @@ namespace thekogans {
 
         bool RSAKeyExchange::RSAParams::ValidateSignature (
                 AsymmetricKey::SharedPtr publicKey,
-                MessageDigest::SharedPtr messageDigest) {
+                MessageDigest::SharedPtr messageDigest,
+                ValidatedParamsCache::SharedPtr validatedParamsCache) {
             if (publicKey.Get () != 0 && messageDigest.Get () != 0 &&
                     publicKey->GetId () == signatureKeyId &&
                     messageDigest->GetName () == signatureMessageDigestName) {
@@ -74,12 +80,30 @@ namespace thekogans {
                         util::Serializer::Size (keyId) +
                         util::Serializer::Size (buffer));
                     paramsBuffer << id << keyId << buffer;
+                    ID key;
+                    if (validatedParamsCache.Get () != 0) {
+                        key = ValidatedParamsCache::GetKey (
+                            id,
+                            signatureKeyId,
+                            signatureMessageDigestName,
+                            paramsBuffer.GetReadPtr (),
+                            paramsBuffer.GetDataAvailableForReading (),
+                            signature.data (),
+                            signature.size ());
+                        if (validatedParamsCache->Contains (key)) {
+                            return true;
+                        }
+                    }
                     Authenticator authenticator (publicKey, messageDigest);
-                    return authenticator.VerifyBufferSignature (
+                    bool result = authenticator.VerifyBufferSignature (
                         paramsBuffer.GetReadPtr (),
                         paramsBuffer.GetDataAvailableForReading (),
                         signature.data (),
                         signature.size ());
+                    if (result && validatedParamsCache.Get () != 0) {
+                        validatedParamsCache->Add (key);
+                    }
+                    return result;
                 }
                 else {
                     THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
@@ -120,13 +144,13 @@ namespace thekogans {
                 const pugi::xml_node &node) {
             Params::Read (header, node);
             keyId = ID::FromHexString (node.attribute (ATTR_KEY_ID).value ());
-            buffer = util::HexDecodestring (node.attribute (ATTR_BUFFER).value ());
+            buffer = HexDecode (node.attribute (ATTR_BUFFER).value ());
         }
 
         void RSAKeyExchange::RSAParams::Write (pugi::xml_node &node) const {
             Params::Write (node);
             node.append_attribute (ATTR_KEY_ID).set_value (keyId.ToHexString ().c_str ());
-            node.append_attribute (ATTR_BUFFER).set_value (util::HexEncodeBuffer (buffer.data (), buffer.size ()).c_str ());
+            node.append_attribute (ATTR_BUFFER).set_value (HexEncode (buffer.data (), buffer.size ()).c_str ());
         }
 
         void RSAKeyExchange::RSAParams::Read (
@@ -134,7 +158,7 @@ namespace thekogans {
                 const util::JSON::Object &object) {
             Params::Read (header, object);
             keyId = ID::FromHexString (object.Get<util::JSON::String> (ATTR_KEY_ID)->value);
-            buffer = util::HexDecodestring (object.Get<util::JSON::String> (ATTR_BUFFER)->value);
+            buffer = HexDecode (object.Get<util::JSON::String> (ATTR_BUFFER)->value);
         }
 
         void RSAKeyExchange::RSAParams::Write (util::JSON::Object &object) const {
@@ -144,7 +168,43 @@ namespace thekogans {
                 keyId.ToHexString ());
             object.Add<const std::string &> (
                 ATTR_BUFFER,
-                util::HexEncodeBuffer (buffer.data (), buffer.size ()));
+                HexEncode (buffer.data (), buffer.size ()));
+        }
+
+        bool RSAKeyExchange::CompactRSAParams::Parse (
+                const void *buffer_,
+                std::size_t length) {
+            if (buffer_ == 0) {
+                return false;
+            }
+            Cursor cursor (buffer_, length);
+            const util::ui8 *begin = cursor.ptr;
+            util::ui8 version = 0;
+            util::ui16 bufferLength_ = 0;
+            if (!cursor.Get (version) || version != VERSION ||
+                    !cursor.Get (ID::SIZE, id) ||
+                    !cursor.Get (ID::SIZE, keyId) ||
+                    !cursor.Get (bufferLength_) || bufferLength_ == 0 ||
+                    !cursor.Get (bufferLength_, buffer) ||
+                    !ParseSignature (begin, cursor)) {
+                return false;
+            }
+            bufferLength = bufferLength_;
+            return true;
+        }
+
+        RSAKeyExchange::RSAParams::SharedPtr RSAKeyExchange::CompactRSAParams::ToRSAParams () const {
+            if (id != 0 && keyId != 0 && buffer != 0) {
+                return RSAParams::SharedPtr (
+                    new RSAParams (
+                        ID (id),
+                        ID (keyId),
+                        std::vector<util::ui8> (buffer, buffer + bufferLength)));
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
         }
 
         RSAKeyExchange::RSAKeyExchange (
@@ -200,14 +260,7 @@ namespace thekogans {
             if (key.Get () != 0 && key->GetKeyType () == OPENSSL_PKEY_RSA && key->IsPrivate () &&
                     rsaParams.Get () != 0) {
                 id = rsaParams->id;
-                util::Buffer symmetricKeyBuffer =
-                    RSADecrypt (
-                        rsaParams->buffer.data (),
-                        rsaParams->buffer.size (),
-                        key,
-                        RSA_PKCS1_OAEP_PADDING,
-                        true);
-                symmetricKeyBuffer >> symmetricKey;
+                encryptedSymmetricKey = rsaParams->buffer;
             }
             else {
                 THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
@@ -219,10 +272,11 @@ namespace thekogans {
                 AsymmetricKey::SharedPtr privateKey,
                 MessageDigest::SharedPtr messageDigest) const {
             Params::SharedPtr rsaParams;
+            SymmetricKey::SharedPtr sharedKey = GetSymmetricKey ();
             util::SecureBuffer symmetricKeyBuffer (
                 util::NetworkEndian,
-                util::Serializable::Size (*symmetricKey));
-            symmetricKeyBuffer << *symmetricKey;
+                util::Serializable::Size (*sharedKey));
+            symmetricKeyBuffer << *sharedKey;
             if (key->IsPrivate ()) {
                 Authenticator authenticator (key, MessageDigest::SharedPtr (new MessageDigest));
                 rsaParams.Reset (
@@ -249,16 +303,44 @@ namespace thekogans {
             return rsaParams;
         }
 
+        util::Buffer RSAKeyExchange::GetCompactParams (
+                AsymmetricKey::SharedPtr privateKey,
+                MessageDigest::SharedPtr messageDigest) const {
+            RSAParams::SharedPtr rsaParams =
+                util::dynamic_refcounted_sharedptr_cast<RSAParams> (GetParams ());
+            if (rsaParams.Get () != 0 && rsaParams->buffer.size () <= util::UI16_MAX) {
+                util::Buffer body (
+                    util::NetworkEndian,
+                    util::UI8_SIZE + // version
+                    ID::SIZE + // id
+                    ID::SIZE + // keyId
+                    util::UI16_SIZE + rsaParams->buffer.size ()); // buffer
+                body << (util::ui8)CompactParams::VERSION;
+                body.Write (rsaParams->id.data, ID::SIZE);
+                body.Write (rsaParams->keyId.data, ID::SIZE);
+                body << (util::ui16)rsaParams->buffer.size ();
+                body.Write (rsaParams->buffer.data (), rsaParams->buffer.size ());
+                return CompactParams::AppendSignature (body, privateKey, messageDigest);
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
         SymmetricKey::SharedPtr RSAKeyExchange::DeriveSharedSymmetricKey (Params::SharedPtr params) const {
-            assert (symmetricKey.Get () != 0);
+            THEKOGANS_CRYPTO_TRACE_SCOPE (OPERATION_KEY_EXCHANGE, GetId (), 0, 0);
+            Stats::Scope statsScope (stats);
+            SymmetricKey::SharedPtr sharedKey = GetSymmetricKey ();
+            assert (sharedKey.Get () != 0);
             if (!key->IsPrivate ()) {
                 RSAParams::SharedPtr rsaParams =
                     util::dynamic_refcounted_sharedptr_cast<RSAParams> (params);
                 if (rsaParams.Get () != 0) {
                     util::SecureBuffer symmetricKeyBuffer (
                         util::NetworkEndian,
-                        util::Serializable::Size (*symmetricKey));
-                    symmetricKeyBuffer << *symmetricKey;
+                        util::Serializable::Size (*sharedKey));
+                    symmetricKeyBuffer << *sharedKey;
                     Authenticator authenticator (key, MessageDigest::SharedPtr (new MessageDigest));
                     if (!authenticator.VerifyBufferSignature (
                             symmetricKeyBuffer.GetReadPtr (),
@@ -267,7 +349,7 @@ namespace thekogans {
                             rsaParams->buffer.size ())) {
                         THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
                             "Key (%s) failed signature verification.",
-                            symmetricKey->GetId ().ToHexString ().c_str ());
+                            sharedKey->GetId ().ToHexString ().c_str ());
                     }
                 }
                 else {
@@ -275,8 +357,26 @@ namespace thekogans {
                         THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
                 }
             }
+            return sharedKey;
+        }
+
+        SymmetricKey::SharedPtr RSAKeyExchange::GetSymmetricKey () const {
+            util::LockGuard<util::Mutex> guard (mutex);
+            if (symmetricKey.Get () == 0) {
+                util::Buffer symmetricKeyBuffer =
+                    RSADecrypt (
+                        encryptedSymmetricKey.data (),
+                        encryptedSymmetricKey.size (),
+                        key,
+                        RSA_PKCS1_OAEP_PADDING,
+                        true);
+                symmetricKeyBuffer >> symmetricKey;
+                encryptedSymmetricKey.clear ();
+            }
             return symmetricKey;
         }
 
     } // namespace crypto
 } // namespace thekogans
+
+#endif // defined (THEKOGANS_CRYPTO_HAVE_RSA)
@@ -0,0 +1,101 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#include "thekogans/util/StringUtils.h"
+#include "thekogans/crypto/RSA.h"
+#include "thekogans/crypto/RSAParams.h"
+
+#if defined (THEKOGANS_CRYPTO_HAVE_RSA)
+
+namespace thekogans {
+    namespace crypto {
+
+        #if !defined (THEKOGANS_CRYPTO_MIN_RSA_PARAMS_IN_PAGE)
+            #define THEKOGANS_CRYPTO_MIN_RSA_PARAMS_IN_PAGE 16
+        #endif // !defined (THEKOGANS_CRYPTO_MIN_RSA_PARAMS_IN_PAGE)
+
+        THEKOGANS_CRYPTO_IMPLEMENT_SERIALIZABLE (
+            RSAParams,
+            1,
+            THEKOGANS_CRYPTO_MIN_RSA_PARAMS_IN_PAGE)
+
+        AsymmetricKey::SharedPtr RSAParams::CreateKey (
+                const ID &id,
+                const std::string &name,
+                const std::string &description) const {
+            return RSA::CreateKey (
+                keyLength,
+                BIGNUMFromui32 (publicExponent),
+                id,
+                name,
+                description);
+        }
+
+        std::size_t RSAParams::Size () const {
+            return
+                Params::Size () +
+                util::Serializer::Size (keyLength) +
+                util::Serializer::Size (publicExponent);
+        }
+
+        void RSAParams::Read (
+                const BinHeader &header,
+                util::Serializer &serializer) {
+            Params::Read (header, serializer);
+            serializer >> keyLength >> publicExponent;
+        }
+
+        void RSAParams::Write (util::Serializer &serializer) const {
+            Params::Write (serializer);
+            serializer << keyLength << publicExponent;
+        }
+
+        const char * const RSAParams::ATTR_KEY_LENGTH = "KeyLength";
+        const char * const RSAParams::ATTR_PUBLIC_EXPONENT = "PublicExponent";
+
+        void RSAParams::Read (
+                const TextHeader &header,
+                const pugi::xml_node &node) {
+            Params::Read (header, node);
+            keyLength = util::stringToui64 (node.attribute (ATTR_KEY_LENGTH).value ());
+            publicExponent = (util::ui32)util::stringToui64 (node.attribute (ATTR_PUBLIC_EXPONENT).value ());
+        }
+
+        void RSAParams::Write (pugi::xml_node &node) const {
+            Params::Write (node);
+            node.append_attribute (ATTR_KEY_LENGTH).set_value (util::ui64Tostring (keyLength).c_str ());
+            node.append_attribute (ATTR_PUBLIC_EXPONENT).set_value (util::ui64Tostring (publicExponent).c_str ());
+        }
+
+        void RSAParams::Read (
+                const TextHeader &header,
+                const util::JSON::Object &object) {
+            Params::Read (header, object);
+            keyLength = object.Get<util::JSON::Number> (ATTR_KEY_LENGTH)->To<util::SizeT> ();
+            publicExponent = (util::ui32)object.Get<util::JSON::Number> (ATTR_PUBLIC_EXPONENT)->To<util::SizeT> ();
+        }
+
+        void RSAParams::Write (util::JSON::Object &object) const {
+            Params::Write (object);
+            object.Add<const util::SizeT &> (ATTR_KEY_LENGTH, keyLength);
+            object.Add<const util::SizeT &> (ATTR_PUBLIC_EXPONENT, util::SizeT (publicExponent));
+        }
+
+    } // namespace crypto
+} // namespace thekogans
+
+#endif // defined (THEKOGANS_CRYPTO_HAVE_RSA)
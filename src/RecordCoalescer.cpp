@@ -0,0 +1,165 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#include <cstring>
+#include "thekogans/util/Exception.h"
+#include "thekogans/util/HRTimer.h"
+#include "thekogans/util/Buffer.h"
+#include "thekogans/crypto/RecordCoalescer.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        RecordCoalescer::RecordCoalescer (
+                Cipher::SharedPtr cipher_,
+                std::size_t maxRecordLength_,
+                util::ui64 maxDelay_) :
+                cipher (cipher_),
+                maxRecordLength (maxRecordLength_),
+                maxDelay (maxDelay_),
+                pendingCount (0),
+                firstPendingTime (0) {
+            if (cipher.Get () == 0 || maxRecordLength <= MESSAGE_HEADER_SIZE) {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+            pending.reserve (maxRecordLength);
+        }
+
+        std::size_t RecordCoalescer::Add (
+                const void *message,
+                std::size_t messageLength,
+                std::vector<util::Buffer> &records) {
+            if ((message == 0 && messageLength > 0) ||
+                    messageLength > maxRecordLength - MESSAGE_HEADER_SIZE) {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+            std::size_t count = 0;
+            if (pending.size () + MESSAGE_HEADER_SIZE + messageLength > maxRecordLength &&
+                    Flush (records)) {
+                ++count;
+            }
+            if (pendingCount == 0) {
+                firstPendingTime = util::HRTimer::Click ();
+            }
+            std::size_t offset = pending.size ();
+            pending.resize (offset + MESSAGE_HEADER_SIZE + messageLength);
+            util::TenantWriteBuffer buffer (
+                util::NetworkEndian, &pending[offset], MESSAGE_HEADER_SIZE);
+            buffer << (util::ui32)messageLength;
+            if (messageLength > 0) {
+                memcpy (&pending[offset + MESSAGE_HEADER_SIZE], message, messageLength);
+            }
+            ++pendingCount;
+            if ((maxDelay == 0 ||
+                    pending.size () + MESSAGE_HEADER_SIZE >= maxRecordLength) &&
+                    Flush (records)) {
+                ++count;
+            }
+            return count;
+        }
+
+        bool RecordCoalescer::Poll (std::vector<util::Buffer> &records) {
+            return pendingCount > 0 && GetTimeToDeadline () == 0 && Flush (records);
+        }
+
+        bool RecordCoalescer::Flush (std::vector<util::Buffer> &records) {
+            if (pendingCount == 0) {
+                return false;
+            }
+            records.push_back (cipher->EncryptAndFrame (&pending[0], pending.size ()));
+            pending.clear ();
+            pendingCount = 0;
+            return true;
+        }
+
+        util::ui64 RecordCoalescer::GetTimeToDeadline () const {
+            if (pendingCount == 0) {
+                return 0;
+            }
+            util::ui64 elapsed = (util::ui64)(util::HRTimer::ToSeconds (
+                util::HRTimer::ComputeElapsedTime (
+                    firstPendingTime, util::HRTimer::Click ())) * 1e6);
+            return elapsed < maxDelay ? maxDelay - elapsed : 0;
+        }
+
+        RecordSplitter::RecordSplitter (
+                KeyRing::SharedPtr keyRing,
+                std::size_t maxRecordLength) :
+                frameDecoder (keyRing, maxRecordLength),
+                frameOffset (0) {}
+
+        util::ui8 *RecordSplitter::GetWritePtr (std::size_t length) {
+            // GetWritePtr can move the receive buffer from under the current record.
+            frame = FrameDecoder::Frame ();
+            frameOffset = 0;
+            return frameDecoder.GetWritePtr (length);
+        }
+
+        void RecordSplitter::Feed (
+                const void *chunk,
+                std::size_t length) {
+            if (chunk != 0 && length > 0) {
+                memcpy (GetWritePtr (length), chunk, length);
+                AdvanceWriteOffset (length);
+            }
+        }
+
+        bool RecordSplitter::Next (Message &message) {
+            while (frameOffset == frame.plaintextLength) {
+                frame = FrameDecoder::Frame ();
+                frameOffset = 0;
+                if (!frameDecoder.Next (frame)) {
+                    return false;
+                }
+            }
+            std::size_t available = frame.plaintextLength - frameOffset;
+            if (available < MESSAGE_HEADER_SIZE) {
+                frameOffset = frame.plaintextLength;
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "Truncated message header in record from key %s",
+                    frame.keyId.ToHexString ().c_str ());
+            }
+            util::TenantReadBuffer buffer (
+                util::NetworkEndian,
+                (util::ui8 *)frame.plaintext + frameOffset,
+                MESSAGE_HEADER_SIZE);
+            util::ui32 length;
+            buffer >> length;
+            if (length > available - MESSAGE_HEADER_SIZE) {
+                // Skip the rest of the (malformed) record.
+                frameOffset = frame.plaintextLength;
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "Invalid message length (%u), available: " THEKOGANS_UTIL_SIZE_T_FORMAT,
+                    length,
+                    available - MESSAGE_HEADER_SIZE);
+            }
+            message.data = frame.plaintext + frameOffset + MESSAGE_HEADER_SIZE;
+            message.length = length;
+            frameOffset += MESSAGE_HEADER_SIZE + length;
+            return true;
+        }
+
+        void RecordSplitter::Reset () {
+            frame = FrameDecoder::Frame ();
+            frameOffset = 0;
+            frameDecoder.Reset ();
+        }
+
+    } // namespace crypto
+} // namespace thekogans
@@ -0,0 +1,234 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <cstring>
+#include "thekogans/util/Exception.h"
+#include "thekogans/util/HRTimer.h"
+#include "thekogans/util/DefaultAllocator.h"
+#include "thekogans/util/SecureAllocator.h"
+#include "thekogans/crypto/RekeyingCipher.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        namespace {
+            const char * const REKEY_INFO = "RekeyingCipher";
+        }
+
+        RekeyingCipher::RekeyingCipher (
+                SymmetricKey::SharedPtr key_,
+                const EVP_CIPHER *cipher_,
+                const EVP_MD *md_,
+                util::ui64 maxMessages_,
+                util::ui64 maxBytes_,
+                util::f64 previousKeyLifetime_) :
+                key (key_),
+                cipher (cipher_),
+                md (md_),
+                maxMessages (maxMessages_),
+                maxBytes (maxBytes_),
+                previousKeyLifetime (previousKeyLifetime_),
+                epoch (0),
+                previousRetireTime (0) {
+            if (key.Get () != 0 && cipher != 0 && maxMessages > 0 && maxBytes > 0) {
+                current.Reset (new Cipher (key, cipher, md));
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        void RekeyingCipher::Rekey () {
+            GetNextCipher ();
+            Advance ();
+        }
+
+        std::size_t RekeyingCipher::Encrypt (
+                const void *plaintext,
+                std::size_t plaintextLength,
+                const void *associatedData,
+                std::size_t associatedDataLength,
+                util::ui8 *ciphertext) {
+            if (ciphertext != 0) {
+                const Stats &stats = current->GetEncryptorStats ();
+                if (stats.GetUseCount () >= maxMessages ||
+                        stats.GetTotalByteCount () + plaintextLength > maxBytes) {
+                    Rekey ();
+                }
+                util::TenantWriteBuffer buffer (util::NetworkEndian, ciphertext, EPOCH_LENGTH);
+                buffer << epoch;
+                return EPOCH_LENGTH + current->Encrypt (
+                    plaintext,
+                    plaintextLength,
+                    associatedData,
+                    associatedDataLength,
+                    ciphertext + EPOCH_LENGTH);
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        util::Buffer RekeyingCipher::Encrypt (
+                const void *plaintext,
+                std::size_t plaintextLength,
+                const void *associatedData,
+                std::size_t associatedDataLength,
+                util::Allocator *allocator) {
+            util::Buffer ciphertext (
+                util::NetworkEndian,
+                GetMaxBufferLength (plaintextLength),
+                0,
+                0,
+                allocator != 0 ? allocator : &util::DefaultAllocator::Instance ());
+            ciphertext.AdvanceWriteOffset (
+                Encrypt (
+                    plaintext,
+                    plaintextLength,
+                    associatedData,
+                    associatedDataLength,
+                    ciphertext.GetWritePtr ()));
+            return ciphertext;
+        }
+
+        std::size_t RekeyingCipher::Decrypt (
+                const void *ciphertext,
+                std::size_t ciphertextLength,
+                const void *associatedData,
+                std::size_t associatedDataLength,
+                util::ui8 *plaintext) {
+            util::ui32 messageEpoch;
+            Cipher::SharedPtr decryptCipher =
+                GetDecryptCipher (ciphertext, ciphertextLength, messageEpoch);
+            if (decryptCipher.Get () != 0) {
+                return decryptCipher->Decrypt (
+                    (const util::ui8 *)ciphertext + EPOCH_LENGTH,
+                    ciphertextLength - EPOCH_LENGTH,
+                    associatedData,
+                    associatedDataLength,
+                    plaintext);
+            }
+            // The peer moved to the next epoch. Only follow it once
+            // the message authenticates (Decrypt throws otherwise).
+            std::size_t plaintextLength = GetNextCipher ()->Decrypt (
+                (const util::ui8 *)ciphertext + EPOCH_LENGTH,
+                ciphertextLength - EPOCH_LENGTH,
+                associatedData,
+                associatedDataLength,
+                plaintext);
+            Advance ();
+            return plaintextLength;
+        }
+
+        util::Buffer RekeyingCipher::Decrypt (
+                const void *ciphertext,
+                std::size_t ciphertextLength,
+                const void *associatedData,
+                std::size_t associatedDataLength,
+                bool secure) {
+            util::Buffer plaintext (
+                util::NetworkEndian,
+                ciphertextLength,
+                0,
+                0,
+                secure ?
+                    (util::Allocator *)&util::SecureAllocator::Instance () :
+                    (util::Allocator *)&util::DefaultAllocator::Instance ());
+            plaintext.AdvanceWriteOffset (
+                Decrypt (
+                    ciphertext,
+                    ciphertextLength,
+                    associatedData,
+                    associatedDataLength,
+                    plaintext.GetWritePtr ()));
+            return plaintext;
+        }
+
+        SymmetricKey::SharedPtr RekeyingCipher::DeriveNextKey () const {
+            if (epoch == util::UI32_MAX) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "%s", "RekeyingCipher epochs exhausted.");
+            }
+            util::ui8 salt[EPOCH_LENGTH];
+            util::TenantWriteBuffer buffer (util::NetworkEndian, salt, EPOCH_LENGTH);
+            buffer << (util::ui32)(epoch + 1);
+            return SymmetricKey::FromHKDF (
+                key->Get ().GetReadPtr (),
+                key->Get ().GetDataAvailableForReading (),
+                salt,
+                EPOCH_LENGTH,
+                REKEY_INFO,
+                strlen (REKEY_INFO),
+                key->GetKeyLength (),
+                SymmetricKey::HKDF_MODE_EXTRACT_AND_EXPAND,
+                md != 0 ? md : THEKOGANS_CRYPTO_DEFAULT_MD);
+        }
+
+        Cipher::SharedPtr RekeyingCipher::GetNextCipher () {
+            if (next.Get () == 0) {
+                nextKey = DeriveNextKey ();
+                next.Reset (new Cipher (nextKey, cipher, md));
+            }
+            return next;
+        }
+
+        void RekeyingCipher::Advance () {
+            previous = current;
+            previousRetireTime = util::HRTimer::Click ();
+            key = nextKey;
+            current = next;
+            ++epoch;
+            // The cached key belonged to the old epoch + 1.
+            nextKey = SymmetricKey::SharedPtr ();
+            next = Cipher::SharedPtr ();
+        }
+
+        Cipher::SharedPtr RekeyingCipher::GetDecryptCipher (
+                const void *ciphertext,
+                std::size_t ciphertextLength,
+                util::ui32 &messageEpoch) {
+            if (ciphertext == 0 || ciphertextLength <= EPOCH_LENGTH) {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+            util::TenantReadBuffer buffer (util::NetworkEndian, ciphertext, EPOCH_LENGTH);
+            buffer >> messageEpoch;
+            if (messageEpoch == epoch) {
+                return current;
+            }
+            if (messageEpoch == epoch + 1) {
+                return Cipher::SharedPtr ();
+            }
+            if (messageEpoch + 1 == epoch && previous.Get () != 0) {
+                if (util::HRTimer::ToSeconds (
+                        util::HRTimer::ComputeElapsedTime (
+                            previousRetireTime, util::HRTimer::Click ())) <= previousKeyLifetime) {
+                    return previous;
+                }
+                previous = Cipher::SharedPtr ();
+            }
+            THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                "Unexpected epoch %u (current epoch: %u)",
+                messageEpoch,
+                epoch);
+        }
+
+    } // namespace crypto
+} // namespace thekogans
@@ -0,0 +1,438 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#include <cstring>
+#include "thekogans/util/Exception.h"
+#include "thekogans/crypto/CPUFeatures.h"
+#include "thekogans/crypto/SHA2MultiBuffer.h"
+#include "thekogans/crypto/SHA2MultiBufferKernel.h"
+#if defined (THEKOGANS_CRYPTO_SHA2_MULTI_BUFFER_NEON)
+    #include <arm_neon.h>
+#endif // defined (THEKOGANS_CRYPTO_SHA2_MULTI_BUFFER_NEON)
+
+namespace thekogans {
+    namespace crypto {
+
+        const util::ui32 SHA2Traits<util::ui32>::K[SHA2Traits<util::ui32>::ROUNDS] = {
+            0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+            0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+            0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+            0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+            0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+            0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+            0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+            0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+        };
+
+        const util::ui64 SHA2Traits<util::ui64>::K[SHA2Traits<util::ui64>::ROUNDS] = {
+            0x428a2f98d728ae22ULL, 0x7137449123ef65cdULL, 0xb5c0fbcfec4d3b2fULL, 0xe9b5dba58189dbbcULL,
+            0x3956c25bf348b538ULL, 0x59f111f1b605d019ULL, 0x923f82a4af194f9bULL, 0xab1c5ed5da6d8118ULL,
+            0xd807aa98a3030242ULL, 0x12835b0145706fbeULL, 0x243185be4ee4b28cULL, 0x550c7dc3d5ffb4e2ULL,
+            0x72be5d74f27b896fULL, 0x80deb1fe3b1696b1ULL, 0x9bdc06a725c71235ULL, 0xc19bf174cf692694ULL,
+            0xe49b69c19ef14ad2ULL, 0xefbe4786384f25e3ULL, 0x0fc19dc68b8cd5b5ULL, 0x240ca1cc77ac9c65ULL,
+            0x2de92c6f592b0275ULL, 0x4a7484aa6ea6e483ULL, 0x5cb0a9dcbd41fbd4ULL, 0x76f988da831153b5ULL,
+            0x983e5152ee66dfabULL, 0xa831c66d2db43210ULL, 0xb00327c898fb213fULL, 0xbf597fc7beef0ee4ULL,
+            0xc6e00bf33da88fc2ULL, 0xd5a79147930aa725ULL, 0x06ca6351e003826fULL, 0x142929670a0e6e70ULL,
+            0x27b70a8546d22ffcULL, 0x2e1b21385c26c926ULL, 0x4d2c6dfc5ac42aedULL, 0x53380d139d95b3dfULL,
+            0x650a73548baf63deULL, 0x766a0abb3c77b2a8ULL, 0x81c2c92e47edaee6ULL, 0x92722c851482353bULL,
+            0xa2bfe8a14cf10364ULL, 0xa81a664bbc423001ULL, 0xc24b8b70d0f89791ULL, 0xc76c51a30654be30ULL,
+            0xd192e819d6ef5218ULL, 0xd69906245565a910ULL, 0xf40e35855771202aULL, 0x106aa07032bbd1b8ULL,
+            0x19a4c116b8d2d0c8ULL, 0x1e376c085141ab53ULL, 0x2748774cdf8eeb99ULL, 0x34b0bcb5e19b48a8ULL,
+            0x391c0cb3c5c95a63ULL, 0x4ed8aa4ae3418acbULL, 0x5b9cca4f7763e373ULL, 0x682e6ff3d6b2b8a3ULL,
+            0x748f82ee5defb2fcULL, 0x78a5636f43172f60ULL, 0x84c87814a1f0ab72ULL, 0x8cc702081a6439ecULL,
+            0x90befffa23631e28ULL, 0xa4506cebde82bde9ULL, 0xbef9a3f7b2c67915ULL, 0xc67178f2e372532bULL,
+            0xca273eceea26619cULL, 0xd186b8c721c0c207ULL, 0xeada7dd6cde0eb1eULL, 0xf57d4f7fee6ed178ULL,
+            0x06f067aa72176fbaULL, 0x0a637dc5a2c898a6ULL, 0x113f9804bef90daeULL, 0x1b710b35131c471bULL,
+            0x28db77f523047d84ULL, 0x32caab7b40c72493ULL, 0x3c9ebe0a15c9bebcULL, 0x431d67c49c100d4cULL,
+            0x4cc5d4becb3e42b6ULL, 0x597f299cfc657e2aULL, 0x5fcb6fab3ad6faecULL, 0x6c44198c4a475817ULL
+        };
+
+        namespace {
+            const util::ui32 SHA224_IV[8] = {
+                0xc1059ed8, 0x367cd507, 0x3070dd17, 0xf70e5939,
+                0xffc00b31, 0x68581511, 0x64f98fa7, 0xbefa4fa4
+            };
+            const util::ui32 SHA256_IV[8] = {
+                0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+            };
+            const util::ui64 SHA384_IV[8] = {
+                0xcbbb9d5dc1059ed8ULL, 0x629a292a367cd507ULL, 0x9159015a3070dd17ULL, 0x152fecd8f70e5939ULL,
+                0x67332667ffc00b31ULL, 0x8eb44a8768581511ULL, 0xdb0c2e0d64f98fa7ULL, 0x47b5481dbefa4fa4ULL
+            };
+            const util::ui64 SHA512_IV[8] = {
+                0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL, 0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+                0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL, 0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL
+            };
+
+            template<typename Word_>
+            struct ScalarLanes {
+                typedef Word_ Word;
+                typedef Word_ Vector;
+                enum {
+                    COUNT = 1,
+                    BITS = sizeof (Word) * 8
+                };
+
+                static inline Vector Load (const Word *words) {
+                    return *words;
+                }
+                static inline void Store (
+                        Word *words,
+                        Vector v) {
+                    *words = v;
+                }
+                static inline Vector Set1 (Word word) {
+                    return word;
+                }
+                static inline Vector Add (
+                        Vector a,
+                        Vector b) {
+                    return (Vector)(a + b);
+                }
+                static inline Vector Xor (
+                        Vector a,
+                        Vector b) {
+                    return a ^ b;
+                }
+                static inline Vector And (
+                        Vector a,
+                        Vector b) {
+                    return a & b;
+                }
+                static inline Vector Or (
+                        Vector a,
+                        Vector b) {
+                    return a | b;
+                }
+                template<int N>
+                static inline Vector Rotr (Vector v) {
+                    return (Vector)((v >> N) | (v << (BITS - N)));
+                }
+                template<int N>
+                static inline Vector Shr (Vector v) {
+                    return (Vector)(v >> N);
+                }
+            };
+
+        #if defined (THEKOGANS_CRYPTO_SHA2_MULTI_BUFFER_NEON)
+            struct NEON32Lanes {
+                typedef util::ui32 Word;
+                typedef uint32x4_t Vector;
+                enum {
+                    COUNT = 4
+                };
+
+                static inline Vector Load (const Word *words) {
+                    return vld1q_u32 (words);
+                }
+                static inline void Store (
+                        Word *words,
+                        Vector v) {
+                    vst1q_u32 (words, v);
+                }
+                static inline Vector Set1 (Word word) {
+                    return vdupq_n_u32 (word);
+                }
+                static inline Vector Add (
+                        Vector a,
+                        Vector b) {
+                    return vaddq_u32 (a, b);
+                }
+                static inline Vector Xor (
+                        Vector a,
+                        Vector b) {
+                    return veorq_u32 (a, b);
+                }
+                static inline Vector And (
+                        Vector a,
+                        Vector b) {
+                    return vandq_u32 (a, b);
+                }
+                static inline Vector Or (
+                        Vector a,
+                        Vector b) {
+                    return vorrq_u32 (a, b);
+                }
+                template<int N>
+                static inline Vector Rotr (Vector v) {
+                    return vsliq_n_u32 (vshrq_n_u32 (v, N), v, 32 - N);
+                }
+                template<int N>
+                static inline Vector Shr (Vector v) {
+                    return vshrq_n_u32 (v, N);
+                }
+            };
+
+            struct NEON64Lanes {
+                typedef util::ui64 Word;
+                typedef uint64x2_t Vector;
+                enum {
+                    COUNT = 2
+                };
+
+                static inline Vector Load (const Word *words) {
+                    return vld1q_u64 (words);
+                }
+                static inline void Store (
+                        Word *words,
+                        Vector v) {
+                    vst1q_u64 (words, v);
+                }
+                static inline Vector Set1 (Word word) {
+                    return vdupq_n_u64 (word);
+                }
+                static inline Vector Add (
+                        Vector a,
+                        Vector b) {
+                    return vaddq_u64 (a, b);
+                }
+                static inline Vector Xor (
+                        Vector a,
+                        Vector b) {
+                    return veorq_u64 (a, b);
+                }
+                static inline Vector And (
+                        Vector a,
+                        Vector b) {
+                    return vandq_u64 (a, b);
+                }
+                static inline Vector Or (
+                        Vector a,
+                        Vector b) {
+                    return vorrq_u64 (a, b);
+                }
+                template<int N>
+                static inline Vector Rotr (Vector v) {
+                    return vsliq_n_u64 (vshrq_n_u64 (v, N), v, 64 - N);
+                }
+                template<int N>
+                static inline Vector Shr (Vector v) {
+                    return vshrq_n_u64 (v, N);
+                }
+            };
+        #endif // defined (THEKOGANS_CRYPTO_SHA2_MULTI_BUFFER_NEON)
+
+            inline bool Is32 (SHA2MultiBuffer::Algorithm algorithm) {
+                return algorithm == SHA2MultiBuffer::SHA224 ||
+                    algorithm == SHA2MultiBuffer::SHA256;
+            }
+        }
+
+        bool SHA2MultiBuffer::GetAlgorithm (
+                const EVP_MD *md,
+                Algorithm &algorithm) {
+            if (md != 0) {
+                switch (EVP_MD_type (md)) {
+                    case NID_sha224:
+                        algorithm = SHA224;
+                        return true;
+                    case NID_sha256:
+                        algorithm = SHA256;
+                        return true;
+                    case NID_sha384:
+                        algorithm = SHA384;
+                        return true;
+                    case NID_sha512:
+                        algorithm = SHA512;
+                        return true;
+                }
+            }
+            return false;
+        }
+
+        std::size_t SHA2MultiBuffer::GetDigestLength (Algorithm algorithm) {
+            switch (algorithm) {
+                case SHA224:
+                    return 28;
+                case SHA256:
+                    return 32;
+                case SHA384:
+                    return 48;
+                case SHA512:
+                    return 64;
+            }
+            THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+        }
+
+        bool SHA2MultiBuffer::IsKernelSupported (Kernel kernel) {
+            switch (kernel) {
+                case KERNEL_AUTO:
+                case KERNEL_SCALAR:
+                    return true;
+                case KERNEL_NEON:
+                #if defined (THEKOGANS_CRYPTO_SHA2_MULTI_BUFFER_NEON)
+                    return true;
+                #else // defined (THEKOGANS_CRYPTO_SHA2_MULTI_BUFFER_NEON)
+                    return false;
+                #endif // defined (THEKOGANS_CRYPTO_SHA2_MULTI_BUFFER_NEON)
+                case KERNEL_AVX2:
+                #if defined (THEKOGANS_CRYPTO_SHA2_MULTI_BUFFER_X86)
+                    return CPUFeatures::Instance ().avx2;
+                #else // defined (THEKOGANS_CRYPTO_SHA2_MULTI_BUFFER_X86)
+                    return false;
+                #endif // defined (THEKOGANS_CRYPTO_SHA2_MULTI_BUFFER_X86)
+                case KERNEL_AVX512:
+                #if defined (THEKOGANS_CRYPTO_SHA2_MULTI_BUFFER_X86)
+                    return CPUFeatures::Instance ().avx512f;
+                #else // defined (THEKOGANS_CRYPTO_SHA2_MULTI_BUFFER_X86)
+                    return false;
+                #endif // defined (THEKOGANS_CRYPTO_SHA2_MULTI_BUFFER_X86)
+            }
+            return false;
+        }
+
+        SHA2MultiBuffer::Kernel SHA2MultiBuffer::GetBestKernel (Algorithm algorithm) {
+            if (IsKernelSupported (KERNEL_AVX512)) {
+                return KERNEL_AVX512;
+            }
+            if (IsKernelSupported (KERNEL_AVX2)) {
+                return KERNEL_AVX2;
+            }
+            if (IsKernelSupported (KERNEL_NEON)) {
+                // The ARMv8 SHA extensions hash a single message
+                // faster than 4 (or 2) NEON lanes.
+                const CPUFeatures &cpuFeatures = CPUFeatures::Instance ();
+                if (Is32 (algorithm) ? !cpuFeatures.armSHA256 : !cpuFeatures.armSHA512) {
+                    return KERNEL_NEON;
+                }
+            }
+            return KERNEL_SCALAR;
+        }
+
+        std::size_t SHA2MultiBuffer::GetLaneCount (
+                Algorithm algorithm,
+                Kernel kernel) {
+            if (kernel == KERNEL_AUTO) {
+                kernel = GetBestKernel (algorithm);
+            }
+            std::size_t lanes32 = 1;
+            switch (kernel) {
+                case KERNEL_AUTO:
+                case KERNEL_SCALAR:
+                    lanes32 = 1;
+                    break;
+                case KERNEL_NEON:
+                    lanes32 = 4;
+                    break;
+                case KERNEL_AVX2:
+                    lanes32 = 8;
+                    break;
+                case KERNEL_AVX512:
+                    lanes32 = 16;
+                    break;
+            }
+            return Is32 (algorithm) || lanes32 == 1 ? lanes32 : lanes32 / 2;
+        }
+
+        const char *SHA2MultiBuffer::KernelToString (Kernel kernel) {
+            switch (kernel) {
+                case KERNEL_AUTO:
+                    return "auto";
+                case KERNEL_SCALAR:
+                    return "scalar";
+                case KERNEL_NEON:
+                    return "neon";
+                case KERNEL_AVX2:
+                    return "avx2";
+                case KERNEL_AVX512:
+                    return "avx512";
+            }
+            return "unknown";
+        }
+
+        void SHA2MultiBuffer::Hash (
+                Algorithm algorithm,
+                const void * const *buffers_,
+                const std::size_t *lengths,
+                std::size_t count,
+                util::ui8 *digests,
+                Kernel kernel) {
+            if ((buffers_ != 0 && lengths != 0 && digests != 0) || count == 0) {
+                for (std::size_t i = 0; i < count; ++i) {
+                    if (buffers_[i] == 0 && lengths[i] > 0) {
+                        THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                            THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+                    }
+                }
+                if (kernel == KERNEL_AUTO) {
+                    kernel = GetBestKernel (algorithm);
+                }
+                else if (!IsKernelSupported (kernel)) {
+                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                        "The %s kernel is not supported on this cpu.",
+                        KernelToString (kernel));
+                }
+                if (count == 0) {
+                    return;
+                }
+                const util::ui8 * const *buffers = (const util::ui8 * const *)buffers_;
+                std::size_t digestLength = GetDigestLength (algorithm);
+                const util::ui32 *iv32 = algorithm == SHA224 ? SHA224_IV : SHA256_IV;
+                const util::ui64 *iv64 = algorithm == SHA384 ? SHA384_IV : SHA512_IV;
+                switch (kernel) {
+                #if defined (THEKOGANS_CRYPTO_SHA2_MULTI_BUFFER_X86)
+                    case KERNEL_AVX512:
+                        if (Is32 (algorithm)) {
+                            SHA256MultiBufferAVX512 (buffers, lengths, count, iv32, digestLength, digests);
+                        }
+                        else {
+                            SHA512MultiBufferAVX512 (buffers, lengths, count, iv64, digestLength, digests);
+                        }
+                        return;
+                    case KERNEL_AVX2:
+                        if (Is32 (algorithm)) {
+                            SHA256MultiBufferAVX2 (buffers, lengths, count, iv32, digestLength, digests);
+                        }
+                        else {
+                            SHA512MultiBufferAVX2 (buffers, lengths, count, iv64, digestLength, digests);
+                        }
+                        return;
+                #endif // defined (THEKOGANS_CRYPTO_SHA2_MULTI_BUFFER_X86)
+                #if defined (THEKOGANS_CRYPTO_SHA2_MULTI_BUFFER_NEON)
+                    case KERNEL_NEON:
+                        if (Is32 (algorithm)) {
+                            SHA2MultiBufferKernel<NEON32Lanes>::Hash (
+                                buffers, lengths, count, iv32, digestLength, digests);
+                        }
+                        else {
+                            SHA2MultiBufferKernel<NEON64Lanes>::Hash (
+                                buffers, lengths, count, iv64, digestLength, digests);
+                        }
+                        return;
+                #endif // defined (THEKOGANS_CRYPTO_SHA2_MULTI_BUFFER_NEON)
+                    default:
+                        if (Is32 (algorithm)) {
+                            SHA2MultiBufferKernel<ScalarLanes<util::ui32>>::Hash (
+                                buffers, lengths, count, iv32, digestLength, digests);
+                        }
+                        else {
+                            SHA2MultiBufferKernel<ScalarLanes<util::ui64>>::Hash (
+                                buffers, lengths, count, iv64, digestLength, digests);
+                        }
+                        return;
+                }
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+    } // namespace crypto
+} // namespace thekogans
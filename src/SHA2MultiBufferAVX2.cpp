@@ -0,0 +1,170 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+// NOTE: Every header this file needs, other than SHA2MultiBufferKernel.h
+// and the intrinsics, has to be included before the target pragma below
+// (see SHA2MultiBufferKernel.h).
+#include <cstddef>
+#include <cstring>
+#include "thekogans/util/Types.h"
+#include "thekogans/crypto/Config.h"
+
+#if defined (__x86_64__) || defined (_M_X64) || defined (__i386__) || defined (_M_IX86)
+
+#if defined (__clang__)
+    #pragma clang attribute push (__attribute__ ((target ("avx2"))), apply_to = function)
+#elif defined (__GNUC__)
+    #pragma GCC push_options
+    #pragma GCC target ("avx2")
+#endif // defined (__clang__)
+
+#include <immintrin.h>
+#include "thekogans/crypto/SHA2MultiBufferKernel.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        namespace {
+            struct AVX2x32Lanes {
+                typedef util::ui32 Word;
+                typedef __m256i Vector;
+                enum {
+                    COUNT = 8
+                };
+
+                static inline Vector Load (const Word *words) {
+                    return _mm256_load_si256 ((const __m256i *)words);
+                }
+                static inline void Store (
+                        Word *words,
+                        Vector v) {
+                    _mm256_store_si256 ((__m256i *)words, v);
+                }
+                static inline Vector Set1 (Word word) {
+                    return _mm256_set1_epi32 ((int)word);
+                }
+                static inline Vector Add (
+                        Vector a,
+                        Vector b) {
+                    return _mm256_add_epi32 (a, b);
+                }
+                static inline Vector Xor (
+                        Vector a,
+                        Vector b) {
+                    return _mm256_xor_si256 (a, b);
+                }
+                static inline Vector And (
+                        Vector a,
+                        Vector b) {
+                    return _mm256_and_si256 (a, b);
+                }
+                static inline Vector Or (
+                        Vector a,
+                        Vector b) {
+                    return _mm256_or_si256 (a, b);
+                }
+                template<int N>
+                static inline Vector Rotr (Vector v) {
+                    return _mm256_or_si256 (_mm256_srli_epi32 (v, N), _mm256_slli_epi32 (v, 32 - N));
+                }
+                template<int N>
+                static inline Vector Shr (Vector v) {
+                    return _mm256_srli_epi32 (v, N);
+                }
+            };
+
+            struct AVX2x64Lanes {
+                typedef util::ui64 Word;
+                typedef __m256i Vector;
+                enum {
+                    COUNT = 4
+                };
+
+                static inline Vector Load (const Word *words) {
+                    return _mm256_load_si256 ((const __m256i *)words);
+                }
+                static inline void Store (
+                        Word *words,
+                        Vector v) {
+                    _mm256_store_si256 ((__m256i *)words, v);
+                }
+                static inline Vector Set1 (Word word) {
+                    return _mm256_set1_epi64x ((long long)word);
+                }
+                static inline Vector Add (
+                        Vector a,
+                        Vector b) {
+                    return _mm256_add_epi64 (a, b);
+                }
+                static inline Vector Xor (
+                        Vector a,
+                        Vector b) {
+                    return _mm256_xor_si256 (a, b);
+                }
+                static inline Vector And (
+                        Vector a,
+                        Vector b) {
+                    return _mm256_and_si256 (a, b);
+                }
+                static inline Vector Or (
+                        Vector a,
+                        Vector b) {
+                    return _mm256_or_si256 (a, b);
+                }
+                template<int N>
+                static inline Vector Rotr (Vector v) {
+                    return _mm256_or_si256 (_mm256_srli_epi64 (v, N), _mm256_slli_epi64 (v, 64 - N));
+                }
+                template<int N>
+                static inline Vector Shr (Vector v) {
+                    return _mm256_srli_epi64 (v, N);
+                }
+            };
+        }
+
+        void SHA256MultiBufferAVX2 (
+                const util::ui8 * const *buffers,
+                const std::size_t *lengths,
+                std::size_t count,
+                const util::ui32 *iv,
+                std::size_t digestLength,
+                util::ui8 *digests) {
+            SHA2MultiBufferKernel<AVX2x32Lanes>::Hash (
+                buffers, lengths, count, iv, digestLength, digests);
+        }
+
+        void SHA512MultiBufferAVX2 (
+                const util::ui8 * const *buffers,
+                const std::size_t *lengths,
+                std::size_t count,
+                const util::ui64 *iv,
+                std::size_t digestLength,
+                util::ui8 *digests) {
+            SHA2MultiBufferKernel<AVX2x64Lanes>::Hash (
+                buffers, lengths, count, iv, digestLength, digests);
+        }
+
+    } // namespace crypto
+} // namespace thekogans
+
+#if defined (__clang__)
+    #pragma clang attribute pop
+#elif defined (__GNUC__)
+    #pragma GCC pop_options
+#endif // defined (__clang__)
+
+#endif // defined (__x86_64__) || defined (_M_X64) || defined (__i386__) || defined (_M_IX86)
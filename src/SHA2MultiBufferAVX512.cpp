@@ -0,0 +1,170 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+// NOTE: Every header this file needs, other than SHA2MultiBufferKernel.h
+// and the intrinsics, has to be included before the target pragma below
+// (see SHA2MultiBufferKernel.h).
+#include <cstddef>
+#include <cstring>
+#include "thekogans/util/Types.h"
+#include "thekogans/crypto/Config.h"
+
+#if defined (__x86_64__) || defined (_M_X64) || defined (__i386__) || defined (_M_IX86)
+
+#if defined (__clang__)
+    #pragma clang attribute push (__attribute__ ((target ("avx512f"))), apply_to = function)
+#elif defined (__GNUC__)
+    #pragma GCC push_options
+    #pragma GCC target ("avx512f")
+#endif // defined (__clang__)
+
+#include <immintrin.h>
+#include "thekogans/crypto/SHA2MultiBufferKernel.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        namespace {
+            struct AVX512x32Lanes {
+                typedef util::ui32 Word;
+                typedef __m512i Vector;
+                enum {
+                    COUNT = 16
+                };
+
+                static inline Vector Load (const Word *words) {
+                    return _mm512_load_si512 ((const void *)words);
+                }
+                static inline void Store (
+                        Word *words,
+                        Vector v) {
+                    _mm512_store_si512 ((void *)words, v);
+                }
+                static inline Vector Set1 (Word word) {
+                    return _mm512_set1_epi32 ((int)word);
+                }
+                static inline Vector Add (
+                        Vector a,
+                        Vector b) {
+                    return _mm512_add_epi32 (a, b);
+                }
+                static inline Vector Xor (
+                        Vector a,
+                        Vector b) {
+                    return _mm512_xor_si512 (a, b);
+                }
+                static inline Vector And (
+                        Vector a,
+                        Vector b) {
+                    return _mm512_and_si512 (a, b);
+                }
+                static inline Vector Or (
+                        Vector a,
+                        Vector b) {
+                    return _mm512_or_si512 (a, b);
+                }
+                template<int N>
+                static inline Vector Rotr (Vector v) {
+                    return _mm512_ror_epi32 (v, N);
+                }
+                template<int N>
+                static inline Vector Shr (Vector v) {
+                    return _mm512_srli_epi32 (v, N);
+                }
+            };
+
+            struct AVX512x64Lanes {
+                typedef util::ui64 Word;
+                typedef __m512i Vector;
+                enum {
+                    COUNT = 8
+                };
+
+                static inline Vector Load (const Word *words) {
+                    return _mm512_load_si512 ((const void *)words);
+                }
+                static inline void Store (
+                        Word *words,
+                        Vector v) {
+                    _mm512_store_si512 ((void *)words, v);
+                }
+                static inline Vector Set1 (Word word) {
+                    return _mm512_set1_epi64 ((long long)word);
+                }
+                static inline Vector Add (
+                        Vector a,
+                        Vector b) {
+                    return _mm512_add_epi64 (a, b);
+                }
+                static inline Vector Xor (
+                        Vector a,
+                        Vector b) {
+                    return _mm512_xor_si512 (a, b);
+                }
+                static inline Vector And (
+                        Vector a,
+                        Vector b) {
+                    return _mm512_and_si512 (a, b);
+                }
+                static inline Vector Or (
+                        Vector a,
+                        Vector b) {
+                    return _mm512_or_si512 (a, b);
+                }
+                template<int N>
+                static inline Vector Rotr (Vector v) {
+                    return _mm512_ror_epi64 (v, N);
+                }
+                template<int N>
+                static inline Vector Shr (Vector v) {
+                    return _mm512_srli_epi64 (v, N);
+                }
+            };
+        }
+
+        void SHA256MultiBufferAVX512 (
+                const util::ui8 * const *buffers,
+                const std::size_t *lengths,
+                std::size_t count,
+                const util::ui32 *iv,
+                std::size_t digestLength,
+                util::ui8 *digests) {
+            SHA2MultiBufferKernel<AVX512x32Lanes>::Hash (
+                buffers, lengths, count, iv, digestLength, digests);
+        }
+
+        void SHA512MultiBufferAVX512 (
+                const util::ui8 * const *buffers,
+                const std::size_t *lengths,
+                std::size_t count,
+                const util::ui64 *iv,
+                std::size_t digestLength,
+                util::ui8 *digests) {
+            SHA2MultiBufferKernel<AVX512x64Lanes>::Hash (
+                buffers, lengths, count, iv, digestLength, digests);
+        }
+
+    } // namespace crypto
+} // namespace thekogans
+
+#if defined (__clang__)
+    #pragma clang attribute pop
+#elif defined (__GNUC__)
+    #pragma GCC pop_options
+#endif // defined (__clang__)
+
+#endif // defined (__x86_64__) || defined (_M_X64) || defined (__i386__) || defined (_M_IX86)
@@ -0,0 +1,192 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#include <map>
+#include "thekogans/util/SpinLock.h"
+#include "thekogans/util/LockGuard.h"
+#include "thekogans/util/SecureAllocator.h"
+#include "thekogans/util/Exception.h"
+#include "thekogans/util/LoggerMgr.h"
+#include "thekogans/crypto/ThreadCacheAllocator.h"
+#include "thekogans/crypto/SecureMemoryStats.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        THEKOGANS_UTIL_IMPLEMENT_ALLOCATOR (SecureMemoryAllocator)
+
+        namespace {
+            std::atomic<util::ui64> totalBytesInUse (0);
+            std::atomic<util::ui64> totalHighWaterMark (0);
+            std::atomic<util::ui64> totalAllocationCount (0);
+            std::atomic<util::ui64> totalFreeCount (0);
+
+            std::atomic<util::ui64> workingSetSize (0);
+            std::atomic<util::ui64> maxWorkingSetSize (0);
+
+            // Function static to be usable from other
+            // translation units' static ctors.
+            util::SpinLock &GetWorkingSetSpinLock () {
+                static util::SpinLock *spinLock = new util::SpinLock;
+                return *spinLock;
+            }
+
+            inline void UpdateHighWaterMark (
+                    std::atomic<util::ui64> &highWaterMark,
+                    util::ui64 bytesInUse) {
+                util::ui64 value = highWaterMark.load (std::memory_order_relaxed);
+                while (value < bytesInUse &&
+                    !highWaterMark.compare_exchange_weak (
+                        value, bytesInUse, std::memory_order_relaxed));
+            }
+
+            void GrowWorkingSet (util::ui64 bytesInUse) {
+                util::LockGuard<util::SpinLock> guard (GetWorkingSetSpinLock ());
+                util::ui64 current = workingSetSize.load (std::memory_order_relaxed);
+                util::ui64 max = maxWorkingSetSize.load (std::memory_order_relaxed);
+                if (bytesInUse > current && current < max) {
+                    util::ui64 size = current > 0 ? current : bytesInUse;
+                    while (size < bytesInUse) {
+                        size <<= 1;
+                    }
+                    if (size == current) {
+                        size <<= 1;
+                    }
+                    if (size > max) {
+                        size = max;
+                    }
+                    THEKOGANS_UTIL_TRY {
+                        util::SecureAllocator::ReservePages (size, size);
+                        workingSetSize.store (size, std::memory_order_relaxed);
+                    }
+                    THEKOGANS_UTIL_CATCH (util::Exception) {
+                        // The memory has already been allocated. Stop
+                        // growing rather than failing every Alloc from
+                        // here on out.
+                        maxWorkingSetSize.store (current, std::memory_order_relaxed);
+                        THEKOGANS_UTIL_LOG_WARNING (
+                            "Unable to grow the working set to " THEKOGANS_UTIL_UI64_FORMAT
+                            " bytes: %s\n",
+                            size,
+                            exception.Report ().c_str ());
+                    }
+                }
+            }
+
+            typedef std::map<std::string, SecureMemoryAllocator *> Allocators;
+
+            Allocators &GetAllocators () {
+                static Allocators *allocators = new Allocators;
+                return *allocators;
+            }
+
+            util::SpinLock &GetAllocatorsSpinLock () {
+                static util::SpinLock *spinLock = new util::SpinLock;
+                return *spinLock;
+            }
+        }
+
+        void *SecureMemoryAllocator::Alloc (std::size_t size) {
+            void *ptr = ThreadCacheAllocator::SecureInstance ().Alloc (size);
+            if (ptr != 0) {
+                util::ui64 inUse =
+                    bytesInUse.fetch_add (size, std::memory_order_relaxed) + size;
+                UpdateHighWaterMark (highWaterMark, inUse);
+                allocationCount.fetch_add (1, std::memory_order_relaxed);
+                util::ui64 totalInUse =
+                    totalBytesInUse.fetch_add (size, std::memory_order_relaxed) + size;
+                UpdateHighWaterMark (totalHighWaterMark, totalInUse);
+                totalAllocationCount.fetch_add (1, std::memory_order_relaxed);
+                if (totalInUse > workingSetSize.load (std::memory_order_relaxed) &&
+                        maxWorkingSetSize.load (std::memory_order_relaxed) >
+                            workingSetSize.load (std::memory_order_relaxed)) {
+                    GrowWorkingSet (totalInUse);
+                }
+            }
+            return ptr;
+        }
+
+        void SecureMemoryAllocator::Free (
+                void *ptr,
+                std::size_t size) {
+            if (ptr != 0) {
+                ThreadCacheAllocator::SecureInstance ().Free (ptr, size);
+                bytesInUse.fetch_sub (size, std::memory_order_relaxed);
+                freeCount.fetch_add (1, std::memory_order_relaxed);
+                totalBytesInUse.fetch_sub (size, std::memory_order_relaxed);
+                totalFreeCount.fetch_add (1, std::memory_order_relaxed);
+            }
+        }
+
+        SecureMemoryAllocator &SecureMemoryStats::GetAllocator (const char *name) {
+            util::LockGuard<util::SpinLock> guard (GetAllocatorsSpinLock ());
+            Allocators &allocators = GetAllocators ();
+            Allocators::iterator it = allocators.find (name);
+            if (it == allocators.end ()) {
+                it = allocators.insert (
+                    Allocators::value_type (name, new SecureMemoryAllocator (name))).first;
+            }
+            return *it->second;
+        }
+
+        SecureMemoryStats::Counters SecureMemoryStats::GetTotals () {
+            Counters counters;
+            counters.bytesInUse = totalBytesInUse.load (std::memory_order_relaxed);
+            counters.highWaterMark = totalHighWaterMark.load (std::memory_order_relaxed);
+            counters.allocationCount = totalAllocationCount.load (std::memory_order_relaxed);
+            counters.freeCount = totalFreeCount.load (std::memory_order_relaxed);
+            return counters;
+        }
+
+        std::vector<SecureMemoryStats::Counters> SecureMemoryStats::GetTypeCounters () {
+            std::vector<Counters> typeCounters;
+            util::LockGuard<util::SpinLock> guard (GetAllocatorsSpinLock ());
+            Allocators &allocators = GetAllocators ();
+            typeCounters.reserve (allocators.size ());
+            for (Allocators::const_iterator
+                    it = allocators.begin (),
+                    end = allocators.end (); it != end; ++it) {
+                Counters counters;
+                counters.name = it->first;
+                counters.bytesInUse = it->second->bytesInUse.load (std::memory_order_relaxed);
+                counters.highWaterMark = it->second->highWaterMark.load (std::memory_order_relaxed);
+                counters.allocationCount = it->second->allocationCount.load (std::memory_order_relaxed);
+                counters.freeCount = it->second->freeCount.load (std::memory_order_relaxed);
+                typeCounters.push_back (counters);
+            }
+            return typeCounters;
+        }
+
+        void SecureMemoryStats::SetWorkingSetSize (
+                util::ui64 workingSetSize_,
+                util::ui64 maxWorkingSetSize_) {
+            util::LockGuard<util::SpinLock> guard (GetWorkingSetSpinLock ());
+            util::SecureAllocator::ReservePages (workingSetSize_, workingSetSize_);
+            workingSetSize.store (workingSetSize_, std::memory_order_relaxed);
+            maxWorkingSetSize.store (maxWorkingSetSize_, std::memory_order_relaxed);
+        }
+
+        util::ui64 SecureMemoryStats::GetWorkingSetSize () {
+            return workingSetSize.load (std::memory_order_relaxed);
+        }
+
+        util::ui64 SecureMemoryStats::GetMaxWorkingSetSize () {
+            return maxWorkingSetSize.load (std::memory_order_relaxed);
+        }
+
+    } // namespace crypto
+} // namespace thekogans
@@ -0,0 +1,259 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include "thekogans/util/Exception.h"
+#include "thekogans/util/Buffer.h"
+#include "thekogans/util/LockGuard.h"
+#include "thekogans/crypto/CiphertextHeader.h"
+#include "thekogans/crypto/SeekableDecryptor.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        SeekableDecryptor::SeekableDecryptor (
+                const std::string &path,
+                SymmetricKey::SharedPtr key,
+                const EVP_CIPHER *cipher_,
+                const EVP_MD *md) :
+                file (util::NetworkEndian, path),
+                cipherSuite (CipherSuite::Empty),
+                blockSize (0),
+                plaintextLength (0),
+                cachedBlock (0) {
+            if (key.Get () != 0 && cipher_ != 0) {
+                cipher.Reset (new Cipher (key, cipher_, md));
+                ReadIndex ();
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        SeekableDecryptor::SeekableDecryptor (
+                const std::string &path,
+                KeyRing::SharedPtr keyRing_) :
+                file (util::NetworkEndian, path),
+                keyRing (keyRing_),
+                cipherSuite (keyRing_.Get () != 0 ? keyRing_->GetCipherSuite () : CipherSuite::Empty),
+                blockSize (0),
+                plaintextLength (0),
+                cachedBlock (0) {
+            if (keyRing.Get () != 0) {
+                ReadIndex ();
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        SeekableDecryptor::~SeekableDecryptor () {
+            if (!plaintext.empty ()) {
+                memset (plaintext.data (), 0, plaintext.size ());
+            }
+        }
+
+        bool SeekableDecryptor::IsSeekable (const std::string &path) {
+            util::ReadOnlyFile file (util::NetworkEndian, path);
+            if (file.GetSize () >= SeekableFileHeader::SIZE + SeekableFileFooter::SIZE) {
+                SeekableFileHeader header;
+                file >> header;
+                return header.magic == SeekableFileHeader::MAGIC;
+            }
+            return false;
+        }
+
+        std::size_t SeekableDecryptor::Read (
+                util::ui64 offset,
+                void *buffer,
+                std::size_t length) {
+            if (buffer != 0 && length > 0) {
+                util::LockGuard<util::Mutex> guard (mutex);
+                util::ui8 *ptr = (util::ui8 *)buffer;
+                std::size_t bytesRead = 0;
+                while (bytesRead < length && offset < plaintextLength) {
+                    // Every block but the last holds exactly blockSize bytes.
+                    std::size_t block = (std::size_t)(offset / blockSize);
+                    std::size_t blockOffset = (std::size_t)(offset % blockSize);
+                    DecryptBlock (block);
+                    std::size_t count = std::min (
+                        length - bytesRead,
+                        (std::size_t)index[block].plaintextLength - blockOffset);
+                    memcpy (ptr + bytesRead, plaintext.data () + blockOffset, count);
+                    bytesRead += count;
+                    offset += count;
+                }
+                return bytesRead;
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        void SeekableDecryptor::ReadIndex () {
+            util::ui64 fileSize = file.GetSize ();
+            if (fileSize < SeekableFileHeader::SIZE + SeekableFileFooter::SIZE) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "%s is not a seekable file",
+                    file.GetPath ().c_str ());
+            }
+            SeekableFileHeader header;
+            file >> header;
+            if (header.magic != SeekableFileHeader::MAGIC ||
+                    header.version != SeekableFileHeader::VERSION ||
+                    header.blockSize == 0 || header.blockSize >= Cipher::MAX_PLAINTEXT_LENGTH) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "Invalid seekable file header in %s",
+                    file.GetPath ().c_str ());
+            }
+            file.Seek (fileSize - SeekableFileFooter::SIZE, SEEK_SET);
+            SeekableFileFooter footer;
+            file >> footer;
+            if (footer.magic != SeekableFileHeader::MAGIC ||
+                    footer.indexOffset < SeekableFileHeader::SIZE ||
+                    footer.indexOffset + footer.indexLength + SeekableFileFooter::SIZE != fileSize) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "Invalid seekable file footer in %s",
+                    file.GetPath ().c_str ());
+            }
+            Cipher::SharedPtr indexCipher = cipher;
+            if (keyRing.Get () != 0) {
+                SymmetricKey::SharedPtr indexKey = keyRing->GetCipherKey (footer.indexKeyId);
+                if (indexKey.Get () == 0) {
+                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                        "Unable to get key %s",
+                        footer.indexKeyId.ToHexString ().c_str ());
+                }
+                indexCipher = cipherSuite.GetCipher (indexKey);
+            }
+            std::vector<util::ui8> indexCiphertext (footer.indexLength);
+            file.Seek (footer.indexOffset, SEEK_SET);
+            if (file.Read (indexCiphertext.data (), footer.indexLength) != footer.indexLength) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "Unable to read %u bytes from %s",
+                    footer.indexLength,
+                    file.GetPath ().c_str ());
+            }
+            // Decrypt throws if the index was tampered with.
+            util::Buffer indexPlaintext = indexCipher->Decrypt (
+                indexCiphertext.data (),
+                indexCiphertext.size (),
+                0,
+                0);
+            util::ui32 indexBlockSize;
+            util::ui64 blockCount;
+            indexPlaintext >> indexBlockSize >> blockCount;
+            // The header is not authenticated on it's own. Make sure
+            // it agrees with the (authenticated) index.
+            if (indexBlockSize != header.blockSize ||
+                    blockCount > indexPlaintext.GetDataAvailableForReading ()) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "Invalid seekable file index in %s",
+                    file.GetPath ().c_str ());
+            }
+            blockSize = header.blockSize;
+            index.resize ((std::size_t)blockCount);
+            util::ui64 nextOffset = SeekableFileHeader::SIZE;
+            for (std::size_t i = 0, count = index.size (); i < count; ++i) {
+                SeekableBlockInfo &blockInfo = index[i];
+                indexPlaintext >> blockInfo;
+                // Blocks are laid out in order, every block but the
+                // last is full, and all of them precede the index.
+                if (blockInfo.offset < nextOffset ||
+                        blockInfo.ciphertextLength <= CiphertextHeader::SIZE ||
+                        blockInfo.ciphertextLength > Cipher::GetMaxBufferLength (blockSize) ||
+                        blockInfo.offset + blockInfo.ciphertextLength > footer.indexOffset ||
+                        blockInfo.plaintextLength == 0 || blockInfo.plaintextLength > blockSize ||
+                        (i + 1 < count && blockInfo.plaintextLength != blockSize)) {
+                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                        "Invalid index entry " THEKOGANS_UTIL_SIZE_T_FORMAT " in %s",
+                        i,
+                        file.GetPath ().c_str ());
+                }
+                nextOffset = blockInfo.offset + blockInfo.ciphertextLength;
+                plaintextLength += blockInfo.plaintextLength;
+            }
+            cachedBlock = index.size ();
+        }
+
+        void SeekableDecryptor::DecryptBlock (std::size_t block) {
+            if (block == cachedBlock) {
+                return;
+            }
+            const SeekableBlockInfo &blockInfo = index[block];
+            ciphertext.resize (blockInfo.ciphertextLength);
+            file.Seek (blockInfo.offset, SEEK_SET);
+            if (file.Read (ciphertext.data (), blockInfo.ciphertextLength) != blockInfo.ciphertextLength) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "Unable to read %u bytes from %s",
+                    blockInfo.ciphertextLength,
+                    file.GetPath ().c_str ());
+            }
+            // The block MAC only proves the block is intact. Comparing
+            // it's IV to the (authenticated) index proves it's the block
+            // that belongs at this position.
+            CiphertextHeader ciphertextHeader;
+            util::TenantReadBuffer buffer (
+                util::NetworkEndian,
+                ciphertext.data (),
+                CiphertextHeader::SIZE);
+            buffer >> ciphertextHeader;
+            if (ciphertextHeader.ivLength != blockInfo.ivLength ||
+                    CiphertextHeader::SIZE + ciphertextHeader.ivLength > ciphertext.size () ||
+                    memcmp (ciphertext.data () + CiphertextHeader::SIZE,
+                        blockInfo.iv, blockInfo.ivLength) != 0) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "Block " THEKOGANS_UTIL_SIZE_T_FORMAT " in %s does not match the index",
+                    block,
+                    file.GetPath ().c_str ());
+            }
+            Cipher::SharedPtr blockCipher = cipher;
+            if (keyRing.Get () != 0) {
+                SymmetricKey::SharedPtr blockKey = keyRing->GetCipherKey (blockInfo.keyId);
+                if (blockKey.Get () == 0) {
+                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                        "Unable to get key %s",
+                        blockInfo.keyId.ToHexString ().c_str ());
+                }
+                blockCipher = cipherSuite.GetCipher (blockKey);
+            }
+            // Decrypt can write up to (padded) ciphertext size bytes.
+            plaintext.resize (ciphertext.size ());
+            // Invalidate the cache first in case Decrypt throws.
+            cachedBlock = index.size ();
+            if (blockCipher->Decrypt (
+                    ciphertext.data (),
+                    ciphertext.size (),
+                    0,
+                    0,
+                    plaintext.data ()) != blockInfo.plaintextLength) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "Block " THEKOGANS_UTIL_SIZE_T_FORMAT " in %s does not match the index",
+                    block,
+                    file.GetPath ().c_str ());
+            }
+            cachedBlock = block;
+        }
+
+    } // namespace crypto
+} // namespace thekogans
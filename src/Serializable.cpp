@@ -17,10 +17,14 @@
 
 #include "thekogans/util/SpinLock.h"
 #include "thekogans/util/LockGuard.h"
+#if defined (THEKOGANS_CRYPTO_HAVE_ARGON2)
+    #include "thekogans/crypto/Argon2Params.h"
+#endif // defined (THEKOGANS_CRYPTO_HAVE_ARGON2)
 #include "thekogans/crypto/KeyRing.h"
 #include "thekogans/crypto/OpenSSLParams.h"
 #include "thekogans/crypto/Ed25519Params.h"
 #include "thekogans/crypto/X25519Params.h"
+#include "thekogans/crypto/RSAParams.h"
 #include "thekogans/crypto/SymmetricKey.h"
 #include "thekogans/crypto/OpenSSLAsymmetricKey.h"
 #include "thekogans/crypto/Ed25519AsymmetricKey.h"
@@ -43,12 +47,20 @@ namespace thekogans {
                     OpenSSLParams::StaticInit ();
                     Ed25519Params::StaticInit ();
                     X25519Params::StaticInit ();
+                #if defined (THEKOGANS_CRYPTO_HAVE_RSA)
+                    RSAParams::StaticInit ();
+                #endif // defined (THEKOGANS_CRYPTO_HAVE_RSA)
                     SymmetricKey::StaticInit ();
                     OpenSSLAsymmetricKey::StaticInit ();
                     Ed25519AsymmetricKey::StaticInit ();
                     X25519AsymmetricKey::StaticInit ();
                     DHEKeyExchange::DHEParams::StaticInit ();
+                #if defined (THEKOGANS_CRYPTO_HAVE_RSA)
                     RSAKeyExchange::RSAParams::StaticInit ();
+                #endif // defined (THEKOGANS_CRYPTO_HAVE_RSA)
+                #if defined (THEKOGANS_CRYPTO_HAVE_ARGON2)
+                    Argon2Params::StaticInit ();
+                #endif // defined (THEKOGANS_CRYPTO_HAVE_ARGON2)
                     registered = true;
                 }
             }
@@ -0,0 +1,170 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#include <ctime>
+#include <cstring>
+#include "thekogans/util/Exception.h"
+#include "thekogans/util/LockGuard.h"
+#include "thekogans/util/SecureAllocator.h"
+#include "thekogans/crypto/SessionTicketManager.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        namespace {
+            // Ticket plaintext:
+            // | version | ticket id | issue time | key length |    key     |
+            // |    1    |    32     |     8      |     4      | key length |
+            const util::ui8 TICKET_VERSION = 1;
+            const char * const RESUMED_KEY_INFO = "thekogans_crypto session resumption v1";
+
+            inline util::ui64 Now () {
+                return (util::ui64)time (0);
+            }
+        }
+
+        SessionTicketManager::SessionTicketManager (
+                Cipher::SharedPtr cipher_,
+                util::ui64 lifetime_,
+                std::size_t replayWindow_) :
+                cipher (cipher_),
+                lifetime (lifetime_),
+                replayWindow (replayWindow_),
+                replayFloor (0) {
+            if (cipher.Get () == 0 || lifetime == 0 || replayWindow == 0) {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        util::Buffer SessionTicketManager::IssueTicket (const SymmetricKey &key) {
+            const SymmetricKey::KeyType &keyData = key.Get ();
+            util::SecureBuffer plaintext (
+                util::NetworkEndian,
+                util::UI8_SIZE + ID::SIZE + util::UI64_SIZE + util::UI32_SIZE +
+                keyData.GetDataAvailableForReading ());
+            plaintext <<
+                TICKET_VERSION <<
+                ID () <<
+                Now () <<
+                (util::ui32)keyData.GetDataAvailableForReading ();
+            if (plaintext.Write (
+                    keyData.GetReadPtr (),
+                    keyData.GetDataAvailableForReading ()) != keyData.GetDataAvailableForReading ()) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "Unable to write " THEKOGANS_UTIL_SIZE_T_FORMAT " bytes to the ticket.",
+                    keyData.GetDataAvailableForReading ());
+            }
+            util::LockGuard<util::Mutex> guard (mutex);
+            return cipher->Encrypt (
+                plaintext.GetReadPtr (),
+                plaintext.GetDataAvailableForReading ());
+        }
+
+        SymmetricKey::SharedPtr SessionTicketManager::RedeemTicket (
+                const void *ticket,
+                std::size_t ticketLength,
+                const void *nonce,
+                std::size_t nonceLength) {
+            if (ticket != 0 && ticketLength > 0 &&
+                    nonce != 0 && nonceLength >= MIN_NONCE_LENGTH) {
+                util::LockGuard<util::Mutex> guard (mutex);
+                util::Buffer plaintext;
+                THEKOGANS_UTIL_TRY {
+                    plaintext = cipher->Decrypt (ticket, ticketLength, 0, 0, true);
+                }
+                THEKOGANS_UTIL_CATCH (util::Exception) {
+                    // Forged, corrupt, or sealed with a different cipher.
+                    return SymmetricKey::SharedPtr ();
+                }
+                util::ui8 version = 0;
+                ID ticketId = ID::Empty;
+                util::ui64 issueTime = 0;
+                util::ui32 keyLength = 0;
+                if (plaintext.GetDataAvailableForReading () <
+                        util::UI8_SIZE + ID::SIZE + util::UI64_SIZE + util::UI32_SIZE) {
+                    return SymmetricKey::SharedPtr ();
+                }
+                plaintext >> version >> ticketId >> issueTime >> keyLength;
+                util::ui64 now = Now ();
+                if (version != TICKET_VERSION ||
+                        keyLength == 0 || keyLength != plaintext.GetDataAvailableForReading () ||
+                        issueTime > now || now - issueTime > lifetime ||
+                        !Redeem (issueTime, ticketId)) {
+                    return SymmetricKey::SharedPtr ();
+                }
+                SymmetricKey key (plaintext.GetReadPtr (), keyLength, ID::Empty);
+                return DeriveResumedKey (key, nonce, nonceLength);
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        SymmetricKey::SharedPtr SessionTicketManager::DeriveResumedKey (
+                const SymmetricKey &key,
+                const void *nonce,
+                std::size_t nonceLength,
+                const ID &id,
+                const std::string &name,
+                const std::string &description) {
+            if (nonce != 0 && nonceLength >= MIN_NONCE_LENGTH) {
+                const SymmetricKey::KeyType &keyData = key.Get ();
+                return SymmetricKey::FromHKDF (
+                    keyData.GetReadPtr (),
+                    keyData.GetDataAvailableForReading (),
+                    nonce,
+                    nonceLength,
+                    RESUMED_KEY_INFO,
+                    strlen (RESUMED_KEY_INFO),
+                    keyData.GetDataAvailableForReading (),
+                    SymmetricKey::HKDF_MODE_EXTRACT_AND_EXPAND,
+                    THEKOGANS_CRYPTO_DEFAULT_MD,
+                    id,
+                    name,
+                    description);
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        bool SessionTicketManager::Redeem (
+                util::ui64 issueTime,
+                const ID &ticketId) {
+            if (issueTime <= replayFloor ||
+                    !redeemed.insert (ticketId).second) {
+                return false;
+            }
+            redeemedOrder.push_back (std::make_pair (issueTime, ticketId));
+            while (redeemedOrder.size () > replayWindow) {
+                // Once an id is forgotten, the only way to keep it's
+                // ticket from being redeemed again is to reject every
+                // ticket issued no later than it was.
+                if (replayFloor < redeemedOrder.front ().first) {
+                    replayFloor = redeemedOrder.front ().first;
+                }
+                redeemed.erase (redeemedOrder.front ().second);
+                redeemedOrder.pop_front ();
+            }
+            return true;
+        }
+
+    } // namespace crypto
+} // namespace thekogans
@@ -0,0 +1,286 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#include "thekogans/crypto/SharedKeyRing.h"
+
+#if defined (THEKOGANS_CRYPTO_HAVE_SHARED_KEY_RING)
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <atomic>
+#include "thekogans/util/LockGuard.h"
+#include "thekogans/util/StringUtils.h"
+#include "thekogans/util/Exception.h"
+
+#if defined (TOOLCHAIN_OS_Linux) && defined (MFD_ALLOW_SEALING) && defined (F_ADD_SEALS)
+    #define THEKOGANS_CRYPTO_HAVE_MEMFD_SEALS
+#endif // defined (TOOLCHAIN_OS_Linux) && defined (MFD_ALLOW_SEALING) && defined (F_ADD_SEALS)
+
+namespace thekogans {
+    namespace crypto {
+
+        namespace {
+            // Makes shared memory object names unique within the process.
+            std::atomic<util::ui32> nextSegmentId (0);
+
+            // Releases whatever it holds unless told otherwise.
+            struct Segment {
+                int handle;
+                util::ui8 *map;
+                util::ui64 size;
+
+                Segment () :
+                    handle (-1),
+                    map (0),
+                    size (0) {}
+                ~Segment () {
+                    Unmap ();
+                    if (handle != -1) {
+                        close (handle);
+                    }
+                }
+
+                void Unmap () {
+                    if (map != 0) {
+                        munmap (map, (std::size_t)size);
+                        map = 0;
+                    }
+                }
+
+                // Map (and optionally lock) the segment. Returns true if locked.
+                bool Map (
+                        int fd,
+                        int protection,
+                        bool lock) {
+                    void *ptr = mmap (0, (std::size_t)size, protection, MAP_SHARED, fd, 0);
+                    if (ptr == MAP_FAILED) {
+                        THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                            THEKOGANS_UTIL_OS_ERROR_CODE);
+                    }
+                    map = (util::ui8 *)ptr;
+                #if defined (MADV_DONTDUMP)
+                    // Keep the keys out of core dumps (a hint, failure is harmless).
+                    madvise (map, (std::size_t)size, MADV_DONTDUMP);
+                #endif // defined (MADV_DONTDUMP)
+                    if (lock) {
+                        if (mlock (map, (std::size_t)size) != 0) {
+                            THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                                "Unable to lock a %s byte key ring segment (check RLIMIT_MEMLOCK): %s",
+                                util::ui64Tostring (size).c_str (),
+                                strerror (errno));
+                        }
+                        return true;
+                    }
+                    return false;
+                }
+
+                util::ui8 *Release () {
+                    util::ui8 *map_ = map;
+                    map = 0;
+                    handle = -1;
+                    return map_;
+                }
+            };
+
+            // Creates the (writable) segment the image is written to.
+            struct SegmentAllocator : public MappedKeyRing::ImageAllocator {
+                Segment &segment;
+                // Used to write the image (not necessarily segment.handle).
+                int writeHandle;
+                bool lock;
+
+                SegmentAllocator (
+                    Segment &segment_,
+                    bool lock_) :
+                    segment (segment_),
+                    writeHandle (-1),
+                    lock (lock_) {}
+                virtual ~SegmentAllocator () {
+                    if (writeHandle != -1 && writeHandle != segment.handle) {
+                        close (writeHandle);
+                    }
+                }
+
+                virtual util::ui8 *Allocate (util::ui64 size) override {
+                    Open ();
+                    if (ftruncate (writeHandle, (off_t)size) != 0) {
+                        THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                            THEKOGANS_UTIL_OS_ERROR_CODE);
+                    }
+                    segment.size = size;
+                    // Lock before writing the keys so that they never hit swap.
+                    segment.Map (writeHandle, PROT_READ | PROT_WRITE, lock);
+                    return segment.map;
+                }
+
+            private:
+            #if defined (THEKOGANS_CRYPTO_HAVE_MEMFD_SEALS)
+                void Open () {
+                    segment.handle = memfd_create (
+                        "thekogans_crypto_SharedKeyRing",
+                        MFD_CLOEXEC | MFD_ALLOW_SEALING);
+                    if (segment.handle == -1) {
+                        THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                            THEKOGANS_UTIL_OS_ERROR_CODE);
+                    }
+                    writeHandle = segment.handle;
+                }
+            #else // defined (THEKOGANS_CRYPTO_HAVE_MEMFD_SEALS)
+                void Open () {
+                    char name[64];
+                    snprintf (name, sizeof (name), "/thekogans_crypto_SharedKeyRing_%ld_%u",
+                        (long)getpid (), (unsigned int)nextSegmentId++);
+                    writeHandle = shm_open (name, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+                    if (writeHandle == -1) {
+                        THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                            THEKOGANS_UTIL_OS_ERROR_CODE);
+                    }
+                    // The handle given out is read only, so the segment can't
+                    // be modified through it.
+                    segment.handle = shm_open (name, O_RDONLY, 0);
+                    int errorCode = THEKOGANS_UTIL_OS_ERROR_CODE;
+                    // Nobody else can open it by name from here on.
+                    shm_unlink (name);
+                    if (segment.handle == -1) {
+                        THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (errorCode);
+                    }
+                    fcntl (segment.handle, F_SETFD, FD_CLOEXEC);
+                }
+            #endif // defined (THEKOGANS_CRYPTO_HAVE_MEMFD_SEALS)
+            };
+        }
+
+        SharedKeyRing::SharedKeyRing (
+                int handle_,
+                util::ui8 *map_,
+                util::ui64 mapSize_,
+                bool locked_) :
+                MappedKeyRing (map_, mapSize_, "shared key ring segment"),
+                handle (handle_),
+                map (map_),
+                mapSize (mapSize_),
+                locked (locked_) {}
+
+        SharedKeyRing::~SharedKeyRing () {
+            munmap (map, (std::size_t)mapSize);
+            if (handle != -1) {
+                close (handle);
+            }
+        }
+
+        SharedKeyRing::SharedPtr SharedKeyRing::Create (
+                const KeyRing &keyRing,
+                bool recursive,
+                bool lock) {
+            Segment segment;
+            {
+                SegmentAllocator allocator (segment, lock);
+                MappedKeyRing::Save (keyRing, allocator, recursive);
+                // The writable mapping has to go before the segment can be sealed.
+                segment.Unmap ();
+            }
+        #if defined (THEKOGANS_CRYPTO_HAVE_MEMFD_SEALS)
+            if (fcntl (segment.handle, F_ADD_SEALS,
+                    F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) != 0) {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE);
+            }
+        #endif // defined (THEKOGANS_CRYPTO_HAVE_MEMFD_SEALS)
+            bool locked = segment.Map (segment.handle, PROT_READ, lock);
+            SharedPtr sharedKeyRing (
+                new SharedKeyRing (segment.handle, segment.map, segment.size, locked));
+            segment.Release ();
+            return sharedKeyRing;
+        }
+
+        SharedKeyRing::SharedPtr SharedKeyRing::Load (
+                const std::string &path,
+                Cipher *cipher,
+                const void *associatedData,
+                std::size_t associatedDataLength,
+                bool recursive,
+                bool lock) {
+            return Create (
+                *KeyRing::Load (path, cipher, associatedData, associatedDataLength),
+                recursive,
+                lock);
+        }
+
+        SharedKeyRing::SharedPtr SharedKeyRing::Attach (
+                int handle,
+                bool lock) {
+        #if defined (THEKOGANS_CRYPTO_HAVE_MEMFD_SEALS)
+            // A memfd that isn't sealed could change under us.
+            int seals = fcntl (handle, F_GET_SEALS);
+            if (seals != -1 && (seals & F_SEAL_WRITE) == 0) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "%s",
+                    "Shared key ring segment is not sealed.");
+            }
+        #endif // defined (THEKOGANS_CRYPTO_HAVE_MEMFD_SEALS)
+            struct stat st;
+            if (fstat (handle, &st) != 0) {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE);
+            }
+            if (st.st_size <= 0 || (util::ui64)st.st_size > (util::ui64)(std::size_t)-1) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "%s",
+                    "Invalid shared key ring segment.");
+            }
+            Segment segment;
+            segment.size = (util::ui64)st.st_size;
+            bool locked = segment.Map (handle, PROT_READ, lock);
+            SharedPtr sharedKeyRing (
+                new SharedKeyRing (-1, segment.map, segment.size, locked));
+            segment.Release ();
+            return sharedKeyRing;
+        }
+
+        Cipher::SharedPtr SharedKeyRing::GetCipher (const ID &keyId) {
+            Cipher::SharedPtr cipher;
+            {
+                util::LockGuard<util::SpinLock> guard (spinLock);
+                if (cipherMap.Get (keyId, cipher)) {
+                    return cipher;
+                }
+            }
+            // Build the cipher outside the lock. If another thread
+            // beats us to it, use theirs.
+            SymmetricKey::SharedPtr key = GetCipherKey (keyId);
+            if (key.Get () != 0) {
+                cipher = GetCipherSuite ().GetCipher (key);
+                util::LockGuard<util::SpinLock> guard (spinLock);
+                Cipher::SharedPtr existing;
+                if (cipherMap.Get (keyId, existing)) {
+                    return existing;
+                }
+                cipherMap.Add (keyId, cipher);
+            }
+            return cipher;
+        }
+
+    } // namespace crypto
+} // namespace thekogans
+
+#endif // defined (THEKOGANS_CRYPTO_HAVE_SHARED_KEY_RING)
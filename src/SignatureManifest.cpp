@@ -0,0 +1,353 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#if defined (TOOLCHAIN_OS_Windows)
+    #include <winsock2.h>
+#endif // defined (TOOLCHAIN_OS_Windows)
+#include <cstring>
+#include <algorithm>
+#include "thekogans/util/Exception.h"
+#include "thekogans/util/Serializer.h"
+#include "thekogans/util/File.h"
+#include "thekogans/util/Path.h"
+#include "thekogans/util/Directory.h"
+#include "thekogans/crypto/CipherSuite.h"
+#include "thekogans/crypto/MessageDigest.h"
+#include "thekogans/crypto/FileReader.h"
+#include "thekogans/crypto/BlockPipeline.h"
+#include "thekogans/crypto/SignatureManifest.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        namespace {
+            // Every block stands for one file. The files are opened
+            // and hashed on the pipeline workers, and the results are
+            // collected (in entry order) on the calling thread.
+            struct FileBlock : public BlockPipeline::Block {
+                std::size_t index;
+                util::ui64 size;
+                bool readable;
+
+                FileBlock (
+                    std::size_t index_,
+                    std::size_t digestLength) :
+                    Block (0, digestLength),
+                    index (index_),
+                    size (0),
+                    readable (false) {}
+            };
+
+            struct FileHasher : public BlockPipeline {
+            private:
+                std::vector<SignatureManifest::Entry> &entries;
+                bool map;
+                // Verify mode: compare instead of record, and
+                // treat unreadable files as invalid instead of
+                // failing the whole batch.
+                std::vector<std::string> *invalidPaths;
+                bool verify;
+                bool valid;
+                std::size_t nextEntry;
+                std::size_t digestLength;
+                std::vector<MessageDigest::SharedPtr> messageDigests;
+
+            public:
+                FileHasher (
+                        std::vector<SignatureManifest::Entry> &entries_,
+                        const EVP_MD *md,
+                        std::size_t workerCount,
+                        bool map_,
+                        bool verify_,
+                        std::vector<std::string> *invalidPaths_ = 0) :
+                        BlockPipeline (workerCount),
+                        entries (entries_),
+                        map (map_),
+                        invalidPaths (invalidPaths_),
+                        verify (verify_),
+                        valid (true),
+                        nextEntry (0),
+                        digestLength (GetMDLength (md)) {
+                    // Each worker gets it's own digest so that
+                    // files can be hashed without locking.
+                    messageDigests.resize (GetWorkerCount ());
+                    for (std::size_t i = 0, count = messageDigests.size (); i < count; ++i) {
+                        messageDigests[i].Reset (new MessageDigest (md));
+                    }
+                }
+
+                bool Hash () {
+                    Run ();
+                    return valid;
+                }
+
+            protected:
+                // BlockPipeline
+                virtual Block::SharedPtr ReadBlock () override {
+                    return nextEntry < entries.size () ?
+                        Block::SharedPtr (new FileBlock (nextEntry++, digestLength)) :
+                        Block::SharedPtr ();
+                }
+                virtual void ProcessBlock (
+                        std::size_t workerIndex,
+                        Block &block) override {
+                    FileBlock &fileBlock = static_cast<FileBlock &> (block);
+                    THEKOGANS_UTIL_TRY {
+                        FileReader file (entries[fileBlock.index].path, map);
+                        fileBlock.size = file.GetSize ();
+                        util::Buffer digest = messageDigests[workerIndex]->HashFile (file);
+                        fileBlock.output.Write (
+                            digest.GetReadPtr (),
+                            digest.GetDataAvailableForReading ());
+                        fileBlock.readable = true;
+                    }
+                    THEKOGANS_UTIL_CATCH (util::Exception) {
+                        if (!verify) {
+                            THEKOGANS_UTIL_RETHROW_EXCEPTION (exception);
+                        }
+                    }
+                }
+                virtual void WriteBlock (Block &block) override {
+                    FileBlock &fileBlock = static_cast<FileBlock &> (block);
+                    SignatureManifest::Entry &entry = entries[fileBlock.index];
+                    if (!verify) {
+                        entry.size = fileBlock.size;
+                        entry.digest.assign (
+                            fileBlock.output.GetReadPtr (),
+                            fileBlock.output.GetReadPtr () +
+                                fileBlock.output.GetDataAvailableForReading ());
+                    }
+                    else if (!fileBlock.readable ||
+                            fileBlock.size != entry.size ||
+                            fileBlock.output.GetDataAvailableForReading () != entry.digest.size () ||
+                            !TimeInsensitiveCompare (
+                                fileBlock.output.GetReadPtr (),
+                                entry.digest.data (),
+                                entry.digest.size ())) {
+                        valid = false;
+                        if (invalidPaths != 0) {
+                            invalidPaths->push_back (entry.path);
+                        }
+                    }
+                }
+            };
+
+            void ListFilesHelper (
+                    const std::string &path,
+                    std::vector<std::string> &paths) {
+                util::Directory directory (path);
+                util::Directory::Entry entry;
+                for (bool gotEntry = directory.GetFirstEntry (entry);
+                        gotEntry; gotEntry = directory.GetNextEntry (entry)) {
+                    if (entry.name != "." && entry.name != "..") {
+                        if (entry.type == util::Directory::Entry::Folder) {
+                            ListFilesHelper (util::MakePath (path, entry.name), paths);
+                        }
+                        else if (entry.type == util::Directory::Entry::File) {
+                            paths.push_back (util::MakePath (path, entry.name));
+                        }
+                    }
+                }
+            }
+        }
+
+        SignatureManifest::SignatureManifest (const EVP_MD *md_) :
+                md (md_) {
+            if (md == 0) {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        SignatureManifest::SharedPtr SignatureManifest::Create (
+                const std::vector<std::string> &paths,
+                Authenticator &signer,
+                const EVP_MD *md,
+                std::size_t workerCount,
+                bool map) {
+            if (!paths.empty () && md != 0) {
+                SharedPtr manifest (new SignatureManifest (md));
+                manifest->entries.reserve (paths.size ());
+                for (std::size_t i = 0, count = paths.size (); i < count; ++i) {
+                    manifest->entries.push_back (Entry (paths[i]));
+                }
+                FileHasher (manifest->entries, md, workerCount, map, false).Hash ();
+                // One private key operation for the whole batch.
+                util::Buffer signedData = manifest->GetSignedData ();
+                manifest->signature = signer.SignBuffer (
+                    signedData.GetReadPtr (),
+                    signedData.GetDataAvailableForReading ());
+                return manifest;
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        SignatureManifest::SharedPtr SignatureManifest::Load (const std::string &path) {
+            util::ReadOnlyFile file (util::NetworkEndian, path);
+            util::Buffer buffer (util::NetworkEndian, (std::size_t)file.GetSize ());
+            buffer.AdvanceWriteOffset (
+                file.Read (
+                    buffer.GetWritePtr (),
+                    buffer.GetDataAvailableForWriting ()));
+            util::ui32 magic;
+            util::ui16 version;
+            std::string messageDigest;
+            util::ui64 entryCount;
+            buffer >> magic >> version >> messageDigest >> entryCount;
+            const EVP_MD *md = CipherSuite::GetOpenSSLMessageDigestByName (messageDigest);
+            // Every entry takes up at least a path length, a size and a digest.
+            if (magic != MAGIC || version != VERSION || md == 0 || entryCount == 0 ||
+                    entryCount > buffer.GetDataAvailableForReading () /
+                        (util::UI32_SIZE + util::UI64_SIZE + GetMDLength (md))) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "Invalid signature manifest %s",
+                    path.c_str ());
+            }
+            SharedPtr manifest (new SignatureManifest (md));
+            manifest->entries.resize ((std::size_t)entryCount);
+            for (std::size_t i = 0, count = manifest->entries.size (); i < count; ++i) {
+                Entry &entry = manifest->entries[i];
+                buffer >> entry.path >> entry.size;
+                entry.digest.resize (manifest->GetDigestLength ());
+                if (buffer.Read (entry.digest.data (), entry.digest.size ()) != entry.digest.size ()) {
+                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                        "Invalid signature manifest %s",
+                        path.c_str ());
+                }
+            }
+            util::ui32 signatureLength;
+            buffer >> signatureLength;
+            if (signatureLength == 0 || signatureLength != buffer.GetDataAvailableForReading ()) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "Invalid signature manifest signature in %s",
+                    path.c_str ());
+            }
+            manifest->signature = util::Buffer (util::NetworkEndian, signatureLength);
+            manifest->signature.AdvanceWriteOffset (
+                buffer.Read (manifest->signature.GetWritePtr (), signatureLength));
+            return manifest;
+        }
+
+        void SignatureManifest::Save (const std::string &path) const {
+            util::Buffer signedData = GetSignedData ();
+            util::SimpleFile file (
+                util::NetworkEndian,
+                path,
+                util::SimpleFile::ReadWrite |
+                util::SimpleFile::Create |
+                util::SimpleFile::Truncate);
+            util::Buffer signatureLength (util::NetworkEndian, util::UI32_SIZE);
+            signatureLength << (util::ui32)signature.GetDataAvailableForReading ();
+            file.Write (
+                signedData.GetReadPtr (),
+                signedData.GetDataAvailableForReading ());
+            file.Write (
+                signatureLength.GetReadPtr (),
+                signatureLength.GetDataAvailableForReading ());
+            file.Write (
+                signature.GetReadPtr (),
+                signature.GetDataAvailableForReading ());
+        }
+
+        std::vector<std::string> SignatureManifest::ListFiles (const std::string &directory) {
+            std::vector<std::string> paths;
+            ListFilesHelper (directory, paths);
+            // Directory order is file system dependent. Sort the
+            // paths so that the same tree gives the same manifest.
+            std::sort (paths.begin (), paths.end ());
+            return paths;
+        }
+
+        std::vector<std::string> SignatureManifest::ReadPathList (const std::string &path) {
+            util::ReadOnlyFile file (util::NetworkEndian, path);
+            std::string contents ((std::size_t)file.GetSize (), '\0');
+            contents.resize (file.Read (&contents[0], contents.size ()));
+            std::vector<std::string> paths;
+            for (std::size_t start = 0; start < contents.size ();) {
+                std::size_t end = contents.find ('\n', start);
+                if (end == std::string::npos) {
+                    end = contents.size ();
+                }
+                std::string line = contents.substr (start, end - start);
+                std::size_t first = line.find_first_not_of (" \t\r");
+                if (first != std::string::npos) {
+                    paths.push_back (
+                        line.substr (first, line.find_last_not_of (" \t\r") - first + 1));
+                }
+                start = end + 1;
+            }
+            return paths;
+        }
+
+        bool SignatureManifest::VerifySignature (Authenticator &verifier) const {
+            util::Buffer signedData = GetSignedData ();
+            return verifier.VerifyBufferSignature (
+                signedData.GetReadPtr (),
+                signedData.GetDataAvailableForReading (),
+                signature.GetReadPtr (),
+                signature.GetDataAvailableForReading ());
+        }
+
+        bool SignatureManifest::Verify (
+                Authenticator &verifier,
+                std::size_t workerCount,
+                bool map,
+                std::vector<std::string> *invalidPaths) const {
+            if (!VerifySignature (verifier)) {
+                return false;
+            }
+            // FileHasher only reads the entries in verify mode.
+            return FileHasher (
+                const_cast<std::vector<Entry> &> (entries),
+                md,
+                workerCount,
+                map,
+                true,
+                invalidPaths).Hash ();
+        }
+
+        util::Buffer SignatureManifest::GetSignedData () const {
+            std::string messageDigest = CipherSuite::GetOpenSSLMessageDigestName (md);
+            std::size_t size =
+                util::UI32_SIZE +
+                util::UI16_SIZE +
+                util::Serializer::Size (messageDigest) +
+                util::UI64_SIZE;
+            for (std::size_t i = 0, count = entries.size (); i < count; ++i) {
+                size +=
+                    util::Serializer::Size (entries[i].path) +
+                    util::UI64_SIZE +
+                    entries[i].digest.size ();
+            }
+            util::Buffer signedData (util::NetworkEndian, size);
+            signedData <<
+                (util::ui32)MAGIC <<
+                (util::ui16)VERSION <<
+                messageDigest <<
+                (util::ui64)entries.size ();
+            for (std::size_t i = 0, count = entries.size (); i < count; ++i) {
+                signedData << entries[i].path << entries[i].size;
+                signedData.Write (entries[i].digest.data (), entries[i].digest.size ());
+            }
+            return signedData;
+        }
+
+    } // namespace crypto
+} // namespace thekogans
@@ -0,0 +1,239 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#include "thekogans/util/Exception.h"
+#include "thekogans/util/LockGuard.h"
+#include "thekogans/util/Thread.h"
+#include "thekogans/util/HRTimer.h"
+#include "thekogans/crypto/DHEKeyExchange.h"
+#include "thekogans/crypto/SignedDHEParamsCache.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        struct SignedDHEParamsCache::Worker : public util::Thread {
+        private:
+            SignedDHEParamsCache &cache;
+
+        public:
+            explicit Worker (SignedDHEParamsCache &cache_) :
+                cache (cache_) {}
+
+        protected:
+            // util::Thread
+            virtual void Run () throw () override {
+                THEKOGANS_UTIL_TRY {
+                    while (cache.WaitForRoom ()) {
+                        // Generate and sign outside the lock; this is the expensive part.
+                        cache.SetNext (cache.CreateEntry ());
+                    }
+                }
+                THEKOGANS_UTIL_CATCH (util::Exception) {
+                    // If the params can't be created or signed, Get will
+                    // throw the same exception when it tries inline.
+                }
+            }
+        };
+
+        SignedDHEParamsCache::SignedDHEParamsCache (
+                Params::SharedPtr params_,
+                AsymmetricKey::SharedPtr privateKey_,
+                MessageDigest::SharedPtr messageDigest_,
+                std::size_t maxAge_,
+                util::ui64 maxUses_,
+                const void *salt_,
+                std::size_t saltLength_,
+                std::size_t keyLength_,
+                const EVP_MD *md_,
+                std::size_t count_,
+                const std::string &keyName_,
+                const std::string &keyDescription_) :
+                params (params_),
+                privateKey (privateKey_),
+                messageDigest (messageDigest_),
+                maxAge (maxAge_),
+                maxUses (maxUses_),
+                salt (
+                    salt_ != 0 && saltLength_ > 0 ?
+                        std::vector<util::ui8> (
+                            (const util::ui8 *)salt_,
+                            (const util::ui8 *)salt_ + saltLength_) :
+                    std::vector<util::ui8> ()),
+                keyLength (keyLength_),
+                md (md_),
+                count (count_),
+                keyName (keyName_),
+                keyDescription (keyDescription_),
+                currentStartTime (0),
+                nextCondition (mutex),
+                done (false) {
+            if (params.Get () == 0 || privateKey.Get () == 0 ||
+                    !privateKey->IsPrivate () || messageDigest.Get () == 0 ||
+                    (maxAge == 0 && maxUses == 0)) {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+            workers.push_back (new Worker (*this));
+            workers.back ()->Create ();
+        }
+
+        SignedDHEParamsCache::~SignedDHEParamsCache () {
+            Stop ();
+        }
+
+        SymmetricKey::SharedPtr SignedDHEParamsCache::Entry::DeriveSharedSymmetricKey (
+                KeyExchange::Params::SharedPtr clientParams,
+                const void *sessionSalt,
+                std::size_t sessionSaltLength) const {
+            const DHEKeyExchange *dheKeyExchange =
+                dynamic_cast<const DHEKeyExchange *> (keyExchange.Get ());
+            if (dheKeyExchange != 0) {
+                return dheKeyExchange->DeriveSharedSymmetricKey (
+                    clientParams, sessionSalt, sessionSaltLength);
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        SignedDHEParamsCache::Entry::SharedPtr SignedDHEParamsCache::Get () {
+            {
+                util::LockGuard<util::Mutex> guard (mutex);
+                if (IsCurrentExpired () && next.Get () != 0) {
+                    StartWindow (next);
+                }
+                if (!IsCurrentExpired ()) {
+                    ++stats.currentUses;
+                    ++stats.hits;
+                    return current;
+                }
+                ++stats.misses;
+            }
+            // The worker fell behind (or was stopped). Pay for
+            // the signature here rather than reuse an expired key.
+            Entry::SharedPtr entry = CreateEntry ();
+            util::LockGuard<util::Mutex> guard (mutex);
+            ++stats.signatures;
+            // Another thread may have started a window while we were signing.
+            if (IsCurrentExpired ()) {
+                StartWindow (entry);
+            }
+            ++stats.currentUses;
+            return current;
+        }
+
+        void SignedDHEParamsCache::Rotate () {
+            util::LockGuard<util::Mutex> guard (mutex);
+            EndWindow ();
+        }
+
+        SignedDHEParamsCache::Stats SignedDHEParamsCache::GetStats () {
+            util::LockGuard<util::Mutex> guard (mutex);
+            Stats snapshot = stats;
+            snapshot.currentAge = GetCurrentAge ();
+            return snapshot;
+        }
+
+        void SignedDHEParamsCache::Stop () {
+            {
+                util::LockGuard<util::Mutex> guard (mutex);
+                done = true;
+                nextCondition.SignalAll ();
+            }
+            for (std::size_t i = 0, count = workers.size (); i < count; ++i) {
+                workers[i]->Wait ();
+            }
+            workers.deleteAndClear ();
+            util::LockGuard<util::Mutex> guard (mutex);
+            next.Reset ();
+        }
+
+        SignedDHEParamsCache::Entry::SharedPtr SignedDHEParamsCache::CreateEntry () const {
+            // The server is the initiator: it's params go out first.
+            // Every window gets a fresh exchange (and key) id.
+            KeyExchange::SharedPtr keyExchange (
+                new DHEKeyExchange (
+                    ID (),
+                    params,
+                    salt.empty () ? 0 : salt.data (),
+                    salt.size (),
+                    keyLength,
+                    md,
+                    count,
+                    ID (),
+                    keyName,
+                    keyDescription));
+            return Entry::SharedPtr (
+                new Entry (
+                    keyExchange,
+                    keyExchange->GetParams (privateKey, messageDigest)));
+        }
+
+        bool SignedDHEParamsCache::IsCurrentExpired () const {
+            return current.Get () == 0 ||
+                (maxUses > 0 && stats.currentUses >= maxUses) ||
+                (maxAge > 0 && GetCurrentAge () >= maxAge);
+        }
+
+        util::f64 SignedDHEParamsCache::GetCurrentAge () const {
+            return current.Get () != 0 ?
+                util::HRTimer::ToSeconds (
+                    util::HRTimer::ComputeElapsedTime (
+                        currentStartTime, util::HRTimer::Click ())) : 0.0;
+        }
+
+        void SignedDHEParamsCache::EndWindow () {
+            if (current.Get () != 0) {
+                stats.previousUses = stats.currentUses;
+                stats.previousAge = GetCurrentAge ();
+                // Releasing the last reference to the entry wipes it's private key.
+                current.Reset ();
+            }
+            stats.currentUses = 0;
+        }
+
+        void SignedDHEParamsCache::StartWindow (Entry::SharedPtr entry) {
+            EndWindow ();
+            current = entry;
+            currentStartTime = util::HRTimer::Click ();
+            ++stats.rotations;
+            if (next.Get () == entry.Get ()) {
+                next.Reset ();
+                // Have the worker sign the next one.
+                nextCondition.Signal ();
+            }
+        }
+
+        bool SignedDHEParamsCache::WaitForRoom () {
+            util::LockGuard<util::Mutex> guard (mutex);
+            while (!done && next.Get () != 0) {
+                nextCondition.Wait ();
+            }
+            return !done;
+        }
+
+        void SignedDHEParamsCache::SetNext (Entry::SharedPtr entry) {
+            util::LockGuard<util::Mutex> guard (mutex);
+            if (!done) {
+                next = entry;
+                ++stats.signatures;
+            }
+        }
+
+    } // namespace crypto
+} // namespace thekogans
@@ -19,6 +19,7 @@
     #include "thekogans/util/SpinLock.h"
     #include "thekogans/util/LockGuard.h"
 #endif // defined (THEKOGANS_CRYPTO_TYPE_Static)
+#include "thekogans/util/DefaultAllocator.h"
 #include "thekogans/crypto/OpenSSLSigner.h"
 #include "thekogans/crypto/OpenSSLUtils.h"
 #include "thekogans/crypto/Ed25519Signer.h"
@@ -28,39 +29,66 @@
 namespace thekogans {
     namespace crypto {
 
-        Signer::Map &Signer::GetMap () {
-            static Map *map = new Map;
-            return *map;
+        Signer::Factory *Signer::GetFactories () {
+            // Zero initialized before any dynamic initialization
+            // (registration) runs.
+            static Factory factories[AsymmetricKey::MAX_KEY_TYPES];
+            return factories;
         }
 
-        Signer::MapInitializer::MapInitializer (
-                const std::string &keyType,
+        void Signer::RegisterFactory (
+                const char *keyType,
                 Factory factory) {
-            std::pair<Map::iterator, bool> result =
-                GetMap ().insert (Map::value_type (keyType, factory));
-            assert (result.second);
-            if (!result.second) {
+            util::ui32 keyTypeId = AsymmetricKey::InternKeyType (keyType);
+            Factory *factories = GetFactories ();
+            assert (factories[keyTypeId] == 0);
+            if (factories[keyTypeId] == 0) {
+                factories[keyTypeId] = factory;
+            }
+            else {
                 THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
-                    "%s is already registered.", keyType.c_str ());
+                    "%s is already registered.", keyType);
             }
         }
 
+        Signer::MapInitializer::MapInitializer (
+                const char *keyType,
+                Factory factory) {
+            RegisterFactory (keyType, factory);
+        }
+
         Signer::Signer (
                 AsymmetricKey::SharedPtr privateKey_,
                 MessageDigest::SharedPtr messageDigest_) :
                 privateKey (privateKey_),
+                sharedStats (0),
                 messageDigest (messageDigest_) {
             if (privateKey.Get () == 0 || messageDigest.Get () == 0) {
                 THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
                     THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
             }
+            metrics.Reset (privateKey->GetId ());
+        }
+
+        void Signer::SavePrefix () {
+            prefix = messageDigest->Clone ();
+        }
+
+        void Signer::InitFromPrefix () {
+            if (prefix.Get () != 0) {
+                messageDigest->CopyState (*prefix);
+            }
+            else {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "%s", "SavePrefix has not been called.");
+            }
         }
 
         Signer::SharedPtr Signer::Get (
                 AsymmetricKey::SharedPtr privateKey,
                 MessageDigest::SharedPtr messageDigest) {
-            Map::iterator it = GetMap ().find (privateKey->GetKeyType ());
-            return it != GetMap ().end () ? it->second (privateKey, messageDigest) : Signer::SharedPtr ();
+            Factory factory = GetFactories ()[privateKey->GetKeyTypeId ()];
+            return factory != 0 ? factory (privateKey, messageDigest) : Signer::SharedPtr ();
         }
 
     #if defined (THEKOGANS_CRYPTO_TYPE_Static)
@@ -70,9 +98,15 @@ namespace thekogans {
             if (!registered) {
                 util::LockGuard<util::SpinLock> guard (spinLock);
                 if (!registered) {
+                #if defined (THEKOGANS_CRYPTO_HAVE_RSA)
                     OpenSSLSigner::StaticInit (OPENSSL_PKEY_RSA);
+                #endif // defined (THEKOGANS_CRYPTO_HAVE_RSA)
+                #if defined (THEKOGANS_CRYPTO_HAVE_DSA)
                     OpenSSLSigner::StaticInit (OPENSSL_PKEY_DSA);
+                #endif // defined (THEKOGANS_CRYPTO_HAVE_DSA)
+                #if defined (THEKOGANS_CRYPTO_HAVE_EC)
                     OpenSSLSigner::StaticInit (OPENSSL_PKEY_EC);
+                #endif // defined (THEKOGANS_CRYPTO_HAVE_EC)
                     Ed25519Signer::StaticInit (Ed25519AsymmetricKey::KEY_TYPE);
                     registered = true;
                 }
@@ -80,8 +114,13 @@ namespace thekogans {
         }
     #endif // defined (THEKOGANS_CRYPTO_TYPE_Static)
 
-        util::Buffer Signer::Final () {
-            util::Buffer signature (util::HostEndian, privateKey->GetKeyLength ());
+        util::Buffer Signer::Final (util::Allocator *allocator) {
+            util::Buffer signature (
+                util::HostEndian,
+                privateKey->GetKeyLength (),
+                0,
+                0,
+                allocator != 0 ? allocator : &util::DefaultAllocator::Instance ());
             signature.AdvanceWriteOffset (Final (signature.GetWritePtr ()));
             return signature;
         }
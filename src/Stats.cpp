@@ -15,34 +15,232 @@
 // You should have received a copy of the GNU General Public License
 // along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
 
+
+#include <limits>
+#include <sstream>
 #include "thekogans/util/XMLUtils.h"
+#include "thekogans/util/HRTimer.h"
 #include "thekogans/crypto/Stats.h"
 
 namespace thekogans {
     namespace crypto {
 
+        namespace {
+            const util::ui64 NO_MIN_BYTE_COUNT = std::numeric_limits<util::ui64>::max ();
+
+            // Spread threads over shards round robin.
+            std::atomic<std::size_t> nextShardIndex (0);
+
+            inline std::size_t GetShardIndex () {
+                static thread_local std::size_t shardIndex =
+                    nextShardIndex.fetch_add (1, std::memory_order_relaxed) % Stats::SHARD_COUNT;
+                return shardIndex;
+            }
+
+            inline std::size_t GetLatencyBucket (util::ui64 nanoseconds) {
+                std::size_t bucket = 0;
+                while (nanoseconds > 1 && bucket < Stats::LATENCY_BUCKET_COUNT - 1) {
+                    nanoseconds >>= 1;
+                    ++bucket;
+                }
+                return bucket;
+            }
+
+            // Publish SHARD_COUNT new shards unless another thread beat us to it.
+            template<typename T>
+            T *GetOrCreateShards (std::atomic<T *> &shards) {
+                T *value = shards.load (std::memory_order_acquire);
+                if (value == 0) {
+                    T *newShards = new T[Stats::SHARD_COUNT];
+                    if (shards.compare_exchange_strong (
+                            value, newShards,
+                            std::memory_order_acq_rel,
+                            std::memory_order_acquire)) {
+                        value = newShards;
+                    }
+                    else {
+                        delete [] newShards;
+                    }
+                }
+                return value;
+            }
+        }
+
+        void Stats::Shard::Reset () {
+            useCount.store (0, std::memory_order_relaxed);
+            minByteCount.store (NO_MIN_BYTE_COUNT, std::memory_order_relaxed);
+            maxByteCount.store (0, std::memory_order_relaxed);
+            totalByteCount.store (0, std::memory_order_relaxed);
+        }
+
+        void Stats::LatencyShard::Reset () {
+            for (std::size_t i = 0; i < LATENCY_BUCKET_COUNT; ++i) {
+                latency[i].store (0, std::memory_order_relaxed);
+            }
+        }
+
+        Stats::Stats (bool latencyEnabled_) :
+                shards (0),
+                latencyShards (0),
+                latencyEnabled (false) {
+            if (latencyEnabled_) {
+                EnableLatency (true);
+            }
+        }
+
+        Stats::~Stats () {
+            delete [] shards.load (std::memory_order_relaxed);
+            delete [] latencyShards.load (std::memory_order_relaxed);
+        }
+
+        Stats::Shard *Stats::GetShards () {
+            return GetOrCreateShards (shards);
+        }
+
+        Stats::LatencyShard *Stats::GetLatencyShards () {
+            return GetOrCreateShards (latencyShards);
+        }
+
+        void Stats::EnableLatency (bool enabled) {
+            // Allocate before enabling so that Scope/UpdateLatency
+            // never race the allocation on the hot path.
+            if (enabled) {
+                GetLatencyShards ();
+            }
+            latencyEnabled.store (enabled, std::memory_order_relaxed);
+        }
+
         void Stats::Update (std::size_t byteCount) {
-            ++useCount;
-            if (minByteCount > byteCount) {
-                minByteCount = byteCount;
+            Shard &shard = GetShards ()[GetShardIndex ()];
+            shard.useCount.fetch_add (1, std::memory_order_relaxed);
+            util::ui64 value = shard.minByteCount.load (std::memory_order_relaxed);
+            while (value > byteCount &&
+                !shard.minByteCount.compare_exchange_weak (
+                    value, byteCount, std::memory_order_relaxed));
+            value = shard.maxByteCount.load (std::memory_order_relaxed);
+            while (value < byteCount &&
+                !shard.maxByteCount.compare_exchange_weak (
+                    value, byteCount, std::memory_order_relaxed));
+            shard.totalByteCount.fetch_add (byteCount, std::memory_order_relaxed);
+        }
+
+        void Stats::UpdateLatency (util::ui64 nanoseconds) {
+            GetLatencyShards ()[GetShardIndex ()].latency[GetLatencyBucket (nanoseconds)].fetch_add (
+                1, std::memory_order_relaxed);
+        }
+
+        void Stats::UpdateLatencySince (util::ui64 start) {
+            UpdateLatency (
+                (util::ui64)(util::HRTimer::ToSeconds (
+                    util::HRTimer::ComputeElapsedTime (
+                        start, util::HRTimer::Click ())) * 1e9));
+        }
+
+        Stats::Scope::Scope (
+                Stats &stats_,
+                std::size_t byteCount_) :
+                stats (stats_),
+                byteCount (byteCount_),
+                start (stats.IsLatencyEnabled () ? util::HRTimer::Click () : 0) {}
+
+        Stats::Scope::~Scope () {
+            stats.Update (byteCount);
+            if (start != 0) {
+                stats.UpdateLatencySince (start);
+            }
+        }
+
+        util::ui64 Stats::GetUseCount () const {
+            util::ui64 useCount = 0;
+            const Shard *currentShards = shards.load (std::memory_order_acquire);
+            for (std::size_t i = 0; currentShards != 0 && i < SHARD_COUNT; ++i) {
+                useCount += currentShards[i].useCount.load (std::memory_order_relaxed);
             }
-            if (maxByteCount < byteCount) {
-                maxByteCount = byteCount;
+            return useCount;
+        }
+
+        util::ui64 Stats::GetMinByteCount () const {
+            util::ui64 minByteCount = NO_MIN_BYTE_COUNT;
+            const Shard *currentShards = shards.load (std::memory_order_acquire);
+            for (std::size_t i = 0; currentShards != 0 && i < SHARD_COUNT; ++i) {
+                util::ui64 value = currentShards[i].minByteCount.load (std::memory_order_relaxed);
+                if (minByteCount > value) {
+                    minByteCount = value;
+                }
+            }
+            return minByteCount != NO_MIN_BYTE_COUNT ? minByteCount : 0;
+        }
+
+        util::ui64 Stats::GetMaxByteCount () const {
+            util::ui64 maxByteCount = 0;
+            const Shard *currentShards = shards.load (std::memory_order_acquire);
+            for (std::size_t i = 0; currentShards != 0 && i < SHARD_COUNT; ++i) {
+                util::ui64 value = currentShards[i].maxByteCount.load (std::memory_order_relaxed);
+                if (maxByteCount < value) {
+                    maxByteCount = value;
+                }
             }
-            totalByteCount += byteCount;
+            return maxByteCount;
+        }
+
+        util::ui64 Stats::GetTotalByteCount () const {
+            util::ui64 totalByteCount = 0;
+            const Shard *currentShards = shards.load (std::memory_order_acquire);
+            for (std::size_t i = 0; currentShards != 0 && i < SHARD_COUNT; ++i) {
+                totalByteCount += currentShards[i].totalByteCount.load (std::memory_order_relaxed);
+            }
+            return totalByteCount;
+        }
+
+        util::ui64 Stats::GetLatencyHistogram (util::ui64 buckets[LATENCY_BUCKET_COUNT]) const {
+            util::ui64 count = 0;
+            const LatencyShard *currentLatencyShards =
+                latencyShards.load (std::memory_order_acquire);
+            for (std::size_t i = 0; i < LATENCY_BUCKET_COUNT; ++i) {
+                buckets[i] = 0;
+                for (std::size_t j = 0; currentLatencyShards != 0 && j < SHARD_COUNT; ++j) {
+                    buckets[i] += currentLatencyShards[j].latency[i].load (std::memory_order_relaxed);
+                }
+                count += buckets[i];
+            }
+            return count;
+        }
+
+        util::ui64 Stats::GetLatencyPercentile (util::f64 percentile) const {
+            util::ui64 buckets[LATENCY_BUCKET_COUNT];
+            util::ui64 count = GetLatencyHistogram (buckets);
+            if (count > 0) {
+                util::f64 target = count * percentile / 100.0;
+                util::ui64 total = 0;
+                for (std::size_t i = 0; i < LATENCY_BUCKET_COUNT; ++i) {
+                    total += buckets[i];
+                    if (buckets[i] > 0 && total >= target) {
+                        return 2ULL << i;
+                    }
+                }
+                return 2ULL << (LATENCY_BUCKET_COUNT - 1);
+            }
+            return 0;
         }
 
         void Stats::Reset () {
-            useCount = 0;
-            minByteCount = 0;
-            maxByteCount = 0;
-            totalByteCount = 0;
+            Shard *currentShards = shards.load (std::memory_order_acquire);
+            LatencyShard *currentLatencyShards = latencyShards.load (std::memory_order_acquire);
+            for (std::size_t i = 0; i < SHARD_COUNT; ++i) {
+                if (currentShards != 0) {
+                    currentShards[i].Reset ();
+                }
+                if (currentLatencyShards != 0) {
+                    currentLatencyShards[i].Reset ();
+                }
+            }
         }
 
         const char * const Stats::ATTR_USE_COUNT = "UseCount";
         const char * const Stats::ATTR_MIN_BYTE_COUNT = "MinByteCount";
         const char * const Stats::ATTR_MAX_BYTE_COUNT = "MaxByteCount";
         const char * const Stats::ATTR_TOTAL_BYTE_COUNT = "TotalByteCount";
+        const char * const Stats::ATTR_LATENCY = "Latency";
 
         std::string Stats::ToString (
                 std::size_t indentationLevel,
@@ -51,21 +249,52 @@ namespace thekogans {
             attributes.push_back (
                 util::Attribute (
                     ATTR_USE_COUNT,
-                    util::size_tTostring (useCount)));
+                    util::size_tTostring ((std::size_t)GetUseCount ())));
             attributes.push_back (
                 util::Attribute (
                     ATTR_MIN_BYTE_COUNT,
-                    util::size_tTostring (minByteCount)));
+                    util::size_tTostring ((std::size_t)GetMinByteCount ())));
             attributes.push_back (
                 util::Attribute (
                     ATTR_MAX_BYTE_COUNT,
-                    util::size_tTostring (maxByteCount)));
+                    util::size_tTostring ((std::size_t)GetMaxByteCount ())));
             attributes.push_back (
                 util::Attribute (
                     ATTR_TOTAL_BYTE_COUNT,
-                    util::size_tTostring (totalByteCount)));
+                    util::size_tTostring ((std::size_t)GetTotalByteCount ())));
             return util::OpenTag (indentationLevel, tagName, attributes, true, true);
         }
 
+        std::string Stats::ToJSON () const {
+            std::stringstream stream;
+            stream <<
+                "{\"" << ATTR_USE_COUNT << "\":" << GetUseCount () <<
+                ",\"" << ATTR_MIN_BYTE_COUNT << "\":" << GetMinByteCount () <<
+                ",\"" << ATTR_MAX_BYTE_COUNT << "\":" << GetMaxByteCount () <<
+                ",\"" << ATTR_TOTAL_BYTE_COUNT << "\":" << GetTotalByteCount ();
+            if (IsLatencyEnabled ()) {
+                util::ui64 buckets[LATENCY_BUCKET_COUNT];
+                util::ui64 count = GetLatencyHistogram (buckets);
+                stream <<
+                    ",\"" << ATTR_LATENCY << "\":{\"Count\":" << count <<
+                    ",\"P50\":" << GetLatencyPercentile (50.0) <<
+                    ",\"P99\":" << GetLatencyPercentile (99.0) <<
+                    ",\"Buckets\":[";
+                bool first = true;
+                for (std::size_t i = 0; i < LATENCY_BUCKET_COUNT; ++i) {
+                    if (buckets[i] > 0) {
+                        if (!first) {
+                            stream << ",";
+                        }
+                        stream << "[" << (2ULL << i) << "," << buckets[i] << "]";
+                        first = false;
+                    }
+                }
+                stream << "]}";
+            }
+            stream << "}";
+            return stream.str ();
+        }
+
     } // namespace crypto
 } // namespace thekogans
@@ -0,0 +1,183 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#include <cstring>
+#include "thekogans/util/Exception.h"
+#include "thekogans/util/RandomSource.h"
+#include "thekogans/crypto/OpenSSLUtils.h"
+#include "thekogans/crypto/ConstantTime.h"
+#include "thekogans/crypto/StreamCipher.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        StreamCipher::StreamCipher (
+                SymmetricKey::SharedPtr key_,
+                const EVP_CIPHER *cipher_) :
+                key (key_),
+                cipher (cipher_),
+                encryptor (key, cipher),
+                decryptor (key, cipher),
+                counter (0),
+                state (Idle) {
+            if (!IsCipherAEAD (cipher) || encryptor.GetIVLength () != NONCE_LENGTH) {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+            memset (nonce, 0, NONCE_LENGTH);
+        }
+
+        StreamCipher::~StreamCipher () {
+            memset (nonce, 0, NONCE_LENGTH);
+        }
+
+        std::size_t StreamCipher::BeginEncryption (util::ui8 *header) {
+            if (header != 0) {
+                if (util::GlobalRandomSource::Instance ().GetBytes (
+                        nonce, NONCE_PREFIX_LENGTH) == NONCE_PREFIX_LENGTH) {
+                    memcpy (header, nonce, NONCE_PREFIX_LENGTH);
+                    counter = 0;
+                    state = Encrypting;
+                    return HEADER_LENGTH;
+                }
+                else {
+                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                        "Unable to get %u random bytes for nonce prefix.",
+                        NONCE_PREFIX_LENGTH);
+                }
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        std::size_t StreamCipher::EncryptSegment (
+                const void *plaintext,
+                std::size_t plaintextLength,
+                bool last,
+                const void *associatedData,
+                std::size_t associatedDataLength,
+                util::ui8 *ciphertext) {
+            if (state == Encrypting &&
+                    ((plaintext != 0 && plaintextLength > 0) || (plaintextLength == 0 && last)) &&
+                    plaintextLength <= MAX_SEGMENT_PLAINTEXT_LENGTH &&
+                    ciphertext != 0) {
+                UpdateNonce (last);
+                encryptor.InitWithIV (nonce);
+                if (associatedData != 0 && associatedDataLength > 0) {
+                    encryptor.SetAssociatedData (associatedData, associatedDataLength);
+                }
+                std::size_t ciphertextLength = 0;
+                if (plaintextLength > 0) {
+                    ciphertextLength += encryptor.Update (plaintext, plaintextLength, ciphertext);
+                }
+                ciphertextLength += encryptor.Final (ciphertext + ciphertextLength);
+                ciphertextLength += encryptor.GetTag (ciphertext + ciphertextLength);
+                if (last) {
+                    state = Finished;
+                }
+                return ciphertextLength;
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        void StreamCipher::BeginDecryption (
+                const void *header,
+                std::size_t headerLength) {
+            if (header != 0 && headerLength == HEADER_LENGTH) {
+                memcpy (nonce, header, NONCE_PREFIX_LENGTH);
+                counter = 0;
+                state = Decrypting;
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        std::size_t StreamCipher::DecryptSegment (
+                const void *ciphertext,
+                std::size_t ciphertextLength,
+                bool last,
+                const void *associatedData,
+                std::size_t associatedDataLength,
+                util::ui8 *plaintext) {
+            if (state == Decrypting &&
+                    ciphertext != 0 && ciphertextLength >= TAG_LENGTH &&
+                    ciphertextLength <= GetSegmentLength (MAX_SEGMENT_PLAINTEXT_LENGTH) &&
+                    plaintext != 0) {
+                std::size_t payloadLength = ciphertextLength - TAG_LENGTH;
+                THEKOGANS_UTIL_TRY {
+                    UpdateNonce (last);
+                    decryptor.Init (nonce);
+                    if (associatedData != 0 && associatedDataLength > 0) {
+                        decryptor.SetAssociatedData (associatedData, associatedDataLength);
+                    }
+                    std::size_t plaintextLength = 0;
+                    if (payloadLength > 0) {
+                        plaintextLength += decryptor.Update (ciphertext, payloadLength, plaintext);
+                    }
+                    decryptor.SetTag ((const util::ui8 *)ciphertext + payloadLength, TAG_LENGTH);
+                    // Final will throw if the segment fails authentication (tampered,
+                    // reordered, dropped or misflagged segments all end up here).
+                    plaintextLength += decryptor.Final (plaintext + plaintextLength);
+                    if (last) {
+                        state = Finished;
+                    }
+                    return plaintextLength;
+                }
+                THEKOGANS_UTIL_CATCH (util::Exception) {
+                    // The counter has moved on. Letting the caller carry on
+                    // would verify the following segments under their correct
+                    // nonces and hide the bad one. Kill the stream, and don't
+                    // leave unverified plaintext behind.
+                    state = Failed;
+                    if (payloadLength > 0) {
+                        SecureZero (plaintext, payloadLength);
+                    }
+                    THEKOGANS_UTIL_RETHROW_EXCEPTION (exception);
+                }
+            }
+            else {
+                if (state == Decrypting) {
+                    state = Failed;
+                }
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        void StreamCipher::UpdateNonce (bool last) {
+            // Counter is never allowed to wrap. Doing so would reuse a nonce.
+            if (counter == util::UI32_MAX) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "%s", "Stream segment counter exhausted.");
+            }
+            util::ui32 segment = counter++;
+            nonce[NONCE_PREFIX_LENGTH] = (util::ui8)(segment >> 24);
+            nonce[NONCE_PREFIX_LENGTH + 1] = (util::ui8)(segment >> 16);
+            nonce[NONCE_PREFIX_LENGTH + 2] = (util::ui8)(segment >> 8);
+            nonce[NONCE_PREFIX_LENGTH + 3] = (util::ui8)segment;
+            nonce[NONCE_PREFIX_LENGTH + COUNTER_LENGTH] = last ? 1 : 0;
+        }
+
+    } // namespace crypto
+} // namespace thekogans
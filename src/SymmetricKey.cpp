@@ -25,16 +25,24 @@
 #include <openssl/hmac.h>
 #include "thekogans/util/SizeT.h"
 #include "thekogans/util/SecureAllocator.h"
-#include "thekogans/util/RandomSource.h"
 #include "thekogans/util/HRTimer.h"
 #include "thekogans/util/XMLUtils.h"
 #include "thekogans/util/StringUtils.h"
+#include "thekogans/util/Thread.h"
+#include "thekogans/util/OwnerVector.h"
+#include "thekogans/util/SystemInfo.h"
+#include "thekogans/util/LockGuard.h"
 #include "thekogans/crypto/MessageDigest.h"
+#include "thekogans/crypto/Blake3.h"
 #include "thekogans/crypto/Argon2Exception.h"
 #include "thekogans/crypto/fastpbkdf2.h"
 #include "thekogans/crypto/OpenSSLInit.h"
 #include "thekogans/crypto/OpenSSLException.h"
 #include "thekogans/crypto/OpenSSLUtils.h"
+#include "thekogans/crypto/CipherKeySchedule.h"
+#include "thekogans/crypto/BufferedRandomSource.h"
+#include "thekogans/crypto/Trace.h"
+#include "thekogans/crypto/TextEncoding.h"
 #include "thekogans/crypto/SymmetricKey.h"
 
 namespace thekogans {
@@ -49,6 +57,55 @@ namespace thekogans {
             1,
             THEKOGANS_CRYPTO_MIN_SYMMETRIC_KEYS_IN_PAGE)
 
+        Stats &SymmetricKey::GetKDFStats (KDF kdf) {
+            if (kdf < KDF_COUNT) {
+                // Leaked on purpose (KDFs can run during static destruction).
+                static Stats *stats = new Stats[KDF_COUNT];
+                return stats[kdf];
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        SymmetricKey::SymmetricKey (
+                const void *buffer,
+                std::size_t length,
+                const ID &id,
+                const std::string &name,
+                const std::string &description) :
+                Serializable (id, name, description),
+                // FixedBuffer will throw if length > EVP_MAX_KEY_LENGTH.
+                key (util::HostEndian, buffer, length, true),
+                ivSaltValid (false),
+                ivCounter (0),
+                ivCounterExhausted (false) {}
+
+        SymmetricKey::SymmetricKey (
+                util::SecureBuffer &&buffer,
+                const ID &id,
+                const std::string &name,
+                const std::string &description) :
+                Serializable (id, name, description),
+                // FixedBuffer will throw if length > EVP_MAX_KEY_LENGTH.
+                key (
+                    util::HostEndian,
+                    buffer.GetReadPtr (),
+                    buffer.GetDataAvailableForReading (),
+                    true),
+                ivSaltValid (false),
+                ivCounter (0),
+                ivCounterExhausted (false) {
+            SecureZero (buffer.GetReadPtr (), buffer.GetDataAvailableForReading ());
+            buffer.AdvanceReadOffset (buffer.GetDataAvailableForReading ());
+        }
+
+        SymmetricKey::~SymmetricKey () {
+            SecureZero (key.GetDataPtr (), key.GetLength ());
+            SecureZero (ivSalt, EVP_MAX_IV_LENGTH);
+        }
+
     #if defined (THEKOGANS_CRYPTO_HAVE_ARGON2)
         SymmetricKey::SharedPtr SymmetricKey::FromArgon2 (
                 argon2_context &context,
@@ -57,17 +114,19 @@ namespace thekogans {
                 const ID &id,
                 const std::string &name,
                 const std::string &description) {
+            THEKOGANS_CRYPTO_TRACE_SCOPE (OPERATION_KDF, id, 0, keyLength);
+            Stats::Scope statsScope (GetKDFStats (KDF_ARGON2), keyLength);
             if (keyLength > 0 && argon2_ctx != 0) {
                 uint8_t *out = context.out;
                 uint32_t outlen = context.outlen;
-                util::SecureVector<util::ui8> key (keyLength);
-                context.out = key.data ();
-                context.outlen = (uint32_t)key.size ();
+                SharedPtr symmetricKey (new SymmetricKey (0, 0, id, name, description));
+                context.out = symmetricKey->Resize (keyLength);
+                context.outlen = (uint32_t)keyLength;
                 int errorCode = argon2_ctx (&context);
                 context.out = out;
                 context.outlen = outlen;
                 if (errorCode == ARGON2_OK) {
-                    return SharedPtr (new SymmetricKey (key.data (), key.size (), id, name, description));
+                    return symmetricKey;
                 }
                 else {
                     THEKOGANS_CRYPTO_THROW_ARGON2_ERROR_CODE_EXCEPTION (errorCode);
@@ -92,6 +151,8 @@ namespace thekogans {
                 const ID &id,
                 const std::string &name,
                 const std::string &description) {
+            THEKOGANS_CRYPTO_TRACE_SCOPE (OPERATION_KDF, id, 0, keyLength);
+            Stats::Scope statsScope (GetKDFStats (KDF_PBKDF1), keyLength);
             if (password != 0 && passwordLength > 0 &&
                     (salt == 0 || saltLength == 8) &&
                     keyLength > 0 && keyLength <= GetMDLength (md) &&
@@ -101,20 +162,29 @@ namespace thekogans {
                 if (salt != 0 && saltLength > 0) {
                     messageDigest.Update (salt, saltLength);
                 }
-                util::SecureVector<util::ui8> buffer (EVP_MAX_MD_SIZE);
-                std::size_t bufferLength = messageDigest.Final (buffer.data ());
-                util::ui64 start = util::HRTimer::Click ();
-                util::f64 elapsedSeconds = 0.0;
-                for (std::size_t i = 1;
-                        i < count || (timeInSeconds != 0.0 && (i % 128 != 0 || elapsedSeconds < timeInSeconds));
-                        ++i) {
-                    messageDigest.Init ();
-                    messageDigest.Update (buffer.data (), bufferLength);
-                    bufferLength = messageDigest.Final (buffer.data ());
-                    elapsedSeconds = util::HRTimer::ToSeconds (
-                        util::HRTimer::ComputeElapsedTime (start, util::HRTimer::Click ()));
-                }
-                return SharedPtr (new SymmetricKey (buffer.data (), keyLength, id, name, description));
+                util::ui8 buffer[EVP_MAX_MD_SIZE];
+                SharedPtr symmetricKey;
+                THEKOGANS_UTIL_TRY {
+                    std::size_t bufferLength = messageDigest.Final (buffer);
+                    util::ui64 start = util::HRTimer::Click ();
+                    util::f64 elapsedSeconds = 0.0;
+                    for (std::size_t i = 1;
+                            i < count || (timeInSeconds != 0.0 && (i % 128 != 0 || elapsedSeconds < timeInSeconds));
+                            ++i) {
+                        messageDigest.Init ();
+                        messageDigest.Update (buffer, bufferLength);
+                        bufferLength = messageDigest.Final (buffer);
+                        elapsedSeconds = util::HRTimer::ToSeconds (
+                            util::HRTimer::ComputeElapsedTime (start, util::HRTimer::Click ()));
+                    }
+                    symmetricKey.Reset (new SymmetricKey (buffer, keyLength, id, name, description));
+                }
+                THEKOGANS_UTIL_CATCH (util::Exception) {
+                    OPENSSL_cleanse (buffer, sizeof (buffer));
+                    THEKOGANS_UTIL_RETHROW_EXCEPTION (exception);
+                }
+                OPENSSL_cleanse (buffer, sizeof (buffer));
+                return symmetricKey;
             }
             else {
                 THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
@@ -122,53 +192,128 @@ namespace thekogans {
             }
         }
 
-        SymmetricKey::SharedPtr SymmetricKey::FromPBKDF2 (
-                const void *password,
-                std::size_t passwordLength,
-                const void *salt,
-                std::size_t saltLength,
-                std::size_t keyLength,
-                PBKDF2_HMAC hash,
-                std::size_t count,
-                const ID &id,
-                const std::string &name,
-                const std::string &description) {
-            if (password != 0 && passwordLength > 0 &&
-                    keyLength > 0 && count > 0) {
-                util::SecureVector<util::ui8> key (keyLength);
+        namespace {
+            void PBKDF2 (
+                    const void *password,
+                    std::size_t passwordLength,
+                    const void *salt,
+                    std::size_t saltLength,
+                    SymmetricKey::PBKDF2_HMAC hash,
+                    std::size_t count,
+                    util::ui8 *key,
+                    std::size_t keyLength) {
                 switch (hash) {
-                    case PBKDF2_HMAC_SHA1:
+                    case SymmetricKey::PBKDF2_HMAC_SHA1:
                         fastpbkdf2_hmac_sha1 (
                             (const uint8_t *)password,
                             (uint32_t)passwordLength,
                             (const uint8_t *)salt,
                             (uint32_t)saltLength,
                             (uint32_t)count,
-                            key.data (),
-                            (uint32_t)key.size ());
+                            key,
+                            (uint32_t)keyLength);
                         break;
-                    case PBKDF2_HMAC_SHA256:
+                    case SymmetricKey::PBKDF2_HMAC_SHA256:
                         fastpbkdf2_hmac_sha256 (
                             (const uint8_t *)password,
                             (uint32_t)passwordLength,
                             (const uint8_t *)salt,
                             (uint32_t)saltLength,
                             (uint32_t)count,
-                            key.data (),
-                            (uint32_t)key.size ());
+                            key,
+                            (uint32_t)keyLength);
                         break;
-                    case PBKDF2_HMAC_SHA512:
+                    case SymmetricKey::PBKDF2_HMAC_SHA512:
                         fastpbkdf2_hmac_sha512 (
                             (const uint8_t *)password,
                             (uint32_t)passwordLength,
                             (const uint8_t *)salt,
                             (uint32_t)saltLength,
                             (uint32_t)count,
-                            key.data (),
-                            (uint32_t)key.size ());
+                            key,
+                            (uint32_t)keyLength);
                         break;
                 }
-                return SharedPtr (new SymmetricKey (key.data (), key.size (), id, name, description));
+            }
+
+            struct PBKDF2Worker : public util::Thread {
+                const std::vector<SymmetricKey::PBKDF2Input> &inputs;
+                std::vector<SymmetricKey::SharedPtr> &keys;
+                std::size_t begin;
+                std::size_t end;
+                std::size_t keyLength;
+                SymmetricKey::PBKDF2_HMAC hash;
+                std::size_t count;
+                std::string error;
+
+                PBKDF2Worker (
+                    const std::vector<SymmetricKey::PBKDF2Input> &inputs_,
+                    std::vector<SymmetricKey::SharedPtr> &keys_,
+                    std::size_t begin_,
+                    std::size_t end_,
+                    std::size_t keyLength_,
+                    SymmetricKey::PBKDF2_HMAC hash_,
+                    std::size_t count_) :
+                    inputs (inputs_),
+                    keys (keys_),
+                    begin (begin_),
+                    end (end_),
+                    keyLength (keyLength_),
+                    hash (hash_),
+                    count (count_) {}
+
+                void DeriveKeys () {
+                    for (std::size_t i = begin; i < end; ++i) {
+                        keys[i] = SymmetricKey::FromPBKDF2 (
+                            inputs[i].password,
+                            inputs[i].passwordLength,
+                            inputs[i].salt,
+                            inputs[i].saltLength,
+                            keyLength,
+                            hash,
+                            count);
+                    }
+                }
+
+            protected:
+                // util::Thread
+                virtual void Run () throw () override {
+                    THEKOGANS_UTIL_TRY {
+                        DeriveKeys ();
+                    }
+                    THEKOGANS_UTIL_CATCH (util::Exception) {
+                        error = exception.Report ();
+                    }
+                }
+            };
+        }
+
+        SymmetricKey::SharedPtr SymmetricKey::FromPBKDF2 (
+                const void *password,
+                std::size_t passwordLength,
+                const void *salt,
+                std::size_t saltLength,
+                std::size_t keyLength,
+                PBKDF2_HMAC hash,
+                std::size_t count,
+                const ID &id,
+                const std::string &name,
+                const std::string &description) {
+            THEKOGANS_CRYPTO_TRACE_SCOPE (OPERATION_KDF, id, 0, keyLength);
+            Stats::Scope statsScope (GetKDFStats (KDF_PBKDF2), keyLength);
+            if (password != 0 && passwordLength > 0 &&
+                    keyLength > 0 && count > 0) {
+                SharedPtr symmetricKey (new SymmetricKey (0, 0, id, name, description));
+                PBKDF2 (
+                    password,
+                    passwordLength,
+                    salt,
+                    saltLength,
+                    hash,
+                    count,
+                    symmetricKey->Resize (keyLength),
+                    keyLength);
+                return symmetricKey;
             }
             else {
                 THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
@@ -176,6 +321,62 @@ namespace thekogans {
             }
         }
 
+        std::vector<SymmetricKey::SharedPtr> SymmetricKey::FromPBKDF2Batch (
+                const std::vector<PBKDF2Input> &inputs,
+                std::size_t keyLength,
+                PBKDF2_HMAC hash,
+                std::size_t count,
+                std::size_t workerCount) {
+            if (keyLength == 0 || count == 0) {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+            for (std::size_t i = 0, inputCount = inputs.size (); i < inputCount; ++i) {
+                if (inputs[i].password == 0 || inputs[i].passwordLength == 0) {
+                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                        "Invalid password: " THEKOGANS_UTIL_SIZE_T_FORMAT ".", i);
+                }
+            }
+            std::vector<SharedPtr> keys (inputs.size ());
+            if (workerCount == 0) {
+                workerCount = util::SystemInfo::Instance ().GetCPUCount ();
+            }
+            if (workerCount > inputs.size ()) {
+                workerCount = inputs.size ();
+            }
+            if (workerCount <= 1) {
+                PBKDF2Worker (inputs, keys, 0, inputs.size (), keyLength, hash, count).DeriveKeys ();
+            }
+            else {
+                util::OwnerVector<PBKDF2Worker> workers;
+                workers.reserve (workerCount);
+                std::size_t stripe = (inputs.size () + workerCount - 1) / workerCount;
+                for (std::size_t begin = 0; begin < inputs.size (); begin += stripe) {
+                    workers.push_back (
+                        new PBKDF2Worker (
+                            inputs,
+                            keys,
+                            begin,
+                            std::min (begin + stripe, inputs.size ()),
+                            keyLength,
+                            hash,
+                            count));
+                    workers.back ()->Create ();
+                }
+                for (std::size_t i = 0, size = workers.size (); i < size; ++i) {
+                    workers[i]->Wait ();
+                }
+                for (std::size_t i = 0, size = workers.size (); i < size; ++i) {
+                    if (!workers[i]->error.empty ()) {
+                        THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                            "%s",
+                            workers[i]->error.c_str ());
+                    }
+                }
+            }
+            return keys;
+        }
+
         SymmetricKey::SharedPtr SymmetricKey::FromOpenSSLPBKDF2 (
                 const void *password,
                 std::size_t passwordLength,
@@ -187,9 +388,11 @@ namespace thekogans {
                 const ID &id,
                 const std::string &name,
                 const std::string &description) {
+            THEKOGANS_CRYPTO_TRACE_SCOPE (OPERATION_KDF, id, 0, keyLength);
+            Stats::Scope statsScope (GetKDFStats (KDF_OPENSSL_PBKDF2), keyLength);
             if (password != 0 && passwordLength > 0 &&
                     keyLength > 0 && md != 0 && count > 0) {
-                util::SecureVector<util::ui8> key (keyLength);
+                SharedPtr symmetricKey (new SymmetricKey (0, 0, id, name, description));
                 if (PKCS5_PBKDF2_HMAC (
                         (const char *)password,
                         (int)passwordLength,
@@ -197,9 +400,9 @@ namespace thekogans {
                         (int)saltLength,
                         (int)count,
                         md,
-                        (int)key.size (),
-                        key.data ()) == 1) {
-                    return SharedPtr (new SymmetricKey (key.data (), key.size (), id, name, description));
+                        (int)keyLength,
+                        symmetricKey->Resize (keyLength)) == 1) {
+                    return symmetricKey;
                 }
                 else {
                     THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
@@ -212,26 +415,25 @@ namespace thekogans {
         }
 
         namespace {
-            void HKDF_Extract (
+            // prk must be at least EVP_MAX_MD_SIZE bytes long.
+            std::size_t HKDF_Extract (
                     const void *hmacKey,
                     std::size_t hmacKeyLength,
                     const void *salt,
                     std::size_t saltLength,
                     const EVP_MD *md,
-                    util::SecureVector<util::ui8> &prk) {
-                util::ui32 length;
-                if (HMAC (md,
+                    util::ui8 *prk) {
+                util::ui32 length = 0;
+                if (HMAC (OpenSSLInit::FetchMessageDigest (md),
                             salt,
                             (int)saltLength,
                             (const util::ui8 *)hmacKey,
                             (int)hmacKeyLength,
-                            prk.data (),
-                            &length) != 0) {
-                    prk.resize (length);
-                }
-                else {
+                            prk,
+                            &length) == 0) {
                     THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
                 }
+                return length;
             }
 
             void HKDF_Expand (
@@ -240,56 +442,49 @@ namespace thekogans {
                     const void *info,
                     std::size_t infoLength,
                     const EVP_MD *md,
-                    util::SecureVector<util::ui8> &key) {
-                HMACContext ctx;
+                    util::ui8 *key,
+                    std::size_t keyLength) {
+                // Reuse the per thread context (allocation) across calls.
+                static thread_local HMACContext ctx;
+                HMACContextReset reset (ctx);
                 if (HMAC_Init_ex (
                             &ctx,
                             (const util::ui8 *)prk,
                             (int)prkLength,
-                            md,
-                            OpenSSLInit::engine) == 1) {
-                    std::vector<util::ui8> digest (GetMDLength (md));
-                    std::size_t count = key.size () / digest.size ();
-                    if ((key.size () % digest.size ()) != 0) {
+                            OpenSSLInit::FetchMessageDigest (md),
+                            OpenSSLInit::GetEngine (EVP_MD_type (md))) == 1) {
+                    util::ui8 digest[EVP_MAX_MD_SIZE];
+                    std::size_t digestLength = GetMDLength (md);
+                    std::size_t count = keyLength / digestLength;
+                    if ((keyLength % digestLength) != 0) {
                         ++count;
                     }
                     for (std::size_t i = 1, offset = 0; i <= count; ++i) {
                         if (i > 1) {
                             if (HMAC_Init_ex (&ctx, 0, 0, 0, 0) != 1 ||
-                                    HMAC_Update (&ctx, digest.data (), digest.size ()) != 1) {
+                                    HMAC_Update (&ctx, digest, digestLength) != 1) {
+                                OPENSSL_cleanse (digest, sizeof (digest));
                                 THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
                             }
                         }
                         const util::ui8 counter = (util::ui8)i;
                         if (HMAC_Update (&ctx, (const util::ui8 *)info, infoLength) == 1 &&
                                 HMAC_Update (&ctx, &counter, 1) == 1 &&
-                                HMAC_Final (&ctx, digest.data (), 0) == 1) {
-                            std::size_t length = offset + digest.size () > key.size () ?
-                                key.size () - offset :
-                                offset;
-                            memcpy (&key[offset], digest.data (), length);
+                                HMAC_Final (&ctx, digest, 0) == 1) {
+                            std::size_t length = offset + digestLength > keyLength ?
+                                keyLength - offset :
+                                digestLength;
+                            memcpy (&key[offset], digest, length);
                             offset += length;
                         }
                         else {
+                            OPENSSL_cleanse (digest, sizeof (digest));
                             THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
                         }
                     }
+                    OPENSSL_cleanse (digest, sizeof (digest));
                 }
             }
-
-            void HKDF (
-                    const void *hmacKey,
-                    std::size_t hmacKeyLength,
-                    const void *salt,
-                    std::size_t saltLength,
-                    const void *info,
-                    std::size_t infoLength,
-                    const EVP_MD *md,
-                    util::SecureVector<util::ui8> &key) {
-                util::SecureVector<util::ui8> prk (EVP_MAX_MD_SIZE);
-                HKDF_Extract (hmacKey, hmacKeyLength, salt, saltLength, md, prk);
-                HKDF_Expand (prk.data (), prk.size (), info, infoLength, md, key);
-            }
         }
 
         SymmetricKey::SharedPtr SymmetricKey::FromHKDF (
@@ -305,20 +500,35 @@ namespace thekogans {
                 const ID &id,
                 const std::string &name,
                 const std::string &description) {
+            THEKOGANS_CRYPTO_TRACE_SCOPE (OPERATION_KDF, id, 0, keyLength);
+            Stats::Scope statsScope (GetKDFStats (KDF_HKDF), keyLength);
             if (hmacKey != 0 && hmacKeyLength > 0 && keyLength > 0 && md != 0) {
-                util::SecureVector<util::ui8> key (keyLength);
+                SharedPtr symmetricKey (new SymmetricKey (0, 0, id, name, description));
                 switch (mode) {
                     case HKDF_MODE_EXTRACT_AND_EXPAND:
                         if (salt != 0 && saltLength > 0 && info != 0 && infoLength > 0) {
-                            HKDF (
-                                hmacKey,
-                                hmacKeyLength,
-                                salt,
-                                saltLength,
-                                info,
-                                infoLength,
-                                md,
-                                key);
+                            util::ui8 prk[EVP_MAX_MD_SIZE];
+                            THEKOGANS_UTIL_TRY {
+                                HKDF_Expand (
+                                    prk,
+                                    HKDF_Extract (
+                                        hmacKey,
+                                        hmacKeyLength,
+                                        salt,
+                                        saltLength,
+                                        md,
+                                        prk),
+                                    info,
+                                    infoLength,
+                                    md,
+                                    symmetricKey->Resize (keyLength),
+                                    keyLength);
+                            }
+                            THEKOGANS_UTIL_CATCH (util::Exception) {
+                                OPENSSL_cleanse (prk, sizeof (prk));
+                                THEKOGANS_UTIL_RETHROW_EXCEPTION (exception);
+                            }
+                            OPENSSL_cleanse (prk, sizeof (prk));
                         }
                         else {
                             THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
@@ -327,13 +537,15 @@ namespace thekogans {
                         break;
                     case HKDF_MODE_EXTRACT_ONLY:
                         if (salt != 0 && saltLength > 0) {
+                            // The prk is the key (and is GetMDLength (md) bytes long).
+                            symmetricKey->Resize (GetMDLength (md));
                             HKDF_Extract (
                                 hmacKey,
                                 hmacKeyLength,
                                 salt,
                                 saltLength,
                                 md,
-                                key);
+                                symmetricKey->key.GetDataPtr ());
                         }
                         else {
                             THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
@@ -348,7 +560,8 @@ namespace thekogans {
                                 info,
                                 infoLength,
                                 md,
-                                key);
+                                symmetricKey->Resize (keyLength),
+                                keyLength);
                         }
                         else {
                             THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
@@ -356,7 +569,34 @@ namespace thekogans {
                         }
                         break;
                 }
-                return SharedPtr (new SymmetricKey (key.data (), key.size (), id, name, description));
+                return symmetricKey;
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        SymmetricKey::SharedPtr SymmetricKey::FromBlake3 (
+                const std::string &context,
+                const void *keyMaterial,
+                std::size_t keyMaterialLength,
+                std::size_t keyLength,
+                const ID &id,
+                const std::string &name,
+                const std::string &description) {
+            THEKOGANS_CRYPTO_TRACE_SCOPE (OPERATION_KDF, id, 0, keyLength);
+            Stats::Scope statsScope (GetKDFStats (KDF_BLAKE3), keyLength);
+            if (!context.empty () && keyMaterial != 0 && keyMaterialLength > 0 && keyLength > 0) {
+                SharedPtr symmetricKey (new SymmetricKey (0, 0, id, name, description));
+                Blake3::DeriveKey (
+                    context.data (),
+                    context.size (),
+                    keyMaterial,
+                    keyMaterialLength,
+                    symmetricKey->Resize (keyLength),
+                    keyLength);
+                return symmetricKey;
             }
             else {
                 THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
@@ -375,33 +615,42 @@ namespace thekogans {
                 const ID &id,
                 const std::string &name,
                 const std::string &description) {
+            THEKOGANS_CRYPTO_TRACE_SCOPE (OPERATION_KDF, id, 0, keyLength);
+            Stats::Scope statsScope (GetKDFStats (KDF_SECRET_AND_SALT), keyLength);
             if (secret != 0 && secretLength > 0 &&
                     keyLength > 0 && md != 0 && count > 0) {
-                util::SecureVector<util::ui8> key (keyLength);
-                keyLength = 0;
-                util::SecureVector<util::ui8> buffer (EVP_MAX_MD_SIZE);
+                SharedPtr symmetricKey (new SymmetricKey (0, 0, id, name, description));
+                util::ui8 *key = symmetricKey->Resize (keyLength);
+                util::ui8 buffer[EVP_MAX_MD_SIZE];
                 std::size_t bufferLength = 0;
-                MessageDigest messageDigest (md);
-                while (keyLength < key.size ()) {
-                    messageDigest.Init ();
-                    if (bufferLength > 0) {
-                        messageDigest.Update (buffer.data (), bufferLength);
-                    }
-                    messageDigest.Update (secret, secretLength);
-                    if (salt != 0 && saltLength > 0) {
-                        messageDigest.Update (salt, saltLength);
-                    }
-                    bufferLength = messageDigest.Final (buffer.data ());
-                    for (std::size_t i = 1; i < count; ++i) {
+                THEKOGANS_UTIL_TRY {
+                    MessageDigest messageDigest (md);
+                    for (std::size_t offset = 0; offset < keyLength;) {
                         messageDigest.Init ();
-                        messageDigest.Update (buffer.data (), bufferLength);
-                        bufferLength = messageDigest.Final (buffer.data ());
+                        if (bufferLength > 0) {
+                            messageDigest.Update (buffer, bufferLength);
+                        }
+                        messageDigest.Update (secret, secretLength);
+                        if (salt != 0 && saltLength > 0) {
+                            messageDigest.Update (salt, saltLength);
+                        }
+                        bufferLength = messageDigest.Final (buffer);
+                        for (std::size_t i = 1; i < count; ++i) {
+                            messageDigest.Init ();
+                            messageDigest.Update (buffer, bufferLength);
+                            bufferLength = messageDigest.Final (buffer);
+                        }
+                        std::size_t length = std::min (keyLength - offset, bufferLength);
+                        memcpy (&key[offset], buffer, length);
+                        offset += length;
                     }
-                    std::size_t count = std::min (key.size () - keyLength, bufferLength);
-                    memcpy (&key[keyLength], buffer.data (), count);
-                    keyLength += count;
                 }
-                return SharedPtr (new SymmetricKey (key.data (), key.size (), id, name, description));
+                THEKOGANS_UTIL_CATCH (util::Exception) {
+                    OPENSSL_cleanse (buffer, sizeof (buffer));
+                    THEKOGANS_UTIL_RETHROW_EXCEPTION (exception);
+                }
+                OPENSSL_cleanse (buffer, sizeof (buffer));
+                return symmetricKey;
             }
             else {
                 THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
@@ -422,32 +671,49 @@ namespace thekogans {
             if (randomLength < MIN_RANDOM_LENGTH) {
                 randomLength = MIN_RANDOM_LENGTH;
             }
-            util::SecureVector<util::ui8> random (randomLength);
-            if (util::GlobalRandomSource::Instance ().GetBytes (
-                    random.data (), randomLength) == randomLength) {
-                return FromSecretAndSalt (
-                    random.data (),
-                    randomLength,
-                    salt,
-                    saltLength,
-                    keyLength,
-                    md,
-                    count,
-                    id,
-                    name,
-                    description);
+            // The common (MIN_RANDOM_LENGTH) case is kept off the heap.
+            util::ui8 stackRandom[MIN_RANDOM_LENGTH];
+            util::SecureVector<util::ui8> heapRandom;
+            util::ui8 *random = stackRandom;
+            if (randomLength > MIN_RANDOM_LENGTH) {
+                heapRandom.resize (randomLength);
+                random = heapRandom.data ();
             }
-            else {
-                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
-                    "Unable to get " THEKOGANS_UTIL_SIZE_T_FORMAT " random bytes for key.",
-                    randomLength);
+            SharedPtr symmetricKey;
+            THEKOGANS_UTIL_TRY {
+                if (BufferedRandomSource::GetThreadInstance ().GetBytes (
+                        random, randomLength) == randomLength) {
+                    symmetricKey = FromSecretAndSalt (
+                        random,
+                        randomLength,
+                        salt,
+                        saltLength,
+                        keyLength,
+                        md,
+                        count,
+                        id,
+                        name,
+                        description);
+                }
+                else {
+                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                        "Unable to get " THEKOGANS_UTIL_SIZE_T_FORMAT " random bytes for key.",
+                        randomLength);
+                }
+            }
+            THEKOGANS_UTIL_CATCH (util::Exception) {
+                OPENSSL_cleanse (stackRandom, sizeof (stackRandom));
+                THEKOGANS_UTIL_RETHROW_EXCEPTION (exception);
             }
+            OPENSSL_cleanse (stackRandom, sizeof (stackRandom));
+            return symmetricKey;
         }
 
         void SymmetricKey::Set (
                 const void *buffer,
                 std::size_t length) {
             if (buffer != 0 && length <= key.GetLength ()) {
+                ClearSchedule ();
                 key.Rewind ();
                 if (key.Write (buffer, length) == length) {
                     if (length < key.GetLength ()) {
@@ -465,6 +731,108 @@ namespace thekogans {
             }
         }
 
+        util::ui8 *SymmetricKey::Resize (std::size_t length) {
+            if (length <= key.GetLength ()) {
+                ClearSchedule ();
+                key.Rewind ();
+                memset (key.GetDataPtr (), 0, key.GetLength ());
+                key.AdvanceWriteOffset (length);
+                return key.GetDataPtr ();
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        void SymmetricKey::GetNextCounterIV (
+                util::ui8 *iv,
+                std::size_t ivLength) const {
+            if (iv != 0 && ivLength > util::UI64_SIZE && ivLength <= EVP_MAX_IV_LENGTH) {
+                std::size_t saltLength = ivLength - util::UI64_SIZE;
+                util::ui64 counter;
+                {
+                    util::LockGuard<util::SpinLock> guard (ivLock);
+                    // RFC 5116 (3.2): salt || counter. Refuse to wrap,
+                    // as that would reuse an iv with the same key.
+                    if (ivCounterExhausted) {
+                        THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                            "%s", "IV counter exhausted, rekey.");
+                    }
+                    // Don't mix counter and ordered channel ivs under one key.
+                    if (!orderedChannelSalts.empty ()) {
+                        THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                            "Key %s is used by an ordered channel.",
+                            GetId ().ToHexString ().c_str ());
+                    }
+                    if (!ivSaltValid) {
+                        if (BufferedRandomSource::GetThreadInstance ().GetBytes (
+                                ivSalt, EVP_MAX_IV_LENGTH) != EVP_MAX_IV_LENGTH) {
+                            THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                                "Unable to get %u random bytes for iv salt.",
+                                EVP_MAX_IV_LENGTH);
+                        }
+                        ivSaltValid = true;
+                    }
+                    memcpy (iv, ivSalt, saltLength);
+                    counter = ivCounter;
+                    if (++ivCounter == 0) {
+                        ivCounterExhausted = true;
+                    }
+                }
+                for (std::size_t i = ivLength; i-- > saltLength;) {
+                    iv[i] = (util::ui8)counter;
+                    counter >>= 8;
+                }
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        util::ui64 SymmetricKey::GetIVCounter () const {
+            util::LockGuard<util::SpinLock> guard (ivLock);
+            return ivCounter;
+        }
+
+        bool SymmetricKey::ClaimOrderedChannelSalt (
+                const void *salt,
+                std::size_t saltLength) const {
+            if (salt != 0 && saltLength > 0) {
+                const util::ui8 *salt_ = (const util::ui8 *)salt;
+                std::vector<util::ui8> claim (salt_, salt_ + saltLength);
+                util::LockGuard<util::SpinLock> guard (ivLock);
+                if (ivCounter > 0 || ivCounterExhausted) {
+                    return false;
+                }
+                for (std::size_t i = 0, count = orderedChannelSalts.size (); i < count; ++i) {
+                    if (orderedChannelSalts[i] == claim) {
+                        return false;
+                    }
+                }
+                orderedChannelSalts.push_back (claim);
+                return true;
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        void SymmetricKey::ClearSchedule () {
+            {
+                util::LockGuard<util::SpinLock> guard (scheduleLock);
+                schedule.Reset ();
+            }
+            util::LockGuard<util::SpinLock> guard (ivLock);
+            SecureZero (ivSalt, EVP_MAX_IV_LENGTH);
+            ivSaltValid = false;
+            ivCounter = 0;
+            ivCounterExhausted = false;
+            orderedChannelSalts.clear ();
+        }
+
         std::size_t SymmetricKey::Size () const {
             return
                 Serializable::Size () +
@@ -479,6 +847,7 @@ namespace thekogans {
             util::SizeT length;
             serializer >> length;
             if (length > 0 && length <= key.GetLength ()) {
+                ClearSchedule ();
                 key.Rewind ();
                 if (key.AdvanceWriteOffset (
                         serializer.Read (key.GetWritePtr (), length)) == length) {
@@ -516,9 +885,10 @@ namespace thekogans {
             util::SecureString hexKey = node.attribute (ATTR_KEY).value ();
             std::size_t length = hexKey.size () / 2;
             if (length > 0 && length <= key.GetLength ()) {
+                ClearSchedule ();
                 key.Rewind ();
                 if (key.AdvanceWriteOffset (
-                        util::HexDecodeBuffer (hexKey.data (), hexKey.size (), key.GetWritePtr ())) == length) {
+                        HexDecode (hexKey.data (), hexKey.size (), key.GetWritePtr ())) == length) {
                     memset (key.GetWritePtr (), 0, key.GetDataAvailableForWriting ());
                 }
                 else {
@@ -535,7 +905,7 @@ namespace thekogans {
         void SymmetricKey::Write (pugi::xml_node &node) const {
             Serializable::Write (node);
             node.append_attribute (ATTR_KEY).set_value (
-                util::HexEncodeBuffer (
+                HexEncode (
                     key.GetReadPtr (),
                     key.GetDataAvailableForReading ()).c_str ());
         }
@@ -547,9 +917,10 @@ namespace thekogans {
             util::SecureString hexKey = object.Get<util::JSON::String> (ATTR_KEY)->value.c_str ();
             std::size_t length = hexKey.size () / 2;
             if (length > 0 && length <= key.GetLength ()) {
+                ClearSchedule ();
                 key.Rewind ();
                 if (key.AdvanceWriteOffset (
-                        util::HexDecodeBuffer (
+                        HexDecode (
                             hexKey.data (),
                             hexKey.size (),
                             key.GetWritePtr ())) == length) {
@@ -570,7 +941,7 @@ namespace thekogans {
             Serializable::Write (object);
             object.Add<const std::string &> (
                 ATTR_KEY,
-                util::HexEncodeBuffer (
+                HexEncode (
                     key.GetReadPtr (),
                     key.GetDataAvailableForReading ()));
         }
@@ -31,16 +31,32 @@
     #include <CoreFoundation/CoreFoundation.h>
     #include <Security/Security.h>
 #endif // defined (TOOLCHAIN_OS_Windows)
+#include <sys/stat.h>
+#if !defined (TOOLCHAIN_OS_Windows)
+    #include <unistd.h>
+#endif // !defined (TOOLCHAIN_OS_Windows)
+#include <cstdlib>
+#include <cstring>
 #include <memory>
 #include <string>
+#include <vector>
+#include <utility>
 #include <openssl/ssl.h>
+#include <openssl/x509.h>
 #include "thekogans/util/Array.h"
+#include "thekogans/util/Buffer.h"
+#include "thekogans/util/File.h"
+#include "thekogans/util/Thread.h"
+#include "thekogans/util/StringUtils.h"
+#include "thekogans/util/LoggerMgr.h"
 #include "thekogans/util/Exception.h"
 #if defined (TOOLCHAIN_OS_Windows)
     #include "thekogans/util/WindowsUtils.h"
 #endif // defined (TOOLCHAIN_OS_Windows)
 #include "thekogans/crypto/OpenSSLUtils.h"
 #include "thekogans/crypto/OpenSSLException.h"
+#include "thekogans/crypto/MessageDigest.h"
+#include "thekogans/crypto/FileReader.h"
 #include "thekogans/crypto/SystemCACertificates.h"
 
 namespace thekogans {
@@ -142,191 +158,507 @@ namespace thekogans {
         #endif // defined (TOOLCHAIN_OS_OSX)
         }
 
-        void SystemCACertificates::Load (bool loadSystemRootCACertificatesOnly) {
-            util::LockGuard<util::SpinLock> guard (spinLock);
-            certificates.clear ();
-        #if defined (TOOLCHAIN_OS_Windows)
-            struct SystemStore {
-                HCERTSTORE certStore;
-                explicit SystemStore (const wchar_t *storeName) :
-                        certStore (CertOpenSystemStoreW (0, storeName)) {
-                    if (certStore == 0) {
-                        THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
-                            THEKOGANS_UTIL_OS_ERROR_CODE);
+        namespace {
+            void LoadSystemCertificates (
+                    bool loadSystemRootCACertificatesOnly,
+                    std::list<X509Ptr> &certificates) {
+            #if defined (TOOLCHAIN_OS_Windows)
+                struct SystemStore {
+                    HCERTSTORE certStore;
+                    explicit SystemStore (const wchar_t *storeName) :
+                            certStore (CertOpenSystemStoreW (0, storeName)) {
+                        if (certStore == 0) {
+                            THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                                THEKOGANS_UTIL_OS_ERROR_CODE);
+                        }
                     }
-                }
-                ~SystemStore () {
-                    CertCloseStore (certStore, 0);
-                }
-            };
-            SystemStore rootStore (L"ROOT");
-            SystemStore caStore (L"CA");
-            SystemStore myStore (L"MY");
-            SystemStore *stores[] = {
-                &rootStore,
-                &caStore,
-                &myStore
-            };
-            for (int i = 0, numStores = THEKOGANS_UTIL_ARRAY_SIZE (stores); i < numStores; ++i) {
-                PCCERT_CONTEXT certContext = 0;
-                while ((certContext = CertEnumCertificatesInStore (stores[i]->certStore, certContext)) != 0) {
-                    // Skip expired certificates.
-                    if (CertVerifyTimeValidity (0, certContext->pCertInfo) == 0) {
-                        if (loadSystemRootCACertificatesOnly) {
-                            // We only want to add Root CAs, so make
-                            // sure Subject and Issuer names match.
-                            std::string subject =
-                                GetCertName (
-                                    certContext->dwCertEncodingType,
-                                    &certContext->pCertInfo->Subject);
-                            std::string issuer =
-                                GetCertName (
-                                    certContext->dwCertEncodingType,
-                                    &certContext->pCertInfo->Issuer);
-                            if (subject.empty () || issuer.empty () || subject != issuer) {
-                                continue;
+                    ~SystemStore () {
+                        CertCloseStore (certStore, 0);
+                    }
+                };
+                SystemStore rootStore (L"ROOT");
+                SystemStore caStore (L"CA");
+                SystemStore myStore (L"MY");
+                SystemStore *stores[] = {
+                    &rootStore,
+                    &caStore,
+                    &myStore
+                };
+                for (int i = 0, numStores = THEKOGANS_UTIL_ARRAY_SIZE (stores); i < numStores; ++i) {
+                    PCCERT_CONTEXT certContext = 0;
+                    while ((certContext = CertEnumCertificatesInStore (stores[i]->certStore, certContext)) != 0) {
+                        // Skip expired certificates.
+                        if (CertVerifyTimeValidity (0, certContext->pCertInfo) == 0) {
+                            if (loadSystemRootCACertificatesOnly) {
+                                // We only want to add Root CAs, so make
+                                // sure Subject and Issuer names match.
+                                std::string subject =
+                                    GetCertName (
+                                        certContext->dwCertEncodingType,
+                                        &certContext->pCertInfo->Subject);
+                                std::string issuer =
+                                    GetCertName (
+                                        certContext->dwCertEncodingType,
+                                        &certContext->pCertInfo->Issuer);
+                                if (subject.empty () || issuer.empty () || subject != issuer) {
+                                    continue;
+                                }
+                            }
+                            X509Ptr certificate =
+                                ParseCertificate (
+                                    certContext->pbCertEncoded,
+                                    certContext->cbCertEncoded,
+                                    encodingTostring (certContext->dwCertEncodingType));
+                            if (certificate.get () != 0) {
+                                certificates.push_back (std::move (certificate));
+                            }
+                            else {
+                                THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
                             }
-                        }
-                        X509Ptr certificate =
-                            ParseCertificate (
-                                certContext->pbCertEncoded,
-                                certContext->cbCertEncoded,
-                                encodingTostring (certContext->dwCertEncodingType));
-                        if (certificate.get () != 0) {
-                            certificates.push_back (std::move (certificate));
-                        }
-                        else {
-                            THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
                         }
                     }
                 }
-            }
-       #elif defined (TOOLCHAIN_OS_Linux)
-            // FIXME: implement
-            assert (0);
-       #elif defined (TOOLCHAIN_OS_OSX)
-            // This code was adapted from: https://github.com/raggi/openssl-osx-ca
-            // Get certificates from all domains, not just System, this lets
-            // the user add CAs to their "login" keychain, and Admins to add
-            // to the "System" keychain
-            SecTrustSettingsDomain domains[] = {
-                kSecTrustSettingsDomainSystem,
-                kSecTrustSettingsDomainAdmin,
-                kSecTrustSettingsDomainUser
-            };
-            CFStringRef x509OID[] = {
-                kSecOIDX509V1ValidityNotBefore,
-                kSecOIDX509V1ValidityNotAfter,
-                kSecOIDX509V1SubjectName,
-                kSecOIDX509V1IssuerName
-            };
-            CFArrayRefPtr x509Keys (
-                CFArrayCreate (0,
-                    (const void **)x509OID,
-                    THEKOGANS_UTIL_ARRAY_SIZE (x509OID),
-                    &kCFTypeArrayCallBacks));
-            for (util::i32 i = 0, numDomains = THEKOGANS_UTIL_ARRAY_SIZE (domains); i < numDomains; ++i) {
-                CFArrayRef certs = 0;
-                OSStatus errorCode = SecTrustSettingsCopyCertificates (domains[i], &certs);
-                if (certs != 0) {
-                    CFArrayRefPtr certsPtr (certs);
-                    for (util::i32 j = 0, numCerts = (util::i32)CFArrayGetCount (certs); j < numCerts; ++j) {
-                        SecCertificateRef cert = (SecCertificateRef)CFArrayGetValueAtIndex (certs, j);
-                        if (cert != 0) {
-                            CFErrorRef error = 0;
-                            CFDictionaryRefPtr names (
-                                SecCertificateCopyValues (cert, x509Keys.get (), &error));
-                            if (names != 0) {
-                                // Check if the certificate expired.
-                                CFNumberRef notBefore =
-                                    (CFNumberRef)CFDictionaryGetValue (
-                                        (CFDictionaryRef)CFDictionaryGetValue (
-                                            names.get (),
-                                            kSecOIDX509V1ValidityNotBefore),
-                                        kSecPropertyKeyValue);
-                                CFNumberRef notAfter =
-                                    (CFNumberRef)CFDictionaryGetValue (
-                                        (CFDictionaryRef)CFDictionaryGetValue (
-                                            names.get (),
-                                            kSecOIDX509V1ValidityNotAfter),
-                                        kSecPropertyKeyValue);
-                                if (notBefore != 0 && notAfter != 0 && CheckDateRange (notBefore, notAfter)) {
-                                    if (loadSystemRootCACertificatesOnly) {
-                                        // We only want to add Root CAs, so make
-                                        // sure Subject and Issuer names match.
-                                        CFStringRef issuer =
-                                            (CFStringRef)CFDictionaryGetValue (
-                                                (CFDictionaryRef)CFDictionaryGetValue (
-                                                    names.get (),
-                                                    kSecOIDX509V1IssuerName),
-                                                kSecPropertyKeyValue);
-                                        CFStringRef subject =
-                                            (CFStringRef)CFDictionaryGetValue(
-                                                (CFDictionaryRef)CFDictionaryGetValue (
-                                                    names.get (),
-                                                    kSecOIDX509V1SubjectName),
-                                                kSecPropertyKeyValue);
-                                        if (issuer == 0 || subject == 0 || !CFEqual (subject, issuer)) {
-                                            continue;
+            #elif defined (TOOLCHAIN_OS_Linux)
+                // FIXME: implement
+                assert (0);
+            #elif defined (TOOLCHAIN_OS_OSX)
+                // This code was adapted from: https://github.com/raggi/openssl-osx-ca
+                // Get certificates from all domains, not just System, this lets
+                // the user add CAs to their "login" keychain, and Admins to add
+                // to the "System" keychain
+                SecTrustSettingsDomain domains[] = {
+                    kSecTrustSettingsDomainSystem,
+                    kSecTrustSettingsDomainAdmin,
+                    kSecTrustSettingsDomainUser
+                };
+                CFStringRef x509OID[] = {
+                    kSecOIDX509V1ValidityNotBefore,
+                    kSecOIDX509V1ValidityNotAfter,
+                    kSecOIDX509V1SubjectName,
+                    kSecOIDX509V1IssuerName
+                };
+                CFArrayRefPtr x509Keys (
+                    CFArrayCreate (0,
+                        (const void **)x509OID,
+                        THEKOGANS_UTIL_ARRAY_SIZE (x509OID),
+                        &kCFTypeArrayCallBacks));
+                for (util::i32 i = 0, numDomains = THEKOGANS_UTIL_ARRAY_SIZE (domains); i < numDomains; ++i) {
+                    CFArrayRef certs = 0;
+                    OSStatus errorCode = SecTrustSettingsCopyCertificates (domains[i], &certs);
+                    if (certs != 0) {
+                        CFArrayRefPtr certsPtr (certs);
+                        for (util::i32 j = 0, numCerts = (util::i32)CFArrayGetCount (certs); j < numCerts; ++j) {
+                            SecCertificateRef cert = (SecCertificateRef)CFArrayGetValueAtIndex (certs, j);
+                            if (cert != 0) {
+                                CFErrorRef error = 0;
+                                CFDictionaryRefPtr names (
+                                    SecCertificateCopyValues (cert, x509Keys.get (), &error));
+                                if (names != 0) {
+                                    // Check if the certificate expired.
+                                    CFNumberRef notBefore =
+                                        (CFNumberRef)CFDictionaryGetValue (
+                                            (CFDictionaryRef)CFDictionaryGetValue (
+                                                names.get (),
+                                                kSecOIDX509V1ValidityNotBefore),
+                                            kSecPropertyKeyValue);
+                                    CFNumberRef notAfter =
+                                        (CFNumberRef)CFDictionaryGetValue (
+                                            (CFDictionaryRef)CFDictionaryGetValue (
+                                                names.get (),
+                                                kSecOIDX509V1ValidityNotAfter),
+                                            kSecPropertyKeyValue);
+                                    if (notBefore != 0 && notAfter != 0 && CheckDateRange (notBefore, notAfter)) {
+                                        if (loadSystemRootCACertificatesOnly) {
+                                            // We only want to add Root CAs, so make
+                                            // sure Subject and Issuer names match.
+                                            CFStringRef issuer =
+                                                (CFStringRef)CFDictionaryGetValue (
+                                                    (CFDictionaryRef)CFDictionaryGetValue (
+                                                        names.get (),
+                                                        kSecOIDX509V1IssuerName),
+                                                    kSecPropertyKeyValue);
+                                            CFStringRef subject =
+                                                (CFStringRef)CFDictionaryGetValue(
+                                                    (CFDictionaryRef)CFDictionaryGetValue (
+                                                        names.get (),
+                                                        kSecOIDX509V1SubjectName),
+                                                    kSecPropertyKeyValue);
+                                            if (issuer == 0 || subject == 0 || !CFEqual (subject, issuer)) {
+                                                continue;
+                                            }
                                         }
-                                    }
-                                    CFDataRef data = 0;
-                                    errorCode =
-                                        SecItemExport (cert, kSecFormatX509Cert, kSecItemPemArmour, 0, &data);
-                                    if (data != 0) {
-                                        CFDataRefPtr dataPtr (data);
-                                        // Apple certificates are PEM encoded.
-                                        X509Ptr certificate =
-                                            ParseCertificate (
-                                                CFDataGetBytePtr (data),
-                                                CFDataGetLength (data),
-                                                PEM_ENCODING);
-                                        if (certificate.get () != 0) {
-                                            certificates.push_back (std::move (certificate));
+                                        CFDataRef data = 0;
+                                        errorCode =
+                                            SecItemExport (cert, kSecFormatX509Cert, kSecItemPemArmour, 0, &data);
+                                        if (data != 0) {
+                                            CFDataRefPtr dataPtr (data);
+                                            // Apple certificates are PEM encoded.
+                                            X509Ptr certificate =
+                                                ParseCertificate (
+                                                    CFDataGetBytePtr (data),
+                                                    CFDataGetLength (data),
+                                                    PEM_ENCODING);
+                                            if (certificate.get () != 0) {
+                                                certificates.push_back (std::move (certificate));
+                                            }
+                                            else {
+                                                THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
+                                            }
                                         }
-                                        else {
-                                            THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
+                                        else if (errorCode != noErr) {
+                                            THEKOGANS_UTIL_THROW_OSSTATUS_ERROR_CODE_EXCEPTION (errorCode);
                                         }
                                     }
-                                    else if (errorCode != noErr) {
-                                        THEKOGANS_UTIL_THROW_OSSTATUS_ERROR_CODE_EXCEPTION (errorCode);
-                                    }
                                 }
-                            }
-                            else if (error != 0) {
-                                CFErrorRefPtr errorPtr (error);
-                                THEKOGANS_UTIL_THROW_CFERRORREF_EXCEPTION (error);
+                                else if (error != 0) {
+                                    CFErrorRefPtr errorPtr (error);
+                                    THEKOGANS_UTIL_THROW_CFERRORREF_EXCEPTION (error);
+                                }
                             }
                         }
                     }
                 }
+            #endif // defined (TOOLCHAIN_OS_Windows)
             }
-        #endif // defined (TOOLCHAIN_OS_Windows)
-        }
 
-        void SystemCACertificates::Use (SSL_CTX *ctx) {
-            if (ctx != 0) {
-                util::LockGuard<util::SpinLock> guard (spinLock);
-                X509_STOREPtr newStore;
-                X509_STORE *store = SSL_CTX_get_cert_store (ctx);
-                if (store == 0) {
-                    newStore.reset (X509_STORE_new ());
-                    if (newStore.get () != 0) {
-                        store = newStore.get ();
+            X509_STOREPtr BuildStore (const std::list<X509Ptr> &certificates) {
+                X509_STOREPtr store (X509_STORE_new ());
+                if (store.get () == 0) {
+                    THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
+                }
+                for (std::list<X509Ptr>::const_iterator
+                        it = certificates.begin (),
+                        end = certificates.end (); it != end; ++it) {
+                    if (X509_STORE_add_cert (store.get (), (*it).get ()) != 1) {
+                        THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
+                    }
+                }
+                return store;
+            }
+
+            // Cache file layout (big endian):
+            // MAGIC, VERSION, fingerprint length, fingerprint,
+            // certificate count, (DER length, DER)...
+            const util::ui32 CACHE_MAGIC = 0x544b4341; // TKCA
+            const util::ui32 CACHE_VERSION = 1;
+
+            inline util::ui32 GetUI32 (const util::ui8 *ptr) {
+                return
+                    ((util::ui32)ptr[0] << 24) |
+                    ((util::ui32)ptr[1] << 16) |
+                    ((util::ui32)ptr[2] << 8) |
+                    (util::ui32)ptr[3];
+            }
+
+            // A cheap summary of the source stores (last write times and
+            // sizes), good enough to tell whether they changed since the
+            // cache was written without enumerating them.
+            std::string GetStoresFingerprint (bool loadSystemRootCACertificatesOnly) {
+                std::string summary = loadSystemRootCACertificatesOnly ? "roots" : "all";
+            #if defined (TOOLCHAIN_OS_Windows)
+                HKEY roots[] = {HKEY_LOCAL_MACHINE, HKEY_CURRENT_USER};
+                const wchar_t *stores[] = {
+                    L"SOFTWARE\\Microsoft\\SystemCertificates\\ROOT\\Certificates",
+                    L"SOFTWARE\\Microsoft\\SystemCertificates\\CA\\Certificates",
+                    L"SOFTWARE\\Microsoft\\SystemCertificates\\MY\\Certificates"
+                };
+                for (std::size_t i = 0; i < THEKOGANS_UTIL_ARRAY_SIZE (roots); ++i) {
+                    for (std::size_t j = 0; j < THEKOGANS_UTIL_ARRAY_SIZE (stores); ++j) {
+                        HKEY key = 0;
+                        if (RegOpenKeyExW (roots[i], stores[j], 0, KEY_READ, &key) == ERROR_SUCCESS) {
+                            DWORD subKeyCount = 0;
+                            FILETIME lastWriteTime = {0, 0};
+                            RegQueryInfoKeyW (key, 0, 0, 0, &subKeyCount,
+                                0, 0, 0, 0, 0, 0, &lastWriteTime);
+                            RegCloseKey (key);
+                            summary += util::FormatString (
+                                ";%u:%u:%u",
+                                subKeyCount,
+                                lastWriteTime.dwHighDateTime,
+                                lastWriteTime.dwLowDateTime);
+                        }
+                        else {
+                            summary += ";-";
+                        }
+                    }
+                }
+            #elif defined (TOOLCHAIN_OS_OSX)
+                std::string paths[] = {
+                    "/System/Library/Keychains/SystemRootCertificates.keychain",
+                    "/Library/Keychains/System.keychain",
+                    "/Library/Trust Settings/Admin.plist",
+                    getenv ("HOME") != 0 ?
+                        std::string (getenv ("HOME")) + "/Library/Keychains/login.keychain-db" :
+                        std::string ()
+                };
+                for (std::size_t i = 0; i < THEKOGANS_UTIL_ARRAY_SIZE (paths); ++i) {
+                    struct stat st;
+                    if (!paths[i].empty () && stat (paths[i].c_str (), &st) == 0) {
+                        summary += util::FormatString (
+                            ";%lld:%lld",
+                            (long long)st.st_mtime,
+                            (long long)st.st_size);
                     }
                     else {
-                        THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
+                        summary += ";-";
                     }
                 }
+            #endif // defined (TOOLCHAIN_OS_Windows)
+                util::ui8 digest[EVP_MAX_MD_SIZE];
+                MessageDigest messageDigest (EVP_sha256 ());
+                messageDigest.Update (summary.data (), summary.size ());
+                std::size_t digestLength = messageDigest.Final (digest);
+                return std::string ((const char *)digest, digestLength);
+            }
+
+            std::vector<std::string> EncodeCertificates (const std::list<X509Ptr> &certificates) {
+                std::vector<std::string> encoded;
+                encoded.reserve (certificates.size ());
                 for (std::list<X509Ptr>::const_iterator
                         it = certificates.begin (),
                         end = certificates.end (); it != end; ++it) {
-                    if (X509_STORE_add_cert (store, (*it).get ()) != 1) {
+                    util::i32 length = i2d_X509 ((*it).get (), 0);
+                    if (length <= 0) {
                         THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
                     }
+                    std::string der ((std::size_t)length, '\0');
+                    util::ui8 *ptr = (util::ui8 *)&der[0];
+                    i2d_X509 ((*it).get (), &ptr);
+                    encoded.push_back (der);
                 }
-                if (newStore.get () != 0) {
-                    SSL_CTX_set_cert_store (ctx, newStore.release ());
+                return encoded;
+            }
+
+        #if !defined (TOOLCHAIN_OS_Windows)
+            // The cache is trusted like the stores it stands in for. Refuse
+            // one that anybody but us could have planted or edited.
+            bool IsCacheFileTrusted (const std::string &cacheFile) {
+                struct stat st;
+                return lstat (cacheFile.c_str (), &st) == 0 &&
+                    S_ISREG (st.st_mode) &&
+                    st.st_uid == geteuid () &&
+                    (st.st_mode & (S_IWGRP | S_IWOTH)) == 0;
+            }
+        #endif // !defined (TOOLCHAIN_OS_Windows)
+
+            // Return false if the cache is missing, untrusted, stale or corrupt.
+            bool LoadCache (
+                    const std::string &cacheFile,
+                    const std::string &fingerprint,
+                    std::list<X509Ptr> &certificates) {
+            #if !defined (TOOLCHAIN_OS_Windows)
+                if (!IsCacheFileTrusted (cacheFile)) {
+                    return false;
+                }
+            #endif // !defined (TOOLCHAIN_OS_Windows)
+                THEKOGANS_UTIL_TRY {
+                    FileReader reader (cacheFile, true);
+                    std::vector<util::ui8> buffer;
+                    const util::ui8 *data = 0;
+                    util::ui64 size = reader.GetSize ();
+                    if (size > (util::ui64)(std::size_t)-1) {
+                        return false;
+                    }
+                    if (reader.IsMapped ()) {
+                        reader.Next (data);
+                    }
+                    else {
+                        buffer.resize ((std::size_t)size);
+                        if (reader.Read (buffer.data (), buffer.size ()) != buffer.size ()) {
+                            return false;
+                        }
+                        data = buffer.data ();
+                    }
+                    const util::ui8 *end = data + size;
+                    if (size < 12 ||
+                            GetUI32 (data) != CACHE_MAGIC ||
+                            GetUI32 (data + 4) != CACHE_VERSION) {
+                        return false;
+                    }
+                    util::ui32 fingerprintLength = GetUI32 (data + 8);
+                    data += 12;
+                    if (fingerprintLength != fingerprint.size () ||
+                            (std::size_t)(end - data) < fingerprintLength + 4 ||
+                            memcmp (data, fingerprint.data (), fingerprintLength) != 0) {
+                        return false;
+                    }
+                    data += fingerprintLength;
+                    util::ui32 count = GetUI32 (data);
+                    data += 4;
+                    std::list<X509Ptr> cachedCertificates;
+                    for (util::ui32 i = 0; i < count; ++i) {
+                        if (end - data < 4) {
+                            return false;
+                        }
+                        util::ui32 length = GetUI32 (data);
+                        data += 4;
+                        if ((std::size_t)(end - data) < length) {
+                            return false;
+                        }
+                        X509Ptr certificate = ParseCertificate (data, length, DER_ENCODING);
+                        if (certificate.get () == 0) {
+                            return false;
+                        }
+                        // The stores skip expired (and not yet valid)
+                        // certificates, and so must the cache.
+                        if (X509_cmp_current_time (X509_get_notBefore (certificate.get ())) < 0 &&
+                                X509_cmp_current_time (X509_get_notAfter (certificate.get ())) > 0) {
+                            cachedCertificates.push_back (std::move (certificate));
+                        }
+                        data += length;
+                    }
+                    certificates.swap (cachedCertificates);
+                    return true;
+                }
+                THEKOGANS_UTIL_CATCH (util::Exception) {
+                    // A missing or unreadable cache is not an error.
+                    return false;
+                }
+            }
+
+            void SaveCache (
+                    const std::string &cacheFile,
+                    const std::string &fingerprint,
+                    const std::list<X509Ptr> &certificates) {
+                THEKOGANS_UTIL_TRY {
+                    std::vector<std::string> encoded = EncodeCertificates (certificates);
+                    std::size_t size = 16 + fingerprint.size ();
+                    for (std::size_t i = 0, count = encoded.size (); i < count; ++i) {
+                        size += 4 + encoded[i].size ();
+                    }
+                    util::Buffer buffer (util::NetworkEndian, size);
+                    buffer << CACHE_MAGIC << CACHE_VERSION << (util::ui32)fingerprint.size ();
+                    buffer.Write (fingerprint.data (), fingerprint.size ());
+                    buffer << (util::ui32)encoded.size ();
+                    for (std::size_t i = 0, count = encoded.size (); i < count; ++i) {
+                        buffer << (util::ui32)encoded[i].size ();
+                        buffer.Write (encoded[i].data (), encoded[i].size ());
+                    }
+                    util::SimpleFile file (
+                        util::NetworkEndian,
+                        cacheFile,
+                        util::SimpleFile::ReadWrite |
+                        util::SimpleFile::Create |
+                        util::SimpleFile::Truncate);
+                #if !defined (TOOLCHAIN_OS_Windows)
+                    // LoadCache refuses group or world writable caches.
+                    chmod (cacheFile.c_str (), S_IRUSR | S_IWUSR);
+                #endif // !defined (TOOLCHAIN_OS_Windows)
+                    file.Write (buffer.GetReadPtr (), buffer.GetDataAvailableForReading ());
+                }
+                THEKOGANS_UTIL_CATCH (util::Exception) {
+                    // Failing to write the cache only costs the next startup.
+                    THEKOGANS_UTIL_LOG_WARNING (
+                        "Unable to write %s: %s\n",
+                        cacheFile.c_str (),
+                        exception.Report ().c_str ());
+                }
+            }
+        }
+
+        struct SystemCACertificates::RefreshThread : public util::Thread {
+            SystemCACertificates &systemCACertificates;
+
+            explicit RefreshThread (SystemCACertificates &systemCACertificates_) :
+                systemCACertificates (systemCACertificates_) {}
+
+        protected:
+            // util::Thread
+            virtual void Run () throw () override {
+                THEKOGANS_UTIL_TRY {
+                    systemCACertificates.Refresh ();
+                }
+                THEKOGANS_UTIL_CATCH (util::Exception) {
+                    THEKOGANS_UTIL_LOG_ERROR ("%s\n", exception.Report ().c_str ());
+                }
+            }
+        };
+
+        SystemCACertificates::SystemCACertificates () :
+            rootCACertificatesOnly (true) {}
+
+        SystemCACertificates::~SystemCACertificates () {
+            if (refreshThread.get () != 0) {
+                refreshThread->Wait ();
+            }
+        }
+
+        void SystemCACertificates::Load (
+                bool loadSystemRootCACertificatesOnly,
+                const std::string &cacheFile,
+                bool refreshInBackground) {
+            // Wait for a previous background refresh.
+            if (refreshThread.get () != 0) {
+                refreshThread->Wait ();
+                refreshThread.reset ();
+            }
+            std::string fingerprint;
+            std::list<X509Ptr> newCertificates;
+            bool cached = false;
+            if (!cacheFile.empty ()) {
+                fingerprint = GetStoresFingerprint (loadSystemRootCACertificatesOnly);
+                cached = LoadCache (cacheFile, fingerprint, newCertificates);
+            }
+            if (!cached) {
+                LoadSystemCertificates (loadSystemRootCACertificatesOnly, newCertificates);
+                if (!cacheFile.empty ()) {
+                    SaveCache (cacheFile, fingerprint, newCertificates);
+                }
+            }
+            X509_STOREPtr newStore = BuildStore (newCertificates);
+            {
+                util::LockGuard<util::SpinLock> guard (spinLock);
+                rootCACertificatesOnly = loadSystemRootCACertificatesOnly;
+                cachePath = cacheFile;
+                certificates.swap (newCertificates);
+                store = std::move (newStore);
+            }
+            // The stores can change without the fingerprint noticing (it's
+            // cheap by design). Double check in the background.
+            if (cached && refreshInBackground) {
+                refreshThread.reset (new RefreshThread (*this));
+                refreshThread->Create ();
+            }
+        }
+
+        bool SystemCACertificates::Refresh () {
+            bool loadSystemRootCACertificatesOnly;
+            std::string cacheFile;
+            std::vector<std::string> current;
+            {
+                util::LockGuard<util::SpinLock> guard (spinLock);
+                loadSystemRootCACertificatesOnly = rootCACertificatesOnly;
+                cacheFile = cachePath;
+                current = EncodeCertificates (certificates);
+            }
+            std::list<X509Ptr> newCertificates;
+            LoadSystemCertificates (loadSystemRootCACertificatesOnly, newCertificates);
+            if (EncodeCertificates (newCertificates) == current) {
+                return false;
+            }
+            if (!cacheFile.empty ()) {
+                SaveCache (
+                    cacheFile,
+                    GetStoresFingerprint (loadSystemRootCACertificatesOnly),
+                    newCertificates);
+            }
+            X509_STOREPtr newStore = BuildStore (newCertificates);
+            util::LockGuard<util::SpinLock> guard (spinLock);
+            certificates.swap (newCertificates);
+            store = std::move (newStore);
+            return true;
+        }
+
+        void SystemCACertificates::Use (SSL_CTX *ctx) {
+            if (ctx != 0) {
+                util::LockGuard<util::SpinLock> guard (spinLock);
+                if (store.get () != 0) {
+                #if OPENSSL_VERSION_NUMBER < 0x10100000L
+                    CRYPTO_add (&store->references, 1, CRYPTO_LOCK_X509_STORE);
+                    SSL_CTX_set_cert_store (ctx, store.get ());
+                #else // OPENSSL_VERSION_NUMBER < 0x10100000L
+                    SSL_CTX_set1_cert_store (ctx, store.get ());
+                #endif // OPENSSL_VERSION_NUMBER < 0x10100000L
                 }
             }
             else {
@@ -338,6 +670,8 @@ namespace thekogans {
         void SystemCACertificates::Flush () {
             util::LockGuard<util::SpinLock> guard (spinLock);
             certificates.clear ();
+            // Contexts that share the store keep their reference.
+            store.reset ();
         }
 
     } // namespace crypto
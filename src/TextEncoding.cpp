@@ -0,0 +1,522 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#include <cstring>
+#if defined (__x86_64__) || defined (_M_X64) || defined (__SSE2__) || \
+        (defined (_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define THEKOGANS_CRYPTO_TEXT_ENCODING_SSE2
+    #include <emmintrin.h>
+#elif defined (__ARM_NEON) || defined (__ARM_NEON__) || defined (_M_ARM64)
+    #define THEKOGANS_CRYPTO_TEXT_ENCODING_NEON
+    #include <arm_neon.h>
+#endif // defined (__x86_64__) || defined (_M_X64) || defined (__SSE2__) || ...
+#include "thekogans/util/Exception.h"
+#if defined (__x86_64__) || defined (_M_X64) || defined (__i386__) || defined (_M_IX86)
+    #define THEKOGANS_CRYPTO_TEXT_ENCODING_SSSE3
+    #include "thekogans/crypto/CPUFeatures.h"
+#endif // defined (__x86_64__) || defined (_M_X64) || defined (__i386__) || defined (_M_IX86)
+#include "thekogans/crypto/TextEncoding.h"
+
+namespace thekogans {
+    namespace crypto {
+
+    #if defined (THEKOGANS_CRYPTO_TEXT_ENCODING_SSSE3)
+        // Defined in TextEncodingSSSE3.cpp.
+        std::size_t Base64EncodeSSSE3 (
+            const util::ui8 *buffer,
+            std::size_t length,
+            char *base64);
+        std::size_t Base64DecodeSSSE3 (
+            const char *base64,
+            std::size_t length,
+            util::ui8 *buffer);
+    #endif // defined (THEKOGANS_CRYPTO_TEXT_ENCODING_SSSE3)
+
+        namespace {
+            const char HEX_DIGITS[] = "0123456789abcdef";
+            const char BASE64_ALPHABET[] =
+                "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+            const char BASE64_PAD = '=';
+            const util::ui8 INVALID_DIGIT = 0xff;
+
+            inline util::ui8 DecodeHexDigit (char digit) {
+                return
+                    digit >= '0' && digit <= '9' ? (util::ui8)(digit - '0') :
+                    digit >= 'a' && digit <= 'f' ? (util::ui8)(digit - 'a' + 10) :
+                    digit >= 'A' && digit <= 'F' ? (util::ui8)(digit - 'A' + 10) :
+                    INVALID_DIGIT;
+            }
+
+            inline util::ui8 DecodeBase64Digit (char digit) {
+                return
+                    digit >= 'A' && digit <= 'Z' ? (util::ui8)(digit - 'A') :
+                    digit >= 'a' && digit <= 'z' ? (util::ui8)(digit - 'a' + 26) :
+                    digit >= '0' && digit <= '9' ? (util::ui8)(digit - '0' + 52) :
+                    digit == '+' ? 62 :
+                    digit == '/' ? 63 :
+                    INVALID_DIGIT;
+            }
+
+            inline bool IsSpace (char ch) {
+                return ch == ' ' || ch == '\t' || ch == '\r' ||
+                    ch == '\n' || ch == '\v' || ch == '\f';
+            }
+
+        #if defined (THEKOGANS_CRYPTO_TEXT_ENCODING_SSE2)
+            // 16 nibbles -> 16 hex digits.
+            inline __m128i NibblesToHex (__m128i nibbles) {
+                return _mm_add_epi8 (
+                    _mm_add_epi8 (nibbles, _mm_set1_epi8 ('0')),
+                    _mm_and_si128 (
+                        _mm_cmpgt_epi8 (nibbles, _mm_set1_epi8 (9)),
+                        _mm_set1_epi8 ('a' - '0' - 10)));
+            }
+
+            inline __m128i InRange (
+                    __m128i ascii,
+                    char first,
+                    char last) {
+                return _mm_and_si128 (
+                    _mm_cmpgt_epi8 (ascii, _mm_set1_epi8 (first - 1)),
+                    _mm_cmpgt_epi8 (_mm_set1_epi8 (last + 1), ascii));
+            }
+
+            // 16 hex digits -> 16 nibbles (valid has 0xff for every good digit).
+            inline __m128i HexToNibbles (
+                    __m128i hex,
+                    __m128i &valid) {
+                __m128i lower = _mm_or_si128 (hex, _mm_set1_epi8 (0x20));
+                __m128i digit = InRange (hex, '0', '9');
+                __m128i alpha = InRange (lower, 'a', 'f');
+                valid = _mm_or_si128 (digit, alpha);
+                return _mm_or_si128 (
+                    _mm_and_si128 (digit, _mm_sub_epi8 (hex, _mm_set1_epi8 ('0'))),
+                    _mm_and_si128 (alpha, _mm_sub_epi8 (lower, _mm_set1_epi8 ('a' - 10))));
+            }
+        #elif defined (THEKOGANS_CRYPTO_TEXT_ENCODING_NEON)
+            inline uint8x16_t NibblesToHex (uint8x16_t nibbles) {
+                return vaddq_u8 (
+                    vaddq_u8 (nibbles, vdupq_n_u8 ('0')),
+                    vandq_u8 (vcgtq_u8 (nibbles, vdupq_n_u8 (9)), vdupq_n_u8 ('a' - '0' - 10)));
+            }
+
+            // Unsigned wrap around turns a range check in to one compare.
+            inline uint8x16_t InRange (
+                    uint8x16_t ascii,
+                    util::ui8 first,
+                    util::ui8 last) {
+                return vcleq_u8 (vsubq_u8 (ascii, vdupq_n_u8 (first)), vdupq_n_u8 (last - first));
+            }
+
+            inline uint8x16_t HexToNibbles (
+                    uint8x16_t hex,
+                    uint8x16_t &valid) {
+                uint8x16_t lower = vorrq_u8 (hex, vdupq_n_u8 (0x20));
+                uint8x16_t digit = InRange (hex, '0', '9');
+                valid = vorrq_u8 (digit, InRange (lower, 'a', 'f'));
+                return vbslq_u8 (digit,
+                    vsubq_u8 (hex, vdupq_n_u8 ('0')),
+                    vsubq_u8 (lower, vdupq_n_u8 ('a' - 10)));
+            }
+
+            inline bool AllSet (uint8x16_t mask) {
+                uint8x8_t folded = vand_u8 (vget_low_u8 (mask), vget_high_u8 (mask));
+                return vget_lane_u64 (vreinterpret_u64_u8 (folded), 0) == 0xffffffffffffffffULL;
+            }
+
+            inline uint8x16_t IndexToAscii (uint8x16_t indices) {
+                uint8x16_t offset = vdupq_n_u8 ('A');
+                offset = vaddq_u8 (offset, vandq_u8 (
+                    vcgtq_u8 (indices, vdupq_n_u8 (25)), vdupq_n_u8 (6)));
+                offset = vaddq_u8 (offset, vandq_u8 (
+                    vcgtq_u8 (indices, vdupq_n_u8 (51)), vdupq_n_u8 ((util::ui8)-75)));
+                offset = vaddq_u8 (offset, vandq_u8 (
+                    vcgtq_u8 (indices, vdupq_n_u8 (61)), vdupq_n_u8 ((util::ui8)-15)));
+                offset = vaddq_u8 (offset, vandq_u8 (
+                    vcgtq_u8 (indices, vdupq_n_u8 (62)), vdupq_n_u8 (3)));
+                return vaddq_u8 (indices, offset);
+            }
+
+            inline uint8x16_t AsciiToIndex (
+                    uint8x16_t ascii,
+                    uint8x16_t &valid) {
+                uint8x16_t upper = InRange (ascii, 'A', 'Z');
+                uint8x16_t lower = InRange (ascii, 'a', 'z');
+                uint8x16_t digit = InRange (ascii, '0', '9');
+                uint8x16_t plus = vceqq_u8 (ascii, vdupq_n_u8 ('+'));
+                uint8x16_t slash = vceqq_u8 (ascii, vdupq_n_u8 ('/'));
+                valid = vorrq_u8 (vorrq_u8 (upper, lower), vorrq_u8 (digit, vorrq_u8 (plus, slash)));
+                uint8x16_t delta = vorrq_u8 (
+                    vorrq_u8 (
+                        vandq_u8 (upper, vdupq_n_u8 ((util::ui8)-65)),
+                        vandq_u8 (lower, vdupq_n_u8 ((util::ui8)-71))),
+                    vorrq_u8 (
+                        vandq_u8 (digit, vdupq_n_u8 (4)),
+                        vorrq_u8 (
+                            vandq_u8 (plus, vdupq_n_u8 (19)),
+                            vandq_u8 (slash, vdupq_n_u8 (16)))));
+                return vaddq_u8 (ascii, delta);
+            }
+
+            // 48 bytes -> 64 characters at a time.
+            std::size_t Base64EncodeNEON (
+                    const util::ui8 *buffer,
+                    std::size_t length,
+                    char *base64) {
+                std::size_t consumed = 0;
+                while (length - consumed >= 48) {
+                    uint8x16x3_t in = vld3q_u8 (buffer + consumed);
+                    uint8x16_t mask = vdupq_n_u8 (0x3f);
+                    uint8x16x4_t out;
+                    out.val[0] = IndexToAscii (vshrq_n_u8 (in.val[0], 2));
+                    out.val[1] = IndexToAscii (vandq_u8 (
+                        vorrq_u8 (vshlq_n_u8 (in.val[0], 4), vshrq_n_u8 (in.val[1], 4)), mask));
+                    out.val[2] = IndexToAscii (vandq_u8 (
+                        vorrq_u8 (vshlq_n_u8 (in.val[1], 2), vshrq_n_u8 (in.val[2], 6)), mask));
+                    out.val[3] = IndexToAscii (vandq_u8 (in.val[2], mask));
+                    vst4q_u8 ((util::ui8 *)base64, out);
+                    base64 += 64;
+                    consumed += 48;
+                }
+                return consumed;
+            }
+
+            // 64 characters -> 48 bytes at a time. Stops at the first
+            // block with anything outside the alphabet in it.
+            std::size_t Base64DecodeNEON (
+                    const char *base64,
+                    std::size_t length,
+                    util::ui8 *buffer) {
+                std::size_t consumed = 0;
+                while (length - consumed >= 64) {
+                    uint8x16x4_t in = vld4q_u8 ((const util::ui8 *)base64 + consumed);
+                    uint8x16_t valid0;
+                    uint8x16_t valid1;
+                    uint8x16_t valid2;
+                    uint8x16_t valid3;
+                    uint8x16_t a = AsciiToIndex (in.val[0], valid0);
+                    uint8x16_t b = AsciiToIndex (in.val[1], valid1);
+                    uint8x16_t c = AsciiToIndex (in.val[2], valid2);
+                    uint8x16_t d = AsciiToIndex (in.val[3], valid3);
+                    if (!AllSet (vandq_u8 (vandq_u8 (valid0, valid1), vandq_u8 (valid2, valid3)))) {
+                        break;
+                    }
+                    uint8x16x3_t out;
+                    out.val[0] = vorrq_u8 (vshlq_n_u8 (a, 2), vshrq_n_u8 (b, 4));
+                    out.val[1] = vorrq_u8 (vshlq_n_u8 (b, 4), vshrq_n_u8 (c, 2));
+                    out.val[2] = vorrq_u8 (vshlq_n_u8 (c, 6), d);
+                    vst3q_u8 (buffer, out);
+                    buffer += 48;
+                    consumed += 64;
+                }
+                return consumed;
+            }
+        #endif // defined (THEKOGANS_CRYPTO_TEXT_ENCODING_SSE2)
+
+        #if defined (THEKOGANS_CRYPTO_TEXT_ENCODING_SSSE3)
+            inline bool HaveSSSE3 () {
+                static const bool haveSSSE3 = CPUFeatures::Instance ().ssse3;
+                return haveSSSE3;
+            }
+        #endif // defined (THEKOGANS_CRYPTO_TEXT_ENCODING_SSSE3)
+
+            // Encode one line (or everything), padding the last group.
+            std::size_t Base64EncodeRun (
+                    const util::ui8 *buffer,
+                    std::size_t length,
+                    char *base64) {
+                char *start = base64;
+                std::size_t consumed = 0;
+            #if defined (THEKOGANS_CRYPTO_TEXT_ENCODING_SSSE3)
+                if (HaveSSSE3 ()) {
+                    consumed = Base64EncodeSSSE3 (buffer, length, base64);
+                }
+            #elif defined (THEKOGANS_CRYPTO_TEXT_ENCODING_NEON)
+                consumed = Base64EncodeNEON (buffer, length, base64);
+            #endif // defined (THEKOGANS_CRYPTO_TEXT_ENCODING_SSSE3)
+                base64 += consumed / 3 * 4;
+                buffer += consumed;
+                length -= consumed;
+                for (; length >= 3; buffer += 3, length -= 3) {
+                    util::ui32 group = (buffer[0] << 16) | (buffer[1] << 8) | buffer[2];
+                    *base64++ = BASE64_ALPHABET[(group >> 18) & 0x3f];
+                    *base64++ = BASE64_ALPHABET[(group >> 12) & 0x3f];
+                    *base64++ = BASE64_ALPHABET[(group >> 6) & 0x3f];
+                    *base64++ = BASE64_ALPHABET[group & 0x3f];
+                }
+                if (length > 0) {
+                    util::ui32 group = (buffer[0] << 16) | (length == 2 ? buffer[1] << 8 : 0);
+                    *base64++ = BASE64_ALPHABET[(group >> 18) & 0x3f];
+                    *base64++ = BASE64_ALPHABET[(group >> 12) & 0x3f];
+                    *base64++ = length == 2 ? BASE64_ALPHABET[(group >> 6) & 0x3f] : BASE64_PAD;
+                    *base64++ = BASE64_PAD;
+                }
+                return base64 - start;
+            }
+        }
+
+        _LIB_THEKOGANS_CRYPTO_DECL std::size_t _LIB_THEKOGANS_CRYPTO_API
+        HexEncode (
+                const void *buffer,
+                std::size_t length,
+                char *hex) {
+            if ((buffer != 0 && hex != 0) || length == 0) {
+                const util::ui8 *ptr = (const util::ui8 *)buffer;
+                char *start = hex;
+            #if defined (THEKOGANS_CRYPTO_TEXT_ENCODING_SSE2)
+                for (; length >= 16; ptr += 16, hex += 32, length -= 16) {
+                    __m128i in = _mm_loadu_si128 ((const __m128i *)ptr);
+                    __m128i mask = _mm_set1_epi8 (0x0f);
+                    __m128i high = NibblesToHex (_mm_and_si128 (_mm_srli_epi16 (in, 4), mask));
+                    __m128i low = NibblesToHex (_mm_and_si128 (in, mask));
+                    _mm_storeu_si128 ((__m128i *)hex, _mm_unpacklo_epi8 (high, low));
+                    _mm_storeu_si128 ((__m128i *)(hex + 16), _mm_unpackhi_epi8 (high, low));
+                }
+            #elif defined (THEKOGANS_CRYPTO_TEXT_ENCODING_NEON)
+                for (; length >= 16; ptr += 16, hex += 32, length -= 16) {
+                    uint8x16_t in = vld1q_u8 (ptr);
+                    uint8x16x2_t out;
+                    out.val[0] = NibblesToHex (vshrq_n_u8 (in, 4));
+                    out.val[1] = NibblesToHex (vandq_u8 (in, vdupq_n_u8 (0x0f)));
+                    vst2q_u8 ((util::ui8 *)hex, out);
+                }
+            #endif // defined (THEKOGANS_CRYPTO_TEXT_ENCODING_SSE2)
+                for (; length > 0; ++ptr, --length) {
+                    *hex++ = HEX_DIGITS[*ptr >> 4];
+                    *hex++ = HEX_DIGITS[*ptr & 0x0f];
+                }
+                return hex - start;
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        _LIB_THEKOGANS_CRYPTO_DECL std::string _LIB_THEKOGANS_CRYPTO_API
+        HexEncode (
+                const void *buffer,
+                std::size_t length) {
+            std::string hex (length * 2, '\0');
+            if (length > 0) {
+                HexEncode (buffer, length, &hex[0]);
+            }
+            return hex;
+        }
+
+        _LIB_THEKOGANS_CRYPTO_DECL std::size_t _LIB_THEKOGANS_CRYPTO_API
+        HexDecode (
+                const char *hex,
+                std::size_t length,
+                util::ui8 *buffer) {
+            if (((hex != 0 && buffer != 0) || length == 0) && (length & 1) == 0) {
+                util::ui8 *start = buffer;
+            #if defined (THEKOGANS_CRYPTO_TEXT_ENCODING_SSE2)
+                for (; length >= 32; hex += 32, buffer += 16, length -= 32) {
+                    __m128i valid0;
+                    __m128i valid1;
+                    __m128i nibbles0 = HexToNibbles (_mm_loadu_si128 ((const __m128i *)hex), valid0);
+                    __m128i nibbles1 = HexToNibbles (_mm_loadu_si128 ((const __m128i *)(hex + 16)), valid1);
+                    if (_mm_movemask_epi8 (_mm_and_si128 (valid0, valid1)) != 0xffff) {
+                        // Let the scalar loop below find the culprit.
+                        break;
+                    }
+                    // Every 16 bit lane holds [high low] nibble pair.
+                    __m128i mask = _mm_set1_epi16 (0x00ff);
+                    __m128i bytes0 = _mm_or_si128 (
+                        _mm_slli_epi16 (_mm_and_si128 (nibbles0, mask), 4),
+                        _mm_srli_epi16 (nibbles0, 8));
+                    __m128i bytes1 = _mm_or_si128 (
+                        _mm_slli_epi16 (_mm_and_si128 (nibbles1, mask), 4),
+                        _mm_srli_epi16 (nibbles1, 8));
+                    _mm_storeu_si128 ((__m128i *)buffer, _mm_packus_epi16 (bytes0, bytes1));
+                }
+            #elif defined (THEKOGANS_CRYPTO_TEXT_ENCODING_NEON)
+                for (; length >= 32; hex += 32, buffer += 16, length -= 32) {
+                    uint8x16x2_t in = vld2q_u8 ((const util::ui8 *)hex);
+                    uint8x16_t valid0;
+                    uint8x16_t valid1;
+                    uint8x16_t high = HexToNibbles (in.val[0], valid0);
+                    uint8x16_t low = HexToNibbles (in.val[1], valid1);
+                    if (!AllSet (vandq_u8 (valid0, valid1))) {
+                        break;
+                    }
+                    vst1q_u8 (buffer, vorrq_u8 (vshlq_n_u8 (high, 4), low));
+                }
+            #endif // defined (THEKOGANS_CRYPTO_TEXT_ENCODING_SSE2)
+                for (; length > 0; hex += 2, length -= 2) {
+                    util::ui8 high = DecodeHexDigit (hex[0]);
+                    util::ui8 low = DecodeHexDigit (hex[1]);
+                    if (high == INVALID_DIGIT || low == INVALID_DIGIT) {
+                        THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                            "Invalid hex digit: '%c'.", high == INVALID_DIGIT ? hex[0] : hex[1]);
+                    }
+                    *buffer++ = (util::ui8)((high << 4) | low);
+                }
+                return buffer - start;
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        _LIB_THEKOGANS_CRYPTO_DECL std::vector<util::ui8> _LIB_THEKOGANS_CRYPTO_API
+        HexDecode (const std::string &hex) {
+            std::vector<util::ui8> buffer (hex.size () / 2);
+            if (!hex.empty ()) {
+                HexDecode (hex.data (), hex.size (), buffer.data ());
+            }
+            return buffer;
+        }
+
+        _LIB_THEKOGANS_CRYPTO_DECL std::size_t _LIB_THEKOGANS_CRYPTO_API
+        GetBase64EncodedLength (
+                std::size_t length,
+                std::size_t lineLength) {
+            std::size_t encodedLength = (length + 2) / 3 * 4;
+            if (lineLength > 0 && encodedLength > 0) {
+                encodedLength += (encodedLength - 1) / lineLength;
+            }
+            return encodedLength;
+        }
+
+        _LIB_THEKOGANS_CRYPTO_DECL std::size_t _LIB_THEKOGANS_CRYPTO_API
+        Base64Encode (
+                const void *buffer,
+                std::size_t length,
+                char *base64,
+                std::size_t lineLength) {
+            if (((buffer != 0 && base64 != 0) || length == 0) && lineLength % 4 == 0) {
+                const util::ui8 *ptr = (const util::ui8 *)buffer;
+                if (lineLength == 0) {
+                    return Base64EncodeRun (ptr, length, base64);
+                }
+                char *start = base64;
+                std::size_t lineBytes = lineLength / 4 * 3;
+                while (length > 0) {
+                    if (base64 != start) {
+                        *base64++ = '\n';
+                    }
+                    std::size_t count = length < lineBytes ? length : lineBytes;
+                    base64 += Base64EncodeRun (ptr, count, base64);
+                    ptr += count;
+                    length -= count;
+                }
+                return base64 - start;
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        _LIB_THEKOGANS_CRYPTO_DECL std::string _LIB_THEKOGANS_CRYPTO_API
+        Base64Encode (
+                const void *buffer,
+                std::size_t length,
+                std::size_t lineLength) {
+            std::string base64 (GetBase64EncodedLength (length, lineLength), '\0');
+            if (!base64.empty ()) {
+                Base64Encode (buffer, length, &base64[0], lineLength);
+            }
+            return base64;
+        }
+
+        _LIB_THEKOGANS_CRYPTO_DECL std::size_t _LIB_THEKOGANS_CRYPTO_API
+        Base64Decode (
+                const char *base64,
+                std::size_t length,
+                util::ui8 *buffer) {
+            if ((base64 != 0 && buffer != 0) || length == 0) {
+                util::ui8 *start = buffer;
+                util::ui32 group = 0;
+                std::size_t count = 0;
+                std::size_t padding = 0;
+                for (std::size_t i = 0; i < length;) {
+                    if (count == 0 && padding == 0) {
+                        // On a group boundary; let the vector code
+                        // chew through as much as it can.
+                        std::size_t consumed = 0;
+                    #if defined (THEKOGANS_CRYPTO_TEXT_ENCODING_SSSE3)
+                        if (HaveSSSE3 ()) {
+                            consumed = Base64DecodeSSSE3 (base64 + i, length - i, buffer);
+                        }
+                    #elif defined (THEKOGANS_CRYPTO_TEXT_ENCODING_NEON)
+                        consumed = Base64DecodeNEON (base64 + i, length - i, buffer);
+                    #endif // defined (THEKOGANS_CRYPTO_TEXT_ENCODING_SSSE3)
+                        buffer += consumed / 4 * 3;
+                        i += consumed;
+                        if (i == length) {
+                            break;
+                        }
+                    }
+                    char ch = base64[i++];
+                    if (IsSpace (ch)) {
+                        continue;
+                    }
+                    if (ch == BASE64_PAD) {
+                        if (count < 2 || count + ++padding > 4) {
+                            THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                                "%s", "Misplaced Base64 padding.");
+                        }
+                        continue;
+                    }
+                    util::ui8 digit = DecodeBase64Digit (ch);
+                    if (digit == INVALID_DIGIT || padding > 0) {
+                        THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                            "Invalid Base64 character: '%c'.", ch);
+                    }
+                    group = (group << 6) | digit;
+                    if (++count == 4) {
+                        *buffer++ = (util::ui8)(group >> 16);
+                        *buffer++ = (util::ui8)(group >> 8);
+                        *buffer++ = (util::ui8)group;
+                        group = 0;
+                        count = 0;
+                    }
+                }
+                if (count == 1 || (padding > 0 && count + padding != 4)) {
+                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                        "%s", "Truncated Base64 input.");
+                }
+                if (count == 2) {
+                    *buffer++ = (util::ui8)(group >> 4);
+                }
+                else if (count == 3) {
+                    *buffer++ = (util::ui8)(group >> 10);
+                    *buffer++ = (util::ui8)(group >> 2);
+                }
+                return buffer - start;
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        _LIB_THEKOGANS_CRYPTO_DECL std::vector<util::ui8> _LIB_THEKOGANS_CRYPTO_API
+        Base64Decode (
+                const char *base64,
+                std::size_t length) {
+            std::vector<util::ui8> buffer (length / 4 * 3 + 3);
+            buffer.resize (length > 0 ? Base64Decode (base64, length, buffer.data ()) : 0);
+            return buffer;
+        }
+
+    } // namespace crypto
+} // namespace thekogans
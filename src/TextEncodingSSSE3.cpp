@@ -0,0 +1,147 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+// NOTE: Every header this file needs, other than the intrinsics, has to
+// be included before the target pragma below (see Blake3SSE41.cpp).
+#include <cstddef>
+#include <cstring>
+#include "thekogans/util/Types.h"
+#include "thekogans/crypto/Config.h"
+
+#if defined (__x86_64__) || defined (_M_X64) || defined (__i386__) || defined (_M_IX86)
+
+#if defined (__clang__)
+    #pragma clang attribute push (__attribute__ ((target ("ssse3"))), apply_to = function)
+#elif defined (__GNUC__)
+    #pragma GCC push_options
+    #pragma GCC target ("ssse3")
+#endif // defined (__clang__)
+
+#include <tmmintrin.h>
+
+namespace thekogans {
+    namespace crypto {
+
+        namespace {
+            // Map 16 6 bit indices to their Base64 characters.
+            // 0..25 -> 'A'.., 26..51 -> 'a'.., 52..61 -> '0'..,
+            // 62 -> '+', 63 -> '/'.
+            inline __m128i IndexToAscii (__m128i indices) {
+                __m128i offset = _mm_set1_epi8 ('A');
+                offset = _mm_add_epi8 (offset, _mm_and_si128 (
+                    _mm_cmpgt_epi8 (indices, _mm_set1_epi8 (25)), _mm_set1_epi8 (6)));
+                offset = _mm_add_epi8 (offset, _mm_and_si128 (
+                    _mm_cmpgt_epi8 (indices, _mm_set1_epi8 (51)), _mm_set1_epi8 (-75)));
+                offset = _mm_add_epi8 (offset, _mm_and_si128 (
+                    _mm_cmpgt_epi8 (indices, _mm_set1_epi8 (61)), _mm_set1_epi8 (-15)));
+                offset = _mm_add_epi8 (offset, _mm_and_si128 (
+                    _mm_cmpgt_epi8 (indices, _mm_set1_epi8 (62)), _mm_set1_epi8 (3)));
+                return _mm_add_epi8 (indices, offset);
+            }
+
+            inline __m128i InRange (
+                    __m128i ascii,
+                    char first,
+                    char last) {
+                return _mm_and_si128 (
+                    _mm_cmpgt_epi8 (ascii, _mm_set1_epi8 (first - 1)),
+                    _mm_cmpgt_epi8 (_mm_set1_epi8 (last + 1), ascii));
+            }
+        }
+
+        // Encode as many 12 byte groups as possible (each load reads
+        // 16 bytes, so the last 4 input bytes are left for the caller).
+        // Returns the number of bytes consumed.
+        std::size_t Base64EncodeSSSE3 (
+                const util::ui8 *buffer,
+                std::size_t length,
+                char *base64) {
+            std::size_t consumed = 0;
+            while (length - consumed >= 16) {
+                __m128i in = _mm_loadu_si128 ((const __m128i *)(buffer + consumed));
+                // Every 32 bit lane gets [b1 b0 b2 b1] of its 3 byte group.
+                in = _mm_shuffle_epi8 (in,
+                    _mm_set_epi8 (10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+                // Move the four 6 bit fields in to the four bytes of the lane.
+                __m128i t0 = _mm_mulhi_epu16 (
+                    _mm_and_si128 (in, _mm_set1_epi32 (0x0fc0fc00)),
+                    _mm_set1_epi32 (0x04000040));
+                __m128i t1 = _mm_mullo_epi16 (
+                    _mm_and_si128 (in, _mm_set1_epi32 (0x003f03f0)),
+                    _mm_set1_epi32 (0x01000010));
+                _mm_storeu_si128 ((__m128i *)base64, IndexToAscii (_mm_or_si128 (t0, t1)));
+                base64 += 16;
+                consumed += 12;
+            }
+            return consumed;
+        }
+
+        // Decode as many 16 character blocks as possible, stopping at
+        // the first block containing anything outside the alphabet
+        // (white space, padding, garbage) for the scalar decoder to
+        // deal with. Returns the number of characters consumed.
+        std::size_t Base64DecodeSSSE3 (
+                const char *base64,
+                std::size_t length,
+                util::ui8 *buffer) {
+            std::size_t consumed = 0;
+            while (length - consumed >= 16) {
+                __m128i in = _mm_loadu_si128 ((const __m128i *)(base64 + consumed));
+                __m128i upper = InRange (in, 'A', 'Z');
+                __m128i lower = InRange (in, 'a', 'z');
+                __m128i digit = InRange (in, '0', '9');
+                __m128i plus = _mm_cmpeq_epi8 (in, _mm_set1_epi8 ('+'));
+                __m128i slash = _mm_cmpeq_epi8 (in, _mm_set1_epi8 ('/'));
+                __m128i valid = _mm_or_si128 (_mm_or_si128 (upper, lower),
+                    _mm_or_si128 (digit, _mm_or_si128 (plus, slash)));
+                if (_mm_movemask_epi8 (valid) != 0xffff) {
+                    break;
+                }
+                __m128i delta = _mm_or_si128 (
+                    _mm_or_si128 (
+                        _mm_and_si128 (upper, _mm_set1_epi8 (-65)),
+                        _mm_and_si128 (lower, _mm_set1_epi8 (-71))),
+                    _mm_or_si128 (
+                        _mm_and_si128 (digit, _mm_set1_epi8 (4)),
+                        _mm_or_si128 (
+                            _mm_and_si128 (plus, _mm_set1_epi8 (19)),
+                            _mm_and_si128 (slash, _mm_set1_epi8 (16)))));
+                in = _mm_add_epi8 (in, delta);
+                // [a b c d] -> a << 18 | b << 12 | c << 6 | d in every 32 bit lane.
+                in = _mm_maddubs_epi16 (in, _mm_set1_epi32 (0x01400140));
+                in = _mm_madd_epi16 (in, _mm_set1_epi32 (0x00011000));
+                in = _mm_shuffle_epi8 (in,
+                    _mm_setr_epi8 (2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+                _mm_storel_epi64 ((__m128i *)buffer, in);
+                util::ui32 tail = (util::ui32)_mm_cvtsi128_si32 (_mm_srli_si128 (in, 8));
+                memcpy (buffer + 8, &tail, 4);
+                buffer += 12;
+                consumed += 16;
+            }
+            return consumed;
+        }
+
+    } // namespace crypto
+} // namespace thekogans
+
+#if defined (__clang__)
+    #pragma clang attribute pop
+#elif defined (__GNUC__)
+    #pragma GCC pop_options
+#endif // defined (__clang__)
+
+#endif // defined (__x86_64__) || defined (_M_X64) || defined (__i386__) || defined (_M_IX86)
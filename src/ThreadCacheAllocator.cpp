@@ -0,0 +1,204 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#include <cstring>
+#include <atomic>
+#include <vector>
+#include "thekogans/util/DefaultAllocator.h"
+#include "thekogans/util/SecureAllocator.h"
+#include "thekogans/crypto/AllocationTracker.h"
+#include "thekogans/crypto/OpenSSLAllocator.h"
+#include "thekogans/crypto/ThreadCacheAllocator.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        THEKOGANS_UTIL_IMPLEMENT_ALLOCATOR (ThreadCacheAllocator)
+
+        namespace {
+            // Return the index of the smallest size class that can hold size
+            // bytes (SIZE_CLASS_COUNT if size > MAX_BLOCK_SIZE).
+            inline std::size_t GetSizeClass (std::size_t size) {
+                std::size_t sizeClass = 0;
+                std::size_t blockSize = ThreadCacheAllocator::MIN_BLOCK_SIZE;
+                while (blockSize < size && sizeClass < ThreadCacheAllocator::SIZE_CLASS_COUNT) {
+                    blockSize <<= 1;
+                    ++sizeClass;
+                }
+                return sizeClass;
+            }
+
+            inline std::size_t GetClassBlockSize (std::size_t sizeClass) {
+                return (std::size_t)ThreadCacheAllocator::MIN_BLOCK_SIZE << sizeClass;
+            }
+
+            std::atomic<util::ui64> nextInstanceId (0);
+
+            // One allocator's blocks cached by one thread.
+            struct Magazine {
+                util::ui64 instanceId;
+                util::Allocator *allocator;
+                std::vector<void *> freeBlocks[ThreadCacheAllocator::SIZE_CLASS_COUNT];
+
+                explicit Magazine (
+                    util::ui64 instanceId_ = 0,
+                    util::Allocator *allocator_ = 0) :
+                    instanceId (instanceId_),
+                    allocator (allocator_) {}
+
+                void Trim () {
+                    for (std::size_t i = 0; i < ThreadCacheAllocator::SIZE_CLASS_COUNT; ++i) {
+                        for (std::size_t j = 0, count = freeBlocks[i].size (); j < count; ++j) {
+                            allocator->Free (freeBlocks[i][j], GetClassBlockSize (i));
+                        }
+                        freeBlocks[i].clear ();
+                    }
+                }
+            };
+
+            // All magazines of the calling thread. There's only
+            // ever a handful of ThreadCacheAllocators so a linear
+            // scan beats a map.
+            // Set once the calling thread's Magazines is gone. Blocks
+            // freed after that (static dtors) bypass the cache.
+            thread_local bool magazinesDestroyed = false;
+
+            struct Magazines {
+                std::vector<Magazine> magazines;
+
+                ~Magazines () {
+                    magazinesDestroyed = true;
+                    for (std::size_t i = 0, count = magazines.size (); i < count; ++i) {
+                        magazines[i].Trim ();
+                    }
+                }
+
+                Magazine *Find (util::ui64 instanceId) {
+                    for (std::size_t i = 0, count = magazines.size (); i < count; ++i) {
+                        if (magazines[i].instanceId == instanceId) {
+                            return &magazines[i];
+                        }
+                    }
+                    return 0;
+                }
+
+                Magazine &Get (
+                        util::ui64 instanceId,
+                        util::Allocator &allocator) {
+                    Magazine *magazine = Find (instanceId);
+                    if (magazine == 0) {
+                        magazines.push_back (Magazine (instanceId, &allocator));
+                        magazine = &magazines.back ();
+                    }
+                    return *magazine;
+                }
+            };
+
+            inline Magazines *GetMagazines () {
+                if (magazinesDestroyed) {
+                    return 0;
+                }
+                static thread_local Magazines magazines;
+                return &magazines;
+            }
+        }
+
+        ThreadCacheAllocator &ThreadCacheAllocator::SecureInstance () {
+            static ThreadCacheAllocator *instance =
+                new ThreadCacheAllocator (&util::SecureAllocator::Instance (), true);
+            return *instance;
+        }
+
+        ThreadCacheAllocator &ThreadCacheAllocator::OpenSSLInstance () {
+            static ThreadCacheAllocator *instance =
+                new ThreadCacheAllocator (&OpenSSLAllocator::Instance ());
+            return *instance;
+        }
+
+        ThreadCacheAllocator::ThreadCacheAllocator (
+                util::Allocator *allocator_,
+                bool secure_,
+                std::size_t maxBlocksPerClass_) :
+                allocator (allocator_ != 0 ? *allocator_ : util::DefaultAllocator::Instance ()),
+                secure (secure_),
+                maxBlocksPerClass (maxBlocksPerClass_),
+                instanceId (nextInstanceId++) {}
+
+        ThreadCacheAllocator::~ThreadCacheAllocator () {
+            Trim ();
+        }
+
+        void *ThreadCacheAllocator::Alloc (std::size_t size) {
+            if (size == 0) {
+                return 0;
+            }
+            AllocationTracker::Record (
+                secure ? AllocationTracker::SOURCE_SECURE : AllocationTracker::SOURCE_POOL,
+                size);
+            std::size_t sizeClass = GetSizeClass (size);
+            if (sizeClass == SIZE_CLASS_COUNT) {
+                return allocator.Alloc (size);
+            }
+            Magazines *magazines = GetMagazines ();
+            Magazine *magazine = magazines != 0 ? magazines->Find (instanceId) : 0;
+            if (magazine != 0 && !magazine->freeBlocks[sizeClass].empty ()) {
+                void *ptr = magazine->freeBlocks[sizeClass].back ();
+                magazine->freeBlocks[sizeClass].pop_back ();
+                return ptr;
+            }
+            return allocator.Alloc (GetClassBlockSize (sizeClass));
+        }
+
+        void ThreadCacheAllocator::Free (
+                void *ptr,
+                std::size_t size) {
+            if (ptr != 0) {
+                std::size_t sizeClass = GetSizeClass (size);
+                if (sizeClass == SIZE_CLASS_COUNT) {
+                    allocator.Free (ptr, size);
+                    return;
+                }
+                if (secure) {
+                    memset (ptr, 0, GetClassBlockSize (sizeClass));
+                }
+                Magazines *magazines = GetMagazines ();
+                if (magazines != 0) {
+                    Magazine &magazine = magazines->Get (instanceId, allocator);
+                    if (magazine.freeBlocks[sizeClass].size () < maxBlocksPerClass) {
+                        if (magazine.freeBlocks[sizeClass].capacity () == 0) {
+                            magazine.freeBlocks[sizeClass].reserve (maxBlocksPerClass);
+                        }
+                        magazine.freeBlocks[sizeClass].push_back (ptr);
+                        return;
+                    }
+                }
+                allocator.Free (ptr, GetClassBlockSize (sizeClass));
+            }
+        }
+
+        void ThreadCacheAllocator::Trim () {
+            Magazines *magazines = GetMagazines ();
+            if (magazines != 0) {
+                Magazine *magazine = magazines->Find (instanceId);
+                if (magazine != 0) {
+                    magazine->Trim ();
+                }
+            }
+        }
+
+    } // namespace crypto
+} // namespace thekogans
@@ -0,0 +1,205 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#include <atomic>
+#include <iomanip>
+#include <sstream>
+#include "thekogans/util/HRTimer.h"
+#include "thekogans/util/LockGuard.h"
+#include "thekogans/crypto/CipherSuite.h"
+#include "thekogans/crypto/Trace.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        namespace {
+            // Set before sink is published, cleared after it is retired,
+            // so that the disabled path costs a single relaxed load.
+            std::atomic<bool> enabled (false);
+
+            util::SpinLock &GetSinkSpinLock () {
+                static util::SpinLock *spinLock = new util::SpinLock;
+                return *spinLock;
+            }
+
+            Trace::Sink::SharedPtr &GetSinkPtr () {
+                static Trace::Sink::SharedPtr *sink = new Trace::Sink::SharedPtr;
+                return *sink;
+            }
+
+            // Small, stable thread ids (Chrome trace tids).
+            std::atomic<util::ui64> nextThreadId (1);
+
+            inline util::ui64 GetThreadId () {
+                static thread_local util::ui64 threadId =
+                    nextThreadId.fetch_add (1, std::memory_order_relaxed);
+                return threadId;
+            }
+
+            void EmitEvent (
+                    Trace::Sink &sink,
+                    Trace::Event &event,
+                    Trace::Phase phase) {
+                event.phase = phase;
+                event.timestamp = util::HRTimer::Click ();
+                sink.OnEvent (event);
+            }
+        }
+
+        void Trace::SetSink (Sink::SharedPtr sink) {
+            util::LockGuard<util::SpinLock> guard (GetSinkSpinLock ());
+            GetSinkPtr () = sink;
+            enabled.store (sink.Get () != 0, std::memory_order_relaxed);
+        }
+
+        Trace::Sink::SharedPtr Trace::GetSink () {
+            util::LockGuard<util::SpinLock> guard (GetSinkSpinLock ());
+            return GetSinkPtr ();
+        }
+
+        bool Trace::IsEnabled () {
+            return enabled.load (std::memory_order_relaxed);
+        }
+
+        const char *Trace::OperationToString (Operation operation) {
+            switch (operation) {
+                case OPERATION_ENCRYPT:
+                    return "Encrypt";
+                case OPERATION_DECRYPT:
+                    return "Decrypt";
+                case OPERATION_SIGN:
+                    return "Sign";
+                case OPERATION_VERIFY:
+                    return "Verify";
+                case OPERATION_KEY_EXCHANGE:
+                    return "KeyExchange";
+                case OPERATION_KEY_RING_LOAD:
+                    return "KeyRingLoad";
+                case OPERATION_KEY_RING_SAVE:
+                    return "KeyRingSave";
+                case OPERATION_KDF:
+                    return "KDF";
+            }
+            return "Unknown";
+        }
+
+        std::string Trace::ToChromeTrace (const std::vector<Event> &events) {
+            std::stringstream stream;
+            stream << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+            // Events from different threads can land in the ring out of order.
+            util::ui64 start = events.empty () ? 0 : events[0].timestamp;
+            for (std::size_t i = 1, count = events.size (); i < count; ++i) {
+                if (start > events[i].timestamp) {
+                    start = events[i].timestamp;
+                }
+            }
+            for (std::size_t i = 0, count = events.size (); i < count; ++i) {
+                const Event &event = events[i];
+                if (i > 0) {
+                    stream << ",";
+                }
+                stream <<
+                    "{\"name\":\"" << OperationToString (event.operation) <<
+                    "\",\"cat\":\"crypto\",\"ph\":\"" <<
+                    (event.phase == PHASE_BEGIN ? "B" : "E") <<
+                    "\",\"ts\":" << std::fixed << std::setprecision (3) <<
+                    util::HRTimer::ToSeconds (
+                        util::HRTimer::ComputeElapsedTime (start, event.timestamp)) * 1e6 <<
+                    ",\"pid\":1,\"tid\":" << event.threadId;
+                if (event.phase == PHASE_BEGIN) {
+                    stream <<
+                        ",\"args\":{\"keyId\":\"" << event.keyId.ToHexString () <<
+                        "\",\"suite\":\"" << CipherSuite::GetCipherSuiteByCode (event.suite).ToString () <<
+                        "\",\"byteCount\":" << event.byteCount << "}";
+                }
+                stream << "}";
+            }
+            stream << "]}";
+            return stream.str ();
+        }
+
+        Trace::Scope::Scope (
+                Operation operation,
+                const ID &keyId,
+                util::ui16 suite,
+                util::ui64 byteCount) {
+            if (IsEnabled ()) {
+                sink = GetSink ();
+                if (sink.Get () != 0) {
+                    event.operation = operation;
+                    event.threadId = GetThreadId ();
+                    event.keyId = keyId;
+                    event.suite = suite;
+                    event.byteCount = byteCount;
+                    EmitEvent (*sink, event, PHASE_BEGIN);
+                }
+            }
+        }
+
+        Trace::Scope::~Scope () {
+            if (sink.Get () != 0) {
+                EmitEvent (*sink, event, PHASE_END);
+            }
+        }
+
+        RingBufferTraceSink::RingBufferTraceSink (std::size_t capacity) :
+                events (capacity > 0 ? capacity : 1),
+                head (0),
+                count (0),
+                droppedCount (0) {}
+
+        std::vector<Trace::Event> RingBufferTraceSink::GetEvents () const {
+            util::LockGuard<util::SpinLock> guard (spinLock);
+            std::vector<Trace::Event> result;
+            result.reserve (count);
+            std::size_t tail = (head + events.size () - count) % events.size ();
+            for (std::size_t i = 0; i < count; ++i) {
+                result.push_back (events[(tail + i) % events.size ()]);
+            }
+            return result;
+        }
+
+        util::ui64 RingBufferTraceSink::GetDroppedCount () const {
+            util::LockGuard<util::SpinLock> guard (spinLock);
+            return droppedCount;
+        }
+
+        void RingBufferTraceSink::Clear () {
+            util::LockGuard<util::SpinLock> guard (spinLock);
+            head = 0;
+            count = 0;
+            droppedCount = 0;
+        }
+
+        std::string RingBufferTraceSink::ToChromeTrace () const {
+            return Trace::ToChromeTrace (GetEvents ());
+        }
+
+        void RingBufferTraceSink::OnEvent (const Trace::Event &event) throw () {
+            util::LockGuard<util::SpinLock> guard (spinLock);
+            events[head] = event;
+            head = (head + 1) % events.size ();
+            if (count < events.size ()) {
+                ++count;
+            }
+            else {
+                ++droppedCount;
+            }
+        }
+
+    } // namespace crypto
+} // namespace thekogans
@@ -0,0 +1,129 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#include "thekogans/util/Exception.h"
+#include "thekogans/util/LockGuard.h"
+#include "thekogans/util/HRTimer.h"
+#include "thekogans/crypto/Blake3.h"
+#include "thekogans/crypto/ValidatedParamsCache.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        ValidatedParamsCache::ValidatedParamsCache (
+                std::size_t ttl_,
+                std::size_t capacity) :
+                ttl (ttl_),
+                cache (capacity) {
+            if (ttl == 0 || capacity == 0) {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        std::size_t ValidatedParamsCache::GetTTL () {
+            util::LockGuard<util::SpinLock> guard (spinLock);
+            return ttl;
+        }
+
+        void ValidatedParamsCache::SetTTL (std::size_t ttl_) {
+            if (ttl_ > 0) {
+                util::LockGuard<util::SpinLock> guard (spinLock);
+                ttl = ttl_;
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        namespace {
+            inline void UpdateLengthPrefixed (
+                    Blake3 &blake3,
+                    const void *buffer,
+                    std::size_t length) {
+                // Length prefix every field so that no two
+                // different tuples hash the same bytes.
+                util::ui64 length64 = length;
+                blake3.Update (&length64, sizeof (length64));
+                if (length > 0) {
+                    blake3.Update (buffer, length);
+                }
+            }
+        }
+
+        ID ValidatedParamsCache::GetKey (
+                const ID &paramsId,
+                const ID &signatureKeyId,
+                const std::string &signatureMessageDigestName,
+                const void *signedData,
+                std::size_t signedDataLength,
+                const void *signature,
+                std::size_t signatureLength) {
+            if (signedData != 0 && signedDataLength > 0 &&
+                    signature != 0 && signatureLength > 0) {
+                Blake3 blake3;
+                UpdateLengthPrefixed (blake3, paramsId.data, paramsId.Size ());
+                UpdateLengthPrefixed (blake3, signatureKeyId.data, signatureKeyId.Size ());
+                UpdateLengthPrefixed (blake3,
+                    signatureMessageDigestName.data (), signatureMessageDigestName.size ());
+                UpdateLengthPrefixed (blake3, signedData, signedDataLength);
+                UpdateLengthPrefixed (blake3, signature, signatureLength);
+                util::ui8 key[ID::SIZE];
+                blake3.Final (key, ID::SIZE);
+                return ID (key);
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        bool ValidatedParamsCache::Contains (const ID &key) {
+            util::ui64 validated;
+            util::LockGuard<util::SpinLock> guard (spinLock);
+            if (cache.Get (key, validated)) {
+                if (util::HRTimer::ToSeconds (
+                        util::HRTimer::ComputeElapsedTime (
+                            validated, util::HRTimer::Click ())) < ttl) {
+                    return true;
+                }
+                cache.Erase (key);
+            }
+            return false;
+        }
+
+        void ValidatedParamsCache::Add (const ID &key) {
+            util::ui64 validated = util::HRTimer::Click ();
+            util::LockGuard<util::SpinLock> guard (spinLock);
+            // Refresh the timestamp of an entry that expired under us.
+            cache.Erase (key);
+            cache.Add (key, validated);
+        }
+
+        IDCacheStats ValidatedParamsCache::GetStats () {
+            util::LockGuard<util::SpinLock> guard (spinLock);
+            return cache.GetStats ();
+        }
+
+        void ValidatedParamsCache::Clear () {
+            util::LockGuard<util::SpinLock> guard (spinLock);
+            cache.Clear ();
+        }
+
+    } // namespace crypto
+} // namespace thekogans
@@ -0,0 +1,140 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#include <string>
+#include "thekogans/util/Exception.h"
+#include "thekogans/util/LockGuard.h"
+#include "thekogans/util/Buffer.h"
+#include "thekogans/crypto/Blake3.h"
+#include "thekogans/crypto/VerificationCache.h"
+
+namespace thekogans {
+    namespace crypto {
+
+        VerificationCache::VerificationCache (std::size_t capacity) :
+                cache (capacity) {
+            if (capacity == 0) {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        std::size_t VerificationCache::GetCapacity () {
+            util::LockGuard<util::SpinLock> guard (spinLock);
+            return cache.GetCapacity ();
+        }
+
+        void VerificationCache::SetCapacity (std::size_t capacity) {
+            if (capacity > 0) {
+                util::LockGuard<util::SpinLock> guard (spinLock);
+                cache.SetCapacity (capacity);
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        namespace {
+            inline void UpdateLengthPrefixed (
+                    Blake3 &blake3,
+                    const void *buffer,
+                    std::size_t length) {
+                // Length prefix every field so that no two
+                // different tuples hash the same bytes.
+                util::ui64 length64 = length;
+                blake3.Update (&length64, sizeof (length64));
+                if (length > 0) {
+                    blake3.Update (buffer, length);
+                }
+            }
+        }
+
+        ID VerificationCache::GetKey (
+                const AsymmetricKey &publicKey,
+                const MessageDigest &messageDigest,
+                const void *buffer,
+                std::size_t bufferLength,
+                const void *signature,
+                std::size_t signatureLength) {
+            if (buffer != 0 && bufferLength > 0 &&
+                    signature != 0 && signatureLength > 0) {
+                Blake3 blake3;
+                // The id is serialized with the key and is chosen by whoever
+                // presents it. Identify the key by it's (public) key material.
+                // The public part of a private key is given the same id, name
+                // and description so that it serializes the same every time.
+                AsymmetricKey::SharedPtr publicPart;
+                const AsymmetricKey *key = &publicKey;
+                if (publicKey.IsPrivate ()) {
+                    publicPart = publicKey.GetPublicKey (
+                        publicKey.GetId (),
+                        publicKey.GetName (),
+                        publicKey.GetDescription ());
+                    key = publicPart.Get ();
+                }
+                util::Buffer serializedKey (util::NetworkEndian, key->Size ());
+                key->Write (serializedKey);
+                UpdateLengthPrefixed (
+                    blake3,
+                    serializedKey.GetReadPtr (),
+                    serializedKey.GetDataAvailableForReading ());
+                std::string keyType = publicKey.GetKeyType ();
+                UpdateLengthPrefixed (blake3, keyType.data (), keyType.size ());
+                std::string messageDigestName = messageDigest.GetName ();
+                UpdateLengthPrefixed (blake3, messageDigestName.data (), messageDigestName.size ());
+                UpdateLengthPrefixed (blake3, buffer, bufferLength);
+                UpdateLengthPrefixed (blake3, signature, signatureLength);
+                util::ui8 key[ID::SIZE];
+                blake3.Final (key, ID::SIZE);
+                return ID (key);
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
+        }
+
+        bool VerificationCache::Contains (const ID &key) {
+            bool value;
+            util::LockGuard<util::SpinLock> guard (spinLock);
+            return cache.Get (key, value);
+        }
+
+        void VerificationCache::Add (const ID &key) {
+            util::LockGuard<util::SpinLock> guard (spinLock);
+            cache.Add (key, true);
+        }
+
+        IDCacheStats VerificationCache::GetStats () {
+            util::LockGuard<util::SpinLock> guard (spinLock);
+            return cache.GetStats ();
+        }
+
+        util::f64 VerificationCache::GetHitRate () {
+            IDCacheStats stats = GetStats ();
+            util::ui64 lookups = stats.hits + stats.misses;
+            return lookups > 0 ? (util::f64)stats.hits / (util::f64)lookups : 0.0;
+        }
+
+        void VerificationCache::Clear () {
+            util::LockGuard<util::SpinLock> guard (spinLock);
+            cache.Clear ();
+        }
+
+    } // namespace crypto
+} // namespace thekogans
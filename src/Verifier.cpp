@@ -15,10 +15,17 @@
 // You should have received a copy of the GNU General Public License
 // along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
 
+#include <atomic>
+#include <map>
+#include <string>
 #if defined (THEKOGANS_CRYPTO_TYPE_Static)
     #include "thekogans/util/SpinLock.h"
     #include "thekogans/util/LockGuard.h"
 #endif // defined (THEKOGANS_CRYPTO_TYPE_Static)
+#include "thekogans/util/Exception.h"
+#include "thekogans/util/Thread.h"
+#include "thekogans/util/OwnerVector.h"
+#include "thekogans/util/SystemInfo.h"
 #include "thekogans/crypto/OpenSSLVerifier.h"
 #include "thekogans/crypto/OpenSSLUtils.h"
 #include "thekogans/crypto/Ed25519Verifier.h"
@@ -28,39 +35,250 @@
 namespace thekogans {
     namespace crypto {
 
-        Verifier::Map &Verifier::GetMap () {
-            static Map *map = new Map;
-            return *map;
+        Verifier::Factory *Verifier::GetFactories () {
+            // Zero initialized before any dynamic initialization
+            // (registration) runs.
+            static Factory factories[AsymmetricKey::MAX_KEY_TYPES];
+            return factories;
         }
 
-        Verifier::MapInitializer::MapInitializer (
-                const std::string &keyType,
+        void Verifier::RegisterFactory (
+                const char *keyType,
                 Factory factory) {
-            std::pair<Map::iterator, bool> result =
-                GetMap ().insert (Map::value_type (keyType, factory));
-            assert (result.second);
-            if (!result.second) {
+            util::ui32 keyTypeId = AsymmetricKey::InternKeyType (keyType);
+            Factory *factories = GetFactories ();
+            assert (factories[keyTypeId] == 0);
+            if (factories[keyTypeId] == 0) {
+                factories[keyTypeId] = factory;
+            }
+            else {
                 THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
-                    "%s is already registered.", keyType.c_str ());
+                    "%s is already registered.", keyType);
             }
         }
 
+        Verifier::MapInitializer::MapInitializer (
+                const char *keyType,
+                Factory factory) {
+            RegisterFactory (keyType, factory);
+        }
+
         Verifier::Verifier (
                 AsymmetricKey::SharedPtr publicKey_,
                 MessageDigest::SharedPtr messageDigest_) :
                 publicKey (publicKey_),
+                sharedStats (0),
                 messageDigest (messageDigest_) {
             if (publicKey.Get () == 0 || messageDigest.Get () == 0) {
                 THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
                     THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
             }
+            metrics.Reset (publicKey->GetId ());
+        }
+
+        void Verifier::SavePrefix () {
+            prefix = messageDigest->Clone ();
+        }
+
+        void Verifier::InitFromPrefix () {
+            if (prefix.Get () != 0) {
+                messageDigest->CopyState (*prefix);
+            }
+            else {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "%s", "SavePrefix has not been called.");
+            }
+        }
+
+        bool Verifier::VerifyBufferSignature (
+                const void *buffer,
+                std::size_t bufferLength,
+                const void *signature,
+                std::size_t signatureLength) {
+            if (buffer != 0 && bufferLength > 0 &&
+                    signature != 0 && signatureLength > 0) {
+                ID key = ID::Empty;
+                if (verificationCache.Get () != 0) {
+                    key = VerificationCache::GetKey (
+                        *publicKey,
+                        *messageDigest,
+                        buffer,
+                        bufferLength,
+                        signature,
+                        signatureLength);
+                    if (verificationCache->Contains (key)) {
+                        return true;
+                    }
+                }
+                Init ();
+                Update (buffer, bufferLength);
+                bool result = Final (signature, signatureLength);
+                if (result && verificationCache.Get () != 0) {
+                    verificationCache->Add (key);
+                }
+                return result;
+            }
+            else {
+                THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                    THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+            }
         }
 
         Verifier::SharedPtr Verifier::Get (
                 AsymmetricKey::SharedPtr publicKey,
                 MessageDigest::SharedPtr messageDigest) {
-            Map::iterator it = GetMap ().find (publicKey->GetKeyType ());
-            return it != GetMap ().end () ? it->second (publicKey, messageDigest) : Verifier::SharedPtr ();
+            Factory factory = GetFactories ()[publicKey->GetKeyTypeId ()];
+            return factory != 0 ? factory (publicKey, messageDigest) : Verifier::SharedPtr ();
+        }
+
+        namespace {
+            // Verifies jobs (groups of items sharing a verifier) until
+            // there are none left (or, if stopOnFailure, one fails).
+            struct VerifyWorker : public util::Thread {
+                const std::vector<Verifier::BatchItem> &items;
+                const std::vector<std::vector<std::size_t>> &jobs;
+                std::atomic<std::size_t> &nextJob;
+                std::atomic<bool> &failed;
+                bool stopOnFailure;
+                // NOTE: Not std::vector<bool>; workers write
+                // neighboring results concurrently.
+                std::vector<util::ui8> &results;
+                std::string error;
+
+                VerifyWorker (
+                    const std::vector<Verifier::BatchItem> &items_,
+                    const std::vector<std::vector<std::size_t>> &jobs_,
+                    std::atomic<std::size_t> &nextJob_,
+                    std::atomic<bool> &failed_,
+                    bool stopOnFailure_,
+                    std::vector<util::ui8> &results_) :
+                    items (items_),
+                    jobs (jobs_),
+                    nextJob (nextJob_),
+                    failed (failed_),
+                    stopOnFailure (stopOnFailure_),
+                    results (results_) {}
+
+                void Verify () {
+                    for (std::size_t job = nextJob++; job < jobs.size (); job = nextJob++) {
+                        for (std::size_t i = 0, count = jobs[job].size (); i < count; ++i) {
+                            const Verifier::BatchItem &item = items[jobs[job][i]];
+                            results[jobs[job][i]] = item.verifier->VerifyBufferSignature (
+                                item.buffer,
+                                item.bufferLength,
+                                item.signature,
+                                item.signatureLength) ? 1 : 0;
+                            if (!results[jobs[job][i]]) {
+                                failed = true;
+                                if (stopOnFailure) {
+                                    Abort ();
+                                    return;
+                                }
+                            }
+                        }
+                    }
+                }
+
+            protected:
+                // util::Thread
+                virtual void Run () throw () override {
+                    THEKOGANS_UTIL_TRY {
+                        Verify ();
+                    }
+                    THEKOGANS_UTIL_CATCH (util::Exception) {
+                        error = exception.Report ();
+                        failed = true;
+                        Abort ();
+                    }
+                }
+
+            private:
+                // Make the other workers run out of jobs.
+                void Abort () {
+                    nextJob = jobs.size ();
+                }
+            };
+        }
+
+        bool Verifier::VerifyBatch (
+                const std::vector<BatchItem> &items,
+                std::vector<bool> *results,
+                std::size_t workerCount,
+                bool stopOnFailure) {
+            std::vector<std::size_t> ed25519Items;
+            std::vector<std::vector<std::size_t>> jobs;
+            {
+                std::map<const Verifier *, std::size_t> verifierJobs;
+                for (std::size_t i = 0, count = items.size (); i < count; ++i) {
+                    const BatchItem &item = items[i];
+                    if (item.verifier.Get () == 0) {
+                        THEKOGANS_UTIL_THROW_ERROR_CODE_EXCEPTION (
+                            THEKOGANS_UTIL_OS_ERROR_CODE_EINVAL);
+                    }
+                    if (item.verifier->GetPublicKey ()->GetKeyType () == Ed25519AsymmetricKey::KEY_TYPE) {
+                        ed25519Items.push_back (i);
+                    }
+                    else {
+                        std::pair<std::map<const Verifier *, std::size_t>::iterator, bool> result =
+                            verifierJobs.insert (
+                                std::map<const Verifier *, std::size_t>::value_type (
+                                    item.verifier.Get (), jobs.size ()));
+                        if (result.second) {
+                            jobs.push_back (std::vector<std::size_t> ());
+                        }
+                        jobs[result.first->second].push_back (i);
+                    }
+                }
+            }
+            std::vector<bool> ed25519Results (items.size (), false);
+            bool valid = Ed25519Verifier::VerifyBatch (items, ed25519Items, &ed25519Results);
+            std::vector<util::ui8> jobResults (items.size (), 0);
+            if (!jobs.empty () && (valid || !stopOnFailure)) {
+                std::atomic<std::size_t> nextJob (0);
+                std::atomic<bool> failed (false);
+                if (workerCount == 0) {
+                    workerCount = util::SystemInfo::Instance ().GetCPUCount ();
+                }
+                if (workerCount > jobs.size ()) {
+                    workerCount = jobs.size ();
+                }
+                if (workerCount <= 1) {
+                    VerifyWorker (items, jobs, nextJob, failed, stopOnFailure, jobResults).Verify ();
+                }
+                else {
+                    util::OwnerVector<VerifyWorker> workers;
+                    workers.reserve (workerCount);
+                    for (std::size_t i = 0; i < workerCount; ++i) {
+                        workers.push_back (
+                            new VerifyWorker (items, jobs, nextJob, failed, stopOnFailure, jobResults));
+                        workers.back ()->Create ();
+                    }
+                    for (std::size_t i = 0; i < workerCount; ++i) {
+                        workers[i]->Wait ();
+                    }
+                    for (std::size_t i = 0; i < workerCount; ++i) {
+                        if (!workers[i]->error.empty ()) {
+                            THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                                "%s", workers[i]->error.c_str ());
+                        }
+                    }
+                }
+                if (failed) {
+                    valid = false;
+                }
+            }
+            if (results != 0) {
+                results->assign (items.size (), false);
+                for (std::size_t i = 0, count = ed25519Items.size (); i < count; ++i) {
+                    (*results)[ed25519Items[i]] = ed25519Results[ed25519Items[i]];
+                }
+                for (std::size_t i = 0, count = jobs.size (); i < count; ++i) {
+                    for (std::size_t j = 0, size = jobs[i].size (); j < size; ++j) {
+                        (*results)[jobs[i][j]] = jobResults[jobs[i][j]] != 0;
+                    }
+                }
+            }
+            return valid;
         }
 
     #if defined (THEKOGANS_CRYPTO_TYPE_Static)
@@ -70,9 +288,15 @@ namespace thekogans {
             if (!registered) {
                 util::LockGuard<util::SpinLock> guard (spinLock);
                 if (!registered) {
+                #if defined (THEKOGANS_CRYPTO_HAVE_RSA)
                     OpenSSLVerifier::StaticInit (OPENSSL_PKEY_RSA);
+                #endif // defined (THEKOGANS_CRYPTO_HAVE_RSA)
+                #if defined (THEKOGANS_CRYPTO_HAVE_DSA)
                     OpenSSLVerifier::StaticInit (OPENSSL_PKEY_DSA);
+                #endif // defined (THEKOGANS_CRYPTO_HAVE_DSA)
+                #if defined (THEKOGANS_CRYPTO_HAVE_EC)
                     OpenSSLVerifier::StaticInit (OPENSSL_PKEY_EC);
+                #endif // defined (THEKOGANS_CRYPTO_HAVE_EC)
                     Ed25519Verifier::StaticInit (Ed25519AsymmetricKey::KEY_TYPE);
                     registered = true;
                 }
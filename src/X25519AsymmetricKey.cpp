@@ -15,6 +15,8 @@
 // You should have received a copy of the GNU General Public License
 // along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
 
+#include "thekogans/crypto/ConstantTime.h"
+#include "thekogans/crypto/TextEncoding.h"
 #include "thekogans/crypto/X25519AsymmetricKey.h"
 
 namespace thekogans {
@@ -45,8 +47,18 @@ namespace thekogans {
             }
         }
 
+        X25519AsymmetricKey::~X25519AsymmetricKey () {
+            key.Rewind ();
+            SecureZero (key.GetWritePtr (), X25519::KEY_LENGTH);
+        }
+
         const char * const X25519AsymmetricKey::KEY_TYPE = "X25519";
 
+        util::ui32 X25519AsymmetricKey::GetKeyTypeId () const {
+            static const util::ui32 keyTypeId = InternKeyType (KEY_TYPE);
+            return keyTypeId;
+        }
+
         AsymmetricKey::SharedPtr X25519AsymmetricKey::GetPublicKey (
                 const ID &id,
                 const std::string &name,
@@ -105,7 +117,7 @@ namespace thekogans {
             if (hexKey.size () == X25519::PRIVATE_KEY_LENGTH * 2) {
                 key.Rewind ();
                 if (key.AdvanceWriteOffset (
-                        util::HexDecodeBuffer (
+                        HexDecode (
                             hexKey.data (),
                             hexKey.size (),
                             key.GetWritePtr ())) != X25519::KEY_LENGTH) {
@@ -127,7 +139,7 @@ namespace thekogans {
         void X25519AsymmetricKey::Write (pugi::xml_node &node) const {
             AsymmetricKey::Write (node);
             node.append_attribute (ATTR_KEY).set_value (
-                util::HexEncodeBuffer (key.GetReadPtr (), X25519::KEY_LENGTH).c_str ());
+                HexEncode (key.GetReadPtr (), X25519::KEY_LENGTH).c_str ());
         }
 
         void X25519AsymmetricKey::Read (
@@ -138,7 +150,7 @@ namespace thekogans {
             if (hexKey.size () == X25519::PRIVATE_KEY_LENGTH * 2) {
                 key.Rewind ();
                 if (key.AdvanceWriteOffset (
-                        util::HexDecodeBuffer (
+                        HexDecode (
                             hexKey.data (),
                             hexKey.size (),
                             key.GetWritePtr ())) != X25519::KEY_LENGTH) {
@@ -161,7 +173,7 @@ namespace thekogans {
             AsymmetricKey::Write (object);
             object.Add<const std::string &> (
                 ATTR_KEY,
-                util::HexEncodeBuffer (key.GetReadPtr (), X25519::KEY_LENGTH));
+                HexEncode (key.GetReadPtr (), X25519::KEY_LENGTH));
         }
 
     } // namespace crypto
@@ -15,7 +15,8 @@
 // You should have received a copy of the GNU General Public License
 // along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
 
-#include "thekogans/util/SecureAllocator.h"
+#include <openssl/crypto.h>
+#include "thekogans/util/Exception.h"
 #include "thekogans/crypto/Curve25519.h"
 #include "thekogans/crypto/X25519AsymmetricKey.h"
 #include "thekogans/crypto/X25519Params.h"
@@ -36,10 +37,20 @@ namespace thekogans {
                 const ID &id,
                 const std::string &name,
                 const std::string &description) const {
-            util::SecureVector<util::ui8> privateKey (X25519::PRIVATE_KEY_LENGTH);
-            X25519::CreateKey (privateKey.data ());
-            return AsymmetricKey::SharedPtr (
-                new X25519AsymmetricKey (privateKey.data (), true, id, name, description));
+            // Generate on the stack; X25519AsymmetricKey is page allocated,
+            // so creating a key doesn't touch the heap.
+            util::ui8 privateKey[X25519::PRIVATE_KEY_LENGTH];
+            AsymmetricKey::SharedPtr key;
+            THEKOGANS_UTIL_TRY {
+                X25519::CreateKey (privateKey);
+                key.Reset (new X25519AsymmetricKey (privateKey, true, id, name, description));
+            }
+            THEKOGANS_UTIL_CATCH (util::Exception) {
+                OPENSSL_cleanse (privateKey, X25519::PRIVATE_KEY_LENGTH);
+                THEKOGANS_UTIL_RETHROW_EXCEPTION (exception);
+            }
+            OPENSSL_cleanse (privateKey, X25519::PRIVATE_KEY_LENGTH);
+            return key;
         }
 
         std::size_t X25519Params::Size () const {
@@ -0,0 +1,52 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined (__thekogans_crypto_tests_TestData_h)
+#define __thekogans_crypto_tests_TestData_h
+
+#include <cstddef>
+#include <string>
+#include "thekogans/util/Types.h"
+
+namespace thekogans {
+    namespace crypto {
+        namespace tests {
+
+            /// \brief
+            /// Return length bytes of deterministic (LCG) test data. The same
+            /// seed always produces the same bytes (across runs, platforms and
+            /// test files), which is what the chunker stability and dedup tests
+            /// rely on. Never use it where random data is needed.
+            /// \param[in] length Number of bytes to return.
+            /// \param[in] seed LCG seed.
+            /// \return length bytes of test data.
+            inline std::string MakeData (
+                    std::size_t length,
+                    util::ui32 seed) {
+                std::string data (length, '\0');
+                for (std::size_t i = 0; i < length; ++i) {
+                    seed = seed * 1664525 + 1013904223;
+                    data[i] = (char)(seed >> 24);
+                }
+                return data;
+            }
+
+        } // namespace tests
+    } // namespace crypto
+} // namespace thekogans
+
+#endif // !defined (__thekogans_crypto_tests_TestData_h)
@@ -0,0 +1,334 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <openssl/evp.h>
+#include <CppUnitXLite/CppUnitXLite.cpp>
+#include "thekogans/util/Types.h"
+#include "thekogans/util/RandomSource.h"
+#include "thekogans/util/Exception.h"
+#include "thekogans/crypto/AllocationTracker.h"
+#include "thekogans/crypto/OpenSSLInit.h"
+#include "thekogans/crypto/OpenSSLUtils.h"
+#include "thekogans/crypto/CipherSuite.h"
+#include "thekogans/crypto/SymmetricKey.h"
+#include "thekogans/crypto/Cipher.h"
+#include "thekogans/crypto/HMAC.h"
+#include "thekogans/crypto/MessageDigest.h"
+#include "thekogans/crypto/Ed25519Params.h"
+#include "thekogans/crypto/Signer.h"
+#include "thekogans/crypto/KeyRing.h"
+
+using namespace thekogans;
+
+THEKOGANS_CRYPTO_IMPLEMENT_ALLOCATION_TRACKER_GLOBAL_NEW
+
+namespace {
+    // OpenSSL only lets us in before it's first allocation.
+    const bool openSSLHooksInstalled = crypto::AllocationTracker::InstallOpenSSLHooks ();
+
+    enum {
+        /// \brief
+        /// Untracked calls made to reach steady state.
+        WARMUP_ITERATIONS = 16,
+        /// \brief
+        /// Tracked calls.
+        ITERATIONS = 100,
+        /// \brief
+        /// Buffer length used by the hot paths.
+        BUFFER_LENGTH = 1024
+    };
+
+    // OpenSSL 3 digest providers allocate a fresh context on every
+    // EVP_DigestInit_ex and EVP_MD_CTX_copy_ex. That's outside of our
+    // control, so measure it and allow exactly that much on the paths
+    // that (re)initialize digests.
+    struct OpenSSLDigestAllocations {
+        util::ui64 init;
+        util::ui64 copy;
+
+        OpenSSLDigestAllocations () :
+                init (0),
+                copy (0) {
+            EVP_MD_CTX *source = EVP_MD_CTX_new ();
+            EVP_MD_CTX *target = EVP_MD_CTX_new ();
+            if (source != 0 && target != 0 &&
+                    EVP_DigestInit_ex (source, THEKOGANS_CRYPTO_DEFAULT_MD, 0) == 1 &&
+                    EVP_MD_CTX_copy_ex (target, source) == 1) {
+                crypto::AllocationTracker::Scope scope;
+                EVP_DigestInit_ex (source, 0, 0);
+                init = scope.GetCounters ().allocationCount[
+                    crypto::AllocationTracker::SOURCE_OPENSSL];
+                scope.Reset ();
+                EVP_MD_CTX_copy_ex (target, source);
+                copy = scope.GetCounters ().allocationCount[
+                    crypto::AllocationTracker::SOURCE_OPENSSL];
+            }
+            EVP_MD_CTX_free (target);
+            EVP_MD_CTX_free (source);
+        }
+    };
+
+    struct HotPath {
+        virtual ~HotPath () {}
+
+        virtual void Run () = 0;
+    };
+
+    struct EncryptHotPath : public HotPath {
+        crypto::Cipher::SharedPtr cipher;
+        std::vector<util::ui8> plaintext;
+        std::vector<util::ui8> ciphertext;
+
+        explicit EncryptHotPath (crypto::Cipher::SharedPtr cipher_) :
+                cipher (cipher_),
+                plaintext (BUFFER_LENGTH),
+                ciphertext (crypto::Cipher::GetMaxBufferLength (BUFFER_LENGTH)) {
+            util::GlobalRandomSource::Instance ().GetBytes (&plaintext[0], BUFFER_LENGTH);
+        }
+
+        virtual void Run () override {
+            cipher->Encrypt (&plaintext[0], BUFFER_LENGTH, 0, 0, &ciphertext[0]);
+        }
+    };
+
+    struct DecryptHotPath : public HotPath {
+        crypto::Cipher::SharedPtr cipher;
+        std::vector<util::ui8> ciphertext;
+        std::size_t ciphertextLength;
+        std::vector<util::ui8> plaintext;
+
+        explicit DecryptHotPath (crypto::Cipher::SharedPtr cipher_) :
+                cipher (cipher_),
+                ciphertext (crypto::Cipher::GetMaxBufferLength (BUFFER_LENGTH)),
+                ciphertextLength (0),
+                plaintext (crypto::Cipher::GetMaxBufferLength (BUFFER_LENGTH)) {
+            util::GlobalRandomSource::Instance ().GetBytes (&plaintext[0], BUFFER_LENGTH);
+            ciphertextLength = cipher->Encrypt (&plaintext[0], BUFFER_LENGTH, 0, 0, &ciphertext[0]);
+        }
+
+        virtual void Run () override {
+            if (cipher->Decrypt (&ciphertext[0], ciphertextLength, 0, 0, &plaintext[0]) != BUFFER_LENGTH) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION ("%s", "Decrypt failed.");
+            }
+        }
+    };
+
+    struct SignBufferHotPath : public HotPath {
+        crypto::HMAC mac;
+        util::ui8 buffer[BUFFER_LENGTH];
+        util::ui8 signature[EVP_MAX_MD_SIZE];
+
+        SignBufferHotPath () :
+                mac (crypto::SymmetricKey::FromRandom (), THEKOGANS_CRYPTO_DEFAULT_MD) {
+            util::GlobalRandomSource::Instance ().GetBytes (buffer, BUFFER_LENGTH);
+        }
+
+        virtual void Run () override {
+            mac.SignBuffer (buffer, BUFFER_LENGTH, signature);
+        }
+    };
+
+    struct SignerHotPath : public HotPath {
+        crypto::Signer::SharedPtr signer;
+        util::ui8 buffer[BUFFER_LENGTH];
+        util::ui8 signature[EVP_MAX_MD_SIZE];
+
+        SignerHotPath () :
+                signer (
+                    crypto::Signer::Get (
+                        crypto::Ed25519Params ().CreateKey (),
+                        crypto::MessageDigest::SharedPtr (new crypto::MessageDigest))) {
+            util::GlobalRandomSource::Instance ().GetBytes (buffer, BUFFER_LENGTH);
+        }
+
+        virtual void Run () override {
+            signer->Init ();
+            signer->Update (buffer, BUFFER_LENGTH);
+            signer->Final (signature);
+        }
+    };
+
+    struct GetCipherHotPath : public HotPath {
+        crypto::KeyRing::SharedPtr keyRing;
+        crypto::ID keyId;
+
+        explicit GetCipherHotPath (const crypto::CipherSuite &cipherSuite) :
+                keyRing (new crypto::KeyRing (cipherSuite)) {
+            crypto::SymmetricKey::SharedPtr key = crypto::SymmetricKey::FromRandom (
+                crypto::SymmetricKey::MIN_RANDOM_LENGTH,
+                0,
+                0,
+                crypto::GetCipherKeyLength (cipherSuite.GetOpenSSLCipher ()));
+            keyRing->AddCipherKey (key);
+            keyId = key->GetId ();
+        }
+
+        virtual void Run () override {
+            if (keyRing->GetCipher (keyId).Get () == 0) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION ("%s", "GetCipher failed.");
+            }
+        }
+    };
+
+    // Return true if ITERATIONS steady state calls of the given hot path
+    // allocate nothing, except for (openSSLAllowance per call) allocations
+    // made by OpenSSL itself.
+    bool TestZeroAllocations (
+            const std::string &name,
+            HotPath &hotPath,
+            util::ui64 openSSLAllowance = 0) {
+        THEKOGANS_UTIL_TRY {
+            std::cout << name << "...";
+            for (std::size_t i = 0; i < WARMUP_ITERATIONS; ++i) {
+                hotPath.Run ();
+            }
+            crypto::AllocationTracker::Scope scope;
+            for (std::size_t i = 0; i < ITERATIONS; ++i) {
+                hotPath.Run ();
+            }
+            crypto::AllocationTracker::Counters counters = scope.GetCounters ();
+            bool result = true;
+            for (std::size_t i = 0; i < crypto::AllocationTracker::SOURCE_COUNT; ++i) {
+                util::ui64 allowed = i == crypto::AllocationTracker::SOURCE_OPENSSL ?
+                    openSSLAllowance * ITERATIONS : 0;
+                if (counters.allocationCount[i] > allowed) {
+                    if (result) {
+                        std::cout << "fail";
+                        result = false;
+                    }
+                    std::cout << " (" << crypto::AllocationTracker::GetSourceName (
+                        (crypto::AllocationTracker::Source)i) << ": " <<
+                        counters.allocationCount[i] << " allocations, " <<
+                        counters.byteCount[i] << " bytes)";
+                }
+            }
+            std::cout << (result ? "pass" : "") << std::endl;
+            return result;
+        }
+        THEKOGANS_UTIL_CATCH (util::Exception) {
+            std::cout << "fail " << exception.Report ();
+            return false;
+        }
+    }
+
+    const crypto::CipherSuite *FindCipherSuite (bool aead) {
+        const std::vector<crypto::CipherSuite> &cipherSuites =
+            crypto::CipherSuite::GetCipherSuites ();
+        for (std::size_t i = 0, count = cipherSuites.size (); i < count; ++i) {
+            if (crypto::IsCipherAEAD (cipherSuites[i].GetOpenSSLCipher ()) == aead) {
+                return &cipherSuites[i];
+            }
+        }
+        return 0;
+    }
+}
+
+TEST (thekogans, AllocationTracker) {
+    crypto::OpenSSLInit openSSLInit;
+    {
+        std::cout << "crypto::AllocationTracker::Scope...";
+        crypto::AllocationTracker::Scope scope;
+        std::string *string = new std::string (100, 'x');
+        delete string;
+        bool result = scope.GetCounters ().allocationCount[
+            crypto::AllocationTracker::SOURCE_HEAP] >= 1;
+        std::cout << (result ? "pass" : "fail") << std::endl;
+        CHECK_EQUAL (result, true);
+    }
+    if (!openSSLHooksInstalled) {
+        std::cout << "OpenSSL allocation hooks unavailable, "
+            "only counting OpenSSLAllocator." << std::endl;
+    }
+    OpenSSLDigestAllocations digestAllocations;
+    const crypto::CipherSuite *aeadCipherSuite = FindCipherSuite (true);
+    if (aeadCipherSuite != 0) {
+        crypto::Cipher::SharedPtr cipher = aeadCipherSuite->GetCipher (
+            crypto::SymmetricKey::FromRandom (
+                crypto::SymmetricKey::MIN_RANDOM_LENGTH,
+                0,
+                0,
+                crypto::GetCipherKeyLength (aeadCipherSuite->GetOpenSSLCipher ())));
+        {
+            EncryptHotPath hotPath (cipher);
+            CHECK_EQUAL (
+                TestZeroAllocations ("crypto::Cipher::Encrypt (" + aeadCipherSuite->cipher + ")", hotPath),
+                true);
+        }
+        {
+            DecryptHotPath hotPath (cipher);
+            CHECK_EQUAL (
+                TestZeroAllocations ("crypto::Cipher::Decrypt (" + aeadCipherSuite->cipher + ")", hotPath),
+                true);
+        }
+        {
+            GetCipherHotPath hotPath (*aeadCipherSuite);
+            CHECK_EQUAL (TestZeroAllocations ("crypto::KeyRing::GetCipher (cache hit)", hotPath), true);
+        }
+    }
+    const crypto::CipherSuite *cbcCipherSuite = FindCipherSuite (false);
+    if (cbcCipherSuite != 0) {
+        // CBC ciphers MAC the ciphertext (HMAC: one context copy in Init, one in Final).
+        crypto::Cipher::SharedPtr cipher = cbcCipherSuite->GetCipher (
+            crypto::SymmetricKey::FromRandom (
+                crypto::SymmetricKey::MIN_RANDOM_LENGTH,
+                0,
+                0,
+                crypto::GetCipherKeyLength (cbcCipherSuite->GetOpenSSLCipher ())));
+        {
+            EncryptHotPath hotPath (cipher);
+            CHECK_EQUAL (
+                TestZeroAllocations (
+                    "crypto::Cipher::Encrypt (" + cbcCipherSuite->cipher + ")",
+                    hotPath,
+                    2 * digestAllocations.copy),
+                true);
+        }
+        {
+            DecryptHotPath hotPath (cipher);
+            CHECK_EQUAL (
+                TestZeroAllocations (
+                    "crypto::Cipher::Decrypt (" + cbcCipherSuite->cipher + ")",
+                    hotPath,
+                    2 * digestAllocations.copy),
+                true);
+        }
+    }
+    {
+        SignBufferHotPath hotPath;
+        CHECK_EQUAL (
+            TestZeroAllocations (
+                "crypto::MAC::SignBuffer (HMAC)",
+                hotPath,
+                2 * digestAllocations.copy),
+            true);
+    }
+    {
+        SignerHotPath hotPath;
+        CHECK_EQUAL (
+            TestZeroAllocations (
+                "crypto::Ed25519Signer::Final",
+                hotPath,
+                digestAllocations.init),
+            true);
+    }
+}
+
+TESTMAIN
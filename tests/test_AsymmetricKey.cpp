@@ -22,6 +22,8 @@
 #include "thekogans/crypto/SymmetricKey.h"
 #include "thekogans/crypto/AsymmetricKey.h"
 #include "thekogans/crypto/DSA.h"
+#include "thekogans/crypto/RSA.h"
+#include "thekogans/crypto/PublicKeyCache.h"
 
 using namespace thekogans;
 
@@ -72,4 +74,56 @@ TEST (thekogans, AsymmetricKey) {
     }
 }
 
+TEST (thekogans, PublicKeyCache) {
+    crypto::OpenSSLInit openSSLInit;
+    std::cout << "PublicKeyCache...";
+    crypto::AsymmetricKey::SharedPtr publicKey = crypto::RSA::CreateKey (1024)->GetPublicKey ();
+    util::Buffer serializer (
+        util::NetworkEndian,
+        util::Serializable::Size (*publicKey));
+    serializer << *publicKey;
+    crypto::IDCacheStats stats = crypto::PublicKeyCache::Instance ().GetStats ();
+    bool result = true;
+    // The first read decodes (and caches) the key, the rest share it.
+    for (std::size_t i = 0; result && i < 3; ++i) {
+        util::TenantReadBuffer buffer (
+            util::NetworkEndian,
+            serializer.GetReadPtr (),
+            serializer.GetDataAvailableForReading ());
+        crypto::AsymmetricKey::SharedPtr publicKey2;
+        buffer >> publicKey2;
+        result = publicKey2.Get () != 0 &&
+            buffer.GetDataAvailableForReading () == 0 &&
+            *publicKey == *publicKey2;
+    }
+    result = result &&
+        crypto::PublicKeyCache::Instance ().GetStats ().hits == stats.hits + 2;
+    std::cout << (result ? "pass" : "fail") << std::endl;
+    CHECK_EQUAL (result, true);
+}
+
+TEST (thekogans, RSAEncryptor) {
+    crypto::OpenSSLInit openSSLInit;
+    crypto::AsymmetricKey::SharedPtr privateKey = crypto::RSA::CreateKey (1024);
+    crypto::RSAEncryptor encryptor (privateKey->GetPublicKey ());
+    crypto::RSAEncryptor::SharedPtr clone = encryptor.Clone ();
+    crypto::RSADecryptor decryptor (privateKey);
+    std::cout << "RSAEncryptor...";
+    bool result = true;
+    const char *plaintext = "The quick brown fox jumps over the lazy dog.";
+    std::size_t plaintextLength = strlen (plaintext);
+    for (std::size_t i = 0; i < 8 && result; ++i) {
+        util::Buffer ciphertext = (i & 1) == 0 ?
+            encryptor.Encrypt (plaintext, plaintextLength) :
+            clone->Encrypt (plaintext, plaintextLength);
+        util::Buffer decrypted = decryptor.Decrypt (
+            ciphertext.GetReadPtr (),
+            ciphertext.GetDataAvailableForReading ());
+        result = decrypted.GetDataAvailableForReading () == plaintextLength &&
+            memcmp (decrypted.GetReadPtr (), plaintext, plaintextLength) == 0;
+    }
+    std::cout << (result ? "pass" : "fail") << std::endl;
+    CHECK_EQUAL (result, true);
+}
+
 TESTMAIN
@@ -15,17 +15,34 @@
 // You should have received a copy of the GNU General Public License
 // along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
 
+#if !defined (TOOLCHAIN_OS_Windows)
+    #include <sys/types.h>
+    #include <sys/wait.h>
+    #include <unistd.h>
+#endif // !defined (TOOLCHAIN_OS_Windows)
+#include <cstring>
+#include <algorithm>
+#include <string>
+#include <vector>
 #include <iostream>
+#include <thread>
+#include <openssl/ecdsa.h>
 #include <CppUnitXLite/CppUnitXLite.cpp>
 #include "thekogans/util/Types.h"
 #include "thekogans/util/Buffer.h"
 #include "thekogans/util/RandomSource.h"
+#include "thekogans/util/File.h"
+#include "thekogans/util/StringUtils.h"
 #include "thekogans/crypto/OpenSSLInit.h"
 #include "thekogans/crypto/RSA.h"
 #include "thekogans/crypto/DSA.h"
 #include "thekogans/crypto/EC.h"
 #include "thekogans/crypto/AsymmetricKey.h"
 #include "thekogans/crypto/Authenticator.h"
+#include "thekogans/crypto/VerificationCache.h"
+#include "thekogans/crypto/ECDSANoncePool.h"
+#include "thekogans/crypto/FileManifest.h"
+#include "thekogans/crypto/SignatureManifest.h"
 
 using namespace thekogans;
 
@@ -48,7 +65,396 @@ namespace {
                 buffer,
                 1024,
                 signature.GetReadPtr (),
-                signature.GetDataAvailableForReading ());
+                signature.GetDataAvailableForReading ()) &&
+                signer.GetStats ().GetUseCount () == 1 &&
+                signer.GetStats ().GetTotalByteCount () == signature.GetDataAvailableForReading () &&
+                verifier.GetStats ().GetUseCount () == 1;
+            if (result) {
+                // Sign/verify the buffer as a shared 768 byte prefix
+                // followed by a 256 byte suffix (Signer/Verifier::SavePrefix).
+                crypto::Signer::SharedPtr prefixSigner = crypto::Signer::Get (
+                    privateKey,
+                    crypto::MessageDigest::SharedPtr (new crypto::MessageDigest));
+                prefixSigner->Init ();
+                prefixSigner->Update (buffer, 768);
+                prefixSigner->SavePrefix ();
+                crypto::Verifier::SharedPtr prefixVerifier = crypto::Verifier::Get (
+                    privateKey->GetPublicKey (),
+                    crypto::MessageDigest::SharedPtr (new crypto::MessageDigest));
+                prefixVerifier->Init ();
+                prefixVerifier->Update (buffer, 768);
+                prefixVerifier->SavePrefix ();
+                for (std::size_t i = 0; result && i < 3; ++i) {
+                    prefixSigner->InitFromPrefix ();
+                    prefixSigner->Update (buffer + 768, 256);
+                    util::Buffer prefixSignature = prefixSigner->Final ();
+                    result = verifier.VerifyBufferSignature (
+                        buffer,
+                        1024,
+                        prefixSignature.GetReadPtr (),
+                        prefixSignature.GetDataAvailableForReading ());
+                    if (result) {
+                        prefixVerifier->InitFromPrefix ();
+                        prefixVerifier->Update (buffer + 768, 256);
+                        result = prefixVerifier->Final (
+                            signature.GetReadPtr (),
+                            signature.GetDataAvailableForReading ());
+                    }
+                }
+            }
+            std::cout << (result ? "pass" : "fail") << std::endl;
+            return result;
+        }
+        THEKOGANS_UTIL_CATCH (util::Exception) {
+            std::cout << "fail " << exception.Report ();
+            return false;
+        }
+    }
+
+    bool TestECDSANoncePool (
+            const char *name,
+            crypto::AsymmetricKey::SharedPtr privateKey,
+            const void *seed,
+            std::size_t seedLength) {
+        THEKOGANS_UTIL_TRY {
+            crypto::ECDSANoncePool::SharedPtr pool (
+                new crypto::ECDSANoncePool (privateKey, 4, 1, seed, seedLength));
+            crypto::ECDSANoncePool::Register (pool);
+            bool result = crypto::ECDSANoncePool::Find (*privateKey) == pool &&
+                TestAuthenticator (name, privateKey);
+            crypto::ECDSANoncePool::Unregister (pool);
+            pool->Stop ();
+            crypto::ECDSANoncePool::Stats stats = pool->GetStats ();
+            // One SignBuffer and three prefixed signatures, every pair used once.
+            return result && stats.hits + stats.misses == 4 && stats.nonces == 0 &&
+                crypto::ECDSANoncePool::Find (*privateKey).Get () == 0;
+        }
+        THEKOGANS_UTIL_CATCH (util::Exception) {
+            std::cout << "fail " << exception.Report ();
+            return false;
+        }
+    }
+
+#if !defined (TOOLCHAIN_OS_Windows)
+    // Return the r of a DER encoded ECDSA signature.
+    std::vector<util::ui8> GetR (
+            const util::ui8 *signature,
+            std::size_t signatureLength) {
+        std::vector<util::ui8> r;
+        ECDSA_SIG *sig = d2i_ECDSA_SIG (0, &signature, (long)signatureLength);
+        if (sig != 0) {
+            const BIGNUM *sigR = 0;
+            ECDSA_SIG_get0 (sig, &sigR, 0);
+            r.resize (BN_num_bytes (sigR));
+            BN_bn2bin (sigR, r.data ());
+            ECDSA_SIG_free (sig);
+        }
+        return r;
+    }
+
+    // Fork while the pool is full, and sign the same digest in the
+    // parent and the child. They must not use the same nonce.
+    bool TestECDSANoncePoolFork (
+            crypto::AsymmetricKey::SharedPtr privateKey,
+            const void *seed,
+            std::size_t seedLength) {
+        THEKOGANS_UTIL_TRY {
+            std::cout << "crypto::ECDSANoncePool (fork)...";
+            crypto::ECDSANoncePool::SharedPtr pool (
+                new crypto::ECDSANoncePool (privateKey, 4, 1, seed, seedLength));
+            for (std::size_t i = 0; i < 10000000 && pool->GetStats ().nonces < 4; ++i) {
+                std::this_thread::yield ();
+            }
+            util::ui8 digest[32];
+            util::GlobalRandomSource::Instance ().GetBytes (digest, sizeof (digest));
+            int fds[2];
+            bool result = pool->GetStats ().nonces == 4 && pipe (fds) == 0;
+            if (result) {
+                pid_t pid = fork ();
+                if (pid == 0) {
+                    close (fds[0]);
+                    util::ui8 signature[256];
+                    util::ui32 signatureLength = 0;
+                    THEKOGANS_UTIL_TRY {
+                        signatureLength = (util::ui32)pool->Sign (digest, sizeof (digest), signature);
+                    }
+                    THEKOGANS_UTIL_CATCH (util::Exception) {
+                    }
+                    if (write (fds[1], &signatureLength, sizeof (signatureLength)) !=
+                            (ssize_t)sizeof (signatureLength) ||
+                            write (fds[1], signature, signatureLength) != (ssize_t)signatureLength) {
+                        _exit (1);
+                    }
+                    _exit (0);
+                }
+                close (fds[1]);
+                util::ui8 signature[256];
+                std::size_t signatureLength = pool->Sign (digest, sizeof (digest), signature);
+                util::ui8 childSignature[256];
+                util::ui32 childSignatureLength = 0;
+                result = pid > 0 &&
+                    read (fds[0], &childSignatureLength, sizeof (childSignatureLength)) ==
+                        (ssize_t)sizeof (childSignatureLength) &&
+                    childSignatureLength > 0 && childSignatureLength <= sizeof (childSignature) &&
+                    read (fds[0], childSignature, childSignatureLength) == (ssize_t)childSignatureLength;
+                close (fds[0]);
+                int status = 0;
+                if (pid > 0) {
+                    waitpid (pid, &status, 0);
+                }
+                if (result) {
+                    std::vector<util::ui8> r = GetR (signature, signatureLength);
+                    std::vector<util::ui8> childR = GetR (childSignature, childSignatureLength);
+                    result = WIFEXITED (status) && WEXITSTATUS (status) == 0 &&
+                        !r.empty () && !childR.empty () && r != childR;
+                }
+            }
+            pool->Stop ();
+            std::cout << (result ? "pass" : "fail") << std::endl;
+            return result;
+        }
+        THEKOGANS_UTIL_CATCH (util::Exception) {
+            std::cout << "fail " << exception.Report ();
+            return false;
+        }
+    }
+#endif // !defined (TOOLCHAIN_OS_Windows)
+
+    void WriteFile (
+            const std::string &path,
+            const std::vector<util::ui8> &contents) {
+        util::SimpleFile file (
+            util::NetworkEndian,
+            path,
+            util::SimpleFile::ReadWrite |
+            util::SimpleFile::Create |
+            util::SimpleFile::Truncate);
+        file.Write (contents.data (), contents.size ());
+    }
+
+    bool TestFileManifest (crypto::AsymmetricKey::SharedPtr privateKey) {
+        THEKOGANS_UTIL_TRY {
+            std::cout << "crypto::FileManifest...";
+            const std::string path = "test_FileManifest.tmp";
+            const util::ui32 chunkSize = 64 * 1024;
+            // 16 full chunks and a partial one.
+            std::vector<util::ui8> contents (16 * chunkSize + 1234);
+            util::GlobalRandomSource::Instance ().GetBytes (contents.data (), contents.size ());
+            WriteFile (path, contents);
+            crypto::Authenticator signer (
+                privateKey,
+                crypto::MessageDigest::SharedPtr (new crypto::MessageDigest));
+            crypto::FileManifest::Create (path, signer, chunkSize)->Save (path + ".manifest");
+            crypto::FileManifest::SharedPtr manifest =
+                crypto::FileManifest::Load (path + ".manifest");
+            crypto::Authenticator verifier (
+                privateKey->GetPublicKey (),
+                crypto::MessageDigest::SharedPtr (new crypto::MessageDigest));
+            // The manifest root is the file's tree hash.
+            util::Buffer root = manifest->GetRoot ();
+            util::Buffer treeHash = crypto::MessageDigest ().HashFileTree (path, chunkSize);
+            bool result = manifest->GetHeader ().chunkCount == 17 &&
+                root.GetDataAvailableForReading () == treeHash.GetDataAvailableForReading () &&
+                memcmp (root.GetReadPtr (), treeHash.GetReadPtr (),
+                    root.GetDataAvailableForReading ()) == 0;
+            if (result) {
+                // Range verification only touches the overlapping chunks.
+                crypto::FileManifestVerifier manifestVerifier (manifest, verifier, 4);
+                result = manifestVerifier.IsSignatureValid () &&
+                    manifestVerifier.Verify (path, chunkSize + 1, chunkSize) &&
+                    manifestVerifier.GetVerifiedChunkCount () == 2 &&
+                    manifestVerifier.IsVerified (chunkSize, 2 * chunkSize) &&
+                    !manifestVerifier.IsVerified ();
+                // Resume from the saved progress.
+                if (result) {
+                    manifestVerifier.SaveProgress (path + ".progress");
+                    crypto::FileManifestVerifier resumedVerifier (manifest, verifier, 4);
+                    result = resumedVerifier.LoadProgress (path + ".progress") &&
+                        resumedVerifier.GetVerifiedChunkCount () == 2 &&
+                        resumedVerifier.Verify (path) &&
+                        resumedVerifier.GetVerifiedChunkCount () == 17 &&
+                        resumedVerifier.IsVerified ();
+                }
+            }
+            if (result) {
+                // Corrupt chunk 5. Only it should fail.
+                contents[5 * chunkSize + 17] ^= 1;
+                WriteFile (path, contents);
+                crypto::FileManifestVerifier manifestVerifier (manifest, verifier);
+                result = !manifestVerifier.Verify (path) &&
+                    manifestVerifier.GetInvalidChunks ().size () == 1 &&
+                    manifestVerifier.GetInvalidChunks ()[0] == 5 &&
+                    manifestVerifier.GetVerifiedChunkCount () == 16 &&
+                    manifestVerifier.Verify (path, 0, 5 * chunkSize);
+            }
+            if (result) {
+                // A manifest signed by a different key is rejected.
+                crypto::Authenticator otherVerifier (
+                    crypto::EC::ParamsFromNamedCurve (NID_X9_62_prime256v1)->CreateKey ()->GetPublicKey (),
+                    crypto::MessageDigest::SharedPtr (new crypto::MessageDigest));
+                crypto::FileManifestVerifier manifestVerifier (manifest, otherVerifier);
+                result = !manifestVerifier.IsSignatureValid () &&
+                    !manifestVerifier.Verify (path, 0, chunkSize);
+            }
+            std::cout << (result ? "pass" : "fail") << std::endl;
+            return result;
+        }
+        THEKOGANS_UTIL_CATCH (util::Exception) {
+            std::cout << "fail " << exception.Report ();
+            return false;
+        }
+    }
+
+    bool TestSignatureManifest (crypto::AsymmetricKey::SharedPtr privateKey) {
+        THEKOGANS_UTIL_TRY {
+            std::cout << "crypto::SignatureManifest...";
+            std::vector<std::string> paths;
+            std::vector<std::vector<util::ui8>> contents;
+            for (std::size_t i = 0; i < 8; ++i) {
+                paths.push_back ("test_SignatureManifest" + util::size_tTostring (i) + ".tmp");
+                contents.push_back (std::vector<util::ui8> (1000 * i + 1));
+                util::GlobalRandomSource::Instance ().GetBytes (
+                    contents.back ().data (), contents.back ().size ());
+                WriteFile (paths.back (), contents.back ());
+            }
+            const std::string manifestPath = "test_SignatureManifest.manifest";
+            crypto::Authenticator signer (
+                privateKey,
+                crypto::MessageDigest::SharedPtr (new crypto::MessageDigest));
+            crypto::SignatureManifest::Create (paths, signer, THEKOGANS_CRYPTO_DEFAULT_MD, 4)->Save (
+                manifestPath);
+            crypto::SignatureManifest::SharedPtr manifest =
+                crypto::SignatureManifest::Load (manifestPath);
+            crypto::Authenticator verifier (
+                privateKey->GetPublicKey (),
+                crypto::MessageDigest::SharedPtr (new crypto::MessageDigest));
+            // Batch digests match the one at a time ones.
+            bool result = manifest->GetEntries ().size () == paths.size () &&
+                manifest->Verify (verifier, 4);
+            for (std::size_t i = 0, count = paths.size (); result && i < count; ++i) {
+                const crypto::SignatureManifest::Entry &entry = manifest->GetEntries ()[i];
+                util::Buffer digest = crypto::MessageDigest ().HashFile (paths[i]);
+                result = entry.path == paths[i] &&
+                    entry.size == contents[i].size () &&
+                    entry.digest.size () == digest.GetDataAvailableForReading () &&
+                    memcmp (entry.digest.data (), digest.GetReadPtr (), entry.digest.size ()) == 0;
+            }
+            if (result) {
+                // Corrupt file 3. Only it should fail.
+                contents[3][17] ^= 1;
+                WriteFile (paths[3], contents[3]);
+                std::vector<std::string> invalidPaths;
+                result = !manifest->Verify (verifier, 4, true, &invalidPaths) &&
+                    invalidPaths.size () == 1 && invalidPaths[0] == paths[3];
+            }
+            if (result) {
+                // A manifest signed by a different key is rejected.
+                crypto::Authenticator otherVerifier (
+                    crypto::EC::ParamsFromNamedCurve (NID_X9_62_prime256v1)->CreateKey ()->GetPublicKey (),
+                    crypto::MessageDigest::SharedPtr (new crypto::MessageDigest));
+                result = !manifest->VerifySignature (otherVerifier);
+            }
+            std::cout << (result ? "pass" : "fail") << std::endl;
+            return result;
+        }
+        THEKOGANS_UTIL_CATCH (util::Exception) {
+            std::cout << "fail " << exception.Report ();
+            return false;
+        }
+    }
+
+    // Sign (Init; Update; Final) with a fresh signer.
+    util::Buffer SignOnce (
+            crypto::AsymmetricKey::SharedPtr privateKey,
+            const void *buffer,
+            std::size_t bufferLength) {
+        crypto::Signer::SharedPtr signer = crypto::Signer::Get (
+            privateKey,
+            crypto::MessageDigest::SharedPtr (new crypto::MessageDigest));
+        signer->Init ();
+        signer->Update (buffer, bufferLength);
+        return signer->Final ();
+    }
+
+    // OpenSSLSigner/OpenSSLVerifier prepare their EVP_MD_CTX once (in the
+    // ctor) and Init copies it. Reuse one signer and one verifier for many
+    // messages, including after abandoned and failed operations, and make
+    // sure every Init starts from a clean state.
+    bool TestOpenSSLSignerReuse (
+            const char *name,
+            crypto::AsymmetricKey::SharedPtr privateKey,
+            bool deterministic) {
+        THEKOGANS_UTIL_TRY {
+            std::cout << name << " reuse...";
+            crypto::Signer::SharedPtr signer = crypto::Signer::Get (
+                privateKey,
+                crypto::MessageDigest::SharedPtr (new crypto::MessageDigest));
+            crypto::Verifier::SharedPtr verifier = crypto::Verifier::Get (
+                privateKey->GetPublicKey (),
+                crypto::MessageDigest::SharedPtr (new crypto::MessageDigest));
+            util::ui8 buffer[1024];
+            util::GlobalRandomSource::Instance ().GetBytes (buffer, 1024);
+            bool result = true;
+            for (std::size_t i = 0; result && i < 8; ++i) {
+                const util::ui8 *message = buffer + i * 16;
+                std::size_t messageLength = 1 + i * 101;
+                // Abandon a signature half way through. The next Init
+                // must discard it.
+                signer->Init ();
+                signer->Update (buffer + 512, 512);
+                signer->Init ();
+                signer->Update (message, messageLength);
+                util::Buffer signature = signer->Final ();
+                // Abandon a verification half way through.
+                verifier->Init ();
+                verifier->Update (buffer + 512, 512);
+                verifier->Init ();
+                verifier->Update (message, messageLength);
+                result = verifier->Final (
+                    signature.GetReadPtr (),
+                    signature.GetDataAvailableForReading ());
+                if (result) {
+                    // A wrong message and a truncated signature must fail,
+                    // and must not leave anything behind for the next Init.
+                    verifier->Init ();
+                    verifier->Update (message, messageLength + 1);
+                    result = !verifier->Final (
+                        signature.GetReadPtr (),
+                        signature.GetDataAvailableForReading ());
+                }
+                if (result) {
+                    verifier->Init ();
+                    verifier->Update (message, messageLength);
+                    result = !verifier->Final (
+                        signature.GetReadPtr (),
+                        signature.GetDataAvailableForReading () - 1);
+                }
+                if (result) {
+                    // A fresh verifier must agree with the reused one.
+                    crypto::Verifier::SharedPtr freshVerifier = crypto::Verifier::Get (
+                        privateKey->GetPublicKey (),
+                        crypto::MessageDigest::SharedPtr (new crypto::MessageDigest));
+                    freshVerifier->Init ();
+                    freshVerifier->Update (message, messageLength);
+                    result = freshVerifier->Final (
+                        signature.GetReadPtr (),
+                        signature.GetDataAvailableForReading ());
+                }
+                if (result && deterministic) {
+                    // PKCS #1 v1.5 signatures are deterministic, so the
+                    // reused signer must produce the same bytes as a fresh one.
+                    util::Buffer freshSignature = SignOnce (privateKey, message, messageLength);
+                    result = freshSignature.GetDataAvailableForReading () ==
+                        signature.GetDataAvailableForReading () &&
+                        memcmp (
+                            freshSignature.GetReadPtr (),
+                            signature.GetReadPtr (),
+                            signature.GetDataAvailableForReading ()) == 0;
+                }
+            }
+            result = result &&
+                signer->GetStats ().GetUseCount () == 8 &&
+                verifier->GetStats ().GetUseCount () == 24;
             std::cout << (result ? "pass" : "fail") << std::endl;
             return result;
         }
@@ -79,6 +485,36 @@ TEST (thekogans, DSA) {
 
 TEST (thekogans, EC) {
     crypto::OpenSSLInit openSSLInit;
+    // Precomputed nonces (random and seeded).
+    CHECK_EQUAL (
+        TestECDSANoncePool (
+            "crypto::ECDSANoncePool",
+            crypto::EC::ParamsFromNamedCurve (NID_X9_62_prime256v1)->CreateKey (),
+            0,
+            0),
+        true);
+    const util::ui8 seed[32] = {1, 2, 3};
+    CHECK_EQUAL (
+        TestECDSANoncePool (
+            "crypto::ECDSANoncePool (seeded)",
+            crypto::EC::ParamsFromNamedCurve (NID_secp384r1)->CreateKey (),
+            seed,
+            sizeof (seed)),
+        true);
+#if !defined (TOOLCHAIN_OS_Windows)
+    CHECK_EQUAL (
+        TestECDSANoncePoolFork (
+            crypto::EC::ParamsFromNamedCurve (NID_X9_62_prime256v1)->CreateKey (),
+            0,
+            0),
+        true);
+    CHECK_EQUAL (
+        TestECDSANoncePoolFork (
+            crypto::EC::ParamsFromNamedCurve (NID_secp384r1)->CreateKey (),
+            seed,
+            sizeof (seed)),
+        true);
+#endif // !defined (TOOLCHAIN_OS_Windows)
     // Named curves
     CHECK_EQUAL (
         TestAuthenticator (
@@ -189,4 +625,250 @@ TEST (thekogans, EC) {
         true);
 }
 
+TEST (thekogans, OpenSSLSignerReuse) {
+    crypto::OpenSSLInit openSSLInit;
+    CHECK_EQUAL (
+        TestOpenSSLSignerReuse (
+            "crypto::RSA::CreateKey (1024)",
+            crypto::RSA::CreateKey (1024),
+            true),
+        true);
+    CHECK_EQUAL (
+        TestOpenSSLSignerReuse (
+            "crypto::DSA::ParamsFromKeyLength (512)->CreateKey ()",
+            crypto::DSA::ParamsFromKeyLength (512)->CreateKey (),
+            false),
+        true);
+    CHECK_EQUAL (
+        TestOpenSSLSignerReuse (
+            "crypto::EC::ParamsFromNamedCurve (NID_X9_62_prime256v1)->CreateKey ()",
+            crypto::EC::ParamsFromNamedCurve (NID_X9_62_prime256v1)->CreateKey (),
+            false),
+        true);
+}
+
+TEST (thekogans, KeyTypeId) {
+    crypto::OpenSSLInit openSSLInit;
+    crypto::AsymmetricKey::SharedPtr rsaKey = crypto::RSA::CreateKey (1024);
+    crypto::AsymmetricKey::SharedPtr ecKey =
+        crypto::EC::ParamsFromNamedCurve (NID_X9_62_prime256v1)->CreateKey ();
+    CHECK_EQUAL (rsaKey->GetKeyTypeId () ==
+        crypto::AsymmetricKey::InternKeyType (crypto::OPENSSL_PKEY_RSA), true);
+    CHECK_EQUAL (ecKey->GetKeyTypeId () ==
+        crypto::AsymmetricKey::InternKeyType (crypto::OPENSSL_PKEY_EC), true);
+    CHECK_EQUAL (rsaKey->GetKeyTypeId () != ecKey->GetKeyTypeId (), true);
+    CHECK_EQUAL (rsaKey->GetPublicKey ()->GetKeyTypeId () == rsaKey->GetKeyTypeId (), true);
+}
+
+TEST (thekogans, FileManifest) {
+    crypto::OpenSSLInit openSSLInit;
+    CHECK_EQUAL (
+        TestFileManifest (
+            crypto::EC::ParamsFromNamedCurve (NID_X9_62_prime256v1)->CreateKey ()),
+        true);
+}
+
+TEST (thekogans, VerificationCache) {
+    crypto::OpenSSLInit openSSLInit;
+    crypto::AsymmetricKey::SharedPtr privateKey =
+        crypto::EC::ParamsFromNamedCurve (NID_X9_62_prime256v1)->CreateKey ();
+    crypto::Authenticator signer (
+        privateKey,
+        crypto::MessageDigest::SharedPtr (new crypto::MessageDigest));
+    crypto::Authenticator verifier (
+        privateKey->GetPublicKey (),
+        crypto::MessageDigest::SharedPtr (new crypto::MessageDigest));
+    crypto::VerificationCache::SharedPtr cache (new crypto::VerificationCache (2));
+    verifier.SetVerificationCache (cache);
+    util::ui8 buffer[3][256];
+    util::Buffer signature[3];
+    for (std::size_t i = 0; i < 3; ++i) {
+        util::GlobalRandomSource::Instance ().GetBytes (buffer[i], 256);
+        signature[i] = signer.SignBuffer (buffer[i], 256);
+    }
+    // Miss, then hit.
+    for (std::size_t i = 0; i < 2; ++i) {
+        CHECK_EQUAL (
+            verifier.VerifyBufferSignature (
+                buffer[0], 256,
+                signature[0].GetReadPtr (),
+                signature[0].GetDataAvailableForReading ()),
+            true);
+    }
+    CHECK_EQUAL (cache->GetStats ().hits == 1, true);
+    CHECK_EQUAL (cache->GetStats ().misses == 1, true);
+    // Failed verifications are not cached.
+    for (std::size_t i = 0; i < 2; ++i) {
+        CHECK_EQUAL (
+            verifier.VerifyBufferSignature (
+                buffer[1], 256,
+                signature[0].GetReadPtr (),
+                signature[0].GetDataAvailableForReading ()),
+            false);
+    }
+    CHECK_EQUAL (cache->GetStats ().hits == 1, true);
+    CHECK_EQUAL (cache->GetStats ().size == 1, true);
+    // The cache stays within capacity.
+    for (std::size_t i = 0; i < 3; ++i) {
+        CHECK_EQUAL (
+            verifier.VerifyBufferSignature (
+                buffer[i], 256,
+                signature[i].GetReadPtr (),
+                signature[i].GetDataAvailableForReading ()),
+            true);
+    }
+    CHECK_EQUAL (cache->GetStats ().size == 2, true);
+    CHECK_EQUAL (cache->GetStats ().evictions == 1, true);
+}
+
+TEST (thekogans, VerificationCacheSharedId) {
+    crypto::OpenSSLInit openSSLInit;
+    crypto::AsymmetricKey::SharedPtr victimKey =
+        crypto::EC::ParamsFromNamedCurve (NID_X9_62_prime256v1)->CreateKey ();
+    // The attacker's key carries the victim key's id.
+    crypto::AsymmetricKey::SharedPtr attackerKey =
+        crypto::EC::ParamsFromNamedCurve (NID_X9_62_prime256v1)->CreateKey (victimKey->GetId ());
+    crypto::VerificationCache::SharedPtr cache (new crypto::VerificationCache);
+    crypto::Authenticator attackerVerifier (
+        attackerKey->GetPublicKey (victimKey->GetId ()),
+        crypto::MessageDigest::SharedPtr (new crypto::MessageDigest));
+    attackerVerifier.SetVerificationCache (cache);
+    crypto::Authenticator victimVerifier (
+        victimKey->GetPublicKey (victimKey->GetId ()),
+        crypto::MessageDigest::SharedPtr (new crypto::MessageDigest));
+    victimVerifier.SetVerificationCache (cache);
+    util::ui8 buffer[256];
+    util::GlobalRandomSource::Instance ().GetBytes (buffer, 256);
+    util::Buffer signature = crypto::Authenticator (
+        attackerKey,
+        crypto::MessageDigest::SharedPtr (new crypto::MessageDigest)).SignBuffer (buffer, 256);
+    // Cache the attacker's (valid) signature...
+    CHECK_EQUAL (
+        attackerVerifier.VerifyBufferSignature (
+            buffer, 256,
+            signature.GetReadPtr (),
+            signature.GetDataAvailableForReading ()),
+        true);
+    CHECK_EQUAL (cache->GetStats ().size == 1, true);
+    // ...it must not verify under the victim's key.
+    CHECK_EQUAL (
+        victimVerifier.VerifyBufferSignature (
+            buffer, 256,
+            signature.GetReadPtr (),
+            signature.GetDataAvailableForReading ()),
+        false);
+    CHECK_EQUAL (cache->GetStats ().hits == 0, true);
+    // A private key and it's public key share cache entries.
+    CHECK_EQUAL (
+        crypto::VerificationCache::GetKey (
+            *attackerKey,
+            crypto::MessageDigest (),
+            buffer, 256,
+            signature.GetReadPtr (),
+            signature.GetDataAvailableForReading ()) ==
+        crypto::VerificationCache::GetKey (
+            *attackerKey->GetPublicKey (attackerKey->GetId ()),
+            crypto::MessageDigest (),
+            buffer, 256,
+            signature.GetReadPtr (),
+            signature.GetDataAvailableForReading ()),
+        true);
+}
+
+TEST (thekogans, AuthenticatorVerifyBatch) {
+    crypto::OpenSSLInit openSSLInit;
+    crypto::AsymmetricKey::SharedPtr privateKeys[] = {
+        crypto::RSA::CreateKey (1024),
+        crypto::EC::ParamsFromNamedCurve (NID_X9_62_prime256v1)->CreateKey (),
+        crypto::EC::ParamsFromEd25519Curve ()->CreateKey ()
+    };
+    const std::size_t ITEM_COUNT = 12;
+    util::ui8 buffers[ITEM_COUNT][256];
+    util::Buffer signatures[ITEM_COUNT];
+    std::vector<crypto::Authenticator::BatchItem> items;
+    for (std::size_t i = 0; i < ITEM_COUNT; ++i) {
+        crypto::AsymmetricKey::SharedPtr privateKey = privateKeys[i % 3];
+        util::GlobalRandomSource::Instance ().GetBytes (buffers[i], 256);
+        signatures[i] = crypto::Authenticator (
+            privateKey,
+            crypto::MessageDigest::SharedPtr (new crypto::MessageDigest)).SignBuffer (buffers[i], 256);
+        items.push_back (
+            crypto::Authenticator::BatchItem (
+                crypto::Authenticator::SharedPtr (
+                    new crypto::Authenticator (
+                        privateKey->GetPublicKey (),
+                        crypto::MessageDigest::SharedPtr (new crypto::MessageDigest))),
+                buffers[i],
+                256,
+                signatures[i].GetReadPtr (),
+                signatures[i].GetDataAvailableForReading ()));
+    }
+    std::vector<bool> results;
+    CHECK_EQUAL (crypto::Authenticator::VerifyBatch (items, &results, 4), true);
+    CHECK_EQUAL (std::count (results.begin (), results.end (), true) == (std::ptrdiff_t)ITEM_COUNT, true);
+    // Corrupt one RSA, one ECDSA and one Ed25519 message.
+    buffers[3][0] ^= 1;
+    buffers[4][0] ^= 1;
+    buffers[5][0] ^= 1;
+    CHECK_EQUAL (crypto::Authenticator::VerifyBatch (items, &results, 4), false);
+    for (std::size_t i = 0; i < ITEM_COUNT; ++i) {
+        CHECK_EQUAL (results[i], i < 3 || i > 5);
+    }
+    CHECK_EQUAL (crypto::Authenticator::VerifyBatch (items, &results, 1, true), false);
+}
+
+TEST (thekogans, AuthenticatorPool) {
+    crypto::OpenSSLInit openSSLInit;
+    crypto::AsymmetricKey::SharedPtr privateKey =
+        crypto::EC::ParamsFromNamedCurve (NID_X9_62_prime256v1)->CreateKey ();
+    crypto::Authenticator signer (
+        privateKey,
+        crypto::MessageDigest::SharedPtr (new crypto::MessageDigest));
+    util::ui8 buffer[256];
+    util::GlobalRandomSource::Instance ().GetBytes (buffer, 256);
+    util::Buffer signature1 = signer.SignBuffer (buffer, 256);
+    util::Buffer signature2 = signer.SignBuffer (buffer, 256);
+    crypto::Authenticator::PoolStats signerStats = signer.GetPoolStats ();
+    CHECK_EQUAL (signerStats.instances == 1, true);
+    CHECK_EQUAL (signerStats.leases == 2, true);
+    CHECK_EQUAL (signerStats.misses == 0, true);
+    CHECK_EQUAL (signer.GetStats ().GetUseCount () == 2, true);
+    // Items sharing an authenticator share one leased verifier.
+    crypto::Authenticator::SharedPtr verifier (
+        new crypto::Authenticator (
+            privateKey->GetPublicKey (),
+            crypto::MessageDigest::SharedPtr (new crypto::MessageDigest)));
+    std::vector<crypto::Authenticator::BatchItem> items;
+    items.push_back (
+        crypto::Authenticator::BatchItem (
+            verifier,
+            buffer,
+            256,
+            signature1.GetReadPtr (),
+            signature1.GetDataAvailableForReading ()));
+    items.push_back (
+        crypto::Authenticator::BatchItem (
+            verifier,
+            buffer,
+            256,
+            signature2.GetReadPtr (),
+            signature2.GetDataAvailableForReading ()));
+    CHECK_EQUAL (crypto::Authenticator::VerifyBatch (items), true);
+    CHECK_EQUAL (verifier->VerifyBufferSignature (
+        buffer, 256, signature1.GetReadPtr (), signature1.GetDataAvailableForReading ()), true);
+    crypto::Authenticator::PoolStats verifierStats = verifier->GetPoolStats ();
+    CHECK_EQUAL (verifierStats.instances == 1, true);
+    CHECK_EQUAL (verifierStats.leases == 2, true);
+    CHECK_EQUAL (verifierStats.maxConcurrentLeases == 1, true);
+    CHECK_EQUAL (verifier->GetStats ().GetUseCount () == 3, true);
+}
+
+TEST (thekogans, SignatureManifest) {
+    crypto::OpenSSLInit openSSLInit;
+    CHECK_EQUAL (
+        TestSignatureManifest (
+            crypto::EC::ParamsFromNamedCurve (NID_X9_62_prime256v1)->CreateKey ()),
+        true);
+}
+
 TESTMAIN
@@ -0,0 +1,163 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <CppUnitXLite/CppUnitXLite.cpp>
+#include "thekogans/util/Types.h"
+#include "thekogans/util/Exception.h"
+#include "thekogans/crypto/BlockPipeline.h"
+#include "TestData.h"
+
+using namespace thekogans;
+using crypto::tests::MakeData;
+
+namespace {
+    const util::ui64 NO_FAIL_BLOCK = (util::ui64)-1;
+
+    // Splits input in to blocks, scrambles every block with a key
+    // stream derived from it's sequence number, and concatenates the
+    // results. Blocks take different amounts of time to process so that
+    // they complete out of order.
+    struct TestPipeline : public crypto::BlockPipeline {
+        enum {
+            BLOCK_SIZE = 1000
+        };
+
+        const std::string &input;
+        std::size_t inputOffset;
+        util::ui64 failBlock;
+        std::string output;
+        std::vector<util::ui64> writtenBlocks;
+
+        TestPipeline (
+            const std::string &input_,
+            std::size_t workerCount,
+            util::ui64 failBlock_ = NO_FAIL_BLOCK) :
+            crypto::BlockPipeline (workerCount),
+            input (input_),
+            inputOffset (0),
+            failBlock (failBlock_) {}
+
+        std::string Scramble () {
+            inputOffset = 0;
+            output.clear ();
+            writtenBlocks.clear ();
+            Run ();
+            return output;
+        }
+
+    protected:
+        // crypto::BlockPipeline
+        virtual Block::SharedPtr ReadBlock () override {
+            Block::SharedPtr block;
+            if (inputOffset < input.size ()) {
+                std::size_t length = input.size () - inputOffset;
+                if (length > BLOCK_SIZE) {
+                    length = BLOCK_SIZE;
+                }
+                block.Reset (new Block (length, length));
+                block->input.Write (input.data () + inputOffset, length);
+                inputOffset += length;
+            }
+            return block;
+        }
+
+        virtual void ProcessBlock (
+                std::size_t /*workerIndex*/,
+                Block &block) override {
+            if (block.sequenceNumber == failBlock) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "Block " THEKOGANS_UTIL_UI64_FORMAT " failed",
+                    block.sequenceNumber);
+            }
+            util::ui32 seed = (util::ui32)block.sequenceNumber + 1;
+            // Make every fourth block slower.
+            util::ui32 rounds = block.sequenceNumber % 4 == 0 ? 1000 : 1;
+            for (util::ui32 i = 0; i < rounds; ++i) {
+                seed = seed * 1664525 + 1013904223;
+            }
+            const util::ui8 *plaintext = block.input.GetReadPtr ();
+            for (std::size_t i = 0, count = block.input.GetDataAvailableForReading (); i < count; ++i) {
+                seed = seed * 1664525 + 1013904223;
+                block.output << (util::ui8)(plaintext[i] ^ (seed >> 24));
+            }
+        }
+
+        virtual void WriteBlock (Block &block) override {
+            output.append (
+                (const char *)block.output.GetReadPtr (),
+                block.output.GetDataAvailableForReading ());
+            writtenBlocks.push_back (block.sequenceNumber);
+        }
+    };
+
+    bool InOrder (const std::vector<util::ui64> &writtenBlocks) {
+        for (std::size_t i = 0, count = writtenBlocks.size (); i < count; ++i) {
+            if (writtenBlocks[i] != i) {
+                return false;
+            }
+        }
+        return true;
+    }
+}
+
+TEST (thekogans, BlockPipeline) {
+    // The last block is short.
+    std::string input = MakeData (100 * TestPipeline::BLOCK_SIZE + 10, 1);
+    TestPipeline single (input, 1);
+    std::string expected = single.Scramble ();
+    CHECK_EQUAL (
+        expected.size () == input.size () &&
+        expected != input &&
+        single.writtenBlocks.size () == 101 &&
+        InOrder (single.writtenBlocks),
+        true);
+    TestPipeline multiple (input, 4);
+    // Run more than once to make sure the pipeline can be reused.
+    for (std::size_t i = 0; i < 3; ++i) {
+        CHECK_EQUAL (
+            multiple.Scramble () == expected &&
+            InOrder (multiple.writtenBlocks),
+            true);
+    }
+}
+
+TEST (thekogans, BlockPipelineError) {
+    std::string input = MakeData (100 * TestPipeline::BLOCK_SIZE, 2);
+    TestPipeline pipeline (input, 4, 37);
+    bool thrown = false;
+    THEKOGANS_UTIL_TRY {
+        pipeline.Scramble ();
+    }
+    THEKOGANS_UTIL_CATCH (util::Exception) {
+        thrown = exception.Report ().find ("Block 37 failed") != std::string::npos;
+    }
+    // Only the blocks preceding the failed one are written.
+    CHECK_EQUAL (thrown, true);
+    CHECK_EQUAL (
+        pipeline.writtenBlocks.size () == 37 &&
+        InOrder (pipeline.writtenBlocks),
+        true);
+    // The pipeline is usable after an error.
+    pipeline.failBlock = NO_FAIL_BLOCK;
+    TestPipeline single (input, 1);
+    CHECK_EQUAL (pipeline.Scramble () == single.Scramble (), true);
+}
+
+TESTMAIN
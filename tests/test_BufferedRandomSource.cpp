@@ -0,0 +1,148 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+
+#if !defined (TOOLCHAIN_OS_Windows)
+    #include <sys/types.h>
+    #include <sys/wait.h>
+    #include <unistd.h>
+#endif // !defined (TOOLCHAIN_OS_Windows)
+#include <cstring>
+#include <string>
+#include <iostream>
+#include <CppUnitXLite/CppUnitXLite.cpp>
+#include "thekogans/util/Types.h"
+#include "thekogans/util/Exception.h"
+#include "thekogans/crypto/OpenSSLInit.h"
+#include "thekogans/crypto/BufferedRandomSource.h"
+
+using namespace thekogans;
+
+TEST (thekogans, BufferedRandomSource) {
+    crypto::OpenSSLInit openSSLInit;
+    bool result = false;
+    THEKOGANS_UTIL_TRY {
+        std::cout << "BufferedRandomSource...";
+        crypto::BufferedRandomSource &randomSource =
+            crypto::BufferedRandomSource::GetThreadInstance ();
+        crypto::BufferedRandomSource::Counters before =
+            crypto::BufferedRandomSource::GetCounters ();
+        // Straddle several refills.
+        const std::size_t LENGTH = crypto::BufferedRandomSource::REFILL_LENGTH * 3 + 17;
+        util::ui8 buffer1[LENGTH];
+        util::ui8 buffer2[LENGTH];
+        randomSource.GetBytes (buffer1, LENGTH);
+        randomSource.GetBytes (buffer2, LENGTH);
+        crypto::BufferedRandomSource::Counters after =
+            crypto::BufferedRandomSource::GetCounters ();
+        result = memcmp (buffer1, buffer2, LENGTH) != 0 &&
+            after.bytes - before.bytes >= 2 * LENGTH &&
+            after.refills - before.refills >= 6;
+        std::cout << (result ? "pass" : "fail") << std::endl;
+    }
+    THEKOGANS_UTIL_CATCH (util::Exception) {
+        std::cout << "fail " << exception.Report ();
+    }
+    CHECK_EQUAL (result, true);
+}
+
+#if !defined (TOOLCHAIN_OS_Windows)
+TEST (thekogans, BufferedRandomSourceFork) {
+    crypto::OpenSSLInit openSSLInit;
+    bool result = false;
+    THEKOGANS_UTIL_TRY {
+        std::cout << "BufferedRandomSourceFork...";
+        crypto::BufferedRandomSource &randomSource =
+            crypto::BufferedRandomSource::GetThreadInstance ();
+        // Make sure there are buffered bytes to inherit.
+        util::ui8 buffer[32];
+        randomSource.GetBytes (buffer, sizeof (buffer));
+        int fds[2];
+        if (pipe (fds) == 0) {
+            pid_t pid = fork ();
+            if (pid == 0) {
+                close (fds[0]);
+                util::ui8 childBuffer[32];
+                crypto::BufferedRandomSource::GetThreadInstance ().GetBytes (
+                    childBuffer, sizeof (childBuffer));
+                _exit (write (fds[1], childBuffer, sizeof (childBuffer)) ==
+                    (ssize_t)sizeof (childBuffer) ? 0 : 1);
+            }
+            close (fds[1]);
+            randomSource.GetBytes (buffer, sizeof (buffer));
+            util::ui8 childBuffer[32];
+            result = pid > 0 &&
+                read (fds[0], childBuffer, sizeof (childBuffer)) == (ssize_t)sizeof (childBuffer) &&
+                memcmp (buffer, childBuffer, sizeof (buffer)) != 0;
+            close (fds[0]);
+            if (pid > 0) {
+                int status = 0;
+                waitpid (pid, &status, 0);
+                result = result && WIFEXITED (status) && WEXITSTATUS (status) == 0;
+            }
+        }
+        std::cout << (result ? "pass" : "fail") << std::endl;
+    }
+    THEKOGANS_UTIL_CATCH (util::Exception) {
+        std::cout << "fail " << exception.Report ();
+    }
+    CHECK_EQUAL (result, true);
+}
+#endif // !defined (TOOLCHAIN_OS_Windows)
+
+namespace {
+    struct SeedCallback : public crypto::OpenSSLInit::SeedCallback {
+        bool called;
+        bool succeeded;
+
+        SeedCallback () :
+            called (false),
+            succeeded (false) {}
+
+        virtual void OnSeeded (const std::string &error) throw () override {
+            called = true;
+            succeeded = error.empty ();
+        }
+    };
+}
+
+TEST (thekogans, AsyncSeed) {
+    crypto::OpenSSLInit openSSLInit (
+        true,
+        crypto::OpenSSLInit::DEFAULT_ENTROPY_NEEDED,
+        crypto::OpenSSLInit::DEFAULT_WORKING_SET_SIZE,
+        0,
+        0,
+        0,
+        true);
+    bool result = false;
+    THEKOGANS_UTIL_TRY {
+        std::cout << "AsyncSeed...";
+        crypto::OpenSSLInit::WaitForSeed ();
+        // Seeding is done so the callback is called right away.
+        SeedCallback::SharedPtr callback (new SeedCallback);
+        crypto::OpenSSLInit::AddSeedCallback (callback);
+        result = crypto::OpenSSLInit::IsSeeded () && callback->called && callback->succeeded;
+        std::cout << (result ? "pass" : "fail") << std::endl;
+    }
+    THEKOGANS_UTIL_CATCH (util::Exception) {
+        std::cout << "fail " << exception.Report ();
+    }
+    CHECK_EQUAL (result, true);
+}
+
+TESTMAIN
@@ -15,13 +15,30 @@
 // You should have received a copy of the GNU General Public License
 // along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
 
+#include <cstring>
+#include <algorithm>
 #include <string>
+#include <vector>
 #include <iostream>
 #include <CppUnitXLite/CppUnitXLite.cpp>
 #include "thekogans/util/Buffer.h"
 #include "thekogans/crypto/OpenSSLInit.h"
 #include "thekogans/crypto/SymmetricKey.h"
+#include "thekogans/crypto/OpenSSLUtils.h"
 #include "thekogans/crypto/Cipher.h"
+#include "thekogans/crypto/CipherKeySchedule.h"
+#include "thekogans/crypto/CipherPool.h"
+#include "thekogans/crypto/CipherSuite.h"
+#include "thekogans/crypto/KeyRing.h"
+#include "thekogans/crypto/FrameDecoder.h"
+#include "thekogans/crypto/RecordCoalescer.h"
+#include "thekogans/crypto/TypedCipher.h"
+#include "thekogans/crypto/BufferPoolAllocator.h"
+#include "thekogans/crypto/ThreadCacheAllocator.h"
+#include "thekogans/crypto/AsyncEngine.h"
+#include "thekogans/crypto/RekeyingCipher.h"
+#include "thekogans/crypto/Trace.h"
+#include "thekogans/crypto/Metrics.h"
 
 using namespace thekogans;
 
@@ -64,6 +81,135 @@ namespace {
             return false;
         }
     }
+
+    bool TestCipherSegments (
+            const char *name,
+            crypto::Cipher &cipher,
+            const void *plaintext,
+            std::size_t plaintextLength,
+            const void *associatedData = 0,
+            std::size_t associatedDataLength = 0) {
+        THEKOGANS_UTIL_TRY {
+            std::cout << name << "...";
+            // Split the plaintext and associated data in to
+            // three segments each. Scatter the ciphertext in
+            // to deliberately odd sized segments.
+            std::size_t third = plaintextLength / 3;
+            crypto::Cipher::ConstSegment plaintextSegments[] = {
+                crypto::Cipher::ConstSegment (plaintext, third),
+                crypto::Cipher::ConstSegment ((const util::ui8 *)plaintext + third, third),
+                crypto::Cipher::ConstSegment (
+                    (const util::ui8 *)plaintext + 2 * third,
+                    plaintextLength - 2 * third)
+            };
+            std::size_t associatedDataThird = associatedDataLength / 3;
+            crypto::Cipher::ConstSegment associatedDataSegments[] = {
+                crypto::Cipher::ConstSegment (associatedData, associatedDataThird),
+                crypto::Cipher::ConstSegment (
+                    (const util::ui8 *)associatedData + associatedDataThird,
+                    associatedDataThird),
+                crypto::Cipher::ConstSegment (
+                    (const util::ui8 *)associatedData + 2 * associatedDataThird,
+                    associatedDataLength - 2 * associatedDataThird)
+            };
+            util::Buffer ciphertext (
+                util::NetworkEndian,
+                crypto::Cipher::GetMaxBufferLength (plaintextLength));
+            crypto::Cipher::Segment ciphertextSegments[] = {
+                crypto::Cipher::Segment (ciphertext.GetWritePtr (), 5),
+                crypto::Cipher::Segment (ciphertext.GetWritePtr () + 5, 13),
+                crypto::Cipher::Segment (
+                    ciphertext.GetWritePtr () + 18,
+                    ciphertext.GetDataAvailableForWriting () - 18)
+            };
+            ciphertext.AdvanceWriteOffset (
+                cipher.Encrypt (
+                    plaintextSegments,
+                    3,
+                    associatedData != 0 ? associatedDataSegments : 0,
+                    associatedData != 0 ? 3 : 0,
+                    ciphertextSegments,
+                    3));
+            util::Buffer decryptedPlaintext = cipher.Decrypt (
+                ciphertext.GetReadPtr (),
+                ciphertext.GetDataAvailableForReading (),
+                associatedData,
+                associatedDataLength);
+            std::string expected (
+                (const char *)plaintext,
+                (const char *)plaintext + plaintextLength);
+            bool result = expected ==
+                std::string (
+                    decryptedPlaintext.GetReadPtr (),
+                    decryptedPlaintext.GetReadPtrEnd ());
+            // Segmented Decrypt: odd sized ciphertext and plaintext segments
+            // (blocks and the tag/mac straddle segment boundaries).
+            crypto::Cipher::ConstSegment ciphertextReadSegments[] = {
+                crypto::Cipher::ConstSegment (ciphertext.GetReadPtr (), 7),
+                crypto::Cipher::ConstSegment (ciphertext.GetReadPtr () + 7, 11),
+                crypto::Cipher::ConstSegment (
+                    ciphertext.GetReadPtr () + 18,
+                    ciphertext.GetDataAvailableForReading () - 18)
+            };
+            std::vector<util::ui8> segmentedPlaintext (ciphertext.GetDataAvailableForReading ());
+            crypto::Cipher::Segment plaintextWriteSegments[] = {
+                crypto::Cipher::Segment (&segmentedPlaintext[0], 3),
+                crypto::Cipher::Segment (&segmentedPlaintext[3], 10),
+                crypto::Cipher::Segment (&segmentedPlaintext[13], segmentedPlaintext.size () - 13)
+            };
+            segmentedPlaintext.resize (
+                cipher.Decrypt (
+                    ciphertextReadSegments,
+                    3,
+                    associatedData != 0 ? associatedDataSegments : 0,
+                    associatedData != 0 ? 3 : 0,
+                    plaintextWriteSegments,
+                    3));
+            result = result &&
+                expected == std::string (segmentedPlaintext.begin (), segmentedPlaintext.end ());
+            // Segmented EncryptAndFrame, the FrameHeader straddles segments too.
+            util::Buffer frame (
+                util::NetworkEndian,
+                crypto::FrameHeader::SIZE + crypto::Cipher::GetMaxBufferLength (plaintextLength));
+            crypto::Cipher::Segment frameSegments[] = {
+                crypto::Cipher::Segment (frame.GetWritePtr (), 2),
+                crypto::Cipher::Segment (frame.GetWritePtr () + 2, 21),
+                crypto::Cipher::Segment (
+                    frame.GetWritePtr () + 23,
+                    frame.GetDataAvailableForWriting () - 23)
+            };
+            frame.AdvanceWriteOffset (
+                cipher.EncryptAndFrame (
+                    plaintextSegments,
+                    3,
+                    associatedData != 0 ? associatedDataSegments : 0,
+                    associatedData != 0 ? 3 : 0,
+                    frameSegments,
+                    3));
+            crypto::FrameHeader frameHeader;
+            frame >> frameHeader;
+            result = result &&
+                frameHeader.keyId == cipher.GetKey ()->GetId () &&
+                frameHeader.ciphertextLength == frame.GetDataAvailableForReading ();
+            if (result) {
+                util::Buffer framedPlaintext = cipher.Decrypt (
+                    frame.GetReadPtr (),
+                    frame.GetDataAvailableForReading (),
+                    associatedData,
+                    associatedDataLength);
+                result = expected ==
+                    std::string (
+                        framedPlaintext.GetReadPtr (),
+                        framedPlaintext.GetReadPtrEnd ());
+            }
+            std::cout << (result ? "pass" : "fail") << std::endl;
+            return result;
+        }
+        THEKOGANS_UTIL_CATCH (util::Exception) {
+            std::cout << "fail " << exception.Report ();
+            return false;
+        }
+    }
 }
 
 TEST (thekogans, CBC) {
@@ -105,4 +251,1411 @@ TEST (thekogans, GCM) {
         true);
 }
 
+#if defined (THEKOGANS_CRYPTO_HAVE_CHACHA20_POLY1305)
+TEST (thekogans, ChaCha20Poly1305) {
+    crypto::OpenSSLInit openSSLInit;
+    crypto::Cipher cipher (
+        crypto::SymmetricKey::FromSecretAndSalt (
+            password.c_str (),
+            password.size (),
+            0,
+            0,
+            crypto::GetCipherKeyLength (EVP_chacha20_poly1305 ())),
+        EVP_chacha20_poly1305 ());
+    CHECK_EQUAL (
+        TestCipher (
+            "ChaCha20-Poly1305",
+            cipher,
+            message.c_str (),
+            message.size (),
+            associatedData.c_str (),
+            associatedData.size ()),
+        true);
+}
+#endif // defined (THEKOGANS_CRYPTO_HAVE_CHACHA20_POLY1305)
+
+TEST (thekogans, FetchCipher) {
+    crypto::OpenSSLInit openSSLInit;
+    const EVP_CIPHER *fetched = crypto::OpenSSLInit::FetchCipher (EVP_aes_256_gcm ());
+    bool result = fetched != 0 &&
+        fetched == crypto::OpenSSLInit::FetchCipher (EVP_aes_256_gcm ()) &&
+        EVP_CIPHER_nid (fetched) == EVP_CIPHER_nid (EVP_aes_256_gcm ());
+    if (result) {
+        crypto::OpenSSLInit::SetPropertyQuery ("provider=default");
+        crypto::Cipher cipher (
+            crypto::SymmetricKey::FromSecretAndSalt (
+                password.c_str (),
+                password.size (),
+                0,
+                0,
+                crypto::GetCipherKeyLength ()));
+        result = TestCipher (
+            "FetchCipher",
+            cipher,
+            message.c_str (),
+            message.size (),
+            associatedData.c_str (),
+            associatedData.size ());
+        crypto::OpenSSLInit::SetPropertyQuery (std::string ());
+    }
+    CHECK_EQUAL (result, true);
+}
+
+TEST (thekogans, InPlace) {
+    crypto::OpenSSLInit openSSLInit;
+    crypto::Cipher cipher (
+        crypto::SymmetricKey::FromSecretAndSalt (
+            password.c_str (),
+            password.size (),
+            0,
+            0,
+            crypto::GetCipherKeyLength ()));
+    bool result = false;
+    THEKOGANS_UTIL_TRY {
+        std::cout << "InPlace...";
+        std::size_t headroom = cipher.GetInPlaceHeadroom ();
+        util::Buffer buffer (
+            util::NetworkEndian,
+            headroom + message.size () + cipher.GetInPlaceTailroom ());
+        memcpy (buffer.GetWritePtr () + headroom, message.c_str (), message.size ());
+        std::size_t ciphertextLength = cipher.EncryptInPlace (
+            buffer.GetWritePtr (),
+            buffer.GetDataAvailableForWriting (),
+            message.size (),
+            associatedData.c_str (),
+            associatedData.size ());
+        util::ui8 *plaintext = 0;
+        std::size_t plaintextLength = cipher.DecryptInPlace (
+            buffer.GetWritePtr (),
+            ciphertextLength,
+            associatedData.c_str (),
+            associatedData.size (),
+            plaintext);
+        result = message == std::string (
+            (const char *)plaintext,
+            (const char *)plaintext + plaintextLength);
+        std::cout << (result ? "pass" : "fail") << std::endl;
+    }
+    THEKOGANS_UTIL_CATCH (util::Exception) {
+        std::cout << "fail " << exception.Report ();
+    }
+    CHECK_EQUAL (result, true);
+}
+
+TEST (thekogans, CBCInterleave) {
+    crypto::OpenSSLInit openSSLInit;
+    bool result = true;
+    THEKOGANS_UTIL_TRY {
+        std::cout << "CBCInterleave...";
+        crypto::Cipher cipher (
+            crypto::SymmetricKey::FromSecretAndSalt (
+                password.c_str (),
+                password.size (),
+                0,
+                0,
+                crypto::GetCipherKeyLength (EVP_aes_256_cbc ())),
+            EVP_aes_256_cbc ());
+        // Encrypt-then-MAC works on 4096 byte pieces. Hit both sides
+        // of every piece (and block) boundary.
+        const std::size_t lengths[] = {
+            1, 15, 16, 17, 4095, 4096, 4097, 8191, 8192, 8193, 3 * 4096 + 5
+        };
+        for (std::size_t i = 0; result && i < sizeof (lengths) / sizeof (lengths[0]); ++i) {
+            std::vector<util::ui8> plaintext (lengths[i]);
+            for (std::size_t j = 0; j < plaintext.size (); ++j) {
+                plaintext[j] = (util::ui8)(j * 31 + 7);
+            }
+            // Decrypt verifies the mac over the whole iv + ciphertext
+            // in one go, so a round trip checks the interleaved mac.
+            util::Buffer ciphertext = cipher.Encrypt (&plaintext[0], plaintext.size ());
+            util::Buffer decrypted = cipher.Decrypt (
+                ciphertext.GetReadPtr (),
+                ciphertext.GetDataAvailableForReading ());
+            result = decrypted.GetDataAvailableForReading () == plaintext.size () &&
+                memcmp (decrypted.GetReadPtr (), &plaintext[0], plaintext.size ()) == 0;
+            // In place (the plaintext and ciphertext pieces overlap).
+            std::size_t headroom = cipher.GetInPlaceHeadroom ();
+            std::vector<util::ui8> buffer (
+                headroom + plaintext.size () + cipher.GetInPlaceTailroom ());
+            memcpy (&buffer[headroom], &plaintext[0], plaintext.size ());
+            std::size_t ciphertextLength = cipher.EncryptInPlace (
+                &buffer[0], buffer.size (), plaintext.size ());
+            util::ui8 *inPlacePlaintext = 0;
+            std::size_t inPlacePlaintextLength = cipher.DecryptInPlace (
+                &buffer[0], ciphertextLength, 0, 0, inPlacePlaintext);
+            result = result &&
+                inPlacePlaintextLength == plaintext.size () &&
+                memcmp (inPlacePlaintext, &plaintext[0], plaintext.size ()) == 0;
+            // Flip a bit in the last block of the first piece.
+            std::size_t offset = crypto::CiphertextHeader::SIZE +
+                crypto::GetCipherIVLength (EVP_aes_256_cbc ()) +
+                std::min (plaintext.size (), (std::size_t)4095);
+            ciphertext.GetReadPtr ()[offset] ^= 1;
+            try {
+                cipher.Decrypt (
+                    ciphertext.GetReadPtr (),
+                    ciphertext.GetDataAvailableForReading ());
+                result = false;
+            }
+            catch (...) {
+            }
+        }
+        std::cout << (result ? "pass" : "fail") << std::endl;
+    }
+    THEKOGANS_UTIL_CATCH (util::Exception) {
+        std::cout << "fail " << exception.Report ();
+        result = false;
+    }
+    CHECK_EQUAL (result, true);
+}
+
+TEST (thekogans, Segments) {
+    crypto::OpenSSLInit openSSLInit;
+    crypto::Cipher cbc (
+        crypto::SymmetricKey::FromSecretAndSalt (
+            password.c_str (),
+            password.size (),
+            0,
+            0,
+            crypto::GetCipherKeyLength (EVP_aes_256_cbc ())),
+        EVP_aes_256_cbc ());
+    CHECK_EQUAL (
+        TestCipherSegments (
+            "CBCSegments",
+            cbc,
+            message.c_str (),
+            message.size ()),
+        true);
+    crypto::Cipher gcm (
+        crypto::SymmetricKey::FromSecretAndSalt (
+            password.c_str (),
+            password.size (),
+            0,
+            0,
+            crypto::GetCipherKeyLength ()));
+    CHECK_EQUAL (
+        TestCipherSegments (
+            "GCMSegments",
+            gcm,
+            message.c_str (),
+            message.size (),
+            associatedData.c_str (),
+            associatedData.size ()),
+        true);
+}
+
+TEST (thekogans, CounterIV) {
+    crypto::OpenSSLInit openSSLInit;
+    crypto::Cipher cipher (
+        crypto::SymmetricKey::FromSecretAndSalt (
+            password.c_str (),
+            password.size (),
+            0,
+            0,
+            crypto::GetCipherKeyLength ()),
+        THEKOGANS_CRYPTO_DEFAULT_CIPHER,
+        THEKOGANS_CRYPTO_DEFAULT_MD,
+        crypto::Encryptor::IV_POLICY_COUNTER);
+    CHECK_EQUAL (
+        TestCipher (
+            "CounterIV",
+            cipher,
+            message.c_str (),
+            message.size (),
+            associatedData.c_str (),
+            associatedData.size ()),
+        true);
+    bool result = false;
+    THEKOGANS_UTIL_TRY {
+        std::cout << "CBCCounterIV...";
+        crypto::Cipher cbc (
+            crypto::SymmetricKey::FromSecretAndSalt (
+                password.c_str (),
+                password.size (),
+                0,
+                0,
+                crypto::GetCipherKeyLength (EVP_aes_256_cbc ())),
+            EVP_aes_256_cbc (),
+            THEKOGANS_CRYPTO_DEFAULT_MD,
+            crypto::Encryptor::IV_POLICY_COUNTER);
+        std::cout << "fail" << std::endl;
+    }
+    THEKOGANS_UTIL_CATCH (util::Exception) {
+        // CBC requires unpredictable ivs.
+        result = true;
+        std::cout << "pass" << std::endl;
+    }
+    CHECK_EQUAL (result, true);
+}
+
+TEST (thekogans, CounterIVSharedKey) {
+    crypto::OpenSSLInit openSSLInit;
+    crypto::SymmetricKey::SharedPtr key = crypto::SymmetricKey::FromRandom ();
+    // Two ciphers (ex: two CipherPool leases) on one key draw
+    // their ivs from the key's sequence, so they never collide.
+    crypto::Cipher cipher1 (
+        key,
+        THEKOGANS_CRYPTO_DEFAULT_CIPHER,
+        THEKOGANS_CRYPTO_DEFAULT_MD,
+        crypto::Encryptor::IV_POLICY_COUNTER);
+    crypto::Cipher cipher2 (
+        key,
+        THEKOGANS_CRYPTO_DEFAULT_CIPHER,
+        THEKOGANS_CRYPTO_DEFAULT_MD,
+        crypto::Encryptor::IV_POLICY_COUNTER);
+    std::vector<std::string> ivs;
+    bool result = true;
+    for (std::size_t i = 0; result && i < 64; ++i) {
+        crypto::Cipher &cipher = i % 2 == 0 ? cipher1 : cipher2;
+        util::Buffer ciphertext = cipher.Encrypt (message.c_str (), message.size ());
+        crypto::CiphertextHeader header;
+        ciphertext >> header;
+        ivs.push_back (
+            std::string ((const char *)ciphertext.GetReadPtr (), header.ivLength));
+        util::Buffer plaintext =
+            (i % 2 == 0 ? cipher2 : cipher1).Decrypt (
+                ciphertext.GetReadPtr () - crypto::CiphertextHeader::SIZE,
+                ciphertext.GetDataAvailableForReading () + crypto::CiphertextHeader::SIZE);
+        result = plaintext.GetDataAvailableForReading () == message.size () &&
+            memcmp (plaintext.GetReadPtr (), message.c_str (), message.size ()) == 0;
+    }
+    CHECK_EQUAL (result, true);
+    std::sort (ivs.begin (), ivs.end ());
+    CHECK_EQUAL (std::unique (ivs.begin (), ivs.end ()) == ivs.end (), true);
+    CHECK_EQUAL (key->GetIVCounter () == 64, true);
+}
+
+TEST (thekogans, CipherPool) {
+    crypto::OpenSSLInit openSSLInit;
+    crypto::CipherPool cipherPool (
+        crypto::SymmetricKey::FromSecretAndSalt (
+            password.c_str (),
+            password.size (),
+            0,
+            0,
+            crypto::GetCipherKeyLength ()),
+        THEKOGANS_CRYPTO_DEFAULT_CIPHER,
+        THEKOGANS_CRYPTO_DEFAULT_MD,
+        2);
+    bool result = false;
+    {
+        crypto::CipherPool::Lease cipher1 (cipherPool);
+        crypto::CipherPool::Lease cipher2 (cipherPool);
+        result = &*cipher1 != &*cipher2 &&
+            TestCipher (
+                "CipherPool",
+                *cipher1,
+                message.c_str (),
+                message.size (),
+                associatedData.c_str (),
+                associatedData.size ());
+    }
+    {
+        // Released ciphers are reused.
+        crypto::CipherPool::Lease cipher (cipherPool);
+    }
+    crypto::CipherPool::Stats stats = cipherPool.GetStats ();
+    CHECK_EQUAL (result && stats.ciphers == 2 && stats.leases == 3, true);
+}
+
+TEST (thekogans, CipherPoolAEADNoMD) {
+    crypto::OpenSSLInit openSSLInit;
+    bool result = false;
+    THEKOGANS_UTIL_TRY {
+        // AEAD suites don't need (or use) a message digest.
+        crypto::CipherPool cipherPool (
+            crypto::SymmetricKey::FromSecretAndSalt (
+                password.c_str (),
+                password.size (),
+                0,
+                0,
+                crypto::GetCipherKeyLength (EVP_aes_256_gcm ())),
+            EVP_aes_256_gcm (),
+            0,
+            1);
+        crypto::CipherPool::Lease cipher (cipherPool);
+        result = TestCipher (
+            "CipherPoolAEADNoMD",
+            *cipher,
+            message.c_str (),
+            message.size (),
+            associatedData.c_str (),
+            associatedData.size ());
+        // CBC suites still do.
+        try {
+            crypto::CipherPool cbcPool (
+                crypto::SymmetricKey::FromSecretAndSalt (
+                    password.c_str (),
+                    password.size (),
+                    0,
+                    0,
+                    crypto::GetCipherKeyLength (EVP_aes_256_cbc ())),
+                EVP_aes_256_cbc (),
+                0,
+                1);
+            result = false;
+        }
+        catch (...) {
+        }
+    }
+    THEKOGANS_UTIL_CATCH (util::Exception) {
+        std::cout << "fail " << exception.Report ();
+        result = false;
+    }
+    CHECK_EQUAL (result, true);
+}
+
+TEST (thekogans, Stats) {
+    crypto::OpenSSLInit openSSLInit;
+    crypto::Cipher cipher (
+        crypto::SymmetricKey::FromSecretAndSalt (
+            password.c_str (),
+            password.size (),
+            0,
+            0,
+            crypto::GetCipherKeyLength ()));
+    cipher.EnableStatsLatency (true);
+    bool result = TestCipher (
+        "Stats",
+        cipher,
+        message.c_str (),
+        message.size (),
+        associatedData.c_str (),
+        associatedData.size ());
+    const crypto::Stats &stats = cipher.GetEncryptorStats ();
+    util::ui64 buckets[crypto::Stats::LATENCY_BUCKET_COUNT];
+    CHECK_EQUAL (
+        result &&
+        stats.GetUseCount () > 0 &&
+        stats.GetMinByteCount () <= stats.GetMaxByteCount () &&
+        stats.GetTotalByteCount () >= message.size () &&
+        stats.GetLatencyHistogram (buckets) == 1 &&
+        stats.ToJSON ().find ("\"Latency\"") != std::string::npos,
+        true);
+}
+
+TEST (thekogans, StatsLazy) {
+    // An unused Stats doesn't carry it's shards (or histogram) around.
+    crypto::Stats stats;
+    util::ui64 buckets[crypto::Stats::LATENCY_BUCKET_COUNT];
+    bool result = sizeof (crypto::Stats) <= 64 &&
+        stats.GetUseCount () == 0 &&
+        stats.GetMinByteCount () == 0 &&
+        stats.GetMaxByteCount () == 0 &&
+        stats.GetLatencyHistogram (buckets) == 0 &&
+        stats.GetLatencyPercentile (99.0) == 0;
+    stats.Reset ();
+    stats.Update (16);
+    stats.Update (32);
+    stats.EnableLatency (true);
+    stats.UpdateLatency (1000);
+    result = result &&
+        stats.GetUseCount () == 2 &&
+        stats.GetMinByteCount () == 16 &&
+        stats.GetMaxByteCount () == 32 &&
+        stats.GetTotalByteCount () == 48 &&
+        stats.GetLatencyHistogram (buckets) == 1;
+    stats.Reset ();
+    CHECK_EQUAL (
+        result &&
+        stats.GetUseCount () == 0 &&
+        stats.GetLatencyHistogram (buckets) == 0,
+        true);
+}
+
+TEST (thekogans, Trace) {
+    crypto::OpenSSLInit openSSLInit;
+    std::cout << "Trace...";
+    crypto::RingBufferTraceSink::SharedPtr sink (new crypto::RingBufferTraceSink (4));
+    crypto::Trace::SetSink (sink);
+    {
+        crypto::Trace::Scope scope (
+            crypto::Trace::OPERATION_ENCRYPT,
+            crypto::ID (),
+            crypto::CipherSuite::Strongest.GetCode (),
+            message.size ());
+    }
+    bool result = sink->GetEvents ().size () == 2;
+    {
+        // Wrap around the ring (2 + 4 events, 4 kept).
+        crypto::Trace::Scope scope1 (crypto::Trace::OPERATION_SIGN, crypto::ID (), 0, 0);
+        crypto::Trace::Scope scope2 (crypto::Trace::OPERATION_VERIFY, crypto::ID (), 0, 0);
+    }
+    crypto::Trace::SetSink (crypto::Trace::Sink::SharedPtr ());
+    {
+        crypto::Trace::Scope scope (crypto::Trace::OPERATION_KDF, crypto::ID (), 0, 0);
+    }
+    std::vector<crypto::Trace::Event> events = sink->GetEvents ();
+    std::string chromeTrace = sink->ToChromeTrace ();
+    result = result &&
+        !crypto::Trace::IsEnabled () &&
+        events.size () == 4 &&
+        sink->GetDroppedCount () == 2 &&
+        events[0].operation == crypto::Trace::OPERATION_SIGN &&
+        events[0].phase == crypto::Trace::PHASE_BEGIN &&
+        events[3].operation == crypto::Trace::OPERATION_SIGN &&
+        events[3].phase == crypto::Trace::PHASE_END &&
+        chromeTrace.find ("\"traceEvents\"") != std::string::npos &&
+        chromeTrace.find ("\"name\":\"Verify\"") != std::string::npos &&
+        chromeTrace.find ("\"name\":\"KDF\"") == std::string::npos;
+    std::cout << (result ? "pass" : "fail") << std::endl;
+    CHECK_EQUAL (result, true);
+}
+
+TEST (thekogans, Metrics) {
+    crypto::OpenSSLInit openSSLInit;
+    bool result = false;
+    THEKOGANS_UTIL_TRY {
+        std::cout << "Metrics...";
+        crypto::KeyRing::SharedPtr keyRing (
+            new crypto::KeyRing (crypto::CipherSuite::Strongest));
+        crypto::SymmetricKey::SharedPtr key1 =
+            crypto::SymmetricKey::FromRandom (
+                crypto::SymmetricKey::MIN_RANDOM_LENGTH,
+                0,
+                0,
+                crypto::GetCipherKeyLength (
+                    crypto::CipherSuite::Strongest.GetOpenSSLCipher ()));
+        crypto::SymmetricKey::SharedPtr key2 =
+            crypto::SymmetricKey::FromRandom (
+                crypto::SymmetricKey::MIN_RANDOM_LENGTH,
+                0,
+                0,
+                crypto::GetCipherKeyLength (
+                    crypto::CipherSuite::Strongest.GetOpenSSLCipher ()));
+        keyRing->AddCipherKey (key1);
+        keyRing->AddCipherKey (key2);
+        keyRing->GetCipher (key1->GetId ())->Encrypt (message.c_str (), message.size ());
+        keyRing->GetCipher (key2->GetId ())->Encrypt (message.c_str (), message.size ());
+        keyRing->GetCipher (key2->GetId ())->Encrypt (message.c_str (), message.size ());
+        std::vector<crypto::Metrics::Sample> keys = crypto::Metrics::GetSnapshot ();
+        std::size_t key2Count = 0;
+        for (std::size_t i = 0, count = keys.size (); i < count; ++i) {
+            if (keys[i].keyId == key2->GetId ()) {
+                key2Count = keys[i].counts[crypto::Metrics::OPERATION_ENCRYPT];
+            }
+        }
+        std::vector<crypto::Metrics::Sample> rings =
+            crypto::Metrics::GetSnapshot (crypto::Metrics::GROUP_BY_RING);
+        util::ui64 ringCount = 0;
+        util::ui64 ringByteCount = 0;
+        for (std::size_t i = 0, count = rings.size (); i < count; ++i) {
+            if (rings[i].ringId == keyRing->GetId ()) {
+                ringCount = rings[i].counts[crypto::Metrics::OPERATION_ENCRYPT];
+                ringByteCount = rings[i].byteCounts[crypto::Metrics::OPERATION_ENCRYPT];
+            }
+        }
+        std::string openMetrics = crypto::Metrics::ToOpenMetrics ();
+        result = key2Count == 2 &&
+            ringCount == 3 &&
+            ringByteCount == 3 * message.size () &&
+            openMetrics.find ("thekogans_crypto_operations_total{") != std::string::npos &&
+            openMetrics.find (keyRing->GetId ().ToHexString ()) != std::string::npos &&
+            openMetrics.find ("# EOF") != std::string::npos;
+    }
+    THEKOGANS_UTIL_CATCH (util::Exception) {
+        std::cout << exception.Report ();
+    }
+    std::cout << (result ? "pass" : "fail") << std::endl;
+    CHECK_EQUAL (result, true);
+}
+
+TEST (thekogans, FrameDecoder) {
+    crypto::OpenSSLInit openSSLInit;
+    bool result = false;
+    THEKOGANS_UTIL_TRY {
+        std::cout << "FrameDecoder...";
+        crypto::KeyRing::SharedPtr keyRing (
+            new crypto::KeyRing (crypto::CipherSuite::Strongest));
+        crypto::SymmetricKey::SharedPtr key =
+            crypto::SymmetricKey::FromSecretAndSalt (
+                password.c_str (),
+                password.size (),
+                0,
+                0,
+                crypto::GetCipherKeyLength (
+                    crypto::CipherSuite::Strongest.GetOpenSSLCipher ()));
+        keyRing->AddCipherKey (key);
+        crypto::Cipher::SharedPtr cipher = keyRing->GetCipher (key->GetId ());
+        util::Buffer frame1 = cipher->EncryptAndFrame (message.c_str (), message.size ());
+        util::Buffer frame2 = cipher->EncryptAndFrame (
+            associatedData.c_str (), associatedData.size ());
+        std::string stream (
+            frame1.GetReadPtr (), frame1.GetReadPtrEnd ());
+        stream.append (frame2.GetReadPtr (), frame2.GetReadPtrEnd ());
+        crypto::FrameDecoder frameDecoder (keyRing);
+        std::vector<std::string> plaintexts;
+        // Trickle the stream in one byte at a time.
+        for (std::size_t i = 0; i < stream.size (); ++i) {
+            frameDecoder.Feed (&stream[i], 1);
+            crypto::FrameDecoder::Frame frame;
+            while (frameDecoder.Next (frame)) {
+                plaintexts.push_back (
+                    std::string (
+                        (const char *)frame.plaintext,
+                        (const char *)frame.plaintext + frame.plaintextLength));
+            }
+        }
+        result = plaintexts.size () == 2 &&
+            plaintexts[0] == message &&
+            plaintexts[1] == associatedData &&
+            frameDecoder.GetDataAvailable () == 0;
+        std::cout << (result ? "pass" : "fail") << std::endl;
+    }
+    THEKOGANS_UTIL_CATCH (util::Exception) {
+        std::cout << "fail " << exception.Report ();
+    }
+    CHECK_EQUAL (result, true);
+}
+
+TEST (thekogans, FrameDecoderPreAuth) {
+    crypto::OpenSSLInit openSSLInit;
+    bool result = false;
+    THEKOGANS_UTIL_TRY {
+        std::cout << "FrameDecoderPreAuth...";
+        crypto::KeyRing::SharedPtr keyRing (
+            new crypto::KeyRing (crypto::CipherSuite::Strongest));
+        crypto::SymmetricKey::SharedPtr key =
+            crypto::SymmetricKey::FromSecretAndSalt (
+                password.c_str (),
+                password.size (),
+                0,
+                0,
+                crypto::GetCipherKeyLength (
+                    crypto::CipherSuite::Strongest.GetOpenSSLCipher ()));
+        keyRing->AddCipherKey (key);
+        crypto::Cipher::SharedPtr cipher = keyRing->GetCipher (key->GetId ());
+        util::Buffer frame = cipher->EncryptAndFrame (message.c_str (), message.size ());
+        std::string stream (frame.GetReadPtr (), frame.GetReadPtrEnd ());
+        std::size_t headersLength =
+            crypto::FrameHeader::SIZE + crypto::CiphertextHeader::SIZE;
+        // A forged iv length is rejected as soon as the headers arrive.
+        bool forgedHeaderRejected = false;
+        {
+            std::string forged = stream;
+            ++forged[crypto::FrameHeader::SIZE + 1];
+            crypto::FrameDecoder frameDecoder (keyRing);
+            frameDecoder.Feed (forged.data (), headersLength);
+            crypto::FrameDecoder::Frame decodedFrame;
+            THEKOGANS_UTIL_TRY {
+                frameDecoder.Next (decodedFrame);
+            }
+            THEKOGANS_UTIL_CATCH (util::Exception) {
+                forgedHeaderRejected = true;
+            }
+        }
+        // So is a frame exceeding it's key's max length.
+        bool oversizedFrameRejected = false;
+        {
+            std::string bulk (1024, 'a');
+            util::Buffer bulkFrame = cipher->EncryptAndFrame (bulk.data (), bulk.size ());
+            crypto::FrameDecoder frameDecoder (keyRing);
+            frameDecoder.SetMaxPlaintextLength (key->GetId (), message.size ());
+            frameDecoder.Feed (bulkFrame.GetReadPtr (), crypto::FrameHeader::SIZE);
+            crypto::FrameDecoder::Frame decodedFrame;
+            THEKOGANS_UTIL_TRY {
+                frameDecoder.Next (decodedFrame);
+            }
+            THEKOGANS_UTIL_CATCH (util::Exception) {
+                oversizedFrameRejected = true;
+            }
+        }
+        // A frame that fails authentication spends the pre-auth budget,
+        // after which even valid frames are refused.
+        bool budgetSpent = false;
+        bool validFrameRefused = false;
+        {
+            std::string tampered = stream;
+            ++tampered[tampered.size () - 1];
+            crypto::FrameDecoder frameDecoder (keyRing);
+            frameDecoder.SetPreAuthBudget (1);
+            frameDecoder.Feed (tampered.data (), tampered.size ());
+            crypto::FrameDecoder::Frame decodedFrame;
+            THEKOGANS_UTIL_TRY {
+                frameDecoder.Next (decodedFrame);
+            }
+            THEKOGANS_UTIL_CATCH (util::Exception) {
+                budgetSpent = frameDecoder.GetPreAuthBytes () == tampered.size () &&
+                    frameDecoder.IsPreAuthBudgetExhausted ();
+            }
+            frameDecoder.Feed (stream.data (), stream.size ());
+            THEKOGANS_UTIL_TRY {
+                frameDecoder.Next (decodedFrame);
+            }
+            THEKOGANS_UTIL_CATCH (util::Exception) {
+                validFrameRefused = frameDecoder.GetDataAvailable () == stream.size ();
+            }
+        }
+        result = forgedHeaderRejected && oversizedFrameRejected &&
+            budgetSpent && validFrameRefused;
+        std::cout << (result ? "pass" : "fail") << std::endl;
+    }
+    THEKOGANS_UTIL_CATCH (util::Exception) {
+        std::cout << "fail " << exception.Report ();
+    }
+    CHECK_EQUAL (result, true);
+}
+
+TEST (thekogans, RecordCoalescer) {
+    crypto::OpenSSLInit openSSLInit;
+    bool result = false;
+    THEKOGANS_UTIL_TRY {
+        std::cout << "RecordCoalescer...";
+        crypto::KeyRing::SharedPtr keyRing (
+            new crypto::KeyRing (crypto::CipherSuite::Strongest));
+        crypto::SymmetricKey::SharedPtr key =
+            crypto::SymmetricKey::FromSecretAndSalt (
+                password.c_str (),
+                password.size (),
+                0,
+                0,
+                crypto::GetCipherKeyLength (
+                    crypto::CipherSuite::Strongest.GetOpenSSLCipher ()));
+        keyRing->AddCipherKey (key);
+        crypto::Cipher::SharedPtr cipher = keyRing->GetCipher (key->GetId ());
+        std::vector<std::string> messages;
+        for (std::size_t i = 0; i < 20; ++i) {
+            messages.push_back (message.substr (0, i * 3 % 50));
+        }
+        // Size limit only (the delay is far enough to never expire).
+        crypto::RecordCoalescer coalescer (cipher, 128, 60000000);
+        std::vector<util::Buffer> records;
+        for (std::size_t i = 0; i < messages.size (); ++i) {
+            coalescer.Add (messages[i].c_str (), messages[i].size (), records);
+        }
+        coalescer.Poll (records);
+        std::size_t pendingCount = coalescer.GetPendingCount ();
+        coalescer.Flush (records);
+        std::string stream;
+        for (std::size_t i = 0; i < records.size (); ++i) {
+            stream.append (records[i].GetReadPtr (), records[i].GetReadPtrEnd ());
+        }
+        crypto::RecordSplitter recordSplitter (keyRing);
+        std::vector<std::string> plaintexts;
+        // Trickle the stream in seven bytes at a time.
+        for (std::size_t i = 0; i < stream.size (); i += 7) {
+            recordSplitter.Feed (&stream[i], std::min<std::size_t> (7, stream.size () - i));
+            crypto::RecordSplitter::Message splitMessage;
+            while (recordSplitter.Next (splitMessage)) {
+                plaintexts.push_back (
+                    std::string (
+                        (const char *)splitMessage.data,
+                        (const char *)splitMessage.data + splitMessage.length));
+            }
+        }
+        result = pendingCount > 0 &&
+            records.size () > 1 && records.size () < messages.size () &&
+            plaintexts == messages;
+        if (result) {
+            // No delay means no coalescing.
+            crypto::RecordCoalescer eagerCoalescer (cipher, 128, 0);
+            records.clear ();
+            for (std::size_t i = 0; i < messages.size (); ++i) {
+                eagerCoalescer.Add (messages[i].c_str (), messages[i].size (), records);
+            }
+            result = records.size () == messages.size () &&
+                eagerCoalescer.GetPendingCount () == 0;
+        }
+        std::cout << (result ? "pass" : "fail") << std::endl;
+    }
+    THEKOGANS_UTIL_CATCH (util::Exception) {
+        std::cout << "fail " << exception.Report ();
+    }
+    CHECK_EQUAL (result, true);
+}
+
+TEST (thekogans, CompactFrame) {
+    crypto::OpenSSLInit openSSLInit;
+    bool result = true;
+    THEKOGANS_UTIL_TRY {
+        std::cout << "CompactFrame...";
+        const EVP_CIPHER *ciphers[] = {EVP_aes_256_gcm (), EVP_aes_256_cbc ()};
+        for (std::size_t i = 0; result && i < 2; ++i) {
+            crypto::KeyRing keyRing (crypto::CipherSuite::Strongest);
+            for (std::size_t j = 0; j < 3; ++j) {
+                keyRing.AddCipherKey (
+                    crypto::SymmetricKey::FromRandom (
+                        crypto::SymmetricKey::MIN_RANDOM_LENGTH,
+                        0,
+                        0,
+                        crypto::GetCipherKeyLength (ciphers[i])));
+            }
+            std::vector<crypto::ID> keyTable;
+            keyRing.GetCipherKeyTable (keyTable);
+            crypto::Cipher cipher (keyRing.GetCipherKey (keyTable[2]), ciphers[i]);
+            util::Buffer frame = cipher.EncryptAndFrameCompact (2, message.c_str (), message.size ());
+            util::Buffer fullFrame = cipher.EncryptAndFrame (message.c_str (), message.size ());
+            // A two byte header instead of FrameHeader + CiphertextHeader.
+            result = keyTable.size () == 3 &&
+                frame.GetDataAvailableForReading () + crypto::FrameHeader::SIZE +
+                    crypto::CiphertextHeader::SIZE ==
+                fullFrame.GetDataAvailableForReading () + 2;
+            // Trickle the header in one byte at a time.
+            crypto::CompactFrameHeader frameHeader;
+            util::ValueParser<crypto::CompactFrameHeader> frameHeaderParser (frameHeader);
+            std::size_t headerLength = 0;
+            while (result && headerLength < crypto::CompactFrameHeader::MAX_SIZE) {
+                util::TenantReadBuffer byte (
+                    util::NetworkEndian, frame.GetReadPtr () + headerLength++, 1);
+                if (frameHeaderParser.ParseValue (byte)) {
+                    break;
+                }
+            }
+            result = result && headerLength == 2 && frameHeader.keyHandle == 2 &&
+                headerLength + frameHeader.ciphertextLength == frame.GetDataAvailableForReading ();
+            if (result) {
+                crypto::Cipher decryptor (
+                    keyRing.GetCipherKey (keyTable[frameHeader.keyHandle]), ciphers[i]);
+                std::vector<util::ui8> plaintext (frameHeader.ciphertextLength);
+                std::size_t plaintextLength = decryptor.DecryptCompact (
+                    frame.GetReadPtr () + headerLength,
+                    frameHeader.ciphertextLength,
+                    0,
+                    0,
+                    plaintext.data ());
+                result = plaintextLength == message.size () &&
+                    memcmp (plaintext.data (), message.c_str (), plaintextLength) == 0;
+            }
+        }
+        if (result) {
+            // Large handles and lengths take more varint bytes.
+            util::Buffer buffer (util::NetworkEndian, crypto::CompactFrameHeader::MAX_SIZE);
+            crypto::CompactFrameHeader frameHeader (300, util::UI32_MAX);
+            buffer << frameHeader;
+            crypto::CompactFrameHeader parsedFrameHeader;
+            buffer >> parsedFrameHeader;
+            result = frameHeader.Size () == 2 + 5 &&
+                parsedFrameHeader.keyHandle == 300 &&
+                parsedFrameHeader.ciphertextLength == util::UI32_MAX;
+        }
+        std::cout << (result ? "pass" : "fail") << std::endl;
+    }
+    THEKOGANS_UTIL_CATCH (util::Exception) {
+        std::cout << "fail " << exception.Report ();
+        result = false;
+    }
+    CHECK_EQUAL (result, true);
+}
+
+TEST (thekogans, OrderedChannel) {
+    crypto::OpenSSLInit openSSLInit;
+    bool result = false;
+    THEKOGANS_UTIL_TRY {
+        std::cout << "OrderedChannel...";
+        crypto::SymmetricKey::SharedPtr key =
+            crypto::SymmetricKey::FromSecretAndSalt (
+                password.c_str (),
+                password.size (),
+                0,
+                0,
+                crypto::GetCipherKeyLength ());
+        crypto::Cipher client (key);
+        crypto::Cipher server (key);
+        const util::ui8 clientSalt[12] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12};
+        const util::ui8 serverSalt[12] = {12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1};
+        client.EnableOrderedChannel (clientSalt, serverSalt, sizeof (clientSalt));
+        server.EnableOrderedChannel (serverSalt, clientSalt, sizeof (serverSalt));
+        std::vector<util::Buffer> frames;
+        for (std::size_t i = 0; i < 3; ++i) {
+            frames.push_back (
+                client.EncryptAndFrameOrdered (
+                    message.c_str (),
+                    message.size (),
+                    associatedData.c_str (),
+                    associatedData.size ()));
+        }
+        util::Buffer fullFrame = client.EncryptAndFrame (message.c_str (), message.size ());
+        // No iv and no CiphertextHeader on the wire.
+        result = frames[0].GetDataAvailableForReading () + crypto::FrameHeader::SIZE +
+            crypto::CiphertextHeader::SIZE + client.GetCompactOverhead () - EVP_GCM_TLS_TAG_LEN ==
+            fullFrame.GetDataAvailableForReading () + util::UI32_SIZE;
+        std::vector<util::ui8> plaintext (message.size ());
+        // Frame 0 out of order.
+        try {
+            server.DecryptOrdered (
+                frames[1].GetReadPtr () + util::UI32_SIZE,
+                frames[1].GetDataAvailableForReading () - util::UI32_SIZE,
+                associatedData.c_str (),
+                associatedData.size (),
+                plaintext.data ());
+            result = false;
+        }
+        catch (...) {
+        }
+        for (std::size_t i = 0; result && i < frames.size (); ++i) {
+            std::size_t plaintextLength = server.DecryptOrdered (
+                frames[i].GetReadPtr () + util::UI32_SIZE,
+                frames[i].GetDataAvailableForReading () - util::UI32_SIZE,
+                associatedData.c_str (),
+                associatedData.size (),
+                plaintext.data ());
+            result = plaintextLength == message.size () &&
+                memcmp (plaintext.data (), message.c_str (), plaintextLength) == 0;
+        }
+        result = result &&
+            client.GetEncryptSequenceNumber () == 3 &&
+            server.GetDecryptSequenceNumber () == 3;
+        std::cout << (result ? "pass" : "fail") << std::endl;
+    }
+    THEKOGANS_UTIL_CATCH (util::Exception) {
+        std::cout << "fail " << exception.Report ();
+    }
+    CHECK_EQUAL (result, true);
+}
+
+namespace {
+    bool EnableOrderedChannelFails (
+            crypto::Cipher &cipher,
+            const util::ui8 *encryptSalt,
+            const util::ui8 *decryptSalt,
+            std::size_t saltLength) {
+        try {
+            cipher.EnableOrderedChannel (encryptSalt, decryptSalt, saltLength);
+            return false;
+        }
+        catch (...) {
+            return true;
+        }
+    }
+}
+
+TEST (thekogans, OrderedChannelMisuse) {
+    crypto::OpenSSLInit openSSLInit;
+    bool result = false;
+    THEKOGANS_UTIL_TRY {
+        std::cout << "OrderedChannelMisuse...";
+        crypto::SymmetricKey::SharedPtr key =
+            crypto::SymmetricKey::FromSecretAndSalt (
+                password.c_str (),
+                password.size (),
+                0,
+                0,
+                crypto::GetCipherKeyLength ());
+        const util::ui8 clientSalt[12] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12};
+        const util::ui8 serverSalt[12] = {12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1};
+        crypto::Cipher client (key);
+        // Both directions on one salt.
+        result = EnableOrderedChannelFails (client, clientSalt, clientSalt, sizeof (clientSalt));
+        client.EnableOrderedChannel (clientSalt, serverSalt, sizeof (clientSalt));
+        client.EncryptAndFrameOrdered (message.c_str (), message.size ());
+        // Re-enabling would reset the sequence number to 0.
+        result = result &&
+            EnableOrderedChannelFails (client, clientSalt, serverSalt, sizeof (clientSalt)) &&
+            client.GetEncryptSequenceNumber () == 1;
+        // A second Cipher on the same key and encrypt salt (pool lease, cache rebuild...).
+        crypto::Cipher rebuilt (key);
+        result = result &&
+            EnableOrderedChannelFails (rebuilt, clientSalt, serverSalt, sizeof (clientSalt));
+        // A Cipher that already encrypted with random ivs.
+        crypto::Cipher server (key);
+        server.Encrypt (message.c_str (), message.size ());
+        result = result &&
+            EnableOrderedChannelFails (server, serverSalt, clientSalt, sizeof (serverSalt));
+        // A key that already handed out counter ivs can't go ordered, and vice versa.
+        crypto::SymmetricKey::SharedPtr counterKey =
+            crypto::SymmetricKey::FromSecretAndSalt (
+                password.c_str (),
+                password.size (),
+                0,
+                0,
+                crypto::GetCipherKeyLength ());
+        util::ui8 iv[12];
+        counterKey->GetNextCounterIV (iv, sizeof (iv));
+        crypto::Cipher counter (counterKey);
+        result = result &&
+            EnableOrderedChannelFails (counter, clientSalt, serverSalt, sizeof (clientSalt));
+        try {
+            key->GetNextCounterIV (iv, sizeof (iv));
+            result = false;
+        }
+        catch (...) {
+        }
+        std::cout << (result ? "pass" : "fail") << std::endl;
+    }
+    THEKOGANS_UTIL_CATCH (util::Exception) {
+        std::cout << "fail " << exception.Report ();
+        result = false;
+    }
+    CHECK_EQUAL (result, true);
+}
+
+TEST (thekogans, TypedCipher) {
+    crypto::OpenSSLInit openSSLInit;
+    bool result = false;
+    THEKOGANS_UTIL_TRY {
+        std::cout << "TypedCipher...";
+        typedef crypto::TypedCipher<crypto::AES256GCM> AES256GCMCipher;
+        crypto::SymmetricKey::SharedPtr key =
+            crypto::SymmetricKey::FromSecretAndSalt (
+                password.c_str (),
+                password.size (),
+                0,
+                0,
+                crypto::GetCipherKeyLength (EVP_aes_256_gcm ()));
+        AES256GCMCipher typedCipher (key);
+        crypto::Cipher cipher (key, EVP_aes_256_gcm ());
+        // TypedCipher -> Cipher.
+        std::vector<util::ui8> ciphertext (
+            AES256GCMCipher::GetMaxBufferLength (message.size ()));
+        std::size_t ciphertextLength = typedCipher.Encrypt (
+            message.c_str (),
+            message.size (),
+            associatedData.c_str (),
+            associatedData.size (),
+            &ciphertext[0]);
+        util::Buffer plaintext1 = cipher.Decrypt (
+            &ciphertext[0],
+            ciphertextLength,
+            associatedData.c_str (),
+            associatedData.size ());
+        // Cipher -> TypedCipher.
+        util::Buffer ciphertext2 = cipher.Encrypt (
+            message.c_str (),
+            message.size (),
+            associatedData.c_str (),
+            associatedData.size ());
+        std::vector<util::ui8> plaintext2 (ciphertext2.GetDataAvailableForReading ());
+        plaintext2.resize (
+            typedCipher.Decrypt (
+                ciphertext2.GetReadPtr (),
+                ciphertext2.GetDataAvailableForReading (),
+                associatedData.c_str (),
+                associatedData.size (),
+                &plaintext2[0]));
+        // Empty associated data (non null, 0 length) is no associated
+        // data, the same on both sides and for both ciphers.
+        std::size_t ciphertextLength3 = typedCipher.Encrypt (
+            message.c_str (),
+            message.size (),
+            associatedData.c_str (),
+            0,
+            &ciphertext[0]);
+        std::vector<util::ui8> plaintext3 (ciphertextLength3);
+        plaintext3.resize (
+            typedCipher.Decrypt (
+                &ciphertext[0],
+                ciphertextLength3,
+                0,
+                0,
+                &plaintext3[0]));
+        util::Buffer plaintext4 = cipher.Decrypt (
+            &ciphertext[0],
+            ciphertextLength3,
+            associatedData.c_str (),
+            0);
+        result = ciphertextLength == AES256GCMCipher::GetMaxBufferLength (message.size ()) &&
+            ciphertextLength == ciphertext2.GetDataAvailableForReading () &&
+            std::string (plaintext1.GetReadPtr (), plaintext1.GetReadPtrEnd ()) == message &&
+            std::string (plaintext2.begin (), plaintext2.end ()) == message &&
+            std::string (plaintext3.begin (), plaintext3.end ()) == message &&
+            std::string (plaintext4.GetReadPtr (), plaintext4.GetReadPtrEnd ()) == message;
+        std::cout << (result ? "pass" : "fail") << std::endl;
+    }
+    THEKOGANS_UTIL_CATCH (util::Exception) {
+        std::cout << "fail " << exception.Report ();
+    }
+    CHECK_EQUAL (result, true);
+}
+
+TEST (thekogans, BufferPoolAllocator) {
+    crypto::OpenSSLInit openSSLInit;
+    crypto::Cipher cipher (
+        crypto::SymmetricKey::FromSecretAndSalt (
+            password.c_str (),
+            password.size (),
+            0,
+            0,
+            crypto::GetCipherKeyLength ()));
+    bool result = false;
+    THEKOGANS_UTIL_TRY {
+        std::cout << "BufferPoolAllocator...";
+        crypto::BufferPoolAllocator allocator;
+        const util::ui8 *first = 0;
+        result = true;
+        for (std::size_t i = 0; result && i < 2; ++i) {
+            util::Buffer ciphertext = cipher.Encrypt (
+                message.c_str (),
+                message.size (),
+                0,
+                0,
+                &allocator);
+            util::Buffer plaintext = cipher.Decrypt (
+                ciphertext.GetReadPtr (),
+                ciphertext.GetDataAvailableForReading (),
+                0,
+                0,
+                true,
+                util::NetworkEndian,
+                &crypto::BufferPoolAllocator::SecureInstance ());
+            result = std::string (plaintext.GetReadPtr (), plaintext.GetReadPtrEnd ()) == message;
+            // The second ciphertext buffer must be recycled from the first.
+            if (i == 0) {
+                first = ciphertext.GetReadPtr ();
+            }
+            else {
+                result = result && first == ciphertext.GetReadPtr ();
+            }
+        }
+        // Reserved node blocks are handed out before the heap is touched.
+        crypto::BufferPoolAllocator &nodeAllocator =
+            crypto::BufferPoolAllocator::NodeInstance (0);
+        result = result && nodeAllocator.GetNode () == 0 &&
+            nodeAllocator.Reserve (message.size (), 2) >= 2;
+        std::cout << (result ? "pass" : "fail") << std::endl;
+    }
+    THEKOGANS_UTIL_CATCH (util::Exception) {
+        std::cout << "fail " << exception.Report ();
+    }
+    CHECK_EQUAL (result, true);
+}
+
+TEST (thekogans, AsyncEngine) {
+    crypto::OpenSSLInit openSSLInit;
+    std::cout << "AsyncEngine...";
+    crypto::CipherPool::SharedPtr cipherPool (
+        new crypto::CipherPool (
+            crypto::SymmetricKey::FromSecretAndSalt (
+                password.c_str (),
+                password.size (),
+                0,
+                0,
+                crypto::GetCipherKeyLength ())));
+    bool result = true;
+    // Synchronous, OpenSSL async job and NUMA aware workers.
+    const std::size_t maxInFlightJobs[] = {0, 8, 0};
+    const bool numaAware[] = {false, false, true};
+    for (std::size_t j = 0; result && j < 3; ++j) {
+        crypto::AsyncEngine engine (
+            2,
+            crypto::AsyncEngine::DEFAULT_MAX_BATCH_JOBS,
+            crypto::AsyncEngine::DEFAULT_SMALL_JOB_LENGTH,
+            maxInFlightJobs[j],
+            numaAware[j]);
+        std::vector<crypto::AsyncEngine::EncryptJob::SharedPtr> encryptJobs;
+        for (std::size_t i = 0; i < 16; ++i) {
+            encryptJobs.push_back (
+                crypto::AsyncEngine::EncryptJob::SharedPtr (
+                    new crypto::AsyncEngine::EncryptJob (
+                        cipherPool,
+                        message.c_str (),
+                        message.size ())));
+            engine.Enqueue (encryptJobs.back ());
+        }
+        std::vector<crypto::AsyncEngine::DecryptJob::SharedPtr> decryptJobs;
+        for (std::size_t i = 0, count = encryptJobs.size (); i < count; ++i) {
+            encryptJobs[i]->Wait ();
+            if (encryptJobs[i]->Failed ()) {
+                result = false;
+                break;
+            }
+            util::Buffer &ciphertext = encryptJobs[i]->GetCiphertext ();
+            decryptJobs.push_back (
+                crypto::AsyncEngine::DecryptJob::SharedPtr (
+                    new crypto::AsyncEngine::DecryptJob (
+                        cipherPool,
+                        ciphertext.GetReadPtr (),
+                        ciphertext.GetDataAvailableForReading ())));
+            engine.Enqueue (decryptJobs.back ());
+        }
+        for (std::size_t i = 0, count = decryptJobs.size (); result && i < count; ++i) {
+            decryptJobs[i]->Wait ();
+            util::Buffer &plaintext = decryptJobs[i]->GetPlaintext ();
+            result = !decryptJobs[i]->Failed () &&
+                plaintext.GetDataAvailableForReading () == message.size () &&
+                memcmp (plaintext.GetReadPtr (), message.c_str (), message.size ()) == 0;
+        }
+        // No engine, so nothing pauses and nothing falls back to software.
+        result = result && engine.GetStats ().GetUseCount () == 32 &&
+            engine.GetOffloadedBatchCount () == 0 &&
+            engine.GetSoftwareBatchCount () == 0;
+        // Every job is accounted to the node of the worker that ran it.
+        std::vector<crypto::NUMATopology::NodeStats> nodeStats = engine.GetNodeStats ();
+        util::ui64 jobCount = 0;
+        for (std::size_t i = 0, count = nodeStats.size (); i < count; ++i) {
+            jobCount += nodeStats[i].jobCount;
+        }
+        result = result && jobCount == 32;
+    }
+    {
+        crypto::OpenSSLInit::SoftwareScope softwareScope;
+        result = result && crypto::OpenSSLInit::GetEngine (EVP_CIPHER_nid (THEKOGANS_CRYPTO_DEFAULT_CIPHER)) == 0;
+    }
+    std::cout << (result ? "pass" : "fail") << std::endl;
+    CHECK_EQUAL (result, true);
+}
+
+TEST (thekogans, RekeyingCipher) {
+    crypto::OpenSSLInit openSSLInit;
+    std::cout << "RekeyingCipher...";
+    crypto::SymmetricKey::SharedPtr key =
+        crypto::SymmetricKey::FromSecretAndSalt (
+            password.c_str (),
+            password.size (),
+            0,
+            0,
+            crypto::GetCipherKeyLength ());
+    crypto::RekeyingCipher sender (
+        key,
+        THEKOGANS_CRYPTO_DEFAULT_CIPHER,
+        THEKOGANS_CRYPTO_DEFAULT_MD,
+        4);
+    crypto::RekeyingCipher receiver (
+        key,
+        THEKOGANS_CRYPTO_DEFAULT_CIPHER,
+        THEKOGANS_CRYPTO_DEFAULT_MD,
+        4);
+    bool result = true;
+    util::Buffer late;
+    for (std::size_t i = 0; result && i < 10; ++i) {
+        util::Buffer ciphertext = sender.Encrypt (message.c_str (), message.size ());
+        if (i == 6) {
+            // Delivered after the receiver moves to the next epoch.
+            late = sender.Encrypt (message.c_str (), message.size ());
+        }
+        util::Buffer plaintext = receiver.Decrypt (
+            ciphertext.GetReadPtr (),
+            ciphertext.GetDataAvailableForReading ());
+        result = plaintext.GetDataAvailableForReading () == message.size () &&
+            memcmp (plaintext.GetReadPtr (), message.c_str (), message.size ()) == 0 &&
+            receiver.GetEpoch () == sender.GetEpoch ();
+    }
+    if (result) {
+        util::Buffer plaintext = receiver.Decrypt (
+            late.GetReadPtr (),
+            late.GetDataAvailableForReading ());
+        result = sender.GetEpoch () == 2 &&
+            plaintext.GetDataAvailableForReading () == message.size ();
+    }
+    if (result) {
+        // Forged next epoch messages are rejected (without moving the
+        // receiver), and don't spoil the (cached) next epoch cipher.
+        util::ui32 nextEpoch = receiver.GetEpoch () + 1;
+        util::Buffer forged (
+            util::NetworkEndian,
+            crypto::RekeyingCipher::GetMaxBufferLength (message.size ()));
+        forged << nextEpoch;
+        memset (forged.GetWritePtr (), 0, forged.GetDataAvailableForWriting ());
+        forged.AdvanceWriteOffset (forged.GetDataAvailableForWriting ());
+        for (std::size_t i = 0; result && i < 3; ++i) {
+            THEKOGANS_UTIL_TRY {
+                receiver.Decrypt (forged.GetReadPtr (), forged.GetDataAvailableForReading ());
+                result = false;
+            }
+            THEKOGANS_UTIL_CATCH (util::Exception) {
+                result = receiver.GetEpoch () + 1 == nextEpoch;
+            }
+        }
+        if (result) {
+            sender.Rekey ();
+            util::Buffer ciphertext = sender.Encrypt (message.c_str (), message.size ());
+            util::Buffer plaintext = receiver.Decrypt (
+                ciphertext.GetReadPtr (),
+                ciphertext.GetDataAvailableForReading ());
+            result = receiver.GetEpoch () == nextEpoch &&
+                plaintext.GetDataAvailableForReading () == message.size () &&
+                memcmp (plaintext.GetReadPtr (), message.c_str (), message.size ()) == 0;
+        }
+    }
+    std::cout << (result ? "pass" : "fail") << std::endl;
+    CHECK_EQUAL (result, true);
+}
+
+TEST (thekogans, ThreadCacheAllocator) {
+    bool result = false;
+    THEKOGANS_UTIL_TRY {
+        std::cout << "ThreadCacheAllocator...";
+        crypto::ThreadCacheAllocator allocator (0, true, 1);
+        util::ui8 *block1 = (util::ui8 *)allocator.Alloc (100);
+        memset (block1, 0xff, 100);
+        allocator.Free (block1, 100);
+        // The block must come back from this thread's magazine, cleared.
+        util::ui8 *block2 = (util::ui8 *)allocator.Alloc (100);
+        result = block1 == block2;
+        for (std::size_t i = 0; result && i < 100; ++i) {
+            result = block2[i] == 0;
+        }
+        allocator.Free (block2, 100);
+        allocator.Trim ();
+        std::cout << (result ? "pass" : "fail") << std::endl;
+    }
+    THEKOGANS_UTIL_CATCH (util::Exception) {
+        std::cout << "fail " << exception.Report ();
+    }
+    CHECK_EQUAL (result, true);
+}
+
+TEST (thekogans, ParallelGCM) {
+    crypto::OpenSSLInit openSSLInit;
+    bool result = false;
+    THEKOGANS_UTIL_TRY {
+        std::cout << "ParallelGCM...";
+        crypto::Cipher parallel (
+            crypto::SymmetricKey::FromSecretAndSalt (
+                password.c_str (),
+                password.size (),
+                0,
+                0,
+                crypto::GetCipherKeyLength (EVP_aes_256_gcm ())),
+            EVP_aes_256_gcm ());
+        parallel.EnableParallelEncrypt (1024 * 1024, 4);
+        crypto::Cipher serial (
+            crypto::SymmetricKey::FromSecretAndSalt (
+                password.c_str (),
+                password.size (),
+                0,
+                0,
+                crypto::GetCipherKeyLength (EVP_aes_256_gcm ())),
+            EVP_aes_256_gcm ());
+        // Odd length so the last stripe ends mid block.
+        std::vector<util::ui8> plaintext (4 * 1024 * 1024 + 13);
+        for (std::size_t i = 0, count = plaintext.size (); i < count; ++i) {
+            plaintext[i] = (util::ui8)(i * 31 + 7);
+        }
+        util::Buffer ciphertext = parallel.Encrypt (
+            &plaintext[0],
+            plaintext.size (),
+            associatedData.c_str (),
+            associatedData.size ());
+        // The serial cipher decrypting (and authenticating) it proves
+        // the parallel path produced standard GCM.
+        util::Buffer decryptedPlaintext = serial.Decrypt (
+            ciphertext.GetReadPtr (),
+            ciphertext.GetDataAvailableForReading (),
+            associatedData.c_str (),
+            associatedData.size ());
+        result = decryptedPlaintext.GetDataAvailableForReading () == plaintext.size () &&
+            memcmp (decryptedPlaintext.GetReadPtr (), &plaintext[0], plaintext.size ()) == 0;
+        if (result) {
+            // Parallel encryption is AES-GCM only.
+            crypto::Cipher cbc (
+                crypto::SymmetricKey::FromSecretAndSalt (
+                    password.c_str (),
+                    password.size (),
+                    0,
+                    0,
+                    crypto::GetCipherKeyLength (EVP_aes_256_cbc ())),
+                EVP_aes_256_cbc ());
+            THEKOGANS_UTIL_TRY {
+                cbc.EnableParallelEncrypt ();
+                result = false;
+            }
+            THEKOGANS_UTIL_CATCH (util::Exception) {
+            }
+        }
+        std::cout << (result ? "pass" : "fail") << std::endl;
+    }
+    THEKOGANS_UTIL_CATCH (util::Exception) {
+        std::cout << "fail " << exception.Report ();
+    }
+    CHECK_EQUAL (result, true);
+}
+
+TEST (thekogans, ParallelCBC) {
+    crypto::OpenSSLInit openSSLInit;
+    bool result = false;
+    THEKOGANS_UTIL_TRY {
+        std::cout << "ParallelCBC...";
+        crypto::Cipher serial (
+            crypto::SymmetricKey::FromSecretAndSalt (
+                password.c_str (),
+                password.size (),
+                0,
+                0,
+                crypto::GetCipherKeyLength (EVP_aes_256_cbc ())),
+            EVP_aes_256_cbc ());
+        crypto::Cipher parallel (
+            crypto::SymmetricKey::FromSecretAndSalt (
+                password.c_str (),
+                password.size (),
+                0,
+                0,
+                crypto::GetCipherKeyLength (EVP_aes_256_cbc ())),
+            EVP_aes_256_cbc ());
+        parallel.EnableParallelDecrypt (1024 * 1024, 4);
+        std::vector<util::ui8> plaintext (4 * 1024 * 1024 + 13);
+        for (std::size_t i = 0, count = plaintext.size (); i < count; ++i) {
+            plaintext[i] = (util::ui8)(i * 31 + 7);
+        }
+        util::Buffer ciphertext = serial.Encrypt (&plaintext[0], plaintext.size ());
+        util::Buffer decryptedPlaintext = parallel.Decrypt (
+            ciphertext.GetReadPtr (),
+            ciphertext.GetDataAvailableForReading ());
+        result = decryptedPlaintext.GetDataAvailableForReading () == plaintext.size () &&
+            memcmp (decryptedPlaintext.GetReadPtr (), &plaintext[0], plaintext.size ()) == 0;
+        if (result) {
+            // A tampered frame must fail it's MAC.
+            ciphertext.GetReadPtr ()[ciphertext.GetDataAvailableForReading () / 2] ^= 1;
+            THEKOGANS_UTIL_TRY {
+                parallel.Decrypt (
+                    ciphertext.GetReadPtr (),
+                    ciphertext.GetDataAvailableForReading ());
+                result = false;
+            }
+            THEKOGANS_UTIL_CATCH (util::Exception) {
+            }
+        }
+        if (result) {
+            // Parallel decryption is CBC only.
+            crypto::Cipher gcm (
+                crypto::SymmetricKey::FromSecretAndSalt (
+                    password.c_str (),
+                    password.size (),
+                    0,
+                    0,
+                    crypto::GetCipherKeyLength (EVP_aes_256_gcm ())),
+                EVP_aes_256_gcm ());
+            THEKOGANS_UTIL_TRY {
+                gcm.EnableParallelDecrypt ();
+                result = false;
+            }
+            THEKOGANS_UTIL_CATCH (util::Exception) {
+            }
+        }
+        std::cout << (result ? "pass" : "fail") << std::endl;
+    }
+    THEKOGANS_UTIL_CATCH (util::Exception) {
+        std::cout << "fail " << exception.Report ();
+    }
+    CHECK_EQUAL (result, true);
+}
+
+TEST (thekogans, CipherKeySchedule) {
+    crypto::OpenSSLInit openSSLInit;
+    bool result = false;
+    THEKOGANS_UTIL_TRY {
+        std::cout << "CipherKeySchedule...";
+        crypto::SymmetricKey::SharedPtr key =
+            crypto::SymmetricKey::FromSecretAndSalt (
+                password.c_str (),
+                password.size (),
+                0,
+                0,
+                crypto::GetCipherKeyLength (EVP_aes_256_cbc ()));
+        crypto::CipherKeySchedule::SharedPtr schedule =
+            crypto::CipherKeySchedule::Get (key, EVP_aes_256_cbc ());
+        // Every cipher on the key shares the one schedule.
+        crypto::Cipher cipher1 (key, EVP_aes_256_cbc ());
+        crypto::Cipher cipher2 (key, EVP_aes_256_cbc ());
+        result = crypto::CipherKeySchedule::Get (key, EVP_aes_256_cbc ()).Get () == schedule.Get ();
+        if (result) {
+            util::Buffer ciphertext = cipher1.Encrypt (message.c_str (), message.size ());
+            util::Buffer plaintext = cipher2.Decrypt (
+                ciphertext.GetReadPtr (),
+                ciphertext.GetDataAvailableForReading ());
+            result = message == std::string (plaintext.GetReadPtr (), plaintext.GetReadPtrEnd ());
+        }
+        if (result) {
+            // A new key drops the old schedule.
+            std::string newKey (crypto::GetCipherKeyLength (EVP_aes_256_cbc ()), 'k');
+            key->Set (newKey.data (), newKey.size ());
+            result = crypto::CipherKeySchedule::Get (key, EVP_aes_256_cbc ()).Get () != schedule.Get ();
+        }
+        std::cout << (result ? "pass" : "fail") << std::endl;
+    }
+    THEKOGANS_UTIL_CATCH (util::Exception) {
+        std::cout << "fail " << exception.Report ();
+    }
+    CHECK_EQUAL (result, true);
+}
+
 TESTMAIN
@@ -0,0 +1,167 @@
+// Copyright 2011 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#include <cstring>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <CppUnitXLite/CppUnitXLite.cpp>
+#include "thekogans/util/Types.h"
+#include "thekogans/util/Array.h"
+#include "thekogans/util/HRTimer.h"
+#include "thekogans/util/RandomSource.h"
+#include "thekogans/crypto/OpenSSLInit.h"
+#include "thekogans/crypto/SymmetricKey.h"
+#include "thekogans/crypto/Cipher.h"
+
+using namespace thekogans;
+
+namespace {
+    const std::string password ("password");
+    const std::string associatedData ("The dog barks at night.");
+    const std::size_t BATCH_SIZE = 256;
+    const std::size_t ITERATIONS = 64;
+
+    bool TestCipherBatch (
+            const char *name,
+            crypto::Cipher &cipher,
+            std::size_t messageLength,
+            const void *associatedData = 0,
+            std::size_t associatedDataLength = 0) {
+        THEKOGANS_UTIL_TRY {
+            std::cout << name << " (" << messageLength << " bytes)...";
+            std::size_t maxBufferLength = crypto::Cipher::GetMaxBufferLength (messageLength);
+            util::Array<util::ui8> plaintext (messageLength * BATCH_SIZE);
+            util::GlobalRandomSource::Instance ().GetBytes (plaintext.array, messageLength * BATCH_SIZE);
+            util::Array<util::ui8> ciphertext (maxBufferLength * BATCH_SIZE);
+            util::Array<util::ui8> decryptedPlaintext (maxBufferLength * BATCH_SIZE);
+            std::vector<crypto::Cipher::EncryptBatchItem> encryptItems (BATCH_SIZE);
+            std::vector<crypto::Cipher::DecryptBatchItem> decryptItems (BATCH_SIZE);
+            for (std::size_t i = 0; i < BATCH_SIZE; ++i) {
+                encryptItems[i] = crypto::Cipher::EncryptBatchItem (
+                    plaintext.array + i * messageLength,
+                    messageLength,
+                    associatedData,
+                    associatedDataLength,
+                    ciphertext.array + i * maxBufferLength);
+            }
+            // Per-call.
+            util::ui64 start = util::HRTimer::Click ();
+            for (std::size_t j = 0; j < ITERATIONS; ++j) {
+                for (std::size_t i = 0; i < BATCH_SIZE; ++i) {
+                    cipher.Encrypt (
+                        encryptItems[i].plaintext,
+                        encryptItems[i].plaintextLength,
+                        encryptItems[i].associatedData,
+                        encryptItems[i].associatedDataLength,
+                        encryptItems[i].ciphertext);
+                }
+            }
+            util::f64 perCallSeconds = util::HRTimer::ToSeconds (
+                util::HRTimer::ComputeElapsedTime (start, util::HRTimer::Click ()));
+            // Batch.
+            start = util::HRTimer::Click ();
+            for (std::size_t j = 0; j < ITERATIONS; ++j) {
+                cipher.EncryptBatch (&encryptItems[0], BATCH_SIZE);
+            }
+            util::f64 batchSeconds = util::HRTimer::ToSeconds (
+                util::HRTimer::ComputeElapsedTime (start, util::HRTimer::Click ()));
+            for (std::size_t i = 0; i < BATCH_SIZE; ++i) {
+                decryptItems[i] = crypto::Cipher::DecryptBatchItem (
+                    encryptItems[i].ciphertext,
+                    encryptItems[i].ciphertextLength,
+                    associatedData,
+                    associatedDataLength,
+                    decryptedPlaintext.array + i * maxBufferLength);
+            }
+            cipher.DecryptBatch (&decryptItems[0], BATCH_SIZE);
+            bool result = true;
+            for (std::size_t i = 0; i < BATCH_SIZE; ++i) {
+                if (decryptItems[i].plaintextLength != messageLength ||
+                        memcmp (
+                            decryptItems[i].plaintext,
+                            encryptItems[i].plaintext,
+                            messageLength) != 0) {
+                    result = false;
+                    break;
+                }
+            }
+            util::f64 megabytes =
+                (util::f64)(messageLength * BATCH_SIZE * ITERATIONS) / (1024.0 * 1024.0);
+            std::cout << (result ? "pass" : "fail") <<
+                " (per-call: " << (perCallSeconds > 0.0 ? megabytes / perCallSeconds : 0.0) << " MB/s, "
+                "batch: " << (batchSeconds > 0.0 ? megabytes / batchSeconds : 0.0) << " MB/s)" << std::endl;
+            return result;
+        }
+        THEKOGANS_UTIL_CATCH (util::Exception) {
+            std::cout << "fail " << exception.Report ();
+            return false;
+        }
+    }
+}
+
+TEST (thekogans, CBCBatch) {
+    crypto::OpenSSLInit openSSLInit;
+    crypto::Cipher cipher (
+        crypto::SymmetricKey::FromSecretAndSalt (
+            password.c_str (),
+            password.size (),
+            0,
+            0,
+            crypto::GetCipherKeyLength (EVP_aes_256_cbc ())),
+        EVP_aes_256_cbc ());
+    CHECK_EQUAL (TestCipherBatch ("CBCBatch", cipher, 64), true);
+    CHECK_EQUAL (TestCipherBatch ("CBCBatch", cipher, 512), true);
+    CHECK_EQUAL (TestCipherBatch ("CBCBatch", cipher, 4096), true);
+}
+
+TEST (thekogans, GCMBatch) {
+    crypto::OpenSSLInit openSSLInit;
+    crypto::Cipher cipher (
+        crypto::SymmetricKey::FromSecretAndSalt (
+            password.c_str (),
+            password.size (),
+            0,
+            0,
+            crypto::GetCipherKeyLength ()));
+    CHECK_EQUAL (
+        TestCipherBatch (
+            "GCMBatch",
+            cipher,
+            64,
+            associatedData.c_str (),
+            associatedData.size ()),
+        true);
+    CHECK_EQUAL (
+        TestCipherBatch (
+            "GCMBatch",
+            cipher,
+            512,
+            associatedData.c_str (),
+            associatedData.size ()),
+        true);
+    CHECK_EQUAL (
+        TestCipherBatch (
+            "GCMBatch",
+            cipher,
+            4096,
+            associatedData.c_str (),
+            associatedData.size ()),
+        true);
+}
+
+TESTMAIN
@@ -17,6 +17,7 @@
 
 #include <iostream>
 #include <CppUnitXLite/CppUnitXLite.cpp>
+#include "thekogans/util/Buffer.h"
 #include "thekogans/crypto/OpenSSLInit.h"
 #include "thekogans/crypto/CipherSuite.h"
 #include "thekogans/crypto/EC.h"
@@ -25,6 +26,8 @@
 #include "thekogans/crypto/RSA.h"
 #include "thekogans/crypto/DHEKeyExchange.h"
 #include "thekogans/crypto/RSAKeyExchange.h"
+#include "thekogans/crypto/CPUFeatures.h"
+#include "thekogans/crypto/OpenSSLUtils.h"
 
 using namespace thekogans;
 
@@ -149,4 +152,117 @@ TEST (thekogans, CipherSuite) {
     }
 }
 
+TEST (thekogans, RankedCipherSuites) {
+    crypto::OpenSSLInit openSSLInit;
+    std::cout << crypto::CPUFeatures::Instance ().ToString ();
+    std::cout << "RankedCipherSuites...";
+    const std::vector<crypto::CipherSuite> &cipherSuites = crypto::CipherSuite::GetCipherSuites ();
+    const std::vector<crypto::CipherSuite> &rankedCipherSuites =
+        crypto::CipherSuite::GetRankedCipherSuites ();
+    bool result = rankedCipherSuites.size () == cipherSuites.size () &&
+        !rankedCipherSuites.empty ();
+    if (result) {
+    #if defined (THEKOGANS_CRYPTO_HAVE_CHACHA20_POLY1305)
+        result = rankedCipherSuites[0].cipher == (crypto::CPUFeatures::Instance ().PreferAESGCM () ?
+            crypto::CipherSuite::CIPHER_AES_256_GCM : crypto::CipherSuite::CIPHER_CHACHA20_POLY1305);
+    #else // defined (THEKOGANS_CRYPTO_HAVE_CHACHA20_POLY1305)
+        result = rankedCipherSuites[0].cipher == crypto::CipherSuite::CIPHER_AES_256_GCM;
+    #endif // defined (THEKOGANS_CRYPTO_HAVE_CHACHA20_POLY1305)
+    }
+    std::cout << (result ? "pass" : "fail") << std::endl;
+    CHECK_EQUAL (result, true);
+}
+
+TEST (thekogans, ResolvedCipherSuite) {
+    crypto::OpenSSLInit openSSLInit;
+    std::cout << "ResolvedCipherSuite...";
+    const std::vector<crypto::CipherSuite> &cipherSuites = crypto::CipherSuite::GetCipherSuites ();
+    bool result = true;
+    for (std::size_t i = 0, count = cipherSuites.size (); result && i < count; ++i) {
+        crypto::CipherSuite cipherSuite (cipherSuites[i].ToString ());
+        result =
+            cipherSuite.GetOpenSSLCipher () ==
+                crypto::CipherSuite::GetOpenSSLCipherByName (cipherSuite.cipher) &&
+            cipherSuite.GetOpenSSLMessageDigest () ==
+                crypto::CipherSuite::GetOpenSSLMessageDigestByName (cipherSuite.messageDigest) &&
+            cipherSuite.GetOpenSSLCipher () ==
+                crypto::CipherSuite::GetOpenSSLCipherByIndex (cipherSuite.GetCipherIndex ()) &&
+            crypto::CipherSuite::GetKeyExchanges ()[cipherSuite.GetKeyExchangeIndex ()] ==
+                cipherSuite.keyExchange &&
+            crypto::CipherSuite::GetAuthenticators ()[cipherSuite.GetAuthenticatorIndex ()] ==
+                cipherSuite.authenticator &&
+            crypto::CipherSuite::GetMessageDigests ()[cipherSuite.GetMessageDigestIndex ()] ==
+                cipherSuite.messageDigest &&
+            cipherSuite.IsKeyExchangeEC () ==
+                (cipherSuite.keyExchange == crypto::CipherSuite::KEY_EXCHANGE_ECDHE);
+    }
+    if (result) {
+        crypto::CipherSuite empty;
+        result = empty.GetCipherIndex () == crypto::CipherSuite::INVALID_INDEX &&
+            empty.GetOpenSSLCipher () == 0;
+    }
+    std::cout << (result ? "pass" : "fail") << std::endl;
+    CHECK_EQUAL (result, true);
+}
+
+TEST (thekogans, NegotiateCipherSuite) {
+    crypto::OpenSSLInit openSSLInit;
+    std::cout << "NegotiateCipherSuite...";
+    const std::vector<util::ui16> &codes = crypto::CipherSuite::GetRankedCipherSuiteCodes ();
+    bool result = !codes.empty ();
+    for (std::size_t i = 0, count = codes.size (); result && i < count; ++i) {
+        result = codes[i] != crypto::CipherSuite::INVALID_CODE &&
+            crypto::CipherSuite::GetCipherSuiteByCode (codes[i]).GetCode () == codes[i];
+    }
+    if (result) {
+        // The peer only supports the weakest suite, and tells us so over the wire.
+        std::vector<util::ui16> peerCodes;
+        peerCodes.push_back (crypto::CipherSuite::Weakest.GetCode ());
+        util::Buffer buffer (util::NetworkEndian, 2 + 2 * peerCodes.size ());
+        crypto::CipherSuite::EncodeCodes (buffer, peerCodes);
+        std::vector<util::ui16> decodedCodes;
+        crypto::CipherSuite::DecodeCodes (buffer, decodedCodes);
+        crypto::CipherSuite::Mask peer (decodedCodes);
+        result = decodedCodes == peerCodes &&
+            crypto::CipherSuite::Negotiate (codes, peer) ==
+                crypto::CipherSuite::Weakest.GetCode () &&
+            crypto::CipherSuite::Negotiate (codes, crypto::CipherSuite::Mask ()) ==
+                crypto::CipherSuite::INVALID_CODE;
+    }
+    std::cout << (result ? "pass" : "fail") << std::endl;
+    CHECK_EQUAL (result, true);
+}
+
+TEST (thekogans, AlgorithmSubset) {
+    crypto::OpenSSLInit openSSLInit;
+    std::cout << "AlgorithmSubset...";
+    const std::vector<crypto::CipherSuite> &cipherSuites = crypto::CipherSuite::GetCipherSuites ();
+    // Even a THEKOGANS_CRYPTO_MINIMAL build has the strongest suite.
+    bool strongest = false;
+    bool result = true;
+    for (std::size_t i = 0, count = cipherSuites.size (); result && i < count; ++i) {
+        const crypto::CipherSuite &cipherSuite = cipherSuites[i];
+        if (cipherSuite == crypto::CipherSuite::Strongest) {
+            strongest = true;
+        }
+    #if !defined (THEKOGANS_CRYPTO_HAVE_RSA)
+        result = result &&
+            cipherSuite.keyExchange != crypto::CipherSuite::KEY_EXCHANGE_RSA &&
+            cipherSuite.authenticator != crypto::CipherSuite::AUTHENTICATOR_RSA;
+    #endif // !defined (THEKOGANS_CRYPTO_HAVE_RSA)
+    #if !defined (THEKOGANS_CRYPTO_HAVE_DSA)
+        result = result && cipherSuite.authenticator != crypto::CipherSuite::AUTHENTICATOR_DSA;
+    #endif // !defined (THEKOGANS_CRYPTO_HAVE_DSA)
+    #if !defined (THEKOGANS_CRYPTO_HAVE_DH)
+        result = result && cipherSuite.keyExchange != crypto::CipherSuite::KEY_EXCHANGE_DHE;
+    #endif // !defined (THEKOGANS_CRYPTO_HAVE_DH)
+    #if !defined (THEKOGANS_CRYPTO_HAVE_CBC)
+        result = result && crypto::IsCipherAEAD (cipherSuite.GetOpenSSLCipher ());
+    #endif // !defined (THEKOGANS_CRYPTO_HAVE_CBC)
+    }
+    result = result && strongest;
+    std::cout << (result ? "pass" : "fail") << std::endl;
+    CHECK_EQUAL (result, true);
+}
+
 TESTMAIN
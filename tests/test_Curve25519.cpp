@@ -15,6 +15,9 @@
 // You should have received a copy of the GNU General Public License
 // along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
 
+#include <memory>
+#include <vector>
+#include <utility>
 #include <iostream>
 #include <CppUnitXLite/CppUnitXLite.cpp>
 #include "thekogans/util/Types.h"
@@ -117,6 +120,441 @@ namespace {
         std::cout << "pass" << std::endl;
         return true;
     }
+
+    bool TestEd25519ExpandedPrivateKey () {
+        std::cout << "Ed25519 expanded private key...";
+        util::ui8 privateKey[crypto::Ed25519::PRIVATE_KEY_LENGTH];
+        crypto::Ed25519::CreateKey (privateKey);
+        util::ui8 publicKey[crypto::Ed25519::PUBLIC_KEY_LENGTH];
+        crypto::Ed25519::GetPublicKey (privateKey, publicKey);
+        crypto::Ed25519::ExpandedPrivateKey expandedPrivateKey (privateKey);
+        const char message[] = "Ed25519 expanded private key";
+        util::ui8 signature1[crypto::Ed25519::SIGNATURE_LENGTH];
+        crypto::Ed25519::SignBuffer (message, sizeof (message), privateKey, signature1);
+        util::ui8 signature2[crypto::Ed25519::SIGNATURE_LENGTH];
+        crypto::Ed25519::SignBuffer (message, sizeof (message), expandedPrivateKey, signature2);
+        // Ed25519 is deterministic.
+        if (memcmp (signature1, signature2, sizeof (signature1)) != 0 ||
+                !crypto::Ed25519::VerifyBufferSignature (
+                    message, sizeof (message), publicKey, signature2)) {
+            std::cout << "Ed25519 expanded private key test failed." << std::endl;
+            return false;
+        }
+        std::cout << "pass" << std::endl;
+        return true;
+    }
+
+    bool TestEd25519PreparedPublicKey () {
+        std::cout << "Ed25519 prepared public key...";
+        util::ui8 privateKey[crypto::Ed25519::PRIVATE_KEY_LENGTH];
+        crypto::Ed25519::CreateKey (privateKey);
+        util::ui8 publicKey[crypto::Ed25519::PUBLIC_KEY_LENGTH];
+        crypto::Ed25519::GetPublicKey (privateKey, publicKey);
+        crypto::Ed25519::PreparedPublicKey preparedPublicKey (publicKey);
+        const char message[] = "Ed25519 prepared public key";
+        util::ui8 signature[crypto::Ed25519::SIGNATURE_LENGTH];
+        crypto::Ed25519::SignBuffer (message, sizeof (message), privateKey, signature);
+        bool valid = preparedPublicKey.valid &&
+            crypto::Ed25519::VerifyBufferSignature (
+                message, sizeof (message), preparedPublicKey, signature);
+        signature[0] ^= 1;
+        if (!valid || crypto::Ed25519::VerifyBufferSignature (
+                message, sizeof (message), preparedPublicKey, signature)) {
+            std::cout << "Ed25519 prepared public key test failed." << std::endl;
+            return false;
+        }
+        std::cout << "pass" << std::endl;
+        return true;
+    }
+
+    bool TestEd25519Batch () {
+        std::cout << "Ed25519 batch verification...";
+        const std::size_t COUNT = 100;
+        std::vector<util::ui8> publicKeys (COUNT * crypto::Ed25519::PUBLIC_KEY_LENGTH);
+        std::vector<util::ui8> signatures (COUNT * crypto::Ed25519::SIGNATURE_LENGTH);
+        std::vector<util::ui64> messages (COUNT);
+        std::vector<const void *> buffers (COUNT);
+        std::vector<std::size_t> bufferLengths (COUNT);
+        std::vector<const util::ui8 *> publicKeyPtrs (COUNT);
+        std::vector<const util::ui8 *> signaturePtrs (COUNT);
+        for (std::size_t i = 0; i < COUNT; ++i) {
+            util::ui8 privateKey[crypto::Ed25519::PRIVATE_KEY_LENGTH];
+            crypto::Ed25519::CreateKey (privateKey);
+            publicKeyPtrs[i] = &publicKeys[i * crypto::Ed25519::PUBLIC_KEY_LENGTH];
+            crypto::Ed25519::GetPublicKey (privateKey, &publicKeys[i * crypto::Ed25519::PUBLIC_KEY_LENGTH]);
+            messages[i] = i;
+            buffers[i] = &messages[i];
+            bufferLengths[i] = sizeof (messages[i]);
+            signaturePtrs[i] = &signatures[i * crypto::Ed25519::SIGNATURE_LENGTH];
+            crypto::Ed25519::SignBuffer (buffers[i], bufferLengths[i], privateKey,
+                &signatures[i * crypto::Ed25519::SIGNATURE_LENGTH]);
+        }
+        if (!crypto::Ed25519::VerifyBufferSignatureBatch (
+                buffers.data (), bufferLengths.data (),
+                publicKeyPtrs.data (), signaturePtrs.data (), COUNT)) {
+            std::cout << "Ed25519 batch verification test failed." << std::endl;
+            return false;
+        }
+        // Corrupt one signature and make sure the per item results find it.
+        const std::size_t BAD = 77;
+        signatures[BAD * crypto::Ed25519::SIGNATURE_LENGTH] ^= 1;
+        std::unique_ptr<bool []> results (new bool[COUNT]);
+        if (crypto::Ed25519::VerifyBufferSignatureBatch (
+                buffers.data (), bufferLengths.data (),
+                publicKeyPtrs.data (), signaturePtrs.data (), COUNT, results.get ())) {
+            std::cout << "Ed25519 batch verification test failed." << std::endl;
+            return false;
+        }
+        for (std::size_t i = 0; i < COUNT; ++i) {
+            if (results[i] != (i != BAD)) {
+                std::cout << "Ed25519 batch verification test failed." << std::endl;
+                return false;
+            }
+        }
+        std::cout << "pass" << std::endl;
+        return true;
+    }
+
+    bool TestEd25519SmallOrderAgreement () {
+        std::cout << "Ed25519 small order batch/single agreement...";
+        // Public key of order 8, R = identity, s = 0. s * B - h * A = -h * A is
+        // R only when 8 | h, so a cofactorless check accepts some messages,
+        // while a cofactored equation accepts them all. Small order keys are
+        // rejected, so all paths must reject every message.
+        static const util::ui8 publicKey[crypto::Ed25519::PUBLIC_KEY_LENGTH] = {
+            0xc7, 0x17, 0x6a, 0x70, 0x3d, 0x4d, 0xd8, 0x4f, 0xba, 0x3c, 0x0b,
+            0x76, 0x0d, 0x10, 0x67, 0x0f, 0x2a, 0x20, 0x53, 0xfa, 0x2c, 0x39,
+            0xcc, 0xc6, 0x4e, 0xc7, 0xfd, 0x77, 0x92, 0xac, 0x03, 0x7a
+        };
+        util::ui8 signature[crypto::Ed25519::SIGNATURE_LENGTH] = {1};
+        crypto::Ed25519::PreparedPublicKey preparedPublicKey (publicKey);
+        for (util::ui64 message = 0; message < 16; ++message) {
+            const void *buffer = &message;
+            std::size_t bufferLength = sizeof (message);
+            const util::ui8 *publicKeyPtr = publicKey;
+            const util::ui8 *signaturePtr = signature;
+            bool batch = crypto::Ed25519::VerifyBufferSignatureBatch (
+                &buffer, &bufferLength, &publicKeyPtr, &signaturePtr, 1);
+            bool single = crypto::Ed25519::VerifyBufferSignature (
+                buffer, bufferLength, publicKey, signature);
+            bool prepared = crypto::Ed25519::VerifyBufferSignature (
+                buffer, bufferLength, preparedPublicKey, signature);
+            if (batch || single || prepared || preparedPublicKey.valid) {
+                std::cout << "Ed25519 small order batch/single agreement test failed." << std::endl;
+                return false;
+            }
+        }
+        std::cout << "pass" << std::endl;
+        return true;
+    }
+
+    bool VerifyAllPaths (
+            const void *buffer,
+            std::size_t bufferLength,
+            const util::ui8 *publicKey,
+            const util::ui8 *signature) {
+        crypto::Ed25519::PreparedPublicKey preparedPublicKey (publicKey);
+        bool batch = crypto::Ed25519::VerifyBufferSignatureBatch (
+            &buffer, &bufferLength, &publicKey, &signature, 1);
+        bool single = crypto::Ed25519::VerifyBufferSignature (
+            buffer, bufferLength, publicKey, signature);
+        bool prepared = crypto::Ed25519::VerifyBufferSignature (
+            buffer, bufferLength, preparedPublicKey, signature);
+        return batch || single || prepared;
+    }
+
+    bool TestEd25519NonCanonical () {
+        std::cout << "Ed25519 non canonical signatures...";
+        util::ui8 privateKey[crypto::Ed25519::PRIVATE_KEY_LENGTH];
+        crypto::Ed25519::CreateKey (privateKey);
+        util::ui8 publicKey[crypto::Ed25519::PUBLIC_KEY_LENGTH];
+        crypto::Ed25519::GetPublicKey (privateKey, publicKey);
+        const char message[] = "Ed25519 non canonical signatures";
+        util::ui8 signature[crypto::Ed25519::SIGNATURE_LENGTH];
+        crypto::Ed25519::SignBuffer (message, sizeof (message), privateKey, signature);
+        if (!VerifyAllPaths (message, sizeof (message), publicKey, signature)) {
+            std::cout << "Ed25519 non canonical signatures test failed." << std::endl;
+            return false;
+        }
+        // s + L verifies just like s unless s < L is enforced.
+        static const util::ui8 L[32] = {
+            0xed, 0xd3, 0xf5, 0x5c, 0x1a, 0x63, 0x12, 0x58,
+            0xd6, 0x9c, 0xf7, 0xa2, 0xde, 0xf9, 0xde, 0x14,
+            0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+            0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x10
+        };
+        util::ui8 malleated[crypto::Ed25519::SIGNATURE_LENGTH];
+        memcpy (malleated, signature, sizeof (malleated));
+        util::ui32 carry = 0;
+        for (std::size_t i = 0; i < 32; ++i) {
+            carry += (util::ui32)malleated[32 + i] + L[i];
+            malleated[32 + i] = (util::ui8)carry;
+            carry >>= 8;
+        }
+        if (VerifyAllPaths (message, sizeof (message), publicKey, malleated)) {
+            std::cout << "Ed25519 non canonical s test failed." << std::endl;
+            return false;
+        }
+        // y = p + 1, a non canonical encoding of the identity.
+        util::ui8 nonCanonical[32];
+        memset (nonCanonical, 0xff, sizeof (nonCanonical));
+        nonCanonical[0] = 0xee;
+        nonCanonical[31] = 0x7f;
+        memcpy (malleated, signature, sizeof (malleated));
+        memcpy (malleated, nonCanonical, sizeof (nonCanonical));
+        if (VerifyAllPaths (message, sizeof (message), publicKey, malleated) ||
+                VerifyAllPaths (message, sizeof (message), nonCanonical, signature)) {
+            std::cout << "Ed25519 non canonical point test failed." << std::endl;
+            return false;
+        }
+        // Small order public key, R = identity, s = 0 (verifies for any
+        // message under a cofactored check).
+        util::ui8 identity[crypto::Ed25519::SIGNATURE_LENGTH] = {1};
+        static const util::ui8 smallOrderPublicKeys[][32] = {
+            // identity (order 1)
+            {0x01},
+            // order 2
+            {0xec, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+             0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+             0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+             0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x7f},
+            // order 4
+            {0x00}
+        };
+        for (std::size_t i = 0; i < sizeof (smallOrderPublicKeys) / 32; ++i) {
+            if (VerifyAllPaths (message, sizeof (message), smallOrderPublicKeys[i], identity)) {
+                std::cout << "Ed25519 small order public key test failed." << std::endl;
+                return false;
+            }
+        }
+        std::cout << "pass" << std::endl;
+        return true;
+    }
+
+    // RFC 8032 section 7.1, TEST 2 and TEST 3. The private key is
+    // seed || public key (see Ed25519::CreateKey).
+    struct Ed25519KAT {
+        util::ui8 privateKey[crypto::Ed25519::PRIVATE_KEY_LENGTH];
+        util::ui8 message[2];
+        std::size_t messageLength;
+        util::ui8 signature[crypto::Ed25519::SIGNATURE_LENGTH];
+    } const ed25519KATs[] = {
+        {
+            {
+                0x4c, 0xcd, 0x08, 0x9b, 0x28, 0xff, 0x96, 0xda, 0x9d, 0xb6, 0xc3,
+                0x46, 0xec, 0x11, 0x4e, 0x0f, 0x5b, 0x8a, 0x31, 0x9f, 0x35, 0xab,
+                0xa6, 0x24, 0xda, 0x8c, 0xf6, 0xed, 0x4f, 0xb8, 0xa6, 0xfb, 0x3d,
+                0x40, 0x17, 0xc3, 0xe8, 0x43, 0x89, 0x5a, 0x92, 0xb7, 0x0a, 0xa7,
+                0x4d, 0x1b, 0x7e, 0xbc, 0x9c, 0x98, 0x2c, 0xcf, 0x2e, 0xc4, 0x96,
+                0x8c, 0xc0, 0xcd, 0x55, 0xf1, 0x2a, 0xf4, 0x66, 0x0c,
+            },
+            {0x72},
+            1,
+            {
+                0x92, 0xa0, 0x09, 0xa9, 0xf0, 0xd4, 0xca, 0xb8, 0x72, 0x0e, 0x82,
+                0x0b, 0x5f, 0x64, 0x25, 0x40, 0xa2, 0xb2, 0x7b, 0x54, 0x16, 0x50,
+                0x3f, 0x8f, 0xb3, 0x76, 0x22, 0x23, 0xeb, 0xdb, 0x69, 0xda, 0x08,
+                0x5a, 0xc1, 0xe4, 0x3e, 0x15, 0x99, 0x6e, 0x45, 0x8f, 0x36, 0x13,
+                0xd0, 0xf1, 0x1d, 0x8c, 0x38, 0x7b, 0x2e, 0xae, 0xb4, 0x30, 0x2a,
+                0xee, 0xb0, 0x0d, 0x29, 0x16, 0x12, 0xbb, 0x0c, 0x00,
+            }
+        },
+        {
+            {
+                0xc5, 0xaa, 0x8d, 0xf4, 0x3f, 0x9f, 0x83, 0x7b, 0xed, 0xb7, 0x44,
+                0x2f, 0x31, 0xdc, 0xb7, 0xb1, 0x66, 0xd3, 0x85, 0x35, 0x07, 0x6f,
+                0x09, 0x4b, 0x85, 0xce, 0x3a, 0x2e, 0x0b, 0x44, 0x58, 0xf7, 0xfc,
+                0x51, 0xcd, 0x8e, 0x62, 0x18, 0xa1, 0xa3, 0x8d, 0xa4, 0x7e, 0xd0,
+                0x02, 0x30, 0xf0, 0x58, 0x08, 0x16, 0xed, 0x13, 0xba, 0x33, 0x03,
+                0xac, 0x5d, 0xeb, 0x91, 0x15, 0x48, 0x90, 0x80, 0x25,
+            },
+            {0xaf, 0x82},
+            2,
+            {
+                0x62, 0x91, 0xd6, 0x57, 0xde, 0xec, 0x24, 0x02, 0x48, 0x27, 0xe6,
+                0x9c, 0x3a, 0xbe, 0x01, 0xa3, 0x0c, 0xe5, 0x48, 0xa2, 0x84, 0x74,
+                0x3a, 0x44, 0x5e, 0x36, 0x80, 0xd7, 0xdb, 0x5a, 0xc3, 0xac, 0x18,
+                0xff, 0x9b, 0x53, 0x8d, 0x16, 0xf2, 0x90, 0xae, 0x67, 0xf7, 0x60,
+                0x98, 0x4d, 0xc6, 0x59, 0x4a, 0x7c, 0x15, 0xe9, 0x71, 0x6e, 0xd2,
+                0x8d, 0xc0, 0x27, 0xbe, 0xce, 0xea, 0x1e, 0xc4, 0x0a,
+            }
+        }
+    };
+
+    bool TestEd25519KAT (
+            const char *name,
+            std::size_t (*signBuffer) (
+                const void *,
+                std::size_t,
+                const util::ui8 *,
+                util::ui8 *),
+            bool (*verifyBufferSignature) (
+                const void *,
+                std::size_t,
+                const util::ui8 *,
+                const util::ui8 *)) {
+        const std::size_t count = sizeof (ed25519KATs) / sizeof (ed25519KATs[0]);
+        for (std::size_t i = 0; i < count; ++i) {
+            const Ed25519KAT &kat = ed25519KATs[i];
+            const util::ui8 *publicKey =
+                kat.privateKey + crypto::Ed25519::PRIVATE_KEY_LENGTH / 2;
+            util::ui8 signature[crypto::Ed25519::SIGNATURE_LENGTH];
+            signBuffer (kat.message, kat.messageLength, kat.privateKey, signature);
+            if (memcmp (signature, kat.signature, sizeof (signature)) != 0) {
+                std::cout << name << " Ed25519 sign test " << i << " failed." << std::endl;
+                return false;
+            }
+            if (!verifyBufferSignature (kat.message, kat.messageLength, publicKey, kat.signature)) {
+                std::cout << name << " Ed25519 verify test " << i << " failed." << std::endl;
+                return false;
+            }
+            signature[0] ^= 1;
+            if (verifyBufferSignature (kat.message, kat.messageLength, publicKey, signature)) {
+                std::cout << name << " Ed25519 forgery test " << i << " failed." << std::endl;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool TestEd25519BatchKAT (
+            const char *name,
+            bool (*verifyBufferSignatureBatch) (
+                const void * const *,
+                const std::size_t *,
+                const util::ui8 * const *,
+                const util::ui8 * const *,
+                std::size_t)) {
+        const std::size_t count = sizeof (ed25519KATs) / sizeof (ed25519KATs[0]);
+        const void *buffers[count];
+        std::size_t bufferLengths[count];
+        const util::ui8 *publicKeys[count];
+        const util::ui8 *signatures[count];
+        for (std::size_t i = 0; i < count; ++i) {
+            buffers[i] = ed25519KATs[i].message;
+            bufferLengths[i] = ed25519KATs[i].messageLength;
+            publicKeys[i] =
+                ed25519KATs[i].privateKey + crypto::Ed25519::PRIVATE_KEY_LENGTH / 2;
+            signatures[i] = ed25519KATs[i].signature;
+        }
+        if (!verifyBufferSignatureBatch (buffers, bufferLengths, publicKeys, signatures, count)) {
+            std::cout << name << " Ed25519 batch test failed." << std::endl;
+            return false;
+        }
+        // Swapping the messages must break the batch equation.
+        std::swap (buffers[0], buffers[1]);
+        std::swap (bufferLengths[0], bufferLengths[1]);
+        if (verifyBufferSignatureBatch (buffers, bufferLengths, publicKeys, signatures, count)) {
+            std::cout << name << " Ed25519 batch forgery test failed." << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    bool VerifyBufferSignatureBatch (
+            const void * const *buffers,
+            const std::size_t *bufferLengths,
+            const util::ui8 * const *publicKeys,
+            const util::ui8 * const *signatures,
+            std::size_t count) {
+        return crypto::Ed25519::VerifyBufferSignatureBatch (
+            buffers, bufferLengths, publicKeys, signatures, count);
+    }
+
+    // RFC 7748 section 6.1.
+    const util::ui8 x25519AlicePrivateKey[crypto::X25519::PRIVATE_KEY_LENGTH] = {
+        0x77, 0x07, 0x6d, 0x0a, 0x73, 0x18, 0xa5, 0x7d, 0x3c, 0x16, 0xc1,
+        0x72, 0x51, 0xb2, 0x66, 0x45, 0xdf, 0x4c, 0x2f, 0x87, 0xeb, 0xc0,
+        0x99, 0x2a, 0xb1, 0x77, 0xfb, 0xa5, 0x1d, 0xb9, 0x2c, 0x2a,
+    };
+    const util::ui8 x25519AlicePublicKey[crypto::X25519::PUBLIC_KEY_LENGTH] = {
+        0x85, 0x20, 0xf0, 0x09, 0x89, 0x30, 0xa7, 0x54, 0x74, 0x8b, 0x7d,
+        0xdc, 0xb4, 0x3e, 0xf7, 0x5a, 0x0d, 0xbf, 0x3a, 0x0d, 0x26, 0x38,
+        0x1a, 0xf4, 0xeb, 0xa4, 0xa9, 0x8e, 0xaa, 0x9b, 0x4e, 0x6a,
+    };
+    const util::ui8 x25519BobPublicKey[crypto::X25519::PUBLIC_KEY_LENGTH] = {
+        0xde, 0x9e, 0xdb, 0x7d, 0x7b, 0x7d, 0xc1, 0xb4, 0xd3, 0x5b, 0x61,
+        0xc2, 0xec, 0xe4, 0x35, 0x37, 0x3f, 0x83, 0x43, 0xc8, 0x5b, 0x78,
+        0x67, 0x4d, 0xad, 0xfc, 0x7e, 0x14, 0x6f, 0x88, 0x2b, 0x4f,
+    };
+    const util::ui8 x25519SharedSecret[crypto::X25519::SHARED_SECRET_LENGTH] = {
+        0x4a, 0x5d, 0x9d, 0x5b, 0xa4, 0xce, 0x2d, 0xe1, 0x72, 0x8e, 0x3b,
+        0xf4, 0x80, 0x35, 0x0f, 0x25, 0xe0, 0x7e, 0x21, 0xc9, 0x47, 0xd1,
+        0x9e, 0x33, 0x76, 0xf0, 0x9b, 0x3c, 0x1e, 0x16, 0x17, 0x42,
+    };
+
+    bool TestX25519KAT (
+            const char *name,
+            void (*computeSharedSecret) (
+                const util::ui8 *,
+                const util::ui8 *,
+                util::ui8 *)) {
+        // The public key is the shared secret with the base point (u = 9).
+        static const util::ui8 basePoint[crypto::X25519::PUBLIC_KEY_LENGTH] = {9};
+        util::ui8 out[crypto::X25519::SHARED_SECRET_LENGTH];
+        computeSharedSecret (x25519AlicePrivateKey, basePoint, out);
+        if (memcmp (out, x25519AlicePublicKey, sizeof (out)) != 0) {
+            std::cout << name << " X25519 public key test failed." << std::endl;
+            return false;
+        }
+        computeSharedSecret (x25519AlicePrivateKey, x25519BobPublicKey, out);
+        if (memcmp (out, x25519SharedSecret, sizeof (out)) != 0) {
+            std::cout << name << " X25519 shared secret test failed." << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    void ComputeSharedSecret (
+            const util::ui8 *privateKey,
+            const util::ui8 *peerPublicKey,
+            util::ui8 *sharedSecret) {
+        crypto::X25519::ComputeSharedSecret (privateKey, peerPublicKey, sharedSecret);
+    }
+
+    // Hold both field backends (the one Ed25519 and X25519 are built on
+    // and the portable ref10 one) to the same known answers. Without this,
+    // building with THEKOGANS_CRYPTO_HAVE_CURVE25519_FE51 leaves ref10
+    // untested (and vice versa).
+    bool TestCurve25519Backends () {
+        std::cout << "Curve25519 backends...";
+        util::ui8 publicKey[crypto::X25519::PUBLIC_KEY_LENGTH];
+        crypto::X25519::GetPublicKey (x25519AlicePrivateKey, publicKey);
+        if (memcmp (publicKey, x25519AlicePublicKey, sizeof (publicKey)) != 0) {
+            std::cout << "X25519::GetPublicKey test failed." << std::endl;
+            return false;
+        }
+        if (!TestX25519KAT ("X25519", ComputeSharedSecret) ||
+                !TestX25519KAT ("ref10", crypto::Curve25519Ref10::X25519ComputeSharedSecret) ||
+                !TestEd25519KAT ("Ed25519",
+                    crypto::Ed25519::SignBuffer,
+                    crypto::Ed25519::VerifyBufferSignature) ||
+                !TestEd25519KAT ("ref10",
+                    crypto::Curve25519Ref10::Ed25519SignBuffer,
+                    crypto::Curve25519Ref10::Ed25519VerifyBufferSignature) ||
+                !TestEd25519BatchKAT ("Ed25519", VerifyBufferSignatureBatch) ||
+                !TestEd25519BatchKAT ("ref10",
+                    crypto::Curve25519Ref10::Ed25519VerifyBufferSignatureBatch)) {
+            return false;
+        }
+        std::cout << "pass" << std::endl;
+        return true;
+    }
+}
+
+TEST (thekogans, Ed25519) {
+    crypto::OpenSSLInit openSSLInit;
+    CHECK_EQUAL (
+        TestEd25519ExpandedPrivateKey () &&
+        TestEd25519PreparedPublicKey () &&
+        TestEd25519Batch () &&
+        TestEd25519SmallOrderAgreement () &&
+        TestEd25519NonCanonical (), true);
+}
+
+TEST (thekogans, Curve25519Backends) {
+    crypto::OpenSSLInit openSSLInit;
+    CHECK_EQUAL (TestCurve25519Backends (), true);
 }
 
 TEST (thekogans, X25519) {
@@ -0,0 +1,726 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iterator>
+#include <iostream>
+#include <CppUnitXLite/CppUnitXLite.cpp>
+#include "thekogans/util/Types.h"
+#include "thekogans/util/Buffer.h"
+#include "thekogans/util/Exception.h"
+#include "thekogans/util/SpinLock.h"
+#include "thekogans/util/LockGuard.h"
+#include "thekogans/crypto/OpenSSLInit.h"
+#include "thekogans/crypto/OpenSSLUtils.h"
+#include "thekogans/crypto/ID.h"
+#include "thekogans/crypto/SymmetricKey.h"
+#include "thekogans/crypto/KeyRing.h"
+#include "thekogans/crypto/CipherSuite.h"
+#include "thekogans/crypto/Cipher.h"
+#include "thekogans/crypto/Compressor.h"
+#include "thekogans/crypto/ContentDefinedChunker.h"
+#include "thekogans/crypto/FileEncryptor.h"
+#include "thekogans/crypto/FileDecryptor.h"
+#include "TestData.h"
+
+using namespace thekogans;
+using crypto::tests::MakeData;
+
+namespace {
+    const char * const PLAINTEXT_PATH = "test_FileEncryptor.plaintext";
+    const char * const CIPHERTEXT_PATH = "test_FileEncryptor.ciphertext";
+    const char * const DECRYPTED_PATH = "test_FileEncryptor.decrypted";
+
+    void WriteFile (
+            const std::string &path,
+            const std::string &data) {
+        std::ofstream file (path.c_str (), std::ios::binary | std::ios::trunc);
+        file.write (data.data (), data.size ());
+    }
+
+    std::string ReadFile (const std::string &path) {
+        std::ifstream file (path.c_str (), std::ios::binary);
+        return std::string (
+            std::istreambuf_iterator<char> (file),
+            std::istreambuf_iterator<char> ());
+    }
+
+    void RemoveFiles () {
+        std::remove (PLAINTEXT_PATH);
+        std::remove (CIPHERTEXT_PATH);
+        std::remove (DECRYPTED_PATH);
+    }
+
+    // Decrypt CIPHERTEXT_PATH and compare it to plaintext.
+    bool Decrypts (
+            crypto::FileDecryptor &fileDecryptor,
+            const std::string &plaintext) {
+        THEKOGANS_UTIL_TRY {
+            fileDecryptor.Decrypt (CIPHERTEXT_PATH, DECRYPTED_PATH);
+            return ReadFile (DECRYPTED_PATH) == plaintext;
+        }
+        THEKOGANS_UTIL_CATCH (util::Exception) {
+            return false;
+        }
+    }
+
+    bool Decrypts (
+            crypto::KeyRing::SharedPtr keyRing,
+            const std::string &plaintext) {
+        crypto::FileDecryptor fileDecryptor (keyRing, 2);
+        return Decrypts (fileDecryptor, plaintext);
+    }
+
+    // A key ring format file (block size followed by FrameHeader framed
+    // blocks) whose i'th block is encrypted with keys[keyIndices[i]].
+    std::string MakeKeyRingFile (
+            const crypto::CipherSuite &cipherSuite,
+            const std::vector<crypto::SymmetricKey::SharedPtr> &keys,
+            const std::vector<std::size_t> &keyIndices,
+            const std::string &plaintext,
+            util::ui32 blockSize) {
+        std::string file;
+        file += (char)(blockSize >> 24);
+        file += (char)(blockSize >> 16);
+        file += (char)(blockSize >> 8);
+        file += (char)blockSize;
+        for (std::size_t i = 0, count = keyIndices.size (); i < count; ++i) {
+            std::string block = plaintext.substr (i * blockSize, blockSize);
+            util::Buffer frame =
+                cipherSuite.GetCipher (keys[keyIndices[i]])->EncryptAndFrame (
+                    block.data (), block.size ());
+            file.append (
+                (const char *)frame.GetReadPtr (),
+                frame.GetDataAvailableForReading ());
+        }
+        return file;
+    }
+
+    // Return the chunks of data.
+    std::vector<std::string> Chunk (
+            const crypto::ContentDefinedChunker &chunker,
+            const std::string &data) {
+        std::vector<std::string> chunks;
+        for (std::size_t offset = 0; offset < data.size ();) {
+            std::size_t length = chunker.FindBoundary (
+                (const util::ui8 *)data.data () + offset,
+                data.size () - offset);
+            chunks.push_back (data.substr (offset, length));
+            offset += length;
+        }
+        return chunks;
+    }
+
+    // Split a content defined chunking file in to it's header
+    // (marker, master key id, block size) and frames (the
+    // last one being the trailer).
+    void SplitChunkedFile (
+            const std::string &file,
+            std::string &header,
+            std::vector<std::string> &frames) {
+        std::size_t headerLength = util::UI32_SIZE + crypto::ID::SIZE + util::UI32_SIZE;
+        header = file.substr (0, headerLength);
+        frames.clear ();
+        for (std::size_t offset = headerLength; offset < file.size ();) {
+            const util::ui8 *length = (const util::ui8 *)file.data () + offset + crypto::ID::SIZE;
+            util::ui32 ciphertextLength =
+                ((util::ui32)length[0] << 24) | ((util::ui32)length[1] << 16) |
+                ((util::ui32)length[2] << 8) | (util::ui32)length[3];
+            std::size_t frameLength = crypto::FileEncryptor::CHUNKED_FRAME_HEADER_SIZE +
+                (ciphertextLength == crypto::FileEncryptor::CHUNKS_TRAILER ? 0 : ciphertextLength);
+            frames.push_back (file.substr (offset, frameLength));
+            offset += frameLength;
+        }
+    }
+
+    // Split a derived keys file in to it's header (marker, master
+    // key id, file id, block size) and frames.
+    void SplitDerivedFile (
+            const std::string &file,
+            std::string &header,
+            std::vector<std::string> &frames) {
+        std::size_t headerLength =
+            util::UI32_SIZE + crypto::ID::SIZE + crypto::ID::SIZE + util::UI32_SIZE;
+        header = file.substr (0, headerLength);
+        frames.clear ();
+        for (std::size_t offset = headerLength; offset < file.size ();) {
+            const util::ui8 *length = (const util::ui8 *)file.data () + offset + util::UI64_SIZE;
+            util::ui32 ciphertextLength =
+                ((util::ui32)length[0] << 24) | ((util::ui32)length[1] << 16) |
+                ((util::ui32)length[2] << 8) | (util::ui32)length[3];
+            std::size_t frameLength =
+                crypto::FileEncryptor::DERIVED_FRAME_HEADER_SIZE + ciphertextLength;
+            frames.push_back (file.substr (offset, frameLength));
+            offset += frameLength;
+        }
+    }
+
+    std::string JoinFrames (
+            const std::string &header,
+            const std::vector<std::string> &frames) {
+        std::string file = header;
+        for (std::size_t i = 0, count = frames.size (); i < count; ++i) {
+            file += frames[i];
+        }
+        return file;
+    }
+
+    typedef std::map<crypto::ID, std::vector<util::ui8>> ChunkStore;
+
+    // Keeps the chunks in a (shared) store, and skips the ones already there.
+    struct StoringFileEncryptor : public crypto::FileEncryptor {
+        util::SpinLock &spinLock;
+        ChunkStore &store;
+        std::size_t skipped;
+
+        StoringFileEncryptor (
+            crypto::KeyRing::SharedPtr keyRing,
+            util::SpinLock &spinLock_,
+            ChunkStore &store_) :
+            crypto::FileEncryptor (keyRing, DEFAULT_BLOCK_SIZE, 2),
+            spinLock (spinLock_),
+            store (store_),
+            skipped (0) {}
+
+    protected:
+        virtual bool IsChunkStored (
+                const crypto::ID &chunkId,
+                std::size_t /*plaintextLength*/) override {
+            util::LockGuard<util::SpinLock> guard (spinLock);
+            if (store.find (chunkId) != store.end ()) {
+                ++skipped;
+                return true;
+            }
+            return false;
+        }
+        virtual void OnChunkWritten (
+                const crypto::ID &chunkId,
+                const util::ui8 *ciphertext,
+                std::size_t ciphertextLength) override {
+            util::LockGuard<util::SpinLock> guard (spinLock);
+            store[chunkId].assign (ciphertext, ciphertext + ciphertextLength);
+        }
+    };
+
+    // Fetches skipped chunks from the store.
+    struct StoringFileDecryptor : public crypto::FileDecryptor {
+        const ChunkStore &store;
+
+        StoringFileDecryptor (
+            crypto::KeyRing::SharedPtr keyRing,
+            const ChunkStore &store_) :
+            crypto::FileDecryptor (keyRing, 2),
+            store (store_) {}
+
+    protected:
+        virtual util::Buffer GetStoredChunk (const crypto::ID &chunkId) override {
+            ChunkStore::const_iterator it = store.find (chunkId);
+            if (it == store.end ()) {
+                return crypto::FileDecryptor::GetStoredChunk (chunkId);
+            }
+            util::Buffer buffer (util::NetworkEndian, it->second.size ());
+            buffer.Write (it->second.data (), it->second.size ());
+            return buffer;
+        }
+    };
+
+    // Fails to encrypt the given block.
+    struct FailingFileEncryptor : public crypto::FileEncryptor {
+        util::ui64 failBlock;
+
+        FailingFileEncryptor (
+            crypto::SymmetricKey::SharedPtr key,
+            std::size_t workerCount,
+            util::ui64 failBlock_) :
+            crypto::FileEncryptor (
+                key,
+                THEKOGANS_CRYPTO_DEFAULT_CIPHER,
+                THEKOGANS_CRYPTO_DEFAULT_MD,
+                4096,
+                workerCount),
+            failBlock (failBlock_) {}
+
+    protected:
+        // crypto::BlockPipeline
+        virtual void ProcessBlock (
+                std::size_t workerIndex,
+                Block &block) override {
+            if (block.sequenceNumber == failBlock) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "Block " THEKOGANS_UTIL_UI64_FORMAT " failed",
+                    block.sequenceNumber);
+            }
+            crypto::FileEncryptor::ProcessBlock (workerIndex, block);
+        }
+    };
+
+    // Encrypt PLAINTEXT_PATH with the given number of workers.
+    std::string Encrypt (
+            crypto::SymmetricKey::SharedPtr key,
+            std::size_t workerCount) {
+        crypto::FileEncryptor fileEncryptor (
+            key,
+            THEKOGANS_CRYPTO_DEFAULT_CIPHER,
+            THEKOGANS_CRYPTO_DEFAULT_MD,
+            4096,
+            workerCount);
+        fileEncryptor.Encrypt (PLAINTEXT_PATH, CIPHERTEXT_PATH);
+        return ReadFile (CIPHERTEXT_PATH);
+    }
+
+    // Decrypt ciphertext with the given number of workers.
+    bool Decrypts (
+            crypto::SymmetricKey::SharedPtr key,
+            std::size_t workerCount,
+            const std::string &ciphertext,
+            const std::string &plaintext) {
+        WriteFile (CIPHERTEXT_PATH, ciphertext);
+        crypto::FileDecryptor fileDecryptor (
+            key,
+            THEKOGANS_CRYPTO_DEFAULT_CIPHER,
+            THEKOGANS_CRYPTO_DEFAULT_MD,
+            workerCount);
+        return Decrypts (fileDecryptor, plaintext);
+    }
+
+    void AppendUI32 (
+            std::string &data,
+            util::ui32 value) {
+        data += (char)(value >> 24);
+        data += (char)(value >> 16);
+        data += (char)(value >> 8);
+        data += (char)value;
+    }
+
+    util::ui32 GetUI32 (
+            const std::string &data,
+            std::size_t offset) {
+        const util::ui8 *value = (const util::ui8 *)data.data () + offset;
+        return
+            ((util::ui32)value[0] << 24) | ((util::ui32)value[1] << 16) |
+            ((util::ui32)value[2] << 8) | (util::ui32)value[3];
+    }
+
+    // Return the (compressed block) plaintexts of a single key
+    // compressed format file (marker, block size, length prefixed
+    // Cipher::Encrypt output).
+    std::vector<std::string> DecryptCompressedBlocks (
+            crypto::SymmetricKey::SharedPtr key,
+            const std::string &file) {
+        crypto::Cipher cipher (key);
+        std::vector<std::string> blocks;
+        for (std::size_t offset = util::UI32_SIZE + util::UI32_SIZE; offset < file.size ();) {
+            util::ui32 ciphertextLength = GetUI32 (file, offset);
+            offset += util::UI32_SIZE;
+            util::Buffer plaintext =
+                cipher.Decrypt (file.data () + offset, ciphertextLength);
+            blocks.push_back (
+                std::string (
+                    (const char *)plaintext.GetReadPtr (),
+                    plaintext.GetDataAvailableForReading ()));
+            offset += ciphertextLength;
+        }
+        return blocks;
+    }
+
+    // Write a single block compressed format file whose (authentic)
+    // block header claims the given uncompressed length.
+    std::string ForgeCompressedFile (
+            crypto::SymmetricKey::SharedPtr key,
+            util::ui32 blockSize,
+            util::ui32 uncompressedLength,
+            const std::string &payload) {
+        std::string block (1, (char)crypto::Compressor::NONE);
+        AppendUI32 (block, uncompressedLength);
+        block += payload;
+        crypto::Cipher cipher (key);
+        util::Buffer ciphertext = cipher.EncryptAndEnlengthen (block.data (), block.size (), 0, 0);
+        std::string file;
+        AppendUI32 (file, crypto::FileEncryptor::COMPRESSED_FORMAT_MARKER);
+        AppendUI32 (file, blockSize);
+        file.append (
+            (const char *)ciphertext.GetReadPtr (),
+            ciphertext.GetDataAvailableForReading ());
+        return file;
+    }
+}
+
+TEST (thekogans, ContentDefinedChunker) {
+    crypto::ContentDefinedChunker chunker (256, 1024, 4096);
+    std::string data = MakeData (256 * 1024, 1);
+    std::vector<std::string> before = Chunk (chunker, data);
+    // Insert 100 bytes in the middle.
+    std::size_t editOffset = data.size () / 2;
+    data.insert (editOffset, MakeData (100, 2));
+    std::vector<std::string> after = Chunk (chunker, data);
+    std::map<std::string, std::size_t> afterChunks;
+    for (std::size_t i = 0, count = after.size (); i < count; ++i) {
+        ++afterChunks[after[i]];
+    }
+    // Every chunk that ends before the edit is unchanged, and the
+    // boundaries resynchronize shortly after it.
+    std::size_t offset = 0;
+    std::size_t changed = 0;
+    bool prefixStable = true;
+    for (std::size_t i = 0, count = before.size (); i < count; ++i) {
+        bool found = afterChunks.find (before[i]) != afterChunks.end ();
+        offset += before[i].size ();
+        if (offset <= editOffset) {
+            prefixStable = prefixStable && found && after[i] == before[i];
+        }
+        else if (!found) {
+            ++changed;
+        }
+    }
+    CHECK_EQUAL (prefixStable, true);
+    CHECK_EQUAL (before.size () > 32 && changed <= 3, true);
+}
+
+TEST (thekogans, FileEncryptorChunked) {
+    crypto::OpenSSLInit openSSLInit;
+    crypto::KeyRing::SharedPtr keyRing (new crypto::KeyRing (crypto::CipherSuite::Strongest));
+    std::string plaintext = MakeData (64 * 1024, 3);
+    WriteFile (PLAINTEXT_PATH, plaintext);
+    crypto::FileEncryptor fileEncryptor (keyRing, crypto::FileEncryptor::DEFAULT_BLOCK_SIZE, 2);
+    fileEncryptor.SetContentDefinedChunking (true, 256, 1024, 4096);
+    fileEncryptor.Encrypt (PLAINTEXT_PATH, CIPHERTEXT_PATH);
+    CHECK_EQUAL (Decrypts (keyRing, plaintext), true);
+    // The master key is not a cipher key.
+    crypto::ID masterKeyId = fileEncryptor.GetMasterKey ()->GetId ();
+    CHECK_EQUAL (
+        keyRing->GetCipherKey (masterKeyId).Get () == 0 &&
+        crypto::FileEncryptor::FindMasterKey (*keyRing, masterKeyId).Get () != 0,
+        true);
+    std::string header;
+    std::vector<std::string> frames;
+    SplitChunkedFile (ReadFile (CIPHERTEXT_PATH), header, frames);
+    CHECK_EQUAL (frames.size () > 4, true);
+    {
+        // Reordered chunks.
+        std::vector<std::string> reordered = frames;
+        std::swap (reordered[0], reordered[1]);
+        WriteFile (CIPHERTEXT_PATH, JoinFrames (header, reordered));
+        CHECK_EQUAL (Decrypts (keyRing, plaintext), false);
+    }
+    {
+        // Dropped chunk.
+        std::vector<std::string> dropped = frames;
+        dropped.erase (dropped.begin () + 1);
+        WriteFile (CIPHERTEXT_PATH, JoinFrames (header, dropped));
+        CHECK_EQUAL (Decrypts (keyRing, plaintext), false);
+    }
+    {
+        // Truncated (no trailer, and no last chunk).
+        std::vector<std::string> truncated (frames.begin (), frames.end () - 1);
+        WriteFile (CIPHERTEXT_PATH, JoinFrames (header, truncated));
+        CHECK_EQUAL (Decrypts (keyRing, plaintext), false);
+        truncated.pop_back ();
+        truncated.push_back (frames.back ());
+        WriteFile (CIPHERTEXT_PATH, JoinFrames (header, truncated));
+        CHECK_EQUAL (Decrypts (keyRing, plaintext), false);
+    }
+    RemoveFiles ();
+}
+
+TEST (thekogans, FileEncryptorChunkedDedup) {
+    crypto::OpenSSLInit openSSLInit;
+    crypto::KeyRing::SharedPtr keyRing (new crypto::KeyRing (crypto::CipherSuite::Strongest));
+    util::SpinLock spinLock;
+    ChunkStore store;
+    std::string plaintext = MakeData (64 * 1024, 4);
+    WriteFile (PLAINTEXT_PATH, plaintext);
+    crypto::SymmetricKey::SharedPtr masterKey;
+    {
+        StoringFileEncryptor fileEncryptor (keyRing, spinLock, store);
+        fileEncryptor.SetContentDefinedChunking (true, 256, 1024, 4096);
+        fileEncryptor.Encrypt (PLAINTEXT_PATH, CIPHERTEXT_PATH);
+        masterKey = fileEncryptor.GetMasterKey ();
+        CHECK_EQUAL (fileEncryptor.skipped == 0 && store.size () > 32, true);
+    }
+    // Edit the file, and encrypt it again with the same master key.
+    plaintext.insert (plaintext.size () / 2, MakeData (100, 5));
+    WriteFile (PLAINTEXT_PATH, plaintext);
+    std::size_t storedChunks = store.size ();
+    {
+        StoringFileEncryptor fileEncryptor (keyRing, spinLock, store);
+        fileEncryptor.SetContentDefinedChunking (true, 256, 1024, 4096);
+        fileEncryptor.SetMasterKey (masterKey);
+        fileEncryptor.Encrypt (PLAINTEXT_PATH, CIPHERTEXT_PATH);
+        // Only the chunks around the edit are new.
+        CHECK_EQUAL (
+            fileEncryptor.skipped + 4 >= storedChunks &&
+            store.size () - storedChunks <= 4,
+            true);
+    }
+    // Skipped chunks are fetched from the store.
+    StoringFileDecryptor storingFileDecryptor (keyRing, store);
+    CHECK_EQUAL (Decrypts (storingFileDecryptor, plaintext), true);
+    // Without it, decryption fails.
+    CHECK_EQUAL (Decrypts (keyRing, plaintext), false);
+    RemoveFiles ();
+}
+
+TEST (thekogans, FileEncryptorDerivedKeys) {
+    crypto::OpenSSLInit openSSLInit;
+    crypto::KeyRing::SharedPtr keyRing (new crypto::KeyRing (crypto::CipherSuite::Strongest));
+    // The last block is short.
+    std::string plaintext = MakeData (16 * 4096 + 100, 6);
+    WriteFile (PLAINTEXT_PATH, plaintext);
+    crypto::FileEncryptor fileEncryptor (keyRing, 4096, 2);
+    fileEncryptor.SetDerivedKeys (true);
+    fileEncryptor.Encrypt (PLAINTEXT_PATH, CIPHERTEXT_PATH);
+    CHECK_EQUAL (Decrypts (keyRing, plaintext), true);
+    // The master key is not a cipher key.
+    crypto::ID masterKeyId = fileEncryptor.GetMasterKey ()->GetId ();
+    CHECK_EQUAL (
+        keyRing->GetCipherKey (masterKeyId).Get () == 0 &&
+        crypto::FileEncryptor::FindMasterKey (*keyRing, masterKeyId).Get () != 0,
+        true);
+    std::string file = ReadFile (CIPHERTEXT_PATH);
+    std::string header;
+    std::vector<std::string> frames;
+    SplitDerivedFile (file, header, frames);
+    CHECK_EQUAL (frames.size () == 17, true);
+    {
+        // Swapped blocks (out of order indices).
+        std::vector<std::string> swapped = frames;
+        std::swap (swapped[2], swapped[3]);
+        WriteFile (CIPHERTEXT_PATH, JoinFrames (header, swapped));
+        CHECK_EQUAL (Decrypts (keyRing, plaintext), false);
+    }
+    {
+        // Swapped block ciphertexts (indices in order). Every
+        // block key is bound to it's index, so they fail to authenticate.
+        std::vector<std::string> swapped = frames;
+        std::size_t headerSize = crypto::FileEncryptor::DERIVED_FRAME_HEADER_SIZE;
+        std::string ciphertext2 = swapped[2].substr (headerSize);
+        swapped[2] = swapped[2].substr (0, headerSize) + swapped[3].substr (headerSize);
+        swapped[3] = swapped[3].substr (0, headerSize) + ciphertext2;
+        WriteFile (CIPHERTEXT_PATH, JoinFrames (header, swapped));
+        CHECK_EQUAL (Decrypts (keyRing, plaintext), false);
+    }
+    {
+        // Wrong master key (same id, different key).
+        WriteFile (CIPHERTEXT_PATH, file);
+        crypto::SymmetricKey::SharedPtr randomKey = crypto::SymmetricKey::FromRandom ();
+        crypto::KeyRing::SharedPtr wrongKeyRing (
+            new crypto::KeyRing (crypto::CipherSuite::Strongest));
+        wrongKeyRing->AddUserData (
+            crypto::SymmetricKey::SharedPtr (
+                new crypto::SymmetricKey (
+                    randomKey->Get ().GetReadPtr (),
+                    randomKey->GetKeyLength (),
+                    masterKeyId)));
+        CHECK_EQUAL (Decrypts (wrongKeyRing, plaintext), false);
+        // And no master key at all.
+        CHECK_EQUAL (
+            Decrypts (
+                crypto::KeyRing::SharedPtr (new crypto::KeyRing (crypto::CipherSuite::Strongest)),
+                plaintext),
+            false);
+        CHECK_EQUAL (Decrypts (keyRing, plaintext), true);
+    }
+    RemoveFiles ();
+}
+
+TEST (thekogans, FileEncryptorWorkers) {
+    crypto::OpenSSLInit openSSLInit;
+    // The last block is short.
+    std::string plaintext = MakeData (32 * 4096 + 7, 7);
+    WriteFile (PLAINTEXT_PATH, plaintext);
+    crypto::SymmetricKey::SharedPtr key = crypto::SymmetricKey::FromRandom ();
+    // Every block has a random IV so the ciphertexts can't be compared
+    // byte for byte (see test_BlockPipeline.cpp). They must have the
+    // same layout, and decrypt in order with any number of workers.
+    std::string ciphertext1 = Encrypt (key, 1);
+    std::string ciphertext4 = Encrypt (key, 4);
+    CHECK_EQUAL (
+        ciphertext1.size () == ciphertext4.size () &&
+        ciphertext1 != ciphertext4,
+        true);
+    CHECK_EQUAL (Decrypts (key, 1, ciphertext1, plaintext), true);
+    CHECK_EQUAL (Decrypts (key, 4, ciphertext1, plaintext), true);
+    CHECK_EQUAL (Decrypts (key, 1, ciphertext4, plaintext), true);
+    CHECK_EQUAL (Decrypts (key, 4, ciphertext4, plaintext), true);
+    RemoveFiles ();
+}
+
+TEST (thekogans, FileDecryptorKeyCiphers) {
+    crypto::OpenSSLInit openSSLInit;
+    const util::ui32 blockSize = 1024;
+    crypto::KeyRing::SharedPtr keyRing (new crypto::KeyRing (crypto::CipherSuite::Strongest));
+    // More keys than a worker caches.
+    std::vector<crypto::SymmetricKey::SharedPtr> keys;
+    for (std::size_t i = 0; i < crypto::FileDecryptor::MAX_CACHED_CIPHERS + 8; ++i) {
+        keys.push_back (
+            crypto::SymmetricKey::FromRandom (
+                crypto::SymmetricKey::MIN_RANDOM_LENGTH,
+                0,
+                0,
+                crypto::GetCipherKeyLength (keyRing->GetCipherSuite ().GetOpenSSLCipher ())));
+        keyRing->AddCipherKey (keys.back ());
+    }
+    // Blocks rotating over a few keys (cache hits), then one block per
+    // key (the caches fill up and get flushed), then the first few keys
+    // again (cached anew after the flush).
+    std::vector<std::size_t> keyIndices;
+    for (std::size_t i = 0; i < 64; ++i) {
+        keyIndices.push_back (i % 3);
+    }
+    for (std::size_t i = 0, count = keys.size (); i < count; ++i) {
+        keyIndices.push_back (i);
+    }
+    for (std::size_t i = 0; i < 32; ++i) {
+        keyIndices.push_back (i % 3);
+    }
+    // The last block is short.
+    std::string plaintext = MakeData (keyIndices.size () * blockSize - 5, 9);
+    std::string ciphertext = MakeKeyRingFile (
+        keyRing->GetCipherSuite (), keys, keyIndices, plaintext, blockSize);
+    WriteFile (CIPHERTEXT_PATH, ciphertext);
+    const std::size_t workerCounts[] = {1, 3};
+    for (std::size_t i = 0; i < sizeof (workerCounts) / sizeof (workerCounts[0]); ++i) {
+        crypto::FileDecryptor fileDecryptor (keyRing, workerCounts[i]);
+        // The second Decrypt starts with warm caches.
+        CHECK_EQUAL (Decrypts (fileDecryptor, plaintext), true);
+        CHECK_EQUAL (Decrypts (fileDecryptor, plaintext), true);
+        // A cached Cipher still authenticates every block.
+        std::string tampered = ciphertext;
+        tampered[tampered.size () - 1] ^= 1;
+        WriteFile (CIPHERTEXT_PATH, tampered);
+        CHECK_EQUAL (Decrypts (fileDecryptor, plaintext), false);
+        WriteFile (CIPHERTEXT_PATH, ciphertext);
+    }
+    RemoveFiles ();
+}
+
+TEST (thekogans, FileEncryptorWorkerError) {
+    crypto::OpenSSLInit openSSLInit;
+    std::string plaintext = MakeData (32 * 4096, 8);
+    WriteFile (PLAINTEXT_PATH, plaintext);
+    crypto::SymmetricKey::SharedPtr key = crypto::SymmetricKey::FromRandom ();
+    {
+        // An encrypting worker's exception is raised by Encrypt.
+        FailingFileEncryptor fileEncryptor (key, 4, 9);
+        bool thrown = false;
+        THEKOGANS_UTIL_TRY {
+            fileEncryptor.Encrypt (PLAINTEXT_PATH, CIPHERTEXT_PATH);
+        }
+        THEKOGANS_UTIL_CATCH (util::Exception) {
+            thrown = exception.Report ().find ("Block 9 failed") != std::string::npos;
+        }
+        CHECK_EQUAL (thrown, true);
+        // And the encryptor is usable afterwards.
+        fileEncryptor.failBlock = (util::ui64)-1;
+        fileEncryptor.Encrypt (PLAINTEXT_PATH, CIPHERTEXT_PATH);
+    }
+    // A decrypting worker's exception (a block fails to
+    // authenticate) is raised by Decrypt.
+    std::string ciphertext = ReadFile (CIPHERTEXT_PATH);
+    CHECK_EQUAL (Decrypts (key, 4, ciphertext, plaintext), true);
+    ciphertext[ciphertext.size () / 2] ^= 1;
+    CHECK_EQUAL (Decrypts (key, 4, ciphertext, plaintext), false);
+    CHECK_EQUAL (Decrypts (key, 1, ciphertext, plaintext), false);
+    RemoveFiles ();
+}
+
+TEST (thekogans, FileEncryptorCompressed) {
+    crypto::OpenSSLInit openSSLInit;
+    // Alternate compressible (text) and incompressible (random) blocks.
+    std::string text;
+    while (text.size () < 4096) {
+        text += "The quick brown fox jumps over the lazy dog. ";
+    }
+    text.resize (4096);
+    std::string plaintext;
+    for (util::ui32 i = 0; i < 4; ++i) {
+        plaintext += text + MakeData (4096, i + 9);
+    }
+    // The last block is short.
+    plaintext += text.substr (0, 100);
+    WriteFile (PLAINTEXT_PATH, plaintext);
+    crypto::SymmetricKey::SharedPtr key = crypto::SymmetricKey::FromRandom ();
+    const util::ui8 algorithms[] = {
+        crypto::Compressor::ZSTD,
+        crypto::Compressor::LZ4
+    };
+    for (std::size_t i = 0; i < 2; ++i) {
+        if (!crypto::Compressor::IsSupported (algorithms[i])) {
+            continue;
+        }
+        crypto::FileEncryptor fileEncryptor (
+            key,
+            THEKOGANS_CRYPTO_DEFAULT_CIPHER,
+            THEKOGANS_CRYPTO_DEFAULT_MD,
+            4096,
+            2);
+        fileEncryptor.SetCompression (algorithms[i]);
+        fileEncryptor.Encrypt (PLAINTEXT_PATH, CIPHERTEXT_PATH);
+        std::string ciphertext = ReadFile (CIPHERTEXT_PATH);
+        CHECK_EQUAL (ciphertext.size () < plaintext.size (), true);
+        CHECK_EQUAL (Decrypts (key, 2, ciphertext, plaintext), true);
+        // Text blocks are compressed, random blocks (which
+        // don't shrink) are stored as is.
+        std::vector<std::string> blocks = DecryptCompressedBlocks (key, ciphertext);
+        CHECK_EQUAL (blocks.size () == 9, true);
+        bool stored = true;
+        for (std::size_t j = 0, count = blocks.size (); j < count; ++j) {
+            const std::string &block = blocks[j];
+            std::size_t length = j + 1 < count ? 4096 : 100;
+            util::ui8 algorithm = j % 2 == 0 ? algorithms[i] : (util::ui8)crypto::Compressor::NONE;
+            if (block.size () < crypto::FileEncryptor::COMPRESSED_BLOCK_HEADER_SIZE ||
+                    (util::ui8)block[0] != algorithm || GetUI32 (block, 1) != length ||
+                    (algorithm == crypto::Compressor::NONE ?
+                        block.substr (crypto::FileEncryptor::COMPRESSED_BLOCK_HEADER_SIZE) !=
+                            plaintext.substr (j * 4096, length) :
+                        block.size () >= crypto::FileEncryptor::COMPRESSED_BLOCK_HEADER_SIZE + length)) {
+                stored = false;
+            }
+        }
+        CHECK_EQUAL (stored, true);
+    }
+    RemoveFiles ();
+}
+
+TEST (thekogans, FileEncryptorCompressedLength) {
+    crypto::OpenSSLInit openSSLInit;
+    crypto::SymmetricKey::SharedPtr key = crypto::SymmetricKey::FromRandom ();
+    std::string payload = MakeData (100, 13);
+    // Well formed.
+    CHECK_EQUAL (
+        Decrypts (key, 2, ForgeCompressedFile (key, 4096, 100, payload), payload),
+        true);
+    // The header is authentic, but the length is bogus. The block must
+    // be rejected before it's decompressed in to a block size buffer.
+    CHECK_EQUAL (
+        Decrypts (key, 2, ForgeCompressedFile (key, 4096, 4097, payload), payload),
+        false);
+    CHECK_EQUAL (
+        Decrypts (key, 2, ForgeCompressedFile (key, 4096, 0xffffffff, payload), payload),
+        false);
+    CHECK_EQUAL (
+        Decrypts (key, 2, ForgeCompressedFile (key, 4096, 0, payload), payload),
+        false);
+    RemoveFiles ();
+}
+
+TESTMAIN
@@ -15,6 +15,8 @@
 // You should have received a copy of the GNU General Public License
 // along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
 
+#include <cstring>
+#include <vector>
 #include <iostream>
 #include <CppUnitXLite/CppUnitXLite.cpp>
 #include "thekogans/util/Exception.h"
@@ -23,8 +25,15 @@
 #include "thekogans/crypto/EC.h"
 #include "thekogans/crypto/RSA.h"
 #include "thekogans/crypto/AsymmetricKey.h"
+#include "thekogans/crypto/X25519AsymmetricKey.h"
+#include "thekogans/crypto/CipherSuite.h"
 #include "thekogans/crypto/DHEKeyExchange.h"
 #include "thekogans/crypto/RSAKeyExchange.h"
+#include "thekogans/crypto/AsyncEngine.h"
+#include "thekogans/crypto/EphemeralKeyPool.h"
+#include "thekogans/crypto/SessionTicketManager.h"
+#include "thekogans/crypto/SignedDHEParamsCache.h"
+#include "thekogans/crypto/ValidatedParamsCache.h"
 
 using namespace thekogans;
 
@@ -67,6 +76,151 @@ namespace {
         }
     }
 
+    bool TestDHEBatch (
+            const char *paramsName,
+            crypto::Params::SharedPtr params) {
+        THEKOGANS_UTIL_TRY {
+            std::cout << paramsName << " batch...";
+            const std::size_t COUNT = 16;
+            std::vector<crypto::KeyExchange::SharedPtr> clients;
+            std::vector<crypto::DHEKeyExchange::PendingDerivation> pending;
+            for (std::size_t i = 0; i < COUNT; ++i) {
+                clients.push_back (
+                    crypto::KeyExchange::SharedPtr (
+                        new crypto::DHEKeyExchange (crypto::ID (), params)));
+                crypto::KeyExchange::SharedPtr server (
+                    new crypto::DHEKeyExchange (clients.back ()->GetParams ()));
+                pending.push_back (
+                    crypto::DHEKeyExchange::PendingDerivation (
+                        clients.back (),
+                        server->GetParams ()));
+            }
+            // A bad entry must not stop the others.
+            pending.push_back (crypto::DHEKeyExchange::PendingDerivation (clients[0]));
+            crypto::DHEKeyExchange::DeriveSharedSymmetricKeys (pending);
+            bool result = pending.back ().key.Get () == 0 && !pending.back ().error.empty ();
+            for (std::size_t i = 0; result && i < COUNT; ++i) {
+                result = pending[i].key.Get () != 0 &&
+                    *pending[i].key == *clients[i]->DeriveSharedSymmetricKey (pending[i].params);
+            }
+            std::cout << (result ? "pass" : "fail") << std::endl;
+            return result;
+        }
+        THEKOGANS_UTIL_CATCH (util::Exception) {
+            std::cout << "fail " << exception.Report ();
+            return false;
+        }
+    }
+
+    bool TestEphemeralKeyPool (
+            const char *paramsName,
+            crypto::Params::SharedPtr params) {
+        THEKOGANS_UTIL_TRY {
+            std::cout << paramsName << " pool...";
+            crypto::EphemeralKeyPool::SharedPtr pool (new crypto::EphemeralKeyPool (params, 4));
+            crypto::EphemeralKeyPool::Register (pool);
+            const std::size_t COUNT = 8;
+            bool result = crypto::EphemeralKeyPool::Find (*params) == pool;
+            for (std::size_t i = 0; result && i < COUNT; ++i) {
+                crypto::DHEKeyExchange keyExchange1 (crypto::ID (), params);
+                crypto::DHEKeyExchange::Params::SharedPtr params1 = keyExchange1.GetParams ();
+                crypto::DHEKeyExchange keyExchange2 (params1);
+                result = *keyExchange1.DeriveSharedSymmetricKey (keyExchange2.GetParams ()) ==
+                    *keyExchange2.DeriveSharedSymmetricKey (params1);
+            }
+            crypto::EphemeralKeyPool::Unregister (pool);
+            pool->Stop ();
+            crypto::EphemeralKeyPool::Stats stats = pool->GetStats ();
+            // Both sides of every exchange took a key from the pool.
+            result = result && stats.hits + stats.misses == 2 * COUNT && stats.keys == 0 &&
+                crypto::EphemeralKeyPool::Find (*params).Get () == 0;
+            std::cout << (result ? "pass" : "fail") << std::endl;
+            return result;
+        }
+        THEKOGANS_UTIL_CATCH (util::Exception) {
+            std::cout << "fail " << exception.Report ();
+            return false;
+        }
+    }
+
+    bool TestCompactDHE (
+            const char *paramsName,
+            crypto::Params::SharedPtr params,
+            crypto::AsymmetricKey::SharedPtr privateKey) {
+        THEKOGANS_UTIL_TRY {
+            std::cout << paramsName << " compact...";
+            crypto::MessageDigest::SharedPtr messageDigest (new crypto::MessageDigest);
+            crypto::AsymmetricKey::SharedPtr publicKey = privateKey->GetPublicKey (privateKey->GetId ());
+            crypto::DHEKeyExchange keyExchange1 (crypto::ID (), params);
+            util::Buffer compact1 = keyExchange1.GetCompactParams (privateKey, messageDigest);
+            crypto::DHEKeyExchange::CompactDHEParams compactParams1;
+            bool result = compactParams1.Parse (
+                compact1.GetReadPtr (),
+                compact1.GetDataAvailableForReading ()) &&
+                compactParams1.ValidateSignature (publicKey, messageDigest) &&
+                compact1.GetDataAvailableForReading () <
+                    util::Serializable::Size (*keyExchange1.GetParams (privateKey, messageDigest));
+            if (result) {
+                crypto::DHEKeyExchange keyExchange2 (compactParams1.ToDHEParams ());
+                util::Buffer compact2 = keyExchange2.GetCompactParams ();
+                crypto::DHEKeyExchange::CompactDHEParams compactParams2;
+                result = compactParams2.Parse (
+                    compact2.GetReadPtr (),
+                    compact2.GetDataAvailableForReading ()) &&
+                    !compactParams2.IsSigned () &&
+                    *keyExchange1.DeriveSharedSymmetricKey (compactParams2.ToDHEParams ()) ==
+                    *keyExchange2.DeriveSharedSymmetricKey (compactParams1.ToDHEParams ());
+                // A truncated encoding must not parse, and a tampered one must not validate.
+                crypto::DHEKeyExchange::CompactDHEParams compactParams3;
+                result = result && !compactParams3.Parse (
+                    compact1.GetReadPtr (),
+                    compact1.GetDataAvailableForReading () - 1);
+                compact1.GetReadPtr ()[1] ^= 1;
+                result = result && compactParams3.Parse (
+                    compact1.GetReadPtr (),
+                    compact1.GetDataAvailableForReading ()) &&
+                    !compactParams3.ValidateSignature (publicKey, messageDigest);
+            }
+            std::cout << (result ? "pass" : "fail") << std::endl;
+            return result;
+        }
+        THEKOGANS_UTIL_CATCH (util::Exception) {
+            std::cout << "fail " << exception.Report ();
+            return false;
+        }
+    }
+
+    bool TestCompactRSA (
+            const char *keyName,
+            crypto::AsymmetricKey::SharedPtr publicKey,
+            crypto::AsymmetricKey::SharedPtr privateKey) {
+        THEKOGANS_UTIL_TRY {
+            std::cout << keyName << " compact...";
+            crypto::RSAKeyExchange keyExchange1 (crypto::ID (), publicKey);
+            util::Buffer compact1 = keyExchange1.GetCompactParams ();
+            crypto::RSAKeyExchange::CompactRSAParams compactParams1;
+            bool result = compactParams1.Parse (
+                compact1.GetReadPtr (),
+                compact1.GetDataAvailableForReading ());
+            if (result) {
+                crypto::RSAKeyExchange keyExchange2 (privateKey, compactParams1.ToRSAParams ());
+                util::Buffer compact2 = keyExchange2.GetCompactParams ();
+                crypto::RSAKeyExchange::CompactRSAParams compactParams2;
+                result = compactParams2.Parse (
+                    compact2.GetReadPtr (),
+                    compact2.GetDataAvailableForReading ()) &&
+                    *keyExchange1.DeriveSharedSymmetricKey (compactParams2.ToRSAParams ()) ==
+                    *keyExchange2.DeriveSharedSymmetricKey (compactParams1.ToRSAParams ());
+            }
+            std::cout << (result ? "pass" : "fail") << std::endl;
+            return result;
+        }
+        THEKOGANS_UTIL_CATCH (util::Exception) {
+            std::cout << "fail " << exception.Report ();
+            return false;
+        }
+    }
+
     bool TestRSA (
             const char *keyName,
             crypto::AsymmetricKey::SharedPtr publicKey,
@@ -173,6 +327,20 @@ TEST (thekogans, EC) {
     crypto::OpenSSLInit openSSLInit;
     crypto::AsymmetricKey::SharedPtr privateKey1 = crypto::RSA::CreateKey (512);
     crypto::AsymmetricKey::SharedPtr privateKey2 = crypto::RSA::CreateKey (512);
+    // ECDHE cipher suites default to X25519.
+    crypto::Params::SharedPtr defaultParams =
+        crypto::CipherSuite::Strongest.GetDefaultKeyExchangeParams ();
+    CHECK_EQUAL (
+        defaultParams.Get () != 0 &&
+        defaultParams->GetKeyType () == crypto::X25519AsymmetricKey::KEY_TYPE,
+        true);
+    CHECK_EQUAL (
+        TestDHE (
+            "crypto::CipherSuite::Strongest.GetDefaultKeyExchangeParams ()",
+            defaultParams,
+            privateKey1,
+            privateKey2),
+        true);
     // Named curves
     CHECK_EQUAL (
         TestDHE (
@@ -323,6 +491,16 @@ TEST (thekogans, EC) {
             privateKey1,
             privateKey2),
         true);
+    CHECK_EQUAL (
+        TestDHEBatch (
+            "crypto::EC::ParamsFromX25519Curve ()",
+            crypto::EC::ParamsFromX25519Curve ()),
+        true);
+    CHECK_EQUAL (
+        TestEphemeralKeyPool (
+            "crypto::EC::ParamsFromX25519Curve ()",
+            crypto::EC::ParamsFromX25519Curve ()),
+        true);
 }
 
 TEST (thekogans, RSA) {
@@ -336,4 +514,247 @@ TEST (thekogans, RSA) {
         true);
 }
 
+TEST (thekogans, RSAAsync) {
+    crypto::OpenSSLInit openSSLInit;
+    std::cout << "RSAAsync...";
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+    crypto::AsymmetricKey::SharedPtr privateKey = crypto::RSA::CreateMultiPrimeKey (1024, 3);
+#else // OPENSSL_VERSION_NUMBER >= 0x10101000L
+    crypto::AsymmetricKey::SharedPtr privateKey = crypto::RSA::CreateKey (1024);
+#endif // OPENSSL_VERSION_NUMBER >= 0x10101000L
+    crypto::AsymmetricKey::SharedPtr publicKey = privateKey->GetPublicKey ();
+    // Server side private key decryptions run on the engine's workers.
+    crypto::AsyncEngine engine (2);
+    const std::size_t HANDSHAKE_COUNT = 8;
+    std::vector<crypto::KeyExchange::SharedPtr> clients;
+    std::vector<crypto::KeyExchange::SharedPtr> servers;
+    std::vector<crypto::AsyncEngine::DeriveSharedSymmetricKeyJob::SharedPtr> jobs;
+    for (std::size_t i = 0; i < HANDSHAKE_COUNT; ++i) {
+        clients.push_back (
+            crypto::KeyExchange::SharedPtr (
+                new crypto::RSAKeyExchange (crypto::ID (), publicKey)));
+        crypto::KeyExchange::Params::SharedPtr params = clients.back ()->GetParams ();
+        servers.push_back (
+            crypto::KeyExchange::SharedPtr (
+                new crypto::RSAKeyExchange (privateKey, params)));
+        jobs.push_back (
+            crypto::AsyncEngine::DeriveSharedSymmetricKeyJob::SharedPtr (
+                new crypto::AsyncEngine::DeriveSharedSymmetricKeyJob (
+                    servers.back (),
+                    params)));
+        engine.Enqueue (jobs.back ());
+    }
+    bool result = true;
+    for (std::size_t i = 0; i < HANDSHAKE_COUNT; ++i) {
+        jobs[i]->Wait ();
+        result = result && !jobs[i]->Failed () && jobs[i]->GetKey ().Get () != 0 &&
+            *jobs[i]->GetKey () == *clients[i]->DeriveSharedSymmetricKey (
+                servers[i]->GetParams ());
+    }
+    std::cout << (result ? "pass" : "fail") << std::endl;
+    CHECK_EQUAL (result, true);
+}
+
+TEST (thekogans, CompactParams) {
+    crypto::OpenSSLInit openSSLInit;
+    crypto::AsymmetricKey::SharedPtr privateKey = crypto::RSA::CreateKey (1024);
+    CHECK_EQUAL (
+        TestCompactDHE (
+            "crypto::EC::ParamsFromX25519Curve ()",
+            crypto::EC::ParamsFromX25519Curve (),
+            privateKey),
+        true);
+    CHECK_EQUAL (
+        TestCompactDHE (
+            "crypto::EC::ParamsFromNamedCurve (NID_X9_62_prime256v1)",
+            crypto::EC::ParamsFromNamedCurve (NID_X9_62_prime256v1),
+            privateKey),
+        true);
+    CHECK_EQUAL (
+        TestCompactDHE (
+            "crypto::EC::ParamsFromRFC5639Curve (crypto::EC::RFC5639_CURVE_256)",
+            crypto::EC::ParamsFromRFC5639Curve (crypto::EC::RFC5639_CURVE_256),
+            privateKey),
+        true);
+    CHECK_EQUAL (
+        TestCompactDHE (
+            "crypto::DH::ParamsFromRFC3526Prime (crypto::DH::RFC3526_PRIME_2048)",
+            crypto::DH::ParamsFromRFC3526Prime (crypto::DH::RFC3526_PRIME_2048),
+            privateKey),
+        true);
+    CHECK_EQUAL (
+        TestCompactRSA (
+            "crypto::RSA::CreateKey (1024)",
+            privateKey->GetPublicKey (),
+            privateKey),
+        true);
+    CHECK_EQUAL (
+        crypto::DHEKeyExchange::GetGroupId (
+            *crypto::DH::ParamsFromPrimeLengthAndGenerator (512)) ==
+            crypto::DHEKeyExchange::GROUP_UNKNOWN,
+        true);
+}
+
+TEST (thekogans, SessionTicketManager) {
+    crypto::OpenSSLInit openSSLInit;
+    crypto::SymmetricKey::SharedPtr sharedKey = crypto::SymmetricKey::FromRandom ();
+    crypto::SessionTicketManager ticketManager (
+        crypto::Cipher::SharedPtr (new crypto::Cipher (crypto::SymmetricKey::FromRandom ())),
+        crypto::SessionTicketManager::DEFAULT_LIFETIME,
+        2);
+    util::Buffer tickets[4];
+    for (std::size_t i = 0; i < 4; ++i) {
+        tickets[i] = ticketManager.IssueTicket (*sharedKey);
+    }
+    const util::ui8 nonce[crypto::SessionTicketManager::MIN_NONCE_LENGTH] = {1, 2, 3};
+    crypto::SymmetricKey::SharedPtr clientKey =
+        crypto::SessionTicketManager::DeriveResumedKey (*sharedKey, nonce, sizeof (nonce));
+    crypto::SymmetricKey::SharedPtr serverKey = ticketManager.RedeemTicket (
+        tickets[0].GetReadPtr (), tickets[0].GetDataAvailableForReading (), nonce, sizeof (nonce));
+    CHECK_EQUAL (serverKey.Get () != 0, true);
+    CHECK_EQUAL (
+        serverKey.Get () != 0 &&
+        serverKey->Get ().GetDataAvailableForReading () == clientKey->Get ().GetDataAvailableForReading () &&
+        memcmp (
+            serverKey->Get ().GetReadPtr (),
+            clientKey->Get ().GetReadPtr (),
+            clientKey->Get ().GetDataAvailableForReading ()) == 0,
+        true);
+    // A resumed key is not the ticketed key.
+    CHECK_EQUAL (
+        memcmp (
+            sharedKey->Get ().GetReadPtr (),
+            clientKey->Get ().GetReadPtr (),
+            clientKey->Get ().GetDataAvailableForReading ()) != 0,
+        true);
+    // Replay.
+    CHECK_EQUAL (
+        ticketManager.RedeemTicket (
+            tickets[0].GetReadPtr (), tickets[0].GetDataAvailableForReading (),
+            nonce, sizeof (nonce)).Get () == 0,
+        true);
+    // Forgery.
+    util::ui8 *forged = tickets[1].GetReadPtr ();
+    forged[tickets[1].GetDataAvailableForReading () - 1] ^= 1;
+    CHECK_EQUAL (
+        ticketManager.RedeemTicket (
+            tickets[1].GetReadPtr (), tickets[1].GetDataAvailableForReading (),
+            nonce, sizeof (nonce)).Get () == 0,
+        true);
+    // Redeeming past the (2 entry) replay window.
+    CHECK_EQUAL (
+        ticketManager.RedeemTicket (
+            tickets[2].GetReadPtr (), tickets[2].GetDataAvailableForReading (),
+            nonce, sizeof (nonce)).Get () != 0,
+        true);
+    CHECK_EQUAL (
+        ticketManager.RedeemTicket (
+            tickets[3].GetReadPtr (), tickets[3].GetDataAvailableForReading (),
+            nonce, sizeof (nonce)).Get () != 0,
+        true);
+    // Ticket 0 has been dropped from the window, but the floor
+    // still rejects it.
+    CHECK_EQUAL (
+        ticketManager.RedeemTicket (
+            tickets[0].GetReadPtr (), tickets[0].GetDataAvailableForReading (),
+            nonce, sizeof (nonce)).Get () == 0,
+        true);
+}
+
+TEST (thekogans, SignedDHEParamsCache) {
+    crypto::OpenSSLInit openSSLInit;
+    crypto::AsymmetricKey::SharedPtr privateKey = crypto::RSA::CreateKey (512);
+    crypto::AsymmetricKey::SharedPtr publicKey = privateKey->GetPublicKey (privateKey->GetId ());
+    crypto::MessageDigest::SharedPtr messageDigest (new crypto::MessageDigest);
+    crypto::SignedDHEParamsCache cache (
+        crypto::EC::ParamsFromX25519Curve (),
+        privateKey,
+        messageDigest,
+        crypto::SignedDHEParamsCache::DEFAULT_MAX_AGE,
+        3);
+    bool result = true;
+    crypto::SignedDHEParamsCache::Entry::SharedPtr entries[7];
+    for (std::size_t i = 0; result && i < 7; ++i) {
+        entries[i] = cache.Get ();
+        crypto::KeyExchange::Params::SharedPtr serverParams = entries[i]->params;
+        result = serverParams->ValidateSignature (publicKey, messageDigest);
+        if (result) {
+            crypto::DHEKeyExchange client (serverParams);
+            crypto::KeyExchange::Params::SharedPtr clientParams = client.GetParams ();
+            result = *client.DeriveSharedSymmetricKey (serverParams) ==
+                *entries[i]->DeriveSharedSymmetricKey (clientParams);
+        }
+    }
+    // Three handshakes per window: 0-2, 3-5 and 6.
+    CHECK_EQUAL (result, true);
+    CHECK_EQUAL (
+        entries[0].Get () == entries[2].Get () && entries[2].Get () != entries[3].Get () &&
+        entries[3].Get () == entries[5].Get () && entries[5].Get () != entries[6].Get (),
+        true);
+    crypto::SignedDHEParamsCache::Stats stats = cache.GetStats ();
+    CHECK_EQUAL (stats.rotations == 3 && stats.hits + stats.misses == 7 && stats.currentUses == 1, true);
+    // Rotate ends the window right away.
+    cache.Rotate ();
+    CHECK_EQUAL (cache.Get ().Get () != entries[6].Get (), true);
+}
+
+TEST (thekogans, SignedDHEParamsCacheSessionSalt) {
+    crypto::OpenSSLInit openSSLInit;
+    crypto::AsymmetricKey::SharedPtr privateKey = crypto::RSA::CreateKey (512);
+    crypto::MessageDigest::SharedPtr messageDigest (new crypto::MessageDigest);
+    crypto::SignedDHEParamsCache cache (
+        crypto::EC::ParamsFromX25519Curve (),
+        privateKey,
+        messageDigest,
+        crypto::SignedDHEParamsCache::DEFAULT_MAX_AGE,
+        2);
+    // Two handshakes in the same window, with the same client params
+    // (a replay) but different session salts.
+    const util::ui8 salt1[] = {1, 2, 3, 4};
+    const util::ui8 salt2[] = {5, 6, 7, 8};
+    crypto::SignedDHEParamsCache::Entry::SharedPtr entry1 = cache.Get ();
+    crypto::SignedDHEParamsCache::Entry::SharedPtr entry2 = cache.Get ();
+    crypto::DHEKeyExchange client (entry1->params);
+    crypto::KeyExchange::Params::SharedPtr clientParams = client.GetParams ();
+    crypto::SymmetricKey::SharedPtr serverKey1 =
+        entry1->DeriveSharedSymmetricKey (clientParams, salt1, sizeof (salt1));
+    crypto::SymmetricKey::SharedPtr serverKey2 =
+        entry2->DeriveSharedSymmetricKey (clientParams, salt2, sizeof (salt2));
+    crypto::SymmetricKey::SharedPtr clientKey1 =
+        client.DeriveSharedSymmetricKey (entry1->params, salt1, sizeof (salt1));
+    CHECK_EQUAL (entry1.Get () == entry2.Get (), true);
+    CHECK_EQUAL (*serverKey1 == *clientKey1 && serverKey1->GetId () == clientKey1->GetId (), true);
+    CHECK_EQUAL (*serverKey1 == *serverKey2 || serverKey1->GetId () == serverKey2->GetId (), false);
+    // The third handshake opens a new window.
+    cache.Get ();
+    crypto::SignedDHEParamsCache::Stats stats = cache.GetStats ();
+    CHECK_EQUAL (stats.rotations == 2 && stats.currentUses == 1 && stats.previousUses == 2, true);
+    CHECK_EQUAL (stats.currentAge >= 0.0 && stats.previousAge >= 0.0, true);
+}
+
+TEST (thekogans, ValidatedParamsCache) {
+    crypto::OpenSSLInit openSSLInit;
+    crypto::AsymmetricKey::SharedPtr privateKey = crypto::RSA::CreateKey (512);
+    crypto::AsymmetricKey::SharedPtr publicKey = privateKey->GetPublicKey (privateKey->GetId ());
+    crypto::MessageDigest::SharedPtr messageDigest (new crypto::MessageDigest);
+    crypto::SignedDHEParamsCache signedParamsCache (
+        crypto::EC::ParamsFromX25519Curve (),
+        privateKey,
+        messageDigest);
+    crypto::KeyExchange::Params::SharedPtr params = signedParamsCache.Get ()->params;
+    crypto::ValidatedParamsCache::SharedPtr cache (new crypto::ValidatedParamsCache);
+    bool result = true;
+    // The first validation verifies the signature, the rest hit the cache.
+    for (std::size_t i = 0; result && i < 3; ++i) {
+        result = params->ValidateSignature (publicKey, messageDigest, cache);
+    }
+    CHECK_EQUAL (result, true);
+    crypto::IDCacheStats stats = cache->GetStats ();
+    CHECK_EQUAL (stats.hits == 2 && stats.misses == 1 && stats.size == 1, true);
+    // A tampered signature misses the cache, and fails verification.
+    params->signature[0] ^= 1;
+    CHECK_EQUAL (params->ValidateSignature (publicKey, messageDigest, cache), false);
+    CHECK_EQUAL (cache->GetStats ().size == 1, true);
+}
+
 TESTMAIN
@@ -15,16 +15,1074 @@
 // You should have received a copy of the GNU General Public License
 // along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
 
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <vector>
 #include <iostream>
 #include <CppUnitXLite/CppUnitXLite.cpp>
+#include "thekogans/util/Types.h"
+#include "thekogans/util/RandomSource.h"
+#include "thekogans/util/Exception.h"
 #include "thekogans/crypto/OpenSSLInit.h"
+#include "thekogans/crypto/OpenSSLUtils.h"
+#include "thekogans/crypto/ID.h"
+#include "thekogans/crypto/MessageDigest.h"
+#include "thekogans/crypto/CipherSuite.h"
+#include "thekogans/crypto/X25519Params.h"
+#include "thekogans/crypto/Ed25519Params.h"
+#include "thekogans/crypto/SymmetricKey.h"
+#include "thekogans/crypto/IDHashMap.h"
 #include "thekogans/crypto/KeyRing.h"
+#include "thekogans/crypto/ConcurrentKeyRing.h"
+#include "thekogans/crypto/LazyKeyRing.h"
+#include "thekogans/crypto/MappedKeyRing.h"
+#include "thekogans/crypto/SharedKeyRing.h"
+#include "thekogans/crypto/JournaledKeyRing.h"
+#include "thekogans/crypto/KeyEnvelope.h"
 
 using namespace thekogans;
 
+namespace {
+    // Drive an IDHashMap and a std::map with the same random
+    // insert/find/erase sequence and make sure they agree.
+    bool TestIDHashMap () {
+        std::cout << "crypto::IDHashMap...";
+        std::vector<crypto::ID> ids (1000);
+        crypto::IDHashMap<std::size_t> hashMap;
+        std::map<crypto::ID, std::size_t> map;
+        bool result = true;
+        for (std::size_t i = 0; result && i < 100000; ++i) {
+            const crypto::ID &id = ids[util::GlobalRandomSource::Instance ().Getui32 () % ids.size ()];
+            crypto::IDHashMap<std::size_t>::iterator it = hashMap.find (id);
+            std::map<crypto::ID, std::size_t>::iterator jt = map.find (id);
+            result = (it == hashMap.end ()) == (jt == map.end ()) &&
+                (it == hashMap.end () || it->second == jt->second);
+            if (result) {
+                if (it != hashMap.end ()) {
+                    hashMap.erase (it);
+                    map.erase (jt);
+                }
+                else {
+                    result = hashMap.insert (
+                        crypto::IDHashMap<std::size_t>::value_type (id, i)).second &&
+                        map.insert (std::map<crypto::ID, std::size_t>::value_type (id, i)).second &&
+                        !hashMap.insert (
+                            crypto::IDHashMap<std::size_t>::value_type (id, i + 1)).second;
+                }
+                result = result && hashMap.size () == map.size ();
+            }
+        }
+        for (crypto::IDHashMap<std::size_t>::const_iterator
+                it = hashMap.begin (),
+                end = hashMap.end (); result && it != end; ++it) {
+            std::map<crypto::ID, std::size_t>::const_iterator jt = map.find (it->first);
+            result = jt != map.end () && jt->second == it->second;
+        }
+        std::cout << (result ? "pass" : "fail") << std::endl;
+        return result;
+    }
+
+    // Make sure the (context reusing) derived ids match a plain digest,
+    // for every scheme, one at a time and as a batch.
+    bool TestIDDerivation () {
+        std::cout << "crypto::ID derivation...";
+        THEKOGANS_UTIL_TRY {
+            const util::ui8 schemes[] = {
+                crypto::ID::SCHEME_SHA256,
+                crypto::ID::SCHEME_BLAKE2S256
+            };
+            std::vector<std::vector<util::ui8>> data (17);
+            std::vector<const void *> buffers;
+            std::vector<std::size_t> lengths;
+            for (std::size_t i = 0; i < data.size (); ++i) {
+                data[i].resize (1 + i * 13);
+                util::GlobalRandomSource::Instance ().GetBytes (&data[i][0], data[i].size ());
+                buffers.push_back (&data[i][0]);
+                lengths.push_back (data[i].size ());
+            }
+            bool result = true;
+            for (std::size_t i = 0; result && i < sizeof (schemes); ++i) {
+                const EVP_MD *md = 0;
+                THEKOGANS_UTIL_TRY {
+                    md = crypto::ID::GetSchemeMessageDigest (schemes[i]);
+                }
+                THEKOGANS_UTIL_CATCH (util::Exception) {
+                    // BLAKE2s is not available in every build.
+                    continue;
+                }
+                crypto::MessageDigest messageDigest (md);
+                std::vector<crypto::ID> ids = crypto::ID::FromBuffers (
+                    &buffers[0], &lengths[0], buffers.size (), schemes[i]);
+                result = ids.size () == data.size ();
+                for (std::size_t j = 0; result && j < data.size (); ++j) {
+                    util::Buffer digest = messageDigest.HashBuffer (&data[j][0], data[j].size ());
+                    crypto::ID id (&data[j][0], data[j].size (), schemes[i]);
+                    result =
+                        digest.GetDataAvailableForReading () == crypto::ID::SIZE &&
+                        memcmp (digest.GetReadPtr (), id.data, crypto::ID::SIZE) == 0 &&
+                        ids[j] == id;
+                }
+            }
+            // The default is SHA-256.
+            result = result &&
+                crypto::ID (&data[0][0], data[0].size ()) ==
+                    crypto::ID (&data[0][0], data[0].size (), crypto::ID::SCHEME_SHA256);
+            std::cout << (result ? "pass" : "fail") << std::endl;
+            return result;
+        }
+        THEKOGANS_UTIL_CATCH (util::Exception) {
+            std::cout << "fail " << exception.Report ();
+            return false;
+        }
+    }
+
+    crypto::SymmetricKey::SharedPtr CreateCipherKey (const crypto::CipherSuite &cipherSuite) {
+        return crypto::SymmetricKey::FromRandom (
+            crypto::SymmetricKey::MIN_RANDOM_LENGTH,
+            0,
+            0,
+            crypto::GetCipherKeyLength (cipherSuite.GetOpenSSLCipher ()));
+    }
+
+    // Make sure the root index follows keys and sub rings
+    // as they are added to and dropped from the tree.
+    bool TestKeyRingIndex () {
+        std::cout << "crypto::KeyRing index...";
+        const crypto::CipherSuite &cipherSuite = crypto::CipherSuite::Strongest;
+        crypto::KeyRing::SharedPtr root (new crypto::KeyRing (cipherSuite));
+        crypto::KeyRing::SharedPtr middle (new crypto::KeyRing (cipherSuite));
+        crypto::KeyRing::SharedPtr leaf (new crypto::KeyRing (cipherSuite));
+        crypto::SymmetricKey::SharedPtr leafKey = CreateCipherKey (cipherSuite);
+        leaf->AddCipherKey (leafKey);
+        middle->AddSubring (leaf);
+        root->AddSubring (middle);
+        bool result =
+            root->GetCipherKey (leafKey->GetId ()).Get () == leafKey.Get () &&
+            middle->GetCipherKey (leafKey->GetId ()).Get () == leafKey.Get () &&
+            root->GetCipherKey (leafKey->GetId (), false).Get () == 0 &&
+            root->GetSubring (leaf->GetId ()).Get () == leaf.Get () &&
+            leaf->GetSubring (middle->GetId ()).Get () == 0;
+        // Keys added to (and dropped from) a sub ring after
+        // the index was built must be visible from the root.
+        crypto::SymmetricKey::SharedPtr middleKey = CreateCipherKey (cipherSuite);
+        middle->AddCipherKey (middleKey);
+        result = result &&
+            root->GetCipherKey (middleKey->GetId ()).Get () == middleKey.Get () &&
+            leaf->GetCipherKey (middleKey->GetId ()).Get () == 0 &&
+            root->DropCipherKey (leafKey->GetId ()) &&
+            root->GetCipherKey (leafKey->GetId ()).Get () == 0 &&
+            leaf->GetCipherKey (leafKey->GetId (), false).Get () == 0;
+        // A dropped sub ring takes it's keys with it, and becomes a root.
+        result = result &&
+            root->DropSubring (middle->GetId ()) &&
+            root->GetCipherKey (middleKey->GetId ()).Get () == 0 &&
+            root->GetSubring (leaf->GetId ()).Get () == 0 &&
+            middle->GetSubring (leaf->GetId ()).Get () == leaf.Get ();
+        // A ring can only have one parent, and cycles are rejected.
+        crypto::KeyRing::SharedPtr other (new crypto::KeyRing (cipherSuite));
+        try {
+            other->AddSubring (leaf);
+            result = false;
+        }
+        catch (const util::Exception &) {
+        }
+        try {
+            leaf->AddSubring (middle);
+            result = false;
+        }
+        catch (const util::Exception &) {
+        }
+        result = result && root->AddSubring (middle) &&
+            root->GetCipherKey (middleKey->GetId ()).Get () == middleKey.Get ();
+        std::cout << (result ? "pass" : "fail") << std::endl;
+        return result;
+    }
+
+    // Make sure readers see published versions, and that per thread
+    // ciphers are reused until their key is rotated out.
+    bool TestKeyRingBulk () {
+        std::cout << "crypto::KeyRing bulk...";
+        THEKOGANS_UTIL_TRY {
+            const crypto::CipherSuite &cipherSuite = crypto::CipherSuite::Strongest;
+            std::vector<crypto::SymmetricKey::SharedPtr> keys;
+            for (std::size_t i = 0; i < 100; ++i) {
+                keys.push_back (CreateCipherKey (cipherSuite));
+            }
+            crypto::KeyRing keyRing (cipherSuite);
+            bool result =
+                keyRing.AddCipherKeys (keys, true, 4) == keys.size () &&
+                keyRing.AddCipherKeys (keys) == 0 &&
+                keyRing.GetCipher (keys[50]->GetId (), false).Get () != 0;
+            // A bad key rejects the whole batch.
+            std::vector<crypto::SymmetricKey::SharedPtr> badKeys;
+            badKeys.push_back (CreateCipherKey (cipherSuite));
+            badKeys.push_back (crypto::SymmetricKey::SharedPtr (new crypto::SymmetricKey ("short", 5)));
+            THEKOGANS_UTIL_TRY {
+                keyRing.AddCipherKeys (badKeys);
+                result = false;
+            }
+            THEKOGANS_UTIL_CATCH (util::Exception) {
+                result = result && keyRing.GetCipherKey (badKeys[0]->GetId (), false).Get () == 0;
+            }
+            // Round trip the raw key material.
+            std::vector<util::ui8> keyMaterial (keyRing.GetCipherKeyMaterialLength ());
+            std::vector<crypto::ID> keyIds;
+            result = result &&
+                keyRing.ExportCipherKeyMaterial (
+                    &keyMaterial[0], keyMaterial.size (), &keyIds) == keyMaterial.size () &&
+                keyIds.size () == keys.size ();
+            crypto::KeyRing copy (cipherSuite);
+            std::vector<crypto::ID> copyIds;
+            result = result &&
+                copy.AddCipherKeyMaterial (
+                    &keyMaterial[0], keyMaterial.size (), &copyIds, true, 0) == keys.size () &&
+                copyIds.size () == keys.size ();
+            for (std::size_t i = 0; result && i < keyIds.size (); ++i) {
+                crypto::SymmetricKey::SharedPtr key = keyRing.GetCipherKey (keyIds[i], false);
+                crypto::SymmetricKey::SharedPtr copyKey = copy.GetCipherKey (copyIds[i], false);
+                result = key->GetKeyLength () == copyKey->GetKeyLength () &&
+                    memcmp (
+                        key->Get ().GetReadPtr (),
+                        copyKey->Get ().GetReadPtr (),
+                        key->GetKeyLength ()) == 0;
+            }
+            std::cout << (result ? "pass" : "fail") << std::endl;
+            return result;
+        }
+        THEKOGANS_UTIL_CATCH (util::Exception) {
+            std::cout << "fail " << exception.Report ();
+            return false;
+        }
+    }
+
+    bool TestKeyRingCache () {
+        std::cout << "crypto::KeyRing cache...";
+        THEKOGANS_UTIL_TRY {
+            const crypto::CipherSuite &cipherSuite = crypto::CipherSuite::Strongest;
+            crypto::KeyRing keyRing (cipherSuite);
+            std::vector<crypto::SymmetricKey::SharedPtr> keys;
+            for (std::size_t i = 0; i < 10; ++i) {
+                keys.push_back (CreateCipherKey (cipherSuite));
+                keyRing.AddCipherKey (keys.back ());
+            }
+            keyRing.SetMaxCachedObjects (4);
+            bool result = true;
+            for (std::size_t i = 0; result && i < keys.size (); ++i) {
+                result = keyRing.GetCipher (keys[i]->GetId (), false).Get () != 0;
+            }
+            // The last one is still cached.
+            result = result && keyRing.GetCipher (keys[9]->GetId (), false).Get () != 0;
+            crypto::IDCacheStats stats = keyRing.GetCacheStats ();
+            result = result &&
+                stats.size == 4 &&
+                stats.hits == 1 &&
+                stats.misses == 10 &&
+                stats.evictions == 6;
+            // Keys stay resident, evicted Ciphers are rebuilt.
+            for (std::size_t i = 0; result && i < keys.size (); ++i) {
+                result =
+                    keyRing.GetCipherKey (keys[i]->GetId (), false).Get () != 0 &&
+                    keyRing.GetCipher (keys[i]->GetId (), false).Get () != 0;
+            }
+            result = result && keyRing.GetCacheStats ().size == 4;
+            std::cout << (result ? "pass" : "fail") << std::endl;
+            return result;
+        }
+        THEKOGANS_UTIL_CATCH (util::Exception) {
+            std::cout << "fail " << exception.Report ();
+            return false;
+        }
+    }
+
+    bool TestKeyRingStream () {
+        std::cout << "crypto::KeyRing stream...";
+        THEKOGANS_UTIL_TRY {
+            const std::string path = "test_KeyRingStream.tmp";
+            const crypto::CipherSuite &cipherSuite = crypto::CipherSuite::Strongest;
+            crypto::KeyRing::SharedPtr keyRing (new crypto::KeyRing (cipherSuite));
+            crypto::KeyRing::SharedPtr subring (new crypto::KeyRing (cipherSuite));
+            keyRing->AddSubring (subring);
+            std::vector<crypto::SymmetricKey::SharedPtr> keys;
+            for (std::size_t i = 0; i < 32; ++i) {
+                keys.push_back (CreateCipherKey (cipherSuite));
+                (i & 1 ? subring : keyRing)->AddCipherKey (keys.back ());
+            }
+            crypto::SymmetricKey::SharedPtr masterKey = CreateCipherKey (cipherSuite);
+            // Small chunks, so that the ring spans plenty of segments.
+            keyRing->SaveStream (path, masterKey, THEKOGANS_CRYPTO_DEFAULT_CIPHER, 100);
+            crypto::KeyRing::SharedPtr loaded = crypto::KeyRing::LoadStream (path, masterKey);
+            bool result = loaded.Get () != 0;
+            for (std::size_t i = 0; result && i < keys.size (); ++i) {
+                result = loaded->GetCipherKey (keys[i]->GetId ()).Get () != 0;
+            }
+            // The wrong key fails authentication.
+            THEKOGANS_UTIL_TRY {
+                crypto::KeyRing::LoadStream (path, CreateCipherKey (cipherSuite));
+                result = false;
+            }
+            THEKOGANS_UTIL_CATCH (util::Exception) {
+            }
+            std::remove (path.c_str ());
+            std::cout << (result ? "pass" : "fail") << std::endl;
+            return result;
+        }
+        THEKOGANS_UTIL_CATCH (util::Exception) {
+            std::cout << "fail " << exception.Report ();
+            return false;
+        }
+    }
+
+    bool TestKeyRingText () {
+        std::cout << "crypto::KeyRing text...";
+        THEKOGANS_UTIL_TRY {
+            const std::string path = "test_KeyRingText.tmp";
+            const crypto::CipherSuite &cipherSuite = crypto::CipherSuite::Strongest;
+            crypto::KeyRing::SharedPtr keyRing (
+                new crypto::KeyRing (cipherSuite, crypto::ID (), "<root> & \"ring\"", "\u00e9"));
+            crypto::KeyRing::SharedPtr subring (new crypto::KeyRing (cipherSuite));
+            keyRing->AddSubring (subring);
+            std::vector<crypto::SymmetricKey::SharedPtr> keys;
+            for (std::size_t i = 0; i < 32; ++i) {
+                keys.push_back (CreateCipherKey (cipherSuite));
+                (i & 1 ? subring : keyRing)->AddCipherKey (keys.back ());
+            }
+            crypto::SymmetricKey::SharedPtr macKey = CreateCipherKey (cipherSuite);
+            keyRing->AddMACKey (macKey);
+            bool result = true;
+            for (std::size_t format = 0; result && format < 2; ++format) {
+                crypto::KeyRing::SharedPtr loaded;
+                if (format == 0) {
+                    keyRing->SaveXML (path);
+                    loaded = crypto::KeyRing::LoadXML (path);
+                }
+                else {
+                    keyRing->SaveJSON (path);
+                    loaded = crypto::KeyRing::LoadJSON (path);
+                }
+                result = loaded.Get () != 0 &&
+                    loaded->GetId () == keyRing->GetId () &&
+                    loaded->GetName () == keyRing->GetName () &&
+                    loaded->GetDescription () == keyRing->GetDescription () &&
+                    loaded->GetSubring (subring->GetId ()).Get () != 0 &&
+                    loaded->GetMACKey (macKey->GetId ()).Get () != 0;
+                for (std::size_t i = 0; result && i < keys.size (); ++i) {
+                    crypto::SymmetricKey::SharedPtr key = loaded->GetCipherKey (keys[i]->GetId ());
+                    result = key.Get () != 0 &&
+                        key->GetKeyLength () == keys[i]->GetKeyLength () &&
+                        memcmp (
+                            key->Get ().GetReadPtr (),
+                            keys[i]->Get ().GetReadPtr (),
+                            key->GetKeyLength ()) == 0;
+                }
+            }
+            std::remove (path.c_str ());
+            std::cout << (result ? "pass" : "fail") << std::endl;
+            return result;
+        }
+        THEKOGANS_UTIL_CATCH (util::Exception) {
+            std::cout << "fail " << exception.Report ();
+            return false;
+        }
+    }
+
+    // Tenant rings created from a template share its params/keys
+    // until modified, and store them once when serialized.
+    bool TestKeyRingTemplate () {
+        std::cout << "crypto::KeyRing template...";
+        THEKOGANS_UTIL_TRY {
+            const std::string path = "test_KeyRingTemplate.tmp";
+            const crypto::CipherSuite &cipherSuite = crypto::CipherSuite::Strongest;
+            crypto::KeyRing::SharedPtr keyRing (new crypto::KeyRing (cipherSuite));
+            crypto::KeyRing::SharedPtr templateRing (new crypto::KeyRing (cipherSuite));
+            crypto::Params::SharedPtr params (new crypto::X25519Params);
+            templateRing->AddKeyExchangeParams (params);
+            crypto::AsymmetricKey::SharedPtr key = crypto::Ed25519Params ().CreateKey ();
+            templateRing->AddAuthenticatorKey (key);
+            keyRing->AddSubring (templateRing);
+            std::vector<crypto::KeyRing::SharedPtr> tenants;
+            for (std::size_t i = 0; i < 4; ++i) {
+                tenants.push_back (crypto::KeyRing::CreateFromTemplate (*templateRing));
+                tenants.back ()->AddCipherKey (CreateCipherKey (cipherSuite));
+                keyRing->AddSubring (tenants.back ());
+            }
+            bool result = true;
+            for (std::size_t i = 0; result && i < tenants.size (); ++i) {
+                result = tenants[i]->SharesEntriesWith (*templateRing) &&
+                    tenants[i]->GetKeyExchangeParams (params->GetId (), false).Get () != 0;
+            }
+            for (std::size_t format = 0; result && format < 3; ++format) {
+                crypto::KeyRing::SharedPtr loaded;
+                if (format == 0) {
+                    keyRing->Save (path);
+                    loaded = crypto::KeyRing::Load (path);
+                }
+                else if (format == 1) {
+                    keyRing->SaveXML (path);
+                    loaded = crypto::KeyRing::LoadXML (path);
+                }
+                else {
+                    keyRing->SaveJSON (path);
+                    loaded = crypto::KeyRing::LoadJSON (path);
+                }
+                crypto::KeyRing::SharedPtr loadedTemplate =
+                    loaded->GetSubring (templateRing->GetId ());
+                result = loadedTemplate.Get () != 0 &&
+                    loadedTemplate->GetAuthenticatorKey (key->GetId (), false).Get () != 0;
+                for (std::size_t i = 0; result && i < tenants.size (); ++i) {
+                    crypto::KeyRing::SharedPtr tenant = loaded->GetSubring (tenants[i]->GetId ());
+                    result = tenant.Get () != 0 &&
+                        tenant->SharesEntriesWith (*loadedTemplate) &&
+                        tenant->GetKeyExchangeParams (params->GetId (), false).Get () != 0;
+                }
+            }
+            // Copy on write.
+            if (result) {
+                tenants[0]->DropAuthenticatorKey (key->GetId ());
+                result = !tenants[0]->SharesEntriesWith (*templateRing) &&
+                    tenants[0]->GetAuthenticatorKey (key->GetId (), false).Get () == 0 &&
+                    tenants[0]->GetKeyExchangeParams (params->GetId (), false).Get () != 0 &&
+                    templateRing->GetAuthenticatorKey (key->GetId (), false).Get () != 0 &&
+                    tenants[1]->SharesEntriesWith (*templateRing);
+            }
+            std::remove (path.c_str ());
+            std::cout << (result ? "pass" : "fail") << std::endl;
+            return result;
+        }
+        THEKOGANS_UTIL_CATCH (util::Exception) {
+            std::cout << "fail " << exception.Report ();
+            return false;
+        }
+    }
+
+    // Compacted keys must behave like the ones in the maps (lookups,
+    // drops, duplicates, serialization), just materialized on demand.
+    bool TestKeyRingCompact () {
+        std::cout << "crypto::KeyRing compact keys...";
+        THEKOGANS_UTIL_TRY {
+            const std::string path = "test_KeyRingCompact.tmp";
+            const crypto::CipherSuite &cipherSuite = crypto::CipherSuite::Strongest;
+            crypto::KeyRing::SharedPtr keyRing (new crypto::KeyRing (cipherSuite));
+            crypto::KeyRing::SharedPtr subring (new crypto::KeyRing (cipherSuite));
+            keyRing->AddSubring (subring);
+            std::vector<crypto::SymmetricKey::SharedPtr> keys;
+            for (std::size_t i = 0; i < 4096; ++i) {
+                crypto::SymmetricKey::SharedPtr key = CreateCipherKey (cipherSuite);
+                if (i % 100 == 0) {
+                    key->SetName ("named");
+                }
+                keys.push_back (key);
+                (i & 1 ? subring : keyRing)->AddCipherKey (key);
+            }
+            crypto::SymmetricKey::SharedPtr macKey = CreateCipherKey (cipherSuite);
+            keyRing->AddMACKey (macKey);
+            bool result = keyRing->CompactKeys () == keys.size () + 1 &&
+                !keyRing->AddCipherKey (keys[0]) &&
+                keyRing->GetMACKey (macKey->GetId ()).Get () != 0 &&
+                keyRing->GetRandomCipher ().Get () != 0;
+            // Drop every third key.
+            for (std::size_t i = 0; result && i < keys.size (); i += 3) {
+                result = keyRing->DropCipherKey (keys[i]->GetId ()) &&
+                    keyRing->GetCipherKey (keys[i]->GetId ()).Get () == 0;
+            }
+            for (std::size_t format = 0; result && format < 4; ++format) {
+                crypto::KeyRing::SharedPtr loaded = keyRing;
+                if (format == 1) {
+                    keyRing->Save (path);
+                    loaded = crypto::KeyRing::Load (path);
+                }
+                else if (format == 2) {
+                    keyRing->SaveXML (path);
+                    loaded = crypto::KeyRing::LoadXML (path);
+                }
+                else if (format == 3) {
+                    keyRing->SaveJSON (path);
+                    loaded = crypto::KeyRing::LoadJSON (path);
+                }
+                for (std::size_t i = 0; result && i < keys.size (); ++i) {
+                    crypto::SymmetricKey::SharedPtr key = loaded->GetCipherKey (keys[i]->GetId ());
+                    result = i % 3 == 0 ?
+                        key.Get () == 0 :
+                        key.Get () != 0 &&
+                            key->GetName () == keys[i]->GetName () &&
+                            key->GetKeyLength () == keys[i]->GetKeyLength () &&
+                            memcmp (
+                                key->Get ().GetReadPtr (),
+                                keys[i]->Get ().GetReadPtr (),
+                                key->GetKeyLength ()) == 0 &&
+                            loaded->GetCipher (keys[i]->GetId ()).Get () != 0;
+                }
+            }
+            std::remove (path.c_str ());
+            std::cout << (result ? "pass" : "fail") << std::endl;
+            return result;
+        }
+        THEKOGANS_UTIL_CATCH (util::Exception) {
+            std::cout << "fail " << exception.Report ();
+            return false;
+        }
+    }
+
+    bool TestKeyRingParallelRead () {
+        std::cout << "crypto::KeyRing parallel read...";
+        THEKOGANS_UTIL_TRY {
+            const std::string path = "test_KeyRingParallelRead.tmp";
+            const crypto::CipherSuite &cipherSuite = crypto::CipherSuite::Strongest;
+            crypto::KeyRing::SharedPtr keyRing (new crypto::KeyRing (cipherSuite));
+            std::vector<crypto::SymmetricKey::SharedPtr> keys;
+            for (std::size_t i = 0; i < 8; ++i) {
+                crypto::KeyRing::SharedPtr subring (new crypto::KeyRing (cipherSuite));
+                keyRing->AddSubring (subring);
+                for (std::size_t j = 0; j < 16; ++j) {
+                    keys.push_back (CreateCipherKey (cipherSuite));
+                    subring->AddCipherKey (keys.back ());
+                }
+            }
+            for (std::size_t i = 0; i < 256; ++i) {
+                keys.push_back (CreateCipherKey (cipherSuite));
+                keyRing->AddCipherKey (keys.back ());
+            }
+            keyRing->Save (path);
+            bool result = true;
+            // Sequential and parallel reads must agree.
+            for (std::size_t workerCount = 1; result && workerCount <= 4; workerCount += 3) {
+                crypto::KeyRing::SetReadWorkerCount (workerCount);
+                crypto::KeyRing::SharedPtr loaded = crypto::KeyRing::Load (path);
+                result = loaded.Get () != 0;
+                for (std::size_t i = 0; result && i < keys.size (); ++i) {
+                    result = loaded->GetCipherKey (keys[i]->GetId ()).Get () != 0;
+                }
+            }
+            crypto::KeyRing::SetReadWorkerCount (0);
+            std::remove (path.c_str ());
+            std::cout << (result ? "pass" : "fail") << std::endl;
+            return result;
+        }
+        THEKOGANS_UTIL_CATCH (util::Exception) {
+            std::cout << "fail " << exception.Report ();
+            return false;
+        }
+    }
+
+    bool TestKeyRingRandom () {
+        std::cout << "crypto::KeyRing random...";
+        THEKOGANS_UTIL_TRY {
+            const crypto::CipherSuite &cipherSuite = crypto::CipherSuite::Strongest;
+            crypto::KeyRing keyRing (cipherSuite);
+            bool result =
+                keyRing.GetRandomCipher ().Get () == 0 &&
+                keyRing.GetRandomMAC ().Get () == 0;
+            std::vector<crypto::SymmetricKey::SharedPtr> keys;
+            for (std::size_t i = 0; i < 16; ++i) {
+                keys.push_back (CreateCipherKey (cipherSuite));
+                keyRing.AddCipherKey (keys.back ());
+                keyRing.AddMACKey (CreateCipherKey (cipherSuite));
+            }
+            // Drops swap the last key in; whatever is left must be reachable.
+            for (std::size_t i = 0; i < keys.size (); i += 2) {
+                keyRing.DropCipherKey (keys[i]->GetId ());
+            }
+            for (std::size_t i = 0; result && i < 256; ++i) {
+                crypto::Cipher::SharedPtr cipher = keyRing.GetRandomCipher ();
+                result = cipher.Get () != 0 &&
+                    keyRing.GetCipherKey (cipher->GetKey ()->GetId ()).Get () != 0 &&
+                    keyRing.GetRandomMAC ().Get () != 0;
+            }
+            std::cout << (result ? "pass" : "fail") << std::endl;
+            return result;
+        }
+        THEKOGANS_UTIL_CATCH (util::Exception) {
+            std::cout << "fail " << exception.Report ();
+            return false;
+        }
+    }
+
+    // The (cached) size of a ring must match that of a freshly loaded copy.
+    bool SizeMatchesLoaded (
+            const crypto::KeyRing &keyRing,
+            const std::string &path) {
+        keyRing.Save (path);
+        crypto::KeyRing::SharedPtr loaded = crypto::KeyRing::Load (path);
+        return util::Serializable::Size (keyRing) == util::Serializable::Size (*loaded);
+    }
+
+    // Cached sizes must follow changes anywhere below (and, for
+    // rings sharing entries, anywhere in) the tree.
+    bool TestKeyRingSize () {
+        std::cout << "crypto::KeyRing size...";
+        THEKOGANS_UTIL_TRY {
+            const std::string path = "test_KeyRingSize.tmp";
+            const crypto::CipherSuite &cipherSuite = crypto::CipherSuite::Strongest;
+            crypto::KeyRing::SharedPtr keyRing (new crypto::KeyRing (cipherSuite));
+            crypto::KeyRing::SharedPtr subring (new crypto::KeyRing (cipherSuite));
+            crypto::KeyRing::SharedPtr leaf (new crypto::KeyRing (cipherSuite));
+            crypto::KeyRing::SharedPtr templateRing (new crypto::KeyRing (cipherSuite));
+            templateRing->AddKeyExchangeParams (crypto::Params::SharedPtr (new crypto::X25519Params));
+            crypto::KeyRing::SharedPtr tenant = crypto::KeyRing::CreateFromTemplate (*templateRing);
+            keyRing->AddSubring (subring);
+            keyRing->AddSubring (templateRing);
+            subring->AddSubring (leaf);
+            subring->AddSubring (tenant);
+            bool result = SizeMatchesLoaded (*keyRing, path);
+            std::size_t size = util::Serializable::Size (*keyRing);
+            crypto::SymmetricKey::SharedPtr key = CreateCipherKey (cipherSuite);
+            leaf->AddCipherKey (key);
+            result = result &&
+                util::Serializable::Size (*keyRing) > size &&
+                SizeMatchesLoaded (*keyRing, path);
+            subring->SetName ("subring");
+            result = result && SizeMatchesLoaded (*keyRing, path);
+            // The tenant has to store the template's params itself now.
+            size = util::Serializable::Size (*keyRing);
+            keyRing->DropSubring (templateRing->GetId ());
+            result = result && SizeMatchesLoaded (*keyRing, path);
+            keyRing->AddSubring (templateRing);
+            result = result &&
+                util::Serializable::Size (*keyRing) == size &&
+                leaf->DropCipherKey (key->GetId ()) &&
+                SizeMatchesLoaded (*keyRing, path) &&
+                subring->DropSubring (leaf->GetId ()) &&
+                SizeMatchesLoaded (*keyRing, path) &&
+                SizeMatchesLoaded (*leaf, path);
+            std::remove (path.c_str ());
+            std::cout << (result ? "pass" : "fail") << std::endl;
+            return result;
+        }
+        THEKOGANS_UTIL_CATCH (util::Exception) {
+            std::cout << "fail " << exception.Report ();
+            return false;
+        }
+    }
+
+    bool TestConcurrentKeyRing () {
+        std::cout << "crypto::ConcurrentKeyRing...";
+        const crypto::CipherSuite &cipherSuite = crypto::CipherSuite::Strongest;
+        crypto::KeyRing keyRing (cipherSuite);
+        crypto::KeyRing::SharedPtr subring (new crypto::KeyRing (cipherSuite));
+        crypto::SymmetricKey::SharedPtr oldKey = CreateCipherKey (cipherSuite);
+        subring->AddCipherKey (oldKey);
+        keyRing.AddSubring (subring);
+        crypto::ConcurrentKeyRing concurrentKeyRing (keyRing);
+        crypto::Cipher::SharedPtr cipher = concurrentKeyRing.GetCipher (oldKey->GetId ());
+        crypto::ConcurrentKeyRing::Snapshot::SharedPtr snapshot = concurrentKeyRing.GetSnapshot ();
+        bool result = cipher.Get () != 0 &&
+            concurrentKeyRing.GetCipher (oldKey->GetId ()).Get () == cipher.Get ();
+        crypto::SymmetricKey::SharedPtr newKey = CreateCipherKey (cipherSuite);
+        result = result &&
+            concurrentKeyRing.RotateCipherKey (newKey, oldKey->GetId ()) &&
+            !concurrentKeyRing.RotateCipherKey (newKey, oldKey->GetId ()) &&
+            concurrentKeyRing.GetVersion () == snapshot->version + 1 &&
+            concurrentKeyRing.GetCipher (oldKey->GetId ()).Get () == 0 &&
+            concurrentKeyRing.GetCipher (newKey->GetId ()).Get () != 0 &&
+            // Old snapshots are immutable.
+            snapshot->GetCipherKey (oldKey->GetId ()).Get () == oldKey.Get () &&
+            snapshot->GetCipherKey (newKey->GetId ()).Get () == 0 &&
+            // Untouched tables are shared between versions.
+            concurrentKeyRing.GetSnapshot ()->macKeys.Get () == snapshot->macKeys.Get () &&
+            concurrentKeyRing.ToKeyRing ()->GetCipherKey (newKey->GetId ()).Get () == newKey.Get () &&
+            concurrentKeyRing.DropCipherKey (newKey->GetId ()) &&
+            concurrentKeyRing.GetCipherKey (newKey->GetId ()).Get () == 0;
+        std::cout << (result ? "pass" : "fail") << std::endl;
+        return result;
+    }
+
+    bool TestLazyKeyRing () {
+        std::cout << "crypto::LazyKeyRing...";
+        THEKOGANS_UTIL_TRY {
+            const std::string path = "test_LazyKeyRing.tmp";
+            const crypto::CipherSuite &cipherSuite = crypto::CipherSuite::Strongest;
+            crypto::KeyRing::SharedPtr keyRing (new crypto::KeyRing (cipherSuite));
+            crypto::KeyRing::SharedPtr subring (new crypto::KeyRing (cipherSuite));
+            keyRing->AddSubring (subring);
+            std::vector<crypto::SymmetricKey::SharedPtr> keys;
+            for (std::size_t i = 0; i < 4; ++i) {
+                keys.push_back (CreateCipherKey (cipherSuite));
+                (i & 1 ? subring : keyRing)->AddCipherKey (keys.back ());
+            }
+            // The same key in two rings is written once.
+            subring->AddCipherKey (keys[0]);
+            crypto::Cipher::SharedPtr masterCipher = cipherSuite.GetCipher (CreateCipherKey (cipherSuite));
+            crypto::LazyKeyRing::Save (path, *keyRing, *masterCipher);
+            crypto::LazyKeyRing lazyKeyRing (path, masterCipher, 2);
+            bool result =
+                lazyKeyRing.GetEntryCount (crypto::LazyKeyRingEntryInfo::CIPHER_KEY) == keys.size () &&
+                lazyKeyRing.GetCachedEntryCount () == 0 &&
+                lazyKeyRing.GetCipherKey (crypto::ID ()).Get () == 0;
+            for (std::size_t i = 0; result && i < keys.size (); ++i) {
+                crypto::SymmetricKey::SharedPtr key = lazyKeyRing.GetCipherKey (keys[i]->GetId ());
+                result = key.Get () != 0 &&
+                    key->GetId () == keys[i]->GetId () &&
+                    lazyKeyRing.GetCipher (keys[i]->GetId ()).Get () != 0 &&
+                    lazyKeyRing.GetCachedEntryCount () <= 2;
+            }
+            // Evicted entries are reloaded on demand.
+            result = result &&
+                lazyKeyRing.Evict (crypto::LazyKeyRingEntryInfo::CIPHER_KEY, keys[3]->GetId ()) &&
+                !lazyKeyRing.Evict (crypto::LazyKeyRingEntryInfo::CIPHER_KEY, keys[0]->GetId ()) &&
+                lazyKeyRing.GetCipherKey (keys[0]->GetId ()).Get () != 0;
+            std::cout << (result ? "pass" : "fail") << std::endl;
+            return result;
+        }
+        THEKOGANS_UTIL_CATCH (util::Exception) {
+            std::cout << "fail " << exception.Report ();
+            return false;
+        }
+    }
+    bool TestMappedKeyRing () {
+        std::cout << "crypto::MappedKeyRing...";
+        THEKOGANS_UTIL_TRY {
+            const std::string path = "test_MappedKeyRing.tmp";
+            const crypto::CipherSuite &cipherSuite = crypto::CipherSuite::Strongest;
+            crypto::KeyRing::SharedPtr keyRing (new crypto::KeyRing (cipherSuite));
+            crypto::KeyRing::SharedPtr subring (new crypto::KeyRing (cipherSuite));
+            keyRing->AddSubring (subring);
+            std::vector<crypto::SymmetricKey::SharedPtr> keys;
+            for (std::size_t i = 0; i < 8; ++i) {
+                keys.push_back (CreateCipherKey (cipherSuite));
+                (i & 1 ? subring : keyRing)->AddCipherKey (keys.back ());
+            }
+            subring->AddCipherKey (keys[0]);
+            crypto::MappedKeyRing::Save (path, *keyRing);
+            crypto::MappedKeyRing mappedKeyRing (path);
+            bool result =
+                mappedKeyRing.GetEntryCount () == keys.size () &&
+                mappedKeyRing.GetCipherSuite () == cipherSuite &&
+                mappedKeyRing.GetCipherKey (crypto::ID ()).Get () == 0 &&
+                mappedKeyRing.GetMACKey (keys[0]->GetId ()).Get () == 0;
+            for (std::size_t i = 0; result && i < keys.size (); ++i) {
+                crypto::SymmetricKey::SharedPtr key = mappedKeyRing.GetCipherKey (keys[i]->GetId ());
+                result = key.Get () != 0 && key->GetId () == keys[i]->GetId ();
+            }
+            std::cout << (result ? "pass" : "fail") << std::endl;
+            return result;
+        }
+        THEKOGANS_UTIL_CATCH (util::Exception) {
+            std::cout << "fail " << exception.Report ();
+            return false;
+        }
+    }
+#if defined (THEKOGANS_CRYPTO_HAVE_SHARED_KEY_RING)
+    bool TestSharedKeyRing () {
+        std::cout << "crypto::SharedKeyRing...";
+        THEKOGANS_UTIL_TRY {
+            const crypto::CipherSuite &cipherSuite = crypto::CipherSuite::Strongest;
+            crypto::KeyRing::SharedPtr keyRing (new crypto::KeyRing (cipherSuite));
+            std::vector<crypto::SymmetricKey::SharedPtr> keys;
+            for (std::size_t i = 0; i < 8; ++i) {
+                keys.push_back (CreateCipherKey (cipherSuite));
+                keyRing->AddCipherKey (keys.back ());
+            }
+            // Don't depend on RLIMIT_MEMLOCK.
+            crypto::SharedKeyRing::SharedPtr loader =
+                crypto::SharedKeyRing::Create (*keyRing, true, false);
+            crypto::SharedKeyRing::SharedPtr worker =
+                crypto::SharedKeyRing::Attach (loader->GetHandle (), false);
+            crypto::Cipher::SharedPtr cipher = worker->GetCipher (keys[0]->GetId ());
+            bool result =
+                loader->GetHandle () != -1 &&
+                worker->GetHandle () == -1 &&
+                worker->GetEntryCount () == keys.size () &&
+                worker->GetCipherSuite () == cipherSuite &&
+                cipher.Get () != 0 &&
+                worker->GetCipher (keys[0]->GetId ()).Get () == cipher.Get () &&
+                worker->GetCipher (crypto::ID ()).Get () == 0;
+            for (std::size_t i = 0; result && i < keys.size (); ++i) {
+                crypto::SymmetricKey::SharedPtr key = worker->GetCipherKey (keys[i]->GetId ());
+                result = key.Get () != 0 &&
+                    key->GetKeyLength () == keys[i]->GetKeyLength () &&
+                    memcmp (
+                        key->Get ().GetReadPtr (),
+                        keys[i]->Get ().GetReadPtr (),
+                        key->GetKeyLength ()) == 0;
+            }
+            std::cout << (result ? "pass" : "fail") << std::endl;
+            return result;
+        }
+        THEKOGANS_UTIL_CATCH (util::Exception) {
+            std::cout << "fail " << exception.Report ();
+            return false;
+        }
+    }
+#endif // defined (THEKOGANS_CRYPTO_HAVE_SHARED_KEY_RING)
+
+    bool TestJournaledKeyRing () {
+        std::cout << "crypto::JournaledKeyRing...";
+        THEKOGANS_UTIL_TRY {
+            const std::string path = "test_JournaledKeyRing.tmp";
+            std::remove (path.c_str ());
+            std::remove ((path + ".journal").c_str ());
+            const crypto::CipherSuite &cipherSuite = crypto::CipherSuite::Strongest;
+            crypto::Cipher::SharedPtr masterCipher = cipherSuite.GetCipher (CreateCipherKey (cipherSuite));
+            std::vector<crypto::SymmetricKey::SharedPtr> keys;
+            for (std::size_t i = 0; i < 4; ++i) {
+                keys.push_back (CreateCipherKey (cipherSuite));
+            }
+            bool result = true;
+            {
+                crypto::JournaledKeyRing keyRing (path, masterCipher, cipherSuite);
+                for (std::size_t i = 0; i < keys.size (); ++i) {
+                    result = result && keyRing.AddCipherKey (keys[i]);
+                }
+                result = result &&
+                    !keyRing.AddCipherKey (keys[0]) &&
+                    keyRing.DropCipherKey (keys[3]->GetId ()) &&
+                    !keyRing.DropCipherKey (keys[3]->GetId ()) &&
+                    keyRing.GetJournalRecordCount () == 5;
+            }
+            {
+                // Replay the journal.
+                crypto::JournaledKeyRing keyRing (path, masterCipher, cipherSuite);
+                result = result &&
+                    keyRing.GetJournalRecordCount () == 5 &&
+                    keyRing.GetKeyRing ().GetCipherKey (keys[0]->GetId ()).Get () != 0 &&
+                    keyRing.GetKeyRing ().GetCipherKey (keys[2]->GetId ()).Get () != 0 &&
+                    keyRing.GetKeyRing ().GetCipherKey (keys[3]->GetId ()).Get () == 0;
+                keyRing.Compact ();
+                result = result && keyRing.GetJournalRecordCount () == 0;
+            }
+            {
+                // The base file is a regular key ring.
+                crypto::KeyRing::SharedPtr keyRing = crypto::KeyRing::Load (path, masterCipher.Get ());
+                result = result &&
+                    keyRing->GetCipherKey (keys[1]->GetId ()).Get () != 0 &&
+                    keyRing->GetCipherKey (keys[3]->GetId ()).Get () == 0;
+            }
+            std::remove (path.c_str ());
+            std::remove ((path + ".journal").c_str ());
+            std::cout << (result ? "pass" : "fail") << std::endl;
+            return result;
+        }
+        THEKOGANS_UTIL_CATCH (util::Exception) {
+            std::cout << "fail " << exception.Report ();
+            return false;
+        }
+    }
+
+    // Make sure attribute lookups follow keys as they are added
+    // to and dropped from the tree, and honor recursive.
+    bool TestKeyRingAttributeIndex () {
+        std::cout << "crypto::KeyRing attribute index...";
+        THEKOGANS_UTIL_TRY {
+            const crypto::CipherSuite &cipherSuite = crypto::CipherSuite::Strongest;
+            crypto::KeyRing::SharedPtr root (new crypto::KeyRing (cipherSuite));
+            crypto::KeyRing::SharedPtr leaf (new crypto::KeyRing (cipherSuite));
+            root->AddSubring (leaf);
+            crypto::SymmetricKey::SharedPtr rootKey = CreateCipherKey (cipherSuite);
+            rootKey->SetName ("root");
+            root->AddCipherKey (rootKey);
+            root->AddAttributeIndex ("name",
+                crypto::KeyRing::AttributeExtractor::SharedPtr (
+                    new crypto::KeyRing::NameExtractor));
+            // Built on first use...
+            bool result =
+                root->GetCipherKey (crypto::KeyRing::AttributeQuery ("name", "root")).Get () == rootKey.Get () &&
+                root->GetCipherKey (crypto::KeyRing::AttributeQuery ("name", "leaf")).Get () == 0;
+            // ...and maintained from then on.
+            crypto::SymmetricKey::SharedPtr leafKey = CreateCipherKey (cipherSuite);
+            leafKey->SetName ("leaf");
+            leaf->AddCipherKey (leafKey);
+            result = result &&
+                root->GetCipherKey (crypto::KeyRing::AttributeQuery ("name", "leaf")).Get () == leafKey.Get () &&
+                root->GetCipherKey (crypto::KeyRing::AttributeQuery ("name", "leaf"), false).Get () == 0 &&
+                leaf->GetCipherKey (crypto::KeyRing::AttributeQuery ("name", "leaf")).Get () == leafKey.Get () &&
+                leaf->GetCipherKey (crypto::KeyRing::AttributeQuery ("name", "root")).Get () == 0 &&
+                root->GetMACKey (crypto::KeyRing::AttributeQuery ("name", "root")).Get () == 0 &&
+                leaf->DropCipherKey (leafKey->GetId ()) &&
+                root->GetCipherKey (crypto::KeyRing::AttributeQuery ("name", "leaf")).Get () == 0 &&
+                root->DropAttributeIndex ("name") &&
+                !root->DropAttributeIndex ("name");
+            THEKOGANS_UTIL_TRY {
+                root->GetCipherKey (crypto::KeyRing::AttributeQuery ("name", "root"));
+                result = false;
+            }
+            THEKOGANS_UTIL_CATCH (util::Exception) {
+            }
+            std::cout << (result ? "pass" : "fail") << std::endl;
+            return result;
+        }
+        THEKOGANS_UTIL_CATCH (util::Exception) {
+            std::cout << "fail " << exception.Report ();
+            return false;
+        }
+    }
+    bool SameKey (
+            crypto::SymmetricKey::SharedPtr key1,
+            crypto::SymmetricKey::SharedPtr key2) {
+        return key1->GetKeyLength () == key2->GetKeyLength () &&
+            memcmp (
+                key1->Get ().GetReadPtr (),
+                key2->Get ().GetReadPtr (),
+                key1->GetKeyLength ()) == 0;
+    }
+
+    // Make sure every KEK in an envelope recovers the same DEK,
+    // and that rotation and revocation only touch the envelope.
+    bool TestKeyEnvelope () {
+        std::cout << "crypto::KeyEnvelope...";
+        THEKOGANS_UTIL_TRY {
+            const crypto::CipherSuite &cipherSuite = crypto::CipherSuite::Strongest;
+            crypto::SymmetricKey::SharedPtr symmetricKek = CreateCipherKey (cipherSuite);
+            crypto::AsymmetricKey::SharedPtr x25519Kek = crypto::X25519Params ().CreateKey ();
+            crypto::KeyEnvelope envelope (cipherSuite);
+            crypto::SymmetricKey::SharedPtr dek = envelope.CreateDataKey ();
+            envelope.Wrap (dek, symmetricKek);
+            // Only the public part is needed to wrap.
+            envelope.Wrap (dek, x25519Kek->GetPublicKey (x25519Kek->GetId ()));
+            crypto::KeyRing::SharedPtr symmetricRing (new crypto::KeyRing (cipherSuite));
+            symmetricRing->AddCipherKey (symmetricKek);
+            crypto::KeyRing::SharedPtr x25519Ring (new crypto::KeyRing (cipherSuite));
+            x25519Ring->AddKeyExchangeKey (x25519Kek);
+            bool result =
+                envelope.wrappedKeys.size () == 2 &&
+                SameKey (envelope.Unwrap (*symmetricRing), dek) &&
+                SameKey (envelope.Unwrap (*x25519Ring), dek) &&
+                SameKey (envelope.Unwrap (x25519Kek), dek);
+            // Round trip through a serializer.
+            util::Buffer buffer (util::NetworkEndian, envelope.Size ());
+            buffer << envelope;
+            crypto::KeyEnvelope copy;
+            buffer >> copy;
+            result = result &&
+                buffer.GetDataAvailableForReading () == 0 &&
+                copy.wrappedKeys.size () == 2 &&
+                SameKey (copy.Unwrap (symmetricKek), dek);
+            // Rotate the symmetric KEK out. The DEK stays the same.
+            crypto::SymmetricKey::SharedPtr newKek = CreateCipherKey (cipherSuite);
+            copy.Rotate (*x25519Ring, symmetricKek->GetId (), newKek);
+            result = result &&
+                !copy.Contains (symmetricKek->GetId ()) &&
+                copy.Contains (newKek->GetId ()) &&
+                SameKey (copy.Unwrap (newKek), dek) &&
+                copy.Remove (x25519Kek->GetId ()) &&
+                !copy.Remove (x25519Kek->GetId ());
+            THEKOGANS_UTIL_TRY {
+                copy.Unwrap (*x25519Ring);
+                result = false;
+            }
+            THEKOGANS_UTIL_CATCH (util::Exception) {
+            }
+            std::cout << (result ? "pass" : "fail") << std::endl;
+            return result;
+        }
+        THEKOGANS_UTIL_CATCH (util::Exception) {
+            std::cout << "fail " << exception.Report ();
+            return false;
+        }
+    }
+
+    // A KEK that can't unwrap it's copy of the DEK must not stop
+    // Unwrap (*keyRing) from trying the others.
+    bool TestKeyEnvelopeUnwrapFallback () {
+        std::cout << "crypto::KeyEnvelope unwrap fallback...";
+        THEKOGANS_UTIL_TRY {
+            const crypto::CipherSuite &cipherSuite = crypto::CipherSuite::Strongest;
+            crypto::SymmetricKey::SharedPtr kek1 = CreateCipherKey (cipherSuite);
+            crypto::SymmetricKey::SharedPtr kek2 = CreateCipherKey (cipherSuite);
+            crypto::KeyEnvelope envelope (cipherSuite);
+            crypto::SymmetricKey::SharedPtr dek = envelope.CreateDataKey ();
+            envelope.Wrap (dek, kek1);
+            envelope.Wrap (dek, kek2);
+            // A stale key with kek1's id in the root, the real kek1 in a subring.
+            // The fast lookup finds the stale one first.
+            crypto::SymmetricKey::SharedPtr staleKek1 = crypto::SymmetricKey::FromRandom (
+                crypto::SymmetricKey::MIN_RANDOM_LENGTH,
+                0,
+                0,
+                crypto::GetCipherKeyLength (cipherSuite.GetOpenSSLCipher ()),
+                THEKOGANS_CRYPTO_DEFAULT_MD,
+                1,
+                kek1->GetId ());
+            crypto::KeyRing::SharedPtr root (new crypto::KeyRing (cipherSuite));
+            crypto::KeyRing::SharedPtr subring (new crypto::KeyRing (cipherSuite));
+            root->AddCipherKey (staleKek1);
+            subring->AddCipherKey (kek1);
+            root->AddSubring (subring);
+            bool result =
+                root->GetCipherKey (kek1->GetId ()).Get () == staleKek1.Get () &&
+                SameKey (envelope.Unwrap (*root), dek);
+            // A damaged copy falls through to the next KEK.
+            crypto::KeyEnvelope damaged = envelope;
+            damaged.wrappedKeys[0].wrappedKey.back () ^= 1;
+            crypto::KeyRing::SharedPtr bothRing (new crypto::KeyRing (cipherSuite));
+            bothRing->AddCipherKey (kek1);
+            bothRing->AddCipherKey (kek2);
+            result = result && SameKey (damaged.Unwrap (*bothRing), dek);
+            // When every KEK fails, Unwrap throws.
+            crypto::KeyRing::SharedPtr staleRing (new crypto::KeyRing (cipherSuite));
+            staleRing->AddCipherKey (staleKek1);
+            crypto::KeyRing::SharedPtr kek1Ring (new crypto::KeyRing (cipherSuite));
+            kek1Ring->AddCipherKey (kek1);
+            crypto::KeyRing *failingRings[] = {staleRing.Get (), kek1Ring.Get ()};
+            const crypto::KeyEnvelope *failingEnvelopes[] = {&envelope, &damaged};
+            for (std::size_t i = 0; result && i < 2; ++i) {
+                THEKOGANS_UTIL_TRY {
+                    failingEnvelopes[i]->Unwrap (*failingRings[i]);
+                    result = false;
+                }
+                THEKOGANS_UTIL_CATCH (util::Exception) {
+                }
+            }
+            std::cout << (result ? "pass" : "fail") << std::endl;
+            return result;
+        }
+        THEKOGANS_UTIL_CATCH (util::Exception) {
+            std::cout << "fail " << exception.Report ();
+            return false;
+        }
+    }
+}
+
 TEST (thekogans, KeyRing) {
     crypto::OpenSSLInit openSSLInit;
-    CHECK_EQUAL (true, true);
+    CHECK_EQUAL (TestKeyRingIndex (), true);
+    CHECK_EQUAL (TestKeyRingAttributeIndex (), true);
+    CHECK_EQUAL (TestKeyRingBulk (), true);
+    CHECK_EQUAL (TestKeyRingCache (), true);
+    CHECK_EQUAL (TestKeyRingStream (), true);
+    CHECK_EQUAL (TestKeyRingText (), true);
+    CHECK_EQUAL (TestKeyRingTemplate (), true);
+    CHECK_EQUAL (TestKeyRingCompact (), true);
+    CHECK_EQUAL (TestKeyRingParallelRead (), true);
+    CHECK_EQUAL (TestKeyRingRandom (), true);
+    CHECK_EQUAL (TestKeyRingSize (), true);
+}
+
+TEST (thekogans, ConcurrentKeyRing) {
+    crypto::OpenSSLInit openSSLInit;
+    CHECK_EQUAL (TestConcurrentKeyRing (), true);
+}
+
+TEST (thekogans, LazyKeyRing) {
+    crypto::OpenSSLInit openSSLInit;
+    CHECK_EQUAL (TestLazyKeyRing (), true);
+}
+
+TEST (thekogans, MappedKeyRing) {
+    crypto::OpenSSLInit openSSLInit;
+    CHECK_EQUAL (TestMappedKeyRing (), true);
+}
+
+#if defined (THEKOGANS_CRYPTO_HAVE_SHARED_KEY_RING)
+TEST (thekogans, SharedKeyRing) {
+    crypto::OpenSSLInit openSSLInit;
+    CHECK_EQUAL (TestSharedKeyRing (), true);
+}
+#endif // defined (THEKOGANS_CRYPTO_HAVE_SHARED_KEY_RING)
+
+TEST (thekogans, JournaledKeyRing) {
+    crypto::OpenSSLInit openSSLInit;
+    CHECK_EQUAL (TestJournaledKeyRing (), true);
+}
+
+TEST (thekogans, KeyEnvelope) {
+    crypto::OpenSSLInit openSSLInit;
+    CHECK_EQUAL (TestKeyEnvelope () && TestKeyEnvelopeUnwrapFallback (), true);
+}
+
+TEST (thekogans, IDHashMap) {
+    crypto::OpenSSLInit openSSLInit;
+    CHECK_EQUAL (TestIDHashMap (), true);
+    CHECK_EQUAL (TestIDDerivation (), true);
 }
 
 TESTMAIN
@@ -15,15 +15,27 @@
 // You should have received a copy of the GNU General Public License
 // along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
 
+#include <cstring>
 #include <iostream>
+#include <openssl/hmac.h>
 #include <CppUnitXLite/CppUnitXLite.cpp>
 #include "thekogans/util/Types.h"
 #include "thekogans/util/Buffer.h"
 #include "thekogans/util/RandomSource.h"
 #include "thekogans/crypto/OpenSSLInit.h"
 #include "thekogans/crypto/CipherSuite.h"
+#include "thekogans/crypto/ConstantTime.h"
+#include "thekogans/crypto/FrameHeader.h"
 #include "thekogans/crypto/HMAC.h"
 #include "thekogans/crypto/CMAC.h"
+#include "thekogans/crypto/GMAC.h"
+#include "thekogans/crypto/Poly1305.h"
+#if defined (THEKOGANS_CRYPTO_HAVE_BLAKE2)
+    #include "thekogans/crypto/Blake2b.h"
+    #include "thekogans/crypto/Blake2s.h"
+    #include "thekogans/crypto/Blake2MAC.h"
+#endif // defined (THEKOGANS_CRYPTO_HAVE_BLAKE2)
+#include "thekogans/crypto/Blake3.h"
 
 using namespace thekogans;
 
@@ -40,11 +52,35 @@ namespace {
             util::ui8 buffer[1024];
             util::GlobalRandomSource::Instance ().GetBytes (buffer, 1024);
             util::Buffer signature = mac.SignBuffer (buffer, 1024);
-            bool result = mac.VerifyBufferSignature (
-                buffer,
-                1024,
-                signature.GetReadPtr (),
-                signature.GetDataAvailableForReading ());
+            // Compare against OpenSSL's own HMAC (and BLAKE3's keyed hash).
+            util::ui8 expected[EVP_MAX_MD_SIZE];
+            util::ui32 expectedLength = 0;
+            if (md == crypto::EVP_blake3_256 ()) {
+                crypto::Blake3 blake3;
+                blake3.InitKeyed (
+                    key->Get ().GetReadPtr (),
+                    key->Get ().GetDataAvailableForReading ());
+                blake3.Update (buffer, 1024);
+                blake3.Final (expected);
+                expectedLength = crypto::Blake3::OUT_LENGTH;
+            }
+            else {
+                ::HMAC (
+                    md,
+                    key->Get ().GetReadPtr (),
+                    (int)key->Get ().GetDataAvailableForReading (),
+                    buffer,
+                    1024,
+                    expected,
+                    &expectedLength);
+            }
+            bool result = signature.GetDataAvailableForReading () == expectedLength &&
+                memcmp (signature.GetReadPtr (), expected, expectedLength) == 0 &&
+                mac.VerifyBufferSignature (
+                    buffer,
+                    1024,
+                    signature.GetReadPtr (),
+                    signature.GetDataAvailableForReading ());
             std::cout << (result ? "pass" : "fail") << std::endl;
             return result;
         }
@@ -77,6 +113,59 @@ namespace {
             return false;
         }
     }
+
+    bool TestNonceMAC (
+            const char *name,
+            crypto::MAC &mac) {
+        THEKOGANS_UTIL_TRY {
+            std::cout << name << "...";
+            util::ui8 buffer[1024];
+            util::GlobalRandomSource::Instance ().GetBytes (buffer, 1024);
+            util::Buffer signature1 = mac.SignBuffer (buffer, 1024);
+            util::Buffer signature2 = mac.SignBuffer (buffer, 1024);
+            // Every signature gets it's own nonce.
+            bool result =
+                signature1.GetDataAvailableForReading () == mac.GetMACLength () &&
+                signature2.GetDataAvailableForReading () == mac.GetMACLength () &&
+                memcmp (signature1.GetReadPtr (), signature2.GetReadPtr (), mac.GetMACLength ()) != 0 &&
+                mac.VerifyBufferSignature (
+                    buffer,
+                    1024,
+                    signature1.GetReadPtr (),
+                    signature1.GetDataAvailableForReading ()) &&
+                mac.VerifyBufferSignature (
+                    buffer,
+                    1024,
+                    signature2.GetReadPtr (),
+                    signature2.GetDataAvailableForReading ());
+            if (result) {
+                buffer[0] ^= 1;
+                result = !mac.VerifyBufferSignature (
+                    buffer,
+                    1024,
+                    signature1.GetReadPtr (),
+                    signature1.GetDataAvailableForReading ());
+            }
+            if (result) {
+                util::Buffer frame = mac.SignAndFrame (crypto::ID (), buffer, 1024);
+                const util::ui8 *payload = 0;
+                std::size_t payloadLength = 0;
+                result = mac.VerifyFrame (
+                    frame.GetReadPtr (),
+                    frame.GetDataAvailableForReading (),
+                    payload,
+                    payloadLength) &&
+                    payloadLength == 1024 &&
+                    memcmp (payload, buffer, 1024) == 0;
+            }
+            std::cout << (result ? "pass" : "fail") << std::endl;
+            return result;
+        }
+        THEKOGANS_UTIL_CATCH (util::Exception) {
+            std::cout << "fail " << exception.Report ();
+            return false;
+        }
+    }
 }
 
 TEST (thekogans, HMAC) {
@@ -116,4 +205,186 @@ TEST (thekogans, CMAC) {
     }
 }
 
+TEST (thekogans, GMAC) {
+    crypto::OpenSSLInit openSSLInit;
+    const std::size_t keyLengths[] = {16, 24, 32};
+    for (std::size_t i = 0; i < 3; ++i) {
+        crypto::SymmetricKey::SharedPtr key = crypto::SymmetricKey::FromSecretAndSalt (
+            secret.c_str (),
+            secret.size (),
+            0,
+            0,
+            keyLengths[i]);
+        crypto::MAC::SharedPtr mac = crypto::CipherSuite::Strongest.GetGMAC (key);
+        CHECK_EQUAL (mac->GetType (), crypto::MAC::TYPE_GMAC);
+        CHECK_EQUAL (TestNonceMAC ("GMAC", *mac), true);
+    }
+    {
+        // The tag must match AES-GCM over an empty plaintext.
+        std::cout << "GMAC AES-GCM...";
+        crypto::SymmetricKey::SharedPtr key = crypto::SymmetricKey::FromSecretAndSalt (
+            secret.c_str (),
+            secret.size ());
+        crypto::GMAC mac (key, crypto::GMAC::GetCipherFromKeyLength (key->GetKeyLength ()));
+        util::ui8 buffer[1024];
+        util::GlobalRandomSource::Instance ().GetBytes (buffer, 1024);
+        util::ui8 signature[crypto::GMAC::SIGNATURE_LENGTH];
+        mac.SignBuffer (buffer, 1024, signature);
+        crypto::CipherContext ctx;
+        util::ui8 tag[crypto::GMAC::TAG_LENGTH];
+        int length = 0;
+        bool result =
+            EVP_EncryptInit_ex (&ctx, mac.GetCipher (), 0,
+                key->Get ().GetReadPtr (), signature) == 1 &&
+            EVP_EncryptUpdate (&ctx, 0, &length, buffer, 1024) == 1 &&
+            EVP_EncryptFinal_ex (&ctx, tag, &length) == 1 &&
+            EVP_CIPHER_CTX_ctrl (&ctx, EVP_CTRL_GCM_GET_TAG,
+                crypto::GMAC::TAG_LENGTH, tag) == 1 &&
+            memcmp (tag, signature + crypto::GMAC::NONCE_LENGTH,
+                crypto::GMAC::TAG_LENGTH) == 0;
+        std::cout << (result ? "pass" : "fail") << std::endl;
+        CHECK_EQUAL (result, true);
+    }
+}
+
+TEST (thekogans, Poly1305) {
+    crypto::OpenSSLInit openSSLInit;
+    crypto::SymmetricKey::SharedPtr key = crypto::SymmetricKey::FromSecretAndSalt (
+        secret.c_str (),
+        secret.size (),
+        0,
+        0,
+        crypto::Poly1305::KEY_LENGTH);
+    crypto::MAC::SharedPtr mac =
+        crypto::CipherSuite::Strongest.GetMAC (key, crypto::MAC::TYPE_POLY1305);
+    CHECK_EQUAL (mac->GetType (), crypto::MAC::TYPE_POLY1305);
+    CHECK_EQUAL (TestNonceMAC ("Poly1305", *mac), true);
+}
+
+#if defined (THEKOGANS_CRYPTO_HAVE_BLAKE2)
+TEST (thekogans, Blake2MAC) {
+    crypto::OpenSSLInit openSSLInit;
+    const EVP_MD *mds[] = {
+        crypto::EVP_blake2b512 (),
+        crypto::EVP_blake2b256 (),
+        crypto::EVP_blake2bp512 (),
+        crypto::EVP_blake2s256 (),
+        crypto::EVP_blake2sp256 ()
+    };
+    // A short key and one longer than any BLAKE2 max key length.
+    const std::size_t keyLengths[] = {32, 100};
+    for (std::size_t i = 0; i < 5; ++i) {
+        for (std::size_t j = 0; j < 2; ++j) {
+            std::cout << "Blake2MAC-" << OBJ_nid2sn (EVP_MD_type (mds[i])) <<
+                "-" << keyLengths[j] << "...";
+            bool result = false;
+            THEKOGANS_UTIL_TRY {
+                crypto::SymmetricKey::SharedPtr key = crypto::SymmetricKey::FromSecretAndSalt (
+                    secret.c_str (),
+                    secret.size (),
+                    0,
+                    0,
+                    keyLengths[j]);
+                crypto::Blake2MAC mac1 (key, mds[i]);
+                crypto::Blake2MAC mac2 (key, mds[i]);
+                crypto::HMAC hmac (key, mds[i]);
+                util::ui8 buffer[1024];
+                util::GlobalRandomSource::Instance ().GetBytes (buffer, 1024);
+                util::Buffer signature1 = mac1.SignBuffer (buffer, 1024);
+                util::Buffer signature2 = mac2.SignBuffer (buffer, 1024);
+                util::Buffer signature3 = hmac.SignBuffer (buffer, 1024);
+                result =
+                    signature1.GetDataAvailableForReading () == (std::size_t)EVP_MD_size (mds[i]) &&
+                    memcmp (signature1.GetReadPtr (), signature2.GetReadPtr (),
+                        signature1.GetDataAvailableForReading ()) == 0 &&
+                    // Keyed BLAKE2 is not HMAC-BLAKE2.
+                    memcmp (signature1.GetReadPtr (), signature3.GetReadPtr (),
+                        signature1.GetDataAvailableForReading ()) != 0 &&
+                    mac1.VerifyBufferSignature (
+                        buffer,
+                        1024,
+                        signature2.GetReadPtr (),
+                        signature2.GetDataAvailableForReading ());
+            }
+            THEKOGANS_UTIL_CATCH (util::Exception) {
+                std::cout << exception.Report ();
+            }
+            std::cout << (result ? "pass" : "fail") << std::endl;
+            CHECK_EQUAL (result, true);
+        }
+    }
+}
+#endif // defined (THEKOGANS_CRYPTO_HAVE_BLAKE2)
+
+TEST (thekogans, AuthenticatedFrame) {
+    crypto::OpenSSLInit openSSLInit;
+    bool result = false;
+    THEKOGANS_UTIL_TRY {
+        std::cout << "AuthenticatedFrame...";
+        crypto::SymmetricKey::SharedPtr key = crypto::SymmetricKey::FromSecretAndSalt (
+            secret.c_str (),
+            secret.size ());
+        crypto::HMAC mac (key, THEKOGANS_CRYPTO_DEFAULT_MD);
+        util::ui8 buffer[1024];
+        util::GlobalRandomSource::Instance ().GetBytes (buffer, 1024);
+        util::Buffer frame = mac.SignAndFrame (key->GetId (), buffer, 1024);
+        const util::ui8 *payload = 0;
+        std::size_t payloadLength = 0;
+        result = frame.GetDataAvailableForReading () == mac.GetFrameLength (1024) &&
+            mac.VerifyFrame (
+                frame.GetReadPtr (),
+                frame.GetDataAvailableForReading (),
+                payload,
+                payloadLength) &&
+            // Verified in place.
+            payload == frame.GetReadPtr () + crypto::FrameHeader::SIZE &&
+            payloadLength == 1024 &&
+            memcmp (payload, buffer, 1024) == 0;
+        if (result) {
+            // The mac covers the header as well as the payload.
+            frame.GetReadPtr ()[0] ^= 1;
+            result = !mac.VerifyFrame (
+                frame.GetReadPtr (),
+                frame.GetDataAvailableForReading (),
+                payload,
+                payloadLength);
+        }
+        std::cout << (result ? "pass" : "fail") << std::endl;
+    }
+    THEKOGANS_UTIL_CATCH (util::Exception) {
+        std::cout << "fail " << exception.Report ();
+    }
+    CHECK_EQUAL (result, true);
+}
+
+TEST (thekogans, ConstantTime) {
+    std::cout << "ConstantTime...";
+    util::ui8 buffer1[100];
+    util::ui8 buffer2[100];
+    util::GlobalRandomSource::Instance ().GetBytes (buffer1, sizeof (buffer1));
+    memcpy (buffer2, buffer1, sizeof (buffer2));
+    bool result = true;
+    // Exercise the vector, word and byte paths.
+    for (std::size_t length = 1; result && length <= sizeof (buffer1); ++length) {
+        result = crypto::ConstantTimeCompare (buffer1, buffer2, length);
+        buffer2[length - 1] ^= 0x80;
+        result = result && !crypto::ConstantTimeCompare (buffer1, buffer2, length);
+        buffer2[length - 1] ^= 0x80;
+    }
+    for (std::size_t i = 0; i < sizeof (buffer2); ++i) {
+        buffer2[i] = ~buffer1[i];
+    }
+    util::ui8 selected[100];
+    crypto::ConstantTimeSelect (true, buffer1, buffer2, selected, sizeof (selected));
+    result = result && memcmp (selected, buffer1, sizeof (selected)) == 0;
+    crypto::ConstantTimeSelect (false, buffer1, buffer2, selected, sizeof (selected));
+    result = result && memcmp (selected, buffer2, sizeof (selected)) == 0;
+    crypto::SecureZero (selected, sizeof (selected));
+    for (std::size_t i = 0; result && i < sizeof (selected); ++i) {
+        result = selected[i] == 0;
+    }
+    std::cout << (result ? "pass" : "fail") << std::endl;
+    CHECK_EQUAL (result, true);
+}
+
 TESTMAIN
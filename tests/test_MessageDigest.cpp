@@ -16,19 +16,35 @@
 // along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
 
 #include <cstring>
+#include <algorithm>
 #include <iostream>
+#include <vector>
 #include <CppUnitXLite/CppUnitXLite.cpp>
 #include "thekogans/util/Buffer.h"
 #include "thekogans/util/File.h"
+#include "thekogans/util/RandomSource.h"
+#include "thekogans/util/StringUtils.h"
 #include "thekogans/crypto/OpenSSLInit.h"
 #include "thekogans/crypto/CipherSuite.h"
+#include "thekogans/crypto/FileReader.h"
+#include "thekogans/crypto/FileWriter.h"
 #include "thekogans/crypto/MessageDigest.h"
+#include "thekogans/crypto/SHA2MultiBuffer.h"
+#include "thekogans/crypto/Blake3.h"
+#include "thekogans/crypto/HMAC.h"
 
 using namespace thekogans;
 
 namespace {
     std::string message ("The quck brown fox jumped over the lazy dog.");
 
+    bool operator == (
+            const util::Buffer &buffer1,
+            const util::Buffer &buffer2) {
+        return buffer1.GetDataAvailableForReading () == buffer2.GetDataAvailableForReading () &&
+            memcmp (buffer1.GetReadPtr (), buffer2.GetReadPtr (), buffer1.GetDataAvailableForReading ()) == 0;
+    }
+
     bool TestMessageDigest (
             const char *name,
             const EVP_MD *md) {
@@ -39,6 +55,20 @@ namespace {
             util::Buffer buffer2 = messageDigest.HashBuffer (message.c_str (), message.size ());
             bool result = buffer1.GetDataAvailableForReading () == buffer2.GetDataAvailableForReading () &&
                 memcmp (buffer1.GetReadPtr (), buffer2.GetReadPtr (), buffer1.GetDataAvailableForReading ()) == 0;
+            if (result) {
+                // Hash the first half once and finish it twice (Clone and CopyState).
+                std::size_t half = message.size () / 2;
+                messageDigest.Init ();
+                messageDigest.Update (message.c_str (), half);
+                crypto::MessageDigest::SharedPtr prefix = messageDigest.Clone ();
+                for (std::size_t i = 0; result && i < 2; ++i) {
+                    messageDigest.CopyState (*prefix);
+                    messageDigest.Update (message.c_str () + half, message.size () - half);
+                    util::Buffer buffer3 (util::HostEndian, messageDigest.GetDigestLength ());
+                    buffer3.AdvanceWriteOffset (messageDigest.Final (buffer3.GetWritePtr ()));
+                    result = buffer3 == buffer1;
+                }
+            }
             if (result) {
                 std::string path = name + std::string (".test");
                 {
@@ -64,6 +94,341 @@ namespace {
             return false;
         }
     }
+
+    bool TestTreeHash (
+            const char *name,
+            const EVP_MD *md) {
+        THEKOGANS_UTIL_TRY {
+            std::cout << name << " tree...";
+            // 10 and a half leaves.
+            const std::size_t leafLength = 4096;
+            std::vector<util::ui8> data (leafLength * 10 + leafLength / 2);
+            util::GlobalRandomSource::Instance ().GetBytes (data.data (), data.size ());
+            crypto::MessageDigest messageDigest (md);
+            util::Buffer singleThreaded =
+                messageDigest.HashBufferTree (data.data (), data.size (), leafLength, 1);
+            util::Buffer multiThreaded =
+                messageDigest.HashBufferTree (data.data (), data.size (), leafLength, 4);
+            util::Buffer plain = messageDigest.HashBuffer (data.data (), data.size ());
+            bool result = singleThreaded == multiThreaded && !(singleThreaded == plain);
+            if (result) {
+                std::string path = name + std::string (".tree.test");
+                {
+                    // Write behind (io_uring if available), in uneven pieces.
+                    crypto::FileWriter file (path, 5000, 3);
+                    for (std::size_t offset = 0, count = data.size (); offset < count;) {
+                        std::size_t length = std::min ((std::size_t)3333, count - offset);
+                        file.Write (data.data () + offset, length);
+                        offset += length;
+                    }
+                    file.Flush ();
+                }
+                util::Buffer mapped = messageDigest.HashFileTree (path, leafLength, 4, true);
+                util::Buffer read = messageDigest.HashFileTree (path, leafLength, 4, false);
+                // Read ahead mode (buffered and direct) must not change the plain hash.
+                util::Buffer plain = messageDigest.HashBuffer (data.data (), data.size ());
+                crypto::FileReader readAhead (path, false, 5000, 2);
+                util::Buffer readAheadHash = messageDigest.HashFile (readAhead);
+                crypto::FileReader direct (path, false, 5000, 3, true);
+                util::Buffer directHash = messageDigest.HashFile (direct);
+                // The I/O thread fallback (no io_uring).
+                crypto::FileReader blocking (path, false, 5000, 3, false, false);
+                util::Buffer blockingHash = messageDigest.HashFile (blocking);
+                unlink (path.c_str ());
+                result = mapped == singleThreaded && read == singleThreaded &&
+                    readAheadHash == plain && directHash == plain && blockingHash == plain &&
+                    readAhead.GetStats ().bytesRead == data.size ();
+            }
+            std::cout << (result ? "pass" : "fail") << std::endl;
+            return result;
+        }
+        THEKOGANS_UTIL_CATCH (util::Exception) {
+            std::cout << "fail " << exception.Report ();
+            return false;
+        }
+    }
+
+    bool TestHashBatch (
+            const char *name,
+            const EVP_MD *md) {
+        THEKOGANS_UTIL_TRY {
+            std::cout << name << " batch...";
+            // Every length around the one and two block padding
+            // boundaries, plus a few multi block ones.
+            std::vector<std::vector<util::ui8>> messages;
+            for (std::size_t length = 1; length <= 260; ++length) {
+                messages.push_back (std::vector<util::ui8> (length));
+            }
+            for (std::size_t i = 0; i < 16; ++i) {
+                messages.push_back (
+                    std::vector<util::ui8> (1 + util::GlobalRandomSource::Instance ().Getui32 () % 10000));
+            }
+            std::vector<const void *> buffers;
+            std::vector<std::size_t> lengths;
+            for (std::size_t i = 0, count = messages.size (); i < count; ++i) {
+                util::GlobalRandomSource::Instance ().GetBytes (
+                    messages[i].data (), messages[i].size ());
+                buffers.push_back (messages[i].data ());
+                lengths.push_back (messages[i].size ());
+            }
+            crypto::MessageDigest messageDigest (md);
+            std::vector<util::Buffer> hashes =
+                messageDigest.HashBatch (buffers.data (), lengths.data (), buffers.size ());
+            bool result = hashes.size () == messages.size ();
+            for (std::size_t i = 0, count = messages.size (); result && i < count; ++i) {
+                result = hashes[i] == messageDigest.HashBuffer (buffers[i], lengths[i]);
+            }
+            // Check every kernel this cpu can run, not just the best one.
+            crypto::SHA2MultiBuffer::Algorithm algorithm;
+            if (result && crypto::SHA2MultiBuffer::GetAlgorithm (md, algorithm)) {
+                const crypto::SHA2MultiBuffer::Kernel kernels[] = {
+                    crypto::SHA2MultiBuffer::KERNEL_SCALAR,
+                    crypto::SHA2MultiBuffer::KERNEL_NEON,
+                    crypto::SHA2MultiBuffer::KERNEL_AVX2,
+                    crypto::SHA2MultiBuffer::KERNEL_AVX512
+                };
+                std::size_t digestLength = messageDigest.GetDigestLength ();
+                std::vector<util::ui8> digests (buffers.size () * digestLength);
+                for (std::size_t i = 0; result && i < sizeof (kernels) / sizeof (kernels[0]); ++i) {
+                    if (crypto::SHA2MultiBuffer::IsKernelSupported (kernels[i])) {
+                        crypto::SHA2MultiBuffer::Hash (algorithm, buffers.data (),
+                            lengths.data (), buffers.size (), digests.data (), kernels[i]);
+                        for (std::size_t j = 0, count = hashes.size (); result && j < count; ++j) {
+                            result = memcmp (hashes[j].GetReadPtr (),
+                                digests.data () + j * digestLength, digestLength) == 0;
+                        }
+                    }
+                }
+            }
+            std::cout << (result ? "pass" : "fail") << std::endl;
+            return result;
+        }
+        THEKOGANS_UTIL_CATCH (util::Exception) {
+            std::cout << "fail " << exception.Report ();
+            return false;
+        }
+    }
+
+    // Official BLAKE3 test vectors (first 32 bytes of output). Input is
+    // i % 251, i = [0, length).
+    const char * const BLAKE3_KEY = "whats the Elvish word for friend";
+    const char * const BLAKE3_CONTEXT = "BLAKE3 2019-12-27 16:29:52 test vectors context";
+    const struct {
+        std::size_t length;
+        const char *hash;
+        const char *keyedHash;
+        const char *deriveKey;
+    } blake3Vectors[] = {
+        {0,
+            "af1349b9f5f9a1a6a0404dea36dcc9499bcb25c9adc112b7cc9a93cae41f3262",
+            "92b2b75604ed3c761f9d6f62392c8a9227ad0ea3f09573e783f1498a4ed60d26",
+            "2cc39783c223154fea8dfb7c1b1660f2ac2dcbd1c1de8277b0b0dd39b7e50d7d"},
+        {1,
+            "2d3adedff11b61f14c886e35afa036736dcd87a74d27b5c1510225d0f592e213",
+            "6d7878dfff2f485635d39013278ae14f1454b8c0a3a2d34bc1ab38228a80c95b",
+            "b3e2e340a117a499c6cf2398a19ee0d29cca2bb7404c73063382693bf66cb06c"},
+        {1023,
+            "10108970eeda3eb932baac1428c7a2163b0e924c9a9e25b35bba72b28f70bd11",
+            "c951ecdf03288d0fcc96ee3413563d8a6d3589547f2c2fb36d9786470f1b9d6e",
+            "74a16c1c3d44368a86e1ca6df64be6a2f64cce8f09220787450722d85725dea5"},
+        {1024,
+            "42214739f095a406f3fc83deb889744ac00df831c10daa55189b5d121c855af7",
+            "75c46f6f3d9eb4f55ecaaee480db732e6c2105546f1e675003687c31719c7ba4",
+            "7356cd7720d5b66b6d0697eb3177d9f8d73a4a5c5e968896eb6a689684302706"},
+        {1025,
+            "d00278ae47eb27b34faecf67b4fe263f82d5412916c1ffd97c8cb7fb814b8444",
+            "357dc55de0c7e382c900fd6e320acc04146be01db6a8ce7210b7189bd664ea69",
+            "effaa245f065fbf82ac186839a249707c3bddf6d3fdda22d1b95a3c970379bcb"},
+        {2048,
+            "e776b6028c7cd22a4d0ba182a8bf62205d2ef576467e838ed6f2529b85fba24a",
+            "879cf1fa2ea0e79126cb1063617a05b6ad9d0b696d0d757cf053439f60a99dd1",
+            "7b2945cb4fef70885cc5d78a87bf6f6207dd901ff239201351ffac04e1088a23"},
+        {8193,
+            "bab6c09cb8ce8cf459261398d2e7aef35700bf488116ceb94a36d0f5f1b7bc3b",
+            "954a2a75420c8d6547e3ba5b98d963e6fa6491addc8c023189cc519821b4a1f5",
+            "af1e0346e389b17c23200270a64aa4e1ead98c61695d917de7d5b00491c9b0f1"},
+        {102400,
+            "bc3e3d41a1146b069abffad3c0d44860cf664390afce4d9661f7902e7943e085",
+            "1c35d1a5811083fd7119f5d5d1ba027b4d01c0c6c49fb6ff2cf75393ea5db4a7",
+            "4652cff7a3f385a6103b5c260fc1593e13c778dbe608efb092fe7ee69df6e9c6"}
+    };
+
+    bool TestBlake3Vectors () {
+        THEKOGANS_UTIL_TRY {
+            std::cout << "BLAKE3 test vectors...";
+            bool result = true;
+            crypto::MessageDigest messageDigest (crypto::EVP_blake3_256 ());
+            crypto::HMAC mac (
+                crypto::SymmetricKey::SharedPtr (
+                    new crypto::SymmetricKey (BLAKE3_KEY, strlen (BLAKE3_KEY))),
+                crypto::EVP_blake3_256 ());
+            for (std::size_t i = 0; result && i < THEKOGANS_UTIL_ARRAY_SIZE (blake3Vectors); ++i) {
+                std::vector<util::ui8> input (blake3Vectors[i].length);
+                for (std::size_t j = 0; j < input.size (); ++j) {
+                    input[j] = (util::ui8)(j % 251);
+                }
+                util::Buffer hash = messageDigest.HashBuffer (input.data (), input.size ());
+                result = util::HexEncodeBuffer (hash.GetReadPtr (), hash.GetDataAvailableForReading ()) ==
+                    blake3Vectors[i].hash;
+                // MAC and SymmetricKey don't take empty input.
+                if (result && !input.empty ()) {
+                    util::Buffer keyedHash = mac.SignBuffer (input.data (), input.size ());
+                    crypto::SymmetricKey::SharedPtr key = crypto::SymmetricKey::FromBlake3 (
+                        BLAKE3_CONTEXT, input.data (), input.size (), 32);
+                    result =
+                        util::HexEncodeBuffer (keyedHash.GetReadPtr (), keyedHash.GetDataAvailableForReading ()) ==
+                            blake3Vectors[i].keyedHash &&
+                        util::HexEncodeBuffer (key->Get ().GetReadPtr (), key->Get ().GetDataAvailableForReading ()) ==
+                            blake3Vectors[i].deriveKey;
+                }
+                // Final is an XOF, longer outputs extend shorter ones.
+                crypto::Blake3 blake3;
+                blake3.InitDeriveKey (BLAKE3_CONTEXT, strlen (BLAKE3_CONTEXT));
+                blake3.Update (input.data (), input.size ());
+                util::ui8 deriveKey[131];
+                blake3.Final (deriveKey, sizeof (deriveKey));
+                result = result && util::HexEncodeBuffer (deriveKey, 32) == blake3Vectors[i].deriveKey;
+            }
+            std::cout << (result ? "pass" : "fail") << std::endl;
+            return result;
+        }
+        THEKOGANS_UTIL_CATCH (util::Exception) {
+            std::cout << "fail " << exception.Report ();
+            return false;
+        }
+    }
+
+    bool TestBlake3Kernels () {
+        THEKOGANS_UTIL_TRY {
+            std::cout << "BLAKE3 kernels...";
+            // Several subtrees of every size, and a partial chunk.
+            std::vector<util::ui8> input (3 * 1024 * 1024 + 5 * 1024 + 17);
+            util::GlobalRandomSource::Instance ().GetBytes (input.data (), input.size ());
+            util::ui8 expected[crypto::Blake3::OUT_LENGTH];
+            {
+                crypto::Blake3 blake3 (1, crypto::Blake3::KERNEL_PORTABLE);
+                blake3.Update (input.data (), input.size ());
+                blake3.Final (expected);
+            }
+            const crypto::Blake3::Kernel kernels[] = {
+                crypto::Blake3::KERNEL_PORTABLE,
+                crypto::Blake3::KERNEL_SSE41,
+                crypto::Blake3::KERNEL_NEON,
+                crypto::Blake3::KERNEL_AVX2,
+                crypto::Blake3::KERNEL_AVX512
+            };
+            bool result = true;
+            for (std::size_t i = 0; result && i < THEKOGANS_UTIL_ARRAY_SIZE (kernels); ++i) {
+                if (crypto::Blake3::IsKernelSupported (kernels[i])) {
+                    // One update on 1 and 4 threads, and uneven updates.
+                    for (std::size_t workerCount = 1; result && workerCount <= 4; workerCount += 3) {
+                        crypto::Blake3 blake3 (workerCount, kernels[i]);
+                        blake3.Update (input.data (), input.size ());
+                        util::ui8 digest[crypto::Blake3::OUT_LENGTH];
+                        blake3.Final (digest);
+                        result = memcmp (digest, expected, crypto::Blake3::OUT_LENGTH) == 0;
+                    }
+                    if (result) {
+                        crypto::Blake3 blake3 (1, kernels[i]);
+                        for (std::size_t offset = 0, length = 1; offset < input.size ();
+                                offset += length, length = length * 3 + 1) {
+                            blake3.Update (&input[offset], std::min (length, input.size () - offset));
+                        }
+                        util::ui8 digest[crypto::Blake3::OUT_LENGTH];
+                        blake3.Final (digest);
+                        result = memcmp (digest, expected, crypto::Blake3::OUT_LENGTH) == 0;
+                    }
+                    if (!result) {
+                        std::cout << crypto::Blake3::KernelToString (kernels[i]) << " ";
+                    }
+                }
+            }
+            std::cout << (result ? "pass" : "fail") << std::endl;
+            return result;
+        }
+        THEKOGANS_UTIL_CATCH (util::Exception) {
+            std::cout << "fail " << exception.Report ();
+            return false;
+        }
+    }
+}
+
+namespace {
+    // Drain file with Next, checking that no chunk exceeds maxChunkLength.
+    std::vector<util::ui8> ReadAllNext (
+            crypto::FileReader &file,
+            std::size_t maxChunkLength,
+            bool &chunkLengths) {
+        std::vector<util::ui8> data;
+        const util::ui8 *chunk = 0;
+        std::size_t chunkLength;
+        while ((chunkLength = file.Next (chunk)) > 0) {
+            if (chunkLength > maxChunkLength) {
+                chunkLengths = false;
+            }
+            data.insert (data.end (), chunk, chunk + chunkLength);
+        }
+        return data;
+    }
+}
+
+TEST (thekogans, FileReader) {
+    crypto::OpenSSLInit openSSLInit;
+    bool result = true;
+    THEKOGANS_UTIL_TRY {
+        std::cout << "FileReader...";
+        const std::string path = "FileReader.test";
+        // Not a multiple of the read block size.
+        std::vector<util::ui8> data (3 * 5000 + 17);
+        util::GlobalRandomSource::Instance ().GetBytes (data.data (), data.size ());
+        {
+            crypto::FileWriter file (path);
+            file.Write (data.data (), data.size ());
+            file.Flush ();
+        }
+        bool chunkLengths = true;
+        // Mapped: the whole file in one chunk (where mapping is supported).
+        crypto::FileReader mapped (path, true);
+        result = mapped.GetSize () == data.size () &&
+            ReadAllNext (mapped, mapped.IsMapped () ? data.size () :
+                crypto::FileReader::DEFAULT_READ_BLOCK_SIZE, chunkLengths) == data &&
+            mapped.GetDataAvailableForReading () == 0;
+        // Chunked: Next never returns more than readBlockSize bytes.
+        crypto::FileReader chunked (path, false, 5000);
+        result = result && !chunked.IsMapped () &&
+            ReadAllNext (chunked, 5000, chunkLengths) == data && chunkLengths;
+        // Read in pieces that don't line up with the read blocks.
+        crypto::FileReader read (path, false, 5000);
+        std::vector<util::ui8> readData;
+        std::vector<util::ui8> piece (777);
+        std::size_t pieceLength;
+        while ((pieceLength = read.Read (piece.data (), piece.size ())) > 0) {
+            readData.insert (readData.end (), piece.begin (), piece.begin () + pieceLength);
+        }
+        result = result && readData == data;
+        // HashFile gives the same digest either way.
+        crypto::MessageDigest messageDigest;
+        util::Buffer plain = messageDigest.HashBuffer (data.data (), data.size ());
+        result = result &&
+            messageDigest.HashFile (path, true) == plain &&
+            messageDigest.HashFile (path, false, 5000) == plain;
+        unlink (path.c_str ());
+        // Empty files can't be mapped and read as empty.
+        {
+            crypto::FileWriter file (path);
+            file.Flush ();
+        }
+        crypto::FileReader empty (path, true);
+        const util::ui8 *chunk = 0;
+        result = result && empty.GetSize () == 0 && empty.Next (chunk) == 0;
+        unlink (path.c_str ());
+        std::cout << (result ? "pass" : "fail") << std::endl;
+    }
+    THEKOGANS_UTIL_CATCH (util::Exception) {
+        std::cout << "fail " << exception.Report ();
+        result = false;
+    }
+    CHECK_EQUAL (result, true);
 }
 
 TEST (thekogans, MessageDigest) {
@@ -79,4 +444,36 @@ TEST (thekogans, MessageDigest) {
     }
 }
 
+TEST (thekogans, TreeHash) {
+    crypto::OpenSSLInit openSSLInit;
+    const std::vector<std::string> &messageDigests =
+        crypto::CipherSuite::GetMessageDigests ();
+    for (std::size_t i = 0, count = messageDigests.size (); i < count; ++i) {
+        CHECK_EQUAL (
+            TestTreeHash (
+                messageDigests[i].c_str (),
+                crypto::CipherSuite::GetOpenSSLMessageDigestByName (messageDigests[i])),
+            true);
+    }
+}
+
+TEST (thekogans, HashBatch) {
+    crypto::OpenSSLInit openSSLInit;
+    const std::vector<std::string> &messageDigests =
+        crypto::CipherSuite::GetMessageDigests ();
+    for (std::size_t i = 0, count = messageDigests.size (); i < count; ++i) {
+        CHECK_EQUAL (
+            TestHashBatch (
+                messageDigests[i].c_str (),
+                crypto::CipherSuite::GetOpenSSLMessageDigestByName (messageDigests[i])),
+            true);
+    }
+}
+
+TEST (thekogans, Blake3) {
+    crypto::OpenSSLInit openSSLInit;
+    CHECK_EQUAL (TestBlake3Vectors (), true);
+    CHECK_EQUAL (TestBlake3Kernels (), true);
+}
+
 TESTMAIN
@@ -15,13 +15,19 @@
 // You should have received a copy of the GNU General Public License
 // along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
 
+#include <cstdio>
 #include <iostream>
+#include <vector>
 #include <CppUnitXLite/CppUnitXLite.cpp>
 #include "thekogans/util/Exception.h"
 #include "thekogans/crypto/OpenSSLInit.h"
 #include "thekogans/crypto/DH.h"
+#include "thekogans/crypto/DHParamsCache.h"
 #include "thekogans/crypto/DSA.h"
 #include "thekogans/crypto/EC.h"
+#include "thekogans/crypto/RSA.h"
+#include "thekogans/crypto/EphemeralKeyPool.h"
+#include "thekogans/crypto/OpenSSLParams.h"
 
 using namespace thekogans;
 
@@ -40,6 +46,52 @@ namespace {
                 params1Buffer.GetDataAvailableForReading ()) == 0;
     }
 
+    // Two lookups of the same well known group must share the parsed
+    // EVP_PKEY while keeping their own name.
+    bool TestParamsCache (
+            const char *paramsName,
+            crypto::Params::SharedPtr params1,
+            crypto::Params::SharedPtr params2) {
+        std::cout << paramsName << "...";
+        crypto::OpenSSLParams *openSSLParams1 =
+            dynamic_cast<crypto::OpenSSLParams *> (params1.Get ());
+        crypto::OpenSSLParams *openSSLParams2 =
+            dynamic_cast<crypto::OpenSSLParams *> (params2.Get ());
+        bool result = openSSLParams1 != 0 && openSSLParams2 != 0 &&
+            openSSLParams1 != openSSLParams2 &&
+            openSSLParams1->Get () == openSSLParams2->Get () &&
+            params1->GetName () != params2->GetName ();
+        std::cout << (result ? "pass" : "fail") << std::endl;
+        return result;
+    }
+
+    // Every key must be a distinct private key of the params type.
+    bool TestCreateKeys (
+            const char *paramsName,
+            crypto::Params::SharedPtr params,
+            std::size_t count,
+            std::size_t workerCount) {
+        THEKOGANS_UTIL_TRY {
+            std::cout << paramsName << "...";
+            std::vector<crypto::AsymmetricKey::SharedPtr> keys =
+                params->CreateKeys (count, workerCount);
+            bool result = keys.size () == count;
+            for (std::size_t i = 0; result && i < count; ++i) {
+                result = keys[i].Get () != 0 && keys[i]->IsPrivate () &&
+                    keys[i]->GetKeyType () == params->GetKeyType ();
+                for (std::size_t j = 0; result && j < i; ++j) {
+                    result = keys[i]->GetId () != keys[j]->GetId ();
+                }
+            }
+            std::cout << (result ? "pass" : "fail") << std::endl;
+            return result;
+        }
+        THEKOGANS_UTIL_CATCH (util::Exception) {
+            std::cout << "fail " << exception.Report ();
+            return false;
+        }
+    }
+
     bool TestParams (
             const char *paramsName,
             crypto::Params::SharedPtr params1) {
@@ -244,4 +296,87 @@ TEST (thekogans, EC) {
         true);
 }
 
+TEST (thekogans, ParamsCache) {
+    crypto::OpenSSLInit openSSLInit;
+    CHECK_EQUAL (
+        TestParamsCache (
+            "crypto::DH::ParamsFromRFC3526Prime (crypto::DH::RFC3526_PRIME_2048)",
+            crypto::DH::ParamsFromRFC3526Prime (crypto::DH::RFC3526_PRIME_2048, crypto::ID (), "1"),
+            crypto::DH::ParamsFromRFC3526Prime (crypto::DH::RFC3526_PRIME_2048, crypto::ID (), "2")),
+        true);
+    CHECK_EQUAL (
+        TestParamsCache (
+            "crypto::EC::ParamsFromNamedCurve (NID_X9_62_prime256v1)",
+            crypto::EC::ParamsFromNamedCurve (NID_X9_62_prime256v1, crypto::ID (), "1"),
+            crypto::EC::ParamsFromNamedCurve (NID_X9_62_prime256v1, crypto::ID (), "2")),
+        true);
+    CHECK_EQUAL (
+        TestParamsCache (
+            "crypto::EC::ParamsFromRFC5639Curve (crypto::EC::RFC5639_CURVE_256)",
+            crypto::EC::ParamsFromRFC5639Curve (crypto::EC::RFC5639_CURVE_256, crypto::ID (), "1"),
+            crypto::EC::ParamsFromRFC5639Curve (crypto::EC::RFC5639_CURVE_256, crypto::ID (), "2")),
+        true);
+}
+
+TEST (thekogans, DHParamsCache) {
+    crypto::OpenSSLInit openSSLInit;
+    CHECK_EQUAL (
+        crypto::DH::ValidateParams (
+            *crypto::DH::ParamsFromRFC3526Prime (crypto::DH::RFC3526_PRIME_1536)),
+        true);
+    crypto::DHParamsCache::SharedPtr cache (new crypto::DHParamsCache ("."));
+    cache->Prepare (512);
+    cache->WaitForIdle ();
+    crypto::Params::SharedPtr params = cache->Get (512);
+    CHECK_EQUAL (params.Get () != 0, true);
+    crypto::DHParamsCache::Register (cache);
+    CHECK_EQUAL (
+        TestParamsCache (
+            "crypto::DH::ParamsFromPrimeLengthAndGenerator (512)",
+            params,
+            crypto::DH::ParamsFromPrimeLengthAndGenerator (512, DH_GENERATOR_2, crypto::ID (), "2")),
+        true);
+    crypto::DHParamsCache::Unregister (cache);
+    // A second cache loads the saved group instead of generating one.
+    crypto::DHParamsCache::SharedPtr cache2 (new crypto::DHParamsCache ("."));
+    cache2->Prepare (512);
+    cache2->WaitForIdle ();
+    CHECK_EQUAL (
+        TestParams (
+            "crypto::DHParamsCache::Get (512)",
+            cache2->Get (512)),
+        true);
+    std::remove (cache->GetPath (512, DH_GENERATOR_2).c_str ());
+}
+
+TEST (thekogans, CreateKeys) {
+    crypto::OpenSSLInit openSSLInit;
+    CHECK_EQUAL (
+        TestCreateKeys (
+            "crypto::RSA::ParamsFromKeyLength (1024)",
+            crypto::RSA::ParamsFromKeyLength (1024),
+            4,
+            2),
+        true);
+    CHECK_EQUAL (
+        TestCreateKeys (
+            "crypto::EC::ParamsFromNamedCurve (NID_X9_62_prime256v1)",
+            crypto::EC::ParamsFromNamedCurve (NID_X9_62_prime256v1),
+            8,
+            0),
+        true);
+    CHECK_EQUAL (
+        TestParams (
+            "crypto::RSA::ParamsFromKeyLength (2048)",
+            crypto::RSA::ParamsFromKeyLength (2048)),
+        true);
+    crypto::EphemeralKeyPool::SharedPtr pool (
+        new crypto::EphemeralKeyPool (crypto::RSA::ParamsFromKeyLength (1024), 2));
+    crypto::AsymmetricKey::SharedPtr key = pool->GetKey ();
+    CHECK_EQUAL (key->GetKeyType () == crypto::OPENSSL_PKEY_RSA && key->GetKeyLength () == 1024, true);
+    CHECK_EQUAL (pool->Matches (*crypto::RSA::ParamsFromKeyLength (1024)), true);
+    CHECK_EQUAL (pool->Matches (*crypto::RSA::ParamsFromKeyLength (2048)), false);
+    pool->Stop ();
+}
+
 TESTMAIN
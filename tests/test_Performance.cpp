@@ -0,0 +1,609 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+// Performance regression harness. Every benchmark is calibrated (iteration
+// count doubled until a sample takes at least MIN_SAMPLE_SECONDS), warmed up
+// and then sampled REPETITIONS times. The median time per operation is the
+// tracked metric.
+//
+// The harness is driven by the following environment variables:
+//
+// THEKOGANS_CRYPTO_PERF_BASELINE: Path of the baseline JSON file. If not set,
+// the results are only reported. If set, the results are compared against the
+// baseline recorded for the same host fingerprint (CPU model and features,
+// OpenSSL version and build flags), and the test fails (with a diff) if any
+// metric is slower than it's baseline by more than the threshold. Hosts
+// without a baseline are added to the file.
+//
+// THEKOGANS_CRYPTO_PERF_THRESHOLD: Regression threshold (in percent, default 10).
+//
+// THEKOGANS_CRYPTO_PERF_UPDATE: If set, the current results replace the
+// host's baseline (after the comparison is reported).
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#if defined (TOOLCHAIN_OS_OSX)
+    #include <sys/types.h>
+    #include <sys/sysctl.h>
+#endif // defined (TOOLCHAIN_OS_OSX)
+#include <openssl/crypto.h>
+#include <CppUnitXLite/CppUnitXLite.cpp>
+#include "thekogans/util/Types.h"
+#include "thekogans/util/SizeT.h"
+#include "thekogans/util/Buffer.h"
+#include "thekogans/util/HRTimer.h"
+#include "thekogans/util/File.h"
+#include "thekogans/util/Path.h"
+#include "thekogans/util/JSON.h"
+#include "thekogans/util/RandomSource.h"
+#include "thekogans/util/Exception.h"
+#include "thekogans/crypto/OpenSSLInit.h"
+#include "thekogans/crypto/CPUFeatures.h"
+#include "thekogans/crypto/CipherSuite.h"
+#include "thekogans/crypto/SymmetricKey.h"
+#include "thekogans/crypto/Cipher.h"
+#include "thekogans/crypto/MessageDigest.h"
+#include "thekogans/crypto/HMAC.h"
+#include "thekogans/crypto/Ed25519Params.h"
+#include "thekogans/crypto/Authenticator.h"
+#include "thekogans/crypto/KeyRing.h"
+
+using namespace thekogans;
+
+namespace {
+    const char * const ENV_BASELINE = "THEKOGANS_CRYPTO_PERF_BASELINE";
+    const char * const ENV_THRESHOLD = "THEKOGANS_CRYPTO_PERF_THRESHOLD";
+    const char * const ENV_UPDATE = "THEKOGANS_CRYPTO_PERF_UPDATE";
+
+    const char * const TAG_HOSTS = "Hosts";
+    const char * const ATTR_CPU = "CPU";
+    const char * const ATTR_OPENSSL = "OpenSSL";
+    const char * const ATTR_BUILD = "Build";
+    const char * const TAG_METRICS = "Metrics";
+    const char * const ATTR_NAME = "Name";
+    const char * const ATTR_NANOSECONDS = "Nanoseconds";
+
+    enum {
+        /// \brief
+        /// Untimed rounds run after calibration.
+        WARMUP_ROUNDS = 2,
+        /// \brief
+        /// Timed rounds (the median is kept).
+        REPETITIONS = 7,
+        /// \brief
+        /// Default regression threshold (in percent).
+        DEFAULT_THRESHOLD = 10,
+        /// \brief
+        /// Buffer length used by the symmetric benchmarks.
+        BUFFER_LENGTH = 64 * 1024,
+        /// \brief
+        /// Number of keys in the key ring benchmark.
+        KEY_RING_SIZE = 10000
+    };
+
+    const util::f64 MIN_SAMPLE_SECONDS = 0.02;
+
+    struct Benchmark {
+        virtual ~Benchmark () {}
+
+        virtual void Run (std::size_t iterations) = 0;
+    };
+
+    struct EncryptBenchmark : public Benchmark {
+        crypto::Cipher::SharedPtr cipher;
+        util::Buffer plaintext;
+        util::Buffer ciphertext;
+
+        explicit EncryptBenchmark (const crypto::CipherSuite &cipherSuite) :
+                cipher (
+                    cipherSuite.GetCipher (
+                        crypto::SymmetricKey::FromRandom (
+                            crypto::SymmetricKey::MIN_RANDOM_LENGTH,
+                            0,
+                            0,
+                            crypto::GetCipherKeyLength (cipherSuite.GetOpenSSLCipher ())))),
+                plaintext (util::NetworkEndian, BUFFER_LENGTH),
+                ciphertext (util::NetworkEndian, crypto::Cipher::GetMaxBufferLength (BUFFER_LENGTH)) {
+            util::GlobalRandomSource::Instance ().GetBytes (plaintext.GetWritePtr (), BUFFER_LENGTH);
+            plaintext.AdvanceWriteOffset (BUFFER_LENGTH);
+        }
+
+        virtual void Run (std::size_t iterations) override {
+            for (std::size_t i = 0; i < iterations; ++i) {
+                cipher->Encrypt (
+                    plaintext.GetReadPtr (),
+                    plaintext.GetDataAvailableForReading (),
+                    0,
+                    0,
+                    ciphertext.GetWritePtr ());
+            }
+        }
+    };
+
+    struct DigestBenchmark : public Benchmark {
+        crypto::MessageDigest messageDigest;
+        util::Buffer buffer;
+
+        explicit DigestBenchmark (const EVP_MD *md) :
+                messageDigest (md),
+                buffer (util::NetworkEndian, BUFFER_LENGTH) {
+            util::GlobalRandomSource::Instance ().GetBytes (buffer.GetWritePtr (), BUFFER_LENGTH);
+            buffer.AdvanceWriteOffset (BUFFER_LENGTH);
+        }
+
+        virtual void Run (std::size_t iterations) override {
+            for (std::size_t i = 0; i < iterations; ++i) {
+                messageDigest.HashBuffer (buffer.GetReadPtr (), buffer.GetDataAvailableForReading ());
+            }
+        }
+    };
+
+    struct HMACBenchmark : public Benchmark {
+        crypto::HMAC mac;
+        util::Buffer buffer;
+
+        explicit HMACBenchmark (const EVP_MD *md) :
+                mac (crypto::SymmetricKey::FromRandom (), md),
+                buffer (util::NetworkEndian, BUFFER_LENGTH) {
+            util::GlobalRandomSource::Instance ().GetBytes (buffer.GetWritePtr (), BUFFER_LENGTH);
+            buffer.AdvanceWriteOffset (BUFFER_LENGTH);
+        }
+
+        virtual void Run (std::size_t iterations) override {
+            for (std::size_t i = 0; i < iterations; ++i) {
+                mac.SignBuffer (buffer.GetReadPtr (), buffer.GetDataAvailableForReading ());
+            }
+        }
+    };
+
+    struct SignBenchmark : public Benchmark {
+        crypto::Authenticator signer;
+        util::ui8 buffer[1024];
+
+        explicit SignBenchmark (crypto::AsymmetricKey::SharedPtr privateKey) :
+                signer (
+                    privateKey,
+                    crypto::MessageDigest::SharedPtr (new crypto::MessageDigest)) {
+            util::GlobalRandomSource::Instance ().GetBytes (buffer, sizeof (buffer));
+        }
+
+        virtual void Run (std::size_t iterations) override {
+            for (std::size_t i = 0; i < iterations; ++i) {
+                signer.SignBuffer (buffer, sizeof (buffer));
+            }
+        }
+    };
+
+    struct VerifyBenchmark : public Benchmark {
+        crypto::Authenticator verifier;
+        util::ui8 buffer[1024];
+        util::Buffer signature;
+
+        explicit VerifyBenchmark (crypto::AsymmetricKey::SharedPtr privateKey) :
+                verifier (
+                    privateKey->GetPublicKey (),
+                    crypto::MessageDigest::SharedPtr (new crypto::MessageDigest)) {
+            util::GlobalRandomSource::Instance ().GetBytes (buffer, sizeof (buffer));
+            crypto::Authenticator signer (
+                privateKey,
+                crypto::MessageDigest::SharedPtr (new crypto::MessageDigest));
+            signature = signer.SignBuffer (buffer, sizeof (buffer));
+        }
+
+        virtual void Run (std::size_t iterations) override {
+            for (std::size_t i = 0; i < iterations; ++i) {
+                if (!verifier.VerifyBufferSignature (
+                        buffer,
+                        sizeof (buffer),
+                        signature.GetReadPtr (),
+                        signature.GetDataAvailableForReading ())) {
+                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION ("%s",
+                        "Signature verification failed.");
+                }
+            }
+        }
+    };
+
+    struct KeyRingLookupBenchmark : public Benchmark {
+        crypto::KeyRing::SharedPtr keyRing;
+        std::vector<crypto::ID> ids;
+
+        KeyRingLookupBenchmark () :
+                keyRing (new crypto::KeyRing (crypto::CipherSuite::Strongest)) {
+            ids.reserve (KEY_RING_SIZE);
+            for (std::size_t i = 0; i < KEY_RING_SIZE; ++i) {
+                crypto::SymmetricKey::SharedPtr key = crypto::SymmetricKey::FromRandom ();
+                keyRing->AddCipherKey (key);
+                ids.push_back (key->GetId ());
+            }
+        }
+
+        virtual void Run (std::size_t iterations) override {
+            for (std::size_t i = 0; i < iterations; ++i) {
+                if (keyRing->GetCipherKey (ids[i % ids.size ()]).Get () == 0) {
+                    THEKOGANS_UTIL_THROW_STRING_EXCEPTION ("%s",
+                        "Key lookup failed.");
+                }
+            }
+        }
+    };
+
+    struct Metric {
+        std::string name;
+        // Median time per operation.
+        util::f64 nanoseconds;
+        // Median absolute deviation relative to the median.
+        util::f64 spread;
+
+        Metric (
+            const std::string &name_ = std::string (),
+            util::f64 nanoseconds_ = 0.0,
+            util::f64 spread_ = 0.0) :
+            name (name_),
+            nanoseconds (nanoseconds_),
+            spread (spread_) {}
+    };
+
+    util::f64 TimeRun (
+            Benchmark &benchmark,
+            std::size_t iterations) {
+        util::ui64 start = util::HRTimer::Click ();
+        benchmark.Run (iterations);
+        return util::HRTimer::ToSeconds (
+            util::HRTimer::ComputeElapsedTime (start, util::HRTimer::Click ()));
+    }
+
+    util::f64 Median (std::vector<util::f64> values) {
+        std::sort (values.begin (), values.end ());
+        std::size_t middle = values.size () / 2;
+        return values.size () % 2 == 1 ?
+            values[middle] : (values[middle - 1] + values[middle]) / 2.0;
+    }
+
+    Metric Measure (
+            const std::string &name,
+            Benchmark &benchmark) {
+        // Calibration doubles as the first warm-up round.
+        std::size_t iterations = 1;
+        while (TimeRun (benchmark, iterations) < MIN_SAMPLE_SECONDS) {
+            iterations *= 2;
+        }
+        for (std::size_t i = 0; i < WARMUP_ROUNDS; ++i) {
+            benchmark.Run (iterations);
+        }
+        std::vector<util::f64> samples;
+        for (std::size_t i = 0; i < REPETITIONS; ++i) {
+            samples.push_back (TimeRun (benchmark, iterations) * 1e9 / iterations);
+        }
+        util::f64 median = Median (samples);
+        std::vector<util::f64> deviations;
+        for (std::size_t i = 0, count = samples.size (); i < count; ++i) {
+            deviations.push_back (fabs (samples[i] - median));
+        }
+        Metric metric (name, median, median > 0.0 ? Median (deviations) / median : 0.0);
+        std::cout << "  " << std::left << std::setw (40) << name << std::right <<
+            std::fixed << std::setprecision (1) << std::setw (14) << metric.nanoseconds <<
+            " ns/op (+/- " << metric.spread * 100.0 << "%)" << std::endl;
+        return metric;
+    }
+
+    void RunSuites (std::vector<Metric> &metrics) {
+        // Symmetric primitives (see examples/cipherbench).
+        {
+            const std::vector<crypto::CipherSuite> &cipherSuites =
+                crypto::CipherSuite::GetCipherSuites ();
+            for (std::size_t i = 0, count = cipherSuites.size (); i < count; ++i) {
+                // Benchmark every cipher once (cipher suites only differ in the
+                // asymmetric parts, and the cipher is all Encrypt touches).
+                bool duplicate = false;
+                for (std::size_t j = 0; !duplicate && j < i; ++j) {
+                    duplicate = cipherSuites[j].cipher == cipherSuites[i].cipher &&
+                        cipherSuites[j].messageDigest == cipherSuites[i].messageDigest;
+                }
+                if (!duplicate) {
+                    EncryptBenchmark benchmark (cipherSuites[i]);
+                    metrics.push_back (
+                        Measure (
+                            "Encrypt 64K " + cipherSuites[i].cipher + "/" +
+                                cipherSuites[i].messageDigest,
+                            benchmark));
+                }
+            }
+        }
+        {
+            DigestBenchmark benchmark (EVP_sha256 ());
+            metrics.push_back (Measure ("MessageDigest 64K SHA2-256", benchmark));
+        }
+        {
+            DigestBenchmark benchmark (EVP_sha512 ());
+            metrics.push_back (Measure ("MessageDigest 64K SHA2-512", benchmark));
+        }
+        {
+            HMACBenchmark benchmark (EVP_sha256 ());
+            metrics.push_back (Measure ("HMAC 64K SHA2-256", benchmark));
+        }
+        // Asymmetric operations (see examples/pkbench).
+        {
+            crypto::AsymmetricKey::SharedPtr privateKey = crypto::Ed25519Params ().CreateKey ();
+            {
+                SignBenchmark benchmark (privateKey);
+                metrics.push_back (Measure ("Sign Ed25519", benchmark));
+            }
+            {
+                VerifyBenchmark benchmark (privateKey);
+                metrics.push_back (Measure ("Verify Ed25519", benchmark));
+            }
+        }
+        // Key ring scale (see examples/keyringbench).
+        {
+            KeyRingLookupBenchmark benchmark;
+            metrics.push_back (Measure ("KeyRing::GetCipherKey (10000 keys)", benchmark));
+        }
+    }
+
+    std::string GetCPUModel () {
+        std::string model;
+    #if defined (TOOLCHAIN_OS_Linux)
+        std::ifstream cpuinfo ("/proc/cpuinfo");
+        std::string line;
+        while (model.empty () && std::getline (cpuinfo, line)) {
+            // x86 reports "model name", some ARM kernels only "Hardware"/"Processor".
+            if (line.compare (0, 10, "model name") == 0 ||
+                    line.compare (0, 8, "Hardware") == 0 ||
+                    line.compare (0, 9, "Processor") == 0) {
+                std::string::size_type colon = line.find (':');
+                if (colon != std::string::npos) {
+                    model = line.substr (line.find_first_not_of (" \t", colon + 1));
+                }
+            }
+        }
+    #elif defined (TOOLCHAIN_OS_OSX)
+        char brand[256];
+        size_t length = sizeof (brand);
+        if (sysctlbyname ("machdep.cpu.brand_string", brand, &length, 0, 0) == 0) {
+            model = brand;
+        }
+    #elif defined (TOOLCHAIN_OS_Windows)
+        const char *identifier = getenv ("PROCESSOR_IDENTIFIER");
+        if (identifier != 0) {
+            model = identifier;
+        }
+    #endif // defined (TOOLCHAIN_OS_Linux)
+        const crypto::CPUFeatures &features = crypto::CPUFeatures::Instance ();
+        return (model.empty () ? std::string ("unknown") : model) + " (" +
+            features.architecture + ", " +
+            (features.HasAES () ? "AES" : "no AES") + ", " +
+            (features.HasSHA256 () ? "SHA256" : "no SHA256") + ", " +
+            (features.PreferAESGCM () ? "AES-GCM" : "ChaCha20-Poly1305") + ")";
+    }
+
+    std::string GetOpenSSLVersion () {
+    #if OPENSSL_VERSION_NUMBER >= 0x10100000L
+        return OpenSSL_version (OPENSSL_VERSION);
+    #else // OPENSSL_VERSION_NUMBER >= 0x10100000L
+        return SSLeay_version (SSLEAY_VERSION);
+    #endif // OPENSSL_VERSION_NUMBER >= 0x10100000L
+    }
+
+    std::string GetBuildFlags () {
+        std::ostringstream build;
+    #if defined (_MSC_VER)
+        build << "MSVC " << _MSC_VER;
+    #elif defined (__clang__)
+        build << "clang " << __clang_major__ << "." << __clang_minor__;
+    #elif defined (__GNUC__)
+        build << "gcc " << __GNUC__ << "." << __GNUC_MINOR__;
+    #else // defined (_MSC_VER)
+        build << "unknown compiler";
+    #endif // defined (_MSC_VER)
+    #if defined (NDEBUG)
+        build << ", Release";
+    #else // defined (NDEBUG)
+        build << ", Debug";
+    #endif // defined (NDEBUG)
+    #if defined (THEKOGANS_CRYPTO_TYPE_Shared)
+        build << ", Shared";
+    #else // defined (THEKOGANS_CRYPTO_TYPE_Shared)
+        build << ", Static";
+    #endif // defined (THEKOGANS_CRYPTO_TYPE_Shared)
+    #if defined (__OPTIMIZE__)
+        build << ", optimized";
+    #endif // defined (__OPTIMIZE__)
+    #if defined (__AVX2__)
+        build << ", AVX2";
+    #endif // defined (__AVX2__)
+        build << ", " << sizeof (void *) * 8 << " bit";
+        return build.str ();
+    }
+
+    std::string ReadTextFile (const std::string &path) {
+        util::ReadOnlyFile file (util::NetworkEndian, path);
+        std::string text ((std::size_t)file.GetSize (), '\0');
+        text.resize (file.Read (&text[0], text.size ()));
+        return text;
+    }
+
+    void WriteTextFile (
+            const std::string &path,
+            const std::string &text) {
+        util::SimpleFile file (
+            util::NetworkEndian,
+            path,
+            util::SimpleFile::ReadWrite |
+            util::SimpleFile::Create |
+            util::SimpleFile::Truncate);
+        file.Write (text.data (), text.size ());
+    }
+
+    util::JSON::Object::SharedPtr LoadBaselines (const std::string &path) {
+        util::JSON::Object::SharedPtr baselines;
+        if (util::Path (path).Exists ()) {
+            baselines = util::dynamic_refcounted_sharedptr_cast<util::JSON::Object> (
+                util::JSON::ParseValue (ReadTextFile (path)));
+            if (baselines.Get () == 0) {
+                THEKOGANS_UTIL_THROW_STRING_EXCEPTION (
+                    "Unable to parse %s", path.c_str ());
+            }
+        }
+        else {
+            baselines.Reset (new util::JSON::Object);
+        }
+        if (baselines->Get<util::JSON::Array> (TAG_HOSTS).Get () == 0) {
+            baselines->Add (TAG_HOSTS, util::JSON::Array::SharedPtr (new util::JSON::Array));
+        }
+        return baselines;
+    }
+
+    util::JSON::Object::SharedPtr CreateHost (
+            const std::string &cpu,
+            const std::string &openssl,
+            const std::string &build,
+            const std::vector<Metric> &metrics) {
+        util::JSON::Object::SharedPtr host (new util::JSON::Object);
+        host->Add<const std::string &> (ATTR_CPU, cpu);
+        host->Add<const std::string &> (ATTR_OPENSSL, openssl);
+        host->Add<const std::string &> (ATTR_BUILD, build);
+        util::JSON::Array::SharedPtr hostMetrics (new util::JSON::Array);
+        for (std::size_t i = 0, count = metrics.size (); i < count; ++i) {
+            util::JSON::Object::SharedPtr metric (new util::JSON::Object);
+            metric->Add<const std::string &> (ATTR_NAME, metrics[i].name);
+            metric->Add<const util::SizeT &> (
+                ATTR_NANOSECONDS,
+                util::SizeT ((std::size_t)(metrics[i].nanoseconds + 0.5)));
+            hostMetrics->Add (metric);
+        }
+        host->Add (TAG_METRICS, hostMetrics);
+        return host;
+    }
+
+    // Compare the current metrics against the host baseline and
+    // print a diff. Return the number of regressed metrics.
+    std::size_t Compare (
+            const util::JSON::Object &host,
+            const std::vector<Metric> &metrics,
+            util::f64 threshold) {
+        std::size_t regressions = 0;
+        std::cout << "  " << std::left << std::setw (40) << "metric" << std::right <<
+            std::setw (14) << "baseline ns" << std::setw (14) << "current ns" <<
+            std::setw (10) << "delta" << std::endl;
+        util::JSON::Array::SharedPtr hostMetrics = host.Get<util::JSON::Array> (TAG_METRICS);
+        for (std::size_t i = 0, count = metrics.size (); i < count; ++i) {
+            util::f64 baseline = 0.0;
+            if (hostMetrics.Get () != 0) {
+                for (std::size_t j = 0, jcount = hostMetrics->GetValueCount (); j < jcount; ++j) {
+                    util::JSON::Object::SharedPtr metric = hostMetrics->Get<util::JSON::Object> (j);
+                    if (metric.Get () != 0 &&
+                            metric->Get<util::JSON::String> (ATTR_NAME)->value == metrics[i].name) {
+                        baseline = (util::f64)(std::size_t)metric->Get<util::JSON::Number> (
+                            ATTR_NANOSECONDS)->To<util::SizeT> ();
+                        break;
+                    }
+                }
+            }
+            std::cout << "  " << std::left << std::setw (40) << metrics[i].name << std::right;
+            if (baseline > 0.0) {
+                util::f64 delta = (metrics[i].nanoseconds - baseline) * 100.0 / baseline;
+                bool regressed = delta > threshold;
+                if (regressed) {
+                    ++regressions;
+                }
+                std::cout << std::fixed << std::setprecision (1) <<
+                    std::setw (14) << baseline <<
+                    std::setw (14) << metrics[i].nanoseconds <<
+                    std::setw (9) << std::showpos << delta << std::noshowpos << "%" <<
+                    (regressed ? "  REGRESSED" : "") << std::endl;
+            }
+            else {
+                std::cout << std::setw (14) << "-" << std::fixed << std::setprecision (1) <<
+                    std::setw (14) << metrics[i].nanoseconds << "  (new)" << std::endl;
+            }
+        }
+        return regressions;
+    }
+}
+
+TEST (thekogans, Performance) {
+    crypto::OpenSSLInit openSSLInit;
+    THEKOGANS_UTIL_TRY {
+        std::string cpu = GetCPUModel ();
+        std::string openssl = GetOpenSSLVersion ();
+        std::string build = GetBuildFlags ();
+        std::cout << "CPU: " << cpu << std::endl <<
+            "OpenSSL: " << openssl << std::endl <<
+            "Build: " << build << std::endl;
+        std::vector<Metric> metrics;
+        RunSuites (metrics);
+        const char *baselinePath = getenv (ENV_BASELINE);
+        if (baselinePath != 0) {
+            const char *thresholdValue = getenv (ENV_THRESHOLD);
+            util::f64 threshold = thresholdValue != 0 ?
+                atof (thresholdValue) : (util::f64)DEFAULT_THRESHOLD;
+            util::JSON::Object::SharedPtr baselines = LoadBaselines (baselinePath);
+            util::JSON::Array::SharedPtr hosts = baselines->Get<util::JSON::Array> (TAG_HOSTS);
+            util::JSON::Array::SharedPtr newHosts (new util::JSON::Array);
+            util::JSON::Object::SharedPtr host;
+            for (std::size_t i = 0, count = hosts->GetValueCount (); i < count; ++i) {
+                util::JSON::Object::SharedPtr candidate = hosts->Get<util::JSON::Object> (i);
+                if (candidate.Get () != 0 &&
+                        candidate->Get<util::JSON::String> (ATTR_CPU)->value == cpu &&
+                        candidate->Get<util::JSON::String> (ATTR_OPENSSL)->value == openssl &&
+                        candidate->Get<util::JSON::String> (ATTR_BUILD)->value == build) {
+                    host = candidate;
+                }
+                else {
+                    newHosts->Add (candidate);
+                }
+            }
+            bool update = getenv (ENV_UPDATE) != 0;
+            std::size_t regressions = 0;
+            if (host.Get () != 0) {
+                std::cout << "Comparing against " << baselinePath <<
+                    " (threshold: " << threshold << "%)" << std::endl;
+                regressions = Compare (*host, metrics, threshold);
+                if (regressions > 0) {
+                    std::cout << regressions << " metric(s) regressed." << std::endl;
+                }
+            }
+            else {
+                std::cout << "No baseline for this host in " << baselinePath <<
+                    ", recording one." << std::endl;
+                update = true;
+            }
+            if (update) {
+                newHosts->Add (CreateHost (cpu, openssl, build, metrics));
+                util::JSON::Object updated;
+                updated.Add (TAG_HOSTS, newHosts);
+                WriteTextFile (baselinePath, util::JSON::FormatValue (updated));
+            }
+            CHECK_EQUAL (regressions, (std::size_t)0);
+        }
+    }
+    THEKOGANS_UTIL_CATCH (util::Exception) {
+        std::cout << "fail " << exception.Report ();
+        CHECK_EQUAL (false, true);
+    }
+}
+
+TESTMAIN
@@ -0,0 +1,230 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#include <cstdio>
+#include <string>
+#include <fstream>
+#include <iterator>
+#include <iostream>
+#include <CppUnitXLite/CppUnitXLite.cpp>
+#include "thekogans/util/Types.h"
+#include "thekogans/util/Exception.h"
+#include "thekogans/crypto/OpenSSLInit.h"
+#include "thekogans/crypto/SymmetricKey.h"
+#include "thekogans/crypto/KeyRing.h"
+#include "thekogans/crypto/CipherSuite.h"
+#include "thekogans/crypto/CiphertextHeader.h"
+#include "thekogans/crypto/SeekableFile.h"
+#include "thekogans/crypto/FileEncryptor.h"
+#include "thekogans/crypto/SeekableDecryptor.h"
+#include "TestData.h"
+
+using namespace thekogans;
+using crypto::tests::MakeData;
+
+namespace {
+    const char * const PLAINTEXT_PATH = "test_SeekableDecryptor.plaintext";
+    const char * const CIPHERTEXT_PATH = "test_SeekableDecryptor.ciphertext";
+
+    const util::ui32 BLOCK_SIZE = 4096;
+    const std::size_t BLOCK_COUNT = 6;
+    // The last block is short.
+    const std::size_t PLAINTEXT_LENGTH = (BLOCK_COUNT - 1) * BLOCK_SIZE + 123;
+
+    void WriteFile (
+            const std::string &path,
+            const std::string &data) {
+        std::ofstream file (path.c_str (), std::ios::binary | std::ios::trunc);
+        file.write (data.data (), data.size ());
+    }
+
+    std::string ReadFile (const std::string &path) {
+        std::ifstream file (path.c_str (), std::ios::binary);
+        return std::string (
+            std::istreambuf_iterator<char> (file),
+            std::istreambuf_iterator<char> ());
+    }
+
+    void RemoveFiles () {
+        std::remove (PLAINTEXT_PATH);
+        std::remove (CIPHERTEXT_PATH);
+    }
+
+    // Read length bytes starting at offset.
+    std::string Read (
+            crypto::SeekableDecryptor &decryptor,
+            util::ui64 offset,
+            std::size_t length) {
+        std::string buffer (length, '\0');
+        buffer.resize (decryptor.Read (offset, &buffer[0], length));
+        return buffer;
+    }
+
+    // Return the file offset of the given (single key) block. Blocks
+    // are util::UI32_SIZE length prefixed Cipher::Encrypt output.
+    std::size_t GetBlockOffset (
+            const std::string &file,
+            std::size_t block) {
+        std::size_t offset = crypto::SeekableFileHeader::SIZE;
+        while (block-- > 0) {
+            const util::ui8 *length = (const util::ui8 *)file.data () + offset;
+            offset += util::UI32_SIZE +
+                (((util::ui32)length[0] << 24) | ((util::ui32)length[1] << 16) |
+                ((util::ui32)length[2] << 8) | (util::ui32)length[3]);
+        }
+        return offset;
+    }
+
+    // Return true if the index of CIPHERTEXT_PATH is rejected, or
+    // reading all of it's plaintext fails.
+    bool Rejected (crypto::SymmetricKey::SharedPtr key) {
+        THEKOGANS_UTIL_TRY {
+            crypto::SeekableDecryptor decryptor (CIPHERTEXT_PATH, key);
+            Read (decryptor, 0, PLAINTEXT_LENGTH);
+            return false;
+        }
+        THEKOGANS_UTIL_CATCH (util::Exception) {
+            return true;
+        }
+    }
+}
+
+TEST (thekogans, SeekableDecryptor) {
+    crypto::OpenSSLInit openSSLInit;
+    std::string plaintext = MakeData (PLAINTEXT_LENGTH, 1);
+    WriteFile (PLAINTEXT_PATH, plaintext);
+    crypto::SymmetricKey::SharedPtr key = crypto::SymmetricKey::FromRandom ();
+    crypto::FileEncryptor fileEncryptor (
+        key,
+        THEKOGANS_CRYPTO_DEFAULT_CIPHER,
+        THEKOGANS_CRYPTO_DEFAULT_MD,
+        BLOCK_SIZE,
+        2);
+    fileEncryptor.Encrypt (PLAINTEXT_PATH, CIPHERTEXT_PATH, true);
+    CHECK_EQUAL (crypto::SeekableDecryptor::IsSeekable (CIPHERTEXT_PATH), true);
+    {
+        crypto::SeekableDecryptor decryptor (CIPHERTEXT_PATH, key);
+        CHECK_EQUAL (
+            decryptor.GetBlockSize () == BLOCK_SIZE &&
+            decryptor.GetBlockCount () == BLOCK_COUNT &&
+            decryptor.GetPlaintextLength () == PLAINTEXT_LENGTH,
+            true);
+        CHECK_EQUAL (Read (decryptor, 0, PLAINTEXT_LENGTH) == plaintext, true);
+        // Ranges crossing block boundaries (in both directions, to exercise the cache).
+        CHECK_EQUAL (
+            Read (decryptor, 3 * BLOCK_SIZE - 100, 200) ==
+            plaintext.substr (3 * BLOCK_SIZE - 100, 200),
+            true);
+        CHECK_EQUAL (
+            Read (decryptor, BLOCK_SIZE - 1, 2 * BLOCK_SIZE + 2) ==
+            plaintext.substr (BLOCK_SIZE - 1, 2 * BLOCK_SIZE + 2),
+            true);
+        // Short read at the end of file.
+        CHECK_EQUAL (
+            Read (decryptor, PLAINTEXT_LENGTH - 10, 100) ==
+            plaintext.substr (PLAINTEXT_LENGTH - 10),
+            true);
+        CHECK_EQUAL (Read (decryptor, PLAINTEXT_LENGTH, 100).empty (), true);
+    }
+    RemoveFiles ();
+}
+
+TEST (thekogans, SeekableDecryptorKeyRing) {
+    crypto::OpenSSLInit openSSLInit;
+    std::string plaintext = MakeData (PLAINTEXT_LENGTH, 2);
+    WriteFile (PLAINTEXT_PATH, plaintext);
+    crypto::KeyRing::SharedPtr keyRing (new crypto::KeyRing (crypto::CipherSuite::Strongest));
+    crypto::FileEncryptor fileEncryptor (keyRing, BLOCK_SIZE, 2);
+    fileEncryptor.Encrypt (PLAINTEXT_PATH, CIPHERTEXT_PATH, true);
+    {
+        crypto::SeekableDecryptor decryptor (CIPHERTEXT_PATH, keyRing);
+        CHECK_EQUAL (decryptor.GetBlockCount () == BLOCK_COUNT, true);
+        CHECK_EQUAL (
+            Read (decryptor, 2 * BLOCK_SIZE - 50, 100) ==
+            plaintext.substr (2 * BLOCK_SIZE - 50, 100),
+            true);
+        CHECK_EQUAL (Read (decryptor, 0, PLAINTEXT_LENGTH) == plaintext, true);
+    }
+    RemoveFiles ();
+}
+
+TEST (thekogans, SeekableDecryptorTampered) {
+    crypto::OpenSSLInit openSSLInit;
+    std::string plaintext = MakeData (PLAINTEXT_LENGTH, 3);
+    WriteFile (PLAINTEXT_PATH, plaintext);
+    crypto::SymmetricKey::SharedPtr key = crypto::SymmetricKey::FromRandom ();
+    crypto::FileEncryptor fileEncryptor (
+        key,
+        THEKOGANS_CRYPTO_DEFAULT_CIPHER,
+        THEKOGANS_CRYPTO_DEFAULT_MD,
+        BLOCK_SIZE,
+        2);
+    fileEncryptor.Encrypt (PLAINTEXT_PATH, CIPHERTEXT_PATH, true);
+    std::string file = ReadFile (CIPHERTEXT_PATH);
+    CHECK_EQUAL (Rejected (key), false);
+    std::size_t footerOffset = file.size () - crypto::SeekableFileFooter::SIZE;
+    {
+        // Index (last byte before the footer).
+        std::string tampered = file;
+        tampered[footerOffset - 1] ^= 1;
+        WriteFile (CIPHERTEXT_PATH, tampered);
+        CHECK_EQUAL (Rejected (key), true);
+    }
+    {
+        // Footer index offset.
+        std::string tampered = file;
+        tampered[footerOffset + util::UI64_SIZE - 1] ^= 1;
+        WriteFile (CIPHERTEXT_PATH, tampered);
+        CHECK_EQUAL (Rejected (key), true);
+    }
+    {
+        // Footer magic.
+        std::string tampered = file;
+        tampered[file.size () - 1] ^= 1;
+        WriteFile (CIPHERTEXT_PATH, tampered);
+        CHECK_EQUAL (Rejected (key), true);
+    }
+    {
+        // Block IV.
+        std::string tampered = file;
+        tampered[GetBlockOffset (file, 2) + util::UI32_SIZE + crypto::CiphertextHeader::SIZE] ^= 1;
+        WriteFile (CIPHERTEXT_PATH, tampered);
+        CHECK_EQUAL (Rejected (key), true);
+    }
+    {
+        // Swapped (intact) blocks.
+        std::size_t block1 = GetBlockOffset (file, 1);
+        std::size_t block2 = GetBlockOffset (file, 2);
+        std::size_t block3 = GetBlockOffset (file, 3);
+        CHECK_EQUAL (block2 - block1 == block3 - block2, true);
+        std::string tampered =
+            file.substr (0, block1) +
+            file.substr (block2, block3 - block2) +
+            file.substr (block1, block2 - block1) +
+            file.substr (block3);
+        WriteFile (CIPHERTEXT_PATH, tampered);
+        CHECK_EQUAL (Rejected (key), true);
+    }
+    {
+        // Wrong key.
+        WriteFile (CIPHERTEXT_PATH, file);
+        CHECK_EQUAL (Rejected (crypto::SymmetricKey::FromRandom ()), true);
+    }
+    RemoveFiles ();
+}
+
+TESTMAIN
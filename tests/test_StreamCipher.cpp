@@ -0,0 +1,160 @@
+// Copyright 2016 Boris Kogan (boris@thekogans.net)
+//
+// This file is part of libthekogans_crypto.
+//
+// libthekogans_crypto is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libthekogans_crypto is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
+
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <CppUnitXLite/CppUnitXLite.cpp>
+#include "thekogans/util/Types.h"
+#include "thekogans/crypto/OpenSSLInit.h"
+#include "thekogans/crypto/SymmetricKey.h"
+#include "thekogans/crypto/StreamCipher.h"
+
+using namespace thekogans;
+
+namespace {
+    const std::string password ("password");
+    const std::string message ("The quick brown fox jumped over the lazy dog.");
+    const std::size_t SEGMENT_LENGTH = 8;
+
+    typedef std::vector<util::ui8> Segment;
+
+    void EncryptStream (
+            crypto::StreamCipher &streamCipher,
+            Segment &header,
+            std::vector<Segment> &segments) {
+        header.resize (crypto::StreamCipher::HEADER_LENGTH);
+        streamCipher.BeginEncryption (&header[0]);
+        for (std::size_t offset = 0; offset < message.size (); offset += SEGMENT_LENGTH) {
+            std::size_t length = std::min (SEGMENT_LENGTH, message.size () - offset);
+            Segment segment (crypto::StreamCipher::GetSegmentLength (length));
+            segment.resize (
+                streamCipher.EncryptSegment (
+                    message.c_str () + offset,
+                    length,
+                    offset + length == message.size (),
+                    0,
+                    0,
+                    &segment[0]));
+            segments.push_back (segment);
+        }
+    }
+
+    bool DecryptStream (
+            crypto::StreamCipher &streamCipher,
+            const Segment &header,
+            const std::vector<Segment> &segments,
+            std::string &plaintext) {
+        THEKOGANS_UTIL_TRY {
+            streamCipher.BeginDecryption (&header[0], header.size ());
+            for (std::size_t i = 0, count = segments.size (); i < count; ++i) {
+                Segment segment (segments[i].size ());
+                segment.resize (
+                    streamCipher.DecryptSegment (
+                        &segments[i][0],
+                        segments[i].size (),
+                        i == count - 1,
+                        0,
+                        0,
+                        &segment[0]));
+                plaintext.append (segment.begin (), segment.end ());
+            }
+            return streamCipher.IsFinished ();
+        }
+        THEKOGANS_UTIL_CATCH (util::Exception) {
+            return false;
+        }
+    }
+}
+
+TEST (thekogans, StreamCipher) {
+    crypto::OpenSSLInit openSSLInit;
+    crypto::StreamCipher streamCipher (
+        crypto::SymmetricKey::FromSecretAndSalt (
+            password.c_str (),
+            password.size (),
+            0,
+            0,
+            crypto::GetCipherKeyLength ()));
+    Segment header;
+    std::vector<Segment> segments;
+    EncryptStream (streamCipher, header, segments);
+    {
+        std::cout << "StreamCipher...";
+        std::string plaintext;
+        bool result = DecryptStream (streamCipher, header, segments, plaintext) &&
+            plaintext == message;
+        std::cout << (result ? "pass" : "fail") << std::endl;
+        CHECK_EQUAL (result, true);
+    }
+    {
+        std::cout << "StreamCipher reorder...";
+        std::vector<Segment> reordered = segments;
+        std::swap (reordered[0], reordered[1]);
+        std::string plaintext;
+        bool result = !DecryptStream (streamCipher, header, reordered, plaintext);
+        std::cout << (result ? "pass" : "fail") << std::endl;
+        CHECK_EQUAL (result, true);
+    }
+    {
+        std::cout << "StreamCipher truncate...";
+        std::vector<Segment> truncated (segments.begin (), segments.end () - 1);
+        std::string plaintext;
+        bool result = !DecryptStream (streamCipher, header, truncated, plaintext);
+        std::cout << (result ? "pass" : "fail") << std::endl;
+        CHECK_EQUAL (result, true);
+    }
+    {
+        std::cout << "StreamCipher tamper and carry on...";
+        std::vector<Segment> tampered = segments;
+        tampered[1][0] ^= 1;
+        streamCipher.BeginDecryption (&header[0], header.size ());
+        Segment segment (tampered[0].size ());
+        streamCipher.DecryptSegment (
+            &tampered[0][0], tampered[0].size (), false, 0, 0, &segment[0]);
+        bool result = false;
+        // The tampered segment fails, and it's unverified plaintext is wiped.
+        segment.assign (tampered[1].size (), 0xff);
+        THEKOGANS_UTIL_TRY {
+            streamCipher.DecryptSegment (
+                &tampered[1][0], tampered[1].size (), false, 0, 0, &segment[0]);
+        }
+        THEKOGANS_UTIL_CATCH (util::Exception) {
+            result = streamCipher.IsFailed ();
+            for (std::size_t i = 0, count = segment.size () - crypto::StreamCipher::TAG_LENGTH;
+                    result && i < count; ++i) {
+                result = segment[i] == 0;
+            }
+        }
+        // A caller that catches and keeps going gets the next segment rejected.
+        if (result) {
+            result = false;
+            THEKOGANS_UTIL_TRY {
+                streamCipher.DecryptSegment (
+                    &tampered[2][0], tampered[2].size (), tampered.size () == 3, 0, 0, &segment[0]);
+            }
+            THEKOGANS_UTIL_CATCH (util::Exception) {
+                result = streamCipher.IsFailed () && !streamCipher.IsFinished ();
+            }
+        }
+        std::cout << (result ? "pass" : "fail") << std::endl;
+        CHECK_EQUAL (result, true);
+    }
+}
+
+TESTMAIN
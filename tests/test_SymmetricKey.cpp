@@ -15,14 +15,25 @@
 // You should have received a copy of the GNU General Public License
 // along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
 
+#include <cstring>
+#include <vector>
+#include <utility>
 #include <iostream>
 #if defined (THEKOGANS_CRYPTO_HAVE_ARGON2)
     #include <argon2.h>
 #endif // defined (THEKOGANS_CRYPTO_HAVE_ARGON2)
 #include <CppUnitXLite/CppUnitXLite.cpp>
 #include "thekogans/util/Buffer.h"
+#include "thekogans/util/StringUtils.h"
+#include "thekogans/util/RandomSource.h"
 #include "thekogans/crypto/OpenSSLInit.h"
 #include "thekogans/crypto/SymmetricKey.h"
+#include "thekogans/crypto/TextEncoding.h"
+#include "thekogans/crypto/SecureMemoryStats.h"
+#include "thekogans/crypto/HKDF.h"
+#if defined (THEKOGANS_CRYPTO_HAVE_ARGON2)
+    #include "thekogans/crypto/Argon2Params.h"
+#endif // defined (THEKOGANS_CRYPTO_HAVE_ARGON2)
 #include "thekogans/crypto/AsymmetricKey.h"
 #include "thekogans/crypto/DSA.h"
 
@@ -84,6 +95,27 @@ TEST (thekogans, SymmetricKey) {
         std::cout << (result ? "pass" : "fail") << std::endl;
         CHECK_EQUAL (result, true);
     }
+    {
+        std::cout << "Argon2Params...";
+        crypto::Argon2Params::SharedPtr params1 =
+            crypto::Argon2Params::Calibrate (0.05, 2, 64 * 1024);
+        util::Buffer serializer (util::NetworkEndian, util::Serializable::Size (*params1));
+        serializer << *params1;
+        crypto::Argon2Params::SharedPtr params2;
+        serializer >> params2;
+        // Persisted parameters must reproduce the key.
+        crypto::SymmetricKey::SharedPtr key1 = params1->DeriveKey (
+            secret.data (), secret.size (), salt.data (), salt.size (), 32, crypto::ID (), "test");
+        crypto::SymmetricKey::SharedPtr key2 = params2->DeriveKey (
+            secret.data (), secret.size (), salt.data (), salt.size (), 32, key1->GetId (), "test");
+        bool result =
+            params2->lanes == 2 &&
+            params2->memoryCost == params1->memoryCost &&
+            params2->timeCost == params1->timeCost &&
+            *key1 == *key2;
+        std::cout << (result ? "pass" : "fail") << std::endl;
+        CHECK_EQUAL (result, true);
+    }
 #endif // defined (THEKOGANS_CRYPTO_HAVE_ARGON2)
     {
         std::cout << "SymmetricKey::FromPBKDF1...";
@@ -130,6 +162,93 @@ TEST (thekogans, SymmetricKey) {
         std::cout << (result ? "pass" : "fail") << std::endl;
         CHECK_EQUAL (result, true);
     }
+    {
+        std::cout << "SymmetricKey::FromPBKDF2Batch...";
+        std::vector<std::string> passwords;
+        std::vector<crypto::SymmetricKey::PBKDF2Input> inputs;
+        for (std::size_t i = 0; i < 64; ++i) {
+            passwords.push_back (secret + util::size_tTostring (i));
+        }
+        for (std::size_t i = 0; i < passwords.size (); ++i) {
+            inputs.push_back (
+                crypto::SymmetricKey::PBKDF2Input (
+                    passwords[i].data (), passwords[i].size (), salt.data (), salt.size ()));
+        }
+        std::vector<crypto::SymmetricKey::SharedPtr> keys =
+            crypto::SymmetricKey::FromPBKDF2Batch (
+                inputs,
+                crypto::GetCipherKeyLength (),
+                crypto::SymmetricKey::PBKDF2_HMAC_SHA256,
+                16,
+                4);
+        // Batch keys must match the one at a time ones.
+        bool result = keys.size () == inputs.size ();
+        for (std::size_t i = 0; result && i < keys.size (); ++i) {
+            crypto::SymmetricKey::SharedPtr key =
+                crypto::SymmetricKey::FromPBKDF2 (
+                    passwords[i].data (),
+                    passwords[i].size (),
+                    salt.data (),
+                    salt.size (),
+                    crypto::GetCipherKeyLength (),
+                    crypto::SymmetricKey::PBKDF2_HMAC_SHA256,
+                    16);
+            result = keys[i]->Get ().GetDataAvailableForReading () ==
+                    key->Get ().GetDataAvailableForReading () &&
+                crypto::TimeInsensitiveCompare (
+                    keys[i]->Get ().GetReadPtr (),
+                    key->Get ().GetReadPtr (),
+                    key->Get ().GetDataAvailableForReading ());
+        }
+        std::cout << (result ? "pass" : "fail") << std::endl;
+        CHECK_EQUAL (result, true);
+    }
+    {
+        std::cout << "HKDF...";
+        // RFC 5869, A.1
+        std::vector<util::ui8> ikm (22, 0x0b);
+        std::vector<util::ui8> hkdfSalt;
+        for (util::ui8 i = 0x00; i <= 0x0c; ++i) {
+            hkdfSalt.push_back (i);
+        }
+        std::vector<util::ui8> info;
+        for (util::ui8 i = 0xf0; i <= 0xf9; ++i) {
+            info.push_back (i);
+        }
+        crypto::HKDF hkdf (ikm.data (), ikm.size (), hkdfSalt.data (), hkdfSalt.size (), EVP_sha256 ());
+        util::ui8 okm[42];
+        hkdf.Expand (info.data (), info.size (), okm, sizeof (okm));
+        bool result = util::HexEncodeBuffer (okm, sizeof (okm)) ==
+            "3cb25f25faacd57a90434f64d0362f2a2d2d0a90cf1a5a4c5db02d56ecc4c5bf34007208d5b887185865";
+        // FromHKDF must agree.
+        crypto::SymmetricKey::SharedPtr key =
+            crypto::SymmetricKey::FromHKDF (
+                ikm.data (),
+                ikm.size (),
+                hkdfSalt.data (),
+                hkdfSalt.size (),
+                info.data (),
+                info.size (),
+                sizeof (okm),
+                crypto::SymmetricKey::HKDF_MODE_EXTRACT_AND_EXPAND,
+                EVP_sha256 ());
+        result = result &&
+            util::HexEncodeBuffer (
+                key->Get ().GetReadPtr (),
+                key->Get ().GetDataAvailableForReading ()) ==
+            util::HexEncodeBuffer (okm, sizeof (okm));
+        std::vector<crypto::HKDF::Output> outputs;
+        outputs.push_back (crypto::HKDF::Output ("cipher"));
+        outputs.push_back (crypto::HKDF::Output ("mac", 64));
+        std::vector<crypto::SymmetricKey::SharedPtr> keys = hkdf.ExpandKeys (outputs);
+        result = result &&
+            keys.size () == 2 &&
+            keys[0]->GetKeyLength () == crypto::GetCipherKeyLength () &&
+            keys[1]->GetKeyLength () == 64 &&
+            !(*keys[0] == *hkdf.ExpandKey ("mac", 3, crypto::GetCipherKeyLength (), keys[0]->GetId ()));
+        std::cout << (result ? "pass" : "fail") << std::endl;
+        CHECK_EQUAL (result, true);
+    }
     {
         std::cout << "SymmetricKey::FromOpenSSLPBKDF2...";
         crypto::SymmetricKey::SharedPtr key1 =
@@ -154,6 +273,8 @@ TEST (thekogans, SymmetricKey) {
     }
     {
         std::cout << "SymmetricKey::FromSecretAndSalt...";
+        util::ui64 useCount = crypto::SymmetricKey::GetKDFStats (
+            crypto::SymmetricKey::KDF_SECRET_AND_SALT).GetUseCount ();
         crypto::SymmetricKey::SharedPtr key1 =
             crypto::SymmetricKey::FromSecretAndSalt (
                 secret.c_str (),
@@ -170,7 +291,9 @@ TEST (thekogans, SymmetricKey) {
         serializer << *key1;
         crypto::SymmetricKey::SharedPtr key2;
         serializer >> key2;
-        bool result = *key1 == *key2;
+        bool result = *key1 == *key2 &&
+            crypto::SymmetricKey::GetKDFStats (
+                crypto::SymmetricKey::KDF_SECRET_AND_SALT).GetUseCount () == useCount + 1;
         std::cout << (result ? "pass" : "fail") << std::endl;
         CHECK_EQUAL (result, true);
     }
@@ -197,4 +320,88 @@ TEST (thekogans, SymmetricKey) {
     }
 }
 
+TEST (thekogans, SecureMemoryStats) {
+    crypto::OpenSSLInit openSSLInit;
+    std::cout << "SecureMemoryStats...";
+    crypto::SymmetricKey::SharedPtr key = crypto::SymmetricKey::FromRandom ();
+    crypto::SecureMemoryStats::Counters totals = crypto::SecureMemoryStats::GetTotals ();
+    bool result = totals.bytesInUse > 0 && totals.highWaterMark >= totals.bytesInUse;
+    std::vector<crypto::SecureMemoryStats::Counters> typeCounters =
+        crypto::SecureMemoryStats::GetTypeCounters ();
+    bool found = false;
+    for (std::size_t i = 0, count = typeCounters.size (); !found && i < count; ++i) {
+        found = typeCounters[i].name == "SymmetricKey" &&
+            typeCounters[i].allocationCount > 0;
+    }
+    result = result && found;
+    std::cout << (result ? "pass" : "fail") << std::endl;
+    CHECK_EQUAL (result, true);
+}
+
+TEST (thekogans, SymmetricKeyFromSecureBuffer) {
+    crypto::OpenSSLInit openSSLInit;
+    std::cout << "SymmetricKey (util::SecureBuffer &&)...";
+    util::SecureBuffer buffer (util::HostEndian, crypto::GetCipherKeyLength ());
+    buffer.AdvanceWriteOffset (
+        util::GlobalRandomSource::Instance ().GetBytes (
+            buffer.GetWritePtr (),
+            buffer.GetDataAvailableForWriting ()));
+    crypto::SymmetricKey expected (buffer.GetReadPtr (), buffer.GetDataAvailableForReading ());
+    crypto::SymmetricKey key (std::move (buffer));
+    bool result = buffer.GetDataAvailableForReading () == 0 &&
+        key.GetKeyLength () == crypto::GetCipherKeyLength () &&
+        memcmp (
+            key.Get ().GetReadPtr (),
+            expected.Get ().GetReadPtr (),
+            key.GetKeyLength ()) == 0;
+    std::cout << (result ? "pass" : "fail") << std::endl;
+    CHECK_EQUAL (result, true);
+}
+
+TEST (thekogans, TextEncoding) {
+    std::cout << "TextEncoding...";
+    bool result = true;
+    THEKOGANS_UTIL_TRY {
+        // RFC 4648 test vectors.
+        const char *plain[] = {"", "f", "fo", "foo", "foob", "fooba", "foobar"};
+        const char *base64[] = {"", "Zg==", "Zm8=", "Zm9v", "Zm9vYg==", "Zm9vYmE=", "Zm9vYmFy"};
+        for (std::size_t i = 0; result && i < 7; ++i) {
+            std::size_t length = strlen (plain[i]);
+            std::vector<util::ui8> decoded = crypto::Base64Decode (base64[i], strlen (base64[i]));
+            result = crypto::Base64Encode (plain[i], length) == base64[i] &&
+                decoded.size () == length && memcmp (decoded.data (), plain[i], length) == 0;
+        }
+        // Exercise the vector and scalar paths against util.
+        util::ui8 buffer[300];
+        util::GlobalRandomSource::Instance ().GetBytes (buffer, sizeof (buffer));
+        for (std::size_t length = 0; result && length <= sizeof (buffer); ++length) {
+            std::string hex = crypto::HexEncode (buffer, length);
+            std::string lines = crypto::Base64Encode (buffer, length, 64);
+            std::vector<util::ui8> fromHex = crypto::HexDecode (hex);
+            std::vector<util::ui8> fromBase64 = crypto::Base64Decode (lines.data (), lines.size ());
+            result = hex == util::HexEncodeBuffer (buffer, length) &&
+                fromHex == std::vector<util::ui8> (buffer, buffer + length) &&
+                fromBase64 == fromHex;
+        }
+        try {
+            crypto::HexDecode (std::string ("0g"));
+            result = false;
+        }
+        catch (...) {
+        }
+        try {
+            crypto::Base64Decode ("Zm9v!mFy", 8);
+            result = false;
+        }
+        catch (...) {
+        }
+    }
+    THEKOGANS_UTIL_CATCH (util::Exception) {
+        std::cout << exception.Report () << std::endl;
+        result = false;
+    }
+    std::cout << (result ? "pass" : "fail") << std::endl;
+    CHECK_EQUAL (result, true);
+}
+
 TESTMAIN
@@ -15,14 +15,291 @@
 // You should have received a copy of the GNU General Public License
 // along with libthekogans_crypto. If not, see <http://www.gnu.org/licenses/>.
 
+#include <sys/stat.h>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iterator>
 #include <iostream>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
 #include <CppUnitXLite/CppUnitXLite.cpp>
+#include "thekogans/util/Types.h"
+#include "thekogans/util/Exception.h"
 #include "thekogans/crypto/OpenSSLInit.h"
+#include "thekogans/crypto/OpenSSLUtils.h"
+#include "thekogans/crypto/OpenSSLException.h"
 #include "thekogans/crypto/SymmetricKey.h"
 #include "thekogans/crypto/AsymmetricKey.h"
+#include "thekogans/crypto/SystemCACertificates.h"
 
 using namespace thekogans;
 
+// LoadSystemCertificates is not implemented on Linux yet, so a cache
+// that's refused can't fall back to the stores there.
+#if defined (TOOLCHAIN_OS_Windows) || defined (TOOLCHAIN_OS_OSX)
+namespace {
+    const char * const CACHE_PATH = "SystemCACertificatesCache.bin";
+
+    std::string ReadFile (const char *path) {
+        std::ifstream file (path, std::ios::binary);
+        return std::string (
+            std::istreambuf_iterator<char> (file),
+            std::istreambuf_iterator<char> ());
+    }
+
+    void WriteFile (
+            const char *path,
+            const std::string &data) {
+        std::ofstream file (path, std::ios::binary | std::ios::trunc);
+        file.write (data.data (), data.size ());
+    }
+
+    void AppendUI32 (
+            std::string &data,
+            util::ui32 value) {
+        data += (char)(value >> 24);
+        data += (char)(value >> 16);
+        data += (char)(value >> 8);
+        data += (char)value;
+    }
+
+    util::ui32 GetUI32 (const std::string &data, std::size_t offset) {
+        return
+            ((util::ui32)(util::ui8)data[offset] << 24) |
+            ((util::ui32)(util::ui8)data[offset + 1] << 16) |
+            ((util::ui32)(util::ui8)data[offset + 2] << 8) |
+            (util::ui32)(util::ui8)data[offset + 3];
+    }
+
+    // Magic, version, fingerprint length and fingerprint of a cache
+    // written by Load.
+    std::string GetCacheHeader (const std::string &cache) {
+        return cache.size () < 12 ?
+            std::string () :
+            cache.substr (0, 12 + GetUI32 (cache, 8));
+    }
+
+    std::string MakeCache (
+            const std::string &header,
+            const std::vector<std::string> &certificates) {
+        std::string cache = header;
+        AppendUI32 (cache, (util::ui32)certificates.size ());
+        for (std::size_t i = 0, count = certificates.size (); i < count; ++i) {
+            AppendUI32 (cache, (util::ui32)certificates[i].size ());
+            cache += certificates[i];
+        }
+        return cache;
+    }
+
+    // DER of a throw away self signed certificate valid
+    // from now + notBeforeDays to now + notAfterDays.
+    std::string CreateCertificate (
+            long notBeforeDays,
+            long notAfterDays) {
+        crypto::EVP_PKEY_CTXPtr ctx (EVP_PKEY_CTX_new_id (EVP_PKEY_RSA, 0));
+        EVP_PKEY *key = 0;
+        if (ctx.get () == 0 ||
+                EVP_PKEY_keygen_init (ctx.get ()) != 1 ||
+                EVP_PKEY_CTX_set_rsa_keygen_bits (ctx.get (), 2048) != 1 ||
+                EVP_PKEY_keygen (ctx.get (), &key) != 1) {
+            THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
+        }
+        crypto::EVP_PKEYPtr keyPtr (key);
+        crypto::X509Ptr certificate (X509_new ());
+        if (certificate.get () == 0) {
+            THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
+        }
+        X509_set_version (certificate.get (), 2);
+        ASN1_INTEGER_set (X509_get_serialNumber (certificate.get ()), 1);
+        X509_gmtime_adj (X509_get_notBefore (certificate.get ()), notBeforeDays * 86400);
+        X509_gmtime_adj (X509_get_notAfter (certificate.get ()), notAfterDays * 86400);
+        X509_NAME *name = X509_get_subject_name (certificate.get ());
+        X509_NAME_add_entry_by_txt (name, "CN", MBSTRING_ASC,
+            (const unsigned char *)"thekogans test CA", -1, -1, 0);
+        if (X509_set_issuer_name (certificate.get (), name) != 1 ||
+                X509_set_pubkey (certificate.get (), key) != 1 ||
+                X509_sign (certificate.get (), key, EVP_sha256 ()) <= 0) {
+            THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
+        }
+        util::i32 length = i2d_X509 (certificate.get (), 0);
+        if (length <= 0) {
+            THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
+        }
+        std::string der ((std::size_t)length, '\0');
+        util::ui8 *ptr = (util::ui8 *)&der[0];
+        i2d_X509 (certificate.get (), &ptr);
+        return der;
+    }
+
+    // Number of certificates in the given context's store.
+    std::size_t GetStoreCount (SSL_CTX *ctx) {
+    #if OPENSSL_VERSION_NUMBER < 0x10100000L
+        return (std::size_t)sk_X509_OBJECT_num (SSL_CTX_get_cert_store (ctx)->objs);
+    #else // OPENSSL_VERSION_NUMBER < 0x10100000L
+        return (std::size_t)sk_X509_OBJECT_num (
+            X509_STORE_get0_objects (SSL_CTX_get_cert_store (ctx)));
+    #endif // OPENSSL_VERSION_NUMBER < 0x10100000L
+    }
+
+    SSL_CTX *CreateContext () {
+        SSL_CTX *ctx = SSL_CTX_new (SSLv23_method ());
+        if (ctx == 0) {
+            THEKOGANS_CRYPTO_THROW_OPENSSL_EXCEPTION;
+        }
+        return ctx;
+    }
+
+    // Number of certificates in the shared store.
+    std::size_t GetStoreCount () {
+        SSL_CTX *ctx = CreateContext ();
+        crypto::SystemCACertificates::Instance ().Use (ctx);
+        std::size_t count = GetStoreCount (ctx);
+        SSL_CTX_free (ctx);
+        return count;
+    }
+}
+
+TEST (thekogans, SystemCACertificatesCacheExpired) {
+    crypto::OpenSSLInit openSSLInit;
+    bool result = false;
+    THEKOGANS_UTIL_TRY {
+        std::cout << "SystemCACertificatesCacheExpired...";
+        std::remove (CACHE_PATH);
+        crypto::SystemCACertificates::Instance ().Load (true, CACHE_PATH, false);
+        std::string header = GetCacheHeader (ReadFile (CACHE_PATH));
+        std::vector<std::string> certificates;
+        certificates.push_back (CreateCertificate (-1, 1));
+        certificates.push_back (CreateCertificate (-2, -1));
+        certificates.push_back (CreateCertificate (1, 2));
+        WriteFile (CACHE_PATH, MakeCache (header, certificates));
+    #if !defined (TOOLCHAIN_OS_Windows)
+        chmod (CACHE_PATH, S_IRUSR | S_IWUSR);
+    #endif // !defined (TOOLCHAIN_OS_Windows)
+        // Only the currently valid certificate survives the load.
+        crypto::SystemCACertificates::Instance ().Load (true, CACHE_PATH, false);
+        result = !header.empty () && GetStoreCount () == 1;
+        crypto::SystemCACertificates::Instance ().Flush ();
+        std::remove (CACHE_PATH);
+        std::cout << (result ? "pass" : "fail") << std::endl;
+    }
+    THEKOGANS_UTIL_CATCH (util::Exception) {
+        std::cout << "fail " << exception.Report ();
+        result = false;
+    }
+    CHECK_EQUAL (result, true);
+}
+
+TEST (thekogans, SystemCACertificatesSharedStore) {
+    crypto::OpenSSLInit openSSLInit;
+    bool result = false;
+    SSL_CTX *ctx1 = 0;
+    SSL_CTX *ctx2 = 0;
+    SSL_CTX *ctx3 = 0;
+    THEKOGANS_UTIL_TRY {
+        std::cout << "SystemCACertificatesSharedStore...";
+        std::remove (CACHE_PATH);
+        crypto::SystemCACertificates::Instance ().Load (true, CACHE_PATH, false);
+        std::string header = GetCacheHeader (ReadFile (CACHE_PATH));
+        std::vector<std::string> certificates;
+        certificates.push_back (CreateCertificate (-1, 1));
+        certificates.push_back (CreateCertificate (-1, 2));
+        WriteFile (CACHE_PATH, MakeCache (header, certificates));
+    #if !defined (TOOLCHAIN_OS_Windows)
+        chmod (CACHE_PATH, S_IRUSR | S_IWUSR);
+    #endif // !defined (TOOLCHAIN_OS_Windows)
+        crypto::SystemCACertificates::Instance ().Load (true, CACHE_PATH, false);
+        ctx1 = CreateContext ();
+        ctx2 = CreateContext ();
+        crypto::SystemCACertificates::Instance ().Use (ctx1);
+        crypto::SystemCACertificates::Instance ().Use (ctx2);
+        // Both contexts share the one store Load built.
+        X509_STORE *store = SSL_CTX_get_cert_store (ctx1);
+        result = !header.empty () &&
+            SSL_CTX_get_cert_store (ctx2) == store &&
+            GetStoreCount (ctx1) == 2;
+        // The stores differ from the planted cache, so Refresh replaces
+        // the shared store. Contexts using the old one keep it, intact.
+        result = result &&
+            crypto::SystemCACertificates::Instance ().Refresh () &&
+            SSL_CTX_get_cert_store (ctx1) == store &&
+            GetStoreCount (ctx1) == 2;
+        std::size_t refreshedCount = 0;
+        if (result) {
+            ctx3 = CreateContext ();
+            crypto::SystemCACertificates::Instance ().Use (ctx3);
+            result = SSL_CTX_get_cert_store (ctx3) != store;
+            refreshedCount = GetStoreCount (ctx3);
+        }
+        // Flush drops our reference only.
+        crypto::SystemCACertificates::Instance ().Flush ();
+        SSL_CTX_free (ctx2);
+        ctx2 = 0;
+        result = result &&
+            SSL_CTX_get_cert_store (ctx1) == store &&
+            GetStoreCount (ctx1) == 2 &&
+            GetStoreCount (ctx3) == refreshedCount;
+        std::remove (CACHE_PATH);
+        std::cout << (result ? "pass" : "fail") << std::endl;
+    }
+    THEKOGANS_UTIL_CATCH (util::Exception) {
+        std::cout << "fail " << exception.Report ();
+        result = false;
+    }
+    SSL_CTX_free (ctx1);
+    SSL_CTX_free (ctx2);
+    SSL_CTX_free (ctx3);
+    CHECK_EQUAL (result, true);
+}
+
+#if !defined (TOOLCHAIN_OS_Windows)
+TEST (thekogans, SystemCACertificatesCachePermissions) {
+    crypto::OpenSSLInit openSSLInit;
+    bool result = false;
+    THEKOGANS_UTIL_TRY {
+        std::cout << "SystemCACertificatesCachePermissions...";
+        std::remove (CACHE_PATH);
+        crypto::SystemCACertificates::Instance ().Load (true, CACHE_PATH, false);
+        struct stat st;
+        // Load writes the cache owner read/write only.
+        result = stat (CACHE_PATH, &st) == 0 &&
+            (st.st_mode & (S_IRWXG | S_IRWXO)) == 0;
+        std::string header = GetCacheHeader (ReadFile (CACHE_PATH));
+        std::vector<std::string> certificates;
+        certificates.push_back (CreateCertificate (-1, 1));
+        std::string planted = MakeCache (header, certificates);
+        const mode_t modes[] = {
+            S_IRUSR | S_IWUSR | S_IWGRP,
+            S_IRUSR | S_IWUSR | S_IWOTH
+        };
+        for (std::size_t i = 0; result && i < sizeof (modes) / sizeof (modes[0]); ++i) {
+            WriteFile (CACHE_PATH, planted);
+            chmod (CACHE_PATH, modes[i]);
+            // A cache others can write is ignored (and rewritten from the stores).
+            crypto::SystemCACertificates::Instance ().Load (true, CACHE_PATH, false);
+            result = ReadFile (CACHE_PATH) != planted &&
+                stat (CACHE_PATH, &st) == 0 &&
+                (st.st_mode & (S_IRWXG | S_IRWXO)) == 0;
+        }
+        // The same cache, trusted, is used as is.
+        WriteFile (CACHE_PATH, planted);
+        chmod (CACHE_PATH, S_IRUSR | S_IWUSR);
+        crypto::SystemCACertificates::Instance ().Load (true, CACHE_PATH, false);
+        result = result && ReadFile (CACHE_PATH) == planted && GetStoreCount () == 1;
+        crypto::SystemCACertificates::Instance ().Flush ();
+        std::remove (CACHE_PATH);
+        std::cout << (result ? "pass" : "fail") << std::endl;
+    }
+    THEKOGANS_UTIL_CATCH (util::Exception) {
+        std::cout << "fail " << exception.Report ();
+        result = false;
+    }
+    CHECK_EQUAL (result, true);
+}
+#endif // !defined (TOOLCHAIN_OS_Windows)
+#endif // defined (TOOLCHAIN_OS_Windows) || defined (TOOLCHAIN_OS_OSX)
+
 TEST (thekogans, SymmetricKey) {
     crypto::OpenSSLInit openSSLInit;
     CHECK_EQUAL (true, true);